@@ -0,0 +1,283 @@
+#-------------------------------------------------
+#
+# Non-interactive benchmark of the linkmasta transport, with --host of the
+# host-side work around each transfer, and with --cartridges of whole
+# cartridge operations on emulated cartridges. With --capture records the USB
+# session to a file, which --replay plays back without the device. Writes
+# results as JSON so they can be compared across firmware and host changes.
+# With --soak instead runs backup and verify cycles for hours, writing CSV.
+#
+#-------------------------------------------------
+
+TARGET = flashmasta-benchmark
+TEMPLATE = app
+
+CONFIG +=\
+    c++11 \
+    console
+
+CONFIG -=\
+    app_bundle \
+    qt
+
+SOURCES +=\
+    src/test/benchmark_main.cpp \
+    src/test/linkmasta_benchmark.cpp \
+    src/test/host_benchmark.cpp \
+    src/test/cartridge_benchmark.cpp \
+    src/test/soak_benchmark.cpp \
+    src/cartridge/ngp_cartridge.cpp \
+    src/cartridge/cartridge.cpp \
+    src/cartridge/cartridge_descriptor.cpp \
+    src/cartridge/cartridge_layout.cpp \
+    src/cartridge/ngp_chip.cpp \
+    src/linkmasta/ngp_linkmasta_device.cpp \
+    src/linkmasta/ngp_linkmasta_messages.cpp \
+    src/task/forwarding_task_controller.cpp \
+    src/task/task_controller.cpp \
+    src/task/task_pool.cpp \
+    src/usb/exception/busy_exception.cpp \
+    src/usb/exception/disconnected_exception.cpp \
+    src/usb/exception/exception.cpp \
+    src/usb/exception/interrupted_exception.cpp \
+    src/usb/exception/not_found_exception.cpp \
+    src/usb/exception/timeout_exception.cpp \
+    src/usb/exception/unconfigured_exception.cpp \
+    src/usb/exception/uninitialized_exception.cpp \
+    src/usb/exception/unopen_exception.cpp \
+    src/usb/libusb_usb_device.cpp \
+    src/usb/usbfs_usb_device.cpp \
+    src/usb/libusb_event_reactor.cpp \
+    src/usb/usb_device.cpp \
+    src/usb/usb_result.cpp \
+    src/usb/usb_capture.cpp \
+    src/usb/replay_usb_device.cpp \
+    src/linkmasta/ws_linkmasta_device.cpp \
+    src/linkmasta/ws_linkmasta_messages.cpp \
+    src/cartridge/ws_cartridge.cpp \
+    src/cartridge/ws_rom_chip.cpp \
+    src/cartridge/ws_sram_chip.cpp \
+    src/linkmasta/linkmasta_device.cpp \
+    src/linkmasta/batch_tuner.cpp \
+    src/linkmasta/device_manager.cpp \
+    src/linkmasta/libusb_device_manager.cpp \
+    src/game/game_descriptor.cpp \
+    src/sqlite/sqlite3.c \
+    src/game/ws_game_catalog.cpp \
+    src/game/ngp_game_catalog.cpp \
+    src/game/catalog_connection_pool.cpp \
+    src/common/log.cpp \
+    src/cartridge/erase_poller.cpp \
+    src/linkmasta/device_job_graph.cpp \
+    src/linkmasta/device_job_coordinator.cpp \
+    src/linkmasta/device_job_scheduler.cpp \
+    src/linkmasta/auto_save_backup.cpp \
+    src/linkmasta/device_multiplexer.cpp \
+    src/cartridge/write_pipeline.cpp \
+    src/cartridge/compare_pipeline.cpp \
+    src/cartridge/block_mismatch_map.cpp \
+    src/cartridge/dump_diff.cpp \
+    src/common/archive_stream.cpp \
+    src/common/buffer_pool.cpp \
+    src/common/dump_archive.cpp \
+    src/common/dump_store.cpp \
+    src/common/file_util.cpp \
+    src/common/hash_stream.cpp \
+    src/common/http_download.cpp \
+    src/common/io_thread.cpp \
+    src/common/latency_histogram.cpp \
+    src/common/output_sink.cpp \
+    src/common/save_history.cpp \
+    src/common/mapped_file.cpp \
+    src/common/memory_budget.cpp \
+    src/common/metrics.cpp \
+    src/common/metrics_server.cpp \
+    src/common/tcp_socket.cpp \
+    src/cartridge/rom_image.cpp \
+    src/cartridge/rom_patch.cpp \
+    src/cartridge/slot_table.cpp \
+    src/cartridge/restore_plan.cpp \
+    src/cartridge/image_pipe.cpp \
+    src/cartridge/operation_planner.cpp \
+    src/cartridge/erase_history.cpp \
+    src/cartridge/cartridge_memory_view.cpp \
+    src/cartridge/image_cache.cpp \
+    src/cartridge/digest_manifest.cpp \
+    src/common/block_compare.cpp \
+    src/cartridge/job_journal.cpp \
+    src/task/throttled_task_controller.cpp \
+    src/linkmasta/emulated_usb_device.cpp \
+    src/linkmasta/device_server_protocol.cpp \
+    src/linkmasta/device_server.cpp \
+    src/linkmasta/job_server_protocol.cpp \
+    src/linkmasta/job_server.cpp \
+    src/linkmasta/store_sync_protocol.cpp \
+    src/linkmasta/store_sync_server.cpp \
+    src/linkmasta/store_sync_client.cpp \
+    src/linkmasta/job_client.cpp \
+    src/linkmasta/remote_usb_device.cpp \
+    src/linkmasta/remote_device_manager.cpp \
+    src/common/trace.cpp \
+    src/game/game_catalog.cpp \
+    src/game/game_hash.cpp \
+    src/game/game_search_index.cpp \
+    src/game/rom_library.cpp \
+    src/game/game_fingerprint.cpp \
+    src/game/binary_game_catalog.cpp \
+    src/game/game_identification_cache.cpp
+
+HEADERS  +=\
+    src/test/linkmasta_benchmark.h \
+    src/test/host_benchmark.h \
+    src/test/cartridge_benchmark.h \
+    src/test/soak_benchmark.h \
+    src/cartridge/cartridge.h \
+    src/cartridge/ngp_cartridge.h \
+    src/common/types.h \
+    src/cartridge/cartridge_descriptor.h \
+    src/cartridge/cartridge_layout.h \
+    src/cartridge/ngp_chip.h \
+    src/linkmasta/linkmasta_device.h \
+    src/linkmasta/batch_tuner.h \
+    src/linkmasta/ngp_linkmasta_device.h \
+    src/linkmasta/ngp_linkmasta_messages.h \
+    src/task/forwarding_task_controller.h \
+    src/task/task_controller.h \
+    src/task/task_pool.h \
+    src/usb/exception/busy_exception.h \
+    src/usb/exception/disconnected_exception.h \
+    src/usb/exception/exception.h \
+    src/usb/exception/interrupted_exception.h \
+    src/usb/exception/not_found_exception.h \
+    src/usb/exception/timeout_exception.h \
+    src/usb/exception/unconfigured_exception.h \
+    src/usb/exception/uninitialized_exception.h \
+    src/usb/exception/unopen_exception.h \
+    src/usb/libusb_usb_device.h \
+    src/usb/usbfs_usb_device.h \
+    src/usb/libusb_event_reactor.h \
+    src/usb/usb.h \
+    src/usb/usb_device.h \
+    src/usb/usb_result.h \
+    src/usb/usb_capture.h \
+    src/usb/replay_usb_device.h \
+    src/usb/usbfwd.h \
+    src/linkmasta/ws_linkmasta_device.h \
+    src/linkmasta/ws_linkmasta_messages.h \
+    src/cartridge/ws_cartridge.h \
+    src/cartridge/ws_rom_chip.h \
+    src/cartridge/ws_sram_chip.h \
+    src/linkmasta/device_manager.h \
+    src/linkmasta/libusb_device_manager.h \
+    src/game/game_catalog.h \
+    src/game/game_descriptor.h \
+    src/sqlite/sqlite3.h \
+    src/sqlite/sqlite3ext.h \
+    src/game/ws_game_catalog.h \
+    src/game/ngp_game_catalog.h \
+    src/game/catalog_connection_pool.h \
+    src/common/log.h \
+    src/cartridge/erase_poller.h \
+    src/linkmasta/device_job_graph.h \
+    src/linkmasta/device_job_coordinator.h \
+    src/linkmasta/device_job_scheduler.h \
+    src/linkmasta/auto_save_backup.h \
+    src/linkmasta/device_multiplexer.h \
+    src/cartridge/write_pipeline.h \
+    src/cartridge/compare_pipeline.h \
+    src/cartridge/block_mismatch_map.h \
+    src/cartridge/dump_diff.h \
+    src/common/archive_stream.h \
+    src/common/buffer_pool.h \
+    src/common/dump_archive.h \
+    src/common/dump_store.h \
+    src/common/file_util.h \
+    src/common/hash_stream.h \
+    src/common/http_download.h \
+    src/common/io_thread.h \
+    src/common/latency_histogram.h \
+    src/common/output_sink.h \
+    src/common/save_history.h \
+    src/common/mapped_file.h \
+    src/common/memory_budget.h \
+    src/common/metrics.h \
+    src/common/metrics_server.h \
+    src/common/tcp_socket.h \
+    src/cartridge/rom_image.h \
+    src/cartridge/rom_patch.h \
+    src/cartridge/slot_table.h \
+    src/cartridge/restore_plan.h \
+    src/cartridge/image_pipe.h \
+    src/cartridge/operation_planner.h \
+    src/cartridge/erase_history.h \
+    src/cartridge/cartridge_memory_view.h \
+    src/cartridge/image_cache.h \
+    src/cartridge/digest_manifest.h \
+    src/common/block_compare.h \
+    src/cartridge/job_journal.h \
+    src/cartridge/block_retry.h \
+    src/cartridge/block_walk.h \
+    src/task/throttled_task_controller.h \
+    src/linkmasta/emulated_usb_device.h \
+    src/linkmasta/device_server_protocol.h \
+    src/linkmasta/device_server.h \
+    src/linkmasta/job_server_protocol.h \
+    src/linkmasta/job_server.h \
+    src/linkmasta/store_sync_protocol.h \
+    src/linkmasta/store_sync_server.h \
+    src/linkmasta/store_sync_client.h \
+    src/linkmasta/job_client.h \
+    src/linkmasta/remote_usb_device.h \
+    src/linkmasta/remote_device_manager.h \
+    src/common/trace.h \
+    src/game/game_hash.h \
+    src/game/game_search_index.h \
+    src/game/rom_library.h \
+    src/game/game_fingerprint.h \
+    src/game/binary_catalog_format.h \
+    src/game/binary_game_catalog.h \
+    src/game/game_identification_cache.h
+
+INCLUDEPATH +=\
+    src \
+    src/common
+
+macx {
+    INCLUDEPATH +=\
+        includes/osx
+    
+    QMAKE_MAC_SDK = macosx10.11
+    
+    QMAKE_LFLAGS +=\
+        -L"$$PWD/libs/osx"\
+        -lobjc
+
+    LIBS     +=\
+        -framework IOKit \
+        -framework CoreFoundation \
+        "$$PWD/libs/osx/libusb-1.0.a"
+    
+    QMAKE_MACOSX_DEPLOYMENT_TARGET = 10.10
+    
+    DEFINES  +=\
+        OS_MACOSX
+}
+win32 {
+    INCLUDEPATH +=\
+        includes/win
+
+    CONFIG(64bit) {
+        LIBS += -L"$$PWD/libs/win64" -l"libusb-1.0" -lws2_32
+    }
+    CONFIG(32bit) {
+        LIBS += -L"$$PWD/libs/win32" -l"libusb-1.0" -lws2_32
+    }
+	
+    DEFINES  +=\
+        OS_WINDOWS
+}
+
+linux {
+    LIBS += -ldl
+    LIBS += -lusb-1.0
+}
@@ -0,0 +1,105 @@
+/*! \file
+ *  \brief File containing the implementation of \ref block_mismatch_map.
+ *  
+ *  File containing the implementation of \ref block_mismatch_map.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see block_mismatch_map
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-05
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "block_mismatch_map.h"
+#include <algorithm>
+
+using namespace std;
+
+
+
+block_mismatch_map::block_mismatch_map()
+  : m_num_mismatched(0)
+{
+  // Nothing else to do
+}
+
+
+
+void block_mismatch_map::add_match(unsigned int offset, unsigned int num_bytes)
+{
+  block b;
+  b.offset = offset;
+  b.num_bytes = num_bytes;
+  b.matched = true;
+  b.first_difference = 0;
+  add(b);
+}
+
+void block_mismatch_map::add_mismatch(unsigned int offset, unsigned int num_bytes, unsigned int first_difference)
+{
+  block b;
+  b.offset = offset;
+  b.num_bytes = num_bytes;
+  b.matched = false;
+  b.first_difference = first_difference;
+  add(b);
+  ++m_num_mismatched;
+}
+
+void block_mismatch_map::clear()
+{
+  m_blocks.clear();
+  m_num_mismatched = 0;
+}
+
+const std::vector<block_mismatch_map::block>& block_mismatch_map::blocks() const
+{
+  return m_blocks;
+}
+
+unsigned int block_mismatch_map::num_mismatched() const
+{
+  return m_num_mismatched;
+}
+
+bool block_mismatch_map::all_matched() const
+{
+  return m_num_mismatched == 0;
+}
+
+std::vector<std::pair<unsigned int, unsigned int>> block_mismatch_map::mismatched_ranges() const
+{
+  vector<pair<unsigned int, unsigned int>> ranges;
+  for (const block& b : m_blocks)
+  {
+    if (b.matched)
+    {
+      continue;
+    }
+    
+    if (!ranges.empty() && ranges.back().second == b.offset)
+    {
+      ranges.back().second = b.offset + b.num_bytes;
+    }
+    else
+    {
+      ranges.push_back(make_pair(b.offset, b.offset + b.num_bytes));
+    }
+  }
+  return ranges;
+}
+
+
+
+void block_mismatch_map::add(const block& b)
+{
+  // Blocks are almost always compared in order, so this is usually the end
+  auto position = upper_bound(m_blocks.begin(), m_blocks.end(), b.offset, [](unsigned int offset, const block& other)
+  {
+    return offset < other.offset;
+  });
+  m_blocks.insert(position, b);
+}
@@ -0,0 +1,133 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref block_mismatch_map
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref block_mismatch_map class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-05
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __BLOCK_MISMATCH_MAP_H__
+#define __BLOCK_MISMATCH_MAP_H__
+
+#include <utility>
+#include <vector>
+
+/*! \class block_mismatch_map
+ *  \brief Class recording which blocks of an image a cartridge failed to
+ *         match.
+ *  
+ *  Class filled in by
+ *  \ref cartridge::compare_cartridge_game_data_blocks() with every block of
+ *  the image it compared, whether the cartridge matched it, and where the
+ *  first difference was. Rather than stopping at the first block that
+ *  differs, that comparison goes on to the end of the image, so the map
+ *  tells apart a cartridge with a single bad block from one holding the
+ *  wrong game. The map can then be handed to
+ *  \ref cartridge::repair_cartridge_game_data() to erase and program only the
+ *  blocks that failed.
+ *  
+ *  Blocks are kept in order of their offset from the start of the image.
+ *  
+ *  This class is *not* thread-safe.
+ */
+class block_mismatch_map
+{
+public:
+  
+  /*!
+   *  \brief Struct describing a single block of the image.
+   */
+  struct block
+  {
+    /*! \brief The offset of the block from the start of the image. */
+    unsigned int   offset;
+    
+    /*! \brief The number of bytes in the block. */
+    unsigned int   num_bytes;
+    
+    /*! \brief Whether the cartridge matched the block. */
+    bool           matched;
+    
+    /*! \brief The offset from the start of the image of the first byte that
+     *         differs, or of the block itself if only its digest was
+     *         compared. Only meaningful if the block did not match. */
+    unsigned int   first_difference;
+  };
+  
+  
+  
+  /*!
+   *  \brief Class constructor. Creates an empty map.
+   */
+                          block_mismatch_map();
+  
+  
+  
+  /*!
+   *  \brief Records a block that the cartridge matched.
+   *  
+   *  \param [in] offset The offset of the block from the start of the image.
+   *  \param [in] num_bytes The number of bytes in the block.
+   */
+  void                    add_match(unsigned int offset, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Records a block that the cartridge did not match.
+   *  
+   *  \param [in] offset The offset of the block from the start of the image.
+   *  \param [in] num_bytes The number of bytes in the block.
+   *  \param [in] first_difference The offset from the start of the image of
+   *         the first byte that differs.
+   */
+  void                    add_mismatch(unsigned int offset, unsigned int num_bytes, unsigned int first_difference);
+  
+  /*!
+   *  \brief Forgets every block recorded.
+   */
+  void                    clear();
+  
+  /*!
+   *  \brief Gets every block recorded, in order of offset.
+   */
+  const std::vector<block>& blocks() const;
+  
+  /*!
+   *  \brief Gets the number of blocks the cartridge did not match.
+   */
+  unsigned int            num_mismatched() const;
+  
+  /*!
+   *  \brief Checks whether the cartridge matched every block recorded.
+   */
+  bool                    all_matched() const;
+  
+  /*!
+   *  \brief Gets the ranges of the image covered by blocks the cartridge did
+   *         not match, as accepted by \ref rom_image::set_changed_ranges().
+   *  
+   *  \return The start and end offsets of each range, in order, with
+   *          neighbouring blocks merged into one range.
+   */
+  std::vector<std::pair<unsigned int, unsigned int>> mismatched_ranges() const;
+
+
+
+private:
+  
+  /*!
+   *  \brief Inserts a block in order of its offset.
+   */
+  void                    add(const block& b);
+  
+  /*! \brief Every block recorded, in order of offset. */
+  std::vector<block>      m_blocks;
+  
+  /*! \brief The number of blocks the cartridge did not match. */
+  unsigned int            m_num_mismatched;
+};
+
+#endif /* defined(__BLOCK_MISMATCH_MAP_H__) */
@@ -0,0 +1,74 @@
+/*! \file
+ *  \brief File containing the \ref retry_on_timeout helper function.
+ *  
+ *  File containing the \ref retry_on_timeout helper function, used by
+ *  cartridge implementations to retry individual blocks of a long-running
+ *  operation when the device stops responding for a moment.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __BLOCK_RETRY_H__
+#define __BLOCK_RETRY_H__
+
+#include <exception>
+#include <string>
+
+#include "common/log.h"
+#include "usb/exception/timeout_exception.h"
+
+/*! \brief Number of times a block is retried after a timeout before giving up. */
+#define BLOCK_MAX_RETRIES 3
+
+/*!
+ *  \brief Runs an operation on a single block, retrying it if the device times
+ *         out.
+ *  
+ *  Runs an operation on a single block of a cartridge. If the operation throws
+ *  a \ref usb::timeout_exception, then the recovery function is called to put
+ *  the device back into a known state and the operation is run again, up to
+ *  \ref BLOCK_MAX_RETRIES times. Any other exception, or a timeout on the last
+ *  attempt, is passed on to the caller.
+ *  
+ *  Exceptions thrown by the recovery function are ignored; the next attempt
+ *  will fail on its own if the device is truly gone.
+ *  
+ *  \param [in] offset The offset of the block, used for logging only.
+ *  \param [in] operation The operation to run. Must be safe to run again after
+ *         being interrupted part-way through.
+ *  \param [in] recover The function to call before each retry.
+ */
+template<typename operation_t, typename recovery_t>
+void retry_on_timeout(unsigned int offset, operation_t operation, recovery_t recover)
+{
+  for (unsigned int attempt = 0; ; ++attempt)
+  {
+    try
+    {
+      operation();
+      return;
+    }
+    catch (usb::timeout_exception& ex)
+    {
+      if (attempt >= BLOCK_MAX_RETRIES)
+      {
+        throw;
+      }
+      log(log_level::INFO, ("Timed out on block at offset " + std::to_string(offset) + ": " + ex.what() + ", retrying").c_str());
+    }
+    
+    try
+    {
+      recover();
+    }
+    catch (std::exception& ex2)
+    {
+      (void) ex2;
+      // Well... this is awkward
+    }
+  }
+}
+
+#endif /* defined(__BLOCK_RETRY_H__) */
@@ -0,0 +1,360 @@
+/*! \file
+ *  \brief File containing the block-walk helpers shared by every cartridge.
+ *  
+ *  File containing the \ref block_walk_policy template and the helper
+ *  functions built on it that cartridge implementations use for each step of
+ *  walking a chip block-by-block: reading or programming a block while
+ *  forwarding progress to the caller's controller, and putting the chip and
+ *  device back into a known state when a walk fails part-way through.
+ *  
+ *  The helpers work with any chip class that provides **address_t** and
+ *  **data_t** types along with **read_bytes()** and **program_bytes()**
+ *  functions that take an optional \ref task_controller, i.e. \ref ngp_chip,
+ *  \ref ws_rom_chip, and \ref ws_sram_chip.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __BLOCK_WALK_H__
+#define __BLOCK_WALK_H__
+
+#include <algorithm>
+#include <exception>
+
+#include "digest_manifest.h"
+#include "common/block_compare.h"
+#include "linkmasta/linkmasta_device.h"
+#include "task/task_controller.h"
+#include "task/forwarding_task_controller.h"
+
+class ws_sram_chip;
+
+/*! \brief The granularity, in bytes, at which
+ *         \ref walk_program_erased_block() looks for blank runs to skip. Runs
+ *         any shorter cost less to program than to program around. */
+#define WALK_BLANK_RUN_SIZE 0x200
+
+/*! \brief The granularity, in bytes, at which
+ *         \ref walk_program_changed_block() compares data with the chip's
+ *         current contents, the size of a single write packet. */
+#define WALK_CHANGED_RUN_SIZE 0x40
+
+/*!
+ *  \brief Policy describing how a chip is put back into a known state.
+ *  
+ *  The default policy suits flash chips: it waits for any erase in progress to
+ *  finish, then resets the chip to read mode. Chips that have no such state
+ *  provide a specialization.
+ */
+template<typename chip_t>
+struct block_walk_policy
+{
+  /*!
+   *  \brief Puts a chip back into a known state after an operation failed.
+   *  
+   *  Exceptions are ignored; the device may already be gone.
+   */
+  static void settle(chip_t* chip)
+  {
+    try
+    {
+      // Wait while the chip finishes erasing (if it was erasing)
+      chip->wait_for_erase();
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Well... this is awkward
+    }
+    
+    try
+    {
+      // Attempt to reset the chip
+      chip->reset();
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Well... this is awkward
+    }
+  }
+};
+
+/*!
+ *  \brief Policy for SRAM chips, which never erase and need no reset.
+ */
+template<>
+struct block_walk_policy<ws_sram_chip>
+{
+  /*! \brief Does nothing. \see block_walk_policy::settle(chip_t*) */
+  static void settle(ws_sram_chip* chip)
+  {
+    (void) chip;
+  }
+};
+
+
+
+/*!
+ *  \brief Reads one block from a chip, forwarding progress to a controller.
+ *  
+ *  \param [in] chip The chip to read from.
+ *  \param [in] address The address of the first byte to read.
+ *  \param [out] data The buffer to read into.
+ *  \param [in] num_bytes The number of bytes to read.
+ *  \param [in,out] controller The controller to report progress to as a share
+ *         of **num_bytes** worth of work. **nullptr** is an accepted value.
+ *  
+ *  \return The number of bytes read.
+ */
+template<typename chip_t>
+unsigned int walk_read_block(chip_t* chip, typename chip_t::address_t address, typename chip_t::data_t* data, unsigned int num_bytes, task_controller* controller)
+{
+  if (controller == nullptr)
+  {
+    return chip->read_bytes(address, data, num_bytes);
+  }
+  
+  // Create a forwarding controller to pass progress updates to
+  forwarding_task_controller fwd_controller(controller);
+  fwd_controller.scale_work_to(num_bytes);
+  return chip->read_bytes(address, data, num_bytes, &fwd_controller);
+}
+
+/*!
+ *  \brief Programs one block of a chip, forwarding progress to a controller.
+ *  
+ *  \param [in] chip The chip to program.
+ *  \param [in] address The address of the first byte to program.
+ *  \param [in] data The data to program.
+ *  \param [in] num_bytes The number of bytes to program.
+ *  \param [in,out] controller The controller to report progress to as a share
+ *         of **num_bytes** worth of work. **nullptr** is an accepted value.
+ *  
+ *  \return The number of bytes programmed.
+ */
+template<typename chip_t>
+unsigned int walk_program_block(chip_t* chip, typename chip_t::address_t address, const typename chip_t::data_t* data, unsigned int num_bytes, task_controller* controller)
+{
+  if (controller == nullptr)
+  {
+    return chip->program_bytes(address, data, num_bytes);
+  }
+  
+  // Create a forwarding controller to pass progress updates to
+  forwarding_task_controller fwd_controller(controller);
+  fwd_controller.scale_work_to(num_bytes);
+  return chip->program_bytes(address, data, num_bytes, &fwd_controller);
+}
+
+/*!
+ *  \brief Programs the parts of an erased block that aren't blank,
+ *         forwarding progress to a controller.
+ *  
+ *  Erased flash already reads blank (all 0xFF), so the data is checked on the
+ *  host for runs of blank bytes, at a granularity of
+ *  \ref WALK_BLANK_RUN_SIZE, and only the runs in between are programmed.
+ *  Blank runs count as done straight away. The block must have been erased
+ *  beforehand.
+ *  
+ *  \param [in] chip The chip to program.
+ *  \param [in] address The address of the first byte to program.
+ *  \param [in] data The data to program.
+ *  \param [in] num_bytes The number of bytes to program.
+ *  \param [in,out] controller The controller to report progress to as a share
+ *         of **num_bytes** worth of work. **nullptr** is an accepted value.
+ *  
+ *  \return The number of bytes programmed or skipped, which is less than
+ *          **num_bytes** only if programming was cut short.
+ */
+template<typename chip_t>
+unsigned int walk_program_erased_block(chip_t* chip, typename chip_t::address_t address, const typename chip_t::data_t* data, unsigned int num_bytes, task_controller* controller)
+{
+  unsigned int offset = 0;
+  while (offset < num_bytes)
+  {
+    // Skip over a blank run
+    unsigned int run_start = offset;
+    while (offset < num_bytes && is_blank_block(data + offset, std::min<unsigned int>(WALK_BLANK_RUN_SIZE, num_bytes - offset)))
+    {
+      offset += std::min<unsigned int>(WALK_BLANK_RUN_SIZE, num_bytes - offset);
+    }
+    if (offset > run_start && controller != nullptr)
+    {
+      controller->on_task_update(task_status::RUNNING, offset - run_start);
+    }
+    if (offset >= num_bytes)
+    {
+      break;
+    }
+    
+    // Program the run that follows, up to the next blank run
+    run_start = offset;
+    do
+    {
+      offset += std::min<unsigned int>(WALK_BLANK_RUN_SIZE, num_bytes - offset);
+    }
+    while (offset < num_bytes && !is_blank_block(data + offset, std::min<unsigned int>(WALK_BLANK_RUN_SIZE, num_bytes - offset)));
+    
+    unsigned int bytes_programmed = walk_program_block(chip, address + run_start, data + run_start, offset - run_start, controller);
+    if (bytes_programmed < offset - run_start)
+    {
+      return run_start + bytes_programmed;
+    }
+  }
+  return num_bytes;
+}
+
+/*!
+ *  \brief Programs the parts of a block that differ from what the chip
+ *         already holds, forwarding progress to a controller.
+ *  
+ *  For chips that need no erasing, such as SRAM. The data is compared with
+ *  the chip's current contents one \ref WALK_CHANGED_RUN_SIZE packet at a
+ *  time, and only runs of packets that differ are programmed, each run in a
+ *  single batch. Packets that already match count as done straight away.
+ *  
+ *  \param [in] chip The chip to program.
+ *  \param [in] address The address of the first byte to program.
+ *  \param [in] data The data to program.
+ *  \param [in] current The chip's current contents at the same addresses,
+ *         e.g. as read back just before.
+ *  \param [in] num_bytes The number of bytes to program.
+ *  \param [in,out] controller The controller to report progress to as a share
+ *         of **num_bytes** worth of work. **nullptr** is an accepted value.
+ *  
+ *  \return The number of bytes programmed or skipped, which is less than
+ *          **num_bytes** only if programming was cut short.
+ */
+template<typename chip_t>
+unsigned int walk_program_changed_block(chip_t* chip, typename chip_t::address_t address, const typename chip_t::data_t* data, const typename chip_t::data_t* current, unsigned int num_bytes, task_controller* controller)
+{
+  auto packet_matches = [&](unsigned int offset)
+  {
+    unsigned int length = std::min<unsigned int>(WALK_CHANGED_RUN_SIZE, num_bytes - offset);
+    return find_first_difference(data + offset, current + offset, length) == length;
+  };
+  
+  unsigned int offset = 0;
+  while (offset < num_bytes)
+  {
+    // Skip over packets that already match
+    unsigned int run_start = offset;
+    while (offset < num_bytes && packet_matches(offset))
+    {
+      offset += std::min<unsigned int>(WALK_CHANGED_RUN_SIZE, num_bytes - offset);
+    }
+    if (offset > run_start && controller != nullptr)
+    {
+      controller->on_task_update(task_status::RUNNING, offset - run_start);
+    }
+    if (offset >= num_bytes)
+    {
+      break;
+    }
+    
+    // Program the run of packets that differ
+    run_start = offset;
+    do
+    {
+      offset += std::min<unsigned int>(WALK_CHANGED_RUN_SIZE, num_bytes - offset);
+    }
+    while (offset < num_bytes && !packet_matches(offset));
+    
+    unsigned int bytes_programmed = walk_program_block(chip, address + run_start, data + run_start, offset - run_start, controller);
+    if (bytes_programmed < offset - run_start)
+    {
+      return run_start + bytes_programmed;
+    }
+  }
+  return num_bytes;
+}
+
+/*!
+ *  \brief Verifies one block of a chip against expected data using a checksum
+ *         computed by the device, without reading the block back.
+ *  
+ *  Only usable when the chip's device supports
+ *  \ref linkmasta_device::checksum_range().
+ *  
+ *  \param [in] chip The chip to verify.
+ *  \param [in] address The address of the first byte to verify.
+ *  \param [in] expected The data the block is expected to hold.
+ *  \param [in] num_bytes The number of bytes to verify.
+ *  \param [in,out] controller The controller to report **num_bytes** worth of
+ *         progress to if the block matches. **nullptr** is an accepted value.
+ *  
+ *  \return true if the checksums match, false otherwise.
+ */
+template<typename chip_t>
+bool walk_checksum_block(chip_t* chip, typename chip_t::address_t address, const unsigned char* expected, unsigned int num_bytes, task_controller* controller)
+{
+  if (chip->checksum_bytes(address, num_bytes) != digest_manifest::crc32c(expected, num_bytes))
+  {
+    return false;
+  }
+  
+  if (controller != nullptr)
+  {
+    controller->on_task_update(task_status::RUNNING, num_bytes);
+  }
+  return true;
+}
+
+/*!
+ *  \brief Tells a controller which phase of a task is running, if there is a
+ *         controller.
+ *  
+ *  \param [in,out] controller The controller of the task. **nullptr** is an
+ *         accepted value.
+ *  \param [in] phase The phase now running.
+ */
+inline void walk_phase(task_controller* controller, task_phase phase)
+{
+  if (controller != nullptr)
+  {
+    controller->on_task_phase(phase);
+  }
+}
+
+/*!
+ *  \brief Cleans up after a block walk that failed part-way through.
+ *  
+ *  Settles the chip according to its \ref block_walk_policy, closes the
+ *  connection to the device, and tells the controller that the task ended in
+ *  error. Exceptions are ignored so that the caller can rethrow the original
+ *  one.
+ *  
+ *  \param [in] chip The chip the walk was on. **nullptr** skips settling.
+ *  \param [in] linkmasta The device the chip is connected through.
+ *  \param [in,out] controller The controller of the task. **nullptr** is an
+ *         accepted value.
+ */
+template<typename chip_t>
+void abandon_block_walk(chip_t* chip, linkmasta_device* linkmasta, task_controller* controller)
+{
+  if (chip != nullptr)
+  {
+    block_walk_policy<chip_t>::settle(chip);
+  }
+  
+  try
+  {
+    linkmasta->close();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // Well... this is awkward
+  }
+  
+  // Inform controller of task end
+  if (controller != nullptr)
+  {
+    controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+  }
+}
+
+#endif /* defined(__BLOCK_WALK_H__) */
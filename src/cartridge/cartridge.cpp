@@ -0,0 +1,604 @@
+/*! \file
+ *  \brief File containing the implementation of \ref cartridge.
+ *  
+ *  File containing the implementation of the functions of \ref cartridge that
+ *  have a default implementation.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see cartridge
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "cartridge.h"
+#include "block_mismatch_map.h"
+#include "digest_manifest.h"
+#include "image_pipe.h"
+#include "rom_image.h"
+#include "rom_patch.h"
+#include "common/log.h"
+#include "task/forwarding_task_controller.h"
+#include "task/task_controller.h"
+#include "task/task_pool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// The size of each window sampled by a spot check, a few read packets long
+#define SPOT_CHECK_WINDOW_SIZE    0x100
+
+// The smallest share of windows a fault must corrupt to be caught with the
+// requested confidence
+#define SPOT_CHECK_FAULT_FRACTION 0.01
+
+// The share of a reflash's progress given to each of backing up and restoring
+// the save, as a fraction of the game's size
+#define REFLASH_SAVE_SHARE        16
+
+unsigned int cartridge::fingerprint_cartridge_save_data(int slot, task_controller* controller)
+{
+  std::stringstream save_data;
+  backup_cartridge_save_data(save_data, slot, controller);
+  
+  std::string bytes = save_data.str();
+  return digest_manifest::crc32c((const unsigned char*) bytes.data(), (unsigned int) bytes.size());
+}
+
+std::future<void> cartridge::backup_cartridge_game_data_async(std::ostream& fout, int slot, task_controller* controller, task_pool* pool)
+{
+  task_pool& runner = (pool != nullptr ? *pool : task_pool::shared());
+  return runner.submit([this, &fout, slot, controller]()
+  {
+    backup_cartridge_game_data(fout, slot, controller);
+  });
+}
+
+std::future<void> cartridge::restore_cartridge_game_data_async(std::istream& fin, int slot, task_controller* controller, task_pool* pool)
+{
+  task_pool& runner = (pool != nullptr ? *pool : task_pool::shared());
+  return runner.submit([this, &fin, slot, controller]()
+  {
+    restore_cartridge_game_data(fin, slot, controller);
+  });
+}
+
+std::future<bool> cartridge::compare_cartridge_game_data_async(std::istream& fin, int slot, task_controller* controller, task_pool* pool)
+{
+  task_pool& runner = (pool != nullptr ? *pool : task_pool::shared());
+  return runner.submit([this, &fin, slot, controller]()
+  {
+    return compare_cartridge_game_data(fin, slot, controller);
+  });
+}
+
+bool cartridge::patch_cartridge_game_data(std::istream& patch, int slot, task_controller* controller)
+{
+  return patch_game_data(patch, nullptr, 0, slot, controller);
+}
+
+bool cartridge::patch_cartridge_game_data(std::istream& patch, const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+{
+  return patch_game_data(patch, image, num_bytes, slot, controller);
+}
+
+bool cartridge::patch_game_data(std::istream& patch, const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+{
+  if (slot != SLOT_ALL && (slot < 0 || slot >= (int) num_slots()))
+  {
+    throw std::invalid_argument("invalid slot number: " + std::to_string(slot));
+  }
+  
+  rom_patch parsed(patch);
+  
+  // Find the cartridge addresses the slot covers
+  unsigned int target_start = 0;
+  unsigned int target_size = descriptor()->num_bytes;
+  if (slot != SLOT_ALL)
+  {
+    for (int i = 0; i < slot; ++i)
+    {
+      target_start += slot_size(i);
+    }
+    target_size = slot_size(slot);
+  }
+  auto image_offset = [&](unsigned int size) -> unsigned int
+  {
+    return (slot == SLOT_ALL ? 0 : slot_image_offset(slot, size));
+  };
+  
+  // Reads the cartridge's current contents, addressed from the start of the
+  // slot, across as many slots as the range covers
+  auto read_back = [&](unsigned int offset, unsigned char* buffer, unsigned int length)
+  {
+    unsigned int address = target_start + offset;
+    while (length > 0)
+    {
+      unsigned int read_slot = 0;
+      unsigned int slot_start = 0;
+      while (address >= slot_start + slot_size(read_slot))
+      {
+        slot_start += slot_size(read_slot);
+        ++read_slot;
+      }
+      unsigned int chunk = std::min(length, slot_start + slot_size(read_slot) - address);
+      
+      if (read_cartridge_game_data((int) read_slot, address - slot_start, buffer, chunk) != chunk)
+      {
+        throw std::runtime_error("Unable to read game data");
+      }
+      address += chunk;
+      buffer += chunk;
+      length -= chunk;
+    }
+  };
+  
+  // Gather the original image, reading back only as much of it as the patch
+  // needs if it wasn't given
+  std::vector<unsigned char> read_data;
+  const unsigned char* source = image;
+  unsigned int source_size = num_bytes;
+  if (source == nullptr)
+  {
+    source_size = (parsed.source_size() != 0 ? parsed.source_size() : target_size);
+    if (source_size > target_size)
+    {
+      throw std::runtime_error("Patch was made for an image larger than the destination");
+    }
+    unsigned int source_offset = image_offset(source_size);
+    read_data.resize(source_size);
+    
+    if (parsed.needs_source())
+    {
+      read_back(source_offset, read_data.data(), source_size);
+    }
+    else
+    {
+      // Read every block a written range touches in its entirety, so that
+      // the rest of the block is programmed back as it was
+      const cartridge_layout* cart_layout = layout();
+      const unsigned int image_start = target_start + source_offset;
+      std::vector<bool> block_read(cart_layout->num_blocks(), false);
+      for (const std::pair<unsigned int, unsigned int>& range : parsed.written_ranges())
+      {
+        unsigned int range_end = std::min(range.second, source_size);
+        for (unsigned int b = 0; b < cart_layout->num_blocks() && range.first < range_end; ++b)
+        {
+          const cartridge_layout::block_entry& block = cart_layout->blocks()[b];
+          if (block_read[b]
+              || block.cartridge_address + block.num_bytes <= image_start + range.first
+              || block.cartridge_address >= image_start + range_end)
+          {
+            continue;
+          }
+          
+          unsigned int lower = std::max(block.cartridge_address, image_start) - image_start;
+          unsigned int upper = std::min(block.cartridge_address + block.num_bytes, image_start + source_size) - image_start;
+          read_back(source_offset + lower, &read_data[lower], upper - lower);
+          block_read[b] = true;
+        }
+      }
+    }
+    source = read_data.data();
+  }
+  
+  unsigned int patched_size = parsed.target_size(source_size);
+  if (patched_size > target_size)
+  {
+    throw std::runtime_error("Patched image too large for destination");
+  }
+  std::vector<unsigned char> patched(patched_size);
+  parsed.apply(source, source_size, patched.data());
+  
+  // Compare the patched image with the original where both cover the same
+  // part of the slot; anything the original doesn't cover has changed
+  long long shift = (long long) image_offset(patched_size) - (long long) image_offset(source_size);
+  std::vector<std::pair<unsigned int, unsigned int>> changed;
+  for (unsigned int i = 0; i < patched_size; ++i)
+  {
+    long long j = (long long) i + shift;
+    if (j >= 0 && j < (long long) source_size && patched[i] == source[j])
+    {
+      continue;
+    }
+    
+    if (!changed.empty() && changed.back().second == i)
+    {
+      ++changed.back().second;
+    }
+    else
+    {
+      changed.push_back(std::make_pair(i, i + 1));
+    }
+  }
+  
+  if (changed.empty())
+  {
+    log(log_level::INFO, "Patch leaves the game data unchanged");
+  }
+  
+  // Program and verify just the blocks that changed
+  rom_image patched_image(patched.data(), patched_size);
+  patched_image.set_changed_ranges(changed);
+  return restore_game_data(patched_image, slot, controller, true);
+}
+
+bool cartridge::compare_cartridge_game_data_blocks(const unsigned char* image, unsigned int num_bytes, block_mismatch_map& mismatches, int slot, task_controller* controller)
+{
+  mismatches.clear();
+  rom_image source(image, num_bytes);
+  return compare_game_data(source, slot, controller, &mismatches);
+}
+
+bool cartridge::compare_cartridge_game_data_blocks(const digest_manifest& manifest, block_mismatch_map& mismatches, int slot, task_controller* controller)
+{
+  mismatches.clear();
+  rom_image source(manifest);
+  return compare_game_data(source, slot, controller, &mismatches);
+}
+
+bool cartridge::repair_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, const block_mismatch_map& mismatches, int slot, task_controller* controller)
+{
+  if (mismatches.all_matched())
+  {
+    log(log_level::INFO, "Every block already matches, nothing to repair");
+  }
+  
+  // Program and verify just the blocks that failed
+  rom_image source(image, num_bytes);
+  source.set_changed_ranges(mismatches.mismatched_ranges());
+  return restore_game_data(source, slot, controller, true);
+}
+
+void cartridge::reflash_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+{
+  // Saves only span a few blocks, so each save step gets a small share of the
+  // progress next to the game itself
+  const unsigned int save_work = std::max(num_bytes / REFLASH_SAVE_SHARE, 1u);
+  
+  if (controller != nullptr)
+  {
+    controller->on_task_start(num_bytes + 2 * save_work);
+  }
+  
+  // Hold the save in memory for the length of the operation
+  std::stringstream save_data;
+  try
+  {
+    if (controller == nullptr)
+    {
+      backup_cartridge_save_data(save_data, slot);
+    }
+    else
+    {
+      forwarding_task_controller fwd_controller(controller);
+      fwd_controller.scale_work_to(save_work);
+      backup_cartridge_save_data(save_data, slot, &fwd_controller);
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    if (controller != nullptr)
+    {
+      controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+    }
+    throw;
+  }
+  
+  if (controller != nullptr && controller->is_task_cancelled())
+  {
+    controller->on_task_end(task_status::CANCELLED, controller->get_task_work_progress());
+    return;
+  }
+  
+  // Write the game, remembering any error until the save is back in place
+  std::exception_ptr error;
+  try
+  {
+    if (controller == nullptr)
+    {
+      restore_cartridge_game_data(image, num_bytes, slot);
+    }
+    else
+    {
+      forwarding_task_controller fwd_controller(controller);
+      fwd_controller.scale_work_to(num_bytes);
+      restore_cartridge_game_data(image, num_bytes, slot, &fwd_controller);
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    error = std::current_exception();
+  }
+  
+  // Put the save back. A cancelled or failed write may already have erased
+  // the save's blocks, so the save is restored regardless, without a
+  // controller that would report the cancellation again.
+  bool interrupted = (error || (controller != nullptr && controller->is_task_cancelled()));
+  try
+  {
+    save_data.seekg(0, save_data.beg);
+    if (controller == nullptr || interrupted)
+    {
+      restore_cartridge_save_data(save_data, slot);
+    }
+    else
+    {
+      forwarding_task_controller fwd_controller(controller);
+      fwd_controller.scale_work_to(save_work);
+      restore_cartridge_save_data(save_data, slot, &fwd_controller);
+    }
+  }
+  catch (std::exception& ex)
+  {
+    log(log_level::INFO, (std::string("Unable to restore save data after writing game: ") + ex.what()).c_str());
+    if (!error)
+    {
+      error = std::current_exception();
+    }
+  }
+  
+  if (controller != nullptr)
+  {
+    controller->on_task_end(error ? task_status::ERROR : (interrupted ? task_status::CANCELLED : task_status::COMPLETED), controller->get_task_work_progress());
+  }
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+}
+
+void cartridge::clone_cartridge_game_data(cartridge& source, int source_slot, int slot, task_controller* controller)
+{
+  if (&source == this)
+  {
+    throw std::invalid_argument("A cartridge cannot be cloned onto itself");
+  }
+  
+  image_pipe pipe(source.game_backup_size(source_slot));
+  task_controller source_controller;
+  
+  // Read the source on a thread of its own rather than the shared pool, since
+  // this thread may itself be one of the pool's and blocks until it's done
+  std::exception_ptr source_error;
+  std::thread reader([&source, source_slot, &pipe, &source_controller, &source_error]()
+  {
+    try
+    {
+      source.backup_cartridge_game_data(pipe.output(), source_slot, &source_controller);
+      pipe.close();
+    }
+    catch (std::exception& ex)
+    {
+      source_error = std::current_exception();
+      pipe.close(ex.what());
+    }
+  });
+  
+  std::exception_ptr error;
+  try
+  {
+    rom_image image(pipe);
+    restore_game_data(image, slot, controller, false);
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    error = std::current_exception();
+  }
+  
+  // A target that stopped early leaves the rest of the source unread
+  if (error || (controller != nullptr && controller->is_task_cancelled()))
+  {
+    pipe.abandon();
+    source_controller.cancel_task();
+  }
+  reader.join();
+  
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+  if (source_error)
+  {
+    std::rethrow_exception(source_error);
+  }
+}
+
+bool cartridge::restore_streamed_cartridge_game_data(image_pipe& pipe, int slot, bool verify, task_controller* controller)
+{
+  rom_image image(pipe);
+  return restore_game_data(image, slot, controller, verify);
+}
+
+bool cartridge::spot_check_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, double confidence, task_controller* controller)
+{
+  if (!(confidence > 0.0 && confidence < 1.0))
+  {
+    throw std::invalid_argument("confidence must be between 0 and 1");
+  }
+  if (slot != SLOT_ALL && (slot < 0 || slot >= (int) num_slots()))
+  {
+    throw std::invalid_argument("invalid slot number: " + std::to_string(slot));
+  }
+  
+  // Find the cartridge addresses the image covers
+  const cartridge_descriptor* desc = descriptor();
+  unsigned int target_start = 0;
+  unsigned int target_size = desc->num_bytes;
+  if (slot != SLOT_ALL)
+  {
+    for (int i = 0; i < slot; ++i)
+    {
+      target_start += slot_size(i);
+    }
+    target_size = slot_size(slot);
+  }
+  unsigned int image_size = std::min(num_bytes, target_size);
+  if (slot != SLOT_ALL)
+  {
+    target_start += slot_image_offset(slot, image_size);
+  }
+  
+  // Collect windows at both ends of the image and across every block
+  // boundary within it
+  unsigned int window_size = std::min<unsigned int>(SPOT_CHECK_WINDOW_SIZE, image_size);
+  std::vector<unsigned int> windows;
+  auto add_window = [&](unsigned int center)
+  {
+    unsigned int start = (center > window_size / 2 ? center - window_size / 2 : 0);
+    windows.push_back(std::min(start, image_size - window_size));
+  };
+  
+  if (image_size > 0)
+  {
+    add_window(0);
+    add_window(image_size);
+    const cartridge_layout* cart_layout = layout();
+    for (unsigned int b = 0; b < cart_layout->num_blocks(); ++b)
+    {
+      unsigned int address = cart_layout->blocks()[b].cartridge_address;
+      if (address > target_start && address < target_start + image_size)
+      {
+        add_window(address - target_start);
+      }
+    }
+    
+    // Then enough random windows that a fault corrupting the given share of
+    // them is missed by all of them with a probability of 1 - confidence
+    unsigned int num_random = (unsigned int) std::ceil(std::log(1.0 - confidence) / std::log(1.0 - SPOT_CHECK_FAULT_FRACTION));
+    std::mt19937 generator((std::random_device())());
+    std::uniform_int_distribution<unsigned int> distribution(0, image_size - window_size);
+    for (unsigned int i = 0; i < num_random; ++i)
+    {
+      windows.push_back(distribution(generator));
+    }
+  }
+  
+  // Merge overlapping windows into ranges so that no byte is read twice
+  std::sort(windows.begin(), windows.end());
+  std::vector<std::pair<unsigned int, unsigned int>> ranges;
+  unsigned int bytes_total = 0;
+  for (unsigned int start : windows)
+  {
+    if (!ranges.empty() && start <= ranges.back().second)
+    {
+      bytes_total += std::max(ranges.back().second, start + window_size) - ranges.back().second;
+      ranges.back().second = std::max(ranges.back().second, start + window_size);
+    }
+    else
+    {
+      ranges.push_back(std::make_pair(start, start + window_size));
+      bytes_total += window_size;
+    }
+  }
+  
+  // Inform controller that task is starting
+  if (controller != nullptr)
+  {
+    controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_VERIFY);
+  }
+  
+  bool matched = true;
+  unsigned int bytes_compared = 0;
+  std::vector<unsigned char> buffer(SPOT_CHECK_WINDOW_SIZE);
+  try
+  {
+    for (unsigned int r = 0; r < ranges.size() && matched && (controller == nullptr || !controller->is_task_cancelled()); ++r)
+    {
+      for (unsigned int offset = ranges[r].first; offset < ranges[r].second && matched; )
+      {
+        // Read up to the end of the range or of the slot holding it, whichever
+        // comes first
+        unsigned int address = target_start + offset;
+        unsigned int read_slot = 0;
+        unsigned int slot_start = 0;
+        while (address >= slot_start + slot_size(read_slot))
+        {
+          slot_start += slot_size(read_slot);
+          ++read_slot;
+        }
+        unsigned int length = std::min(ranges[r].second - offset, slot_start + slot_size(read_slot) - address);
+        length = std::min<unsigned int>(length, SPOT_CHECK_WINDOW_SIZE);
+        
+        if (read_cartridge_game_data((int) read_slot, address - slot_start, buffer.data(), length) != length)
+        {
+          throw std::runtime_error("Unable to read game data");
+        }
+        
+        if (memcmp(buffer.data(), &image[offset], length) != 0)
+        {
+          unsigned int mismatch_offset = offset;
+          while (buffer[mismatch_offset - offset] == image[mismatch_offset])
+          {
+            ++mismatch_offset;
+          }
+          matched = false;
+          log(log_level::INFO, ("Cartridge data differs from file at offset " + std::to_string(mismatch_offset)).c_str());
+        }
+        
+        offset += length;
+        bytes_compared += length;
+        if (controller != nullptr)
+        {
+          controller->on_task_update(task_status::RUNNING, length);
+        }
+      }
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    if (controller != nullptr)
+    {
+      controller->on_task_end(task_status::ERROR, bytes_compared);
+    }
+    throw;
+  }
+  
+  // Inform controller that task is complete
+  if (controller != nullptr)
+  {
+    controller->on_task_end(controller->is_task_cancelled() && bytes_compared < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_compared);
+  }
+  return matched;
+}
+
+unsigned int cartridge::game_data_address(int slot, unsigned int num_bytes) const
+{
+  if (slot == SLOT_ALL)
+  {
+    return 0;
+  }
+  if (slot < 0 || slot >= (int) num_slots())
+  {
+    throw std::invalid_argument("invalid slot number: " + std::to_string(slot));
+  }
+  
+  unsigned int address = 0;
+  for (int i = 0; i < slot; ++i)
+  {
+    address += slot_size(i);
+  }
+  return address + slot_image_offset(slot, std::min(num_bytes, slot_size(slot)));
+}
+
+unsigned int cartridge::slot_image_offset(int slot, unsigned int num_bytes) const
+{
+  (void) slot;
+  (void) num_bytes;
+  return 0;
+}
@@ -15,10 +15,23 @@
 
 #include "common/types.h"
 #include "cartridge_descriptor.h"
+#include "cartridge_layout.h"
+#include <future>
 #include <iosfwd>
 #include <string>
 
 class task_controller;
+class task_pool;
+class digest_manifest;
+class rom_image;
+class image_pipe;
+class job_journal;
+class erase_history;
+class block_mismatch_map;
+struct slot_table;
+
+/*! \brief The default confidence of \ref cartridge::spot_check_cartridge_game_data(). */
+#define SPOT_CHECK_DEFAULT_CONFIDENCE 0.99
 
 
 
@@ -105,6 +118,21 @@ public:
    */
   virtual const cartridge_descriptor* descriptor() const = 0;
   
+  /*! \brief Gets a flat \ref cartridge_layout of the chips and blocks
+   *         described by \ref descriptor().
+   *  
+   *  Gets the \ref cartridge_layout built from the cartridge's descriptor on
+   *  initialization. Loops over every block of the cartridge should prefer it
+   *  over walking the descriptor's chip and block pointers.
+   *  
+   *  If a call to this function is made before a call to \ref init() is made,
+   *  the function will return a **nullptr**.
+   *  
+   *  \see cartridge_layout
+   *  \see descriptor()
+   */
+  virtual const cartridge_layout* layout() const = 0;
+  
   
   
   /*! \brief Initializes the cartridge using default settings.
@@ -118,6 +146,45 @@ public:
    */
   virtual void        init() = 0;
   
+  /*! \brief Sets the journal used to resume interrupted game data operations.
+   *  
+   *  Sets the journal that the next calls to
+   *  \ref backup_cartridge_game_data(std::ostream&, int, task_controller*) and
+   *  the restore functions use to skip blocks completed by an earlier,
+   *  interrupted attempt and to record each block as it completes. Backups
+   *  resume after the last contiguous block in the journal, so the output
+   *  stream must hold the data written by the earlier attempt and must allow
+   *  seeking.
+   *  
+   *  The journal is not owned by the cartridge and must outlive its use. Set
+   *  to **nullptr** to always process every block, which is the default.
+   *  
+   *  \param [in] journal The journal to use, or **nullptr** for none.
+   *  
+   *  \see job_journal
+   */
+  virtual void        set_journal(job_journal* journal) = 0;
+  
+  /*! \brief Sets the history the erase times of the cartridge's flash chips
+   *         are recorded in.
+   *  
+   *  Sets the history that every erase waited on is recorded in, keyed by the
+   *  serial number of the device the cartridge is plugged into and each chip's
+   *  index and IDs. The recorded times also pace the polling of later erases.
+   *  Chips found by \ref init() pick up the history as well, so this may be
+   *  called before or after initializing the cartridge.
+   *  
+   *  The history is not owned by the cartridge and must outlive its use. Set
+   *  to **nullptr** to stop recording, which is the default.
+   *  
+   *  \param [in] history The history to use, or **nullptr** for none.
+   *  \param [in] serial The serial number of the device the cartridge is
+   *         plugged into.
+   *  
+   *  \see erase_history
+   */
+  virtual void        set_erase_history(erase_history* history, const std::string& serial) = 0;
+  
   /*! \brief Writes a cartridge's game data to an output stream.
    *
    *  Extracts the game data from a cartridge and writes its contents to an
@@ -187,6 +254,265 @@ public:
    */
   virtual void        restore_cartridge_game_data(std::istream& fin, int slot = SLOT_ALL, task_controller* controller = nullptr) = 0;
   
+  /*! \brief Overwrites a cartridge's game data with an image in memory.
+   *  
+   *  Same as
+   *  \ref restore_cartridge_game_data(std::istream& fin, int slot, task_controller* controller),
+   *  except that the game data is taken from a block of memory, such as a
+   *  \ref mapped_file. Blocks are programmed straight from the image without
+   *  being copied, and the image is never written to, so the same image can be
+   *  restored to several cartridges at once.
+   *  
+   *  \param [in] image Pointer to the start of the game data.
+   *  \param [in] num_bytes The number of bytes of game data.
+   *  \param [in] slot The game slot on the cartridge to write to in the case of
+   *         multiple games on a single cartridge. Set to \ref SLOT_ALL to
+   *         overwrite the entire cartridge.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \see restore_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
+   *  \see task_controller
+   */
+  virtual void        restore_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot = SLOT_ALL, task_controller* controller = nullptr) = 0;
+  
+  /*! \brief Overwrites a cartridge's game data with data from an input
+   *         stream and verifies it in the same pass.
+   *  
+   *  Same as
+   *  \ref restore_cartridge_game_data(std::istream& fin, int slot, task_controller* controller),
+   *  except that each block is read back from the cartridge right after it is
+   *  programmed and compared to the source block. Blocks that don't match are
+   *  erased and programmed again a limited number of times. This replaces a
+   *  restore followed by a separate
+   *  \ref compare_cartridge_game_data(std::istream& fin, int slot, task_controller* controller),
+   *  without walking the cartridge twice.
+   *  
+   *  \param [in] fin The input stream to read from. Cannot be any of the
+   *         standard input streams, e.g. \ref std::cin.
+   *  \param [in] slot The game slot on the cartridge to write to in the case of
+   *         multiple games on a single cartridge. Set to \ref SLOT_ALL to
+   *         overwrite the entire cartridge.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \returns **true** Every block written matched after programming.
+   *  \returns **false** At least one block still did not match after retrying.
+   *  
+   *  \throws std::invalid_argument Input stream is a standard input stream.
+   *  
+   *  \see restore_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
+   *  \see task_controller
+   */
+  virtual bool        restore_and_verify_cartridge_game_data(std::istream& fin, int slot = SLOT_ALL, task_controller* controller = nullptr) = 0;
+  
+  /*! \brief Overwrites a cartridge's game data with an image in memory and
+   *         verifies it in the same pass.
+   *  
+   *  Same as
+   *  \ref restore_and_verify_cartridge_game_data(std::istream& fin, int slot, task_controller* controller),
+   *  except that the game data is taken from a block of memory, such as a
+   *  \ref mapped_file.
+   *  
+   *  \param [in] image Pointer to the start of the game data.
+   *  \param [in] num_bytes The number of bytes of game data.
+   *  \param [in] slot The game slot on the cartridge to write to in the case of
+   *         multiple games on a single cartridge. Set to \ref SLOT_ALL to
+   *         overwrite the entire cartridge.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \returns **true** Every block written matched after programming.
+   *  \returns **false** At least one block still did not match after retrying.
+   *  
+   *  \see restore_and_verify_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
+   */
+  virtual bool        restore_and_verify_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot = SLOT_ALL, task_controller* controller = nullptr) = 0;
+  
+  /*! \brief Applies an IPS or BPS patch to the cartridge's game data.
+   *  
+   *  Applies a patch straight to the cartridge without a patched image having
+   *  to be written out first. The cartridge's current game data is read back,
+   *  patched in memory, and compared with what was read, and only the blocks
+   *  that differ are erased and programmed and then verified. For an IPS
+   *  patch, only the blocks the patch writes to are read back. A BPS patch
+   *  can copy from anywhere in the original image, so the whole image it was
+   *  made for is read back and checked against the patch's checksum first.
+   *  
+   *  The patch is taken to be of an image of the whole slot, unless it
+   *  records the size of the image it was made for. Such smaller images line
+   *  up with the slot the same way as in
+   *  \ref restore_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller).
+   *  
+   *  This function is a blocking function. A \ref task_controller object may
+   *  be optionally provided to allow for mid-process communication and
+   *  progress updates of the programming. Reading back is not reported.
+   *  
+   *  \param [in,out] patch The input stream to read the patch from.
+   *  \param [in] slot The game slot on the cartridge to patch in the case of
+   *         multiple games on a single cartridge. Set to \ref SLOT_ALL to
+   *         patch the entire cartridge.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \returns **true** Every block written matched after programming.
+   *  \returns **false** At least one block still did not match after retrying.
+   *  
+   *  \throws std::runtime_error The patch is damaged or was not made for the
+   *           cartridge's contents, or the patched image does not fit.
+   *  
+   *  \see rom_patch
+   */
+  virtual bool        patch_cartridge_game_data(std::istream& patch, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*! \brief Applies an IPS or BPS patch to the cartridge's game data, given
+   *         the cartridge's current contents.
+   *  
+   *  Same as
+   *  \ref patch_cartridge_game_data(std::istream& patch, int slot, task_controller* controller),
+   *  except that the cartridge is taken to already hold the given image, e.g.
+   *  the file it was last restored from, so that nothing needs to be read back
+   *  before programming.
+   *  
+   *  \param [in,out] patch The input stream to read the patch from.
+   *  \param [in] image Pointer to the image the cartridge holds.
+   *  \param [in] num_bytes The number of bytes in the image.
+   *  \param [in] slot The game slot on the cartridge to patch in the case of
+   *         multiple games on a single cartridge. Set to \ref SLOT_ALL to
+   *         patch the entire cartridge.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \returns **true** Every block written matched after programming.
+   *  \returns **false** At least one block still did not match after retrying.
+   *  
+   *  \see patch_cartridge_game_data(std::istream& patch, int slot, task_controller* controller)
+   */
+  virtual bool        patch_cartridge_game_data(std::istream& patch, const unsigned char* image, unsigned int num_bytes, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*! \brief Reprograms only the blocks of the cartridge's game data that
+   *         failed to match an image.
+   *  
+   *  Erases, programs, and verifies just the blocks recorded as mismatched
+   *  by
+   *  \ref compare_cartridge_game_data_blocks(const unsigned char* image, unsigned int num_bytes, block_mismatch_map& mismatches, int slot, task_controller* controller),
+   *  leaving every other block as it is. After a verify turns up a few bad
+   *  blocks, this repairs the cartridge in a fraction of the time of flashing
+   *  the whole image again.
+   *  
+   *  This function is a blocking function. A \ref task_controller object may
+   *  be optionally provided to allow for mid-process communication and
+   *  progress updates.
+   *  
+   *  \param [in] image Pointer to the image the map was made against.
+   *  \param [in] num_bytes The number of bytes in the image.
+   *  \param [in] mismatches The blocks to reprogram. If every block matched,
+   *         nothing is written.
+   *  \param [in] slot The game slot the map was made for, or \ref SLOT_ALL.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \returns **true** Every block written matched after programming.
+   *  \returns **false** At least one block still did not match after retrying.
+   *  
+   *  \see block_mismatch_map
+   */
+  bool                repair_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, const block_mismatch_map& mismatches, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*! \brief Overwrites a cartridge's game data with an image in memory while
+   *         keeping its save data.
+   *  
+   *  Upgrades the game on a cartridge without losing its save in a single
+   *  operation: the save data is backed up into memory, the image is written
+   *  with
+   *  \ref restore_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller),
+   *  and the save data is then restored, which only rewrites the blocks that
+   *  hold the save. Nothing is written to disk in between, and the cartridge
+   *  is not probed again.
+   *  
+   *  The save is restored even if writing the game is cancelled or fails part
+   *  of the way through, since the game's blocks may already have been
+   *  erased. The error, if any, is passed on to the caller afterwards.
+   *  
+   *  This function is a blocking function. A \ref task_controller object may
+   *  be optionally provided to allow for mid-process communication and
+   *  progress updates over all three steps.
+   *  
+   *  \param [in] image Pointer to the start of the game data.
+   *  \param [in] num_bytes The number of bytes of game data.
+   *  \param [in] slot The game slot on the cartridge to write to in the case of
+   *         multiple games on a single cartridge. Set to \ref SLOT_ALL to
+   *         overwrite the entire cartridge.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \see restore_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+   *  \see backup_cartridge_save_data(std::ostream& fout, int slot, task_controller* controller)
+   *  \see restore_cartridge_save_data(std::istream& fin, int slot, task_controller* controller)
+   */
+  void                reflash_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*! \brief Copies the game data of another cartridge onto this one.
+   *  
+   *  Copies a game slot of another cartridge, attached through a different
+   *  device, onto this cartridge without going through a file. The source is
+   *  backed up on another thread into an \ref image_pipe in memory while this
+   *  cartridge is erased and programmed from it, so reading the source and
+   *  writing this cartridge overlap.
+   *  
+   *  This function is a blocking function. A \ref task_controller object may
+   *  be optionally provided to allow for mid-process communication and
+   *  progress updates, which follow the writing of this cartridge.
+   *  
+   *  \param [in,out] source The initialized cartridge to copy from.
+   *  \param [in] source_slot The game slot of the source to copy, or
+   *         \ref SLOT_ALL.
+   *  \param [in] slot The game slot of this cartridge to write to, or
+   *         \ref SLOT_ALL.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \throws std::invalid_argument If the source is this cartridge.
+   *  
+   *  \see backup_cartridge_game_data(std::ostream& fout, int slot, task_controller* controller)
+   *  \see restore_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
+   */
+  void                clone_cartridge_game_data(cartridge& source, int source_slot = SLOT_ALL, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*! \brief Overwrites a cartridge's game data with an image that is still
+   *         arriving.
+   *  
+   *  Same as
+   *  \ref restore_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller),
+   *  except that the game data is taken from an \ref image_pipe another
+   *  thread is still writing, such as an image being downloaded. Each block
+   *  is erased and programmed as soon as its bytes have arrived. The pipe is
+   *  only read from, so the same pipe can be restored to several cartridges
+   *  at once.
+   *  
+   *  This function is a blocking function. A \ref task_controller object may
+   *  be optionally provided to allow for mid-process communication and
+   *  progress updates.
+   *  
+   *  \param [in,out] pipe The pipe the image is being written to.
+   *  \param [in] slot The game slot on the cartridge to write to in the case of
+   *         multiple games on a single cartridge. Set to \ref SLOT_ALL to
+   *         overwrite the entire cartridge.
+   *  \param [in] verify Whether to read back and compare each block after
+   *         programming it.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \return true if verifying was disabled or every block matched, false
+   *          otherwise.
+   *  
+   *  \throws std::runtime_error If the writer stopped before writing the
+   *          whole image.
+   *  
+   *  \see restore_and_verify_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+   */
+  bool                restore_streamed_cartridge_game_data(image_pipe& pipe, int slot = SLOT_ALL, bool verify = false, task_controller* controller = nullptr);
+  
   /*! \brief Compares the cartridge's game data with the contents of an input
    *         stream.
    *  
@@ -229,6 +555,151 @@ public:
    */
   virtual bool        compare_cartridge_game_data(std::istream& fin, int slot = SLOT_ALL, task_controller* controller = nullptr) = 0;
   
+  /*! \brief Compares the cartridge's game data with an image in memory.
+   *  
+   *  Same as
+   *  \ref compare_cartridge_game_data(std::istream& fin, int slot, task_controller* controller),
+   *  except that the game data is taken from a block of memory, such as a
+   *  \ref mapped_file. Blocks are compared in place without being copied.
+   *  
+   *  \param [in] image Pointer to the start of the game data.
+   *  \param [in] num_bytes The number of bytes of game data.
+   *  \param [in] slot The game slot on the cartridge to compare in the case of
+   *         multiple games on a single cartridge. Set to \ref SLOT_ALL to
+   *         compare the entire cartridge.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \returns **true** The cartridge game data and image match.
+   *  \returns **false** The cartridge game data and image do not match.
+   *  
+   *  \see compare_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
+   *  \see task_controller
+   */
+  virtual bool        compare_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot = SLOT_ALL, task_controller* controller = nullptr) = 0;
+  
+  /*! \brief Compares the cartridge's game data with the digests of an
+   *         image.
+   *  
+   *  Same as
+   *  \ref compare_cartridge_game_data(std::istream& fin, int slot, task_controller* controller),
+   *  except that each block read from the cartridge is hashed and compared to
+   *  the matching digest of a \ref digest_manifest, so the image itself is
+   *  never read. Stops at the first block that does not match and logs its
+   *  offset.
+   *  
+   *  \param [in] manifest The digests of the image to compare against.
+   *  \param [in] slot The game slot on the cartridge to compare in the case of
+   *         multiple games on a single cartridge. Set to \ref SLOT_ALL to
+   *         compare the entire cartridge.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \returns **true** The cartridge game data matches every digest.
+   *  \returns **false** The cartridge game data does not match.
+   *  
+   *  \throws std::invalid_argument The blocks of the cartridge do not line up
+   *           with the blocks of the manifest.
+   *  
+   *  \see compare_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
+   *  \see digest_manifest
+   */
+  virtual bool        compare_cartridge_game_data(const digest_manifest& manifest, int slot = SLOT_ALL, task_controller* controller = nullptr) = 0;
+  
+  /*! \brief Compares the cartridge's game data with an image in memory,
+   *         recording every block that differs.
+   *  
+   *  Same as
+   *  \ref compare_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller),
+   *  except that the comparison does not stop at the first block that
+   *  differs. Every block compared is recorded in a \ref block_mismatch_map
+   *  along with the offset of its first difference, so that the blocks that
+   *  failed can be reprogrammed on their own with
+   *  \ref repair_cartridge_game_data().
+   *  
+   *  \param [in] image Pointer to the start of the game data.
+   *  \param [in] num_bytes The number of bytes of game data.
+   *  \param [out] mismatches Cleared, then filled in with every block
+   *         compared. Blocks not reached because the task was cancelled are
+   *         left out.
+   *  \param [in] slot The game slot on the cartridge to compare in the case of
+   *         multiple games on a single cartridge. Set to \ref SLOT_ALL to
+   *         compare the entire cartridge.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \returns **true** The cartridge game data and image match.
+   *  \returns **false** The cartridge game data and image do not match.
+   *  
+   *  \see compare_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+   *  \see block_mismatch_map
+   */
+  bool                compare_cartridge_game_data_blocks(const unsigned char* image, unsigned int num_bytes, block_mismatch_map& mismatches, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*! \brief Compares the cartridge's game data with the digests of an
+   *         image, recording every block that differs.
+   *  
+   *  Same as
+   *  \ref compare_cartridge_game_data_blocks(const unsigned char* image, unsigned int num_bytes, block_mismatch_map& mismatches, int slot, task_controller* controller),
+   *  except that blocks are compared to the digests of a
+   *  \ref digest_manifest. The first difference of each block that differs
+   *  is the start of the block.
+   *  
+   *  \param [in] manifest The digests of the image to compare against.
+   *  \param [out] mismatches Cleared, then filled in with every block
+   *         compared.
+   *  \param [in] slot The game slot on the cartridge to compare in the case of
+   *         multiple games on a single cartridge. Set to \ref SLOT_ALL to
+   *         compare the entire cartridge.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \returns **true** The cartridge game data matches every digest.
+   *  \returns **false** The cartridge game data does not match.
+   *  
+   *  \throws std::invalid_argument The blocks of the cartridge do not line up
+   *           with the blocks of the manifest.
+   */
+  bool                compare_cartridge_game_data_blocks(const digest_manifest& manifest, block_mismatch_map& mismatches, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*! \brief Compares a random sample of the cartridge's game data with an
+   *         image.
+   *  
+   *  Reads only a sample of small windows of the cartridge and compares them
+   *  to the matching parts of the image, for batches of cartridges whose
+   *  flashing was already verified. The sample always covers both ends of the
+   *  image and every block boundary within it, plus enough random windows
+   *  that a fault corrupting at least 1 window in 100, such as a bad chip or a
+   *  wrong image, is caught with the given confidence. Stops at the first
+   *  window that does not match and logs its offset.
+   *  
+   *  Images of a single slot line up with the slot the same way as in
+   *  \ref compare_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller).
+   *  
+   *  This function is a blocking function, although it takes far less time
+   *  than a full compare. A \ref task_controller object may be optionally
+   *  provided to allow for mid-process communication and progress updates.
+   *  
+   *  \param [in] image Pointer to the image to compare against.
+   *  \param [in] num_bytes The number of bytes in the image.
+   *  \param [in] slot The game slot on the cartridge to compare in the case of
+   *         multiple games on a single cartridge. Set to \ref SLOT_ALL to
+   *         compare the entire cartridge.
+   *  \param [in] confidence The probability of catching a fault that corrupts
+   *         1 window in 100. Must be greater than 0 and less than 1.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \returns **true** Every sampled window matches the image.
+   *  \returns **false** A sampled window does not match.
+   *  
+   *  \throws std::invalid_argument The slot does not exist or the confidence
+   *           is out of range.
+   *  
+   *  \see compare_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+   */
+  bool                spot_check_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot = SLOT_ALL, double confidence = SPOT_CHECK_DEFAULT_CONFIDENCE, task_controller* controller = nullptr);
+  
   /*! \brief Saves a cartridge's game save data to an output stream.
    *
    *  Extracts the game save data from a cartridge and writes its contents to an
@@ -343,6 +814,95 @@ public:
    */
   virtual bool        compare_cartridge_save_data(std::istream& fin, int slot = SLOT_ALL, task_controller* controller = nullptr) = 0;
   
+  /*! \brief Computes a fingerprint of a cartridge's game save data.
+   *  
+   *  Computes the CRC32C checksum of the save data exactly as
+   *  \ref backup_cartridge_save_data(std::ostream&, int, task_controller*)
+   *  would write it, without writing it anywhere. Comparing the result with
+   *  \ref digest_manifest::crc32c() of an earlier backup tells whether the
+   *  save data has changed since that backup was made.
+   *  
+   *  The default implementation backs the save data up to memory and hashes
+   *  it, so it costs as many reads from the cartridge as a backup. Cartridges
+   *  whose hardware can checksum data on the device should override it.
+   *  
+   *  This function is a blocking function that can take several seconds to
+   *  complete. A \ref task_controller object may be optionally provided to
+   *  allow for mid-process communication and progress updates. If no controller
+   *  is supplied or **nullptr** is given, then this feature will be ignored.
+   *  
+   *  If a call to this funtion is made before a call to \ref init() is made,
+   *  this function will throw an exception and no other action will be taken.
+   *  
+   *  \param [in] slot The game slot on the cartridge to fingerprint save data
+   *         from in the case of multiple games on a single cartridge. Set to
+   *         \ref SLOT_ALL to fingerprint save data from all slots.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  
+   *  \returns The CRC32C checksum of the save data.
+   *  
+   *  \see digest_manifest::crc32c(const unsigned char*, unsigned int)
+   */
+  virtual unsigned int fingerprint_cartridge_save_data(int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*! \brief Backs up a cartridge's game data without blocking.
+   *  
+   *  Queues \ref backup_cartridge_game_data(std::ostream&, int, task_controller*)
+   *  on a \ref task_pool and returns right away. The stream, the controller, and
+   *  this object must outlive the operation, and no other operation may be
+   *  started on this cartridge until it completes.
+   *  
+   *  \param [out] fout The output stream to write to.
+   *  \param [in] slot The game slot to back up, or \ref SLOT_ALL.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  \param [in] pool (optional) The pool to run the operation on. If
+   *         **nullptr**, then \ref task_pool::shared() is used.
+   *  
+   *  \returns A future that becomes ready when the backup completes, and
+   *           rethrows any exception the backup threw.
+   */
+  std::future<void>    backup_cartridge_game_data_async(std::ostream& fout, int slot = SLOT_ALL, task_controller* controller = nullptr, task_pool* pool = nullptr);
+  
+  /*! \brief Overwrites a cartridge's game data without blocking.
+   *  
+   *  Queues \ref restore_cartridge_game_data(std::istream&, int, task_controller*)
+   *  on a \ref task_pool and returns right away. The stream, the controller, and
+   *  this object must outlive the operation, and no other operation may be
+   *  started on this cartridge until it completes.
+   *  
+   *  \param [in] fin The input stream to read from.
+   *  \param [in] slot The game slot to overwrite, or \ref SLOT_ALL.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  \param [in] pool (optional) The pool to run the operation on. If
+   *         **nullptr**, then \ref task_pool::shared() is used.
+   *  
+   *  \returns A future that becomes ready when the restore completes, and
+   *           rethrows any exception the restore threw.
+   */
+  std::future<void>    restore_cartridge_game_data_async(std::istream& fin, int slot = SLOT_ALL, task_controller* controller = nullptr, task_pool* pool = nullptr);
+  
+  /*! \brief Compares a cartridge's game data to a stream without blocking.
+   *  
+   *  Queues \ref compare_cartridge_game_data(std::istream&, int, task_controller*)
+   *  on a \ref task_pool and returns right away. The stream, the controller, and
+   *  this object must outlive the operation, and no other operation may be
+   *  started on this cartridge until it completes.
+   *  
+   *  \param [in] fin The input stream to compare against.
+   *  \param [in] slot The game slot to compare, or \ref SLOT_ALL.
+   *  \param [in,out] controller (optional) The controller object to send
+   *         progress updates. **nullptr** is an accepted value.
+   *  \param [in] pool (optional) The pool to run the operation on. If
+   *         **nullptr**, then \ref task_pool::shared() is used.
+   *  
+   *  \returns A future that receives true if the data matched, and rethrows
+   *           any exception the comparison threw.
+   */
+  std::future<bool>    compare_cartridge_game_data_async(std::istream& fin, int slot = SLOT_ALL, task_controller* controller = nullptr, task_pool* pool = nullptr);
+  
   /*! \brief Gets the number of game data slots exist on the cartridge.
    *  
    *  Reports the number of game "slots" that the cartridge can hold. This can
@@ -359,6 +919,47 @@ public:
    */
   virtual unsigned int slot_size(int slot) const = 0;
   
+  /*! \brief Gets the number of bytes a backup of a game slot will hold.
+   *  
+   *  Gets the number of bytes \ref backup_cartridge_game_data() writes for
+   *  the given slot, which may be less than the size of the slot if the game
+   *  doesn't fill it.
+   *  
+   *  If a call to this funtion is made before a call to \ref init() is made,
+   *  this function will throw an exception and no other action will be taken.
+   *  
+   *  \param [in] slot The game slot, or \ref SLOT_ALL.
+   */
+  virtual unsigned int game_backup_size(int slot) const = 0;
+  
+  /*! \brief Gets the number of bytes of save data a backup of a slot will
+   *         hold.
+   *  
+   *  Gets the number of bytes of save data
+   *  \ref backup_cartridge_save_data() reads for the given slot, not counting
+   *  any headers of the save file.
+   *  
+   *  If a call to this funtion is made before a call to \ref init() is made,
+   *  this function will throw an exception and no other action will be taken.
+   *  
+   *  \param [in] slot The game slot, or \ref SLOT_ALL.
+   */
+  virtual unsigned int save_backup_size(int slot) const = 0;
+  
+  /*! \brief Gets the cartridge address at which an image of a slot starts.
+   *  
+   *  Gets the address, relative to the start of the cartridge, of the first
+   *  byte written when an image of the given size is restored to the given
+   *  slot. Used to work out which blocks an operation on the slot touches.
+   *  
+   *  \param [in] slot The game slot, or \ref SLOT_ALL.
+   *  \param [in] num_bytes The number of bytes in the image, no more than the
+   *         size of the slot.
+   *  
+   *  \throws std::invalid_argument If the slot does not exist.
+   */
+  unsigned int         game_data_address(int slot, unsigned int num_bytes) const;
+  
   /*! \brief Fetches the name of a game located in a given slot.
    *  
    *  Gets the name of the game on the cartridge in the given slot. If no game
@@ -377,6 +978,114 @@ public:
    *           gone on the cartridge.
    */
   virtual std::string  fetch_game_name(int slot) = 0;
+  
+  /*! \brief Describes the slots of the cartridge and their games' headers in
+   *         a compact table.
+   *  
+   *  Fills a \ref slot_table from what \ref init() read about each slot,
+   *  without talking to the cartridge. The key of the game identified in each
+   *  slot is left at 0 for the caller to fill in.
+   *  
+   *  If a call to this funtion is made before a call to \ref init() is made,
+   *  this function will throw an exception and no other action will be taken.
+   *  
+   *  \param [out] table The table to fill.
+   *  
+   *  \throws std::runtime_error If the cartridge has more slots than a table
+   *          holds.
+   */
+  virtual void         fetch_slot_table(slot_table& table) const = 0;
+  
+  /*! \brief Reads a range of game data from a given slot.
+   *  
+   *  Reads a small range of game data directly, without backing up the rest
+   *  of the slot. Used to sample a few blocks of a game, e.g. to identify it
+   *  by its contents.
+   *  
+   *  If a call to this funtion is made before a call to \ref init() is made,
+   *  this function will throw an exception and no other action will be taken.
+   *  
+   *  \param [in] slot The game slot on the cartridge to read from.
+   *  \param [in] offset The offset of the first byte to read from the start of
+   *         the slot.
+   *  \param [out] buffer The buffer to read into. Must have room for
+   *         **num_bytes** bytes.
+   *  \param [in] num_bytes The number of bytes to read.
+   *  
+   *  \returns The number of bytes read.
+   *  
+   *  \throws std::invalid_argument If the slot does not exist or the range
+   *           does not lie within it.
+   */
+  virtual unsigned int read_cartridge_game_data(int slot, unsigned int offset, unsigned char* buffer, unsigned int num_bytes) = 0;
+  
+  
+  
+protected:
+  
+  /*! \brief Gets where in a slot an image of that slot starts.
+   *  
+   *  Gets the offset of the first byte of an image of a single slot from the
+   *  start of the slot when the image is smaller than the slot. The default
+   *  implementation lines images up with the start of the slot.
+   *  
+   *  \param [in] slot The game slot the image is of.
+   *  \param [in] num_bytes The number of bytes in the image, no more than the
+   *         size of the slot.
+   *  
+   *  \returns The offset of the image from the start of the slot.
+   */
+  virtual unsigned int slot_image_offset(int slot, unsigned int num_bytes) const;
+  
+  /*!
+   *  \brief Writes an image to the cartridge's game data.
+   *  
+   *  Implementation shared by every version of
+   *  \ref restore_cartridge_game_data(),
+   *  \ref restore_and_verify_cartridge_game_data(), and
+   *  \ref patch_cartridge_game_data(). Blocks the image reports as unchanged
+   *  through \ref rom_image::is_changed() are left as they are.
+   *  
+   *  \param [in,out] image The image to write.
+   *  \param [in] slot The game slot to write to, or \ref SLOT_ALL.
+   *  \param [in,out] controller The controller object to send progress updates.
+   *         **nullptr** is an accepted value.
+   *  \param [in] verify Whether to read back and retry each block after
+   *         programming it.
+   *  
+   *  \returns false if verifying any block failed, true otherwise.
+   */
+  virtual bool        restore_game_data(rom_image& image, int slot, task_controller* controller, bool verify) = 0;
+  
+  /*!
+   *  \brief Compares an image to the cartridge's game data.
+   *  
+   *  Implementation shared by every version of
+   *  \ref compare_cartridge_game_data() and
+   *  \ref compare_cartridge_game_data_blocks().
+   *  
+   *  \param [in,out] image The image to compare.
+   *  \param [in] slot The game slot to compare, or \ref SLOT_ALL.
+   *  \param [in,out] controller The controller object to send progress updates.
+   *         **nullptr** is an accepted value.
+   *  \param [out] mismatches The map to record every block compared in, or
+   *         **nullptr** to stop at the first block that differs.
+   *  
+   *  \returns true if the cartridge matches the image, false otherwise.
+   */
+  virtual bool        compare_game_data(rom_image& image, int slot, task_controller* controller, block_mismatch_map* mismatches) = 0;
+  
+  
+  
+private:
+  
+  /*!
+   *  \brief Applies a patch, reading back whatever part of the cartridge's
+   *         current contents isn't given.
+   *  
+   *  \see patch_cartridge_game_data(std::istream& patch, const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+   */
+  bool                patch_game_data(std::istream& patch, const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller);
 };
 
 #endif // defined(__CARTRIDGE_H__)
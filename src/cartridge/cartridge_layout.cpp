@@ -0,0 +1,144 @@
+/*! \file
+ *  \brief File containing the implementation of the \ref cartridge_layout
+ *         class.
+ *  
+ *  File containing the implementation of the \ref cartridge_layout class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "cartridge_layout.h"
+#include "cartridge_descriptor.h"
+
+cartridge_layout::cartridge_layout()
+  : m_num_bytes(0)
+{
+  // Nothing else to do
+}
+
+cartridge_layout::cartridge_layout(const cartridge_descriptor& descriptor)
+  : m_num_bytes(0)
+{
+  m_chips.reserve(descriptor.num_chips);
+  for (unsigned int i = 0; i < descriptor.num_chips; ++i)
+  {
+    const cartridge_descriptor::chip_descriptor* chip_desc = descriptor.chips[i];
+    
+    // Keep an empty entry for a missing chip so that chip indices still match
+    chip_entry chip;
+    chip.manufacturer_id = (chip_desc != nullptr ? chip_desc->manufacturer_id : 0);
+    chip.device_id = (chip_desc != nullptr ? chip_desc->device_id : 0);
+    chip.cartridge_address = m_num_bytes;
+    chip.num_bytes = (chip_desc != nullptr ? chip_desc->num_bytes : 0);
+    chip.first_block = (unsigned int) m_blocks.size();
+    
+    for (unsigned int j = 0; chip_desc != nullptr && j < chip_desc->num_blocks; ++j)
+    {
+      const cartridge_descriptor::chip_descriptor::block_descriptor* block_desc = chip_desc->blocks[j];
+      if (block_desc == nullptr)
+      {
+        continue;
+      }
+      
+      block_entry block;
+      block.chip_num = i;
+      block.block_num = j;
+      block.base_address = block_desc->base_address;
+      block.cartridge_address = chip.cartridge_address + block_desc->base_address;
+      block.num_bytes = block_desc->num_bytes;
+      block.is_protected = block_desc->is_protected;
+      m_blocks.push_back(block);
+    }
+    
+    chip.num_blocks = (unsigned int) m_blocks.size() - chip.first_block;
+    m_chips.push_back(chip);
+    m_num_bytes += chip.num_bytes;
+  }
+}
+
+
+
+unsigned int cartridge_layout::num_chips() const
+{
+  return (unsigned int) m_chips.size();
+}
+
+const cartridge_layout::chip_entry& cartridge_layout::chip(unsigned int chip) const
+{
+  return m_chips[chip];
+}
+
+unsigned int cartridge_layout::num_blocks() const
+{
+  return (unsigned int) m_blocks.size();
+}
+
+const cartridge_layout::block_entry* cartridge_layout::blocks() const
+{
+  return m_blocks.data();
+}
+
+const cartridge_layout::block_entry* cartridge_layout::chip_blocks(unsigned int chip) const
+{
+  return m_blocks.data() + m_chips[chip].first_block;
+}
+
+int cartridge_layout::find_block(unsigned int chip, unsigned int address) const
+{
+  const block_entry* blocks = chip_blocks(chip);
+  
+  // Blocks are in address order, so find the last one starting at or before
+  // the address
+  unsigned int lower = 0;
+  unsigned int upper = m_chips[chip].num_blocks;
+  while (lower < upper)
+  {
+    unsigned int middle = lower + (upper - lower) / 2;
+    if (blocks[middle].base_address <= address)
+    {
+      lower = middle + 1;
+    }
+    else
+    {
+      upper = middle;
+    }
+  }
+  
+  if (lower == 0 || address - blocks[lower - 1].base_address >= blocks[lower - 1].num_bytes)
+  {
+    return -1;
+  }
+  return (int) (lower - 1);
+}
+
+unsigned int cartridge_layout::num_bytes() const
+{
+  return m_num_bytes;
+}
+
+unsigned int cartridge_layout::num_unprotected_bytes(unsigned int chip_lower_bound, unsigned int chip_upper_bound, unsigned int* num_blocks) const
+{
+  unsigned int bytes_total = 0;
+  unsigned int blocks_total = 0;
+  if (chip_lower_bound < chip_upper_bound && chip_lower_bound < m_chips.size())
+  {
+    const block_entry* block = chip_blocks(chip_lower_bound);
+    const block_entry* end = (chip_upper_bound < m_chips.size() ? chip_blocks(chip_upper_bound) : m_blocks.data() + m_blocks.size());
+    for (; block != end; ++block)
+    {
+      if (!block->is_protected)
+      {
+        bytes_total += block->num_bytes;
+        ++blocks_total;
+      }
+    }
+  }
+  
+  if (num_blocks != nullptr)
+  {
+    *num_blocks = blocks_total;
+  }
+  return bytes_total;
+}
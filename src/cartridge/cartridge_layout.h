@@ -0,0 +1,188 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref cartridge_layout class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref cartridge_layout class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __CARTRIDGE_LAYOUT_H__
+#define __CARTRIDGE_LAYOUT_H__
+
+#include <vector>
+
+struct cartridge_descriptor;
+
+/*! \class cartridge_layout
+ *  \brief Flat, contiguous copy of the chips and blocks of a
+ *         \ref cartridge_descriptor.
+ *  
+ *  Flat copy of the chip and block structure of a \ref cartridge_descriptor.
+ *  Every block of the cartridge is stored in a single contiguous array, chip
+ *  by chip and in address order, and each chip records the range of that
+ *  array that holds its blocks. Walking the blocks of a chip is then a walk
+ *  over consecutive elements instead of a chain of pointers, the layout is
+ *  cheap to copy and cache, and the block containing an address can be found
+ *  with a binary search.
+ *  
+ *  The layout is a snapshot; it does not change when the descriptor it was
+ *  built from changes.
+ *  
+ *  \see cartridge_descriptor
+ */
+class cartridge_layout
+{
+public:
+  
+  /*! \struct block_entry
+   *  \brief A single block of the cartridge.
+   */
+  struct block_entry
+  {
+    /*! \brief Index of the chip the block is on. */
+    unsigned int          chip_num;
+    
+    /*! \brief Index of the block on its chip. */
+    unsigned int          block_num;
+    
+    /*! \brief Address of the block relative to the start of its chip. */
+    unsigned int          base_address;
+    
+    /*! \brief Address of the block relative to the start of the cartridge. */
+    unsigned int          cartridge_address;
+    
+    /*! \brief Size of the block in bytes. */
+    unsigned int          num_bytes;
+    
+    /*! \brief Flag indicating that the block is write protected. */
+    bool                  is_protected;
+  };
+  
+  /*! \struct chip_entry
+   *  \brief A single chip of the cartridge and the range of its blocks.
+   */
+  struct chip_entry
+  {
+    /*! \brief The id of the manufacturer of the chip. */
+    unsigned int          manufacturer_id;
+    
+    /*! \brief The id of the chip. */
+    unsigned int          device_id;
+    
+    /*! \brief Address of the chip relative to the start of the cartridge. */
+    unsigned int          cartridge_address;
+    
+    /*! \brief Size of the chip in bytes. */
+    unsigned int          num_bytes;
+    
+    /*! \brief Index of the chip's first block in the block array. */
+    unsigned int          first_block;
+    
+    /*! \brief The number of blocks on the chip. */
+    unsigned int          num_blocks;
+  };
+  
+  
+  
+  /*!
+   *  \brief Class constructor. Creates an empty layout.
+   */
+                          cartridge_layout();
+  
+  /*!
+   *  \brief Class constructor. Flattens the given descriptor.
+   *  
+   *  Blocks that the descriptor has not filled in yet, i.e. that are still
+   *  **nullptr**, are left out. Chips that are still **nullptr** are kept as
+   *  chips without any bytes or blocks so that chip indices stay the same.
+   *  
+   *  \param [in] descriptor The descriptor to flatten.
+   */
+  explicit                cartridge_layout(const cartridge_descriptor& descriptor);
+  
+  
+  
+  /*!
+   *  \brief Gets the number of chips on the cartridge.
+   */
+  unsigned int            num_chips() const;
+  
+  /*!
+   *  \brief Gets a chip of the cartridge.
+   *  
+   *  \param [in] chip The index of the chip. Must be less than
+   *         \ref num_chips().
+   */
+  const chip_entry&       chip(unsigned int chip) const;
+  
+  /*!
+   *  \brief Gets the number of blocks on the whole cartridge.
+   */
+  unsigned int            num_blocks() const;
+  
+  /*!
+   *  \brief Gets the array of every block on the cartridge, chip by chip.
+   *  
+   *  \see num_blocks()
+   */
+  const block_entry*      blocks() const;
+  
+  /*!
+   *  \brief Gets the array of blocks on a single chip.
+   *  
+   *  \param [in] chip The index of the chip. Must be less than
+   *         \ref num_chips().
+   *  
+   *  \return Pointer to the chip's first block, followed by the rest of the
+   *          chip's blocks. The length of the array is the **num_blocks** of
+   *          the chip's \ref chip_entry.
+   */
+  const block_entry*      chip_blocks(unsigned int chip) const;
+  
+  /*!
+   *  \brief Finds the block of a chip that contains an address.
+   *  
+   *  \param [in] chip The index of the chip. Must be less than
+   *         \ref num_chips().
+   *  \param [in] address The address relative to the start of the chip.
+   *  
+   *  \return The index of the block on the chip, or -1 if no block of the chip
+   *          contains the address.
+   */
+  int                     find_block(unsigned int chip, unsigned int address) const;
+  
+  /*!
+   *  \brief Gets the total size of the cartridge's chips in bytes.
+   */
+  unsigned int            num_bytes() const;
+  
+  /*!
+   *  \brief Gets the total size of the blocks that aren't write protected in
+   *         a range of chips, in bytes.
+   *  
+   *  \param [in] chip_lower_bound The index of the first chip to count.
+   *  \param [in] chip_upper_bound One past the index of the last chip to
+   *         count.
+   *  \param [out] num_blocks The number of blocks counted. **nullptr** is an
+   *         accepted value.
+   */
+  unsigned int            num_unprotected_bytes(unsigned int chip_lower_bound, unsigned int chip_upper_bound, unsigned int* num_blocks = nullptr) const;
+
+
+
+private:
+  
+  /*! \brief Every chip of the cartridge. */
+  std::vector<chip_entry> m_chips;
+  
+  /*! \brief Every block of the cartridge, chip by chip. */
+  std::vector<block_entry> m_blocks;
+  
+  /*! \brief The total size of the cartridge's chips in bytes. */
+  unsigned int            m_num_bytes;
+};
+
+#endif /* defined(__CARTRIDGE_LAYOUT_H__) */
@@ -0,0 +1,255 @@
+/*! \file
+ *  \brief File containing the implementation of \ref cartridge_memory_view.
+ *  
+ *  File containing the implementation of \ref cartridge_memory_view.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see cartridge_memory_view
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-25
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "cartridge_memory_view.h"
+#include "cartridge.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+
+
+cartridge_memory_view::cartridge_memory_view(cartridge* cart, int slot, unsigned int max_pages)
+  : m_cartridge(cart), m_slot(slot),
+    m_size(slot >= 0 && slot < (int) cart->num_slots() ? cart->slot_size(slot) : 0),
+    m_max_pages(max_pages), m_generation(0)
+{
+  if (slot < 0 || slot >= (int) cart->num_slots())
+  {
+    throw std::invalid_argument("Invalid slot number");
+  }
+  if (max_pages == 0)
+  {
+    throw std::invalid_argument("A memory view needs room for at least one page");
+  }
+}
+
+
+
+unsigned int cartridge_memory_view::size() const
+{
+  return m_size;
+}
+
+unsigned int cartridge_memory_view::num_pages() const
+{
+  return (m_size + MEMORY_VIEW_PAGE_SIZE - 1) / MEMORY_VIEW_PAGE_SIZE;
+}
+
+bool cartridge_memory_view::is_page_loaded(unsigned int page)
+{
+  lock_guard<mutex> lock(m_mutex);
+  return (m_pages.find(page) != m_pages.end());
+}
+
+bool cartridge_memory_view::copy_loaded(unsigned int offset, unsigned char* buffer, unsigned int num_bytes, std::vector<bool>* loaded)
+{
+  check_range(offset, num_bytes);
+  if (loaded != nullptr)
+  {
+    loaded->assign(num_bytes, false);
+  }
+  
+  lock_guard<mutex> lock(m_mutex);
+  bool all_loaded = true;
+  unsigned int copied = 0;
+  while (copied < num_bytes)
+  {
+    unsigned int page = (offset + copied) / MEMORY_VIEW_PAGE_SIZE;
+    unsigned int page_offset = (offset + copied) % MEMORY_VIEW_PAGE_SIZE;
+    unsigned int chunk = min(num_bytes - copied, MEMORY_VIEW_PAGE_SIZE - page_offset);
+    
+    auto it = m_pages.find(page);
+    if (it == m_pages.end())
+    {
+      all_loaded = false;
+    }
+    else
+    {
+      memcpy(buffer + copied, it->second.data() + page_offset, chunk);
+      if (loaded != nullptr)
+      {
+        fill(loaded->begin() + copied, loaded->begin() + copied + chunk, true);
+      }
+      touch_page(page);
+    }
+    copied += chunk;
+  }
+  return all_loaded;
+}
+
+unsigned int cartridge_memory_view::read(unsigned int offset, unsigned char* buffer, unsigned int num_bytes)
+{
+  check_range(offset, num_bytes);
+  
+  // Read and copy a page at a time, so that a range larger than the view
+  // keeps doesn't lose its first pages before they are copied
+  unsigned int copied = 0;
+  while (copied < num_bytes)
+  {
+    unsigned int page = (offset + copied) / MEMORY_VIEW_PAGE_SIZE;
+    unsigned int page_offset = (offset + copied) % MEMORY_VIEW_PAGE_SIZE;
+    unsigned int chunk = min(num_bytes - copied, MEMORY_VIEW_PAGE_SIZE - page_offset);
+    
+    if (!copy_loaded(offset + copied, buffer + copied, chunk))
+    {
+      load_page(page);
+      if (!copy_loaded(offset + copied, buffer + copied, chunk))
+      {
+        // Invalidated while being read, so read straight from the cartridge
+        if (m_cartridge->read_cartridge_game_data(m_slot, offset + copied, buffer + copied, chunk) != chunk)
+        {
+          return copied;
+        }
+      }
+    }
+    copied += chunk;
+  }
+  return copied;
+}
+
+void cartridge_memory_view::request_pages(unsigned int first, unsigned int count)
+{
+  unsigned int end = (unsigned int) min((unsigned long long) first + count, (unsigned long long) num_pages());
+  
+  lock_guard<mutex> lock(m_mutex);
+  m_pending.clear();
+  
+  // What is on screen first, then what scrolling on would show next, then
+  // what scrolling back would
+  for (unsigned int page = first; page < end; ++page)
+  {
+    m_pending.push_back(page);
+  }
+  for (unsigned int i = 0; i < MEMORY_VIEW_PREFETCH_PAGES && end + i < num_pages(); ++i)
+  {
+    m_pending.push_back(end + i);
+  }
+  for (unsigned int i = 1; i <= MEMORY_VIEW_PREFETCH_PAGES && i <= first && first < num_pages(); ++i)
+  {
+    m_pending.push_back(first - i);
+  }
+  
+  m_pending.remove_if([this](unsigned int page) { return m_pages.find(page) != m_pages.end(); });
+}
+
+bool cartridge_memory_view::has_pending()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return !m_pending.empty();
+}
+
+bool cartridge_memory_view::fetch_next()
+{
+  unsigned int page;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    while (!m_pending.empty() && m_pages.find(m_pending.front()) != m_pages.end())
+    {
+      m_pending.pop_front();
+    }
+    if (m_pending.empty())
+    {
+      return false;
+    }
+    page = m_pending.front();
+    m_pending.pop_front();
+  }
+  
+  load_page(page);
+  return true;
+}
+
+void cartridge_memory_view::invalidate()
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_pages.clear();
+  m_recent.clear();
+  ++m_generation;
+}
+
+void cartridge_memory_view::set_page_listener(page_callback listener)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_listener = listener;
+}
+
+
+
+void cartridge_memory_view::check_range(unsigned int offset, unsigned int num_bytes) const
+{
+  if (offset > m_size || num_bytes > m_size - offset)
+  {
+    throw std::invalid_argument("Range does not fit in slot");
+  }
+}
+
+unsigned int cartridge_memory_view::page_bytes(unsigned int page) const
+{
+  return min((unsigned int) MEMORY_VIEW_PAGE_SIZE, m_size - page * MEMORY_VIEW_PAGE_SIZE);
+}
+
+void cartridge_memory_view::load_page(unsigned int page)
+{
+  unsigned int generation;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    generation = m_generation;
+  }
+  
+  // The cartridge is read without the lock, so that pages already loaded can
+  // be shown meanwhile
+  vector<unsigned char> data(page_bytes(page));
+  unsigned int offset = page * MEMORY_VIEW_PAGE_SIZE;
+  if (m_cartridge->read_cartridge_game_data(m_slot, offset, data.data(), (unsigned int) data.size()) != data.size())
+  {
+    throw std::runtime_error("Could not read page " + to_string(page) + " of slot " + to_string(m_slot));
+  }
+  
+  page_callback listener;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    if (generation != m_generation)
+    {
+      return;
+    }
+    
+    m_pages[page].swap(data);
+    touch_page(page);
+    while (m_recent.size() > m_max_pages)
+    {
+      m_pages.erase(m_recent.back());
+      m_recent.pop_back();
+    }
+    listener = m_listener;
+  }
+  
+  if (listener != nullptr)
+  {
+    listener(page);
+  }
+}
+
+void cartridge_memory_view::touch_page(unsigned int page)
+{
+  auto it = find(m_recent.begin(), m_recent.end(), page);
+  if (it != m_recent.end())
+  {
+    m_recent.erase(it);
+  }
+  m_recent.push_front(page);
+}
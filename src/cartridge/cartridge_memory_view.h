@@ -0,0 +1,246 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref cartridge_memory_view
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref cartridge_memory_view class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-25
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __CARTRIDGE_MEMORY_VIEW_H__
+#define __CARTRIDGE_MEMORY_VIEW_H__
+
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+class cartridge;
+
+/*! \brief The number of bytes in each page of a \ref cartridge_memory_view. */
+#define MEMORY_VIEW_PAGE_SIZE           0x1000
+
+/*! \brief The default for the number of pages a \ref cartridge_memory_view
+ *         keeps. */
+#define MEMORY_VIEW_DEFAULT_MAX_PAGES   256
+
+/*! \brief The number of pages on each side of the ones asked for that a
+ *         \ref cartridge_memory_view fetches ahead of time. */
+#define MEMORY_VIEW_PREFETCH_PAGES      4
+
+
+
+/*! \class cartridge_memory_view
+ *  \brief Paged view of the game data of one slot of a cartridge, read on
+ *         demand.
+ *  
+ *  Lets the memory of a cartridge be browsed without dumping it first. The
+ *  slot is split into pages of \ref MEMORY_VIEW_PAGE_SIZE bytes that are only
+ *  read from the device when somebody asks for them, and the most recently
+ *  used of them are kept for the next time they are needed.
+ *  
+ *  Whoever shows the memory says which pages are on screen with
+ *  \ref request_pages(), and a background worker calls \ref fetch_next()
+ *  until it returns false, then waits for more to be requested. Pages asked
+ *  for are read first, in the order asked, and the
+ *  \ref MEMORY_VIEW_PREFETCH_PAGES pages on either side of them after, ahead
+ *  of the ones before, so that scrolling on finds them already there. Asking
+ *  for other pages drops whatever was still waiting to be read for the old
+ *  ones.
+ *  
+ *  Each page is read with one uncontrolled call to
+ *  \ref cartridge::read_cartridge_game_data(int slot, unsigned int offset, unsigned char* buffer, unsigned int num_bytes)
+ *  that is small enough for \ref linkmasta_device::set_cache_reads(bool) to
+ *  keep, so pages dropped from the view are read back from the device's read
+ *  cache when it is on.
+ *  
+ *  This class is thread-safe, except that calls that read the cartridge,
+ *  \ref fetch_next() and \ref read(), must not be made at the same time as
+ *  anything else that uses the cartridge or its device, such as by claiming
+ *  the device around them.
+ */
+class cartridge_memory_view
+{
+public:
+  
+  /*!
+   *  \brief Function type called each time a page is read.
+   *  
+   *  Called with the index of the page from the thread that read it, without
+   *  the view's lock held.
+   */
+  typedef std::function<void(unsigned int page)> page_callback;
+  
+  
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in] cart The cartridge to view. Must be initialized and outlive
+   *         the view.
+   *  \param [in] slot The slot to view.
+   *  \param [in] max_pages The number of pages to keep at most, at least the
+   *         number shown at once plus those fetched around them.
+   *  
+   *  \throws std::invalid_argument If the slot does not exist or max_pages is
+   *          0.
+   */
+                            cartridge_memory_view(cartridge* cart, int slot, unsigned int max_pages = MEMORY_VIEW_DEFAULT_MAX_PAGES);
+  
+  
+  
+  /*!
+   *  \brief Gets the number of bytes in the slot.
+   */
+  unsigned int              size() const;
+  
+  /*!
+   *  \brief Gets the number of pages in the slot, the last of which may be
+   *         short.
+   */
+  unsigned int              num_pages() const;
+  
+  /*!
+   *  \brief Gets whether a page has been read and is still kept.
+   */
+  bool                      is_page_loaded(unsigned int page);
+  
+  /*!
+   *  \brief Copies a range of bytes if every page it touches is loaded,
+   *         without reading the cartridge.
+   *  
+   *  \param [in] offset The offset of the first byte in the slot.
+   *  \param [out] buffer The buffer to copy into. Must hold **num_bytes**
+   *         bytes.
+   *  \param [in] num_bytes The number of bytes to copy.
+   *  \param [out] loaded Set to whether each byte was copied, if not null.
+   *         Bytes of pages that aren't loaded are left alone in **buffer**.
+   *  
+   *  \return true if every byte was copied.
+   *  
+   *  \throws std::invalid_argument If the range does not fit in the slot.
+   */
+  bool                      copy_loaded(unsigned int offset, unsigned char* buffer, unsigned int num_bytes, std::vector<bool>* loaded = nullptr);
+  
+  /*!
+   *  \brief Copies a range of bytes, first reading the pages it touches that
+   *         aren't loaded.
+   *  
+   *  \param [in] offset The offset of the first byte in the slot.
+   *  \param [out] buffer The buffer to copy into. Must hold **num_bytes**
+   *         bytes.
+   *  \param [in] num_bytes The number of bytes to copy.
+   *  
+   *  \return The number of bytes copied.
+   *  
+   *  \throws std::invalid_argument If the range does not fit in the slot.
+   *  \throws std::exception If the cartridge could not be read.
+   */
+  unsigned int              read(unsigned int offset, unsigned char* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Sets the pages that are wanted now, such as those on screen.
+   *  
+   *  Replaces whatever was waiting to be read with the given pages that
+   *  aren't loaded yet, followed by those around them.
+   *  
+   *  \param [in] first The index of the first page wanted.
+   *  \param [in] count The number of pages wanted. Those past the end of the
+   *         slot are ignored.
+   */
+  void                      request_pages(unsigned int first, unsigned int count);
+  
+  /*!
+   *  \brief Gets whether any page is waiting to be read.
+   */
+  bool                      has_pending();
+  
+  /*!
+   *  \brief Reads the next page waiting to be read.
+   *  
+   *  \return true if a page was read, false if nothing was waiting.
+   *  
+   *  \throws std::exception If the cartridge could not be read. The page is
+   *          dropped from those waiting.
+   */
+  bool                      fetch_next();
+  
+  /*!
+   *  \brief Forgets every page read, such as after the cartridge was written.
+   */
+  void                      invalidate();
+  
+  /*!
+   *  \brief Sets a function to call each time a page is read.
+   *  
+   *  \param [in] listener The function to call, or nullptr to stop calling
+   *         one.
+   */
+  void                      set_page_listener(page_callback listener);
+
+
+
+private:
+  cartridge_memory_view(const cartridge_memory_view& other) = delete;
+  cartridge_memory_view& operator=(const cartridge_memory_view& other) = delete;
+  
+  /*!
+   *  \brief Throws if a range of bytes does not fit in the slot.
+   */
+  void                      check_range(unsigned int offset, unsigned int num_bytes) const;
+  
+  /*!
+   *  \brief Gets the number of bytes in a page.
+   */
+  unsigned int              page_bytes(unsigned int page) const;
+  
+  /*!
+   *  \brief Reads a page from the cartridge and keeps it.
+   */
+  void                      load_page(unsigned int page);
+  
+  /*!
+   *  \brief Marks a page as the most recently used. Must be called with the
+   *         lock held.
+   */
+  void                      touch_page(unsigned int page);
+  
+  
+  
+  /*! \brief The cartridge being viewed. */
+  cartridge* const          m_cartridge;
+  
+  /*! \brief The slot being viewed. */
+  const int                 m_slot;
+  
+  /*! \brief The number of bytes in the slot. */
+  const unsigned int        m_size;
+  
+  /*! \brief The number of pages kept at most. */
+  const unsigned int        m_max_pages;
+  
+  /*! \brief The pages kept, indexed by page. */
+  std::map<unsigned int, std::vector<unsigned char>> m_pages;
+  
+  /*! \brief The pages kept, most recently used first. */
+  std::list<unsigned int>   m_recent;
+  
+  /*! \brief The pages waiting to be read, in the order they are read. */
+  std::list<unsigned int>   m_pending;
+  
+  /*! \brief Incremented by \ref invalidate() so that pages being read when it
+   *         is called aren't kept. */
+  unsigned int              m_generation;
+  
+  /*! \brief Function called each time a page is read. */
+  page_callback             m_listener;
+  
+  /*! \brief Mutex guarding every member. */
+  std::mutex                m_mutex;
+};
+
+#endif /* defined(__CARTRIDGE_MEMORY_VIEW_H__) */
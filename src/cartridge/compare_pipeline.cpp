@@ -0,0 +1,138 @@
+/*! \file
+ *  \brief File containing the implementation of \ref compare_pipeline.
+ *  
+ *  File containing the implementation of \ref compare_pipeline.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see compare_pipeline
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-29
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "compare_pipeline.h"
+
+#define MIN_NUM_BUFFERS 2
+
+using namespace std;
+
+
+
+compare_pipeline::compare_pipeline(buffer_pool& pool, unsigned int buffer_size, block_comparer comparer, unsigned int num_buffers)
+  : m_comparer(comparer), m_comparing(false), m_mismatched(false), m_stopping(false)
+{
+  if (num_buffers < MIN_NUM_BUFFERS)
+  {
+    num_buffers = MIN_NUM_BUFFERS;
+  }
+  
+  for (unsigned int i = 0; i < num_buffers; ++i)
+  {
+    m_buffers.push_back(pool.acquire(buffer_size));
+    m_free_buffers.push_back(m_buffers.back().data());
+  }
+  
+  m_thread = thread(&compare_pipeline::comparer_function, this);
+}
+
+compare_pipeline::~compare_pipeline()
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_stopping = true;
+  m_condition.notify_all();
+  lock.unlock();
+  
+  if (m_thread.joinable())
+  {
+    m_thread.join();
+  }
+}
+
+
+
+unsigned char* compare_pipeline::acquire_buffer()
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return !m_free_buffers.empty(); });
+  
+  unsigned char* buffer = m_free_buffers.front();
+  m_free_buffers.pop_front();
+  return buffer;
+}
+
+void compare_pipeline::submit_buffer(unsigned char* buffer, unsigned int offset, unsigned int num_bytes)
+{
+  lock_guard<mutex> lock(m_mutex);
+  queued_block block = {buffer, offset, num_bytes};
+  m_queued_blocks.push_back(block);
+  m_condition.notify_all();
+}
+
+bool compare_pipeline::matched()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return !m_mismatched && m_error == nullptr;
+}
+
+bool compare_pipeline::finish()
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return m_queued_blocks.empty() && !m_comparing; });
+  
+  if (m_error != nullptr)
+  {
+    rethrow_exception(m_error);
+  }
+  return !m_mismatched;
+}
+
+
+
+void compare_pipeline::comparer_function()
+{
+  unique_lock<mutex> lock(m_mutex);
+  
+  while (true)
+  {
+    m_condition.wait(lock, [this] { return m_stopping || !m_queued_blocks.empty(); });
+    if (m_stopping)
+    {
+      break;
+    }
+    
+    queued_block block = m_queued_blocks.front();
+    m_queued_blocks.pop_front();
+    m_comparing = true;
+    bool skip = (m_mismatched || m_error != nullptr || block.num_bytes == 0);
+    lock.unlock();
+    
+    // Keep recycling buffers after a mismatch so the producer never stalls,
+    // but don't compare anything more
+    bool matched = true;
+    exception_ptr error;
+    if (!skip)
+    {
+      try
+      {
+        matched = m_comparer(block.offset, block.buffer, block.num_bytes);
+      }
+      catch (...)
+      {
+        error = current_exception();
+      }
+    }
+    
+    lock.lock();
+    m_mismatched = m_mismatched || !matched;
+    if (m_error == nullptr)
+    {
+      m_error = error;
+    }
+    m_comparing = false;
+    m_free_buffers.push_back(block.buffer);
+    m_condition.notify_all();
+  }
+}
@@ -0,0 +1,199 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref compare_pipeline class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref compare_pipeline class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-29
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __COMPARE_PIPELINE_H__
+#define __COMPARE_PIPELINE_H__
+
+#include "common/buffer_pool.h"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! \class compare_pipeline
+ *  \brief Class for comparing blocks read from a cartridge on a background
+ *         thread.
+ *  
+ *  Class for comparing blocks of data against their source on a background
+ *  thread, so that the next block can be read from a cartridge while the
+ *  previous one is still being read from the file and compared. Works like
+ *  \ref write_pipeline: the caller fills a buffer obtained from
+ *  \ref acquire_buffer() and hands it back with
+ *  \ref submit_buffer(unsigned char* buffer, unsigned int offset, unsigned int num_bytes),
+ *  after which the buffer is compared and recycled by the comparer thread.
+ *  
+ *  \code
+ *  compare_pipeline pipeline(pool, BLOCK_SIZE, [&](unsigned int offset, const unsigned char* data, unsigned int num_bytes)
+ *  {
+ *    return image.matches(offset, data, f_buffer, num_bytes);
+ *  });
+ *  while (pipeline.matched() && ...)
+ *  {
+ *    unsigned char* buffer = pipeline.acquire_buffer();
+ *    unsigned int num_bytes = chip->read_bytes(address, buffer, BLOCK_SIZE);
+ *    pipeline.submit_buffer(buffer, offset, num_bytes);
+ *  }
+ *  bool matched = pipeline.finish();
+ *  \endcode
+ *  
+ *  Once a block has failed to match, later blocks are recycled without being
+ *  compared. Whatever the comparison function reads from, such as the file,
+ *  must not be used by anyone else while the pipeline exists.
+ *  
+ *  The producer side of this class is *not* thread-safe; only one thread
+ *  should acquire and submit buffers.
+ */
+class compare_pipeline
+{
+public:
+  
+  /*!
+   *  \brief Type of a function called on the comparer thread with each block.
+   *  
+   *  Type of a function called on the comparer thread with each block, in
+   *  order, given the offset it was submitted with. Returns true if the block
+   *  matches. Exceptions it throws are passed on by \ref finish().
+   */
+  typedef std::function<bool(unsigned int, const unsigned char*, unsigned int)> block_comparer;
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  Class constructor. Borrows the buffers and starts the comparer thread.
+   *  
+   *  \param [in,out] pool The pool to borrow buffers from. Must outlive the
+   *         pipeline.
+   *  \param [in] buffer_size The size of each buffer in bytes.
+   *  \param [in] comparer The function comparing each block.
+   *  \param [in] num_buffers The number of buffers to cycle through. Values
+   *         less than 2 are treated as 2.
+   */
+                          compare_pipeline(buffer_pool& pool, unsigned int buffer_size, block_comparer comparer, unsigned int num_buffers = 2);
+  
+  /*!
+   *  \brief Class destructor.
+   *  
+   *  Class destructor. Waits for the block being compared, discards the rest,
+   *  stops the comparer thread, and frees the buffers.
+   */
+                          ~compare_pipeline();
+  
+  
+  
+  /*!
+   *  \brief Gets a buffer to fill with the next block.
+   *  
+   *  Gets a buffer of the size given at construction to fill with the next
+   *  block. Blocks until the comparer thread has recycled a buffer if all of
+   *  them are in use.
+   *  
+   *  \return A pointer to an unused buffer.
+   */
+  unsigned char*          acquire_buffer();
+  
+  /*!
+   *  \brief Queues a filled buffer to be compared.
+   *  
+   *  Queues a buffer previously returned by \ref acquire_buffer() to be
+   *  compared. Blocks are compared in the order they are submitted. The
+   *  buffer must not be used again until it is returned by another call to
+   *  \ref acquire_buffer(). Submitting 0 bytes just recycles the buffer.
+   *  
+   *  \param [in] buffer The buffer to compare.
+   *  \param [in] offset The offset of the block, passed on to the comparison
+   *         function.
+   *  \param [in] num_bytes The number of bytes in the buffer to compare.
+   */
+  void                    submit_buffer(unsigned char* buffer, unsigned int offset, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Gets whether every block compared so far matched.
+   *  
+   *  \return false if any block failed to match or could not be compared,
+   *          true otherwise.
+   */
+  bool                    matched();
+  
+  /*!
+   *  \brief Blocks until every submitted block has been compared.
+   *  
+   *  Blocks until every submitted block has been compared. If comparing any
+   *  block threw an exception, the exception is thrown again.
+   *  
+   *  \return true if every block matched, false otherwise.
+   */
+  bool                    finish();
+
+
+
+private:
+  
+  /*!
+   *  \brief The function that the comparer thread executes.
+   */
+  void                    comparer_function();
+  
+  /*!
+   *  \brief A block waiting to be compared.
+   */
+  struct queued_block
+  {
+    /*! \brief The buffer holding the block. */
+    unsigned char*        buffer;
+    
+    /*! \brief The offset the block was submitted with. */
+    unsigned int          offset;
+    
+    /*! \brief The number of bytes in the block. */
+    unsigned int          num_bytes;
+  };
+  
+  
+  
+  /*! \brief Function comparing each block. */
+  block_comparer          m_comparer;
+  
+  /*! \brief All buffers borrowed by the pipeline. */
+  std::vector<buffer_pool::buffer> m_buffers;
+  
+  /*! \brief Buffers available to \ref acquire_buffer(). */
+  std::deque<unsigned char*> m_free_buffers;
+  
+  /*! \brief Submitted blocks waiting to be compared. */
+  std::deque<queued_block> m_queued_blocks;
+  
+  /*! \brief Flag indicating that the comparer thread is comparing a block. */
+  bool                    m_comparing;
+  
+  /*! \brief Flag indicating that a block failed to match. */
+  bool                    m_mismatched;
+  
+  /*! \brief The exception thrown while comparing a block, if any. */
+  std::exception_ptr      m_error;
+  
+  /*! \brief Flag telling the comparer thread to exit without comparing the
+   *         blocks left in the queue. */
+  bool                    m_stopping;
+  
+  /*! \brief Data lock used to share state with the comparer thread. */
+  std::mutex              m_mutex;
+  
+  /*! \brief Condition used to signal changes to the queues. */
+  std::condition_variable m_condition;
+  
+  /*! \brief Handle for the comparer thread. */
+  std::thread             m_thread;
+};
+
+#endif /* defined(__COMPARE_PIPELINE_H__) */
@@ -0,0 +1,201 @@
+/*! \file
+ *  \brief File containing the implementation of \ref digest_manifest.
+ *  
+ *  File containing the implementation of \ref digest_manifest.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see digest_manifest
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-20
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "digest_manifest.h"
+#include <fstream>
+#include <iomanip>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+
+#define CRC32C_POLYNOMIAL 0x82F63B78u
+#define MANIFEST_TAG      "crc32c"
+
+using namespace std;
+
+
+
+/*!
+ *  \brief Builds the lookup table for the byte-wise CRC32C algorithm.
+ */
+static vector<unsigned int> build_crc32c_table()
+{
+  vector<unsigned int> table(256);
+  for (unsigned int i = 0; i < 256; ++i)
+  {
+    unsigned int crc = i;
+    for (unsigned int bit = 0; bit < 8; ++bit)
+    {
+      crc = (crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1);
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+
+
+digest_manifest::digest_manifest()
+  : m_size(0), m_block_size(DEFAULT_BLOCK_SIZE)
+{
+  // Nothing else to do
+}
+
+digest_manifest::digest_manifest(const unsigned char* data, unsigned int num_bytes, unsigned int block_size)
+  : m_size(num_bytes), m_block_size(block_size)
+{
+  if (block_size == 0)
+  {
+    throw std::invalid_argument("block size cannot be 0");
+  }
+  
+  m_digests.reserve((num_bytes + block_size - 1) / block_size);
+  for (unsigned int offset = 0; offset < num_bytes; offset += block_size)
+  {
+    unsigned int length = (num_bytes - offset > block_size ? block_size : num_bytes - offset);
+    m_digests.push_back(crc32c(data + offset, length));
+  }
+}
+
+
+
+digest_manifest digest_manifest::load(std::istream& fin)
+{
+  digest_manifest manifest;
+  string tag;
+  
+  fin >> tag >> manifest.m_block_size >> manifest.m_size;
+  if (!fin || tag != MANIFEST_TAG || manifest.m_block_size == 0)
+  {
+    throw std::runtime_error("Invalid digest manifest");
+  }
+  
+  unsigned int num_blocks = (manifest.m_size + manifest.m_block_size - 1) / manifest.m_block_size;
+  manifest.m_digests.resize(num_blocks);
+  for (unsigned int i = 0; i < num_blocks; ++i)
+  {
+    fin >> hex >> manifest.m_digests[i];
+  }
+  if (!fin)
+  {
+    throw std::runtime_error("Invalid digest manifest");
+  }
+  
+  return manifest;
+}
+
+void digest_manifest::save(std::ostream& fout) const
+{
+  fout << MANIFEST_TAG << " " << dec << m_block_size << " " << m_size << "\n";
+  for (unsigned int digest : m_digests)
+  {
+    fout << hex << setw(8) << setfill('0') << digest << "\n";
+  }
+  fout << dec;
+}
+
+std::string digest_manifest::path_for(const std::string& image_path)
+{
+  return image_path + "." MANIFEST_TAG;
+}
+
+std::shared_ptr<const digest_manifest> digest_manifest::load_for(const std::string& image_path)
+{
+  ifstream fimage(image_path.c_str(), ios::binary | ios::ate);
+  ifstream fmanifest(path_for(image_path).c_str());
+  if (!fimage.is_open() || !fmanifest.is_open())
+  {
+    return nullptr;
+  }
+  
+  shared_ptr<digest_manifest> manifest;
+  try
+  {
+    manifest = make_shared<digest_manifest>(load(fmanifest));
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    return nullptr;
+  }
+  
+  // Ignore manifests left over from an older version of the image
+  if ((streamoff) manifest->size() != (streamoff) fimage.tellg())
+  {
+    return nullptr;
+  }
+  return manifest;
+}
+
+unsigned int digest_manifest::crc32c(const unsigned char* data, unsigned int num_bytes)
+{
+  static const vector<unsigned int> table = build_crc32c_table();
+  
+  unsigned int crc = 0xFFFFFFFFu;
+  for (unsigned int i = 0; i < num_bytes; ++i)
+  {
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFFu;
+}
+
+
+
+unsigned int digest_manifest::size() const
+{
+  return m_size;
+}
+
+unsigned int digest_manifest::block_size() const
+{
+  return m_block_size;
+}
+
+unsigned int digest_manifest::num_blocks() const
+{
+  return (unsigned int) m_digests.size();
+}
+
+unsigned int digest_manifest::digest(unsigned int block_i) const
+{
+  return m_digests.at(block_i);
+}
+
+bool digest_manifest::matches(unsigned int offset, const unsigned char* data, unsigned int num_bytes, unsigned int* mismatch_offset) const
+{
+  if (offset > m_size || num_bytes > m_size - offset)
+  {
+    throw std::invalid_argument("range outside of image");
+  }
+  if (offset % m_block_size != 0 || (num_bytes % m_block_size != 0 && offset + num_bytes != m_size))
+  {
+    throw std::invalid_argument("range does not line up with manifest blocks");
+  }
+  
+  for (unsigned int i = 0; i < num_bytes; i += m_block_size)
+  {
+    unsigned int length = (num_bytes - i > m_block_size ? m_block_size : num_bytes - i);
+    if (crc32c(data + i, length) != m_digests[(offset + i) / m_block_size])
+    {
+      if (mismatch_offset != nullptr)
+      {
+        *mismatch_offset = offset + i;
+      }
+      return false;
+    }
+  }
+  
+  return true;
+}
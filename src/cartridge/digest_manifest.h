@@ -0,0 +1,178 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref digest_manifest class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref digest_manifest class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-20
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __DIGEST_MANIFEST_H__
+#define __DIGEST_MANIFEST_H__
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*! \class digest_manifest
+ *  \brief Class holding a CRC32C digest for every block of a game image.
+ *  
+ *  Class holding a CRC32C digest for every fixed-size block of a game image.
+ *  A manifest allows a cartridge to be verified against an image without
+ *  reading the image itself: each block read from the cartridge is hashed and
+ *  compared to the digest of the corresponding block of the image.
+ *  
+ *  Manifests are stored as text next to the image they describe, see
+ *  \ref path_for(const std::string&). The first line holds the word
+ *  **crc32c**, the block size, and the image size, followed by one line with
+ *  the hexadecimal digest of each block.
+ */
+class digest_manifest
+{
+public:
+  
+  /*!
+   *  \brief The default number of bytes covered by each digest.
+   *  
+   *  The default number of bytes covered by each digest. Matches the smallest
+   *  erase block found on supported cartridges so that the blocks read while
+   *  verifying always start on a digest boundary.
+   */
+  static const unsigned int DEFAULT_BLOCK_SIZE = 0x2000;
+  
+  
+  
+  /*!
+   *  \brief Constructs an empty manifest.
+   */
+                          digest_manifest();
+  
+  /*!
+   *  \brief Computes the manifest for an image in memory.
+   *  
+   *  \param [in] data Pointer to the start of the image.
+   *  \param [in] num_bytes The size of the image in bytes.
+   *  \param [in] block_size The number of bytes covered by each digest.
+   *  
+   *  \throws std::invalid_argument If **block_size** is 0.
+   */
+                          digest_manifest(const unsigned char* data, unsigned int num_bytes, unsigned int block_size = DEFAULT_BLOCK_SIZE);
+  
+  
+  
+  /*!
+   *  \brief Reads a manifest from a stream.
+   *  
+   *  \param [in,out] fin The stream to read from.
+   *  
+   *  \return The manifest.
+   *  
+   *  \throws std::runtime_error If the stream does not contain a valid manifest.
+   */
+  static digest_manifest  load(std::istream& fin);
+  
+  /*!
+   *  \brief Writes the manifest to a stream.
+   *  
+   *  \param [in,out] fout The stream to write to.
+   */
+  void                    save(std::ostream& fout) const;
+  
+  /*!
+   *  \brief Gets the path of the manifest that belongs to an image file.
+   *  
+   *  \param [in] image_path The path of the image file.
+   *  
+   *  \return The path of the image's manifest, which is the path of the image
+   *          with **.crc32c** appended.
+   */
+  static std::string      path_for(const std::string& image_path);
+  
+  /*!
+   *  \brief Loads the manifest that belongs to an image file, if any.
+   *  
+   *  Loads the manifest stored next to an image file, see
+   *  \ref path_for(const std::string&). The manifest is only used if it
+   *  describes an image of the same size as the image file.
+   *  
+   *  \param [in] image_path The path of the image file.
+   *  
+   *  \return The manifest, or **nullptr** if there is no usable manifest.
+   */
+  static std::shared_ptr<const digest_manifest> load_for(const std::string& image_path);
+  
+  /*!
+   *  \brief Computes the CRC32C (Castagnoli) checksum of a block of data.
+   *  
+   *  \param [in] data Pointer to the data.
+   *  \param [in] num_bytes The number of bytes of data.
+   *  
+   *  \return The checksum.
+   */
+  static unsigned int     crc32c(const unsigned char* data, unsigned int num_bytes);
+  
+  
+  
+  /*!
+   *  \brief Gets the size of the described image in bytes.
+   */
+  unsigned int            size() const;
+  
+  /*!
+   *  \brief Gets the number of bytes covered by each digest.
+   */
+  unsigned int            block_size() const;
+  
+  /*!
+   *  \brief Gets the number of digests in the manifest.
+   *  
+   *  Gets the number of digests in the manifest. The last digest may cover
+   *  fewer than \ref block_size() bytes.
+   */
+  unsigned int            num_blocks() const;
+  
+  /*!
+   *  \brief Gets the digest of a block of the image.
+   *  
+   *  \param [in] block_i The index of the block.
+   */
+  unsigned int            digest(unsigned int block_i) const;
+  
+  /*!
+   *  \brief Checks whether data matches a range of the described image.
+   *  
+   *  Checks whether data matches a range of the described image by hashing
+   *  it a block at a time. The range must start on a block boundary and end
+   *  either on a block boundary or at the end of the image.
+   *  
+   *  \param [in] offset The offset of the range within the image.
+   *  \param [in] data The data to check.
+   *  \param [in] num_bytes The length of the range in bytes.
+   *  \param [out] mismatch_offset (optional) Set to the offset of the first
+   *         block that did not match, if any.
+   *  
+   *  \return true if every block matched, false otherwise.
+   *  
+   *  \throws std::invalid_argument If the range is outside of the image or
+   *          does not line up with the blocks of the manifest.
+   */
+  bool                    matches(unsigned int offset, const unsigned char* data, unsigned int num_bytes, unsigned int* mismatch_offset = nullptr) const;
+  
+  
+  
+private:
+  
+  /*! \brief The size of the described image in bytes. */
+  unsigned int            m_size;
+  
+  /*! \brief The number of bytes covered by each digest. */
+  unsigned int            m_block_size;
+  
+  /*! \brief The digest of each block of the image. */
+  std::vector<unsigned int> m_digests;
+};
+
+#endif /* defined(__DIGEST_MANIFEST_H__) */
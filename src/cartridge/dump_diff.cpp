@@ -0,0 +1,160 @@
+/*! \file
+ *  \brief File containing the implementation of \ref dump_diff.
+ *  
+ *  File containing the implementation of \ref dump_diff.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see dump_diff
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-06
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "dump_diff.h"
+#include "cartridge_layout.h"
+#include "common/block_compare.h"
+#include <algorithm>
+
+using namespace std;
+
+
+
+dump_diff::dump_diff(const unsigned char* a, unsigned int a_size, const unsigned char* b, unsigned int b_size, unsigned int merge_gap)
+  : m_a(a), m_a_size(a_size), m_b(b), m_b_size(b_size), m_num_differing(0)
+{
+  if (merge_gap == 0)
+  {
+    merge_gap = 1;
+  }
+  
+  unsigned int common = min(a_size, b_size);
+  unsigned int offset = 0;
+  while (offset < common)
+  {
+    // Skip over the matching bytes a vector at a time
+    offset += find_first_difference(a + offset, b + offset, common - offset);
+    if (offset == common)
+    {
+      break;
+    }
+    
+    // Extend the range for as long as another difference follows within the
+    // gap
+    unsigned int end = offset + 1;
+    while (end < common)
+    {
+      unsigned int window = min(merge_gap, common - end);
+      unsigned int next = find_first_difference(a + end, b + end, window);
+      if (next == window)
+      {
+        break;
+      }
+      end += next + 1;
+    }
+    
+    range r;
+    r.offset = offset;
+    r.num_bytes = end - offset;
+    r.num_differing = count_differing(offset, end - offset);
+    m_num_differing += r.num_differing;
+    m_ranges.push_back(r);
+    offset = end;
+  }
+  
+  // Whatever only one of the images holds differs
+  unsigned int longest = max(a_size, b_size);
+  if (longest > common)
+  {
+    range r;
+    r.offset = common;
+    r.num_bytes = longest - common;
+    r.num_differing = longest - common;
+    m_num_differing += r.num_differing;
+    m_ranges.push_back(r);
+  }
+}
+
+
+
+bool dump_diff::identical() const
+{
+  return m_ranges.empty();
+}
+
+const std::vector<dump_diff::range>& dump_diff::ranges() const
+{
+  return m_ranges;
+}
+
+unsigned int dump_diff::num_differing() const
+{
+  return m_num_differing;
+}
+
+std::vector<dump_diff::block_change> dump_diff::changed_blocks(const cartridge_layout& layout) const
+{
+  vector<block_change> changes;
+  const cartridge_layout::block_entry* blocks = layout.blocks();
+  const cartridge_layout::block_entry* blocks_end = blocks + layout.num_blocks();
+  
+  for (const range& r : m_ranges)
+  {
+    // Find the first block ending past the start of the range
+    const cartridge_layout::block_entry* block = upper_bound(blocks, blocks_end, r.offset, [](unsigned int offset, const cartridge_layout::block_entry& b)
+    {
+      return offset < b.cartridge_address + b.num_bytes;
+    });
+    
+    unsigned int range_end = r.offset + r.num_bytes;
+    for (; block != blocks_end && block->cartridge_address < range_end; ++block)
+    {
+      unsigned int start = max(r.offset, block->cartridge_address);
+      unsigned int end = min(range_end, block->cartridge_address + block->num_bytes);
+      unsigned int num_differing = count_differing(start, end - start);
+      if (num_differing == 0)
+      {
+        continue;
+      }
+      
+      // Neighbouring ranges may fall in the same block
+      if (!changes.empty() && changes.back().chip_num == block->chip_num && changes.back().block_num == block->block_num)
+      {
+        changes.back().num_differing += num_differing;
+        continue;
+      }
+      
+      block_change change;
+      change.chip_num = block->chip_num;
+      change.block_num = block->block_num;
+      change.cartridge_address = block->cartridge_address;
+      change.num_bytes = block->num_bytes;
+      change.first_difference = start;
+      while (change.first_difference < end && change.first_difference < m_a_size && change.first_difference < m_b_size
+             && m_a[change.first_difference] == m_b[change.first_difference])
+      {
+        ++change.first_difference;
+      }
+      change.num_differing = num_differing;
+      changes.push_back(change);
+    }
+  }
+  return changes;
+}
+
+
+
+unsigned int dump_diff::count_differing(unsigned int offset, unsigned int num_bytes) const
+{
+  unsigned int count = 0;
+  for (unsigned int i = offset; i < offset + num_bytes; ++i)
+  {
+    if (i >= m_a_size || i >= m_b_size || m_a[i] != m_b[i])
+    {
+      ++count;
+    }
+  }
+  return count;
+}
@@ -0,0 +1,165 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref dump_diff class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref dump_diff class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-06
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __DUMP_DIFF_H__
+#define __DUMP_DIFF_H__
+
+#include <vector>
+
+class cartridge_layout;
+
+/*! \brief The default number of matching bytes between two differences below
+ *         which \ref dump_diff reports them as a single range. */
+#define DUMP_DIFF_DEFAULT_GAP 16
+
+
+
+/*! \class dump_diff
+ *  \brief Class finding the ranges in which two dumps of a cartridge differ.
+ *  
+ *  Class comparing two images, such as a dump of a cartridge and the image it
+ *  was flashed with, to diagnose bad cartridges and bad flashes. The images
+ *  are compared with \ref find_first_difference(), which skips over the
+ *  matching stretches a vector at a time, so that a pair of whole 4 MiB
+ *  images that mostly match is compared in a few milliseconds. Differences
+ *  separated by fewer matching bytes than a given gap are reported as one
+ *  range, so that a block of noise doesn't show up as thousands of ranges.
+ *  
+ *  The ranges can be placed onto the chips and blocks of a cartridge with
+ *  \ref changed_blocks(), which tells a run of differences confined to one
+ *  block, like an erase that failed, from differences spread over a whole
+ *  chip, like a chip that failed.
+ *  
+ *  Where one image is longer than the other, the bytes past the end of the
+ *  shorter one are reported as a range of their own.
+ *  
+ *  The images are not copied and must outlive the object.
+ */
+class dump_diff
+{
+public:
+  
+  /*!
+   *  \brief Struct describing a range in which the images differ.
+   */
+  struct range
+  {
+    /*! \brief The offset of the first byte of the range. */
+    unsigned int          offset;
+    
+    /*! \brief The number of bytes from the first to the last differing byte
+     *         of the range. */
+    unsigned int          num_bytes;
+    
+    /*! \brief The number of bytes in the range that differ. */
+    unsigned int          num_differing;
+  };
+  
+  /*!
+   *  \brief Struct describing a block of a cartridge in which the images
+   *         differ.
+   */
+  struct block_change
+  {
+    /*! \brief Index of the chip the block is on. */
+    unsigned int          chip_num;
+    
+    /*! \brief Index of the block on its chip. */
+    unsigned int          block_num;
+    
+    /*! \brief Address of the block relative to the start of the cartridge,
+     *         and so the offset of the block in the images. */
+    unsigned int          cartridge_address;
+    
+    /*! \brief Size of the block in bytes. */
+    unsigned int          num_bytes;
+    
+    /*! \brief The offset in the images of the first byte of the block that
+     *         differs. */
+    unsigned int          first_difference;
+    
+    /*! \brief The number of bytes of the block that differ. */
+    unsigned int          num_differing;
+  };
+  
+  
+  
+  /*!
+   *  \brief Class constructor. Compares two images.
+   *  
+   *  \param [in] a Pointer to the first image.
+   *  \param [in] a_size The number of bytes in the first image.
+   *  \param [in] b Pointer to the second image.
+   *  \param [in] b_size The number of bytes in the second image.
+   *  \param [in] merge_gap Differences separated by fewer matching bytes are
+   *         reported as a single range.
+   */
+                          dump_diff(const unsigned char* a, unsigned int a_size, const unsigned char* b, unsigned int b_size, unsigned int merge_gap = DUMP_DIFF_DEFAULT_GAP);
+  
+  
+  
+  /*!
+   *  \brief Checks whether the images are the same.
+   */
+  bool                    identical() const;
+  
+  /*!
+   *  \brief Gets every range in which the images differ, in order.
+   */
+  const std::vector<range>& ranges() const;
+  
+  /*!
+   *  \brief Gets the total number of bytes that differ, counting the bytes
+   *         past the end of the shorter image.
+   */
+  unsigned int            num_differing() const;
+  
+  /*!
+   *  \brief Places the differences onto the blocks of a cartridge.
+   *  
+   *  \param [in] layout The layout of the cartridge the images are of, as a
+   *         whole, starting at its first chip.
+   *  
+   *  \return Every block holding a difference, in order. Differences past the
+   *          end of the cartridge are left out.
+   */
+  std::vector<block_change> changed_blocks(const cartridge_layout& layout) const;
+
+
+
+private:
+  
+  /*!
+   *  \brief Counts the bytes that differ in part of the images, treating
+   *         bytes past the end of either as differing.
+   */
+  unsigned int            count_differing(unsigned int offset, unsigned int num_bytes) const;
+  
+  /*! \brief The first image. */
+  const unsigned char*    m_a;
+  
+  /*! \brief The number of bytes in the first image. */
+  unsigned int            m_a_size;
+  
+  /*! \brief The second image. */
+  const unsigned char*    m_b;
+  
+  /*! \brief The number of bytes in the second image. */
+  unsigned int            m_b_size;
+  
+  /*! \brief Every range in which the images differ, in order. */
+  std::vector<range>      m_ranges;
+  
+  /*! \brief The total number of bytes that differ. */
+  unsigned int            m_num_differing;
+};
+
+#endif /* defined(__DUMP_DIFF_H__) */
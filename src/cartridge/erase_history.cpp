@@ -0,0 +1,272 @@
+/*! \file
+ *  \brief File containing the implementation of \ref erase_history.
+ *  
+ *  File containing the implementation of \ref erase_history.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see erase_history
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-22
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "erase_history.h"
+#include "common/log.h"
+#include <sstream>
+#include <stdexcept>
+
+#define HISTORY_MAGIC       "flashmasta-erase-history 1"
+
+// The number of first erases averaged into the baseline of a block or chip
+#define BASELINE_SAMPLES    4
+
+// How far each erase moves the recent average towards its duration
+#define RECENT_WEIGHT       0.25
+
+// How much slower than its baseline a block must recently have been to count
+// as degraded
+#define DEGRADED_RATIO      1.5
+
+using namespace std;
+
+
+
+erase_history::erase_history(const std::string& path)
+  : m_path(path)
+{
+  // Load the erases recorded by earlier runs
+  bool valid = false;
+  {
+    ifstream fin(m_path.c_str());
+    string line;
+    if (fin.is_open() && getline(fin, line) && line == HISTORY_MAGIC)
+    {
+      valid = true;
+      while (getline(fin, line))
+      {
+        istringstream entry(line);
+        chip_key key;
+        long long block_address;
+        unsigned int milliseconds;
+        if (!(entry >> key.chip_num >> key.manufacturer_id >> key.device_id >> block_address >> milliseconds))
+        {
+          continue;
+        }
+        entry.get();
+        getline(entry, key.serial);
+        
+        chip_record& record = record_for(key);
+        add_sample(block_address < 0 ? record.chip_erases : record.blocks[(unsigned int) block_address], milliseconds);
+      }
+    }
+  }
+  
+  // Chips that were already slowing down have been reported before
+  for (auto& chip_pair : m_chips)
+  {
+    chip_pair.second.flagged = health_of(chip_pair.second).degrading;
+  }
+  
+  m_fout.open(m_path.c_str(), valid ? ios::app : ios::trunc);
+  if (!m_fout.is_open())
+  {
+    throw std::runtime_error("Unable to open file " + m_path);
+  }
+  if (!valid)
+  {
+    m_fout << HISTORY_MAGIC << "\n";
+    m_fout.flush();
+  }
+}
+
+erase_history::~erase_history()
+{
+  m_fout.close();
+}
+
+
+
+const std::string& erase_history::path() const
+{
+  return m_path;
+}
+
+void erase_history::record_block_erase(const chip_key& key, unsigned int block_address, unsigned int milliseconds)
+{
+  lock_guard<mutex> lock(m_mutex);
+  chip_record& record = record_for(key);
+  add_sample(record.blocks[block_address], milliseconds);
+  append(key, block_address, milliseconds);
+  check_degrading(record);
+}
+
+void erase_history::record_chip_erase(const chip_key& key, unsigned int milliseconds)
+{
+  lock_guard<mutex> lock(m_mutex);
+  chip_record& record = record_for(key);
+  add_sample(record.chip_erases, milliseconds);
+  append(key, -1, milliseconds);
+  check_degrading(record);
+}
+
+unsigned int erase_history::typical_block_erase_ms(const chip_key& key, unsigned int block_address, unsigned int fallback_ms)
+{
+  lock_guard<mutex> lock(m_mutex);
+  chip_record& record = record_for(key);
+  
+  auto it = record.blocks.find(block_address);
+  if (it != record.blocks.end() && it->second.count > 0)
+  {
+    return (unsigned int) it->second.recent_ms;
+  }
+  
+  // Blocks of the same chip that have been erased before are the next best
+  // guess
+  chip_health health = health_of(record);
+  return (health.num_block_erases > 0 ? (unsigned int) health.recent_block_ms : fallback_ms);
+}
+
+unsigned int erase_history::typical_chip_erase_ms(const chip_key& key, unsigned int fallback_ms)
+{
+  lock_guard<mutex> lock(m_mutex);
+  const erase_stats& stats = record_for(key).chip_erases;
+  return (stats.count > 0 ? (unsigned int) stats.recent_ms : fallback_ms);
+}
+
+erase_history::chip_health erase_history::get_chip_health(const chip_key& key)
+{
+  lock_guard<mutex> lock(m_mutex);
+  return health_of(record_for(key));
+}
+
+std::vector<erase_history::chip_health> erase_history::get_all_chip_health()
+{
+  lock_guard<mutex> lock(m_mutex);
+  vector<chip_health> health;
+  for (auto& chip_pair : m_chips)
+  {
+    if (!chip_pair.second.blocks.empty() || chip_pair.second.chip_erases.count > 0)
+    {
+      health.push_back(health_of(chip_pair.second));
+    }
+  }
+  return health;
+}
+
+
+
+erase_history::chip_record& erase_history::record_for(const chip_key& key)
+{
+  ostringstream name;
+  name << key.serial << "/" << key.chip_num << "/" << key.manufacturer_id << ":" << key.device_id;
+  
+  auto it = m_chips.find(name.str());
+  if (it == m_chips.end())
+  {
+    chip_record record;
+    record.key = key;
+    record.chip_erases.count = 0;
+    record.chip_erases.baseline_ms = 0.0;
+    record.chip_erases.recent_ms = 0.0;
+    record.flagged = false;
+    it = m_chips.insert(make_pair(name.str(), record)).first;
+  }
+  return it->second;
+}
+
+void erase_history::add_sample(erase_stats& stats, double milliseconds)
+{
+  // New blocks start out zeroed by the map
+  if (stats.count == 0)
+  {
+    stats.baseline_ms = milliseconds;
+    stats.recent_ms = milliseconds;
+  }
+  else
+  {
+    if (stats.count < BASELINE_SAMPLES)
+    {
+      stats.baseline_ms += (milliseconds - stats.baseline_ms) / (stats.count + 1);
+    }
+    stats.recent_ms += (milliseconds - stats.recent_ms) * RECENT_WEIGHT;
+  }
+  ++stats.count;
+}
+
+bool erase_history::is_degraded(const erase_stats& stats)
+{
+  return stats.count > BASELINE_SAMPLES && stats.recent_ms > stats.baseline_ms * DEGRADED_RATIO;
+}
+
+erase_history::chip_health erase_history::health_of(const chip_record& record)
+{
+  chip_health health;
+  health.key = record.key;
+  health.num_block_erases = 0;
+  health.num_chip_erases = record.chip_erases.count;
+  health.baseline_block_ms = 0.0;
+  health.recent_block_ms = 0.0;
+  health.slowest_block_address = 0;
+  health.slowest_block_ms = 0.0;
+  health.recent_chip_ms = record.chip_erases.recent_ms;
+  health.num_degraded_blocks = 0;
+  
+  unsigned int num_blocks = 0;
+  for (auto& block_pair : record.blocks)
+  {
+    const erase_stats& stats = block_pair.second;
+    if (stats.count == 0)
+    {
+      continue;
+    }
+    
+    ++num_blocks;
+    health.num_block_erases += stats.count;
+    health.baseline_block_ms += stats.baseline_ms;
+    health.recent_block_ms += stats.recent_ms;
+    if (stats.recent_ms > health.slowest_block_ms)
+    {
+      health.slowest_block_address = block_pair.first;
+      health.slowest_block_ms = stats.recent_ms;
+    }
+    if (is_degraded(stats))
+    {
+      ++health.num_degraded_blocks;
+    }
+  }
+  if (num_blocks > 0)
+  {
+    health.baseline_block_ms /= num_blocks;
+    health.recent_block_ms /= num_blocks;
+  }
+  
+  health.degrading = (health.num_degraded_blocks > 0 || is_degraded(record.chip_erases));
+  return health;
+}
+
+void erase_history::check_degrading(chip_record& record)
+{
+  bool degrading = health_of(record).degrading;
+  if (degrading && !record.flagged)
+  {
+    ostringstream message;
+    message << "Chip " << record.key.chip_num << " of the cartridge on device "
+            << record.key.serial << " is erasing slower than it used to";
+    log(log_level::INFO, message.str().c_str());
+  }
+  record.flagged = degrading;
+}
+
+void erase_history::append(const chip_key& key, long long block_address, unsigned int milliseconds)
+{
+  m_fout << key.chip_num << " " << key.manufacturer_id << " " << key.device_id << " "
+         << block_address << " " << milliseconds << " " << key.serial << "\n";
+  m_fout.flush();
+  if (!m_fout.good())
+  {
+    throw std::runtime_error("Unable to write to file " + m_path);
+  }
+}
@@ -0,0 +1,270 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref erase_history class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref erase_history class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-22
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __ERASE_HISTORY_H__
+#define __ERASE_HISTORY_H__
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*! \class erase_history
+ *  \brief Class keeping a persistent record of how long flash erases take.
+ *  
+ *  Class recording the duration of every block and chip erase waited on, for
+ *  each chip of each cartridge, in a small text file that survives between
+ *  runs. Every erase is appended to the file and flushed before moving on, so
+ *  the file stays valid even if the program is killed.
+ *  
+ *  Chips are told apart by the serial number of the device the cartridge is
+ *  plugged into along with the chip's index and IDs, see \ref chip_key. The
+ *  recorded durations are used to pace the polling of later erases of the
+ *  same blocks, see \ref erase_poller, to estimate erase times when planning
+ *  operations, and to flag chips whose erases are getting slower, which is
+ *  how worn flash memory shows before it starts failing.
+ *  
+ *  This class is thread-safe.
+ */
+class erase_history
+{
+public:
+  
+  /*!
+   *  \brief Struct identifying a single chip of a cartridge.
+   */
+  struct chip_key
+  {
+    /*! \brief The serial number of the device the cartridge is plugged into. */
+    std::string    serial;
+    
+    /*! \brief The index of the chip on the cartridge. */
+    unsigned int   chip_num;
+    
+    /*! \brief The id of the manufacturer of the chip. */
+    unsigned int   manufacturer_id;
+    
+    /*! \brief The id of the chip. */
+    unsigned int   device_id;
+  };
+  
+  /*!
+   *  \brief Struct summarizing the erase times of a single chip.
+   *  
+   *  Times are given both as a baseline, the average of the first erases
+   *  recorded, and as a recent average that follows the latest erases. A
+   *  block whose recent average has grown well past its baseline is counted
+   *  as degraded.
+   */
+  struct chip_health
+  {
+    /*! \brief The chip the summary is of. */
+    chip_key       key;
+    
+    /*! \brief The number of block erases recorded. */
+    unsigned int   num_block_erases;
+    
+    /*! \brief The number of whole-chip erases recorded. */
+    unsigned int   num_chip_erases;
+    
+    /*! \brief The average baseline block erase time in milliseconds. */
+    double         baseline_block_ms;
+    
+    /*! \brief The average recent block erase time in milliseconds. */
+    double         recent_block_ms;
+    
+    /*! \brief The address of the block with the slowest recent erases. */
+    unsigned int   slowest_block_address;
+    
+    /*! \brief The recent erase time of the slowest block in milliseconds. */
+    double         slowest_block_ms;
+    
+    /*! \brief The recent whole-chip erase time in milliseconds. */
+    double         recent_chip_ms;
+    
+    /*! \brief The number of blocks whose erases have slowed down. */
+    unsigned int   num_degraded_blocks;
+    
+    /*! \brief Whether any block, or the chip as a whole, has slowed down. */
+    bool           degrading;
+  };
+  
+  
+  
+  /*!
+   *  \brief Opens the history at the given path.
+   *  
+   *  Opens the history at the given path, loading the erases already recorded
+   *  there. Lines that can't be read, such as a partially written last line,
+   *  are skipped.
+   *  
+   *  \param [in] path The path of the history file.
+   *  
+   *  \throws std::runtime_error If the history file could not be written.
+   */
+  explicit                erase_history(const std::string& path);
+  
+  /*!
+   *  \brief Class destructor. Closes the history file.
+   */
+                          ~erase_history();
+  
+  
+  
+  /*!
+   *  \brief Gets the path of the history file.
+   */
+  const std::string&      path() const;
+  
+  /*!
+   *  \brief Records the erase of a block.
+   *  
+   *  \param [in] key The chip the block is on.
+   *  \param [in] block_address The address of the block relative to the start
+   *         of the chip.
+   *  \param [in] milliseconds How long the erase took.
+   *  
+   *  \throws std::runtime_error If the history file could not be written.
+   */
+  void                    record_block_erase(const chip_key& key, unsigned int block_address, unsigned int milliseconds);
+  
+  /*!
+   *  \brief Records the erase of a whole chip.
+   *  
+   *  \param [in] key The chip.
+   *  \param [in] milliseconds How long the erase took.
+   *  
+   *  \throws std::runtime_error If the history file could not be written.
+   */
+  void                    record_chip_erase(const chip_key& key, unsigned int milliseconds);
+  
+  /*!
+   *  \brief Gets how long erases of a block recently took.
+   *  
+   *  \param [in] key The chip the block is on.
+   *  \param [in] block_address The address of the block relative to the start
+   *         of the chip.
+   *  \param [in] fallback_ms The time to return if neither the block nor any
+   *         other block of the chip has been erased before.
+   *  
+   *  \return The recent erase time of the block in milliseconds, or of the
+   *          chip's blocks on average if the block has no history.
+   */
+  unsigned int            typical_block_erase_ms(const chip_key& key, unsigned int block_address, unsigned int fallback_ms);
+  
+  /*!
+   *  \brief Gets how long erases of a whole chip recently took.
+   *  
+   *  \param [in] key The chip.
+   *  \param [in] fallback_ms The time to return if the chip has not been
+   *         erased as a whole before.
+   */
+  unsigned int            typical_chip_erase_ms(const chip_key& key, unsigned int fallback_ms);
+  
+  /*!
+   *  \brief Gets a summary of the erase times of a chip.
+   *  
+   *  \param [in] key The chip.
+   *  
+   *  \return The summary, with every count 0 if the chip has no history.
+   */
+  chip_health             get_chip_health(const chip_key& key);
+  
+  /*!
+   *  \brief Gets a summary of the erase times of every chip with a history.
+   */
+  std::vector<chip_health> get_all_chip_health();
+
+
+
+private:
+  
+  /*!
+   *  \brief Struct containing a running summary of a series of erase times.
+   */
+  struct erase_stats
+  {
+    unsigned int          count;
+    double                baseline_ms;
+    double                recent_ms;
+  };
+  
+  /*!
+   *  \brief Struct containing everything recorded about a chip.
+   */
+  struct chip_record
+  {
+    chip_key              key;
+    std::map<unsigned int, erase_stats> blocks;
+    erase_stats           chip_erases;
+    bool                  flagged;
+  };
+  
+  /*!
+   *  \brief Gets the record of a chip, creating it if needed. Must be called
+   *         with the lock held.
+   */
+  chip_record&            record_for(const chip_key& key);
+  
+  /*!
+   *  \brief Adds an erase time to a running summary.
+   */
+  static void             add_sample(erase_stats& stats, double milliseconds);
+  
+  /*!
+   *  \brief Checks whether a series of erase times has slowed down.
+   */
+  static bool             is_degraded(const erase_stats& stats);
+  
+  /*!
+   *  \brief Summarizes a chip's record.
+   */
+  static chip_health      health_of(const chip_record& record);
+  
+  /*!
+   *  \brief Logs a chip that has just started to slow down. Must be called
+   *         with the lock held.
+   */
+  void                    check_degrading(chip_record& record);
+  
+  /*!
+   *  \brief Appends an erase to the history file. Must be called with the
+   *         lock held.
+   */
+  void                    append(const chip_key& key, long long block_address, unsigned int milliseconds);
+  
+  /*!
+   *  \brief Disabled copy constructor.
+   */
+                          erase_history(const erase_history& other) = delete;
+  
+  /*!
+   *  \brief Disabled copy assignment operator.
+   */
+  erase_history&          operator=(const erase_history& other) = delete;
+  
+  
+  
+  /*! \brief Path of the history file. */
+  const std::string       m_path;
+  
+  /*! \brief Stream the history is appended to. */
+  std::ofstream           m_fout;
+  
+  /*! \brief Everything recorded about each chip, by key. */
+  std::map<std::string, chip_record> m_chips;
+  
+  /*! \brief Mutex guarding every member. */
+  std::mutex              m_mutex;
+};
+
+#endif /* defined(__ERASE_HISTORY_H__) */
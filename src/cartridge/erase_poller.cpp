@@ -0,0 +1,67 @@
+/*! \file
+ *  \brief File containing the implementation of \ref erase_poller.
+ *  
+ *  File containing the implementation of \ref erase_poller.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see erase_poller
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-17
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "erase_poller.h"
+#include "task/task_controller.h"
+#include <thread>
+
+#define QUIET_PERIOD_PERCENT  75
+#define SLEEP_SLICE_MS        50
+#define MIN_BACKOFF_MS        2
+#define MAX_BACKOFF_MS        64
+
+using namespace std::chrono;
+
+
+
+erase_poller::erase_poller(time_point_t erase_start, unsigned int typical_time_ms)
+  : m_erase_start(erase_start), m_typical_time_ms(typical_time_ms),
+    m_backoff_ms(MIN_BACKOFF_MS)
+{
+  // Nothing else to do
+}
+
+void erase_poller::wait(task_controller* controller)
+{
+  unsigned int elapsed_ms = (unsigned int) duration_cast<milliseconds>(steady_clock::now() - m_erase_start).count();
+  unsigned int quiet_ms = m_typical_time_ms * QUIET_PERIOD_PERCENT / 100;
+  
+  unsigned int delay_ms;
+  if (elapsed_ms < quiet_ms)
+  {
+    // The chip almost certainly isn't done yet, so don't bother asking
+    delay_ms = quiet_ms - elapsed_ms;
+    if (delay_ms > SLEEP_SLICE_MS)
+    {
+      delay_ms = SLEEP_SLICE_MS;
+    }
+  }
+  else
+  {
+    delay_ms = m_backoff_ms;
+    m_backoff_ms *= 2;
+    if (m_backoff_ms > MAX_BACKOFF_MS)
+    {
+      m_backoff_ms = MAX_BACKOFF_MS;
+    }
+  }
+  
+  std::this_thread::sleep_for(milliseconds(delay_ms));
+  
+  if (controller != nullptr)
+  {
+    controller->on_task_update(task_status::RUNNING, 0);
+  }
+}
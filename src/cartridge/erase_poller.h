@@ -0,0 +1,87 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref erase_poller class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref erase_poller class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-17
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __ERASE_POLLER_H__
+#define __ERASE_POLLER_H__
+
+#include <chrono>
+
+class task_controller;
+
+/*! \class erase_poller
+ *  \brief Class for pacing the polling of a flash chip while it erases.
+ *  
+ *  Class for pacing the polling of a flash chip while it erases. Rather than
+ *  polling the chip in a tight loop, which costs a USB round trip per poll,
+ *  this class sleeps through most of the chip's typical erase time and then
+ *  polls with an exponentially increasing delay until the erase completes.
+ *  
+ *  \code
+ *  erase_poller poller(erase_start, 700);
+ *  while (chip->test_erasing())
+ *  {
+ *    poller.wait(controller);
+ *  }
+ *  \endcode
+ *  
+ *  This class is *not* thread-safe. Use caution when working in a multithreaded
+ *  environment.
+ */
+class erase_poller
+{
+public:
+  
+  /*! \brief Type used to represent points in time. */
+  typedef std::chrono::steady_clock::time_point time_point_t;
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  Class constructor. Initializes the poller to pace polls of an erase
+   *  operation that began at the given time and that is expected to take
+   *  roughly the given number of milliseconds.
+   *  
+   *  \param [in] erase_start The time at which the erase command was sent.
+   *  \param [in] typical_time_ms The typical duration of the erase operation
+   *         in milliseconds, usually taken from the chip's datasheet.
+   */
+  erase_poller(time_point_t erase_start, unsigned int typical_time_ms);
+  
+  /*!
+   *  \brief Blocks until the chip should next be polled.
+   *  
+   *  Blocks until the chip should next be polled. Until most of the typical
+   *  erase time has elapsed, this function sleeps in short slices. After that,
+   *  each call sleeps for twice as long as the previous one, up to a fixed
+   *  maximum.
+   *  
+   *  If a controller is supplied, it is sent a progress update of 0 once per
+   *  call so that any user interface remains responsive.
+   *  
+   *  \param [in,out] controller The controller to update. Can be nullptr.
+   */
+  void                    wait(task_controller* controller = nullptr);
+  
+  
+  
+private:
+  
+  /*! \brief The time at which the erase operation began. */
+  const time_point_t      m_erase_start;
+  
+  /*! \brief The typical duration of the erase operation in milliseconds. */
+  const unsigned int      m_typical_time_ms;
+  
+  /*! \brief The delay to use for the next poll once past the quiet period. */
+  unsigned int            m_backoff_ms;
+};
+
+#endif /* defined(__ERASE_POLLER_H__) */
@@ -0,0 +1,362 @@
+/*! \file
+ *  \brief File containing the implementation of \ref image_cache.
+ *  
+ *  File containing the implementation of \ref image_cache.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see image_cache
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-19
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "image_cache.h"
+#include "common/block_compare.h"
+#include "common/file_util.h"
+#include "common/mapped_file.h"
+#include "common/memory_budget.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+// First word of an image index, changed whenever the format changes so that
+// older indexes are rebuilt rather than misread
+#define IMAGE_INDEX_MAGIC  "fmidx2"
+#define IMAGE_INDEX_SUFFIX ".fmidx"
+
+using namespace std;
+
+
+
+const unsigned int image_cache::BLOCK_SIZE;
+
+
+
+image_cache::image::image(const std::string& path)
+  : m_path(path), m_file(make_shared<mapped_file>(path)), m_mtime(modification_time(path))
+{
+  // An image analysed before, even by an earlier run, is picked up as it was
+  long long mtime = m_mtime;
+  if (load_index(mtime))
+  {
+    return;
+  }
+  
+  const unsigned char* data = m_file->data();
+  unsigned int size = m_file->size();
+  m_manifest = make_shared<digest_manifest>(data, size, BLOCK_SIZE);
+  m_blank_blocks.reserve(m_manifest->num_blocks());
+  
+  for (unsigned int offset = 0; offset < size; offset += BLOCK_SIZE)
+  {
+    unsigned int length = (size - offset > BLOCK_SIZE ? BLOCK_SIZE : size - offset);
+    m_blank_blocks.push_back(::is_blank_block(data + offset, length));
+  }
+  
+  save_index(mtime);
+}
+
+std::string image_cache::image::index_path_for(const std::string& image_path)
+{
+  return image_path + IMAGE_INDEX_SUFFIX;
+}
+
+bool image_cache::image::load_index(long long mtime)
+{
+  if (mtime < 0)
+  {
+    return false;
+  }
+  
+  ifstream fin(index_path_for(m_path).c_str());
+  if (!fin.is_open())
+  {
+    return false;
+  }
+  
+  string magic;
+  long long index_mtime = -1;
+  unsigned long long index_size = 0;
+  string blank_flags;
+  fin >> magic >> index_mtime >> index_size >> blank_flags;
+  
+  // Ignore indexes left over from an older version of the image
+  if (!fin || magic != IMAGE_INDEX_MAGIC || index_mtime != mtime || index_size != m_file->size())
+  {
+    return false;
+  }
+  
+  shared_ptr<digest_manifest> manifest;
+  try
+  {
+    manifest = make_shared<digest_manifest>(digest_manifest::load(fin));
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    return false;
+  }
+  if (manifest->size() != m_file->size() || manifest->block_size() != BLOCK_SIZE
+      || manifest->num_blocks() != blank_flags.size())
+  {
+    return false;
+  }
+  
+  m_blank_blocks.clear();
+  m_blank_blocks.reserve(blank_flags.size());
+  for (char flag : blank_flags)
+  {
+    if (flag != '0' && flag != '1')
+    {
+      m_blank_blocks.clear();
+      return false;
+    }
+    m_blank_blocks.push_back(flag == '1');
+  }
+  m_manifest = manifest;
+  return true;
+}
+
+void image_cache::image::save_index(long long mtime) const
+{
+  if (mtime < 0)
+  {
+    return;
+  }
+  
+  // Every image has at least one block, so the flags are never an empty word
+  ostringstream sout;
+  sout << IMAGE_INDEX_MAGIC << " " << mtime << " " << m_file->size() << " ";
+  for (bool blank : m_blank_blocks)
+  {
+    sout << (blank ? '1' : '0');
+  }
+  sout << "\n";
+  m_manifest->save(sout);
+  
+  // Write to a temporary file first so that a run cut short never leaves a
+  // partial index behind. An image in a folder that can't be written to is
+  // just analysed again next time
+  string path = index_path_for(m_path);
+  string temp_path = path + ".tmp";
+  {
+    ofstream fout(temp_path.c_str(), ios::trunc);
+    if (!fout.is_open())
+    {
+      return;
+    }
+    fout << sout.str();
+    fout.flush();
+    if (!fout)
+    {
+      fout.close();
+      remove(temp_path.c_str());
+      return;
+    }
+  }
+  if (!replace_file(temp_path, path))
+  {
+    remove(temp_path.c_str());
+  }
+}
+
+const std::string& image_cache::image::path() const
+{
+  return m_path;
+}
+
+const unsigned char* image_cache::image::data() const
+{
+  return m_file->data();
+}
+
+unsigned int image_cache::image::size() const
+{
+  return m_file->size();
+}
+
+std::shared_ptr<const mapped_file> image_cache::image::file() const
+{
+  return m_file;
+}
+
+unsigned int image_cache::image::num_blocks() const
+{
+  return m_manifest->num_blocks();
+}
+
+std::shared_ptr<const digest_manifest> image_cache::image::manifest() const
+{
+  return m_manifest;
+}
+
+bool image_cache::image::is_blank(unsigned int offset, unsigned int num_bytes) const
+{
+  if (offset > size() || num_bytes > size() - offset)
+  {
+    throw std::invalid_argument("range outside of image");
+  }
+  
+  const unsigned char* data = m_file->data();
+  unsigned int end = offset + num_bytes;
+  
+  while (offset < end)
+  {
+    unsigned int block_i = offset / BLOCK_SIZE;
+    unsigned int block_end = (block_i + 1) * BLOCK_SIZE;
+    
+    if (offset % BLOCK_SIZE == 0 && (block_end <= end || end == size()))
+    {
+      // Whole block is in range, so use the summary
+      if (!m_blank_blocks[block_i])
+      {
+        return false;
+      }
+      offset = block_end;
+      continue;
+    }
+    
+    // Only part of the block is in range, so check the bytes themselves
+    unsigned int length = (end < block_end ? end : block_end) - offset;
+    if (!::is_blank_block(data + offset, length))
+    {
+      return false;
+    }
+    offset += length;
+  }
+  
+  return true;
+}
+
+
+
+image_cache::image_cache()
+  : m_budget(process_memory_budget()), m_reclaimer_id(0)
+{
+  if (m_budget != nullptr)
+  {
+    m_reclaimer_id = m_budget->add_reclaimer([this](unsigned long long num_bytes)
+    {
+      // Let go of the least recently used images until enough is freed
+      lock_guard<mutex> lock(m_mutex);
+      unsigned long long freed = 0;
+      while (freed < num_bytes && !m_retained.empty())
+      {
+        freed += m_retained.back()->size();
+        drop(--m_retained.end());
+      }
+    });
+  }
+}
+
+image_cache::~image_cache()
+{
+  if (m_budget != nullptr)
+  {
+    m_budget->remove_reclaimer(m_reclaimer_id);
+  }
+  
+  lock_guard<mutex> lock(m_mutex);
+  while (!m_retained.empty())
+  {
+    drop(m_retained.begin());
+  }
+}
+
+std::shared_ptr<const image_cache::image> image_cache::get(const std::string& path)
+{
+  // Hold the lock while loading so that concurrent jobs for the same file
+  // don't all load it at once
+  lock_guard<mutex> lock(m_mutex);
+  
+  auto it = m_images.find(path);
+  if (it != m_images.end())
+  {
+    shared_ptr<const image> cached = it->second.lock();
+    if (cached && cached->m_mtime == modification_time(path))
+    {
+      retain(cached);
+      return cached;
+    }
+    
+    // A kept image whose file has changed goes to make room for the new one
+    for (auto retained = m_retained.begin(); cached && retained != m_retained.end(); ++retained)
+    {
+      if (*retained == cached)
+      {
+        drop(retained);
+        break;
+      }
+    }
+  }
+  
+  shared_ptr<const image> loaded(new image(path));
+  
+  // Validate the image
+  if (loaded->size() == 0)
+  {
+    throw std::runtime_error("File is empty");
+  }
+  if (loaded->is_blank(0, loaded->size()))
+  {
+    throw std::runtime_error("File contains no data");
+  }
+  
+  // Forget about images nobody is using anymore while we're here
+  for (auto entry = m_images.begin(); entry != m_images.end();)
+  {
+    if (entry->second.expired())
+    {
+      entry = m_images.erase(entry);
+    }
+    else
+    {
+      ++entry;
+    }
+  }
+  
+  m_images[path] = loaded;
+  retain(loaded);
+  return loaded;
+}
+
+
+
+void image_cache::retain(const std::shared_ptr<const image>& img)
+{
+  if (m_budget == nullptr)
+  {
+    return;
+  }
+  
+  for (auto it = m_retained.begin(); it != m_retained.end(); ++it)
+  {
+    if (*it == img)
+    {
+      m_retained.splice(m_retained.begin(), m_retained, it);
+      return;
+    }
+  }
+  
+  // Older images make room for the new one, but the budget needed by jobs is
+  // never waited for
+  while (!m_budget->try_reserve(img->size()))
+  {
+    if (m_retained.empty())
+    {
+      return;
+    }
+    drop(--m_retained.end());
+  }
+  m_retained.push_front(img);
+}
+
+void image_cache::drop(std::list<std::shared_ptr<const image>>::iterator it)
+{
+  m_budget->release((*it)->size());
+  m_retained.erase(it);
+}
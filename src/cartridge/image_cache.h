@@ -0,0 +1,270 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref image_cache class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref image_cache class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-19
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __IMAGE_CACHE_H__
+#define __IMAGE_CACHE_H__
+
+#include "digest_manifest.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class mapped_file;
+class memory_budget;
+
+/*! \class image_cache
+ *  \brief Class that loads game images once and shares them between jobs.
+ *  
+ *  Class that loads game images once and shares them between jobs. When the
+ *  same file is flashed to several cartridges at once, every job gets the same
+ *  read-only \ref image_cache::image instead of reading the file again.
+ *  
+ *  Images are only cached for as long as someone holds on to them. Once the
+ *  last job using an image lets go of it, the next request for the same path
+ *  loads the file again. A request for an image whose file has changed since
+ *  it was loaded also loads it again, even while jobs still hold the old one.
+ *  
+ *  If a \ref process_memory_budget() is set when the cache is made, images
+ *  are also kept after the last job lets go of them, for as long as the
+ *  budget has room for them, so that a manifest flashing the same few images
+ *  over and over doesn't keep reading and indexing them. The least recently
+ *  used images are let go first whenever the budget runs short.
+ *  
+ *  This class is thread-safe.
+ */
+class image_cache
+{
+public:
+  
+  /*!
+   *  \brief The number of bytes covered by each precomputed block summary.
+   *  
+   *  The number of bytes covered by each digest of \ref image::manifest() and
+   *  each blank flag used by \ref image::is_blank(unsigned int, unsigned int). Matches the smallest erase
+   *  block found on supported cartridges so that any block boundary on a
+   *  chip falls on a summary boundary.
+   */
+  static const unsigned int BLOCK_SIZE = digest_manifest::DEFAULT_BLOCK_SIZE;
+  
+  /*! \class image
+   *  \brief An immutable, validated game image with precomputed summaries.
+   *  
+   *  An immutable, validated game image mapped into memory, along with a
+   *  \ref digest_manifest and a blank flag for every \ref BLOCK_SIZE bytes of
+   *  the image. Instances
+   *  can only be created by \ref image_cache and can be used from several
+   *  threads at once.
+   *  
+   *  The summaries are kept in an index next to the image, see
+   *  \ref index_path_for(const std::string&), so that an image analysed once
+   *  is ready right away the next time it is loaded, even by another run. The
+   *  index is only used if it was written for an image of the same size and
+   *  modification time, to the nanosecond where the file system keeps it, and
+   *  is skipped if it can't be written.
+   */
+  class image
+  {
+  public:
+    
+    /*!
+     *  \brief Gets the path the image was loaded from.
+     */
+    const std::string&    path() const;
+    
+    /*!
+     *  \brief Gets a pointer to the start of the image in memory.
+     */
+    const unsigned char*  data() const;
+    
+    /*!
+     *  \brief Gets the size of the image in bytes.
+     */
+    unsigned int          size() const;
+    
+    /*!
+     *  \brief Gets the mapped file backing the image.
+     *  
+     *  Gets the mapped file backing the image, e.g. to pass to
+     *  \ref device_job_scheduler::submit_flash_job(unsigned int, std::shared_ptr<const mapped_file>, int).
+     */
+    std::shared_ptr<const mapped_file> file() const;
+    
+    /*!
+     *  \brief Gets the number of block summaries.
+     *  
+     *  Gets the number of \ref BLOCK_SIZE blocks in the image. The last block
+     *  may be shorter than \ref BLOCK_SIZE.
+     */
+    unsigned int          num_blocks() const;
+    
+    /*!
+     *  \brief Gets the digest manifest of the image.
+     *  
+     *  Gets the digest manifest of the image, e.g. to verify a batch of
+     *  cartridges without comparing against the image itself.
+     */
+    std::shared_ptr<const digest_manifest> manifest() const;
+    
+    /*!
+     *  \brief Gets whether every byte of a range of the image is 0xFF.
+     *  
+     *  Gets whether every byte of a range of the image is 0xFF. Blocks that
+     *  are entirely inside the range are looked up in the precomputed
+     *  summaries. Only the bytes of partially covered blocks are examined.
+     *  
+     *  \param [in] offset The offset of the first byte of the range.
+     *  \param [in] num_bytes The number of bytes in the range.
+     *  
+     *  \return true if the range is blank, false otherwise.
+     */
+    bool                  is_blank(unsigned int offset, unsigned int num_bytes) const;
+    
+    /*!
+     *  \brief Gets the path of the index that belongs to an image file.
+     *  
+     *  \param [in] image_path The path of the image file.
+     *  
+     *  \return The path of the image's index, which is the path of the image
+     *          with **.fmidx** appended.
+     */
+    static std::string    index_path_for(const std::string& image_path);
+    
+    
+    
+  private:
+    
+    friend class image_cache;
+    
+    /*!
+     *  \brief Class constructor.
+     *  
+     *  Class constructor. Maps the file and computes the block summaries.
+     *  
+     *  \param [in] path The path of the file to load.
+     */
+                          image(const std::string& path);
+    
+    /*!
+     *  \brief Loads the summaries from the image's index.
+     *  
+     *  \param [in] mtime The modification time of the image file.
+     *  
+     *  \return true if the index was usable, false otherwise.
+     */
+    bool                  load_index(long long mtime);
+    
+    /*!
+     *  \brief Writes the summaries to the image's index, if possible.
+     *  
+     *  \param [in] mtime The modification time of the image file.
+     */
+    void                  save_index(long long mtime) const;
+    
+    /*! \brief Disabled copy constructor. */
+                          image(const image& other) = delete;
+    
+    /*! \brief Disabled copy assignment operator. */
+    image&                operator=(const image& other) = delete;
+    
+    
+    
+    /*! \brief The path the image was loaded from. */
+    std::string           m_path;
+    
+    /*! \brief The mapped file backing the image. */
+    std::shared_ptr<const mapped_file> m_file;
+    
+    /*! \brief Digest of every block of the image. */
+    std::shared_ptr<const digest_manifest> m_manifest;
+    
+    /*! \brief Flags indicating which blocks of the image are blank. */
+    std::vector<bool>     m_blank_blocks;
+    
+    /*! \brief Modification time of the file when it was loaded, or -1 if
+     *         unknown. */
+    long long             m_mtime;
+  };
+  
+  
+  
+  /*!
+   *  \brief Class constructor.
+   */
+                          image_cache();
+  
+  /*!
+   *  \brief Class destructor. Lets go of the images kept for the budget.
+   */
+                          ~image_cache();
+  
+  
+  
+  /*!
+   *  \brief Gets the image for the file at the given path.
+   *  
+   *  Gets the image for the file at the given path, loading and validating it
+   *  if no one is using it yet. Concurrent requests for the same path that
+   *  arrive while the file is being loaded wait for it and share the result.
+   *  
+   *  \param [in] path The path of the file.
+   *  
+   *  \return The shared image.
+   *  
+   *  \throws std::runtime_error If the file could not be mapped, is empty, or
+   *          contains nothing but blank bytes.
+   */
+  std::shared_ptr<const image> get(const std::string& path);
+  
+  
+  
+private:
+  
+  /*! \brief Disabled copy constructor. */
+                          image_cache(const image_cache& other) = delete;
+  
+  /*! \brief Disabled copy assignment operator. */
+  image_cache&            operator=(const image_cache& other) = delete;
+  
+  /*!
+   *  \brief Keeps an image for the budget, as the most recently used one.
+   *         Must be called with \ref m_mutex held.
+   */
+  void                    retain(const std::shared_ptr<const image>& img);
+  
+  /*!
+   *  \brief Lets go of a kept image. Must be called with \ref m_mutex held.
+   */
+  void                    drop(std::list<std::shared_ptr<const image>>::iterator it);
+  
+  
+  
+  /*! \brief Images currently in use, indexed by path. */
+  std::map<std::string, std::weak_ptr<const image>> m_images;
+  
+  /*! \brief Images kept for the budget, most recently used first. */
+  std::list<std::shared_ptr<const image>> m_retained;
+  
+  /*! \brief Mutex guarding \ref m_images and \ref m_retained. */
+  std::mutex              m_mutex;
+  
+  /*! \brief The budget kept images are charged to, or **nullptr** if images
+   *         aren't kept. */
+  memory_budget* const    m_budget;
+  
+  /*! \brief The ID of the reclaimer letting go of kept images. */
+  unsigned int            m_reclaimer_id;
+};
+
+#endif /* defined(__IMAGE_CACHE_H__) */
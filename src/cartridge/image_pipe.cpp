@@ -0,0 +1,126 @@
+/*! \file
+ *  \brief File containing the implementation of \ref image_pipe.
+ *  
+ *  File containing the implementation of \ref image_pipe.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see image_pipe
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "image_pipe.h"
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+image_pipe::image_pipe(unsigned int num_bytes)
+  : m_data(num_bytes), m_filled(0), m_closed(false), m_abandoned(false),
+    m_buf(this), m_output(&m_buf)
+{
+  // Nothing else to do
+}
+
+
+
+unsigned int image_pipe::size() const
+{
+  return (unsigned int) m_data.size();
+}
+
+std::ostream& image_pipe::output()
+{
+  return m_output;
+}
+
+void image_pipe::close(const std::string& error)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_closed = true;
+  if (m_filled < m_data.size())
+  {
+    m_error = (error.empty() ? "Source stopped before the end of the image" : error);
+  }
+  m_condition.notify_all();
+}
+
+void image_pipe::abandon()
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_abandoned = true;
+  m_condition.notify_all();
+}
+
+const unsigned char* image_pipe::wait_for(unsigned int offset, unsigned int num_bytes)
+{
+  if (offset > m_data.size() || num_bytes > m_data.size() - offset)
+  {
+    throw runtime_error("Read past the end of the image");
+  }
+  
+  unique_lock<mutex> lock(m_mutex);
+  m_condition.wait(lock, [this, offset, num_bytes] { return m_closed || m_filled >= offset + num_bytes; });
+  if (m_filled < offset + num_bytes)
+  {
+    throw runtime_error(m_error);
+  }
+  
+  // Written bytes are never touched again, so they can be read unlocked
+  return m_data.data() + offset;
+}
+
+
+
+unsigned int image_pipe::write(const unsigned char* data, unsigned int num_bytes)
+{
+  unsigned int offset;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    if (m_abandoned || m_closed)
+    {
+      return 0;
+    }
+    offset = m_filled;
+  }
+  
+  // Only the writer moves the end, so copy outside the lock
+  if (num_bytes > m_data.size() - offset)
+  {
+    num_bytes = (unsigned int) m_data.size() - offset;
+  }
+  memcpy(m_data.data() + offset, data, num_bytes);
+  
+  lock_guard<mutex> lock(m_mutex);
+  m_filled = offset + num_bytes;
+  m_condition.notify_all();
+  return num_bytes;
+}
+
+
+
+image_pipe::pipe_buf::pipe_buf(image_pipe* pipe)
+  : m_pipe(pipe)
+{
+  // Nothing else to do
+}
+
+std::streamsize image_pipe::pipe_buf::xsputn(const char* s, std::streamsize n)
+{
+  return m_pipe->write((const unsigned char*) s, (unsigned int) n);
+}
+
+image_pipe::pipe_buf::int_type image_pipe::pipe_buf::overflow(int_type c)
+{
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+  {
+    return traits_type::not_eof(c);
+  }
+  
+  unsigned char byte = (unsigned char) traits_type::to_char_type(c);
+  return (m_pipe->write(&byte, 1) == 1 ? c : traits_type::eof());
+}
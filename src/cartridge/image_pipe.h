@@ -0,0 +1,155 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref image_pipe class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref image_pipe class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __IMAGE_PIPE_H__
+#define __IMAGE_PIPE_H__
+
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/*! \class image_pipe
+ *  \brief Class passing a game image from one thread to another as it is
+ *         written.
+ *  
+ *  Class holding a game image of a known size in memory while one thread
+ *  writes it in order through \ref output() and another reads it through a
+ *  \ref rom_image. A read of a part of the image that hasn't been written yet
+ *  blocks until it has, so a cartridge can be programmed from an image while
+ *  the image is still being backed up from another cartridge.
+ *  
+ *  The whole image is kept so that the reader may read its blocks in any
+ *  order, e.g. to program two chips at once. Its size is bounded by the size
+ *  of a cartridge.
+ *  
+ *  This class is thread-safe.
+ */
+class image_pipe
+{
+public:
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in] num_bytes The size of the image.
+   */
+  explicit                image_pipe(unsigned int num_bytes);
+  
+  
+  
+  /*!
+   *  \brief Gets the size of the image in bytes.
+   */
+  unsigned int            size() const;
+  
+  /*!
+   *  \brief Gets the stream the image is written through.
+   *  
+   *  Bytes past the end of the image are refused, putting the stream in a
+   *  failed state, as is everything once \ref abandon() has been called.
+   */
+  std::ostream&           output();
+  
+  /*!
+   *  \brief Marks the writer as finished.
+   *  
+   *  Called once the writer has stopped, whether it wrote the whole image or
+   *  not. Readers waiting for bytes that will now never be written are woken
+   *  up and fail.
+   *  
+   *  \param [in] error Description of why the writer stopped early, if it
+   *         did.
+   */
+  void                    close(const std::string& error = "");
+  
+  /*!
+   *  \brief Marks the reader as finished.
+   *  
+   *  Called when the reader stops early so that the writer fails on its next
+   *  write rather than filling an image nobody will read.
+   */
+  void                    abandon();
+  
+  /*!
+   *  \brief Waits until a range of the image has been written.
+   *  
+   *  \param [in] offset The offset of the range from the start of the image.
+   *  \param [in] num_bytes The number of bytes in the range.
+   *  
+   *  \return Pointer to the bytes of the range, which stay valid for the
+   *          lifetime of the pipe.
+   *  
+   *  \throws std::runtime_error If the writer stopped before writing the
+   *          range.
+   */
+  const unsigned char*    wait_for(unsigned int offset, unsigned int num_bytes);
+
+
+
+private:
+  
+  /*!
+   *  \brief Stream buffer writing straight into the image.
+   */
+  class pipe_buf: public std::streambuf
+  {
+  public:
+    explicit              pipe_buf(image_pipe* pipe);
+  
+  protected:
+    std::streamsize       xsputn(const char* s, std::streamsize n);
+    int_type              overflow(int_type c);
+  
+  private:
+    image_pipe*           m_pipe;
+  };
+  
+  /*!
+   *  \brief Appends bytes to the image.
+   *  
+   *  \return The number of bytes appended.
+   */
+  unsigned int            write(const unsigned char* data, unsigned int num_bytes);
+  
+  
+  
+  /*! \brief The image. */
+  std::vector<unsigned char> m_data;
+  
+  /*! \brief The number of bytes written so far. */
+  unsigned int            m_filled;
+  
+  /*! \brief Whether the writer has finished. */
+  bool                    m_closed;
+  
+  /*! \brief Whether the reader has stopped early. */
+  bool                    m_abandoned;
+  
+  /*! \brief Why the writer stopped early, if it did. */
+  std::string             m_error;
+  
+  /*! \brief Mutex guarding the progress of the image. */
+  std::mutex              m_mutex;
+  
+  /*! \brief Signalled each time bytes are written or either side stops. */
+  std::condition_variable m_condition;
+  
+  /*! \brief The stream buffer behind \ref m_output. */
+  pipe_buf                m_buf;
+  
+  /*! \brief The stream the image is written through. */
+  std::ostream            m_output;
+};
+
+#endif /* defined(__IMAGE_PIPE_H__) */
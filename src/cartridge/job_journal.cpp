@@ -0,0 +1,154 @@
+/*! \file
+ *  \brief File containing the implementation of \ref job_journal.
+ *  
+ *  File containing the implementation of \ref job_journal.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see job_journal
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "job_journal.h"
+
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+
+#define JOURNAL_MAGIC "flashmasta-journal 1"
+
+using namespace std;
+
+
+
+job_journal::job_journal(const std::string& path, const std::string& description)
+  : m_path(path), m_description(description), m_resumed(false)
+{
+  // Load progress left behind by an earlier attempt at the same operation
+  ifstream fin(m_path.c_str());
+  string magic;
+  string line;
+  if (fin.is_open() && getline(fin, magic) && magic == JOURNAL_MAGIC
+      && getline(fin, line) && line == m_description)
+  {
+    // A partially written last line is simply ignored
+    while (getline(fin, line))
+    {
+      istringstream entry(line);
+      unsigned int offset;
+      unsigned int num_bytes;
+      if (!(entry >> offset >> num_bytes))
+      {
+        break;
+      }
+      if (m_completed[offset] < num_bytes)
+      {
+        m_completed[offset] = num_bytes;
+      }
+    }
+    m_resumed = !m_completed.empty();
+  }
+  fin.close();
+  
+  if (m_resumed)
+  {
+    m_fout.open(m_path.c_str(), ios::app);
+    if (!m_fout.is_open())
+    {
+      throw std::runtime_error("Unable to open file " + m_path);
+    }
+  }
+  else
+  {
+    rewrite();
+  }
+}
+
+job_journal::~job_journal()
+{
+  m_fout.close();
+}
+
+
+
+const std::string& job_journal::path() const
+{
+  return m_path;
+}
+
+bool job_journal::resumed() const
+{
+  return m_resumed;
+}
+
+bool job_journal::is_complete(unsigned int offset, unsigned int num_bytes) const
+{
+  auto it = m_completed.find(offset);
+  return (it != m_completed.end() && it->second >= num_bytes);
+}
+
+unsigned int job_journal::completed_bytes() const
+{
+  unsigned int num_bytes = 0;
+  for (auto& entry : m_completed)
+  {
+    if (entry.first > num_bytes)
+    {
+      break;
+    }
+    if (entry.first + entry.second > num_bytes)
+    {
+      num_bytes = entry.first + entry.second;
+    }
+  }
+  return num_bytes;
+}
+
+void job_journal::mark_complete(unsigned int offset, unsigned int num_bytes)
+{
+  if (is_complete(offset, num_bytes))
+  {
+    return;
+  }
+  
+  m_completed[offset] = num_bytes;
+  m_fout << offset << ' ' << num_bytes << '\n';
+  m_fout.flush();
+  if (!m_fout.good())
+  {
+    throw std::runtime_error("Unable to write to file " + m_path);
+  }
+}
+
+void job_journal::clear()
+{
+  m_completed.clear();
+  m_resumed = false;
+  rewrite();
+}
+
+void job_journal::discard()
+{
+  m_fout.close();
+  remove(m_path.c_str());
+}
+
+
+
+void job_journal::rewrite()
+{
+  m_fout.close();
+  m_fout.clear();
+  m_fout.open(m_path.c_str(), ios::trunc);
+  if (!m_fout.is_open())
+  {
+    throw std::runtime_error("Unable to open file " + m_path);
+  }
+  
+  m_fout << JOURNAL_MAGIC << '\n' << m_description << '\n';
+  m_fout.flush();
+}
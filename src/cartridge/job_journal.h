@@ -0,0 +1,168 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref job_journal class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref job_journal class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __JOB_JOURNAL_H__
+#define __JOB_JOURNAL_H__
+
+#include <fstream>
+#include <map>
+#include <string>
+
+/*! \class job_journal
+ *  \brief Class recording which blocks of a backup or restore have completed.
+ *  
+ *  Class recording which blocks of a long-running backup or restore have
+ *  completed so that the operation can pick up where it left off if it is
+ *  interrupted. Every completed block is appended to a small text file and
+ *  flushed before moving on, so the file stays valid even if the program is
+ *  killed.
+ *  
+ *  The first lines of the file identify the operation, see
+ *  \ref job_journal(const std::string&, const std::string&). A journal left
+ *  behind by a different operation on the same file is discarded rather than
+ *  resumed.
+ *  
+ *  \code
+ *  job_journal journal(image_path + ".journal", description);
+ *  cart->set_journal(&journal);
+ *  cart->restore_cartridge_game_data(fin, slot, controller);
+ *  cart->set_journal(nullptr);
+ *  journal.discard();
+ *  \endcode
+ */
+class job_journal
+{
+public:
+  
+  /*!
+   *  \brief Opens the journal at the given path.
+   *  
+   *  Opens the journal at the given path. If a journal already exists there
+   *  and was written for an operation with the same description, then its
+   *  completed blocks are loaded and \ref resumed() returns true. Otherwise,
+   *  the file is replaced with an empty journal for the given description.
+   *  
+   *  \param [in] path The path of the journal file.
+   *  \param [in] description A single line identifying the operation, such as
+   *         its type, the slot, and the size and checksum of the image.
+   *         Operations with equal descriptions must process the same blocks.
+   *  
+   *  \throws std::runtime_error If the journal file could not be written.
+   */
+                          job_journal(const std::string& path, const std::string& description);
+  
+  /*!
+   *  \brief Class destructor. Closes the journal file, leaving it in place.
+   */
+                          ~job_journal();
+  
+  
+  
+  /*!
+   *  \brief Gets the path of the journal file.
+   */
+  const std::string&      path() const;
+  
+  /*!
+   *  \brief Gets whether progress from an earlier attempt was loaded.
+   *  
+   *  \return true if at least one completed block was loaded from an existing
+   *          journal, false otherwise.
+   */
+  bool                    resumed() const;
+  
+  /*!
+   *  \brief Checks whether a block has been completed.
+   *  
+   *  \param [in] offset The offset of the block in the image.
+   *  \param [in] num_bytes The size of the block in bytes.
+   *  
+   *  \return true if a block starting at the given offset and covering at
+   *          least the given number of bytes was marked complete.
+   */
+  bool                    is_complete(unsigned int offset, unsigned int num_bytes) const;
+  
+  /*!
+   *  \brief Gets the number of bytes completed without gaps from offset 0.
+   *  
+   *  Gets the number of bytes completed without gaps from offset 0. Used by
+   *  operations such as backups that write their output in order.
+   *  
+   *  \return The number of contiguous bytes completed from the start.
+   */
+  unsigned int            completed_bytes() const;
+  
+  /*!
+   *  \brief Marks a block as completed and records it in the journal file.
+   *  
+   *  \param [in] offset The offset of the block in the image.
+   *  \param [in] num_bytes The size of the block in bytes.
+   *  
+   *  \throws std::runtime_error If the journal file could not be written.
+   */
+  void                    mark_complete(unsigned int offset, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Forgets all completed blocks.
+   *  
+   *  Forgets all completed blocks, such as when the output of a backup being
+   *  resumed has gone missing.
+   *  
+   *  \throws std::runtime_error If the journal file could not be written.
+   */
+  void                    clear();
+  
+  /*!
+   *  \brief Closes and deletes the journal file.
+   *  
+   *  Closes and deletes the journal file. Called once the operation has
+   *  completed successfully. The journal must not be used afterwards.
+   */
+  void                    discard();
+  
+  
+  
+private:
+  
+  /*!
+   *  \brief Replaces the journal file with one holding only the header.
+   */
+  void                    rewrite();
+  
+  /*!
+   *  \brief Disabled copy constructor.
+   */
+                          job_journal(const job_journal& other) = delete;
+  
+  /*!
+   *  \brief Disabled copy assignment operator.
+   */
+  job_journal&            operator=(const job_journal& other) = delete;
+  
+  
+  
+  /*! \brief Path of the journal file. */
+  const std::string       m_path;
+  
+  /*! \brief Line identifying the operation being journaled. */
+  const std::string       m_description;
+  
+  /*! \brief Stream the journal is appended to. */
+  std::ofstream           m_fout;
+  
+  /*! \brief Completed blocks, mapping each offset to its size in bytes. */
+  std::map<unsigned int, unsigned int> m_completed;
+  
+  /*! \brief Flag indicating that progress was loaded from an existing file. */
+  bool                    m_resumed;
+};
+
+#endif /* defined(__JOB_JOURNAL_H__) */
@@ -18,15 +18,47 @@
 #include "ngp_cartridge.h"
 #include "linkmasta/linkmasta_device.h"
 #include "ngp_chip.h"
+#include "write_pipeline.h"
+#include "compare_pipeline.h"
+#include "block_mismatch_map.h"
+#include "slot_table.h"
+#include "restore_plan.h"
+#include "rom_image.h"
+#include "digest_manifest.h"
+#include "job_journal.h"
+#include "block_retry.h"
+#include "block_walk.h"
+#include "common/block_compare.h"
+#include "common/hash_stream.h"
+#include "common/log.h"
 #include "task/task_controller.h"
 #include "task/forwarding_task_controller.h"
+#include <algorithm>
 #include <iostream>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
 
 using namespace std;
 
 #define DEFAULT_BLOCK_SIZE 0x10000
+#define STREAM_READ_SIZE   0x80000
 #define NGF_HEADER_VERSION 0x0053
 
+// Sparse save files have the same layout, except that blank blocks have a
+// block header with no data. The header's byte count is still that of the
+// equivalent standard file
+#define NGF_SPARSE_HEADER_VERSION 0x0153
+
+#define VERIFY_MAX_RETRIES            2
+
+// Bytes of the game header, at the start of the first chip, covered by a
+// cartridge's fingerprint
+#define FINGERPRINT_HEADER_BYTES      64
+
 struct NGFheader
 {
   uint16_t version;
@@ -40,11 +72,141 @@ struct NGFblock
   uint32_t num_bytes;
 };
 
+struct restore_job
+{
+  unsigned int base_address;
+  unsigned int file_offset;
+  unsigned int num_bytes;
+  bool         prepared;
+  bool         compared;
+  bool         needs_erase;
+  bool         needs_program;
+  bool         blank_known;
+  bool         blank;
+};
+
+// Cartridge descriptors that have already been built, keyed on the
+// manufacturer id, device id, and factoryProt value of each chip in order
+typedef std::vector<unsigned int> descriptor_cache_key;
+static std::map<descriptor_cache_key, std::shared_ptr<const cartridge_descriptor>> descriptor_cache;
+static std::mutex descriptor_cache_mutex;
+
+// Unprotected blocks of known official cartridges, keyed on the game id and
+// version in the cartridge header
+struct known_cartridge
+{
+  unsigned int num_chips;
+  unsigned int num_bytes;
+  std::vector<ngp_cartridge::known_block> unprotected_blocks;
+};
+static std::map<unsigned int, known_cartridge> known_cartridges;
+static std::mutex known_cartridges_mutex;
+
+// Regions each game saves to, keyed on the game id and version in the
+// cartridge header
+static std::map<unsigned int, std::vector<ngp_cartridge::save_region>> game_save_regions;
+static std::mutex game_save_regions_mutex;
+
+// Gets the number of blocks on a chip of the given size. (1 block per 64 Kib
+// (8 KiB), with the last block split into 4)
+static unsigned int chip_num_blocks(unsigned int num_bytes)
+{
+  unsigned int num_blocks = num_bytes / DEFAULT_BLOCK_SIZE;
+  if (num_blocks > 0)
+  {
+    num_blocks += 3;
+  }
+  return num_blocks;
+}
+
+// Creates the descriptor of a block on a chip with the given number of blocks,
+// with its protection status left for the caller to fill in
+static cartridge_descriptor::chip_descriptor::block_descriptor* make_block_descriptor(unsigned int num_blocks, unsigned int block_i)
+{
+  // Initialize block descriptor
+  cartridge_descriptor::chip_descriptor::block_descriptor* block;
+  block = new cartridge_descriptor::chip_descriptor::block_descriptor();
+  block->block_num = block_i;
+  block->is_protected = false;
+  
+  // Determine size of block based on index of block relative to total number
+  // of blocks on chip
+  switch (num_blocks - block_i)
+  {
+  case 1:    // Last block on chip
+    block->num_bytes = DEFAULT_BLOCK_SIZE / 4;
+    break;
+    
+  case 2:    // Second-last block on chip
+  case 3:    // Third-last block on chip
+    block->num_bytes = DEFAULT_BLOCK_SIZE / 8;
+    break;
+    
+  case 4:    // Fourth-last block on chip
+    block->num_bytes = DEFAULT_BLOCK_SIZE / 2;
+    break;
+    
+  default:   // Some other block
+    block->num_bytes = DEFAULT_BLOCK_SIZE;
+    break;
+  }
+  
+  // Determine base address of block based on index of block relative to total
+  // number of blocks on chip
+  block->base_address = 0;
+  unsigned int num_basic_blocks = num_blocks - 4;
+  switch (num_blocks - block_i)
+  {
+  // Note: Fall-throughs are intended
+  case 1:    // Last block on chip
+    block->base_address += DEFAULT_BLOCK_SIZE / 8;
+    
+  case 2:    // Second-last block on chip
+    block->base_address += DEFAULT_BLOCK_SIZE / 8;
+    
+  case 3:    // Third-last block on chip
+    block->base_address += DEFAULT_BLOCK_SIZE / 2;
+    
+  case 4:    // Fourth-last block on chip
+  default:   // Some other block
+    block->base_address += (block_i > num_basic_blocks ? num_basic_blocks : block_i) * DEFAULT_BLOCK_SIZE;
+    break;
+  }
+  
+  return block;
+}
+
+// Adds up the blocks holding save data
+static unsigned int count_save_bytes(const cartridge_descriptor* descriptor, const vector<vector<bool>>& saved, unsigned int* num_blocks)
+{
+  unsigned int num_bytes = 0;
+  unsigned int blocks = 0;
+  for (unsigned int c = 0; c < saved.size(); ++c)
+  {
+    for (unsigned int b = 0; b < saved[c].size(); ++b)
+    {
+      if (saved[c][b])
+      {
+        num_bytes += descriptor->chips[c]->blocks[b]->num_bytes;
+        ++blocks;
+      }
+    }
+  }
+  if (num_blocks != nullptr)
+  {
+    *num_blocks = blocks;
+  }
+  return num_bytes;
+}
+
 
 
 ngp_cartridge::ngp_cartridge(linkmasta_device* linkmasta)
   : m_was_init(false),
-    m_linkmasta(linkmasta), m_descriptor(nullptr), m_num_chips(0)
+    m_linkmasta(linkmasta), m_descriptor(nullptr), m_layout(), m_num_chips(0),
+    m_differential_restore(true), m_probe_block_protection(true),
+    m_sparse_saves(false), m_limit_saves_to_game(true), m_trimmed_backups(false), m_journal(nullptr),
+    m_erase_history(nullptr)
 {
   for (unsigned int i = 0; i < MAX_NUM_CHIPS; ++i)
   {
@@ -86,6 +248,11 @@ const cartridge_descriptor* ngp_cartridge::descriptor() const
   return m_descriptor;
 }
 
+const cartridge_layout* ngp_cartridge::layout() const
+{
+  return (m_descriptor != nullptr ? &m_layout : nullptr);
+}
+
 
 
 void ngp_cartridge::init()
@@ -100,9 +267,24 @@ void ngp_cartridge::init()
   m_linkmasta->init();
   m_linkmasta->open();
   build_cartridge_destriptor();
+  m_layout = (m_descriptor != nullptr ? cartridge_layout(*m_descriptor) : cartridge_layout());
   m_metadata.resize(num_slots());
   build_game_metadata();
   m_linkmasta->close();
+  apply_erase_history();
+  learn_save_regions();
+}
+
+void ngp_cartridge::set_journal(job_journal* journal)
+{
+  m_journal = journal;
+}
+
+void ngp_cartridge::set_erase_history(erase_history* history, const std::string& serial)
+{
+  m_erase_history = history;
+  m_erase_serial = serial;
+  apply_erase_history();
 }
 
 void ngp_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, task_controller* controller)
@@ -137,25 +319,30 @@ void ngp_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, tas
   
   // Determine the total number of bytes to write
   unsigned int bytes_written = 0;
-  unsigned int bytes_total = 0;
-  for (unsigned int i = chip_lower_bound; i < chip_upper_bound; ++i)
-  {
-    bytes_total += descriptor()->chips[i]->num_bytes;
-  }
+  unsigned int bytes_total = game_backup_size(slot);
   
   // Initialize markers
   unsigned int curr_chip = chip_lower_bound;
   unsigned int curr_block = 0;
   
-  // Allocate a buffer with max size of a block
-  const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
+  // Pick up after the blocks that an interrupted backup already wrote
+  unsigned int bytes_resumed = (m_journal != nullptr ? m_journal->completed_bytes() : 0);
+  if (bytes_resumed > 0)
+  {
+    fout.seekp(bytes_resumed);
+  }
+  
+  // Write blocks to the file on another thread while the next one is read
+  const unsigned int BUFFER_MAX_SIZE = STREAM_READ_SIZE;
   unsigned int       buffer_size = 0;
-  unsigned char*     buffer = new unsigned char[BUFFER_MAX_SIZE];
+  unsigned char*     buffer;
+  write_pipeline     pipeline(fout, m_linkmasta->buffers(), BUFFER_MAX_SIZE);
   
   // Inform controller that task is starting
   if (controller != nullptr)
   {
     controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_READ);
   }
   
   // Begin writing data block-by-block
@@ -164,11 +351,20 @@ void ngp_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, tas
     // Open connection to NGP chip
     m_linkmasta->open();
     
+    // Read both chips of a two-chip cartridge at once when the device can
+    // interleave their batches. A resumed backup goes one chip at a time
+    if (slot == SLOT_ALL && chip_upper_bound == 2 && bytes_resumed == 0
+        && bytes_total > descriptor()->chips[0]->num_bytes
+        && bytes_total - descriptor()->chips[0]->num_bytes <= descriptor()->chips[1]->num_bytes
+        && m_linkmasta->supports_interleaved_read_bytes())
+    {
+      bytes_written = backup_both_chips(pipeline, bytes_total, BUFFER_MAX_SIZE, controller);
+      curr_chip = chip_upper_bound;
+    }
+    
     while (bytes_written < bytes_total && curr_chip < chip_upper_bound && (controller == nullptr || !controller->is_task_cancelled()))
     {
-#ifdef VERBOSE
-      std::cout << "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)" << endl;
-#endif
+      LOG_STREAM(log_level::VERBOSE, "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)");
       
       // Convenience variables
       cartridge_descriptor::chip_descriptor* chip;
@@ -176,59 +372,82 @@ void ngp_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, tas
       chip = descriptor()->chips[curr_chip];
       block = chip->blocks[curr_block];
       
-      // Calculate number of expected bytes
+      // Calculate number of expected bytes, reading the contiguous blocks that
+      // follow on the same chip in the same stream
+      const cartridge_layout::block_entry* chip_blocks = layout()->chip_blocks(curr_chip);
       unsigned int bytes_expected = block->num_bytes;
+      unsigned int run_blocks = 1;
+      while (bytes_written >= bytes_resumed && curr_block + run_blocks < chip->num_blocks
+             && chip_blocks[curr_block + run_blocks].base_address == block->base_address + bytes_expected
+             && bytes_expected + chip_blocks[curr_block + run_blocks].num_bytes <= BUFFER_MAX_SIZE)
+      {
+        bytes_expected += chip_blocks[curr_block + run_blocks].num_bytes;
+        ++run_blocks;
+      }
       if (bytes_expected > bytes_total - bytes_written)
       {
         bytes_expected = bytes_total - bytes_written;
       }
       
-      // Attempt to read bytes from cartridge
-      if (controller == nullptr)
+      if (bytes_written + bytes_expected <= bytes_resumed)
       {
-        buffer_size = m_chips[curr_chip]->read_bytes(block->base_address, buffer, bytes_expected);
+        // Block is already in the file
+        buffer_size = bytes_expected;
+        if (controller != nullptr)
+        {
+          controller->on_task_update(task_status::RUNNING, bytes_expected);
+        }
       }
       else
       {
-        // Create a forwarding controller to pass progress updates to
-        forwarding_task_controller fwd_controller(controller);
-        fwd_controller.scale_work_to(bytes_expected);
-        try
+        // Attempt to read bytes from cartridge, retrying if the device hangs
+        buffer = pipeline.acquire_buffer();
+        retry_on_timeout(bytes_written, [&]
         {
-          buffer_size = m_chips[curr_chip]->read_bytes(block->base_address, buffer, bytes_expected, &fwd_controller);
+          buffer_size = walk_read_block(m_chips[curr_chip], block->base_address, buffer, bytes_expected, controller);
+        }, [&]
+        {
+          m_linkmasta->recover_connection();
+          m_chips[curr_chip]->reset();
+        });
+        
+        // A read cut short by cancelling just ends the backup early
+        if (buffer_size != bytes_expected && controller != nullptr && controller->is_task_cancelled())
+        {
+          break;
         }
-        catch (std::exception& ex)
+        
+        // Check for errors
+        if (buffer_size != bytes_expected)
         {
-          (void) ex;
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-          throw;
+          if (controller != nullptr)
+          {
+            controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          }
+          throw std::runtime_error("ERROR");
         }
-      }
-      
-      // Check for errors
-      if (buffer_size != bytes_expected)
-      {
-        if (controller != nullptr)
+        if (!pipeline.good())
         {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          if (controller != nullptr)
+          {
+            controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          }
+          throw std::runtime_error("ERROR");
         }
-        throw std::runtime_error("ERROR");
-      }
-      if (!fout.good())
-      {
-        if (controller != nullptr)
+        
+        // Queue buffer to be written to file
+        pipeline.submit_buffer(buffer, buffer_size);
+        
+        // Record the blocks that have reached the file so far
+        if (m_journal != nullptr)
         {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          m_journal->mark_complete(0, bytes_resumed + pipeline.bytes_written());
         }
-        throw std::runtime_error("ERROR");
       }
       
-      // Write buffer to file
-      fout.write((char*) buffer, buffer_size);
-      
       // Update markers
       bytes_written += buffer_size;
-      curr_block++;
+      curr_block += run_blocks;
       if (curr_block >= chip->num_blocks)
       {
         curr_block = 0;
@@ -238,50 +457,136 @@ void ngp_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, tas
     
     // Clean up before returning
     m_linkmasta->close();
+    
+    // Wait for the last blocks to reach the file
+    pipeline.finish();
+    if (m_journal != nullptr)
+    {
+      m_journal->mark_complete(0, bytes_resumed + pipeline.bytes_written());
+    }
   }
   catch (std::exception& ex)
   {
     (void) ex;
-    
     // Error occured! Clean up and pass error on to caller
-    try {
-      // Spinlock while the chip finishes erasing (if it was erasing)
-      while (m_chips[curr_chip]->is_erasing());
-    } catch (std::exception& ex2) {
-      (void) ex2;
-      // Well... this is awkward
+    abandon_block_walk(m_chips[curr_chip], m_linkmasta, controller);
+    throw;
+  }
+  
+  // Inform controller of task end
+  if (controller != nullptr)
+  {
+    controller->on_task_end(controller->is_task_cancelled() && bytes_written < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_written);
+  }
+}
+
+unsigned int ngp_cartridge::backup_both_chips(write_pipeline& pipeline, unsigned int bytes_total, unsigned int run_size, task_controller* controller)
+{
+  // Chip 1 follows the whole of chip 0 in the file, so its data waits in
+  // memory until chip 0 has been queued
+  unsigned int chip_bytes[2] = {descriptor()->chips[0]->num_bytes, bytes_total - descriptor()->chips[0]->num_bytes};
+  unsigned int bytes_read[2] = {0, 0};
+  unsigned int curr_block[2] = {0, 0};
+  buffer_pool::buffer second_memory = m_linkmasta->buffers().acquire(chip_bytes[1]);
+  unsigned char* second = second_memory.data();
+  
+  while ((bytes_read[0] < chip_bytes[0] || bytes_read[1] < chip_bytes[1]) && (controller == nullptr || !controller->is_task_cancelled()))
+  {
+    LOG_STREAM(log_level::VERBOSE, "(chip 0, block " << curr_block[0] << "; chip 1, block " << curr_block[1] << ") " << (bytes_read[0] + bytes_read[1]) << " B / " << bytes_total << " B (" << ((bytes_read[0] + bytes_read[1]) * 100 / bytes_total) << "%)");
+    
+    // Take the next contiguous blocks on each chip that fit in a single run
+    ngp_chip::address_t run_address[2] = {0, 0};
+    unsigned int run_bytes[2] = {0, 0};
+    unsigned int run_blocks[2] = {0, 0};
+    for (unsigned int chip_i = 0; chip_i < 2; ++chip_i)
+    {
+      if (bytes_read[chip_i] >= chip_bytes[chip_i])
+      {
+        continue;
+      }
+      
+      const cartridge_layout::block_entry* chip_blocks = layout()->chip_blocks(chip_i);
+      unsigned int num_blocks = descriptor()->chips[chip_i]->num_blocks;
+      unsigned int first = curr_block[chip_i];
+      run_address[chip_i] = chip_blocks[first].base_address;
+      run_bytes[chip_i] = chip_blocks[first].num_bytes;
+      run_blocks[chip_i] = 1;
+      while (first + run_blocks[chip_i] < num_blocks
+             && chip_blocks[first + run_blocks[chip_i]].base_address == run_address[chip_i] + run_bytes[chip_i]
+             && run_bytes[chip_i] + chip_blocks[first + run_blocks[chip_i]].num_bytes <= run_size)
+      {
+        run_bytes[chip_i] += chip_blocks[first + run_blocks[chip_i]].num_bytes;
+        ++run_blocks[chip_i];
+      }
+      run_bytes[chip_i] = std::min(run_bytes[chip_i], chip_bytes[chip_i] - bytes_read[chip_i]);
     }
     
-    try {
-      // Attempt to reset the chip
-      m_chips[curr_chip]->reset();
-    } catch (std::exception& ex2) {
-      (void) ex2;
-      // Well... this is awkward
+    // Attempt to read both runs at once, retrying if the device hangs
+    unsigned char* buffer = (run_bytes[0] > 0 ? pipeline.acquire_buffer() : nullptr);
+    unsigned int buffer_size = 0;
+    retry_on_timeout(bytes_read[0], [&]
+    {
+      forwarding_task_controller fwd_controller(controller);
+      fwd_controller.scale_work_to(run_bytes[0] + run_bytes[1]);
+      buffer_size = m_chips[0]->read_bytes_interleaved(run_address[0], buffer, run_bytes[0], *m_chips[1], run_address[1], second + bytes_read[1], run_bytes[1], controller == nullptr ? nullptr : &fwd_controller);
+    }, [&]
+    {
+      m_linkmasta->recover_connection();
+      m_chips[0]->reset();
+      m_chips[1]->reset();
+    });
+    
+    // A read cut short by cancelling just ends the backup early
+    if (buffer_size != run_bytes[0] + run_bytes[1] && controller != nullptr && controller->is_task_cancelled())
+    {
+      break;
     }
     
-    try {
-      m_linkmasta->close();
-    } catch (std::exception& ex2) {
-      (void) ex2;
-      // Well... this is awkward
+    // Check for errors
+    if (buffer_size != run_bytes[0] + run_bytes[1] || !pipeline.good())
+    {
+      if (controller != nullptr)
+      {
+        controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+      }
+      throw std::runtime_error("ERROR");
     }
     
-    // Inform controller of task end
-    if (controller != nullptr)
+    // Queue chip 0's run to be written to file
+    if (run_bytes[0] > 0)
     {
-      controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+      pipeline.submit_buffer(buffer, run_bytes[0]);
+      if (m_journal != nullptr)
+      {
+        m_journal->mark_complete(0, pipeline.bytes_written());
+      }
+    }
+    
+    for (unsigned int chip_i = 0; chip_i < 2; ++chip_i)
+    {
+      bytes_read[chip_i] += run_bytes[chip_i];
+      curr_block[chip_i] += run_blocks[chip_i];
     }
-    delete [] buffer;
-    throw;
   }
   
-  // Inform controller of task end
-  if (controller != nullptr)
+  // Chip 1 can only follow a complete chip 0
+  if (bytes_read[0] < chip_bytes[0])
   {
-    controller->on_task_end(controller->is_task_cancelled() && bytes_written < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_written);
+    return bytes_read[0];
+  }
+  for (unsigned int offset = 0; offset < bytes_read[1]; )
+  {
+    unsigned int num_bytes = std::min(run_size, bytes_read[1] - offset);
+    unsigned char* buffer = pipeline.acquire_buffer();
+    memcpy(buffer, second + offset, num_bytes);
+    pipeline.submit_buffer(buffer, num_bytes);
+    offset += num_bytes;
+    if (m_journal != nullptr)
+    {
+      m_journal->mark_complete(0, pipeline.bytes_written());
+    }
   }
-  delete [] buffer;
+  return bytes_read[0] + bytes_read[1];
 }
 
 void ngp_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
@@ -292,6 +597,36 @@ void ngp_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, tas
     throw std::invalid_argument("Standard input cannot be used in cartridge operations");
   }
   
+  rom_image image(fin);
+  restore_game_data(image, slot, controller, false);
+}
+
+void ngp_cartridge::restore_cartridge_game_data(const unsigned char* image_data, unsigned int num_bytes, int slot, task_controller* controller)
+{
+  rom_image image(image_data, num_bytes);
+  restore_game_data(image, slot, controller, false);
+}
+
+bool ngp_cartridge::restore_and_verify_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
+{
+  // Ensure argument type is not the standard input
+  if (&fin == &std::cin)
+  {
+    throw std::invalid_argument("Standard input cannot be used in cartridge operations");
+  }
+  
+  rom_image image(fin);
+  return restore_game_data(image, slot, controller, true);
+}
+
+bool ngp_cartridge::restore_and_verify_cartridge_game_data(const unsigned char* image_data, unsigned int num_bytes, int slot, task_controller* controller)
+{
+  rom_image image(image_data, num_bytes);
+  return restore_game_data(image, slot, controller, true);
+}
+
+bool ngp_cartridge::restore_game_data(rom_image& image, int slot, task_controller* controller, bool verify)
+{
   // Ensure class was initialized
   if (!m_was_init)
   {
@@ -321,10 +656,8 @@ void ngp_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, tas
   }
   
   // Determine the total number of bytes to write
-  fin.seekg(0, fin.end);
   unsigned int bytes_written = 0;
-  unsigned int bytes_total = (unsigned int) fin.tellg();
-  fin.seekg(0, fin.beg);
+  unsigned int bytes_total = image.size();
   
   unsigned int bytes_chip_sum  = 0;
   for (unsigned int i = chip_lower_bound; i < chip_upper_bound; ++i)
@@ -338,107 +671,302 @@ void ngp_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, tas
     throw std::runtime_error("File too large for cartridge");
   }
   
-  // Initialize markers
-  unsigned int curr_chip = chip_lower_bound;
-  unsigned int curr_block = 0;
+  // Split the file into per-chip queues of blocks so that an erase on one chip
+  // can be started while the other chip is being programmed. The plan is
+  // shared by every cartridge of this layout the same image is flashed to.
+  std::shared_ptr<const restore_plan> plan = restore_plan::get(*layout(), chip_lower_bound, chip_upper_bound, image.data(), bytes_total);
+  std::vector<std::deque<restore_job>> chip_jobs(chip_upper_bound);
+  for (const restore_plan::extent& e : plan->extents())
+  {
+    restore_job job;
+    job.base_address = e.base_address;
+    job.file_offset = e.file_offset;
+    job.num_bytes = e.num_bytes;
+    job.prepared = false;
+    job.compared = false;
+    job.needs_erase = true;
+    job.needs_program = true;
+    job.blank_known = plan->knows_blank();
+    job.blank = e.blank;
+    
+    // Leave out blocks that an interrupted restore already wrote or that a
+    // patch leaves as they are
+    if ((m_journal != nullptr && m_journal->is_complete(job.file_offset, job.num_bytes)) || !image.is_changed(job.file_offset, job.num_bytes))
+    {
+      bytes_written += job.num_bytes;
+    }
+    else
+    {
+      chip_jobs[e.chip_num].push_back(job);
+    }
+  }
   
-  // Allocate a buffer with max size of a block
+  // Allocate a buffer with max size of a block for each chip, unless blocks
+  // can be taken straight from an image in memory
   const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
-  unsigned int       buffer_size = 0;
-  unsigned char*     buffer = new unsigned char[BUFFER_MAX_SIZE];
-  
-  // Inform controller that task is starting
-  if (controller != nullptr)
+  buffer_pool::buffer chip_buffers[MAX_NUM_CHIPS];
+  unsigned char*     buffers[MAX_NUM_CHIPS] = {nullptr};
+  const unsigned char* blocks[MAX_NUM_CHIPS] = {nullptr};
+  for (unsigned int i = chip_lower_bound; i < chip_upper_bound && image.needs_buffer(); ++i)
   {
-    controller->on_task_start(bytes_total);
+    chip_buffers[i] = m_linkmasta->buffers().acquire(BUFFER_MAX_SIZE);
+    buffers[i] = chip_buffers[i].data();
   }
+  buffer_pool::buffer cart_buffer_memory = (m_differential_restore || verify ? m_linkmasta->buffers().acquire(BUFFER_MAX_SIZE) : buffer_pool::buffer());
+  unsigned char*     cart_buffer = cart_buffer_memory.data();
+  bool               verified = true;
   
-  // Begin writing data block-by-block
-  try
+  // Finds the next chip after the given one that still has blocks to write,
+  // or the given chip if no other chip does
+  auto next_chip_with_jobs = [&](unsigned int from) -> unsigned int
   {
-    // Open connection to NGP chip
-    m_linkmasta->open();
-    
-    while (bytes_written < bytes_total && (controller == nullptr || !controller->is_task_cancelled()))
+    const unsigned int num_chips = chip_upper_bound - chip_lower_bound;
+    for (unsigned int i = 1; i <= num_chips; ++i)
     {
-#ifdef VERBOSE
-      std::cout << "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)" << endl;
-#endif
-      
-      cartridge_descriptor::chip_descriptor* chip;
-      cartridge_descriptor::chip_descriptor::block_descriptor* block;
-      chip = descriptor()->chips[curr_chip];
-      block = chip->blocks[curr_block];
-      
-      // Calculate number of expected bytes
-      unsigned bytes_expected = block->num_bytes;
-      if (bytes_expected > bytes_total - bytes_written)
+      unsigned int chip_i = chip_lower_bound + (from - chip_lower_bound + i) % num_chips;
+      if (!chip_jobs[chip_i].empty())
       {
-        bytes_expected = bytes_total - bytes_written;
+        return chip_i;
       }
+    }
+    return from;
+  };
+  
+  // Flags indicating which chips have been erased in their entirety
+  bool chip_erased[MAX_NUM_CHIPS] = {false};
+  
+  // Reads a block from the image for its chip and decides what needs to be
+  // done with it
+  auto classify_job = [&](unsigned int chip_i, restore_job& job)
+  {
+    blocks[chip_i] = image.read(job.file_offset, buffers[chip_i], job.num_bytes);
+    
+    bool blank = (job.blank_known ? job.blank : is_blank_block(blocks[chip_i], job.num_bytes));
+    
+    if (chip_erased[chip_i])
+    {
+      // The whole chip is being erased, so only non-blank blocks need work
+      job.needs_erase = false;
+      job.needs_program = !blank;
+    }
+    else if (m_differential_restore && !job.compared)
+    {
+      // In differential mode, compare against the cartridge's current contents
+      // and skip the block entirely if it already matches
+      unsigned int bytes_read = m_chips[chip_i]->read_bytes(job.base_address, cart_buffer, job.num_bytes);
       
-      // Attempt to read bytes from file
-      fin.read((char*) buffer, bytes_expected);
-      buffer_size = (unsigned int) fin.gcount();
-      
-      // Check for errors
-      if (buffer_size != bytes_expected)
+      job.needs_erase = (bytes_read != job.num_bytes || memcmp(blocks[chip_i], cart_buffer, job.num_bytes) != 0);
+      job.needs_program = job.needs_erase && !blank;
+      job.compared = true;
+    }
+    else if (!m_differential_restore)
+    {
+      // The block is erased either way, which leaves it blank already
+      job.needs_program = !blank;
+    }
+  };
+  
+  // Reads a block from the image and starts erasing it if needed without
+  // waiting for the erase to complete
+  auto prepare_job = [&](unsigned int chip_i, restore_job& job)
+  {
+    classify_job(chip_i, job);
+    if (job.needs_erase)
+    {
+      m_chips[chip_i]->erase_block(job.base_address);
+    }
+    job.prepared = true;
+  };
+  
+  // Inform controller that task is starting
+  if (controller != nullptr)
+  {
+    controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_PROGRAM);
+    if (bytes_written > 0)
+    {
+      controller->on_task_update(task_status::RUNNING, bytes_written);
+    }
+  }
+  
+  // Begin writing data block-by-block
+  try
+  {
+    // Open connection to NGP chip
+    m_linkmasta->open();
+    
+    // Erase chips that are being rewritten in their entirety with a single
+    // chip erase if that is estimated to be faster than erasing block-by-block
+    int time_saved = 0;
+    for (unsigned int chip_i = chip_lower_bound; chip_i < chip_upper_bound; ++chip_i)
+    {
+      cartridge_descriptor::chip_descriptor* chip = descriptor()->chips[chip_i];
+      
+      unsigned int bytes_covered = 0;
+      for (const restore_job& job : chip_jobs[chip_i])
       {
-        if (controller != nullptr)
+        bytes_covered += job.num_bytes;
+      }
+      if (chip_jobs[chip_i].size() != chip->num_blocks || bytes_covered != chip->num_bytes)
+      {
+        continue;
+      }
+      
+      // In differential mode, only count the blocks that actually differ
+      unsigned int blocks_to_erase = chip->num_blocks;
+      if (m_differential_restore)
+      {
+        blocks_to_erase = 0;
+        for (restore_job& job : chip_jobs[chip_i])
         {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          classify_job(chip_i, job);
+          blocks_to_erase += (job.needs_erase ? 1 : 0);
         }
-        throw std::runtime_error("ERROR");
       }
-      if (!fin.good() && (buffer_size + bytes_written) < bytes_total)
+      
+      int block_erase_time = (int) blocks_to_erase * NGP_CHIP_BLOCK_ERASE_TIME_MS;
+      int chip_erase_time = NGP_CHIP_CHIP_ERASE_TIME_MS;
+      if (block_erase_time <= chip_erase_time)
       {
-        if (controller != nullptr)
+        continue;
+      }
+      
+      m_chips[chip_i]->erase_chip();
+      chip_erased[chip_i] = true;
+      time_saved += block_erase_time - chip_erase_time;
+    }
+    
+    if (controller != nullptr && time_saved > 0)
+    {
+      controller->on_task_time_saved(time_saved);
+    }
+    
+    unsigned int curr_chip = chip_lower_bound;
+    while (bytes_written < bytes_total && (controller == nullptr || !controller->is_task_cancelled()))
+    {
+      if (chip_jobs[curr_chip].empty())
+      {
+        curr_chip = next_chip_with_jobs(curr_chip);
+      }
+      
+      LOG_STREAM(log_level::VERBOSE, "(chip " << curr_chip << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)");
+      
+      restore_job& job = chip_jobs[curr_chip].front();
+      if (!job.prepared)
+      {
+        retry_on_timeout(job.file_offset, [&]
         {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-        }
-        throw std::runtime_error("ERROR");
+          prepare_job(curr_chip, job);
+        }, [&]
+        {
+          m_linkmasta->recover_connection();
+          m_chips[curr_chip]->reset();
+        });
       }
       
-      // Erase block from cartridge
-      m_chips[curr_chip]->erase_block(block->base_address);
+      // Start erasing the next block on another chip so that its erase time
+      // overlaps with programming this one
+      unsigned int next_chip = next_chip_with_jobs(curr_chip);
+      if (next_chip != curr_chip && !chip_jobs[next_chip].front().prepared)
+      {
+        retry_on_timeout(chip_jobs[next_chip].front().file_offset, [&]
+        {
+          prepare_job(next_chip, chip_jobs[next_chip].front());
+        }, [&]
+        {
+          m_linkmasta->recover_connection();
+          m_chips[next_chip]->reset();
+        });
+      }
       
-      // Wait for erasure to complete
-      while (m_chips[curr_chip]->test_erasing())
+      // Wait for erasure to complete and write buffer to cartridge. If the
+      // device hangs part-way through, the block is erased again before
+      // starting over.
+      bool interrupted = false;
+      unsigned int bytes_programmed = job.num_bytes;
+      retry_on_timeout(job.file_offset, [&]
       {
-        if (controller != nullptr)
+        if (interrupted && (job.needs_erase || chip_erased[curr_chip]))
         {
-          controller->on_task_update(task_status::RUNNING, 0);
+          m_chips[curr_chip]->erase_block(job.base_address);
         }
-      }
+        m_chips[curr_chip]->wait_for_erase(controller);
+        
+        if (job.needs_program)
+        {
+          // The block is freshly erased, so its blank runs are left as they are
+          bytes_programmed = walk_program_erased_block(m_chips[curr_chip], job.base_address, blocks[curr_chip], job.num_bytes, controller);
+        }
+      }, [&]
+      {
+        m_linkmasta->recover_connection();
+        interrupted = true;
+        m_chips[curr_chip]->reset();
+      });
       
-      // Write buffer to cartridge
-      if (controller == nullptr)
+      // A block cut short by cancelling is neither verified nor recorded, so
+      // that resuming the restore programs it again
+      if (bytes_programmed < job.num_bytes && controller != nullptr && controller->is_task_cancelled())
       {
-        m_chips[curr_chip]->program_bytes(block->base_address, buffer, buffer_size);
+        break;
       }
-      else
+      if (!job.needs_program && controller != nullptr)
       {
-        forwarding_task_controller fwd_controller(controller);
-        fwd_controller.scale_work_to(buffer_size);
-        try
+        controller->on_task_update(task_status::RUNNING, job.num_bytes);
+      }
+      
+      // Read the block back while its source is still at hand and rewrite it
+      // if it doesn't match. Blocks that a differential restore found to
+      // match already don't need to be read again.
+      bool matched = true;
+      if (verify && !(job.compared && !job.needs_erase))
+      {
+        walk_phase(controller, TASK_PHASE_VERIFY);
+        matched = false;
+        for (unsigned int attempt = 0; ; ++attempt)
         {
-          m_chips[curr_chip]->program_bytes(block->base_address, buffer, buffer_size, &fwd_controller);
+          unsigned int bytes_read = m_chips[curr_chip]->read_bytes(job.base_address, cart_buffer, job.num_bytes);
+          matched = (bytes_read == job.num_bytes && find_first_difference(blocks[curr_chip], cart_buffer, job.num_bytes) == job.num_bytes);
+          if (matched || attempt >= VERIFY_MAX_RETRIES)
+          {
+            break;
+          }
+          
+          m_chips[curr_chip]->erase_block(job.base_address);
+          m_chips[curr_chip]->wait_for_erase(controller);
+          walk_program_erased_block(m_chips[curr_chip], job.base_address, blocks[curr_chip], job.num_bytes, (task_controller*) nullptr);
         }
-        catch (std::exception& ex)
+        
+        if (!matched)
         {
-          (void) ex;
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-          throw;
+          log(log_level::INFO, ("Block at offset " + std::to_string(job.file_offset) + " failed to verify").c_str());
+          verified = false;
         }
+        walk_phase(controller, TASK_PHASE_PROGRAM);
       }
       
-      // Update markers
-      bytes_written += buffer_size;
-      curr_block++;
-      if (curr_block >= chip->num_blocks)
+      // Record the block so that it can be skipped if the restore is resumed,
+      // unless it needs another try
+      if (m_journal != nullptr && matched)
       {
-        curr_block = 0;
-        curr_chip++;
+        m_journal->mark_complete(job.file_offset, job.num_bytes);
+      }
+      
+      // Update markers, switching chips when possible so that the erase
+      // started above has time to progress
+      bytes_written += job.num_bytes;
+      chip_jobs[curr_chip].pop_front();
+      curr_chip = next_chip;
+    }
+    
+    // Let any erase started ahead of time finish before closing, and reset
+    // the chips if cancelling stopped part-way through a block
+    for (unsigned int i = chip_lower_bound; i < chip_upper_bound; ++i)
+    {
+      m_chips[i]->wait_for_erase();
+      if (controller != nullptr && controller->is_task_cancelled())
+      {
+        m_chips[i]->reset();
       }
     }
     
@@ -449,20 +977,23 @@ void ngp_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, tas
   {
     (void) ex;
     // Error occured! Clean up and pass error on to caller
-    try {
-      // Spinlock while the chip finishes erasing (if it was erasing)
-      while (m_chips[curr_chip]->is_erasing());
-    } catch (exception ex2) {
-      (void) ex2;
-      // Well... this is awkward
-    }
-    
-    try {
-      // Attempt to reset the chip
-      m_chips[curr_chip]->reset();
-    } catch (exception ex2) {
-      (void) ex2;
-      // Well... this is awkward
+    for (unsigned int i = chip_lower_bound; i < chip_upper_bound; ++i)
+    {
+      try {
+        // Wait while the chip finishes erasing (if it was erasing)
+        m_chips[i]->wait_for_erase();
+      } catch (exception ex2) {
+        (void) ex2;
+        // Well... this is awkward
+      }
+      
+      try {
+        // Attempt to reset the chip
+        m_chips[i]->reset();
+      } catch (exception ex2) {
+        (void) ex2;
+        // Well... this is awkward
+      }
     }
     
     try {
@@ -476,7 +1007,6 @@ void ngp_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, tas
     {
       controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
     }
-    delete [] buffer;
     throw;
   }
   
@@ -485,7 +1015,7 @@ void ngp_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, tas
   {
     controller->on_task_end(controller->is_task_cancelled() && bytes_written < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_written);
   }
-  delete [] buffer;
+  return verified;
 }
 
 bool ngp_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
@@ -496,6 +1026,24 @@ bool ngp_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, tas
     throw std::invalid_argument("Standard input cannot be used in cartridge operations");
   }
   
+  rom_image image(fin);
+  return compare_game_data(image, slot, controller, nullptr);
+}
+
+bool ngp_cartridge::compare_cartridge_game_data(const unsigned char* image_data, unsigned int num_bytes, int slot, task_controller* controller)
+{
+  rom_image image(image_data, num_bytes);
+  return compare_game_data(image, slot, controller, nullptr);
+}
+
+bool ngp_cartridge::compare_cartridge_game_data(const digest_manifest& manifest, int slot, task_controller* controller)
+{
+  rom_image image(manifest);
+  return compare_game_data(image, slot, controller, nullptr);
+}
+
+bool ngp_cartridge::compare_game_data(rom_image& image, int slot, task_controller* controller, block_mismatch_map* mismatches)
+{
   // Ensure class was initialized
   if (!m_was_init)
   {
@@ -525,10 +1073,8 @@ bool ngp_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, tas
   }
   
   // determine the total number of bytes to compare
-  fin.seekg(0, fin.end);
   unsigned int bytes_compared = 0;
-  unsigned int bytes_total = (unsigned int) fin.tellg();
-  fin.seekg(0, fin.beg);
+  unsigned int bytes_total = image.size();
   
   unsigned int bytes_chip_sum  = 0;
   for (unsigned int i = chip_lower_bound; i < chip_upper_bound; ++i)
@@ -547,17 +1093,47 @@ bool ngp_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, tas
   unsigned int curr_block = 0;
   bool         matched = true;
   
-  // Allocate a buffer with max size of a block
+  // Allocate a buffer with max size of a block, unless blocks can be taken
+  // straight from an image in memory
   const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
   unsigned int       f_buffer_size = 0;
-  unsigned char*     f_buffer = new unsigned char[BUFFER_MAX_SIZE];
+  buffer_pool::buffer f_buffer_memory = (image.needs_buffer() ? m_linkmasta->buffers().acquire(BUFFER_MAX_SIZE) : buffer_pool::buffer());
+  unsigned char*     f_buffer = f_buffer_memory.data();
   unsigned int       c_buffer_size = 0;
-  unsigned char*     c_buffer = new unsigned char[BUFFER_MAX_SIZE];
+  unsigned char*     c_buffer;
+  
+  // Compare blocks against the file, or against its digests when verifying
+  // with a manifest, on another thread while the next block is read. When
+  // mapping mismatches, blocks that differ are recorded rather than ending
+  // the comparison
+  compare_pipeline   pipeline(m_linkmasta->buffers(), BUFFER_MAX_SIZE, [&image, f_buffer, mismatches](unsigned int offset, const unsigned char* data, unsigned int num_bytes) -> bool
+  {
+    unsigned int mismatch_offset = offset;
+    if (!image.matches(offset, data, f_buffer, num_bytes, &mismatch_offset))
+    {
+      log(log_level::INFO, ("Cartridge data differs from file at offset " + std::to_string(mismatch_offset)).c_str());
+      if (mismatches == nullptr)
+      {
+        return false;
+      }
+      mismatches->add_mismatch(offset, num_bytes, mismatch_offset);
+      return true;
+    }
+    if (mismatches != nullptr)
+    {
+      mismatches->add_match(offset, num_bytes);
+    }
+    return true;
+  });
+  
+  // Only images whose contents are at hand can be checksummed on the host
+  const bool use_checksums = m_linkmasta->supports_checksum_range() && image.has_contents();
   
   // Inform controller that task is starting
   if (controller != nullptr)
   {
     controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_VERIFY);
   }
   
   // Begin comparing data block-by-block
@@ -566,11 +1142,9 @@ bool ngp_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, tas
     // Open connection to NGP chip
     m_linkmasta->open();
     
-    while (bytes_compared < bytes_total && matched && (controller == nullptr || !controller->is_task_cancelled()))
+    while (bytes_compared < bytes_total && pipeline.matched() && (controller == nullptr || !controller->is_task_cancelled()))
     {
-#ifdef VERBOSE
-      std::cout << "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_compared << " B / " << bytes_total << " B (" << (bytes_compared * 100 / bytes_total) << "%)" << endl;
-#endif
+      LOG_STREAM(log_level::VERBOSE, "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_compared << " B / " << bytes_total << " B (" << (bytes_compared * 100 / bytes_total) << "%)");
       
       // Convenience variables
       cartridge_descriptor::chip_descriptor* chip;
@@ -585,69 +1159,69 @@ bool ngp_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, tas
         bytes_expected = bytes_total - bytes_compared;
       }
       
-      // Attempt to read bytes from file
-      fin.read((char*) f_buffer, bytes_expected);
-      f_buffer_size = (unsigned int) fin.gcount();
+      f_buffer_size = bytes_expected;
       
-      // Check for errors
-      if (f_buffer_size != bytes_expected)
-      {
-        if (controller != nullptr)
-        {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-        }
-        throw std::runtime_error("ERROR");
-      }
-      if (!fin.good() && (f_buffer_size + bytes_compared) < bytes_total)
+      // The image can't be read here while the comparer thread is still using
+      // it, which may also reveal that an earlier block differed
+      if (use_checksums && !pipeline.finish())
       {
-        if (controller != nullptr)
-        {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-        }
-        throw std::runtime_error("ERROR");
+        break;
       }
       
-      // Attempt to read bytes from cartridge
-      if (controller == nullptr)
-      {
-        c_buffer_size = m_chips[curr_chip]->read_bytes(block->base_address, c_buffer, bytes_expected);
-      }
-      else
+      // Read the block from the image up front when the device checksums it,
+      // ending the task if the file can't be read
+      const unsigned char* f_block = nullptr;
+      if (use_checksums)
       {
-        // Use a forwarding controller to pass progress updates to our controller
-        forwarding_task_controller fwd_controller(controller);
-        fwd_controller.scale_work_to(bytes_expected);
         try
         {
-          c_buffer_size = m_chips[curr_chip]->read_bytes(block->base_address, c_buffer, bytes_expected, &fwd_controller);
+          f_block = image.read(bytes_compared, f_buffer, bytes_expected);
         }
         catch (std::exception& ex)
         {
           (void) ex;
-          // Inform controller of error
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          if (controller != nullptr)
+          {
+            controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          }
           throw;
         }
       }
       
-      // Check for errors
-      if (c_buffer_size != bytes_expected)
+      // Let the device checksum the block itself when it can, only reading it
+      // back if the checksums differ to find where
+      if (use_checksums && walk_checksum_block(m_chips[curr_chip], block->base_address, f_block, bytes_expected, controller))
       {
-        if (controller != nullptr)
+        // Block matches without having been transferred
+        if (mismatches != nullptr)
         {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          mismatches->add_match(bytes_compared, bytes_expected);
         }
-        throw std::runtime_error("ERROR");
       }
-      
-      // Compare contents of buffers
-      for (unsigned int i = 0; i < f_buffer_size && i < c_buffer_size; ++i)
+      else
       {
-        if (f_buffer[i] != c_buffer[i])
+        // Attempt to read bytes from cartridge
+        c_buffer = pipeline.acquire_buffer();
+        c_buffer_size = walk_read_block(m_chips[curr_chip], block->base_address, c_buffer, bytes_expected, controller);
+        
+        // A read cut short by cancelling just ends the comparison early
+        if (c_buffer_size != bytes_expected && controller != nullptr && controller->is_task_cancelled())
         {
-          matched = false;
+          pipeline.submit_buffer(c_buffer, bytes_compared, 0);
           break;
         }
+        
+        // Check for errors
+        if (c_buffer_size != bytes_expected)
+        {
+          if (controller != nullptr)
+          {
+            controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          }
+          throw std::runtime_error("ERROR");
+        }
+        
+        pipeline.submit_buffer(c_buffer, bytes_compared, bytes_expected);
       }
       
       // Update markers
@@ -662,39 +1236,17 @@ bool ngp_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, tas
     
     // Clean up before returning
     m_linkmasta->close();
+    matched = pipeline.finish();
+    if (mismatches != nullptr)
+    {
+      matched = matched && mismatches->all_matched();
+    }
   }
   catch (std::exception& ex)
   {
     (void) ex;
     // Error occured! Clean up and pass error on to caller
-    // Note: I appologize for the change in style: it's to save lines
-    try {
-      // Spinlock while the chip finishes erasing (if it was erasing)
-      while (m_chips[curr_chip]->is_erasing());
-    } catch (exception ex2) {
-      // Well... this is awkward
-    }
-    
-    try {
-      // Attempt to reset the chip
-      m_chips[curr_chip]->reset();
-    } catch (exception ex2) {
-      // Well... this is awkward
-    }
-    
-    try {
-      m_linkmasta->close();
-    } catch (exception ex2) {
-      // Well... this is awkward
-    }
-    
-    // Inform controller that error
-    if (controller != nullptr)
-    {
-      controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-    }
-    delete [] f_buffer;
-    delete [] c_buffer;
+    abandon_block_walk(m_chips[curr_chip], m_linkmasta, controller);
     throw;
   }
   
@@ -703,8 +1255,6 @@ bool ngp_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, tas
   {
     controller->on_task_end(controller->is_task_cancelled() && bytes_compared < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_compared);
   }
-  delete [] f_buffer;
-  delete [] c_buffer;
   return matched;
 }
 
@@ -739,25 +1289,15 @@ void ngp_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, tas
   }
   
   // Determine the total number of bytes and blocks to write
+  vector<vector<bool>> saved = save_blocks(chip_lower_bound, chip_upper_bound);
   unsigned int bytes_written = 0;
-  unsigned int bytes_total = 0;
   unsigned int blocks_total = 0;
-  for (unsigned int i = chip_lower_bound; i < chip_upper_bound; ++i)
-  {
-    for (unsigned int j = 0; j < descriptor()->chips[i]->num_blocks; ++j)
-    {
-      if (!descriptor()->chips[i]->blocks[j]->is_protected)
-      {
-        bytes_total += descriptor()->chips[i]->blocks[j]->num_bytes;
-        blocks_total++;
-      }
-    }
-  }
+  unsigned int bytes_total = count_save_bytes(descriptor(), saved, &blocks_total);
   
   // Create the file and block header structs and populate with data
   NGFheader file_header;
   NGFblock  block_header;
-  file_header.version = NGF_HEADER_VERSION;
+  file_header.version = (m_sparse_saves ? NGF_SPARSE_HEADER_VERSION : NGF_HEADER_VERSION);
   file_header.num_bytes = sizeof(file_header);
   file_header.num_bytes += bytes_total;
   file_header.num_bytes += sizeof(block_header) * blocks_total;
@@ -773,12 +1313,14 @@ void ngp_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, tas
   // Allocate a buffer with max size of a block
   const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
   unsigned int       buffer_size = 0;
-  unsigned char*     buffer = new unsigned char[BUFFER_MAX_SIZE];
+  buffer_pool::buffer buffer_memory = m_linkmasta->buffers().acquire(BUFFER_MAX_SIZE);
+  unsigned char*     buffer = buffer_memory.data();
   
   // Inform controller that task is starting
   if (controller != nullptr)
   {
     controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_READ);
   }
   
   // Begin writing data block-by-block
@@ -789,9 +1331,7 @@ void ngp_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, tas
     
     while (bytes_written < bytes_total && curr_chip < chip_upper_bound && (controller == nullptr || !controller->is_task_cancelled()))
     {
-#ifdef VERBOSE
-      std::cout << "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)" << endl;
-#endif
+      LOG_STREAM(log_level::VERBOSE, "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)");
       
       // Convenience variables
       cartridge_descriptor::chip_descriptor* chip;
@@ -799,8 +1339,8 @@ void ngp_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, tas
       chip = descriptor()->chips[curr_chip];
       block = chip->blocks[curr_block];
       
-      // Only write unprotected blocks
-      if (!block->is_protected)
+      // Only write the blocks saves are kept in
+      if (saved[curr_chip][curr_block])
       {
         // Populate the header
         block_header.address = block->base_address;
@@ -809,10 +1349,6 @@ void ngp_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, tas
         // Adjust for NGP virtual address offset
         block_header.address += 0x200000 + 0x600000 * (curr_chip - chip_lower_bound);
         
-        // Write block header to file
-        fout.write((char*) &block_header, sizeof(block_header));
-        
-        
         // Calculate number of expected bytes
         unsigned int bytes_expected = block->num_bytes;
         if (bytes_expected > bytes_total - bytes_written)
@@ -821,25 +1357,12 @@ void ngp_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, tas
         }
         
         // Attempt to read bytes from cartridge
-        if (controller == nullptr)
-        {
-          buffer_size = m_chips[curr_chip]->read_bytes(block->base_address, buffer, bytes_expected);
-        }
-        else
+        buffer_size = walk_read_block(m_chips[curr_chip], block->base_address, buffer, bytes_expected, controller);
+        
+        // A read cut short by cancelling just ends the backup early
+        if (buffer_size != bytes_expected && controller != nullptr && controller->is_task_cancelled())
         {
-          // Create a forwarding controller to pass progress updates to
-          forwarding_task_controller fwd_controller(controller);
-          fwd_controller.scale_work_to(bytes_expected);
-          try
-          {
-            buffer_size = m_chips[curr_chip]->read_bytes(block->base_address, buffer, bytes_expected, &fwd_controller);
-          }
-          catch (std::exception& ex)
-          {
-            (void) ex;
-            controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-            throw;
-          }
+          break;
         }
         
         // Check for errors
@@ -860,8 +1383,15 @@ void ngp_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, tas
           throw std::runtime_error("ERROR");
         }
         
-        // Write buffer to file
-        fout.write((char*) buffer, buffer_size);
+        // Sparse files leave out the data of blank blocks
+        if (m_sparse_saves && is_blank_block(buffer, buffer_size))
+        {
+          block_header.num_bytes = 0;
+        }
+        
+        // Write block header and buffer to file
+        fout.write((char*) &block_header, sizeof(block_header));
+        fout.write((char*) buffer, block_header.num_bytes == 0 ? 0 : buffer_size);
         bytes_written += buffer_size;
       }
       
@@ -881,35 +1411,7 @@ void ngp_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, tas
   {
     (void) ex;
     // Error occured! Clean up and pass error on to caller
-    try {
-      // Spinlock while the chip finishes erasing (if it was erasing)
-      while (m_chips[curr_chip]->is_erasing());
-    } catch (std::exception& ex2) {
-      (void) ex2;
-      // Well... this is awkward
-    }
-    
-    try {
-      // Attempt to reset the chip
-      m_chips[curr_chip]->reset();
-    } catch (std::exception& ex2) {
-      (void) ex2;
-      // Well... this is awkward
-    }
-    
-    try {
-      m_linkmasta->close();
-    } catch (std::exception& ex2) {
-      (void) ex2;
-      // Well... this is awkward
-    }
-    
-    // Inform controller of task end
-    if (controller != nullptr)
-    {
-      controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-    }
-    delete [] buffer;
+    abandon_block_walk(m_chips[curr_chip], m_linkmasta, controller);
     throw;
   }
   
@@ -918,7 +1420,6 @@ void ngp_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, tas
   {
     controller->on_task_end(controller->is_task_cancelled() && bytes_written < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_written);
   }
-  delete [] buffer;
 }
 
 void ngp_cartridge::restore_cartridge_save_data(std::istream& fin, int slot, task_controller* controller)
@@ -974,16 +1475,19 @@ void ngp_cartridge::restore_cartridge_save_data(std::istream& fin, int slot, tas
   // Initialize markers
   unsigned int curr_chip = 0;
   unsigned int curr_block = 0;
+  vector<vector<bool>> saved = save_blocks(chip_lower_bound, chip_upper_bound);
   
   // Allocate a buffer with max size of a block
   const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
   unsigned int       buffer_size = 0;
-  unsigned char*     buffer = new unsigned char[BUFFER_MAX_SIZE];
+  buffer_pool::buffer buffer_memory = m_linkmasta->buffers().acquire(BUFFER_MAX_SIZE);
+  unsigned char*     buffer = buffer_memory.data();
   
   // Inform controller that task is starting
   if (controller != nullptr)
   {
     controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_PROGRAM);
   }
   
   // Array of blocks that have been previously written to
@@ -1031,27 +1535,77 @@ void ngp_cartridge::restore_cartridge_save_data(std::istream& fin, int slot, tas
       }
       
       // Determine the block index on which the block resides
-      for (curr_block = 0; curr_block < chip->num_blocks; ++curr_block)
-      {
-        block = chip->blocks[curr_block];
-        if (block_header.address >= block->base_address && block_header.address < block->base_address + block->num_bytes)
-        {
-          break;
-        }
-      }
+      int found_block = layout()->find_block(curr_chip, block_header.address);
       
       // Ensure integrity
-      if (curr_block >= chip->num_blocks)
+      if (found_block < 0)
       {
         throw std::runtime_error("Save file does not fit on this cartridge");
       }
+      curr_block = (unsigned int) found_block;
+      block = chip->blocks[curr_block];
+      
+      // Blocks the game doesn't save to hold the game, even when an older
+      // backup included them
+      if (!block->is_protected && !saved[curr_chip][curr_block])
+      {
+        bool blank_run = (file_header.version == NGF_SPARSE_HEADER_VERSION && block_header.num_bytes == 0);
+        unsigned int skipped = (blank_run ? block->num_bytes : block_header.num_bytes);
+        if (skipped > bytes_total - bytes_written)
+        {
+          skipped = bytes_total - bytes_written;
+        }
+        if (!blank_run)
+        {
+          fin.ignore(skipped);
+        }
+        if (controller != nullptr)
+        {
+          controller->on_task_update(task_status::RUNNING, skipped);
+        }
+        bytes_written += skipped;
+        continue;
+      }
+      
+      // A blank block in a sparse file only has to be erased, and only if it
+      // isn't blank on the cartridge already
+      if (file_header.version == NGF_SPARSE_HEADER_VERSION && block_header.num_bytes == 0)
+      {
+        if (block_header.address != block->base_address)
+        {
+          throw std::runtime_error("Save file does not fit on this cartridge");
+        }
+        
+        unsigned int run_bytes = block->num_bytes;
+        if (run_bytes > bytes_total - bytes_written)
+        {
+          run_bytes = bytes_total - bytes_written;
+        }
+        
+        if (erased_blocks[curr_chip][curr_block] == false)
+        {
+          buffer_size = walk_read_block(m_chips[curr_chip], block->base_address, buffer, run_bytes, controller);
+          
+          if (buffer_size != run_bytes || !is_blank_block(buffer, buffer_size))
+          {
+            m_chips[curr_chip]->erase_block(block->base_address);
+            m_chips[curr_chip]->wait_for_erase(controller);
+          }
+          erased_blocks[curr_chip][curr_block] = true;
+        }
+        else if (controller != nullptr)
+        {
+          controller->on_task_update(task_status::RUNNING, run_bytes);
+        }
+        
+        bytes_written += run_bytes;
+        continue;
+      }
       
       
       
       // With the destination block and chip found, transfer data from file
-#ifdef VERBOSE
-      std::cout << "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)" << endl;
-#endif
+      LOG_STREAM(log_level::VERBOSE, "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)");
       
       // Calculate number of expected bytes
       unsigned bytes_expected = block_header.num_bytes;
@@ -1088,37 +1642,13 @@ void ngp_cartridge::restore_cartridge_save_data(std::istream& fin, int slot, tas
         m_chips[curr_chip]->erase_block(block->base_address);
         
         // Wait for erasure to complete
-        while (m_chips[curr_chip]->test_erasing())
-        {
-          if (controller != nullptr)
-          {
-            controller->on_task_update(task_status::RUNNING, 0);
-          }
-        }
+        m_chips[curr_chip]->wait_for_erase(controller);
         
         erased_blocks[curr_chip][curr_block] = true;
       }
       
       // Write buffer to cartridge
-      if (controller == nullptr)
-      {
-        m_chips[curr_chip]->program_bytes(block_header.address, buffer, buffer_size);
-      }
-      else
-      {
-        forwarding_task_controller fwd_controller(controller);
-        fwd_controller.scale_work_to(buffer_size);
-        try
-        {
-          m_chips[curr_chip]->program_bytes(block_header.address, buffer, buffer_size, &fwd_controller);
-        }
-        catch (std::exception& ex)
-        {
-          (void) ex;
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-          throw;
-        }
-      }
+      walk_program_block(m_chips[curr_chip], block_header.address, buffer, buffer_size, controller);
       
       bytes_written += buffer_size;
     }
@@ -1131,8 +1661,8 @@ void ngp_cartridge::restore_cartridge_save_data(std::istream& fin, int slot, tas
     (void) ex;
     // Error occured! Clean up and pass error on to caller
     try {
-      // Spinlock while the chip finishes erasing (if it was erasing)
-      while (m_chips[curr_chip]->is_erasing());
+      // Wait while the chip finishes erasing (if it was erasing)
+      m_chips[curr_chip]->wait_for_erase();
     } catch (exception ex2) {
       // Well... this is awkward
     }
@@ -1160,7 +1690,6 @@ void ngp_cartridge::restore_cartridge_save_data(std::istream& fin, int slot, tas
       delete [] erased_blocks[c];
     }
     delete [] erased_blocks;
-    delete [] buffer;
     
     throw;
   }
@@ -1175,7 +1704,6 @@ void ngp_cartridge::restore_cartridge_save_data(std::istream& fin, int slot, tas
     delete [] erased_blocks[c];
   }
   delete [] erased_blocks;
-  delete [] buffer;
 }
 
 bool ngp_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, task_controller* controller)
@@ -1232,18 +1760,22 @@ bool ngp_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, tas
   unsigned int curr_chip = chip_lower_bound;
   unsigned int curr_block = 0;
   bool         matched = true;
+  vector<vector<bool>> saved = save_blocks(chip_lower_bound, chip_upper_bound);
   
   // Allocate a buffer with max size of a block
   const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
   unsigned int       f_buffer_size = 0;
-  unsigned char*     f_buffer = new unsigned char[BUFFER_MAX_SIZE];
+  buffer_pool::buffer f_buffer_memory = m_linkmasta->buffers().acquire(BUFFER_MAX_SIZE);
+  unsigned char*     f_buffer = f_buffer_memory.data();
   unsigned int       c_buffer_size = 0;
-  unsigned char*     c_buffer = new unsigned char[BUFFER_MAX_SIZE];
+  buffer_pool::buffer c_buffer_memory = m_linkmasta->buffers().acquire(BUFFER_MAX_SIZE);
+  unsigned char*     c_buffer = c_buffer_memory.data();
   
   // Inform controller that task is starting
   if (controller != nullptr)
   {
     controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_VERIFY);
   }
   
   // Begin comparing data block-by-block
@@ -1279,29 +1811,40 @@ bool ngp_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, tas
       }
       
       // Determine the block index on which the block resides
-      for (curr_block = 0; curr_block < chip->num_blocks; ++curr_block)
-      {
-        block = chip->blocks[curr_block];
-        if (block_header.address <= block->base_address)
-        {
-          break;
-        }
-      }
+      int found_block = layout()->find_block(curr_chip, block_header.address);
+      curr_block = (found_block < 0 ? chip->num_blocks : (unsigned int) found_block);
+      block = (found_block < 0 ? nullptr : chip->blocks[curr_block]);
       
       // Ensure integrity
       if (curr_block >= chip->num_blocks
           || block_header.address != block->base_address
-          || block_header.num_bytes != block->num_bytes)
+          || (block_header.num_bytes != block->num_bytes
+              && (file_header.version != NGF_SPARSE_HEADER_VERSION || block_header.num_bytes != 0)))
       {
         throw std::runtime_error("Save file does not fit on this cartridge");
       }
       
+      // Blocks the game doesn't save to hold the game, even when an older
+      // backup included them
+      if (!block->is_protected && !saved[curr_chip][curr_block])
+      {
+        unsigned int skipped = block->num_bytes;
+        if (skipped > bytes_total - bytes_written)
+        {
+          skipped = bytes_total - bytes_written;
+        }
+        if (block_header.num_bytes != 0)
+        {
+          fin.ignore(skipped);
+        }
+        bytes_written += skipped;
+        continue;
+      }
+      
       
       
       // With the destination block and chip found, transfer data from file
-#ifdef VERBOSE
-      std::cout << "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)" << endl;
-#endif
+      LOG_STREAM(log_level::VERBOSE, "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)");
       
       // Calculate number of expected bytes
       unsigned bytes_expected = block->num_bytes;
@@ -1310,9 +1853,19 @@ bool ngp_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, tas
         bytes_expected = bytes_total - bytes_written;
       }
       
-      // Attempt to read bytes from file
-      fin.read((char*) f_buffer, bytes_expected);
-      f_buffer_size = (unsigned int) fin.gcount();
+      // Attempt to read bytes from file. Blank blocks in sparse files have
+      // no data in the file
+      bool blank_run = (file_header.version == NGF_SPARSE_HEADER_VERSION && block_header.num_bytes == 0);
+      if (blank_run)
+      {
+        memset(f_buffer, 0xFF, bytes_expected);
+        f_buffer_size = bytes_expected;
+      }
+      else
+      {
+        fin.read((char*) f_buffer, bytes_expected);
+        f_buffer_size = (unsigned int) fin.gcount();
+      }
       
       // Check for errors
       if (f_buffer_size != bytes_expected)
@@ -1333,26 +1886,12 @@ bool ngp_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, tas
       }
       
       // Attempt to read bytes from cartridge
-      if (controller == nullptr)
-      {
-        c_buffer_size = m_chips[curr_chip]->read_bytes(block->base_address, c_buffer, bytes_expected);
-      }
-      else
+      c_buffer_size = walk_read_block(m_chips[curr_chip], block->base_address, c_buffer, bytes_expected, controller);
+      
+      // A read cut short by cancelling just ends the comparison early
+      if (c_buffer_size != bytes_expected && controller != nullptr && controller->is_task_cancelled())
       {
-        // Use a forwarding controller to pass progress updates to our controller
-        forwarding_task_controller fwd_controller(controller);
-        fwd_controller.scale_work_to(bytes_expected);
-        try
-        {
-          c_buffer_size = m_chips[curr_chip]->read_bytes(block->base_address, c_buffer, bytes_expected, &fwd_controller);
-        }
-        catch (std::exception& ex)
-        {
-          (void) ex;
-          // Inform controller of error
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-          throw;
-        }
+        break;
       }
       
       // Check for errors
@@ -1367,13 +1906,10 @@ bool ngp_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, tas
       
       
       // Compare contents of buffers
-      for (unsigned int i = 0; i < f_buffer_size && i < c_buffer_size; ++i)
+      unsigned int compare_size = (f_buffer_size < c_buffer_size ? f_buffer_size : c_buffer_size);
+      if (find_first_difference(f_buffer, c_buffer, compare_size) != compare_size)
       {
-        if (f_buffer[i] != c_buffer[i])
-        {
-          matched = false;
-          break;
-        }
+        matched = false;
       }
       
       bytes_written += f_buffer_size;
@@ -1386,32 +1922,7 @@ bool ngp_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, tas
   {
     (void) ex;
     // Error occured! Clean up and pass error on to caller
-    try {
-      // Spinlock while the chip finishes erasing (if it was erasing)
-      while (m_chips[curr_chip]->is_erasing());
-    } catch (exception ex2) {
-      // Well... this is awkward
-    }
-    
-    try {
-      // Attempt to reset the chip
-      m_chips[curr_chip]->reset();
-    } catch (exception ex2) {
-      // Well... this is awkward
-    }
-    
-    try {
-      m_linkmasta->close();
-    } catch (exception ex2) {
-      // Well... this is awkward
-    }
-    
-    if (controller != nullptr)
-    {
-      controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-    }
-    delete [] f_buffer;
-    delete [] c_buffer;
+    abandon_block_walk(m_chips[curr_chip], m_linkmasta, controller);
     throw;
   }
   
@@ -1421,11 +1932,82 @@ bool ngp_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, tas
     controller->on_task_end(controller->is_task_cancelled() && bytes_written < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_written);
   }
   
-  delete [] f_buffer;
-  delete [] c_buffer;
   return matched;
 }
 
+bool ngp_cartridge::differential_restore() const
+{
+  return m_differential_restore;
+}
+
+void ngp_cartridge::set_differential_restore(bool enabled)
+{
+  m_differential_restore = enabled;
+}
+
+bool ngp_cartridge::probe_block_protection() const
+{
+  return m_probe_block_protection;
+}
+
+void ngp_cartridge::set_probe_block_protection(bool enabled)
+{
+  m_probe_block_protection = enabled;
+}
+
+bool ngp_cartridge::sparse_saves() const
+{
+  return m_sparse_saves;
+}
+
+void ngp_cartridge::set_sparse_saves(bool enabled)
+{
+  m_sparse_saves = enabled;
+}
+
+bool ngp_cartridge::limit_saves_to_game() const
+{
+  return m_limit_saves_to_game;
+}
+
+void ngp_cartridge::set_limit_saves_to_game(bool enabled)
+{
+  m_limit_saves_to_game = enabled;
+}
+
+bool ngp_cartridge::trimmed_backups() const
+{
+  return m_trimmed_backups;
+}
+
+void ngp_cartridge::set_trimmed_backups(bool enabled)
+{
+  m_trimmed_backups = enabled;
+}
+
+void ngp_cartridge::clear_descriptor_cache()
+{
+  lock_guard<mutex> lock(descriptor_cache_mutex);
+  descriptor_cache.clear();
+}
+
+void ngp_cartridge::add_known_cartridge(unsigned short game_id, unsigned char game_version, unsigned int num_chips, unsigned int num_bytes, const std::vector<known_block>& unprotected_blocks)
+{
+  known_cartridge known;
+  known.num_chips = num_chips;
+  known.num_bytes = num_bytes;
+  known.unprotected_blocks = unprotected_blocks;
+  
+  lock_guard<mutex> lock(known_cartridges_mutex);
+  known_cartridges[((unsigned int) game_id << 8) | game_version] = known;
+}
+
+void ngp_cartridge::add_game_save_regions(unsigned short game_id, unsigned char game_version, const std::vector<save_region>& regions)
+{
+  lock_guard<mutex> lock(game_save_regions_mutex);
+  game_save_regions[((unsigned int) game_id << 8) | game_version] = regions;
+}
+
 unsigned int ngp_cartridge::num_slots() const
 {
   // Ensure class was initialized
@@ -1459,6 +2041,47 @@ unsigned int ngp_cartridge::slot_size(int slot) const
   }
 }
 
+unsigned int ngp_cartridge::game_backup_size(int slot) const
+{
+  unsigned int bytes_total = slot_size(slot);
+  
+  // Stop at the end of the game if its size is known
+  if (m_trimmed_backups)
+  {
+    unsigned int used_bytes = game_size(slot);
+    if (used_bytes > 0 && used_bytes < bytes_total)
+    {
+      bytes_total = used_bytes;
+    }
+  }
+  
+  return bytes_total;
+}
+
+unsigned int ngp_cartridge::save_backup_size(int slot) const
+{
+  // Ensure class was initialized
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Cartridge not initialized");
+  }
+  
+  // Saves live in the blocks of the slot that aren't write protected and
+  // that the game saves to, if known
+  if (slot == SLOT_ALL)
+  {
+    return count_save_bytes(descriptor(), save_blocks(0, descriptor()->num_chips), nullptr);
+  }
+  else if (slot >= 0 && slot < (int) num_slots())
+  {
+    return count_save_bytes(descriptor(), save_blocks(slot, slot + 1), nullptr);
+  }
+  else
+  {
+    throw std::runtime_error("INVALID SLOT");
+  }
+}
+
 std::string ngp_cartridge::fetch_game_name(int slot)
 {
   // Make sure cartridge has been initialized
@@ -1501,6 +2124,75 @@ std::string ngp_cartridge::fetch_game_name(int slot)
   return s;
 }
 
+void ngp_cartridge::fetch_slot_table(slot_table& table) const
+{
+  // Ensure class was initialized
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Cartridge not initialized");
+  }
+  
+  if (m_metadata.size() > SLOT_TABLE_MAX_SLOTS)
+  {
+    throw std::runtime_error("Too many slots for a slot table");
+  }
+  
+  table.clear();
+  table.system = (unsigned char) system();
+  table.type = (unsigned char) type();
+  table.num_slots = (unsigned char) m_metadata.size();
+  for (unsigned int i = 0; i < m_metadata.size(); ++i)
+  {
+    slot_table::entry& e = table.slots[i];
+    e.num_bytes = slot_size((int) i);
+    e.startup_address = (unsigned int) m_metadata[i].startup_address;
+    e.game_id = m_metadata[i].game_id;
+    e.version = m_metadata[i].game_version;
+    e.minimum_system = m_metadata[i].minimum_system;
+    strncpy(e.game_name, m_metadata[i].game_name, SLOT_TABLE_NAME_BYTES);
+  }
+}
+
+unsigned int ngp_cartridge::read_cartridge_game_data(int slot, unsigned int offset, unsigned char* buffer, unsigned int num_bytes)
+{
+  // Make sure cartridge has been initialized
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Cartridge not initialized");
+  }
+  
+  // Verify parameters
+  if (slot >= (int) num_slots() || slot < 0)
+  {
+    throw std::invalid_argument("Invalid slot number");
+  }
+  if (offset > slot_size(slot) || num_bytes > slot_size(slot) - offset)
+  {
+    throw std::invalid_argument("Range does not fit in slot");
+  }
+  
+  unsigned int bytes_read = 0;
+  try
+  {
+    m_linkmasta->open();
+    bytes_read = m_chips[slot]->read_bytes(offset, buffer, num_bytes);
+    m_linkmasta->close();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    try {
+      m_linkmasta->close();
+    } catch(std::exception& ex2) {
+      // Well... this is awkward
+    }
+    
+    throw;
+  }
+  
+  return bytes_read;
+}
+
 const ngp_cartridge::game_metadata* ngp_cartridge::get_game_metadata(int slot) const
 {
   // Ensure class was initialized
@@ -1518,6 +2210,33 @@ const ngp_cartridge::game_metadata* ngp_cartridge::get_game_metadata(int slot) c
   return &m_metadata[slot];
 }
 
+unsigned int ngp_cartridge::game_size(int slot) const
+{
+  // A FlashMasta cartridge may hold a different game on each chip
+  if (slot == SLOT_ALL && type() != CARTRIDGE_OFFICIAL)
+  {
+    return 0;
+  }
+  
+  const game_metadata* metadata = get_game_metadata(slot == SLOT_ALL ? 0 : slot);
+  if (metadata == nullptr)
+  {
+    return 0;
+  }
+  
+  unsigned int num_bytes;
+  {
+    lock_guard<mutex> lock(known_cartridges_mutex);
+    auto it = known_cartridges.find(((unsigned int) metadata->game_id << 8) | metadata->game_version);
+    if (it == known_cartridges.end())
+    {
+      return 0;
+    }
+    num_bytes = it->second.num_bytes;
+  }
+  return std::min(num_bytes, slot_size(slot));
+}
+
 
 
 bool ngp_cartridge::test_for_cartridge(linkmasta_device* linkmasta)
@@ -1534,6 +2253,108 @@ bool ngp_cartridge::test_for_cartridge(linkmasta_device* linkmasta)
   return exists;
 }
 
+bool ngp_cartridge::probe_for_cartridge(linkmasta_device* linkmasta)
+{
+  bool exists;
+  
+  linkmasta->open();
+  try
+  {
+    ngp_chip chip(linkmasta, 0);
+    exists = chip.test_present();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    linkmasta->close();
+    throw;
+  }
+  linkmasta->close();
+  
+  return exists;
+}
+
+std::string ngp_cartridge::fingerprint_cartridge(linkmasta_device* linkmasta)
+{
+  std::ostringstream fingerprint;
+  
+  linkmasta->open();
+  try
+  {
+    unsigned int num_chips = 0;
+    for (unsigned int i = 0; i < MAX_NUM_CHIPS; ++i)
+    {
+      ngp_chip chip(linkmasta, i);
+      ngp_chip::manufact_id_t manufacturer = chip.get_manufacturer_id();
+      ngp_chip::device_id_t   device_id    = chip.get_device_id();
+      chip.reset();
+      if (manufacturer == 0x90 && device_id == 0x90)
+      {
+        break;
+      }
+      
+      fingerprint << std::hex << (unsigned int) manufacturer << ":" << (unsigned int) device_id << ",";
+      ++num_chips;
+    }
+    
+    // The header names the game and its version, so a cartridge flashed with
+    // another game tells itself apart
+    if (num_chips > 0)
+    {
+      unsigned char buffer[FINGERPRINT_HEADER_BYTES];
+      ngp_chip chip(linkmasta, 0);
+      chip.read_bytes(0, buffer, FINGERPRINT_HEADER_BYTES);
+      fingerprint << std::hex << crc32_data(buffer, FINGERPRINT_HEADER_BYTES);
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    linkmasta->close();
+    throw;
+  }
+  linkmasta->close();
+  
+  return fingerprint.str();
+}
+
+cartridge_descriptor* ngp_cartridge::build_image_descriptor(unsigned int num_bytes)
+{
+  // Use the smallest chip that holds the image, and two of the largest for
+  // images that don't fit one
+  unsigned int chip_bytes = 0x80000;
+  while (chip_bytes < num_bytes && chip_bytes < 0x200000)
+  {
+    chip_bytes *= 2;
+  }
+  unsigned int num_chips = (num_bytes > chip_bytes ? 2 : 1);
+  if (num_bytes > num_chips * chip_bytes)
+  {
+    throw std::invalid_argument("Image is too large for a Neo Geo Pocket cartridge");
+  }
+  
+  cartridge_descriptor* descriptor = new cartridge_descriptor(num_chips);
+  descriptor->system = SYSTEM_NEO_GEO_POCKET;
+  descriptor->type = CARTRIDGE_OFFICIAL;
+  descriptor->num_bytes = num_chips * chip_bytes;
+  
+  for (unsigned int i = 0; i < num_chips; ++i)
+  {
+    cartridge_descriptor::chip_descriptor* chip_desc = new cartridge_descriptor::chip_descriptor(chip_num_blocks(chip_bytes));
+    chip_desc->num_bytes = chip_bytes;
+    chip_desc->chip_num = i;
+    chip_desc->manufacturer_id = 0;
+    chip_desc->device_id = (chip_bytes == 0x200000 ? 0x2F : (chip_bytes == 0x100000 ? 0x2C : 0xAB));
+    descriptor->chips[i] = chip_desc;
+    
+    for (unsigned int j = 0; j < chip_desc->num_blocks; ++j)
+    {
+      chip_desc->blocks[j] = make_block_descriptor(chip_desc->num_blocks, j);
+    }
+  }
+  return descriptor;
+}
+
 
 
 void ngp_cartridge::build_cartridge_destriptor()
@@ -1545,13 +2366,16 @@ void ngp_cartridge::build_cartridge_destriptor()
   }
   
   ngp_chip* chip;
+  descriptor_cache_key key;
   
   for (unsigned int i = 0; i < MAX_NUM_CHIPS; ++i)
   {
     chip = new ngp_chip(m_linkmasta, i);
     
     // Check if chip exists or not
-    if (chip->get_manufacturer_id() == 0x90 && chip->get_device_id() == 0x90)
+    ngp_chip::manufact_id_t manufacturer = chip->get_manufacturer_id();
+    ngp_chip::device_id_t   device_id    = chip->get_device_id();
+    if (manufacturer == 0x90 && device_id == 0x90)
     {
       delete chip;
       m_num_chips = i;
@@ -1562,20 +2386,72 @@ void ngp_cartridge::build_cartridge_destriptor()
     m_num_chips = i + 1;
     
     // Initialize chip
-    m_chips[i]->test_bypass_support();
+    ngp_chip::factory_prot_t factory_prot = chip->get_factory_prot();
+    m_chips[i]->test_bypass_support(factory_prot);
+    
+    key.push_back(manufacturer);
+    key.push_back(device_id);
+    key.push_back(factory_prot);
+  }
+  
+  // Reuse a previously built descriptor if we've seen these chips before
+  {
+    lock_guard<mutex> lock(descriptor_cache_mutex);
+    auto it = descriptor_cache.find(key);
+    if (it != descriptor_cache.end())
+    {
+      m_descriptor = new cartridge_descriptor(*it->second);
+    }
+  }
+  bool cached = (m_descriptor != nullptr);
+  
+  if (!cached)
+  {
+    // Initialize cartridge descriptor
+    m_descriptor = new cartridge_descriptor(m_num_chips);
+    m_descriptor->system = SYSTEM_NEO_GEO_POCKET;
+    m_descriptor->type = (m_num_chips > 0 && key[2] == 0x85 ? CARTRIDGE_FLASHMASTA : CARTRIDGE_OFFICIAL);
+    m_descriptor->num_bytes = 0;
+    
+    // Build chips
+    for (unsigned int i = 0; i < m_num_chips; ++i)
+    {
+      build_chip_descriptor(i);
+      m_descriptor->num_bytes += m_descriptor->chips[i]->num_bytes;
+    }
   }
   
-  // Initialize cartridge descriptor
-  m_descriptor = new cartridge_descriptor(m_num_chips);
-  m_descriptor->system = SYSTEM_NEO_GEO_POCKET;
-  m_descriptor->type = (m_chips[0]->get_factory_prot() == 0x85 ? CARTRIDGE_FLASHMASTA : CARTRIDGE_OFFICIAL);
-  m_descriptor->num_bytes = 0;
+  // Known official cartridges don't need their blocks queried one by one
+  if ((!cached || m_probe_block_protection) && !seed_block_protection())
+  {
+    for (unsigned int i = 0; i < m_num_chips; ++i)
+    {
+      build_block_protection(i);
+    }
+  }
+  
+  if (!cached)
+  {
+    lock_guard<mutex> lock(descriptor_cache_mutex);
+    descriptor_cache[key] = std::make_shared<const cartridge_descriptor>(*m_descriptor);
+  }
+}
+
+void ngp_cartridge::apply_erase_history()
+{
+  if (m_descriptor == nullptr)
+  {
+    return;
+  }
   
-  // Build chips
   for (unsigned int i = 0; i < m_num_chips; ++i)
   {
-    build_chip_descriptor(i);
-    m_descriptor->num_bytes += m_descriptor->chips[i]->num_bytes;
+    erase_history::chip_key key;
+    key.serial = m_erase_serial;
+    key.chip_num = i;
+    key.manufacturer_id = m_descriptor->chips[i]->manufacturer_id;
+    key.device_id = m_descriptor->chips[i]->device_id;
+    m_chips[i]->set_erase_history(m_erase_history, key);
   }
 }
 
@@ -1616,13 +2492,8 @@ void ngp_cartridge::build_chip_descriptor(unsigned int chip_i)
     break;
   }
   
-  // Calculate number of blocks. (1 block per 64 Kib (8 KiB))
-  num_blocks = num_bytes / DEFAULT_BLOCK_SIZE;
-  if (num_blocks > 0)
-  {
-    // Account for last block being split into 4
-    num_blocks += 3;
-  }
+  // Calculate number of blocks
+  num_blocks = chip_num_blocks(num_bytes);
   
   // Initialize chip descriptor
   chip_desc = new cartridge_descriptor::chip_descriptor(num_blocks);
@@ -1642,62 +2513,194 @@ void ngp_cartridge::build_chip_descriptor(unsigned int chip_i)
 
 void ngp_cartridge::build_block_descriptor(unsigned int chip_i, unsigned int block_i)
 {
-  ngp_chip* chip = m_chips[chip_i];
+  // Add (unfinished) block descriptor to chip descriptor
+  m_descriptor->chips[chip_i]->blocks[block_i] = make_block_descriptor(m_descriptor->chips[chip_i]->num_blocks, block_i);
+}
+
+void ngp_cartridge::build_block_protection(unsigned int chip_i)
+{
+  cartridge_descriptor::chip_descriptor* chip_desc = m_descriptor->chips[chip_i];
+  std::vector<ngp_chip::address_t> addresses(chip_desc->num_blocks);
+  std::unique_ptr<ngp_chip::protect_t[]> protections(new ngp_chip::protect_t[chip_desc->num_blocks]);
+  for (unsigned int i = 0; i < chip_desc->num_blocks; ++i)
+  {
+    addresses[i] = chip_desc->blocks[i]->base_address;
+  }
   
-  // Initialize block descriptor
-  cartridge_descriptor::chip_descriptor::block_descriptor* block;
-  block = new cartridge_descriptor::chip_descriptor::block_descriptor();
-  block->block_num = block_i;
+  m_chips[chip_i]->get_block_protections(addresses.data(), protections.get(), chip_desc->num_blocks);
   
-  // Add (unfinished) block descriptor to chip descriptor
-  m_descriptor->chips[chip_i]->blocks[block_i] = block;
+  for (unsigned int i = 0; i < chip_desc->num_blocks; ++i)
+  {
+    chip_desc->blocks[i]->is_protected = protections[i];
+  }
+}
+
+bool ngp_cartridge::seed_block_protection()
+{
+  if (m_descriptor->type != CARTRIDGE_OFFICIAL || m_num_chips == 0)
+  {
+    return false;
+  }
   
-  // Determine size of block based on index of block relative to total number
-  // of blocks on chip
-  switch (m_descriptor->chips[chip_i]->num_blocks - block_i)
+  // Skip reading the header when there's nothing to look it up in
   {
-  case 1:    // Last block on chip
-    block->num_bytes = DEFAULT_BLOCK_SIZE / 4;
-    break;
-    
-  case 2:    // Second-last block on chip
-  case 3:    // Third-last block on chip
-    block->num_bytes = DEFAULT_BLOCK_SIZE / 8;
-    break;
-    
-  case 4:    // Fourth-last block on chip
-    block->num_bytes = DEFAULT_BLOCK_SIZE / 2;
-    break;
-    
-  default:   // Some other block
-    block->num_bytes = DEFAULT_BLOCK_SIZE;
-    break;
+    lock_guard<mutex> lock(known_cartridges_mutex);
+    if (known_cartridges.empty())
+    {
+      return false;
+    }
   }
   
-  // Determine base address of block based on index of block relative to total
-  // number of blocks on chip
-  block->base_address = 0;
-  unsigned int num_basic_blocks = m_descriptor->chips[chip_i]->num_blocks - 4;
-  switch (m_descriptor->chips[chip_i]->num_blocks - block_i)
+  unsigned char buffer[64];
+  m_chips[0]->read_bytes(0, buffer, 64);
+  game_metadata metadata;
+  metadata.read_from_data_array(buffer);
+  
+  known_cartridge known;
   {
-  // Note: Fall-throughs are intended
-  case 1:    // Last block on chip
-    block->base_address += DEFAULT_BLOCK_SIZE / 8;
-    
-  case 2:    // Second-last block on chip
-    block->base_address += DEFAULT_BLOCK_SIZE / 8;
-    
-  case 3:    // Third-last block on chip
-    block->base_address += DEFAULT_BLOCK_SIZE / 2;
+    lock_guard<mutex> lock(known_cartridges_mutex);
+    auto it = known_cartridges.find(((unsigned int) metadata.game_id << 8) | metadata.game_version);
+    if (it == known_cartridges.end())
+    {
+      return false;
+    }
+    known = it->second;
+  }
+  
+  // A cartridge with other chips than registered is not the one registered
+  if (known.num_chips != m_num_chips || known.num_bytes != m_descriptor->num_bytes)
+  {
+    return false;
+  }
+  for (const known_block& unprotected : known.unprotected_blocks)
+  {
+    if (unprotected.chip >= m_num_chips
+        || unprotected.block_num >= m_descriptor->chips[unprotected.chip]->num_blocks
+        || m_descriptor->chips[unprotected.chip]->blocks[unprotected.block_num]->base_address != unprotected.base_address)
+    {
+      return false;
+    }
+  }
+  
+  // Every block is protected except those registered as unprotected
+  for (unsigned int i = 0; i < m_num_chips; ++i)
+  {
+    for (unsigned int j = 0; j < m_descriptor->chips[i]->num_blocks; ++j)
+    {
+      m_descriptor->chips[i]->blocks[j]->is_protected = true;
+    }
+  }
+  for (const known_block& unprotected : known.unprotected_blocks)
+  {
+    m_descriptor->chips[unprotected.chip]->blocks[unprotected.block_num]->is_protected = false;
+  }
+  return true;
+}
+
+void ngp_cartridge::learn_save_regions()
+{
+  if (m_descriptor->type != CARTRIDGE_OFFICIAL || m_metadata.empty())
+  {
+    return;
+  }
+  
+  // A cartridge without protected blocks doesn't tell where the game saves
+  vector<save_region> regions;
+  bool any_protected = false;
+  for (unsigned int i = 0; i < m_descriptor->num_chips; ++i)
+  {
+    for (unsigned int j = 0; j < m_descriptor->chips[i]->num_blocks; ++j)
+    {
+      const cartridge_descriptor::chip_descriptor::block_descriptor* block = m_descriptor->chips[i]->blocks[j];
+      if (block->is_protected)
+      {
+        any_protected = true;
+      }
+      else
+      {
+        save_region region;
+        region.chip = i;
+        region.base_address = block->base_address;
+        region.num_bytes = block->num_bytes;
+        regions.push_back(region);
+      }
+    }
+  }
+  if (!any_protected || regions.empty())
+  {
+    return;
+  }
+  
+  add_game_save_regions(m_metadata[0].game_id, m_metadata[0].game_version, regions);
+}
+
+std::vector<std::vector<bool>> ngp_cartridge::save_blocks(unsigned int chip_lower_bound, unsigned int chip_upper_bound) const
+{
+  const cartridge_descriptor* desc = m_descriptor;
+  vector<vector<bool>> unprotected(desc->num_chips);
+  for (unsigned int i = 0; i < desc->num_chips; ++i)
+  {
+    unprotected[i].assign(desc->chips[i]->num_blocks, false);
+    for (unsigned int j = 0; i >= chip_lower_bound && i < chip_upper_bound && j < desc->chips[i]->num_blocks; ++j)
+    {
+      unprotected[i][j] = !desc->chips[i]->blocks[j]->is_protected;
+    }
+  }
+  
+  if (!m_limit_saves_to_game || chip_lower_bound >= m_metadata.size())
+  {
+    return unprotected;
+  }
+  
+  vector<save_region> regions;
+  {
+    lock_guard<mutex> lock(game_save_regions_mutex);
+    auto it = game_save_regions.find(((unsigned int) m_metadata[chip_lower_bound].game_id << 8) | m_metadata[chip_lower_bound].game_version);
+    if (it == game_save_regions.end())
+    {
+      return unprotected;
+    }
+    regions = it->second;
+  }
+  
+  // Keep the unprotected blocks overlapping any of the game's regions
+  vector<vector<bool>> saved(desc->num_chips);
+  vector<bool> any_saved(desc->num_chips, false);
+  for (unsigned int i = 0; i < desc->num_chips; ++i)
+  {
+    saved[i].assign(desc->chips[i]->num_blocks, false);
+  }
+  for (const save_region& region : regions)
+  {
+    unsigned int chip_i = chip_lower_bound + region.chip;
+    if (chip_i >= chip_upper_bound || chip_i >= desc->num_chips)
+    {
+      continue;
+    }
     
-  case 4:    // Fourth-last block on chip
-  default:   // Some other block
-    block->base_address += (block_i > num_basic_blocks ? num_basic_blocks : block_i) * DEFAULT_BLOCK_SIZE;
-    break;
+    unsigned long long region_end = (unsigned long long) region.base_address + (region.num_bytes == 0 ? 1 : region.num_bytes);
+    for (unsigned int j = 0; j < desc->chips[chip_i]->num_blocks; ++j)
+    {
+      const cartridge_descriptor::chip_descriptor::block_descriptor* block = desc->chips[chip_i]->blocks[j];
+      unsigned long long block_end = (unsigned long long) block->base_address + block->num_bytes;
+      if (unprotected[chip_i][j] && block->base_address < region_end && region.base_address < block_end)
+      {
+        saved[chip_i][j] = true;
+        any_saved[chip_i] = true;
+      }
+    }
   }
   
-  // Query chip for protection status of block
-  block->is_protected = (chip->get_block_protection(block->base_address) == 0 ? false : true);
+  // Chips that no region matches, such as those holding other games, keep
+  // every unprotected block
+  for (unsigned int i = 0; i < desc->num_chips; ++i)
+  {
+    if (!any_saved[i])
+    {
+      saved[i] = unprotected[i];
+    }
+  }
+  return saved;
 }
 
 void ngp_cartridge::build_game_metadata(int slot)
@@ -1715,12 +2718,11 @@ void ngp_cartridge::build_game_metadata(int slot)
   else if (slot >= 0 && slot < (int) m_metadata.size())
   {
     // Read metadata from cartridge and build metadata from it
-    unsigned char* buffer = new unsigned char[64];
+    unsigned char buffer[64];
     
     m_chips[slot]->read_bytes(0, buffer, 64);
     
     m_metadata[slot].read_from_data_array(buffer);
-    delete [] buffer;
   }
 }
 
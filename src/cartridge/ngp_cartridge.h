@@ -17,7 +17,9 @@
 #include <vector>
 
 class linkmasta_device;
+class rom_image;
 class ngp_chip;
+class write_pipeline;
 
 /*! \class ngp_cartridge
  *  \brief Class representing a Neo Geo Pocket game cartridge.
@@ -67,6 +69,36 @@ public:
     char           game_name[13];
   };
   
+  /*! \struct known_block
+   *  \brief A block that a known official cartridge leaves unprotected.
+   *  
+   *  \see add_known_cartridge()
+   */
+  struct known_block
+  {
+    unsigned int   chip;
+    unsigned int   block_num;
+    unsigned int   base_address;
+  };
+  
+  /*! \struct save_region
+   *  \brief A part of the chips that a game writes its saves to.
+   *  
+   *  \see add_game_save_regions()
+   */
+  struct save_region
+  {
+    /*! \brief The chip, counting from the first chip of the game's slot. */
+    unsigned int   chip;
+    
+    /*! \brief The address of the start of the region on the chip. */
+    unsigned int   base_address;
+    
+    /*! \brief The size of the region in bytes, or 0 for just the block at
+     *         \ref base_address, however large it is on the cartridge. */
+    unsigned int   num_bytes;
+  };
+  
   
   
   /*! \brief Class constructor.
@@ -111,6 +143,11 @@ public:
    */
   const cartridge_descriptor* descriptor() const;
   
+  /*!
+   *  \see cartridge::layout()
+   */
+  const cartridge_layout* layout() const;
+  
   
   
   /*!
@@ -118,6 +155,16 @@ public:
    */
   void                  init();
   
+  /*!
+   *  \see cartridge::set_journal(job_journal* journal)
+   */
+  void                  set_journal(job_journal* journal);
+  
+  /*!
+   *  \see cartridge::set_erase_history(erase_history* history, const std::string& serial)
+   */
+  void                  set_erase_history(erase_history* history, const std::string& serial);
+  
   /*!
    *  \see cartridge::backup_cartridge_game_data(std::ostream& fout, task_controller* controller = nullptr)
    */
@@ -128,11 +175,36 @@ public:
    */
   void                  restore_cartridge_game_data(std::istream& fin, int slot = SLOT_ALL, task_controller* controller = nullptr);
   
+  /*!
+   *  \see cartridge::restore_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+   */
+  void                  restore_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*!
+   *  \see cartridge::restore_and_verify_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
+   */
+  bool                  restore_and_verify_cartridge_game_data(std::istream& fin, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*!
+   *  \see cartridge::restore_and_verify_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+   */
+  bool                  restore_and_verify_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
   /*!
    *  \see cartridge::compare_cartridge_game_data(std::istream& fin, task_controller* controller = nullptr)
    */
   bool                  compare_cartridge_game_data(std::istream& fin, int slot = SLOT_ALL, task_controller* controller = nullptr);
   
+  /*!
+   *  \see cartridge::compare_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+   */
+  bool                  compare_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*!
+   *  \see cartridge::compare_cartridge_game_data(const digest_manifest& manifest, int slot, task_controller* controller)
+   */
+  bool                  compare_cartridge_game_data(const digest_manifest& manifest, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
   /*!
    *  \see cartridge::backup_cartridge_save_data(std::ostream& fout, task_controller* controller = nullptr)
    */
@@ -158,11 +230,31 @@ public:
    */
   unsigned int          slot_size(int slot) const;
   
+  /*!
+   *  \see cartridge::game_backup_size(int slot) const
+   */
+  unsigned int          game_backup_size(int slot) const;
+  
+  /*!
+   *  \see cartridge::save_backup_size(int slot) const
+   */
+  unsigned int          save_backup_size(int slot) const;
+  
   /*!
    *  \see cartridge::fetch_game_name(int slot)
    */
   std::string           fetch_game_name(int slot);
   
+  /*!
+   *  \see cartridge::fetch_slot_table(slot_table& table) const
+   */
+  void                  fetch_slot_table(slot_table& table) const;
+  
+  /*!
+   *  \see cartridge::read_cartridge_game_data(int slot, unsigned int offset, unsigned char* buffer, unsigned int num_bytes)
+   */
+  unsigned int          read_cartridge_game_data(int slot, unsigned int offset, unsigned char* buffer, unsigned int num_bytes);
+  
   /*!
    * \brief Gets the parsed metadata of the game in the given slot.
    * 
@@ -183,6 +275,215 @@ public:
    */
   const game_metadata*  get_game_metadata(int slot) const;
   
+  /*!
+   *  \brief Gets the number of bytes that the game in a slot actually uses.
+   *  
+   *  Looks the game up by the game id and version in its header among the
+   *  cartridges registered with \ref add_known_cartridge(). For
+   *  \ref SLOT_ALL, only an official cartridge has a single game to look up.
+   *  
+   *  \param slot The slot of the game, or \ref SLOT_ALL.
+   *  
+   *  \return The size of the game in bytes, no more than the size of the
+   *          slot, or 0 if the game's size is unknown.
+   *  
+   *  \see set_trimmed_backups(bool enabled)
+   */
+  unsigned int          game_size(int slot) const;
+  
+  /*!
+   *  \brief Gets whether differential restores are enabled.
+   *  
+   *  Gets whether \ref restore_cartridge_game_data() compares each block with
+   *  the cartridge's current contents before erasing it. See
+   *  \ref set_differential_restore(bool enabled) for details.
+   *  
+   *  \returns true if differential restores are enabled, false otherwise.
+   */
+  bool                  differential_restore() const;
+  
+  /*!
+   *  \brief Enables or disables differential restores.
+   *  
+   *  When enabled, \ref restore_cartridge_game_data() reads each block from
+   *  the cartridge before writing it. Blocks that already match the file are
+   *  skipped entirely, and blocks that are blank (all 0xFF) in the file are
+   *  erased without being programmed. Only blocks that differ are erased and
+   *  reprogrammed. Enabled by default.
+   *  
+   *  \param enabled true to enable differential restores, false to always
+   *         erase and program every block.
+   */
+  void                  set_differential_restore(bool enabled);
+  
+  /*!
+   *  \brief Gets whether block protection is probed on cached descriptors.
+   *  
+   *  Gets whether \ref init() queries every block's protection status even
+   *  when the cartridge's layout was found in the descriptor cache. See
+   *  \ref set_probe_block_protection(bool enabled) for details.
+   *  
+   *  \returns true if block protection is always probed, false otherwise.
+   */
+  bool                  probe_block_protection() const;
+  
+  /*!
+   *  \brief Enables or disables probing block protection on cached
+   *         descriptors.
+   *  
+   *  Cartridge descriptors are cached for the lifetime of the program, keyed
+   *  on the manufacturer id, device id, and factoryProt value of every chip on
+   *  the cartridge. When \ref init() finds a matching descriptor in the cache,
+   *  the chip and block layout is copied from it instead of being rebuilt.
+   *  
+   *  When enabled, the protection status of every block is still queried from
+   *  the cartridge, which costs one round trip per block. When disabled, the
+   *  protection status recorded in the cache is used as-is, so that detecting
+   *  a known cartridge only costs a handful of round trips. Enabled by default.
+   *  
+   *  Either way, the protection status of an official cartridge registered
+   *  with \ref add_known_cartridge() is taken from its registration rather
+   *  than queried.
+   *  
+   *  \param enabled true to always query block protection, false to trust the
+   *         cached values.
+   */
+  void                  set_probe_block_protection(bool enabled);
+  
+  /*!
+   *  \brief Gets whether save data is backed up in the sparse NGF format.
+   *  
+   *  Gets whether \ref backup_cartridge_save_data() writes the sparse NGF
+   *  format. See \ref set_sparse_saves(bool enabled) for details.
+   *  
+   *  \returns true if sparse save files are written, false otherwise.
+   */
+  bool                  sparse_saves() const;
+  
+  /*!
+   *  \brief Enables or disables backing up save data in the sparse NGF format.
+   *  
+   *  When enabled, \ref backup_cartridge_save_data() writes blocks that are
+   *  blank (all 0xFF) as block headers with no data, and marks the file with a
+   *  different version number. Such files are much smaller, and restoring
+   *  them only erases blank blocks that aren't blank on the cartridge already.
+   *  Emulators don't understand the sparse format, so it is disabled by
+   *  default.
+   *  
+   *  \ref restore_cartridge_save_data() and \ref compare_cartridge_save_data()
+   *  accept both formats regardless of this setting.
+   *  
+   *  \param enabled true to write sparse save files, false to write the
+   *         standard format.
+   */
+  void                  set_sparse_saves(bool enabled);
+  
+  /*!
+   *  \brief Gets whether save data is limited to the blocks the game saves
+   *         to.
+   *  
+   *  Gets whether save backups, restores, and comparisons skip the
+   *  unprotected blocks the game on the cartridge is known not to save to.
+   *  See \ref set_limit_saves_to_game(bool enabled) for details.
+   *  
+   *  \returns true if save data is limited to the game's save regions, false
+   *           otherwise.
+   */
+  bool                  limit_saves_to_game() const;
+  
+  /*!
+   *  \brief Enables or disables limiting save data to the blocks the game
+   *         saves to.
+   *  
+   *  Flash cartridges leave every block unprotected, so by default their
+   *  save backups hold the whole cartridge. When enabled and the game in the
+   *  slot has save regions registered with \ref add_game_save_regions(),
+   *  \ref backup_cartridge_save_data() only backs up the unprotected blocks
+   *  overlapping those regions, and \ref restore_cartridge_save_data() and
+   *  \ref compare_cartridge_save_data() skip the other blocks in a save file.
+   *  On chips where no unprotected block overlaps the regions, such as the
+   *  chips of other games when backing up every slot, every unprotected
+   *  block is used as before. Enabled by default.
+   *  
+   *  \param enabled true to limit save data to the game's save regions, false
+   *         to use every unprotected block.
+   */
+  void                  set_limit_saves_to_game(bool enabled);
+  
+  /*!
+   *  \brief Gets whether game data backups stop at the end of the game.
+   *  
+   *  Gets whether \ref backup_cartridge_game_data() only backs up the part of
+   *  a slot the game uses. See \ref set_trimmed_backups(bool enabled) for
+   *  details.
+   *  
+   *  \returns true if backups are trimmed, false otherwise.
+   */
+  bool                  trimmed_backups() const;
+  
+  /*!
+   *  \brief Enables or disables stopping game data backups at the end of the
+   *         game.
+   *  
+   *  When enabled, \ref backup_cartridge_game_data() stops after the number
+   *  of bytes given by \ref game_size(int slot) when the game's size is
+   *  known, instead of backing up the whole slot. A 4 Mbit game in a 16 Mbit
+   *  slot is then backed up in a quarter of the time. Restoring such an image
+   *  only writes the blocks it covers and leaves the rest of the slot as it
+   *  is. Disabled by default.
+   *  
+   *  \param enabled true to trim backups to the game's size, false to always
+   *         back up the whole slot.
+   */
+  void                  set_trimmed_backups(bool enabled);
+  
+  /*!
+   *  \brief Discards all cached cartridge descriptors.
+   *  
+   *  \see set_probe_block_protection(bool enabled)
+   */
+  static void           clear_descriptor_cache();
+  
+  /*!
+   *  \brief Registers the block protection of a known official cartridge.
+   *  
+   *  When \ref init() finds an official cartridge whose header carries the
+   *  given game id and version, and whose chips add up to the given number of
+   *  chips and bytes, the cartridge's blocks are marked as protected except
+   *  for the given ones instead of being queried one by one. Only the chip
+   *  ids then have to be read from the cartridge. Registering the same game
+   *  again replaces the earlier registration.
+   *  
+   *  \param [in] game_id The game id in the cartridge's header.
+   *  \param [in] game_version The game version in the cartridge's header.
+   *  \param [in] num_chips The number of chips on the cartridge.
+   *  \param [in] num_bytes The total size of the cartridge's chips in bytes.
+   *  \param [in] unprotected_blocks Every block the cartridge leaves
+   *         unprotected.
+   *  
+   *  \see known_block
+   */
+  static void           add_known_cartridge(unsigned short game_id, unsigned char game_version, unsigned int num_chips, unsigned int num_bytes, const std::vector<known_block>& unprotected_blocks);
+  
+  /*!
+   *  \brief Registers the parts of the chips a game saves to.
+   *  
+   *  Registers where the game with the given id and version keeps its saves,
+   *  so that its save data can be limited to those blocks on any cartridge
+   *  carrying it, see \ref set_limit_saves_to_game(bool enabled). The game
+   *  catalog registers the save blocks it knows of, and \ref init() learns
+   *  the exact regions from the unprotected blocks of every official
+   *  cartridge it sees. Registering the same game again replaces the earlier
+   *  registration.
+   *  
+   *  \param [in] game_id The game id in the cartridge's header.
+   *  \param [in] game_version The game version in the cartridge's header.
+   *  \param [in] regions Every region the game saves to.
+   *  
+   *  \see save_region
+   */
+  static void           add_game_save_regions(unsigned short game_id, unsigned char game_version, const std::vector<save_region>& regions);
+  
   
   
   /*! \brief Tests the provided \ref linkmasta_device for whether or not a
@@ -208,6 +509,62 @@ public:
    */
   static bool           test_for_cartridge(linkmasta_device* linkmasta);
   
+  /*! \brief Quickly checks the provided \ref linkmasta_device for whether or
+   *         not a cartridge is present.
+   *  
+   *  Cheaper version of \ref test_for_cartridge(linkmasta_device*) meant for
+   *  polling, using a single pipelined word sequence. Only checks that the
+   *  first chip answers, and so can be fooled by a cartridge that is not
+   *  seated properly; confirm with
+   *  \ref test_for_cartridge(linkmasta_device*) when the answer changes.
+   *  
+   *  \param linkmasta The \ref linkmasta_device to use to test if a cartridge
+   *         is present.
+   *  
+   *  \returns **true** A cartridge is likely present.
+   *  \returns **false** A cartridge is likely not present.
+   *  
+   *  \see ngp_chip::test_present()
+   */
+  static bool           probe_for_cartridge(linkmasta_device* linkmasta);
+  
+  /*! \brief Reads a quick fingerprint of the cartridge connected to the
+   *         provided \ref linkmasta_device.
+   *  
+   *  Reads the manufacturer and device IDs of each chip and the game header
+   *  at the start of the first chip, leaving out everything
+   *  \ref init() probes block by block, and combines them into a string that
+   *  is the same every time the same cartridge is read, as long as its game
+   *  hasn't changed.
+   *  
+   *  \param linkmasta The \ref linkmasta_device to read the cartridge through.
+   *  
+   *  \returns The fingerprint, or an empty string if no chip answered.
+   *  
+   *  \see linkmasta_device::fingerprint_cartridge()
+   */
+  static std::string    fingerprint_cartridge(linkmasta_device* linkmasta);
+  
+  /*!
+   *  \brief Builds the descriptor of a cartridge an image is flashed onto,
+   *         without reading a cartridge.
+   *  
+   *  Lays out the smallest of the 4, 8, and 16 Mib chips that holds the
+   *  image, or two 16 Mib chips for images larger than one, with the same
+   *  blocks \ref build_cartridge_descriptor() would find on such a cartridge.
+   *  The chips' manufacturer IDs are left at 0 and no block is protected.
+   *  Lets addresses in an image be told apart by chip and block where no
+   *  cartridge is at hand, such as when comparing two dumps.
+   *  
+   *  \param [in] num_bytes The number of bytes in the image.
+   *  
+   *  \return A new descriptor, which the caller must delete.
+   *  
+   *  \throws std::invalid_argument If the image is too large for any
+   *           cartridge.
+   */
+  static cartridge_descriptor* build_image_descriptor(unsigned int num_bytes);
+  
   
   
 protected:
@@ -221,6 +578,10 @@ protected:
    *  \ref build_chip_descriptor(unsigned int chip_i) automatically to gather
    *  information about the onboard hardware.
    *  
+   *  If a cartridge with the same chips has been seen before, the descriptor
+   *  is copied from the descriptor cache instead of being rebuilt. See
+   *  \ref set_probe_block_protection(bool enabled).
+   *  
    *  Before building the descriptor, this function replaces the internally
    *  cached descriptor with the newly created one. To access the newly created
    *  descriptor, use \ref descriptor().
@@ -234,6 +595,11 @@ protected:
    */
   void                  build_cartridge_destriptor();
   
+  /*!
+   *  \brief Passes \ref m_erase_history on to each chip found so far.
+   */
+  void                  apply_erase_history();
+  
   /*! \brief Creates and populates a \ref cartridge_descriptor::chip_descriptor
    *         struct using information gathered from the associated
    *         \ref linkmasta_device.
@@ -268,10 +634,11 @@ protected:
    *         struct using information gathered from the associated
    *         \ref linkmasta_device.
    *  
-   *  Uses the associated \ref linkmasta_device to query for information on the
-   *  specified chip's sectors. Gathers information on the sector's storage
-   *  capacity, base address, and write protection status. This function is
-   *  automatically called by \ref build_chip_descriptor(unsigned int chip_i).
+   *  Fills in the specified sector's storage capacity and base address. The
+   *  sector's write protection status is left for
+   *  \ref build_block_protection(unsigned int chip_i) to fill in with the
+   *  rest of the chip's. This function is automatically called by
+   *  \ref build_chip_descriptor(unsigned int chip_i).
    *  
    *  After building the descriptor, this function updates the internally
    *  cached descriptor with the newly created one. To access the result of this
@@ -296,6 +663,65 @@ protected:
    */
   void                  build_block_descriptor(unsigned int chip_i, unsigned int block_i);
   
+  /*! \brief Queries the write protection status of every block on a chip and
+   *         stores it in the chip's descriptor.
+   *  
+   *  Reads the protection status of all of the chip's blocks in a single
+   *  autoselect session with
+   *  \ref ngp_chip::get_block_protections(const address_t* sector_addresses, protect_t* protections, unsigned int num_sectors),
+   *  rather than unlocking and resetting the chip once per block. The chip's
+   *  descriptor and its blocks must already be built.
+   *  
+   *  This function is a blocking function that can take several seconds to
+   *  complete.
+   *  
+   *  \param [in] chip_i The index of the chip to query.
+   *  
+   *  \see build_chip_descriptor(unsigned int chip_i)
+   *  \see build_block_descriptor(unsigned int chip_i, unsigned int block_i)
+   */
+  void                  build_block_protection(unsigned int chip_i);
+  
+  /*! \brief Fills in the protection status of every block from the
+   *         registration of a known official cartridge.
+   *  
+   *  Reads the game id and version from the cartridge's header and looks them
+   *  up among the cartridges registered with \ref add_known_cartridge(). The
+   *  cartridge's descriptor and its blocks must already be built.
+   *  
+   *  \returns **true** if the cartridge matched a registration and every
+   *            block's protection status was filled in, **false** if the
+   *            protection status has to be queried instead.
+   *  
+   *  \see build_block_protection(unsigned int chip_i)
+   */
+  bool                  seed_block_protection();
+  
+  /*!
+   *  \brief Registers the unprotected blocks of an official cartridge as
+   *         the save regions of its game.
+   *  
+   *  Official cartridges protect every block but the ones the game saves to,
+   *  so they tell where the game saves on flash cartridges too. Does nothing
+   *  for other cartridges.
+   *  
+   *  \see add_game_save_regions()
+   */
+  void                  learn_save_regions();
+  
+  /*!
+   *  \brief Determines which blocks save data is kept in.
+   *  
+   *  \param [in] chip_lower_bound The first chip of the slot.
+   *  \param [in] chip_upper_bound One past the last chip of the slot.
+   *  
+   *  \returns For each chip of the cartridge, whether each of its blocks
+   *            holds save data. Chips outside the slot hold none.
+   *  
+   *  \see set_limit_saves_to_game(bool enabled)
+   */
+  std::vector<std::vector<bool>> save_blocks(unsigned int chip_lower_bound, unsigned int chip_upper_bound) const;
+  
   /*! \brief Reads game metadata from the cartridge and caches it for later use.
    * 
    *  Reads data from the cartridge to get game metadata from all game slots on
@@ -310,6 +736,65 @@ protected:
   
 private:
   
+  /*!
+   *  \brief Writes the contents of a game image to the cartridge.
+   *  
+   *  Implementation shared by every version of
+   *  \ref restore_cartridge_game_data() and
+   *  \ref restore_and_verify_cartridge_game_data().
+   *  
+   *  \param [in,out] image The image to write.
+   *  \param [in] slot The game slot to write to, or \ref SLOT_ALL.
+   *  \param [in,out] controller The controller object to send progress updates.
+   *         **nullptr** is an accepted value.
+   *  \param [in] verify Whether to read back and retry each block after
+   *         programming it.
+   *  
+   *  \returns false if verifying any block failed, true otherwise.
+   */
+  bool                  restore_game_data(rom_image& image, int slot, task_controller* controller, bool verify);
+  
+  /*!
+   *  \brief Compares the contents of a game image to the cartridge.
+   *  
+   *  Implementation shared by every version of
+   *  \ref compare_cartridge_game_data() and
+   *  \ref compare_cartridge_game_data_blocks().
+   *  
+   *  \param [in,out] image The image to compare.
+   *  \param [in] slot The game slot to compare, or \ref SLOT_ALL.
+   *  \param [in,out] controller The controller object to send progress updates.
+   *         **nullptr** is an accepted value.
+   *  \param [out] mismatches The map to record every block compared in, or
+   *         **nullptr** to stop at the first block that differs.
+   *  
+   *  \returns true if the cartridge matches the image, false otherwise.
+   */
+  bool                  compare_game_data(rom_image& image, int slot, task_controller* controller, block_mismatch_map* mismatches);
+  
+  /*!
+   *  \brief Reads both chips of a two-chip cartridge at once for
+   *         \ref backup_cartridge_game_data().
+   *  
+   *  Reads runs of blocks from both chips with
+   *  \ref ngp_chip::read_bytes_interleaved(), taking a run from each chip in
+   *  turn. Chip 0's runs are queued to be written as they arrive, while chip
+   *  1's are gathered in memory and queued behind the whole of chip 0, since
+   *  the output may not be seekable.
+   *  
+   *  \param [in,out] pipeline The pipeline writing the backup.
+   *  \param [in] bytes_total The number of bytes to back up, more than chip 0
+   *         holds and no more than both chips hold.
+   *  \param [in] run_size The largest number of bytes to read from a chip at
+   *         once. No larger than the pipeline's buffers.
+   *  \param [in,out] controller The controller object to send progress updates.
+   *         **nullptr** is an accepted value.
+   *  
+   *  \returns The number of bytes queued to be written, short of
+   *            **bytes_total** only if cancelled.
+   */
+  unsigned int          backup_both_chips(write_pipeline& pipeline, unsigned int bytes_total, unsigned int run_size, task_controller* controller);
+  
   /*! \brief Disabled copy constructor.
    *  
    *  The copy constructor for this class. Because this class cannot be copied
@@ -374,6 +859,14 @@ private:
    */
   cartridge_descriptor* m_descriptor;
   
+  /*! \brief Flat copy of \ref m_descriptor, built along with it by
+   *         \ref init().
+   *  
+   *  \see cartridge_layout
+   *  \see m_descriptor
+   */
+  cartridge_layout      m_layout;
+  
   /*! \brief The number of flash storage chips onboard the cartridge.
    *  
    *  The number of flash storage chips onboard the cartridge. Used to determine
@@ -415,6 +908,68 @@ private:
    *  \see game_metadata
    */
   std::vector<game_metadata> m_metadata;
+  
+  /*!
+   *  \brief Flag indicating that game data restores should skip blocks that
+   *         already match the file.
+   *  
+   *  \see set_differential_restore(bool enabled)
+   */
+  bool                  m_differential_restore;
+  
+  /*!
+   *  \brief Flag indicating that block protection should be queried even when
+   *         the descriptor is found in the cache.
+   *  
+   *  \see set_probe_block_protection(bool enabled)
+   */
+  bool                  m_probe_block_protection;
+  
+  /*!
+   *  \brief Flag indicating that save data is backed up in the sparse NGF
+   *         format.
+   *  
+   *  \see set_sparse_saves(bool enabled)
+   */
+  bool                  m_sparse_saves;
+  
+  /*!
+   *  \brief Flag indicating that save data is limited to the blocks the
+   *         game saves to.
+   *  
+   *  \see set_limit_saves_to_game(bool enabled)
+   */
+  bool                  m_limit_saves_to_game;
+  
+  /*!
+   *  \brief Flag indicating that game data backups stop at the end of the
+   *         game.
+   *  
+   *  \see set_trimmed_backups(bool enabled)
+   */
+  bool                  m_trimmed_backups;
+  
+  /*!
+   *  \brief Journal used to skip and record completed blocks of game data
+   *         backups and restores, or **nullptr** if none.
+   *  
+   *  \see set_journal(job_journal* journal)
+   */
+  job_journal*          m_journal;
+  
+  /*!
+   *  \brief History the erase times of the chips are recorded in, or
+   *         **nullptr** if none.
+   *  
+   *  \see set_erase_history(erase_history* history, const std::string& serial)
+   */
+  erase_history*        m_erase_history;
+  
+  /*!
+   *  \brief Serial number of the device the cartridge is plugged into, used
+   *         to key \ref m_erase_history.
+   */
+  std::string           m_erase_serial;
 };
 
 #endif /* defined(__NGP_CARTRIDGE_H__) */
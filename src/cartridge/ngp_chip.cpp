@@ -17,6 +17,11 @@
 #include "linkmasta/linkmasta_device.h"
 #include "task/task_controller.h"
 #include "task/forwarding_task_controller.h"
+#include "erase_poller.h"
+#include "common/trace.h"
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
 
 
 
@@ -27,6 +32,23 @@
 
 #define MASK_SECTOR   0x001FE000
 
+#define READ_PIPELINE_DEPTH 2
+
+// Status bit that toggles on every read while the chip erases, but not once
+// the erase is suspended, and how many times to check it after suspending
+#define STATUS_TOGGLE_BIT       0x40
+#define ERASE_SUSPEND_MAX_POLLS 16
+
+// How long to wait for the firmware to say an erase is done, in multiples of
+// the typical erase time, before polling the chip instead, and how long to
+// wait at a time so that the task can be updated meanwhile
+#define ERASE_NOTIFY_TIMEOUT_FACTOR 4
+#define ERASE_NOTIFY_SLICE_MS       250
+
+// Number of bytes read or programmed per word sequence when the device can't
+// transfer whole ranges itself
+#define FALLBACK_BATCH_BYTES 64
+
 const int BYPASS_SUPPORTERS[3] = {
   0x83, /* NGP Flashmasta */
   0x85, /* WS Flashmasta */
@@ -45,8 +67,9 @@ typedef ngp_chip::address_t      address_t;
 
 
 ngp_chip::ngp_chip(linkmasta_device* linkmasta_device, chip_index_t chip_num)
-  : m_mode(READ), m_last_erased_addr(0), m_supports_bypass(false),
-    m_linkmasta(linkmasta_device), m_chip_num(chip_num)
+  : m_last_erased_addr(0), m_erase_start(), m_suspend_start(),
+    m_erasing_chip(false), m_erase_history(nullptr),
+    m_supports_bypass(false), m_linkmasta(linkmasta_device), m_chip_num(chip_num)
 {
   // Nothing else to do
 }
@@ -77,21 +100,56 @@ void ngp_chip::reset()
     // We can only reset when we're not erasing
     throw std::runtime_error("Chip is busy erasing");
   }
+  if (current_mode() == ERASE_SUSPENDED)
+  {
+    // Resetting would leave the erase suspended, not the chip in read mode
+    throw std::runtime_error("Chip erase is suspended");
+  }
+  
+  linkmasta_device::word_command commands[5];
+  unsigned int num_commands = 0;
   
-  if (current_mode() == BYPASS)
+  if (current_mode() == BYPASS || current_mode() == UNKNOWN)
   {
-    // If we're in bypass mode, do something special to exit it
-    write(ADDR_DONTCARE, 0x90);
-    write(ADDR_DONTCARE, 0x00);
+    // If we're or may be in bypass mode, do something special to exit it. In
+    // any other mode the chip ignores these writes
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0x90};
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0x00};
   }
   
   // Send the full command
-  write(ADDR_COMMAND1, 0xAA);
-  write(ADDR_COMMAND2, 0x55);
-  write(ADDR_COMMAND3, 0xF0);
+  commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA};
+  commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55};
+  commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0xF0};
+  m_linkmasta->run_word_sequence(m_chip_num, commands, num_commands);
   
   // Update the cached mode
-  m_mode = READ;
+  set_mode(READ);
+}
+
+bool ngp_chip::test_present()
+{
+  if (is_erasing())
+  {
+    // We can only reset when we're not erasing
+    throw std::runtime_error("Chip is busy erasing");
+  }
+  
+  // Reset, enter autoselect, read the manufacturer ID, and reset again. A
+  // single 0xF0 write is enough to leave read or autoselect mode
+  linkmasta_device::word_command commands[6] = {
+    {linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0xF0},
+    {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+    {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+    {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x90},
+    {linkmasta_device::WORD_READ,  0x0000,        0},
+    {linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0xF0}
+  };
+  m_linkmasta->run_word_sequence(m_chip_num, commands, 6);
+  set_mode(READ);
+  
+  // Without a chip to answer, the bus still holds the autoselect command
+  return ((manufact_id_t) commands[4].data != 0x90);
 }
 
 manufact_id_t ngp_chip::get_manufacturer_id()
@@ -113,12 +171,7 @@ manufact_id_t ngp_chip::get_manufacturer_id()
   }
   else
   {
-    if (current_mode() != AUTOSELECT)
-    {
-      enter_autoselect();
-    }
-    
-    return read(0x0000);
+    return autoselect_read(0x0000);
   }
 }
 
@@ -141,12 +194,7 @@ device_id_t ngp_chip::get_device_id()
   }
   else
   {
-    if (current_mode() != AUTOSELECT)
-    {
-      enter_autoselect();
-    }
-    
-    return read(0x0001);
+    return autoselect_read(0x0001);
   }
 }
 
@@ -158,12 +206,7 @@ factory_prot_t ngp_chip::get_factory_prot()
     throw std::runtime_error("Chip is busy erasing");
   }
   
-  if (current_mode() != AUTOSELECT)
-  {
-    enter_autoselect();
-  }
-  
-  return read(0x0003);
+  return autoselect_read(0x0003);
 }
 
 protect_t ngp_chip::get_block_protection(address_t sector_address)
@@ -186,12 +229,53 @@ protect_t ngp_chip::get_block_protection(address_t sector_address)
   }
   else
   {
-    if (current_mode() != AUTOSELECT)
-    {
-      enter_autoselect();
-    }
-    
-    return (read((sector_address & MASK_SECTOR) | 0x00000002) != 0);
+    return (autoselect_read((sector_address & MASK_SECTOR) | 0x00000002) != 0);
+  }
+}
+
+void ngp_chip::get_block_protections(const address_t* sector_addresses, protect_t* protections, unsigned int num_sectors)
+{
+  if (is_erasing())
+  {
+    // We can only reset when we're not erasing
+    throw std::runtime_error("Chip is busy erasing");
+  }
+  
+  if (num_sectors == 0)
+  {
+    return;
+  }
+  
+  // Bypass mode takes its own exit sequence before autoselect can be entered
+  chip_mode mode = current_mode();
+  if (mode != READ && mode != AUTOSELECT)
+  {
+    reset();
+  }
+  
+  // Enter autoselect once, read every sector's protection status, then reset
+  // with a single 0xF0 write
+  std::vector<linkmasta_device::word_command> commands;
+  commands.reserve(num_sectors + 4);
+  if (mode != AUTOSELECT)
+  {
+    commands.push_back({linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA});
+    commands.push_back({linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55});
+    commands.push_back({linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x90});
+  }
+  unsigned int first_read = (unsigned int) commands.size();
+  for (unsigned int i = 0; i < num_sectors; ++i)
+  {
+    commands.push_back({linkmasta_device::WORD_READ, (sector_addresses[i] & MASK_SECTOR) | 0x00000002, 0});
+  }
+  commands.push_back({linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0xF0});
+  
+  m_linkmasta->run_word_sequence(m_chip_num, commands.data(), (unsigned int) commands.size());
+  set_mode(READ);
+  
+  for (unsigned int i = 0; i < num_sectors; ++i)
+  {
+    protections[i] = (commands[first_read + i].data != 0);
   }
 }
 
@@ -209,19 +293,27 @@ void ngp_chip::program_byte(address_t address, data_t data)
     reset();
   }
   
+  linkmasta_device::word_command commands[4];
+  unsigned int num_commands = 0;
+  chip_mode mode = current_mode();
+  
   // Write prefix based on whether or not in bypass mode
-  if (current_mode() == BYPASS)
+  if (mode == BYPASS)
   {
-    write(ADDR_DONTCARE, 0xA0);
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0xA0};
   }
   else
   {
-    write(ADDR_COMMAND1, 0xAA);
-    write(ADDR_COMMAND2, 0x55);
-    write(ADDR_COMMAND3, 0xA0);
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA};
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55};
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0xA0};
   }
   
-  write(address, data);
+  commands[num_commands++] = {linkmasta_device::WORD_WRITE, address, data};
+  m_linkmasta->run_word_sequence(m_chip_num, commands, num_commands);
+  
+  // Programming a byte leaves the chip in the mode it was in
+  set_mode(mode);
 }
 
 void ngp_chip::unlock_bypass()
@@ -247,11 +339,14 @@ void ngp_chip::unlock_bypass()
   // Unlock bypass mode and update flags
   if (current_mode() != BYPASS)
   {
-    write(ADDR_COMMAND1, 0xAA);
-    write(ADDR_COMMAND2, 0x55);
-    write(ADDR_COMMAND3, 0x20);
+    linkmasta_device::word_command commands[] = {
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x20}
+    };
+    m_linkmasta->run_word_sequence(m_chip_num, commands, 3);
     
-    m_mode = BYPASS;
+    set_mode(BYPASS);
   }
 }
 
@@ -270,6 +365,8 @@ void ngp_chip::erase_chip()
   }
   
   m_last_erased_addr = 0;
+  m_erase_start = erase_poller::time_point_t::clock::now();
+  m_erasing_chip = true;
   
   if (m_linkmasta->supports_erase_chip())
   {
@@ -278,15 +375,18 @@ void ngp_chip::erase_chip()
   else
   {
     // Send the nuke command sequence to chip
-    write(ADDR_COMMAND1, 0xAA);
-    write(ADDR_COMMAND2, 0x55);
-    write(ADDR_COMMAND3, 0x80);
-    write(ADDR_COMMAND1, 0xAA);
-    write(ADDR_COMMAND2, 0x55);
-    write(ADDR_COMMAND3, 0x10);
-  }
-  
-  m_mode = ERASE;
+    linkmasta_device::word_command commands[] = {
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x80},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x10}
+    };
+    m_linkmasta->run_word_sequence(m_chip_num, commands, 6);
+  }
+  
+  set_mode(ERASE);
 }
 
 void ngp_chip::erase_block(address_t block_address)
@@ -304,30 +404,99 @@ void ngp_chip::erase_block(address_t block_address)
   }
   
   m_last_erased_addr = block_address;
+  m_erase_start = erase_poller::time_point_t::clock::now();
+  m_erasing_chip = false;
   
-  if (m_linkmasta->supports_erase_chip())
+  if (m_linkmasta->supports_erase_chip_block())
   {
-    m_linkmasta->erase_chip(m_chip_num);
+    m_linkmasta->erase_chip_block(m_chip_num, block_address);
   }
   else
   {
     // Send the sector erase command sequence to chip
-    write(ADDR_COMMAND1, 0xAA);
-    write(ADDR_COMMAND2, 0x55);
-    write(ADDR_COMMAND3, 0x80);
-    write(ADDR_COMMAND1, 0xAA);
-    write(ADDR_COMMAND2, 0x55);
-    write((block_address & MASK_SECTOR), 0x30);
+    linkmasta_device::word_command commands[] = {
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x80},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+      {linkmasta_device::WORD_WRITE, (block_address & MASK_SECTOR), 0x30}
+    };
+    m_linkmasta->run_word_sequence(m_chip_num, commands, 6);
+  }
+  
+  set_mode(ERASE);
+}
+
+bool ngp_chip::suspend_erase()
+{
+  if (current_mode() != ERASE)
+  {
+    return false;
+  }
+  if (m_erasing_chip)
+  {
+    throw std::runtime_error("Chip erases can't be suspended");
+  }
+  
+  // Suspend, then read the erasing block twice in the same burst. The toggle
+  // bit only stops toggling once the erase has been set aside, and nothing
+  // toggles at all if the erase had already finished
+  for (unsigned int i = 0; i < ERASE_SUSPEND_MAX_POLLS; ++i)
+  {
+    linkmasta_device::word_command commands[3];
+    unsigned int num_commands = 0;
+    if (i == 0)
+    {
+      commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0xB0};
+    }
+    commands[num_commands++] = {linkmasta_device::WORD_READ, m_last_erased_addr, 0};
+    commands[num_commands++] = {linkmasta_device::WORD_READ, m_last_erased_addr, 0};
+    m_linkmasta->run_word_sequence(m_chip_num, commands, num_commands);
+    
+    word_t result1 = (word_t) commands[num_commands - 2].data;
+    word_t result2 = (word_t) commands[num_commands - 1].data;
+    if (result1 == result2)
+    {
+      set_mode(READ);
+      return false;
+    }
+    if (((result1 ^ result2) & STATUS_TOGGLE_BIT) == 0)
+    {
+      m_suspend_start = erase_poller::time_point_t::clock::now();
+      set_mode(ERASE_SUSPENDED);
+      return true;
+    }
   }
   
-  m_mode = ERASE;
+  // The suspend command may still land, so the mode can't be trusted either
+  set_mode(UNKNOWN);
+  throw std::runtime_error("Chip did not suspend its erase");
+}
+
+void ngp_chip::resume_erase()
+{
+  if (current_mode() != ERASE_SUSPENDED)
+  {
+    return;
+  }
+  
+  linkmasta_device::word_command commands[] = {
+    {linkmasta_device::WORD_WRITE, (m_last_erased_addr & MASK_SECTOR), 0x30}
+  };
+  m_linkmasta->run_word_sequence(m_chip_num, commands, 1);
+  
+  // Time spent suspended doesn't count towards the erase
+  m_erase_start += erase_poller::time_point_t::clock::now() - m_suspend_start;
+  set_mode(ERASE);
 }
 
 
 
 ngp_chip::chip_mode ngp_chip::current_mode() const
 {
-  return m_mode;
+  int mode = m_linkmasta->chip_mode(m_chip_num);
+  return (mode == CHIP_MODE_UNKNOWN ? UNKNOWN : (chip_mode) mode);
 }
 
 bool ngp_chip::supports_bypass() const
@@ -344,17 +513,15 @@ bool ngp_chip::test_bypass_support()
   }
   
   // Test against manufacturer id, device id, and some potentially custom data
-  if (current_mode() != AUTOSELECT)
-  {
-    enter_autoselect();
-  }
-  
-  unsigned char result = read(0x03);
-  
+  return test_bypass_support(autoselect_read(0x03));
+}
+
+bool ngp_chip::test_bypass_support(factory_prot_t factory_prot)
+{
   m_supports_bypass = false;
   for (unsigned int i = 0; BYPASS_SUPPORTERS[i] != -1; ++i)
   {
-    if ((int) result == BYPASS_SUPPORTERS[i])
+    if ((int) factory_prot == BYPASS_SUPPORTERS[i])
     {
       m_supports_bypass = true;
       break;
@@ -376,13 +543,99 @@ bool ngp_chip::test_erasing()
     return false;
   }
   
-  unsigned char result = read(m_last_erased_addr);
+  unsigned char result = m_linkmasta->read_erase_status(m_chip_num, m_last_erased_addr);
   
-  m_mode = (result == 0xFF ? READ : ERASE);
+  set_mode(result == 0xFF ? READ : ERASE);
   
   return is_erasing();
 }
 
+void ngp_chip::wait_for_erase(task_controller* controller)
+{
+  trace_scope  trace(TRACE_ERASE_POLL);
+  resume_erase();
+  if (!test_erasing())
+  {
+    return;
+  }
+  
+  // Count the wait as erase time, then go back to whatever was running
+  task_phase prev_phase = TASK_PHASE_OTHER;
+  if (controller != nullptr)
+  {
+    prev_phase = controller->get_task_phase();
+    controller->on_task_phase(TASK_PHASE_ERASE);
+  }
+  
+  // Earlier erases of the same block tell better than the datasheet how long
+  // to sleep before polling
+  unsigned int typical_ms = (m_erasing_chip ? NGP_CHIP_CHIP_ERASE_TIME_MS : NGP_CHIP_BLOCK_ERASE_TIME_MS);
+  if (m_erase_history != nullptr)
+  {
+    typical_ms = (m_erasing_chip ? m_erase_history->typical_chip_erase_ms(m_erase_key, typical_ms)
+                  : m_erase_history->typical_block_erase_ms(m_erase_key, m_last_erased_addr, typical_ms));
+  }
+  
+  // Firmware that says when the erase is done spares us from polling for it,
+  // though the chip still has the final word
+  bool notified = false;
+  if (m_linkmasta->supports_erase_notification())
+  {
+    auto deadline = erase_poller::time_point_t::clock::now() + std::chrono::milliseconds(typical_ms * ERASE_NOTIFY_TIMEOUT_FACTOR);
+    while (!notified && erase_poller::time_point_t::clock::now() < deadline)
+    {
+      notified = m_linkmasta->wait_for_erase_notification(m_chip_num, ERASE_NOTIFY_SLICE_MS);
+      if (controller != nullptr)
+      {
+        controller->on_task_update(task_status::RUNNING, 0);
+      }
+    }
+  }
+  
+  if (!notified || test_erasing())
+  {
+    erase_poller poller(m_erase_start, typical_ms);
+    do
+    {
+      poller.wait(controller);
+    } while (test_erasing());
+  }
+  
+  // Erases that had already finished by the first poll aren't timed, since
+  // all that is known is that they took less than that
+  if (m_erase_history != nullptr)
+  {
+    unsigned int elapsed_ms = (unsigned int) std::chrono::duration_cast<std::chrono::milliseconds>(erase_poller::time_point_t::clock::now() - m_erase_start).count();
+    try
+    {
+      if (m_erasing_chip)
+      {
+        m_erase_history->record_chip_erase(m_erase_key, elapsed_ms);
+      }
+      else
+      {
+        m_erase_history->record_block_erase(m_erase_key, m_last_erased_addr, elapsed_ms);
+      }
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Losing a sample is not worth failing the operation over
+    }
+  }
+  
+  if (controller != nullptr)
+  {
+    controller->on_task_phase(prev_phase);
+  }
+}
+
+void ngp_chip::set_erase_history(erase_history* history, const erase_history::chip_key& key)
+{
+  m_erase_history = history;
+  m_erase_key = key;
+}
+
 unsigned int ngp_chip::read_bytes(address_t address, data_t* data, unsigned int num_bytes, task_controller* controller)
 {
   if (is_erasing())
@@ -391,8 +644,9 @@ unsigned int ngp_chip::read_bytes(address_t address, data_t* data, unsigned int
     throw std::runtime_error("Chip is busy erasing");
   }
   
-  // Ensure we're in read mode
-  if (current_mode() != READ)
+  // Ensure we're in read mode. Blocks other than the one being erased can be
+  // read as they are while the erase is suspended
+  if (current_mode() != READ && current_mode() != ERASE_SUSPENDED)
   {
     reset();
   }
@@ -402,7 +656,7 @@ unsigned int ngp_chip::read_bytes(address_t address, data_t* data, unsigned int
     // Use Linkmasta's built-in support for batch reads
     if (controller == nullptr)
     {
-      return m_linkmasta->read_bytes(m_chip_num, address, data, num_bytes);
+      return m_linkmasta->stream_read_bytes(m_chip_num, address, data, num_bytes, READ_PIPELINE_DEPTH);
     }
     else
     {
@@ -418,7 +672,7 @@ unsigned int ngp_chip::read_bytes(address_t address, data_t* data, unsigned int
       {
         try
         {
-          result = m_linkmasta->read_bytes(m_chip_num, address, data, num_bytes, &fwd_controller);
+          result = m_linkmasta->stream_read_bytes(m_chip_num, address, data, num_bytes, READ_PIPELINE_DEPTH, &fwd_controller);
         }
         catch (std::exception& ex)
         {
@@ -441,13 +695,21 @@ unsigned int ngp_chip::read_bytes(address_t address, data_t* data, unsigned int
       controller->on_task_start(num_bytes);
     }
     
-    // Linkmasta does not support batch reading; to it manually
-    unsigned int i;
-    for (i = 0; i < num_bytes && (controller == nullptr || !controller->is_task_cancelled()); ++i, ++address)
+    // Linkmasta does not support batch reading; queue single-word reads in
+    // bursts instead of waiting on the reply to each one
+    linkmasta_device::word_command commands[FALLBACK_BATCH_BYTES];
+    unsigned int i = 0;
+    while (i < num_bytes && (controller == nullptr || !controller->is_task_cancelled()))
     {
+      unsigned int batch_size = std::min(num_bytes - i, (unsigned int) FALLBACK_BATCH_BYTES);
+      for (unsigned int j = 0; j < batch_size; ++j)
+      {
+        commands[j] = {linkmasta_device::WORD_READ, address + i + j, 0};
+      }
+      
       try
       {
-        data[i] = read(address);
+        m_linkmasta->run_word_sequence(m_chip_num, commands, batch_size);
       }
       catch (std::exception& ex)
       {
@@ -460,10 +722,16 @@ unsigned int ngp_chip::read_bytes(address_t address, data_t* data, unsigned int
         throw;
       }
       
+      for (unsigned int j = 0; j < batch_size; ++j)
+      {
+        data[i + j] = (data_t) commands[j].data;
+      }
+      i += batch_size;
+      
       // Update controller on task progress
       if (controller != nullptr)
       {
-        controller->on_task_update(task_status::RUNNING, 1);
+        controller->on_task_update(task_status::RUNNING, batch_size);
       }
     }
     
@@ -476,6 +744,79 @@ unsigned int ngp_chip::read_bytes(address_t address, data_t* data, unsigned int
   }
 }
 
+unsigned int ngp_chip::read_bytes_interleaved(address_t address, data_t* data, unsigned int num_bytes, ngp_chip& other, address_t other_address, data_t* other_data, unsigned int other_num_bytes, task_controller* controller)
+{
+  if (other.m_linkmasta != m_linkmasta)
+  {
+    throw std::invalid_argument("Chips are connected through different devices");
+  }
+  
+  // Without batch reads there's nothing to interleave
+  if (!m_linkmasta->supports_read_bytes())
+  {
+    unsigned int total_bytes = num_bytes + other_num_bytes;
+    if (controller != nullptr)
+    {
+      controller->on_task_start(total_bytes);
+    }
+    
+    forwarding_task_controller fwd_controller(controller);
+    fwd_controller.scale_work_to(num_bytes);
+    unsigned int result = read_bytes(address, data, num_bytes, controller == nullptr ? nullptr : &fwd_controller);
+    if (result == num_bytes && (controller == nullptr || !controller->is_task_cancelled()))
+    {
+      forwarding_task_controller other_fwd_controller(controller);
+      other_fwd_controller.scale_work_to(other_num_bytes);
+      result += other.read_bytes(other_address, other_data, other_num_bytes, controller == nullptr ? nullptr : &other_fwd_controller);
+    }
+    
+    if (controller != nullptr)
+    {
+      controller->on_task_end(controller->is_task_cancelled() && result < total_bytes ? task_status::CANCELLED : task_status::COMPLETED, result);
+    }
+    return result;
+  }
+  
+  // Ensure both chips are in read mode, as read_bytes() would
+  ngp_chip* chips[] = {this, &other};
+  for (ngp_chip* chip : chips)
+  {
+    if (chip->is_erasing())
+    {
+      throw std::runtime_error("Chip is busy erasing");
+    }
+    if (chip->current_mode() != READ && chip->current_mode() != ERASE_SUSPENDED)
+    {
+      chip->reset();
+    }
+  }
+  
+  // Keep a batch queued for each chip while the other's is received
+  linkmasta_device::read_lane lanes[2] = {
+    {m_chip_num, address, data, num_bytes, 0},
+    {other.m_chip_num, other_address, other_data, other_num_bytes, 0}
+  };
+  return m_linkmasta->interleaved_read_bytes(lanes, 2, READ_PIPELINE_DEPTH * 2, controller);
+}
+
+unsigned int ngp_chip::checksum_bytes(address_t address, unsigned int num_bytes)
+{
+  if (is_erasing())
+  {
+    // We can only reset when we're not erasing
+    throw std::runtime_error("Chip is busy erasing");
+  }
+  
+  // Ensure we're in read mode. Blocks other than the one being erased can be
+  // read as they are while the erase is suspended
+  if (current_mode() != READ && current_mode() != ERASE_SUSPENDED)
+  {
+    reset();
+  }
+  
+  return m_linkmasta->checksum_range(m_chip_num, address, num_bytes);
+}
+
 unsigned int ngp_chip::program_bytes(address_t address, const data_t* data, unsigned int num_bytes, task_controller* controller)
 {
   if (is_erasing())
@@ -492,10 +833,13 @@ unsigned int ngp_chip::program_bytes(address_t address, const data_t* data, unsi
       reset();
     }
     
-    // Use Linkmasta's built-in support for batch programming
+    // Use Linkmasta's built-in support for batch programming. The firmware
+    // enters and leaves bypass mode itself, returning the chip to read mode
     if (controller == nullptr)
     {
-      return m_linkmasta->program_bytes(m_chip_num, address, data, num_bytes, supports_bypass());
+      unsigned int result = m_linkmasta->program_bytes(m_chip_num, address, data, num_bytes, supports_bypass());
+      set_mode(READ);
+      return result;
     }
     else
     {
@@ -512,6 +856,7 @@ unsigned int ngp_chip::program_bytes(address_t address, const data_t* data, unsi
         try
         {
           result = m_linkmasta->program_bytes(m_chip_num, address, data, num_bytes, supports_bypass(),  &fwd_controller);
+          set_mode(READ);
         }
         catch (std::exception& ex)
         {
@@ -546,13 +891,35 @@ unsigned int ngp_chip::program_bytes(address_t address, const data_t* data, unsi
       controller->on_task_start(num_bytes);
     }
     
-    // Send byte of data one at a time
-    unsigned int i;
-    for (i = 0; i < num_bytes && (controller == nullptr || !controller->is_task_cancelled()); ++i, ++address)
+    // Queue the program sequences of many bytes in a single burst, each one
+    // the same sequence that program_byte() sends. Programming leaves the chip
+    // in bypass mode, so consecutive batches and blocks don't unlock it again
+    linkmasta_device::word_command commands[FALLBACK_BATCH_BYTES * 4];
+    chip_mode mode = current_mode();
+    unsigned int i = 0;
+    while (i < num_bytes && (controller == nullptr || !controller->is_task_cancelled()))
     {
+      unsigned int batch_size = std::min(num_bytes - i, (unsigned int) FALLBACK_BATCH_BYTES);
+      unsigned int num_commands = 0;
+      for (unsigned int j = 0; j < batch_size; ++j)
+      {
+        if (mode == BYPASS)
+        {
+          commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0xA0};
+        }
+        else
+        {
+          commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA};
+          commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55};
+          commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0xA0};
+        }
+        commands[num_commands++] = {linkmasta_device::WORD_WRITE, address + i + j, data[i + j]};
+      }
+      
       try
       {
-        program_byte(address, data[i]);
+        m_linkmasta->run_word_sequence(m_chip_num, commands, num_commands);
+        set_mode(mode);
       }
       catch (std::exception& ex)
       {
@@ -563,11 +930,12 @@ unsigned int ngp_chip::program_bytes(address_t address, const data_t* data, unsi
         }
         throw;
       }
+      i += batch_size;
       
       // Inform controller of task progress
       if (controller != nullptr)
       {
-        controller->on_task_update(task_status::RUNNING, 1);
+        controller->on_task_update(task_status::RUNNING, batch_size);
       }
     }
     
@@ -584,8 +952,42 @@ unsigned int ngp_chip::program_bytes(address_t address, const data_t* data, unsi
 
 void ngp_chip::enter_autoselect()
 {
-  write(ADDR_COMMAND1, 0xAA);
-  write(ADDR_COMMAND2, 0x55);
-  write(ADDR_COMMAND3, 0x90);
-  m_mode = AUTOSELECT;
+  linkmasta_device::word_command commands[] = {
+    {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+    {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+    {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x90}
+  };
+  m_linkmasta->run_word_sequence(m_chip_num, commands, 3);
+  set_mode(AUTOSELECT);
+}
+
+word_t ngp_chip::autoselect_read(address_t address)
+{
+  // Bypass mode, or whatever mode the chip may be in, has to be left first
+  if (current_mode() != READ && current_mode() != AUTOSELECT)
+  {
+    reset();
+  }
+  
+  linkmasta_device::word_command commands[4];
+  unsigned int num_commands = 0;
+  
+  // Prefix the read with the autoselect command sequence if necessary
+  if (current_mode() != AUTOSELECT)
+  {
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA};
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55};
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x90};
+  }
+  commands[num_commands++] = {linkmasta_device::WORD_READ, address, 0};
+  
+  m_linkmasta->run_word_sequence(m_chip_num, commands, num_commands);
+  set_mode(AUTOSELECT);
+  
+  return (word_t) commands[num_commands - 1].data;
+}
+
+void ngp_chip::set_mode(chip_mode mode)
+{
+  m_linkmasta->set_chip_mode(m_chip_num, (mode == UNKNOWN ? CHIP_MODE_UNKNOWN : (int) mode));
 }
@@ -12,9 +12,20 @@
 #ifndef __NGP_CHIP_H__
 #define __NGP_CHIP_H__
 
+#include "erase_history.h"
+#include "erase_poller.h"
+
 class linkmasta_device;
 class task_controller;
 
+/*! \brief Typical time taken by the chip to erase a single block, in
+ *         milliseconds. */
+#define NGP_CHIP_BLOCK_ERASE_TIME_MS  700
+
+/*! \brief Typical time taken by the chip to erase itself entirely, in
+ *         milliseconds. */
+#define NGP_CHIP_CHIP_ERASE_TIME_MS   15000
+
 /*! \class ngp_chip
  *  \brief Class for controlling and interacting with a flash storage chip on a
  *         Neo Geo Pocket cartridge.
@@ -83,7 +94,17 @@ public:
     BYPASS,
     
     /*! \brief Device is busy erasing. */
-    ERASE
+    ERASE,
+    
+    /*! \brief Device has set a block erase aside to be read from.
+     *  
+     *  \see suspend_erase()
+     */
+    ERASE_SUSPENDED,
+    
+    /*! \brief Device may be in any mode, such as before anything has been
+     *         sent to it or after a command sequence failed. */
+    UNKNOWN
   };
   
   
@@ -156,6 +177,11 @@ public:
    *  Sends the reset command sequence to the hardware device. Whether or not
    *  the operation is successful is not guaranteed.
    *  
+   *  The sequence is sent even if the chip is believed to be in read mode
+   *  already, so that a chip left in a state nobody knows of can be
+   *  recovered. Methods that merely need read mode only call this when
+   *  \ref current_mode() says so.
+   *  
    *  This function is a blocking function that can take several seconds to
    *  complete.
    *  
@@ -166,6 +192,21 @@ public:
    */
   void                    reset();
   
+  /*!
+   *  \brief Quickly checks whether the chip is there at all.
+   *  
+   *  Reads the chip's manufacturer ID and returns the chip to read mode in a
+   *  single pipelined word sequence, so that the check costs one round trip's
+   *  worth of latency. Unlike \ref get_manufacturer_id(), nothing else about
+   *  the chip is probed.
+   *  
+   *  Causes the device to enter \ref chip_mode::READ mode.
+   *  
+   *  \return true if the chip answered, false if only the command written
+   *          last could be read back, as happens when nothing is connected.
+   */
+  bool                    test_present();
+  
   /*! \brief Commands the device to fetch the manufacturer id.
    *  
    *  Sends the command sequence necessary to enter \ref chip_mode::AUTOSELECT
@@ -244,6 +285,32 @@ public:
    */
   protect_t               get_block_protection(address_t sector_address);
   
+  /*! \brief Queries the device on the protection status of several sectors
+   *         at once.
+   *  
+   *  Enters \ref chip_mode::AUTOSELECT mode once, reads the protection status
+   *  of every given sector, and resets the device, all as a single pipelined
+   *  word sequence. Unlike calling
+   *  \ref get_block_protection(address_t sector_address) for each sector, the
+   *  device is not unlocked and reset again between sectors.
+   *  
+   *  This function is a blocking function that can take several seconds to
+   *  complete.
+   *  
+   *  Causes the device to enter \ref chip_mode::READ mode.
+   *  
+   *  \param [in] sector_addresses Array of the base addresses of the blocks
+   *         (sectors) to test for protection.
+   *  \param [out] protections Array that receives, for each sector, **true**
+   *         if the sector is protected and **false** if it is unprotected.
+   *  \param [in] num_sectors The number of elements in both arrays.
+   *  
+   *  \see get_block_protection(address_t sector_address)
+   *  \see chip_mode::READ
+   *  \see current_mode()
+   */
+  void                    get_block_protections(const address_t* sector_addresses, protect_t* protections, unsigned int num_sectors);
+  
   /*! \brief Attempts to program a word at a specific address on the chip.
    *  
    *  Attepts to program a word at a specific address on the chip. See note
@@ -331,13 +398,50 @@ public:
    */
   void                    erase_block(address_t block_address);
   
+  /*! \brief Suspends a block erase so that the chip can be read from.
+   *  
+   *  Sends the erase suspend command and polls the chip until it has set the
+   *  erase aside, which takes it a few microseconds. While suspended, every
+   *  block but the one being erased can be read as usual with
+   *  \ref read_bytes() and \ref checksum_bytes(); reading the block being
+   *  erased returns status bits rather than data. The erase carries on once
+   *  \ref resume_erase() or \ref wait_for_erase() is called, and the time
+   *  spent suspended is not counted towards it.
+   *  
+   *  Anything else that would command the chip, such as \ref reset() or
+   *  programming, throws while the erase is suspended.
+   *  
+   *  Causes the device to enter \ref chip_mode::ERASE_SUSPENDED if the erase
+   *  was still running, or \ref chip_mode::READ if it had already finished.
+   *  
+   *  \returns **true** if the erase was suspended, **false** if it had
+   *            already finished or the chip is not erasing.
+   *  
+   *  \throws std::runtime_error If the chip is erasing as a whole, which can't
+   *          be suspended, or it never reports the erase as suspended.
+   */
+  bool                    suspend_erase();
+  
+  /*! \brief Resumes an erase set aside with \ref suspend_erase().
+   *  
+   *  Does nothing unless the chip is in \ref chip_mode::ERASE_SUSPENDED mode.
+   *  Once resumed, the erase has to be polled as usual with
+   *  \ref test_erasing() or \ref wait_for_erase().
+   *  
+   *  Causes the device to enter \ref chip_mode::ERASE.
+   */
+  void                    resume_erase();
+  
   
   
   /*! \brief Gets the currently assumed mode that the chip is in.
    *  
-   *  Gets the currently assumed mode that the chip is in. This value is not
-   *  guaranteed to be true because the device may have been in an unknown state
-   *  when this class was created.
+   *  Gets the currently assumed mode that the chip is in, as recorded with
+   *  \ref linkmasta_device::chip_mode() by whichever object last drove the
+   *  chip. Reset, unlock, and autoselect sequences are only sent when this
+   *  mode says they are needed. The mode is \ref chip_mode::UNKNOWN until
+   *  something has been sent to the chip, and again whenever the device loses
+   *  track of it.
    *  
    *  \returns The current \ref chip_mode that the device is assumed to be in.
    *  
@@ -391,6 +495,24 @@ public:
    */
   bool                    test_bypass_support();
   
+  /*! \brief Determines whether or not the chip supports
+   *         \ref chip_mode::BYPASS mode from a known factoryProt value.
+   *  
+   *  Determines whether or not the chip supports \ref chip_mode::BYPASS mode
+   *  from a factoryProt value previously read with \ref get_factory_prot().
+   *  Makes the same determination as \ref test_bypass_support() but without
+   *  querying the chip. The result is cached internally and can be retrieved
+   *  using \ref supports_bypass().
+   *  
+   *  \param [in] factory_prot The factoryProt value of the chip.
+   *  
+   *  \returns **true** if the chip supports \ref chip_mode::BYPASS mode,
+   *           **false** if it does not.
+   *  
+   *  \see test_bypass_support()
+   */
+  bool                    test_bypass_support(factory_prot_t factory_prot);
+  
   /*! \brief Gets whether or not the chip was last determined to be in
    *         \ref chip_mode::ERASE mode.
    *  
@@ -445,6 +567,42 @@ public:
    */
   bool                    test_erasing();
   
+  /*! \brief Blocks until the chip is no longer in \ref chip_mode::ERASE mode.
+   *  
+   *  Blocks until the chip is no longer in \ref chip_mode::ERASE mode,
+   *  resuming the erase first if it was suspended. Unlike
+   *  calling \ref test_erasing() in a tight loop, this function uses an
+   *  \ref erase_poller to sleep through most of the chip's typical erase time
+   *  and polls with an increasing delay from then on, which keeps USB traffic
+   *  to a minimum while the chip is busy.
+   *  
+   *  A \ref task_controller object may be optionally provided. It will be sent
+   *  progress updates of 0 while waiting so that any user interface remains
+   *  responsive, and the wait is counted towards its
+   *  \ref task_phase::TASK_PHASE_ERASE time. Erase operations cannot be
+   *  interrupted, so cancelling the task has no effect on this function.
+   *  
+   *  \param [in,out] controller The controller to update. Can be nullptr.
+   *  
+   *  \see test_erasing()
+   *  \see erase_poller
+   */
+  void                    wait_for_erase(task_controller* controller = nullptr);
+  
+  /*! \brief Sets the history the erases of this chip are recorded in.
+   *  
+   *  Sets the \ref erase_history that \ref wait_for_erase() records the
+   *  duration of each erase in, and whose earlier erases of the same block it
+   *  uses in place of the datasheet's typical erase time to pace its polls.
+   *  
+   *  The history is not owned by the chip and must outlive its use. Set to
+   *  **nullptr** to stop recording, which is the default.
+   *  
+   *  \param [in] history The history to use, or **nullptr** for none.
+   *  \param [in] key The key identifying this chip in the history.
+   */
+  void                    set_erase_history(erase_history* history, const erase_history::chip_key& key);
+  
   /*! \brief Reads a series of sequential bytes of data from the chip.
    *  
    *  Reads a series of sequential bytes of data from the chip. Does not modify
@@ -480,6 +638,58 @@ public:
    */
   unsigned int            read_bytes(address_t address, data_t* data, unsigned int num_bytes, task_controller* controller = nullptr);
   
+  /*! \brief Reads a series of sequential bytes from this chip and another at
+   *         once.
+   *  
+   *  Reads a series of sequential bytes from this chip and another chip on
+   *  the same cartridge, like calling \ref read_bytes() on each in turn,
+   *  except that when the device supports
+   *  \ref linkmasta_device::interleaved_read_bytes() the batches for the two
+   *  chips are queued on the device together, so that the device sets up one
+   *  chip while the other's data is still being received.
+   *  
+   *  Causes both devices to enter \ref chip_mode::READ mode.
+   *  
+   *  \param [in] address The address on this chip to begin reading bytes.
+   *  \param [out] data The buffer to write this chip's bytes to.
+   *  \param [in] num_bytes The number of bytes to read from this chip.
+   *  \param [in,out] other The other chip, which must be connected through the
+   *         same device.
+   *  \param [in] other_address The address on the other chip to begin reading
+   *         bytes.
+   *  \param [out] other_data The buffer to write the other chip's bytes to.
+   *  \param [in] other_num_bytes The number of bytes to read from the other
+   *         chip.
+   *  \param [in,out] controller The \ref task_controller to report progress to,
+   *         as the total of both chips. This value must be a valid pointer a
+   *         \ref task_controller object or **nullptr**.
+   *  
+   *  \returns The total number of bytes successfully read from both chips.
+   *  
+   *  \throws std::invalid_argument If the other chip is connected through a
+   *          different device.
+   *  
+   *  \see read_bytes(address_t address, data_t* data, unsigned int num_bytes, task_controller* controller = nullptr)
+   */
+  unsigned int            read_bytes_interleaved(address_t address, data_t* data, unsigned int num_bytes, ngp_chip& other, address_t other_address, data_t* other_data, unsigned int other_num_bytes, task_controller* controller = nullptr);
+  
+  /*! \brief Has the device checksum a series of sequential bytes on the chip.
+   *  
+   *  Has the device compute the CRC32C checksum of a series of sequential
+   *  bytes on the chip without reading the bytes back. Only available if
+   *  \ref linkmasta_device::supports_checksum_range() returns true.
+   *  
+   *  Causes the device to enter \ref chip_mode::READ mode.
+   *  
+   *  \param [in] address The address on the chip of the first byte.
+   *  \param [in] num_bytes The number of bytes to checksum.
+   *  
+   *  \returns The CRC32C checksum of the bytes.
+   *  
+   *  \see linkmasta_device::checksum_range(chip_index chip, address_t start_address, unsigned int num_bytes)
+   */
+  unsigned int            checksum_bytes(address_t address, unsigned int num_bytes);
+  
   /*! \brief Programs a series of bytes of data sequentially to the chip.
    *  
    *  Programs the flash data on the chip given a sequence of bytes, starting at
@@ -538,18 +748,31 @@ private:
    */
   void                    enter_autoselect();
   
+  /*! \brief Reads a word from the chip in \ref chip_mode::AUTOSELECT mode.
+   *  
+   *  Reads a word of metadata from the chip in \ref chip_mode::AUTOSELECT
+   *  mode. If the chip is not already in \ref chip_mode::AUTOSELECT mode, the
+   *  command sequence to enter it is sent in the same burst as the read using
+   *  \ref linkmasta_device::run_word_sequence().
+   *  
+   *  Causes the device to enter \ref chip_mode::AUTOSELECT mode.
+   *  
+   *  \param [in] address The autoselect address to read from.
+   *  
+   *  \returns The word returned from the device.
+   */
+  word_t                  autoselect_read(address_t address);
   
-  
-  /*! \brief The currently predicted mode of the chip.
+  /*! \brief Records the mode the chip has been left in.
    *  
-   *  The currently predicted mode the hardware device is in. This value is
-   *  to track the state of the chip and must be actively maintained when
-   *  passing commands that could alter the state of the device. This value is
-   *  initialized to \ref chip_mode::READ.
+   *  Records the mode with \ref linkmasta_device::set_chip_mode() so that
+   *  every object driving the same chip agrees on it.
    *  
-   *  \see chip_mode
+   *  \param [in] mode The mode the chip is now in.
    */
-  chip_mode               m_mode;
+  void                    set_mode(chip_mode mode);
+  
+  
   
   /*! \brief The address of the last block erased.
    *  
@@ -562,6 +785,25 @@ private:
    */
   address_t               m_last_erased_addr;
   
+  /*! \brief The time at which the last erase command was sent, moved later
+   *         by however long the erase was suspended. */
+  erase_poller::time_point_t m_erase_start;
+  
+  /*! \brief The time at which the erase was last suspended. */
+  erase_poller::time_point_t m_suspend_start;
+  
+  /*! \brief Flag indicating that the last erase command erased the whole chip. */
+  bool                    m_erasing_chip;
+  
+  /*! \brief The history erases are recorded in, or **nullptr** if none.
+   *  
+   *  \see set_erase_history(erase_history* history, const erase_history::chip_key& key)
+   */
+  erase_history*          m_erase_history;
+  
+  /*! \brief The key identifying this chip in \ref m_erase_history. */
+  erase_history::chip_key m_erase_key;
+  
   /*! \brief Boolean value indicating whether or not the device supports bypass
    *         mode.
    *  
@@ -0,0 +1,336 @@
+/*! \file
+ *  \brief File containing the implementation of \ref operation_planner.
+ *  
+ *  File containing the implementation of \ref operation_planner.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see operation_planner
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-21
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "operation_planner.h"
+#include "cartridge.h"
+#include "cartridge_layout.h"
+#include "erase_history.h"
+#include "ngp_chip.h"
+#include "ws_rom_chip.h"
+#include "common/block_compare.h"
+#include "task/task_controller.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+// Typical rates of a device on a full-speed link. Erases start from the
+// timings the cartridges use to decide between block and chip erases
+#define DEFAULT_READ_BYTES_PER_SECOND       300000.0
+#define DEFAULT_PROGRAM_BYTES_PER_SECOND    80000.0
+
+// How far each calibration moves a rate towards the measured one
+#define CALIBRATION_WEIGHT                  0.5
+
+using namespace std;
+
+static double blend(double current, double measured)
+{
+  return current + (measured - current) * CALIBRATION_WEIGHT;
+}
+
+static operation_planner::plan empty_plan(operation_planner::operation op)
+{
+  operation_planner::plan p;
+  p.op = op;
+  p.num_blocks = 0;
+  p.num_block_erases = 0;
+  p.num_chip_erases = 0;
+  p.chip_erase_bytes = 0;
+  p.bytes_read = 0;
+  p.bytes_programmed = 0;
+  return p;
+}
+
+static bool is_save_operation(operation_planner::operation op)
+{
+  return op == operation_planner::operation::BACKUP_SAVE || op == operation_planner::operation::RESTORE_SAVE;
+}
+
+
+
+operation_planner::operation_planner()
+  : m_rates(default_rates()), m_chip_system(SYSTEM_NEO_GEO_POCKET)
+{
+  // Nothing else to do
+}
+
+operation_planner::operation_planner(const rates& initial_rates)
+  : m_rates(initial_rates), m_chip_system(SYSTEM_UNKNOWN)
+{
+  // Nothing else to do
+}
+
+
+
+operation_planner::rates operation_planner::default_rates(system_type system)
+{
+  rates r;
+  r.read_bytes_per_second = DEFAULT_READ_BYTES_PER_SECOND;
+  r.program_bytes_per_second = DEFAULT_PROGRAM_BYTES_PER_SECOND;
+  if (system == SYSTEM_WONDERSWAN)
+  {
+    r.block_erase_seconds = WS_ROM_CHIP_BLOCK_ERASE_TIME_MS / 1000.0;
+    r.chip_erase_seconds = WS_ROM_CHIP_CHIP_ERASE_TIME_MS / 1000.0;
+  }
+  else
+  {
+    r.block_erase_seconds = NGP_CHIP_BLOCK_ERASE_TIME_MS / 1000.0;
+    r.chip_erase_seconds = NGP_CHIP_CHIP_ERASE_TIME_MS / 1000.0;
+  }
+  return r;
+}
+
+const operation_planner::rates& operation_planner::get_rates() const
+{
+  return m_rates;
+}
+
+void operation_planner::set_rates(const rates& new_rates)
+{
+  m_rates = new_rates;
+}
+
+void operation_planner::use_erase_history(erase_history& history, const cartridge_layout& layout, const std::string& serial)
+{
+  double block_ms = 0.0;
+  unsigned int num_block_chips = 0;
+  double chip_ms = 0.0;
+  unsigned int num_chip_chips = 0;
+  
+  for (unsigned int chip_i = 0; chip_i < layout.num_chips(); ++chip_i)
+  {
+    const cartridge_layout::chip_entry& chip = layout.chip(chip_i);
+    erase_history::chip_key key;
+    key.serial = serial;
+    key.chip_num = chip_i;
+    key.manufacturer_id = chip.manufacturer_id;
+    key.device_id = chip.device_id;
+    
+    erase_history::chip_health health = history.get_chip_health(key);
+    if (health.num_block_erases > 0)
+    {
+      block_ms += health.recent_block_ms;
+      ++num_block_chips;
+    }
+    if (health.num_chip_erases > 0)
+    {
+      chip_ms += health.recent_chip_ms;
+      ++num_chip_chips;
+    }
+  }
+  
+  if (num_block_chips > 0)
+  {
+    m_rates.block_erase_seconds = block_ms / num_block_chips / 1000.0;
+  }
+  if (num_chip_chips > 0)
+  {
+    m_rates.chip_erase_seconds = chip_ms / num_chip_chips / 1000.0;
+  }
+}
+
+void operation_planner::use_chip_timings(system_type system)
+{
+  if (system == m_chip_system)
+  {
+    return;
+  }
+  
+  rates typical = default_rates(system);
+  m_rates.block_erase_seconds = typical.block_erase_seconds;
+  m_rates.chip_erase_seconds = typical.chip_erase_seconds;
+  m_chip_system = system;
+}
+
+
+
+operation_planner::plan operation_planner::plan_range(const cartridge_layout& layout, operation op, unsigned int address, unsigned int num_bytes, const unsigned char* image, bool skip_protected) const
+{
+  if (address > layout.num_bytes() || num_bytes > layout.num_bytes() - address)
+  {
+    throw invalid_argument("Range does not lie within the cartridge");
+  }
+  
+  plan p = empty_plan(op);
+  const bool writes = (op == operation::FLASH || op == operation::FLASH_AND_VERIFY || op == operation::RESTORE_SAVE);
+  const bool reads = (op != operation::FLASH && op != operation::RESTORE_SAVE);
+  const unsigned int end = address + num_bytes;
+  
+  for (unsigned int chip_i = 0; chip_i < layout.num_chips(); ++chip_i)
+  {
+    const cartridge_layout::chip_entry& chip = layout.chip(chip_i);
+    if (chip.num_bytes == 0 || chip.cartridge_address >= end || chip.cartridge_address + chip.num_bytes <= address)
+    {
+      continue;
+    }
+    
+    const cartridge_layout::block_entry* blocks = layout.chip_blocks(chip_i);
+    unsigned int chip_blocks = 0;
+    unsigned int chip_bytes = 0;
+    for (unsigned int block_i = 0; block_i < chip.num_blocks; ++block_i)
+    {
+      const cartridge_layout::block_entry& block = blocks[block_i];
+      unsigned int start = max(block.cartridge_address, address);
+      unsigned int stop = min(block.cartridge_address + block.num_bytes, end);
+      if (start >= stop || (skip_protected && block.is_protected))
+      {
+        continue;
+      }
+      
+      unsigned int block_bytes = stop - start;
+      ++p.num_blocks;
+      ++chip_blocks;
+      chip_bytes += block_bytes;
+      if (reads)
+      {
+        p.bytes_read += block_bytes;
+      }
+      if (writes && (image == nullptr || !is_blank_block(image + (start - address), block_bytes)))
+      {
+        p.bytes_programmed += block_bytes;
+      }
+    }
+    
+    if (!writes)
+    {
+      continue;
+    }
+    
+    // Like the cartridge, erase a chip that is rewritten in its entirety all
+    // at once if that is faster than erasing it block by block
+    double block_erase_time = chip_blocks * m_rates.block_erase_seconds;
+    double chip_erase_time = m_rates.chip_erase_seconds;
+    if (chip_blocks == chip.num_blocks && chip_bytes == chip.num_bytes && chip_erase_time < block_erase_time)
+    {
+      ++p.num_chip_erases;
+      p.chip_erase_bytes += chip.num_bytes;
+    }
+    else
+    {
+      p.num_block_erases += chip_blocks;
+    }
+  }
+  
+  return p;
+}
+
+operation_planner::plan operation_planner::plan_game(const cartridge& cart, operation op, int slot, const unsigned char* image, unsigned int num_bytes) const
+{
+  if (is_save_operation(op))
+  {
+    throw invalid_argument("Save operations are planned with plan_save()");
+  }
+  if (slot != cartridge::SLOT_ALL && (slot < 0 || slot >= (int) cart.num_slots()))
+  {
+    throw invalid_argument("invalid slot number: " + to_string(slot));
+  }
+  
+  // Images larger than the slot are cut short by the cartridge
+  if (num_bytes == 0)
+  {
+    num_bytes = cart.game_backup_size(slot);
+  }
+  num_bytes = min(num_bytes, slot == cartridge::SLOT_ALL ? cart.layout()->num_bytes() : cart.slot_size(slot));
+  
+  return plan_range(*cart.layout(), op, cart.game_data_address(slot, num_bytes), num_bytes, image);
+}
+
+operation_planner::plan operation_planner::plan_save(const cartridge& cart, operation op, int slot) const
+{
+  if (!is_save_operation(op))
+  {
+    throw invalid_argument("Game operations are planned with plan_game()");
+  }
+  
+  switch (cart.system())
+  {
+  case SYSTEM_NEO_GEO_POCKET:
+  {
+    // Saves are kept in the flash blocks of each slot that aren't protected
+    const cartridge_layout& layout = *cart.layout();
+    if (slot == cartridge::SLOT_ALL)
+    {
+      return plan_range(layout, op, 0, layout.num_bytes(), nullptr, true);
+    }
+    if (slot < 0 || slot >= (int) layout.num_chips())
+    {
+      throw invalid_argument("invalid slot number: " + to_string(slot));
+    }
+    return plan_range(layout, op, layout.chip(slot).cartridge_address, layout.chip(slot).num_bytes, nullptr, true);
+  }
+  
+  default:
+  {
+    // Saves are kept in static RAM, which needs no erasing
+    plan p = empty_plan(op);
+    unsigned int num_bytes = cart.save_backup_size(slot);
+    if (op == operation::BACKUP_SAVE)
+    {
+      p.bytes_read = num_bytes;
+    }
+    else
+    {
+      p.bytes_programmed = num_bytes;
+    }
+    return p;
+  }
+  }
+}
+
+
+
+double operation_planner::estimate_erase_seconds(const plan& p) const
+{
+  return p.num_block_erases * m_rates.block_erase_seconds
+    + p.num_chip_erases * m_rates.chip_erase_seconds;
+}
+
+double operation_planner::estimate_seconds(const plan& p) const
+{
+  return estimate_erase_seconds(p)
+    + (double) p.bytes_read / m_rates.read_bytes_per_second
+    + (double) p.bytes_programmed / m_rates.program_bytes_per_second;
+}
+
+void operation_planner::calibrate(const plan& p, const task_controller& controller)
+{
+  if (controller.get_task_status() != task_status::COMPLETED)
+  {
+    return;
+  }
+  
+  double read_seconds = controller.get_task_phase_seconds(TASK_PHASE_READ) + controller.get_task_phase_seconds(TASK_PHASE_VERIFY);
+  if (p.bytes_read > 0 && read_seconds > 0.0)
+  {
+    m_rates.read_bytes_per_second = blend(m_rates.read_bytes_per_second, p.bytes_read / read_seconds);
+  }
+  
+  double program_seconds = controller.get_task_phase_seconds(TASK_PHASE_PROGRAM);
+  if (p.bytes_programmed > 0 && program_seconds > 0.0)
+  {
+    m_rates.program_bytes_per_second = blend(m_rates.program_bytes_per_second, p.bytes_programmed / program_seconds);
+  }
+  
+  // Both kinds of erase are scaled alike, since the time spent waiting on
+  // them is only measured together
+  double predicted_erase_seconds = estimate_erase_seconds(p);
+  double erase_seconds = controller.get_task_phase_seconds(TASK_PHASE_ERASE);
+  if (predicted_erase_seconds > 0.0 && erase_seconds > 0.0)
+  {
+    double scale = blend(1.0, erase_seconds / predicted_erase_seconds);
+    m_rates.block_erase_seconds *= scale;
+    m_rates.chip_erase_seconds *= scale;
+  }
+}
@@ -0,0 +1,265 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref operation_planner
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref operation_planner class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-21
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __OPERATION_PLANNER_H__
+#define __OPERATION_PLANNER_H__
+
+#include "cartridge_descriptor.h"
+#include <string>
+
+class cartridge;
+class cartridge_layout;
+class erase_history;
+class task_controller;
+
+/*! \class operation_planner
+ *  \brief Class that works out what a cartridge operation will cost before it
+ *         runs.
+ *  
+ *  Class that turns an operation on a cartridge, such as flashing an image,
+ *  verifying it, or backing up a save, into a \ref plan listing the blocks it
+ *  touches, the erases it needs, and the bytes it moves over USB, and that
+ *  estimates how long the plan will take. Erases are planned the way the
+ *  cartridge performs them, including erasing a whole chip at once where that
+ *  is faster, and blocks of an image that are blank are not counted as
+ *  programmed.
+ *  
+ *  Estimates start from typical transfer rates and erase timings and are
+ *  calibrated with \ref calibrate() from the time finished jobs actually spent
+ *  in each \ref task_phase. Erases that overlap with programming another chip
+ *  are calibrated down accordingly, so estimates of a device converge on what
+ *  it really takes.
+ *  
+ *  This class is not thread-safe.
+ */
+class operation_planner
+{
+public:
+  
+  /*!
+   *  \brief The kinds of operation that can be planned.
+   */
+  enum class operation
+  {
+    /*! \brief Reading game data into a file. */
+    BACKUP,
+    
+    /*! \brief Writing an image to the game data. */
+    FLASH,
+    
+    /*! \brief Writing an image and reading back each block as it goes. */
+    FLASH_AND_VERIFY,
+    
+    /*! \brief Reading game data to compare it against an image. */
+    VERIFY,
+    
+    /*! \brief Reading save data into a file. */
+    BACKUP_SAVE,
+    
+    /*! \brief Writing save data from a file. */
+    RESTORE_SAVE
+  };
+  
+  /*!
+   *  \brief Struct containing the transfer rates and erase timings estimates
+   *         are based on.
+   */
+  struct rates
+  {
+    /*! \brief Bytes read from the cartridge per second. */
+    double         read_bytes_per_second;
+    
+    /*! \brief Bytes programmed into the cartridge per second. */
+    double         program_bytes_per_second;
+    
+    /*! \brief Seconds spent waiting for each block erase. */
+    double         block_erase_seconds;
+    
+    /*! \brief Seconds spent waiting for a whole chip to erase. */
+    double         chip_erase_seconds;
+  };
+  
+  /*!
+   *  \brief Struct describing the work an operation performs.
+   */
+  struct plan
+  {
+    /*! \brief The operation planned. */
+    operation      op;
+    
+    /*! \brief The number of blocks the operation touches. */
+    unsigned int   num_blocks;
+    
+    /*! \brief The number of blocks erased one at a time. */
+    unsigned int   num_block_erases;
+    
+    /*! \brief The number of chips erased in their entirety. */
+    unsigned int   num_chip_erases;
+    
+    /*! \brief The combined size of the chips erased in their entirety. */
+    unsigned long long chip_erase_bytes;
+    
+    /*! \brief The number of bytes read from the cartridge. */
+    unsigned long long bytes_read;
+    
+    /*! \brief The number of bytes programmed into the cartridge. */
+    unsigned long long bytes_programmed;
+  };
+  
+  
+  
+  /*!
+   *  \brief Class constructor. Starts from \ref default_rates().
+   */
+                          operation_planner();
+  
+  /*!
+   *  \brief Class constructor. Starts from the given rates.
+   *  
+   *  \param [in] initial_rates The rates to start from, such as ones saved
+   *         from an earlier calibration.
+   */
+  explicit                operation_planner(const rates& initial_rates);
+  
+  
+  
+  /*!
+   *  \brief Gets the typical rates of a device over a full-speed link.
+   *  
+   *  \param [in] system The system of the cartridge, whose chips' typical
+   *         erase timings are used. Anything but a WonderSwan cartridge gets
+   *         the timings of a Neo Geo Pocket cartridge.
+   */
+  static rates            default_rates(system_type system = SYSTEM_NEO_GEO_POCKET);
+  
+  /*!
+   *  \brief Gets the rates estimates are currently based on.
+   */
+  const rates&            get_rates() const;
+  
+  /*!
+   *  \brief Replaces the rates estimates are based on.
+   */
+  void                    set_rates(const rates& new_rates);
+  
+  /*!
+   *  \brief Bases the erase timings on the recorded erases of a cartridge.
+   *  
+   *  Replaces the block and chip erase timings with the recent averages that
+   *  an \ref erase_history holds for the chips of the cartridge plugged into
+   *  the given device. Timings for which nothing has been recorded are left
+   *  as they are.
+   *  
+   *  \param [in] history The history to read.
+   *  \param [in] layout The layout of the cartridge.
+   *  \param [in] serial The serial number of the device the cartridge is
+   *         plugged into.
+   */
+  void                    use_erase_history(erase_history& history, const cartridge_layout& layout, const std::string& serial);
+  
+  /*!
+   *  \brief Bases the erase timings on the chips of a system's cartridges.
+   *  
+   *  Replaces the block and chip erase timings with the typical ones of the
+   *  given system's chips, unless they already are based on that system's
+   *  chips, in which case calibrated timings are kept.
+   *  
+   *  \param [in] system The system of the cartridge plugged in.
+   */
+  void                    use_chip_timings(system_type system);
+  
+  
+  
+  /*!
+   *  \brief Plans an operation on a range of cartridge addresses.
+   *  
+   *  \param [in] layout The layout of the cartridge.
+   *  \param [in] op The operation to plan.
+   *  \param [in] address The cartridge address of the first byte of the
+   *         range.
+   *  \param [in] num_bytes The number of bytes in the range.
+   *  \param [in] image The data that will be written to the range, used to
+   *         leave blank blocks out of the bytes programmed. **nullptr** is an
+   *         accepted value, in which case every byte is counted.
+   *  \param [in] skip_protected Whether write protected blocks are left out
+   *         of the range, as they are for saves.
+   *  
+   *  \throws std::invalid_argument If the range does not lie within the
+   *          cartridge.
+   */
+  plan                    plan_range(const cartridge_layout& layout, operation op, unsigned int address, unsigned int num_bytes, const unsigned char* image = nullptr, bool skip_protected = false) const;
+  
+  /*!
+   *  \brief Plans an operation on the game data in a slot of a cartridge.
+   *  
+   *  \param [in] cart The initialized cartridge.
+   *  \param [in] op The operation to plan. Must not be a save operation.
+   *  \param [in] slot The slot, or \ref cartridge::SLOT_ALL.
+   *  \param [in] image The image that will be written or compared, or
+   *         **nullptr** if there is none or it isn't known yet.
+   *  \param [in] num_bytes The size of the image, or 0 to plan for the size
+   *         of a backup of the slot.
+   *  
+   *  \throws std::invalid_argument If the operation is a save operation or
+   *          the slot does not exist.
+   */
+  plan                    plan_game(const cartridge& cart, operation op, int slot, const unsigned char* image = nullptr, unsigned int num_bytes = 0) const;
+  
+  /*!
+   *  \brief Plans an operation on the save data in a slot of a cartridge.
+   *  
+   *  \param [in] cart The initialized cartridge.
+   *  \param [in] op The operation to plan. Must be a save operation.
+   *  \param [in] slot The slot, or \ref cartridge::SLOT_ALL.
+   *  
+   *  \throws std::invalid_argument If the operation is not a save operation.
+   */
+  plan                    plan_save(const cartridge& cart, operation op, int slot) const;
+  
+  
+  
+  /*!
+   *  \brief Estimates the seconds a plan spends waiting for erases.
+   */
+  double                  estimate_erase_seconds(const plan& p) const;
+  
+  /*!
+   *  \brief Estimates the seconds a plan takes from start to finish.
+   */
+  double                  estimate_seconds(const plan& p) const;
+  
+  /*!
+   *  \brief Folds the measured timings of a finished operation into the
+   *         rates.
+   *  
+   *  Compares the time the operation spent erasing, programming, and reading
+   *  with the work its plan says it did, and moves each rate part of the way
+   *  towards what was measured so that a single unusual run does not throw
+   *  the estimates off. Operations that did not complete are ignored.
+   *  
+   *  \param [in] p The plan of the operation.
+   *  \param [in] controller The controller the operation reported through.
+   */
+  void                    calibrate(const plan& p, const task_controller& controller);
+
+
+
+private:
+  
+  /*! \brief The rates estimates are currently based on. */
+  rates                   m_rates;
+  
+  /*! \brief The system whose chips the erase timings are based on. */
+  system_type             m_chip_system;
+};
+
+#endif /* defined(__OPERATION_PLANNER_H__) */
@@ -0,0 +1,232 @@
+/*! \file
+ *  \brief File containing the implementation of the \ref restore_plan class.
+ *  
+ *  File containing the implementation of the \ref restore_plan class.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see restore_plan
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "restore_plan.h"
+#include "cartridge_layout.h"
+#include "common/block_compare.h"
+#include <algorithm>
+#include <map>
+#include <mutex>
+
+using namespace std;
+
+// Plans that have been made for shared images, keyed on the chip bounds, the
+// size of the image, and the address and size of every block planned for
+typedef std::vector<unsigned int> plan_cache_key;
+struct plan_cache_entry
+{
+  std::weak_ptr<const void> owner;
+  std::weak_ptr<const image_cache::image> analysis;
+  unsigned int num_bytes;
+  std::map<plan_cache_key, std::shared_ptr<const restore_plan>> plans;
+};
+static std::map<const unsigned char*, plan_cache_entry> shared_images;
+static std::mutex shared_images_mutex;
+
+// Drops the images no one holds any more. Must be called with the mutex held.
+static void prune_shared_images()
+{
+  for (auto it = shared_images.begin(); it != shared_images.end();)
+  {
+    if (it->second.owner.expired())
+    {
+      it = shared_images.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+
+
+// Shares an image, taking blank blocks from its analysis if there is one
+static void share(std::shared_ptr<const void> owner, std::shared_ptr<const image_cache::image> analysis, const unsigned char* data, unsigned int num_bytes)
+{
+  if (owner == nullptr || data == nullptr)
+  {
+    return;
+  }
+  
+  lock_guard<mutex> lock(shared_images_mutex);
+  prune_shared_images();
+  
+  auto it = shared_images.find(data);
+  if (it != shared_images.end())
+  {
+    // Keep the plans if this is the same image shared again, otherwise the
+    // memory was reused for another image and they no longer apply
+    plan_cache_entry& image = it->second;
+    bool same_owner = !image.owner.owner_before(owner) && !owner.owner_before(image.owner);
+    if (!same_owner || image.num_bytes != num_bytes)
+    {
+      image.owner = owner;
+      image.analysis.reset();
+      image.num_bytes = num_bytes;
+      image.plans.clear();
+    }
+    if (analysis != nullptr)
+    {
+      image.analysis = analysis;
+    }
+    return;
+  }
+  
+  if (shared_images.size() >= RESTORE_PLAN_MAX_IMAGES)
+  {
+    shared_images.erase(shared_images.begin());
+  }
+  
+  plan_cache_entry& image = shared_images[data];
+  image.owner = owner;
+  image.analysis = analysis;
+  image.num_bytes = num_bytes;
+}
+
+
+
+restore_plan::restore_plan(const cartridge_layout& layout, unsigned int chip_lower_bound, unsigned int chip_upper_bound, const unsigned char* data, unsigned int num_bytes, const image_cache::image* analysis)
+  : m_knows_blank(data != nullptr)
+{
+  unsigned int offset = 0;
+  for (unsigned int chip_i = chip_lower_bound; chip_i < chip_upper_bound && offset < num_bytes; ++chip_i)
+  {
+    const cartridge_layout::block_entry* blocks = layout.chip_blocks(chip_i);
+    for (unsigned int block_i = 0; block_i < layout.chip(chip_i).num_blocks && offset < num_bytes; ++block_i)
+    {
+      extent e;
+      e.chip_num = chip_i;
+      e.base_address = blocks[block_i].base_address;
+      e.file_offset = offset;
+      e.num_bytes = min(blocks[block_i].num_bytes, num_bytes - offset);
+      if (analysis != nullptr)
+      {
+        e.blank = analysis->is_blank(offset, e.num_bytes);
+      }
+      else
+      {
+        e.blank = (data != nullptr && is_blank_block(data + offset, e.num_bytes));
+      }
+      m_extents.push_back(e);
+      
+      offset += e.num_bytes;
+    }
+  }
+}
+
+
+
+const std::vector<restore_plan::extent>& restore_plan::extents() const
+{
+  return m_extents;
+}
+
+bool restore_plan::knows_blank() const
+{
+  return m_knows_blank;
+}
+
+
+
+void restore_plan::share_image(std::shared_ptr<const void> owner, const unsigned char* data, unsigned int num_bytes)
+{
+  share(owner, nullptr, data, num_bytes);
+}
+
+void restore_plan::share_image(std::shared_ptr<const image_cache::image> image)
+{
+  if (image == nullptr)
+  {
+    return;
+  }
+  share(image, image, image->data(), image->size());
+}
+
+std::shared_ptr<const restore_plan> restore_plan::get(const cartridge_layout& layout, unsigned int chip_lower_bound, unsigned int chip_upper_bound, const unsigned char* data, unsigned int num_bytes)
+{
+  if (data == nullptr)
+  {
+    return make_shared<const restore_plan>(layout, chip_lower_bound, chip_upper_bound, data, num_bytes);
+  }
+  
+  plan_cache_key key = {chip_lower_bound, chip_upper_bound, num_bytes};
+  for (unsigned int chip_i = chip_lower_bound; chip_i < chip_upper_bound; ++chip_i)
+  {
+    const cartridge_layout::block_entry* blocks = layout.chip_blocks(chip_i);
+    key.push_back(layout.chip(chip_i).num_blocks);
+    for (unsigned int block_i = 0; block_i < layout.chip(chip_i).num_blocks; ++block_i)
+    {
+      key.push_back(blocks[block_i].base_address);
+      key.push_back(blocks[block_i].num_bytes);
+    }
+  }
+  
+  shared_ptr<const image_cache::image> analysis;
+  {
+    lock_guard<mutex> lock(shared_images_mutex);
+    auto it = shared_images.find(data);
+    if (it == shared_images.end() || it->second.num_bytes != num_bytes)
+    {
+      return make_shared<const restore_plan>(layout, chip_lower_bound, chip_upper_bound, data, num_bytes);
+    }
+    if (it->second.owner.expired())
+    {
+      shared_images.erase(it);
+      return make_shared<const restore_plan>(layout, chip_lower_bound, chip_upper_bound, data, num_bytes);
+    }
+    
+    auto found = it->second.plans.find(key);
+    if (found != it->second.plans.end())
+    {
+      return found->second;
+    }
+    analysis = it->second.analysis.lock();
+  }
+  
+  // Make the plan without holding the lock, since checking every block for
+  // blanks reads the whole image unless it was analysed already
+  shared_ptr<const restore_plan> plan = make_shared<const restore_plan>(layout, chip_lower_bound, chip_upper_bound, data, num_bytes, analysis.get());
+  
+  lock_guard<mutex> lock(shared_images_mutex);
+  auto it = shared_images.find(data);
+  if (it != shared_images.end() && it->second.num_bytes == num_bytes && !it->second.owner.expired())
+  {
+    // Another cartridge may have made the same plan meanwhile, in which case
+    // every cartridge is handed the one kept
+    auto inserted = it->second.plans.insert(make_pair(key, plan));
+    return inserted.first->second;
+  }
+  return plan;
+}
+
+unsigned int restore_plan::num_cached()
+{
+  lock_guard<mutex> lock(shared_images_mutex);
+  prune_shared_images();
+  
+  unsigned int num_plans = 0;
+  for (const auto& image : shared_images)
+  {
+    num_plans += (unsigned int) image.second.plans.size();
+  }
+  return num_plans;
+}
+
+void restore_plan::clear_cache()
+{
+  lock_guard<mutex> lock(shared_images_mutex);
+  shared_images.clear();
+}
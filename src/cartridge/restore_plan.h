@@ -0,0 +1,158 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref restore_plan class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref restore_plan class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __RESTORE_PLAN_H__
+#define __RESTORE_PLAN_H__
+
+#include "image_cache.h"
+#include <memory>
+#include <vector>
+
+class cartridge_layout;
+
+/*! \brief The most images whose plans are kept at once. Images let go of by
+ *         everyone are dropped first. */
+#define RESTORE_PLAN_MAX_IMAGES 64
+
+/*! \class restore_plan
+ *  \brief Compact list of the blocks an image is written to on a cartridge.
+ *  
+ *  Class mapping every block of an image to the chip and block of a
+ *  \ref cartridge_layout it is written to, along with whether the block is
+ *  blank and so only needs erasing. Everything in a plan depends only on the
+ *  layout and the image, so the blocks that are left out, compared, or
+ *  erased a chip at a time on a particular run are still decided while
+ *  writing.
+ *  
+ *  Flashing the same image onto many cartridges of the same kind, as a
+ *  broadcast or a batch does, would make the same plan for each. An image
+ *  that stays in memory for the whole batch can be shared with
+ *  \ref share_image(), after which \ref get() makes its plan once for every
+ *  layout and hands the same plan to every cartridge.
+ *  
+ *  Plans are immutable once made, and the static functions are thread-safe.
+ */
+class restore_plan
+{
+public:
+  
+  /*! \struct extent
+   *  \brief A single block of the image and where it is written.
+   */
+  struct extent
+  {
+    /*! \brief Index of the chip the block is written to. */
+    unsigned int          chip_num;
+    
+    /*! \brief Address of the block relative to the start of its chip. */
+    unsigned int          base_address;
+    
+    /*! \brief Offset of the block in the image. */
+    unsigned int          file_offset;
+    
+    /*! \brief The number of bytes of the image in the block, which is less
+     *         than the block's size for the last block of a short image. */
+    unsigned int          num_bytes;
+    
+    /*! \brief Whether every byte of the block in the image is 0xFF. Only
+     *         meaningful if the plan \ref knows_blank(). */
+    bool                  blank;
+  };
+  
+  
+  
+  /*!
+   *  \brief Class constructor. Plans writing an image to a range of chips.
+   *  
+   *  \param [in] layout The layout of the cartridge.
+   *  \param [in] chip_lower_bound The first chip written to.
+   *  \param [in] chip_upper_bound One past the last chip written to.
+   *  \param [in] data Pointer to the image in memory, or **nullptr** if it
+   *         isn't, in which case the plan doesn't know which blocks are
+   *         blank.
+   *  \param [in] num_bytes The size of the image in bytes.
+   *  \param [in] analysis The \ref image_cache::image holding **data**, whose
+   *         blank flags are used rather than reading every block, or
+   *         **nullptr** to read them.
+   */
+                          restore_plan(const cartridge_layout& layout, unsigned int chip_lower_bound, unsigned int chip_upper_bound, const unsigned char* data, unsigned int num_bytes, const image_cache::image* analysis = nullptr);
+  
+  
+  
+  /*!
+   *  \brief Gets every block of the image, chip by chip in address order.
+   */
+  const std::vector<extent>& extents() const;
+  
+  /*!
+   *  \brief Gets whether the plan knows which blocks are blank.
+   */
+  bool                    knows_blank() const;
+  
+  
+  
+  /*!
+   *  \brief Lets the plans of an image in memory be kept and shared.
+   *  
+   *  Plans for the image are kept for as long as **owner** is held by
+   *  anyone else, which must keep the image's memory unchanged.
+   *  
+   *  \param [in] owner The object holding the image, such as its
+   *         \ref mapped_file.
+   *  \param [in] data Pointer to the image in memory.
+   *  \param [in] num_bytes The size of the image in bytes.
+   */
+  static void             share_image(std::shared_ptr<const void> owner, const unsigned char* data, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Lets the plans of a cached image be kept and shared.
+   *  
+   *  Same as \ref share_image(std::shared_ptr<const void>, const unsigned char*, unsigned int),
+   *  except that plans take which blocks are blank from the image's analysis
+   *  instead of reading the whole image.
+   *  
+   *  \param [in] image The image from an \ref image_cache.
+   */
+  static void             share_image(std::shared_ptr<const image_cache::image> image);
+  
+  /*!
+   *  \brief Gets the plan for writing an image to a range of chips.
+   *  
+   *  Gets the kept plan if the image was shared with \ref share_image() and
+   *  was planned for the same layout before, otherwise makes a new one,
+   *  keeping it only if the image was shared.
+   *  
+   *  \see restore_plan(const cartridge_layout&, unsigned int, unsigned int, const unsigned char*, unsigned int, const image_cache::image*)
+   */
+  static std::shared_ptr<const restore_plan> get(const cartridge_layout& layout, unsigned int chip_lower_bound, unsigned int chip_upper_bound, const unsigned char* data, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Gets the number of plans kept.
+   */
+  static unsigned int     num_cached();
+  
+  /*!
+   *  \brief Discards every kept plan and shared image.
+   */
+  static void             clear_cache();
+
+
+
+private:
+  
+  /*! \brief Every block of the image. */
+  std::vector<extent>     m_extents;
+  
+  /*! \brief Whether \ref extent::blank is known. */
+  bool                    m_knows_blank;
+};
+
+#endif /* defined(__RESTORE_PLAN_H__) */
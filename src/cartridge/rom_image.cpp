@@ -0,0 +1,147 @@
+/*! \file
+ *  \brief File containing the implementation of \ref rom_image.
+ *  
+ *  File containing the implementation of \ref rom_image.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see rom_image
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "rom_image.h"
+#include "digest_manifest.h"
+#include "image_pipe.h"
+#include "common/block_compare.h"
+#include "common/trace.h"
+#include <algorithm>
+#include <istream>
+#include <stdexcept>
+
+using namespace std;
+
+
+
+rom_image::rom_image(std::istream& fin)
+  : m_fin(&fin), m_data(nullptr), m_manifest(nullptr), m_pipe(nullptr), m_size(0), m_has_changed_ranges(false)
+{
+  fin.seekg(0, fin.end);
+  m_size = (unsigned int) fin.tellg();
+  fin.seekg(0, fin.beg);
+}
+
+rom_image::rom_image(const unsigned char* data, unsigned int num_bytes)
+  : m_fin(nullptr), m_data(data), m_manifest(nullptr), m_pipe(nullptr), m_size(num_bytes), m_has_changed_ranges(false)
+{
+  // Nothing else to do
+}
+
+rom_image::rom_image(const digest_manifest& manifest)
+  : m_fin(nullptr), m_data(nullptr), m_manifest(&manifest), m_pipe(nullptr), m_size(manifest.size()), m_has_changed_ranges(false)
+{
+  // Nothing else to do
+}
+
+rom_image::rom_image(image_pipe& pipe)
+  : m_fin(nullptr), m_data(nullptr), m_manifest(nullptr), m_pipe(&pipe), m_size(pipe.size()), m_has_changed_ranges(false)
+{
+  // Nothing else to do
+}
+
+
+
+unsigned int rom_image::size() const
+{
+  return m_size;
+}
+
+bool rom_image::needs_buffer() const
+{
+  return m_fin != nullptr;
+}
+
+bool rom_image::has_contents() const
+{
+  return m_manifest == nullptr;
+}
+
+const unsigned char* rom_image::data() const
+{
+  return m_data;
+}
+
+const unsigned char* rom_image::read(unsigned int offset, unsigned char* buffer, unsigned int num_bytes)
+{
+  if (offset > m_size || num_bytes > m_size - offset)
+  {
+    throw std::runtime_error("ERROR");
+  }
+  
+  if (m_manifest != nullptr)
+  {
+    throw std::runtime_error("Image contents are not available");
+  }
+  if (m_pipe != nullptr)
+  {
+    return m_pipe->wait_for(offset, num_bytes);
+  }
+  if (m_fin == nullptr)
+  {
+    return m_data + offset;
+  }
+  
+  trace_scope trace(TRACE_FILE_IO, num_bytes);
+  m_fin->seekg(offset, m_fin->beg);
+  m_fin->read((char*) buffer, num_bytes);
+  if ((unsigned int) m_fin->gcount() != num_bytes)
+  {
+    throw std::runtime_error("ERROR");
+  }
+  return buffer;
+}
+
+bool rom_image::matches(unsigned int offset, const unsigned char* data, unsigned char* buffer, unsigned int num_bytes, unsigned int* mismatch_offset)
+{
+  if (m_manifest != nullptr)
+  {
+    return m_manifest->matches(offset, data, num_bytes, mismatch_offset);
+  }
+  
+  const unsigned char* block = read(offset, buffer, num_bytes);
+  unsigned int i = find_first_difference(block, data, num_bytes);
+  if (i != num_bytes)
+  {
+    if (mismatch_offset != nullptr)
+    {
+      *mismatch_offset = offset + i;
+    }
+    return false;
+  }
+  
+  return true;
+}
+
+void rom_image::set_changed_ranges(const std::vector<std::pair<unsigned int, unsigned int>>& ranges)
+{
+  m_changed_ranges = ranges;
+  m_has_changed_ranges = true;
+}
+
+bool rom_image::is_changed(unsigned int offset, unsigned int num_bytes) const
+{
+  if (!m_has_changed_ranges)
+  {
+    return true;
+  }
+  
+  // Find the first range that ends past the start of the block
+  auto range = upper_bound(m_changed_ranges.begin(), m_changed_ranges.end(), offset, [](unsigned int value, const pair<unsigned int, unsigned int>& r)
+  {
+    return value < r.second;
+  });
+  return range != m_changed_ranges.end() && range->first < offset + num_bytes;
+}
@@ -0,0 +1,216 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref rom_image class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref rom_image class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __ROM_IMAGE_H__
+#define __ROM_IMAGE_H__
+
+#include <iosfwd>
+#include <utility>
+#include <vector>
+
+class digest_manifest;
+class image_pipe;
+
+/*! \class rom_image
+ *  \brief Class providing random access to the contents of a game image.
+ *  
+ *  Class providing random access to the contents of a game image, which can
+ *  either be an input stream or a block of memory such as a
+ *  \ref mapped_file. Cartridge implementations read blocks through this
+ *  class so that the same code handles both. When the image is in memory,
+ *  blocks are returned in place and never copied.
+ *  
+ *  An image can also be backed by a \ref digest_manifest instead of the
+ *  image's contents. Such an image can only be compared against with
+ *  \ref matches(), not read from.
+ *  
+ *  An image backed by an \ref image_pipe is read while it is still being
+ *  written, each read waiting for the bytes it needs.
+ */
+class rom_image
+{
+public:
+  
+  /*!
+   *  \brief Constructs an image backed by an input stream.
+   *  
+   *  Constructs an image backed by an input stream. The stream must support
+   *  seeking. The size of the image is determined right away.
+   *  
+   *  \param [in,out] fin The stream to read from.
+   */
+                          rom_image(std::istream& fin);
+  
+  /*!
+   *  \brief Constructs an image backed by a block of memory.
+   *  
+   *  Constructs an image backed by a block of memory. The memory is not
+   *  copied and must remain valid for the lifetime of this object.
+   *  
+   *  \param [in] data Pointer to the start of the image.
+   *  \param [in] num_bytes The size of the image in bytes.
+   */
+                          rom_image(const unsigned char* data, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Constructs an image backed by a digest manifest.
+   *  
+   *  Constructs an image backed by the per-block digests of a manifest rather
+   *  than the contents of the image. The manifest is not copied and must
+   *  remain valid for the lifetime of this object.
+   *  
+   *  \param [in] manifest The manifest describing the image.
+   */
+                          rom_image(const digest_manifest& manifest);
+  
+  /*!
+   *  \brief Constructs an image backed by a pipe.
+   *  
+   *  Constructs an image backed by an \ref image_pipe that another thread is
+   *  still writing. Blocks are returned in place once they have been written.
+   *  The pipe must remain valid for the lifetime of this object.
+   *  
+   *  \param [in] pipe The pipe to read from.
+   */
+                          rom_image(image_pipe& pipe);
+  
+  
+  
+  /*!
+   *  \brief Gets the size of the image in bytes.
+   */
+  unsigned int            size() const;
+  
+  /*!
+   *  \brief Gets whether reading from the image requires a buffer.
+   *  
+   *  Gets whether reading from or comparing against the image requires a
+   *  buffer. If false, the image is in memory or backed by a manifest, and
+   *  the buffer arguments of \ref read() and \ref matches() are never
+   *  touched, so callers do not need to allocate one.
+   */
+  bool                    needs_buffer() const;
+  
+  /*!
+   *  \brief Gets whether the contents of the image are available.
+   *  
+   *  Gets whether the bytes of the image can be read with \ref read(). If
+   *  false, the image is backed by a manifest and only its digests are known.
+   */
+  bool                    has_contents() const;
+  
+  /*!
+   *  \brief Gets the memory backing the image.
+   *  
+   *  \return Pointer to the first byte of the image, or **nullptr** if the
+   *          image is not in memory.
+   */
+  const unsigned char*    data() const;
+  
+  /*!
+   *  \brief Gets a block of the image.
+   *  
+   *  Gets a block of bytes from the image. If the image is in memory, a
+   *  pointer into the image is returned and the buffer is ignored. Otherwise
+   *  the block is read from the stream into the buffer and the buffer is
+   *  returned.
+   *  
+   *  \param [in] offset The offset of the block from the start of the image.
+   *  \param [out] buffer Buffer to read the block into if the image is not in
+   *         memory. Must be at least **num_bytes** large, or may be
+   *         **nullptr** if \ref needs_buffer() returns false.
+   *  \param [in] num_bytes The number of bytes in the block.
+   *  
+   *  \return Pointer to the bytes of the block.
+   *  
+   *  \throws std::runtime_error If the block could not be read in full or the
+   *          image is backed by a manifest.
+   */
+  const unsigned char*    read(unsigned int offset, unsigned char* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Checks whether data matches a block of the image.
+   *  
+   *  Checks whether data, e.g. a block read from a cartridge, matches a block
+   *  of the image. If the image is backed by a manifest, the data is hashed
+   *  and compared to the manifest's digests instead, and the block must line
+   *  up with the blocks of the manifest.
+   *  
+   *  \param [in] offset The offset of the block from the start of the image.
+   *  \param [in] data The data to check.
+   *  \param [out] buffer Buffer to read the block into if the image is a
+   *         stream. Must be at least **num_bytes** large, or may be
+   *         **nullptr** if \ref needs_buffer() returns false.
+   *  \param [in] num_bytes The number of bytes in the block.
+   *  \param [out] mismatch_offset (optional) Set to the offset of the first
+   *         byte that did not match, or to the first block that did not match
+   *         if backed by a manifest.
+   *  
+   *  \return true if the data matches, false otherwise.
+   *  
+   *  \throws std::runtime_error If the block could not be read in full.
+   *  \throws std::invalid_argument If the block does not line up with the
+   *          blocks of the manifest.
+   */
+  bool                    matches(unsigned int offset, const unsigned char* data, unsigned char* buffer, unsigned int num_bytes, unsigned int* mismatch_offset = nullptr);
+  
+  /*!
+   *  \brief Limits the parts of the image that differ from the cartridge.
+   *  
+   *  Marks every part of the image outside the given ranges as already
+   *  matching the cartridge, e.g. because a patch left it as it was, so that
+   *  restoring the image leaves the blocks that lie completely outside the
+   *  ranges untouched. By default the whole image is taken to differ.
+   *  
+   *  \param [in] ranges The ranges that differ, as pairs of start and end
+   *         offsets, in order and without overlaps.
+   */
+  void                    set_changed_ranges(const std::vector<std::pair<unsigned int, unsigned int>>& ranges);
+  
+  /*!
+   *  \brief Checks whether a block of the image may differ from the
+   *         cartridge.
+   *  
+   *  \param [in] offset The offset of the block from the start of the image.
+   *  \param [in] num_bytes The number of bytes in the block.
+   *  
+   *  \return false if the block lies completely outside the ranges given to
+   *          \ref set_changed_ranges(), true otherwise.
+   */
+  bool                    is_changed(unsigned int offset, unsigned int num_bytes) const;
+  
+  
+  
+private:
+  
+  /*! \brief The stream backing the image, or **nullptr** if in memory. */
+  std::istream*           m_fin;
+  
+  /*! \brief The memory backing the image, or **nullptr** if not in memory. */
+  const unsigned char*    m_data;
+  
+  /*! \brief The manifest backing the image, or **nullptr** if not used. */
+  const digest_manifest*  m_manifest;
+  
+  /*! \brief The pipe backing the image, or **nullptr** if not used. */
+  image_pipe*             m_pipe;
+  
+  /*! \brief The size of the image in bytes. */
+  unsigned int            m_size;
+  
+  /*! \brief Flag indicating that only \ref m_changed_ranges differ. */
+  bool                    m_has_changed_ranges;
+  
+  /*! \brief The ranges of the image that differ from the cartridge. */
+  std::vector<std::pair<unsigned int, unsigned int>> m_changed_ranges;
+};
+
+#endif /* defined(__ROM_IMAGE_H__) */
@@ -0,0 +1,334 @@
+/*! \file
+ *  \brief File containing the implementation of \ref rom_patch.
+ *  
+ *  File containing the implementation of \ref rom_patch.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see rom_patch
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "rom_patch.h"
+#include "common/hash_stream.h"
+#include <algorithm>
+#include <cstring>
+#include <istream>
+#include <iterator>
+#include <stdexcept>
+
+// The size of the footer of a BPS patch: the checksums of the original image,
+// the patched image, and the patch itself
+#define BPS_FOOTER_SIZE 12
+
+// The IPS record offset that marks the end of the records
+#define IPS_EOF_MARKER  0x454F46
+
+using namespace std;
+
+static unsigned int read_le32(const unsigned char* data)
+{
+  return (unsigned int) data[0] | ((unsigned int) data[1] << 8) | ((unsigned int) data[2] << 16) | ((unsigned int) data[3] << 24);
+}
+
+
+
+rom_patch::rom_patch(std::istream& fin)
+  : m_format(format::IPS), m_source_size(0), m_target_size(0), m_actions_offset(0)
+{
+  m_data.assign(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+  const unsigned int size = (unsigned int) m_data.size();
+  
+  if (size >= 5 && memcmp(m_data.data(), "PATCH", 5) == 0)
+  {
+    m_format = format::IPS;
+    
+    // Collect the range written by each record, up to the end marker
+    unsigned int offset = 5;
+    bool found_end = false;
+    while (offset + 3 <= size)
+    {
+      unsigned int address = ((unsigned int) m_data[offset] << 16) | ((unsigned int) m_data[offset + 1] << 8) | m_data[offset + 2];
+      offset += 3;
+      if (address == IPS_EOF_MARKER)
+      {
+        found_end = true;
+        break;
+      }
+      
+      if (offset + 2 > size)
+      {
+        break;
+      }
+      unsigned int length = ((unsigned int) m_data[offset] << 8) | m_data[offset + 1];
+      offset += 2;
+      if (length == 0)
+      {
+        // Run-length encoded record: a count followed by a single value
+        if (offset + 3 > size)
+        {
+          break;
+        }
+        length = ((unsigned int) m_data[offset] << 8) | m_data[offset + 1];
+        offset += 3;
+      }
+      else
+      {
+        if (offset + length > size)
+        {
+          break;
+        }
+        offset += length;
+      }
+      
+      if (length > 0)
+      {
+        m_ranges.push_back(make_pair(address, address + length));
+      }
+    }
+    
+    if (!found_end)
+    {
+      throw runtime_error("IPS patch is truncated");
+    }
+    
+    // Merge overlapping records into ranges
+    sort(m_ranges.begin(), m_ranges.end());
+    vector<pair<unsigned int, unsigned int>> merged;
+    for (const pair<unsigned int, unsigned int>& range : m_ranges)
+    {
+      if (!merged.empty() && range.first <= merged.back().second)
+      {
+        merged.back().second = max(merged.back().second, range.second);
+      }
+      else
+      {
+        merged.push_back(range);
+      }
+    }
+    m_ranges.swap(merged);
+  }
+  else if (size >= 4 + 3 + BPS_FOOTER_SIZE && memcmp(m_data.data(), "BPS1", 4) == 0)
+  {
+    m_format = format::BPS;
+    
+    if (crc32_data(m_data.data(), size - 4) != read_le32(&m_data[size - 4]))
+    {
+      throw runtime_error("BPS patch is damaged");
+    }
+    
+    unsigned int offset = 4;
+    unsigned long long source_size = read_number(offset);
+    unsigned long long target_size = read_number(offset);
+    unsigned long long metadata_size = read_number(offset);
+    if (source_size > 0xFFFFFFFF || target_size > 0xFFFFFFFF || metadata_size > size - BPS_FOOTER_SIZE - offset)
+    {
+      throw runtime_error("BPS patch is damaged");
+    }
+    m_source_size = (unsigned int) source_size;
+    m_target_size = (unsigned int) target_size;
+    m_actions_offset = offset + (unsigned int) metadata_size;
+  }
+  else
+  {
+    throw runtime_error("Unrecognized patch format");
+  }
+}
+
+
+
+rom_patch::format rom_patch::patch_format() const
+{
+  return m_format;
+}
+
+bool rom_patch::needs_source() const
+{
+  return m_format == format::BPS;
+}
+
+unsigned int rom_patch::source_size() const
+{
+  return m_source_size;
+}
+
+unsigned int rom_patch::target_size(unsigned int source_size) const
+{
+  if (m_format == format::BPS)
+  {
+    return m_target_size;
+  }
+  
+  // IPS patches grow the image to fit records past its end
+  return (m_ranges.empty() ? source_size : max(source_size, m_ranges.back().second));
+}
+
+std::vector<std::pair<unsigned int, unsigned int>> rom_patch::written_ranges() const
+{
+  if (m_format == format::BPS)
+  {
+    // Any part of the image may be rebuilt from anywhere else
+    vector<pair<unsigned int, unsigned int>> ranges;
+    if (m_target_size > 0)
+    {
+      ranges.push_back(make_pair(0u, m_target_size));
+    }
+    return ranges;
+  }
+  
+  return m_ranges;
+}
+
+void rom_patch::apply(const unsigned char* source, unsigned int source_size, unsigned char* target) const
+{
+  const unsigned int size = (unsigned int) m_data.size();
+  
+  if (m_format == format::IPS)
+  {
+    // Start from the original image and overwrite each record in file order,
+    // so that later records win where they overlap
+    unsigned int num_bytes = target_size(source_size);
+    memcpy(target, source, source_size);
+    memset(target + source_size, 0, num_bytes - source_size);
+    
+    unsigned int offset = 5;
+    while (true)
+    {
+      unsigned int address = ((unsigned int) m_data[offset] << 16) | ((unsigned int) m_data[offset + 1] << 8) | m_data[offset + 2];
+      offset += 3;
+      if (address == IPS_EOF_MARKER)
+      {
+        break;
+      }
+      
+      unsigned int length = ((unsigned int) m_data[offset] << 8) | m_data[offset + 1];
+      offset += 2;
+      if (length == 0)
+      {
+        length = ((unsigned int) m_data[offset] << 8) | m_data[offset + 1];
+        memset(target + address, m_data[offset + 2], length);
+        offset += 3;
+      }
+      else
+      {
+        memcpy(target + address, &m_data[offset], length);
+        offset += length;
+      }
+    }
+    return;
+  }
+  
+  // BPS patches record which image they were made for
+  if (source_size != m_source_size || crc32_data(source, source_size) != read_le32(&m_data[size - BPS_FOOTER_SIZE]))
+  {
+    throw runtime_error("Patch was not made for this image");
+  }
+  
+  const unsigned int actions_end = size - BPS_FOOTER_SIZE;
+  unsigned int offset = m_actions_offset;
+  unsigned int output_offset = 0;
+  long long source_relative = 0;
+  long long target_relative = 0;
+  while (offset < actions_end)
+  {
+    unsigned long long action = read_number(offset);
+    unsigned long long length = (action >> 2) + 1;
+    if (length > m_target_size - output_offset)
+    {
+      throw runtime_error("BPS patch is damaged");
+    }
+    
+    switch (action & 3)
+    {
+    case 0:
+      // Copy from the same place in the original image
+      if (output_offset + length > source_size)
+      {
+        throw runtime_error("BPS patch is damaged");
+      }
+      memcpy(target + output_offset, source + output_offset, (size_t) length);
+      break;
+    
+    case 1:
+      // Copy from the patch itself
+      if (length > actions_end - offset)
+      {
+        throw runtime_error("BPS patch is damaged");
+      }
+      memcpy(target + output_offset, &m_data[offset], (size_t) length);
+      offset += (unsigned int) length;
+      break;
+    
+    case 2:
+    {
+      // Copy from elsewhere in the original image
+      unsigned long long delta = read_number(offset);
+      source_relative += (delta & 1 ? -(long long) (delta >> 1) : (long long) (delta >> 1));
+      if (source_relative < 0 || (unsigned long long) source_relative + length > source_size)
+      {
+        throw runtime_error("BPS patch is damaged");
+      }
+      memcpy(target + output_offset, source + source_relative, (size_t) length);
+      source_relative += (long long) length;
+      break;
+    }
+    
+    case 3:
+    {
+      // Copy from earlier in the patched image, byte by byte since the
+      // ranges may overlap
+      unsigned long long delta = read_number(offset);
+      target_relative += (delta & 1 ? -(long long) (delta >> 1) : (long long) (delta >> 1));
+      if (target_relative < 0 || (unsigned long long) target_relative >= output_offset)
+      {
+        throw runtime_error("BPS patch is damaged");
+      }
+      for (unsigned long long i = 0; i < length; ++i)
+      {
+        target[output_offset + i] = target[target_relative + i];
+      }
+      target_relative += (long long) length;
+      break;
+    }
+    }
+    
+    output_offset += (unsigned int) length;
+  }
+  
+  if (output_offset != m_target_size || crc32_data(target, m_target_size) != read_le32(&m_data[size - BPS_FOOTER_SIZE + 4]))
+  {
+    throw runtime_error("Patched image does not match the patch");
+  }
+}
+
+
+
+unsigned long long rom_patch::read_number(unsigned int& offset) const
+{
+  const unsigned int end = (unsigned int) m_data.size() - BPS_FOOTER_SIZE;
+  
+  // Each byte holds 7 bits, lowest first, with the top bit set on the last
+  // one; every byte but the last also adds one to the next place
+  unsigned long long value = 0;
+  unsigned long long shift = 1;
+  while (true)
+  {
+    if (offset >= end || shift > (1ULL << 56))
+    {
+      throw runtime_error("BPS patch is damaged");
+    }
+    unsigned char byte = m_data[offset++];
+    value += (byte & 0x7F) * shift;
+    if (byte & 0x80)
+    {
+      break;
+    }
+    shift <<= 7;
+    value += shift;
+  }
+  return value;
+}
@@ -0,0 +1,142 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref rom_patch class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref rom_patch class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __ROM_PATCH_H__
+#define __ROM_PATCH_H__
+
+#include <iosfwd>
+#include <utility>
+#include <vector>
+
+/*! \class rom_patch
+ *  \brief Class holding an IPS or BPS patch of a game image.
+ *  
+ *  Class holding a patch of a game image in either the IPS or the BPS format,
+ *  checked for consistency as it is loaded. A patch is applied to an image in
+ *  memory with \ref apply().
+ *  
+ *  An IPS patch only overwrites ranges of the image, so the ranges it writes
+ *  are known up front and only those parts of the original image are needed
+ *  to apply it. A BPS patch can copy from anywhere in the original image, so
+ *  applying it needs the whole original image, whose size and checksum the
+ *  patch records.
+ */
+class rom_patch
+{
+public:
+  
+  /*! \brief The format of a patch. */
+  enum class format
+  {
+    IPS,
+    BPS
+  };
+  
+  
+  
+  /*!
+   *  \brief Loads a patch from an input stream.
+   *  
+   *  \param [in,out] fin The stream to read the patch from. Read to its end.
+   *  
+   *  \throws std::runtime_error If the patch is not in a known format or is
+   *          damaged.
+   */
+  explicit                rom_patch(std::istream& fin);
+  
+  
+  
+  /*!
+   *  \brief Gets the format of the patch.
+   */
+  format                  patch_format() const;
+  
+  /*!
+   *  \brief Gets whether the patch may read from anywhere in the original
+   *         image.
+   *  
+   *  If false, only the bytes in \ref written_ranges() of the original image
+   *  need to be known to apply the patch.
+   */
+  bool                    needs_source() const;
+  
+  /*!
+   *  \brief Gets the size of the original image the patch applies to, or 0 if
+   *         the patch doesn't record one.
+   */
+  unsigned int            source_size() const;
+  
+  /*!
+   *  \brief Gets the size of the patched image.
+   *  
+   *  \param [in] source_size The size of the original image.
+   */
+  unsigned int            target_size(unsigned int source_size) const;
+  
+  /*!
+   *  \brief Gets the ranges of the patched image the patch writes to.
+   *  
+   *  \return The ranges as pairs of start and end offsets, in order and
+   *          without overlaps.
+   */
+  std::vector<std::pair<unsigned int, unsigned int>> written_ranges() const;
+  
+  /*!
+   *  \brief Applies the patch to an image.
+   *  
+   *  \param [in] source The original image.
+   *  \param [in] source_size The size of the original image in bytes.
+   *  \param [out] target Buffer to write the patched image to. Must be at
+   *         least \ref target_size() bytes large, and must not overlap the
+   *         original image.
+   *  
+   *  \throws std::runtime_error If the original image is not the one the
+   *          patch was made for, as far as the patch can tell, or the patched
+   *          image does not match the patch's checksum.
+   */
+  void                    apply(const unsigned char* source, unsigned int source_size, unsigned char* target) const;
+
+
+
+private:
+  
+  /*!
+   *  \brief Reads a variable-length number from a BPS patch.
+   *  
+   *  \param [in,out] offset The offset of the number in the patch. Moved past
+   *         the number.
+   *  
+   *  \throws std::runtime_error If the number runs past the end of the patch.
+   */
+  unsigned long long      read_number(unsigned int& offset) const;
+  
+  
+  
+  /*! \brief The format of the patch. */
+  format                  m_format;
+  
+  /*! \brief The contents of the patch file. */
+  std::vector<unsigned char> m_data;
+  
+  /*! \brief The ranges an IPS patch writes to, in order and merged. */
+  std::vector<std::pair<unsigned int, unsigned int>> m_ranges;
+  
+  /*! \brief The size of the original image of a BPS patch. */
+  unsigned int            m_source_size;
+  
+  /*! \brief The size of the patched image of a BPS patch. */
+  unsigned int            m_target_size;
+  
+  /*! \brief The offset of the first action of a BPS patch. */
+  unsigned int            m_actions_offset;
+};
+
+#endif /* defined(__ROM_PATCH_H__) */
@@ -0,0 +1,163 @@
+/*! \file
+ *  \brief File containing the implementation of \ref slot_table.
+ *  
+ *  File containing the implementation of \ref slot_table.
+ *  
+ *  See corrensponding header file to view documentation for struct, its
+ *  methods, and its member variables.
+ *  
+ *  \see slot_table
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-07
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "slot_table.h"
+#include "common/hash_stream.h"
+#include <cstring>
+#include <stdexcept>
+
+// First byte of a serialized table, changed whenever its layout does
+#define SLOT_TABLE_FORMAT 1
+
+using namespace std;
+
+
+
+static void write_le(unsigned char* data, unsigned int value, unsigned int num_bytes)
+{
+  for (unsigned int i = 0; i < num_bytes; ++i)
+  {
+    data[i] = (unsigned char) (value >> (8 * i));
+  }
+}
+
+static unsigned int read_le(const unsigned char* data, unsigned int num_bytes)
+{
+  unsigned int value = 0;
+  for (unsigned int i = 0; i < num_bytes; ++i)
+  {
+    value |= ((unsigned int) data[i]) << (8 * i);
+  }
+  return value;
+}
+
+
+
+unsigned int slot_table::game_key(const std::string& name)
+{
+  unsigned int key = crc32_data((const unsigned char*) name.data(), (unsigned int) name.size());
+  return (key == 0 ? 1 : key);
+}
+
+void slot_table::clear()
+{
+  memset(this, 0, sizeof(slot_table));
+}
+
+void slot_table::write_to_data_array(unsigned char* data) const
+{
+  memset(data, 0, SLOT_TABLE_BYTES);
+  data[0] = SLOT_TABLE_FORMAT;
+  data[1] = system;
+  data[2] = type;
+  data[3] = num_slots;
+  
+  for (unsigned int i = 0; i < num_slots && i < SLOT_TABLE_MAX_SLOTS; ++i)
+  {
+    const entry& e = slots[i];
+    unsigned char* d = data + 4 + i * SLOT_TABLE_ENTRY_BYTES;
+    write_le(d + 0, e.num_bytes, 4);
+    write_le(d + 4, e.startup_address, 4);
+    write_le(d + 8, e.game_key, 4);
+    write_le(d + 12, e.game_id, 2);
+    write_le(d + 14, e.checksum, 2);
+    d[16] = e.developer_id;
+    d[17] = e.version;
+    d[18] = e.minimum_system;
+    d[19] = e.rom_size;
+    d[20] = e.save_size;
+    d[21] = e.flags;
+    d[22] = e.rtc_present;
+    memcpy(d + 24, e.game_name, SLOT_TABLE_NAME_BYTES);
+  }
+}
+
+void slot_table::read_from_data_array(const unsigned char* data, unsigned int num_bytes)
+{
+  if (num_bytes < SLOT_TABLE_BYTES || data[0] != SLOT_TABLE_FORMAT || data[3] > SLOT_TABLE_MAX_SLOTS)
+  {
+    throw std::invalid_argument("Not a slot table");
+  }
+  
+  clear();
+  system = data[1];
+  type = data[2];
+  num_slots = data[3];
+  
+  for (unsigned int i = 0; i < num_slots; ++i)
+  {
+    entry& e = slots[i];
+    const unsigned char* d = data + 4 + i * SLOT_TABLE_ENTRY_BYTES;
+    e.num_bytes = read_le(d + 0, 4);
+    e.startup_address = read_le(d + 4, 4);
+    e.game_key = read_le(d + 8, 4);
+    e.game_id = (unsigned short) read_le(d + 12, 2);
+    e.checksum = (unsigned short) read_le(d + 14, 2);
+    e.developer_id = d[16];
+    e.version = d[17];
+    e.minimum_system = d[18];
+    e.rom_size = d[19];
+    e.save_size = d[20];
+    e.flags = d[21];
+    e.rtc_present = d[22];
+    memcpy(e.game_name, d + 24, SLOT_TABLE_NAME_BYTES);
+  }
+}
+
+bool slot_table::same_cartridge(const slot_table& other) const
+{
+  if (system != other.system || type != other.type || num_slots != other.num_slots)
+  {
+    return false;
+  }
+  
+  for (unsigned int i = 0; i < num_slots && i < SLOT_TABLE_MAX_SLOTS; ++i)
+  {
+    const entry& a = slots[i];
+    const entry& b = other.slots[i];
+    if (a.num_bytes != b.num_bytes || a.startup_address != b.startup_address
+        || a.game_id != b.game_id || a.checksum != b.checksum
+        || a.developer_id != b.developer_id || a.version != b.version
+        || a.minimum_system != b.minimum_system || a.rom_size != b.rom_size
+        || a.save_size != b.save_size || a.flags != b.flags || a.rtc_present != b.rtc_present
+        || memcmp(a.game_name, b.game_name, SLOT_TABLE_NAME_BYTES) != 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool slot_table::operator==(const slot_table& other) const
+{
+  if (!same_cartridge(other))
+  {
+    return false;
+  }
+  
+  for (unsigned int i = 0; i < num_slots && i < SLOT_TABLE_MAX_SLOTS; ++i)
+  {
+    if (slots[i].game_key != other.slots[i].game_key)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool slot_table::operator!=(const slot_table& other) const
+{
+  return !(*this == other);
+}
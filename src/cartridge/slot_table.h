@@ -0,0 +1,155 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref slot_table struct.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref slot_table struct.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-07
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __SLOT_TABLE_H__
+#define __SLOT_TABLE_H__
+
+#include <string>
+
+/*! \brief The most slots a \ref slot_table holds. */
+#define SLOT_TABLE_MAX_SLOTS    16
+
+/*! \brief The number of bytes of game name a \ref slot_table keeps per slot,
+ *         which is as long as a Neo Geo Pocket header's name. */
+#define SLOT_TABLE_NAME_BYTES   12
+
+/*! \brief The number of bytes each slot takes in a serialized
+ *         \ref slot_table. */
+#define SLOT_TABLE_ENTRY_BYTES  36
+
+/*! \brief The number of bytes a serialized \ref slot_table takes, whatever
+ *         number of slots it holds. */
+#define SLOT_TABLE_BYTES        (4 + SLOT_TABLE_MAX_SLOTS * SLOT_TABLE_ENTRY_BYTES)
+
+/*! \struct slot_table
+ *  \brief Compact, fixed-size description of the slots of a cartridge and the
+ *         games in them.
+ *  
+ *  Plain struct holding the size and header fields of each slot of a Neo Geo
+ *  Pocket or WonderSwan cartridge, as read by \ref cartridge::init(), along
+ *  with a key of the game identified in each slot. Being a fixed size with
+ *  no pointers, a table is cheap to keep for every device in a rack, to copy
+ *  between threads, and to compare, telling a cartridge seated again apart
+ *  from a different one without reading it.
+ *  
+ *  A table is serialized to exactly \ref SLOT_TABLE_BYTES bytes in a fixed,
+ *  little-endian layout, so that it can be stored or sent to another process
+ *  as is. Unused slots and fields a system doesn't have are zero.
+ *  
+ *  \see cartridge::fetch_slot_table()
+ */
+struct slot_table
+{
+  /*!
+   *  \brief Struct describing a single slot.
+   */
+  struct entry
+  {
+    /*! \brief The size of the slot in bytes. */
+    unsigned int   num_bytes;
+    
+    /*! \brief The startup address in the game's header. Neo Geo Pocket
+     *         only. */
+    unsigned int   startup_address;
+    
+    /*! \brief The key of the game identified in the slot, or 0 if none.
+     *  
+     *  \see game_key()
+     */
+    unsigned int   game_key;
+    
+    /*! \brief The game ID in the game's header. */
+    unsigned short game_id;
+    
+    /*! \brief The checksum in the game's footer. WonderSwan only. */
+    unsigned short checksum;
+    
+    /*! \brief The developer ID in the game's footer. WonderSwan only. */
+    unsigned char  developer_id;
+    
+    /*! \brief The game version of a Neo Geo Pocket game, or the mapper
+     *         version of a WonderSwan game. */
+    unsigned char  version;
+    
+    /*! \brief The minimum system the game runs on. */
+    unsigned char  minimum_system;
+    
+    /*! \brief The ROM size code in the game's footer. WonderSwan only. */
+    unsigned char  rom_size;
+    
+    /*! \brief The save size code in the game's footer. WonderSwan only. */
+    unsigned char  save_size;
+    
+    /*! \brief The flags in the game's footer. WonderSwan only. */
+    unsigned char  flags;
+    
+    /*! \brief Whether the game's footer says the cartridge has a real-time
+     *         clock. WonderSwan only. */
+    unsigned char  rtc_present;
+    
+    /*! \brief The name in the game's header, padded with zeroes and not
+     *         necessarily terminated. Neo Geo Pocket only. */
+    char           game_name[SLOT_TABLE_NAME_BYTES];
+  };
+  
+  
+  
+  /*!
+   *  \brief Computes the key a game is identified by in a table.
+   *  
+   *  \param [in] name The name of the game, as its catalog gives it.
+   *  
+   *  \return A non-zero key that is the same in every process.
+   */
+  static unsigned int game_key(const std::string& name);
+  
+  /*! \brief Sets every field to zero, leaving the table with no slots. */
+  void clear();
+  
+  /*! \brief Expects an array of at least \ref SLOT_TABLE_BYTES bytes. */
+  void write_to_data_array(unsigned char* data) const;
+  
+  /*!
+   *  \brief Expects an array written by \ref write_to_data_array().
+   *  
+   *  \throws std::invalid_argument If the array is too short or doesn't hold
+   *          a table.
+   */
+  void read_from_data_array(const unsigned char* data, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Checks whether two tables describe the same cartridge, ignoring
+   *         which games have been identified in its slots.
+   */
+  bool same_cartridge(const slot_table& other) const;
+  
+  /*! \brief Checks whether two tables are the same, field by field. */
+  bool operator==(const slot_table& other) const;
+  
+  /*! \brief Checks whether two tables differ in any field. */
+  bool operator!=(const slot_table& other) const;
+  
+  
+  
+  /*! \brief The system of the cartridge, as a \ref system_type. */
+  unsigned char  system;
+  
+  /*! \brief The type of the cartridge, as a \ref cartridge_type. */
+  unsigned char  type;
+  
+  /*! \brief The number of slots in use in \ref slots. */
+  unsigned char  num_slots;
+  
+  /*! \brief Every slot of the cartridge, in order. */
+  entry          slots[SLOT_TABLE_MAX_SLOTS];
+};
+
+#endif /* defined(__SLOT_TABLE_H__) */
@@ -0,0 +1,176 @@
+/*! \file
+ *  \brief File containing the implementation of \ref write_pipeline.
+ *  
+ *  File containing the implementation of \ref write_pipeline.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see write_pipeline
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-17
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "write_pipeline.h"
+#include "common/trace.h"
+#include <stdexcept>
+
+#define MIN_NUM_BUFFERS 2
+
+using namespace std;
+
+
+
+write_pipeline::write_pipeline(output_sink& sink, buffer_pool& pool, unsigned int buffer_size, unsigned int num_buffers, block_observer observer)
+  : m_sink(&sink), m_observer(observer),
+    m_writing(false), m_failed(false), m_bytes_written(0), m_stopping(false)
+{
+  start(pool, buffer_size, num_buffers);
+}
+
+write_pipeline::write_pipeline(std::ostream& out, buffer_pool& pool, unsigned int buffer_size, unsigned int num_buffers, block_observer observer)
+  : m_sink(nullptr), m_observer(observer),
+    m_writing(false), m_failed(false), m_bytes_written(0), m_stopping(false)
+{
+  // Skip the buffer of a stream over a sink. Whatever it collected so far has
+  // to reach the sink before the first block does
+  sink_ostream* sink_out = dynamic_cast<sink_ostream*>(&out);
+  if (sink_out != nullptr)
+  {
+    m_failed = !sink_out->flush().good();
+    m_sink = &sink_out->sink();
+  }
+  else
+  {
+    m_stream_sink.reset(new ostream_sink(out));
+    m_sink = m_stream_sink.get();
+  }
+  
+  start(pool, buffer_size, num_buffers);
+}
+
+write_pipeline::~write_pipeline()
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_stopping = true;
+  m_condition.notify_all();
+  lock.unlock();
+  
+  if (m_thread.joinable())
+  {
+    m_thread.join();
+  }
+}
+
+
+
+unsigned char* write_pipeline::acquire_buffer()
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return !m_free_buffers.empty(); });
+  
+  unsigned char* buffer = m_free_buffers.front();
+  m_free_buffers.pop_front();
+  return buffer;
+}
+
+void write_pipeline::submit_buffer(unsigned char* buffer, unsigned int num_bytes)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_queued_buffers.push_back(make_pair(buffer, num_bytes));
+  m_condition.notify_all();
+}
+
+bool write_pipeline::good()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return !m_failed;
+}
+
+unsigned int write_pipeline::bytes_written()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_bytes_written;
+}
+
+void write_pipeline::finish()
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return m_queued_buffers.empty() && !m_writing; });
+  
+  if (m_failed)
+  {
+    throw std::runtime_error("Error occured while writing to file");
+  }
+}
+
+
+
+void write_pipeline::start(buffer_pool& pool, unsigned int buffer_size, unsigned int num_buffers)
+{
+  if (num_buffers < MIN_NUM_BUFFERS)
+  {
+    num_buffers = MIN_NUM_BUFFERS;
+  }
+  
+  for (unsigned int i = 0; i < num_buffers; ++i)
+  {
+    m_buffers.push_back(pool.acquire(buffer_size));
+    m_free_buffers.push_back(m_buffers.back().data());
+  }
+  
+  m_thread = thread(&write_pipeline::writer_function, this);
+}
+
+void write_pipeline::writer_function()
+{
+  unique_lock<mutex> lock(m_mutex);
+  
+  while (true)
+  {
+    m_condition.wait(lock, [this] { return m_stopping || !m_queued_buffers.empty(); });
+    if (m_queued_buffers.empty())
+    {
+      // Stopping and nothing left to write
+      break;
+    }
+    
+    pair<unsigned char*, unsigned int> block = m_queued_buffers.front();
+    m_queued_buffers.pop_front();
+    m_writing = true;
+    bool failed = m_failed;
+    lock.unlock();
+    
+    // Keep recycling buffers after a failure so the producer never stalls,
+    // but don't write anything more
+    if (!failed)
+    {
+      try
+      {
+        if (m_observer)
+        {
+          m_observer(block.first, block.second);
+        }
+        trace_scope trace(TRACE_FILE_IO, block.second);
+        m_sink->write(block.first, block.second);
+      }
+      catch (std::exception& ex)
+      {
+        (void) ex;
+        failed = true;
+      }
+    }
+    
+    lock.lock();
+    m_failed = m_failed || failed;
+    if (!m_failed)
+    {
+      m_bytes_written += block.second;
+    }
+    m_writing = false;
+    m_free_buffers.push_back(block.first);
+    m_condition.notify_all();
+  }
+}
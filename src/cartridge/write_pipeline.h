@@ -0,0 +1,218 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref write_pipeline class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref write_pipeline class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-17
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __WRITE_PIPELINE_H__
+#define __WRITE_PIPELINE_H__
+
+#include "common/buffer_pool.h"
+#include "common/output_sink.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*! \class write_pipeline
+ *  \brief Class for writing blocks of data to a stream on a background thread.
+ *  
+ *  Class for writing blocks of data to an output sink on a background
+ *  thread, so that the next block can be read from a cartridge while the
+ *  previous one is still being written to disk. The pipeline owns a small,
+ *  fixed set of buffers. The caller fills a buffer obtained from
+ *  \ref acquire_buffer() and hands it back with
+ *  \ref submit_buffer(unsigned char* buffer, unsigned int num_bytes), after
+ *  which the buffer is written and recycled by the writer thread.
+ *  
+ *  \code
+ *  write_pipeline pipeline(fout, BLOCK_SIZE);
+ *  while (...)
+ *  {
+ *    unsigned char* buffer = pipeline.acquire_buffer();
+ *    unsigned int num_bytes = chip->read_bytes(address, buffer, BLOCK_SIZE);
+ *    pipeline.submit_buffer(buffer, num_bytes);
+ *  }
+ *  pipeline.finish();
+ *  \endcode
+ *  
+ *  The pipeline writes to an \ref output_sink, or to a stream through an
+ *  \ref ostream_sink. Given a \ref sink_ostream, it writes to the stream's
+ *  sink directly, skipping the stream's buffer. While the pipeline exists,
+ *  the output must not be used by anyone else.
+ *  
+ *  The producer side of this class is *not* thread-safe; only one thread
+ *  should acquire and submit buffers.
+ */
+class write_pipeline
+{
+public:
+  
+  /*!
+   *  \brief Type of a function called with each block before it is written.
+   *  
+   *  Type of a function called on the writer thread with each block, in order,
+   *  just before it is written. Can be used to hash the data as it goes by.
+   */
+  typedef std::function<void(const unsigned char*, unsigned int)> block_observer;
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  Class constructor. Borrows the buffers and starts the writer thread.
+   *  
+   *  \param [in,out] sink The sink to write blocks to. Must outlive the
+   *         pipeline.
+   *  \param [in,out] pool The pool to borrow buffers from. Must outlive the
+   *         pipeline.
+   *  \param [in] buffer_size The size of each buffer in bytes.
+   *  \param [in] num_buffers The number of buffers to cycle through. Values
+   *         less than 2 are treated as 2.
+   *  \param [in] observer Optional function to call with each block before it
+   *         is written.
+   */
+                          write_pipeline(output_sink& sink, buffer_pool& pool, unsigned int buffer_size, unsigned int num_buffers = 3, block_observer observer = nullptr);
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  Class constructor. Borrows the buffers and starts the writer thread.
+   *  
+   *  \param [in,out] out The stream to write blocks to.
+   *  \param [in,out] pool The pool to borrow buffers from. Must outlive the
+   *         pipeline.
+   *  \param [in] buffer_size The size of each buffer in bytes.
+   *  \param [in] num_buffers The number of buffers to cycle through. Values
+   *         less than 2 are treated as 2.
+   *  \param [in] observer Optional function to call with each block before it
+   *         is written.
+   */
+                          write_pipeline(std::ostream& out, buffer_pool& pool, unsigned int buffer_size, unsigned int num_buffers = 3, block_observer observer = nullptr);
+  
+  /*!
+   *  \brief Class destructor.
+   *  
+   *  Class destructor. Waits for any submitted blocks to be written, stops
+   *  the writer thread, and frees the buffers. Errors are not reported; call
+   *  \ref finish() beforehand to find out whether every block was written.
+   */
+                          ~write_pipeline();
+  
+  
+  
+  /*!
+   *  \brief Gets a buffer to fill with the next block.
+   *  
+   *  Gets a buffer of the size given at construction to fill with the next
+   *  block. Blocks until the writer thread has recycled a buffer if all of
+   *  them are in use.
+   *  
+   *  \return A pointer to an unused buffer.
+   */
+  unsigned char*          acquire_buffer();
+  
+  /*!
+   *  \brief Queues a filled buffer to be written.
+   *  
+   *  Queues a buffer previously returned by \ref acquire_buffer() to be
+   *  written to the sink. Blocks are written in the order they are
+   *  submitted. The buffer must not be used again until it is returned by
+   *  another call to \ref acquire_buffer().
+   *  
+   *  \param [in] buffer The buffer to write.
+   *  \param [in] num_bytes The number of bytes in the buffer to write.
+   */
+  void                    submit_buffer(unsigned char* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Gets whether every block written so far was written successfully.
+   *  
+   *  \return false if writing any block failed, true otherwise.
+   */
+  bool                    good();
+  
+  /*!
+   *  \brief Gets the number of bytes written to the stream so far.
+   *  
+   *  Gets the number of bytes that the writer thread has handed to the sink
+   *  without error. Bytes that have only been submitted are not counted.
+   *  
+   *  \return The number of bytes written.
+   */
+  unsigned int            bytes_written();
+  
+  /*!
+   *  \brief Blocks until every submitted block has been written.
+   *  
+   *  Blocks until every submitted block has been written. If writing any block
+   *  failed, an exception is thrown.
+   */
+  void                    finish();
+
+
+
+private:
+  
+  /*!
+   *  \brief Borrows the buffers and starts the writer thread.
+   */
+  void                    start(buffer_pool& pool, unsigned int buffer_size, unsigned int num_buffers);
+  
+  /*!
+   *  \brief The function that the writer thread executes.
+   */
+  void                    writer_function();
+  
+  
+  
+  /*! \brief The adapter for the stream written to, if not given a sink. */
+  std::unique_ptr<ostream_sink> m_stream_sink;
+  
+  /*! \brief The sink written to. */
+  output_sink*            m_sink;
+  
+  /*! \brief Function called with each block before it is written. */
+  block_observer          m_observer;
+  
+  /*! \brief All buffers borrowed by the pipeline. */
+  std::vector<buffer_pool::buffer> m_buffers;
+  
+  /*! \brief Buffers available to \ref acquire_buffer(). */
+  std::deque<unsigned char*> m_free_buffers;
+  
+  /*! \brief Submitted buffers waiting to be written, with their sizes. */
+  std::deque<std::pair<unsigned char*, unsigned int>> m_queued_buffers;
+  
+  /*! \brief Flag indicating that the writer thread is writing a block. */
+  bool                    m_writing;
+  
+  /*! \brief Flag indicating that writing a block failed. */
+  bool                    m_failed;
+  
+  /*! \brief Number of bytes successfully written to \ref m_sink. */
+  unsigned int            m_bytes_written;
+  
+  /*! \brief Flag telling the writer thread to exit once the queue is empty. */
+  bool                    m_stopping;
+  
+  /*! \brief Data lock used to share state with the writer thread. */
+  std::mutex              m_mutex;
+  
+  /*! \brief Condition used to signal changes to the queues. */
+  std::condition_variable m_condition;
+  
+  /*! \brief Handle for the writer thread. */
+  std::thread             m_thread;
+};
+
+#endif /* defined(__WRITE_PIPELINE_H__) */
@@ -15,13 +15,29 @@
 
 #include "ws_cartridge.h"
 #include "linkmasta/linkmasta_device.h"
+#include "linkmasta/ws_linkmasta_messages.h"
 #include "ws_rom_chip.h"
 #include "ws_sram_chip.h"
+#include "write_pipeline.h"
+#include "compare_pipeline.h"
+#include "block_mismatch_map.h"
+#include "slot_table.h"
+#include "image_pipe.h"
+#include "rom_image.h"
+#include "digest_manifest.h"
+#include "job_journal.h"
+#include "block_retry.h"
+#include "block_walk.h"
+#include "common/block_compare.h"
+#include "common/log.h"
 #include "task/task_controller.h"
 #include "task/forwarding_task_controller.h"
+#include <algorithm>
 #include <fstream>
+#include <memory>
 #include <sstream>
 #include <iomanip>
+#include <thread>
 
 //#ifdef VERBOSE
 #include <iostream>
@@ -30,13 +46,30 @@
 using namespace std;
 
 #define DEFAULT_BLOCK_SIZE 0x20000
+#define STREAM_READ_SIZE   0x80000
 #define DEFAULT_SRAM_SIZE  0x400000
+#define VERIFY_MAX_RETRIES 2
+#define FOOTER_SIZE        10
+
+// At the time of this code writing, cartridges contain a single chip with a
+// constant size and block size
+#define ROM_CHIP_SIZE      0x8000000
+
+// Games moved between slots go through memory this many bytes at a time, a
+// chunk of each slot when swapping. Larger chunks switch slots less often
+#define RELOCATE_CHUNK_SIZE 0x400000
+
+// Save data is moved in blocks that are a whole number of the largest batches
+// the linkmasta sends, 255 packets of 64 bytes, so no batch is cut short
+#define SAVE_BLOCK_SIZE    (8 * 255 * 64)
 
 
 
 ws_cartridge::ws_cartridge(linkmasta_device* linkmasta)
-  : m_was_init(false), m_linkmasta(linkmasta), m_descriptor(nullptr),
-    m_rom_chip(new ws_rom_chip(m_linkmasta)), m_sram_chip(new ws_sram_chip(m_linkmasta))
+  : m_was_init(false), m_linkmasta(linkmasta), m_descriptor(nullptr), m_layout(),
+    m_rom_chip(new ws_rom_chip(m_linkmasta)), m_sram_chip(new ws_sram_chip(m_linkmasta)),
+    m_eeprom_chip(new ws_sram_chip(m_linkmasta, wsmsg::TARGET_EEPROM)),
+    m_journal(nullptr), m_erase_history(nullptr), m_differential_save_restore(true)
 {
   // Nothing else to do
 }
@@ -57,6 +90,11 @@ ws_cartridge::~ws_cartridge()
   {
     delete m_sram_chip;
   }
+  
+  if (m_eeprom_chip != nullptr)
+  {
+    delete m_eeprom_chip;
+  }
 }
 
 
@@ -82,6 +120,11 @@ const cartridge_descriptor* ws_cartridge::descriptor() const
   return m_descriptor;
 }
 
+const cartridge_layout* ws_cartridge::layout() const
+{
+  return (m_descriptor != nullptr ? &m_layout : nullptr);
+}
+
 
 
 void ws_cartridge::init()
@@ -95,11 +138,36 @@ void ws_cartridge::init()
   m_linkmasta->init();
   m_linkmasta->open();
   m_rom_chip->reset();
+  m_rom_chip->invalidate_selected_slot();
   m_rom_chip->select_slot(0);
   build_cartridge_destriptor();
+  m_layout = (m_descriptor != nullptr ? cartridge_layout(*m_descriptor) : cartridge_layout());
   build_slots_layout();
   build_game_metadata();
   m_linkmasta->close();
+  apply_erase_history();
+}
+
+void ws_cartridge::set_journal(job_journal* journal)
+{
+  m_journal = journal;
+}
+
+void ws_cartridge::set_erase_history(erase_history* history, const std::string& serial)
+{
+  m_erase_history = history;
+  m_erase_serial = serial;
+  apply_erase_history();
+}
+
+bool ws_cartridge::differential_save_restore() const
+{
+  return m_differential_save_restore;
+}
+
+void ws_cartridge::set_differential_save_restore(bool enabled)
+{
+  m_differential_save_restore = enabled;
 }
 
 void ws_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, task_controller* controller)
@@ -137,47 +205,7 @@ void ws_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, task
   
   // Determine the total number of bytes to write
   unsigned int bytes_written = 0;
-  unsigned int bytes_total = 0;
-  
-  // Special case full-cartridge backup
-  if (slot == SLOT_ALL)
-  {
-    bytes_total = descriptor()->num_bytes;
-  }
-  else
-  {
-    const game_metadata* metadata = get_game_metadata(slot);
-    switch (metadata->rom_size)
-    {
-      case 0x0002:
-        bytes_total = 0x80000; // 4Mbit (512KB)
-        break;
-        
-      case 0x0003:
-        bytes_total = 0x100000; // 8Mbit (1MB)
-        break;
-        
-      case 0x0004:
-        bytes_total = 0x200000; // 16Mbit (2MB)
-        break;
-        
-      case 0x0006:
-        bytes_total = 0x400000; // 32Mbit (4MB)
-        break;
-        
-      case 0x0008:
-        bytes_total = 0x800000; // 64Mbit (8MB)
-        break;
-        
-      case 0x0009:
-        bytes_total = 0x1000000; // 128Mbit (16MB)
-        break;
-        
-      default:
-        bytes_total = slot_size;
-        break;
-    }
-  }
+  unsigned int bytes_total = game_backup_size(slot);
   
   // Initialize markers
   unsigned int curr_chip = 0;
@@ -194,27 +222,31 @@ void ws_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, task
     }
     
     // Figure out the current block
-    for (unsigned int i = 0; i < descriptor()->chips[0]->num_blocks; ++i)
+    int found_block = layout()->find_block(0, curr_slot_offset + curr_offset);
+    if (found_block >= 0)
     {
-      if (descriptor()->chips[0]->blocks[i]->base_address <= (curr_slot_offset + curr_offset)
-          && descriptor()->chips[0]->blocks[i]->base_address
-          + descriptor()->chips[0]->blocks[i]->num_bytes > (curr_slot_offset + curr_offset))
-      {
-        curr_block = i;
-        break;
-      }
+      curr_block = (unsigned int) found_block;
     }
   }
   
-  // Allocate a buffer with max size of a block
-  const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
+  // Pick up after the blocks that an interrupted backup already wrote
+  unsigned int bytes_resumed = (m_journal != nullptr ? m_journal->completed_bytes() : 0);
+  if (bytes_resumed > 0)
+  {
+    fout.seekp(bytes_resumed);
+  }
+  
+  // Write blocks to the file on another thread while the next one is read
+  const unsigned int BUFFER_MAX_SIZE = STREAM_READ_SIZE;
   unsigned int       buffer_size = 0;
-  unsigned char*     buffer = new unsigned char[BUFFER_MAX_SIZE];
+  unsigned char*     buffer;
+  write_pipeline     pipeline(fout, m_linkmasta->buffers(), BUFFER_MAX_SIZE);
   
   // Inform controller that task is starting
   if (controller != nullptr)
   {
     controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_READ);
   }
   
   // Begin writing data block-by-block
@@ -225,9 +257,7 @@ void ws_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, task
     
     while (bytes_written < bytes_total && curr_chip < descriptor()->num_chips && (controller == nullptr || !controller->is_task_cancelled()))
     {
-#ifdef VERBOSE
-      std::cout << "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)" << endl;
-#endif
+      LOG_STREAM(log_level::VERBOSE, "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)");
       
       // Convenience variables
       cartridge_descriptor::chip_descriptor* chip;
@@ -235,8 +265,17 @@ void ws_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, task
       chip = descriptor()->chips[curr_chip];
       block = chip->blocks[curr_block];
       
-      // Calculate number of expected bytes
+      // Calculate number of expected bytes, reading the contiguous blocks that
+      // follow in the same stream
+      const cartridge_layout::block_entry* chip_blocks = layout()->chip_blocks(curr_chip);
       unsigned int bytes_expected = (block->base_address + block->num_bytes) - (curr_slot_offset + curr_offset);
+      for (unsigned int next_block = curr_block + 1;
+           bytes_written >= bytes_resumed && next_block < chip->num_blocks && bytes_expected < BUFFER_MAX_SIZE
+           && chip_blocks[next_block].base_address == chip_blocks[next_block - 1].base_address + chip_blocks[next_block - 1].num_bytes;
+           ++next_block)
+      {
+        bytes_expected += chip_blocks[next_block].num_bytes;
+      }
       if (bytes_expected > bytes_total - bytes_written)
       {
         // Make sure we don't write more bytes than we initially expected
@@ -253,53 +292,70 @@ void ws_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, task
         bytes_expected = BUFFER_MAX_SIZE;
       }
       
-      // Attempt to read bytes from cartridge
-      if (controller == nullptr)
+      if (bytes_written + bytes_expected <= bytes_resumed)
       {
-        buffer_size = m_rom_chip->read_bytes(curr_offset, buffer, bytes_expected);
+        // Block is already in the file
+        buffer_size = bytes_expected;
+        if (controller != nullptr)
+        {
+          controller->on_task_update(task_status::RUNNING, bytes_expected);
+        }
       }
       else
       {
-        // Create a forwarding controller to pass progress updates to
-        forwarding_task_controller fwd_controller(controller);
-        fwd_controller.scale_work_to(bytes_expected);
-        try
+        // Attempt to read bytes from cartridge, retrying if the device hangs
+        buffer = pipeline.acquire_buffer();
+        retry_on_timeout(bytes_written, [&]
+        {
+          buffer_size = walk_read_block(m_rom_chip, curr_offset, buffer, bytes_expected, controller);
+        }, [&]
         {
-          buffer_size = m_rom_chip->read_bytes(curr_offset, buffer, bytes_expected, &fwd_controller);
+          m_linkmasta->recover_connection();
+          // The device may have lost its slot along with the transfer
+          m_rom_chip->reset();
+          m_rom_chip->invalidate_selected_slot();
+          m_rom_chip->select_slot(curr_slot);
+        });
+        
+        // A read cut short by cancelling just ends the backup early
+        if (buffer_size != bytes_expected && controller != nullptr && controller->is_task_cancelled())
+        {
+          break;
         }
-        catch (std::exception& ex)
+        
+        // Check for errors
+        if (buffer_size != bytes_expected)
         {
-          (void) ex;
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-          throw;
+          if (controller != nullptr)
+          {
+            controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          }
+          throw std::runtime_error("ERROR");
         }
-      }
-      
-      // Check for errors
-      if (buffer_size != bytes_expected)
-      {
-        if (controller != nullptr)
+        if (!pipeline.good())
         {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          if (controller != nullptr)
+          {
+            controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          }
+          throw std::runtime_error("ERROR");
         }
-        throw std::runtime_error("ERROR");
-      }
-      if (!fout.good())
-      {
-        if (controller != nullptr)
+        
+        // Queue buffer to be written to file
+        pipeline.submit_buffer(buffer, buffer_size);
+        
+        // Record the blocks that have reached the file so far
+        if (m_journal != nullptr)
         {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          m_journal->mark_complete(0, bytes_resumed + pipeline.bytes_written());
         }
-        throw std::runtime_error("ERROR");
       }
       
-      // Write buffer to file
-      fout.write((char*) buffer, buffer_size);
-      
       // Update markers
       bytes_written += buffer_size;
       curr_offset += buffer_size;
-      if (curr_slot_offset + curr_offset >= block->base_address + block->num_bytes)
+      while (curr_block < chip->num_blocks
+             && curr_slot_offset + curr_offset >= chip->blocks[curr_block]->base_address + chip->blocks[curr_block]->num_bytes)
       {
         curr_block++;
       }
@@ -315,7 +371,10 @@ void ws_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, task
         if (curr_slot < num_slots() - 1)
         {
           curr_slot++;
-          m_linkmasta->switch_slot(curr_slot);
+          if (!m_rom_chip->select_slot(curr_slot))
+          {
+            throw std::runtime_error("Error occured while attempting to switch slot");
+          }
         }
         slot_size = this->slot_size(curr_slot);
       }
@@ -323,19 +382,161 @@ void ws_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, task
     
     // Clean up before returning
     m_linkmasta->close();
+    
+    // Wait for the last blocks to reach the file
+    pipeline.finish();
+    if (m_journal != nullptr)
+    {
+      m_journal->mark_complete(0, bytes_resumed + pipeline.bytes_written());
+    }
   }
   catch (std::exception& ex)
   {
     (void) ex;
     // Error occured! Clean up and pass error on to caller
-    try {
-      // Spinlock while the chip finishes erasing (if it was erasing)
-      while (m_rom_chip->is_erasing());
-    } catch (std::exception& ex2) {
-      (void) ex2;
-      // Well... this is awkward
+    abandon_block_walk(m_rom_chip, m_linkmasta, controller);
+    throw;
+  }
+  
+  // Inform controller of task end
+  if (controller != nullptr)
+  {
+    controller->on_task_end(controller->is_task_cancelled() && bytes_written < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_written);
+  }
+}
+
+void ws_cartridge::backup_slots_game_data(const std::vector<std::ostream*>& fouts, task_controller* controller)
+{
+  // Ensure class was intiialized
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Cartridge not initialized");
+  }
+  
+  // Validate arguments
+  if (fouts.size() > m_slots.size())
+  {
+    throw std::invalid_argument("more outputs than slots: " + std::to_string(fouts.size()));
+  }
+  
+  // Games sit at the top of their slots, so only read what each one occupies
+  std::vector<unsigned int> slot_bytes(fouts.size(), 0);
+  unsigned int bytes_total = 0;
+  for (unsigned int i = 0; i < fouts.size(); ++i)
+  {
+    if (fouts[i] == nullptr)
+    {
+      continue;
+    }
+    
+    slot_bytes[i] = get_game_size(i);
+    if (slot_bytes[i] == 0 || slot_bytes[i] > slot_size(i))
+    {
+      slot_bytes[i] = slot_size(i);
+    }
+    bytes_total += slot_bytes[i];
+  }
+  
+  const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
+  unsigned int       bytes_written = 0;
+  
+  // Each slot gets its own pipeline. The previous slot's pipeline is only
+  // waited on once the next slot has been read, so that its last writes
+  // overlap the reads
+  std::unique_ptr<write_pipeline> prev_pipeline;
+  std::unique_ptr<write_pipeline> pipeline;
+  
+  // Inform controller that task is starting
+  if (controller != nullptr)
+  {
+    controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_READ);
+  }
+  
+  try
+  {
+    m_linkmasta->open();
+    
+    for (unsigned int curr_slot = 0; curr_slot < fouts.size() && (controller == nullptr || !controller->is_task_cancelled()); ++curr_slot)
+    {
+      if (fouts[curr_slot] == nullptr)
+      {
+        continue;
+      }
+      
+      if (!m_rom_chip->select_slot(curr_slot))
+      {
+        throw std::runtime_error("Error occured while attempting to switch slot");
+      }
+      
+      pipeline.reset(new write_pipeline(*fouts[curr_slot], m_linkmasta->buffers(), BUFFER_MAX_SIZE));
+      
+      unsigned int curr_offset = slot_size(curr_slot) - slot_bytes[curr_slot];
+      unsigned int slot_end = slot_size(curr_slot);
+      while (curr_offset < slot_end && (controller == nullptr || !controller->is_task_cancelled()))
+      {
+        // Keep reads aligned to blocks
+        unsigned int bytes_expected = BUFFER_MAX_SIZE - curr_offset % BUFFER_MAX_SIZE;
+        if (bytes_expected > slot_end - curr_offset)
+        {
+          bytes_expected = slot_end - curr_offset;
+        }
+        
+        // Attempt to read bytes from cartridge, retrying if the device hangs
+        unsigned int buffer_size = 0;
+        unsigned char* buffer = pipeline->acquire_buffer();
+        retry_on_timeout(bytes_written, [&]
+        {
+          buffer_size = walk_read_block(m_rom_chip, curr_offset, buffer, bytes_expected, controller);
+        }, [&]
+        {
+          m_linkmasta->recover_connection();
+          // The device may have lost its slot along with the transfer
+          m_rom_chip->reset();
+          m_rom_chip->invalidate_selected_slot();
+          m_rom_chip->select_slot(curr_slot);
+        });
+        
+        // A read cut short by cancelling just ends the backup early
+        if (buffer_size != bytes_expected && controller != nullptr && controller->is_task_cancelled())
+        {
+          break;
+        }
+        
+        // Check for errors
+        if (buffer_size != bytes_expected || !pipeline->good())
+        {
+          throw std::runtime_error("ERROR");
+        }
+        
+        // Queue buffer to be written to file
+        pipeline->submit_buffer(buffer, buffer_size);
+        
+        bytes_written += buffer_size;
+        curr_offset += buffer_size;
+      }
+      
+      // The previous slot has had the whole of this one to finish writing
+      if (prev_pipeline != nullptr)
+      {
+        prev_pipeline->finish();
+      }
+      prev_pipeline = std::move(pipeline);
     }
     
+    // Clean up before returning
+    m_linkmasta->close();
+    
+    // Wait for the last blocks to reach the file
+    if (prev_pipeline != nullptr)
+    {
+      prev_pipeline->finish();
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // Error occured! Clean up and pass error on to caller
     try {
       // Attempt to reset the chip
       m_rom_chip->reset();
@@ -356,7 +557,6 @@ void ws_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, task
     {
       controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
     }
-    delete [] buffer;
     throw;
   }
   
@@ -365,10 +565,178 @@ void ws_cartridge::backup_cartridge_game_data(std::ostream& fout, int slot, task
   {
     controller->on_task_end(controller->is_task_cancelled() && bytes_written < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_written);
   }
-  delete [] buffer;
 }
 
 void ws_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
+{
+  rom_image image(fin);
+  restore_game_data(image, slot, controller, false);
+}
+
+void ws_cartridge::restore_cartridge_game_data(const unsigned char* image_data, unsigned int num_bytes, int slot, task_controller* controller)
+{
+  rom_image image(image_data, num_bytes);
+  restore_game_data(image, slot, controller, false);
+}
+
+bool ws_cartridge::restore_and_verify_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
+{
+  rom_image image(fin);
+  return restore_game_data(image, slot, controller, true);
+}
+
+bool ws_cartridge::restore_and_verify_cartridge_game_data(const unsigned char* image_data, unsigned int num_bytes, int slot, task_controller* controller)
+{
+  rom_image image(image_data, num_bytes);
+  return restore_game_data(image, slot, controller, true);
+}
+
+bool ws_cartridge::restore_slots_game_data(const std::vector<std::pair<int, std::istream*>>& images, task_controller* controller, bool verify)
+{
+  // Ensure class was intiialized
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Cartridge not initialized");
+  }
+  
+  // Visit the slots in order so that each is only switched to once
+  std::vector<std::pair<int, std::istream*>> order(images);
+  std::sort(order.begin(), order.end(), [](const std::pair<int, std::istream*>& a, const std::pair<int, std::istream*>& b)
+  {
+    return a.first < b.first;
+  });
+  
+  // Validate arguments before anything is erased
+  std::vector<std::unique_ptr<image_pipe>> pipes;
+  unsigned int bytes_total = 0;
+  for (unsigned int i = 0; i < order.size(); ++i)
+  {
+    int slot = order[i].first;
+    if (slot < 0 || slot >= (int) m_slots.size())
+    {
+      throw std::invalid_argument("invalid slot number: " + std::to_string(slot));
+    }
+    if (i > 0 && order[i - 1].first == slot)
+    {
+      throw std::invalid_argument("slot given more than once: " + std::to_string(slot));
+    }
+    
+    std::istream& fin = *order[i].second;
+    fin.seekg(0, fin.end);
+    std::streamoff num_bytes = fin.tellg();
+    fin.seekg(0, fin.beg);
+    if (num_bytes < 0)
+    {
+      throw std::runtime_error("Unable to read image for slot " + std::to_string(slot));
+    }
+    if ((unsigned long long) num_bytes > slot_size(slot))
+    {
+      throw std::runtime_error("File too large for destination");
+    }
+    
+    pipes.emplace_back(new image_pipe((unsigned int) num_bytes));
+    bytes_total += (unsigned int) num_bytes;
+  }
+  
+  // Read the images one after the other while the slots before them are
+  // being written. Once one fails, or the writes stop early, the images after
+  // it are closed unread so that nothing waits on them
+  std::thread loader([&order, &pipes]()
+  {
+    std::vector<char> chunk(DEFAULT_BLOCK_SIZE);
+    for (unsigned int i = 0; i < pipes.size(); ++i)
+    {
+      image_pipe& pipe = *pipes[i];
+      try
+      {
+        std::istream& fin = *order[i].second;
+        for (unsigned int remaining = pipe.size(); remaining > 0; )
+        {
+          unsigned int num_bytes = std::min(remaining, (unsigned int) chunk.size());
+          fin.read(chunk.data(), num_bytes);
+          if ((unsigned int) fin.gcount() != num_bytes)
+          {
+            throw std::runtime_error("Unable to read image for slot " + std::to_string(order[i].first));
+          }
+          
+          pipe.output().write(chunk.data(), num_bytes);
+          if (!pipe.output())
+          {
+            throw std::runtime_error("Flash stopped");
+          }
+          remaining -= num_bytes;
+        }
+        pipe.close();
+      }
+      catch (std::exception& ex)
+      {
+        for (unsigned int j = i; j < pipes.size(); ++j)
+        {
+          pipes[j]->close(ex.what());
+        }
+        return;
+      }
+    }
+  });
+  
+  if (controller != nullptr)
+  {
+    controller->on_task_start(bytes_total);
+  }
+  
+  // The journal's offsets only describe a single image
+  job_journal* journal = m_journal;
+  m_journal = nullptr;
+  
+  // Keep the device open across the slots so the slot selected by one write
+  // is still known to the next
+  std::exception_ptr error;
+  bool verified = true;
+  try
+  {
+    linkmasta_device::session session(m_linkmasta);
+    for (unsigned int i = 0; i < order.size() && (controller == nullptr || !controller->is_task_cancelled()); ++i)
+    {
+      rom_image image(*pipes[i]);
+      if (controller == nullptr)
+      {
+        verified = restore_game_data(image, order[i].first, nullptr, verify) && verified;
+      }
+      else
+      {
+        forwarding_task_controller fwd_controller(controller);
+        fwd_controller.scale_work_to(image.size());
+        verified = restore_game_data(image, order[i].first, &fwd_controller, verify) && verified;
+      }
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    error = std::current_exception();
+  }
+  m_journal = journal;
+  
+  // Slots left unwritten no longer need their images
+  for (auto& pipe : pipes)
+  {
+    pipe->abandon();
+  }
+  loader.join();
+  
+  bool interrupted = (error || (controller != nullptr && controller->is_task_cancelled()));
+  if (controller != nullptr)
+  {
+    controller->on_task_end(error ? task_status::ERROR : (interrupted ? task_status::CANCELLED : task_status::COMPLETED), controller->get_task_work_progress());
+  }
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+  return verified;
+}
+
+bool ws_cartridge::restore_game_data(rom_image& image, int slot, task_controller* controller, bool verify)
 {
   // Due to how WonderSwan games are read and stored on a cart, the game's meta
   // data is stored in the upper addresses. Because of how cartridges are made,
@@ -396,16 +764,14 @@ void ws_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, task
   }
   
   // Determine the total number of bytes to write
-  fin.seekg(0, fin.end);
   unsigned int bytes_written = 0;
-  unsigned int bytes_total = (unsigned int) fin.tellg();
-  fin.seekg(0, fin.beg);
+  unsigned int bytes_total = image.size();
   
   // Ensure file will fit
   unsigned int curr_slot = (slot == SLOT_ALL ? 0 : (unsigned int) slot);
   unsigned int slot_size = this->slot_size(curr_slot);
   
-  if (m_rom_chip->selected_slot() != curr_slot && !m_rom_chip->select_slot(curr_slot))
+  if (!m_rom_chip->select_slot(curr_slot))
   {
     throw std::runtime_error("Error occured while attempting to switch slot");
   }
@@ -428,26 +794,28 @@ void ws_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, task
   {
     slot_offset += this->slot_size(i);
   }
-  for (unsigned int i = 0; i < descriptor()->chips[0]->num_blocks; ++i)
+  int found_block = layout()->find_block(0, slot_offset + curr_offset);
+  if (found_block >= 0)
   {
-    if (descriptor()->chips[0]->blocks[i]->base_address <= (slot_offset + curr_offset)
-        && descriptor()->chips[0]->blocks[i]->base_address
-        + descriptor()->chips[0]->blocks[i]->num_bytes > (slot_offset + curr_offset))
-    {
-      curr_block = i;
-      break;
-    }
+    curr_block = (unsigned int) found_block;
   }
   
-  // Allocate a buffer with max size of a block
+  // Allocate a buffer with max size of a block, unless blocks can be taken
+  // straight from an image in memory
   const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
   unsigned int       buffer_size = 0;
-  unsigned char*     buffer = new unsigned char[BUFFER_MAX_SIZE];
+  buffer_pool::buffer buffer_memory = (image.needs_buffer() ? m_linkmasta->buffers().acquire(BUFFER_MAX_SIZE) : buffer_pool::buffer());
+  unsigned char*     buffer = buffer_memory.data();
+  const unsigned char* f_block = nullptr;
+  buffer_pool::buffer verify_buffer_memory = (verify ? m_linkmasta->buffers().acquire(BUFFER_MAX_SIZE) : buffer_pool::buffer());
+  unsigned char*     verify_buffer = verify_buffer_memory.data();
+  bool               verified = true;
   
   // Inform controller that task is starting
   if (controller != nullptr)
   {
     controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_PROGRAM);
   }
   
   // Begin writing data block-by-block
@@ -458,9 +826,7 @@ void ws_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, task
     
     while (bytes_written < bytes_total && (controller == nullptr || !controller->is_task_cancelled()))
     {
-#ifdef VERBOSE
-      std::cout << "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)" << endl;
-#endif
+      LOG_STREAM(log_level::VERBOSE, "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)");
       
       // Convenience variables
       cartridge_descriptor::chip_descriptor* chip;
@@ -483,59 +849,80 @@ void ws_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, task
         bytes_expected = slot_size - curr_offset;
       }
       
-      // Attempt to read bytes from file
-      fin.read((char*) buffer, bytes_expected);
-      buffer_size = ((unsigned int) fin.tellg()) - bytes_written;
-      
-      // Check for errors
-      if (buffer_size != bytes_expected)
+      buffer_size = bytes_expected;
+      if ((m_journal != nullptr && m_journal->is_complete(bytes_written, bytes_expected)) || !image.is_changed(bytes_written, bytes_expected))
       {
+        // Block was already written by an interrupted restore, or a patch
+        // leaves it as it is
         if (controller != nullptr)
         {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          controller->on_task_update(task_status::RUNNING, bytes_expected);
         }
-        throw std::runtime_error("ERROR");
       }
-      if (!fin.good() && (buffer_size + bytes_written) < bytes_total)
+      else
       {
-        if (controller != nullptr)
+        // Attempt to read bytes from file
+        f_block = image.read(bytes_written, buffer, bytes_expected);
+        
+        // Erase block from cartridge, wait for erasure to complete, and write
+        // buffer to cartridge, starting over if the device hangs
+        unsigned int bytes_programmed = 0;
+        retry_on_timeout(bytes_written, [&]
         {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-        }
-        throw std::runtime_error("ERROR");
-      }
-      
-      // Erase block from cartridge
-      m_rom_chip->erase_block(block->base_address);
-      
-      // Wait for erasure to complete
-      while (m_rom_chip->test_erasing())
-      {
-        // Give UI an opportunity to update
-        if (controller != nullptr)
+          m_rom_chip->erase_block(block->base_address);
+          m_rom_chip->wait_for_erase(controller);
+          
+          bytes_programmed = walk_program_erased_block(m_rom_chip, curr_offset, f_block, buffer_size, controller);
+        }, [&]
+        {
+          m_linkmasta->recover_connection();
+          // The device may have lost its slot along with the transfer
+          m_rom_chip->reset();
+          m_rom_chip->invalidate_selected_slot();
+          m_rom_chip->select_slot(curr_slot);
+        });
+        
+        // A block cut short by cancelling is neither verified nor recorded,
+        // so that resuming the restore programs it again
+        if (bytes_programmed < buffer_size && controller != nullptr && controller->is_task_cancelled())
         {
-          controller->on_task_update(task_status::RUNNING, 0);
+          break;
         }
-      }
-      
-      // Write buffer to cartridge
-      if (controller == nullptr)
-      {
-        m_rom_chip->program_bytes(curr_offset, buffer, buffer_size);
-      }
-      else
-      {
-        forwarding_task_controller fwd_controller(controller);
-        fwd_controller.scale_work_to(buffer_size);
-        try
+        
+        // Read the block back while its source is still at hand and rewrite it
+        // if it doesn't match
+        bool matched = true;
+        if (verify)
         {
-          m_rom_chip->program_bytes(curr_offset, buffer, buffer_size, &fwd_controller);
+          walk_phase(controller, TASK_PHASE_VERIFY);
+          matched = false;
+          for (unsigned int attempt = 0; ; ++attempt)
+          {
+            unsigned int bytes_read = m_rom_chip->read_bytes(curr_offset, verify_buffer, buffer_size);
+            matched = (bytes_read == buffer_size && find_first_difference(f_block, verify_buffer, buffer_size) == buffer_size);
+            if (matched || attempt >= VERIFY_MAX_RETRIES)
+            {
+              break;
+            }
+            
+            m_rom_chip->erase_block(block->base_address);
+            m_rom_chip->wait_for_erase(controller);
+            walk_program_erased_block(m_rom_chip, curr_offset, f_block, buffer_size, (task_controller*) nullptr);
+          }
+          
+          if (!matched)
+          {
+            log(log_level::INFO, ("Block at offset " + std::to_string(bytes_written) + " failed to verify").c_str());
+            verified = false;
+          }
+          walk_phase(controller, TASK_PHASE_PROGRAM);
         }
-        catch (std::exception& ex)
+        
+        // Record the block so that it can be skipped if the restore is resumed,
+        // unless it needs another try
+        if (m_journal != nullptr && matched)
         {
-          (void) ex;
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-          throw;
+          m_journal->mark_complete(bytes_written, buffer_size);
         }
       }
       
@@ -558,12 +945,22 @@ void ws_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, task
         if (curr_slot < num_slots() - 1)
         {
           curr_slot++;
-          m_linkmasta->switch_slot(curr_slot);
+          if (!m_rom_chip->select_slot(curr_slot))
+          {
+            throw std::runtime_error("Error occured while attempting to switch slot");
+          }
         }
         slot_size = this->slot_size(curr_slot);
       }
     }
     
+    // A cancelled restore may have stopped part-way through a block
+    if (controller != nullptr && controller->is_task_cancelled())
+    {
+      m_rom_chip->wait_for_erase();
+      m_rom_chip->reset();
+    }
+    
     // Clean up before returning
     m_linkmasta->close();
   }
@@ -572,8 +969,8 @@ void ws_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, task
     (void) ex;
     // Error occured! Clean up and pass error on to caller
     try {
-      // Spinlock while the chip finishes erasing (if it was erasing)
-      while (m_rom_chip->is_erasing());
+      // Wait while the chip finishes erasing (if it was erasing)
+      m_rom_chip->wait_for_erase();
     } catch (exception ex2) {
       (void) ex2;
       // Well... this is awkward
@@ -596,10 +993,9 @@ void ws_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, task
     
     if (controller != nullptr)
     {
-      std::cout << controller->get_task_work_progress() << std::endl;
+      LOG_STREAM(log_level::DEBUG, "Restore failed after " << controller->get_task_work_progress() << " B");
       controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
     }
-    delete [] buffer;
     throw;
   }
   
@@ -608,10 +1004,257 @@ void ws_cartridge::restore_cartridge_game_data(std::istream& fin, int slot, task
   {
     controller->on_task_end(controller->is_task_cancelled() && bytes_written < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_written);
   }
-  delete [] buffer;
+  return verified;
+}
+
+void ws_cartridge::copy_slot_game_data(int source_slot, int slot, task_controller* controller)
+{
+  relocate_slot_game_data(source_slot, slot, false, controller);
+}
+
+void ws_cartridge::swap_slots_game_data(int slot_a, int slot_b, task_controller* controller)
+{
+  relocate_slot_game_data(slot_a, slot_b, true, controller);
+}
+
+void ws_cartridge::relocate_slot_game_data(int slot_a, int slot_b, bool swap, task_controller* controller)
+{
+  // Ensure class was intiialized
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Cartridge not initialized");
+  }
+  
+  // Validate arguments
+  if (slot_a < 0 || slot_a >= (int) m_slots.size())
+  {
+    throw std::invalid_argument("invalid slot number: " + std::to_string(slot_a));
+  }
+  if (slot_b < 0 || slot_b >= (int) m_slots.size())
+  {
+    throw std::invalid_argument("invalid slot number: " + std::to_string(slot_b));
+  }
+  if (slot_a == slot_b)
+  {
+    throw std::invalid_argument("a slot cannot be moved onto itself: " + std::to_string(slot_a));
+  }
+  
+  // Games sit at the top of their slots, so only move what they occupy,
+  // rounded out to whole blocks so that every block written can be erased
+  unsigned int num_bytes = std::min(game_backup_size(slot_a), slot_size(slot_a));
+  if (swap)
+  {
+    num_bytes = std::max(num_bytes, std::min(game_backup_size(slot_b), slot_size(slot_b)));
+  }
+  num_bytes = (num_bytes + DEFAULT_BLOCK_SIZE - 1) / DEFAULT_BLOCK_SIZE * DEFAULT_BLOCK_SIZE;
+  if (num_bytes > slot_size(slot_a) || num_bytes > slot_size(slot_b))
+  {
+    throw std::runtime_error("Game too large for destination");
+  }
+  
+  // Reading both slots and writing both slots each count once
+  unsigned int bytes_total = num_bytes * (swap ? 4 : 2);
+  std::vector<unsigned char> buffer_a(std::min(num_bytes, (unsigned int) RELOCATE_CHUNK_SIZE));
+  std::vector<unsigned char> buffer_b(swap ? buffer_a.size() : 0);
+  
+  // Reads a range of a slot, returning false if cut short by cancelling
+  auto read_range = [this, controller](int slot, unsigned int offset, unsigned char* data, unsigned int range_bytes) -> bool
+  {
+    if (!m_rom_chip->select_slot(slot))
+    {
+      throw std::runtime_error("Error occured while attempting to switch slot");
+    }
+    walk_phase(controller, TASK_PHASE_READ);
+    
+    for (unsigned int bytes_read = 0; bytes_read < range_bytes; )
+    {
+      unsigned int bytes_expected = std::min(range_bytes - bytes_read, (unsigned int) DEFAULT_BLOCK_SIZE);
+      unsigned int buffer_size = 0;
+      retry_on_timeout(offset + bytes_read, [&]
+      {
+        buffer_size = walk_read_block(m_rom_chip, offset + bytes_read, data + bytes_read, bytes_expected, controller);
+      }, [&]
+      {
+        m_linkmasta->recover_connection();
+        // The device may have lost its slot along with the transfer
+        m_rom_chip->reset();
+        m_rom_chip->invalidate_selected_slot();
+        m_rom_chip->select_slot(slot);
+      });
+      
+      if (buffer_size != bytes_expected)
+      {
+        if (controller != nullptr && controller->is_task_cancelled())
+        {
+          return false;
+        }
+        throw std::runtime_error("ERROR");
+      }
+      bytes_read += buffer_size;
+    }
+    return true;
+  };
+  
+  // Inform controller that task is starting
+  if (controller != nullptr)
+  {
+    controller->on_task_start(bytes_total);
+  }
+  
+  try
+  {
+    linkmasta_device::session session(m_linkmasta);
+    
+    // Each chunk is read from the first slot, read from and written to the
+    // second, then written to the first, which the next chunk starts reading
+    // from again, so every chunk costs two slot switches
+    unsigned int chunk_bytes = 0;
+    for (unsigned int chunk = 0; chunk < num_bytes && (controller == nullptr || !controller->is_task_cancelled()); chunk += chunk_bytes)
+    {
+      chunk_bytes = std::min(num_bytes - chunk, (unsigned int) buffer_a.size());
+      unsigned int offset_a = slot_size(slot_a) - num_bytes + chunk;
+      unsigned int offset_b = slot_size(slot_b) - num_bytes + chunk;
+      
+      // Everything the chunk overwrites is read before any of it is written,
+      // so stopping here loses nothing
+      if (!read_range(slot_a, offset_a, buffer_a.data(), chunk_bytes)
+          || (swap && !read_range(slot_b, offset_b, buffer_b.data(), chunk_bytes)))
+      {
+        break;
+      }
+      
+      write_slot_blocks(slot_b, offset_b, buffer_a.data(), (swap ? buffer_b.data() : nullptr), chunk_bytes, controller);
+      if (swap)
+      {
+        write_slot_blocks(slot_a, offset_a, buffer_b.data(), buffer_a.data(), chunk_bytes, controller);
+      }
+    }
+    
+    // The footers have moved along with the games
+    build_game_metadata(slot_b);
+    if (swap)
+    {
+      build_game_metadata(slot_a);
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // Error occured! Clean up and pass error on to caller
+    try {
+      // Wait while the chip finishes erasing (if it was erasing)
+      m_rom_chip->wait_for_erase();
+    } catch (std::exception& ex2) {
+      (void) ex2;
+      // Well... this is awkward
+    }
+    
+    try {
+      // Attempt to reset the chip
+      m_rom_chip->reset();
+    } catch (std::exception& ex2) {
+      (void) ex2;
+      // Well... this is awkward
+    }
+    
+    if (controller != nullptr)
+    {
+      controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+    }
+    throw;
+  }
+  
+  // Inform controller that task has ended
+  if (controller != nullptr)
+  {
+    unsigned int work = controller->get_task_work_progress();
+    controller->on_task_end(controller->is_task_cancelled() && work < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, work);
+  }
+}
+
+ws_sram_chip* ws_cartridge::save_chip(int slot) const
+{
+  const game_metadata* metadata = get_game_metadata(slot == SLOT_ALL ? 0 : slot);
+  if (metadata != nullptr && calculate_eeprom_size(metadata->save_size) > 0)
+  {
+    return m_eeprom_chip;
+  }
+  return m_sram_chip;
+}
+
+void ws_cartridge::write_slot_blocks(int slot, unsigned int offset, const unsigned char* data, const unsigned char* current, unsigned int num_bytes, task_controller* controller)
+{
+  if (!m_rom_chip->select_slot(slot))
+  {
+    throw std::runtime_error("Error occured while attempting to switch slot");
+  }
+  walk_phase(controller, TASK_PHASE_PROGRAM);
+  
+  unsigned int slot_offset = 0;
+  for (int i = 0; i < slot; ++i)
+  {
+    slot_offset += slot_size(i);
+  }
+  
+  const cartridge_descriptor::chip_descriptor* chip = descriptor()->chips[0];
+  for (unsigned int bytes_written = 0; bytes_written < num_bytes; )
+  {
+    unsigned int curr_offset = offset + bytes_written;
+    int block_index = layout()->find_block(0, slot_offset + curr_offset);
+    if (block_index < 0)
+    {
+      throw std::runtime_error("No block at offset " + std::to_string(slot_offset + curr_offset));
+    }
+    const cartridge_descriptor::chip_descriptor::block_descriptor* block = chip->blocks[block_index];
+    unsigned int block_bytes = std::min(block->base_address + block->num_bytes - (slot_offset + curr_offset), num_bytes - bytes_written);
+    
+    // Blocks that already hold the data are left alone. Others are written in
+    // full even if the task is cancelled, since their data may only be in
+    // memory
+    if (current == nullptr || find_first_difference(data + bytes_written, current + bytes_written, block_bytes) != block_bytes)
+    {
+      retry_on_timeout(slot_offset + curr_offset, [&]
+      {
+        m_rom_chip->erase_block(block->base_address);
+        m_rom_chip->wait_for_erase(controller);
+        walk_program_erased_block(m_rom_chip, curr_offset, data + bytes_written, block_bytes, (task_controller*) nullptr);
+      }, [&]
+      {
+        m_linkmasta->recover_connection();
+        // The device may have lost its slot along with the transfer
+        m_rom_chip->reset();
+        m_rom_chip->invalidate_selected_slot();
+        m_rom_chip->select_slot(slot);
+      });
+    }
+    
+    if (controller != nullptr)
+    {
+      controller->on_task_update(task_status::RUNNING, block_bytes);
+    }
+    bytes_written += block_bytes;
+  }
 }
 
 bool ws_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
+{
+  rom_image image(fin);
+  return compare_game_data(image, slot, controller, nullptr);
+}
+
+bool ws_cartridge::compare_cartridge_game_data(const unsigned char* image_data, unsigned int num_bytes, int slot, task_controller* controller)
+{
+  rom_image image(image_data, num_bytes);
+  return compare_game_data(image, slot, controller, nullptr);
+}
+
+bool ws_cartridge::compare_cartridge_game_data(const digest_manifest& manifest, int slot, task_controller* controller)
+{
+  rom_image image(manifest);
+  return compare_game_data(image, slot, controller, nullptr);
+}
+
+bool ws_cartridge::compare_game_data(rom_image& image, int slot, task_controller* controller, block_mismatch_map* mismatches)
 {
   // WonderSwan games store their metadata at the top of the chip on which they
   // reside. Thus, we only compare the contents of the file with the upper-most
@@ -637,16 +1280,14 @@ bool ws_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, task
   {
     throw std::invalid_argument("invalid slot number: " + std::to_string(slot));
   }
-  else if (m_rom_chip->selected_slot() != curr_slot)
+  else if (!m_rom_chip->select_slot(curr_slot))
   {
-    m_rom_chip->select_slot(curr_slot);
+    throw std::runtime_error("Error occured while attempting to switch slot");
   }
   
   // determine the total number of bytes to compare
-  fin.seekg(0, fin.end);
   unsigned int bytes_compared = 0;
-  unsigned int bytes_total = (unsigned int) fin.tellg();
-  fin.seekg(0, fin.beg);
+  unsigned int bytes_total = image.size();
   
   // Ensure file will fit
   if (bytes_total > (slot == SLOT_ALL ? descriptor()->num_bytes : slot_size))
@@ -666,15 +1307,15 @@ bool ws_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, task
   {
     slot_offset += this->slot_size(i);
   }
-  for (unsigned int i = 0; i < descriptor()->chips[0]->num_blocks; ++i)
+  int found_block = layout()->find_block(0, slot_offset + curr_offset);
+  if (found_block >= 0)
   {
-    if (descriptor()->chips[0]->blocks[i]->base_address <= (slot_offset + curr_offset)
-        && descriptor()->chips[0]->blocks[i]->base_address
-        + descriptor()->chips[0]->blocks[i]->num_bytes > (slot_offset + curr_offset))
-    {
-      curr_block = i;
-      break;
-    }
+    curr_block = (unsigned int) found_block;
+  }
+  else if (slot != SLOT_ALL)
+  {
+    // The last slot ends at the end of the chip, past its last block
+    curr_block = descriptor()->chips[0]->num_blocks;
   }
   if (slot != SLOT_ALL)
   {
@@ -684,17 +1325,47 @@ bool ws_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, task
   
   m_linkmasta->close();
   
-  // Allocate a buffer with max size of a block
+  // Allocate a buffer with max size of a block, unless blocks can be taken
+  // straight from an image in memory
   const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
   unsigned int       f_buffer_size = 0;
-  unsigned char*     f_buffer = new unsigned char[BUFFER_MAX_SIZE];
+  buffer_pool::buffer f_buffer_memory = (image.needs_buffer() ? m_linkmasta->buffers().acquire(BUFFER_MAX_SIZE) : buffer_pool::buffer());
+  unsigned char*     f_buffer = f_buffer_memory.data();
   unsigned int       c_buffer_size = 0;
-  unsigned char*     c_buffer = new unsigned char[BUFFER_MAX_SIZE];
+  unsigned char*     c_buffer;
+  
+  // Compare blocks against the file, or against its digests when verifying
+  // with a manifest, on another thread while the next block is read. When
+  // mapping mismatches, blocks that differ are recorded rather than ending
+  // the comparison
+  compare_pipeline   pipeline(m_linkmasta->buffers(), BUFFER_MAX_SIZE, [&image, f_buffer, mismatches](unsigned int offset, const unsigned char* data, unsigned int num_bytes) -> bool
+  {
+    unsigned int mismatch_offset = offset;
+    if (!image.matches(offset, data, f_buffer, num_bytes, &mismatch_offset))
+    {
+      log(log_level::INFO, ("Cartridge data differs from file at offset " + std::to_string(mismatch_offset)).c_str());
+      if (mismatches == nullptr)
+      {
+        return false;
+      }
+      mismatches->add_mismatch(offset, num_bytes, mismatch_offset);
+      return true;
+    }
+    if (mismatches != nullptr)
+    {
+      mismatches->add_match(offset, num_bytes);
+    }
+    return true;
+  });
+  
+  // Only images whose contents are at hand can be checksummed on the host
+  const bool use_checksums = m_linkmasta->supports_checksum_range() && image.has_contents();
   
   // Inform controller that task is starting
   if (controller != nullptr)
   {
     controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_VERIFY);
   }
   
   // Begin comparing data block-by-block
@@ -703,11 +1374,9 @@ bool ws_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, task
     // Open connection to NGP chip
     m_linkmasta->open();
     
-    while (bytes_compared < bytes_total && matched && (controller == nullptr || !controller->is_task_cancelled()))
+    while (bytes_compared < bytes_total && pipeline.matched() && (controller == nullptr || !controller->is_task_cancelled()))
     {
-#ifdef VERBOSE
-      std::cout << "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_compared << " B / " << bytes_total << " B (" << (bytes_compared * 100 / bytes_total) << "%)" << endl;
-#endif
+      LOG_STREAM(log_level::VERBOSE, "(chip " << curr_chip << ", block " << curr_block << ") " << bytes_compared << " B / " << bytes_total << " B (" << (bytes_compared * 100 / bytes_total) << "%)");
       
       // Convenience variables
       cartridge_descriptor::chip_descriptor* chip;
@@ -726,75 +1395,56 @@ bool ws_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, task
         bytes_expected = slot_size - curr_offset;
       }
       
-      // Attempt to read bytes from file
+      // Find the matching offset in the file. Individual slots are aligned to
+      // the end of the file.
+      unsigned int f_offset = bytes_compared;
       if (slot != SLOT_ALL)
       {
-        fin.seekg(-((int) (slot_size - curr_offset)), fin.end);
+        f_offset = bytes_total - (slot_size - curr_offset);
       }
-      streamoff f_start = fin.tellg();
-      fin.read((char*) f_buffer, bytes_expected);
-      streamoff f_end = fin.tellg();
-      f_buffer_size = (unsigned int) (f_end - f_start);
+      f_buffer_size = bytes_expected;
       
-      // Check for errors
-      if (f_buffer_size != bytes_expected)
+      // The image can't be read here while the comparer thread is still using
+      // it, which may also reveal that an earlier block differed
+      if (use_checksums && !pipeline.finish())
       {
-        if (controller != nullptr)
-        {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-        }
-        throw std::runtime_error("ERROR");
-      }
-      if (!fin.good() && (f_buffer_size + bytes_compared) < bytes_total)
-      {
-        if (controller != nullptr)
-        {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-        }
-        throw std::runtime_error("ERROR");
+        break;
       }
       
-      // Attempt to read bytes from cartridge
-      if (controller == nullptr)
-      {
-        c_buffer_size = m_rom_chip->read_bytes(curr_offset, c_buffer, bytes_expected);
-      }
-      else
+      // Let the device checksum the block itself when it can, only reading it
+      // back if the checksums differ to find where
+      if (use_checksums && walk_checksum_block(m_rom_chip, curr_offset, image.read(f_offset, f_buffer, bytes_expected), bytes_expected, controller))
       {
-        // Use a forwarding controller to pass progress updates to our controller
-        forwarding_task_controller fwd_controller(controller);
-        fwd_controller.scale_work_to(bytes_expected);
-        try
+        // Block matches without having been transferred
+        if (mismatches != nullptr)
         {
-          c_buffer_size = m_rom_chip->read_bytes(curr_offset, c_buffer, bytes_expected, &fwd_controller);
-        }
-        catch (std::exception& ex)
-        {
-          (void) ex;
-          // Inform controller of error
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-          throw;
+          mismatches->add_match(f_offset, bytes_expected);
         }
       }
-      
-      // Check for errors
-      if (c_buffer_size != bytes_expected)
+      else
       {
-        if (controller != nullptr)
+        // Attempt to read bytes from cartridge
+        c_buffer = pipeline.acquire_buffer();
+        c_buffer_size = walk_read_block(m_rom_chip, curr_offset, c_buffer, bytes_expected, controller);
+        
+        // A read cut short by cancelling just ends the comparison early
+        if (c_buffer_size != bytes_expected && controller != nullptr && controller->is_task_cancelled())
         {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          pipeline.submit_buffer(c_buffer, f_offset, 0);
+          break;
         }
-        throw std::runtime_error("ERROR");
-      }
-      
-      // Compare contents of buffers
-      for (unsigned int i = 0; i < f_buffer_size && i < c_buffer_size; ++i)
-      {
-        if (f_buffer[i] != c_buffer[i])
+        
+        // Check for errors
+        if (c_buffer_size != bytes_expected)
         {
-          matched = false;
-          break;
+          if (controller != nullptr)
+          {
+            controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
+          }
+          throw std::runtime_error("ERROR");
         }
+        
+        pipeline.submit_buffer(c_buffer, f_offset, bytes_expected);
       }
       
       // Update markers
@@ -806,9 +1456,10 @@ bool ws_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, task
         {
           curr_block++;
         }
-        else
+        else if (bytes_compared < bytes_total)
         {
-          // Step backwards if verifying individual slot
+          // Step backwards if verifying individual slot, unless that was the
+          // first block of the image, which may be the first of the chip
           curr_block--;
           curr_offset = chip->blocks[curr_block]->base_address - slot_offset;
         }
@@ -825,7 +1476,10 @@ bool ws_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, task
         if (curr_slot < num_slots() - 1)
         {
           curr_slot++;
-          m_linkmasta->switch_slot(curr_slot);
+          if (!m_rom_chip->select_slot(curr_slot))
+          {
+            throw std::runtime_error("Error occured while attempting to switch slot");
+          }
         }
         slot_size = this->slot_size(curr_slot);
       }
@@ -833,42 +1487,17 @@ bool ws_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, task
     
     // Clean up before returning
     m_linkmasta->close();
+    matched = pipeline.finish();
+    if (mismatches != nullptr)
+    {
+      matched = matched && mismatches->all_matched();
+    }
   }
   catch (std::exception& ex)
   {
     (void) ex;
     // Error occured! Clean up and pass error on to caller
-    // Note: I appologize for the change in style: it's to save lines
-    try {
-      // Spinlock while the chip finishes erasing (if it was erasing)
-      while (m_rom_chip->is_erasing());
-    } catch (std::exception &ex2) {
-      (void) ex2;
-      // Well... this is awkward
-    }
-    
-    try {
-      // Attempt to reset the chip
-      m_rom_chip->reset();
-    } catch (std::exception &ex2) {
-      (void) ex2;
-      // Well... this is awkward
-    }
-    
-    try {
-      m_linkmasta->close();
-    } catch (std::exception &ex2) {
-      (void) ex2;
-      // Well... this is awkward
-    }
-    
-    // Inform controller that error
-    if (controller != nullptr)
-    {
-      controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-    }
-    delete [] f_buffer;
-    delete [] c_buffer;
+    abandon_block_walk(m_rom_chip, m_linkmasta, controller);
     throw;
   }
   
@@ -877,34 +1506,35 @@ bool ws_cartridge::compare_cartridge_game_data(std::istream& fin, int slot, task
   {
     controller->on_task_end(controller->is_task_cancelled() && bytes_compared < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_compared);
   }
-  delete [] f_buffer;
-  delete [] c_buffer;
   return matched;
 }
 
 void ws_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, task_controller* controller)
 {
-  (void) slot;
-  
   // Ensure class was intiialized
   if (!m_was_init)
   {
     throw std::runtime_error("Cartridge not initialized");
   }
   
+  // Games saving to EEPROM keep their saves in the linkmasta
+  ws_sram_chip* chip = save_chip(slot);
+  
   // Determine the total number of bytes to write
   unsigned int bytes_written = 0;
-  unsigned int bytes_total = DEFAULT_SRAM_SIZE; // Always assume 4 Mib chip
-  
-  // Allocate a buffer with max size of a block
-  const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
+  unsigned int bytes_total = save_backup_size(slot);
+  
+  // Write blocks to the file on another thread while the next one is read
+  const unsigned int BUFFER_MAX_SIZE = SAVE_BLOCK_SIZE;
   unsigned int       buffer_size = 0;
-  unsigned char*     buffer = new unsigned char[BUFFER_MAX_SIZE];
+  unsigned char*     buffer;
+  write_pipeline     pipeline(fout, m_linkmasta->buffers(), BUFFER_MAX_SIZE);
   
   // Inform controller that task is starting
   if (controller != nullptr)
   {
     controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_READ);
   }
   
   // Begin writing data block-by-block
@@ -913,11 +1543,12 @@ void ws_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, task
     // Open connection to NGP chip
     m_linkmasta->open();
     
+    // Progress of every block is passed on through the same controller
+    forwarding_task_controller fwd_controller(controller);
+    
     while (bytes_written < bytes_total && (controller == nullptr || !controller->is_task_cancelled()))
     {
-#ifdef VERBOSE
-      std::cout << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)" << endl;
-#endif
+      LOG_STREAM(log_level::VERBOSE, bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)");
       
       // Calcualte number of expected bytes
       unsigned int bytes_expected = BUFFER_MAX_SIZE;
@@ -927,47 +1558,31 @@ void ws_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, task
       }
       
       // Attempt to read bytes from cartridge
+      buffer = pipeline.acquire_buffer();
       if (controller == nullptr)
       {
-        buffer_size = m_sram_chip->read_bytes(bytes_written, buffer, bytes_expected);
+        buffer_size = chip->read_bytes(bytes_written, buffer, bytes_expected);
       }
       else
       {
-        // Create a forwarding controller to pass progress updates to
-        forwarding_task_controller fwd_controller(controller);
         fwd_controller.scale_work_to(bytes_expected);
-        try
-        {
-          buffer_size = m_sram_chip->read_bytes(bytes_written, buffer, bytes_expected, &fwd_controller);
-        }
-        catch (std::exception& ex)
-        {
-          (void) ex;
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-          throw;
-        }
+        buffer_size = chip->read_bytes(bytes_written, buffer, bytes_expected, &fwd_controller);
       }
       
-      // Check for errors
-      if (buffer_size != bytes_expected)
+      // A read cut short by cancelling just ends the backup early
+      if (buffer_size != bytes_expected && controller != nullptr && controller->is_task_cancelled())
       {
-        if (controller != nullptr)
-        {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-        }
-        throw std::runtime_error("ERROR");
+        break;
       }
-      if (!fout.good())
+      
+      // Check for errors
+      if (buffer_size != bytes_expected || !pipeline.good())
       {
-        if (controller != nullptr)
-        {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-        }
         throw std::runtime_error("ERROR");
       }
       
-      // Write buffer to file
-      fout.write((char*) buffer, buffer_size);
+      // Queue buffer to be written to file
+      pipeline.submit_buffer(buffer, buffer_size);
       
       // Update markers
       bytes_written += buffer_size;
@@ -975,24 +1590,15 @@ void ws_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, task
     
     // Clean up before returning
     m_linkmasta->close();
+    
+    // Wait for the last blocks to reach the file
+    pipeline.finish();
   }
   catch (std::exception& ex)
   {
     (void) ex;
     // Error occured! Clean up and pass error on to caller
-    try {
-      m_linkmasta->close();
-    } catch (std::exception& ex2) {
-      (void) ex2;
-      // Well... this is awkward
-    }
-    
-    // Inform controller of task end
-    if (controller != nullptr)
-    {
-      controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-    }
-    delete [] buffer;
+    abandon_block_walk(chip, m_linkmasta, controller);
     throw;
   }
   
@@ -1001,100 +1607,77 @@ void ws_cartridge::backup_cartridge_save_data(std::ostream& fout, int slot, task
   {
     controller->on_task_end(controller->is_task_cancelled() && bytes_written < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_written);
   }
-  delete [] buffer;
 }
 
 void ws_cartridge::restore_cartridge_save_data(std::istream& fin, int slot, task_controller* controller)
 {
-  (void) slot;
-  
   // Ensure class was intiialized
   if (!m_was_init)
   {
     throw std::runtime_error("Cartridge not initialized");
   }
   
+  // Games saving to EEPROM keep their saves in the linkmasta
+  ws_sram_chip* chip = save_chip(slot);
+  
   // Determine the total number of bytes to write
   fin.seekg(0, fin.end);
   unsigned int bytes_written = 0;
   unsigned int bytes_total = (unsigned int) fin.tellg();
   fin.seekg(0, fin.beg);
   
-  // Allocate a buffer with max size of a block
-  const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
-  unsigned int       buffer_size = 0;
-  unsigned char*     buffer = new unsigned char[BUFFER_MAX_SIZE];
+  // EEPROM holds no more than the game saves
+  if (chip == m_eeprom_chip && bytes_total > save_backup_size(slot))
+  {
+    throw std::runtime_error("Save file does not fit in the game's EEPROM");
+  }
+  
+  // Save files are small, so read the whole file up front and hand it to the
+  // linkmasta in one go. That way it can send the largest batches it supports
+  // and keep them in flight from start to finish
+  std::vector<unsigned char> image(bytes_total);
+  fin.read((char*) image.data(), bytes_total);
+  if ((unsigned int) fin.gcount() != bytes_total)
+  {
+    throw std::runtime_error("ERROR");
+  }
   
   // Inform controller that task is starting
   if (controller != nullptr)
   {
     controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_PROGRAM);
   }
   
-  // Begin writing data block-by-block
   try
   {
     // Open connection to NGP chip
     m_linkmasta->open();
     
-    while (bytes_written < bytes_total && (controller == nullptr || !controller->is_task_cancelled()))
+    // Write data to cartridge
+    if (m_differential_save_restore)
     {
-#ifdef VERBOSE
-      std::cout << bytes_written << " B / " << bytes_total << " B (" << (bytes_written * 100 / bytes_total) << "%)" << endl;
-#endif
-      
-      // Calcualte number of expected bytes
-      unsigned bytes_expected = BUFFER_MAX_SIZE;
-      if (bytes_expected > bytes_total - bytes_written)
-      {
-        bytes_expected = bytes_total - bytes_written;
-      }
-      
-      // Attempt to read bytes from file
-      fin.read((char*) buffer, bytes_expected);
-      buffer_size = ((unsigned int) fin.tellg()) - bytes_written;
-      
-      // Check for errors
-      if (buffer_size != bytes_expected)
-      {
-        if (controller != nullptr)
-        {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-        }
-        throw std::runtime_error("ERROR");
-      }
-      if (!fin.good() && (buffer_size + bytes_written) < bytes_total)
+      // Read back the current contents in one go as well, then write only the
+      // packets that differ
+      walk_phase(controller, TASK_PHASE_READ);
+      std::vector<unsigned char> current(bytes_total);
+      if (chip->read_bytes(0, current.data(), bytes_total) != bytes_total)
       {
-        if (controller != nullptr)
-        {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-        }
         throw std::runtime_error("ERROR");
       }
+      walk_phase(controller, TASK_PHASE_PROGRAM);
       
-      // Write buffer to cartridge
-      if (controller == nullptr)
-      {
-        m_sram_chip->program_bytes(bytes_written, buffer, buffer_size);
-      }
-      else
-      {
-        forwarding_task_controller fwd_controller(controller);
-        fwd_controller.scale_work_to(buffer_size);
-        try
-        {
-          m_sram_chip->program_bytes(bytes_written, buffer, buffer_size, &fwd_controller);
-        }
-        catch (std::exception& ex)
-        {
-          (void) ex;
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-          throw;
-        }
-      }
-      
-      // Update markers
-      bytes_written += buffer_size;
+      bytes_written = walk_program_changed_block(chip, 0, image.data(), current.data(), bytes_total, controller);
+    }
+    else
+    {
+      bytes_written = walk_program_block(chip, 0, image.data(), bytes_total, controller);
+    }
+    
+    // Check for errors
+    if (bytes_written != bytes_total && (controller == nullptr || !controller->is_task_cancelled()))
+    {
+      throw std::runtime_error("ERROR");
     }
     
     // Clean up before returning
@@ -1104,18 +1687,7 @@ void ws_cartridge::restore_cartridge_save_data(std::istream& fin, int slot, task
   {
     (void) ex;
     // Error occured! Clean up and pass error on to caller
-    try {
-      m_linkmasta->close();
-    } catch (std::exception &ex2) {
-      (void) ex2;
-      // Well... this is awkward
-    }
-    
-    if (controller != nullptr)
-    {
-      controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-    }
-    delete [] buffer;
+    abandon_block_walk(chip, m_linkmasta, controller);
     throw;
   }
   
@@ -1124,19 +1696,19 @@ void ws_cartridge::restore_cartridge_save_data(std::istream& fin, int slot, task
   {
     controller->on_task_end(controller->is_task_cancelled() && bytes_written < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_written);
   }
-  delete [] buffer;
 }
 
 bool ws_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, task_controller* controller)
 {
-  (void) slot;
-  
   // Ensure class was initialized
   if (!m_was_init)
   {
     throw std::runtime_error("Cartridge not initialized");
   }
   
+  // Games saving to EEPROM keep their saves in the linkmasta
+  ws_sram_chip* chip = save_chip(slot);
+  
   // determine the total number of bytes to compare
   fin.seekg(0, fin.end);
   unsigned int bytes_compared = 0;
@@ -1148,15 +1720,34 @@ bool ws_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, task
   
   // Allocate a buffer with max size of a block
   const unsigned int BUFFER_MAX_SIZE = DEFAULT_BLOCK_SIZE;
-  unsigned int       f_buffer_size = 0;
-  unsigned char*     f_buffer = new unsigned char[BUFFER_MAX_SIZE];
+  buffer_pool::buffer f_buffer_memory = m_linkmasta->buffers().acquire(BUFFER_MAX_SIZE);
+  unsigned char*     f_buffer = f_buffer_memory.data();
   unsigned int       c_buffer_size = 0;
-  unsigned char*     c_buffer = new unsigned char[BUFFER_MAX_SIZE];
+  unsigned char*     c_buffer;
+  
+  // Read the file and compare on another thread while the next block is read
+  // from the cartridge. Blocks are submitted in order, so the file is read
+  // straight through
+  compare_pipeline   pipeline(m_linkmasta->buffers(), BUFFER_MAX_SIZE, [&fin, f_buffer](unsigned int offset, const unsigned char* data, unsigned int num_bytes) -> bool
+  {
+    (void) offset;
+    
+    // Attempt to read bytes from file
+    fin.read((char*) f_buffer, num_bytes);
+    if ((unsigned int) fin.gcount() != num_bytes)
+    {
+      throw std::runtime_error("ERROR");
+    }
+    
+    // Compare contents of buffers
+    return find_first_difference(f_buffer, data, num_bytes) == num_bytes;
+  });
   
   // Inform controller that task is starting
   if (controller != nullptr)
   {
     controller->on_task_start(bytes_total);
+    controller->on_task_phase(TASK_PHASE_VERIFY);
   }
   
   // Begin comparing data block-by-block
@@ -1165,11 +1756,9 @@ bool ws_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, task
     // Open connection to NGP chip
     m_linkmasta->open();
     
-    while (bytes_compared < bytes_total && matched && (controller == nullptr || !controller->is_task_cancelled()))
+    while (bytes_compared < bytes_total && pipeline.matched() && (controller == nullptr || !controller->is_task_cancelled()))
     {
-#ifdef VERBOSE
-      std::cout << bytes_compared << " B / " << bytes_total << " B (" << (bytes_compared * 100 / bytes_total) << "%)" << endl;
-#endif
+      LOG_STREAM(log_level::VERBOSE, bytes_compared << " B / " << bytes_total << " B (" << (bytes_compared * 100 / bytes_total) << "%)");
       
       // Calcualte number of expected bytes
       unsigned bytes_expected = BUFFER_MAX_SIZE;
@@ -1178,49 +1767,15 @@ bool ws_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, task
         bytes_expected = bytes_total - bytes_compared;
       }
       
-      // Attempt to read bytes from file
-      fin.read((char*) f_buffer, bytes_expected);
-      f_buffer_size = ((unsigned int) fin.tellg()) - bytes_compared;
-      
-      // Check for errors
-      if (f_buffer_size != bytes_expected)
-      {
-        if (controller != nullptr)
-        {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-        }
-        throw std::runtime_error("ERROR");
-      }
-      if (!fin.good() && (f_buffer_size + bytes_compared) < bytes_total)
-      {
-        if (controller != nullptr)
-        {
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-        }
-        throw std::runtime_error("ERROR");
-      }
-      
       // Attempt to read bytes from cartridge
-      if (controller == nullptr)
-      {
-        c_buffer_size = m_sram_chip->read_bytes(bytes_compared, c_buffer, bytes_expected);
-      }
-      else
+      c_buffer = pipeline.acquire_buffer();
+      c_buffer_size = walk_read_block(chip, bytes_compared, c_buffer, bytes_expected, controller);
+      
+      // A read cut short by cancelling just ends the comparison early
+      if (c_buffer_size != bytes_expected && controller != nullptr && controller->is_task_cancelled())
       {
-        // Use a forwarding controller to pass progress updates to our controller
-        forwarding_task_controller fwd_controller(controller);
-        fwd_controller.scale_work_to(bytes_expected);
-        try
-        {
-          c_buffer_size = m_sram_chip->read_bytes(bytes_compared, c_buffer, bytes_expected, &fwd_controller);
-        }
-        catch (std::exception& ex)
-        {
-          (void) ex;
-          // Inform controller of error
-          controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-          throw;
-        }
+        pipeline.submit_buffer(c_buffer, bytes_compared, 0);
+        break;
       }
       
       // Check for errors
@@ -1233,41 +1788,21 @@ bool ws_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, task
         throw std::runtime_error("ERROR");
       }
       
-      // Compare contents of buffers
-      for (unsigned int i = 0; i < f_buffer_size && i < c_buffer_size; ++i)
-      {
-        if (f_buffer[i] != c_buffer[i])
-        {
-          matched = false;
-          break;
-        }
-      }
+      pipeline.submit_buffer(c_buffer, bytes_compared, c_buffer_size);
       
       // Update markers
-      bytes_compared += f_buffer_size;
+      bytes_compared += c_buffer_size;
     }
     
     // Clean up before returning
     m_linkmasta->close();
+    matched = pipeline.finish();
   }
   catch (std::exception& ex)
   {
     (void) ex;
     // Error occured! Clean up and pass error on to caller
-    try {
-      m_linkmasta->close();
-    } catch (std::exception &ex2) {
-      (void) ex2;
-      // Well... this is awkward
-    }
-    
-    // Inform controller that error
-    if (controller != nullptr)
-    {
-      controller->on_task_end(task_status::ERROR, controller->get_task_work_progress());
-    }
-    delete [] f_buffer;
-    delete [] c_buffer;
+    abandon_block_walk(chip, m_linkmasta, controller);
     throw;
   }
   
@@ -1276,8 +1811,6 @@ bool ws_cartridge::compare_cartridge_save_data(std::istream& fin, int slot, task
   {
     controller->on_task_end(controller->is_task_cancelled() && bytes_compared < bytes_total ? task_status::CANCELLED : task_status::COMPLETED, bytes_compared);
   }
-  delete [] f_buffer;
-  delete [] c_buffer;
   return matched;
 }
 
@@ -1310,6 +1843,46 @@ unsigned int ws_cartridge::slot_size(int slot) const
   }
 }
 
+unsigned int ws_cartridge::game_backup_size(int slot) const
+{
+  // Special case full-cartridge backup
+  if (slot == SLOT_ALL)
+  {
+    // Ensure class was initialized
+    if (!m_was_init)
+    {
+      throw std::runtime_error("Cartridge not initialized");
+    }
+    return descriptor()->num_bytes;
+  }
+  
+  // Games only take up as much of the slot as their metadata says
+  unsigned int slot_bytes = slot_size(slot);
+  unsigned int game_bytes = get_game_size(slot);
+  return (game_bytes > 0 ? game_bytes : slot_bytes);
+}
+
+unsigned int ws_cartridge::save_backup_size(int slot) const
+{
+  // Ensure class was initialized
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Cartridge not initialized");
+  }
+  
+  // EEPROM saves are only as large as the game's EEPROM
+  if (save_chip(slot) == m_eeprom_chip)
+  {
+    return calculate_eeprom_size(get_game_metadata(slot == SLOT_ALL ? 0 : slot)->save_size);
+  }
+  return DEFAULT_SRAM_SIZE; // Always assume 4 Mib chip
+}
+
+unsigned int ws_cartridge::slot_image_offset(int slot, unsigned int num_bytes) const
+{
+  return slot_size(slot) - num_bytes;
+}
+
 std::string ws_cartridge::fetch_game_name(int slot)
 {
   // Get developer ID from chip
@@ -1332,7 +1905,7 @@ std::string ws_cartridge::fetch_game_name(int slot)
   {
     throw std::invalid_argument("invalid slot number: " + std::to_string(slot));
   }
-  if (!m_linkmasta->switch_slot(slot))
+  if (!m_rom_chip->select_slot(slot))
   {
     throw std::runtime_error("Error occured while attempting to switch slot");
   }
@@ -1357,6 +1930,82 @@ std::string ws_cartridge::fetch_game_name(int slot)
   return std::string(r.str());
 }
 
+void ws_cartridge::fetch_slot_table(slot_table& table) const
+{
+  // Ensure class was initialized
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Cartridge not initialized");
+  }
+  
+  if (m_slots.size() > SLOT_TABLE_MAX_SLOTS)
+  {
+    throw std::runtime_error("Too many slots for a slot table");
+  }
+  
+  table.clear();
+  table.system = (unsigned char) system();
+  table.type = (unsigned char) type();
+  table.num_slots = (unsigned char) m_slots.size();
+  for (unsigned int i = 0; i < m_slots.size(); ++i)
+  {
+    slot_table::entry& e = table.slots[i];
+    e.num_bytes = m_slots[i];
+    if (i < m_metadata.size())
+    {
+      e.game_id = m_metadata[i].game_id;
+      e.checksum = m_metadata[i].checksum;
+      e.developer_id = m_metadata[i].developer_id;
+      e.version = m_metadata[i].mapper_version;
+      e.minimum_system = m_metadata[i].minimum_system;
+      e.rom_size = m_metadata[i].rom_size;
+      e.save_size = m_metadata[i].save_size;
+      e.flags = m_metadata[i].flags;
+      e.rtc_present = m_metadata[i].RTC_present;
+    }
+  }
+}
+
+unsigned int ws_cartridge::read_cartridge_game_data(int slot, unsigned int offset, unsigned char* buffer, unsigned int num_bytes)
+{
+  // Ensure class was initialized
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Cartridge not initialized");
+  }
+  
+  // Validate arguments
+  if (slot < 0 || slot >= (int) m_slots.size())
+  {
+    throw std::invalid_argument("invalid slot number: " + std::to_string(slot));
+  }
+  if (offset > slot_size(slot) || num_bytes > slot_size(slot) - offset)
+  {
+    throw std::invalid_argument("range does not fit in slot: " + std::to_string(slot));
+  }
+  
+  m_linkmasta->open();
+  
+  unsigned int bytes_read = 0;
+  try
+  {
+    if (!m_rom_chip->select_slot((unsigned int) slot))
+    {
+      throw std::runtime_error("Error occured while attempting to switch slot");
+    }
+    bytes_read = m_rom_chip->read_bytes(offset, buffer, num_bytes);
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    m_linkmasta->close();
+    throw;
+  }
+  
+  m_linkmasta->close();
+  return bytes_read;
+}
+
 const ws_cartridge::game_metadata* ws_cartridge::get_game_metadata(int slot) const
 {
   if (slot < 0 || slot >= (int) m_metadata.size()) return nullptr;
@@ -1398,6 +2047,55 @@ unsigned int ws_cartridge::calculate_game_size(int size_code)
   }
 }
 
+unsigned int ws_cartridge::calculate_eeprom_size(int save_code)
+{
+  switch (save_code)
+  {
+  case 0x10:
+    return 1 << 7;
+    
+  case 0x20:
+    return 1 << 11;
+    
+  case 0x50:
+    return 1 << 10;
+    
+  default:
+    return 0;
+  }
+}
+
+cartridge_descriptor* ws_cartridge::build_image_descriptor(unsigned int num_bytes)
+{
+  if (num_bytes > ROM_CHIP_SIZE)
+  {
+    throw std::invalid_argument("Image is too large for a WonderSwan cartridge");
+  }
+  
+  cartridge_descriptor* descriptor = new cartridge_descriptor(1);
+  descriptor->system = system_type::SYSTEM_WONDERSWAN;
+  descriptor->type = cartridge_type::CARTRIDGE_FLASHMASTA;
+  descriptor->num_bytes = ROM_CHIP_SIZE;
+  
+  cartridge_descriptor::chip_descriptor* chip_desc = new cartridge_descriptor::chip_descriptor(ROM_CHIP_SIZE / DEFAULT_BLOCK_SIZE);
+  chip_desc->num_bytes = ROM_CHIP_SIZE;
+  chip_desc->chip_num = 0;
+  chip_desc->manufacturer_id = 0;
+  chip_desc->device_id = 0;
+  descriptor->chips[0] = chip_desc;
+  
+  for (unsigned int i = 0; i < chip_desc->num_blocks; ++i)
+  {
+    cartridge_descriptor::chip_descriptor::block_descriptor* block = new cartridge_descriptor::chip_descriptor::block_descriptor();
+    block->block_num = i;
+    block->num_bytes = DEFAULT_BLOCK_SIZE;
+    block->base_address = i * DEFAULT_BLOCK_SIZE;
+    block->is_protected = false;
+    chip_desc->blocks[i] = block;
+  }
+  return descriptor;
+}
+
 
 
 void ws_cartridge::build_cartridge_destriptor()
@@ -1425,6 +2123,21 @@ void ws_cartridge::build_cartridge_destriptor()
   m_descriptor->num_bytes += m_descriptor->chips[0]->num_bytes;
 }
 
+void ws_cartridge::apply_erase_history()
+{
+  if (m_descriptor == nullptr)
+  {
+    return;
+  }
+  
+  erase_history::chip_key key;
+  key.serial = m_erase_serial;
+  key.chip_num = 0;
+  key.manufacturer_id = m_descriptor->chips[0]->manufacturer_id;
+  key.device_id = m_descriptor->chips[0]->device_id;
+  m_rom_chip->set_erase_history(m_erase_history, key);
+}
+
 void ws_cartridge::build_chip_descriptor(unsigned int chip_i)
 {
   ws_rom_chip* chip = m_rom_chip;
@@ -1442,9 +2155,7 @@ void ws_cartridge::build_chip_descriptor(unsigned int chip_i)
     return;
   }
   
-  // At the time of this code writing, cartridges contain a single chip
-  // with a constant size and block size.
-  num_bytes = 0x8000000;
+  num_bytes = ROM_CHIP_SIZE;
   
   // Calculate number of blocks. (1 block per 64 Kib (8 KiB))
   num_blocks = num_bytes / DEFAULT_BLOCK_SIZE;
@@ -1510,20 +2221,23 @@ void ws_cartridge::build_game_metadata(int slot)
   
   if (slot == -1)
   {
+    // Fetch the footers of all slots at once rather than visiting each
+    std::vector<unsigned char> buffer(m_metadata.size() * FOOTER_SIZE);
+    m_rom_chip->read_slot_footers(buffer.data(), FOOTER_SIZE);
+    
     for (unsigned int i = 0; i < m_metadata.size(); i++)
     {
-      build_game_metadata(i);
+      m_metadata[i].read_from_data_array(&buffer[i * FOOTER_SIZE]);
     }
   }
   else if (slot >= 0 && slot < (int) m_metadata.size())
   {
-    unsigned char* buffer = new unsigned char[10];
+    unsigned char buffer[FOOTER_SIZE];
     
     m_rom_chip->select_slot(slot);
-    m_rom_chip->read_bytes(slot_size(slot) - 10, buffer, 10);
+    m_rom_chip->read_bytes(slot_size(slot) - FOOTER_SIZE, buffer, FOOTER_SIZE);
     
     m_metadata[slot].read_from_data_array(buffer);
-    delete [] buffer;
   }
 }
 
@@ -17,6 +17,7 @@
 #include <vector>
 
 class linkmasta_device;
+class rom_image;
 class ws_rom_chip;
 class ws_sram_chip;
 
@@ -100,6 +101,11 @@ public:
    */
   const cartridge_descriptor* descriptor() const;
   
+  /*!
+   *  \see cartridge::layout()
+   */
+  const cartridge_layout* layout() const;
+  
   
   
   /*!
@@ -107,21 +113,202 @@ public:
    */
   void                  init();
   
+  /*!
+   *  \see cartridge::set_journal(job_journal* journal)
+   */
+  void                  set_journal(job_journal* journal);
+  
+  /*!
+   *  \see cartridge::set_erase_history(erase_history* history, const std::string& serial)
+   */
+  void                  set_erase_history(erase_history* history, const std::string& serial);
+  
+  /*!
+   *  \brief Gets whether differential save restores are enabled.
+   *  
+   *  Gets whether \ref restore_cartridge_save_data() only writes the parts of
+   *  the save that differ from the cartridge. See
+   *  \ref set_differential_save_restore(bool enabled) for details.
+   *  
+   *  \returns true if differential save restores are enabled, false
+   *           otherwise.
+   */
+  bool                  differential_save_restore() const;
+  
+  /*!
+   *  \brief Enables or disables differential save restores.
+   *  
+   *  SRAM needs no erasing, so when enabled,
+   *  \ref restore_cartridge_save_data() first reads back the cartridge's
+   *  current save data in a single batch, compares it with the file one
+   *  \ref WALK_CHANGED_RUN_SIZE packet at a time, and writes only the packets
+   *  that differ. Enabled by default.
+   *  
+   *  \param enabled true to enable differential save restores, false to
+   *         always write the entire save.
+   */
+  void                  set_differential_save_restore(bool enabled);
+  
   /*!
    *  \see cartridge::backup_cartridge_game_data(std::ostream& fout, task_controller* controller = nullptr)
    */
   void                  backup_cartridge_game_data(std::ostream& fout, int slot = SLOT_ALL, task_controller* controller = nullptr);
   
+  /*!
+   *  \brief Backs up the game in every slot to its own stream in one pass.
+   *  
+   *  Backs up the game in each slot to the stream at the same index of
+   *  \ref fouts, visiting the slots in order without reopening the device in
+   *  between. As with \ref backup_cartridge_game_data(std::ostream&, int, task_controller*),
+   *  only the bytes occupied by each game are read. Each stream is written on
+   *  a background thread, so the last blocks of one slot are still being
+   *  written while the next slot is read.
+   *  
+   *  This function ignores any journal set with
+   *  \ref set_journal(job_journal*).
+   *  
+   *  This function is a blocking function that can take several minutes to
+   *  complete.
+   *  
+   *  \param [out] fouts The streams to write each slot to, indexed by slot.
+   *         **nullptr** entries and slots past the end of the vector are
+   *         skipped.
+   *  \param [in,out] controller The controller object to send progress
+   *         updates. **nullptr** is an accepted value.
+   *  
+   *  \throws std::invalid_argument If there are more streams than slots.
+   */
+  void                  backup_slots_game_data(const std::vector<std::ostream*>& fouts, task_controller* controller = nullptr);
+  
   /*!
    *  \see cartridge::restore_cartridge_game_data(std::istream& fin, task_controller* controller = nullptr)
    */
   void                  restore_cartridge_game_data(std::istream& fin, int slot = SLOT_ALL, task_controller* controller = nullptr);
   
+  /*!
+   *  \see cartridge::restore_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+   */
+  void                  restore_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*!
+   *  \see cartridge::restore_and_verify_cartridge_game_data(std::istream& fin, int slot, task_controller* controller)
+   */
+  bool                  restore_and_verify_cartridge_game_data(std::istream& fin, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*!
+   *  \brief Flashes a game to each of several slots in one pass.
+   *  
+   *  Writes each image to the slot it is paired with, visiting the slots in
+   *  order so that each is switched to only once, without reopening the
+   *  device in between. The images are read on a background thread, one
+   *  after the other, so that the next slot's image is being read while the
+   *  current slot's blocks are erased and programmed. Every image is held in
+   *  memory until all slots are done, which is bounded by the size of the
+   *  cartridge. Each image is written the same way
+   *  \ref restore_cartridge_game_data(std::istream&, int, task_controller*)
+   *  writes it to its slot.
+   *  
+   *  This function ignores any journal set with
+   *  \ref set_journal(job_journal*).
+   *  
+   *  This function is a blocking function that can take several minutes to
+   *  complete.
+   *  
+   *  \param [in,out] images The slots to flash, each paired with the stream
+   *         to read its image from. The streams must support seeking.
+   *  \param [in,out] controller The controller object to send progress
+   *         updates. **nullptr** is an accepted value.
+   *  \param [in] verify Whether to read back and retry each block after
+   *         programming it, as
+   *         \ref restore_and_verify_cartridge_game_data(std::istream&, int, task_controller*)
+   *         does.
+   *  
+   *  \returns false if verifying any block failed, true otherwise.
+   *  
+   *  \throws std::invalid_argument If a slot is invalid or given more than
+   *          once.
+   *  \throws std::runtime_error If an image is too large for its slot or can't
+   *          be read.
+   */
+  bool                  restore_slots_game_data(const std::vector<std::pair<int, std::istream*>>& images, task_controller* controller = nullptr, bool verify = false);
+  
+  /*!
+   *  \brief Copies the game in one slot to another slot of the same
+   *         cartridge.
+   *  
+   *  Streams the game from the source slot to the top of the destination
+   *  slot through a bounded buffer in memory, without touching the disk. The
+   *  game is moved a few megabytes at a time, switching slots only twice per
+   *  chunk, so that the copy takes about as long as flashing the game. The
+   *  source slot is left as it is.
+   *  
+   *  Cancelling takes effect between chunks, so the destination is never left
+   *  with a chunk only partly written.
+   *  
+   *  This function ignores any journal set with
+   *  \ref set_journal(job_journal*).
+   *  
+   *  This function is a blocking function that can take several minutes to
+   *  complete.
+   *  
+   *  \param [in] source_slot The slot to copy from.
+   *  \param [in] slot The slot to copy to.
+   *  \param [in,out] controller The controller object to send progress
+   *         updates. **nullptr** is an accepted value.
+   *  
+   *  \throws std::invalid_argument If a slot is invalid or both are the same.
+   *  \throws std::runtime_error If the game doesn't fit the destination slot.
+   */
+  void                  copy_slot_game_data(int source_slot, int slot, task_controller* controller = nullptr);
+  
+  /*!
+   *  \brief Swaps the games in two slots of the same cartridge.
+   *  
+   *  Exchanges the games at the top of two slots a chunk at a time, holding
+   *  one chunk of each slot in memory, without touching the disk. Blocks that
+   *  are the same in both slots are left untouched.
+   *  
+   *  Cancelling takes effect between chunks, so the slots always hold whole
+   *  chunks of one game or the other. A chunk only exists in memory while it
+   *  is being written, however, so a device that fails part-way through a
+   *  swap can lose it. Games that can't be replaced should be backed up
+   *  first.
+   *  
+   *  This function ignores any journal set with
+   *  \ref set_journal(job_journal*).
+   *  
+   *  This function is a blocking function that can take several minutes to
+   *  complete.
+   *  
+   *  \param [in] slot_a One of the slots.
+   *  \param [in] slot_b The other slot.
+   *  \param [in,out] controller The controller object to send progress
+   *         updates. **nullptr** is an accepted value.
+   *  
+   *  \throws std::invalid_argument If a slot is invalid or both are the same.
+   */
+  void                  swap_slots_game_data(int slot_a, int slot_b, task_controller* controller = nullptr);
+  
+  /*!
+   *  \see cartridge::restore_and_verify_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+   */
+  bool                  restore_and_verify_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
   /*!
    *  \see cartridge::compare_cartridge_game_data(std::istream& fin, task_controller* controller = nullptr)
    */
   bool                  compare_cartridge_game_data(std::istream& fin, int slot = SLOT_ALL, task_controller* controller = nullptr);
   
+  /*!
+   *  \see cartridge::compare_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+   */
+  bool                  compare_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
+  /*!
+   *  \see cartridge::compare_cartridge_game_data(const digest_manifest& manifest, int slot, task_controller* controller)
+   */
+  bool                  compare_cartridge_game_data(const digest_manifest& manifest, int slot = SLOT_ALL, task_controller* controller = nullptr);
+  
   /*!
    *  \see cartridge::backup_cartridge_save_data(std::ostream& fout, task_controller* controller = nullptr)
    */
@@ -147,11 +334,31 @@ public:
    */
   unsigned int          slot_size(int slot) const;
   
+  /*!
+   *  \see cartridge::game_backup_size(int slot) const
+   */
+  unsigned int          game_backup_size(int slot) const;
+  
+  /*!
+   *  \see cartridge::save_backup_size(int slot) const
+   */
+  unsigned int          save_backup_size(int slot) const;
+  
   /*!
    *  \see cartridge::fetch_game_name(int slot)
    */
   std::string           fetch_game_name(int slot);
   
+  /*!
+   *  \see cartridge::fetch_slot_table(slot_table& table) const
+   */
+  void                  fetch_slot_table(slot_table& table) const;
+  
+  /*!
+   *  \see cartridge::read_cartridge_game_data(int slot, unsigned int offset, unsigned char* buffer, unsigned int num_bytes)
+   */
+  unsigned int          read_cartridge_game_data(int slot, unsigned int offset, unsigned char* buffer, unsigned int num_bytes);
+  
   /*!
    * \brief Gets the parsed metadata of the game in the given slot.
    * 
@@ -203,10 +410,51 @@ public:
    */
   static unsigned int   calculate_game_size(int size_code);
   
+  /*!
+   *  \brief Calculates the size of a game's EEPROM save given the numerical
+   *         save size code in its metadata.
+   *  
+   *  Games saving to EEPROM instead of SRAM keep their saves in the
+   *  linkmasta's own EEPROM.
+   *  
+   *  \param [in] save_code The save size code to translate to bytes.
+   *  
+   *  \return The number of bytes of EEPROM the game saves to. If
+   *          \ref save_code is not an EEPROM code, a 0 is returned.
+   */
+  static unsigned int   calculate_eeprom_size(int save_code);
+  
+  /*!
+   *  \brief Builds the descriptor of a cartridge an image is flashed onto,
+   *         without reading a cartridge.
+   *  
+   *  Lays out the single chip of every cartridge and its uniform blocks,
+   *  the same as \ref build_cartridge_descriptor() would find, with an image
+   *  of the whole cartridge starting at the chip's first byte. The chip's IDs
+   *  are left at 0 and no block is protected. Lets addresses in an image be
+   *  told apart by block where no cartridge is at hand, such as when
+   *  comparing two dumps.
+   *  
+   *  \param [in] num_bytes The number of bytes in the image.
+   *  
+   *  \return A new descriptor, which the caller must delete.
+   *  
+   *  \throws std::invalid_argument If the image is too large for any
+   *           cartridge.
+   */
+  static cartridge_descriptor* build_image_descriptor(unsigned int num_bytes);
+  
   
 
 protected:
   
+  /*! \brief Lines images of a single slot up with the end of the slot, the
+   *         way WonderSwan games are laid out.
+   *  
+   *  \see cartridge::slot_image_offset(int slot, unsigned int num_bytes) const
+   */
+  unsigned int          slot_image_offset(int slot, unsigned int num_bytes) const;
+  
   /*! \brief Constructs a \ref cartridge_descriptor struct using information
    *         gathered from the associated \ref linkmasta_device.
    *  
@@ -229,6 +477,11 @@ protected:
    */
   void                  build_cartridge_destriptor();
   
+  /*!
+   *  \brief Passes \ref m_erase_history on to each chip found so far.
+   */
+  void                  apply_erase_history();
+  
   /*! \brief Creates and populates a \ref cartridge_descriptor::chip_descriptor
    *         struct using information gathered from the associated
    *         \ref linkmasta_device.
@@ -313,6 +566,86 @@ protected:
   
 private:
   
+  /*!
+   *  \brief Writes the contents of a game image to the cartridge.
+   *  
+   *  Implementation shared by every version of
+   *  \ref restore_cartridge_game_data() and
+   *  \ref restore_and_verify_cartridge_game_data().
+   *  
+   *  \param [in,out] image The image to write.
+   *  \param [in] slot The game slot to write to, or \ref SLOT_ALL.
+   *  \param [in,out] controller The controller object to send progress updates.
+   *         **nullptr** is an accepted value.
+   *  \param [in] verify Whether to read back and retry each block after
+   *         programming it.
+   *  
+   *  \returns false if verifying any block failed, true otherwise.
+   */
+  bool                  restore_game_data(rom_image& image, int slot, task_controller* controller, bool verify);
+  
+  /*!
+   *  \brief Compares the contents of a game image to the cartridge.
+   *  
+   *  Implementation shared by every version of
+   *  \ref compare_cartridge_game_data() and
+   *  \ref compare_cartridge_game_data_blocks().
+   *  
+   *  \param [in,out] image The image to compare.
+   *  \param [in] slot The game slot to compare, or \ref SLOT_ALL.
+   *  \param [in,out] controller The controller object to send progress updates.
+   *         **nullptr** is an accepted value.
+   *  \param [out] mismatches The map to record every block compared in, or
+   *         **nullptr** to stop at the first block that differs.
+   *  
+   *  \returns true if the cartridge matches the image, false otherwise.
+   */
+  bool                  compare_game_data(rom_image& image, int slot, task_controller* controller, block_mismatch_map* mismatches);
+  
+  /*!
+   *  \brief Moves the top of one slot to the top of another through memory.
+   *  
+   *  Implementation shared by \ref copy_slot_game_data() and
+   *  \ref swap_slots_game_data().
+   *  
+   *  \param [in] slot_a The slot whose game is written to **slot_b**.
+   *  \param [in] slot_b The slot written to.
+   *  \param [in] swap Whether to also write the game in **slot_b** to
+   *         **slot_a**.
+   *  \param [in,out] controller The controller object to send progress updates.
+   *         **nullptr** is an accepted value.
+   */
+  void                  relocate_slot_game_data(int slot_a, int slot_b, bool swap, task_controller* controller);
+  
+  /*!
+   *  \brief Erases and programs whole blocks of a slot from memory.
+   *  
+   *  Writes a range of the selected slot block by block. Blocks for which
+   *  **current** already holds the same data are skipped. Cancelling is not
+   *  checked, so the range is always written in full.
+   *  
+   *  \param [in] slot The slot to write to, which must be selected.
+   *  \param [in] offset The offset of the range from the start of the slot.
+   *         Must be at the start of a block.
+   *  \param [in] data The data to write.
+   *  \param [in] current What the range holds now, or **nullptr** if unknown.
+   *  \param [in] num_bytes The size of the range. Must end at the end of a
+   *         block.
+   *  \param [in,out] controller The controller object to send progress updates.
+   *         **nullptr** is an accepted value.
+   */
+  void                  write_slot_blocks(int slot, unsigned int offset, const unsigned char* data, const unsigned char* current, unsigned int num_bytes, task_controller* controller);
+  
+  /*!
+   *  \brief Gets the chip a slot's save data is kept in.
+   *  
+   *  \param [in] slot The game slot, or \ref SLOT_ALL for the first slot.
+   *  
+   *  \returns \ref m_eeprom_chip if the game in the slot saves to EEPROM,
+   *           \ref m_sram_chip otherwise.
+   */
+  ws_sram_chip*         save_chip(int slot) const;
+  
   /*! \brief Disabled copy constructor.
    *  
    *  The copy constructor for this class. Because this class cannot be copied
@@ -377,6 +710,14 @@ private:
    */
   cartridge_descriptor* m_descriptor;
   
+  /*! \brief Flat copy of \ref m_descriptor, built along with it by
+   *         \ref init().
+   *  
+   *  \see cartridge_layout
+   *  \see m_descriptor
+   */
+  cartridge_layout      m_layout;
+  
   /*! \brief A pointer to the \ref ws_rom_chip instance that handles
    *         communications with the cartridge's ROM device.
    *  
@@ -404,6 +745,14 @@ private:
    */
   ws_sram_chip*         m_sram_chip;
   
+  /*! \brief A pointer to the \ref ws_sram_chip object that handles
+   *         communications with the linkmasta's EEPROM, where the saves of
+   *         games saving to EEPROM are kept.
+   *  
+   *  \see save_chip(int slot) const
+   */
+  ws_sram_chip*         m_eeprom_chip;
+  
   /*! \brief The vector used for caching the slot layout of the cartridge.
    *  
    *  The vector used for caching the slot layout of the cartridge. Stored as an
@@ -426,7 +775,36 @@ private:
    *  
    *  \see game_metadata
    */
-  std::vector<game_metadata> m_metadata;
+  std::vector<game_metadata> m_metadata;  
+  /*!
+   *  \brief Journal used to skip and record completed blocks of game data
+   *         backups and restores, or **nullptr** if none.
+   *  
+   *  \see set_journal(job_journal* journal)
+   */
+  job_journal*          m_journal;
+  
+  /*!
+   *  \brief History the erase times of the chips are recorded in, or
+   *         **nullptr** if none.
+   *  
+   *  \see set_erase_history(erase_history* history, const std::string& serial)
+   */
+  erase_history*        m_erase_history;
+  
+  /*!
+   *  \brief Serial number of the device the cartridge is plugged into, used
+   *         to key \ref m_erase_history.
+   */
+  std::string           m_erase_serial;
+  
+  /*!
+   *  \brief Flag indicating that save data restores should only write the
+   *         packets that differ from the cartridge.
+   *  
+   *  \see set_differential_save_restore(bool enabled)
+   */
+  bool                  m_differential_save_restore;
 };
 
 #endif /* defined(__WS_CARTRIDGE_H__) */
@@ -17,6 +17,10 @@
 #include "linkmasta/linkmasta_device.h"
 #include "task/task_controller.h"
 #include "task/forwarding_task_controller.h"
+#include "erase_poller.h"
+#include "common/trace.h"
+#include <algorithm>
+#include <stdexcept>
 
 
 
@@ -29,6 +33,21 @@
 
 #define MASK_SECTOR   0xFFFE0000
 
+// Status bit that toggles on every read while the chip erases, but not once
+// the erase is suspended, and how many times to check it after suspending
+#define STATUS_TOGGLE_BIT       0x40
+#define ERASE_SUSPEND_MAX_POLLS 16
+
+// How long to wait for the firmware to say an erase is done, in multiples of
+// the typical erase time, before polling the chip instead, and how long to
+// wait at a time so that the task can be updated meanwhile
+#define ERASE_NOTIFY_TIMEOUT_FACTOR 4
+#define ERASE_NOTIFY_SLICE_MS       250
+
+// Number of bytes programmed per word sequence when the device can't program
+// whole ranges itself
+#define FALLBACK_BATCH_BYTES 64
+
 typedef ws_rom_chip::data_t        data_t;
 typedef ws_rom_chip::word_t        word_t;
 typedef ws_rom_chip::chip_index_t  chip_index_t;
@@ -40,9 +59,10 @@ typedef ws_rom_chip::address_t     address_t;
 
 
 ws_rom_chip::ws_rom_chip(linkmasta_device* linkmasta_device)
-  : m_mode(READ), m_last_erased_addr(0),
+  : m_last_erased_addr(0), m_erase_start(), m_suspend_start(),
+    m_erasing_chip(false), m_erase_history(nullptr),
     m_linkmasta(linkmasta_device), m_chip_num(CHIP_INDEX),
-    m_slot_index(0)
+    m_slot_index(0), m_slot_known(false)
 {
   // Nothing else to do
 }
@@ -73,14 +93,31 @@ void ws_rom_chip::reset()
     // We can only reset when we're not erasing
     throw std::runtime_error("Chip still erasing");
   }
+  if (current_mode() == ERASE_SUSPENDED)
+  {
+    // Resetting would leave the erase suspended, not the chip in read mode
+    throw std::runtime_error("Chip erase is suspended");
+  }
+  
+  linkmasta_device::word_command commands[5];
+  unsigned int num_commands = 0;
+  
+  if (current_mode() == BYPASS || current_mode() == UNKNOWN)
+  {
+    // If we're or may be in bypass mode, do something special to exit it. In
+    // any other mode the chip ignores these writes
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0x90};
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0x00};
+  }
   
   // Send the full command
-  write(ADDR_COMMAND1, 0xAA);
-  write(ADDR_COMMAND2, 0x55);
-  write(ADDR_COMMAND3, 0xF0);
+  commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA};
+  commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55};
+  commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0xF0};
+  m_linkmasta->run_word_sequence(m_chip_num, commands, num_commands);
   
   // Update the cached mode
-  m_mode = READ;
+  set_mode(READ);
 }
 
 manufact_id_t ws_rom_chip::get_manufacturer_id()
@@ -102,12 +139,7 @@ manufact_id_t ws_rom_chip::get_manufacturer_id()
   }
   else
   {
-    if (current_mode() != AUTOSELECT)
-    {
-      enter_autoselect();
-    }
-    
-    return read(0x0000);
+    return autoselect_read(0x0000);
   }
 }
 
@@ -130,12 +162,7 @@ device_id_t ws_rom_chip::get_device_id()
   }
   else
   {
-    if (current_mode() != AUTOSELECT)
-    {
-      enter_autoselect();
-    }
-    
-    return read(0x0002);
+    return autoselect_read(0x0002);
   }
 }
 
@@ -159,18 +186,26 @@ void ws_rom_chip::program_word(address_t address, word_t data)
     reset();
   }
   
-  if (current_mode() == BYPASS)
+  linkmasta_device::word_command commands[4];
+  unsigned int num_commands = 0;
+  chip_mode mode = current_mode();
+  
+  if (mode == BYPASS)
   {
-    write(ADDR_DONTCARE, 0xA0);
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0xA0};
   }
   else
   {
-    write(ADDR_COMMAND1, 0xAA);
-    write(ADDR_COMMAND2, 0x55);
-    write(ADDR_COMMAND3, 0xA0);
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA};
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55};
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0xA0};
   }
   
-  write(address, data);
+  commands[num_commands++] = {linkmasta_device::WORD_WRITE, address, data};
+  m_linkmasta->run_word_sequence(m_chip_num, commands, num_commands);
+  
+  // Programming a word leaves the chip in the mode it was in
+  set_mode(mode);
 }
 
 void ws_rom_chip::unlock_bypass()
@@ -196,11 +231,14 @@ void ws_rom_chip::unlock_bypass()
   // Unlock bypass mode and update flags
   if (current_mode() != BYPASS)
   {
-    write(ADDR_COMMAND1, 0xAA);
-    write(ADDR_COMMAND2, 0x55);
-    write(ADDR_COMMAND3, 0x20);
+    linkmasta_device::word_command commands[] = {
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x20}
+    };
+    m_linkmasta->run_word_sequence(m_chip_num, commands, 3);
     
-    m_mode = BYPASS;
+    set_mode(BYPASS);
   }
 }
 
@@ -219,6 +257,8 @@ void ws_rom_chip::erase_chip()
   }
   
   m_last_erased_addr = 0;
+  m_erase_start = erase_poller::time_point_t::clock::now();
+  m_erasing_chip = true;
   
   if (m_linkmasta->supports_erase_chip())
   {
@@ -227,15 +267,18 @@ void ws_rom_chip::erase_chip()
   else
   {
     // Send the nuke command sequence to chip
-    write(ADDR_COMMAND1, 0xAA);
-    write(ADDR_COMMAND2, 0x55);
-    write(ADDR_COMMAND3, 0x80);
-    write(ADDR_COMMAND1, 0xAA);
-    write(ADDR_COMMAND2, 0x55);
-    write(ADDR_COMMAND3, 0x10);
+    linkmasta_device::word_command commands[] = {
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x80},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x10}
+    };
+    m_linkmasta->run_word_sequence(m_chip_num, commands, 6);
   }
   
-  m_mode = ERASE;
+  set_mode(ERASE);
 }
 
 void ws_rom_chip::erase_block(address_t block_address)
@@ -254,6 +297,8 @@ void ws_rom_chip::erase_block(address_t block_address)
   
   block_address &= MASK_SECTOR;
   m_last_erased_addr = block_address;
+  m_erase_start = erase_poller::time_point_t::clock::now();
+  m_erasing_chip = false;
   
   if (m_linkmasta->supports_erase_chip())
   {
@@ -262,22 +307,89 @@ void ws_rom_chip::erase_block(address_t block_address)
   else
   {
     // Send the sector erase command sequence to chip
-    write(ADDR_COMMAND1, 0xAA);
-    write(ADDR_COMMAND2, 0x55);
-    write(ADDR_COMMAND3, 0x80);
-    write(ADDR_COMMAND1, 0xAA);
-    write(ADDR_COMMAND2, 0x55);
-    write(m_last_erased_addr, 0x30);
+    linkmasta_device::word_command commands[] = {
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x80},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+      {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+      {linkmasta_device::WORD_WRITE, m_last_erased_addr, 0x30}
+    };
+    m_linkmasta->run_word_sequence(m_chip_num, commands, 6);
   }
   
-  m_mode = ERASE;
+  set_mode(ERASE);
+}
+
+bool ws_rom_chip::suspend_erase()
+{
+  if (current_mode() != ERASE)
+  {
+    return false;
+  }
+  if (m_erasing_chip)
+  {
+    throw std::runtime_error("Chip erases can't be suspended");
+  }
+  
+  // Suspend, then read the erasing block twice in the same burst. The toggle
+  // bit only stops toggling once the erase has been set aside, and nothing
+  // toggles at all if the erase had already finished
+  for (unsigned int i = 0; i < ERASE_SUSPEND_MAX_POLLS; ++i)
+  {
+    linkmasta_device::word_command commands[3];
+    unsigned int num_commands = 0;
+    if (i == 0)
+    {
+      commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0xB0};
+    }
+    commands[num_commands++] = {linkmasta_device::WORD_READ, m_last_erased_addr, 0};
+    commands[num_commands++] = {linkmasta_device::WORD_READ, m_last_erased_addr, 0};
+    m_linkmasta->run_word_sequence(m_chip_num, commands, num_commands);
+    
+    word_t result1 = (word_t) commands[num_commands - 2].data;
+    word_t result2 = (word_t) commands[num_commands - 1].data;
+    if (result1 == result2)
+    {
+      set_mode(READ);
+      return false;
+    }
+    if (((result1 ^ result2) & STATUS_TOGGLE_BIT) == 0)
+    {
+      m_suspend_start = erase_poller::time_point_t::clock::now();
+      set_mode(ERASE_SUSPENDED);
+      return true;
+    }
+  }
+  
+  // The suspend command may still land, so the mode can't be trusted either
+  set_mode(UNKNOWN);
+  throw std::runtime_error("Chip did not suspend its erase");
+}
+
+void ws_rom_chip::resume_erase()
+{
+  if (current_mode() != ERASE_SUSPENDED)
+  {
+    return;
+  }
+  
+  linkmasta_device::word_command commands[] = {
+    {linkmasta_device::WORD_WRITE, m_last_erased_addr, 0x30}
+  };
+  m_linkmasta->run_word_sequence(m_chip_num, commands, 1);
+  
+  // Time spent suspended doesn't count towards the erase
+  m_erase_start += erase_poller::time_point_t::clock::now() - m_suspend_start;
+  set_mode(ERASE);
 }
 
 
 
 ws_rom_chip::chip_mode ws_rom_chip::current_mode() const
 {
-  return m_mode;
+  int mode = m_linkmasta->chip_mode(m_chip_num);
+  return (mode == CHIP_MODE_UNKNOWN ? UNKNOWN : (chip_mode) mode);
 }
 
 bool ws_rom_chip::supports_bypass() const
@@ -312,14 +424,100 @@ bool ws_rom_chip::test_erasing()
   }
   
   // Send BLANK CHECK SETUP command sequence
-  unsigned char result1 = read(m_last_erased_addr);
-  unsigned char result2 = read(m_last_erased_addr);
+  unsigned char result1 = m_linkmasta->read_erase_status(m_chip_num, m_last_erased_addr);
+  unsigned char result2 = m_linkmasta->read_erase_status(m_chip_num, m_last_erased_addr);
   
-  m_mode = (result1 != result2 ? ERASE : READ);
+  set_mode(result1 != result2 ? ERASE : READ);
   
   return is_erasing();
 }
 
+void ws_rom_chip::wait_for_erase(task_controller* controller)
+{
+  trace_scope  trace(TRACE_ERASE_POLL);
+  resume_erase();
+  if (!test_erasing())
+  {
+    return;
+  }
+  
+  // Count the wait as erase time, then go back to whatever was running
+  task_phase prev_phase = TASK_PHASE_OTHER;
+  if (controller != nullptr)
+  {
+    prev_phase = controller->get_task_phase();
+    controller->on_task_phase(TASK_PHASE_ERASE);
+  }
+  
+  // Earlier erases of the same block tell better than the datasheet how long
+  // to sleep before polling
+  unsigned int typical_ms = (m_erasing_chip ? WS_ROM_CHIP_CHIP_ERASE_TIME_MS : WS_ROM_CHIP_BLOCK_ERASE_TIME_MS);
+  if (m_erase_history != nullptr)
+  {
+    typical_ms = (m_erasing_chip ? m_erase_history->typical_chip_erase_ms(m_erase_key, typical_ms)
+                  : m_erase_history->typical_block_erase_ms(m_erase_key, m_last_erased_addr, typical_ms));
+  }
+  
+  // Firmware that says when the erase is done spares us from polling for it,
+  // though the chip still has the final word
+  bool notified = false;
+  if (m_linkmasta->supports_erase_notification())
+  {
+    auto deadline = erase_poller::time_point_t::clock::now() + std::chrono::milliseconds(typical_ms * ERASE_NOTIFY_TIMEOUT_FACTOR);
+    while (!notified && erase_poller::time_point_t::clock::now() < deadline)
+    {
+      notified = m_linkmasta->wait_for_erase_notification(m_chip_num, ERASE_NOTIFY_SLICE_MS);
+      if (controller != nullptr)
+      {
+        controller->on_task_update(task_status::RUNNING, 0);
+      }
+    }
+  }
+  
+  if (!notified || test_erasing())
+  {
+    erase_poller poller(m_erase_start, typical_ms);
+    do
+    {
+      poller.wait(controller);
+    } while (test_erasing());
+  }
+  
+  // Erases that had already finished by the first poll aren't timed, since
+  // all that is known is that they took less than that
+  if (m_erase_history != nullptr)
+  {
+    unsigned int elapsed_ms = (unsigned int) std::chrono::duration_cast<std::chrono::milliseconds>(erase_poller::time_point_t::clock::now() - m_erase_start).count();
+    try
+    {
+      if (m_erasing_chip)
+      {
+        m_erase_history->record_chip_erase(m_erase_key, elapsed_ms);
+      }
+      else
+      {
+        m_erase_history->record_block_erase(m_erase_key, m_last_erased_addr, elapsed_ms);
+      }
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Losing a sample is not worth failing the operation over
+    }
+  }
+  
+  if (controller != nullptr)
+  {
+    controller->on_task_phase(prev_phase);
+  }
+}
+
+void ws_rom_chip::set_erase_history(erase_history* history, const erase_history::chip_key& key)
+{
+  m_erase_history = history;
+  m_erase_key = key;
+}
+
 unsigned int ws_rom_chip::read_bytes(address_t address, data_t* data, unsigned int num_bytes, task_controller* controller)
 {
   if (is_erasing())
@@ -328,8 +526,9 @@ unsigned int ws_rom_chip::read_bytes(address_t address, data_t* data, unsigned i
     throw std::runtime_error("Chip still erasing");
   }
   
-  // Ensure we're in read mode
-  if (current_mode() != READ)
+  // Ensure we're in read mode. Blocks other than the one being erased can be
+  // read as they are while the erase is suspended
+  if (current_mode() != READ && current_mode() != ERASE_SUSPENDED)
   {
     reset();
   }
@@ -413,6 +612,24 @@ unsigned int ws_rom_chip::read_bytes(address_t address, data_t* data, unsigned i
   }
 }
 
+unsigned int ws_rom_chip::checksum_bytes(address_t address, unsigned int num_bytes)
+{
+  if (is_erasing())
+  {
+    // We can only reset when we're not erasing
+    throw std::runtime_error("Chip still erasing");
+  }
+  
+  // Ensure we're in read mode. Blocks other than the one being erased can be
+  // read as they are while the erase is suspended
+  if (current_mode() != READ && current_mode() != ERASE_SUSPENDED)
+  {
+    reset();
+  }
+  
+  return m_linkmasta->checksum_range(m_chip_num, address, num_bytes);
+}
+
 unsigned int ws_rom_chip::program_bytes(address_t address, const data_t* data, unsigned int num_bytes, task_controller* controller)
 {
   if (is_erasing())
@@ -429,10 +646,13 @@ unsigned int ws_rom_chip::program_bytes(address_t address, const data_t* data, u
       reset();
     }
     
-    // Use Linkmasta's built-in support for batch programming
+    // Use Linkmasta's built-in support for batch programming. The firmware
+    // enters and leaves bypass mode itself, returning the chip to read mode
     if (controller == nullptr)
     {
-      return m_linkmasta->program_bytes(m_chip_num, address, data, num_bytes, supports_bypass());
+      unsigned int result = m_linkmasta->program_bytes(m_chip_num, address, data, num_bytes, supports_bypass());
+      set_mode(READ);
+      return result;
     }
     else
     {
@@ -449,6 +669,7 @@ unsigned int ws_rom_chip::program_bytes(address_t address, const data_t* data, u
         try
         {
           result = m_linkmasta->program_bytes(m_chip_num, address, data, num_bytes, supports_bypass(),  &fwd_controller);
+          set_mode(READ);
         }
         catch (std::exception& ex)
         {
@@ -474,7 +695,7 @@ unsigned int ws_rom_chip::program_bytes(address_t address, const data_t* data, u
     {
       unlock_bypass();
     }
-    if (current_mode() != READ)
+    else if (!supports_bypass() && current_mode() != READ)
     {
       reset();
     }
@@ -485,13 +706,36 @@ unsigned int ws_rom_chip::program_bytes(address_t address, const data_t* data, u
       controller->on_task_start(num_bytes);
     }
     
-    // Program word of data one at a time
-    unsigned int i;
-    for (i = 0; i < num_bytes && (controller == nullptr || !controller->is_task_cancelled()); i++, address++)
+    // Queue the program sequences of many words in a single burst with their
+    // acknowledgements checked afterwards, each one the same sequence that
+    // program_word() sends. Programming leaves the chip in bypass mode, so
+    // consecutive batches and blocks don't unlock it again
+    linkmasta_device::word_command commands[FALLBACK_BATCH_BYTES * 4];
+    chip_mode mode = current_mode();
+    unsigned int i = 0;
+    while (i < num_bytes && (controller == nullptr || !controller->is_task_cancelled()))
     {
+      unsigned int batch_size = std::min(num_bytes - i, (unsigned int) FALLBACK_BATCH_BYTES);
+      unsigned int num_commands = 0;
+      for (unsigned int j = 0; j < batch_size; ++j)
+      {
+        if (mode == BYPASS)
+        {
+          commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_DONTCARE, 0xA0};
+        }
+        else
+        {
+          commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA};
+          commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55};
+          commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0xA0};
+        }
+        commands[num_commands++] = {linkmasta_device::WORD_WRITE, address + i + j, data[i + j]};
+      }
+      
       try
       {
-        program_word(address, data[i]);
+        m_linkmasta->run_word_sequence(m_chip_num, commands, num_commands);
+        set_mode(mode);
       }
       catch (std::exception& ex)
       {
@@ -502,11 +746,12 @@ unsigned int ws_rom_chip::program_bytes(address_t address, const data_t* data, u
         }
         throw;
       }
+      i += batch_size;
       
       // Inform controller of task progress
       if (controller != nullptr)
       {
-        controller->on_task_update(task_status::RUNNING, 1);
+        controller->on_task_update(task_status::RUNNING, batch_size);
       }
     }
     
@@ -532,6 +777,12 @@ bool ws_rom_chip::select_slot(unsigned int slot)
     throw std::runtime_error("Chip still erasing");
   }
   
+  // Switching to the slot that's already selected would only cost a round trip
+  if (m_slot_known && m_slot_index == slot)
+  {
+    return true;
+  }
+  
   // Ensure chip has been reset
   if (current_mode() != READ)
   {
@@ -540,10 +791,15 @@ bool ws_rom_chip::select_slot(unsigned int slot)
   
   if (m_linkmasta->supports_switch_slot())
   {
+    // Until the switch is known to have gone through, the device could be on
+    // either slot
+    m_slot_known = false;
+    
     // Use linkmasta's functionality if available
     if (m_linkmasta->switch_slot(slot))
     {
       m_slot_index = slot;
+      m_slot_known = true;
       return true;
     }
     else
@@ -558,12 +814,72 @@ bool ws_rom_chip::select_slot(unsigned int slot)
   }
 }
 
+void ws_rom_chip::read_slot_footers(data_t* buffer, unsigned int num_bytes)
+{
+  if (is_erasing())
+  {
+    // We can only reset when we're not erasing
+    throw std::runtime_error("Chip still erasing");
+  }
+  
+  // Ensure we're in read mode
+  if (current_mode() != READ)
+  {
+    reset();
+  }
+  
+  // The footer scan leaves the device on m_slot_index even if it wasn't
+  // selected through this object before
+  m_slot_known = false;
+  m_linkmasta->read_slot_footers(m_chip_num, num_bytes, buffer, m_slot_index);
+  m_slot_known = true;
+}
+
+void ws_rom_chip::invalidate_selected_slot()
+{
+  m_slot_known = false;
+}
+
 
 
 void ws_rom_chip::enter_autoselect()
 {
-  write(ADDR_COMMAND1, 0xAA);
-  write(ADDR_COMMAND2, 0x55);
-  write(ADDR_COMMAND3, 0x90);
-  m_mode = AUTOSELECT;
+  linkmasta_device::word_command commands[] = {
+    {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA},
+    {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55},
+    {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x90}
+  };
+  m_linkmasta->run_word_sequence(m_chip_num, commands, 3);
+  set_mode(AUTOSELECT);
+}
+
+word_t ws_rom_chip::autoselect_read(address_t address)
+{
+  // Bypass mode, or whatever mode the chip may be in, has to be left first
+  if (current_mode() != READ && current_mode() != AUTOSELECT)
+  {
+    reset();
+  }
+  
+  linkmasta_device::word_command commands[4];
+  unsigned int num_commands = 0;
+  
+  // Prefix the read with the autoselect command sequence if necessary
+  if (current_mode() != AUTOSELECT)
+  {
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND1, 0xAA};
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND2, 0x55};
+    commands[num_commands++] = {linkmasta_device::WORD_WRITE, ADDR_COMMAND3, 0x90};
+  }
+  commands[num_commands++] = {linkmasta_device::WORD_READ, address, 0};
+  
+  m_linkmasta->run_word_sequence(m_chip_num, commands, num_commands);
+  set_mode(AUTOSELECT);
+  
+  return (word_t) commands[num_commands - 1].data;
+}
+
+void ws_rom_chip::set_mode(chip_mode mode)
+{
+  m_linkmasta->set_chip_mode(m_chip_num, (mode == UNKNOWN ? CHIP_MODE_UNKNOWN : (int) mode));
 }
@@ -12,9 +12,20 @@
 #ifndef __WS_ROM_CHIP_H__
 #define __WS_ROM_CHIP_H__
 
+#include "erase_history.h"
+#include "erase_poller.h"
+
 class linkmasta_device;
 class task_controller;
 
+/*! \brief Typical time taken by the chip to erase a single block, in
+ *         milliseconds. */
+#define WS_ROM_CHIP_BLOCK_ERASE_TIME_MS  500
+
+/*! \brief Typical time taken by the chip to erase itself entirely, in
+ *         milliseconds. */
+#define WS_ROM_CHIP_CHIP_ERASE_TIME_MS   60000
+
 /*! \class ws_rom_chip
  *  \brief Class for controlling and interacting with a flash storage chip on a
  *         WonderSwan cartridge.
@@ -81,7 +92,17 @@ public:
     BYPASS,
     
     /*! \brief Device is busy erasing. */
-    ERASE
+    ERASE,
+    
+    /*! \brief Device has set a block erase aside to be read from.
+     *  
+     *  \see suspend_erase()
+     */
+    ERASE_SUSPENDED,
+    
+    /*! \brief Device may be in any mode, such as before anything has been
+     *         sent to it or after a command sequence failed. */
+    UNKNOWN
   };
   
   
@@ -155,6 +176,11 @@ public:
    *  Sends the reset command sequence to the hardware device. Whether or not
    *  the operation is successful is not guaranteed.
    *  
+   *  The sequence is sent even if the chip is believed to be in read mode
+   *  already, so that a chip left in a state nobody knows of can be
+   *  recovered. Methods that merely need read mode only call this when
+   *  \ref current_mode() says so.
+   *  
    *  This function is a blocking function that can take several seconds to
    *  complete.
    *  
@@ -311,13 +337,50 @@ public:
    */
   void                    erase_block(address_t block_address);
   
+  /*! \brief Suspends a block erase so that the chip can be read from.
+   *  
+   *  Sends the erase suspend command and polls the chip until it has set the
+   *  erase aside, which takes it a few microseconds. While suspended, every
+   *  block but the one being erased can be read as usual with
+   *  \ref read_bytes() and \ref checksum_bytes(); reading the block being
+   *  erased returns status bits rather than data. The erase carries on once
+   *  \ref resume_erase() or \ref wait_for_erase() is called, and the time
+   *  spent suspended is not counted towards it.
+   *  
+   *  Anything else that would command the chip, such as \ref reset() or
+   *  programming, throws while the erase is suspended.
+   *  
+   *  Causes the device to enter \ref chip_mode::ERASE_SUSPENDED if the erase
+   *  was still running, or \ref chip_mode::READ if it had already finished.
+   *  
+   *  \returns **true** if the erase was suspended, **false** if it had
+   *            already finished or the chip is not erasing.
+   *  
+   *  \throws std::runtime_error If the chip is erasing as a whole, which can't
+   *          be suspended, or it never reports the erase as suspended.
+   */
+  bool                    suspend_erase();
+  
+  /*! \brief Resumes an erase set aside with \ref suspend_erase().
+   *  
+   *  Does nothing unless the chip is in \ref chip_mode::ERASE_SUSPENDED mode.
+   *  Once resumed, the erase has to be polled as usual with
+   *  \ref test_erasing() or \ref wait_for_erase().
+   *  
+   *  Causes the device to enter \ref chip_mode::ERASE.
+   */
+  void                    resume_erase();
+  
   
   
   /*! \brief Gets the currently assumed mode that the chip is in.
    *  
-   *  Gets the currently assumed mode that the chip is in. This value is not
-   *  guaranteed to be true because the device may have been in an unknown state
-   *  when this class was created.
+   *  Gets the currently assumed mode that the chip is in, as recorded with
+   *  \ref linkmasta_device::chip_mode() by whichever object last drove the
+   *  chip. Reset, unlock, and autoselect sequences are only sent when this
+   *  mode says they are needed. The mode is \ref chip_mode::UNKNOWN until
+   *  something has been sent to the chip, and again whenever the device loses
+   *  track of it.
    *  
    *  \returns The current \ref chip_mode that the device is assumed to be in.
    *  
@@ -421,6 +484,42 @@ public:
    */
   bool                    test_erasing();
   
+  /*! \brief Blocks until the chip is no longer in \ref chip_mode::ERASE mode.
+   *  
+   *  Blocks until the chip is no longer in \ref chip_mode::ERASE mode,
+   *  resuming the erase first if it was suspended. Unlike
+   *  calling \ref test_erasing() in a tight loop, this function uses an
+   *  \ref erase_poller to sleep through most of the chip's typical erase time
+   *  and polls with an increasing delay from then on, which keeps USB traffic
+   *  to a minimum while the chip is busy.
+   *  
+   *  A \ref task_controller object may be optionally provided. It will be sent
+   *  progress updates of 0 while waiting so that any user interface remains
+   *  responsive, and the wait is counted towards its
+   *  \ref task_phase::TASK_PHASE_ERASE time. Erase operations cannot be
+   *  interrupted, so cancelling the task has no effect on this function.
+   *  
+   *  \param [in,out] controller The controller to update. Can be nullptr.
+   *  
+   *  \see test_erasing()
+   *  \see erase_poller
+   */
+  void                    wait_for_erase(task_controller* controller = nullptr);
+  
+  /*! \brief Sets the history the erases of this chip are recorded in.
+   *  
+   *  Sets the \ref erase_history that \ref wait_for_erase() records the
+   *  duration of each erase in, and whose earlier erases of the same block it
+   *  uses in place of the datasheet's typical erase time to pace its polls.
+   *  
+   *  The history is not owned by the chip and must outlive its use. Set to
+   *  **nullptr** to stop recording, which is the default.
+   *  
+   *  \param [in] history The history to use, or **nullptr** for none.
+   *  \param [in] key The key identifying this chip in the history.
+   */
+  void                    set_erase_history(erase_history* history, const erase_history::chip_key& key);
+  
   /*! \brief Reads a series of sequential bytes of data from the chip.
    *  
    *  Reads a series of sequential bytes of data from the chip. Does not modify
@@ -456,6 +555,23 @@ public:
    */
   unsigned int            read_bytes(address_t address, data_t* data, unsigned int num_bytes, task_controller* controller = nullptr);
   
+  /*! \brief Has the device checksum a series of sequential bytes on the chip.
+   *  
+   *  Has the device compute the CRC32C checksum of a series of sequential
+   *  bytes on the chip without reading the bytes back. Only available if
+   *  \ref linkmasta_device::supports_checksum_range() returns true.
+   *  
+   *  Causes the device to enter \ref chip_mode::READ mode.
+   *  
+   *  \param [in] address The address on the chip of the first byte.
+   *  \param [in] num_bytes The number of bytes to checksum.
+   *  
+   *  \returns The CRC32C checksum of the bytes.
+   *  
+   *  \see linkmasta_device::checksum_range(chip_index chip, address_t start_address, unsigned int num_bytes)
+   */
+  unsigned int            checksum_bytes(address_t address, unsigned int num_bytes);
+  
   /*! \brief Programs a series of bytes of data sequentially to the chip.
    *  
    *  Programs the flash data on the chip given a sequence of bytes, starting at
@@ -513,7 +629,8 @@ public:
   /*! \brief Sends the slot selection command to the device.
    *  
    *  Sends the slot selection command to the device, effectively changing
-   *  which frame of addresses are available for access. This function directly
+   *  which frame of addresses are available for access. If the slot is
+   *  already known to be selected, no command is sent. This function directly
    *  affects the results of calls to other operations, such as
    *  \ref read_bytes(address_t, data_t*, unsigned int, task_controller*) and
    *  \ref program_bytes(address_t, const data_t*, unsigned int, task_controller*).
@@ -527,6 +644,37 @@ public:
    */
   bool                    select_slot(unsigned int slot);
   
+  /*! \brief Reads the last bytes of every slot on the cartridge.
+   *  
+   *  Reads the last \ref num_bytes bytes of every slot on the cartridge into
+   *  the buffer, one slot after another, letting the linkmasta batch the
+   *  requests. The slot selected beforehand is selected again afterwards, so
+   *  \ref selected_slot() stays accurate.
+   *  
+   *  This function is a blocking function that can take several seconds to
+   *  complete.
+   *  
+   *  \param [out] buffer The buffer to read into. Must hold \ref num_bytes
+   *         bytes for every slot.
+   *  \param [in] num_bytes The number of bytes to read from the end of each
+   *         slot.
+   *  
+   *  \see linkmasta_device::read_slot_footers(chip_index chip, unsigned int num_bytes, data_t* buffer, unsigned int final_slot)
+   */
+  void                    read_slot_footers(data_t* buffer, unsigned int num_bytes);
+  
+  /*! \brief Forgets which slot is selected on the device.
+   *  
+   *  Marks the selected slot as unknown, so that the next call to
+   *  \ref select_slot(unsigned int) sends the slot selection command even if
+   *  the same slot is requested. Should be called whenever the device may have
+   *  changed slots without this object's knowledge, such as after the device
+   *  was reset or reconnected.
+   *  
+   *  \see select_slot(unsigned int)
+   */
+  void                    invalidate_selected_slot();
+  
   
   
 private:
@@ -546,20 +694,33 @@ private:
    */
   void                    enter_autoselect();
   
+  /*! \brief Reads a word from the chip in \ref chip_mode::AUTOSELECT mode.
+   *  
+   *  Reads a word of metadata from the chip in \ref chip_mode::AUTOSELECT
+   *  mode. If the chip is not already in \ref chip_mode::AUTOSELECT mode, the
+   *  command sequence to enter it is sent in the same burst as the read using
+   *  \ref linkmasta_device::run_word_sequence().
+   *  
+   *  Causes the device to enter \ref chip_mode::AUTOSELECT mode.
+   *  
+   *  \param [in] address The autoselect address to read from.
+   *  
+   *  \returns The word returned from the device.
+   */
+  word_t                  autoselect_read(address_t address);
   
-  
-private:
-  
-  /*! \brief The currently predicted mode of the chip.
+  /*! \brief Records the mode the chip has been left in.
    *  
-   *  The currently predicted mode the hardware device is in. This value is
-   *  to track the state of the chip and must be actively maintained when
-   *  passing commands that could alter the state of the device. This value is
-   *  initialized to \ref chip_mode::READ.
+   *  Records the mode with \ref linkmasta_device::set_chip_mode() so that
+   *  every object driving the same chip agrees on it.
    *  
-   *  \see chip_mode
+   *  \param [in] mode The mode the chip is now in.
    */
-  chip_mode               m_mode;
+  void                    set_mode(chip_mode mode);
+
+
+
+private:
   
   /*! \brief The address of the last block erased.
    *  
@@ -572,6 +733,25 @@ private:
    */
   address_t               m_last_erased_addr;
   
+  /*! \brief The time at which the last erase command was sent, moved later
+   *         by however long the erase was suspended. */
+  erase_poller::time_point_t m_erase_start;
+  
+  /*! \brief The time at which the erase was last suspended. */
+  erase_poller::time_point_t m_suspend_start;
+  
+  /*! \brief Flag indicating that the last erase command erased the whole chip. */
+  bool                    m_erasing_chip;
+  
+  /*! \brief The history erases are recorded in, or **nullptr** if none.
+   *  
+   *  \see set_erase_history(erase_history* history, const erase_history::chip_key& key)
+   */
+  erase_history*          m_erase_history;
+  
+  /*! \brief The key identifying this chip in \ref m_erase_history. */
+  erase_history::chip_key m_erase_key;
+  
   /*! \brief Boolean indicating whether the chip supports bypass program mode.
    * 
    *  Cached value indicating whether the device supports bypass programming,
@@ -615,6 +795,14 @@ private:
    *  \see select_slot(unsigned int)
    */
   unsigned int            m_slot_index;
+  
+  /*! \brief Whether the device is known to be on \ref m_slot_index.
+   *  
+   *  Cleared when the chip is created, when a slot switch fails, and by
+   *  \ref invalidate_selected_slot(). While set, \ref select_slot(unsigned int)
+   *  skips switching to the slot that's already selected.
+   */
+  bool                    m_slot_known;
 };
 
 #endif /* defined(__WS_ROM_CHIP_H__) */
@@ -32,6 +32,12 @@ ws_sram_chip::ws_sram_chip(linkmasta_device* linkmasta)
   // Nothing else to do
 }
 
+ws_sram_chip::ws_sram_chip(linkmasta_device* linkmasta, chip_index_t chip_num)
+  : m_linkmasta(linkmasta), m_chip_num(chip_num)
+{
+  // Nothing else to do
+}
+
 ws_sram_chip::~ws_sram_chip()
 {
   // Nothing else to do
@@ -62,6 +62,23 @@ public:
    */
                           ws_sram_chip(linkmasta_device* linkmasta);
   
+  /*! \brief Constructor for save storage the linkmasta reaches through
+   *         another chip index.
+   *  
+   *  Initializes members with supplied parameters, for save storage such as
+   *  the EEPROM that games saving to EEPROM use, which is read and written a
+   *  byte at a time like SRAM but through another chip index.
+   *  
+   *  \param[in,out] linkmasta Pointer to the \ref linkmasta_device this chip is
+   *                 to use for communication with the hardware. Must be a
+   *                 pointer to a valid object in memory.
+   *  \param[in] chip_num The chip index the linkmasta reaches the storage
+   *             through, such as \ref wsmsg::TARGET_EEPROM.
+   *  
+   *  \see linkmasta_device
+   */
+                          ws_sram_chip(linkmasta_device* linkmasta, chip_index_t chip_num);
+  
   /*! \brief The destructor for the class.
    *  
    *  Frees dynamically allocated memory and closes any open connections.
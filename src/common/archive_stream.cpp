@@ -0,0 +1,258 @@
+/*! \file
+ *  \brief File containing the implementation of \ref archive_ostream and the
+ *         functions for reading archives.
+ *  
+ *  File containing the implementation of \ref archive_ostream and the
+ *  functions for reading archives.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "archive_stream.h"
+#include <cstring>
+#include <stdexcept>
+
+#define ARCHIVE_MAGIC      "FMZ1"
+#define ARCHIVE_MAGIC_SIZE 4
+
+// Control bytes below this value start a run of that many plus one literal
+// bytes. The rest repeat the following byte MIN_REPEAT or more times
+#define MAX_LITERAL        128
+#define MIN_REPEAT         3
+#define MAX_REPEAT         (256 - MAX_LITERAL + MIN_REPEAT - 1)
+
+static void put_u32(unsigned char* dest, unsigned int value)
+{
+  for (int i = 0; i < 4; ++i)
+  {
+    dest[i] = (unsigned char) (value >> (8 * i));
+  }
+}
+
+static unsigned int get_u32(const unsigned char* src)
+{
+  return (unsigned int) src[0] | ((unsigned int) src[1] << 8)
+    | ((unsigned int) src[2] << 16) | ((unsigned int) src[3] << 24);
+}
+
+// Writes src[start, end) to dest as literal runs, returning the new offset
+static unsigned int pack_literals(const unsigned char* src, unsigned int start, unsigned int end, unsigned char* dest, unsigned int out)
+{
+  while (start < end)
+  {
+    unsigned int count = end - start;
+    if (count > MAX_LITERAL)
+    {
+      count = MAX_LITERAL;
+    }
+    dest[out++] = (unsigned char) (count - 1);
+    memcpy(&dest[out], &src[start], count);
+    out += count;
+    start += count;
+  }
+  return out;
+}
+
+// Compresses a block into dest, which must have room for the worst case of
+// one control byte per MAX_LITERAL bytes. Returns the compressed size
+static unsigned int pack_block(const unsigned char* src, unsigned int num_bytes, unsigned char* dest)
+{
+  unsigned int in = 0;
+  unsigned int out = 0;
+  unsigned int literal_start = 0;
+  
+  while (in < num_bytes)
+  {
+    unsigned int run = 1;
+    while (in + run < num_bytes && run < MAX_REPEAT && src[in + run] == src[in])
+    {
+      ++run;
+    }
+    
+    if (run >= MIN_REPEAT)
+    {
+      out = pack_literals(src, literal_start, in, dest, out);
+      dest[out++] = (unsigned char) (MAX_LITERAL + run - MIN_REPEAT);
+      dest[out++] = src[in];
+      in += run;
+      literal_start = in;
+    }
+    else
+    {
+      in += run;
+    }
+  }
+  
+  return pack_literals(src, literal_start, num_bytes, dest, out);
+}
+
+// Uncompresses a block, returning false if it is malformed
+static bool unpack_block(const unsigned char* src, unsigned int num_bytes, unsigned char* dest, unsigned int dest_size)
+{
+  unsigned int in = 0;
+  unsigned int out = 0;
+  
+  while (in < num_bytes)
+  {
+    unsigned int control = src[in++];
+    if (control < MAX_LITERAL)
+    {
+      unsigned int count = control + 1;
+      if (count > num_bytes - in || count > dest_size - out)
+      {
+        return false;
+      }
+      memcpy(&dest[out], &src[in], count);
+      in += count;
+      out += count;
+    }
+    else
+    {
+      unsigned int count = control - MAX_LITERAL + MIN_REPEAT;
+      if (in >= num_bytes || count > dest_size - out)
+      {
+        return false;
+      }
+      memset(&dest[out], src[in++], count);
+      out += count;
+    }
+  }
+  
+  return out == dest_size;
+}
+
+
+
+archive_streambuf::archive_streambuf(std::ostream& out)
+  : m_out(out)
+{
+  m_block.reserve(ARCHIVE_BLOCK_SIZE);
+  m_packed.resize(8 + ARCHIVE_BLOCK_SIZE + ARCHIVE_BLOCK_SIZE / MAX_LITERAL + 1);
+  m_out.write(ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+}
+
+archive_streambuf::~archive_streambuf()
+{
+  write_block();
+  m_out.flush();
+}
+
+archive_streambuf::int_type archive_streambuf::overflow(int_type ch)
+{
+  if (traits_type::eq_int_type(ch, traits_type::eof()))
+  {
+    return traits_type::not_eof(ch);
+  }
+  
+  char c = traits_type::to_char_type(ch);
+  return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+}
+
+std::streamsize archive_streambuf::xsputn(const char_type* s, std::streamsize count)
+{
+  std::streamsize written = 0;
+  while (written < count)
+  {
+    std::streamsize chunk = ARCHIVE_BLOCK_SIZE - (std::streamsize) m_block.size();
+    if (chunk > count - written)
+    {
+      chunk = count - written;
+    }
+    m_block.insert(m_block.end(), s + written, s + written + chunk);
+    written += chunk;
+    
+    if (m_block.size() == ARCHIVE_BLOCK_SIZE && !write_block())
+    {
+      break;
+    }
+  }
+  return written;
+}
+
+int archive_streambuf::sync()
+{
+  if (!write_block())
+  {
+    return -1;
+  }
+  m_out.flush();
+  return m_out.good() ? 0 : -1;
+}
+
+bool archive_streambuf::write_block()
+{
+  if (m_block.empty())
+  {
+    return m_out.good();
+  }
+  
+  unsigned int packed_size = pack_block((const unsigned char*) m_block.data(), (unsigned int) m_block.size(), &m_packed[8]);
+  put_u32(&m_packed[0], (unsigned int) m_block.size());
+  put_u32(&m_packed[4], packed_size);
+  m_out.write((const char*) m_packed.data(), 8 + packed_size);
+  m_block.clear();
+  return m_out.good();
+}
+
+
+
+archive_ostream::archive_ostream(std::ostream& out)
+  : std::ostream(nullptr), m_buf(out)
+{
+  rdbuf(&m_buf);
+}
+
+
+
+bool is_archive(const unsigned char* data, unsigned int num_bytes)
+{
+  return num_bytes >= ARCHIVE_MAGIC_SIZE && memcmp(data, ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE) == 0;
+}
+
+bool is_archive_path(const std::string& path)
+{
+  static const std::string extension = ARCHIVE_EXTENSION;
+  return path.size() >= extension.size()
+    && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+std::vector<unsigned char> extract_archive(const unsigned char* data, unsigned int num_bytes)
+{
+  if (!is_archive(data, num_bytes))
+  {
+    throw std::runtime_error("Not a compressed archive");
+  }
+  
+  std::vector<unsigned char> result;
+  unsigned int offset = ARCHIVE_MAGIC_SIZE;
+  while (offset < num_bytes)
+  {
+    if (num_bytes - offset < 8)
+    {
+      throw std::runtime_error("Corrupt compressed archive");
+    }
+    unsigned int raw_size = get_u32(&data[offset]);
+    unsigned int packed_size = get_u32(&data[offset + 4]);
+    offset += 8;
+    
+    if (raw_size > ARCHIVE_BLOCK_SIZE || packed_size > num_bytes - offset)
+    {
+      throw std::runtime_error("Corrupt compressed archive");
+    }
+    
+    size_t start = result.size();
+    result.resize(start + raw_size);
+    if (!unpack_block(&data[offset], packed_size, &result[start], raw_size))
+    {
+      throw std::runtime_error("Corrupt compressed archive");
+    }
+    offset += packed_size;
+  }
+  
+  return result;
+}
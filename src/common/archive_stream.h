@@ -0,0 +1,158 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref archive_ostream class
+ *         and functions for reading archives.
+ *  
+ *  File containing the declaration of the \ref archive_ostream class, which
+ *  compresses backups as they are written, along with the functions used to
+ *  recognize and extract compressed archives when they are read back.
+ *  
+ *  An archive starts with the four bytes "FMZ1" and is followed by blocks of
+ *  up to \ref ARCHIVE_BLOCK_SIZE bytes, each stored as its uncompressed size
+ *  and compressed size as 32-bit little-endian values followed by the
+ *  compressed data. Blocks are compressed with a run-length scheme that
+ *  shrinks the long runs of 0xFF found in padded and erased flash to almost
+ *  nothing while never growing other data by more than 1 byte in 128.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __ARCHIVE_STREAM_H__
+#define __ARCHIVE_STREAM_H__
+
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/*! \brief The file extension of compressed archives. */
+#define ARCHIVE_EXTENSION  ".fmz"
+
+/*! \brief The largest number of uncompressed bytes in a single archive block. */
+#define ARCHIVE_BLOCK_SIZE 0x10000
+
+/*! \class archive_streambuf
+ *  \brief Stream buffer that compresses everything written to it.
+ *  
+ *  Stream buffer that collects written data into blocks, compresses each full
+ *  block, and writes it to another output stream. Used through
+ *  \ref archive_ostream.
+ */
+class archive_streambuf : public std::streambuf
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Writes the archive header to the output.
+   *  
+   *  \param [in,out] out The stream to write the archive to.
+   */
+  explicit                archive_streambuf(std::ostream& out);
+  
+  /*!
+   *  \brief Class destructor. Writes any data still buffered.
+   */
+                          ~archive_streambuf();
+  
+  
+  
+protected:
+  
+  /*! \see std::streambuf::overflow(int_type) */
+  int_type                overflow(int_type ch);
+  
+  /*! \see std::streambuf::xsputn(const char_type*, std::streamsize) */
+  std::streamsize         xsputn(const char_type* s, std::streamsize count);
+  
+  /*! \see std::streambuf::sync() */
+  int                     sync();
+  
+  
+  
+private:
+  archive_streambuf(const archive_streambuf& other) = delete;
+  archive_streambuf& operator=(const archive_streambuf& other) = delete;
+  
+  /*!
+   *  \brief Compresses and writes the buffered data as one block.
+   *  
+   *  \return false if writing to the output failed, true otherwise.
+   */
+  bool                    write_block();
+  
+  /*! \brief The stream the archive is written to. */
+  std::ostream&           m_out;
+  
+  /*! \brief Uncompressed data waiting to be written. */
+  std::vector<char>       m_block;
+  
+  /*! \brief Scratch space for the compressed block. */
+  std::vector<unsigned char> m_packed;
+};
+
+/*! \class archive_ostream
+ *  \brief Output stream that compresses everything written to it.
+ *  
+ *  Output stream that writes a compressed archive of everything written to it
+ *  into another stream. The archive is complete once this stream has been
+ *  flushed or destroyed. Compression happens on the thread doing the writing,
+ *  so when used behind a \ref write_pipeline it overlaps reading from the
+ *  cartridge.
+ *  
+ *  Seeking is not supported.
+ */
+class archive_ostream : public std::ostream
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Writes the archive header to the output.
+   *  
+   *  \param [in,out] out The stream to write the archive to. Must outlive this
+   *         stream.
+   */
+  explicit                archive_ostream(std::ostream& out);
+  
+  
+  
+private:
+  
+  /*! \brief The stream buffer doing the compression. */
+  archive_streambuf       m_buf;
+};
+
+
+
+/*!
+ *  \brief Checks whether data is a compressed archive.
+ *  
+ *  \param [in] data The data to check.
+ *  \param [in] num_bytes The number of bytes of data.
+ *  
+ *  \return true if the data starts with the archive header, false otherwise.
+ */
+bool is_archive(const unsigned char* data, unsigned int num_bytes);
+
+/*!
+ *  \brief Checks whether a path names a compressed archive by its extension.
+ *  
+ *  \param [in] path The path to check.
+ *  
+ *  \return true if the path ends in \ref ARCHIVE_EXTENSION, false otherwise.
+ */
+bool is_archive_path(const std::string& path);
+
+/*!
+ *  \brief Extracts the contents of a compressed archive.
+ *  
+ *  \param [in] data The archive, starting with its header.
+ *  \param [in] num_bytes The number of bytes in the archive.
+ *  
+ *  \return The uncompressed contents.
+ *  
+ *  \throws std::runtime_error If the data is not a valid archive.
+ */
+std::vector<unsigned char> extract_archive(const unsigned char* data, unsigned int num_bytes);
+
+#endif /* defined(__ARCHIVE_STREAM_H__) */
@@ -0,0 +1,171 @@
+/*! \file
+ *  \brief File containing the definitions of fast block comparison functions.
+ *  
+ *  File containing the definitions of fast block comparison functions.
+ *  
+ *  See corrensponding header file to view documentation for each function.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-21
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "block_compare.h"
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#define BLOCK_COMPARE_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLOCK_COMPARE_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define BLOCK_COMPARE_NEON
+#include <arm_neon.h>
+#endif
+
+#define BLANK_WORD 0xFFFFFFFFFFFFFFFFull
+
+
+
+// The vector loops only tell us that a chunk differs somewhere; the chunk is
+// then rescanned a byte at a time to find out where. Whatever is left over
+// after the last whole chunk is compared a word at a time, then byte-by-byte.
+
+/*!
+ *  \brief Compares two blocks a word at a time starting at the given offset.
+ */
+static unsigned int scalar_first_difference(const unsigned char* a, const unsigned char* b, unsigned int offset, unsigned int num_bytes)
+{
+  for (; offset + sizeof(uint64_t) <= num_bytes; offset += sizeof(uint64_t))
+  {
+    uint64_t word_a, word_b;
+    memcpy(&word_a, a + offset, sizeof(word_a));
+    memcpy(&word_b, b + offset, sizeof(word_b));
+    if (word_a != word_b)
+    {
+      break;
+    }
+  }
+  
+  for (; offset < num_bytes; ++offset)
+  {
+    if (a[offset] != b[offset])
+    {
+      break;
+    }
+  }
+  
+  return offset;
+}
+
+/*!
+ *  \brief Checks a block for blank bytes a word at a time starting at the
+ *         given offset.
+ */
+static unsigned int scalar_first_not_blank(const unsigned char* data, unsigned int offset, unsigned int num_bytes)
+{
+  for (; offset + sizeof(uint64_t) <= num_bytes; offset += sizeof(uint64_t))
+  {
+    uint64_t word;
+    memcpy(&word, data + offset, sizeof(word));
+    if (word != BLANK_WORD)
+    {
+      break;
+    }
+  }
+  
+  for (; offset < num_bytes; ++offset)
+  {
+    if (data[offset] != 0xFF)
+    {
+      break;
+    }
+  }
+  
+  return offset;
+}
+
+
+
+unsigned int find_first_difference(const unsigned char* a, const unsigned char* b, unsigned int num_bytes)
+{
+  unsigned int offset = 0;
+  
+#if defined(BLOCK_COMPARE_AVX2)
+  for (; offset + 32 <= num_bytes; offset += 32)
+  {
+    __m256i chunk_a = _mm256_loadu_si256((const __m256i*) (a + offset));
+    __m256i chunk_b = _mm256_loadu_si256((const __m256i*) (b + offset));
+    if ((unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk_a, chunk_b)) != 0xFFFFFFFFu)
+    {
+      break;
+    }
+  }
+#elif defined(BLOCK_COMPARE_SSE2)
+  for (; offset + 16 <= num_bytes; offset += 16)
+  {
+    __m128i chunk_a = _mm_loadu_si128((const __m128i*) (a + offset));
+    __m128i chunk_b = _mm_loadu_si128((const __m128i*) (b + offset));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk_a, chunk_b)) != 0xFFFF)
+    {
+      break;
+    }
+  }
+#elif defined(BLOCK_COMPARE_NEON)
+  for (; offset + 16 <= num_bytes; offset += 16)
+  {
+    uint64x2_t diff = vreinterpretq_u64_u8(veorq_u8(vld1q_u8(a + offset), vld1q_u8(b + offset)));
+    if ((vgetq_lane_u64(diff, 0) | vgetq_lane_u64(diff, 1)) != 0)
+    {
+      break;
+    }
+  }
+#endif
+  
+  return scalar_first_difference(a, b, offset, num_bytes);
+}
+
+unsigned int find_first_not_blank(const unsigned char* data, unsigned int num_bytes)
+{
+  unsigned int offset = 0;
+  
+#if defined(BLOCK_COMPARE_AVX2)
+  const __m256i blank = _mm256_set1_epi8((char) 0xFF);
+  for (; offset + 32 <= num_bytes; offset += 32)
+  {
+    __m256i chunk = _mm256_loadu_si256((const __m256i*) (data + offset));
+    if ((unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, blank)) != 0xFFFFFFFFu)
+    {
+      break;
+    }
+  }
+#elif defined(BLOCK_COMPARE_SSE2)
+  const __m128i blank = _mm_set1_epi8((char) 0xFF);
+  for (; offset + 16 <= num_bytes; offset += 16)
+  {
+    __m128i chunk = _mm_loadu_si128((const __m128i*) (data + offset));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, blank)) != 0xFFFF)
+    {
+      break;
+    }
+  }
+#elif defined(BLOCK_COMPARE_NEON)
+  for (; offset + 16 <= num_bytes; offset += 16)
+  {
+    uint64x2_t chunk = vreinterpretq_u64_u8(vld1q_u8(data + offset));
+    if ((vgetq_lane_u64(chunk, 0) & vgetq_lane_u64(chunk, 1)) != BLANK_WORD)
+    {
+      break;
+    }
+  }
+#endif
+  
+  return scalar_first_not_blank(data, offset, num_bytes);
+}
+
+bool is_blank_block(const unsigned char* data, unsigned int num_bytes)
+{
+  return find_first_not_blank(data, num_bytes) == num_bytes;
+}
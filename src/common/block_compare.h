@@ -0,0 +1,55 @@
+/*! \file
+ *  \brief File containing declarations of fast block comparison functions.
+ *  
+ *  File containing declarations of functions for comparing blocks of data and
+ *  checking them for blank (0xFF) bytes. The functions use SSE2, AVX2, or
+ *  NEON instructions when the compiler targets them and fall back to
+ *  word-at-a-time comparisons otherwise.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-21
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __BLOCK_COMPARE_H__
+#define __BLOCK_COMPARE_H__
+
+/*!
+ *  \brief Finds the first offset at which two blocks of data differ.
+ *  
+ *  \param [in] a The first block of data.
+ *  \param [in] b The second block of data.
+ *  \param [in] num_bytes The number of bytes to compare.
+ *  
+ *  \return The offset of the first byte that differs, or **num_bytes** if the
+ *          blocks are identical.
+ */
+unsigned int find_first_difference(const unsigned char* a, const unsigned char* b, unsigned int num_bytes);
+
+/*!
+ *  \brief Finds the first byte in a block of data that is not blank.
+ *  
+ *  Finds the first byte in a block of data that is not 0xFF, the value of
+ *  erased flash memory.
+ *  
+ *  \param [in] data The block of data.
+ *  \param [in] num_bytes The number of bytes to check.
+ *  
+ *  \return The offset of the first byte that is not 0xFF, or **num_bytes** if
+ *          the whole block is blank.
+ */
+unsigned int find_first_not_blank(const unsigned char* data, unsigned int num_bytes);
+
+/*!
+ *  \brief Checks whether every byte in a block of data is blank.
+ *  
+ *  \param [in] data The block of data.
+ *  \param [in] num_bytes The number of bytes to check.
+ *  
+ *  \return true if every byte is 0xFF, false otherwise.
+ *  
+ *  \see find_first_not_blank(const unsigned char*, unsigned int)
+ */
+bool is_blank_block(const unsigned char* data, unsigned int num_bytes);
+
+#endif /* defined(__BLOCK_COMPARE_H__) */
@@ -0,0 +1,204 @@
+/*! \file
+ *  \brief File containing the implementation of \ref buffer_pool.
+ *  
+ *  File containing the implementation of \ref buffer_pool.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see buffer_pool
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "buffer_pool.h"
+#include "memory_budget.h"
+#include <cstdint>
+#include <new>
+
+using namespace std;
+
+buffer_pool::buffer::buffer()
+  : m_pool(nullptr), m_storage(nullptr), m_data(nullptr), m_size(0)
+{
+  // Nothing else to do
+}
+
+buffer_pool::buffer::buffer(buffer_pool* pool, unsigned char* storage, unsigned char* data, unsigned int size)
+  : m_pool(pool), m_storage(storage), m_data(data), m_size(size)
+{
+  // Nothing else to do
+}
+
+buffer_pool::buffer::buffer(buffer&& other)
+  : m_pool(other.m_pool), m_storage(other.m_storage), m_data(other.m_data), m_size(other.m_size)
+{
+  other.m_pool = nullptr;
+  other.m_storage = nullptr;
+  other.m_data = nullptr;
+  other.m_size = 0;
+}
+
+buffer_pool::buffer::~buffer()
+{
+  release();
+}
+
+buffer_pool::buffer& buffer_pool::buffer::operator=(buffer&& other)
+{
+  if (this != &other)
+  {
+    release();
+    m_pool = other.m_pool;
+    m_storage = other.m_storage;
+    m_data = other.m_data;
+    m_size = other.m_size;
+    other.m_pool = nullptr;
+    other.m_storage = nullptr;
+    other.m_data = nullptr;
+    other.m_size = 0;
+  }
+  return *this;
+}
+
+unsigned char* buffer_pool::buffer::data() const
+{
+  return m_data;
+}
+
+unsigned int buffer_pool::buffer::size() const
+{
+  return m_size;
+}
+
+void buffer_pool::buffer::release()
+{
+  if (m_storage != nullptr)
+  {
+    m_pool->give_back(m_storage, m_data, m_size);
+  }
+  m_pool = nullptr;
+  m_storage = nullptr;
+  m_data = nullptr;
+  m_size = 0;
+}
+
+
+
+buffer_pool::buffer_pool(unsigned int max_idle)
+  : m_max_idle(max_idle), m_budget(process_memory_budget()), m_reclaimer_id(0)
+{
+  m_idle.reserve(max_idle);
+  if (m_budget != nullptr)
+  {
+    m_reclaimer_id = m_budget->add_reclaimer([this](unsigned long long num_bytes)
+    {
+      (void) num_bytes;
+      trim();
+    });
+  }
+}
+
+buffer_pool::~buffer_pool()
+{
+  if (m_budget != nullptr)
+  {
+    m_budget->remove_reclaimer(m_reclaimer_id);
+  }
+  trim();
+}
+
+
+
+buffer_pool::buffer buffer_pool::acquire(unsigned int num_bytes)
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    
+    // Hand out the smallest buffer that is big enough so that large buffers
+    // stay available for large requests
+    auto best = m_idle.end();
+    for (auto it = m_idle.begin(); it != m_idle.end(); ++it)
+    {
+      if (it->size >= num_bytes && (best == m_idle.end() || it->size < best->size))
+      {
+        best = it;
+      }
+    }
+    
+    if (best != m_idle.end())
+    {
+      idle_buffer idle = *best;
+      *best = m_idle.back();
+      m_idle.pop_back();
+      return buffer(this, idle.storage, idle.data, idle.size);
+    }
+  }
+  
+  if (m_budget != nullptr)
+  {
+    m_budget->reserve(num_bytes);
+  }
+  
+  // Over-allocate so that the start can be moved up to the next alignment
+  // boundary
+  unsigned char* storage = nullptr;
+  try
+  {
+    storage = new unsigned char[num_bytes + BUFFER_POOL_ALIGNMENT - 1];
+  }
+  catch (std::bad_alloc& ex)
+  {
+    (void) ex;
+    if (m_budget != nullptr)
+    {
+      m_budget->release(num_bytes);
+    }
+    throw;
+  }
+  uintptr_t address = (uintptr_t) storage;
+  unsigned char* data = storage + ((BUFFER_POOL_ALIGNMENT - address % BUFFER_POOL_ALIGNMENT) % BUFFER_POOL_ALIGNMENT);
+  return buffer(this, storage, data, num_bytes);
+}
+
+void buffer_pool::trim()
+{
+  unsigned long long num_bytes = 0;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (const idle_buffer& idle : m_idle)
+    {
+      num_bytes += idle.size;
+      delete [] idle.storage;
+    }
+    m_idle.clear();
+  }
+  
+  if (m_budget != nullptr && num_bytes > 0)
+  {
+    m_budget->release(num_bytes);
+  }
+}
+
+
+
+void buffer_pool::give_back(unsigned char* storage, unsigned char* data, unsigned int size)
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    if (m_idle.size() < m_max_idle)
+    {
+      idle_buffer idle = {storage, data, size};
+      m_idle.push_back(idle);
+      return;
+    }
+  }
+  
+  delete [] storage;
+  if (m_budget != nullptr)
+  {
+    m_budget->release(size);
+  }
+}
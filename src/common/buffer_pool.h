@@ -0,0 +1,204 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref buffer_pool class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref buffer_pool class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __BUFFER_POOL_H__
+#define __BUFFER_POOL_H__
+
+#include <mutex>
+#include <vector>
+
+class memory_budget;
+
+/*! \brief The alignment in bytes of every buffer handed out by a pool. */
+#define BUFFER_POOL_ALIGNMENT 64
+
+/*! \brief The default number of unused buffers a pool holds on to. */
+#define BUFFER_POOL_MAX_IDLE  8
+
+/*! \class buffer_pool
+ *  \brief Class that hands out reusable, aligned scratch buffers.
+ *  
+ *  Class that hands out scratch buffers aligned to
+ *  \ref BUFFER_POOL_ALIGNMENT bytes and takes them back when they are no
+ *  longer needed, so that a batch of operations on the same device reuses the
+ *  same few buffers instead of allocating new ones for every backup, restore,
+ *  and compare.
+ *  
+ *  Buffers are handed out as \ref buffer_pool::buffer objects that return
+ *  themselves to the pool when destroyed. A pool must outlive every buffer it
+ *  hands out.
+ *  
+ *  If a \ref process_memory_budget() is set when the pool is made, every
+ *  buffer the pool allocates, whether in use or idle, is charged to it. A
+ *  new buffer waits for the budget, holding up whoever needs it, and idle
+ *  buffers are freed whenever the budget runs out.
+ *  
+ *  This class is thread-safe.
+ */
+class buffer_pool
+{
+public:
+  
+  /*! \class buffer
+   *  \brief A scratch buffer borrowed from a \ref buffer_pool.
+   *  
+   *  A scratch buffer borrowed from a \ref buffer_pool, returned to it when
+   *  this object is destroyed or \ref release() is called. Can be moved but
+   *  not copied. A default-constructed buffer holds no memory.
+   */
+  class buffer
+  {
+  public:
+    
+    /*!
+     *  \brief Constructs an empty buffer that holds no memory.
+     */
+                          buffer();
+    
+    /*!
+     *  \brief Move constructor. Leaves **other** empty.
+     */
+                          buffer(buffer&& other);
+    
+    /*!
+     *  \brief Class destructor. Returns the memory to its pool.
+     */
+                          ~buffer();
+    
+    /*!
+     *  \brief Move assignment operator. Returns any memory held by this
+     *         buffer to its pool and leaves **other** empty.
+     */
+    buffer&               operator=(buffer&& other);
+    
+    /*!
+     *  \brief Gets a pointer to the start of the buffer, or nullptr if the
+     *         buffer is empty.
+     */
+    unsigned char*        data() const;
+    
+    /*!
+     *  \brief Gets the number of usable bytes in the buffer, which may be more
+     *         than were asked for.
+     */
+    unsigned int          size() const;
+    
+    /*!
+     *  \brief Returns the memory to its pool early, leaving this buffer empty.
+     */
+    void                  release();
+    
+    
+    
+  private:
+    friend class buffer_pool;
+    
+    buffer(const buffer& other) = delete;
+    buffer& operator=(const buffer& other) = delete;
+    
+    /*!
+     *  \brief Constructs a buffer holding memory from a pool.
+     */
+                          buffer(buffer_pool* pool, unsigned char* storage, unsigned char* data, unsigned int size);
+    
+    /*! \brief The pool the memory came from. */
+    buffer_pool*          m_pool;
+    
+    /*! \brief The memory as it was allocated. */
+    unsigned char*        m_storage;
+    
+    /*! \brief The aligned start of the memory. */
+    unsigned char*        m_data;
+    
+    /*! \brief The number of usable bytes from \ref m_data. */
+    unsigned int          m_size;
+  };
+  
+  
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in] max_idle The largest number of unused buffers to hold on to.
+   *         Buffers returned beyond this are freed.
+   */
+  explicit                buffer_pool(unsigned int max_idle = BUFFER_POOL_MAX_IDLE);
+  
+  /*!
+   *  \brief Class destructor. Frees every unused buffer.
+   *  
+   *  Every buffer handed out must have been returned by now.
+   */
+                          ~buffer_pool();
+  
+  
+  
+  /*!
+   *  \brief Borrows a buffer of at least the given size.
+   *  
+   *  Hands out the smallest unused buffer that is big enough, or allocates a
+   *  new one if there is none.
+   *  
+   *  \param [in] num_bytes The number of bytes needed.
+   *  
+   *  \return The borrowed buffer.
+   *  
+   *  \throws std::bad_alloc If a new buffer could not be allocated.
+   */
+  buffer                  acquire(unsigned int num_bytes);
+  
+  /*!
+   *  \brief Frees every unused buffer.
+   */
+  void                    trim();
+  
+  
+  
+private:
+  
+  /*! \brief Disabled copy constructor. */
+                          buffer_pool(const buffer_pool& other) = delete;
+  
+  /*! \brief Disabled copy assignment operator. */
+  buffer_pool&            operator=(const buffer_pool& other) = delete;
+  
+  /*!
+   *  \brief Takes back memory from a buffer that is no longer needed.
+   */
+  void                    give_back(unsigned char* storage, unsigned char* data, unsigned int size);
+  
+  /*! \brief An unused buffer waiting to be handed out. */
+  struct idle_buffer
+  {
+    unsigned char*        storage;
+    unsigned char*        data;
+    unsigned int          size;
+  };
+  
+  
+  
+  /*! \brief The largest number of unused buffers to hold on to. */
+  const unsigned int      m_max_idle;
+  
+  /*! \brief The unused buffers. */
+  std::vector<idle_buffer> m_idle;
+  
+  /*! \brief Mutex guarding \ref m_idle. */
+  std::mutex              m_mutex;
+  
+  /*! \brief The budget buffers are charged to, or **nullptr** if none. */
+  memory_budget* const    m_budget;
+  
+  /*! \brief The ID of the reclaimer trimming the pool for \ref m_budget. */
+  unsigned int            m_reclaimer_id;
+};
+
+#endif /* defined(__BUFFER_POOL_H__) */
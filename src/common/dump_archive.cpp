@@ -0,0 +1,429 @@
+/*! \file
+ *  \brief File containing the implementations of \ref dump_archive and
+ *         \ref dump_archive_writer.
+ *  
+ *  File containing the implementations of \ref dump_archive and
+ *  \ref dump_archive_writer.
+ *  
+ *  See corrensponding header file to view documentation for classes, their
+ *  methods, and their member variables.
+ *  
+ *  \see dump_archive
+ *  \see dump_archive_writer
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-01
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "dump_archive.h"
+#include "dump_store.h"
+#include "file_util.h"
+#include "hash_stream.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+// First bytes of every archive
+#define ARCHIVE_MAGIC      "fmda1\n"
+#define ARCHIVE_MAGIC_SIZE (sizeof(ARCHIVE_MAGIC) - 1)
+
+// Start of the line written in front of each dump, and of the index
+#define ENTRY_TAG          "fmde"
+#define INDEX_TAG          "fmdx1"
+
+// Last bytes of every archive, after the offset, size, and CRC32 of the index
+#define TRAILER_MAGIC      "FMDX"
+#define TRAILER_SIZE       20
+
+// Largest line in front of a dump worth reading when walking the dumps
+#define MAX_ENTRY_LINE     4096
+
+// Largest index worth reading
+#define MAX_INDEX_SIZE     0x4000000
+
+using namespace std;
+
+
+
+// Keeps characters that separate fields out of IDs and metadata
+static string field_text(string text)
+{
+  for (char& c : text)
+  {
+    if (c == '\t' || c == '\n' || c == '\r')
+    {
+      c = ' ';
+    }
+  }
+  return text;
+}
+
+static void put_little_endian(unsigned char* out, unsigned long long value, unsigned int num_bytes)
+{
+  for (unsigned int i = 0; i < num_bytes; ++i)
+  {
+    out[i] = (unsigned char) (value >> (8 * i));
+  }
+}
+
+static unsigned long long get_little_endian(const unsigned char* in, unsigned int num_bytes)
+{
+  unsigned long long value = 0;
+  for (unsigned int i = num_bytes; i > 0; --i)
+  {
+    value = (value << 8) | in[i - 1];
+  }
+  return value;
+}
+
+// Adds a dump to a list, in place of any earlier one with the same ID
+static void put_entry(vector<dump_archive::entry>& entries, map<string, size_t>& ids, const dump_archive::entry& e)
+{
+  auto it = ids.find(e.id);
+  if (it != ids.end())
+  {
+    entries[it->second] = e;
+  }
+  else
+  {
+    ids[e.id] = entries.size();
+    entries.push_back(e);
+  }
+}
+
+static mutex& writer_mutex()
+{
+  static mutex writers;
+  return writers;
+}
+
+// Reads the index the trailer points to, if it is intact
+static bool read_index(istream& fin, unsigned long long file_size, vector<dump_archive::entry>& entries, unsigned long long& end)
+{
+  if (file_size < ARCHIVE_MAGIC_SIZE + TRAILER_SIZE)
+  {
+    return false;
+  }
+  
+  unsigned char trailer[TRAILER_SIZE];
+  fin.clear();
+  fin.seekg(file_size - TRAILER_SIZE);
+  if (!fin.read((char*) trailer, TRAILER_SIZE)
+      || string((const char*) trailer + 16, 4) != TRAILER_MAGIC)
+  {
+    return false;
+  }
+  unsigned long long index_offset = get_little_endian(trailer, 8);
+  unsigned long long index_size = get_little_endian(trailer + 8, 4);
+  unsigned int index_crc = (unsigned int) get_little_endian(trailer + 12, 4);
+  if (index_offset < ARCHIVE_MAGIC_SIZE || index_size > MAX_INDEX_SIZE
+      || index_offset + index_size != file_size - TRAILER_SIZE)
+  {
+    return false;
+  }
+  
+  string index((size_t) index_size, '\0');
+  fin.seekg(index_offset);
+  if (!fin.read(&index[0], index.size())
+      || crc32_data((const unsigned char*) index.data(), (unsigned int) index.size()) != index_crc)
+  {
+    return false;
+  }
+  
+  istringstream lines(index);
+  string line;
+  getline(lines, line);
+  vector<string> header = split_fields(line);
+  unsigned long long count = 0;
+  if (header.size() != 2 || header[0] != INDEX_TAG || !parse_number(header[1], count))
+  {
+    return false;
+  }
+  
+  vector<dump_archive::entry> listed;
+  map<string, size_t> ids;
+  while (getline(lines, line) && !line.empty())
+  {
+    vector<string> fields = split_fields(line);
+    unsigned long long offset = 0;
+    unsigned long long size = 0;
+    if (fields.size() != 5 || !parse_number(fields[2], offset) || !parse_number(fields[3], size)
+        || size > 0xFFFFFFFFULL || offset + size > index_offset)
+    {
+      return false;
+    }
+    dump_archive::entry e = {fields[0], fields[1], offset, (unsigned int) size, fields[4]};
+    put_entry(listed, ids, e);
+  }
+  if (listed.size() != count)
+  {
+    return false;
+  }
+  
+  entries.swap(listed);
+  end = index_offset;
+  return true;
+}
+
+// Finds the dumps by the lines in front of each, keeping the ones that were
+// written completely
+static unsigned long long walk_entries(istream& fin, unsigned long long file_size, vector<dump_archive::entry>& entries)
+{
+  map<string, size_t> ids;
+  unsigned long long position = ARCHIVE_MAGIC_SIZE;
+  while (position < file_size)
+  {
+    fin.clear();
+    fin.seekg(position);
+    string line;
+    char c = '\0';
+    while (line.size() < MAX_ENTRY_LINE && fin.get(c) && c != '\n')
+    {
+      line += c;
+    }
+    if (c != '\n')
+    {
+      break;
+    }
+    
+    vector<string> fields = split_fields(line);
+    unsigned long long size = 0;
+    if (fields.size() != 5 || fields[0] != ENTRY_TAG || !parse_number(fields[3], size)
+        || size > 0xFFFFFFFFULL)
+    {
+      break;
+    }
+    unsigned long long offset = position + line.size() + 1;
+    if (offset + size > file_size)
+    {
+      break;
+    }
+    
+    string data((size_t) size, '\0');
+    if (size > 0 && !fin.read(&data[0], data.size()))
+    {
+      break;
+    }
+    if (dump_store::sha256((const unsigned char*) data.data(), (unsigned int) data.size()) != fields[2])
+    {
+      break;
+    }
+    
+    dump_archive::entry e = {fields[1], fields[2], offset, (unsigned int) size, fields[4]};
+    put_entry(entries, ids, e);
+    position = offset + size;
+  }
+  return position;
+}
+
+
+
+bool dump_archive::is_member_path(const std::string& path)
+{
+  string archive_path;
+  string id;
+  return split_member_path(path, archive_path, id);
+}
+
+bool dump_archive::split_member_path(const std::string& path, std::string& archive_path, std::string& id)
+{
+  static const string marker = string(DUMP_ARCHIVE_EXTENSION) + DUMP_ARCHIVE_MEMBER_SEPARATOR;
+  size_t found = path.rfind(marker);
+  if (found == string::npos || found + marker.size() == path.size())
+  {
+    return false;
+  }
+  archive_path = path.substr(0, found + marker.size() - 1);
+  id = path.substr(found + marker.size());
+  return true;
+}
+
+std::string dump_archive::member_path(const std::string& archive_path, const std::string& id)
+{
+  return archive_path + DUMP_ARCHIVE_MEMBER_SEPARATOR + id;
+}
+
+
+
+dump_archive::dump_archive(const std::string& path)
+  : m_path(path)
+{
+  ifstream fin(path.c_str(), ios::binary);
+  if (!fin.is_open())
+  {
+    throw std::runtime_error("Unable to open file " + path);
+  }
+  
+  load(fin, path, m_entries);
+  for (size_t i = 0; i < m_entries.size(); ++i)
+  {
+    m_ids[m_entries[i].id] = i;
+  }
+}
+
+
+
+const std::string& dump_archive::path() const
+{
+  return m_path;
+}
+
+const std::vector<dump_archive::entry>& dump_archive::entries() const
+{
+  return m_entries;
+}
+
+const dump_archive::entry* dump_archive::find(const std::string& id) const
+{
+  auto it = m_ids.find(id);
+  return (it == m_ids.end() ? nullptr : &m_entries[it->second]);
+}
+
+
+
+unsigned long long dump_archive::load(std::istream& fin, const std::string& path, std::vector<entry>& entries)
+{
+  fin.clear();
+  fin.seekg(0, ios::end);
+  unsigned long long file_size = (unsigned long long) fin.tellg();
+  
+  char magic[ARCHIVE_MAGIC_SIZE];
+  fin.seekg(0);
+  if (file_size < ARCHIVE_MAGIC_SIZE || !fin.read(magic, ARCHIVE_MAGIC_SIZE)
+      || string(magic, ARCHIVE_MAGIC_SIZE) != ARCHIVE_MAGIC)
+  {
+    throw std::runtime_error("Not a dump archive: " + path);
+  }
+  
+  entries.clear();
+  unsigned long long end = 0;
+  if (!read_index(fin, file_size, entries, end))
+  {
+    end = walk_entries(fin, file_size, entries);
+  }
+  fin.clear();
+  return end;
+}
+
+
+
+dump_archive_writer::dump_archive_writer(const std::string& path)
+  : m_lock(writer_mutex()), m_path(path), m_end(ARCHIVE_MAGIC_SIZE), m_file_size(0), m_dirty(false)
+{
+  m_file.open(path.c_str(), ios::binary | ios::in | ios::out);
+  if (!m_file.is_open())
+  {
+    // Create the archive, then open it for reading as well
+    ofstream created(path.c_str(), ios::binary | ios::out | ios::trunc);
+    created.write(ARCHIVE_MAGIC, ARCHIVE_MAGIC_SIZE);
+    created.close();
+    if (!created)
+    {
+      throw std::runtime_error("Unable to create file " + path);
+    }
+    m_file.open(path.c_str(), ios::binary | ios::in | ios::out);
+    if (!m_file.is_open())
+    {
+      throw std::runtime_error("Unable to open file " + path);
+    }
+  }
+  
+  m_end = dump_archive::load(m_file, path, m_entries);
+  for (size_t i = 0; i < m_entries.size(); ++i)
+  {
+    m_ids[m_entries[i].id] = i;
+  }
+  m_file.seekg(0, ios::end);
+  m_file_size = (unsigned long long) m_file.tellg();
+}
+
+dump_archive_writer::~dump_archive_writer()
+{
+  if (m_dirty)
+  {
+    try
+    {
+      commit();
+    }
+    catch (std::exception& ex)
+    {
+      // The dumps are found again by walking them the next time
+      (void) ex;
+    }
+  }
+}
+
+
+
+dump_archive::entry dump_archive_writer::add(const std::string& id, const unsigned char* data, unsigned int num_bytes, const std::string& metadata)
+{
+  if (id.empty())
+  {
+    throw std::invalid_argument("Dumps in an archive need an ID");
+  }
+  
+  dump_archive::entry e;
+  e.id = field_text(id);
+  e.sha256 = dump_store::sha256(data, num_bytes);
+  e.size = num_bytes;
+  e.metadata = field_text(metadata);
+  
+  string line = string(ENTRY_TAG) + "\t" + e.id + "\t" + e.sha256 + "\t" + to_string(e.size) + "\t" + e.metadata + "\n";
+  e.offset = m_end + line.size();
+  
+  // Goes over the index, which is written again after the dump
+  m_dirty = true;
+  m_file.seekp(m_end);
+  m_file.write(line.data(), line.size());
+  m_file.write((const char*) data, num_bytes);
+  if (!m_file)
+  {
+    m_file.clear();
+    throw std::runtime_error("Unable to write to file " + m_path);
+  }
+  
+  m_end = e.offset + num_bytes;
+  m_file_size = max(m_file_size, m_end);
+  put_entry(m_entries, m_ids, e);
+  return e;
+}
+
+void dump_archive_writer::commit()
+{
+  ostringstream index;
+  index << INDEX_TAG << "\t" << m_entries.size() << "\n";
+  for (const dump_archive::entry& e : m_entries)
+  {
+    index << e.id << "\t" << e.sha256 << "\t" << e.offset << "\t" << e.size << "\t" << e.metadata << "\n";
+  }
+  string text = index.str();
+  
+  // The trailer has to end the file, so pad out whatever is left of a longer
+  // index written before
+  if (m_end + text.size() + TRAILER_SIZE < m_file_size)
+  {
+    text.append((size_t) (m_file_size - m_end - text.size() - TRAILER_SIZE), '\n');
+  }
+  
+  unsigned char trailer[TRAILER_SIZE];
+  put_little_endian(trailer, m_end, 8);
+  put_little_endian(trailer + 8, text.size(), 4);
+  put_little_endian(trailer + 12, crc32_data((const unsigned char*) text.data(), (unsigned int) text.size()), 4);
+  copy(TRAILER_MAGIC, TRAILER_MAGIC + 4, trailer + 16);
+  
+  m_file.seekp(m_end);
+  m_file.write(text.data(), text.size());
+  m_file.write((const char*) trailer, TRAILER_SIZE);
+  m_file.flush();
+  if (!m_file)
+  {
+    m_file.clear();
+    throw std::runtime_error("Unable to write the index of " + m_path);
+  }
+  
+  m_file_size = max(m_file_size, m_end + text.size() + TRAILER_SIZE);
+  m_dirty = false;
+}
@@ -0,0 +1,269 @@
+/*! \file
+ *  \brief File containing the declarations of the \ref dump_archive and
+ *         \ref dump_archive_writer classes.
+ *  
+ *  File containing the header information and declarations of the
+ *  \ref dump_archive and \ref dump_archive_writer classes.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-01
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __DUMP_ARCHIVE_H__
+#define __DUMP_ARCHIVE_H__
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*! \brief Extension of the files holding many dumps. */
+#define DUMP_ARCHIVE_EXTENSION ".fmda"
+
+/*! \brief Character separating the path of an archive from the ID of one of
+ *         its dumps in a member path. */
+#define DUMP_ARCHIVE_MEMBER_SEPARATOR '#'
+
+/*! \class dump_archive
+ *  \brief Class reading the index of a file holding many dumps.
+ *  
+ *  Class listing the dumps kept in a single archive file written by
+ *  \ref dump_archive_writer, so that thousands of small dumps such as save
+ *  files don't each cost a file of their own. Every dump is stored whole and
+ *  uncompressed, one after the other, and the file ends with an index giving
+ *  the ID, SHA-256 digest, offset, size, and metadata of each, so that a scan
+ *  of the library reads a single small block of the file.
+ *  
+ *  A dump in an archive is named with a member path made of the path of the
+ *  archive, a \ref DUMP_ARCHIVE_MEMBER_SEPARATOR, and its ID, such as
+ *  **saves.fmda#Pocket Tennis**. \ref mapped_file maps just the part of the
+ *  archive holding the dump when given such a path, so restores read it
+ *  without copying.
+ *  
+ *  If writing the index was interrupted, the dumps are found again by
+ *  walking the headers written in front of each.
+ */
+class dump_archive
+{
+public:
+  
+  /*!
+   *  \brief Struct describing a single dump in an archive.
+   */
+  struct entry
+  {
+    /*! \brief The ID of the dump, unique within the archive. */
+    std::string           id;
+    
+    /*! \brief The hexadecimal SHA-256 digest of the dump. */
+    std::string           sha256;
+    
+    /*! \brief The offset of the first byte of the dump in the archive. */
+    unsigned long long    offset;
+    
+    /*! \brief The size of the dump in bytes. */
+    unsigned int          size;
+    
+    /*! \brief Free-form text describing the dump, such as the system it was
+     *         backed up from. */
+    std::string           metadata;
+  };
+  
+  
+  
+  /*!
+   *  \brief Determines whether a path names a dump inside an archive.
+   *  
+   *  \param [in] path The path.
+   */
+  static bool             is_member_path(const std::string& path);
+  
+  /*!
+   *  \brief Splits a member path into the path of the archive and the ID of
+   *         the dump.
+   *  
+   *  \param [in] path The member path.
+   *  \param [out] archive_path Set to the path of the archive.
+   *  \param [out] id Set to the ID of the dump.
+   *  
+   *  \return true if the path is a member path, false otherwise.
+   */
+  static bool             split_member_path(const std::string& path, std::string& archive_path, std::string& id);
+  
+  /*!
+   *  \brief Builds the member path of a dump inside an archive.
+   *  
+   *  \param [in] archive_path The path of the archive.
+   *  \param [in] id The ID of the dump.
+   */
+  static std::string      member_path(const std::string& archive_path, const std::string& id);
+  
+  
+  
+  /*!
+   *  \brief Class constructor. Reads the index of an archive.
+   *  
+   *  \param [in] path The path of the archive.
+   *  
+   *  \throws std::runtime_error If the file could not be opened or isn't an
+   *          archive.
+   */
+  explicit                dump_archive(const std::string& path);
+  
+  
+  
+  /*!
+   *  \brief Gets the path of the archive.
+   */
+  const std::string&      path() const;
+  
+  /*!
+   *  \brief Gets every dump in the archive, in the order they were first
+   *         added.
+   */
+  const std::vector<entry>& entries() const;
+  
+  /*!
+   *  \brief Looks up a dump by ID.
+   *  
+   *  \param [in] id The ID of the dump.
+   *  
+   *  \return The dump, or **nullptr** if the archive holds none with the ID.
+   */
+  const entry*            find(const std::string& id) const;
+
+
+
+private:
+  friend class dump_archive_writer;
+  
+  /*!
+   *  \brief Reads the index from an open archive, or walks the dumps if the
+   *         index is missing or damaged.
+   *  
+   *  \param [in,out] fin The archive.
+   *  \param [in] path The path of the archive, for errors.
+   *  \param [out] entries Filled with the dumps in the archive.
+   *  
+   *  \return The offset just past the last dump, where the next one goes.
+   *  
+   *  \throws std::runtime_error If the file isn't an archive.
+   */
+  static unsigned long long load(std::istream& fin, const std::string& path, std::vector<entry>& entries);
+  
+  
+  
+  /*! \brief The path of the archive. */
+  const std::string       m_path;
+  
+  /*! \brief Every dump in the archive. */
+  std::vector<entry>      m_entries;
+  
+  /*! \brief The position of each dump in \ref m_entries, by ID. */
+  std::map<std::string, size_t> m_ids;
+};
+
+
+
+/*! \class dump_archive_writer
+ *  \brief Class adding dumps to an archive.
+ *  
+ *  Class appending dumps to the end of an archive read by \ref dump_archive,
+ *  creating it if needed. Dumps already in the archive are never moved or
+ *  overwritten, so mappings of them stay valid. Adding a dump with the ID of
+ *  one already there replaces it in the index, and the old copy is left
+ *  unused.
+ *  
+ *  The index is written over the previous one once every dump has been
+ *  added, when \ref commit() is called or the writer is destroyed. Only one
+ *  writer is open at a time in the process, so backups finishing together
+ *  take turns.
+ */
+class dump_archive_writer
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Opens an archive for adding dumps, creating
+   *         it if it doesn't exist.
+   *  
+   *  \param [in] path The path of the archive.
+   *  
+   *  \throws std::runtime_error If the file could not be opened or created,
+   *          or exists and isn't an archive.
+   */
+  explicit                dump_archive_writer(const std::string& path);
+  
+  /*!
+   *  \brief Class destructor. Writes the index if any dump was added since
+   *         the last \ref commit().
+   */
+                          ~dump_archive_writer();
+  
+  
+  
+  /*!
+   *  \brief Adds a dump to the end of the archive.
+   *  
+   *  \param [in] id The ID of the dump. Tabs and line breaks are replaced
+   *         with spaces.
+   *  \param [in] data Pointer to the dump.
+   *  \param [in] num_bytes The size of the dump in bytes.
+   *  \param [in] metadata Text describing the dump. Tabs and line breaks are
+   *         replaced with spaces.
+   *  
+   *  \return The dump as it will be listed in the index.
+   *  
+   *  \throws std::invalid_argument If the ID is empty.
+   *  \throws std::runtime_error If the dump could not be written.
+   */
+  dump_archive::entry     add(const std::string& id, const unsigned char* data, unsigned int num_bytes, const std::string& metadata = std::string());
+  
+  /*!
+   *  \brief Writes the index, making every dump added so far visible to
+   *         readers.
+   *  
+   *  \throws std::runtime_error If the index could not be written.
+   */
+  void                    commit();
+
+
+
+private:
+  
+  /*! \brief Disabled copy constructor. */
+                          dump_archive_writer(const dump_archive_writer& other) = delete;
+  
+  /*! \brief Disabled copy assignment operator. */
+  dump_archive_writer&    operator=(const dump_archive_writer& other) = delete;
+  
+  
+  
+  /*! \brief Lock keeping other writers out while this one is open. */
+  std::unique_lock<std::mutex> m_lock;
+  
+  /*! \brief The path of the archive. */
+  const std::string       m_path;
+  
+  /*! \brief The open archive. */
+  std::fstream            m_file;
+  
+  /*! \brief Every dump in the archive, including the ones added. */
+  std::vector<dump_archive::entry> m_entries;
+  
+  /*! \brief The position of each dump in \ref m_entries, by ID. */
+  std::map<std::string, size_t> m_ids;
+  
+  /*! \brief The offset just past the last dump, where the next one goes. */
+  unsigned long long      m_end;
+  
+  /*! \brief The size of the file. */
+  unsigned long long      m_file_size;
+  
+  /*! \brief Whether dumps were added since the index was last written. */
+  bool                    m_dirty;
+};
+
+#endif /* defined(__DUMP_ARCHIVE_H__) */
@@ -0,0 +1,341 @@
+/*! \file
+ *  \brief File containing the implementation of \ref dump_store.
+ *  
+ *  File containing the implementation of \ref dump_store.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see dump_store
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "dump_store.h"
+#include "file_util.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#define REFERENCE_MAGIC    "fmref1"
+#define STORED_EXTENSION   ".bin"
+#define TEMP_EXTENSION     ".tmp"
+
+// References are tiny, so anything larger can't be one
+#define MAX_REFERENCE_SIZE 4096
+
+using namespace std;
+
+static const unsigned int sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline unsigned int rotr(unsigned int x, unsigned int n)
+{
+  return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_block(unsigned int state[8], const unsigned char* block)
+{
+  unsigned int w[64];
+  for (int i = 0; i < 16; ++i)
+  {
+    w[i] = ((unsigned int) block[i * 4] << 24) | ((unsigned int) block[i * 4 + 1] << 16)
+      | ((unsigned int) block[i * 4 + 2] << 8) | (unsigned int) block[i * 4 + 3];
+  }
+  for (int i = 16; i < 64; ++i)
+  {
+    unsigned int s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    unsigned int s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  
+  unsigned int a = state[0], b = state[1], c = state[2], d = state[3];
+  unsigned int e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; ++i)
+  {
+    unsigned int t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+    unsigned int t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+  state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static string read_file(const string& path, size_t max_size = (size_t) -1)
+{
+  ifstream fin(path.c_str(), ios::binary);
+  if (!fin.is_open())
+  {
+    throw std::runtime_error("Unable to open file " + path);
+  }
+  
+  fin.seekg(0, ios::end);
+  streamoff size = fin.tellg();
+  fin.seekg(0, ios::beg);
+  if (size < 0 || (unsigned long long) size > max_size)
+  {
+    return string();
+  }
+  
+  string contents((size_t) size, '\0');
+  fin.read(&contents[0], size);
+  if (fin.gcount() != size)
+  {
+    throw std::runtime_error("Unable to read file " + path);
+  }
+  return contents;
+}
+
+static void write_file(const string& path, const string& contents)
+{
+  ofstream fout(path.c_str(), ios::binary | ios::out | ios::trunc);
+  fout.write(contents.data(), contents.size());
+  fout.close();
+  if (!fout)
+  {
+    remove(path.c_str());
+    throw std::runtime_error("Unable to write file " + path);
+  }
+}
+
+
+
+dump_store::dump_store(const std::string& directory)
+  : m_directory(directory)
+{
+  // Nothing else to do
+}
+
+
+
+const std::string& dump_store::directory() const
+{
+  return m_directory;
+}
+
+std::string dump_store::path_for(const std::string& digest) const
+{
+  return m_directory + "/" + digest + STORED_EXTENSION;
+}
+
+bool dump_store::contains(const std::string& digest) const
+{
+  return ifstream(path_for(digest).c_str(), ios::binary).is_open();
+}
+
+std::string dump_store::add(const std::string& path)
+{
+  string digest;
+  string target;
+  if (read_reference(path, digest, target))
+  {
+    return digest;
+  }
+  
+  string contents = read_file(path);
+  digest = sha256((const unsigned char*) contents.data(), (unsigned int) contents.size());
+  string stored_path = path_for(digest);
+  
+  lock_guard<mutex> lock(m_mutex);
+  if (!contains(digest))
+  {
+    // Store a copy under a temporary name first so that an interrupted copy
+    // is never mistaken for a complete one
+    if (rename(path.c_str(), stored_path.c_str()) != 0)
+    {
+      write_file(stored_path + TEMP_EXTENSION, contents);
+      if (!replace_file(stored_path + TEMP_EXTENSION, stored_path))
+      {
+        remove((stored_path + TEMP_EXTENSION).c_str());
+        throw std::runtime_error("Unable to store file " + path);
+      }
+    }
+  }
+  
+  stringstream reference;
+  reference << REFERENCE_MAGIC << "\n" << digest << " " << contents.size() << "\n" << stored_path << "\n";
+  write_file(path + TEMP_EXTENSION, reference.str());
+  if (!replace_file(path + TEMP_EXTENSION, path))
+  {
+    remove((path + TEMP_EXTENSION).c_str());
+    throw std::runtime_error("Unable to replace file " + path);
+  }
+  
+  return digest;
+}
+
+std::string dump_store::add_data(const unsigned char* data, unsigned int num_bytes)
+{
+  string digest = sha256(data, num_bytes);
+  string stored_path = path_for(digest);
+  
+  lock_guard<mutex> lock(m_mutex);
+  if (!contains(digest))
+  {
+    write_file(stored_path + TEMP_EXTENSION, string((const char*) data, num_bytes));
+    if (!replace_file(stored_path + TEMP_EXTENSION, stored_path))
+    {
+      remove((stored_path + TEMP_EXTENSION).c_str());
+      throw std::runtime_error("Unable to store file " + stored_path);
+    }
+  }
+  return digest;
+}
+
+std::vector<unsigned char> dump_store::read(const std::string& digest) const
+{
+  string contents = read_file(path_for(digest));
+  return vector<unsigned char>(contents.begin(), contents.end());
+}
+
+std::vector<std::string> dump_store::digests() const
+{
+  // Anything that isn't named like a stored file, such as a copy cut off
+  // while being stored, is left out
+  vector<string> names;
+#ifdef _WIN32
+  WIN32_FIND_DATAA data;
+  HANDLE find = FindFirstFileA((m_directory + "\\*" STORED_EXTENSION).c_str(), &data);
+  if (find != INVALID_HANDLE_VALUE)
+  {
+    do
+    {
+      names.push_back(data.cFileName);
+    }
+    while (FindNextFileA(find, &data));
+    FindClose(find);
+  }
+#else
+  DIR* dir = opendir(m_directory.c_str());
+  if (dir != nullptr)
+  {
+    for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+      names.push_back(entry->d_name);
+    }
+    closedir(dir);
+  }
+#endif
+  
+  static const string extension = STORED_EXTENSION;
+  vector<string> found;
+  for (const string& name : names)
+  {
+    if (name.size() == 64 + extension.size() && name.compare(64, extension.size(), extension) == 0
+        && name.find_first_not_of("0123456789abcdef") == 64)
+    {
+      found.push_back(name.substr(0, 64));
+    }
+  }
+  return found;
+}
+
+
+
+std::string dump_store::sha256(const unsigned char* data, unsigned int num_bytes)
+{
+  unsigned int state[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  
+  unsigned int offset = 0;
+  for (; num_bytes - offset >= 64; offset += 64)
+  {
+    sha256_block(state, &data[offset]);
+  }
+  
+  // Pad the rest with a single 1 bit, zeros, and the length in bits
+  unsigned char tail[128] = {0};
+  unsigned int tail_size = num_bytes - offset;
+  if (tail_size > 0)
+  {
+    memcpy(tail, &data[offset], tail_size);
+  }
+  tail[tail_size] = 0x80;
+  unsigned int padded_size = (tail_size < 56 ? 64 : 128);
+  unsigned long long num_bits = (unsigned long long) num_bytes * 8;
+  for (int i = 0; i < 8; ++i)
+  {
+    tail[padded_size - 1 - i] = (unsigned char) (num_bits >> (8 * i));
+  }
+  for (unsigned int i = 0; i < padded_size; i += 64)
+  {
+    sha256_block(state, &tail[i]);
+  }
+  
+  static const char hex_digits[] = "0123456789abcdef";
+  string digest;
+  digest.reserve(64);
+  for (int i = 0; i < 8; ++i)
+  {
+    for (int shift = 28; shift >= 0; shift -= 4)
+    {
+      digest += hex_digits[(state[i] >> shift) & 0xF];
+    }
+  }
+  return digest;
+}
+
+std::string dump_store::resolve(const std::string& path)
+{
+  string digest;
+  string target;
+  try
+  {
+    if (read_reference(path, digest, target))
+    {
+      return target;
+    }
+  }
+  catch (std::exception& ex)
+  {
+    // Let the caller report the file as missing in its own words
+    (void) ex;
+  }
+  return path;
+}
+
+
+
+bool dump_store::read_reference(const std::string& path, std::string& digest, std::string& target)
+{
+  string contents = read_file(path, MAX_REFERENCE_SIZE);
+  if (contents.compare(0, strlen(REFERENCE_MAGIC) + 1, REFERENCE_MAGIC "\n") != 0)
+  {
+    return false;
+  }
+  
+  stringstream reference(contents);
+  string magic;
+  unsigned long long size;
+  getline(reference, magic);
+  reference >> digest >> size;
+  reference.ignore(1);
+  getline(reference, target);
+  return !reference.fail() && digest.size() == 64 && !target.empty();
+}
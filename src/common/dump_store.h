@@ -0,0 +1,169 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref dump_store class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref dump_store class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __DUMP_STORE_H__
+#define __DUMP_STORE_H__
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*! \class dump_store
+ *  \brief Class that keeps a single copy of every distinct backup.
+ *  
+ *  Class that keeps a single copy of every distinct backup in a directory,
+ *  each file named after the SHA-256 digest of its contents. Adding a backup
+ *  to the store moves it into the directory if its digest has not been seen
+ *  before and replaces the original file with a small reference to the stored
+ *  copy, so that dumping the same retail release many times only stores its
+ *  contents once.
+ *  
+ *  A reference is a text file starting with the line "fmref1", followed by a
+ *  line with the digest and size of the stored file and a line with its path.
+ *  \ref mapped_file follows references when opening a file, so references can
+ *  be flashed and verified like the backups they replaced.
+ *  
+ *  This class is thread-safe.
+ */
+class dump_store
+{
+public:
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in] directory The directory to keep stored files in. Must already
+   *         exist. Should be an absolute path, since it is recorded in every
+   *         reference.
+   */
+  explicit                dump_store(const std::string& directory);
+  
+  
+  
+  /*!
+   *  \brief Gets the directory stored files are kept in.
+   */
+  const std::string&      directory() const;
+  
+  /*!
+   *  \brief Gets the path a file with the given digest is stored at.
+   *  
+   *  \param [in] digest The hexadecimal SHA-256 digest of the file.
+   */
+  std::string             path_for(const std::string& digest) const;
+  
+  /*!
+   *  \brief Determines whether a file with the given digest is stored.
+   *  
+   *  \param [in] digest The hexadecimal SHA-256 digest of the file.
+   */
+  bool                    contains(const std::string& digest) const;
+  
+  /*!
+   *  \brief Adds a file to the store and replaces it with a reference.
+   *  
+   *  Adds the file at the given path to the store. If a file with the same
+   *  contents is already stored, the file is deleted, otherwise it is moved
+   *  into the store. Either way, a reference to the stored copy is then
+   *  written in its place. Files that already are references are left alone.
+   *  
+   *  \param [in] path The path of the file to add.
+   *  
+   *  \return The hexadecimal SHA-256 digest of the file.
+   *  
+   *  \throws std::runtime_error If the file could not be read, stored, or
+   *          replaced.
+   */
+  std::string             add(const std::string& path);
+  
+  /*!
+   *  \brief Adds data to the store directly, without a file to replace.
+   *  
+   *  Used for data that arrives whole from elsewhere, such as when
+   *  \ref store_sync_server receives a file from another station's store.
+   *  
+   *  \param [in] data Pointer to the data.
+   *  \param [in] num_bytes The number of bytes of data.
+   *  
+   *  \return The hexadecimal SHA-256 digest of the data.
+   *  
+   *  \throws std::runtime_error If the data could not be stored.
+   */
+  std::string             add_data(const unsigned char* data, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Reads a stored file whole.
+   *  
+   *  \param [in] digest The hexadecimal SHA-256 digest of the file.
+   *  
+   *  \throws std::runtime_error If no such file is stored or it could not be
+   *          read.
+   */
+  std::vector<unsigned char> read(const std::string& digest) const;
+  
+  /*!
+   *  \brief Lists the digest of every stored file, in no particular order.
+   */
+  std::vector<std::string> digests() const;
+  
+  
+  
+  /*!
+   *  \brief Computes the SHA-256 digest of a block of data.
+   *  
+   *  \param [in] data Pointer to the data.
+   *  \param [in] num_bytes The number of bytes of data.
+   *  
+   *  \return The digest as 64 lowercase hexadecimal digits.
+   */
+  static std::string      sha256(const unsigned char* data, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Gets the path of the file a reference refers to.
+   *  
+   *  \param [in] path The path of a file that may be a reference.
+   *  
+   *  \return The path of the stored file if **path** is a reference, or
+   *          **path** itself otherwise.
+   */
+  static std::string      resolve(const std::string& path);
+  
+  
+  
+private:
+  
+  /*! \brief Disabled copy constructor. */
+                          dump_store(const dump_store& other) = delete;
+  
+  /*! \brief Disabled copy assignment operator. */
+  dump_store&             operator=(const dump_store& other) = delete;
+  
+  /*!
+   *  \brief Reads a reference file.
+   *  
+   *  \param [in] path The path of the file.
+   *  \param [out] digest Set to the digest of the stored file.
+   *  \param [out] target Set to the path of the stored file.
+   *  
+   *  \return true if the file is a reference, false otherwise.
+   */
+  static bool             read_reference(const std::string& path, std::string& digest, std::string& target);
+  
+  
+  
+  /*! \brief The directory stored files are kept in. */
+  const std::string       m_directory;
+  
+  /*! \brief Mutex keeping concurrent backups of the same image apart. */
+  std::mutex              m_mutex;
+};
+
+#endif /* defined(__DUMP_STORE_H__) */
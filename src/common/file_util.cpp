@@ -0,0 +1,96 @@
+/*! \file
+ *  \brief File containing the implementation of file system helper
+ *         functions.
+ *  
+ *  File containing the implementation of file system helper functions.
+ *  
+ *  See corrensponding header file to view documentation for the functions.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "file_util.h"
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+bool replace_file(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+  // Windows' rename refuses to replace an existing file
+  return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+  return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+
+long long modification_time(const std::string& path)
+{
+#ifdef _WIN32
+  // stat() only gives whole seconds on Windows
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data))
+  {
+    return -1;
+  }
+  return filetime_to_modification_time(data.ftLastWriteTime.dwHighDateTime, data.ftLastWriteTime.dwLowDateTime);
+#else
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0)
+  {
+    return -1;
+  }
+  return modification_time(info);
+#endif
+}
+
+long long modification_time(const struct stat& info)
+{
+#if defined(__APPLE__)
+  return (long long) info.st_mtimespec.tv_sec * 1000000000LL + info.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  return (long long) info.st_mtime * 1000000000LL;
+#else
+  return (long long) info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+#endif
+}
+
+long long filetime_to_modification_time(unsigned int high, unsigned int low)
+{
+  // FILETIME counts 100ns intervals since 1601
+  unsigned long long ticks = ((unsigned long long) high << 32) | low;
+  return ((long long) ticks - 116444736000000000LL) * 100LL;
+}
+
+std::vector<std::string> split_fields(const std::string& line)
+{
+  std::vector<std::string> fields;
+  size_t start = 0;
+  while (true)
+  {
+    size_t tab = line.find('\t', start);
+    fields.push_back(line.substr(start, tab - start));
+    if (tab == std::string::npos)
+    {
+      return fields;
+    }
+    start = tab + 1;
+  }
+}
+
+bool parse_number(const std::string& text, unsigned long long& value)
+{
+  if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos)
+  {
+    return false;
+  }
+  value = strtoull(text.c_str(), nullptr, 10);
+  return true;
+}
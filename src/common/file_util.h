@@ -0,0 +1,86 @@
+/*! \file
+ *  \brief File containing declarations of file system helper functions.
+ *  
+ *  File containing declarations of small helper functions for working with
+ *  files that are shared by the stores, caches, and indexes kept on disk.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __FILE_UTIL_H__
+#define __FILE_UTIL_H__
+
+#include <string>
+#include <vector>
+
+struct stat;
+
+/*!
+ *  \brief Renames a file, replacing any file at the destination.
+ *  
+ *  Moves a file written in full under a temporary name over the file it
+ *  replaces, so that readers see either the old or the new file and never a
+ *  partly written one.
+ *  
+ *  \param [in] from The path of the file to rename.
+ *  \param [in] to The path to rename it to.
+ *  
+ *  \return true if the file was renamed, false otherwise.
+ */
+bool replace_file(const std::string& from, const std::string& to);
+
+/*!
+ *  \brief Gets the modification time of a file in nanoseconds.
+ *  
+ *  Gets the modification time of a file in nanoseconds since 1970, as finely
+ *  as the file system keeps it, so that a file rewritten within the same
+ *  second is still seen to have changed.
+ *  
+ *  \param [in] path The path of the file.
+ *  
+ *  \return The modification time, or -1 if it can't be read.
+ */
+long long modification_time(const std::string& path);
+
+/*!
+ *  \brief Gets the modification time held by a file's status in nanoseconds.
+ *  
+ *  \param [in] info The status of the file, as read by **stat()**.
+ *  
+ *  \return The modification time in nanoseconds since 1970.
+ */
+long long modification_time(const struct stat& info);
+
+/*!
+ *  \brief Converts a Windows FILETIME to a modification time in nanoseconds.
+ *  
+ *  \param [in] high The high 32 bits of the FILETIME.
+ *  \param [in] low The low 32 bits of the FILETIME.
+ *  
+ *  \return The time in nanoseconds since 1970.
+ */
+long long filetime_to_modification_time(unsigned int high, unsigned int low);
+/*!
+ *  \brief Splits a line of a tab-separated record into its fields.
+ *  
+ *  \param [in] line The line, without its line break.
+ *  
+ *  \return Every field of the line in order. A line without tabs is a single
+ *          field.
+ */
+std::vector<std::string> split_fields(const std::string& line);
+
+/*!
+ *  \brief Parses a field of a record holding a decimal number.
+ *  
+ *  \param [in] text The field.
+ *  \param [out] value Set to the number if the field holds one.
+ *  
+ *  \return true if the field is made up of decimal digits only, false
+ *          otherwise.
+ */
+bool parse_number(const std::string& text, unsigned long long& value);
+
+#endif /* defined(__FILE_UTIL_H__) */
@@ -0,0 +1,380 @@
+/*! \file
+ *  \brief File containing the implementation of \ref hash_ostream.
+ *  
+ *  File containing the implementation of \ref hash_ostream.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "hash_stream.h"
+#include <cstring>
+
+#define CRC32_POLYNOMIAL 0xEDB88320u
+
+using namespace std;
+
+static const unsigned int md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const unsigned int md5_shifts[16] = {
+  7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21
+};
+
+static inline unsigned int rotl(unsigned int x, unsigned int n)
+{
+  return (x << n) | (x >> (32 - n));
+}
+
+static void md5_block(unsigned int state[4], const unsigned char* block)
+{
+  unsigned int m[16];
+  for (int i = 0; i < 16; ++i)
+  {
+    m[i] = (unsigned int) block[i * 4] | ((unsigned int) block[i * 4 + 1] << 8)
+      | ((unsigned int) block[i * 4 + 2] << 16) | ((unsigned int) block[i * 4 + 3] << 24);
+  }
+  
+  unsigned int a = state[0], b = state[1], c = state[2], d = state[3];
+  for (int i = 0; i < 64; ++i)
+  {
+    unsigned int f;
+    int g;
+    switch (i / 16)
+    {
+    case 0:  f = (b & c) | (~b & d); g = i;                break;
+    case 1:  f = (d & b) | (~d & c); g = (5 * i + 1) % 16; break;
+    case 2:  f = b ^ c ^ d;          g = (3 * i + 5) % 16; break;
+    default: f = c ^ (b | ~d);       g = (7 * i) % 16;     break;
+    }
+    f += a + md5_k[i] + m[g];
+    a = d;
+    d = c;
+    c = b;
+    b += rotl(f, md5_shifts[(i / 16) * 4 + i % 4]);
+  }
+  
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+}
+
+static void sha1_block(unsigned int state[5], const unsigned char* block)
+{
+  unsigned int w[80];
+  for (int i = 0; i < 16; ++i)
+  {
+    w[i] = ((unsigned int) block[i * 4] << 24) | ((unsigned int) block[i * 4 + 1] << 16)
+      | ((unsigned int) block[i * 4 + 2] << 8) | (unsigned int) block[i * 4 + 3];
+  }
+  for (int i = 16; i < 80; ++i)
+  {
+    w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+  }
+  
+  unsigned int a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+  for (int i = 0; i < 80; ++i)
+  {
+    unsigned int f;
+    unsigned int k;
+    switch (i / 20)
+    {
+    case 0:  f = (b & c) | (~b & d);          k = 0x5a827999; break;
+    case 1:  f = b ^ c ^ d;                   k = 0x6ed9eba1; break;
+    case 2:  f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; break;
+    default: f = b ^ c ^ d;                   k = 0xca62c1d6; break;
+    }
+    unsigned int t = rotl(a, 5) + f + e + k + w[i];
+    e = d;
+    d = c;
+    c = rotl(b, 30);
+    b = a;
+    a = t;
+  }
+  
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d; state[4] += e;
+}
+
+// Feeds data through a block function, keeping any partial block for later
+template<typename state_t, typename block_function_t>
+static void update_blocks(state_t& state, const unsigned char* data, unsigned int num_bytes, block_function_t block_function)
+{
+  unsigned int num_pending = (unsigned int) (state.num_bytes % 64);
+  state.num_bytes += num_bytes;
+  
+  if (num_pending > 0)
+  {
+    unsigned int count = (num_bytes < 64 - num_pending ? num_bytes : 64 - num_pending);
+    memcpy(&state.pending[num_pending], data, count);
+    data += count;
+    num_bytes -= count;
+    num_pending += count;
+    if (num_pending < 64)
+    {
+      return;
+    }
+    block_function(state.words, state.pending);
+  }
+  
+  for (; num_bytes >= 64; data += 64, num_bytes -= 64)
+  {
+    block_function(state.words, data);
+  }
+  memcpy(state.pending, data, num_bytes);
+}
+
+// Pads the final block with a single 1 bit, zeros, and the length in bits,
+// stored little-endian for MD5 and big-endian for SHA-1
+template<typename state_t, typename block_function_t>
+static void finish_blocks(state_t& state, bool big_endian, block_function_t block_function)
+{
+  unsigned long long num_bits = state.num_bytes * 8;
+  unsigned char padding[72] = {0x80};
+  unsigned int padding_size = (unsigned int) (56 - state.num_bytes % 64 + 64) % 64;
+  if (padding_size == 0)
+  {
+    padding_size = 64;
+  }
+  for (int i = 0; i < 8; ++i)
+  {
+    padding[padding_size + i] = (unsigned char) (num_bits >> (8 * (big_endian ? 7 - i : i)));
+  }
+  unsigned long long num_bytes = state.num_bytes;
+  update_blocks(state, padding, padding_size + 8, block_function);
+  state.num_bytes = num_bytes;
+}
+
+static string to_hex(const unsigned int* words, unsigned int num_words, bool big_endian)
+{
+  static const char hex_digits[] = "0123456789abcdef";
+  string digest;
+  digest.reserve(num_words * 8);
+  for (unsigned int i = 0; i < num_words; ++i)
+  {
+    for (int byte = 0; byte < 4; ++byte)
+    {
+      unsigned int value = (words[i] >> (8 * (big_endian ? 3 - byte : byte))) & 0xFF;
+      digest += hex_digits[value >> 4];
+      digest += hex_digits[value & 0xF];
+    }
+  }
+  return digest;
+}
+
+static unsigned int update_crc32(unsigned int crc, const unsigned char* data, unsigned int num_bytes)
+{
+  static const struct crc32_table
+  {
+    crc32_table()
+    {
+      for (unsigned int i = 0; i < 256; ++i)
+      {
+        unsigned int crc = i;
+        for (unsigned int bit = 0; bit < 8; ++bit)
+        {
+          crc = (crc & 1 ? (crc >> 1) ^ CRC32_POLYNOMIAL : crc >> 1);
+        }
+        entries[i] = crc;
+      }
+    }
+    unsigned int entries[256];
+  } table;
+  
+  for (unsigned int i = 0; i < num_bytes; ++i)
+  {
+    crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+
+
+dump_hashes::dump_hashes()
+  : num_bytes(0), crc32(0)
+{
+  // Nothing else to do
+}
+
+
+
+hash_streambuf::hash_streambuf(std::ostream& out)
+  : m_out(out), m_crc32(0xFFFFFFFF)
+{
+  static const unsigned int md5_init[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0};
+  static const unsigned int sha1_init[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+  memcpy(m_md5.words, md5_init, sizeof(md5_init));
+  memcpy(m_sha1.words, sha1_init, sizeof(sha1_init));
+  m_md5.num_bytes = 0;
+  m_sha1.num_bytes = 0;
+  m_chunk.reserve(HASH_CHUNK_SIZE);
+  m_hashing.reserve(HASH_CHUNK_SIZE);
+}
+
+hash_streambuf::~hash_streambuf()
+{
+  wait_for_hashing();
+}
+
+
+
+dump_hashes hash_streambuf::hashes()
+{
+  hash_chunk();
+  wait_for_hashing();
+  
+  // Finish copies so that more data can still be written
+  block_hash_state md5 = m_md5;
+  block_hash_state sha1 = m_sha1;
+  finish_blocks(md5, false, [](unsigned int* words, const unsigned char* block) { md5_block(words, block); });
+  finish_blocks(sha1, true, [](unsigned int* words, const unsigned char* block) { sha1_block(words, block); });
+  
+  dump_hashes result;
+  result.num_bytes = m_md5.num_bytes;
+  result.crc32 = ~m_crc32;
+  result.md5 = to_hex(md5.words, 4, false);
+  result.sha1 = to_hex(sha1.words, 5, true);
+  return result;
+}
+
+
+
+hash_streambuf::int_type hash_streambuf::overflow(int_type ch)
+{
+  if (traits_type::eq_int_type(ch, traits_type::eof()))
+  {
+    return traits_type::not_eof(ch);
+  }
+  
+  char c = traits_type::to_char_type(ch);
+  return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+}
+
+std::streamsize hash_streambuf::xsputn(const char_type* s, std::streamsize count)
+{
+  // Only hash what actually made it to the output
+  if (!m_out.write(s, count))
+  {
+    return 0;
+  }
+  
+  std::streamsize hashed = 0;
+  while (hashed < count)
+  {
+    std::streamsize chunk = HASH_CHUNK_SIZE - (std::streamsize) m_chunk.size();
+    if (chunk > count - hashed)
+    {
+      chunk = count - hashed;
+    }
+    m_chunk.insert(m_chunk.end(), s + hashed, s + hashed + chunk);
+    hashed += chunk;
+    
+    if (m_chunk.size() == HASH_CHUNK_SIZE)
+    {
+      hash_chunk();
+    }
+  }
+  return count;
+}
+
+int hash_streambuf::sync()
+{
+  m_out.flush();
+  return m_out.good() ? 0 : -1;
+}
+
+
+
+void hash_streambuf::hash_chunk()
+{
+  wait_for_hashing();
+  if (m_chunk.empty())
+  {
+    return;
+  }
+  m_chunk.swap(m_hashing);
+  m_chunk.clear();
+  
+  // Each algorithm only depends on its own state, so all of them run at once
+  m_workers.push_back(async(launch::async, [this]()
+  {
+    m_crc32 = update_crc32(m_crc32, m_hashing.data(), (unsigned int) m_hashing.size());
+  }));
+  m_workers.push_back(async(launch::async, [this]()
+  {
+    update_blocks(m_md5, m_hashing.data(), (unsigned int) m_hashing.size(), [](unsigned int* words, const unsigned char* block) { md5_block(words, block); });
+  }));
+  m_workers.push_back(async(launch::async, [this]()
+  {
+    update_blocks(m_sha1, m_hashing.data(), (unsigned int) m_hashing.size(), [](unsigned int* words, const unsigned char* block) { sha1_block(words, block); });
+  }));
+}
+
+void hash_streambuf::wait_for_hashing()
+{
+  for (future<void>& worker : m_workers)
+  {
+    worker.get();
+  }
+  m_workers.clear();
+}
+
+
+
+// Stream buffer that throws away everything written to it
+struct null_streambuf : public std::streambuf
+{
+  int_type overflow(int_type ch) { return traits_type::not_eof(ch); }
+  std::streamsize xsputn(const char_type* s, std::streamsize count) { (void) s; return count; }
+};
+
+// Output stream that throws away everything written to it
+struct discard_ostream : public std::ostream
+{
+  discard_ostream() : std::ostream(nullptr) { rdbuf(&m_null_buf); }
+  null_streambuf m_null_buf;
+};
+
+
+
+hash_ostream::hash_ostream(std::ostream& out)
+  : std::ostream(nullptr), m_buf(out)
+{
+  rdbuf(&m_buf);
+}
+
+hash_ostream::hash_ostream()
+  : std::ostream(nullptr), m_discard(new discard_ostream()), m_buf(*m_discard)
+{
+  rdbuf(&m_buf);
+}
+
+dump_hashes hash_ostream::hashes()
+{
+  flush();
+  return m_buf.hashes();
+}
+
+
+
+dump_hashes hash_data(const unsigned char* data, unsigned int num_bytes)
+{
+  discard_ostream discard;
+  hash_streambuf buf(discard);
+  buf.sputn((const char*) data, num_bytes);
+  return buf.hashes();
+}
+
+unsigned int crc32_data(const unsigned char* data, unsigned int num_bytes)
+{
+  return ~update_crc32(0xFFFFFFFF, data, num_bytes);
+}
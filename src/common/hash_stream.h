@@ -0,0 +1,211 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref hash_ostream class.
+ *  
+ *  File containing the declaration of the \ref hash_ostream class, which
+ *  computes the checksums archive catalogues record for a dump while it is
+ *  being written, along with the \ref dump_hashes struct holding them.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __HASH_STREAM_H__
+#define __HASH_STREAM_H__
+
+#include <future>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/*! \brief The number of bytes handed to the hashing threads at a time. */
+#define HASH_CHUNK_SIZE 0x40000
+
+/*!
+ *  \brief Struct containing the checksums of a dump.
+ */
+struct dump_hashes
+{
+  /*!
+   *  \brief Constructs the checksums of an empty dump.
+   */
+  dump_hashes();
+  
+  /*! \brief The number of bytes hashed. */
+  unsigned long long      num_bytes;
+  
+  /*! \brief The CRC32 checksum, as used by zip. */
+  unsigned int            crc32;
+  
+  /*! \brief The MD5 digest as 32 lowercase hexadecimal digits. */
+  std::string             md5;
+  
+  /*! \brief The SHA-1 digest as 40 lowercase hexadecimal digits. */
+  std::string             sha1;
+};
+
+/*! \class hash_streambuf
+ *  \brief Stream buffer that hashes everything written through it.
+ *  
+ *  Stream buffer that passes everything written to it on to another output
+ *  stream and collects it into chunks of \ref HASH_CHUNK_SIZE bytes. Each
+ *  full chunk is hashed with every algorithm at once on worker threads while
+ *  the next chunk is being collected. Used through \ref hash_ostream.
+ */
+class hash_streambuf : public std::streambuf
+{
+public:
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in,out] out The stream to pass written data on to.
+   */
+  explicit                hash_streambuf(std::ostream& out);
+  
+  /*!
+   *  \brief Class destructor. Waits for the worker threads to finish.
+   */
+                          ~hash_streambuf();
+  
+  /*!
+   *  \brief Gets the checksums of everything written so far.
+   */
+  dump_hashes             hashes();
+
+
+
+protected:
+  
+  /*! \see std::streambuf::overflow(int_type) */
+  int_type                overflow(int_type ch);
+  
+  /*! \see std::streambuf::xsputn(const char_type*, std::streamsize) */
+  std::streamsize         xsputn(const char_type* s, std::streamsize count);
+  
+  /*! \see std::streambuf::sync() */
+  int                     sync();
+
+
+
+private:
+  
+  hash_streambuf(const hash_streambuf& other) = delete;
+  hash_streambuf& operator=(const hash_streambuf& other) = delete;
+  
+  /*! \brief The running state of a hash working on 64-byte blocks. */
+  struct block_hash_state
+  {
+    unsigned int          words[5];
+    unsigned long long    num_bytes;
+    unsigned char         pending[64];
+  };
+  
+  /*!
+   *  \brief Hands the collected chunk to the worker threads, once they have
+   *         finished with the previous one.
+   */
+  void                    hash_chunk();
+  
+  /*!
+   *  \brief Waits for the worker threads to finish hashing the last chunk.
+   */
+  void                    wait_for_hashing();
+  
+  
+  
+  /*! \brief The stream written data is passed on to. */
+  std::ostream&           m_out;
+  
+  /*! \brief Data waiting to be hashed. */
+  std::vector<unsigned char> m_chunk;
+  
+  /*! \brief Data being hashed by the worker threads. */
+  std::vector<unsigned char> m_hashing;
+  
+  /*! \brief The worker threads hashing \ref m_hashing. */
+  std::vector<std::future<void>> m_workers;
+  
+  /*! \brief The running CRC32 checksum, not yet inverted. */
+  unsigned int            m_crc32;
+  
+  /*! \brief The running MD5 state. */
+  block_hash_state        m_md5;
+  
+  /*! \brief The running SHA-1 state. */
+  block_hash_state        m_sha1;
+};
+
+/*! \class hash_ostream
+ *  \brief Output stream that hashes everything written to it.
+ *  
+ *  Output stream that passes everything written to it on to another stream
+ *  while computing its CRC32, MD5, and SHA-1 checksums, so that a backup
+ *  doesn't need to be read back to be catalogued. The hashing happens on
+ *  worker threads, overlapping both the writing and reading from the
+ *  cartridge.
+ *  
+ *  Seeking is not supported.
+ */
+class hash_ostream : public std::ostream
+{
+public:
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in,out] out The stream to pass written data on to. Must outlive
+   *         this stream.
+   */
+  explicit                hash_ostream(std::ostream& out);
+  
+  /*!
+   *  \brief Constructs a stream that only hashes what is written to it.
+   *  
+   *  Constructs a stream that computes the checksums of what is written to it
+   *  and throws the data itself away, e.g. to check a dump against checksums
+   *  known in advance without keeping it.
+   */
+                          hash_ostream();
+  
+  /*!
+   *  \brief Flushes the stream and gets the checksums of everything written
+   *         so far.
+   */
+  dump_hashes             hashes();
+
+
+
+private:
+  
+  /*! \brief The stream discarding written data, or **nullptr** if it is
+   *         passed on to another stream. */
+  std::unique_ptr<std::ostream> m_discard;
+  
+  /*! \brief The stream buffer doing the hashing. */
+  hash_streambuf          m_buf;
+};
+
+/*!
+ *  \brief Computes the checksums of a block of data.
+ *  
+ *  \param [in] data Pointer to the data.
+ *  \param [in] num_bytes The number of bytes of data.
+ *  
+ *  \return The checksums.
+ */
+dump_hashes hash_data(const unsigned char* data, unsigned int num_bytes);
+
+/*!
+ *  \brief Computes just the CRC32 checksum of a block of data.
+ *  
+ *  \param [in] data Pointer to the data.
+ *  \param [in] num_bytes The number of bytes of data.
+ *  
+ *  \return The CRC32 checksum, as used by zip.
+ */
+unsigned int crc32_data(const unsigned char* data, unsigned int num_bytes);
+
+#endif /* defined(__HASH_STREAM_H__) */
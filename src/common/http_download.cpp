@@ -0,0 +1,259 @@
+/*! \file
+ *  \brief File containing the implementation of \ref http_download.
+ *  
+ *  File containing the implementation of \ref http_download.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see http_download
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-30
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "http_download.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+#define URL_SCHEME "http://"
+
+// How long the server may go silent before the connection is considered
+// stalled and the download resumed on a new one
+#define RECEIVE_TIMEOUT_MS 15000
+
+// The number of times in a row the download is resumed without receiving
+// anything before giving up
+#define MAX_RESUMES 5
+
+// Largest set of response headers accepted
+#define MAX_HEADER_BYTES 0x4000
+
+// Size of each piece of the body handed to the stream
+#define CHUNK_SIZE 0x10000
+
+using namespace std;
+
+
+
+static string lowercase(string text)
+{
+  for (char& c : text)
+  {
+    c = (char) tolower((unsigned char) c);
+  }
+  return text;
+}
+
+
+
+bool http_download::is_url(const std::string& path)
+{
+  return lowercase(path.substr(0, sizeof(URL_SCHEME) - 1)) == URL_SCHEME;
+}
+
+http_download::http_download(const std::string& url)
+  : m_url(url), m_port(80), m_size(0), m_skip(0), m_cancelled(false)
+{
+  if (!is_url(url))
+  {
+    throw std::invalid_argument("Only http:// URLs can be downloaded: " + url);
+  }
+  
+  string rest = url.substr(sizeof(URL_SCHEME) - 1);
+  size_t slash = rest.find('/');
+  string authority = rest.substr(0, slash);
+  m_target = (slash == string::npos ? "/" : rest.substr(slash));
+  
+  size_t colon = authority.find(':');
+  m_host = authority.substr(0, colon);
+  if (colon != string::npos)
+  {
+    char* end = nullptr;
+    long port = strtol(authority.c_str() + colon + 1, &end, 10);
+    if (*end != '\0' || port <= 0 || port > 65535)
+    {
+      throw std::invalid_argument("Invalid port in URL: " + url);
+    }
+    m_port = (unsigned short) port;
+  }
+  if (m_host.empty())
+  {
+    throw std::invalid_argument("Missing host in URL: " + url);
+  }
+}
+
+
+
+unsigned long long http_download::open()
+{
+  m_size = request(0);
+  return m_size;
+}
+
+void http_download::read_to(std::ostream& fout)
+{
+  vector<char> buffer(CHUNK_SIZE);
+  unsigned long long received = 0;
+  unsigned int resumes = 0;
+  
+  while (received < m_size)
+  {
+    // Bytes that came in with the headers go first
+    size_t num_received = 0;
+    if (!m_pending.empty())
+    {
+      num_received = min(m_pending.size(), (size_t) (m_size - received));
+      copy(m_pending.begin(), m_pending.begin() + num_received, buffer.begin());
+      m_pending.clear();
+    }
+    else
+    {
+      try
+      {
+        if (m_cancelled)
+        {
+          throw std::runtime_error("Download cancelled");
+        }
+        num_received = m_socket.receive_some(buffer.data(), (size_t) min((unsigned long long) buffer.size(), m_size - received), RECEIVE_TIMEOUT_MS);
+        if (num_received == 0)
+        {
+          throw std::runtime_error("Connection closed before the end of " + m_url);
+        }
+      }
+      catch (std::exception& ex)
+      {
+        // Pick up where the connection left off, unless it keeps failing
+        m_socket.close();
+        if (m_cancelled || ++resumes > MAX_RESUMES)
+        {
+          throw std::runtime_error(string("Download of ") + m_url + " failed: " + ex.what());
+        }
+        request(received);
+        continue;
+      }
+    }
+    
+    // A server ignoring a range request sends the file from the start
+    size_t skipped = (size_t) min(m_skip, (unsigned long long) num_received);
+    m_skip -= skipped;
+    if (num_received > skipped)
+    {
+      fout.write(buffer.data() + skipped, num_received - skipped);
+      if (!fout)
+      {
+        throw std::runtime_error("Downloaded data of " + m_url + " was refused");
+      }
+      received += num_received - skipped;
+      resumes = 0;
+    }
+  }
+  
+  m_socket.close();
+}
+
+void http_download::cancel()
+{
+  m_cancelled = true;
+  m_socket.shutdown();
+}
+
+
+
+unsigned long long http_download::request(unsigned long long offset)
+{
+  if (m_cancelled)
+  {
+    throw std::runtime_error("Download cancelled");
+  }
+  
+  m_socket.close();
+  m_socket.connect(m_host, m_port);
+  
+  ostringstream request;
+  request << "GET " << m_target << " HTTP/1.1\r\n"
+          << "Host: " << m_host << (m_port != 80 ? ":" + to_string(m_port) : string()) << "\r\n"
+          << "Accept-Encoding: identity\r\n"
+          << "Connection: close\r\n";
+  if (offset > 0)
+  {
+    request << "Range: bytes=" << offset << "-\r\n";
+  }
+  request << "\r\n";
+  string text = request.str();
+  m_socket.send_all(text.data(), text.size());
+  
+  // Read until the end of the headers. Whatever follows is the body
+  string headers;
+  size_t end_of_headers = string::npos;
+  while (end_of_headers == string::npos)
+  {
+    char buffer[1024];
+    size_t num_received = m_socket.receive_some(buffer, sizeof(buffer), RECEIVE_TIMEOUT_MS);
+    if (num_received == 0)
+    {
+      throw std::runtime_error("Connection closed before the response to " + m_url);
+    }
+    headers.append(buffer, num_received);
+    end_of_headers = headers.find("\r\n\r\n");
+    if (end_of_headers == string::npos && headers.size() > MAX_HEADER_BYTES)
+    {
+      throw std::runtime_error("Response headers too large for " + m_url);
+    }
+  }
+  m_pending.assign(headers.begin() + end_of_headers + 4, headers.end());
+  headers.resize(end_of_headers);
+  
+  istringstream lines(headers);
+  string line;
+  getline(lines, line);
+  istringstream status_line(line);
+  string version;
+  int status = 0;
+  status_line >> version >> status;
+  if (status != 200 && !(status == 206 && offset > 0))
+  {
+    throw std::runtime_error("Server answered " + to_string(status) + " for " + m_url);
+  }
+  
+  long long length = -1;
+  while (getline(lines, line))
+  {
+    if (!line.empty() && line[line.size() - 1] == '\r')
+    {
+      line.resize(line.size() - 1);
+    }
+    size_t colon = line.find(':');
+    if (colon == string::npos)
+    {
+      continue;
+    }
+    string name = lowercase(line.substr(0, colon));
+    string value = line.substr(line.find_first_not_of(' ', colon + 1) == string::npos ? line.size() : line.find_first_not_of(' ', colon + 1));
+    if (name == "content-length")
+    {
+      length = atoll(value.c_str());
+    }
+    else if (name == "transfer-encoding" && lowercase(value) != "identity")
+    {
+      throw std::runtime_error("Chunked responses are not supported, for " + m_url);
+    }
+  }
+  if (length < 0)
+  {
+    throw std::runtime_error("Server didn't give the size of " + m_url);
+  }
+  
+  m_skip = (status == 200 ? offset : 0);
+  if (offset > 0 && (unsigned long long) length != m_size - offset + m_skip)
+  {
+    throw std::runtime_error("File changed on the server during the download of " + m_url);
+  }
+  return (unsigned long long) length;
+}
@@ -0,0 +1,143 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref http_download class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref http_download class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-30
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __HTTP_DOWNLOAD_H__
+#define __HTTP_DOWNLOAD_H__
+
+#include "tcp_socket.h"
+
+#include <atomic>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+/*! \class http_download
+ *  \brief Class downloading a file over plain HTTP as a stream.
+ *  
+ *  Class fetching a single file with an HTTP/1.1 GET request and writing its
+ *  body to a stream as it arrives, so that whoever reads the stream, such as
+ *  an \ref image_pipe feeding a cartridge being flashed, can start on the
+ *  first bytes while the rest is still on its way. If the connection drops or
+ *  stalls partway, the download is picked up where it left off with a range
+ *  request, so a hiccup on the network doesn't start the file over.
+ *  
+ *  The server must give the size of the file up front with a Content-Length
+ *  header. HTTPS, redirects and chunked responses are not supported.
+ *  
+ *  \ref cancel() may be called from any thread. Otherwise, this class is
+ *  *not* thread-safe.
+ */
+class http_download
+{
+public:
+  
+  /*!
+   *  \brief Determines whether a path names a file to download rather than a
+   *         local file.
+   *  
+   *  \param [in] path The path or URL.
+   *  
+   *  \return true if the path is an http URL, false otherwise.
+   */
+  static bool             is_url(const std::string& path);
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in] url The URL of the file, of the form
+   *         **http://host[:port]/path**.
+   *  
+   *  \throws std::invalid_argument If the URL can't be parsed or isn't an
+   *          http:// URL.
+   */
+  explicit                http_download(const std::string& url);
+  
+  
+  
+  /*!
+   *  \brief Sends the request and waits for the response's headers.
+   *  
+   *  \return The size of the file in bytes.
+   *  
+   *  \throws std::runtime_error If the server couldn't be reached or didn't
+   *          answer with the file.
+   */
+  unsigned long long      open();
+  
+  /*!
+   *  \brief Writes the body of the file to a stream as it arrives.
+   *  
+   *  Must be called after \ref open(). Returns once every byte of the file
+   *  has been written.
+   *  
+   *  \param [in,out] fout The stream to write to.
+   *  
+   *  \throws std::runtime_error If the download failed more times in a row
+   *          than it can resume from, was cancelled, or the stream refused
+   *          the data.
+   */
+  void                    read_to(std::ostream& fout);
+  
+  /*!
+   *  \brief Stops the download, failing \ref open() or \ref read_to() on
+   *         whatever thread is running it.
+   */
+  void                    cancel();
+
+
+
+private:
+  
+  /*!
+   *  \brief Connects, asks for the file from an offset on, and reads the
+   *         response's headers.
+   *  
+   *  \param [in] offset The first byte of the file wanted.
+   *  
+   *  \return The number of bytes of the body the server will send.
+   */
+  unsigned long long      request(unsigned long long offset);
+  
+  http_download(const http_download& other) = delete;
+  http_download& operator=(const http_download& other) = delete;
+  
+  
+  
+  /*! \brief The URL of the file. */
+  const std::string       m_url;
+  
+  /*! \brief The host part of the URL. */
+  std::string             m_host;
+  
+  /*! \brief The port part of the URL. */
+  unsigned short          m_port;
+  
+  /*! \brief The path and query part of the URL. */
+  std::string             m_target;
+  
+  /*! \brief The connection to the server. */
+  tcp_socket              m_socket;
+  
+  /*! \brief The size of the file, known once \ref open() returns. */
+  unsigned long long      m_size;
+  
+  /*! \brief Bytes of the body received along with the headers. */
+  std::vector<char>       m_pending;
+  
+  /*! \brief Bytes the server sends before the offset asked for, when it
+   *         ignores a range request. */
+  unsigned long long      m_skip;
+  
+  /*! \brief Whether \ref cancel() has been called. */
+  std::atomic<bool>       m_cancelled;
+};
+
+#endif /* defined(__HTTP_DOWNLOAD_H__) */
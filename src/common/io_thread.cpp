@@ -0,0 +1,177 @@
+/*! \file
+ *  \brief File containing the implementation of \ref io_thread_options and
+ *         \ref configure_io_thread().
+ *  
+ *  File containing the implementation of \ref io_thread_options and
+ *  \ref configure_io_thread().
+ *  
+ *  See corrensponding header file to view documentation for the struct and
+ *  function.
+ *  
+ *  \see io_thread_options
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-29
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "io_thread.h"
+#include "log.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(OS_WINDOWS)
+#include <windows.h>
+#elif defined(OS_MACOSX)
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#include <pthread.h>
+#elif defined(OS_LINUX)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+
+
+io_thread_options::io_thread_options()
+  : high_priority(false)
+{
+  // Nothing else to do
+}
+
+bool io_thread_options::any() const
+{
+  return high_priority || !cpus.empty();
+}
+
+int io_thread_options::cpu_for(unsigned int index) const
+{
+  return (cpus.empty() ? -1 : (int) cpus[index % cpus.size()]);
+}
+
+bool io_thread_options::parse_cpus(const std::string& text, std::vector<unsigned int>& cpus)
+{
+  cpus.clear();
+  size_t start = 0;
+  while (start <= text.size())
+  {
+    size_t end = text.find(',', start);
+    string item = text.substr(start, end == string::npos ? string::npos : end - start);
+    char* item_end = nullptr;
+    unsigned long cpu = strtoul(item.c_str(), &item_end, 10);
+    if (item.empty() || *item_end != '\0' || cpu > 1023)
+    {
+      return false;
+    }
+    cpus.push_back((unsigned int) cpu);
+    
+    if (end == string::npos)
+    {
+      break;
+    }
+    start = end + 1;
+  }
+  return !cpus.empty();
+}
+
+
+
+bool configure_io_thread(bool high_priority, int cpu)
+{
+  bool success = true;
+
+#if defined(OS_WINDOWS)
+  if (!SetThreadPriority(GetCurrentThread(), high_priority ? THREAD_PRIORITY_HIGHEST : THREAD_PRIORITY_NORMAL))
+  {
+    log(log_level::INFO, ("Unable to set I/O thread priority, error " + to_string(GetLastError())).c_str());
+    success = false;
+  }
+  
+  DWORD_PTR process_mask;
+  DWORD_PTR system_mask;
+  if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+  {
+    DWORD_PTR mask = (cpu < 0 ? process_mask : ((DWORD_PTR) 1 << cpu));
+    if (cpu >= (int) (sizeof(DWORD_PTR) * 8) || SetThreadAffinityMask(GetCurrentThread(), mask) == 0)
+    {
+      log(log_level::INFO, ("Unable to pin I/O thread to CPU " + to_string(cpu)).c_str());
+      success = false;
+    }
+  }
+#elif defined(OS_MACOSX)
+  if (pthread_set_qos_class_self_np(high_priority ? QOS_CLASS_USER_INTERACTIVE : QOS_CLASS_DEFAULT, 0) != 0)
+  {
+    log(log_level::INFO, "Unable to set I/O thread quality of service");
+    success = false;
+  }
+  
+  // Threads with the same tag are kept on the same CPU where the kernel can,
+  // and 0 means no tag
+  thread_affinity_policy_data_t policy = {cpu < 0 ? 0 : cpu + 1};
+  if (thread_policy_set(mach_thread_self(), THREAD_AFFINITY_POLICY, (thread_policy_t) &policy, THREAD_AFFINITY_POLICY_COUNT) != KERN_SUCCESS
+      && cpu >= 0)
+  {
+    log(log_level::INFO, ("CPU affinity is not supported, I/O thread not pinned to CPU " + to_string(cpu)).c_str());
+  }
+#elif defined(OS_LINUX)
+  // The lowest real-time level is enough to run ahead of every normal thread
+  sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = (high_priority ? sched_get_priority_min(SCHED_RR) : 0);
+  int result = pthread_setschedparam(pthread_self(), high_priority ? SCHED_RR : SCHED_OTHER, &param);
+  
+  // Without permission for real-time scheduling, a lower nice value may still
+  // be allowed. Only a nice value this function set is undone
+  id_t tid = (id_t) syscall(SYS_gettid);
+  if (high_priority && result != 0 && setpriority(PRIO_PROCESS, tid, IO_THREAD_NICE) != 0)
+  {
+    log(log_level::INFO, ("Unable to raise I/O thread priority: " + string(strerror(errno))).c_str());
+    success = false;
+  }
+  else if (!high_priority && getpriority(PRIO_PROCESS, tid) == IO_THREAD_NICE)
+  {
+    setpriority(PRIO_PROCESS, tid, 0);
+  }
+  
+  // A thread that isn't pinned gets the CPUs of the main thread back, which
+  // are those the process was started with
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (cpu < 0)
+  {
+    result = sched_getaffinity(getpid(), sizeof(cpus), &cpus);
+  }
+  else if (cpu < CPU_SETSIZE)
+  {
+    CPU_SET(cpu, &cpus);
+    result = 0;
+  }
+  else
+  {
+    result = -1;
+  }
+  if (result == 0)
+  {
+    result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+  if (result != 0 && cpu >= 0)
+  {
+    log(log_level::INFO, ("Unable to pin I/O thread to CPU " + to_string(cpu)).c_str());
+    success = false;
+  }
+#else
+  if (high_priority || cpu >= 0)
+  {
+    log(log_level::INFO, "I/O thread priority and affinity are not supported on this platform");
+    success = false;
+  }
+#endif
+  
+  return success;
+}
@@ -0,0 +1,95 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref io_thread_options
+ *         struct and of the functions tuning the threads that move data to
+ *         and from devices.
+ *  
+ *  File containing the declaration of the \ref io_thread_options struct,
+ *  which describes how the threads doing USB I/O should be scheduled, and of
+ *  \ref configure_io_thread(), which applies it to the calling thread using
+ *  whatever the platform offers.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-29
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __IO_THREAD_H__
+#define __IO_THREAD_H__
+
+#include <string>
+#include <vector>
+
+/*! \brief Nice value of an I/O thread with a raised priority on Linux, where
+ *         the real-time policy isn't permitted. */
+#define IO_THREAD_NICE -10
+
+/*! \struct io_thread_options
+ *  \brief Struct describing how the threads doing USB I/O are scheduled.
+ *  
+ *  Left at its defaults, I/O threads are scheduled like any other thread.
+ *  Raising their priority and pinning them to CPUs kept clear of other work
+ *  keeps the round trip of every packet short when the machine is busy.
+ */
+struct io_thread_options
+{
+  /*! \brief Whether to run I/O threads above the normal priority. */
+  bool                      high_priority;
+  
+  /*! \brief CPUs to pin I/O threads to, handed out in turn so that each
+   *         thread gets one, or empty to let them run anywhere. */
+  std::vector<unsigned int> cpus;
+  
+  /*!
+   *  \brief Initializes the options to schedule I/O threads normally.
+   */
+                            io_thread_options();
+  
+  /*!
+   *  \brief Determines whether the options change anything.
+   */
+  bool                      any() const;
+  
+  /*!
+   *  \brief Gets the CPU the I/O thread with the given index is pinned to.
+   *  
+   *  \param [in] index The index of the thread, such as the order in which
+   *         its device was first given a job.
+   *  
+   *  \return The CPU, or -1 if the thread isn't pinned.
+   */
+  int                       cpu_for(unsigned int index) const;
+  
+  /*!
+   *  \brief Parses a comma-separated list of CPU numbers, such as "2,3".
+   *  
+   *  \param [in] text The list to parse.
+   *  \param [out] cpus Filled in with the CPUs.
+   *  
+   *  \return false if the list isn't made of CPU numbers, true otherwise.
+   */
+  static bool               parse_cpus(const std::string& text, std::vector<unsigned int>& cpus);
+};
+
+/*!
+ *  \brief Sets the priority and CPU of the calling thread.
+ *  
+ *  Sets the priority and CPU affinity of the calling thread, or puts them
+ *  back to normal. On Linux, a raised priority uses the round-robin real-time
+ *  policy at its lowest level, falling back to a nice value of
+ *  \ref IO_THREAD_NICE where real-time scheduling isn't permitted. On OS X,
+ *  it uses the user-interactive quality of service, and the CPU is only
+ *  passed on as an affinity hint, which the kernel may ignore. On Windows, it
+ *  uses the highest thread priority.
+ *  
+ *  Whatever the platform refuses, typically for lack of permission, is
+ *  logged and left as it was. The thread keeps working either way.
+ *  
+ *  \param [in] high_priority Whether to run the thread above the normal
+ *         priority, or at the normal priority again.
+ *  \param [in] cpu The CPU to pin the thread to, or -1 to let it run on any.
+ *  
+ *  \return true if everything asked for was applied, false otherwise.
+ */
+bool configure_io_thread(bool high_priority, int cpu);
+
+#endif /* defined(__IO_THREAD_H__) */
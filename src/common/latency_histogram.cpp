@@ -0,0 +1,143 @@
+/*! \file
+ *  \brief File containing the implementation of \ref latency_histogram.
+ *  
+ *  File containing the implementation of \ref latency_histogram.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see latency_histogram
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-03
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "latency_histogram.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// Number of bits of a latency that pick its bucket within its power of two
+#define SUB_BUCKET_BITS 4
+
+
+
+double latency_histogram::snapshot::mean_us() const
+{
+  return (count == 0 ? 0.0 : (double) total_us / (double) count);
+}
+
+unsigned long long latency_histogram::snapshot::percentile_us(double percentile) const
+{
+  if (count == 0)
+  {
+    return 0;
+  }
+  
+  // The percentile falls on the latency of this rank, counting from the
+  // shortest
+  unsigned long long rank = (unsigned long long) ((double) count * min(max(percentile, 0.0), 100.0) / 100.0 + 0.5);
+  rank = max(rank, 1ULL);
+  unsigned long long seen = 0;
+  for (unsigned int bucket = 0; bucket < buckets.size(); ++bucket)
+  {
+    seen += buckets[bucket];
+    if (seen >= rank)
+    {
+      return min(bucket_upper_bound(bucket), max_us);
+    }
+  }
+  return max_us;
+}
+
+
+
+unsigned int latency_histogram::bucket_of(unsigned long long microseconds)
+{
+  if (microseconds < LATENCY_HISTOGRAM_SUB_BUCKETS)
+  {
+    return (unsigned int) microseconds;
+  }
+  
+  unsigned int exponent = SUB_BUCKET_BITS;
+  while (exponent < 63 && (microseconds >> (exponent + 1)) != 0)
+  {
+    ++exponent;
+  }
+  
+  // The top bits below the highest pick the bucket within the power of two
+  unsigned int sub_bucket = (unsigned int) (microseconds >> (exponent - SUB_BUCKET_BITS)) - LATENCY_HISTOGRAM_SUB_BUCKETS;
+  unsigned int bucket = LATENCY_HISTOGRAM_SUB_BUCKETS * (exponent - SUB_BUCKET_BITS + 1) + sub_bucket;
+  return min(bucket, (unsigned int) LATENCY_HISTOGRAM_NUM_BUCKETS - 1);
+}
+
+unsigned long long latency_histogram::bucket_upper_bound(unsigned int bucket)
+{
+  if (bucket < LATENCY_HISTOGRAM_SUB_BUCKETS)
+  {
+    return bucket;
+  }
+  
+  unsigned int shift = bucket / LATENCY_HISTOGRAM_SUB_BUCKETS - 1;
+  unsigned long long lower = (unsigned long long) (LATENCY_HISTOGRAM_SUB_BUCKETS + bucket % LATENCY_HISTOGRAM_SUB_BUCKETS) << shift;
+  return lower + (1ULL << shift) - 1;
+}
+
+
+
+latency_histogram::latency_histogram()
+  : m_count(0), m_total_us(0), m_max_us(0)
+{
+  for (unsigned int i = 0; i < LATENCY_HISTOGRAM_NUM_BUCKETS; ++i)
+  {
+    m_buckets[i].store(0, memory_order_relaxed);
+  }
+}
+
+
+
+void latency_histogram::record(unsigned long long microseconds)
+{
+  m_buckets[bucket_of(microseconds)].fetch_add(1, memory_order_relaxed);
+  m_count.fetch_add(1, memory_order_relaxed);
+  m_total_us.fetch_add(microseconds, memory_order_relaxed);
+  
+  unsigned long long longest = m_max_us.load(memory_order_relaxed);
+  while (microseconds > longest && !m_max_us.compare_exchange_weak(longest, microseconds, memory_order_relaxed))
+  {
+    // longest was reloaded by the failed exchange
+  }
+}
+
+void latency_histogram::record_since(chrono::steady_clock::time_point started)
+{
+  long long microseconds = (long long) chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count();
+  record((unsigned long long) max(microseconds, 0LL));
+}
+
+latency_histogram::snapshot latency_histogram::read() const
+{
+  snapshot s;
+  s.count = m_count.load(memory_order_relaxed);
+  s.total_us = m_total_us.load(memory_order_relaxed);
+  s.max_us = m_max_us.load(memory_order_relaxed);
+  s.buckets.resize(LATENCY_HISTOGRAM_NUM_BUCKETS);
+  for (unsigned int i = 0; i < LATENCY_HISTOGRAM_NUM_BUCKETS; ++i)
+  {
+    s.buckets[i] = m_buckets[i].load(memory_order_relaxed);
+  }
+  return s;
+}
+
+void latency_histogram::reset()
+{
+  for (unsigned int i = 0; i < LATENCY_HISTOGRAM_NUM_BUCKETS; ++i)
+  {
+    m_buckets[i].store(0, memory_order_relaxed);
+  }
+  m_count.store(0, memory_order_relaxed);
+  m_total_us.store(0, memory_order_relaxed);
+  m_max_us.store(0, memory_order_relaxed);
+}
@@ -0,0 +1,159 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref latency_histogram
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref latency_histogram class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-03
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __LATENCY_HISTOGRAM_H__
+#define __LATENCY_HISTOGRAM_H__
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+/*! \brief Number of buckets each power of two of microseconds is split into,
+ *         bounding the error of a percentile to one part in this many. */
+#define LATENCY_HISTOGRAM_SUB_BUCKETS 16
+
+/*! \brief Number of buckets in a \ref latency_histogram, covering latencies
+ *         up to 2^32 microseconds. Longer latencies go in the last bucket. */
+#define LATENCY_HISTOGRAM_NUM_BUCKETS (LATENCY_HISTOGRAM_SUB_BUCKETS * 29)
+
+/*! \class latency_histogram
+ *  \brief Class counting how long something took, in buckets of microseconds
+ *         that widen as latencies grow.
+ *  
+ *  Class recording latencies in the manner of an HDR histogram: latencies
+ *  under \ref LATENCY_HISTOGRAM_SUB_BUCKETS microseconds each have a bucket
+ *  of their own, and every power of two above is split into
+ *  \ref LATENCY_HISTOGRAM_SUB_BUCKETS buckets of equal width. Every latency
+ *  is therefore kept to within about 6%, from a microsecond to over an hour,
+ *  in a fixed amount of memory, so that tail latencies such as the 99.9th
+ *  percentile can be read off no matter how rare they are.
+ *  
+ *  Recording a latency costs a few relaxed atomic operations and never
+ *  allocates, so histograms can be left on in production. This class is
+ *  thread-safe; a \ref snapshot taken while latencies are being recorded may
+ *  be off by the latencies recorded meanwhile.
+ */
+class latency_histogram
+{
+public:
+  
+  /*!
+   *  \brief Struct containing a copy of the counts of a histogram.
+   */
+  struct snapshot
+  {
+    /*! \brief The number of latencies recorded. */
+    unsigned long long    count;
+    
+    /*! \brief The sum of every latency recorded, in microseconds. */
+    unsigned long long    total_us;
+    
+    /*! \brief The longest latency recorded, in microseconds. */
+    unsigned long long    max_us;
+    
+    /*! \brief The number of latencies in each bucket. */
+    std::vector<unsigned long long> buckets;
+    
+    /*!
+     *  \brief Gets the mean latency.
+     *  
+     *  \return The mean in microseconds, or 0 if nothing was recorded.
+     */
+    double                mean_us() const;
+    
+    /*!
+     *  \brief Gets the latency that a given share of latencies were no
+     *         longer than.
+     *  
+     *  \param [in] percentile The share as a percentage, such as 99.9.
+     *  
+     *  \return The upper bound of the bucket holding the percentile in
+     *          microseconds, no more than \ref max_us, or 0 if nothing was
+     *          recorded.
+     */
+    unsigned long long    percentile_us(double percentile) const;
+  };
+  
+  
+  
+  /*!
+   *  \brief Gets the bucket a latency is counted in.
+   *  
+   *  \param [in] microseconds The latency.
+   */
+  static unsigned int     bucket_of(unsigned long long microseconds);
+  
+  /*!
+   *  \brief Gets the longest latency counted in a bucket.
+   *  
+   *  \param [in] bucket The bucket.
+   *  
+   *  \return The latency in microseconds.
+   */
+  static unsigned long long bucket_upper_bound(unsigned int bucket);
+  
+  
+  
+  /*!
+   *  \brief Class constructor. Creates an empty histogram.
+   */
+                          latency_histogram();
+  
+  
+  
+  /*!
+   *  \brief Records a latency.
+   *  
+   *  \param [in] microseconds The latency.
+   */
+  void                    record(unsigned long long microseconds);
+  
+  /*!
+   *  \brief Records the time since something started.
+   *  
+   *  \param [in] started When it started. It is taken to have finished just
+   *         now.
+   */
+  void                    record_since(std::chrono::steady_clock::time_point started);
+  
+  /*!
+   *  \brief Copies the counts of the histogram.
+   */
+  snapshot                read() const;
+  
+  /*!
+   *  \brief Forgets every latency recorded so far.
+   */
+  void                    reset();
+
+
+
+private:
+  latency_histogram(const latency_histogram& other) = delete;
+  latency_histogram& operator=(const latency_histogram& other) = delete;
+  
+  
+  
+  /*! \brief The number of latencies in each bucket. */
+  std::atomic<unsigned long long> m_buckets[LATENCY_HISTOGRAM_NUM_BUCKETS];
+  
+  /*! \brief The number of latencies recorded. */
+  std::atomic<unsigned long long> m_count;
+  
+  /*! \brief The sum of every latency recorded, in microseconds. */
+  std::atomic<unsigned long long> m_total_us;
+  
+  /*! \brief The longest latency recorded, in microseconds. */
+  std::atomic<unsigned long long> m_max_us;
+};
+
+#endif /* defined(__LATENCY_HISTOGRAM_H__) */
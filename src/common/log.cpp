@@ -1,8 +1,14 @@
 /*! \file
  *  \brief File containing the definitions for logging functions.
- *
+ *  
  *  File containing the definitions for logging functions.
  *  
+ *  Log entries are formatted by the calling thread into fixed-size records and
+ *  pushed onto a bounded lock-free queue. A single background thread drains the
+ *  queue and writes the records to the log file, so logging never blocks the
+ *  caller on file I/O. If the queue stays full, records are dropped and the
+ *  number dropped is noted in the log once there is room again.
+ *  
  *  \author Daniel Andrus
  *  \date 2016-01-20
  *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
@@ -11,41 +17,265 @@
 #include "log.h"
 
 #ifndef DISABLE_LOGGING
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
 #include <fstream>
-#include <iomanip>
 #include <ctime>
-#include <stack>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define INDENT_STRING "  "
 
-#ifndef MIN_LOG_LEVEL
+// Number of records in the queue. Must be a power of 2
+#define LOG_QUEUE_SIZE       4096
 
-#ifdef DEBUG
-#define MIN_LOG_LEVEL log_level::DEBUG
-#else
-#define MIN_LOG_LEVEL log_level::INFO
-#endif // defined(DEBUG)
-#endif // defined(MIN_LOG_LEVEL)
+// Text held by a single record. Longer messages span several records
+#define LOG_RECORD_TEXT_SIZE 192
 
-#define INDENT_STRING "  "
-static int        log_prev_level = -1;
-static int        log_indent_level = 0;
-static bool       log_current_indent_level_empty = true;
-static std::stack<log_level> log_level_stack;
-static std::ofstream lout;
+// How long the writer sleeps between checks of the queue. Producers wake it
+// early each time another half of the queue has been filled
+#define LOG_WRITER_IDLE_MS   10
+
+// How many times a producer yields to the writer before dropping a record
+#define LOG_FULL_RETRIES     64
+
+struct log_record
+{
+  std::atomic<unsigned long> sequence;
+  std::time_t                time;
+  unsigned int               thread;
+  int                        indent_level;
+  bool                       continuation;
+  char                       text[LOG_RECORD_TEXT_SIZE];
+};
+
+// Bounded multi-producer queue after Dmitry Vyukov's design. Each record's
+// sequence number tells producers and the single consumer whose turn it is
+struct log_queue
+{
+  log_queue() : enqueue_pos(0), dequeue_pos(0)
+  {
+    for (unsigned long i = 0; i < LOG_QUEUE_SIZE; ++i)
+    {
+      records[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  
+  log_record                 records[LOG_QUEUE_SIZE];
+  std::atomic<unsigned long> enqueue_pos;
+  unsigned long              dequeue_pos;
+};
+
+// Nesting state is kept per thread so that threads don't indent each other
+struct log_thread_state
+{
+  log_thread_state() : id(0), prev_level(-1), indent_level(0), current_indent_level_empty(true) {}
+  
+  unsigned int           id;
+  int                    prev_level;
+  int                    indent_level;
+  bool                   current_indent_level_empty;
+  std::vector<log_level> level_stack;
+};
+
+static log_queue                 log_records;
+static std::atomic<unsigned int> log_num_dropped(0);
+static std::atomic<unsigned int> log_next_thread_id(1);
+static thread_local log_thread_state log_state;
+
+static std::ofstream             lout;
+static std::thread               log_writer;
+static std::mutex                log_writer_mutex;
+static std::condition_variable   log_writer_condition;
+static bool                      log_writer_stopping = false;
+
+#endif // defined(DISABLE_LOGGING)
+
+
+
+#ifndef DISABLE_LOGGING
+static void log_push(const char* message, bool continuation)
+{
+  if (log_state.id == 0)
+  {
+    log_state.id = log_next_thread_id.fetch_add(1);
+  }
+  
+  std::time_t now = std::time(nullptr);
+  size_t length = std::strlen(message);
+  size_t offset = 0;
+  do
+  {
+    log_record* record;
+    unsigned int retries = 0;
+    unsigned long pos = log_records.enqueue_pos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      record = &log_records.records[pos & (LOG_QUEUE_SIZE - 1)];
+      long diff = (long) (record->sequence.load(std::memory_order_acquire) - pos);
+      if (diff == 0)
+      {
+        if (log_records.enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          break;
+        }
+      }
+      else if (diff < 0)
+      {
+        // Queue is full. Give the writer a brief chance to catch up, then drop
+        // the rest of the message rather than stall the caller
+        if (retries++ == LOG_FULL_RETRIES)
+        {
+          log_num_dropped.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+        log_writer_condition.notify_one();
+        std::this_thread::yield();
+        pos = log_records.enqueue_pos.load(std::memory_order_relaxed);
+      }
+      else
+      {
+        pos = log_records.enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    
+    size_t chunk = std::min(length - offset, (size_t) LOG_RECORD_TEXT_SIZE - 1);
+    std::memcpy(record->text, message + offset, chunk);
+    record->text[chunk] = '\0';
+    record->time = now;
+    record->thread = log_state.id;
+    record->indent_level = log_state.indent_level;
+    record->continuation = continuation || offset > 0;
+    record->sequence.store(pos + 1, std::memory_order_release);
+    
+    if ((pos & (LOG_QUEUE_SIZE / 2 - 1)) == LOG_QUEUE_SIZE / 2 - 1)
+    {
+      log_writer_condition.notify_one();
+    }
+    
+    offset += chunk;
+  } while (offset < length);
+}
+
+static bool log_pop(log_record& out)
+{
+  log_record& record = log_records.records[log_records.dequeue_pos & (LOG_QUEUE_SIZE - 1)];
+  if (record.sequence.load(std::memory_order_acquire) != log_records.dequeue_pos + 1)
+  {
+    return false;
+  }
+  
+  out.time = record.time;
+  out.thread = record.thread;
+  out.indent_level = record.indent_level;
+  out.continuation = record.continuation;
+  std::memcpy(out.text, record.text, LOG_RECORD_TEXT_SIZE);
+  record.sequence.store(log_records.dequeue_pos + LOG_QUEUE_SIZE, std::memory_order_release);
+  ++log_records.dequeue_pos;
+  return true;
+}
 
+static void log_write_records()
+{
+  static unsigned int last_thread = 0;
+  static std::time_t  last_time = 0;
+  static char         last_timestamp[64] = "";
+  log_record record;
+  bool wrote = false;
+  
+  while (log_pop(record))
+  {
+    // A continuation goes on the same line only if nothing from another
+    // thread was written in between
+    if (!record.continuation || record.thread != last_thread)
+    {
+      // Timestamps only have a resolution of a second, so reuse the last one
+      if (record.time != last_time)
+      {
+        std::tm tm = *std::localtime(&record.time);
+        std::strftime(last_timestamp, sizeof(last_timestamp), "%c", &tm);
+        last_time = record.time;
+      }
+      lout << '\n' << last_timestamp << " [" << record.thread << "]: ";
+      for (int i = 0; i < record.indent_level; i++)
+      {
+        lout << INDENT_STRING;
+      }
+      if (record.continuation)
+      {
+        lout << "... ";
+      }
+    }
+    lout << record.text;
+    last_thread = record.thread;
+    wrote = true;
+  }
+  
+  unsigned int num_dropped = log_num_dropped.exchange(0, std::memory_order_relaxed);
+  if (num_dropped > 0)
+  {
+    lout << "\n(" << num_dropped << " log messages dropped)";
+    last_thread = 0;
+    wrote = true;
+  }
+  
+  if (wrote)
+  {
+    lout.flush();
+  }
+}
+
+static void log_writer_function()
+{
+  std::unique_lock<std::mutex> lock(log_writer_mutex);
+  while (!log_writer_stopping)
+  {
+    lock.unlock();
+    log_write_records();
+    lock.lock();
+    
+    // Producers never wait on the writer and only wake it occasionally, so it
+    // also polls
+    log_writer_condition.wait_for(lock, std::chrono::milliseconds(LOG_WRITER_IDLE_MS));
+  }
+  lock.unlock();
+  
+  log_write_records();
+}
 #endif // defined(DISABLE_LOGGING)
 
 
 
+std::atomic<int> log_runtime_level((int) MIN_LOG_LEVEL);
+
+
+
 void log_init()
 {
 #ifndef DISABLE_LOGGING
   lout.open("log.txt", std::ofstream::out | std::ofstream::app);
+  log_writer_stopping = false;
+  log_writer = std::thread(log_writer_function);
 #endif
 }
 
 void log_deinit()
 {
 #ifndef DISABLE_LOGGING
+  if (log_writer.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> lock(log_writer_mutex);
+      log_writer_stopping = true;
+    }
+    log_writer_condition.notify_one();
+    log_writer.join();
+  }
+  
   lout << '\n';
   lout.flush();
   lout.close();
@@ -54,6 +284,13 @@ void log_deinit()
 
 
 
+void log_set_level(log_level level)
+{
+  log_runtime_level.store((int) level, std::memory_order_relaxed);
+}
+
+
+
 void log(const char* message)
 {
 #ifndef DISABLE_LOGGING
@@ -66,29 +303,12 @@ void log(const char* message)
 void log(log_level level, const char* message)
 {
 #ifndef DISABLE_LOGGING
-  if (level >= MIN_LOG_LEVEL)
+  if (log_enabled(level))
   {
-    // Print newline
-    lout << '\n';
-    
-    // Print timestamp
-    std::time_t t = std::time(nullptr);
-    std::tm tm = *std::localtime(&t);
-    lout << std::put_time(&tm, "%c") << ": ";
-    
-    // Display indentation
-    for (int i = 0; i < log_indent_level; i++)
-    {
-      lout << INDENT_STRING;
-    }
-    
-    // Print to log and flush output
-    lout << message;
-    lout.flush();
-    
-    log_current_indent_level_empty = false;
+    log_push(message, false);
+    log_state.current_indent_level_empty = false;
   }
-  log_prev_level = level;
+  log_state.prev_level = level;
 #else
   (void) level;
   (void) message;
@@ -98,12 +318,10 @@ void log(log_level level, const char* message)
 void log_cont(const char* message)
 {
 #ifndef DISABLE_LOGGING
- if (log_prev_level >= MIN_LOG_LEVEL)
- {
-   // Print to log and flush output
-   lout << message;
-   lout.flush();
- }
+  if (log_enabled((log_level) log_state.prev_level))
+  {
+    log_push(message, true);
+  }
 #else
   (void) message;
 #endif
@@ -122,9 +340,9 @@ void log_start(log_level level, const char* message)
 {
 #ifndef DISABLE_LOGGING
   log(level, message);
-  log_indent_level++;
-  log_current_indent_level_empty = true;
-  log_level_stack.push(level);
+  log_state.indent_level++;
+  log_state.current_indent_level_empty = true;
+  log_state.level_stack.push_back(level);
 #else
   (void) level;
   (void) message;
@@ -141,20 +359,23 @@ void log_end()
 void log_end(const char* message)
 {
 #ifndef DISABLE_LOGGING
-  if (log_indent_level > 0) log_indent_level--;
+  if (log_state.indent_level > 0) log_state.indent_level--;
   if (message != nullptr)
   {
-    if (log_current_indent_level_empty)
+    if (log_state.current_indent_level_empty)
     {
       log_cont(message);
     }
     else
     {
-      log(log_level_stack.top(), message);
+      log(log_state.level_stack.empty() ? log_level::INFO : log_state.level_stack.back(), message);
     }
   }
-  log_level_stack.pop();
-  log_current_indent_level_empty = false;
+  if (!log_state.level_stack.empty())
+  {
+    log_state.level_stack.pop_back();
+  }
+  log_state.current_indent_level_empty = false;
 #else
   (void) message;
 #endif
@@ -1,9 +1,23 @@
 /*! \file
  *  \brief File containing declarations of logging functions.
- *
+ *  
  *  File containing declarations of logging functions and any prerequisites,
  *  such as the \ref log_level enum.
  *  
+ *  All logging functions are safe to call from any thread. Indentation from
+ *  \ref log_start(const char*) and \ref log_end(const char*) is tracked
+ *  separately for each thread, and entries are written to the log file by a
+ *  background thread so that callers never wait on file I/O.
+ *  
+ *  Entries below MIN_LOG_LEVEL are never written. It defaults to
+ *  \ref log_level::DEBUG in debug builds and \ref log_level::INFO otherwise,
+ *  and can be set at build time. Entries below it are dropped with a single
+ *  comparison of constants, and the level can be raised further at run time
+ *  with \ref log_set_level(log_level). Messages that are costly to build, such
+ *  as those made in transfer loops, should go through \ref LOG_MESSAGE or
+ *  \ref LOG_STREAM so that nothing is formatted for entries that are dropped,
+ *  and release builds pay nothing for them at all.
+ *  
  *  \author Daniel Andrus
  *  \date 2016-01-20
  *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
@@ -12,6 +26,9 @@
 #ifndef __LOG_H__
 #define __LOG_H__
 
+#include <atomic>
+#include <sstream>
+
 /*!
  *  \brief Enum representing the logging level for a log message.
  */
@@ -37,18 +54,81 @@ enum log_level
   INFO
 };
 
+#ifndef MIN_LOG_LEVEL
+#ifdef DEBUG
+#define MIN_LOG_LEVEL log_level::DEBUG
+#else
+#define MIN_LOG_LEVEL log_level::INFO
+#endif // defined(DEBUG)
+#endif // !defined(MIN_LOG_LEVEL)
+
+/*!
+ *  \brief The lowest level written at run time. Use \ref log_enabled() and
+ *         \ref log_set_level(log_level) rather than this.
+ */
+extern std::atomic<int> log_runtime_level;
+
+/*!
+ *  \brief Logs a message at the given level, only evaluating **message** if
+ *         an entry at that level would be written.
+ *  
+ *  \param level The level of the entry.
+ *  \param message An expression giving the entry as a C string.
+ */
+#define LOG_MESSAGE(level, message) \
+  do { if (log_enabled(level)) { log((level), (message)); } } while (0)
+
+/*!
+ *  \brief Logs a message built by streaming into a std::ostringstream, only
+ *         building it if an entry at the given level would be written.
+ *  
+ *  \param level The level of the entry.
+ *  \param stream The values to stream into the entry, separated by <<.
+ */
+#define LOG_STREAM(level, stream) \
+  do { if (log_enabled(level)) { std::ostringstream log_entry_stream; log_entry_stream << stream; log((level), log_entry_stream.str().c_str()); } } while (0)
+
 
 
 /*!
- *  \brief Initialize the logging system.
+ *  \brief Initialize the logging system, opening the log file and starting the
+ *         thread that writes to it.
  */
 void log_init();
 
 /*!
- *  \brief Deinitialize the logging system, closing files, and flushing streams.
+ *  \brief Deinitialize the logging system, writing any entries still queued,
+ *         stopping the writer thread, and closing files.
  */
 void log_deinit();
 
+/*!
+ *  \brief Sets the lowest level written from now on. Levels below
+ *         MIN_LOG_LEVEL are never written, whatever the level set.
+ *  
+ *  \param [in] level The lowest level to write.
+ */
+void log_set_level(log_level level);
+
+/*!
+ *  \brief Gets whether an entry at the given level would be written.
+ *  
+ *  Levels below MIN_LOG_LEVEL are rejected at compile time when the level is
+ *  a constant, so code guarded by this check is left out of builds that never
+ *  write it.
+ *  
+ *  \param [in] level The level of the entry.
+ */
+inline bool log_enabled(log_level level)
+{
+#ifndef DISABLE_LOGGING
+  return (level >= MIN_LOG_LEVEL && (int) level >= log_runtime_level.load(std::memory_order_relaxed));
+#else
+  (void) level;
+  return false;
+#endif
+}
+
 
 
 /*!
@@ -0,0 +1,220 @@
+/*! \file
+ *  \brief File containing the implementation of \ref mapped_file.
+ *  
+ *  File containing the implementation of \ref mapped_file.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see mapped_file
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "mapped_file.h"
+#include "archive_stream.h"
+#include "dump_archive.h"
+#include "dump_store.h"
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+
+
+// Finds the file holding the contents at a path, and where they are in it.
+// A size of -1 means the whole file
+static void locate(const std::string& path, string& file_path, unsigned long long& offset, long long& size)
+{
+  string archive_path;
+  string id;
+  if (dump_archive::split_member_path(path, archive_path, id))
+  {
+    dump_archive archive(archive_path);
+    const dump_archive::entry* member = archive.find(id);
+    if (member == nullptr)
+    {
+      throw std::runtime_error("No dump named " + id + " in " + archive_path);
+    }
+    file_path = archive_path;
+    offset = member->offset;
+    size = member->size;
+  }
+  else
+  {
+    file_path = dump_store::resolve(path);
+    offset = 0;
+    size = -1;
+  }
+}
+
+
+
+#ifdef _WIN32
+
+mapped_file::mapped_file(const std::string& path)
+  : m_data(nullptr), m_size(0), m_mapping(nullptr), m_mapping_size(0), m_is_archive(false),
+    m_file_handle(INVALID_HANDLE_VALUE), m_mapping_handle(nullptr)
+{
+  string file_path;
+  unsigned long long offset;
+  long long size;
+  locate(path, file_path, offset, size);
+  
+  // Archives stay open to dumps being added while one of theirs is mapped
+  DWORD share_mode = (size < 0 ? FILE_SHARE_READ : FILE_SHARE_READ | FILE_SHARE_WRITE);
+  m_file_handle = CreateFileA(file_path.c_str(), GENERIC_READ, share_mode, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (m_file_handle == INVALID_HANDLE_VALUE)
+  {
+    throw std::runtime_error("Unable to open file " + path);
+  }
+  
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(m_file_handle, &file_size)
+      || (size < 0 && file_size.HighPart != 0)
+      || (size >= 0 && offset + size > (unsigned long long) file_size.QuadPart))
+  {
+    CloseHandle(m_file_handle);
+    throw std::runtime_error("Unable to map file " + path);
+  }
+  m_size = (unsigned int) (size < 0 ? file_size.QuadPart : size);
+  
+  // Empty files can't be mapped, but there's nothing to map anyway
+  if (m_size == 0)
+  {
+    return;
+  }
+  
+  // Views have to start on a multiple of the allocation granularity
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+  unsigned long long start = offset - offset % system_info.dwAllocationGranularity;
+  m_mapping_size = offset - start + m_size;
+  
+  m_mapping_handle = CreateFileMappingA(m_file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (m_mapping_handle != nullptr)
+  {
+    m_mapping = MapViewOfFile(m_mapping_handle, FILE_MAP_READ, (DWORD) (start >> 32), (DWORD) start, (SIZE_T) m_mapping_size);
+  }
+  
+  if (m_mapping == nullptr)
+  {
+    if (m_mapping_handle != nullptr)
+    {
+      CloseHandle(m_mapping_handle);
+    }
+    CloseHandle(m_file_handle);
+    throw std::runtime_error("Unable to map file " + path);
+  }
+  m_data = (const unsigned char*) m_mapping + (offset - start);
+  
+  extract_if_archive();
+}
+
+mapped_file::~mapped_file()
+{
+  if (m_mapping != nullptr)
+  {
+    UnmapViewOfFile(m_mapping);
+  }
+  if (m_mapping_handle != nullptr)
+  {
+    CloseHandle(m_mapping_handle);
+  }
+  CloseHandle(m_file_handle);
+}
+
+#else
+
+mapped_file::mapped_file(const std::string& path)
+  : m_data(nullptr), m_size(0), m_mapping(nullptr), m_mapping_size(0), m_is_archive(false), m_fd(-1)
+{
+  string file_path;
+  unsigned long long offset;
+  long long size;
+  locate(path, file_path, offset, size);
+  
+  m_fd = open(file_path.c_str(), O_RDONLY);
+  if (m_fd < 0)
+  {
+    throw std::runtime_error("Unable to open file " + path);
+  }
+  
+  struct stat file_info;
+  if (fstat(m_fd, &file_info) != 0
+      || (size < 0 && (unsigned long long) file_info.st_size > 0xFFFFFFFFULL)
+      || (size >= 0 && offset + size > (unsigned long long) file_info.st_size))
+  {
+    close(m_fd);
+    throw std::runtime_error("Unable to map file " + path);
+  }
+  m_size = (unsigned int) (size < 0 ? file_info.st_size : size);
+  
+  // Empty files can't be mapped, but there's nothing to map anyway
+  if (m_size == 0)
+  {
+    return;
+  }
+  
+  // Mappings have to start on a page
+  unsigned long long start = offset - offset % (unsigned long long) sysconf(_SC_PAGESIZE);
+  m_mapping_size = offset - start + m_size;
+  
+  void* data = mmap(nullptr, (size_t) m_mapping_size, PROT_READ, MAP_PRIVATE, m_fd, (off_t) start);
+  if (data == MAP_FAILED)
+  {
+    close(m_fd);
+    throw std::runtime_error("Unable to map file " + path);
+  }
+  m_mapping = data;
+  m_data = (const unsigned char*) data + (offset - start);
+  
+  // The image is read front to back, so let the kernel read ahead
+  madvise(data, (size_t) m_mapping_size, MADV_SEQUENTIAL);
+  
+  extract_if_archive();
+}
+
+mapped_file::~mapped_file()
+{
+  if (m_mapping != nullptr)
+  {
+    munmap(m_mapping, (size_t) m_mapping_size);
+  }
+  close(m_fd);
+}
+
+#endif
+
+
+
+const unsigned char* mapped_file::data() const
+{
+  return m_is_archive ? m_extracted.data() : m_data;
+}
+
+unsigned int mapped_file::size() const
+{
+  return m_is_archive ? (unsigned int) m_extracted.size() : m_size;
+}
+
+
+
+void mapped_file::extract_if_archive()
+{
+  if (is_archive(m_data, m_size))
+  {
+    m_extracted = extract_archive(m_data, m_size);
+    m_is_archive = true;
+  }
+}
@@ -0,0 +1,128 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref mapped_file class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref mapped_file class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <string>
+#include <vector>
+
+/*! \class mapped_file
+ *  \brief Class for mapping a file read-only into memory.
+ *  
+ *  Class for mapping a file read-only into memory, so that its contents can be
+ *  used directly without copying them into buffers first. Uses
+ *  **MapViewOfFile** on Windows and **mmap** everywhere else. The mapping is
+ *  released when the object is destroyed.
+ *  
+ *  Since the mapping is never written to, a single instance can be shared
+ *  between threads, e.g. when flashing the same image to several cartridges
+ *  at once.
+ *  
+ *  Compressed archives written by \ref archive_ostream are recognized and
+ *  extracted into memory when opened, so that their uncompressed contents are
+ *  seen instead. References written by \ref dump_store are followed to the
+ *  file they refer to. A member path naming a dump inside a
+ *  \ref dump_archive maps only the part of the archive holding the dump.
+ */
+class mapped_file
+{
+public:
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  Class constructor. Opens and maps the entire file at the given path.
+   *  
+   *  \param [in] path The path of the file to map.
+   *  
+   *  \throws std::runtime_error If the file could not be opened or mapped.
+   */
+                          mapped_file(const std::string& path);
+  
+  /*!
+   *  \brief Class destructor.
+   *  
+   *  Class destructor. Unmaps the file and closes it.
+   */
+                          ~mapped_file();
+  
+  
+  
+  /*!
+   *  \brief Gets a pointer to the start of the mapped file contents, or of
+   *         the extracted contents if the file is a compressed archive.
+   *  
+   *  \return A pointer to the start of the file contents. Will be **nullptr**
+   *          if the file is empty.
+   */
+  const unsigned char*    data() const;
+  
+  /*!
+   *  \brief Gets the size of the mapped file in bytes, or of the extracted
+   *         contents if the file is a compressed archive.
+   *  
+   *  \return The number of bytes in the file.
+   */
+  unsigned int            size() const;
+  
+  
+  
+private:
+  
+  /*! \brief Disabled copy constructor. A mapping has a single owner. */
+                          mapped_file(const mapped_file& other) = delete;
+  
+  /*! \brief Disabled copy assignment operator. A mapping has a single owner. */
+  mapped_file&            operator=(const mapped_file& other) = delete;
+  
+  /*!
+   *  \brief Replaces the contents with the extracted contents if the file is
+   *         a compressed archive.
+   *  
+   *  \throws std::runtime_error If the archive is corrupt.
+   */
+  void                    extract_if_archive();
+  
+  
+  
+  /*! \brief Pointer to the start of the mapped contents. */
+  const unsigned char*    m_data;
+  
+  /*! \brief Size of the mapped contents in bytes. */
+  unsigned int            m_size;
+  
+  /*! \brief Start of the mapping, which may begin before \ref m_data to
+   *         keep it aligned when only part of a file is mapped. */
+  void*                   m_mapping;
+  
+  /*! \brief Size of the mapping in bytes. */
+  unsigned long long      m_mapping_size;
+  
+  /*! \brief Whether the file is a compressed archive. */
+  bool                    m_is_archive;
+  
+  /*! \brief The extracted contents if the file is a compressed archive. */
+  std::vector<unsigned char> m_extracted;
+  
+#ifdef _WIN32
+  /*! \brief Windows handle of the open file. */
+  void*                   m_file_handle;
+  
+  /*! \brief Windows handle of the file mapping object. */
+  void*                   m_mapping_handle;
+#else
+  /*! \brief File descriptor of the open file. */
+  int                     m_fd;
+#endif
+};
+
+#endif /* defined(__MAPPED_FILE_H__) */
@@ -0,0 +1,147 @@
+/*! \file
+ *  \brief File containing the implementation of \ref memory_budget.
+ *  
+ *  File containing the implementation of \ref memory_budget.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see memory_budget
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-08
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "memory_budget.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+// How often a waiting reservation asks the reclaimers again, since memory
+// given back by a job is often kept idle by its pool rather than released
+#define RECLAIM_INTERVAL_MS 20
+
+using namespace std;
+
+static atomic<memory_budget*> current_budget(nullptr);
+
+
+
+memory_budget* process_memory_budget()
+{
+  return current_budget.load();
+}
+
+void set_process_memory_budget(memory_budget* budget)
+{
+  current_budget.store(budget);
+}
+
+
+
+memory_budget::memory_budget(unsigned long long limit)
+  : m_next_reclaimer_id(1)
+{
+  m_usage.limit = limit;
+  m_usage.used = 0;
+  m_usage.peak = 0;
+  m_usage.num_waits = 0;
+  m_usage.num_overcommits = 0;
+  m_usage.num_refused = 0;
+}
+
+
+
+void memory_budget::reserve(unsigned long long num_bytes)
+{
+  unique_lock<mutex> lock(m_mutex);
+  if (fits(num_bytes))
+  {
+    take(num_bytes);
+    return;
+  }
+  ++m_usage.num_waits;
+  
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(MEMORY_BUDGET_MAX_WAIT_MS);
+  while (!fits(num_bytes))
+  {
+    auto now = chrono::steady_clock::now();
+    if (now >= deadline)
+    {
+      ++m_usage.num_overcommits;
+      break;
+    }
+    
+    // Memory kept only to save time goes before anyone waits
+    unsigned long long wanted = m_usage.used + num_bytes - m_usage.limit;
+    lock.unlock();
+    {
+      lock_guard<mutex> reclaim_lock(m_reclaim_mutex);
+      for (auto& entry : m_reclaimers)
+      {
+        entry.second(wanted);
+      }
+    }
+    lock.lock();
+    
+    m_released.wait_for(lock, min(chrono::duration_cast<chrono::steady_clock::duration>(chrono::milliseconds(RECLAIM_INTERVAL_MS)), deadline - now),
+                        [this, num_bytes] { return fits(num_bytes); });
+  }
+  take(num_bytes);
+}
+
+bool memory_budget::try_reserve(unsigned long long num_bytes)
+{
+  lock_guard<mutex> lock(m_mutex);
+  if (m_usage.used + num_bytes > m_usage.limit)
+  {
+    ++m_usage.num_refused;
+    return false;
+  }
+  take(num_bytes);
+  return true;
+}
+
+void memory_budget::release(unsigned long long num_bytes)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_usage.used = (num_bytes < m_usage.used ? m_usage.used - num_bytes : 0);
+  m_released.notify_all();
+}
+
+memory_budget::usage memory_budget::get_usage()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_usage;
+}
+
+unsigned int memory_budget::add_reclaimer(reclaimer function)
+{
+  lock_guard<mutex> lock(m_reclaim_mutex);
+  unsigned int id = m_next_reclaimer_id++;
+  m_reclaimers[id] = function;
+  return id;
+}
+
+void memory_budget::remove_reclaimer(unsigned int id)
+{
+  lock_guard<mutex> lock(m_reclaim_mutex);
+  m_reclaimers.erase(id);
+}
+
+
+
+bool memory_budget::fits(unsigned long long num_bytes) const
+{
+  return m_usage.used == 0 || m_usage.used + num_bytes <= m_usage.limit;
+}
+
+void memory_budget::take(unsigned long long num_bytes)
+{
+  m_usage.used += num_bytes;
+  if (m_usage.used > m_usage.peak)
+  {
+    m_usage.peak = m_usage.used;
+  }
+}
@@ -0,0 +1,209 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref memory_budget class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref memory_budget class and of the functions setting the budget the whole
+ *  process shares.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-08
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __MEMORY_BUDGET_H__
+#define __MEMORY_BUDGET_H__
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+
+/*! \brief The longest a reservation waits for memory to be released before
+ *         it is let through over the limit, in milliseconds. */
+#define MEMORY_BUDGET_MAX_WAIT_MS 5000
+
+/*! \class memory_budget
+ *  \brief Class capping the memory held by buffers and caches across every
+ *         device.
+ *  
+ *  Class keeping count of the bytes held by the buffer pools of every device,
+ *  the images kept by an \ref image_cache, and the reads kept by each
+ *  device's read cache, so that a host running many jobs at once stays
+ *  within a fixed amount of memory instead of growing with the number of
+ *  devices.
+ *  
+ *  Memory that is needed to make progress, such as the buffers of a
+ *  pipeline, is taken with \ref reserve(), which blocks while the budget is
+ *  spent, so that jobs starting while others hold the memory wait for it
+ *  rather than adding to it. Before waiting, the budget asks every registered
+ *  reclaimer to give up memory that is only kept to save time, such as idle
+ *  buffers and cached images, least recently used first. So that jobs each
+ *  holding part of what they need can't stall one another for good, a
+ *  reservation that waits longer than \ref MEMORY_BUDGET_MAX_WAIT_MS is let
+ *  through over the limit and counted as an overcommit.
+ *  
+ *  Memory that is only worth keeping if there is room, such as a cached
+ *  image, is taken with \ref try_reserve(), which never waits.
+ *  
+ *  This class is thread-safe. Reclaimers are called from whichever thread is
+ *  reserving memory, and must not reserve memory themselves.
+ */
+class memory_budget
+{
+public:
+  
+  /*!
+   *  \brief Type of a function giving up memory when the budget runs out.
+   *  
+   *  Called with the number of bytes wanted, and returning after releasing as
+   *  much of it as it can through \ref release().
+   */
+  typedef std::function<void(unsigned long long)> reclaimer;
+  
+  /*!
+   *  \brief Struct holding counters of how the budget has been used.
+   */
+  struct usage
+  {
+    /*! \brief The limit in bytes. */
+    unsigned long long    limit;
+    
+    /*! \brief The number of bytes reserved now. */
+    unsigned long long    used;
+    
+    /*! \brief The most bytes reserved at once. */
+    unsigned long long    peak;
+    
+    /*! \brief The number of reservations that had to wait for memory. */
+    unsigned long long    num_waits;
+    
+    /*! \brief The number of reservations let through over the limit. */
+    unsigned long long    num_overcommits;
+    
+    /*! \brief The number of reservations by \ref try_reserve() turned down. */
+    unsigned long long    num_refused;
+  };
+  
+  
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in] limit The most bytes to hold at once.
+   */
+  explicit                memory_budget(unsigned long long limit);
+  
+  
+  
+  /*!
+   *  \brief Reserves memory, waiting for it if the budget is spent.
+   *  
+   *  Asks the reclaimers for memory if the reservation doesn't fit, then
+   *  waits for it to be released. A reservation made while nothing else is
+   *  reserved always goes through, however large.
+   *  
+   *  \param [in] num_bytes The number of bytes to reserve.
+   */
+  void                    reserve(unsigned long long num_bytes);
+  
+  /*!
+   *  \brief Reserves memory if it fits without waiting or reclaiming.
+   *  
+   *  \param [in] num_bytes The number of bytes to reserve.
+   *  
+   *  \return true if the memory was reserved, false otherwise.
+   */
+  bool                    try_reserve(unsigned long long num_bytes);
+  
+  /*!
+   *  \brief Releases memory reserved earlier.
+   *  
+   *  \param [in] num_bytes The number of bytes to release.
+   */
+  void                    release(unsigned long long num_bytes);
+  
+  /*!
+   *  \brief Gets the counters of how the budget has been used.
+   */
+  usage                   get_usage();
+  
+  /*!
+   *  \brief Registers a function to call for memory when the budget runs out.
+   *  
+   *  \param [in] function The function to call.
+   *  
+   *  \return An ID to pass to \ref remove_reclaimer().
+   */
+  unsigned int            add_reclaimer(reclaimer function);
+  
+  /*!
+   *  \brief Unregisters a function added with \ref add_reclaimer(), waiting
+   *         for it to return if it is being called.
+   *  
+   *  \param [in] id The ID returned when it was added.
+   */
+  void                    remove_reclaimer(unsigned int id);
+
+
+
+private:
+  
+  /*! \brief Disabled copy constructor. */
+                          memory_budget(const memory_budget& other) = delete;
+  
+  /*! \brief Disabled copy assignment operator. */
+  memory_budget&          operator=(const memory_budget& other) = delete;
+  
+  /*!
+   *  \brief Checks whether a reservation fits. Must be called with
+   *         \ref m_mutex held.
+   */
+  bool                    fits(unsigned long long num_bytes) const;
+  
+  /*!
+   *  \brief Records a reservation. Must be called with \ref m_mutex held.
+   */
+  void                    take(unsigned long long num_bytes);
+  
+  
+  
+  /*! \brief Counters of how the budget has been used. */
+  usage                   m_usage;
+  
+  /*! \brief Mutex guarding \ref m_usage. */
+  std::mutex              m_mutex;
+  
+  /*! \brief Condition signalled when memory is released. */
+  std::condition_variable m_released;
+  
+  /*! \brief The registered reclaimers, indexed by ID. */
+  std::map<unsigned int, reclaimer> m_reclaimers;
+  
+  /*! \brief The ID to give the next reclaimer. */
+  unsigned int            m_next_reclaimer_id;
+  
+  /*! \brief Mutex guarding \ref m_reclaimers, held while they are called so
+   *         that none is removed in the middle of a call. */
+  std::mutex              m_reclaim_mutex;
+};
+
+
+
+/*!
+ *  \brief Gets the budget buffers and caches made from now on take their
+ *         memory from, or **nullptr** if there is no limit.
+ */
+memory_budget* process_memory_budget();
+
+/*!
+ *  \brief Sets the budget buffers and caches made from now on take their
+ *         memory from.
+ *  
+ *  Should be called once at startup, before any devices are opened. The
+ *  budget must outlive every buffer pool and cache created while it is set.
+ *  
+ *  \param [in] budget The budget, or **nullptr** for no limit.
+ */
+void set_process_memory_budget(memory_budget* budget);
+
+#endif /* defined(__MEMORY_BUDGET_H__) */
@@ -0,0 +1,146 @@
+/*! \file
+ *  \brief File containing the definitions of the metrics registry.
+ *  
+ *  File containing the definitions of the \ref metric class and the metrics
+ *  registry functions.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "metrics.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+
+struct metric_family
+{
+  metric_type             type;
+  std::string             help;
+  std::map<std::string, std::unique_ptr<metric>> metrics;
+};
+
+// Families are kept sorted by name so that the export is stable
+static std::mutex                            metrics_mutex;
+static std::map<std::string, metric_family>  metrics_families;
+
+
+
+static metric* metrics_get(const std::string& name, metric_type type, const std::string& help, const std::string& labels)
+{
+  std::lock_guard<std::mutex> lock(metrics_mutex);
+  
+  auto family_it = metrics_families.find(name);
+  if (family_it == metrics_families.end())
+  {
+    metric_family family;
+    family.type = type;
+    family.help = help;
+    family_it = metrics_families.emplace(name, std::move(family)).first;
+  }
+  
+  std::unique_ptr<metric>& m = family_it->second.metrics[labels];
+  if (m == nullptr)
+  {
+    m.reset(new metric());
+  }
+  return m.get();
+}
+
+static void metrics_write_escaped(std::ostream& out, const std::string& text)
+{
+  for (char c : text)
+  {
+    switch (c)
+    {
+    case '\\': out << "\\\\"; break;
+    case '\n': out << "\\n";  break;
+    default:   out << c;      break;
+    }
+  }
+}
+
+
+
+metric::metric()
+  : m_value(0.0)
+{
+  // Nothing else to do
+}
+
+void metric::add(double amount)
+{
+  double value = m_value.load(std::memory_order_relaxed);
+  while (!m_value.compare_exchange_weak(value, value + amount, std::memory_order_relaxed))
+  {
+    // value was reloaded by the failed exchange
+  }
+}
+
+void metric::set(double value)
+{
+  m_value.store(value, std::memory_order_relaxed);
+}
+
+double metric::value() const
+{
+  return m_value.load(std::memory_order_relaxed);
+}
+
+
+
+metric* metrics_counter(const std::string& name, const std::string& help, const std::string& labels)
+{
+  return metrics_get(name, METRIC_COUNTER, help, labels);
+}
+
+metric* metrics_gauge(const std::string& name, const std::string& help, const std::string& labels)
+{
+  return metrics_get(name, METRIC_GAUGE, help, labels);
+}
+
+std::string metrics_label(const std::string& name, const std::string& value)
+{
+  std::string result = name + "=\"";
+  for (char c : value)
+  {
+    switch (c)
+    {
+    case '\\': result += "\\\\"; break;
+    case '"':  result += "\\\""; break;
+    case '\n': result += "\\n";  break;
+    default:   result += c;      break;
+    }
+  }
+  return result + "\"";
+}
+
+void metrics_write_prometheus(std::ostream& out)
+{
+  std::lock_guard<std::mutex> lock(metrics_mutex);
+  
+  // Counters of bytes quickly outgrow the default precision
+  std::streamsize precision = out.precision(15);
+  for (const auto& family : metrics_families)
+  {
+    out << "# HELP " << family.first << " ";
+    metrics_write_escaped(out, family.second.help);
+    out << "\n# TYPE " << family.first << " "
+        << (family.second.type == METRIC_COUNTER ? "counter" : "gauge") << "\n";
+    
+    for (const auto& m : family.second.metrics)
+    {
+      out << family.first;
+      if (!m.first.empty())
+      {
+        out << "{" << m.first << "}";
+      }
+      out << " " << m.second->value() << "\n";
+    }
+  }
+  out.precision(precision);
+  out.flush();
+}
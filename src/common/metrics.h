@@ -0,0 +1,123 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref metric class and the
+ *         functions of the metrics registry.
+ *  
+ *  File containing the declaration of the \ref metric class and the functions
+ *  used to look up metrics in the process-wide registry and export them in the
+ *  Prometheus text exposition format.
+ *  
+ *  Metrics are identified by a name and a set of labels. Looking one up takes
+ *  a lock, so hot paths look their metrics up once and keep the pointer;
+ *  updating a metric afterwards costs a single atomic operation. Metrics are
+ *  never freed, so the pointers stay valid for the lifetime of the process.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <atomic>
+#include <iosfwd>
+#include <string>
+
+/*!
+ *  \brief Enum representing how a metric's value is to be interpreted.
+ */
+enum metric_type
+{
+  /*! \brief A value that only ever goes up, such as a number of bytes. */
+  METRIC_COUNTER,
+  
+  /*! \brief A value that can go up and down, such as a rate. */
+  METRIC_GAUGE
+};
+
+/*! \class metric
+ *  \brief A single named and labelled value in the metrics registry.
+ *  
+ *  This class is thread-safe.
+ */
+class metric
+{
+public:
+  
+  /*!
+   *  \brief Constructs a metric with a value of 0.
+   */
+                          metric();
+  
+  /*!
+   *  \brief Adds to the value.
+   *  
+   *  \param [in] amount The amount to add.
+   */
+  void                    add(double amount = 1.0);
+  
+  /*!
+   *  \brief Replaces the value. Only meaningful for gauges.
+   *  
+   *  \param [in] value The new value.
+   */
+  void                    set(double value);
+  
+  /*!
+   *  \brief Gets the current value.
+   */
+  double                  value() const;
+
+
+
+private:
+  metric(const metric& other) = delete;
+  metric& operator=(const metric& other) = delete;
+  
+  /*! \brief The current value. */
+  std::atomic<double>     m_value;
+};
+
+
+
+/*!
+ *  \brief Gets the counter with the given name and labels, creating it if
+ *         necessary.
+ *  
+ *  \param [in] name The name of the metric, e.g. "flashmasta_usb_bytes_total".
+ *  \param [in] help A one-line description of the metric. Only the first
+ *         description given for a name is kept.
+ *  \param [in] labels The metric's labels as comma-separated pairs built with
+ *         \ref metrics_label(), or an empty string for none.
+ *  
+ *  \return The counter. Never nullptr.
+ */
+metric* metrics_counter(const std::string& name, const std::string& help, const std::string& labels = "");
+
+/*!
+ *  \brief Gets the gauge with the given name and labels, creating it if
+ *         necessary.
+ *  
+ *  \see metrics_counter(const std::string&, const std::string&, const std::string&)
+ */
+metric* metrics_gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+
+/*!
+ *  \brief Builds one label pair, escaping the value as Prometheus requires.
+ *  
+ *  \param [in] name The name of the label.
+ *  \param [in] value The value of the label.
+ *  
+ *  \return The pair in the form name="value".
+ */
+std::string metrics_label(const std::string& name, const std::string& value);
+
+/*!
+ *  \brief Writes every metric in the registry to the output in the Prometheus
+ *         text exposition format.
+ *  
+ *  \param [out] out The stream to write to.
+ */
+void metrics_write_prometheus(std::ostream& out);
+
+#endif /* defined(__METRICS_H__) */
@@ -0,0 +1,205 @@
+/*! \file
+ *  \brief File containing the implementation of the \ref metrics_server class.
+ *  
+ *  File containing the implementation of the \ref metrics_server class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "metrics_server.h"
+#include "metrics.h"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#if defined(OS_WINDOWS)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET socket_t;
+#define INVALID_SOCKET_VALUE INVALID_SOCKET
+#define close_socket closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int    socket_t;
+#define INVALID_SOCKET_VALUE (-1)
+#define close_socket ::close
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Requests are never more than a line or two
+#define MAX_REQUEST_SIZE 4096
+
+metrics_server::metrics_server(unsigned short port)
+  : m_port(port), m_socket(-1), m_stopping(false)
+{
+  // Nothing else to do
+}
+
+metrics_server::~metrics_server()
+{
+  stop();
+}
+
+void metrics_server::start()
+{
+  if (m_thread.joinable())
+  {
+    return;
+  }
+  
+#if defined(OS_WINDOWS)
+  WSADATA wsa_data;
+  if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+  {
+    throw std::runtime_error("Unable to initialize Winsock");
+  }
+#endif
+  
+  socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (s == INVALID_SOCKET_VALUE)
+  {
+    throw std::runtime_error("Unable to create metrics socket");
+  }
+  
+  int reuse = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*) &reuse, sizeof(reuse));
+  
+  // Only accept connections from this machine
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(m_port);
+  if (::bind(s, (const sockaddr*) &address, sizeof(address)) != 0 || listen(s, 4) != 0)
+  {
+    close_socket(s);
+    throw std::runtime_error("Unable to listen for metrics requests on port " + std::to_string(m_port));
+  }
+  
+  m_socket = (long long) s;
+  m_stopping = false;
+  m_thread = std::thread(&metrics_server::serve, this);
+}
+
+void metrics_server::stop()
+{
+  if (!m_thread.joinable())
+  {
+    return;
+  }
+  
+  m_stopping = true;
+  m_thread.join();
+  close_socket((socket_t) m_socket);
+  m_socket = -1;
+  
+#if defined(OS_WINDOWS)
+  WSACleanup();
+#endif
+}
+
+
+
+void metrics_server::serve()
+{
+  socket_t s = (socket_t) m_socket;
+  while (!m_stopping)
+  {
+    // Wait for a connection, checking every so often whether to stop
+    fd_set ready;
+    FD_ZERO(&ready);
+    FD_SET(s, &ready);
+    timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = METRICS_SERVER_POLL_MS * 1000;
+    if (select((int) s + 1, &ready, nullptr, nullptr, &timeout) <= 0)
+    {
+      continue;
+    }
+    
+    socket_t client = accept(s, nullptr, nullptr);
+    if (client == INVALID_SOCKET_VALUE)
+    {
+      continue;
+    }
+    handle_connection((long long) client);
+    close_socket(client);
+  }
+}
+
+void metrics_server::handle_connection(long long client)
+{
+  socket_t c = (socket_t) client;
+  
+  // Read until the end of the request's headers; the body, if any, is ignored
+  std::string request;
+  char buffer[512];
+  while (request.size() < MAX_REQUEST_SIZE && request.find("\r\n\r\n") == std::string::npos)
+  {
+    fd_set ready;
+    FD_ZERO(&ready);
+    FD_SET(c, &ready);
+    timeval timeout;
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    if (select((int) c + 1, &ready, nullptr, nullptr, &timeout) <= 0)
+    {
+      return;
+    }
+    
+    int num_read = (int) recv(c, buffer, sizeof(buffer), 0);
+    if (num_read <= 0)
+    {
+      return;
+    }
+    request.append(buffer, (size_t) num_read);
+  }
+  
+  std::string status;
+  std::string content_type = "text/plain; charset=utf-8";
+  std::ostringstream body;
+  if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 13, "GET /metrics?") == 0)
+  {
+    status = "200 OK";
+    content_type = "text/plain; version=0.0.4; charset=utf-8";
+    metrics_write_prometheus(body);
+  }
+  else if (request.compare(0, 4, "GET ") == 0)
+  {
+    status = "404 Not Found";
+    body << "Metrics are served at /metrics\n";
+  }
+  else
+  {
+    status = "405 Method Not Allowed";
+  }
+  
+  std::string content = body.str();
+  std::string response = "HTTP/1.0 " + status + "\r\n"
+    "Content-Type: " + content_type + "\r\n"
+    "Content-Length: " + std::to_string(content.size()) + "\r\n"
+    "Connection: close\r\n"
+    "\r\n" + content;
+  
+  size_t sent = 0;
+  while (sent < response.size())
+  {
+    int num_sent = (int) send(c, response.data() + sent, (int) (response.size() - sent), MSG_NOSIGNAL);
+    if (num_sent <= 0)
+    {
+      return;
+    }
+    sent += (size_t) num_sent;
+  }
+}
@@ -0,0 +1,92 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref metrics_server class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref metrics_server class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __METRICS_SERVER_H__
+#define __METRICS_SERVER_H__
+
+#include <atomic>
+#include <thread>
+
+/*! \brief How long the server waits for a connection before checking whether
+ *         it has been asked to stop, in milliseconds. */
+#define METRICS_SERVER_POLL_MS 200
+
+/*! \class metrics_server
+ *  \brief Minimal HTTP server exposing the metrics registry.
+ *  
+ *  Minimal HTTP server that answers every GET request for "/metrics" with the
+ *  contents of the metrics registry in the Prometheus text exposition format,
+ *  as written by \ref metrics_write_prometheus(). The server only listens on
+ *  the loopback interface and handles one request at a time on a thread of
+ *  its own, which is plenty for a scraper polling every few seconds.
+ */
+class metrics_server
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Does not start the server.
+   *  
+   *  \param [in] port The TCP port to listen on.
+   */
+  explicit                metrics_server(unsigned short port);
+  
+  /*!
+   *  \brief Class destructor. Stops the server if it is running.
+   */
+                          ~metrics_server();
+  
+  /*!
+   *  \brief Starts listening and serving requests in the background.
+   *  
+   *  \throws std::runtime_error If the port could not be listened on.
+   */
+  void                    start();
+  
+  /*!
+   *  \brief Stops the server, waiting for any request being served to finish.
+   */
+  void                    stop();
+
+
+
+private:
+  metrics_server(const metrics_server& other) = delete;
+  metrics_server& operator=(const metrics_server& other) = delete;
+  
+  /*!
+   *  \brief Entry point of the server thread.
+   */
+  void                    serve();
+  
+  /*!
+   *  \brief Reads one request from a connection and answers it.
+   *  
+   *  \param [in] client The socket of the connection.
+   */
+  void                    handle_connection(long long client);
+  
+  
+
+  /*! \brief The TCP port to listen on. */
+  const unsigned short    m_port;
+  
+  /*! \brief The listening socket, or -1 if not listening. */
+  long long               m_socket;
+  
+  /*! \brief Flag telling the server thread to stop. */
+  std::atomic<bool>       m_stopping;
+  
+  /*! \brief The server thread. */
+  std::thread             m_thread;
+};
+
+#endif /* defined(__METRICS_SERVER_H__) */
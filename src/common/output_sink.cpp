@@ -0,0 +1,460 @@
+/*! \file
+ *  \brief File containing the implementation of \ref output_sink and its
+ *         implementations.
+ *  
+ *  File containing the implementation of \ref ostream_sink, \ref file_sink,
+ *  \ref sink_streambuf, and \ref sink_ostream.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see output_sink
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "output_sink.h"
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+
+
+ostream_sink::ostream_sink(std::ostream& out)
+  : m_out(out)
+{
+  // Nothing else to do
+}
+
+void ostream_sink::write(const unsigned char* data, unsigned int num_bytes)
+{
+  m_out.write((const char*) data, num_bytes);
+  if (!m_out.good())
+  {
+    throw std::runtime_error("Error occured while writing to file");
+  }
+}
+
+void ostream_sink::seek(unsigned long long offset)
+{
+  m_out.seekp((streamoff) offset);
+  if (!m_out.good())
+  {
+    throw std::runtime_error("Unable to seek in file");
+  }
+}
+
+long long ostream_sink::tell()
+{
+  return (long long) m_out.tellp();
+}
+
+void ostream_sink::flush()
+{
+  m_out.flush();
+  if (!m_out.good())
+  {
+    throw std::runtime_error("Error occured while writing to file");
+  }
+}
+
+
+
+#ifdef _WIN32
+
+file_sink::file_sink(const std::string& path, unsigned long long expected_size, bool keep_contents)
+  : m_path(path), m_position(0), m_reserved(false), m_file_handle(INVALID_HANDLE_VALUE)
+{
+  m_file_handle = CreateFileA(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, keep_contents ? OPEN_EXISTING : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (m_file_handle == INVALID_HANDLE_VALUE)
+  {
+    throw std::runtime_error("Unable to open file " + path);
+  }
+  
+  if (expected_size > 0)
+  {
+    if (!reserve(expected_size))
+    {
+      CloseHandle(m_file_handle);
+      throw std::runtime_error("Not enough space for file " + path);
+    }
+    m_reserved = true;
+  }
+}
+
+file_sink::~file_sink()
+{
+  if (m_file_handle != INVALID_HANDLE_VALUE)
+  {
+    CloseHandle(m_file_handle);
+  }
+}
+
+void file_sink::write(const unsigned char* data, unsigned int num_bytes)
+{
+  while (num_bytes > 0)
+  {
+    DWORD written = 0;
+    if (!WriteFile(m_file_handle, data, num_bytes, &written, nullptr) || written == 0)
+    {
+      throw std::runtime_error("Error occured while writing to file " + m_path);
+    }
+    data += written;
+    num_bytes -= written;
+    m_position += written;
+  }
+}
+
+void file_sink::seek(unsigned long long offset)
+{
+  LARGE_INTEGER distance;
+  distance.QuadPart = (LONGLONG) offset;
+  if (!SetFilePointerEx(m_file_handle, distance, nullptr, FILE_BEGIN))
+  {
+    throw std::runtime_error("Unable to seek in file " + m_path);
+  }
+  m_position = offset;
+}
+
+void file_sink::flush()
+{
+  // Writes aren't buffered, so there is nothing to hand on
+}
+
+void file_sink::close()
+{
+  if (m_file_handle == INVALID_HANDLE_VALUE)
+  {
+    return;
+  }
+  
+  // Windows releases the space reserved past the end of the file once the
+  // last handle to it is closed
+  BOOL closed = CloseHandle(m_file_handle);
+  m_file_handle = INVALID_HANDLE_VALUE;
+  if (!closed)
+  {
+    throw std::runtime_error("Unable to write file " + m_path);
+  }
+}
+
+bool file_sink::reserve(unsigned long long num_bytes)
+{
+#if defined(_WIN32_WINNT) && _WIN32_WINNT >= 0x0600
+  FILE_ALLOCATION_INFO info;
+  info.AllocationSize.QuadPart = (LONGLONG) num_bytes;
+  if (SetFileInformationByHandle(m_file_handle, FileAllocationInfo, &info, sizeof(info)))
+  {
+    return true;
+  }
+  return GetLastError() != ERROR_DISK_FULL;
+#else
+  // Setting the allocation size needs Windows Vista
+  (void) num_bytes;
+  return true;
+#endif
+}
+
+#else
+
+file_sink::file_sink(const std::string& path, unsigned long long expected_size, bool keep_contents)
+  : m_path(path), m_position(0), m_reserved(false), m_fd(-1)
+{
+  m_fd = open(path.c_str(), O_WRONLY | (keep_contents ? 0 : O_CREAT | O_TRUNC), 0666);
+  if (m_fd < 0)
+  {
+    throw std::runtime_error("Unable to open file " + path);
+  }
+  
+  if (expected_size > 0)
+  {
+    if (!reserve(expected_size))
+    {
+      ::close(m_fd);
+      throw std::runtime_error("Not enough space for file " + path);
+    }
+    m_reserved = true;
+  }
+}
+
+file_sink::~file_sink()
+{
+  if (m_fd >= 0)
+  {
+    ::close(m_fd);
+  }
+}
+
+void file_sink::write(const unsigned char* data, unsigned int num_bytes)
+{
+  while (num_bytes > 0)
+  {
+    ssize_t written = ::write(m_fd, data, num_bytes);
+    if (written < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (written <= 0)
+    {
+      throw std::runtime_error("Error occured while writing to file " + m_path);
+    }
+    data += written;
+    num_bytes -= (unsigned int) written;
+    m_position += (unsigned long long) written;
+  }
+}
+
+void file_sink::seek(unsigned long long offset)
+{
+  if (lseek(m_fd, (off_t) offset, SEEK_SET) == (off_t) -1)
+  {
+    throw std::runtime_error("Unable to seek in file " + m_path);
+  }
+  m_position = offset;
+}
+
+void file_sink::flush()
+{
+  // Writes aren't buffered, so there is nothing to hand on
+}
+
+void file_sink::close()
+{
+  if (m_fd < 0)
+  {
+    return;
+  }
+  
+  // Space reserved past the end of the file stays reserved until the file is
+  // truncated, even to the size it already has
+  bool ok = true;
+  if (m_reserved)
+  {
+    struct stat info;
+    ok = (fstat(m_fd, &info) == 0 && ftruncate(m_fd, info.st_size) == 0);
+  }
+  ok = (::close(m_fd) == 0) && ok;
+  m_fd = -1;
+  if (!ok)
+  {
+    throw std::runtime_error("Unable to write file " + m_path);
+  }
+}
+
+bool file_sink::reserve(unsigned long long num_bytes)
+{
+#if defined(__linux__)
+  if (fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, (off_t) num_bytes) == 0)
+  {
+    return true;
+  }
+  return errno != ENOSPC;
+#elif defined(__APPLE__)
+  // Ask for one contiguous piece first, then for any space at all
+  fstore_t store;
+  memset(&store, 0, sizeof(store));
+  store.fst_flags = F_ALLOCATECONTIG;
+  store.fst_posmode = F_PEOFPOSMODE;
+  store.fst_length = (off_t) num_bytes;
+  if (fcntl(m_fd, F_PREALLOCATE, &store) != -1)
+  {
+    return true;
+  }
+  store.fst_flags = F_ALLOCATEALL;
+  if (fcntl(m_fd, F_PREALLOCATE, &store) != -1)
+  {
+    return true;
+  }
+  return errno != ENOSPC;
+#else
+  (void) num_bytes;
+  return true;
+#endif
+}
+
+#endif
+
+long long file_sink::tell()
+{
+  return (long long) m_position;
+}
+
+
+
+sink_streambuf::sink_streambuf(output_sink& sink)
+  : m_sink(sink), m_buffer(SINK_STREAM_BUFFER_SIZE)
+{
+  setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+}
+
+sink_streambuf::~sink_streambuf()
+{
+  write_buffer();
+}
+
+output_sink& sink_streambuf::sink()
+{
+  return m_sink;
+}
+
+sink_streambuf::int_type sink_streambuf::overflow(int_type ch)
+{
+  if (!write_buffer())
+  {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(ch, traits_type::eof()))
+  {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+  return traits_type::not_eof(ch);
+}
+
+std::streamsize sink_streambuf::xsputn(const char_type* s, std::streamsize count)
+{
+  // Large blocks, like those of a backup, go straight to the sink rather than
+  // being copied through the buffer
+  if (count >= (std::streamsize) m_buffer.size())
+  {
+    if (!write_buffer())
+    {
+      return 0;
+    }
+    try
+    {
+      m_sink.write((const unsigned char*) s, (unsigned int) count);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      return 0;
+    }
+    return count;
+  }
+  
+  std::streamsize written = 0;
+  while (written < count)
+  {
+    if (pptr() == epptr() && !write_buffer())
+    {
+      break;
+    }
+    std::streamsize num_bytes = count - written;
+    if (num_bytes > epptr() - pptr())
+    {
+      num_bytes = epptr() - pptr();
+    }
+    memcpy(pptr(), s + written, (size_t) num_bytes);
+    pbump((int) num_bytes);
+    written += num_bytes;
+  }
+  return written;
+}
+
+int sink_streambuf::sync()
+{
+  if (!write_buffer())
+  {
+    return -1;
+  }
+  try
+  {
+    m_sink.flush();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    return -1;
+  }
+  return 0;
+}
+
+sink_streambuf::pos_type sink_streambuf::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+{
+  // The end of a sink isn't known
+  if ((which & ios_base::out) == 0 || dir == ios_base::end || !write_buffer())
+  {
+    return pos_type(off_type(-1));
+  }
+  
+  try
+  {
+    long long position = off;
+    if (dir == ios_base::cur)
+    {
+      long long current = m_sink.tell();
+      if (current < 0)
+      {
+        return pos_type(off_type(-1));
+      }
+      if (off == 0)
+      {
+        return pos_type(off_type(current));
+      }
+      position += current;
+    }
+    if (position < 0)
+    {
+      return pos_type(off_type(-1));
+    }
+    m_sink.seek((unsigned long long) position);
+    return pos_type(off_type(position));
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    return pos_type(off_type(-1));
+  }
+}
+
+sink_streambuf::pos_type sink_streambuf::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+  return seekoff(off_type(pos), ios_base::beg, which);
+}
+
+bool sink_streambuf::write_buffer()
+{
+  unsigned int num_bytes = (unsigned int) (pptr() - pbase());
+  setp(m_buffer.data(), m_buffer.data() + m_buffer.size());
+  if (num_bytes == 0)
+  {
+    return true;
+  }
+  
+  try
+  {
+    m_sink.write((const unsigned char*) m_buffer.data(), num_bytes);
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    return false;
+  }
+  return true;
+}
+
+
+
+sink_ostream::sink_ostream(output_sink& sink)
+  : std::ostream(nullptr), m_buf(sink)
+{
+  rdbuf(&m_buf);
+}
+
+output_sink& sink_ostream::sink()
+{
+  return m_buf.sink();
+}
@@ -0,0 +1,303 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref output_sink interface
+ *         and its implementations.
+ *  
+ *  File containing the declaration of the \ref output_sink interface that
+ *  backups are written to, the \ref ostream_sink adapter writing to an
+ *  existing stream, the \ref file_sink class writing straight to a file, and
+ *  the \ref sink_ostream class for using a sink where a stream is expected.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __OUTPUT_SINK_H__
+#define __OUTPUT_SINK_H__
+
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/*! \brief The number of bytes a \ref sink_ostream collects before writing
+ *         them to its sink. */
+#define SINK_STREAM_BUFFER_SIZE 0x10000
+
+/*! \class output_sink
+ *  \brief Interface for a destination that blocks of data are written to.
+ *  
+ *  Interface for a destination that blocks of data are written to in order,
+ *  such as the file a backup is saved to. Unlike a stream, every call either
+ *  writes the whole block or throws an exception, so that the reason for a
+ *  failure isn't lost.
+ */
+class output_sink
+{
+public:
+  
+  /*!
+   *  \brief Class destructor.
+   */
+  virtual                 ~output_sink() {}
+  
+  /*!
+   *  \brief Writes a block of data at the current position and moves past it.
+   *  
+   *  \param [in] data The data to write.
+   *  \param [in] num_bytes The number of bytes to write.
+   *  
+   *  \throws std::runtime_error If the data couldn't be written.
+   */
+  virtual void            write(const unsigned char* data, unsigned int num_bytes) = 0;
+  
+  /*!
+   *  \brief Moves the position that the next block is written at.
+   *  
+   *  \param [in] offset The offset in bytes from the start of the sink.
+   *  
+   *  \throws std::runtime_error If the sink can't be seeked.
+   */
+  virtual void            seek(unsigned long long offset) = 0;
+  
+  /*!
+   *  \brief Gets the position that the next block is written at.
+   *  
+   *  \return The offset in bytes from the start of the sink, or -1 if it isn't
+   *          known.
+   */
+  virtual long long       tell() = 0;
+  
+  /*!
+   *  \brief Hands everything written so far on to the operating system.
+   *  
+   *  \throws std::runtime_error If any of it couldn't be written.
+   */
+  virtual void            flush() = 0;
+};
+
+/*! \class ostream_sink
+ *  \brief Sink writing to an output stream.
+ *  
+ *  Sink that writes to an existing output stream, so that code writing to a
+ *  sink can still write to a stream such as a \ref hash_ostream or an
+ *  \ref archive_ostream.
+ */
+class ostream_sink : public output_sink
+{
+public:
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in,out] out The stream to write to. Must outlive the sink.
+   */
+  explicit                ostream_sink(std::ostream& out);
+  
+  void                    write(const unsigned char* data, unsigned int num_bytes);
+  void                    seek(unsigned long long offset);
+  long long               tell();
+  void                    flush();
+
+
+
+private:
+  
+  /*! \brief The stream written to. */
+  std::ostream&           m_out;
+};
+
+/*! \class file_sink
+ *  \brief Sink writing straight to a file.
+ *  
+ *  Sink that writes to a file through the operating system with no buffering
+ *  of its own, since the blocks of a backup are already large. If the size of
+ *  the file is known in advance, the space for all of it is reserved when the
+ *  file is opened, so that the file system can lay the file out in one piece
+ *  rather than growing it block by block, and so that running out of disk
+ *  space is noticed before anything is read from the cartridge. Reserving the
+ *  space doesn't change the size of the file, so a backup that turns out
+ *  smaller or is interrupted leaves a file holding only what was written.
+ *  
+ *  Space is reserved with fallocate() on Linux, the F_PREALLOCATE command on
+ *  OS X, and the file's allocation size on Windows. Where none of these are
+ *  supported, the file simply grows as it is written.
+ */
+class file_sink : public output_sink
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Opens the file.
+   *  
+   *  \param [in] path The path of the file to write.
+   *  \param [in] expected_size The number of bytes expected to be written, or
+   *         0 if not known. Only used to reserve space.
+   *  \param [in] keep_contents Whether to open an existing file and keep what
+   *         it holds, e.g. to resume writing it, rather than create a new,
+   *         empty file.
+   *  
+   *  \throws std::runtime_error If the file can't be opened or doesn't exist
+   *          when keeping its contents, or if there isn't enough space for the
+   *          expected size.
+   */
+                          file_sink(const std::string& path, unsigned long long expected_size = 0, bool keep_contents = false);
+  
+  /*!
+   *  \brief Class destructor. Closes the file if still open, ignoring errors.
+   */
+                          ~file_sink();
+  
+  void                    write(const unsigned char* data, unsigned int num_bytes);
+  void                    seek(unsigned long long offset);
+  long long               tell();
+  void                    flush();
+  
+  /*!
+   *  \brief Closes the file, releasing any space reserved but not written.
+   *  
+   *  \throws std::runtime_error If the file couldn't be closed cleanly.
+   */
+  void                    close();
+
+
+
+private:
+  
+  file_sink(const file_sink& other) = delete;
+  file_sink& operator=(const file_sink& other) = delete;
+  
+  /*!
+   *  \brief Reserves space for the file without changing its size.
+   *  
+   *  \param [in] num_bytes The number of bytes to reserve space for.
+   *  
+   *  \return false if the file system is out of space, true otherwise,
+   *          including if reserving space isn't supported.
+   */
+  bool                    reserve(unsigned long long num_bytes);
+  
+  
+  
+  /*! \brief The path of the file, for error messages. */
+  const std::string       m_path;
+  
+  /*! \brief The offset the next block is written at. */
+  unsigned long long      m_position;
+  
+  /*! \brief Whether space was reserved past what gets written. */
+  bool                    m_reserved;
+
+#ifdef _WIN32
+  /*! \brief Windows handle of the open file, or INVALID_HANDLE_VALUE. */
+  void*                   m_file_handle;
+#else
+  /*! \brief File descriptor of the open file, or -1. */
+  int                     m_fd;
+#endif
+};
+
+/*! \class sink_streambuf
+ *  \brief Stream buffer writing to an \ref output_sink.
+ *  
+ *  Stream buffer that collects what is written to it into blocks of
+ *  \ref SINK_STREAM_BUFFER_SIZE bytes and writes them to a sink. Used
+ *  through \ref sink_ostream.
+ */
+class sink_streambuf : public std::streambuf
+{
+public:
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in,out] sink The sink to write to.
+   */
+  explicit                sink_streambuf(output_sink& sink);
+  
+  /*!
+   *  \brief Class destructor. Writes any data still collected to the sink,
+   *         ignoring errors.
+   */
+                          ~sink_streambuf();
+  
+  /*!
+   *  \brief Gets the sink written to.
+   */
+  output_sink&            sink();
+
+
+
+protected:
+  
+  /*! \see std::streambuf::overflow(int_type) */
+  int_type                overflow(int_type ch);
+  
+  /*! \see std::streambuf::xsputn(const char_type*, std::streamsize) */
+  std::streamsize         xsputn(const char_type* s, std::streamsize count);
+  
+  /*! \see std::streambuf::sync() */
+  int                     sync();
+  
+  /*! \see std::streambuf::seekoff(off_type, std::ios_base::seekdir, std::ios_base::openmode) */
+  pos_type                seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which);
+  
+  /*! \see std::streambuf::seekpos(pos_type, std::ios_base::openmode) */
+  pos_type                seekpos(pos_type pos, std::ios_base::openmode which);
+
+
+
+private:
+  
+  sink_streambuf(const sink_streambuf& other) = delete;
+  sink_streambuf& operator=(const sink_streambuf& other) = delete;
+  
+  /*!
+   *  \brief Writes the collected data to the sink.
+   *  
+   *  \return false if the sink threw an exception, true otherwise.
+   */
+  bool                    write_buffer();
+  
+  
+  
+  /*! \brief The sink written to. */
+  output_sink&            m_sink;
+  
+  /*! \brief Data waiting to be written. */
+  std::vector<char>       m_buffer;
+};
+
+/*! \class sink_ostream
+ *  \brief Output stream writing to an \ref output_sink.
+ *  
+ *  Output stream that writes to a sink, so that a sink can be handed to code
+ *  that writes to a stream. Seeking from the start and from the current
+ *  position is supported if the sink supports it. A \ref write_pipeline
+ *  given one of these streams writes to its sink directly.
+ */
+class sink_ostream : public std::ostream
+{
+public:
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in,out] sink The sink to write to. Must outlive this stream.
+   */
+  explicit                sink_ostream(output_sink& sink);
+  
+  /*!
+   *  \brief Gets the sink written to.
+   */
+  output_sink&            sink();
+
+
+
+private:
+  
+  /*! \brief The stream buffer doing the writing. */
+  sink_streambuf          m_buf;
+};
+
+#endif /* defined(__OUTPUT_SINK_H__) */
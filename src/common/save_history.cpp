@@ -0,0 +1,335 @@
+/*! \file
+ *  \brief File containing the implementation of \ref save_history.
+ *  
+ *  File containing the implementation of \ref save_history.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see save_history
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-02
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "save_history.h"
+#include "block_compare.h"
+#include "dump_store.h"
+#include "file_util.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+
+// First line of every history, followed by its block size
+#define HISTORY_MAGIC    "fmsh1"
+
+// Start of the line written in front of each version
+#define VERSION_TAG      "fmsv"
+
+// Largest line in front of a version worth reading
+#define MAX_VERSION_LINE 512
+
+using namespace std;
+
+
+
+// Reads a line no longer than the given length, returning false if the line
+// is longer or has no end
+static bool read_line(istream& fin, string& line, size_t max_length)
+{
+  line.clear();
+  char c = '\0';
+  while (line.size() < max_length && fin.get(c) && c != '\n')
+  {
+    line += c;
+  }
+  return c == '\n';
+}
+
+// Lists the blocks that differ from the previous version, each as its number
+// followed by its bytes. Blocks past the end of the previous version always
+// differ
+static string changed_blocks(const vector<unsigned char>& previous, const unsigned char* data, unsigned int num_bytes, unsigned int block_size)
+{
+  string blocks;
+  unsigned int common = (unsigned int) min((size_t) num_bytes, previous.size());
+  unsigned int offset = 0;
+  while (offset < num_bytes)
+  {
+    if (offset < common)
+    {
+      offset += find_first_difference(previous.data() + offset, data + offset, common - offset);
+      if (offset == num_bytes)
+      {
+        break;
+      }
+    }
+    
+    unsigned int block = offset / block_size;
+    unsigned int start = block * block_size;
+    unsigned int length = min(block_size, num_bytes - start);
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+      blocks += (char) (block >> (8 * i));
+    }
+    blocks.append((const char*) data + start, length);
+    offset = start + length;
+  }
+  return blocks;
+}
+
+// Writes the changed blocks over the previous version
+static void apply_blocks(vector<unsigned char>& save, const string& blocks, unsigned int block_size)
+{
+  size_t position = 0;
+  while (position + 4 <= blocks.size())
+  {
+    unsigned int block = 0;
+    for (unsigned int i = 4; i > 0; --i)
+    {
+      block = (block << 8) | (unsigned char) blocks[position + i - 1];
+    }
+    position += 4;
+    
+    unsigned long long start = (unsigned long long) block * block_size;
+    if (start >= save.size())
+    {
+      throw std::runtime_error("Save history holds a block past the end of the save");
+    }
+    size_t length = (size_t) min((unsigned long long) block_size, save.size() - start);
+    if (position + length > blocks.size())
+    {
+      throw std::runtime_error("Save history holds a block cut short");
+    }
+    copy(blocks.begin() + position, blocks.begin() + position + length, save.begin() + (size_t) start);
+    position += length;
+  }
+}
+
+
+
+bool save_history::is_history_path(const std::string& path)
+{
+  static const string extension = SAVE_HISTORY_EXTENSION;
+  return path.size() >= extension.size()
+    && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+void save_history::split_version_path(const std::string& path, std::string& history_path, unsigned int& number)
+{
+  // Anything but a version number after the separator is part of the name
+  size_t separator = path.rfind(SAVE_HISTORY_VERSION_SEPARATOR);
+  unsigned long long value = 0;
+  if (separator == string::npos || !parse_number(path.substr(separator + 1), value)
+      || value == 0 || value > 0xFFFFFFFFULL)
+  {
+    history_path = path;
+    number = 0;
+    return;
+  }
+  history_path = path.substr(0, separator);
+  number = (unsigned int) value;
+}
+
+
+
+save_history::save_history(const std::string& path)
+  : m_path(path), m_block_size(SAVE_HISTORY_BLOCK_SIZE), m_num_deltas(0), m_end(0)
+{
+  ifstream fin(path.c_str(), ios::binary);
+  if (!fin.is_open() || fin.peek() == char_traits<char>::eof())
+  {
+    return;
+  }
+  
+  string line;
+  vector<string> header;
+  unsigned long long block_size = 0;
+  if (read_line(fin, line, MAX_VERSION_LINE))
+  {
+    header = split_fields(line);
+  }
+  if (header.size() != 2 || header[0] != HISTORY_MAGIC || !parse_number(header[1], block_size)
+      || block_size == 0 || block_size > 0xFFFFFFFFULL)
+  {
+    throw std::runtime_error("Not a save history: " + path);
+  }
+  m_block_size = (unsigned int) block_size;
+  m_end = line.size() + 1;
+  
+  fin.seekg(0, ios::end);
+  unsigned long long file_size = (unsigned long long) fin.tellg();
+  
+  // Stop at the first version that wasn't written completely
+  while (true)
+  {
+    fin.clear();
+    fin.seekg(m_end);
+    if (!read_line(fin, line, MAX_VERSION_LINE))
+    {
+      break;
+    }
+    
+    vector<string> fields = split_fields(line);
+    unsigned long long number = 0;
+    unsigned long long timestamp = 0;
+    unsigned long long size = 0;
+    unsigned long long stored_bytes = 0;
+    if (fields.size() != 7 || fields[0] != VERSION_TAG
+        || !parse_number(fields[1], number) || number != m_versions.size() + 1
+        || !parse_number(fields[2], timestamp) || !parse_number(fields[3], size) || size > 0xFFFFFFFFULL
+        || (fields[4] != "base" && fields[4] != "delta") || (fields[4] == "delta" && m_versions.empty())
+        || !parse_number(fields[5], stored_bytes) || stored_bytes > 0xFFFFFFFFULL)
+    {
+      break;
+    }
+    
+    version v;
+    v.number = (unsigned int) number;
+    v.timestamp = (long long) timestamp;
+    v.size = (unsigned int) size;
+    v.sha256 = fields[6];
+    v.is_base = (fields[4] == "base");
+    v.offset = m_end + line.size() + 1;
+    v.stored_bytes = (unsigned int) stored_bytes;
+    if (v.offset + v.stored_bytes > file_size)
+    {
+      break;
+    }
+    
+    m_versions.push_back(v);
+    m_num_deltas = (v.is_base ? 0 : m_num_deltas + 1);
+    m_end = v.offset + v.stored_bytes;
+  }
+}
+
+
+
+const std::string& save_history::path() const
+{
+  return m_path;
+}
+
+const std::vector<save_history::version>& save_history::versions() const
+{
+  return m_versions;
+}
+
+unsigned int save_history::check_in(const unsigned char* data, unsigned int num_bytes)
+{
+  string sha256 = dump_store::sha256(data, num_bytes);
+  vector<unsigned char> previous;
+  if (!m_versions.empty())
+  {
+    if (m_versions.back().sha256 == sha256 && m_versions.back().size == num_bytes)
+    {
+      return m_versions.back().number;
+    }
+    previous = restore(m_versions.back().number);
+  }
+  
+  // Store the version whole when storing the changes saves little
+  string stored;
+  bool is_base = (m_versions.empty() || m_num_deltas >= SAVE_HISTORY_MAX_DELTAS);
+  if (!is_base)
+  {
+    stored = changed_blocks(previous, data, num_bytes, m_block_size);
+    is_base = (stored.size() >= num_bytes / 2);
+  }
+  if (is_base)
+  {
+    stored.assign((const char*) data, num_bytes);
+  }
+  
+  version v;
+  v.number = (unsigned int) m_versions.size() + 1;
+  v.timestamp = (long long) time(nullptr);
+  v.size = num_bytes;
+  v.sha256 = sha256;
+  v.is_base = is_base;
+  v.stored_bytes = (unsigned int) stored.size();
+  string line = string(VERSION_TAG) + "\t" + to_string(v.number) + "\t" + to_string(v.timestamp)
+    + "\t" + to_string(v.size) + "\t" + (is_base ? "base" : "delta") + "\t" + to_string(v.stored_bytes)
+    + "\t" + v.sha256 + "\n";
+  
+  // A new history starts with its header. Otherwise the version goes over
+  // whatever was cut off after the last complete one
+  string header = (m_end == 0 ? string(HISTORY_MAGIC) + "\t" + to_string(m_block_size) + "\n" : string());
+  fstream fout(m_path.c_str(), ios::binary | ios::out | (m_end == 0 ? ios::trunc : ios::in));
+  if (!fout.is_open())
+  {
+    throw std::runtime_error("Unable to open file " + m_path);
+  }
+  fout.seekp(m_end);
+  fout.write(header.data(), header.size());
+  fout.write(line.data(), line.size());
+  fout.write(stored.data(), stored.size());
+  fout.close();
+  if (!fout)
+  {
+    throw std::runtime_error("Unable to write file " + m_path);
+  }
+  
+  v.offset = m_end + header.size() + line.size();
+  m_end = v.offset + v.stored_bytes;
+  m_num_deltas = (is_base ? 0 : m_num_deltas + 1);
+  m_versions.push_back(v);
+  return v.number;
+}
+
+std::vector<unsigned char> save_history::restore(unsigned int number) const
+{
+  if (number == 0)
+  {
+    number = (unsigned int) m_versions.size();
+  }
+  if (number == 0 || number > m_versions.size())
+  {
+    throw std::invalid_argument("No version " + to_string(number) + " of the save in " + m_path);
+  }
+  
+  // Start from the last version stored whole and apply the changes since
+  unsigned int first = number - 1;
+  while (!m_versions[first].is_base)
+  {
+    --first;
+  }
+  
+  ifstream fin(m_path.c_str(), ios::binary);
+  if (!fin.is_open())
+  {
+    throw std::runtime_error("Unable to open file " + m_path);
+  }
+  
+  vector<unsigned char> save;
+  for (unsigned int i = first; i < number; ++i)
+  {
+    const version& v = m_versions[i];
+    string stored(v.stored_bytes, '\0');
+    fin.seekg(v.offset);
+    if (v.stored_bytes > 0 && !fin.read(&stored[0], stored.size()))
+    {
+      throw std::runtime_error("Unable to read file " + m_path);
+    }
+    
+    if (v.is_base)
+    {
+      save.assign(stored.begin(), stored.end());
+    }
+    else
+    {
+      save.resize(v.size);
+      apply_blocks(save, stored, m_block_size);
+    }
+  }
+  
+  if (dump_store::sha256(save.data(), (unsigned int) save.size()) != m_versions[number - 1].sha256)
+  {
+    throw std::runtime_error("Version " + to_string(number) + " of the save in " + m_path + " is corrupt");
+  }
+  return save;
+}
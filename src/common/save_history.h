@@ -0,0 +1,178 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref save_history class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref save_history class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-02
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __SAVE_HISTORY_H__
+#define __SAVE_HISTORY_H__
+
+#include <string>
+#include <vector>
+
+/*! \brief Extension of the files holding the history of a save. */
+#define SAVE_HISTORY_EXTENSION ".fmsh"
+
+/*! \brief Size of the blocks versions of a save are compared and stored in. */
+#define SAVE_HISTORY_BLOCK_SIZE 0x200
+
+/*! \brief Most versions stored as changes in a row before the next version is
+ *         stored whole, bounding how much has to be read to restore one. */
+#define SAVE_HISTORY_MAX_DELTAS 16
+
+/*! \brief Character separating the path of a history from the number of a
+ *         version in a version path. */
+#define SAVE_HISTORY_VERSION_SEPARATOR '@'
+
+/*! \class save_history
+ *  \brief Class keeping every version of a cartridge's save data in a file.
+ *  
+ *  Class checking in the save data of a cartridge each time it is backed up
+ *  and keeping every version that differed from the one before, so that an
+ *  older save can be restored. Rather than a copy of the whole save, each
+ *  version is stored as the blocks of \ref SAVE_HISTORY_BLOCK_SIZE bytes that
+ *  changed since the version before, found with
+ *  \ref find_first_difference(). Every \ref SAVE_HISTORY_MAX_DELTAS versions,
+ *  or whenever most of the blocks changed, the version is stored whole
+ *  instead.
+ *  
+ *  Versions are appended to the end of the file. A version that was cut off
+ *  while being written is ignored, and written over by the next.
+ *  
+ *  A version of a history is named with a version path made of the path of
+ *  the history, a \ref SAVE_HISTORY_VERSION_SEPARATOR, and the number of the
+ *  version, such as **pocket-tennis.fmsh@3**. The path of the history alone
+ *  names the latest version.
+ *  
+ *  This class is *not* thread-safe.
+ */
+class save_history
+{
+public:
+  
+  /*!
+   *  \brief Struct describing a single version of the save data.
+   */
+  struct version
+  {
+    /*! \brief The number of the version, counting from 1. */
+    unsigned int          number;
+    
+    /*! \brief The time the version was checked in, in seconds since the
+     *         epoch. */
+    long long             timestamp;
+    
+    /*! \brief The size of the save data in bytes. */
+    unsigned int          size;
+    
+    /*! \brief The hexadecimal SHA-256 digest of the save data. */
+    std::string           sha256;
+    
+    /*! \brief Whether the version is stored whole rather than as changes. */
+    bool                  is_base;
+    
+    /*! \brief The offset in the file of the stored data. */
+    unsigned long long    offset;
+    
+    /*! \brief The number of bytes stored for the version. */
+    unsigned int          stored_bytes;
+  };
+  
+  
+  
+  /*!
+   *  \brief Determines whether a path names a history by its extension.
+   *  
+   *  \param [in] path The path, without a version number.
+   */
+  static bool             is_history_path(const std::string& path);
+  
+  /*!
+   *  \brief Splits a version path into the path of the history and the
+   *         number of the version.
+   *  
+   *  \param [in] path The path, with or without a version number.
+   *  \param [out] history_path Set to the path of the history.
+   *  \param [out] number Set to the number of the version, or 0 for the
+   *         latest if the path holds none.
+   */
+  static void             split_version_path(const std::string& path, std::string& history_path, unsigned int& number);
+  
+  
+  
+  /*!
+   *  \brief Class constructor. Reads the list of versions in a history.
+   *  
+   *  \param [in] path The path of the history. The file need not exist yet.
+   *  
+   *  \throws std::runtime_error If the file exists and isn't a history.
+   */
+  explicit                save_history(const std::string& path);
+  
+  
+  
+  /*!
+   *  \brief Gets the path of the history.
+   */
+  const std::string&      path() const;
+  
+  /*!
+   *  \brief Gets every version in the history, oldest first.
+   */
+  const std::vector<version>& versions() const;
+  
+  /*!
+   *  \brief Adds the save data as a new version, unless it matches the
+   *         latest one.
+   *  
+   *  \param [in] data Pointer to the save data.
+   *  \param [in] num_bytes The size of the save data in bytes.
+   *  
+   *  \return The number of the new version, or of the latest version if it
+   *          holds the same save data.
+   *  
+   *  \throws std::runtime_error If the history could not be written.
+   */
+  unsigned int            check_in(const unsigned char* data, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Rebuilds a version of the save data in memory.
+   *  
+   *  \param [in] number The number of the version, or 0 for the latest.
+   *  
+   *  \return The save data.
+   *  
+   *  \throws std::invalid_argument If the history holds no such version.
+   *  \throws std::runtime_error If the history could not be read or the
+   *          rebuilt save data doesn't match its digest.
+   */
+  std::vector<unsigned char> restore(unsigned int number = 0) const;
+
+
+
+private:
+  
+  /*! \brief The path of the history. */
+  const std::string       m_path;
+  
+  /*! \brief The block size the history is stored in. */
+  unsigned int            m_block_size;
+  
+  /*! \brief Every version, oldest first. */
+  std::vector<version>    m_versions;
+  
+  /*! \brief The number of versions stored as changes since the last one
+   *         stored whole. */
+  unsigned int            m_num_deltas;
+  
+  /*! \brief The offset just past the last complete version, where the next
+   *         one goes. */
+  unsigned long long      m_end;
+};
+
+#endif /* defined(__SAVE_HISTORY_H__) */
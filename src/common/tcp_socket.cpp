@@ -0,0 +1,286 @@
+/*! \file
+ *  \brief File containing the implementation of the \ref tcp_socket class.
+ *  
+ *  File containing the implementation of the \ref tcp_socket class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-23
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "tcp_socket.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#if defined(OS_WINDOWS)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET socket_t;
+#define INVALID_SOCKET_VALUE INVALID_SOCKET
+#define close_socket closesocket
+#define SHUTDOWN_BOTH SD_BOTH
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int    socket_t;
+#define INVALID_SOCKET_VALUE (-1)
+#define close_socket ::close
+#define SHUTDOWN_BOTH SHUT_RDWR
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Largest chunk handed to a single send or recv call
+#define MAX_CHUNK_SIZE 0x40000
+
+static void disable_nagle(socket_t s)
+{
+  int enabled = 1;
+  setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*) &enabled, sizeof(enabled));
+}
+
+
+
+tcp_socket::tcp_socket()
+  : m_socket(-1)
+{
+  // Nothing else to do
+}
+
+tcp_socket::~tcp_socket()
+{
+  close();
+}
+
+
+
+void tcp_socket::connect(const std::string& host, unsigned short port)
+{
+  if (is_open())
+  {
+    throw std::runtime_error("Socket is already open");
+  }
+  
+  acquire_sockets();
+  
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+  addrinfo* addresses = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0 || addresses == nullptr)
+  {
+    release_sockets();
+    throw std::runtime_error("Unable to resolve host " + host);
+  }
+  
+  socket_t s = INVALID_SOCKET_VALUE;
+  for (addrinfo* address = addresses; address != nullptr; address = address->ai_next)
+  {
+    s = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (s == INVALID_SOCKET_VALUE)
+    {
+      continue;
+    }
+    if (::connect(s, address->ai_addr, (int) address->ai_addrlen) == 0)
+    {
+      break;
+    }
+    close_socket(s);
+    s = INVALID_SOCKET_VALUE;
+  }
+  freeaddrinfo(addresses);
+  
+  if (s == INVALID_SOCKET_VALUE)
+  {
+    release_sockets();
+    throw std::runtime_error("Unable to connect to " + host + ":" + std::to_string(port));
+  }
+  
+  disable_nagle(s);
+  m_socket = (long long) s;
+}
+
+void tcp_socket::listen(unsigned short port, bool loopback_only)
+{
+  if (is_open())
+  {
+    throw std::runtime_error("Socket is already open");
+  }
+  
+  acquire_sockets();
+  
+  socket_t s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (s == INVALID_SOCKET_VALUE)
+  {
+    release_sockets();
+    throw std::runtime_error("Unable to create socket");
+  }
+  
+  int reuse = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*) &reuse, sizeof(reuse));
+  
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(loopback_only ? INADDR_LOOPBACK : INADDR_ANY);
+  address.sin_port = htons(port);
+  if (::bind(s, (const sockaddr*) &address, sizeof(address)) != 0 || ::listen(s, 8) != 0)
+  {
+    close_socket(s);
+    release_sockets();
+    throw std::runtime_error("Unable to listen on port " + std::to_string(port));
+  }
+  
+  m_socket = (long long) s;
+}
+
+bool tcp_socket::accept(tcp_socket& client, unsigned int timeout_ms)
+{
+  if (!is_open() || client.is_open())
+  {
+    return false;
+  }
+  
+  socket_t s = (socket_t) m_socket;
+  fd_set ready;
+  FD_ZERO(&ready);
+  FD_SET(s, &ready);
+  timeval timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_usec = (timeout_ms % 1000) * 1000;
+  if (select((int) s + 1, &ready, nullptr, nullptr, &timeout) <= 0)
+  {
+    return false;
+  }
+  
+  socket_t c = ::accept(s, nullptr, nullptr);
+  if (c == INVALID_SOCKET_VALUE)
+  {
+    return false;
+  }
+  
+  disable_nagle(c);
+  client.adopt((long long) c);
+  return true;
+}
+
+void tcp_socket::send_all(const void* data, size_t num_bytes)
+{
+  const char* bytes = (const char*) data;
+  size_t sent = 0;
+  while (sent < num_bytes)
+  {
+    int chunk = (int) (num_bytes - sent < MAX_CHUNK_SIZE ? num_bytes - sent : MAX_CHUNK_SIZE);
+    int num_sent = (int) send((socket_t) m_socket, bytes + sent, chunk, MSG_NOSIGNAL);
+    if (num_sent <= 0)
+    {
+      throw std::runtime_error("Connection lost while sending");
+    }
+    sent += (size_t) num_sent;
+  }
+}
+
+void tcp_socket::receive_all(void* data, size_t num_bytes)
+{
+  char* bytes = (char*) data;
+  size_t received = 0;
+  while (received < num_bytes)
+  {
+    int chunk = (int) (num_bytes - received < MAX_CHUNK_SIZE ? num_bytes - received : MAX_CHUNK_SIZE);
+    int num_received = (int) recv((socket_t) m_socket, bytes + received, chunk, 0);
+    if (num_received <= 0)
+    {
+      throw std::runtime_error("Connection lost while receiving");
+    }
+    received += (size_t) num_received;
+  }
+}
+
+size_t tcp_socket::receive_some(void* data, size_t max_bytes, unsigned int timeout_ms)
+{
+  socket_t s = (socket_t) m_socket;
+  fd_set ready;
+  FD_ZERO(&ready);
+  FD_SET(s, &ready);
+  timeval timeout;
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_usec = (timeout_ms % 1000) * 1000;
+  int num_ready = select((int) s + 1, &ready, nullptr, nullptr, &timeout);
+  if (num_ready == 0)
+  {
+    throw std::runtime_error("Timed out while receiving");
+  }
+  if (num_ready < 0)
+  {
+    throw std::runtime_error("Connection lost while receiving");
+  }
+  
+  int chunk = (int) (max_bytes < MAX_CHUNK_SIZE ? max_bytes : MAX_CHUNK_SIZE);
+  int num_received = (int) recv(s, (char*) data, chunk, 0);
+  if (num_received < 0)
+  {
+    throw std::runtime_error("Connection lost while receiving");
+  }
+  return (size_t) num_received;
+}
+
+bool tcp_socket::is_open() const
+{
+  return m_socket != -1;
+}
+
+void tcp_socket::shutdown()
+{
+  if (is_open())
+  {
+    ::shutdown((socket_t) m_socket, SHUTDOWN_BOTH);
+  }
+}
+
+void tcp_socket::close()
+{
+  if (!is_open())
+  {
+    return;
+  }
+  
+  close_socket((socket_t) m_socket);
+  m_socket = -1;
+  release_sockets();
+}
+
+
+
+void tcp_socket::acquire_sockets()
+{
+#if defined(OS_WINDOWS)
+  WSADATA wsa_data;
+  if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+  {
+    throw std::runtime_error("Unable to initialize Winsock");
+  }
+#endif
+}
+
+void tcp_socket::release_sockets()
+{
+#if defined(OS_WINDOWS)
+  WSACleanup();
+#endif
+}
+
+void tcp_socket::adopt(long long s)
+{
+  acquire_sockets();
+  m_socket = s;
+}
@@ -0,0 +1,164 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref tcp_socket class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref tcp_socket class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-23
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __TCP_SOCKET_H__
+#define __TCP_SOCKET_H__
+
+#include <cstddef>
+#include <string>
+
+/*! \class tcp_socket
+ *  \brief Minimal blocking TCP socket.
+ *  
+ *  Minimal wrapper around a blocking TCP socket that can either connect to a
+ *  server or listen for connections, and that sends and receives whole
+ *  buffers at a time. Connected sockets have Nagle's algorithm turned off,
+ *  since the protocols run over them already send their data in batches and
+ *  are sensitive to latency.
+ *  
+ *  Sending and receiving may happen on different threads at the same time,
+ *  and \ref shutdown() may be called from any thread to wake a thread
+ *  blocked on the socket. Otherwise, this class is not thread-safe.
+ */
+class tcp_socket
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Creates a socket that is not yet open.
+   */
+                          tcp_socket();
+  
+  /*!
+   *  \brief Class destructor. Closes the socket if it is open.
+   */
+                          ~tcp_socket();
+  
+  
+  
+  /*!
+   *  \brief Connects to a server.
+   *  
+   *  \param [in] host The host name or address of the server.
+   *  \param [in] port The TCP port of the server.
+   *  
+   *  \throws std::runtime_error If the socket is already open or the server
+   *          could not be reached.
+   */
+  void                    connect(const std::string& host, unsigned short port);
+  
+  /*!
+   *  \brief Starts listening for connections.
+   *  
+   *  \param [in] port The TCP port to listen on.
+   *  \param [in] loopback_only Whether to only accept connections from this
+   *         machine.
+   *  
+   *  \throws std::runtime_error If the socket is already open or the port
+   *          could not be listened on.
+   */
+  void                    listen(unsigned short port, bool loopback_only);
+  
+  /*!
+   *  \brief Waits for a connection on a listening socket and accepts it.
+   *  
+   *  \param [out] client The socket to hand the connection to. Must not be
+   *         open.
+   *  \param [in] timeout_ms How long to wait for a connection.
+   *  
+   *  \return **true** if a connection was accepted, **false** if none came in
+   *          time.
+   */
+  bool                    accept(tcp_socket& client, unsigned int timeout_ms);
+  
+  /*!
+   *  \brief Sends an entire buffer.
+   *  
+   *  \param [in] data The bytes to send.
+   *  \param [in] num_bytes The number of bytes to send.
+   *  
+   *  \throws std::runtime_error If the connection was closed or failed.
+   */
+  void                    send_all(const void* data, size_t num_bytes);
+  
+  /*!
+   *  \brief Receives exactly the given number of bytes.
+   *  
+   *  \param [out] data The buffer to receive into.
+   *  \param [in] num_bytes The number of bytes to receive.
+   *  
+   *  \throws std::runtime_error If the connection was closed or failed before
+   *          every byte was received.
+   */
+  void                    receive_all(void* data, size_t num_bytes);
+  
+  /*!
+   *  \brief Receives whatever bytes arrive next, up to a limit.
+   *  
+   *  \param [out] data The buffer to receive into.
+   *  \param [in] max_bytes The size of the buffer.
+   *  \param [in] timeout_ms How long to wait for the first byte, in
+   *         milliseconds.
+   *  
+   *  \return The number of bytes received, or 0 if the other side closed the
+   *          connection.
+   *  
+   *  \throws std::runtime_error If no byte arrived in time or the connection
+   *          failed.
+   */
+  size_t                  receive_some(void* data, size_t max_bytes, unsigned int timeout_ms);
+  
+  /*!
+   *  \brief Checks whether the socket is open.
+   */
+  bool                    is_open() const;
+  
+  /*!
+   *  \brief Shuts the connection down in both directions without closing the
+   *         socket, failing any send or receive in progress on another
+   *         thread.
+   */
+  void                    shutdown();
+  
+  /*!
+   *  \brief Closes the socket. Does nothing if it is not open.
+   */
+  void                    close();
+
+
+
+private:
+  tcp_socket(const tcp_socket& other) = delete;
+  tcp_socket& operator=(const tcp_socket& other) = delete;
+  
+  /*!
+   *  \brief Initializes the platform's socket library. Every call must be
+   *         matched by a call to \ref release_sockets().
+   */
+  static void             acquire_sockets();
+  
+  /*!
+   *  \brief Releases the platform's socket library.
+   */
+  static void             release_sockets();
+  
+  /*!
+   *  \brief Takes over an accepted connection.
+   */
+  void                    adopt(long long s);
+  
+  
+  
+  /*! \brief The socket, or -1 if not open. */
+  long long               m_socket;
+};
+
+#endif /* defined(__TCP_SOCKET_H__) */
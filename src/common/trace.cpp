@@ -0,0 +1,241 @@
+/*! \file
+ *  \brief File containing the definitions for tracing functions.
+ *  
+ *  File containing the definitions for tracing functions.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-15
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+// Durations are bucketed in powers of two microseconds, the last bucket
+// holding everything from about a second up
+#define NUM_HISTOGRAM_BUCKETS 21
+
+struct trace_event
+{
+  trace_phase             phase;
+  unsigned int            num_bytes;
+  unsigned int            thread;
+  trace_clock::time_point start;
+  trace_clock::time_point end;
+};
+
+#ifndef DISABLE_TRACING
+static std::atomic<bool>               trace_enabled(false);
+static std::atomic<unsigned long long> trace_next_event(0);
+static std::vector<trace_event>        trace_events;
+static trace_clock::time_point         trace_epoch;
+#endif // defined(DISABLE_TRACING)
+
+static const char* const trace_phase_names[NUM_TRACE_PHASES] = {
+  "transfer-out",
+  "transfer-in",
+  "command",
+  "data",
+  "ack",
+  "erase-poll",
+  "file-io"
+};
+
+
+
+#ifndef DISABLE_TRACING
+static void trace_collect(std::vector<trace_event>& events)
+{
+  unsigned long long next = trace_next_event.load();
+  unsigned long long count = std::min(next, (unsigned long long) trace_events.size());
+  
+  events.clear();
+  events.reserve((size_t) count);
+  for (unsigned long long i = next - count; i < next; ++i)
+  {
+    events.push_back(trace_events[(size_t) (i % trace_events.size())]);
+  }
+}
+#endif // defined(DISABLE_TRACING)
+
+
+
+void trace_start(unsigned int capacity)
+{
+#ifndef DISABLE_TRACING
+  trace_enabled = false;
+  trace_events.assign(std::max(capacity, 1u), trace_event());
+  trace_next_event = 0;
+  trace_epoch = trace_clock::now();
+  trace_enabled = true;
+#else
+  (void) capacity;
+#endif
+}
+
+void trace_stop()
+{
+#ifndef DISABLE_TRACING
+  trace_enabled = false;
+#endif
+}
+
+bool trace_is_enabled()
+{
+#ifndef DISABLE_TRACING
+  return trace_enabled.load(std::memory_order_relaxed);
+#else
+  return false;
+#endif
+}
+
+
+
+void trace_record(trace_phase phase, trace_clock::time_point start, trace_clock::time_point end, unsigned int num_bytes)
+{
+#ifndef DISABLE_TRACING
+  if (!trace_enabled.load(std::memory_order_relaxed))
+  {
+    return;
+  }
+  
+  // Claiming a slot is the only synchronization needed between recorders
+  unsigned long long slot = trace_next_event.fetch_add(1);
+  trace_event& event = trace_events[(size_t) (slot % trace_events.size())];
+  event.phase = phase;
+  event.num_bytes = num_bytes;
+  event.thread = (unsigned int) (std::hash<std::thread::id>()(std::this_thread::get_id()) % 100000);
+  event.start = start;
+  event.end = end;
+#else
+  (void) phase;
+  (void) start;
+  (void) end;
+  (void) num_bytes;
+#endif
+}
+
+void trace_write_chrome_json(std::ostream& out)
+{
+#ifndef DISABLE_TRACING
+  std::vector<trace_event> events;
+  trace_collect(events);
+  
+  out << "{\"traceEvents\": [";
+  for (size_t i = 0; i < events.size(); ++i)
+  {
+    const trace_event& event = events[i];
+    out << (i == 0 ? "\n" : ",\n")
+        << "  {\"name\": \"" << trace_phase_names[event.phase] << "\""
+        << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.thread
+        << ", \"ts\": " << std::chrono::duration_cast<std::chrono::microseconds>(event.start - trace_epoch).count()
+        << ", \"dur\": " << std::chrono::duration_cast<std::chrono::microseconds>(event.end - event.start).count()
+        << ", \"args\": {\"bytes\": " << event.num_bytes << "}}";
+  }
+  out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+#else
+  out << "{\"traceEvents\": []}\n";
+#endif
+}
+
+void trace_write_summary(std::ostream& out)
+{
+#ifndef DISABLE_TRACING
+  std::vector<trace_event> events;
+  trace_collect(events);
+  
+  unsigned long long count[NUM_TRACE_PHASES] = {0};
+  unsigned long long bytes[NUM_TRACE_PHASES] = {0};
+  double             seconds[NUM_TRACE_PHASES] = {0};
+  unsigned long long histogram[NUM_TRACE_PHASES][NUM_HISTOGRAM_BUCKETS] = {{0}};
+  
+  for (const trace_event& event : events)
+  {
+    long long us = std::chrono::duration_cast<std::chrono::microseconds>(event.end - event.start).count();
+    int bucket = 0;
+    while (bucket < NUM_HISTOGRAM_BUCKETS - 1 && us >= (1LL << bucket))
+    {
+      ++bucket;
+    }
+    
+    ++count[event.phase];
+    bytes[event.phase] += event.num_bytes;
+    seconds[event.phase] += std::chrono::duration<double>(event.end - event.start).count();
+    ++histogram[event.phase][bucket];
+  }
+  
+  out << "phase         events       bytes     total ms    mean us\n";
+  for (int phase = 0; phase < NUM_TRACE_PHASES; ++phase)
+  {
+    if (count[phase] == 0)
+    {
+      continue;
+    }
+    out << std::left << std::setw(12) << trace_phase_names[phase] << std::right
+        << std::setw(8) << count[phase]
+        << std::setw(12) << bytes[phase]
+        << std::setw(13) << std::fixed << std::setprecision(1) << seconds[phase] * 1000.0
+        << std::setw(11) << seconds[phase] * 1000000.0 / count[phase] << "\n";
+  }
+  
+  for (int phase = 0; phase < NUM_TRACE_PHASES; ++phase)
+  {
+    if (count[phase] == 0)
+    {
+      continue;
+    }
+    out << "\n" << trace_phase_names[phase] << " durations:\n";
+    for (int bucket = 0; bucket < NUM_HISTOGRAM_BUCKETS; ++bucket)
+    {
+      if (histogram[phase][bucket] == 0)
+      {
+        continue;
+      }
+      out << "  < " << std::setw(8);
+      if (bucket == NUM_HISTOGRAM_BUCKETS - 1)
+      {
+        out << "inf";
+      }
+      else
+      {
+        out << (1LL << bucket);
+      }
+      out << " us: " << histogram[phase][bucket] << "\n";
+    }
+  }
+  out.unsetf(std::ios_base::floatfield);
+#else
+  out << "Tracing disabled\n";
+#endif
+}
+
+
+
+trace_scope::trace_scope(trace_phase phase, unsigned int num_bytes)
+  : m_phase(phase), m_num_bytes(num_bytes), m_enabled(trace_is_enabled())
+{
+  if (m_enabled)
+  {
+    m_start = trace_clock::now();
+  }
+}
+
+trace_scope::~trace_scope()
+{
+  if (m_enabled)
+  {
+    trace_record(m_phase, m_start, trace_clock::now(), m_num_bytes);
+  }
+}
+
+void trace_scope::set_num_bytes(unsigned int num_bytes)
+{
+  m_num_bytes = num_bytes;
+}
@@ -0,0 +1,166 @@
+/*! \file
+ *  \brief File containing declarations of tracing functions.
+ *  
+ *  File containing declarations of functions used to record the timing of
+ *  USB transfers, erase waits, and file I/O, and any prerequisites, such as
+ *  the \ref trace_phase enum.
+ *  
+ *  Tracing is off by default. While it is off, recording an event costs a
+ *  single atomic load. Once started with \ref trace_start(), events are kept in
+ *  a fixed-size ring buffer, so that the most recent events are always
+ *  available regardless of how long the trace runs, and can be exported in the
+ *  Chrome trace event format or as a per-phase summary.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-15
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <chrono>
+#include <iosfwd>
+
+/*!
+ *  \brief Enum representing the kind of work recorded by a trace event.
+ */
+enum trace_phase
+{
+  /*! \brief A single USB transfer from the host to the device. */
+  TRACE_TRANSFER_OUT,
+  
+  /*! \brief A single USB transfer from the device to the host. */
+  TRACE_TRANSFER_IN,
+  
+  /*! \brief A word-sized command round trip with a linkmasta device. */
+  TRACE_COMMAND,
+  
+  /*! \brief Moving a batch of data to or from a linkmasta device, including
+   *         the command that starts the batch. */
+  TRACE_DATA,
+  
+  /*! \brief Waiting for a linkmasta device to acknowledge programmed data. */
+  TRACE_ACK,
+  
+  /*! \brief Waiting for a chip to finish erasing. */
+  TRACE_ERASE_POLL,
+  
+  /*! \brief Reading or writing a file. */
+  TRACE_FILE_IO,
+  
+  /*! \brief The number of trace phases. Not a phase. */
+  NUM_TRACE_PHASES
+};
+
+/*! \brief Clock used to timestamp trace events. */
+typedef std::chrono::steady_clock trace_clock;
+
+
+
+/*!
+ *  \brief Starts recording trace events, discarding any previously recorded.
+ *  
+ *  \param [in] capacity The maximum number of events kept. Once full, the
+ *         oldest events are overwritten.
+ */
+void trace_start(unsigned int capacity = 65536);
+
+/*!
+ *  \brief Stops recording trace events. Events recorded so far are kept until
+ *         the next call to \ref trace_start().
+ */
+void trace_stop();
+
+/*!
+ *  \brief Determines whether trace events are currently being recorded.
+ */
+bool trace_is_enabled();
+
+
+
+/*!
+ *  \brief Records a trace event. Does nothing if tracing is not enabled.
+ *  
+ *  \param [in] phase The kind of work the event represents.
+ *  \param [in] start The time at which the work started.
+ *  \param [in] end The time at which the work ended.
+ *  \param [in] num_bytes The number of bytes moved by the work, if any.
+ */
+void trace_record(trace_phase phase, trace_clock::time_point start, trace_clock::time_point end, unsigned int num_bytes = 0);
+
+/*!
+ *  \brief Writes all recorded events to the output in the Chrome trace event
+ *         format, which can be loaded into chrome://tracing.
+ *  
+ *  Should not be called while events are still being recorded from other
+ *  threads.
+ *  
+ *  \param [out] out The stream to write to.
+ */
+void trace_write_chrome_json(std::ostream& out);
+
+/*!
+ *  \brief Writes a summary of the recorded events to the output, giving the
+ *         number of events, bytes, and time spent in each phase along with a
+ *         histogram of event durations.
+ *  
+ *  Should not be called while events are still being recorded from other
+ *  threads.
+ *  
+ *  \param [out] out The stream to write to.
+ */
+void trace_write_summary(std::ostream& out);
+
+
+
+/*! \class trace_scope
+ *  \brief Records a trace event spanning the lifetime of the object.
+ *  
+ *  Records a trace event that starts when the object is constructed and ends
+ *  when it is destroyed, including when the scope is left by an exception.
+ *  Does nothing if tracing was not enabled when the object was constructed.
+ */
+class trace_scope
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Starts the event.
+   *  
+   *  \param [in] phase The kind of work the event represents.
+   *  \param [in] num_bytes The number of bytes moved by the work, if known.
+   */
+  explicit trace_scope(trace_phase phase, unsigned int num_bytes = 0);
+  
+  /*!
+   *  \brief Class destructor. Ends and records the event.
+   */
+  ~trace_scope();
+  
+  /*!
+   *  \brief Sets the number of bytes moved by the work, for when it isn't known
+   *         up front.
+   */
+  void set_num_bytes(unsigned int num_bytes);
+
+
+
+private:
+  trace_scope(const trace_scope& other) = delete;
+  trace_scope& operator=(const trace_scope& other) = delete;
+  
+  /*! \brief The kind of work the event represents. */
+  const trace_phase        m_phase;
+  
+  /*! \brief The number of bytes moved by the work. */
+  unsigned int             m_num_bytes;
+  
+  /*! \brief Whether tracing was enabled when the event started. */
+  const bool               m_enabled;
+  
+  /*! \brief The time at which the event started. */
+  trace_clock::time_point  m_start;
+};
+
+#endif /* defined(__TRACE_H__) */
@@ -0,0 +1,24 @@
+#ifndef __BINARY_CATALOG_FORMAT_H__
+#define __BINARY_CATALOG_FORMAT_H__
+
+// Layout of the compact game catalogs written by tools/build-database and read
+// by binary_game_catalog. All integers are little-endian.
+//
+//   header   magic "FMGC", version, entry count, string table offset (u32 each)
+//   entries  one per hash, sorted by hash as a signed 64-bit integer:
+//              hash (i64), name offset, developer offset, game size in bytes,
+//              sample fingerprint or 0 if none, CRC32 of the known-good
+//              image, SHA-1 offset (u32 each). The SHA-1 is 40 lowercase hex
+//              digits, or empty if the game has no known-good image
+//   strings  NUL-terminated names, addressed by offset from the table start
+//
+// Where several games share a hash, only the first is kept, same as the
+// SQLite catalogs' LIMIT 1 lookup. Files of an older version are rejected, so
+// the SQLite catalog is used until the binary one is rebuilt.
+
+#define BINARY_CATALOG_MAGIC        "FMGC"
+#define BINARY_CATALOG_VERSION      2
+#define BINARY_CATALOG_HEADER_SIZE  16
+#define BINARY_CATALOG_ENTRY_SIZE   32
+
+#endif // defined(__BINARY_CATALOG_FORMAT_H__)
@@ -0,0 +1,202 @@
+#include "binary_game_catalog.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "binary_catalog_format.h"
+#include "game_hash.h"
+#include "cartridge/ws_cartridge.h"
+#include "common/mapped_file.h"
+
+using namespace std;
+
+static unsigned int read_u32(const unsigned char* data)
+{
+  return (unsigned int) data[0] | ((unsigned int) data[1] << 8)
+         | ((unsigned int) data[2] << 16) | ((unsigned int) data[3] << 24);
+}
+
+static long long read_i64(const unsigned char* data)
+{
+  unsigned long long value = read_u32(data) | ((unsigned long long) read_u32(data + 4) << 32);
+  return (long long) value;
+}
+
+binary_game_catalog::binary_game_catalog(const char* file_name, game_descriptor::game_system system)
+  : m_file(new mapped_file(file_name)), m_system(system), m_entries(nullptr), m_num_entries(0),
+    m_strings(nullptr), m_strings_size(0)
+{
+  // Validate the header before trusting any offsets in it
+  const unsigned char* data = m_file->data();
+  unsigned int size = m_file->size();
+  if (size < BINARY_CATALOG_HEADER_SIZE || memcmp(data, BINARY_CATALOG_MAGIC, 4) != 0
+      || read_u32(data + 4) != BINARY_CATALOG_VERSION)
+  {
+    throw std::runtime_error("Unrecognized catalog file");
+  }
+  
+  m_num_entries = read_u32(data + 8);
+  unsigned int strings_offset = read_u32(data + 12);
+  if (m_num_entries > (size - BINARY_CATALOG_HEADER_SIZE) / BINARY_CATALOG_ENTRY_SIZE
+      || strings_offset < BINARY_CATALOG_HEADER_SIZE + m_num_entries * BINARY_CATALOG_ENTRY_SIZE
+      || strings_offset > size)
+  {
+    throw std::runtime_error("Corrupt catalog file");
+  }
+  
+  m_entries = data + BINARY_CATALOG_HEADER_SIZE;
+  m_strings = (const char*) data + strings_offset;
+  m_strings_size = size - strings_offset;
+  
+  for (unsigned int i = 0; i < m_num_entries; ++i)
+  {
+    const unsigned char* entry = m_entries + i * BINARY_CATALOG_ENTRY_SIZE;
+    unsigned int fingerprint = read_u32(entry + 20);
+    if (fingerprint != 0)
+    {
+      m_fingerprints.emplace(fingerprint, read_i64(entry));
+    }
+  }
+}
+
+binary_game_catalog::~binary_game_catalog()
+{
+  // Nothing else to do
+}
+
+const game_descriptor* binary_game_catalog::identify_game(cartridge* cart, int slot_num)
+{
+  // Build hash from cartridge metadata
+  long long hash;
+  bool valid = false;
+  switch (m_system)
+  {
+  case game_descriptor::game_system::NEO_GEO_POCKET:
+    valid = ngp_game_hash(cart, slot_num, &hash);
+    break;
+    
+  case game_descriptor::game_system::WONDERSWAN:
+    valid = ws_game_hash(cart, slot_num, &hash);
+    break;
+    
+  default:
+    break;
+  }
+  if (!valid)
+  {
+    return nullptr;
+  }
+  
+  return identify_hash(hash);
+}
+
+const game_descriptor* binary_game_catalog::identify_game_by_fingerprint(unsigned int fingerprint)
+{
+  // Never modified once opened, so needs no lock
+  auto it = m_fingerprints.find(fingerprint);
+  return (it == m_fingerprints.end() ? nullptr : identify_hash(it->second));
+}
+
+bool binary_game_catalog::known_good_hashes(long long hash, game_image_hashes* hashes)
+{
+  // Never modified once opened, so needs no lock
+  const unsigned char* entry = find_entry(hash);
+  if (entry == nullptr || *entry_string(entry, 5) == '\0')
+  {
+    return false;
+  }
+  hashes->crc32 = read_u32(entry + 24);
+  hashes->sha1 = entry_string(entry, 5);
+  return true;
+}
+
+game_descriptor::game_system binary_game_catalog::system() const
+{
+  return m_system;
+}
+
+std::vector<const game_descriptor*> binary_game_catalog::search(const std::string& query, unsigned int max_results)
+{
+  call_once(m_search_once, [this]
+  {
+    for (unsigned int i = 0; i < m_num_entries; ++i)
+    {
+      const unsigned char* entry = m_entries + i * BINARY_CATALOG_ENTRY_SIZE;
+      m_search_index.add(read_i64(entry), entry_string(entry, 0));
+    }
+    m_search_index.finish();
+  });
+  
+  vector<const game_descriptor*> matches;
+  for (long long hash : m_search_index.search(query, max_results))
+  {
+    const game_descriptor* descriptor = identify_hash(hash);
+    if (descriptor != nullptr)
+    {
+      matches.push_back(descriptor);
+    }
+  }
+  return matches;
+}
+
+const game_descriptor* binary_game_catalog::identify_hash(long long hash)
+{
+  // Reuse the descriptor from an earlier lookup of the same game
+  lock_guard<mutex> lock(m_mutex);
+  auto it = m_games.find(hash);
+  if (it != m_games.end())
+  {
+    return &it->second;
+  }
+  
+  const unsigned char* entry = find_entry(hash);
+  if (entry == nullptr)
+  {
+    return nullptr;
+  }
+  
+  game_descriptor descriptor(entry_string(entry, 0), entry_string(entry, 1));
+  descriptor.system = m_system;
+  descriptor.num_bytes = read_u32(entry + 16);
+  if (m_system == game_descriptor::game_system::WONDERSWAN)
+  {
+    // The game's size is encoded in its hash
+    descriptor.num_bytes = ws_cartridge::calculate_game_size((int) ((hash >> (4*8)) & 0xFF));
+  }
+  return &m_games.emplace(hash, descriptor).first->second;
+}
+
+const char* binary_game_catalog::entry_string(const unsigned char* entry, int field) const
+{
+  // Names that don't lie entirely within the string table are left empty
+  unsigned int offset = read_u32(entry + 8 + 4 * field);
+  if (offset < m_strings_size && memchr(m_strings + offset, '\0', m_strings_size - offset) != nullptr)
+  {
+    return m_strings + offset;
+  }
+  return "";
+}
+
+const unsigned char* binary_game_catalog::find_entry(long long hash) const
+{
+  unsigned int low = 0;
+  unsigned int high = m_num_entries;
+  while (low < high)
+  {
+    unsigned int mid = low + (high - low) / 2;
+    long long mid_hash = read_i64(m_entries + mid * BINARY_CATALOG_ENTRY_SIZE);
+    if (mid_hash < hash)
+    {
+      low = mid + 1;
+    }
+    else if (mid_hash > hash)
+    {
+      high = mid;
+    }
+    else
+    {
+      return m_entries + mid * BINARY_CATALOG_ENTRY_SIZE;
+    }
+  }
+  return nullptr;
+}
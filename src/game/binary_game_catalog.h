@@ -0,0 +1,49 @@
+#ifndef __BINARY_GAME_CATALOG_H__
+#define __BINARY_GAME_CATALOG_H__
+
+#include "game_catalog.h"
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+class mapped_file;
+
+// Catalog backed by a memory-mapped binary table, see binary_catalog_format.h.
+// Lookups binary-search the mapped entries instead of querying SQLite
+class binary_game_catalog : public game_catalog
+{
+public:
+  binary_game_catalog(const char* file_name, game_descriptor::game_system system);
+  ~binary_game_catalog();
+  
+  const game_descriptor* identify_game(cartridge* cart, int slot_num = -1);
+  const game_descriptor* identify_game_by_fingerprint(unsigned int fingerprint);
+  const game_descriptor* identify_hash(long long hash);
+  bool known_good_hashes(long long hash, game_image_hashes* hashes);
+  game_descriptor::game_system system() const;
+  std::vector<const game_descriptor*> search(const std::string& query, unsigned int max_results = GAME_SEARCH_DEFAULT_MAX_RESULTS);
+
+private:
+  const unsigned char* find_entry(long long hash) const;
+  const char* entry_string(const unsigned char* entry, int field) const;
+  
+  std::unique_ptr<mapped_file> m_file;
+  game_descriptor::game_system m_system;
+  const unsigned char* m_entries;
+  unsigned int m_num_entries;
+  const char* m_strings;
+  unsigned int m_strings_size;
+  
+  // Interned descriptors by hash, added as games are first identified
+  std::mutex m_mutex;
+  std::unordered_map<long long, game_descriptor> m_games;
+  
+  // Hashes of the games with a sample fingerprint, indexed once when opened
+  std::unordered_map<unsigned int, long long> m_fingerprints;
+  
+  // Names of every game by word, built by the first search
+  std::once_flag m_search_once;
+  game_search_index m_search_index;
+};
+
+#endif // defined(__BINARY_GAME_CATALOG_H__)
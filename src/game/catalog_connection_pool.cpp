@@ -0,0 +1,144 @@
+#include "catalog_connection_pool.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+#include "sqlite/sqlite3.h"
+
+using namespace std;
+
+// Most of a catalog file each connection maps into memory rather than reads
+#define CATALOG_MMAP_SIZE "268435456"
+
+// Builds the URI opening a file read-only and immutable. Characters that mean
+// something in a URI are escaped, and Windows paths use forward slashes
+static string catalog_uri(const char* db_file_name)
+{
+  string uri = "file:";
+  for (const char* c = db_file_name; *c != '\0'; ++c)
+  {
+    if (*c == '\\')
+    {
+      uri += '/';
+    }
+    else if (*c == '?' || *c == '#' || *c == '%')
+    {
+      char escaped[4];
+      snprintf(escaped, sizeof(escaped), "%%%02X", (unsigned char) *c);
+      uri += escaped;
+    }
+    else
+    {
+      uri += *c;
+    }
+  }
+  return uri + "?mode=ro&immutable=1";
+}
+
+
+
+catalog_connection_pool::lease::lease(catalog_connection_pool* pool, const connection& conn)
+  : m_pool(pool), m_connection(conn)
+{
+  // Nothing else to do
+}
+
+catalog_connection_pool::lease::lease(lease&& other)
+  : m_pool(other.m_pool), m_connection(other.m_connection)
+{
+  other.m_pool = nullptr;
+}
+
+catalog_connection_pool::lease::~lease()
+{
+  if (m_pool != nullptr)
+  {
+    m_pool->release(m_connection);
+  }
+}
+
+sqlite3* catalog_connection_pool::lease::db() const
+{
+  return m_connection.db;
+}
+
+sqlite3_stmt* catalog_connection_pool::lease::lookup_stmt() const
+{
+  return m_connection.lookup_stmt;
+}
+
+
+
+catalog_connection_pool::catalog_connection_pool(const char* db_file_name, const std::string& lookup_query)
+  : m_uri(catalog_uri(db_file_name)), m_lookup_query(lookup_query)
+{
+  connection conn = open();
+  if (conn.db == nullptr)
+  {
+    throw std::runtime_error("Unable to open database");
+  }
+  m_idle.push_back(conn);
+}
+
+catalog_connection_pool::~catalog_connection_pool()
+{
+  for (const connection& conn : m_idle)
+  {
+    close(conn);
+  }
+}
+
+catalog_connection_pool::lease catalog_connection_pool::acquire()
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    if (!m_idle.empty())
+    {
+      connection conn = m_idle.back();
+      m_idle.pop_back();
+      return lease(this, conn);
+    }
+  }
+  
+  // Every connection is busy on another thread, so this thread gets its own
+  return lease(this, open());
+}
+
+catalog_connection_pool::connection catalog_connection_pool::open() const
+{
+  connection conn = {nullptr, nullptr};
+  
+  // Each connection is only ever used by one thread at a time, so SQLite's
+  // own locking of it is left out
+  if (sqlite3_open_v2(m_uri.c_str(), &conn.db, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK)
+  {
+    sqlite3_close_v2(conn.db);
+    conn.db = nullptr;
+    return conn;
+  }
+  sqlite3_exec(conn.db, "PRAGMA mmap_size=" CATALOG_MMAP_SIZE, nullptr, nullptr, nullptr);
+  
+  // If the lookup can't be prepared, lookups on the connection find nothing
+  if (sqlite3_prepare_v2(conn.db, m_lookup_query.c_str(), -1, &conn.lookup_stmt, nullptr) != SQLITE_OK)
+  {
+    sqlite3_finalize(conn.lookup_stmt);
+    conn.lookup_stmt = nullptr;
+  }
+  return conn;
+}
+
+void catalog_connection_pool::close(const connection& conn)
+{
+  sqlite3_finalize(conn.lookup_stmt);
+  sqlite3_close_v2(conn.db);
+}
+
+void catalog_connection_pool::release(const connection& conn)
+{
+  if (conn.db == nullptr)
+  {
+    return;
+  }
+  lock_guard<mutex> lock(m_mutex);
+  m_idle.push_back(conn);
+}
@@ -0,0 +1,77 @@
+#ifndef __CATALOG_CONNECTION_POOL_H__
+#define __CATALOG_CONNECTION_POOL_H__
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// Read-only connections to a catalog database, each used by a single thread
+// at a time, so that lookups from background identification, the library
+// indexer and device jobs run side by side instead of taking turns on one
+// connection. Connections are opened as they are first needed and kept for
+// reuse, with the database marked immutable so that SQLite never locks or
+// rereads it, and memory-mapped so that pages are shared between them. Each
+// connection has its own copy of the catalog's lookup statement. This class
+// is thread-safe
+class catalog_connection_pool
+{
+private:
+  struct connection
+  {
+    sqlite3* db;
+    sqlite3_stmt* lookup_stmt;
+  };
+
+public:
+  // A connection borrowed from the pool, given back when the lease is
+  // destroyed
+  class lease
+  {
+  public:
+    lease(lease&& other);
+    ~lease();
+    
+    // The connection, or nullptr if none could be opened
+    sqlite3* db() const;
+    
+    // The lookup statement prepared on the connection, or nullptr if it
+    // couldn't be prepared. Must be reset before the lease is given back
+    sqlite3_stmt* lookup_stmt() const;
+  
+  private:
+    friend class catalog_connection_pool;
+    lease(catalog_connection_pool* pool, const connection& conn);
+    lease(const lease& other) = delete;
+    lease& operator=(const lease& other) = delete;
+    
+    catalog_connection_pool* m_pool;
+    connection m_connection;
+  };
+  
+  // Throws std::runtime_error if the database can't be opened
+  catalog_connection_pool(const char* db_file_name, const std::string& lookup_query);
+  ~catalog_connection_pool();
+  
+  // Borrows an idle connection, opening another if every one is in use
+  lease acquire();
+
+private:
+  catalog_connection_pool(const catalog_connection_pool& other) = delete;
+  catalog_connection_pool& operator=(const catalog_connection_pool& other) = delete;
+  
+  // Opens a connection and prepares its lookup statement. The connection's
+  // db is nullptr if the database couldn't be opened
+  connection open() const;
+  static void close(const connection& conn);
+  void release(const connection& conn);
+  
+  const std::string m_uri;
+  const std::string m_lookup_query;
+  std::mutex m_mutex;
+  std::vector<connection> m_idle;
+};
+
+#endif // defined(__CATALOG_CONNECTION_POOL_H__)
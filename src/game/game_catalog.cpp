@@ -0,0 +1,73 @@
+#include "game_catalog.h"
+
+#include <stdexcept>
+
+#include "binary_game_catalog.h"
+#include "game_hash.h"
+#include "ngp_game_catalog.h"
+#include "ws_game_catalog.h"
+#include "common/mapped_file.h"
+
+void game_catalog::identify_games(cartridge* cart, const std::vector<int>& slots, std::vector<const game_descriptor*>& descriptors)
+{
+  descriptors.assign(slots.size(), nullptr);
+  for (unsigned int i = 0; i < slots.size(); ++i)
+  {
+    descriptors[i] = identify_game(cart, slots[i]);
+  }
+}
+
+const game_descriptor* game_catalog::identify_image(const std::string& path)
+{
+  long long hash;
+  bool has_hash = false;
+  try
+  {
+    mapped_file image(path);
+    switch (system())
+    {
+    case game_descriptor::game_system::NEO_GEO_POCKET:
+      has_hash = ngp_image_hash(image.data(), image.size(), &hash);
+      break;
+    
+    case game_descriptor::game_system::WONDERSWAN:
+      has_hash = ws_image_hash(image.data(), image.size(), &hash);
+      break;
+    
+    default:
+      break;
+    }
+  }
+  catch (std::exception& ex)
+  {
+    // Unreadable images are simply not identified
+    (void) ex;
+  }
+  
+  return (has_hash ? identify_hash(hash) : nullptr);
+}
+
+game_catalog* open_game_catalog(const std::string& base_path, game_descriptor::game_system system)
+{
+  try
+  {
+    return new binary_game_catalog((base_path + ".bin").c_str(), system);
+  }
+  catch (std::exception& ex)
+  {
+    // No usable binary catalog, so use the database instead
+    (void) ex;
+  }
+  
+  switch (system)
+  {
+  case game_descriptor::game_system::NEO_GEO_POCKET:
+    return new ngp_game_catalog((base_path + ".db").c_str(), true);
+    
+  case game_descriptor::game_system::WONDERSWAN:
+    return new ws_game_catalog((base_path + ".db").c_str(), true);
+    
+  default:
+    throw std::runtime_error("Unsupported game system");
+  }
+}
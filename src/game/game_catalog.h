@@ -2,14 +2,72 @@
 #define __GAME_CATALOG_H__
 
 #include "game_descriptor.h"
+#include "game_search_index.h"
+#include <string>
+#include <vector>
 
 class cartridge;
 
+// Checksums of the complete image of a game from a known-good dump, as
+// hash_ostream computes them
+struct game_image_hashes
+{
+  unsigned int crc32;
+  std::string sha1;
+};
+
 class game_catalog
 {
 public:
   virtual ~game_catalog() {}
+  
+  // Returns the descriptor of the game in the given slot, or nullptr if the
+  // game isn't known. Descriptors belong to the catalog and stay valid until
+  // it is destroyed, and the same game always yields the same descriptor
   virtual const game_descriptor* identify_game(cartridge* cart, int slot_num = -1) = 0;
+  
+  // Identifies the games in several slots of the same cartridge at once,
+  // setting one descriptor per slot as identify_game() would. Catalogs backed
+  // by a database look up every game they haven't seen before with a single
+  // query. The default implementation calls identify_game() for each slot
+  virtual void identify_games(cartridge* cart, const std::vector<int>& slots, std::vector<const game_descriptor*>& descriptors);
+  
+  // Returns the games with names matching what was typed so far, best matches
+  // first, as ranked by game_search_index::search(). The names are indexed by
+  // word the first time the catalog is searched, so that every search after
+  // is quick enough to run on each key press
+  virtual std::vector<const game_descriptor*> search(const std::string& query, unsigned int max_results = GAME_SEARCH_DEFAULT_MAX_RESULTS) = 0;
+  
+  // Returns the descriptor of the game with the given sample fingerprint, see
+  // game_fingerprint.h, or nullptr if the catalog has no game with it
+  virtual const game_descriptor* identify_game_by_fingerprint(unsigned int fingerprint) = 0;
+  
+  // Returns the descriptor of the game with the given hash, see game_hash.h,
+  // or nullptr if the catalog has no game with it. Lets games be identified
+  // from images as well as from cartridges
+  virtual const game_descriptor* identify_hash(long long hash) = 0;
+  
+  // Returns the descriptor of the game in an image file, or nullptr if the
+  // game isn't known or the file can't be opened. Builds the same hash as
+  // identify_game() from the metadata at the start of a Neo Geo Pocket image
+  // or the end of a WonderSwan image. The file is mapped rather than read, so
+  // only the pages holding the metadata are fetched however large it is
+  const game_descriptor* identify_image(const std::string& path);
+  
+  // Looks up the checksums of the known-good image of the game with the given
+  // hash, so that a dump of the game can be verified without the original
+  // image. Returns false if the catalog has none for the game, including when
+  // it was built before they were recorded
+  virtual bool known_good_hashes(long long hash, game_image_hashes* hashes) = 0;
+  
+  // Returns the system of the games in the catalog
+  virtual game_descriptor::game_system system() const = 0;
 };
 
+// Opens the catalog for a system given its path without an extension. Uses the
+// compact binary catalog (.bin) if there is one, falling back to the SQLite
+// database (.db) loaded into memory. Throws std::runtime_error if neither can
+// be opened
+game_catalog* open_game_catalog(const std::string& base_path, game_descriptor::game_system system);
+
 #endif // defined(__GAME_CATALOG_H__)
@@ -12,6 +12,7 @@ game_descriptor::game_descriptor(const game_descriptor& other)
   : game_descriptor(other.name, other.developer_name)
 {
   system = other.system;
+  num_bytes = other.num_bytes;
 }
 
 game_descriptor::~game_descriptor()
@@ -0,0 +1,107 @@
+#include "game_fingerprint.h"
+
+#include <vector>
+
+#include "cartridge/cartridge.h"
+#include "cartridge/digest_manifest.h"
+#include "game_catalog.h"
+
+// Offset of the given sample from the start of a game of the given size, or
+// from the start of a slot of that size holding the game
+static unsigned int sample_offset(game_descriptor::game_system system, unsigned int num_bytes, int sample_i)
+{
+  unsigned int offset = sample_i * (GAME_SAMPLE_WINDOW_SIZE / GAME_NUM_SAMPLES);
+  if (system == game_descriptor::game_system::WONDERSWAN)
+  {
+    // The last sample ends at the very end of the game
+    offset += num_bytes - GAME_SAMPLE_WINDOW_SIZE + (GAME_SAMPLE_WINDOW_SIZE / GAME_NUM_SAMPLES - GAME_SAMPLE_SIZE);
+  }
+  return offset;
+}
+
+// Zero is left to mean that there is no fingerprint
+static unsigned int finish_fingerprint(const std::vector<unsigned char>& samples)
+{
+  unsigned int fingerprint = digest_manifest::crc32c(samples.data(), (unsigned int) samples.size());
+  return (fingerprint == 0 ? 1 : fingerprint);
+}
+
+bool sample_game_fingerprint(cartridge* cart, int slot_num, unsigned int* fingerprint)
+{
+  game_descriptor::game_system system;
+  switch (cart->system())
+  {
+  case system_type::SYSTEM_NEO_GEO_POCKET:
+    system = game_descriptor::game_system::NEO_GEO_POCKET;
+    break;
+    
+  case system_type::SYSTEM_WONDERSWAN:
+    system = game_descriptor::game_system::WONDERSWAN;
+    break;
+    
+  default:
+    return false;
+  }
+  if (slot_num == -1)
+  {
+    slot_num = 0;
+  }
+  
+  unsigned int slot_size = cart->slot_size(slot_num);
+  if (slot_size < GAME_SAMPLE_WINDOW_SIZE)
+  {
+    return false;
+  }
+  
+  std::vector<unsigned char> samples(GAME_NUM_SAMPLES * GAME_SAMPLE_SIZE);
+  for (int i = 0; i < GAME_NUM_SAMPLES; ++i)
+  {
+    unsigned int offset = sample_offset(system, slot_size, i);
+    if (cart->read_cartridge_game_data(slot_num, offset, &samples[i * GAME_SAMPLE_SIZE], GAME_SAMPLE_SIZE) != GAME_SAMPLE_SIZE)
+    {
+      return false;
+    }
+  }
+  
+  *fingerprint = finish_fingerprint(samples);
+  return true;
+}
+
+unsigned int sample_image_fingerprint(game_descriptor::game_system system, const unsigned char* data, unsigned int num_bytes)
+{
+  if (num_bytes < GAME_SAMPLE_WINDOW_SIZE)
+  {
+    return 0;
+  }
+  
+  std::vector<unsigned char> samples;
+  samples.reserve(GAME_NUM_SAMPLES * GAME_SAMPLE_SIZE);
+  for (int i = 0; i < GAME_NUM_SAMPLES; ++i)
+  {
+    const unsigned char* sample = data + sample_offset(system, num_bytes, i);
+    samples.insert(samples.end(), sample, sample + GAME_SAMPLE_SIZE);
+  }
+  return finish_fingerprint(samples);
+}
+
+const game_descriptor* quick_identify_game(game_catalog* catalog, cartridge* cart, int slot_num, unsigned int* fingerprint)
+{
+  unsigned int sampled = 0;
+  if (fingerprint != nullptr)
+  {
+    *fingerprint = 0;
+  }
+  if (sample_game_fingerprint(cart, slot_num, &sampled))
+  {
+    if (fingerprint != nullptr)
+    {
+      *fingerprint = sampled;
+    }
+    const game_descriptor* descriptor = catalog->identify_game_by_fingerprint(sampled);
+    if (descriptor != nullptr)
+    {
+      return descriptor;
+    }
+  }
+  return catalog->identify_game(cart, slot_num);
+}
@@ -0,0 +1,33 @@
+#ifndef __GAME_FINGERPRINT_H__
+#define __GAME_FINGERPRINT_H__
+
+#include "game_descriptor.h"
+
+class cartridge;
+class game_catalog;
+
+// Sample fingerprints identify a game by its contents rather than its header,
+// from a handful of small blocks spread over a fixed window of the game. The
+// window starts at the beginning of a Neo Geo Pocket game and ends at the end
+// of a WonderSwan game, where each system keeps its header, so a cartridge and
+// an image of the game yield the same fingerprint regardless of the size of
+// the chip the game is on
+#define GAME_SAMPLE_WINDOW_SIZE 0x20000
+#define GAME_SAMPLE_SIZE        0x200
+#define GAME_NUM_SAMPLES        8
+
+// Compute the sample fingerprint of the game in the given slot by reading only
+// the sampled blocks. Returns false if the slot is too small to sample. A slot
+// of -1 means the first slot
+bool sample_game_fingerprint(cartridge* cart, int slot_num, unsigned int* fingerprint);
+
+// Compute the sample fingerprint of a game image, e.g. to add to a catalog.
+// Returns 0, which is never a valid fingerprint, if the image is too small
+unsigned int sample_image_fingerprint(game_descriptor::game_system system, const unsigned char* data, unsigned int num_bytes);
+
+// Identifies the game in the given slot by its sample fingerprint, falling back
+// to its metadata if the catalog has no fingerprint for it. If given, the
+// fingerprint is set to the one sampled, or 0 if the slot couldn't be sampled
+const game_descriptor* quick_identify_game(game_catalog* catalog, cartridge* cart, int slot_num = -1, unsigned int* fingerprint = nullptr);
+
+#endif // defined(__GAME_FINGERPRINT_H__)
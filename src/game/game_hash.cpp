@@ -0,0 +1,101 @@
+#include "game_hash.h"
+
+#include "cartridge/ngp_cartridge.h"
+#include "cartridge/ws_cartridge.h"
+
+static long long ngp_metadata_hash(const ngp_cartridge::game_metadata* metadata)
+{
+  long long hash = 0;
+  hash |= ((long long) metadata->startup_address) << (4 * 8);
+  hash |= ((long long) metadata->game_id) << (2 * 8);
+  hash |= ((long long) metadata->game_version) << (1 * 8);
+  hash |= ((long long) metadata->minimum_system);
+  return hash;
+}
+
+static long long ws_metadata_hash(const ws_cartridge::game_metadata* metadata)
+{
+  long long hash = 0;
+  hash |= ((long long) metadata->developer_id) << (7*8);
+  hash |= ((long long) metadata->minimum_system) << (6*8);
+  hash |= ((long long) metadata->game_id) << (5*8);
+  hash |= ((long long) metadata->rom_size) << (4*8);
+  hash |= ((long long) metadata->save_size) << (3*8);
+  hash |= ((long long) metadata->flags) << (2*8);
+  hash |= ((long long) metadata->checksum);
+  return hash;
+}
+
+bool ngp_game_hash(cartridge* cart, int slot_num, long long* hash)
+{
+  // Verify arguments
+  if (cart->system() != system_type::SYSTEM_NEO_GEO_POCKET)
+  {
+    return false;
+  }
+  if (slot_num == -1)
+  {
+    slot_num = 0;
+  }
+  
+  // Fetch game metadata
+  const ngp_cartridge::game_metadata* metadata = ((ngp_cartridge*) cart)->get_game_metadata(slot_num);
+  if (metadata == nullptr)
+  {
+    return false;
+  }
+  
+  // Build hash
+  *hash = ngp_metadata_hash(metadata);
+  return true;
+}
+
+bool ws_game_hash(cartridge* cart, int slot_num, long long* hash)
+{
+  // Verify arguments
+  if (cart->system() != system_type::SYSTEM_WONDERSWAN)
+  {
+    return false;
+  }
+  if (slot_num == -1)
+  {
+    slot_num = 0;
+  }
+  
+  // Fetch game metadata
+  const ws_cartridge::game_metadata* metadata = ((ws_cartridge*) cart)->get_game_metadata(slot_num);
+  if (metadata == nullptr)
+  {
+    return false;
+  }
+  
+  // Build hash
+  *hash = ws_metadata_hash(metadata);
+  return true;
+}
+
+bool ngp_image_hash(const unsigned char* data, unsigned int num_bytes, long long* hash)
+{
+  if (num_bytes < 48)
+  {
+    return false;
+  }
+  
+  ngp_cartridge::game_metadata metadata;
+  metadata.read_from_data_array(data);
+  *hash = ngp_metadata_hash(&metadata);
+  return true;
+}
+
+bool ws_image_hash(const unsigned char* data, unsigned int num_bytes, long long* hash)
+{
+  if (num_bytes < 10)
+  {
+    return false;
+  }
+  
+  ws_cartridge::game_metadata metadata;
+  metadata.read_from_data_array(data + num_bytes - 10);
+  *hash = ws_metadata_hash(&metadata);
+  return true;
+}
@@ -0,0 +1,18 @@
+#ifndef __GAME_HASH_H__
+#define __GAME_HASH_H__
+
+class cartridge;
+
+// Build the hash used to look up the game in the given slot of a cartridge,
+// from the game's metadata. Return false if the cartridge is for another
+// system or the slot has no metadata. A slot of -1 means the first slot
+bool ngp_game_hash(cartridge* cart, int slot_num, long long* hash);
+bool ws_game_hash(cartridge* cart, int slot_num, long long* hash);
+
+// Build the same hashes from the metadata of a game image, found in the first
+// 48 bytes of a Neo Geo Pocket image and the last 10 bytes of a WonderSwan
+// image. Return false if the image is too small to have metadata
+bool ngp_image_hash(const unsigned char* data, unsigned int num_bytes, long long* hash);
+bool ws_image_hash(const unsigned char* data, unsigned int num_bytes, long long* hash);
+
+#endif // defined(__GAME_HASH_H__)
@@ -0,0 +1,112 @@
+#include "game_identification_cache.h"
+
+#include "game_catalog.h"
+#include "game_hash.h"
+#include "cartridge/cartridge.h"
+
+using namespace std;
+
+game_identification_cache::game_identification_cache(unsigned int capacity)
+  : m_capacity(capacity == 0 ? 1 : capacity)
+{
+  // Nothing else to do
+}
+
+bool game_identification_cache::make_key(cartridge* cart, int slot_num, key_t* key)
+{
+  // Hashes of different systems can collide, so the system is part of the key
+  long long hash;
+  bool success = (cart->system() == system_type::SYSTEM_NEO_GEO_POCKET ? ngp_game_hash(cart, slot_num, &hash)
+                  : cart->system() == system_type::SYSTEM_WONDERSWAN ? ws_game_hash(cart, slot_num, &hash)
+                  : false);
+  if (success)
+  {
+    *key = key_t((int) cart->system(), hash);
+  }
+  return success;
+}
+
+bool game_identification_cache::lookup(cartridge* cart, int slot_num, const game_descriptor** descriptor)
+{
+  key_t key;
+  if (!make_key(cart, slot_num, &key))
+  {
+    // Games without metadata can never be identified
+    *descriptor = nullptr;
+    return true;
+  }
+  
+  lock_guard<mutex> lock(m_mutex);
+  auto it = m_index.find(key);
+  if (it == m_index.end())
+  {
+    return false;
+  }
+  
+  // Mark as most recently used
+  m_entries.splice(m_entries.begin(), m_entries, it->second);
+  *descriptor = it->second->second;
+  return true;
+}
+
+const game_descriptor* game_identification_cache::identify_game(game_catalog* catalog, cartridge* cart, int slot_num)
+{
+  const game_descriptor* descriptor;
+  if (lookup(cart, slot_num, &descriptor))
+  {
+    return descriptor;
+  }
+  
+  // Lookups of the same game racing each other get the same descriptor from
+  // the catalog, so the catalog is asked without holding the lock
+  key_t key;
+  make_key(cart, slot_num, &key);
+  descriptor = catalog->identify_game(cart, slot_num);
+  remember(key, descriptor);
+  return descriptor;
+}
+
+void game_identification_cache::identify_games(game_catalog* catalog, cartridge* cart, const std::vector<int>& slots, std::vector<const game_descriptor*>& descriptors)
+{
+  descriptors.assign(slots.size(), nullptr);
+  
+  vector<int> missing_slots;
+  vector<unsigned int> missing_indices;
+  for (unsigned int i = 0; i < slots.size(); ++i)
+  {
+    if (!lookup(cart, slots[i], &descriptors[i]))
+    {
+      missing_slots.push_back(slots[i]);
+      missing_indices.push_back(i);
+    }
+  }
+  if (missing_slots.empty())
+  {
+    return;
+  }
+  
+  vector<const game_descriptor*> found;
+  catalog->identify_games(cart, missing_slots, found);
+  for (unsigned int i = 0; i < missing_slots.size(); ++i)
+  {
+    key_t key;
+    make_key(cart, missing_slots[i], &key);
+    descriptors[missing_indices[i]] = found[i];
+    remember(key, found[i]);
+  }
+}
+
+void game_identification_cache::remember(const key_t& key, const game_descriptor* descriptor)
+{
+  lock_guard<mutex> lock(m_mutex);
+  if (m_index.find(key) == m_index.end())
+  {
+    m_entries.push_front(make_pair(key, descriptor));
+    m_index[key] = m_entries.begin();
+    if (m_entries.size() > m_capacity)
+    {
+      m_index.erase(m_entries.back().first);
+      m_entries.pop_back();
+    }
+  }
+}
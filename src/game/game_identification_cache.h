@@ -0,0 +1,53 @@
+#ifndef __GAME_IDENTIFICATION_CACHE_H__
+#define __GAME_IDENTIFICATION_CACHE_H__
+
+#include "game_descriptor.h"
+#include <list>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+class cartridge;
+class game_catalog;
+
+// Remembers the most recently identified games by system and metadata hash,
+// so that a cartridge seen again is named without going to a catalog. Misses
+// are remembered too. Descriptors belong to the catalogs they came from, which
+// have to outlive the cache. This class is thread-safe
+class game_identification_cache
+{
+public:
+  explicit game_identification_cache(unsigned int capacity = 64);
+  
+  // Looks up the game in the given slot without touching a catalog. Returns
+  // false if it hasn't been identified recently, otherwise sets the descriptor,
+  // which is nullptr if the catalog didn't know the game
+  bool lookup(cartridge* cart, int slot_num, const game_descriptor** descriptor);
+  
+  // Identifies the game in the given slot, asking the catalog only if the
+  // game isn't cached
+  const game_descriptor* identify_game(game_catalog* catalog, cartridge* cart, int slot_num = -1);
+  
+  // Identifies the games in several slots at once, asking the catalog about
+  // every game that isn't cached in a single batch
+  void identify_games(game_catalog* catalog, cartridge* cart, const std::vector<int>& slots, std::vector<const game_descriptor*>& descriptors);
+
+private:
+  typedef std::pair<int, long long> key_t;
+  typedef std::list<std::pair<key_t, const game_descriptor*>> entries_t;
+  
+  static bool make_key(cartridge* cart, int slot_num, key_t* key);
+  
+  // Adds a catalog's answer, unless a racing lookup already has
+  void remember(const key_t& key, const game_descriptor* descriptor);
+  
+  const unsigned int m_capacity;
+  std::mutex m_mutex;
+  
+  // Entries from most to least recently used, indexed by key
+  entries_t m_entries;
+  std::map<key_t, entries_t::iterator> m_index;
+};
+
+#endif // defined(__GAME_IDENTIFICATION_CACHE_H__)
@@ -0,0 +1,137 @@
+#include "game_search_index.h"
+
+#include <algorithm>
+#include <cctype>
+#include <tuple>
+
+using namespace std;
+
+static bool starts_with(const string& text, const string& prefix)
+{
+  return text.size() >= prefix.size() && text.compare(0, prefix.size(), prefix) == 0;
+}
+
+static string join_words(const vector<string>& words)
+{
+  string joined;
+  for (const string& word : words)
+  {
+    if (!joined.empty())
+    {
+      joined += ' ';
+    }
+    joined += word;
+  }
+  return joined;
+}
+
+void game_search_index::add(long long hash, const std::string& name)
+{
+  game g;
+  g.hash = hash;
+  g.folded_name = fold(name);
+  g.words = split_words(g.folded_name);
+  
+  unsigned int index = (unsigned int) m_games.size();
+  for (const string& word : g.words)
+  {
+    m_words.push_back(make_pair(word, index));
+  }
+  m_games.push_back(std::move(g));
+}
+
+void game_search_index::finish()
+{
+  sort(m_words.begin(), m_words.end());
+  m_words.erase(unique(m_words.begin(), m_words.end()), m_words.end());
+}
+
+std::vector<long long> game_search_index::search(const std::string& query, unsigned int max_results) const
+{
+  vector<string> query_words = split_words(fold(query));
+  if (query_words.empty() || max_results == 0)
+  {
+    return vector<long long>();
+  }
+  
+  // Gather the games with a word starting with the longest query word, which
+  // is likely the one the fewest words start with
+  const string& key = *max_element(query_words.begin(), query_words.end(),
+                                   [](const string& a, const string& b) { return a.size() < b.size(); });
+  vector<unsigned int> candidates;
+  for (auto it = lower_bound(m_words.begin(), m_words.end(), make_pair(key, 0u));
+       it != m_words.end() && starts_with(it->first, key); ++it)
+  {
+    candidates.push_back(it->second);
+  }
+  sort(candidates.begin(), candidates.end());
+  candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+  
+  // Keep those that match the other words too, ranked as documented
+  typedef tuple<bool, bool, size_t, const string*, unsigned int> rank_t;
+  string joined_query = join_words(query_words);
+  vector<rank_t> matches;
+  for (unsigned int index : candidates)
+  {
+    const game& g = m_games[index];
+    bool matches_all = all_of(query_words.begin(), query_words.end(), [&g](const string& query_word)
+    {
+      return any_of(g.words.begin(), g.words.end(), [&query_word](const string& word) { return starts_with(word, query_word); });
+    });
+    if (matches_all)
+    {
+      matches.push_back(rank_t(!starts_with(join_words(g.words), joined_query),
+                               !starts_with(g.words.front(), query_words.front()),
+                               g.folded_name.size(), &g.folded_name, index));
+    }
+  }
+  
+  auto by_rank = [](const rank_t& a, const rank_t& b)
+  {
+    return tie(get<0>(a), get<1>(a), get<2>(a), *get<3>(a), get<4>(a))
+           < tie(get<0>(b), get<1>(b), get<2>(b), *get<3>(b), get<4>(b));
+  };
+  size_t num_results = min((size_t) max_results, matches.size());
+  partial_sort(matches.begin(), matches.begin() + num_results, matches.end(), by_rank);
+  
+  vector<long long> hashes;
+  hashes.reserve(num_results);
+  for (size_t i = 0; i < num_results; ++i)
+  {
+    hashes.push_back(m_games[get<4>(matches[i])].hash);
+  }
+  return hashes;
+}
+
+std::string game_search_index::fold(const std::string& text)
+{
+  string folded(text);
+  for (char& c : folded)
+  {
+    c = (char) tolower((unsigned char) c);
+  }
+  return folded;
+}
+
+std::vector<std::string> game_search_index::split_words(const std::string& folded)
+{
+  vector<string> words;
+  string word;
+  for (char c : folded)
+  {
+    if (isalnum((unsigned char) c))
+    {
+      word += c;
+    }
+    else if (!word.empty())
+    {
+      words.push_back(word);
+      word.clear();
+    }
+  }
+  if (!word.empty())
+  {
+    words.push_back(word);
+  }
+  return words;
+}
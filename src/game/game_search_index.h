@@ -0,0 +1,48 @@
+#ifndef __GAME_SEARCH_INDEX_H__
+#define __GAME_SEARCH_INDEX_H__
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// The default number of matches game_catalog::search() returns
+#define GAME_SEARCH_DEFAULT_MAX_RESULTS 20
+
+// Index of game names by the words in them, so that a search finds the games
+// with words starting with what was typed without scanning every name. Words
+// are runs of letters and digits, compared without regard to case. Built once
+// with add() and finish(), then only read, so searches need no lock
+class game_search_index
+{
+public:
+  // Adds a game by its catalog hash. Must be called before finish()
+  void add(long long hash, const std::string& name);
+  
+  // Sorts the words added so that they can be searched
+  void finish();
+  
+  // Returns the hashes of the games of which every word of the query starts a
+  // word, best matches first: names starting with the whole query, then
+  // names whose first word matches, then the shortest names, and finally in
+  // alphabetical order. An empty query matches nothing
+  std::vector<long long> search(const std::string& query, unsigned int max_results = GAME_SEARCH_DEFAULT_MAX_RESULTS) const;
+  
+private:
+  struct game
+  {
+    long long hash;
+    std::string folded_name;
+    std::vector<std::string> words;
+  };
+  
+  // Lowercases a string and splits it into words
+  static std::string fold(const std::string& text);
+  static std::vector<std::string> split_words(const std::string& folded);
+  
+  std::vector<game> m_games;
+  
+  // Every word of every game with the index of the game, sorted by word
+  std::vector<std::pair<std::string, unsigned int>> m_words;
+};
+
+#endif // defined(__GAME_SEARCH_INDEX_H__)
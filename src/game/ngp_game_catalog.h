@@ -2,19 +2,57 @@
 #define __NGP_GAME_CATALOG_H__
 
 #include "game_catalog.h"
+#include "catalog_connection_pool.h"
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 
 struct sqlite3;
+struct sqlite3_stmt;
 
 class ngp_game_catalog : public game_catalog
 {
 public:
-  ngp_game_catalog(const char* db_file_name);
+  ngp_game_catalog(const char* db_file_name, bool load_into_memory = false);
   ~ngp_game_catalog();
   
   const game_descriptor* identify_game(cartridge* cart, int slot_num =-1);
-  
+  const game_descriptor* identify_game_by_fingerprint(unsigned int fingerprint);
+  const game_descriptor* identify_hash(long long hash);
+  bool known_good_hashes(long long hash, game_image_hashes* hashes);
+  game_descriptor::game_system system() const;
+  void identify_games(cartridge* cart, const std::vector<int>& slots, std::vector<const game_descriptor*>& descriptors);
+  std::vector<const game_descriptor*> search(const std::string& query, unsigned int max_results = GAME_SEARCH_DEFAULT_MAX_RESULTS);
+
 private:
-  sqlite3* m_sqlite;
+  // Looks up games that haven't been seen before in a single query, keeping
+  // what it finds. Must be called without the lock held
+  void query_hashes(const std::vector<long long>& hashes);
+  void load_known_cartridges(sqlite3* db);
+  
+  // Queries run on a connection of their own, and only take the lock to
+  // check and update the interned descriptors
+  catalog_connection_pool m_connections;
+  std::mutex m_mutex;
+  
+  // Interned descriptors by hash. When the whole catalog isn't loaded into
+  // memory, games are added as they are first identified
+  bool m_loaded_into_memory;
+  std::unordered_map<long long, game_descriptor> m_games;
+  std::unordered_set<long long> m_unknown_hashes;
+  
+  // Hashes of the games with a sample fingerprint. Empty if the database
+  // predates fingerprints
+  std::unordered_map<unsigned int, long long> m_fingerprints;
+  
+  // Checksums of the games with a known-good image, by hash. Empty if the
+  // database predates them
+  std::unordered_map<long long, game_image_hashes> m_image_hashes;
+  
+  // Names of every game by word, built by the first search
+  void build_search_index();
+  std::once_flag m_search_once;
+  game_search_index m_search_index;
 };
 
 #endif // defined(__NGP_GAME_CATALOG_H__)
@@ -0,0 +1,425 @@
+#include "rom_library.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+#include "game_catalog.h"
+#include "game_hash.h"
+#include "cartridge/ngp_cartridge.h"
+#include "common/dump_archive.h"
+#include "common/file_util.h"
+#include "common/mapped_file.h"
+#include "task/task_pool.h"
+
+using namespace std;
+
+// First line of an index file, changed whenever the format changes so that
+// older indexes are rebuilt rather than misread
+#define ROM_LIBRARY_INDEX_MAGIC "fmlib2"
+
+// Keeps a name on one field of its line in the index
+static string index_field(const string& text)
+{
+  string field(text);
+  for (char& c : field)
+  {
+    if (c == '\t' || c == '\r' || c == '\n')
+    {
+      c = ' ';
+    }
+  }
+  return field;
+}
+
+// Names in metadata are padded with spaces or nulls
+static string trimmed_name(const char* name)
+{
+  string trimmed(name);
+  while (!trimmed.empty() && (isspace((unsigned char) trimmed.back()) || !isprint((unsigned char) trimmed.back())))
+  {
+    trimmed.erase(trimmed.size() - 1);
+  }
+  return trimmed;
+}
+
+static bool is_dump_archive_name(const string& name)
+{
+  static const string extension = DUMP_ARCHIVE_EXTENSION;
+  return name.size() > extension.size()
+    && name.compare(name.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+rom_library::rom_library(const std::string& index_path)
+  : m_index_path(index_path)
+{
+  load();
+}
+
+unsigned int rom_library::scan(const std::vector<std::string>& directories, game_catalog* ngp_catalog, game_catalog* ws_catalog)
+{
+  vector<rom_library_entry> found;
+  for (const string& directory : directories)
+  {
+    list_images(directory, found);
+  }
+  sort(found.begin(), found.end(), [](const rom_library_entry& a, const rom_library_entry& b) { return a.path < b.path; });
+  found.erase(unique(found.begin(), found.end(), [](const rom_library_entry& a, const rom_library_entry& b) { return a.path == b.path; }), found.end());
+  
+  // Keep what was read before of every image that hasn't changed since
+  unordered_map<string, const rom_library_entry*> previous;
+  for (const rom_library_entry& entry : m_entries)
+  {
+    previous[entry.path] = &entry;
+  }
+  vector<unsigned int> changed;
+  for (unsigned int i = 0; i < found.size(); ++i)
+  {
+    auto it = previous.find(found[i].path);
+    if (it != previous.end() && it->second->mtime == found[i].mtime && it->second->size == found[i].size)
+    {
+      found[i] = *it->second;
+    }
+    else
+    {
+      changed.push_back(i);
+    }
+  }
+  
+  // Read the rest many at once. Each thread takes the next image left rather
+  // than a fixed share, so that a few slow reads don't hold up the others
+  vector<char> readable(found.size(), 1);
+  if (!changed.empty())
+  {
+    task_pool pool(changed.size() < ROM_LIBRARY_SCAN_THREADS ? (unsigned int) changed.size() : ROM_LIBRARY_SCAN_THREADS);
+    atomic<unsigned int> next(0);
+    vector<future<void>> threads;
+    for (unsigned int t = 0; t < pool.num_threads(); ++t)
+    {
+      threads.push_back(pool.submit([&]()
+      {
+        for (unsigned int i = next++; i < changed.size(); i = next++)
+        {
+          readable[changed[i]] = read_image(found[changed[i]]);
+        }
+      }));
+    }
+    for (future<void>& thread : threads)
+    {
+      thread.get();
+    }
+  }
+  
+  // Images that couldn't be read are left out, so that the next scan tries again
+  m_entries.clear();
+  for (unsigned int i = 0; i < found.size(); ++i)
+  {
+    if (readable[i])
+    {
+      m_entries.push_back(std::move(found[i]));
+    }
+  }
+  
+  // Look every game up again, since the catalogs may know more games now
+  for (rom_library_entry& entry : m_entries)
+  {
+    game_catalog* catalog = (entry.system == game_descriptor::NEO_GEO_POCKET ? ngp_catalog : ws_catalog);
+    if (catalog != nullptr)
+    {
+      const game_descriptor* descriptor = (entry.has_hash ? catalog->identify_hash(entry.hash) : nullptr);
+      entry.name = (descriptor == nullptr ? "" : descriptor->name);
+    }
+  }
+  
+  save();
+  return (unsigned int) changed.size();
+}
+
+const std::vector<rom_library_entry>& rom_library::entries() const
+{
+  return m_entries;
+}
+
+std::vector<const rom_library_entry*> rom_library::find(long long hash) const
+{
+  vector<const rom_library_entry*> matches;
+  for (const rom_library_entry& entry : m_entries)
+  {
+    if (entry.has_hash && entry.hash == hash)
+    {
+      matches.push_back(&entry);
+    }
+  }
+  return matches;
+}
+
+void rom_library::save() const
+{
+  // Write the whole index next to the old one first, so that a failed write
+  // never leaves a partial index behind
+  string temp_path = m_index_path + ".tmp";
+  ofstream fout(temp_path.c_str(), ios::out | ios::trunc);
+  fout << ROM_LIBRARY_INDEX_MAGIC << "\n";
+  for (const rom_library_entry& entry : m_entries)
+  {
+    fout << entry.mtime << '\t' << entry.size << '\t' << (int) entry.system << '\t';
+    if (entry.has_hash)
+    {
+      fout << hex << (unsigned long long) entry.hash << dec;
+    }
+    else
+    {
+      fout << '-';
+    }
+    fout << '\t' << index_field(entry.metadata_name) << '\t' << index_field(entry.name) << '\t' << entry.path << "\n";
+  }
+  fout.close();
+  
+  if (!fout || !replace_file(temp_path, m_index_path))
+  {
+    remove(temp_path.c_str());
+    throw std::runtime_error("Unable to write library index " + m_index_path);
+  }
+}
+
+
+
+void rom_library::load()
+{
+  ifstream fin(m_index_path.c_str());
+  string line;
+  if (!getline(fin, line) || line != ROM_LIBRARY_INDEX_MAGIC)
+  {
+    return;
+  }
+  
+  while (getline(fin, line))
+  {
+    // The path comes last, so that it may hold anything but a line break
+    vector<string> fields;
+    string::size_type start = 0;
+    while (fields.size() < 6)
+    {
+      string::size_type end = line.find('\t', start);
+      if (end == string::npos)
+      {
+        break;
+      }
+      fields.push_back(line.substr(start, end - start));
+      start = end + 1;
+    }
+    if (fields.size() < 6 || start >= line.size())
+    {
+      continue;
+    }
+    
+    rom_library_entry entry;
+    entry.mtime = atoll(fields[0].c_str());
+    entry.size = atoll(fields[1].c_str());
+    entry.system = (game_descriptor::game_system) atoi(fields[2].c_str());
+    entry.has_hash = (fields[3] != "-");
+    entry.hash = (entry.has_hash ? (long long) strtoull(fields[3].c_str(), nullptr, 16) : 0);
+    entry.metadata_name = fields[4];
+    entry.name = fields[5];
+    entry.path = line.substr(start);
+    if (entry.system == system_for(entry.path))
+    {
+      m_entries.push_back(entry);
+    }
+  }
+}
+
+game_descriptor::game_system rom_library::system_for(const std::string& path)
+{
+  string::size_type dot = path.find_last_of("./\\");
+  if (dot == string::npos || path[dot] != '.')
+  {
+    return game_descriptor::UNKNOWN;
+  }
+  
+  string extension = path.substr(dot + 1);
+  for (char& c : extension)
+  {
+    c = (char) tolower((unsigned char) c);
+  }
+  if (extension == "ngp" || extension == "ngc")
+  {
+    return game_descriptor::NEO_GEO_POCKET;
+  }
+  if (extension == "ws" || extension == "wsc")
+  {
+    return game_descriptor::WONDERSWAN;
+  }
+  return game_descriptor::UNKNOWN;
+}
+
+void rom_library::list_images(const std::string& directory, std::vector<rom_library_entry>& images)
+{
+  // Listing a directory gives the modification time and size of every file on
+  // Windows. Elsewhere each file has to be looked at anyway to tell
+  // directories apart, which gives them too
+  vector<string> subdirectories;
+#ifdef _WIN32
+  WIN32_FIND_DATAA data;
+  HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &data);
+  if (find == INVALID_HANDLE_VALUE)
+  {
+    return;
+  }
+  do
+  {
+    string name = data.cFileName;
+    if (name == "." || name == "..")
+    {
+      continue;
+    }
+    string path = directory + "\\" + name;
+    if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+    {
+      subdirectories.push_back(path);
+      continue;
+    }
+    if (is_dump_archive_name(name))
+    {
+      list_archive(path, images);
+      continue;
+    }
+    
+    game_descriptor::game_system system = system_for(name);
+    if (system != game_descriptor::UNKNOWN)
+    {
+      rom_library_entry entry;
+      entry.path = path;
+      entry.mtime = filetime_to_modification_time(data.ftLastWriteTime.dwHighDateTime, data.ftLastWriteTime.dwLowDateTime);
+      entry.size = (long long) (((unsigned long long) data.nFileSizeHigh << 32) | data.nFileSizeLow);
+      entry.system = system;
+      entry.has_hash = false;
+      entry.hash = 0;
+      images.push_back(entry);
+    }
+  }
+  while (FindNextFileA(find, &data));
+  FindClose(find);
+#else
+  DIR* dir = opendir(directory.c_str());
+  if (dir == nullptr)
+  {
+    return;
+  }
+  for (struct dirent* item = readdir(dir); item != nullptr; item = readdir(dir))
+  {
+    string name = item->d_name;
+    if (name == "." || name == "..")
+    {
+      continue;
+    }
+    string path = directory + "/" + name;
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+    {
+      continue;
+    }
+    if (S_ISDIR(info.st_mode))
+    {
+      subdirectories.push_back(path);
+      continue;
+    }
+    if (S_ISREG(info.st_mode) && is_dump_archive_name(name))
+    {
+      list_archive(path, images);
+      continue;
+    }
+    
+    game_descriptor::game_system system = system_for(name);
+    if (S_ISREG(info.st_mode) && system != game_descriptor::UNKNOWN)
+    {
+      rom_library_entry entry;
+      entry.path = path;
+      entry.mtime = modification_time(info);
+      entry.size = (long long) info.st_size;
+      entry.system = system;
+      entry.has_hash = false;
+      entry.hash = 0;
+      images.push_back(entry);
+    }
+  }
+  closedir(dir);
+#endif
+  
+  for (const string& subdirectory : subdirectories)
+  {
+    list_images(subdirectory, images);
+  }
+}
+
+void rom_library::list_archive(const std::string& path, std::vector<rom_library_entry>& images)
+{
+  try
+  {
+    dump_archive archive(path);
+    for (const dump_archive::entry& member : archive.entries())
+    {
+      game_descriptor::game_system system = system_for(member.id);
+      if (system != game_descriptor::UNKNOWN)
+      {
+        rom_library_entry entry;
+        entry.path = dump_archive::member_path(path, member.id);
+        entry.mtime = (long long) member.offset;
+        entry.size = (long long) member.size;
+        entry.system = system;
+        entry.has_hash = false;
+        entry.hash = 0;
+        images.push_back(entry);
+      }
+    }
+  }
+  catch (std::runtime_error&)
+  {
+    // Not an archive after all
+  }
+}
+
+bool rom_library::read_image(rom_library_entry& entry)
+{
+  entry.has_hash = false;
+  entry.metadata_name.clear();
+  entry.name.clear();
+  try
+  {
+    // Only the pages of the mapping holding the metadata are ever read, so
+    // large images on a share cost no more than small ones
+    mapped_file image(entry.path);
+    if (entry.system == game_descriptor::NEO_GEO_POCKET)
+    {
+      entry.has_hash = ngp_image_hash(image.data(), image.size(), &entry.hash);
+      if (entry.has_hash)
+      {
+        ngp_cartridge::game_metadata metadata;
+        metadata.read_from_data_array(image.data());
+        entry.metadata_name = trimmed_name(metadata.game_name);
+      }
+    }
+    else
+    {
+      entry.has_hash = ws_image_hash(image.data(), image.size(), &entry.hash);
+    }
+    return true;
+  }
+  catch (std::exception&)
+  {
+    return false;
+  }
+}
@@ -0,0 +1,90 @@
+#ifndef __ROM_LIBRARY_H__
+#define __ROM_LIBRARY_H__
+
+#include "game_descriptor.h"
+#include <string>
+#include <vector>
+
+class game_catalog;
+
+// The number of images read at once while scanning. Images usually live on a
+// network share, where each read waits on the network rather than the disk
+#define ROM_LIBRARY_SCAN_THREADS 8
+
+// An image found while scanning the library
+struct rom_library_entry
+{
+  std::string path;
+  long long mtime;
+  long long size;
+  game_descriptor::game_system system;
+  
+  // The catalog hash built from the image's metadata, see game_hash.h. Only
+  // set if has_hash is true
+  bool has_hash;
+  long long hash;
+  
+  // The name in the image's metadata, and the name of the game in the
+  // catalog, empty if the catalog doesn't know the game. WonderSwan metadata
+  // has no name, so only the catalog names WonderSwan games
+  std::string metadata_name;
+  std::string name;
+};
+
+// Index of the game images in a set of directories, so that an image can be
+// picked by game without browsing folders. Scanning reads the metadata of
+// every .ngp, .ngc, .ws, and .wsc image found, many at once, and looks its
+// hash up in the catalogs. The index is saved to a file between runs, and a
+// scan only reads the images that are new or whose modification time or size
+// changed since, so rescanning a large library that hardly changed is quick.
+// Images kept in a dump_archive are listed from its index under their member
+// paths, and mapped straight out of the archive when read
+class rom_library
+{
+public:
+  // Loads the index saved at the given path, if there is one. A missing or
+  // unreadable index is treated as empty and rebuilt by the next scan
+  explicit rom_library(const std::string& index_path);
+  
+  // Scans the given directories and everything under them, then saves the
+  // index. Images no longer found are dropped. Every image is looked up in
+  // the catalogs again, since they may have been updated, but only images
+  // that changed are read. Either catalog may be nullptr. Returns the number
+  // of images read. Throws std::runtime_error if the index can't be saved
+  unsigned int scan(const std::vector<std::string>& directories, game_catalog* ngp_catalog, game_catalog* ws_catalog);
+  
+  // Returns every image in the index, ordered by path
+  const std::vector<rom_library_entry>& entries() const;
+  
+  // Returns the images of games with the given catalog hash
+  std::vector<const rom_library_entry*> find(long long hash) const;
+  
+  // Writes the index to its file, replacing the one there. Throws
+  // std::runtime_error if it can't be written
+  void save() const;
+
+private:
+  void load();
+  
+  // Returns the system an image is for by its file extension, or UNKNOWN if
+  // it isn't a game image
+  static game_descriptor::game_system system_for(const std::string& path);
+  
+  // Adds an entry with the path, modification time, and size of every game
+  // image under a directory to the list
+  static void list_images(const std::string& directory, std::vector<rom_library_entry>& images);
+  
+  // Adds an entry for every game image inside an archive to the list. Their
+  // modification time is where their data starts, which moves whenever an
+  // image is replaced
+  static void list_archive(const std::string& path, std::vector<rom_library_entry>& images);
+  
+  // Fills in an entry from the image at its path. Returns false if the image
+  // can't be read
+  static bool read_image(rom_library_entry& entry);
+  
+  const std::string m_index_path;
+  std::vector<rom_library_entry> m_entries;
+};
+
+#endif // defined(__ROM_LIBRARY_H__)
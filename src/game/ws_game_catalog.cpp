@@ -1,85 +1,343 @@
 #include "ws_game_catalog.h"
 
+#include <algorithm>
 #include <cstring>
 #include <string>
 #include <stdexcept>
 
 #include "cartridge/ws_cartridge.h"
+#include "game_hash.h"
 #include "sqlite/sqlite3.h"
 
 using namespace std;
 
-ws_game_catalog::ws_game_catalog(const char* db_file_name)
-  : m_sqlite(nullptr)
+// Builds a descriptor from the GameName and Developer columns of a result row.
+// The game's size is encoded in its hash, so is the same for every cartridge
+// that matches
+static game_descriptor read_game(sqlite3_stmt* stmt, int first_column, long long hash)
 {
-  if (sqlite3_open_v2(db_file_name, &m_sqlite, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+  const unsigned char* game_name = sqlite3_column_text(stmt, first_column);
+  const unsigned char* developer_name = sqlite3_column_text(stmt, first_column + 1);
+  game_descriptor descriptor(game_name == nullptr ? "" : (const char*) game_name,
+                             developer_name == nullptr ? "" : (const char*) developer_name);
+  descriptor.system = game_descriptor::game_system::WONDERSWAN;
+  descriptor.num_bytes = ws_cartridge::calculate_game_size((int) ((hash >> (4*8)) & 0xFF));
+  return descriptor;
+}
+
+ws_game_catalog::ws_game_catalog(const char* db_file_name, bool load_into_memory)
+  : m_connections(db_file_name, "SELECT GameName, Developer FROM Games WHERE Hash=:hash LIMIT 1"), m_loaded_into_memory(false)
+{
+  // Everything loaded up front is read on the connection opened first
+  catalog_connection_pool::lease connection = m_connections.acquire();
+  sqlite3* db = connection.db();
+  
+  // Optionally load every game so that lookups never touch the database
+  if (load_into_memory)
+  {
+    sqlite3_stmt* stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT Hash, GameName, Developer FROM Games", -1, &stmt, nullptr) == SQLITE_OK)
+    {
+      int result;
+      while ((result = sqlite3_step(stmt)) == SQLITE_ROW)
+      {
+        // Keep the first game for each hash, same as the single lookup
+        long long hash = sqlite3_column_int64(stmt, 0);
+        if (m_games.find(hash) == m_games.end())
+        {
+          m_games.emplace(hash, read_game(stmt, 1, hash));
+        }
+      }
+      
+      // Fall back to the database rather than trust a partial load
+      m_loaded_into_memory = (result == SQLITE_DONE);
+      if (!m_loaded_into_memory)
+      {
+        m_games.clear();
+      }
+    }
+    sqlite3_finalize(stmt);
+  }
+  
+  // Fingerprints are few, so are always loaded. Databases built before they
+  // were added have no such column, and simply find nothing
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db, "SELECT Fingerprint, `Hash` FROM Games WHERE Fingerprint IS NOT NULL ORDER BY ID", -1, &stmt, nullptr) == SQLITE_OK)
   {
-    sqlite3_close_v2(m_sqlite);
-    throw std::runtime_error("Unable to open database");
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      m_fingerprints.emplace((unsigned int) sqlite3_column_int64(stmt, 0), sqlite3_column_int64(stmt, 1));
+    }
   }
+  sqlite3_finalize(stmt);
+  
+  // So are the checksums of known-good images, kept for the first game of
+  // each hash like every other lookup
+  stmt = nullptr;
+  if (sqlite3_prepare_v2(db, "SELECT `Hash`, ImageCRC32, ImageSHA1 FROM Games WHERE ImageSHA1 IS NOT NULL ORDER BY ID", -1, &stmt, nullptr) == SQLITE_OK)
+  {
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      game_image_hashes hashes;
+      hashes.crc32 = (unsigned int) sqlite3_column_int64(stmt, 1);
+      hashes.sha1 = (const char*) sqlite3_column_text(stmt, 2);
+      m_image_hashes.emplace(sqlite3_column_int64(stmt, 0), hashes);
+    }
+  }
+  sqlite3_finalize(stmt);
 }
 
 ws_game_catalog::~ws_game_catalog()
 {
-  sqlite3_close_v2(m_sqlite);
+  // Nothing else to do
 }
 
 const game_descriptor* ws_game_catalog::identify_game(cartridge* cart, int slot_num)
 {
   // Build hash from cartridge metadata
-  // Match hash to cartridge in database
-  //   If multiple matches, return first
-  
-  
-  // Verify arguments
-  if (cart->system() != system_type::SYSTEM_WONDERSWAN)
+  long long hash;
+  if (!ws_game_hash(cart, slot_num, &hash))
   {
     return nullptr;
   }
-  if (slot_num == -1)
+  
+  return identify_hash(hash);
+}
+
+void ws_game_catalog::identify_games(cartridge* cart, const std::vector<int>& slots, std::vector<const game_descriptor*>& descriptors)
+{
+  descriptors.assign(slots.size(), nullptr);
+  vector<long long> hashes(slots.size());
+  vector<bool> valid(slots.size(), false);
+  for (unsigned int i = 0; i < slots.size(); ++i)
   {
-    slot_num = 0;
+    valid[i] = ws_game_hash(cart, slots[i], &hashes[i]);
   }
   
-  // Fetch game metadata
-  const ws_cartridge::game_metadata* metadata = ((ws_cartridge*) cart)->get_game_metadata(slot_num);
-  if (metadata == nullptr)
+  // The whole catalog is never modified once loaded, so needs no lock
+  if (m_loaded_into_memory)
   {
-    return nullptr;
+    for (unsigned int i = 0; i < slots.size(); ++i)
+    {
+      auto it = (valid[i] ? m_games.find(hashes[i]) : m_games.end());
+      descriptors[i] = (it == m_games.end() ? nullptr : &it->second);
+    }
+    return;
+  }
+  
+  // Every game not seen before is looked up with the same query, without
+  // holding the lock while it runs
+  vector<long long> missing;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (unsigned int i = 0; i < slots.size(); ++i)
+    {
+      if (valid[i] && m_games.find(hashes[i]) == m_games.end() && m_unknown_hashes.count(hashes[i]) == 0
+          && find(missing.begin(), missing.end(), hashes[i]) == missing.end())
+      {
+        missing.push_back(hashes[i]);
+      }
+    }
+  }
+  if (!missing.empty())
+  {
+    query_hashes(missing);
   }
   
-  // Build hash
-  long long hash = 0;
-  hash |= ((long long) metadata->developer_id) << (7*8);
-  hash |= ((long long) metadata->minimum_system) << (6*8);
-  hash |= ((long long) metadata->game_id) << (5*8);
-  hash |= ((long long) metadata->rom_size) << (4*8);
-  hash |= ((long long) metadata->save_size) << (3*8);
-  hash |= ((long long) metadata->flags) << (2*8);
-  hash |= ((long long) metadata->checksum);
+  lock_guard<mutex> lock(m_mutex);
+  for (unsigned int i = 0; i < slots.size(); ++i)
+  {
+    auto it = (valid[i] ? m_games.find(hashes[i]) : m_games.end());
+    descriptors[i] = (it == m_games.end() ? nullptr : &it->second);
+  }
+}
+
+const game_descriptor* ws_game_catalog::identify_game_by_fingerprint(unsigned int fingerprint)
+{
+  // Never modified once loaded, so needs no lock
+  auto it = m_fingerprints.find(fingerprint);
+  return (it == m_fingerprints.end() ? nullptr : identify_hash(it->second));
+}
+
+bool ws_game_catalog::known_good_hashes(long long hash, game_image_hashes* hashes)
+{
+  // Never modified once loaded, so needs no lock
+  auto it = m_image_hashes.find(hash);
+  if (it == m_image_hashes.end())
+  {
+    return false;
+  }
+  *hashes = it->second;
+  return true;
+}
+
+game_descriptor::game_system ws_game_catalog::system() const
+{
+  return game_descriptor::game_system::WONDERSWAN;
+}
+
+std::vector<const game_descriptor*> ws_game_catalog::search(const std::string& query, unsigned int max_results)
+{
+  call_once(m_search_once, [this] { build_search_index(); });
   
-  // Query database for hash match in database and only get 1st matching result
-  string query = "SELECT GameName, Developer FROM Games WHERE Hash=:hash LIMIT 1";
+  vector<const game_descriptor*> matches;
+  for (long long hash : m_search_index.search(query, max_results))
+  {
+    const game_descriptor* descriptor = identify_hash(hash);
+    if (descriptor != nullptr)
+    {
+      matches.push_back(descriptor);
+    }
+  }
+  return matches;
+}
+
+void ws_game_catalog::build_search_index()
+{
+  // Only the first game of each hash can be identified, so only it is found
+  unordered_set<long long> added;
+  catalog_connection_pool::lease connection = m_connections.acquire();
   sqlite3_stmt* stmt = nullptr;
-  if (sqlite3_prepare(m_sqlite, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+  if (connection.db() != nullptr && sqlite3_prepare_v2(connection.db(), "SELECT Hash, GameName FROM Games ORDER BY ID", -1, &stmt, nullptr) == SQLITE_OK)
   {
-    return nullptr;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+      long long hash = sqlite3_column_int64(stmt, 0);
+      const unsigned char* game_name = sqlite3_column_text(stmt, 1);
+      if (game_name != nullptr && added.insert(hash).second)
+      {
+        m_search_index.add(hash, (const char*) game_name);
+      }
+    }
+  }
+  sqlite3_finalize(stmt);
+  m_search_index.finish();
+}
+
+const game_descriptor* ws_game_catalog::identify_hash(long long hash)
+{
+  // The whole catalog is never modified once loaded, so needs no lock
+  if (m_loaded_into_memory)
+  {
+    auto it = m_games.find(hash);
+    return (it == m_games.end() ? nullptr : &it->second);
   }
   
-  if (sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":hash"), hash) != SQLITE_OK
-      || sqlite3_step(stmt) != SQLITE_ROW)
+  // Reuse the descriptor from an earlier lookup of the same game
   {
+    lock_guard<mutex> lock(m_mutex);
+    auto it = m_games.find(hash);
+    if (it != m_games.end())
+    {
+      return &it->second;
+    }
+    if (m_unknown_hashes.count(hash) != 0)
+    {
+      return nullptr;
+    }
+  }
+  
+  // Query database for hash match in database and only get first matching
+  // result, on a connection no other thread is using
+  vector<game_descriptor> found;
+  int result = SQLITE_ERROR;
+  {
+    catalog_connection_pool::lease connection = m_connections.acquire();
+    sqlite3_stmt* stmt = connection.lookup_stmt();
+    if (stmt == nullptr)
+    {
+      return nullptr;
+    }
+    if (sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, ":hash"), hash) == SQLITE_OK)
+    {
+      result = sqlite3_step(stmt);
+    }
+    if (result == SQLITE_ROW)
+    {
+      // Build descriptor from database result set
+      found.push_back(read_game(stmt, 0, hash));
+    }
+    
+    // Ready the statement for the next lookup
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+  }
+  
+  // Keep whichever descriptor was interned first if another thread looked
+  // up the same game meanwhile
+  lock_guard<mutex> lock(m_mutex);
+  if (result == SQLITE_ROW)
+  {
+    return &m_games.emplace(hash, found.front()).first->second;
+  }
+  else if (result == SQLITE_DONE)
+  {
+    // The database is read-only, so a game that isn't there never will be
+    m_unknown_hashes.insert(hash);
+  }
+  return nullptr;
+}
+
+void ws_game_catalog::query_hashes(const std::vector<long long>& hashes)
+{
+  string query = "SELECT Hash, GameName, Developer FROM Games WHERE Hash IN (?";
+  for (unsigned int i = 1; i < hashes.size(); ++i)
+  {
+    query += ",?";
+  }
+  query += ")";
+  
+  // Run the query on a connection no other thread is using, keeping the
+  // first game for each hash, same as the single lookup
+  vector<pair<long long, game_descriptor>> found;
+  int result = SQLITE_ERROR;
+  {
+    catalog_connection_pool::lease connection = m_connections.acquire();
+    sqlite3_stmt* stmt = nullptr;
+    if (connection.db() == nullptr || sqlite3_prepare_v2(connection.db(), query.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+    {
+      sqlite3_finalize(stmt);
+      return;
+    }
+    
+    result = SQLITE_DONE;
+    for (unsigned int i = 0; i < hashes.size() && result == SQLITE_DONE; ++i)
+    {
+      if (sqlite3_bind_int64(stmt, (int) i + 1, hashes[i]) != SQLITE_OK)
+      {
+        result = SQLITE_ERROR;
+      }
+    }
+    if (result == SQLITE_DONE)
+    {
+      unordered_set<long long> seen;
+      while ((result = sqlite3_step(stmt)) == SQLITE_ROW)
+      {
+        long long hash = sqlite3_column_int64(stmt, 0);
+        if (seen.insert(hash).second)
+        {
+          found.push_back(make_pair(hash, read_game(stmt, 1, hash)));
+        }
+      }
+    }
     sqlite3_finalize(stmt);
-    return nullptr;
   }
   
-  // Build descriptor from database result set
-  string game_name = string((const char*) sqlite3_column_text(stmt, 0));
-  string developer_name = string((const char*) sqlite3_column_text(stmt, 1));
-  game_descriptor* descriptor = new game_descriptor(game_name.c_str(), developer_name.c_str());
-  descriptor->system = game_descriptor::game_system::WONDERSWAN;
-  descriptor->num_bytes = ((ws_cartridge*) cart)->get_game_size(slot_num);
+  lock_guard<mutex> lock(m_mutex);
+  for (const pair<long long, game_descriptor>& game : found)
+  {
+    m_games.emplace(game.first, game.second);
+  }
   
-  sqlite3_finalize(stmt);
-  return descriptor;
+  // The database is read-only, so a game that isn't there never will be
+  if (result == SQLITE_DONE)
+  {
+    for (long long hash : hashes)
+    {
+      if (m_games.find(hash) == m_games.end())
+      {
+        m_unknown_hashes.insert(hash);
+      }
+    }
+  }
 }
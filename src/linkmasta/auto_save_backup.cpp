@@ -0,0 +1,175 @@
+/*! \file
+ *  \brief File containing the implementation of \ref auto_save_backup.
+ *  
+ *  File containing the implementation of \ref auto_save_backup.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-05
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "auto_save_backup.h"
+
+#include <sstream>
+#include <vector>
+
+#include "common/dump_store.h"
+#include "common/log.h"
+#include "common/save_history.h"
+#include "device_job_scheduler.h"
+#include "cartridge/cartridge.h"
+#include "cartridge/digest_manifest.h"
+#include "task/task_controller.h"
+
+using namespace std;
+
+// The number of hex digits of the digest of a cartridge's key naming its
+// history
+#define HISTORY_NAME_DIGITS 16
+
+
+
+auto_save_backup::auto_save_backup(device_job_scheduler* scheduler, const std::string& directory)
+  : m_scheduler(scheduler), m_directory(directory)
+{
+  // Nothing else to do
+}
+
+auto_save_backup::~auto_save_backup()
+{
+  // Cancelling calls back into this object, so the lock can't be held
+  vector<unsigned int> job_ids;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (const auto& pending : m_pending)
+    {
+      job_ids.push_back(pending.second);
+    }
+  }
+  for (unsigned int job_id : job_ids)
+  {
+    try
+    {
+      m_scheduler->cancel_job(job_id);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // The job finished in the meantime
+    }
+  }
+  
+  unique_lock<mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return m_pending.empty(); });
+}
+
+
+
+const std::string& auto_save_backup::directory() const
+{
+  return m_directory;
+}
+
+unsigned int auto_save_backup::cartridge_inserted(unsigned int device_id, const std::string& cartridge_fingerprint)
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    if (m_pending.find(device_id) != m_pending.end())
+    {
+      return 0;
+    }
+    m_pending[device_id] = 0;
+  }
+  
+  unsigned int job_id = m_scheduler->submit_job(device_id, [this, cartridge_fingerprint](cartridge* cart, task_controller* controller) -> bool
+  {
+    return back_up(cart, cartridge_fingerprint, controller);
+  }, [this, device_id](unsigned int job_id)
+  {
+    (void) job_id;
+    
+    // Nothing may be touched once the destructor can see this
+    lock_guard<mutex> lock(m_mutex);
+    m_pending.erase(device_id);
+    m_condition.notify_all();
+  });
+  m_scheduler->set_job_priority(job_id, AUTO_SAVE_BACKUP_PRIORITY);
+  
+  // The job may already have finished
+  lock_guard<mutex> lock(m_mutex);
+  auto pending = m_pending.find(device_id);
+  if (pending != m_pending.end())
+  {
+    pending->second = job_id;
+  }
+  return job_id;
+}
+
+std::string auto_save_backup::history_path(const std::string& key) const
+{
+  string digest = dump_store::sha256((const unsigned char*) key.data(), (unsigned int) key.size());
+  return m_directory + "/" + digest.substr(0, HISTORY_NAME_DIGITS) + SAVE_HISTORY_EXTENSION;
+}
+
+
+
+bool auto_save_backup::back_up(cartridge* cart, const std::string& cartridge_fingerprint, task_controller* controller)
+{
+  string key = (cartridge_fingerprint.empty() ? cart->fetch_game_name(0) : cartridge_fingerprint);
+  string path = history_path(key);
+  
+  // The fingerprint is cheap next to a backup, so it isn't reported as
+  // progress
+  unsigned int fingerprint = cart->fingerprint_cartridge_save_data(cartridge::SLOT_ALL);
+  if (controller->is_task_cancelled())
+  {
+    return true;
+  }
+  
+  bool known;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    auto last = m_save_fingerprints.find(path);
+    known = (last != m_save_fingerprints.end());
+    if (known && last->second == fingerprint)
+    {
+      log(log_level::INFO, ("Save data unchanged since last checked in to " + path).c_str());
+      return true;
+    }
+  }
+  
+  // The first time a history is seen, its latest version tells whether the
+  // save was already checked in by an earlier run
+  save_history history(path);
+  if (!known && !history.versions().empty())
+  {
+    vector<unsigned char> latest = history.restore();
+    unsigned int latest_fingerprint = digest_manifest::crc32c(latest.data(), (unsigned int) latest.size());
+    
+    lock_guard<mutex> lock(m_mutex);
+    m_save_fingerprints[path] = latest_fingerprint;
+    if (latest_fingerprint == fingerprint)
+    {
+      log(log_level::INFO, ("Save data unchanged since last checked in to " + path).c_str());
+      return true;
+    }
+  }
+  
+  stringstream save_data;
+  cart->backup_cartridge_save_data(save_data, cartridge::SLOT_ALL, controller);
+  if (controller->is_task_cancelled())
+  {
+    return true;
+  }
+  string bytes = save_data.str();
+  
+  unsigned int number = history.check_in((const unsigned char*) bytes.data(), (unsigned int) bytes.size());
+  log(log_level::INFO, ("Save data checked in to " + path + " as version " + std::to_string(number)).c_str());
+  
+  lock_guard<mutex> lock(m_mutex);
+  m_save_fingerprints[path] = digest_manifest::crc32c((const unsigned char*) bytes.data(), (unsigned int) bytes.size());
+  return true;
+}
@@ -0,0 +1,136 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref auto_save_backup
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref auto_save_backup class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-05
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __AUTO_SAVE_BACKUP_H__
+#define __AUTO_SAVE_BACKUP_H__
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+
+class device_job_scheduler;
+class cartridge;
+class task_controller;
+
+/*! \brief The priority of the jobs queued by \ref auto_save_backup, below
+ *         that of every job submitted as usual. */
+#define AUTO_SAVE_BACKUP_PRIORITY -1
+
+
+
+/*! \class auto_save_backup
+ *  \brief Backs up the save of every cartridge as it is inserted.
+ *  
+ *  Class implementing an opt-in policy that keeps a copy of each cartridge's
+ *  save before anyone gets the chance to flash over it. Whenever a cartridge
+ *  is seen being inserted, such as by the presence polling of the UI, a job
+ *  is queued on the device that takes the save's fingerprint with
+ *  \ref cartridge::fingerprint_cartridge_save_data(), which cartridges that
+ *  can checksum on the device answer without reading the save back. Only if
+ *  the fingerprint was not seen before is the save backed up and checked in
+ *  to a \ref save_history, which stores just the blocks changed since the
+ *  last version.
+ *  
+ *  Each cartridge gets a history of its own in the given directory, named
+ *  after the fingerprint the device took of the cartridge when it was
+ *  inserted, see \ref linkmasta_device::fingerprint_cartridge(), or after the
+ *  name of its game if the device can't tell cartridges apart.
+ *  
+ *  The jobs are queued with \ref AUTO_SAVE_BACKUP_PRIORITY, so that every
+ *  other job waiting for the device goes first and saves are only backed up
+ *  while the device would otherwise sit idle. At most one is queued for a
+ *  device at a time.
+ *  
+ *  This class is thread-safe.
+ */
+class auto_save_backup
+{
+public:
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in] scheduler The scheduler to queue the backups on. Must outlive
+   *         this object.
+   *  \param [in] directory The directory to keep the histories in. Must
+   *         exist.
+   */
+                          auto_save_backup(device_job_scheduler* scheduler, const std::string& directory);
+  
+  /*!
+   *  \brief Class destructor. Cancels the backups that haven't run and waits
+   *         for the one running to finish.
+   */
+                          ~auto_save_backup();
+  
+  
+  
+  /*!
+   *  \brief Gets the directory the histories are kept in.
+   */
+  const std::string&      directory() const;
+  
+  /*!
+   *  \brief Queues a backup of the save of a cartridge that was just
+   *         inserted.
+   *  
+   *  Does nothing if a backup is already queued for the device.
+   *  
+   *  \param [in] device_id The ID of the device the cartridge was inserted
+   *         into.
+   *  \param [in] cartridge_fingerprint The fingerprint of the cartridge, or
+   *         an empty string if the device can't tell cartridges apart.
+   *  
+   *  \return The ID of the queued job, or 0 if none was queued.
+   */
+  unsigned int            cartridge_inserted(unsigned int device_id, const std::string& cartridge_fingerprint);
+  
+  /*!
+   *  \brief Gets the path of the history a cartridge's save is kept in.
+   *  
+   *  \param [in] key The fingerprint of the cartridge or the name of its
+   *         game.
+   */
+  std::string             history_path(const std::string& key) const;
+
+
+
+private:
+  
+  /*!
+   *  \brief Fingerprints the save of a cartridge and checks it in if it
+   *         wasn't seen before.
+   */
+  bool                    back_up(cartridge* cart, const std::string& cartridge_fingerprint, task_controller* controller);
+  
+  /*! \brief The scheduler the backups are queued on. */
+  device_job_scheduler* const m_scheduler;
+  
+  /*! \brief The directory the histories are kept in. */
+  const std::string       m_directory;
+  
+  /*! \brief The fingerprint of the save last checked in to each history,
+   *         by path. */
+  std::map<std::string, unsigned int> m_save_fingerprints;
+  
+  /*! \brief The job queued for each device that has one, by device ID. */
+  std::map<unsigned int, unsigned int> m_pending;
+  
+  /*! \brief Mutex guarding every member above. */
+  std::mutex              m_mutex;
+  
+  /*! \brief Signalled whenever a queued job has finished. */
+  std::condition_variable m_condition;
+};
+
+#endif /* defined(__AUTO_SAVE_BACKUP_H__) */
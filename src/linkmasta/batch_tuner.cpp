@@ -0,0 +1,291 @@
+/*! \file
+ *  \brief File containing the implementation of \ref batch_tuner and
+ *         \ref batch_tuning_store.
+ *  
+ *  File containing the implementation of \ref batch_tuner and
+ *  \ref batch_tuning_store.
+ *  
+ *  See corrensponding header file to view documentation for the classes,
+ *  their methods, and their member variables.
+ *  
+ *  \see batch_tuner
+ *  \see batch_tuning_store
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-28
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "batch_tuner.h"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#define TUNING_MAGIC        "flashmasta-batch-tuning 1"
+
+// Smallest batch the tuner falls back to, unless the firmware's largest is
+// smaller still
+#define MIN_BATCH_PACKETS   4
+
+// The number of full batches timed before deciding whether to change sizes
+#define WINDOW_BATCHES      8
+
+// How far each window moves a size's average towards its latest rate
+#define RATE_WEIGHT         0.5
+
+// How much faster another size must be before moving to it, so that noise
+// doesn't keep the tuner flipping between two sizes that are as good
+#define FASTER_RATIO        1.05
+
+// The number of windows a size is left alone after it first fails. Each
+// further failure doubles it, up to MAX_COOLDOWN_SHIFT times
+#define COOLDOWN_WINDOWS    16
+#define MAX_COOLDOWN_SHIFT  5
+
+// The number of windows spent at the same size before the sizes around it
+// are timed again
+#define RETIME_WINDOWS      64
+
+using namespace std;
+
+
+
+batch_tuner::batch_tuner()
+  : m_level(0), m_direction(1), m_window_batches(0), m_window_seconds(0.0), m_stable_windows(0)
+{
+  level single = {1, 0.0, 0, 0};
+  m_levels.push_back(single);
+}
+
+void batch_tuner::reset(unsigned int max_packets, unsigned int packet_step, unsigned int initial_packets)
+{
+  // Build the ladder of sizes from the largest down, keeping each a multiple
+  // of the step so that only the last transfer of a batch ends short
+  unsigned int step = (packet_step > 0 && packet_step <= max_packets ? packet_step : 1);
+  unsigned int largest = std::max(max_packets - max_packets % step, 1u);
+  unsigned int smallest = std::min(largest, std::max((unsigned int) MIN_BATCH_PACKETS, step));
+  
+  m_levels.clear();
+  for (unsigned int packets = largest; packets >= smallest; )
+  {
+    level size = {packets, 0.0, 0, 0};
+    m_levels.insert(m_levels.begin(), size);
+    
+    unsigned int next = packets / 2;
+    next -= next % step;
+    if (next == packets || next == 0)
+    {
+      break;
+    }
+    packets = next;
+  }
+  
+  // Start from the largest size no larger than the initial one. Sizes above
+  // it were presumably left behind for a reason, so are treated as having
+  // failed often and only tried again after a long while
+  unsigned int start = (unsigned int) m_levels.size() - 1;
+  if (initial_packets > 0)
+  {
+    while (start > 0 && m_levels[start].packets > initial_packets)
+    {
+      m_levels[start].failures = MAX_COOLDOWN_SHIFT + 1;
+      m_levels[start].cooldown = COOLDOWN_WINDOWS << MAX_COOLDOWN_SHIFT;
+      --start;
+    }
+  }
+  m_direction = 1;
+  move_to(start);
+}
+
+unsigned int batch_tuner::packets() const
+{
+  return m_levels[m_level].packets;
+}
+
+bool batch_tuner::record_batch(unsigned int num_packets, double seconds)
+{
+  if (num_packets != packets())
+  {
+    return false;
+  }
+  
+  m_window_seconds += seconds;
+  if (++m_window_batches < WINDOW_BATCHES)
+  {
+    return false;
+  }
+  
+  level& current = m_levels[m_level];
+  double rate = (double) (m_window_batches * current.packets) / std::max(m_window_seconds, 1e-9);
+  current.packets_per_second = (current.packets_per_second == 0.0 ? rate
+                                : current.packets_per_second + (rate - current.packets_per_second) * RATE_WEIGHT);
+  m_window_batches = 0;
+  m_window_seconds = 0.0;
+  return decide();
+}
+
+bool batch_tuner::record_failure()
+{
+  level& current = m_levels[m_level];
+  ++current.failures;
+  current.cooldown = COOLDOWN_WINDOWS << std::min(current.failures - 1, (unsigned int) MAX_COOLDOWN_SHIFT);
+  
+  // Head for smaller batches
+  m_direction = -1;
+  if (m_level == 0)
+  {
+    move_to(0);
+    return false;
+  }
+  move_to(m_level - 1);
+  return true;
+}
+
+
+
+bool batch_tuner::decide()
+{
+  for (level& size : m_levels)
+  {
+    if (size.cooldown > 0)
+    {
+      --size.cooldown;
+    }
+  }
+  ++m_stable_windows;
+  
+  const level& current = m_levels[m_level];
+  int ahead = (int) m_level + m_direction;
+  int behind = (int) m_level - m_direction;
+  bool has_ahead = (ahead >= 0 && ahead < (int) m_levels.size() && m_levels[ahead].cooldown == 0);
+  bool has_behind = (behind >= 0 && behind < (int) m_levels.size() && m_levels[behind].cooldown == 0);
+  
+  // Keep going the same way while it pays off, trying a size that hasn't
+  // been timed only if the last step was an improvement
+  bool improving = (!has_behind || m_levels[behind].packets_per_second == 0.0
+                    || current.packets_per_second > m_levels[behind].packets_per_second * FASTER_RATIO);
+  if (has_ahead && ((m_levels[ahead].packets_per_second == 0.0 && improving)
+                    || m_levels[ahead].packets_per_second > current.packets_per_second * FASTER_RATIO))
+  {
+    move_to(ahead);
+    return true;
+  }
+  
+  // Go back if the last step made things worse
+  if (has_behind && m_levels[behind].packets_per_second > current.packets_per_second * FASTER_RATIO)
+  {
+    m_direction = -m_direction;
+    move_to(behind);
+    return true;
+  }
+  
+  // Having settled, forget how the neighbours did every so often and look
+  // the other way, so that they are timed again
+  if (m_stable_windows >= RETIME_WINDOWS)
+  {
+    for (int neighbour = (int) m_level - 1; neighbour <= (int) m_level + 1; neighbour += 2)
+    {
+      if (neighbour >= 0 && neighbour < (int) m_levels.size())
+      {
+        m_levels[neighbour].packets_per_second = 0.0;
+      }
+    }
+    m_direction = -m_direction;
+    m_stable_windows = 0;
+  }
+  return false;
+}
+
+void batch_tuner::move_to(unsigned int level_index)
+{
+  m_level = level_index;
+  m_window_batches = 0;
+  m_window_seconds = 0.0;
+  m_stable_windows = 0;
+}
+
+
+
+batch_tuning_store::batch_tuning_store(const std::string& path)
+  : m_path(path)
+{
+  // Load the sizes recorded by earlier runs, later lines replacing earlier
+  // ones
+  {
+    ifstream fin(m_path.c_str());
+    string line;
+    if (fin.is_open() && getline(fin, line) && line == TUNING_MAGIC)
+    {
+      while (getline(fin, line))
+      {
+        istringstream entry(line);
+        string direction;
+        unsigned int packets;
+        string serial;
+        if (!(entry >> direction >> packets) || packets == 0 || (direction != "read" && direction != "write"))
+        {
+          continue;
+        }
+        entry.get();
+        getline(entry, serial);
+        m_sizes[make_pair((int) (direction == "read" ? BATCH_READ : BATCH_WRITE), serial)] = packets;
+      }
+    }
+  }
+  
+  // Start the file over with only the latest sizes so it doesn't keep growing
+  m_fout.open(m_path.c_str(), ios::trunc);
+  if (!m_fout.is_open())
+  {
+    throw std::runtime_error("Unable to open file " + m_path);
+  }
+  m_fout << TUNING_MAGIC << "\n";
+  for (auto& size_pair : m_sizes)
+  {
+    append(size_pair.first.second, (batch_direction) size_pair.first.first, size_pair.second);
+  }
+  m_fout.flush();
+}
+
+batch_tuning_store::~batch_tuning_store()
+{
+  m_fout.close();
+}
+
+
+
+const std::string& batch_tuning_store::path() const
+{
+  return m_path;
+}
+
+unsigned int batch_tuning_store::get(const std::string& serial, batch_direction direction)
+{
+  lock_guard<mutex> lock(m_mutex);
+  auto it = m_sizes.find(make_pair((int) direction, serial));
+  return (it == m_sizes.end() ? 0 : it->second);
+}
+
+void batch_tuning_store::set(const std::string& serial, batch_direction direction, unsigned int packets)
+{
+  lock_guard<mutex> lock(m_mutex);
+  unsigned int& size = m_sizes[make_pair((int) direction, serial)];
+  if (size == packets)
+  {
+    return;
+  }
+  size = packets;
+  append(serial, direction, packets);
+  m_fout.flush();
+  if (!m_fout)
+  {
+    throw std::runtime_error("Unable to write file " + m_path);
+  }
+}
+
+
+
+void batch_tuning_store::append(const std::string& serial, batch_direction direction, unsigned int packets)
+{
+  m_fout << (direction == BATCH_READ ? "read" : "write") << " " << packets << " " << serial << "\n";
+}
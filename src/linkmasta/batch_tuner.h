@@ -0,0 +1,265 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref batch_tuner and
+ *         \ref batch_tuning_store classes.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref batch_tuner class, which adapts the size of the read64xN and
+ *  write64xN batches sent to a device, and of the \ref batch_tuning_store
+ *  class, which remembers the tuned sizes between runs.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-28
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __BATCH_TUNER_H__
+#define __BATCH_TUNER_H__
+
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*! \enum batch_direction
+ *  \brief Enumeration of the directions in which batches move data.
+ */
+enum batch_direction
+{
+  /*! \brief Batches of data read from the device, read64xN. */
+  BATCH_READ,
+  
+  /*! \brief Batches of data written to the device, write64xN. */
+  BATCH_WRITE
+};
+
+
+
+/*! \class batch_tuner
+ *  \brief Class adapting the number of packets per batch to what a device
+ *         moves fastest.
+ *  
+ *  Class choosing how many packets to send in each batch moving data in one
+ *  direction. Sizes are picked from a ladder halving down from the largest
+ *  batch the firmware accepts. Each size is timed over a window of full
+ *  batches, and after every window the tuner keeps stepping the same way,
+ *  towards larger batches to begin with, for as long as each step moves data
+ *  faster, and steps back once one doesn't, settling on the fastest. A batch
+ *  that fails, typically by timing out on a hub that can't keep up with
+ *  large transfers, moves the tuner a size down right away and keeps it from
+ *  trying the failed size again for a while, longer each time it fails. The
+ *  sizes on either side are timed again from time to time, in case the
+ *  conditions that made them slower have changed.
+ *  
+ *  This class is *not* thread-safe.
+ */
+class batch_tuner
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Leaves the tuner with a single size of 1
+   *         packet until \ref reset() is called.
+   */
+                          batch_tuner();
+  
+  /*!
+   *  \brief Starts tuning from scratch.
+   *  
+   *  \param [in] max_packets The largest number of packets per batch the
+   *         firmware accepts.
+   *  \param [in] packet_step The number of packets every size must be a
+   *         multiple of, such as the number of packets that fit a USB
+   *         packet. Ignored if the largest batch is smaller.
+   *  \param [in] initial_packets The size to start from, such as the size
+   *         tuned in an earlier run, or 0 to start from the largest. Sizes
+   *         larger than it are treated as having failed repeatedly.
+   */
+  void                    reset(unsigned int max_packets, unsigned int packet_step, unsigned int initial_packets = 0);
+  
+  /*!
+   *  \brief Gets the number of packets to send in the next full batch.
+   */
+  unsigned int            packets() const;
+  
+  /*!
+   *  \brief Records a batch that completed.
+   *  
+   *  Batches of a size other than \ref packets(), such as the short last
+   *  batch of a transfer, are ignored.
+   *  
+   *  \param [in] num_packets The number of packets in the batch.
+   *  \param [in] seconds How long the batch took.
+   *  
+   *  \return true if the size to use changed, false otherwise.
+   */
+  bool                    record_batch(unsigned int num_packets, double seconds);
+  
+  /*!
+   *  \brief Records a batch of size \ref packets() that failed.
+   *  
+   *  \return true if the size to use changed, false otherwise.
+   */
+  bool                    record_failure();
+
+
+
+private:
+  
+  /*!
+   *  \brief Struct containing what has been measured of a single size.
+   */
+  struct level
+  {
+    /*! \brief The number of packets per batch. */
+    unsigned int          packets;
+    
+    /*! \brief Running average of packets moved per second, or 0 if the size
+     *         hasn't been timed. */
+    double                packets_per_second;
+    
+    /*! \brief The number of batches of this size that failed. */
+    unsigned int          failures;
+    
+    /*! \brief The number of windows left before the size may be tried again
+     *         after failing. */
+    unsigned int          cooldown;
+  };
+  
+  /*!
+   *  \brief Chooses the size for the next window once one has been timed.
+   *  
+   *  \return true if the size changed, false otherwise.
+   */
+  bool                    decide();
+  
+  /*!
+   *  \brief Moves to another size and starts a new window.
+   */
+  void                    move_to(unsigned int level_index);
+  
+  
+  
+  /*! \brief The sizes to choose from, smallest first. */
+  std::vector<level>      m_levels;
+  
+  /*! \brief Index of the size in use. */
+  unsigned int            m_level;
+  
+  /*! \brief The way the sizes are being searched, 1 towards larger and -1
+   *         towards smaller. */
+  int                     m_direction;
+  
+  /*! \brief The number of batches timed in the current window. */
+  unsigned int            m_window_batches;
+  
+  /*! \brief The time taken by the batches of the current window. */
+  double                  m_window_seconds;
+  
+  /*! \brief The number of windows since the size last changed. */
+  unsigned int            m_stable_windows;
+};
+
+
+
+/*! \class batch_tuning_store
+ *  \brief Class keeping a persistent record of the batch sizes tuned for
+ *         each device.
+ *  
+ *  Class remembering, in a small text file that survives between runs, the
+ *  batch size \ref batch_tuner settled on in each direction for each device,
+ *  told apart by serial number. Every change is appended to the file and
+ *  flushed before moving on, and the file is compacted down to the latest
+ *  sizes whenever it is opened.
+ *  
+ *  This class is thread-safe.
+ */
+class batch_tuning_store
+{
+public:
+  
+  /*!
+   *  \brief Opens the store at the given path.
+   *  
+   *  Opens the store at the given path, loading the sizes already recorded
+   *  there. Lines that can't be read, such as a partially written last line,
+   *  are skipped.
+   *  
+   *  \param [in] path The path of the store file.
+   *  
+   *  \throws std::runtime_error If the store file could not be written.
+   */
+  explicit                batch_tuning_store(const std::string& path);
+  
+  /*!
+   *  \brief Class destructor. Closes the store file.
+   */
+                          ~batch_tuning_store();
+  
+  
+  
+  /*!
+   *  \brief Gets the path of the store file.
+   */
+  const std::string&      path() const;
+  
+  /*!
+   *  \brief Gets the batch size tuned for a device.
+   *  
+   *  \param [in] serial The serial number of the device.
+   *  \param [in] direction The direction of the batches.
+   *  
+   *  \return The number of packets per batch, or 0 if none was recorded.
+   */
+  unsigned int            get(const std::string& serial, batch_direction direction);
+  
+  /*!
+   *  \brief Records the batch size tuned for a device.
+   *  
+   *  Records the batch size tuned for a device. Recording the size already
+   *  recorded does nothing.
+   *  
+   *  \param [in] serial The serial number of the device.
+   *  \param [in] direction The direction of the batches.
+   *  \param [in] packets The number of packets per batch.
+   *  
+   *  \throws std::runtime_error If the store file could not be written.
+   */
+  void                    set(const std::string& serial, batch_direction direction, unsigned int packets);
+
+
+
+private:
+  
+  /*!
+   *  \brief Appends a size to the store file. Must be called with the lock
+   *         held.
+   */
+  void                    append(const std::string& serial, batch_direction direction, unsigned int packets);
+  
+  /*!
+   *  \brief Disabled copy constructor.
+   */
+                          batch_tuning_store(const batch_tuning_store& other) = delete;
+  
+  /*!
+   *  \brief Disabled copy assignment operator.
+   */
+  batch_tuning_store&     operator=(const batch_tuning_store& other) = delete;
+  
+  
+  
+  /*! \brief Path of the store file. */
+  const std::string       m_path;
+  
+  /*! \brief Stream the sizes are appended to. */
+  std::ofstream           m_fout;
+  
+  /*! \brief The latest size recorded, by direction and serial number. */
+  std::map<std::pair<int, std::string>, unsigned int> m_sizes;
+  
+  /*! \brief Mutex guarding every member. */
+  std::mutex              m_mutex;
+};
+
+#endif /* defined(__BATCH_TUNER_H__) */
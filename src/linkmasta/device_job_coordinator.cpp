@@ -0,0 +1,451 @@
+/*! \file
+ *  \brief File containing the implementation of \ref device_job_coordinator.
+ *  
+ *  File containing the implementation of \ref device_job_coordinator.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-24
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "device_job_coordinator.h"
+
+#include <chrono>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include "common/log.h"
+#include "device_manager.h"
+
+using namespace std;
+
+// How long a failed job's device is given to show up as disconnected, and how
+// often it is checked meanwhile
+#define DISCONNECT_GRACE_MS         3000
+#define DISCONNECT_POLL_MS          100
+
+
+
+device_job_coordinator::device_job_coordinator(device_manager* manager, device_job_scheduler* scheduler)
+  : m_manager(manager), m_scheduler(scheduler),
+    m_max_attempts(DEFAULT_COORDINATOR_MAX_ATTEMPTS),
+    m_queue_depth(DEFAULT_COORDINATOR_QUEUE_DEPTH), m_device_listener(0),
+    m_num_unfinished(0), m_num_callbacks(0), m_cancelled(false)
+{
+  // Devices that show up later start taking requests right away
+  m_device_listener = m_manager->add_device_listener([this](unsigned int device_id, bool connected)
+  {
+    (void) device_id;
+    if (connected)
+    {
+      dispatch();
+    }
+  });
+}
+
+device_job_coordinator::~device_job_coordinator()
+{
+  m_manager->remove_device_listener(m_device_listener);
+  cancel();
+  
+  // Jobs that were placed still call back into the coordinator when they end
+  unique_lock<mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return m_num_unfinished == 0 && m_num_callbacks == 0; });
+}
+
+
+
+unsigned int device_job_coordinator::submit(const std::string& name, job_factory factory)
+{
+  request r;
+  r.name = name;
+  r.factory = factory;
+  r.has_plan = false;
+  r.estimated_seconds = -1.0;
+  return add_request(r);
+}
+
+unsigned int device_job_coordinator::submit(const std::string& name, job_factory factory, const operation_planner::plan& plan)
+{
+  request r;
+  r.name = name;
+  r.factory = factory;
+  r.has_plan = true;
+  r.plan = plan;
+  r.estimated_seconds = operation_planner(operation_planner::default_rates()).estimate_seconds(plan);
+  return add_request(r);
+}
+
+void device_job_coordinator::set_max_attempts(unsigned int max_attempts)
+{
+  if (max_attempts == 0)
+  {
+    throw std::invalid_argument("A request needs at least one attempt");
+  }
+  
+  lock_guard<mutex> lock(m_mutex);
+  m_max_attempts = max_attempts;
+}
+
+void device_job_coordinator::set_queue_depth(unsigned int depth)
+{
+  if (depth == 0)
+  {
+    throw std::invalid_argument("A device needs room for at least one job");
+  }
+  
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_queue_depth = depth;
+  }
+  
+  // A deeper queue may make room for waiting requests
+  dispatch();
+}
+
+void device_job_coordinator::set_request_listener(request_callback listener)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_listener = listener;
+}
+
+void device_job_coordinator::cancel()
+{
+  vector<unsigned int> cancelled;
+  vector<int> job_ids;
+  request_callback listener;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_cancelled = true;
+    listener = m_listener;
+    
+    for (unsigned int request_id : m_waiting)
+    {
+      finish_request(m_requests[request_id], CANCELLED, false, "Cancelled");
+      cancelled.push_back(request_id);
+    }
+    m_waiting.clear();
+    
+    for (const request& r : m_requests)
+    {
+      if (r.placed && !r.finished)
+      {
+        job_ids.push_back(r.job_id);
+      }
+    }
+  }
+  
+  // Placed requests finish once their jobs report back
+  for (int job_id : job_ids)
+  {
+    if (job_id >= 0)
+    {
+      m_scheduler->cancel_job((unsigned int) job_id);
+    }
+  }
+  
+  if (listener != nullptr)
+  {
+    for (unsigned int request_id : cancelled)
+    {
+      listener(request_id);
+    }
+  }
+}
+
+void device_job_coordinator::wait()
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return m_num_unfinished == 0; });
+}
+
+bool device_job_coordinator::is_finished()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_num_unfinished == 0;
+}
+
+std::vector<unsigned int> device_job_coordinator::get_requests()
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  vector<unsigned int> request_ids;
+  for (unsigned int i = 0; i < m_requests.size(); ++i)
+  {
+    request_ids.push_back(i);
+  }
+  return request_ids;
+}
+
+device_job_coordinator::request_info device_job_coordinator::get_request_info(unsigned int request_id)
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  if (request_id >= m_requests.size())
+  {
+    throw std::invalid_argument("Unknown request ID " + std::to_string(request_id));
+  }
+  
+  const request& r = m_requests[request_id];
+  request_info info;
+  info.request_id = request_id;
+  info.name = r.name;
+  info.placed = r.placed;
+  info.device_id = r.device_id;
+  info.job_id = r.job_id;
+  info.attempts = r.attempts;
+  info.status = r.status;
+  info.result = r.result;
+  info.error = r.error;
+  info.estimated_seconds = r.estimated_seconds;
+  
+  // An unfinished request reports the state of its job
+  if (!r.finished && r.job_id >= 0)
+  {
+    info.status = m_scheduler->get_job_info((unsigned int) r.job_id).status;
+  }
+  return info;
+}
+
+
+
+unsigned int device_job_coordinator::add_request(request& r)
+{
+  unsigned int request_id;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    
+    if (m_cancelled)
+    {
+      throw std::runtime_error("Coordinator has been cancelled");
+    }
+    
+    r.placed = false;
+    r.device_id = 0;
+    r.job_id = -1;
+    r.attempts = 0;
+    r.finished = false;
+    r.status = NOT_STARTED;
+    r.result = false;
+    
+    request_id = (unsigned int) m_requests.size();
+    m_requests.push_back(r);
+    m_waiting.push_back(request_id);
+    ++m_num_unfinished;
+  }
+  
+  dispatch();
+  return request_id;
+}
+
+void device_job_coordinator::dispatch()
+{
+  while (true)
+  {
+    unsigned int request_id;
+    unsigned int device_id;
+    job_factory factory;
+    {
+      lock_guard<mutex> lock(m_mutex);
+      if (m_cancelled || !choose_placement(request_id, device_id))
+      {
+        return;
+      }
+      
+      // Reserve the device's room before letting go of the lock so that
+      // concurrent dispatches don't overfill it
+      request& r = m_requests[request_id];
+      r.placed = true;
+      r.device_id = device_id;
+      r.job_id = -1;
+      ++r.attempts;
+      ++m_device_jobs[device_id];
+      factory = r.factory;
+    }
+    
+    // The job may finish before its callback is set, which then runs it
+    // right away, so no lock can be held here
+    int job_id = -1;
+    std::string error;
+    try
+    {
+      job_id = (int) factory(m_scheduler, device_id);
+    }
+    catch (std::exception& ex)
+    {
+      error = ex.what();
+    }
+    
+    if (job_id < 0)
+    {
+      request_callback listener;
+      {
+        lock_guard<mutex> lock(m_mutex);
+        --m_device_jobs[device_id];
+        finish_request(m_requests[request_id], ERROR, false, error);
+        listener = m_listener;
+      }
+      if (listener != nullptr)
+      {
+        listener(request_id);
+      }
+      continue;
+    }
+    
+    bool has_plan;
+    operation_planner::plan plan;
+    {
+      lock_guard<mutex> lock(m_mutex);
+      request& r = m_requests[request_id];
+      r.job_id = job_id;
+      has_plan = r.has_plan;
+      plan = r.plan;
+    }
+    
+    log(log_level::INFO, ("Placed request " + to_string(request_id) + " on device "
+                          + to_string(device_id) + " as job " + to_string(job_id)).c_str());
+    if (has_plan)
+    {
+      m_scheduler->set_job_plan((unsigned int) job_id, plan);
+    }
+    m_scheduler->set_job_callback((unsigned int) job_id, [this, request_id](unsigned int finished_job_id)
+    {
+      on_job_finished(request_id, finished_job_id);
+    });
+  }
+}
+
+bool device_job_coordinator::choose_placement(unsigned int& request_id, unsigned int& device_id)
+{
+  if (m_waiting.empty())
+  {
+    return false;
+  }
+  
+  // Largest planned request first, then the oldest of those without a plan
+  auto chosen = m_waiting.begin();
+  for (auto it = m_waiting.begin(); it != m_waiting.end(); ++it)
+  {
+    const request& r = m_requests[*it];
+    const request& best = m_requests[*chosen];
+    if (r.has_plan && (!best.has_plan || r.estimated_seconds > best.estimated_seconds))
+    {
+      chosen = it;
+    }
+  }
+  const request& r = m_requests[*chosen];
+  
+  // Whichever device with room would be done with it soonest
+  bool found = false;
+  double best_seconds = numeric_limits<double>::infinity();
+  unsigned int best_jobs = 0;
+  for (unsigned int id : m_manager->get_connected_devices())
+  {
+    unsigned int num_jobs = m_device_jobs[id];
+    if (num_jobs >= m_queue_depth)
+    {
+      continue;
+    }
+    
+    double seconds = m_scheduler->get_estimated_backlog(id);
+    if (r.has_plan)
+    {
+      seconds += operation_planner(m_scheduler->get_estimated_rates(id)).estimate_seconds(r.plan);
+    }
+    if (!found || seconds < best_seconds || (seconds == best_seconds && num_jobs < best_jobs))
+    {
+      found = true;
+      best_seconds = seconds;
+      best_jobs = num_jobs;
+      device_id = id;
+    }
+  }
+  
+  if (!found)
+  {
+    return false;
+  }
+  
+  request_id = *chosen;
+  m_waiting.erase(chosen);
+  return true;
+}
+
+void device_job_coordinator::on_job_finished(unsigned int request_id, unsigned int job_id)
+{
+  device_job_scheduler::job_info job = m_scheduler->get_job_info(job_id);
+  
+  unsigned int device_id;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    device_id = m_requests[request_id].device_id;
+    ++m_num_callbacks;
+  }
+  
+  // Only a failure on a device that went away is worth another try; the
+  // cartridge of a device that is still there failed the job itself
+  bool retry = (job.status == ERROR && is_device_gone(device_id));
+  
+  request_callback listener;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    request& r = m_requests[request_id];
+    --m_device_jobs[device_id];
+    
+    if (retry && !m_cancelled && r.attempts < m_max_attempts)
+    {
+      log(log_level::INFO, ("Device " + to_string(device_id) + " went away, placing request "
+                            + to_string(request_id) + " again").c_str());
+      r.placed = false;
+      m_waiting.push_front(request_id);
+    }
+    else
+    {
+      finish_request(r, job.status, job.result, job.error);
+      listener = m_listener;
+    }
+  }
+  
+  if (listener != nullptr)
+  {
+    listener(request_id);
+  }
+  
+  // The device's room, or the request, can go to someone else now
+  dispatch();
+  
+  // Nothing may be touched once the destructor can see this
+  lock_guard<mutex> lock(m_mutex);
+  --m_num_callbacks;
+  m_condition.notify_all();
+}
+
+bool device_job_coordinator::is_device_gone(unsigned int device_id)
+{
+  m_manager->request_refresh();
+  
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(DISCONNECT_GRACE_MS);
+  while (m_manager->is_connected(device_id))
+  {
+    if (chrono::steady_clock::now() >= deadline)
+    {
+      return false;
+    }
+    this_thread::sleep_for(chrono::milliseconds(DISCONNECT_POLL_MS));
+  }
+  return true;
+}
+
+void device_job_coordinator::finish_request(request& r, task_status status, bool result, const std::string& error)
+{
+  r.finished = true;
+  r.status = status;
+  r.result = result;
+  r.error = error;
+  --m_num_unfinished;
+  m_condition.notify_all();
+}
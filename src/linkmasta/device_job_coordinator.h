@@ -0,0 +1,355 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref device_job_coordinator
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref device_job_coordinator class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-24
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __DEVICE_JOB_COORDINATOR_H__
+#define __DEVICE_JOB_COORDINATOR_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "device_job_scheduler.h"
+
+class device_manager;
+
+/*! \brief The default for \ref device_job_coordinator::set_max_attempts(). */
+#define DEFAULT_COORDINATOR_MAX_ATTEMPTS 3
+
+/*! \brief The default for \ref device_job_coordinator::set_queue_depth(). */
+#define DEFAULT_COORDINATOR_QUEUE_DEPTH  1
+
+
+
+/*! \class device_job_coordinator
+ *  \brief Places jobs that may run on any device on whichever device suits
+ *         them best.
+ *  
+ *  Takes requests for jobs that don't care which device they run on, such as
+ *  flashing an image onto whichever blank cartridge is free, and places each
+ *  one on a device of a \ref device_job_scheduler. Combined with
+ *  \ref remote_device_manager, the devices may be spread across many
+ *  stations, and throughput grows with the number of devices without anyone
+ *  assigning work to them.
+ *  
+ *  Requests are only placed once a device has room for them, that is once it
+ *  has fewer than \ref set_queue_depth() of the coordinator's jobs queued or
+ *  running, so a slow device never ends up with a long queue that faster ones
+ *  could have shared. When several devices have room, a request goes to the
+ *  one that would finish it soonest, given the work the device already has
+ *  and the rates measured on its earlier jobs, see
+ *  \ref device_job_scheduler::get_estimated_backlog() and
+ *  \ref device_job_scheduler::get_estimated_rates(). Requests with a plan are
+ *  placed largest first, which keeps a long job from being left to run alone
+ *  at the end, and requests without one are placed in the order they came
+ *  in.
+ *  
+ *  When a request's job fails because its device went away, the request is
+ *  placed again on another device, up to \ref set_max_attempts() times in
+ *  all. Devices that connect later start taking requests right away.
+ *  
+ *  This class is thread-safe.
+ */
+class device_job_coordinator
+{
+public:
+  
+  /*!
+   *  \brief Function type that queues a request's job on the device chosen
+   *         for it.
+   *  
+   *  Called with the scheduler and the ID of the device chosen, and returns
+   *  the ID of the job queued, e.g. by calling
+   *  \ref device_job_scheduler::submit_flash_job(). May be called more than
+   *  once if the request has to be placed again.
+   */
+  typedef std::function<unsigned int(device_job_scheduler* scheduler, unsigned int device_id)> job_factory;
+  
+  /*!
+   *  \brief Function type called once a request has finished.
+   *  
+   *  Called with the ID of the request from whichever thread finished it,
+   *  without the coordinator's lock held.
+   */
+  typedef std::function<void(unsigned int request_id)> request_callback;
+  
+  /*!
+   *  \brief Struct containing a snapshot of the state of a single request.
+   */
+  struct request_info
+  {
+    /*! \brief The ID of the request. */
+    unsigned int   request_id;
+    
+    /*! \brief The name of the request, used in reports. */
+    std::string    name;
+    
+    /*! \brief Whether the request has been placed on a device. */
+    bool           placed;
+    
+    /*! \brief The ID of the device the request was last placed on. */
+    unsigned int   device_id;
+    
+    /*! \brief The ID of the request's last scheduler job, or -1 if it has
+     *         none. */
+    int            job_id;
+    
+    /*! \brief The number of times the request has been placed. */
+    unsigned int   attempts;
+    
+    /*! \brief The status of the request. */
+    task_status    status;
+    
+    /*! \brief The value returned by the job, valid once it has completed. */
+    bool           result;
+    
+    /*! \brief Description of the error that ended the request, if any. */
+    std::string    error;
+    
+    /*! \brief The estimated seconds of the request at typical rates, or a
+     *         negative value if it has no plan. */
+    double         estimated_seconds;
+  };
+  
+  
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in] manager The manager whose devices requests are placed on.
+   *         Must be the one the scheduler uses, and must outlive the
+   *         coordinator.
+   *  \param [in] scheduler The scheduler to queue jobs on. Must outlive the
+   *         coordinator.
+   */
+                            device_job_coordinator(device_manager* manager, device_job_scheduler* scheduler);
+  
+  /*!
+   *  \brief Class destructor.
+   *  
+   *  Class destructor. Cancels any unfinished requests and waits for the
+   *  jobs already placed to finish and report back.
+   */
+                            ~device_job_coordinator();
+  
+  
+  
+  /*!
+   *  \brief Submits a request whose cost is unknown.
+   *  
+   *  \param [in] name The name of the request, used in reports.
+   *  \param [in] factory The function that queues the request's job.
+   *  
+   *  \return The ID of the new request.
+   *  
+   *  \throws std::runtime_error If the coordinator has been cancelled.
+   */
+  unsigned int              submit(const std::string& name, job_factory factory);
+  
+  /*!
+   *  \brief Submits a request with a plan of the work it will do.
+   *  
+   *  The plan is used to choose the device the request runs on, and is given
+   *  to the job with \ref device_job_scheduler::set_job_plan() so that the
+   *  device's estimates account for it.
+   *  
+   *  \param [in] name The name of the request, used in reports.
+   *  \param [in] factory The function that queues the request's job.
+   *  \param [in] plan The plan of the request's job.
+   *  
+   *  \return The ID of the new request.
+   *  
+   *  \throws std::runtime_error If the coordinator has been cancelled.
+   */
+  unsigned int              submit(const std::string& name, job_factory factory, const operation_planner::plan& plan);
+  
+  /*!
+   *  \brief Sets how many times a request may be placed before it is given up
+   *         on. Defaults to \ref DEFAULT_COORDINATOR_MAX_ATTEMPTS.
+   *  
+   *  \param [in] max_attempts The number of times, at least 1.
+   *  
+   *  \throws std::invalid_argument If max_attempts is 0.
+   */
+  void                      set_max_attempts(unsigned int max_attempts);
+  
+  /*!
+   *  \brief Sets how many of the coordinator's jobs a device may have queued
+   *         or running at once. Defaults to
+   *         \ref DEFAULT_COORDINATOR_QUEUE_DEPTH.
+   *  
+   *  \param [in] depth The number of jobs, at least 1.
+   *  
+   *  \throws std::invalid_argument If depth is 0.
+   */
+  void                      set_queue_depth(unsigned int depth);
+  
+  /*!
+   *  \brief Sets a function to call each time a request finishes.
+   *  
+   *  \param [in] listener The function to call, or nullptr to stop calling
+   *         one.
+   */
+  void                      set_request_listener(request_callback listener);
+  
+  /*!
+   *  \brief Cancels every request that hasn't finished yet.
+   *  
+   *  Requests that haven't been placed are cancelled right away, and the jobs
+   *  of the others are cancelled through the scheduler. Does not wait for
+   *  anything to stop.
+   */
+  void                      cancel();
+  
+  /*!
+   *  \brief Blocks until every request has finished.
+   *  
+   *  Requests only finish once a device takes them, so this blocks for as
+   *  long as no device is connected.
+   */
+  void                      wait();
+  
+  /*!
+   *  \brief Gets whether every request has finished.
+   */
+  bool                      is_finished();
+  
+  /*!
+   *  \brief Gets the IDs of every request, in the order they were submitted.
+   */
+  std::vector<unsigned int> get_requests();
+  
+  /*!
+   *  \brief Gets a snapshot of the state of a request.
+   *  
+   *  \param [in] request_id The ID of the request.
+   *  
+   *  \throws std::invalid_argument If the request does not exist.
+   */
+  request_info              get_request_info(unsigned int request_id);
+
+
+
+private:
+  device_job_coordinator(const device_job_coordinator& other) = delete;
+  device_job_coordinator& operator=(const device_job_coordinator& other) = delete;
+  
+  /*!
+   *  \brief Struct containing the coordinator's internal record of a
+   *         request.
+   */
+  struct request
+  {
+    std::string             name;
+    job_factory             factory;
+    bool                    has_plan;
+    operation_planner::plan plan;
+    double                  estimated_seconds;
+    bool                    placed;
+    unsigned int            device_id;
+    int                     job_id;
+    unsigned int            attempts;
+    bool                    finished;
+    task_status             status;
+    bool                    result;
+    std::string             error;
+  };
+  
+  /*!
+   *  \brief Adds a request to the queue of requests waiting to be placed.
+   */
+  unsigned int              add_request(request& r);
+  
+  /*!
+   *  \brief Places waiting requests on devices with room for them, until
+   *         either runs out.
+   */
+  void                      dispatch();
+  
+  /*!
+   *  \brief Chooses the next request to place and the device to place it on.
+   *         Must be called with the lock held.
+   *  
+   *  \param [out] request_id The ID of the request.
+   *  \param [out] device_id The ID of the device.
+   *  
+   *  \return false if no request is waiting or no device has room.
+   */
+  bool                      choose_placement(unsigned int& request_id, unsigned int& device_id);
+  
+  /*!
+   *  \brief Records the outcome of a request's job, placing the request again
+   *         if its device went away.
+   */
+  void                      on_job_finished(unsigned int request_id, unsigned int job_id);
+  
+  /*!
+   *  \brief Checks whether a device has gone away, giving its manager a
+   *         moment to notice a device that has just been unplugged.
+   */
+  bool                      is_device_gone(unsigned int device_id);
+  
+  /*!
+   *  \brief Marks a request as finished. Must be called with the lock held.
+   */
+  void                      finish_request(request& r, task_status status, bool result, const std::string& error);
+  
+  
+  
+  /*! \brief The manager whose devices requests are placed on. */
+  device_manager* const     m_manager;
+  
+  /*! \brief The scheduler jobs are queued on. */
+  device_job_scheduler* const m_scheduler;
+  
+  /*! \brief Every request, indexed by ID. */
+  std::vector<request>      m_requests;
+  
+  /*! \brief The IDs of the requests waiting to be placed, oldest first. */
+  std::deque<unsigned int>  m_waiting;
+  
+  /*! \brief The number of jobs queued or running on each device, by device
+   *         ID. */
+  std::map<unsigned int, unsigned int> m_device_jobs;
+  
+  /*! \brief The number of times a request may be placed. */
+  unsigned int              m_max_attempts;
+  
+  /*! \brief The number of jobs a device may have queued or running. */
+  unsigned int              m_queue_depth;
+  
+  /*! \brief Function called each time a request finishes. */
+  request_callback          m_listener;
+  
+  /*! \brief Handle of the listener registered with \ref m_manager. */
+  unsigned int              m_device_listener;
+  
+  /*! \brief The number of requests that haven't finished. */
+  unsigned int              m_num_unfinished;
+  
+  /*! \brief The number of job callbacks still running. */
+  unsigned int              m_num_callbacks;
+  
+  /*! \brief Whether \ref cancel() has been called. */
+  bool                      m_cancelled;
+  
+  /*! \brief Mutex guarding every member. */
+  std::mutex                m_mutex;
+  
+  /*! \brief Signalled each time a request finishes. */
+  std::condition_variable   m_condition;
+};
+
+#endif /* defined(__DEVICE_JOB_COORDINATOR_H__) */
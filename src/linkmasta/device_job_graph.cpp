@@ -0,0 +1,474 @@
+/*! \file
+ *  \brief File containing the implementation of \ref device_job_graph.
+ *  
+ *  File containing the implementation of \ref device_job_graph.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-08
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "device_job_graph.h"
+
+#include <sstream>
+#include <stdexcept>
+
+#include "common/log.h"
+#include "common/mapped_file.h"
+#include "cartridge/cartridge.h"
+#include "cartridge/digest_manifest.h"
+#include "task/task_pool.h"
+
+using namespace std;
+
+static double seconds_between(chrono::steady_clock::time_point start, chrono::steady_clock::time_point end)
+{
+  return chrono::duration_cast<chrono::duration<double>>(end - start).count();
+}
+
+
+
+device_job_graph::device_job_graph(device_job_scheduler* scheduler, task_pool* pool)
+  : m_scheduler(scheduler), m_pool(pool != nullptr ? pool : &task_pool::shared()),
+    m_num_unfinished(0), m_started(false), m_cancelled(false)
+{
+  // Nothing else to do
+}
+
+device_job_graph::~device_job_graph()
+{
+  cancel();
+  
+  // Steps that were running still call back into the graph when they end
+  unique_lock<mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return !m_started || m_num_unfinished == 0; });
+}
+
+
+
+unsigned int device_job_graph::add_device_step(const std::string& name, unsigned int device_id, device_job_scheduler::job_function function, const std::vector<unsigned int>& dependencies)
+{
+  step s;
+  s.name = name;
+  s.on_device = true;
+  s.device_id = device_id;
+  s.run_on_device = function;
+  return add_step(s, dependencies);
+}
+
+unsigned int device_job_graph::add_host_step(const std::string& name, host_function function, const std::vector<unsigned int>& dependencies)
+{
+  step s;
+  s.name = name;
+  s.on_device = false;
+  s.device_id = 0;
+  s.run_on_host = function;
+  return add_step(s, dependencies);
+}
+
+std::vector<unsigned int> device_job_graph::add_reflash_workflow(const std::vector<unsigned int>& device_ids, std::shared_ptr<const mapped_file> image, int slot)
+{
+  vector<unsigned int> steps;
+  
+  // Hashed once for every device, on the host while the devices are busy
+  shared_ptr<shared_ptr<const digest_manifest>> manifest = make_shared<shared_ptr<const digest_manifest>>();
+  unsigned int hash_step = add_host_step("hash", [image, manifest]() -> bool
+  {
+    *manifest = make_shared<const digest_manifest>(image->data(), image->size());
+    return true;
+  });
+  steps.push_back(hash_step);
+  
+  for (unsigned int device_id : device_ids)
+  {
+    shared_ptr<string> save = make_shared<string>();
+    
+    unsigned int identify = add_device_step("identify", device_id, [device_id](cartridge* cart, task_controller* controller) -> bool
+    {
+      (void) controller;
+      if (cart->system() == SYSTEM_UNKNOWN)
+      {
+        throw runtime_error("Unrecognized cartridge");
+      }
+      log(log_level::INFO, ("Device " + to_string(device_id) + " has a cartridge for system " + to_string((int) cart->system())).c_str());
+      return true;
+    });
+    
+    unsigned int backup_save = add_device_step("backup-save", device_id, [save, slot](cartridge* cart, task_controller* controller) -> bool
+    {
+      ostringstream fout;
+      cart->backup_cartridge_save_data(fout, slot, controller);
+      *save = fout.str();
+      return true;
+    }, {identify});
+    
+    unsigned int flash = add_device_step("flash", device_id, [image, slot](cartridge* cart, task_controller* controller) -> bool
+    {
+      cart->restore_cartridge_game_data(image->data(), image->size(), slot, controller);
+      return true;
+    }, {backup_save});
+    
+    unsigned int verify = add_device_step("verify", device_id, [manifest, slot](cartridge* cart, task_controller* controller) -> bool
+    {
+      return cart->compare_cartridge_game_data(**manifest, slot, controller);
+    }, {flash, hash_step});
+    
+    unsigned int restore_save = add_device_step("restore-save", device_id, [save, slot](cartridge* cart, task_controller* controller) -> bool
+    {
+      istringstream fin(*save);
+      cart->restore_cartridge_save_data(fin, slot, controller);
+      return true;
+    }, {verify});
+    
+    unsigned int verify_save = add_device_step("verify-save", device_id, [save, slot](cartridge* cart, task_controller* controller) -> bool
+    {
+      istringstream fin(*save);
+      return cart->compare_cartridge_save_data(fin, slot, controller);
+    }, {restore_save});
+    
+    steps.insert(steps.end(), {identify, backup_save, flash, verify, restore_save, verify_save});
+  }
+  
+  return steps;
+}
+
+void device_job_graph::set_step_listener(step_callback listener)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_listener = listener;
+}
+
+void device_job_graph::start()
+{
+  vector<unsigned int> ready;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    if (m_started)
+    {
+      throw runtime_error("Graph has already been started");
+    }
+    m_started = true;
+    m_num_unfinished = (unsigned int) m_steps.size();
+    
+    auto now = chrono::steady_clock::now();
+    for (unsigned int i = 0; i < m_steps.size(); ++i)
+    {
+      if (m_steps[i].num_waiting == 0)
+      {
+        m_steps[i].launched = true;
+        m_steps[i].ready_time = now;
+        ready.push_back(i);
+      }
+    }
+  }
+  
+  for (unsigned int step_id : ready)
+  {
+    launch(step_id);
+  }
+  m_condition.notify_all();
+}
+
+void device_job_graph::cancel()
+{
+  vector<unsigned int> jobs;
+  vector<unsigned int> cancelled;
+  step_callback listener;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_cancelled = true;
+    for (unsigned int i = 0; i < m_steps.size(); ++i)
+    {
+      step& s = m_steps[i];
+      if (s.finished)
+      {
+        continue;
+      }
+      
+      if (!s.launched && m_started)
+      {
+        cancel_step(i, "Cancelled", cancelled);
+      }
+      else if (s.on_device && s.job_id >= 0)
+      {
+        jobs.push_back((unsigned int) s.job_id);
+      }
+    }
+    listener = m_listener;
+    m_condition.notify_all();
+  }
+  
+  for (unsigned int job_id : jobs)
+  {
+    m_scheduler->cancel_job(job_id);
+  }
+  
+  if (listener != nullptr && m_started)
+  {
+    for (unsigned int step_id : cancelled)
+    {
+      listener(step_id);
+    }
+  }
+}
+
+void device_job_graph::wait()
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return m_started && m_num_unfinished == 0; });
+}
+
+bool device_job_graph::is_finished()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_started && m_num_unfinished == 0;
+}
+
+std::vector<unsigned int> device_job_graph::get_steps()
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  vector<unsigned int> steps;
+  for (unsigned int i = 0; i < m_steps.size(); ++i)
+  {
+    steps.push_back(i);
+  }
+  return steps;
+}
+
+device_job_graph::step_info device_job_graph::get_step_info(unsigned int step_id)
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  if (step_id >= m_steps.size())
+  {
+    throw invalid_argument("Unknown step ID " + to_string(step_id));
+  }
+  
+  const step& s = m_steps[step_id];
+  step_info info;
+  info.step_id = step_id;
+  info.name = s.name;
+  info.on_device = s.on_device;
+  info.device_id = s.device_id;
+  info.job_id = s.job_id;
+  info.status = s.status;
+  info.result = s.result;
+  info.error = s.error;
+  
+  // Steps still in progress are timed up to now
+  auto now = chrono::steady_clock::now();
+  auto end = (s.finished ? s.end_time : now);
+  info.seconds_waiting = 0.0;
+  info.seconds_running = 0.0;
+  if (s.launched)
+  {
+    info.seconds_waiting = seconds_between(s.ready_time, (s.began ? s.start_time : end));
+  }
+  if (s.began)
+  {
+    info.seconds_running = seconds_between(s.start_time, end);
+  }
+  return info;
+}
+
+
+
+unsigned int device_job_graph::add_step(step& s, const std::vector<unsigned int>& dependencies)
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  if (m_started)
+  {
+    throw runtime_error("Steps cannot be added once the graph has started");
+  }
+  for (unsigned int dependency : dependencies)
+  {
+    if (dependency >= m_steps.size())
+    {
+      throw invalid_argument("Unknown step ID " + to_string(dependency));
+    }
+  }
+  
+  unsigned int step_id = (unsigned int) m_steps.size();
+  s.num_waiting = (unsigned int) dependencies.size();
+  s.job_id = -1;
+  s.launched = false;
+  s.began = false;
+  s.finished = false;
+  s.status = task_status::NOT_STARTED;
+  s.result = false;
+  m_steps.push_back(s);
+  
+  for (unsigned int dependency : dependencies)
+  {
+    m_steps[dependency].dependents.push_back(step_id);
+  }
+  return step_id;
+}
+
+void device_job_graph::launch(unsigned int step_id)
+{
+  // Steps aren't added once the graph has started, so the functions can be
+  // copied out without holding the lock
+  const step& s = m_steps[step_id];
+  
+  if (!s.on_device)
+  {
+    host_function function = s.run_on_host;
+    m_pool->submit([this, step_id, function]()
+    {
+      if (!begin_step(step_id))
+      {
+        finish_step(step_id, task_status::CANCELLED, false, "Cancelled");
+        return;
+      }
+      
+      try
+      {
+        bool result = function();
+        finish_step(step_id, task_status::COMPLETED, result, "");
+      }
+      catch (std::exception& ex)
+      {
+        finish_step(step_id, task_status::ERROR, false, ex.what());
+      }
+    });
+    return;
+  }
+  
+  // The job records how it ended so that the callback can tell a step that
+  // ran from one that never got its device
+  shared_ptr<task_status> status = make_shared<task_status>(task_status::NOT_STARTED);
+  shared_ptr<bool> result = make_shared<bool>(false);
+  device_job_scheduler::job_function function = s.run_on_device;
+  auto job = [this, step_id, function, status, result](cartridge* cart, task_controller* controller) -> bool
+  {
+    if (!begin_step(step_id))
+    {
+      controller->cancel_task();
+      *status = task_status::CANCELLED;
+      return false;
+    }
+    
+    *status = task_status::ERROR;
+    *result = function(cart, controller);
+    *status = (controller->is_task_cancelled() ? task_status::CANCELLED : task_status::COMPLETED);
+    return *result;
+  };
+  auto on_finished = [this, step_id, status, result](unsigned int job_id)
+  {
+    device_job_scheduler::job_info info = m_scheduler->get_job_info(job_id);
+    if (*status == task_status::NOT_STARTED)
+    {
+      // Never ran, so the job's own status says why
+      *status = (info.status == task_status::CANCELLED ? task_status::CANCELLED : task_status::ERROR);
+    }
+    finish_step(step_id, *status, *result, (info.error.empty() && *status == task_status::CANCELLED ? "Cancelled" : info.error));
+  };
+  
+  try
+  {
+    unsigned int job_id = m_scheduler->submit_job(s.device_id, job, on_finished);
+    
+    lock_guard<mutex> lock(m_mutex);
+    m_steps[step_id].job_id = (int) job_id;
+  }
+  catch (std::exception& ex)
+  {
+    finish_step(step_id, task_status::ERROR, false, ex.what());
+  }
+}
+
+bool device_job_graph::begin_step(unsigned int step_id)
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  step& s = m_steps[step_id];
+  s.began = true;
+  s.start_time = chrono::steady_clock::now();
+  s.status = task_status::RUNNING;
+  return !m_cancelled;
+}
+
+void device_job_graph::finish_step(unsigned int step_id, task_status status, bool result, const std::string& error)
+{
+  vector<unsigned int> ready;
+  vector<unsigned int> cancelled;
+  step_callback listener;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    
+    step& s = m_steps[step_id];
+    if (s.finished)
+    {
+      return;
+    }
+    s.finished = true;
+    s.status = status;
+    s.result = result;
+    s.error = error;
+    s.end_time = chrono::steady_clock::now();
+    --m_num_unfinished;
+    
+    for (unsigned int dependent : s.dependents)
+    {
+      step& d = m_steps[dependent];
+      if (d.finished)
+      {
+        continue;
+      }
+      
+      if (status != task_status::COMPLETED || m_cancelled)
+      {
+        cancel_step(dependent, "Step " + to_string(step_id) + " (" + s.name + ") did not complete", cancelled);
+      }
+      else if (--d.num_waiting == 0)
+      {
+        d.launched = true;
+        d.ready_time = s.end_time;
+        ready.push_back(dependent);
+      }
+    }
+    
+    listener = m_listener;
+    m_condition.notify_all();
+  }
+  
+  if (listener != nullptr)
+  {
+    listener(step_id);
+    for (unsigned int dependent : cancelled)
+    {
+      listener(dependent);
+    }
+  }
+  
+  for (unsigned int dependent : ready)
+  {
+    launch(dependent);
+  }
+}
+
+void device_job_graph::cancel_step(unsigned int step_id, const std::string& error, std::vector<unsigned int>& cancelled)
+{
+  step& s = m_steps[step_id];
+  if (s.finished)
+  {
+    return;
+  }
+  s.finished = true;
+  s.status = task_status::CANCELLED;
+  s.error = error;
+  s.end_time = chrono::steady_clock::now();
+  --m_num_unfinished;
+  cancelled.push_back(step_id);
+  
+  for (unsigned int dependent : s.dependents)
+  {
+    cancel_step(dependent, error, cancelled);
+  }
+}
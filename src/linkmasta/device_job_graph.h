@@ -0,0 +1,323 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref device_job_graph class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref device_job_graph class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-08
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __DEVICE_JOB_GRAPH_H__
+#define __DEVICE_JOB_GRAPH_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "device_job_scheduler.h"
+
+class mapped_file;
+class task_pool;
+
+
+
+/*! \class device_job_graph
+ *  \brief Runs a graph of dependent steps across several devices.
+ *  
+ *  Runs a workflow made of steps that depend on one another, such as
+ *  identifying a cartridge, backing up its save, flashing it, verifying it,
+ *  and restoring the save. Device steps are queued as jobs on a
+ *  \ref device_job_scheduler, and host steps that don't touch a device, such
+ *  as hashing an image, run on a \ref task_pool. A step starts as soon as
+ *  every step it depends on has completed, so independent work overlaps: an
+ *  image is hashed while the cartridges are erased, and each device moves on
+ *  to its next step without waiting for the other devices.
+ *  
+ *  A step that fails or is cancelled cancels every step that depends on it. A
+ *  step that completes but returns false, such as a verification that found a
+ *  mismatch, does not stop its dependents.
+ *  
+ *  Steps are added before \ref start() is called, and the graph cannot be
+ *  changed afterwards. The time each step spent waiting for its device and
+ *  running is recorded and can be queried with
+ *  \ref get_step_info(unsigned int step_id).
+ *  
+ *  This class is thread-safe.
+ */
+class device_job_graph
+{
+public:
+  
+  /*!
+   *  \brief Function type for a step that runs on the host.
+   *  
+   *  The return value is recorded as the step's result.
+   */
+  typedef std::function<bool()> host_function;
+  
+  /*!
+   *  \brief Function type called once a step has finished.
+   *  
+   *  Called with the ID of the step from whichever thread finished it, without
+   *  the graph's lock held.
+   */
+  typedef std::function<void(unsigned int step_id)> step_callback;
+  
+  /*!
+   *  \brief Struct containing a snapshot of the state of a single step.
+   */
+  struct step_info
+  {
+    /*! \brief The ID of the step. */
+    unsigned int   step_id;
+    
+    /*! \brief The name of the step. */
+    std::string    name;
+    
+    /*! \brief Whether the step runs on a device rather than on the host. */
+    bool           on_device;
+    
+    /*! \brief The ID of the device the step runs on, if it runs on one. */
+    unsigned int   device_id;
+    
+    /*! \brief The ID of the step's scheduler job, or -1 if it has none yet. */
+    int            job_id;
+    
+    /*! \brief The status of the step. */
+    task_status    status;
+    
+    /*! \brief The value returned by the step, valid once it has completed. */
+    bool           result;
+    
+    /*! \brief Description of the error that ended the step, if any. */
+    std::string    error;
+    
+    /*! \brief The seconds between the step becoming ready and starting to
+     *         run, such as while waiting for its device. */
+    double         seconds_waiting;
+    
+    /*! \brief The seconds the step has spent running. */
+    double         seconds_running;
+  };
+  
+  
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in] scheduler The scheduler to queue device steps on. Must
+   *         outlive the graph.
+   *  \param [in] pool The pool to run host steps on, or nullptr to use
+   *         \ref task_pool::shared().
+   */
+                            device_job_graph(device_job_scheduler* scheduler, task_pool* pool = nullptr);
+  
+  /*!
+   *  \brief Class destructor.
+   *  
+   *  Class destructor. Cancels any unfinished steps and waits for the ones
+   *  already running to finish.
+   */
+                            ~device_job_graph();
+  
+  
+  
+  /*!
+   *  \brief Adds a step that runs on a device.
+   *  
+   *  \param [in] name The name of the step, used in reports.
+   *  \param [in] device_id The ID of the device to run the step on.
+   *  \param [in] function The function to run, as for
+   *         \ref device_job_scheduler::submit_job().
+   *  \param [in] dependencies The IDs of the steps that must complete before
+   *         this one starts.
+   *  
+   *  \return The ID of the new step.
+   *  
+   *  \throws std::runtime_error If the graph has already been started.
+   *  \throws std::invalid_argument If a dependency is not a step of the graph.
+   */
+  unsigned int              add_device_step(const std::string& name, unsigned int device_id, device_job_scheduler::job_function function, const std::vector<unsigned int>& dependencies = std::vector<unsigned int>());
+  
+  /*!
+   *  \brief Adds a step that runs on the host.
+   *  
+   *  \param [in] name The name of the step, used in reports.
+   *  \param [in] function The function to run.
+   *  \param [in] dependencies The IDs of the steps that must complete before
+   *         this one starts.
+   *  
+   *  \return The ID of the new step.
+   *  
+   *  \throws std::runtime_error If the graph has already been started.
+   *  \throws std::invalid_argument If a dependency is not a step of the graph.
+   */
+  unsigned int              add_host_step(const std::string& name, host_function function, const std::vector<unsigned int>& dependencies = std::vector<unsigned int>());
+  
+  /*!
+   *  \brief Adds the steps that reflash every given device with an image
+   *         while keeping its save.
+   *  
+   *  Adds one host step that hashes the image and, for each device, the
+   *  steps "identify", "backup-save", "flash", "verify", "restore-save", and
+   *  "verify-save", each depending on the one before it. The verification of
+   *  the game also waits for the image to be hashed, which happens while the
+   *  first devices are being flashed.
+   *  
+   *  \param [in] device_ids The IDs of the devices to reflash.
+   *  \param [in] image The image to flash.
+   *  \param [in] slot The slot to flash.
+   *  
+   *  \return The IDs of the steps added, in the order they were added.
+   *  
+   *  \throws std::runtime_error If the graph has already been started.
+   */
+  std::vector<unsigned int> add_reflash_workflow(const std::vector<unsigned int>& device_ids, std::shared_ptr<const mapped_file> image, int slot = -1);
+  
+  /*!
+   *  \brief Sets a function to call each time a step finishes.
+   *  
+   *  \param [in] listener The function to call, or nullptr to stop calling
+   *         one.
+   */
+  void                      set_step_listener(step_callback listener);
+  
+  /*!
+   *  \brief Starts every step that doesn't depend on another one.
+   *  
+   *  \throws std::runtime_error If the graph has already been started.
+   */
+  void                      start();
+  
+  /*!
+   *  \brief Cancels every step that hasn't finished yet.
+   *  
+   *  Steps that haven't started are cancelled right away, and device steps
+   *  that are running are cancelled through their scheduler job. Host steps
+   *  that are running are left to finish. Does not wait for anything to stop.
+   */
+  void                      cancel();
+  
+  /*!
+   *  \brief Blocks until every step has finished.
+   */
+  void                      wait();
+  
+  /*!
+   *  \brief Gets whether the graph has been started and every step has
+   *         finished.
+   */
+  bool                      is_finished();
+  
+  /*!
+   *  \brief Gets the IDs of every step, in the order they were added.
+   */
+  std::vector<unsigned int> get_steps();
+  
+  /*!
+   *  \brief Gets a snapshot of the state of a step.
+   *  
+   *  \param [in] step_id The ID of the step.
+   *  
+   *  \throws std::invalid_argument If the step does not exist.
+   */
+  step_info                 get_step_info(unsigned int step_id);
+
+
+
+private:
+  
+  /*!
+   *  \brief Struct containing the graph's internal record of a step.
+   */
+  struct step
+  {
+    std::string             name;
+    bool                    on_device;
+    unsigned int            device_id;
+    device_job_scheduler::job_function run_on_device;
+    host_function           run_on_host;
+    std::vector<unsigned int> dependents;
+    unsigned int            num_waiting;
+    int                     job_id;
+    bool                    launched;
+    bool                    began;
+    bool                    finished;
+    task_status             status;
+    bool                    result;
+    std::string             error;
+    std::chrono::steady_clock::time_point ready_time;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point end_time;
+  };
+  
+  /*!
+   *  \brief Adds a step after checking that it can be added.
+   */
+  unsigned int              add_step(step& s, const std::vector<unsigned int>& dependencies);
+  
+  /*!
+   *  \brief Runs a step that was just made ready.
+   */
+  void                      launch(unsigned int step_id);
+  
+  /*!
+   *  \brief Records that a step has begun running.
+   *  
+   *  \return false if the graph was cancelled and the step should not run.
+   */
+  bool                      begin_step(unsigned int step_id);
+  
+  /*!
+   *  \brief Records the outcome of a step and launches the steps it made
+   *         ready.
+   */
+  void                      finish_step(unsigned int step_id, task_status status, bool result, const std::string& error);
+  
+  /*!
+   *  \brief Marks a step that hasn't started, and every step depending on it,
+   *         as cancelled. Must be called with the lock held.
+   *  
+   *  \param [in] step_id The ID of the step.
+   *  \param [in] error Description of why the step was cancelled.
+   *  \param [out] cancelled Has the ID of every step cancelled added to it.
+   */
+  void                      cancel_step(unsigned int step_id, const std::string& error, std::vector<unsigned int>& cancelled);
+  
+  
+  
+  /*! \brief The scheduler device steps are queued on. */
+  device_job_scheduler*     m_scheduler;
+  
+  /*! \brief The pool host steps run on. */
+  task_pool*                m_pool;
+  
+  /*! \brief Every step, indexed by ID. */
+  std::vector<step>         m_steps;
+  
+  /*! \brief Function called each time a step finishes. */
+  step_callback             m_listener;
+  
+  /*! \brief The number of steps that haven't finished. */
+  unsigned int              m_num_unfinished;
+  
+  /*! \brief Whether \ref start() has been called. */
+  bool                      m_started;
+  
+  /*! \brief Whether \ref cancel() has been called. */
+  bool                      m_cancelled;
+  
+  /*! \brief Mutex guarding every member. */
+  std::mutex                m_mutex;
+  
+  /*! \brief Signalled each time a step finishes. */
+  std::condition_variable   m_condition;
+};
+
+#endif /* defined(__DEVICE_JOB_GRAPH_H__) */
@@ -0,0 +1,1477 @@
+/*! \file
+ *  \brief File containing the implementation of \ref device_job_scheduler.
+ *  
+ *  File containing the implementation of \ref device_job_scheduler.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-08
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "device_job_scheduler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+#include "common/archive_stream.h"
+#include "common/dump_archive.h"
+#include "common/dump_store.h"
+#include "common/log.h"
+#include "common/mapped_file.h"
+#include "common/metrics.h"
+#include "common/output_sink.h"
+#include "common/save_history.h"
+#include "device_manager.h"
+#include "linkmasta_device.h"
+#include "cartridge/cartridge.h"
+#include "cartridge/digest_manifest.h"
+#include "cartridge/job_journal.h"
+#include "cartridge/ngp_cartridge.h"
+#include "cartridge/restore_plan.h"
+#include "cartridge/ws_cartridge.h"
+#include "task/task_pool.h"
+
+#define JOURNAL_EXTENSION       ".journal"
+
+// The number of bytes at the start of a cartridge read back to tell it apart
+// from other cartridges of the same kind
+#define FINGERPRINT_BYTES       0x2000
+
+using namespace std;
+
+
+
+// Gets the path of the journal a device keeps for jobs on a file. Every
+// device has its own journal, so jobs on different devices never share one
+static string journal_path(const string& file_path, const string& serial, unsigned int device_id)
+{
+  string key;
+  for (char c : serial)
+  {
+    if (isalnum((unsigned char) c))
+    {
+      key += c;
+    }
+  }
+  if (key.empty())
+  {
+    key = "device" + std::to_string(device_id);
+  }
+  return file_path + "." + key + JOURNAL_EXTENSION;
+}
+
+// Describes the chips of a cartridge, so that a journal is never resumed on a
+// different kind of cartridge
+static string chip_fingerprint(cartridge* cart)
+{
+  const cartridge_descriptor* descriptor = cart->descriptor();
+  string fingerprint = "chips";
+  for (unsigned int chip_i = 0; chip_i < descriptor->num_chips; ++chip_i)
+  {
+    fingerprint += " " + std::to_string(descriptor->chips[chip_i]->manufacturer_id)
+      + ":" + std::to_string(descriptor->chips[chip_i]->device_id);
+  }
+  return fingerprint;
+}
+
+// Also checksums the start of the cartridge, telling apart cartridges of the
+// same kind for as long as nothing is written to them
+static string cartridge_fingerprint(cartridge* cart)
+{
+  vector<unsigned char> start(min((unsigned int) FINGERPRINT_BYTES, cart->slot_size(0)));
+  unsigned int num_bytes = (start.empty() ? 0 : cart->read_cartridge_game_data(0, 0, start.data(), (unsigned int) start.size()));
+  return chip_fingerprint(cart) + " start " + std::to_string(digest_manifest::crc32c(start.data(), num_bytes));
+}
+
+
+
+// Adds a dump read into memory to the archive a member path names
+static void add_to_archive(const string& member_path, const string& bytes, cartridge* cart, int slot)
+{
+  string archive_path;
+  string id;
+  dump_archive::split_member_path(member_path, archive_path, id);
+  
+  dump_archive_writer archive(archive_path);
+  archive.add(id, (const unsigned char*) bytes.data(), (unsigned int) bytes.size(),
+    "system=" + std::to_string((int) cart->system()) + " slot=" + std::to_string(slot));
+  archive.commit();
+}
+
+
+
+device_job_scheduler::device_job_scheduler(device_manager* manager)
+  : m_manager(manager), m_next_job_id(0), m_num_unfinished(0), m_num_callbacks(0),
+    m_num_job_changes(0), m_stopping(false), m_started(false), m_max_jobs_per_hub(DEFAULT_MAX_JOBS_PER_HUB),
+    m_erase_history(nullptr), m_io_generation(0), m_callbacks(new task_pool(1))
+{
+  // Nothing else to do
+}
+
+device_job_scheduler::~device_job_scheduler()
+{
+  cancel_all_jobs();
+  
+  // Tell workers to exit and wait for them
+  unique_lock<mutex> lock(m_mutex);
+  m_stopping = true;
+  m_condition.notify_all();
+  lock.unlock();
+  
+  for (auto& worker_pair : m_workers)
+  {
+    if (worker_pair.second->thread.joinable())
+    {
+      worker_pair.second->thread.join();
+    }
+    delete worker_pair.second;
+  }
+  
+  // Callbacks still queued may look their jobs up
+  m_callbacks.reset();
+  
+  for (auto& job_pair : m_jobs)
+  {
+    delete job_pair.second;
+  }
+}
+
+
+
+unsigned int device_job_scheduler::submit_job(unsigned int device_id, job_function function)
+{
+  return queue_job(device_id, function, nullptr);
+}
+
+unsigned int device_job_scheduler::submit_job(unsigned int device_id, job_function function, job_callback on_finished)
+{
+  return queue_job(device_id, function, nullptr, on_finished);
+}
+
+void device_job_scheduler::set_job_callback(unsigned int job_id, job_callback on_finished)
+{
+  unique_lock<mutex> lock(m_mutex);
+  
+  auto it = m_jobs.find(job_id);
+  if (it == m_jobs.end())
+  {
+    throw std::invalid_argument("Unknown job ID " + std::to_string(job_id));
+  }
+  
+  job* j = it->second;
+  if (!j->finished)
+  {
+    j->on_finished = on_finished;
+    return;
+  }
+  
+  lock.unlock();
+  if (on_finished != nullptr)
+  {
+    on_finished(job_id);
+  }
+}
+
+unsigned int device_job_scheduler::queue_job(unsigned int device_id, job_function function, std::shared_ptr<dump_hashes> hashes, job_callback on_finished, bool preemptible, bool writes_cartridge)
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  if (m_stopping)
+  {
+    throw std::runtime_error("Scheduler is shutting down");
+  }
+  
+  job* j = new job();
+  j->job_id = m_next_job_id++;
+  j->device_id = device_id;
+  j->function = function;
+  j->on_finished = on_finished;
+  j->started = false;
+  j->claimed = false;
+  j->finished = false;
+  j->result = false;
+  j->hashes = hashes;
+  j->has_plan = false;
+  j->priority = 0;
+  j->preemptible = preemptible;
+  j->writes_cartridge = writes_cartridge;
+  j->num_yields = 0;
+  m_jobs[j->job_id] = j;
+  ++m_num_unfinished;
+  
+  // Start a worker for the device if it doesn't have one yet
+  device_worker* worker;
+  auto it = m_workers.find(device_id);
+  if (it == m_workers.end())
+  {
+    worker = new device_worker();
+    worker->busy = false;
+    worker->running = nullptr;
+    worker->bus = 0;
+    worker->shared_hub = false;
+    worker->index = (unsigned int) m_workers.size();
+    worker->io_generation = 0;
+    try
+    {
+      // The hub is the port path up to the device's own port
+      string path = m_manager->get_port_path(device_id);
+      worker->bus = m_manager->get_bus_number(device_id);
+      worker->hub = path.substr(0, path.find_last_of(".-") == string::npos ? 0 : path.find_last_of(".-"));
+      worker->shared_hub = m_manager->is_on_shared_hub(device_id);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Without a known place, the device is neither throttled nor balanced
+    }
+    m_workers[device_id] = worker;
+    enqueue_job(worker, j);
+    worker->thread = thread(&device_job_scheduler::worker_function, this, device_id);
+  }
+  else
+  {
+    worker = it->second;
+    enqueue_job(worker, j);
+    preempt_if_needed(worker);
+  }
+  
+  ++m_num_job_changes;
+  m_condition.notify_all();
+  return j->job_id;
+}
+
+unsigned int device_job_scheduler::submit_backup_job(unsigned int device_id, const std::string& file_path, int slot, std::shared_ptr<dump_store> store, bool trimmed)
+{
+  // Keeps only one copy of images that have been backed up before
+  auto add_to_store = [file_path, store]()
+  {
+    if (store != nullptr)
+    {
+      string digest = store->add(file_path);
+      log(log_level::INFO, ("Backup " + file_path + " stored as " + digest).c_str());
+    }
+  };
+  
+  // The checksums of the backup, filled in by the job
+  shared_ptr<dump_hashes> hashes = make_shared<dump_hashes>();
+  bool preemptible = !is_archive_path(file_path) && !dump_archive::is_member_path(file_path);
+  
+  return queue_job(device_id, [this, device_id, file_path, slot, add_to_store, hashes, trimmed](cartridge* cart, task_controller* controller) -> bool
+  {
+    if (trimmed && cart->system() == SYSTEM_NEO_GEO_POCKET)
+    {
+      ((ngp_cartridge*) cart)->set_trimmed_backups(true);
+    }
+    
+    // Dumps join an archive whole, once all of them has been read
+    if (dump_archive::is_member_path(file_path))
+    {
+      stringstream dump;
+      {
+        hash_ostream hashed(dump);
+        cart->backup_cartridge_game_data(hashed, slot, controller);
+        *hashes = hashed.hashes();
+      }
+      if (!controller->is_task_cancelled())
+      {
+        add_to_archive(file_path, dump.str(), cart, slot);
+      }
+      return true;
+    }
+    
+    // Archives are compressed as they are written, so they can't be resumed
+    if (is_archive_path(file_path))
+    {
+      ofstream fout(file_path.c_str(), ios::binary | ios::out | ios::trunc);
+      if (!fout.is_open())
+      {
+        throw std::runtime_error("Unable to open file " + file_path);
+      }
+      
+      {
+        archive_ostream archive(fout);
+        hash_ostream hashed(archive);
+        cart->backup_cartridge_game_data(hashed, slot, controller);
+        *hashes = hashed.hashes();
+      }
+      fout.close();
+      if (!fout)
+      {
+        throw std::runtime_error("Unable to write file " + file_path);
+      }
+      
+      if (!controller->is_task_cancelled())
+      {
+        add_to_store();
+      }
+      return true;
+    }
+    
+    // Resume an earlier backup of the same cartridge to the same file if it
+    // was interrupted. A different cartridge starts over rather than being
+    // spliced onto what the earlier one left in the file
+    job_journal journal(journal_path(file_path, m_manager->get_serial_number(device_id), device_id),
+      "backup " + std::to_string((int) cart->system()) + " " + std::to_string(slot)
+      + " " + std::to_string(cart->descriptor()->num_bytes) + (trimmed ? " trimmed" : "")
+      + " " + cartridge_fingerprint(cart));
+    if (static_cast<job_controller*>(controller)->journal_stale.exchange(false))
+    {
+      journal.clear();
+    }
+    
+    // Write straight to the file, reserving space for the whole backup up
+    // front so that a full disk is noticed before anything is read
+    unsigned long long expected_size = cart->game_backup_size(slot);
+    unique_ptr<file_sink> file;
+    bool resumed = false;
+    if (journal.resumed())
+    {
+      try
+      {
+        file.reset(new file_sink(file_path, expected_size, true));
+        resumed = true;
+      }
+      catch (std::runtime_error& ex)
+      {
+        (void) ex;
+        journal.clear();
+      }
+    }
+    if (file == nullptr)
+    {
+      file.reset(new file_sink(file_path, expected_size));
+    }
+    sink_ostream fout(*file);
+    
+    // Hash the backup as it is written. A resumed backup seeks past the part
+    // an earlier job wrote, so it is hashed from the file once complete
+    cart->set_journal(&journal);
+    if (resumed)
+    {
+      cart->backup_cartridge_game_data(fout, slot, controller);
+    }
+    else
+    {
+      hash_ostream hashed(fout);
+      cart->backup_cartridge_game_data(hashed, slot, controller);
+      *hashes = hashed.hashes();
+    }
+    cart->set_journal(nullptr);
+    
+    if (!controller->is_task_cancelled())
+    {
+      journal.discard();
+      fout.flush();
+      file->close();
+      if (!fout)
+      {
+        throw std::runtime_error("Unable to write file " + file_path);
+      }
+      if (resumed)
+      {
+        mapped_file image(file_path);
+        *hashes = hash_data(image.data(), image.size());
+      }
+      add_to_store();
+    }
+    return true;
+  }, hashes, nullptr, preemptible, false);
+}
+
+unsigned int device_job_scheduler::submit_backup_slots_job(unsigned int device_id, const std::string& file_path)
+{
+  return queue_job(device_id, [file_path](cartridge* cart, task_controller* controller) -> bool
+  {
+    ws_cartridge* ws_cart = dynamic_cast<ws_cartridge*>(cart);
+    if (ws_cart == nullptr)
+    {
+      throw std::runtime_error("Cartridge does not support backing up slots separately");
+    }
+    
+    // Name each file after its slot, keeping the extension
+    size_t dot = file_path.find_last_of('.');
+    size_t slash = file_path.find_last_of("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+    {
+      dot = file_path.size();
+    }
+    
+    vector<unique_ptr<ofstream>> files;
+    vector<ostream*> fouts;
+    for (unsigned int i = 0; i < ws_cart->num_slots(); ++i)
+    {
+      string slot_path = file_path.substr(0, dot) + "-slot" + to_string(i) + file_path.substr(dot);
+      files.emplace_back(new ofstream(slot_path.c_str(), ios::binary | ios::out | ios::trunc));
+      if (!files.back()->is_open())
+      {
+        throw std::runtime_error("Unable to open file " + slot_path);
+      }
+      fouts.push_back(files.back().get());
+    }
+    
+    ws_cart->backup_slots_game_data(fouts, controller);
+    return true;
+  }, nullptr, nullptr, false, false);
+}
+
+unsigned int device_job_scheduler::submit_save_backup_job(unsigned int device_id, const std::string& file_path, int slot)
+{
+  return queue_job(device_id, [file_path, slot](cartridge* cart, task_controller* controller) -> bool
+  {
+    // Back up to memory first so that the file is only written if needed
+    stringstream save_data;
+    cart->backup_cartridge_save_data(save_data, slot, controller);
+    if (controller->is_task_cancelled())
+    {
+      return true;
+    }
+    string bytes = save_data.str();
+    
+    if (dump_archive::is_member_path(file_path))
+    {
+      try
+      {
+        mapped_file archived(file_path);
+        if (string((const char*) archived.data(), archived.size()) == bytes)
+        {
+          log(log_level::INFO, ("Save data unchanged, leaving " + file_path + " as is").c_str());
+          return true;
+        }
+      }
+      catch (std::runtime_error& ex)
+      {
+        // Not backed up to the archive yet
+        (void) ex;
+      }
+      add_to_archive(file_path, bytes, cart, slot);
+      return true;
+    }
+    
+    ifstream fin(file_path.c_str(), ios::binary);
+    if (fin.is_open())
+    {
+      string archived((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
+      if (is_archive((const unsigned char*) archived.data(), archived.size()))
+      {
+        vector<unsigned char> extracted = extract_archive((const unsigned char*) archived.data(), archived.size());
+        archived.assign(extracted.begin(), extracted.end());
+      }
+      if (archived == bytes)
+      {
+        log(log_level::INFO, ("Save data unchanged, leaving " + file_path + " as is").c_str());
+        return true;
+      }
+      fin.close();
+    }
+    
+    ofstream fout(file_path.c_str(), ios::binary | ios::out | ios::trunc);
+    if (!fout.is_open())
+    {
+      throw std::runtime_error("Unable to open file " + file_path);
+    }
+    if (is_archive_path(file_path))
+    {
+      archive_ostream archive(fout);
+      archive.write(bytes.data(), bytes.size());
+      archive.flush();
+    }
+    else
+    {
+      fout.write(bytes.data(), bytes.size());
+    }
+    if (!fout.good())
+    {
+      throw std::runtime_error("Unable to write file " + file_path);
+    }
+    return true;
+  }, nullptr, nullptr, false, false);
+}
+
+unsigned int device_job_scheduler::submit_save_history_job(unsigned int device_id, const std::string& history_path, int slot)
+{
+  return queue_job(device_id, [history_path, slot](cartridge* cart, task_controller* controller) -> bool
+  {
+    stringstream save_data;
+    cart->backup_cartridge_save_data(save_data, slot, controller);
+    if (controller->is_task_cancelled())
+    {
+      return true;
+    }
+    string bytes = save_data.str();
+    
+    save_history history(history_path);
+    unsigned int num_versions = (unsigned int) history.versions().size();
+    unsigned int number = history.check_in((const unsigned char*) bytes.data(), (unsigned int) bytes.size());
+    if (number == num_versions)
+    {
+      log(log_level::INFO, ("Save data unchanged since version " + std::to_string(number) + " in " + history_path).c_str());
+    }
+    else
+    {
+      log(log_level::INFO, ("Save data checked in to " + history_path + " as version " + std::to_string(number)).c_str());
+    }
+    return true;
+  }, nullptr, nullptr, false, false);
+}
+
+unsigned int device_job_scheduler::submit_restore_save_job(unsigned int device_id, const std::string& file_path, int slot)
+{
+  return submit_job(device_id, [file_path, slot](cartridge* cart, task_controller* controller) -> bool
+  {
+    string history_path;
+    unsigned int number;
+    save_history::split_version_path(file_path, history_path, number);
+    
+    string bytes;
+    if (number != 0 || save_history::is_history_path(history_path))
+    {
+      save_history history(history_path);
+      vector<unsigned char> save = history.restore(number);
+      bytes.assign(save.begin(), save.end());
+    }
+    else
+    {
+      mapped_file save(file_path);
+      bytes.assign((const char*) save.data(), save.size());
+    }
+    
+    istringstream fin(bytes);
+    cart->restore_cartridge_save_data(fin, slot, controller);
+    return true;
+  });
+}
+
+unsigned int device_job_scheduler::submit_flash_job(unsigned int device_id, const std::string& file_path, int slot)
+{
+  return queue_job(device_id, [this, device_id, file_path, slot](cartridge* cart, task_controller* controller) -> bool
+  {
+    mapped_file image(file_path);
+    
+    // Resume an earlier flash of the same file on the same device if it was
+    // interrupted
+    job_journal journal(journal_path(file_path, m_manager->get_serial_number(device_id), device_id),
+      "flash " + std::to_string((int) cart->system()) + " " + std::to_string(slot)
+      + " " + std::to_string(image.size()) + " " + std::to_string(digest_manifest::crc32c(image.data(), image.size()))
+      + " " + chip_fingerprint(cart));
+    if (static_cast<job_controller*>(controller)->journal_stale.exchange(false))
+    {
+      journal.clear();
+    }
+    bool resumed = journal.resumed();
+    
+    cart->set_journal(&journal);
+    cart->restore_cartridge_game_data(image.data(), image.size(), slot, controller);
+    
+    // Flashing changes the start of the cartridge, so unlike a backup the
+    // cartridge can't be told apart up front. The skipped blocks are checked
+    // instead, and a cartridge that doesn't hold them is flashed in full
+    if (resumed && !controller->is_task_cancelled()
+        && !cart->compare_cartridge_game_data(image.data(), image.size(), slot, controller)
+        && !controller->is_task_cancelled())
+    {
+      journal.clear();
+      cart->restore_cartridge_game_data(image.data(), image.size(), slot, controller);
+    }
+    cart->set_journal(nullptr);
+    
+    if (!controller->is_task_cancelled())
+    {
+      journal.discard();
+    }
+    return true;
+  }, nullptr, nullptr, true);
+}
+
+unsigned int device_job_scheduler::submit_flash_job(unsigned int device_id, std::shared_ptr<const mapped_file> image, int slot)
+{
+  // The image is held until every job flashing it finishes, so cartridges of
+  // the same layout can share its restore plan
+  restore_plan::share_image(image, image->data(), image->size());
+  return submit_job(device_id, [image, slot](cartridge* cart, task_controller* controller) -> bool
+  {
+    cart->restore_cartridge_game_data(image->data(), image->size(), slot, controller);
+    return true;
+  });
+}
+
+unsigned int device_job_scheduler::submit_flash_slots_job(unsigned int device_id, const std::vector<std::pair<int, std::string>>& files)
+{
+  return submit_job(device_id, [files](cartridge* cart, task_controller* controller) -> bool
+  {
+    ws_cartridge* ws_cart = dynamic_cast<ws_cartridge*>(cart);
+    if (ws_cart == nullptr)
+    {
+      throw std::runtime_error("Cartridge does not support flashing slots separately");
+    }
+    
+    // Plain files are read as the flash goes, archives are extracted up front
+    vector<unique_ptr<istream>> fins;
+    vector<pair<int, istream*>> images;
+    for (auto& file : files)
+    {
+      if (is_archive_path(file.second))
+      {
+        mapped_file image(file.second);
+        fins.emplace_back(new istringstream(string((const char*) image.data(), image.size())));
+      }
+      else
+      {
+        ifstream* fin = new ifstream(file.second.c_str(), ios::binary);
+        fins.emplace_back(fin);
+        if (!fin->is_open())
+        {
+          throw std::runtime_error("Unable to open file " + file.second);
+        }
+      }
+      images.push_back(make_pair(file.first, fins.back().get()));
+    }
+    
+    ws_cart->restore_slots_game_data(images, controller);
+    return true;
+  });
+}
+
+unsigned int device_job_scheduler::submit_copy_slot_job(unsigned int device_id, int source_slot, int slot)
+{
+  return submit_job(device_id, [source_slot, slot](cartridge* cart, task_controller* controller) -> bool
+  {
+    ws_cartridge* ws_cart = dynamic_cast<ws_cartridge*>(cart);
+    if (ws_cart == nullptr)
+    {
+      throw std::runtime_error("Cartridge does not support copying slots");
+    }
+    
+    ws_cart->copy_slot_game_data(source_slot, slot, controller);
+    return true;
+  });
+}
+
+unsigned int device_job_scheduler::submit_swap_slots_job(unsigned int device_id, int slot_a, int slot_b)
+{
+  return submit_job(device_id, [slot_a, slot_b](cartridge* cart, task_controller* controller) -> bool
+  {
+    ws_cartridge* ws_cart = dynamic_cast<ws_cartridge*>(cart);
+    if (ws_cart == nullptr)
+    {
+      throw std::runtime_error("Cartridge does not support swapping slots");
+    }
+    
+    ws_cart->swap_slots_game_data(slot_a, slot_b, controller);
+    return true;
+  });
+}
+
+unsigned int device_job_scheduler::submit_flash_and_verify_job(unsigned int device_id, std::shared_ptr<const mapped_file> image, int slot)
+{
+  restore_plan::share_image(image, image->data(), image->size());
+  return submit_job(device_id, [image, slot](cartridge* cart, task_controller* controller) -> bool
+  {
+    return cart->restore_and_verify_cartridge_game_data(image->data(), image->size(), slot, controller);
+  });
+}
+
+unsigned int device_job_scheduler::submit_clone_job(unsigned int source_device_id, unsigned int device_id, int source_slot, int slot)
+{
+  if (source_device_id == device_id)
+  {
+    throw std::invalid_argument("A device cannot be cloned onto itself");
+  }
+  
+  return submit_job(device_id, [this, source_device_id, source_slot, slot](cartridge* cart, task_controller* controller) -> bool
+  {
+    // Wait for the source the same way the worker waits for the target
+    if (!m_manager->claim_device(source_device_id, CLAIM_TIMEOUT_INFINITE, controller))
+    {
+      return false;
+    }
+    
+    try
+    {
+      linkmasta_device* linkmasta = m_manager->get_linkmasta_device(source_device_id);
+      linkmasta_device::session session(linkmasta);
+      
+      unique_ptr<cartridge> source(linkmasta->build_cartridge());
+      if (source == nullptr)
+      {
+        throw std::runtime_error("Unable to build cartridge for source device");
+      }
+      source->init();
+      
+      cart->clone_cartridge_game_data(*source, source_slot, slot, controller);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      m_manager->release_device(source_device_id);
+      throw;
+    }
+    
+    m_manager->release_device(source_device_id);
+    return true;
+  });
+}
+
+std::vector<unsigned int> device_job_scheduler::submit_broadcast_job(const std::vector<unsigned int>& device_ids, std::shared_ptr<const image_cache::image> image, int slot)
+{
+  if (image == nullptr)
+  {
+    throw std::invalid_argument("No image to broadcast");
+  }
+  
+  restore_plan::share_image(image);
+  vector<unsigned int> job_ids;
+  for (unsigned int device_id : device_ids)
+  {
+    job_ids.push_back(submit_job(device_id, [image, slot](cartridge* cart, task_controller* controller) -> bool
+    {
+      return cart->restore_and_verify_cartridge_game_data(image->data(), image->size(), slot, controller);
+    }));
+  }
+  return job_ids;
+}
+
+unsigned int device_job_scheduler::submit_verify_job(unsigned int device_id, const std::string& file_path, int slot)
+{
+  return queue_job(device_id, [file_path, slot](cartridge* cart, task_controller* controller) -> bool
+  {
+    // Opening the file through a mapping extracts archives transparently
+    mapped_file image(file_path);
+    return cart->compare_cartridge_game_data(image.data(), image.size(), slot, controller);
+  }, nullptr, nullptr, false, false);
+}
+
+unsigned int device_job_scheduler::submit_verify_job(unsigned int device_id, std::shared_ptr<const mapped_file> image, int slot)
+{
+  return queue_job(device_id, [image, slot](cartridge* cart, task_controller* controller) -> bool
+  {
+    return cart->compare_cartridge_game_data(image->data(), image->size(), slot, controller);
+  }, nullptr, nullptr, false, false);
+}
+
+unsigned int device_job_scheduler::submit_verify_job(unsigned int device_id, std::shared_ptr<const digest_manifest> manifest, int slot)
+{
+  return queue_job(device_id, [manifest, slot](cartridge* cart, task_controller* controller) -> bool
+  {
+    return cart->compare_cartridge_game_data(*manifest, slot, controller);
+  }, nullptr, nullptr, false, false);
+}
+
+unsigned int device_job_scheduler::submit_spot_check_job(unsigned int device_id, std::shared_ptr<const mapped_file> image, int slot, double confidence)
+{
+  return queue_job(device_id, [image, slot, confidence](cartridge* cart, task_controller* controller) -> bool
+  {
+    return cart->spot_check_cartridge_game_data(image->data(), image->size(), slot, confidence, controller);
+  }, nullptr, nullptr, false, false);
+}
+
+
+
+std::vector<unsigned int> device_job_scheduler::get_jobs()
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  vector<unsigned int> jobs;
+  for (auto& job_pair : m_jobs)
+  {
+    jobs.push_back(job_pair.first);
+  }
+  return jobs;
+}
+
+device_job_scheduler::job_info device_job_scheduler::get_job_info(unsigned int job_id)
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  auto it = m_jobs.find(job_id);
+  if (it == m_jobs.end())
+  {
+    throw std::invalid_argument("Unknown job ID " + std::to_string(job_id));
+  }
+  
+  job* j = it->second;
+  job_info info;
+  info.job_id = j->job_id;
+  info.device_id = j->device_id;
+  info.status = j->controller.get_task_status();
+  info.priority = j->priority;
+  info.num_yields = j->num_yields;
+  info.work_expected = j->controller.get_task_expected_work();
+  info.work_progress = j->controller.get_task_work_progress();
+  info.work_per_second = j->controller.get_task_work_rate();
+  info.smoothed_work_per_second = j->controller.get_task_smoothed_work_rate();
+  info.seconds_remaining = j->controller.get_task_seconds_remaining();
+  info.phase = j->controller.get_task_phase();
+  for (unsigned int i = 0; i < NUM_TASK_PHASES; ++i)
+  {
+    info.phase_seconds[i] = j->controller.get_task_phase_seconds((task_phase) i);
+  }
+  info.finished = j->finished;
+  info.result = j->result;
+  info.error = j->error;
+  if (j->hashes != nullptr && j->finished)
+  {
+    info.hashes = *j->hashes;
+  }
+  info.estimated_seconds = (j->has_plan ? m_planners[j->device_id].estimate_seconds(j->plan) : -1.0);
+  return info;
+}
+
+device_job_scheduler::throughput_info device_job_scheduler::get_throughput()
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  throughput_info info;
+  info.num_jobs_queued = 0;
+  info.num_jobs_running = 0;
+  info.num_jobs_completed = 0;
+  info.num_jobs_failed = 0;
+  info.num_active_devices = 0;
+  info.work_expected = 0;
+  info.work_progress = 0;
+  info.seconds_elapsed = 0.0;
+  info.work_per_second = 0.0;
+  
+  for (auto& job_pair : m_jobs)
+  {
+    add_job_throughput(job_pair.second, info);
+  }
+  
+  for (auto& worker_pair : m_workers)
+  {
+    if (worker_pair.second->busy)
+    {
+      ++info.num_active_devices;
+    }
+  }
+  
+  if (m_started)
+  {
+    info.seconds_elapsed = chrono::duration<double>(chrono::steady_clock::now() - m_start_time).count();
+    if (info.seconds_elapsed > 0.0)
+    {
+      info.work_per_second = (double) info.work_progress / info.seconds_elapsed;
+    }
+  }
+  
+  return info;
+}
+
+device_job_scheduler::throughput_info device_job_scheduler::get_throughput(const std::vector<unsigned int>& job_ids)
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  throughput_info info;
+  info.num_jobs_queued = 0;
+  info.num_jobs_running = 0;
+  info.num_jobs_completed = 0;
+  info.num_jobs_failed = 0;
+  info.num_active_devices = 0;
+  info.work_expected = 0;
+  info.work_progress = 0;
+  info.seconds_elapsed = 0.0;
+  info.work_per_second = 0.0;
+  
+  for (unsigned int job_id : job_ids)
+  {
+    auto it = m_jobs.find(job_id);
+    if (it == m_jobs.end())
+    {
+      throw std::invalid_argument("Unknown job ID " + std::to_string(job_id));
+    }
+    
+    job* j = it->second;
+    add_job_throughput(j, info);
+    if (j->started)
+    {
+      info.seconds_elapsed = max(info.seconds_elapsed, j->controller.get_task_seconds_elapsed());
+    }
+  }
+  
+  // Every job of a batch runs on its own device
+  info.num_active_devices = info.num_jobs_running;
+  if (info.seconds_elapsed > 0.0)
+  {
+    info.work_per_second = (double) info.work_progress / info.seconds_elapsed;
+  }
+  
+  return info;
+}
+
+void device_job_scheduler::cancel_job(unsigned int job_id)
+{
+  unique_lock<mutex> lock(m_mutex);
+  
+  auto it = m_jobs.find(job_id);
+  if (it == m_jobs.end())
+  {
+    throw std::invalid_argument("Unknown job ID " + std::to_string(job_id));
+  }
+  
+  job* j = it->second;
+  if (j->finished)
+  {
+    return;
+  }
+  
+  j->controller.cancel_task();
+  
+  // Jobs using the device stop sooner if they don't have to wait for the
+  // transfers in flight to finish
+  if (j->claimed)
+  {
+    try
+    {
+      m_manager->get_linkmasta_device(j->device_id)->abort_transfers();
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // The job will stop on its own
+    }
+  }
+  
+  // Jobs that haven't started yet can be dropped from the queue right away
+  if (!j->started)
+  {
+    auto& queue = m_workers[j->device_id]->queue;
+    for (auto q_it = queue.begin(); q_it != queue.end(); ++q_it)
+    {
+      if (*q_it == j)
+      {
+        queue.erase(q_it);
+        break;
+      }
+    }
+    
+    j->finished = true;
+    j->controller.on_task_end(task_status::CANCELLED, 0);
+    --m_num_unfinished;
+    ++m_num_job_changes;
+    m_condition.notify_all();
+    
+    job_callback on_finished = j->on_finished;
+    lock.unlock();
+    if (on_finished != nullptr)
+    {
+      on_finished(job_id);
+    }
+  }
+}
+
+void device_job_scheduler::cancel_all_jobs()
+{
+  for (unsigned int job_id : get_jobs())
+  {
+    cancel_job(job_id);
+  }
+}
+
+void device_job_scheduler::wait_for_all_jobs()
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return m_num_unfinished == 0 && m_num_callbacks == 0; });
+}
+
+bool device_job_scheduler::wait_for_job_change(unsigned long long& changes, unsigned int timeout_ms)
+{
+  unique_lock<mutex> lock(m_mutex);
+  bool changed = m_condition.wait_for(lock, chrono::milliseconds(timeout_ms), [this, &changes] { return m_num_job_changes != changes; });
+  changes = m_num_job_changes;
+  return changed;
+}
+
+unsigned int device_job_scheduler::get_max_jobs_per_hub()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_max_jobs_per_hub;
+}
+
+void device_job_scheduler::set_max_jobs_per_hub(unsigned int max_jobs)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_max_jobs_per_hub = max_jobs;
+  
+  // A higher limit may let waiting workers start
+  m_condition.notify_all();
+}
+
+void device_job_scheduler::set_job_plan(unsigned int job_id, const operation_planner::plan& plan)
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  auto it = m_jobs.find(job_id);
+  if (it == m_jobs.end())
+  {
+    throw std::invalid_argument("Unknown job ID " + std::to_string(job_id));
+  }
+  it->second->has_plan = true;
+  it->second->plan = plan;
+  
+  // The new estimate may change which waiting worker goes first
+  m_condition.notify_all();
+}
+
+void device_job_scheduler::set_job_priority(unsigned int job_id, int priority)
+{
+  lock_guard<mutex> lock(m_mutex);
+  
+  auto it = m_jobs.find(job_id);
+  if (it == m_jobs.end())
+  {
+    throw std::invalid_argument("Unknown job ID " + std::to_string(job_id));
+  }
+  
+  job* j = it->second;
+  j->priority = priority;
+  if (j->finished)
+  {
+    return;
+  }
+  
+  // Move a waiting job to its new place in the queue
+  device_worker* worker = m_workers[j->device_id];
+  if (!j->started)
+  {
+    auto& queue = worker->queue;
+    queue.erase(std::find(queue.begin(), queue.end(), j));
+    enqueue_job(worker, j);
+  }
+  preempt_if_needed(worker);
+  m_condition.notify_all();
+}
+
+void device_job_scheduler::set_erase_history(erase_history* history)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_erase_history = history;
+}
+
+io_thread_options device_job_scheduler::get_io_thread_options()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_io_options;
+}
+
+void device_job_scheduler::set_io_thread_options(const io_thread_options& opts)
+{
+  lock_guard<mutex> lock(m_mutex);
+  m_io_options = opts;
+  ++m_io_generation;
+}
+
+double device_job_scheduler::get_estimated_backlog(unsigned int device_id)
+{
+  lock_guard<mutex> lock(m_mutex);
+  return estimated_backlog(device_id);
+}
+
+operation_planner::rates device_job_scheduler::get_estimated_rates(unsigned int device_id)
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_planners[device_id].get_rates();
+}
+
+
+
+void device_job_scheduler::worker_function(unsigned int device_id)
+{
+  unique_lock<mutex> lock(m_mutex);
+  device_worker* worker = m_workers[device_id];
+  
+  while (true)
+  {
+    m_condition.wait(lock, [this, worker] { return m_stopping || (!worker->queue.empty() && can_start(worker)); });
+    if (worker->queue.empty())
+    {
+      // Stopping and nothing left to do
+      break;
+    }
+    
+    job* j = worker->queue.front();
+    worker->queue.pop_front();
+    j->started = true;
+    
+    // Jobs that yielded can't trust their journals once the cartridge has
+    // been written to behind their backs, so they start over
+    if (j->writes_cartridge)
+    {
+      for (job* waiting : worker->queue)
+      {
+        if (waiting->num_yields > 0)
+        {
+          waiting->controller.journal_stale = true;
+        }
+      }
+    }
+    worker->busy = true;
+    worker->running = j;
+    ++m_hub_jobs[worker->hub];
+    ++m_bus_jobs[worker->bus];
+    if (!m_started)
+    {
+      m_started = true;
+      m_start_time = chrono::steady_clock::now();
+    }
+    
+    // Threads are only touched once options have been set
+    bool configure = (worker->io_generation != m_io_generation);
+    io_thread_options io_options = m_io_options;
+    worker->io_generation = m_io_generation;
+    
+    lock.unlock();
+    if (configure)
+    {
+      configure_io_thread(io_options.high_priority, io_options.cpu_for(worker->index));
+    }
+    bool result = false;
+    std::string error;
+    run_job(j, result, error);
+    lock.lock();
+    
+    worker->busy = false;
+    worker->running = nullptr;
+    --m_hub_jobs[worker->hub];
+    --m_bus_jobs[worker->bus];
+    
+    // A job that stopped to make way for one of higher priority goes back in
+    // the queue, to resume from its journal once the device gets back to it
+    if (j->controller.yield_requested.exchange(false) && j->controller.get_task_status() == task_status::NOT_STARTED)
+    {
+      if (!j->controller.is_cancel_requested())
+      {
+        log(log_level::INFO, ("Job " + std::to_string(j->job_id) + " on device "
+          + std::to_string(device_id) + " yielded to a job of higher priority").c_str());
+        j->started = false;
+        ++j->num_yields;
+        enqueue_job(worker, j);
+        m_condition.notify_all();
+        continue;
+      }
+      
+      // Cancelled while stopping to yield
+      j->controller.on_task_end(task_status::CANCELLED, j->controller.get_task_work_progress());
+    }
+    
+    lock.unlock();
+    record_job_metrics(j, result);
+    lock.lock();
+    
+    j->result = result;
+    j->error = error;
+    j->finished = true;
+    if (j->has_plan)
+    {
+      m_planners[device_id].calibrate(j->plan, j->controller);
+    }
+    --m_num_unfinished;
+    ++m_num_job_changes;
+    m_condition.notify_all();
+    
+    // Whatever the callback does is left to another thread so that the
+    // worker can get on with the device's next job
+    if (j->on_finished != nullptr)
+    {
+      job_callback on_finished = j->on_finished;
+      unsigned int job_id = j->job_id;
+      ++m_num_callbacks;
+      m_callbacks->submit([this, on_finished, job_id]()
+      {
+        try
+        {
+          on_finished(job_id);
+        }
+        catch (std::exception& ex)
+        {
+          log(log_level::INFO, (string("Job callback failed: ") + ex.what()).c_str());
+        }
+        lock_guard<mutex> callback_lock(m_mutex);
+        --m_num_callbacks;
+        m_condition.notify_all();
+      });
+    }
+  }
+}
+
+bool device_job_scheduler::can_start(const device_worker* worker)
+{
+  if (!hub_has_room(worker))
+  {
+    return false;
+  }
+  
+  // When the hub only has room for one more job, let the waiting device with
+  // the most work left go first so that it doesn't end up running alone once
+  // the others are done
+  if (worker->shared_hub && m_max_jobs_per_hub != 0 && m_hub_jobs[worker->hub] + 1 == m_max_jobs_per_hub)
+  {
+    double backlog = estimated_backlog(worker->queue.front()->device_id);
+    for (auto& worker_pair : m_workers)
+    {
+      const device_worker* other = worker_pair.second;
+      if (other != worker && !other->busy && !other->queue.empty() && other->shared_hub && other->hub == worker->hub
+          && estimated_backlog(worker_pair.first) > backlog)
+      {
+        return false;
+      }
+    }
+  }
+  
+  // Let a worker on a less busy bus that is also ready go first, so that
+  // running jobs are spread across host controllers
+  unsigned int bus_jobs = m_bus_jobs[worker->bus];
+  for (auto& worker_pair : m_workers)
+  {
+    const device_worker* other = worker_pair.second;
+    if (other != worker && !other->busy && !other->queue.empty() && other->bus != worker->bus
+        && m_bus_jobs[other->bus] < bus_jobs && hub_has_room(other))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void device_job_scheduler::enqueue_job(device_worker* worker, job* j)
+{
+  // Job IDs grow with submission, so a job that yielded goes back ahead of
+  // the jobs of its priority that were submitted after it
+  auto it = worker->queue.begin();
+  while (it != worker->queue.end() && ((*it)->priority > j->priority || ((*it)->priority == j->priority && (*it)->job_id < j->job_id)))
+  {
+    ++it;
+  }
+  worker->queue.insert(it, j);
+}
+
+void device_job_scheduler::preempt_if_needed(device_worker* worker)
+{
+  job* running = worker->running;
+  // Only jobs that leave the cartridge as it is may run in the middle of a
+  // journaled job, since anything they wrote would be skipped on resuming
+  if (running != nullptr && running->preemptible && !worker->queue.empty()
+      && !worker->queue.front()->writes_cartridge && worker->queue.front()->priority > running->priority)
+  {
+    running->controller.yield_requested = true;
+  }
+}
+
+bool device_job_scheduler::hub_has_room(const device_worker* worker)
+{
+  return !worker->shared_hub || m_max_jobs_per_hub == 0 || m_hub_jobs[worker->hub] < m_max_jobs_per_hub;
+}
+
+double device_job_scheduler::estimated_backlog(unsigned int device_id)
+{
+  const operation_planner& planner = m_planners[device_id];
+  double seconds = 0.0;
+  for (auto& job_pair : m_jobs)
+  {
+    const job* j = job_pair.second;
+    if (j->device_id != device_id || j->finished || !j->has_plan)
+    {
+      continue;
+    }
+    
+    double estimate = planner.estimate_seconds(j->plan);
+    if (j->started)
+    {
+      estimate = max(estimate - j->controller.get_task_seconds_elapsed(), 0.0);
+    }
+    seconds += estimate;
+  }
+  return seconds;
+}
+
+void device_job_scheduler::add_job_throughput(const job* j, throughput_info& info)
+{
+  if (!j->started)
+  {
+    ++info.num_jobs_queued;
+    return;
+  }
+  
+  info.work_expected += j->controller.get_task_expected_work();
+  info.work_progress += j->controller.get_task_work_progress();
+  
+  if (!j->finished)
+  {
+    ++info.num_jobs_running;
+  }
+  else if (j->controller.get_task_status() == task_status::COMPLETED)
+  {
+    ++info.num_jobs_completed;
+  }
+  else
+  {
+    ++info.num_jobs_failed;
+  }
+}
+
+void device_job_scheduler::record_job_metrics(const job* j, bool result)
+{
+  std::string serial;
+  try
+  {
+    serial = m_manager->get_serial_number(j->device_id);
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // The device may already be gone
+  }
+  
+  const char* outcome;
+  switch (j->controller.get_task_status())
+  {
+  case task_status::COMPLETED:
+    outcome = (result ? "succeeded" : "failed");
+    break;
+  case task_status::CANCELLED:
+    outcome = "cancelled";
+    break;
+  default:
+    outcome = "error";
+    break;
+  }
+  
+  std::string labels = metrics_label("device", std::to_string(j->device_id)) + "," + metrics_label("serial", serial);
+  double seconds = j->controller.get_task_seconds_elapsed();
+  double work = j->controller.get_task_work_progress();
+  metrics_counter("flashmasta_jobs_total", "Jobs finished, by outcome", labels + "," + metrics_label("outcome", outcome))->add();
+  metrics_counter("flashmasta_job_seconds_total", "Time spent running jobs", labels)->add(seconds);
+  metrics_counter("flashmasta_job_bytes_total", "Bytes processed by jobs", labels)->add(work);
+  if (seconds > 0.0)
+  {
+    metrics_gauge("flashmasta_job_bytes_per_second", "Average throughput of the last job to finish", labels)->set(work / seconds);
+  }
+}
+
+device_job_scheduler::job_controller::job_controller()
+  : yield_requested(false), journal_stale(false)
+{
+  // Nothing else to do
+}
+
+bool device_job_scheduler::job_controller::is_task_cancelled() const
+{
+  return task_controller::is_task_cancelled() || yield_requested.load();
+}
+
+void device_job_scheduler::job_controller::on_task_end(task_status status, int work_total)
+{
+  if (yield_requested.load())
+  {
+    if (status == task_status::CANCELLED && !task_controller::is_task_cancelled())
+    {
+      status = task_status::NOT_STARTED;
+    }
+    else
+    {
+      yield_requested = false;
+    }
+  }
+  task_controller::on_task_end(status, work_total);
+}
+
+bool device_job_scheduler::job_controller::is_cancel_requested() const
+{
+  return task_controller::is_task_cancelled();
+}
+
+
+
+void device_job_scheduler::run_job(job* j, bool& result, std::string& error)
+{
+  // Wait in line for any other user of the device to release it, giving up
+  // if the job is cancelled in the meantime
+  bool claimed = false;
+  try
+  {
+    claimed = m_manager->claim_device(j->device_id, CLAIM_TIMEOUT_INFINITE, &j->controller);
+  }
+  catch (std::exception& ex)
+  {
+    error = ex.what();
+    j->controller.on_task_end(task_status::ERROR, 0);
+    return;
+  }
+  
+  if (!claimed)
+  {
+    j->controller.on_task_end(task_status::CANCELLED, 0);
+    return;
+  }
+  
+  {
+    lock_guard<mutex> lock(m_mutex);
+    j->claimed = true;
+  }
+  
+  cartridge* cart = nullptr;
+  try
+  {
+    // Hold the device open across the job so that the cartridge's operations,
+    // and any job that follows soon after, skip setting up the interface
+    linkmasta_device* linkmasta = m_manager->get_linkmasta_device(j->device_id);
+    linkmasta_device::session session(linkmasta);
+    
+    cart = linkmasta->build_cartridge();
+    if (cart == nullptr)
+    {
+      throw std::runtime_error("Unable to build cartridge for device");
+    }
+    cart->init();
+    
+    erase_history* history;
+    {
+      lock_guard<mutex> lock(m_mutex);
+      history = m_erase_history;
+      m_planners[j->device_id].use_chip_timings(cart->system());
+    }
+    if (history != nullptr)
+    {
+      std::string serial = m_manager->get_serial_number(j->device_id);
+      cart->set_erase_history(history, serial);
+      
+      lock_guard<mutex> lock(m_mutex);
+      m_planners[j->device_id].use_erase_history(*history, *cart->layout(), serial);
+    }
+    
+    result = j->function(cart, &j->controller);
+  }
+  catch (std::exception& ex)
+  {
+    log(log_level::INFO, ("Job " + std::to_string(j->job_id) + " on device "
+      + std::to_string(j->device_id) + " failed: " + ex.what()).c_str());
+    error = ex.what();
+    j->controller.on_task_end(task_status::ERROR, j->controller.get_task_work_progress());
+  }
+  
+  if (cart != nullptr)
+  {
+    delete cart;
+  }
+  
+  {
+    lock_guard<mutex> lock(m_mutex);
+    j->claimed = false;
+  }
+  
+  try
+  {
+    m_manager->release_device(j->device_id);
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // Well... this is awkward
+  }
+}
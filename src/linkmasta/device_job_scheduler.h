@@ -0,0 +1,1090 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref device_job_scheduler
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref device_job_scheduler class. This file includes the minimal number of
+ *  files necessary to use any instance of the \ref device_job_scheduler class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-08
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __DEVICE_JOB_SCHEDULER_H__
+#define __DEVICE_JOB_SCHEDULER_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cartridge/cartridge.h"
+#include "cartridge/erase_history.h"
+#include "cartridge/image_cache.h"
+#include "cartridge/operation_planner.h"
+#include "common/hash_stream.h"
+#include "common/io_thread.h"
+#include "task/task_controller.h"
+
+class device_manager;
+class mapped_file;
+class digest_manifest;
+class dump_store;
+class task_pool;
+
+/*! \brief The default for \ref device_job_scheduler::set_max_jobs_per_hub(). */
+#define DEFAULT_MAX_JOBS_PER_HUB 2
+
+
+
+/*!
+ *  \brief Runs cartridge jobs on several \ref linkmasta_device devices at once.
+ *  
+ *  Runs cartridge jobs such as backups, flashes, and verifications on several
+ *  \ref linkmasta_device devices in parallel. Each device that has jobs
+ *  submitted for it gets its own worker thread, which claims the device
+ *  through the associated \ref device_manager, runs that device's jobs in
+ *  order of priority, and releases the device between jobs. Jobs for
+ *  different devices run concurrently. Each job holds a
+ *  \ref linkmasta_device::session, so back-to-back jobs on a device reuse its
+ *  open connection.
+ *  
+ *  Jobs are placed with the USB topology in mind. Devices behind the same
+ *  full-speed hub share a single full-speed link, so only
+ *  \ref get_max_jobs_per_hub() of them run jobs at once, and when several
+ *  devices are waiting to start, the ones on the least busy host controller
+ *  go first.
+ *  
+ *  Jobs can be given a priority with \ref set_job_priority(). A device runs
+ *  its waiting jobs of the highest priority first, and those of equal
+ *  priority in the order they were submitted. Journaled jobs, those from
+ *  \ref submit_backup_job() that back up to a plain file and from
+ *  \ref submit_flash_job(unsigned int device_id, const std::string& file_path, int slot),
+ *  are also preemptible: when a job of higher priority that only reads the
+ *  cartridge is waiting for their device, they stop at the next block
+ *  boundary, the higher priority jobs run, and they then resume from their
+ *  journal. A short save backup can
+ *  therefore be given a higher priority than a long flash to keep it from
+ *  waiting for the whole flash.
+ *  
+ *  Jobs can be given an \ref operation_planner::plan with
+ *  \ref set_job_plan(). Their time is then estimated with rates calibrated
+ *  from the device's earlier jobs, the work left on each device can be
+ *  queried with \ref get_estimated_backlog(), and when a hub only has room
+ *  for one more job, the waiting device with the most work left goes first.
+ *  
+ *  Given an \ref erase_history with \ref set_erase_history(), every erase a
+ *  job waits on is recorded in it, and the recorded times pace the polling of
+ *  later erases and replace the device's erase estimates.
+ *  
+ *  Each device's worker thread does nothing but run the device's jobs. The
+ *  callbacks of finished jobs run on a thread of their own. Given
+ *  \ref io_thread_options with \ref set_io_thread_options(), worker threads
+ *  run at a raised priority, each pinned to a CPU of its own, so that other
+ *  work on a busy machine doesn't hold up the round trip of every packet.
+ *  
+ *  Progress of individual jobs can be queried with
+ *  \ref get_job_info(unsigned int job_id), and the combined progress and
+ *  throughput of all jobs can be queried with \ref get_throughput().
+ *  
+ *  This class is thread-safe.
+ */
+class device_job_scheduler
+{
+public:
+  
+  /*!
+   *  \brief Function type for a job to be run on a cartridge.
+   *  
+   *  Function type for a job to be run on a cartridge. The function is given
+   *  an initialized \ref cartridge for the job's device and a
+   *  \ref task_controller to report progress through. The return value is
+   *  recorded as the job's result, which is used by verification jobs to
+   *  report whether the data matched.
+   */
+  typedef std::function<bool(cartridge*, task_controller*)> job_function;
+  
+  /*!
+   *  \brief Function type called once a job has finished.
+   *  
+   *  Function type called with the ID of a job once it has finished, however
+   *  it ended, including when it was cancelled before it started or could not
+   *  claim its device. Called without the scheduler's lock held, so it may
+   *  query the scheduler or queue more jobs.
+   */
+  typedef std::function<void(unsigned int job_id)> job_callback;
+  
+  /*!
+   *  \brief Struct containing a snapshot of the state of a single job.
+   */
+  struct job_info
+  {
+    /*! \brief The ID of the job. */
+    unsigned int   job_id;
+    
+    /*! \brief The ID of the device the job runs on. */
+    unsigned int   device_id;
+    
+    /*! \brief The current status of the job. A job that stopped to make way
+     *         for one of higher priority is \ref task_status::NOT_STARTED
+     *         until it resumes. */
+    task_status    status;
+    
+    /*! \brief The priority of the job. \see set_job_priority() */
+    int            priority;
+    
+    /*! \brief The number of times the job stopped to make way for one of
+     *         higher priority. */
+    unsigned int   num_yields;
+    
+    /*! \brief The amount of work the job expects to perform. */
+    int            work_expected;
+    
+    /*! \brief The amount of work the job has performed so far. */
+    int            work_progress;
+    
+    /*! \brief The work performed per second over the last sample.
+     *         \see task_controller::get_task_work_rate() */
+    double         work_per_second;
+    
+    /*! \brief The work performed per second, smoothed over the last few
+     *         seconds. \see task_controller::get_task_smoothed_work_rate() */
+    double         smoothed_work_per_second;
+    
+    /*! \brief The estimated seconds until the job ends, or a negative value
+     *         if unknown. \see task_controller::get_task_seconds_remaining() */
+    double         seconds_remaining;
+    
+    /*! \brief The phase the job is in. */
+    task_phase     phase;
+    
+    /*! \brief The seconds the job has spent in each phase, indexed by
+     *         \ref task_phase. */
+    double         phase_seconds[NUM_TASK_PHASES];
+    
+    /*! \brief Whether the job has ended and \ref result, \ref error, and
+     *         \ref hashes are final. Its status may read as ended shortly
+     *         before this is set. */
+    bool           finished;
+    
+    /*! \brief The value returned by the job, valid once it has completed. */
+    bool           result;
+    
+    /*! \brief Description of the error that ended the job, if any. */
+    std::string    error;
+    
+    /*! \brief The checksums of the data backed up by a job from
+     *         \ref submit_backup_job(), valid once it has completed. */
+    dump_hashes    hashes;
+    
+    /*! \brief The estimated seconds the whole job takes, or a negative value
+     *         if it has no plan. \see set_job_plan() */
+    double         estimated_seconds;
+  };
+  
+  /*!
+   *  \brief Struct containing a snapshot of the combined progress of all jobs.
+   */
+  struct throughput_info
+  {
+    /*! \brief Number of jobs waiting for their device to become free. */
+    unsigned int   num_jobs_queued;
+    
+    /*! \brief Number of jobs currently running. */
+    unsigned int   num_jobs_running;
+    
+    /*! \brief Number of jobs that have completed successfully. */
+    unsigned int   num_jobs_completed;
+    
+    /*! \brief Number of jobs that ended in an error or were cancelled. */
+    unsigned int   num_jobs_failed;
+    
+    /*! \brief Number of devices currently running a job. */
+    unsigned int   num_active_devices;
+    
+    /*! \brief Combined expected work of all submitted jobs. */
+    long long      work_expected;
+    
+    /*! \brief Combined work performed by all submitted jobs. */
+    long long      work_progress;
+    
+    /*! \brief Time elapsed since the first job started, in seconds. */
+    double         seconds_elapsed;
+    
+    /*! \brief Average combined work performed per second. */
+    double         work_per_second;
+  };
+  
+  
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  Class constructor. Initializes member variables to default values.
+   *  
+   *  \param [in] manager The \ref device_manager through which devices are
+   *         claimed and released. Must outlive this object.
+   */
+                            device_job_scheduler(device_manager* manager);
+  
+  /*!
+   *  \brief Class destructor.
+   *  
+   *  Class destructor. Cancels any unfinished jobs and joins with all worker
+   *  threads before returning.
+   */
+                            ~device_job_scheduler();
+  
+  
+  
+  /*!
+   *  \brief Queues a job to be run on the given device.
+   *  
+   *  Queues a job to be run on the device with the given ID. If no worker
+   *  thread exists for the device, one is started. Jobs for the same device
+   *  are run one at a time in order of priority, and in the order they were
+   *  submitted within a priority. The job is given priority 0.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on, as given by
+   *         the associated \ref device_manager.
+   *  \param [in] job The function to run.
+   *  
+   *  \return The ID of the newly queued job.
+   */
+  unsigned int              submit_job(unsigned int device_id, job_function job);
+  
+  /*!
+   *  \brief Queues a job to be run on the given device, calling a function
+   *         once it has finished.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on, as given by
+   *         the associated \ref device_manager.
+   *  \param [in] job The function to run.
+   *  \param [in] on_finished Called once the job has finished. Called from
+   *         the scheduler's callback thread, or from the thread cancelling the
+   *         job if it hadn't started.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_job(unsigned int device_id, job_function job, job_callback on_finished);
+  
+  /*!
+   *  \brief Sets the function to call once a job has finished.
+   *  
+   *  Sets the function to call once the job has finished, replacing the one
+   *  it was submitted with, if any. Lets jobs queued by any of the submit
+   *  functions be followed. If the job has already finished, the function is
+   *  called right away from the calling thread.
+   *  
+   *  \param [in] job_id The ID of the job.
+   *  \param [in] on_finished The function to call.
+   *  
+   *  \throws std::invalid_argument If the job does not exist.
+   */
+  void                      set_job_callback(unsigned int job_id, job_callback on_finished);
+  
+  /*!
+   *  \brief Queues a job that backs up a cartridge's game data to a file.
+   *  
+   *  Progress is journaled next to the file, in a journal of the device's own,
+   *  see \ref job_journal. If an earlier backup of the same slot of the same
+   *  cartridge to the same file on the same device was interrupted, then the
+   *  job resumes after the last block that reached the file instead of starting
+   *  over. The cartridge is told by its chips and the checksum of its first
+   *  bytes, and a different one starts over. The journal is deleted once the
+   *  backup completes. Unless backing
+   *  up to an archive, the job is preemptible, see \ref set_job_priority().
+   *  
+   *  A member path such as **backups.fmda#game.ngp** backs up into memory
+   *  and then adds the dump to the \ref dump_archive, without a journal. Such
+   *  backups aren't added to the \ref dump_store.
+   *  
+   *  If a \ref dump_store is given, the finished backup is added to it, so
+   *  that the file is replaced by a reference if the same image has been
+   *  backed up before.
+   *  
+   *  The CRC32, MD5, and SHA-1 checksums of the backup are computed while it
+   *  is being written and reported in the job's \ref job_info::hashes. Only a
+   *  resumed backup is read back from the file to be hashed.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] file_path The path of the file to write.
+   *  \param [in] slot The slot to back up, or \ref cartridge::SLOT_ALL.
+   *  \param [in] store The store to add the backup to, if any.
+   *  \param [in] trimmed Whether to stop the backup of a Neo Geo Pocket game
+   *         at the end of the game when its size is known, see
+   *         \ref ngp_cartridge::set_trimmed_backups(bool enabled).
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_backup_job(unsigned int device_id, const std::string& file_path, int slot = -1, std::shared_ptr<dump_store> store = nullptr, bool trimmed = false);
+  
+  /*!
+   *  \brief Queues a job that backs up every slot of a cartridge to its own
+   *         file.
+   *  
+   *  Backs up the game in each slot in a single pass over the cartridge. Each
+   *  slot is written to the given path with "-slot" and the slot number added
+   *  before the file extension. Only WonderSwan cartridges are supported; the
+   *  job fails on any other. Unlike \ref submit_backup_job(), the job is not
+   *  journaled.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] file_path The path the file names are derived from.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_backup_slots_job(unsigned int device_id, const std::string& file_path);
+  
+  /*!
+   *  \brief Queues a job that backs up a cartridge's save data to a file if
+   *         it has changed.
+   *  
+   *  Reads the save data into memory and compares it with the file. If the
+   *  file already holds the same save data, it is left untouched, so that
+   *  repeated backups of an unchanged cartridge cost only the reads. A member
+   *  path such as **saves.fmda#game.ngf** compares with and adds to the dump
+   *  of that ID in a \ref dump_archive.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] file_path The path of the file to write.
+   *  \param [in] slot The slot to back up, or \ref cartridge::SLOT_ALL.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_save_backup_job(unsigned int device_id, const std::string& file_path, int slot = -1);
+  
+  /*!
+   *  \brief Queues a job that checks a cartridge's save data in to a
+   *         \ref save_history.
+   *  
+   *  Reads the save data into memory and adds it to the history as a new
+   *  version, storing only the blocks that changed since the latest one. If
+   *  the save data matches the latest version, nothing is written.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] history_path The path of the history, created if needed.
+   *  \param [in] slot The slot to back up, or \ref cartridge::SLOT_ALL.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_save_history_job(unsigned int device_id, const std::string& history_path, int slot = -1);
+  
+  /*!
+   *  \brief Queues a job that restores a cartridge's save data.
+   *  
+   *  The save data is read from a file, or rebuilt in memory from a
+   *  \ref save_history when given a history or a version path such as
+   *  **pocket-tennis.fmsh@3**, and handed straight to
+   *  \ref cartridge::restore_cartridge_save_data(), so that a cartridge
+   *  restoring saves differentially only writes what changed.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] file_path The path of the file, history, or version.
+   *  \param [in] slot The slot to restore, or \ref cartridge::SLOT_ALL.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_restore_save_job(unsigned int device_id, const std::string& file_path, int slot = -1);
+  
+  /*!
+   *  \brief Queues a job that flashes a file to a cartridge.
+   *  
+   *  Progress is journaled next to the file, in a journal of the device's own,
+   *  see \ref job_journal. If an earlier flash of the same file to the same
+   *  slot of the same kind of cartridge on the same device was interrupted,
+   *  then the blocks it completed are skipped. The cartridge is then compared
+   *  against the file, and flashed again in full if the skipped blocks aren't
+   *  on it, such as when another cartridge was plugged in meanwhile. The
+   *  journal is deleted once the flash completes. The job is
+   *  preemptible, see \ref set_job_priority().
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] file_path The path of the file to read.
+   *  \param [in] slot The slot to flash, or \ref cartridge::SLOT_ALL.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_flash_job(unsigned int device_id, const std::string& file_path, int slot = -1);
+  
+  /*!
+   *  \brief Queues a job that flashes a mapped file to a cartridge.
+   *  
+   *  Same as
+   *  \ref submit_flash_job(unsigned int device_id, const std::string& file_path, int slot),
+   *  except that the file is already mapped into memory. The same mapping can
+   *  be given to jobs on several devices so that the file is only read once.
+   *  The job keeps the mapping alive until it finishes.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] image The mapped file to flash.
+   *  \param [in] slot The slot to flash, or \ref cartridge::SLOT_ALL.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_flash_job(unsigned int device_id, std::shared_ptr<const mapped_file> image, int slot = -1);
+  
+  /*!
+   *  \brief Queues a job that flashes a file to each of several slots of a
+   *         cartridge.
+   *  
+   *  Flashes every file to its slot in a single session with
+   *  \ref ws_cartridge::restore_slots_game_data(), reading the next file
+   *  while the current slot is being written. Only WonderSwan cartridges are
+   *  supported; the job fails on any other. Unlike
+   *  \ref submit_flash_job(unsigned int device_id, const std::string& file_path, int slot),
+   *  the job is not journaled.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] files The slots to flash, each paired with the path of the
+   *         file to flash to it.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_flash_slots_job(unsigned int device_id, const std::vector<std::pair<int, std::string>>& files);
+  
+  /*!
+   *  \brief Queues a job that copies the game in one slot of a cartridge to
+   *         another slot of the same cartridge.
+   *  
+   *  Copies the game with \ref ws_cartridge::copy_slot_game_data(), without
+   *  an intermediate file. Only WonderSwan cartridges are supported; the job
+   *  fails on any other.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] source_slot The slot to copy from.
+   *  \param [in] slot The slot to copy to.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_copy_slot_job(unsigned int device_id, int source_slot, int slot);
+  
+  /*!
+   *  \brief Queues a job that swaps the games in two slots of a cartridge.
+   *  
+   *  Swaps the games with \ref ws_cartridge::swap_slots_game_data(), without
+   *  an intermediate file. Only WonderSwan cartridges are supported; the job
+   *  fails on any other.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] slot_a The first slot to swap.
+   *  \param [in] slot_b The second slot to swap.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_swap_slots_job(unsigned int device_id, int slot_a, int slot_b);
+  
+  /*!
+   *  \brief Queues a job that flashes a mapped file to a cartridge and
+   *         verifies each block as it goes.
+   *  
+   *  The job's result will be true if every block matched after being
+   *  programmed.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] image The mapped file to flash.
+   *  \param [in] slot The slot to flash, or \ref cartridge::SLOT_ALL.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see cartridge::restore_and_verify_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, task_controller* controller)
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_flash_and_verify_job(unsigned int device_id, std::shared_ptr<const mapped_file> image, int slot = -1);
+  
+  /*!
+   *  \brief Queues a job that copies the game data of one device's cartridge
+   *         onto another's.
+   *  
+   *  Queues a job on the target device that also claims the source device for
+   *  as long as it runs, then streams the source's game data straight onto
+   *  the target with \ref cartridge::clone_cartridge_game_data(), without
+   *  an intermediate file.
+   *  
+   *  \param [in] source_device_id The ID of the device to copy from.
+   *  \param [in] device_id The ID of the device to copy onto.
+   *  \param [in] source_slot The slot of the source to copy, or
+   *         \ref cartridge::SLOT_ALL.
+   *  \param [in] slot The slot of the target to write to, or
+   *         \ref cartridge::SLOT_ALL.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_clone_job(unsigned int source_device_id, unsigned int device_id, int source_slot = -1, int slot = -1);
+  
+  /*!
+   *  \brief Queues jobs that flash and verify one cached image onto several
+   *         devices at once.
+   *  
+   *  Queues one job per device that flashes the image and verifies each block
+   *  as it goes, all reading the same \ref image_cache::image so that the
+   *  file is only read and hashed once. Each device runs its job on its own
+   *  worker, so the whole batch takes about as long as flashing a single
+   *  cartridge, and a cartridge that fails only ends its own job. The
+   *  combined progress of the batch can be queried by passing the returned
+   *  IDs to \ref get_throughput(const std::vector<unsigned int>& job_ids).
+   *  
+   *  \param [in] device_ids The IDs of the devices to flash.
+   *  \param [in] image The cached image to flash.
+   *  \param [in] slot The slot to flash, or \ref cartridge::SLOT_ALL.
+   *  
+   *  \return The IDs of the newly queued jobs, in the order of the devices.
+   *  
+   *  \see submit_flash_and_verify_job(unsigned int device_id, std::shared_ptr<const mapped_file> image, int slot)
+   */
+  std::vector<unsigned int> submit_broadcast_job(const std::vector<unsigned int>& device_ids, std::shared_ptr<const image_cache::image> image, int slot = -1);
+  
+  /*!
+   *  \brief Queues a job that verifies a cartridge's game data against a file.
+   *  
+   *  The job's result will be true if the cartridge matched the file.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] file_path The path of the file to compare against.
+   *  \param [in] slot The slot to verify, or \ref cartridge::SLOT_ALL.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_verify_job(unsigned int device_id, const std::string& file_path, int slot = -1);
+  
+  /*!
+   *  \brief Queues a job that verifies a cartridge's game data against a
+   *         mapped file.
+   *  
+   *  Same as
+   *  \ref submit_verify_job(unsigned int device_id, const std::string& file_path, int slot),
+   *  except that the file is already mapped into memory. The same mapping can
+   *  be given to jobs on several devices so that the file is only read once.
+   *  The job keeps the mapping alive until it finishes.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] image The mapped file to compare against.
+   *  \param [in] slot The slot to verify, or \ref cartridge::SLOT_ALL.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_verify_job(unsigned int device_id, std::shared_ptr<const mapped_file> image, int slot = -1);
+  
+  /*!
+   *  \brief Queues a job that verifies a cartridge's game data against the
+   *         digests of an image.
+   *  
+   *  Same as
+   *  \ref submit_verify_job(unsigned int device_id, const std::string& file_path, int slot),
+   *  except that the cartridge is compared to a \ref digest_manifest rather
+   *  than the image itself. The same manifest can be given to jobs on several
+   *  devices so that a batch only needs the image hashed once. The job keeps
+   *  the manifest alive until it finishes.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] manifest The manifest to compare against.
+   *  \param [in] slot The slot to verify, or \ref cartridge::SLOT_ALL.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_verify_job(unsigned int device_id, std::shared_ptr<const digest_manifest> manifest, int slot = -1);
+  
+  /*!
+   *  \brief Queues a job that compares a random sample of a cartridge's game
+   *         data against a mapped file.
+   *  
+   *  Same as
+   *  \ref submit_verify_job(unsigned int device_id, std::shared_ptr<const mapped_file> image, int slot),
+   *  except that only a sample of the cartridge is read, for batches whose
+   *  flashing was already verified.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] image The mapped file to compare against.
+   *  \param [in] slot The slot to check, or \ref cartridge::SLOT_ALL.
+   *  \param [in] confidence The probability of catching a fault that corrupts
+   *         1 sampled window in 100.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see cartridge::spot_check_cartridge_game_data(const unsigned char* image, unsigned int num_bytes, int slot, double confidence, task_controller* controller)
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              submit_spot_check_job(unsigned int device_id, std::shared_ptr<const mapped_file> image, int slot = -1, double confidence = SPOT_CHECK_DEFAULT_CONFIDENCE);
+  
+  
+  
+  /*!
+   *  \brief Gets the IDs of all jobs submitted to this scheduler.
+   *  
+   *  \return A \ref std::vector of job IDs in the order they were submitted.
+   */
+  std::vector<unsigned int> get_jobs();
+  
+  /*!
+   *  \brief Gets a snapshot of the state of the job with the given ID.
+   *  
+   *  Gets a snapshot of the state of the job with the given ID. If no job with
+   *  the given ID exists, an exception is thrown.
+   *  
+   *  \param [in] job_id The ID of the job.
+   *  
+   *  \return A \ref job_info struct describing the job.
+   */
+  job_info                  get_job_info(unsigned int job_id);
+  
+  /*!
+   *  \brief Gets a snapshot of the combined progress of all jobs.
+   *  
+   *  \return A \ref throughput_info struct describing all jobs.
+   */
+  throughput_info           get_throughput();
+  
+  /*!
+   *  \brief Gets a snapshot of the combined progress of some of the jobs.
+   *  
+   *  Same as \ref get_throughput(), but only counts the given jobs, e.g. the
+   *  jobs of a single batch. The elapsed time is that of the longest running
+   *  of the jobs, and the number of active devices is the number of the jobs
+   *  that are running.
+   *  
+   *  \param [in] job_ids The IDs of the jobs to count.
+   *  
+   *  \return A \ref throughput_info struct describing the jobs.
+   *  
+   *  \throws std::invalid_argument If any of the jobs does not exist.
+   */
+  throughput_info           get_throughput(const std::vector<unsigned int>& job_ids);
+  
+  /*!
+   *  \brief Cancels the job with the given ID.
+   *  
+   *  Cancels the job with the given ID. A queued job is removed from its
+   *  device's queue. A running job is asked to stop through its
+   *  \ref task_controller and has any read in flight aborted with
+   *  \ref linkmasta_device::abort_transfers(), but this function does not
+   *  wait for it to stop.
+   *  
+   *  \param [in] job_id The ID of the job to cancel.
+   */
+  void                      cancel_job(unsigned int job_id);
+  
+  /*!
+   *  \brief Cancels all unfinished jobs.
+   *  
+   *  \see cancel_job(unsigned int job_id)
+   */
+  void                      cancel_all_jobs();
+  
+  /*!
+   *  \brief Blocks until every submitted job has finished and its callback,
+   *         if any, has returned.
+   */
+  void                      wait_for_all_jobs();
+  
+  /*!
+   *  \brief Blocks until a job is queued or finishes, or until a timeout.
+   *  
+   *  Lets a caller following the jobs, such as \ref job_server, hear of
+   *  finished jobs right away without polling them constantly.
+   *  
+   *  \param [in,out] changes The number of changes the caller has seen, as
+   *         set by the previous call, or 0 at first. Set to the number of
+   *         changes when returning.
+   *  \param [in] timeout_ms The longest to wait in milliseconds.
+   *  
+   *  \return **true** if a job was queued or finished since the caller last
+   *          looked, **false** on timeout.
+   */
+  bool                      wait_for_job_change(unsigned long long& changes, unsigned int timeout_ms);
+  
+  /*!
+   *  \brief Gets the number of devices behind a shared hub that may run jobs
+   *         at once.
+   *  
+   *  \see set_max_jobs_per_hub(unsigned int max_jobs)
+   */
+  unsigned int              get_max_jobs_per_hub();
+  
+  /*!
+   *  \brief Sets the number of devices behind a shared hub that may run jobs
+   *         at once.
+   *  
+   *  Sets how many devices behind the same full-speed hub, as reported by
+   *  \ref device_manager::is_on_shared_hub(), may run jobs at the same time.
+   *  Running more would only split the hub's bandwidth between them. Jobs
+   *  that are already running are not affected.
+   *  
+   *  \param [in] max_jobs The number of jobs, or 0 for no limit.
+   */
+  void                      set_max_jobs_per_hub(unsigned int max_jobs);
+  
+  /*!
+   *  \brief Gives a job a plan of the work it will do.
+   *  
+   *  Gives a job a plan of the work it will do, such as one from
+   *  \ref operation_planner::plan_game(), so that its time can be estimated
+   *  before it runs. Once the job completes, the time it spent in each phase
+   *  is used to calibrate the estimates of later jobs on the same device.
+   *  
+   *  \param [in] job_id The ID of the job.
+   *  \param [in] plan The plan of the job.
+   *  
+   *  \throws std::invalid_argument If the job does not exist.
+   */
+  void                      set_job_plan(unsigned int job_id, const operation_planner::plan& plan);
+  
+  /*!
+   *  \brief Sets the priority of a job.
+   *  
+   *  Sets the priority of a job, moving it ahead of the waiting jobs of its
+   *  device with a lower priority. If the job only reads the cartridge, such
+   *  as a backup or a verification, and the job running on the device is
+   *  preemptible and of a lower priority, the running job is asked to stop at
+   *  its next block boundary and is queued again behind the job, so that it
+   *  resumes from its journal once the device gets to it. Jobs that write to
+   *  the cartridge, such as flashes, erases, and save restores, never
+   *  preempt another job. Should one run anyway while a job that yielded
+   *  waits, such as one of a higher priority submitted meanwhile, the
+   *  yielded job discards its journal and starts over. Other running jobs
+   *  are left to finish.
+   *  
+   *  \param [in] job_id The ID of the job.
+   *  \param [in] priority The priority of the job. Higher priorities run
+   *         first. Jobs are submitted with priority 0.
+   *  
+   *  \throws std::invalid_argument If the job does not exist.
+   */
+  void                      set_job_priority(unsigned int job_id, int priority);
+  
+  /*!
+   *  \brief Sets the history that erases are recorded in.
+   *  
+   *  Sets the history that the cartridges of jobs started from now on record
+   *  their erases in, keyed by the serial number of their device. Once a
+   *  cartridge is initialized, the erase timings of its device's estimates
+   *  are taken from the history where it has any.
+   *  
+   *  \param [in] history The history, or **nullptr** to stop recording. Must
+   *         outlive the jobs that use it.
+   */
+  void                      set_erase_history(erase_history* history);
+  
+  /*!
+   *  \brief Gets how worker threads are scheduled.
+   *  
+   *  \see set_io_thread_options(const io_thread_options& opts)
+   */
+  io_thread_options         get_io_thread_options();
+  
+  /*!
+   *  \brief Sets how worker threads are scheduled.
+   *  
+   *  Sets the priority and CPUs of the threads running each device's jobs,
+   *  see \ref configure_io_thread(). The CPUs are handed out in the order
+   *  the devices were first given a job. Each worker applies the options
+   *  before starting its next job, so running jobs are not affected.
+   *  
+   *  \param [in] opts How to schedule worker threads.
+   */
+  void                      set_io_thread_options(const io_thread_options& opts);
+  
+  /*!
+   *  \brief Gets the estimated seconds until a device finishes the jobs it
+   *         has been given.
+   *  
+   *  Adds up the estimated time of the device's queued jobs and the time left
+   *  of its running job. Jobs without a plan are not counted. Can be used to
+   *  give work that may run on any device to the least busy one.
+   *  
+   *  \param [in] device_id The ID of the device.
+   */
+  double                    get_estimated_backlog(unsigned int device_id);
+  
+  /*!
+   *  \brief Gets the rates a device's estimates are currently based on.
+   *  
+   *  \param [in] device_id The ID of the device.
+   */
+  operation_planner::rates  get_estimated_rates(unsigned int device_id);
+
+
+
+private:
+  
+  /*!
+   *  \brief Controller of a job that can also be asked to yield its device.
+   *  
+   *  Reports the task as cancelled while a yield is requested, so that a
+   *  preemptible job stops at its next block boundary the same way it does
+   *  when cancelled, leaving its journal behind. A task that ends cancelled
+   *  because of the yield is recorded as \ref task_status::NOT_STARTED. A task
+   *  that ends any other way, such as one that completed before noticing,
+   *  drops the request.
+   */
+  class job_controller : public task_controller
+  {
+  public:
+    
+    /*!
+     *  \brief Class constructor.
+     */
+                            job_controller();
+    
+    /*!
+     *  \brief Determines whether the task was cancelled or asked to yield.
+     *  
+     *  \see task_controller::is_task_cancelled()
+     */
+    bool                    is_task_cancelled() const;
+    
+    /*!
+     *  \see task_controller::on_task_end(task_status status, int work_total)
+     */
+    void                    on_task_end(task_status status, int work_total);
+    
+    /*!
+     *  \brief Determines whether the task was cancelled, not counting
+     *         requests to yield.
+     */
+    bool                    is_cancel_requested() const;
+    
+    /*! \brief Flag asking the task to stop so that it can be resumed later. */
+    std::atomic<bool>       yield_requested;
+    
+    /*! \brief Flag telling a task that yielded that its cartridge was
+     *         written to before it resumed, so its journal no longer holds. */
+    std::atomic<bool>       journal_stale;
+  };
+  
+  /*!
+   *  \brief Struct containing the scheduler's internal record of a job.
+   */
+  struct job
+  {
+    unsigned int            job_id;
+    unsigned int            device_id;
+    job_function            function;
+    job_callback            on_finished;
+    job_controller          controller;
+    bool                    started;
+    bool                    claimed;
+    bool                    finished;
+    bool                    result;
+    std::string             error;
+    std::shared_ptr<dump_hashes> hashes;
+    bool                    has_plan;
+    operation_planner::plan plan;
+    int                     priority;
+    bool                    preemptible;
+    bool                    writes_cartridge;
+    unsigned int            num_yields;
+  };
+  
+  /*!
+   *  \brief Struct containing a device's worker thread and job queue.
+   */
+  struct device_worker
+  {
+    std::thread             thread;
+    std::deque<job*>        queue;
+    bool                    busy;
+    job*                    running;
+    unsigned int            bus;
+    std::string             hub;
+    bool                    shared_hub;
+    
+    /*! \brief The order in which the device was first given a job, which
+     *         picks its CPU. */
+    unsigned int            index;
+    
+    /*! \brief The \ref m_io_generation the thread was last configured
+     *         for. */
+    unsigned int            io_generation;
+  };
+  
+  /*!
+   *  \brief Queues a job, recording the checksums it computes.
+   *  
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] function The function to run.
+   *  \param [in] hashes Filled in by the function with the checksums of the
+   *         data it backed up, or nullptr if it computes none.
+   *  \param [in] on_finished Called once the job has finished, or nullptr.
+   *  \param [in] preemptible Whether the function journals its progress, so
+   *         that it can be stopped at a block boundary when a job of higher
+   *         priority is waiting, and resumed later.
+   *  \param [in] writes_cartridge Whether the function may write to the
+   *         cartridge, in which case it never preempts a journaled job.
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \see submit_job(unsigned int device_id, job_function job)
+   */
+  unsigned int              queue_job(unsigned int device_id, job_function function, std::shared_ptr<dump_hashes> hashes, job_callback on_finished = nullptr, bool preemptible = false, bool writes_cartridge = true);
+  
+  /*!
+   *  \brief Places a job in its device's queue, behind the jobs of higher or
+   *         equal priority that were submitted before it. Must be called with
+   *         the lock held.
+   */
+  static void               enqueue_job(device_worker* worker, job* j);
+  
+  /*!
+   *  \brief Asks the job running on a device to yield if it is preemptible and
+   *         the device has a waiting job of higher priority. Must be called
+   *         with the lock held.
+   */
+  static void               preempt_if_needed(device_worker* worker);
+  
+  /*!
+   *  \brief Adds a job's counts and progress to a throughput snapshot. Must
+   *         be called with the lock held.
+   */
+  static void               add_job_throughput(const job* j, throughput_info& info);
+  
+  /*!
+   *  \brief Entry point of each device's worker thread.
+   *  
+   *  \param [in] device_id The ID of the device the worker serves.
+   */
+  void                      worker_function(unsigned int device_id);
+  
+  /*!
+   *  \brief Claims the job's device, runs the job, and releases the device.
+   *  
+   *  \param [in,out] j The job to run.
+   *  \param [out] result The value returned by the job.
+   *  \param [out] error Description of the error that ended the job, if any.
+   */
+  void                      run_job(job* j, bool& result, std::string& error);
+  
+  /*!
+   *  \brief Adds a finished job's outcome, duration, and throughput to the
+   *         metrics of its device.
+   *  
+   *  \param [in] j The finished job.
+   *  \param [in] result The value returned by the job.
+   */
+  void                      record_job_metrics(const job* j, bool result);
+  
+  /*!
+   *  \brief Checks whether a worker may start its next job without crowding
+   *         its hub or jumping ahead of a worker on a less busy bus. Must be
+   *         called with the lock held.
+   */
+  bool                      can_start(const device_worker* worker);
+  
+  /*!
+   *  \brief Checks whether a worker's hub has room for another job. Must be
+   *         called with the lock held.
+   */
+  bool                      hub_has_room(const device_worker* worker);
+  
+  /*!
+   *  \brief Estimates the seconds of work a device has left. Must be called
+   *         with the lock held.
+   *  
+   *  \see get_estimated_backlog(unsigned int device_id)
+   */
+  double                    estimated_backlog(unsigned int device_id);
+  
+  
+  
+  /*! \brief The device manager used to claim and release devices. */
+  device_manager* const     m_manager;
+  
+  /*! \brief All jobs submitted to this scheduler, indexed by ID. */
+  std::map<unsigned int, job*> m_jobs;
+  
+  /*! \brief Worker threads and queues, indexed by device ID. */
+  std::map<unsigned int, device_worker*> m_workers;
+  
+  /*! \brief The ID to give to the next submitted job. */
+  unsigned int              m_next_job_id;
+  
+  /*! \brief Number of submitted jobs that have not finished. */
+  unsigned int              m_num_unfinished;
+  
+  /*! \brief Number of callbacks of finished jobs that have not returned. */
+  unsigned int              m_num_callbacks;
+  
+  /*! \brief Number of times a job was queued or finished. */
+  unsigned long long        m_num_job_changes;
+  
+  /*! \brief Flag telling worker threads to exit once idle. */
+  bool                      m_stopping;
+  
+  /*! \brief Flag indicating that \ref m_start_time has been set. */
+  bool                      m_started;
+  
+  /*! \brief The time at which the first job started. */
+  std::chrono::steady_clock::time_point m_start_time;
+  
+  /*! \brief The number of jobs allowed to run behind each shared hub. */
+  unsigned int              m_max_jobs_per_hub;
+  
+  /*! \brief The number of running jobs behind each hub, by hub path. */
+  std::map<std::string, unsigned int> m_hub_jobs;
+  
+  /*! \brief The number of running jobs on each bus, by bus number. */
+  std::map<unsigned int, unsigned int> m_bus_jobs;
+  
+  /*! \brief Planners calibrated from each device's finished jobs, by device
+   *         ID. */
+  std::map<unsigned int, operation_planner> m_planners;
+  
+  /*! \brief History that erases are recorded in, or nullptr. */
+  erase_history*            m_erase_history;
+  
+  /*! \brief How worker threads are scheduled. */
+  io_thread_options         m_io_options;
+  
+  /*! \brief Incremented whenever \ref m_io_options changes, telling workers
+   *         to configure their threads again. */
+  unsigned int              m_io_generation;
+  
+  /*! \brief Thread running the callbacks of finished jobs, so that none of
+   *         them run on a worker thread. */
+  std::unique_ptr<task_pool> m_callbacks;
+  
+  /*! \brief Data lock used to make this class thread-safe. */
+  std::mutex                m_mutex;
+  
+  /*! \brief Condition used to wake worker threads and waiting callers. */
+  std::condition_variable   m_condition;
+};
+
+#endif /* defined(__DEVICE_JOB_SCHEDULER_H__) */
@@ -14,9 +14,11 @@
 
 #include "device_manager.h"
 
+#include <algorithm>
 #include <chrono>
 
 #include "common/log.h"
+#include "task/task_controller.h"
 #include "usb/usb_device.h"
 #include "ngp_linkmasta_device.h"
 #include "ws_linkmasta_device.h"
@@ -24,10 +26,14 @@
 using namespace std;
 using namespace usb;
 
+#define DEFAULT_REFRESH_INTERVAL_MS 1000
+
 
 
 device_manager::device_manager()
-  : m_thread_kill_flag(false), m_thread_dead(true), curr_id(0)
+  : m_thread_kill_flag(false), m_refresh_requested(false),
+    m_refresh_interval_ms(DEFAULT_REFRESH_INTERVAL_MS), m_thread_dead(true),
+    curr_id(0), m_next_listener_handle(0)
 {
   // Nothing else to do
 }
@@ -41,6 +47,34 @@ device_manager::~device_manager()
 
 
 
+bool device_manager::claim_device(unsigned int id, unsigned int timeout_ms, task_controller* controller)
+{
+  if (controller == nullptr)
+  {
+    return claim_device(id, timeout_ms);
+  }
+  
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+  while (!controller->is_task_cancelled())
+  {
+    unsigned int wait_ms = CLAIM_CANCEL_CHECK_INTERVAL_MS;
+    if (timeout_ms != CLAIM_TIMEOUT_INFINITE)
+    {
+      auto remaining = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+      if (remaining <= 0)
+      {
+        return false;
+      }
+      wait_ms = (unsigned int) min<long long>(wait_ms, remaining);
+    }
+    if (claim_device(id, wait_ms))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
 unsigned int device_manager::generate_id()
 {
   return curr_id++;
@@ -53,7 +87,6 @@ void device_manager::start_auto_refresh()
     m_thread_dead = false;
     m_thread_kill_flag = false;
     m_refresh_thread = thread(&device_manager::refresh_thread_function, this);
-    m_refresh_thread.detach();
   }
 }
 
@@ -61,7 +94,11 @@ void device_manager::stop_auto_refresh_and_wait()
 {
   log_start(log_level::DEBUG, "DeviceManager::stopAutoRefreshAndWait() {");
   
+  m_refresh_mutex.lock();
   m_thread_kill_flag = true;
+  m_refresh_condition.notify_all();
+  m_refresh_mutex.unlock();
+  
   if (m_refresh_thread.joinable())
   {
     log(log_level::DEBUG, "waiting to join refresh_thread");
@@ -76,6 +113,35 @@ void device_manager::stop_auto_refresh_and_wait()
   log_end("}");
 }
 
+void device_manager::request_refresh()
+{
+  m_refresh_mutex.lock();
+  m_refresh_requested = true;
+  m_refresh_condition.notify_all();
+  m_refresh_mutex.unlock();
+}
+
+void device_manager::set_refresh_interval(unsigned int interval_ms)
+{
+  m_refresh_mutex.lock();
+  m_refresh_interval_ms = interval_ms;
+  m_refresh_mutex.unlock();
+}
+
+unsigned int device_manager::add_device_listener(device_listener listener)
+{
+  lock_guard<mutex> lock(m_listeners_mutex);
+  unsigned int handle = m_next_listener_handle++;
+  m_listeners[handle] = listener;
+  return handle;
+}
+
+void device_manager::remove_device_listener(unsigned int handle)
+{
+  lock_guard<mutex> lock(m_listeners_mutex);
+  m_listeners.erase(handle);
+}
+
 linkmasta_device* device_manager::build_linkmasta_device(usb::usb_device* device)
 {
   device->init();
@@ -104,27 +170,101 @@ linkmasta_device* device_manager::build_linkmasta_device(usb::usb_device* device
 
 
 
+void device_manager::notify_device_listeners(unsigned int id, bool connected)
+{
+  lock_guard<mutex> lock(m_listeners_mutex);
+  for (auto& entry : m_listeners)
+  {
+    try
+    {
+      entry.second(id, connected);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Do nothing, fail silently
+    }
+  }
+}
+
+void device_manager::close_idle_devices()
+{
+  for (unsigned int id : get_connected_devices())
+  {
+    try
+    {
+      if (!try_claim_device(id))
+      {
+        // In use, so try again on the next refresh
+        continue;
+      }
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Device went away
+      continue;
+    }
+    
+    try
+    {
+      linkmasta_device* linkmasta = get_linkmasta_device(id);
+      if (linkmasta != nullptr)
+      {
+        linkmasta->close_if_idle();
+      }
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Do nothing, fail silently
+    }
+    
+    try
+    {
+      release_device(id);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Do nothing, fail silently
+    }
+  }
+}
+
+
+
 void device_manager::refresh_thread_function()
 {
+  unique_lock<mutex> lock(m_refresh_mutex);
+  
   // Set target time to refresh
   auto target_time = chrono::steady_clock::now();
-  target_time += chrono::seconds(1);
+  target_time += chrono::milliseconds(m_refresh_interval_ms);
   
   // Loop as long as object exists
   while (!m_thread_kill_flag)
   {
-    // Only execute if we've reached our target time
-    if (chrono::steady_clock::now() < target_time)
+    // Sleep until our target time or until someone asks for a refresh
+    m_refresh_condition.wait_until(lock, target_time, [this]
     {
-      continue;
+      return m_thread_kill_flag || m_refresh_requested;
+    });
+    if (m_thread_kill_flag)
+    {
+      break;
     }
+    m_refresh_requested = false;
     
-    // Make call to child
+    // Make call to child without holding the lock so it can request refreshes
+    lock.unlock();
     refresh_device_list();
+    close_idle_devices();
+    lock.lock();
     
     // Update refresh timer
-    target_time = target_time = chrono::steady_clock::now();
-    target_time += chrono::seconds(1);
+    target_time = chrono::steady_clock::now();
+    target_time += chrono::milliseconds(m_refresh_interval_ms);
   }
   
   m_thread_dead = true;
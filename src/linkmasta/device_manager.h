@@ -13,6 +13,9 @@
 #ifndef __DEVICE_MANAGER_H__
 #define __DEVICE_MANAGER_H__
 
+#include <condition_variable>
+#include <functional>
+#include <map>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -21,6 +24,22 @@ namespace usb {
 class usb_device;
 }
 class linkmasta_device;
+class task_controller;
+
+/*! \brief Timeout for \ref device_manager::claim_device() that never expires. */
+#define CLAIM_TIMEOUT_INFINITE ((unsigned int) -1)
+
+/*! \brief How often a claim waiting on behalf of a task checks whether the
+ *         task was cancelled, in milliseconds. */
+#define CLAIM_CANCEL_CHECK_INTERVAL_MS 100
+
+/*!
+ *  \brief Function called when a device is connected or disconnected.
+ *  
+ *  The first argument is the ID of the device, and the second is true if the
+ *  device was connected or false if it was disconnected.
+ */
+typedef std::function<void(unsigned int, bool)> device_listener;
 
 
 
@@ -180,6 +199,43 @@ public:
    */
   virtual std::string               get_serial_number(unsigned int id) = 0;
   
+  /*!
+   *  \brief Gets the number of the USB bus, i.e. the host controller, the
+   *         \ref linkmasta_device with the given ID is attached to.
+   *  
+   *  \param [in] id The ID number of the device to fetch the information for.
+   *         Must be a valid ID number of a connected \ref linkamsta_device.
+   */
+  virtual unsigned int              get_bus_number(unsigned int id) = 0;
+  
+  /*!
+   *  \brief Gets the path of ports leading to the \ref linkmasta_device with
+   *         the given ID.
+   *  
+   *  Gets the chain of hub ports between the host controller and the device,
+   *  in the form "bus-port.port.port". Devices whose paths only differ in the
+   *  last port sit behind the same hub.
+   *  
+   *  \param [in] id The ID number of the device to fetch the information for.
+   *         Must be a valid ID number of a connected \ref linkamsta_device.
+   *  
+   *  \return The path of the device, or an empty string if unknown.
+   */
+  virtual std::string               get_port_path(unsigned int id) = 0;
+  
+  /*!
+   *  \brief Gets whether the \ref linkmasta_device with the given ID shares
+   *         its hub's bandwidth with the other devices behind that hub.
+   *  
+   *  A full-speed hub, or a full-speed port of the host controller, gives all
+   *  of its devices a single full-speed link between them, while a high-speed
+   *  hub gives each full-speed device its own.
+   *  
+   *  \param [in] id The ID number of the device to fetch the information for.
+   *         Must be a valid ID number of a connected \ref linkamsta_device.
+   */
+  virtual bool                      is_on_shared_hub(unsigned int id) = 0;
+  
   /*!
    *  \brief Gets a pointer to a \ref linkamsta_device object that can be used
    *         to interact with the device.
@@ -236,6 +292,56 @@ public:
    */
   virtual bool                      try_claim_device(unsigned int id) = 0;
   
+  /*!
+   *  \brief Claims the desired \ref linkmasta_device that has the provided ID,
+   *         waiting for it to be released if it is already claimed.
+   *  
+   *  Claims the desired \ref linkmasta_device that has the provided ID. If the
+   *  device is already claimed, then the calling thread sleeps until it is
+   *  released or until the timeout expires. Callers waiting on the same device
+   *  are served in the order in which they started waiting, and
+   *  \ref try_claim_device(unsigned int) never claims a device ahead of them.
+   *  
+   *  \param [in] id The ID number of the device to claim. Must be a valid ID
+   *         number of a connected \ref linkmasta_device.
+   *  \param [in] timeout_ms The maximum number of milliseconds to wait, or
+   *         \ref CLAIM_TIMEOUT_INFINITE to wait for as long as it takes.
+   *  
+   *  \return true if this function successfully claimed the device, false if
+   *          the timeout expired first.
+   *  
+   *  \throws std::invalid_argument If no device with the provided ID exists,
+   *          or if the device is disconnected while waiting.
+   */
+  virtual bool                      claim_device(unsigned int id, unsigned int timeout_ms) = 0;
+  
+  /*!
+   *  \brief Claims a device on behalf of a task, waiting until it is released
+   *         or the task is cancelled.
+   *  
+   *  Claims the device like \ref claim_device(unsigned int, unsigned int),
+   *  but also gives up when the task is cancelled, which is checked every
+   *  \ref CLAIM_CANCEL_CHECK_INTERVAL_MS. The caller keeps its place in line
+   *  for the whole wait, so a task waiting this way is served in turn however
+   *  long it waits.
+   *  
+   *  The default implementation calls
+   *  \ref claim_device(unsigned int, unsigned int) once per interval.
+   *  
+   *  \param [in] id The ID number of the device to claim.
+   *  \param [in] timeout_ms The maximum number of milliseconds to wait, or
+   *         \ref CLAIM_TIMEOUT_INFINITE to wait for as long as it takes.
+   *  \param [in] controller The controller of the task. **nullptr** is an
+   *         accepted value, in which case the claim is never cancelled.
+   *  
+   *  \return true if this function successfully claimed the device, false if
+   *          the timeout expired or the task was cancelled first.
+   *  
+   *  \throws std::invalid_argument If no device with the provided ID exists,
+   *          or if the device is disconnected while waiting.
+   */
+  virtual bool                      claim_device(unsigned int id, unsigned int timeout_ms, task_controller* controller);
+  
   /*!
    *  \brief Releases the claim on the \ref linkmasta_device that has the
    *         provided ID.
@@ -250,6 +356,48 @@ public:
    */
   virtual void                      release_device(unsigned int id) = 0;
   
+  /*!
+   *  \brief Asks the auto-refresh thread to refresh the device list as soon as
+   *         possible.
+   *  
+   *  Wakes the auto-refresh thread so that it calls
+   *  \ref refresh_device_list() without waiting for the refresh interval to
+   *  elapse. This function does not block and is safe to call from any thread,
+   *  including from within USB event callbacks.
+   */
+  void                              request_refresh();
+  
+  /*!
+   *  \brief Registers a function to be called whenever a device is connected
+   *         or disconnected.
+   *  
+   *  Registers a function to be called whenever a device is connected or
+   *  disconnected, so that interested parties don't have to poll the
+   *  connected device list. Listeners are called from the auto-refresh thread
+   *  after the device list has been updated, one at a time. They should return
+   *  quickly and must not add or remove listeners themselves.
+   *  
+   *  Devices that were already connected when the listener was added are not
+   *  reported, so callers should read \ref get_connected_devices() once after
+   *  adding a listener.
+   *  
+   *  \param [in] listener The function to call.
+   *  
+   *  \return A handle that can be passed to \ref remove_device_listener().
+   */
+  unsigned int                      add_device_listener(device_listener listener);
+  
+  /*!
+   *  \brief Unregisters a function added with \ref add_device_listener().
+   *  
+   *  Unregisters a function added with \ref add_device_listener(). Once this
+   *  function returns, the listener is not being called and will not be
+   *  called again.
+   *  
+   *  \param [in] handle The handle returned when the listener was added.
+   */
+  void                              remove_device_listener(unsigned int handle);
+  
   
   
 protected:
@@ -298,6 +446,21 @@ protected:
    */
   void                              stop_auto_refresh_and_wait();
   
+  /*!
+   *  \brief Sets the interval at which the auto-refresh thread refreshes the
+   *         device list when no refresh has been requested.
+   *  
+   *  Sets the interval at which the auto-refresh thread calls
+   *  \ref refresh_device_list() when no refresh has been requested through
+   *  \ref request_refresh(). Implementations that are notified of device
+   *  connections and disconnections can use a long interval as a fallback.
+   *  The new interval takes effect after the next refresh. Defaults to 1000
+   *  milliseconds.
+   *  
+   *  \param [in] interval_ms The new interval in milliseconds.
+   */
+  void                              set_refresh_interval(unsigned int interval_ms);
+  
   /*!
    *  \brief Polls connected devices to test for new connections or disconnected
    *         devices and updates any member variables to track these changes.
@@ -307,6 +470,15 @@ protected:
    */
   virtual void                      refresh_device_list() = 0;
   
+  /*!
+   *  \brief Closes every device that has been left open by a
+   *         \ref linkmasta_device::session for longer than its idle timeout.
+   *  
+   *  Called by the auto-refresh thread after every refresh. Devices that are
+   *  currently claimed are skipped until the next refresh.
+   */
+  void                              close_idle_devices();
+  
   /*!
    *  \brief Constructs a \ref linkmasta_device object using the provided
    *         \ref usb::usb_device object as a handle.
@@ -321,6 +493,16 @@ protected:
    */
   static linkmasta_device*          build_linkmasta_device(usb::usb_device* device);
   
+  /*!
+   *  \brief Calls every registered listener to report that a device was
+   *         connected or disconnected.
+   *  
+   *  \param [in] id The ID of the device.
+   *  \param [in] connected true if the device was connected, false if it was
+   *         disconnected.
+   */
+  void                              notify_device_listeners(unsigned int id, bool connected);
+  
   
   
 private:
@@ -348,6 +530,18 @@ private:
   /*! \brief Flag telling the device refreshing thread to complete. */
   bool                              m_thread_kill_flag;
   
+  /*! \brief Flag telling the device refreshing thread to refresh early. */
+  bool                              m_refresh_requested;
+  
+  /*! \brief Interval in milliseconds between unrequested refreshes. */
+  unsigned int                      m_refresh_interval_ms;
+  
+  /*! \brief Lock protecting the refresh thread's flags. */
+  std::mutex                        m_refresh_mutex;
+  
+  /*! \brief Condition used to wake the device refreshing thread. */
+  std::condition_variable           m_refresh_condition;
+  
   /*! \brief Flag indicating that the device refreshing thread has completed. */
   bool                              m_thread_dead;
   
@@ -356,6 +550,18 @@ private:
    *         \ref generate_id().
    */
   unsigned int                      curr_id;
+  
+  /*! \brief Registered device listeners, indexed by handle. */
+  std::map<unsigned int, device_listener> m_listeners;
+  
+  /*! \brief The handle to give the next listener that is added. */
+  unsigned int                      m_next_listener_handle;
+  
+  /*!
+   *  \brief Lock protecting \ref m_listeners, held while listeners are
+   *         called.
+   */
+  std::mutex                        m_listeners_mutex;
 };
 
 #endif /* defined(__DEVICE_MANAGER_H__) */
@@ -0,0 +1,197 @@
+/*! \file
+ *  \brief File containing the implementation of \ref device_multiplexer.
+ *  
+ *  File containing the implementation of \ref device_multiplexer.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-29
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "device_multiplexer.h"
+
+#include "device_manager.h"
+#include "linkmasta_device.h"
+
+using namespace std;
+
+
+
+device_multiplexer::device_multiplexer(device_manager* manager)
+  : m_manager(manager), m_stopping(false)
+{
+  // Nothing else to do
+}
+
+device_multiplexer::~device_multiplexer()
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_stopping = true;
+    m_condition.notify_all();
+  }
+  
+  for (auto& queue_pair : m_queues)
+  {
+    queue_pair.second->thread.join();
+  }
+}
+
+
+
+std::shared_future<usb::result<bool>> device_multiplexer::probe_for_cartridge(unsigned int device_id)
+{
+  // A job can only be running on a cartridge that's there
+  if (is_job_running(device_id))
+  {
+    promise<usb::result<bool>> answer;
+    answer.set_value(usb::result<bool>::success(true));
+    return answer.get_future().share();
+  }
+  
+  return submit(device_id, [](linkmasta_device* linkmasta)
+  {
+    return linkmasta->try_probe_for_cartridge();
+  }, MULTIPLEXER_PROBE_KEY);
+}
+
+void device_multiplexer::begin_job(unsigned int device_id)
+{
+  {
+    unique_lock<mutex> lock(m_mutex);
+    device_queue& queue = queue_for(device_id);
+    
+    // Keeps the thread from starting on another request meanwhile
+    ++queue.jobs_waiting;
+    m_condition.wait(lock, [&queue] { return !queue.running && !queue.job_running; });
+    --queue.jobs_waiting;
+    queue.job_running = true;
+  }
+  
+  try
+  {
+    m_manager->claim_device(device_id, CLAIM_TIMEOUT_INFINITE);
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    lock_guard<mutex> lock(m_mutex);
+    queue_for(device_id).job_running = false;
+    m_condition.notify_all();
+    throw;
+  }
+}
+
+void device_multiplexer::end_job(unsigned int device_id)
+{
+  m_manager->release_device(device_id);
+  
+  lock_guard<mutex> lock(m_mutex);
+  queue_for(device_id).job_running = false;
+  m_condition.notify_all();
+}
+
+bool device_multiplexer::is_job_running(unsigned int device_id)
+{
+  lock_guard<mutex> lock(m_mutex);
+  auto it = m_queues.find(device_id);
+  return (it != m_queues.end() && it->second->job_running);
+}
+
+
+
+device_multiplexer::job::job(device_multiplexer* multiplexer, unsigned int device_id)
+  : m_multiplexer(multiplexer), m_device_id(device_id)
+{
+  m_multiplexer->begin_job(m_device_id);
+}
+
+device_multiplexer::job::~job()
+{
+  m_multiplexer->end_job(m_device_id);
+}
+
+
+
+device_multiplexer::device_queue& device_multiplexer::queue_for(unsigned int device_id)
+{
+  unique_ptr<device_queue>& queue = m_queues[device_id];
+  if (queue == nullptr)
+  {
+    queue.reset(new device_queue);
+    queue->running = false;
+    queue->jobs_waiting = 0;
+    queue->job_running = false;
+    queue->thread = thread(&device_multiplexer::thread_function, this, device_id, queue.get());
+  }
+  return *queue;
+}
+
+void device_multiplexer::thread_function(unsigned int device_id, device_queue* queue)
+{
+  unique_lock<mutex> lock(m_mutex);
+  while (true)
+  {
+    m_condition.wait(lock, [this, queue]
+    {
+      return (m_stopping && queue->requests.empty())
+          || (!queue->requests.empty() && !queue->job_running && queue->jobs_waiting == 0);
+    });
+    if (queue->requests.empty())
+    {
+      return;
+    }
+    queue->running = true;
+    lock.unlock();
+    
+    // Claim and open the device once for every request queued. If that
+    // fails, every request fails the same way
+    bool claimed = false;
+    linkmasta_device* linkmasta = nullptr;
+    unique_ptr<linkmasta_device::session> session;
+    exception_ptr error;
+    try
+    {
+      m_manager->claim_device(device_id, CLAIM_TIMEOUT_INFINITE);
+      claimed = true;
+      linkmasta = m_manager->get_linkmasta_device(device_id);
+      session.reset(new linkmasta_device::session(linkmasta));
+    }
+    catch (...)
+    {
+      error = current_exception();
+    }
+    
+    // Hand the device over as soon as a job asks for it
+    lock.lock();
+    while (!queue->requests.empty() && (queue->jobs_waiting == 0 || error != nullptr))
+    {
+      queued_request request = queue->requests.front();
+      queue->requests.pop_front();
+      
+      // Whoever asks from now on gets an answer read after this one
+      if (!request.merge_key.empty())
+      {
+        queue->merged.erase(request.merge_key);
+      }
+      
+      lock.unlock();
+      request.run(linkmasta, error);
+      lock.lock();
+    }
+    lock.unlock();
+    
+    session.reset();
+    if (claimed)
+    {
+      m_manager->release_device(device_id);
+    }
+    
+    lock.lock();
+    queue->running = false;
+    m_condition.notify_all();
+  }
+}
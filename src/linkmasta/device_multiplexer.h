@@ -0,0 +1,304 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref device_multiplexer
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref device_multiplexer class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-29
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __DEVICE_MULTIPLEXER_H__
+#define __DEVICE_MULTIPLEXER_H__
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+#include "usb/usb_result.h"
+
+class device_manager;
+class linkmasta_device;
+
+/*! \brief Merge key of the requests made by
+ *         \ref device_multiplexer::probe_for_cartridge(). */
+#define MULTIPLEXER_PROBE_KEY "probe"
+
+
+
+/*! \class device_multiplexer
+ *  \brief Class serializing the short requests of many clients to each
+ *         device through a single queue.
+ *  
+ *  Class taking requests to talk to a device, such as polling it for a
+ *  cartridge, reading metadata, or fetching a page of memory, from any number
+ *  of clients and running them one after the other on a thread of the
+ *  device's own. The thread claims the device and holds a
+ *  \ref linkmasta_device::session for as long as it has requests queued, so
+ *  a burst of requests sets up the device once, and no request is skipped
+ *  because another client happened to have the device claimed.
+ *  
+ *  Requests given the same merge key while one of them is still queued are
+ *  run once, and every client gets the same result. Long operations such as
+ *  flashing a cartridge take the device outside of the queue with
+ *  \ref begin_job(). The thread hands the device over as soon as the request
+ *  it is running returns, and queued requests wait until \ref end_job() is
+ *  called, except for \ref probe_for_cartridge(), which is answered from the
+ *  job right away since a job can only run on a cartridge that is there.
+ *  
+ *  This class is thread-safe.
+ */
+class device_multiplexer
+{
+public:
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in] manager The manager of the devices. Must outlive the
+   *         multiplexer.
+   */
+  explicit                device_multiplexer(device_manager* manager);
+  
+  /*!
+   *  \brief Class destructor. Runs every queued request, then stops the
+   *         threads.
+   *  
+   *  No job may be running.
+   */
+                          ~device_multiplexer();
+  
+  
+  
+  /*!
+   *  \brief Queues a request to run on a device.
+   *  
+   *  Queues a function to run with the device claimed and open. If the device
+   *  could not be claimed or opened, the function isn't run and the result
+   *  receives the exception instead.
+   *  
+   *  \param [in] device_id The ID of the device.
+   *  \param [in] request The function to run. Takes the device's
+   *         \ref linkmasta_device.
+   *  \param [in] merge_key If not empty, a name for what the request asks,
+   *         such as "firmware-version". A request with the same key that is
+   *         still queued is run in its place, so requests with the same key
+   *         must return the same type.
+   *  
+   *  \return A future that receives the result of the request, or the
+   *          exception it threw.
+   */
+  template<typename F>
+  std::shared_future<typename std::result_of<F(linkmasta_device*)>::type> submit(unsigned int device_id, F request, const std::string& merge_key = std::string())
+  {
+    typedef typename std::result_of<F(linkmasta_device*)>::type result_type;
+    typedef std::shared_future<result_type> future_type;
+    
+    std::lock_guard<std::mutex> lock(m_mutex);
+    device_queue& queue = queue_for(device_id);
+    if (!merge_key.empty())
+    {
+      auto it = queue.merged.find(merge_key);
+      if (it != queue.merged.end())
+      {
+        return *std::static_pointer_cast<future_type>(it->second);
+      }
+    }
+    
+    // std::function needs a copyable target, so share the task. A device
+    // that failed to open is passed on as the exception to rethrow
+    std::shared_ptr<std::packaged_task<result_type(linkmasta_device*, std::exception_ptr)>> task =
+      std::make_shared<std::packaged_task<result_type(linkmasta_device*, std::exception_ptr)>>(
+        [request](linkmasta_device* linkmasta, std::exception_ptr error) -> result_type
+        {
+          if (error != nullptr)
+          {
+            std::rethrow_exception(error);
+          }
+          return request(linkmasta);
+        });
+    std::shared_ptr<future_type> result = std::make_shared<future_type>(task->get_future().share());
+    
+    queued_request queued;
+    queued.merge_key = merge_key;
+    queued.run = [task](linkmasta_device* linkmasta, std::exception_ptr error) { (*task)(linkmasta, error); };
+    queue.requests.push_back(queued);
+    if (!merge_key.empty())
+    {
+      queue.merged[merge_key] = result;
+    }
+    m_condition.notify_all();
+    return *result;
+  }
+  
+  /*!
+   *  \brief Quickly checks a device for a connected cartridge.
+   *  
+   *  Queues a call to \ref linkmasta_device::try_probe_for_cartridge(),
+   *  merged with any other queued under \ref MULTIPLEXER_PROBE_KEY. While a
+   *  job is running on the device, answers that a cartridge is connected
+   *  without queuing anything.
+   *  
+   *  \param [in] device_id The ID of the device.
+   *  
+   *  \return A future that receives whether a cartridge is likely connected,
+   *          or how the probe failed.
+   */
+  std::shared_future<usb::result<bool>> probe_for_cartridge(unsigned int device_id);
+  
+  /*!
+   *  \brief Takes a device out of the queue for a long operation.
+   *  
+   *  Waits for the request running on the device, if any, to return, then
+   *  claims the device for the caller. Queued requests wait until
+   *  \ref end_job() is called.
+   *  
+   *  \param [in] device_id The ID of the device.
+   *  
+   *  \throws std::invalid_argument If no device with the given id exists.
+   */
+  void                    begin_job(unsigned int device_id);
+  
+  /*!
+   *  \brief Hands a device taken by \ref begin_job() back to the queue.
+   *  
+   *  \param [in] device_id The ID of the device.
+   */
+  void                    end_job(unsigned int device_id);
+  
+  /*!
+   *  \brief Determines whether a job taken with \ref begin_job() is running
+   *         on a device.
+   *  
+   *  \param [in] device_id The ID of the device.
+   */
+  bool                    is_job_running(unsigned int device_id);
+  
+  
+  
+  /*! \class job
+   *  \brief Lease calling \ref begin_job() when constructed and
+   *         \ref end_job() when destroyed.
+   */
+  class job
+  {
+  public:
+    
+    /*!
+     *  \brief Class constructor. Takes the device out of the queue.
+     *  
+     *  \param [in] multiplexer The multiplexer of the device. Must outlive
+     *         the job.
+     *  \param [in] device_id The ID of the device.
+     *  
+     *  \see device_multiplexer::begin_job()
+     */
+                          job(device_multiplexer* multiplexer, unsigned int device_id);
+    
+    /*!
+     *  \brief Class destructor. Hands the device back to the queue.
+     */
+                          ~job();
+  
+  private:
+    job(const job& other) = delete;
+    job& operator=(const job& other) = delete;
+    
+    /*! \brief The multiplexer of the device. */
+    device_multiplexer*   m_multiplexer;
+    
+    /*! \brief The ID of the device. */
+    unsigned int          m_device_id;
+  };
+
+
+
+private:
+  
+  /*!
+   *  \brief Struct describing a single queued request.
+   */
+  struct queued_request
+  {
+    /*! \brief The key the request may be merged on, or empty. */
+    std::string           merge_key;
+    
+    /*! \brief Runs the request, or fails it with the given exception. */
+    std::function<void(linkmasta_device*, std::exception_ptr)> run;
+  };
+  
+  /*!
+   *  \brief Struct containing the queue of a single device.
+   */
+  struct device_queue
+  {
+    /*! \brief Requests waiting to run, first to run first. */
+    std::deque<queued_request> requests;
+    
+    /*! \brief The results of queued requests by merge key, each a
+     *         std::shared_future of the type the request returns. */
+    std::map<std::string, std::shared_ptr<void>> merged;
+    
+    /*! \brief Whether the device's thread has the device claimed. */
+    bool                  running;
+    
+    /*! \brief The number of callers waiting in \ref begin_job(). */
+    unsigned int          jobs_waiting;
+    
+    /*! \brief Whether a job has the device. */
+    bool                  job_running;
+    
+    /*! \brief The thread running the requests. */
+    std::thread           thread;
+  };
+  
+  /*!
+   *  \brief Gets the queue of a device, starting its thread if it has none
+   *         yet. Must be called with the lock held.
+   */
+  device_queue&           queue_for(unsigned int device_id);
+  
+  /*!
+   *  \brief Function run by the thread of each device.
+   */
+  void                    thread_function(unsigned int device_id, device_queue* queue);
+  
+  /*!
+   *  \brief Disabled copy constructor.
+   */
+                          device_multiplexer(const device_multiplexer& other) = delete;
+  
+  /*!
+   *  \brief Disabled copy assignment operator.
+   */
+  device_multiplexer&     operator=(const device_multiplexer& other) = delete;
+  
+  
+  
+  /*! \brief The manager of the devices. */
+  device_manager* const   m_manager;
+  
+  /*! \brief The queue of every device asked for so far, by ID. */
+  std::map<unsigned int, std::unique_ptr<device_queue>> m_queues;
+  
+  /*! \brief Flag telling the threads to stop once their queues are empty. */
+  bool                    m_stopping;
+  
+  /*! \brief Mutex guarding every member. */
+  std::mutex              m_mutex;
+  
+  /*! \brief Condition signalled whenever a queue or job changes. */
+  std::condition_variable m_condition;
+};
+
+#endif /* defined(__DEVICE_MULTIPLEXER_H__) */
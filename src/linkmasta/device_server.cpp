@@ -0,0 +1,721 @@
+/*! \file
+ *  \brief File containing the implementation of \ref device_server.
+ *  
+ *  File containing the implementation of \ref device_server.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see device_server
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-23
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "device_server.h"
+#include "libusb_device_manager.h"
+#include "common/log.h"
+#include "usb/usb.h"
+#include <stdexcept>
+
+using namespace std;
+
+
+
+device_server::device_server(libusb_device_manager* manager, unsigned short port, bool loopback_only)
+  : m_manager(manager), m_port(port), m_loopback_only(loopback_only), m_stopping(false)
+{
+  // Nothing else to do
+}
+
+device_server::~device_server()
+{
+  stop();
+}
+
+void device_server::start()
+{
+  if (m_thread.joinable())
+  {
+    return;
+  }
+  
+  m_socket.listen(m_port, m_loopback_only);
+  m_stopping = false;
+  m_thread = std::thread(&device_server::serve, this);
+}
+
+void device_server::stop()
+{
+  if (!m_thread.joinable())
+  {
+    return;
+  }
+  
+  m_stopping = true;
+  m_thread.join();
+  m_socket.close();
+  
+  // Disconnecting the clients wakes their threads up
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (connection* c : m_connections)
+    {
+      c->socket.shutdown();
+    }
+  }
+  reap_connections(true);
+}
+
+unsigned int device_server::num_connections()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return (unsigned int) m_connections.size();
+}
+
+
+
+void device_server::serve()
+{
+  while (!m_stopping)
+  {
+    reap_connections(false);
+    
+    connection* c = new connection;
+    if (!m_socket.accept(c->socket, DEVICE_SERVER_POLL_MS))
+    {
+      delete c;
+      continue;
+    }
+    
+    c->closed = false;
+    c->finished = false;
+    c->abort_generation = 0;
+    c->usb = nullptr;
+    c->device_id = 0;
+    c->session = nullptr;
+    c->timeout = 0;
+    c->failed = false;
+    c->failure_status = DEVICE_SERVER_OK;
+    c->failure_timeout = 0;
+    
+    lock_guard<mutex> lock(m_mutex);
+    m_connections.push_back(c);
+    c->reader = std::thread(&device_server::read_requests, this, c);
+    c->worker = std::thread(&device_server::run_requests, this, c);
+  }
+}
+
+void device_server::reap_connections(bool all)
+{
+  vector<connection*> finished;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (auto it = m_connections.begin(); it != m_connections.end();)
+    {
+      bool done;
+      {
+        lock_guard<mutex> connection_lock((*it)->mutex);
+        done = (*it)->finished;
+      }
+      
+      if (all || done)
+      {
+        finished.push_back(*it);
+        it = m_connections.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+  
+  for (connection* c : finished)
+  {
+    c->reader.join();
+    c->worker.join();
+    delete c;
+  }
+}
+
+
+
+void device_server::read_requests(connection* c)
+{
+  try
+  {
+    while (true)
+    {
+      request r;
+      r.frame.receive(c->socket);
+      
+      lock_guard<mutex> lock(c->mutex);
+      if (r.frame.type == DEVICE_SERVER_ABORT)
+      {
+        // Everything already queued is abandoned along with the transfers in
+        // flight, which the USB device allows aborting from any thread
+        ++c->abort_generation;
+        if (c->usb != nullptr)
+        {
+          c->usb->abort_pending_transfers();
+        }
+        continue;
+      }
+      
+      r.abort_generation = c->abort_generation;
+      c->queue.push_back(std::move(r));
+      c->condition.notify_all();
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // The client disconnected
+  }
+  
+  lock_guard<mutex> lock(c->mutex);
+  c->closed = true;
+  c->condition.notify_all();
+}
+
+void device_server::run_requests(connection* c)
+{
+  unique_lock<mutex> lock(c->mutex);
+  bool keep_going = true;
+  while (keep_going)
+  {
+    c->condition.wait(lock, [c] { return c->closed || !c->queue.empty(); });
+    if (c->queue.empty())
+    {
+      break;
+    }
+    
+    // Run everything that has arrived as one batch, so that the transfers in
+    // it can be queued with the device together
+    deque<request> batch;
+    batch.swap(c->queue);
+    lock.unlock();
+    
+    try
+    {
+      for (request& r : batch)
+      {
+        if (!run_request(c, r))
+        {
+          keep_going = false;
+          break;
+        }
+      }
+      complete_transfers(c);
+      flush(c);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // The client is gone or broke the protocol
+      keep_going = false;
+    }
+    
+    lock.lock();
+  }
+  lock.unlock();
+  
+  close_device(c);
+  c->socket.shutdown();
+  
+  lock.lock();
+  c->finished = true;
+}
+
+
+
+bool device_server::run_request(connection* c, request& r)
+{
+  device_server_frame& frame = r.frame;
+  switch (frame.type)
+  {
+  case DEVICE_SERVER_HELLO:
+  {
+    bool compatible = (frame.get_u32() == DEVICE_SERVER_MAGIC && frame.get_u32() == DEVICE_SERVER_PROTOCOL_VERSION);
+    device_server_frame reply(DEVICE_SERVER_HELLO);
+    reply.put_u32(DEVICE_SERVER_MAGIC);
+    reply.put_u32(DEVICE_SERVER_PROTOCOL_VERSION);
+    reply.encode(c->out);
+    if (!compatible)
+    {
+      flush(c);
+    }
+    return compatible;
+  }
+  
+  case DEVICE_SERVER_LIST:
+    list_devices(c);
+    return true;
+  
+  case DEVICE_SERVER_OPEN:
+    open_device(c, frame.get_u32());
+    return true;
+  
+  case DEVICE_SERVER_CLOSE:
+  {
+    complete_transfers(c);
+    device_server_frame reply(DEVICE_SERVER_CLOSE);
+    reply.put_status(c->failed ? c->failure_status : (unsigned int) DEVICE_SERVER_OK, c->failure_timeout, c->failure_message);
+    reply.encode(c->out);
+    flush(c);
+    return false;
+  }
+  
+  case DEVICE_SERVER_WRITE:
+  case DEVICE_SERVER_READ:
+  {
+    bool aborted;
+    {
+      lock_guard<mutex> lock(c->mutex);
+      aborted = (r.abort_generation != c->abort_generation);
+    }
+    if (aborted && !c->failed)
+    {
+      c->failed = true;
+      c->failure_status = DEVICE_SERVER_INTERRUPTED;
+      c->failure_timeout = c->timeout;
+      c->failure_message = "Transfer aborted";
+      fail_pending(c);
+    }
+    transfer(c, r);
+    return true;
+  }
+  
+  case DEVICE_SERVER_RECOVER:
+  {
+    complete_transfers(c);
+    bool recovered = false;
+    if (c->session != nullptr)
+    {
+      try
+      {
+        recovered = c->usb->recover();
+      }
+      catch (std::exception& ex)
+      {
+        (void) ex;
+        // Leave the connection marked as unrecoverable
+      }
+    }
+    c->failed = !recovered;
+    device_server_frame reply(DEVICE_SERVER_RECOVER);
+    reply.put_status(DEVICE_SERVER_OK);
+    reply.put_u8(recovered ? 1 : 0);
+    reply.encode(c->out);
+    flush(c);
+    return true;
+  }
+  
+  default:
+    throw std::runtime_error("Unknown device server message " + std::to_string(frame.type));
+  }
+}
+
+void device_server::list_devices(connection* c)
+{
+  device_server_frame reply(DEVICE_SERVER_LIST);
+  vector<device_server_frame> entries;
+  for (unsigned int id : m_manager->get_connected_devices())
+  {
+    device_server_frame entry;
+    try
+    {
+      entry.put_u32(id);
+      entry.put_u32(m_manager->get_vendor_id(id));
+      entry.put_u32(m_manager->get_product_id(id));
+      entry.put_u32(m_manager->get_bus_number(id));
+      entry.put_u8(m_manager->is_on_shared_hub(id) ? 1 : 0);
+      entry.put_string(m_manager->get_manufacturer_string(id));
+      entry.put_string(m_manager->get_product_string(id));
+      entry.put_string(m_manager->get_serial_number(id));
+      entry.put_string(m_manager->get_port_path(id));
+      
+      // The client's linkmasta sizes its batches to the endpoints
+      vector<pair<unsigned int, unsigned int>> endpoints;
+      const usb::usb_device::device_description* desc = m_manager->get_usb_device(id)->get_device_description();
+      for (unsigned int i = 0; i < desc->num_configurations; ++i)
+      {
+        const usb::usb_device::device_configuration* config = desc->configurations[i];
+        for (unsigned int j = 0; config != nullptr && j < config->num_interfaces; ++j)
+        {
+          const usb::usb_device::device_interface* interface = config->interfaces[j];
+          for (unsigned int k = 0; interface != nullptr && k < interface->num_alt_settings; ++k)
+          {
+            const usb::usb_device::device_alt_setting* alt_setting = interface->alt_settings[k];
+            for (unsigned int l = 0; alt_setting != nullptr && l < alt_setting->num_endpoints; ++l)
+            {
+              const usb::usb_device::device_endpoint* endpoint = alt_setting->endpoints[l];
+              if (endpoint != nullptr)
+              {
+                endpoints.push_back(make_pair(endpoint->address, endpoint->max_packet_size));
+              }
+            }
+          }
+        }
+      }
+      entry.put_u32((unsigned int) endpoints.size());
+      for (auto& endpoint : endpoints)
+      {
+        entry.put_u32(endpoint.first);
+        entry.put_u32(endpoint.second);
+      }
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // The device was disconnected in the meantime
+      continue;
+    }
+    entries.push_back(entry);
+  }
+  
+  reply.put_u32((unsigned int) entries.size());
+  for (const device_server_frame& entry : entries)
+  {
+    reply.put_bytes(entry.payload.data(), (unsigned int) entry.payload.size());
+  }
+  reply.encode(c->out);
+  flush(c);
+}
+
+void device_server::open_device(connection* c, unsigned int device_id)
+{
+  device_server_frame reply(DEVICE_SERVER_OPEN);
+  if (c->session != nullptr)
+  {
+    reply.put_status(DEVICE_SERVER_ERROR, 0, "A device is already open on this connection");
+    reply.encode(c->out);
+    flush(c);
+    return;
+  }
+  
+  bool claimed = false;
+  try
+  {
+    claimed = m_manager->claim_device(device_id, DEVICE_SERVER_CLAIM_TIMEOUT_MS);
+    if (!claimed)
+    {
+      throw usb::busy_exception();
+    }
+    
+    usb::usb_device* usb = m_manager->get_usb_device(device_id);
+    c->session = new linkmasta_device::session(m_manager->get_linkmasta_device(device_id));
+    c->device_id = device_id;
+    c->timeout = usb->timeout();
+    c->failed = false;
+    
+    lock_guard<mutex> lock(c->mutex);
+    c->usb = usb;
+  }
+  catch (std::exception& ex)
+  {
+    record_failure(c);
+    c->failed = false;
+    if (claimed)
+    {
+      m_manager->release_device(device_id);
+    }
+    reply.put_status(c->failure_status, c->failure_timeout, c->failure_message);
+    reply.encode(c->out);
+    flush(c);
+    log(log_level::INFO, ("Device server: unable to open device " + std::to_string(device_id) + ": " + ex.what()).c_str());
+    return;
+  }
+  
+  reply.put_status(DEVICE_SERVER_OK);
+  reply.encode(c->out);
+  flush(c);
+  log(log_level::INFO, ("Device server: opened device " + std::to_string(device_id) + " for a client").c_str());
+}
+
+void device_server::close_device(connection* c)
+{
+  if (c->session == nullptr)
+  {
+    return;
+  }
+  
+  try
+  {
+    complete_transfers(c);
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // The client is gone, so the replies don't matter
+  }
+  
+  {
+    lock_guard<mutex> lock(c->mutex);
+    c->usb = nullptr;
+  }
+  
+  try
+  {
+    delete c->session;
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // The device may already be gone
+  }
+  c->session = nullptr;
+  
+  try
+  {
+    m_manager->release_device(c->device_id);
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // The device may already be gone
+  }
+  log(log_level::INFO, ("Device server: released device " + std::to_string(c->device_id)).c_str());
+}
+
+
+
+void device_server::transfer(connection* c, request& r)
+{
+  device_server_frame& frame = r.frame;
+  bool is_read = (frame.type == DEVICE_SERVER_READ);
+  unsigned int timeout = frame.get_u32();
+  
+  if (c->session == nullptr && !c->failed)
+  {
+    c->failed = true;
+    c->failure_status = DEVICE_SERVER_ERROR;
+    c->failure_timeout = timeout;
+    c->failure_message = "No device is open on this connection";
+  }
+  
+  // Transfers after a failure are skipped until the client recovers
+  if (c->failed)
+  {
+    if (is_read)
+    {
+      reply_failure(c, DEVICE_SERVER_READ);
+    }
+    return;
+  }
+  
+  usb::usb_device* usb = c->usb;
+  bool submitting = false;
+  try
+  {
+    // The length of a read comes from the client, so it is checked before
+    // anything is allocated for it
+    unsigned int num_bytes = (is_read ? frame.get_u32() : 0);
+    if (num_bytes > DEVICE_SERVER_MAX_PAYLOAD)
+    {
+      throw std::invalid_argument("Read of " + std::to_string(num_bytes) + " bytes exceeds the largest payload");
+    }
+    
+    if (timeout != c->timeout)
+    {
+      complete_transfers(c);
+      if (c->failed)
+      {
+        if (is_read)
+        {
+          reply_failure(c, DEVICE_SERVER_READ);
+        }
+        return;
+      }
+      usb->set_timeout(timeout);
+      c->timeout = timeout;
+    }
+    
+    if (!usb->supports_async_transfers())
+    {
+      if (is_read)
+      {
+        vector<unsigned char> buffer(num_bytes);
+        unsigned int num_read = usb->read(buffer.data(), (unsigned int) buffer.size());
+        device_server_frame reply(DEVICE_SERVER_READ);
+        reply.put_status(DEVICE_SERVER_OK);
+        reply.put_bytes(buffer.data(), num_read);
+        reply.encode(c->out);
+        flush(c);
+      }
+      else
+      {
+        usb->write(frame.remaining_bytes(), frame.remaining());
+      }
+      return;
+    }
+    
+    // Keep as many transfers queued with the device as it allows
+    if (c->pending.size() >= usb->max_pending_transfers())
+    {
+      complete_transfer(c);
+      if (c->failed)
+      {
+        if (is_read)
+        {
+          reply_failure(c, DEVICE_SERVER_READ);
+        }
+        return;
+      }
+    }
+    
+    // The buffer of a read must stay put until it completes, which elements
+    // of a deque do
+    pending_transfer transfer;
+    transfer.is_read = is_read;
+    c->pending.push_back(transfer);
+    submitting = true;
+    pending_transfer& pending = c->pending.back();
+    if (is_read)
+    {
+      pending.buffer.resize(num_bytes);
+      usb->submit_read(pending.buffer.data(), (unsigned int) pending.buffer.size());
+    }
+    else
+    {
+      usb->submit_write(frame.remaining_bytes(), frame.remaining());
+    }
+    submitting = false;
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    if (submitting)
+    {
+      // The transfer never made it to the device
+      c->pending.pop_back();
+    }
+    record_failure(c);
+    fail_pending(c);
+    if (is_read)
+    {
+      reply_failure(c, DEVICE_SERVER_READ);
+    }
+  }
+}
+
+void device_server::complete_transfer(connection* c)
+{
+  pending_transfer transfer = std::move(c->pending.front());
+  c->pending.pop_front();
+  
+  try
+  {
+    unsigned int num_bytes = c->usb->complete_transfer();
+    if (transfer.is_read)
+    {
+      device_server_frame reply(DEVICE_SERVER_READ);
+      reply.put_status(DEVICE_SERVER_OK);
+      reply.put_bytes(transfer.buffer.data(), num_bytes);
+      reply.encode(c->out);
+      flush(c);
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    record_failure(c);
+    if (transfer.is_read)
+    {
+      reply_failure(c, DEVICE_SERVER_READ);
+    }
+    fail_pending(c);
+  }
+}
+
+void device_server::complete_transfers(connection* c)
+{
+  while (!c->pending.empty())
+  {
+    complete_transfer(c);
+  }
+}
+
+
+
+void device_server::record_failure(connection* c)
+{
+  c->failed = true;
+  c->failure_timeout = c->timeout;
+  try
+  {
+    throw;
+  }
+  catch (usb::timeout_exception& ex)
+  {
+    c->failure_status = DEVICE_SERVER_TIMEOUT;
+    c->failure_timeout = ex.timeout();
+    c->failure_message = ex.what();
+  }
+  catch (usb::disconnected_exception& ex)
+  {
+    c->failure_status = DEVICE_SERVER_DISCONNECTED;
+    c->failure_message = ex.what();
+  }
+  catch (usb::interrupted_exception& ex)
+  {
+    c->failure_status = DEVICE_SERVER_INTERRUPTED;
+    c->failure_message = ex.what();
+  }
+  catch (usb::busy_exception& ex)
+  {
+    c->failure_status = DEVICE_SERVER_BUSY;
+    c->failure_message = ex.what();
+  }
+  catch (std::exception& ex)
+  {
+    c->failure_status = DEVICE_SERVER_ERROR;
+    c->failure_message = ex.what();
+  }
+}
+
+void device_server::fail_pending(connection* c)
+{
+  if (c->pending.empty())
+  {
+    return;
+  }
+  
+  try
+  {
+    c->usb->cancel_pending_transfers();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // Recovering will sort the device out
+  }
+  
+  for (const pending_transfer& transfer : c->pending)
+  {
+    if (transfer.is_read)
+    {
+      reply_failure(c, DEVICE_SERVER_READ);
+    }
+  }
+  c->pending.clear();
+}
+
+void device_server::reply_failure(connection* c, unsigned char type)
+{
+  device_server_frame reply(type);
+  reply.put_status(c->failure_status, c->failure_timeout, c->failure_message);
+  reply.encode(c->out);
+  flush(c);
+}
+
+void device_server::flush(connection* c)
+{
+  if (!c->out.empty())
+  {
+    c->socket.send_all(c->out.data(), c->out.size());
+    c->out.clear();
+  }
+}
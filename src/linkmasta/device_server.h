@@ -0,0 +1,264 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref device_server class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref device_server class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-23
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __DEVICE_SERVER_H__
+#define __DEVICE_SERVER_H__
+
+#include "common/tcp_socket.h"
+#include "device_server_protocol.h"
+#include "linkmasta_device.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace usb {
+class usb_device;
+}
+class libusb_device_manager;
+
+/*! \brief How long the server waits for a connection before checking whether
+ *         it has been asked to stop, in milliseconds. */
+#define DEVICE_SERVER_POLL_MS           200
+
+/*! \brief How long a client's open waits for a device that is in use on the
+ *         server, in milliseconds. */
+#define DEVICE_SERVER_CLAIM_TIMEOUT_MS  5000
+
+/*! \class device_server
+ *  \brief Server that lets other machines use the LinkMasta devices attached
+ *         to this one.
+ *  
+ *  Server that exposes the devices of a \ref libusb_device_manager over TCP,
+ *  so that a single host running \ref remote_device_manager can drive devices
+ *  attached to many thin machines. The protocol is described in
+ *  device_server_protocol.h.
+ *  
+ *  Each client connection may open one device, which is claimed from the
+ *  manager and held open with a \ref linkmasta_device::session until the
+ *  connection closes. The USB transfers the client sends are then relayed to
+ *  the device as they are. Transfers arrive in batches and are queued up
+ *  with the device's asynchronous transfers where it supports them, so a
+ *  stream of reads keeps the bus busy while the replies travel back over the
+ *  network. Aborts are acted on as soon as they arrive, even while the
+ *  transfers before them are still running.
+ *  
+ *  Every connection is served by a thread that reads its requests and a
+ *  thread that runs them.
+ */
+class device_server
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Does not start the server.
+   *  
+   *  \param [in] manager The manager of the devices to expose. Must outlive
+   *         the server.
+   *  \param [in] port The TCP port to listen on.
+   *  \param [in] loopback_only Whether to only accept connections from this
+   *         machine.
+   */
+                          device_server(libusb_device_manager* manager, unsigned short port, bool loopback_only = false);
+  
+  /*!
+   *  \brief Class destructor. Stops the server if it is running.
+   */
+                          ~device_server();
+  
+  /*!
+   *  \brief Starts listening and serving clients in the background.
+   *  
+   *  \throws std::runtime_error If the port could not be listened on.
+   */
+  void                    start();
+  
+  /*!
+   *  \brief Stops the server, disconnecting every client and releasing the
+   *         devices they had open.
+   */
+  void                    stop();
+  
+  /*!
+   *  \brief Gets the number of clients currently connected.
+   */
+  unsigned int            num_connections();
+
+
+
+private:
+  device_server(const device_server& other) = delete;
+  device_server& operator=(const device_server& other) = delete;
+  
+  /*!
+   *  \brief Struct containing a request waiting to be run.
+   */
+  struct request
+  {
+    device_server_frame   frame;
+    unsigned int          abort_generation;
+  };
+  
+  /*!
+   *  \brief Struct containing a transfer submitted to the device but not yet
+   *         completed.
+   */
+  struct pending_transfer
+  {
+    bool                  is_read;
+    std::vector<unsigned char> buffer;
+  };
+  
+  /*!
+   *  \brief Struct containing the state of a client connection.
+   */
+  struct connection
+  {
+    tcp_socket            socket;
+    std::thread           reader;
+    std::thread           worker;
+    
+    /*! \brief Everything below up to \ref out is guarded by this mutex. */
+    std::mutex            mutex;
+    std::condition_variable condition;
+    std::deque<request>   queue;
+    bool                  closed;
+    bool                  finished;
+    unsigned int          abort_generation;
+    usb::usb_device*      usb;
+    
+    /*! \brief Everything below is only used by the worker thread. */
+    std::vector<unsigned char> out;
+    unsigned int          device_id;
+    linkmasta_device::session* session;
+    std::deque<pending_transfer> pending;
+    unsigned int          timeout;
+    bool                  failed;
+    unsigned int          failure_status;
+    unsigned int          failure_timeout;
+    std::string           failure_message;
+  };
+  
+  /*!
+   *  \brief Entry point of the thread accepting connections.
+   */
+  void                    serve();
+  
+  /*!
+   *  \brief Joins and deletes the connections that have finished.
+   *  
+   *  \param [in] all Whether to wait for every connection rather than only
+   *         the finished ones.
+   */
+  void                    reap_connections(bool all);
+  
+  /*!
+   *  \brief Entry point of a connection's reader thread.
+   */
+  void                    read_requests(connection* c);
+  
+  /*!
+   *  \brief Entry point of a connection's worker thread.
+   */
+  void                    run_requests(connection* c);
+  
+  /*!
+   *  \brief Runs a request.
+   *  
+   *  \return **false** if the connection should be closed.
+   */
+  bool                    run_request(connection* c, request& r);
+  
+  /*!
+   *  \brief Answers a \ref DEVICE_SERVER_LIST request.
+   */
+  void                    list_devices(connection* c);
+  
+  /*!
+   *  \brief Claims and opens a device for a connection.
+   */
+  void                    open_device(connection* c, unsigned int device_id);
+  
+  /*!
+   *  \brief Finishes the connection's transfers and releases its device.
+   */
+  void                    close_device(connection* c);
+  
+  /*!
+   *  \brief Runs or submits a single transfer.
+   */
+  void                    transfer(connection* c, request& r);
+  
+  /*!
+   *  \brief Waits for the oldest submitted transfer and answers it if it is a
+   *         read.
+   */
+  void                    complete_transfer(connection* c);
+  
+  /*!
+   *  \brief Waits for every submitted transfer.
+   */
+  void                    complete_transfers(connection* c);
+  
+  /*!
+   *  \brief Records the exception being handled as the connection's failure.
+   *         Must be called from within a catch block.
+   */
+  static void             record_failure(connection* c);
+  
+  /*!
+   *  \brief Cancels every submitted transfer after a failure, answering the
+   *         reads among them with the failure.
+   */
+  static void             fail_pending(connection* c);
+  
+  /*!
+   *  \brief Appends a reply carrying the connection's failure.
+   */
+  static void             reply_failure(connection* c, unsigned char type);
+  
+  /*!
+   *  \brief Sends the replies queued on the connection.
+   */
+  static void             flush(connection* c);
+  
+  
+  
+  /*! \brief The manager of the devices exposed. */
+  libusb_device_manager* const m_manager;
+  
+  /*! \brief The TCP port to listen on. */
+  const unsigned short    m_port;
+  
+  /*! \brief Whether only connections from this machine are accepted. */
+  const bool              m_loopback_only;
+  
+  /*! \brief The listening socket. */
+  tcp_socket              m_socket;
+  
+  /*! \brief Flag telling the server thread to stop. */
+  std::atomic<bool>       m_stopping;
+  
+  /*! \brief The thread accepting connections. */
+  std::thread             m_thread;
+  
+  /*! \brief The client connections. */
+  std::list<connection*>  m_connections;
+  
+  /*! \brief Mutex guarding \ref m_connections. */
+  std::mutex              m_mutex;
+};
+
+#endif /* defined(__DEVICE_SERVER_H__) */
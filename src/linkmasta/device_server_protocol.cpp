@@ -0,0 +1,176 @@
+/*! \file
+ *  \brief File containing the implementation of \ref device_server_frame.
+ *  
+ *  File containing the implementation of \ref device_server_frame.
+ *  
+ *  See corrensponding header file to view documentation for struct, its
+ *  methods, and its member variables.
+ *  
+ *  \see device_server_frame
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-23
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "device_server_protocol.h"
+#include "common/tcp_socket.h"
+#include <stdexcept>
+
+#define FRAME_HEADER_SIZE 5
+
+using namespace std;
+
+
+
+device_server_frame::device_server_frame(unsigned char type)
+  : type(type), read_offset(0)
+{
+  // Nothing else to do
+}
+
+
+
+void device_server_frame::put_u8(unsigned int value)
+{
+  payload.push_back((unsigned char) value);
+}
+
+void device_server_frame::put_u32(unsigned int value)
+{
+  payload.push_back((unsigned char) value);
+  payload.push_back((unsigned char) (value >> 8));
+  payload.push_back((unsigned char) (value >> 16));
+  payload.push_back((unsigned char) (value >> 24));
+}
+
+void device_server_frame::put_string(const std::string& value)
+{
+  put_u32((unsigned int) value.size());
+  payload.insert(payload.end(), value.begin(), value.end());
+}
+
+void device_server_frame::put_bytes(const unsigned char* data, unsigned int num_bytes)
+{
+  payload.insert(payload.end(), data, data + num_bytes);
+}
+
+void device_server_frame::put_status(unsigned int status, unsigned int timeout, const std::string& message)
+{
+  put_u8(status);
+  if (status != DEVICE_SERVER_OK)
+  {
+    put_u32(timeout);
+    put_string(message);
+  }
+}
+
+
+
+unsigned int device_server_frame::get_u8()
+{
+  if (remaining() < 1)
+  {
+    throw std::runtime_error("Truncated device server message");
+  }
+  return payload[read_offset++];
+}
+
+unsigned int device_server_frame::get_u32()
+{
+  if (remaining() < 4)
+  {
+    throw std::runtime_error("Truncated device server message");
+  }
+  unsigned int value = (unsigned int) payload[read_offset]
+    | ((unsigned int) payload[read_offset + 1] << 8)
+    | ((unsigned int) payload[read_offset + 2] << 16)
+    | ((unsigned int) payload[read_offset + 3] << 24);
+  read_offset += 4;
+  return value;
+}
+
+std::string device_server_frame::get_string()
+{
+  unsigned int length = get_u32();
+  if (remaining() < length)
+  {
+    throw std::runtime_error("Truncated device server message");
+  }
+  string value((const char*) remaining_bytes(), length);
+  read_offset += length;
+  return value;
+}
+
+unsigned int device_server_frame::remaining() const
+{
+  return (unsigned int) payload.size() - read_offset;
+}
+
+const unsigned char* device_server_frame::remaining_bytes() const
+{
+  return payload.data() + read_offset;
+}
+
+
+
+void device_server_frame::encode(std::vector<unsigned char>& out) const
+{
+  unsigned int length = (unsigned int) payload.size();
+  out.push_back(type);
+  out.push_back((unsigned char) length);
+  out.push_back((unsigned char) (length >> 8));
+  out.push_back((unsigned char) (length >> 16));
+  out.push_back((unsigned char) (length >> 24));
+  out.insert(out.end(), payload.begin(), payload.end());
+}
+
+void device_server_frame::receive(tcp_socket& socket)
+{
+  unsigned char header[FRAME_HEADER_SIZE];
+  socket.receive_all(header, FRAME_HEADER_SIZE);
+  
+  unsigned int length = (unsigned int) header[1] | ((unsigned int) header[2] << 8)
+    | ((unsigned int) header[3] << 16) | ((unsigned int) header[4] << 24);
+  if (length > DEVICE_SERVER_MAX_PAYLOAD)
+  {
+    throw std::runtime_error("Device server message too large");
+  }
+  
+  type = header[0];
+  payload.resize(length);
+  read_offset = 0;
+  if (length > 0)
+  {
+    socket.receive_all(payload.data(), length);
+  }
+}
+
+
+
+void device_server_connect(tcp_socket& socket, const std::string& host, unsigned short port)
+{
+  socket.connect(host, port);
+  try
+  {
+    vector<unsigned char> out;
+    device_server_frame hello(DEVICE_SERVER_HELLO);
+    hello.put_u32(DEVICE_SERVER_MAGIC);
+    hello.put_u32(DEVICE_SERVER_PROTOCOL_VERSION);
+    hello.encode(out);
+    socket.send_all(out.data(), out.size());
+    
+    device_server_frame reply;
+    reply.receive(socket);
+    if (reply.type != DEVICE_SERVER_HELLO || reply.get_u32() != DEVICE_SERVER_MAGIC
+        || reply.get_u32() != DEVICE_SERVER_PROTOCOL_VERSION)
+    {
+      throw std::runtime_error("Incompatible device server at " + host + ":" + to_string(port));
+    }
+  }
+  catch (...)
+  {
+    socket.close();
+    throw;
+  }
+}
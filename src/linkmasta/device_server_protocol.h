@@ -0,0 +1,242 @@
+/*! \file
+ *  \brief File containing the definitions shared by \ref device_server and
+ *         \ref remote_usb_device.
+ *  
+ *  File containing the message types, status codes, and framing of the
+ *  protocol \ref device_server speaks with \ref remote_usb_device and
+ *  \ref remote_device_manager.
+ *  
+ *  Every message is a frame made of a one byte \ref device_server_message
+ *  type, a four byte payload length, and the payload. All integers are
+ *  unsigned and little-endian, and strings are a four byte length followed by
+ *  their bytes.
+ *  
+ *  A connection starts with the client sending a \ref DEVICE_SERVER_HELLO and
+ *  the server answering with one of its own. The client may then list the
+ *  server's devices with \ref DEVICE_SERVER_LIST any number of times, and may
+ *  open one of them with \ref DEVICE_SERVER_OPEN, after which the connection
+ *  carries the device's USB transfers until it is closed with
+ *  \ref DEVICE_SERVER_CLOSE.
+ *  
+ *  Transfers are not acknowledged one by one. Writes are never answered, and
+ *  reads are answered in the order they were sent, so a client can send a
+ *  whole batch of commands and read requests at once and collect the replies
+ *  as they stream back. Once a transfer fails, the server skips every
+ *  transfer after it and answers every request that expects a reply with the
+ *  same failure, until the client sends \ref DEVICE_SERVER_RECOVER.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-23
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __DEVICE_SERVER_PROTOCOL_H__
+#define __DEVICE_SERVER_PROTOCOL_H__
+
+#include <string>
+#include <vector>
+
+class tcp_socket;
+
+/*! \brief The TCP port \ref device_server listens on by default. */
+#define DEVICE_SERVER_DEFAULT_PORT      7400
+
+/*! \brief The version of the protocol, exchanged in \ref DEVICE_SERVER_HELLO. */
+#define DEVICE_SERVER_PROTOCOL_VERSION  1
+
+/*! \brief Identifies the protocol at the start of \ref DEVICE_SERVER_HELLO. */
+#define DEVICE_SERVER_MAGIC             0x534D4446 /* "FDMS" */
+
+/*! \brief The largest payload either side accepts in a single frame. */
+#define DEVICE_SERVER_MAX_PAYLOAD       0x1000000
+
+
+
+/*!
+ *  \brief The types of message exchanged with a \ref device_server.
+ */
+enum device_server_message
+{
+  /*!
+   *  \brief Opens the conversation. Both ways: u32 magic, u32 version.
+   */
+  DEVICE_SERVER_HELLO = 1,
+  
+  /*!
+   *  \brief Lists the server's devices. Request: empty. Reply: u32 count,
+   *         then for each device u32 id, u32 vendor id, u32 product id,
+   *         u32 bus number, u8 shared hub flag, the manufacturer, product,
+   *         serial number, and port path strings, u32 number of endpoints,
+   *         and a u32 address and u32 largest packet size for each endpoint.
+   */
+  DEVICE_SERVER_LIST,
+  
+  /*!
+   *  \brief Claims and opens a device. Request: u32 device id. Reply: status.
+   */
+  DEVICE_SERVER_OPEN,
+  
+  /*!
+   *  \brief Finishes every transfer sent so far, then releases the device.
+   *         Request: empty. Reply: status.
+   */
+  DEVICE_SERVER_CLOSE,
+  
+  /*!
+   *  \brief Writes to the device's output endpoint. Request: u32 timeout,
+   *         then the bytes. Never answered.
+   */
+  DEVICE_SERVER_WRITE,
+  
+  /*!
+   *  \brief Reads from the device's input endpoint. Request: u32 timeout,
+   *         u32 number of bytes, at most \ref DEVICE_SERVER_MAX_PAYLOAD.
+   *         Reply: status, then the bytes read. Asking for more fails the
+   *         connection's transfers like any other error.
+   */
+  DEVICE_SERVER_READ,
+  
+  /*!
+   *  \brief Brings the connection back to a usable state after a failed
+   *         transfer. Request: empty. Reply: status, u8 recovered flag.
+   */
+  DEVICE_SERVER_RECOVER,
+  
+  /*!
+   *  \brief Makes every transfer sent so far fail as soon as possible.
+   *         Request: empty. Never answered.
+   */
+  DEVICE_SERVER_ABORT
+};
+
+/*!
+ *  \brief The outcomes reported at the start of every reply.
+ *  
+ *  A status is a u8 code. Any code other than \ref DEVICE_SERVER_OK is
+ *  followed by the u32 timeout of the failed transfer and a message string.
+ */
+enum device_server_status
+{
+  /*! \brief The request succeeded. */
+  DEVICE_SERVER_OK = 0,
+  
+  /*! \brief A transfer timed out. Matches \ref usb::timeout_exception. */
+  DEVICE_SERVER_TIMEOUT,
+  
+  /*! \brief The device is gone. Matches \ref usb::disconnected_exception. */
+  DEVICE_SERVER_DISCONNECTED,
+  
+  /*! \brief A transfer was aborted. Matches
+   *         \ref usb::interrupted_exception. */
+  DEVICE_SERVER_INTERRUPTED,
+  
+  /*! \brief The device is in use. Matches \ref usb::busy_exception. */
+  DEVICE_SERVER_BUSY,
+  
+  /*! \brief Any other failure. Matches \ref usb::exception. */
+  DEVICE_SERVER_ERROR
+};
+
+
+
+/*! \struct device_server_frame
+ *  \brief A single message of the \ref device_server protocol.
+ *  
+ *  Struct holding the type and payload of a frame, with helpers for building
+ *  the payload field by field and for reading it back in the same order.
+ */
+struct device_server_frame
+{
+  /*!
+   *  \brief Constructs an empty frame of the given type.
+   */
+  explicit                device_server_frame(unsigned char type = 0);
+  
+  /*! \brief Appends a u8 to the payload. */
+  void                    put_u8(unsigned int value);
+  
+  /*! \brief Appends a u32 to the payload. */
+  void                    put_u32(unsigned int value);
+  
+  /*! \brief Appends a string to the payload. */
+  void                    put_string(const std::string& value);
+  
+  /*! \brief Appends raw bytes to the payload. */
+  void                    put_bytes(const unsigned char* data, unsigned int num_bytes);
+  
+  /*! \brief Appends a status, along with its timeout and message if it is a
+   *         failure. */
+  void                    put_status(unsigned int status, unsigned int timeout = 0, const std::string& message = "");
+  
+  /*!
+   *  \brief Reads the next u8 of the payload.
+   *  
+   *  \throws std::runtime_error If the payload is too short.
+   */
+  unsigned int            get_u8();
+  
+  /*!
+   *  \brief Reads the next u32 of the payload.
+   *  
+   *  \throws std::runtime_error If the payload is too short.
+   */
+  unsigned int            get_u32();
+  
+  /*!
+   *  \brief Reads the next string of the payload.
+   *  
+   *  \throws std::runtime_error If the payload is too short.
+   */
+  std::string             get_string();
+  
+  /*!
+   *  \brief Gets the number of bytes of the payload not read yet.
+   */
+  unsigned int            remaining() const;
+  
+  /*!
+   *  \brief Gets a pointer to the bytes of the payload not read yet.
+   */
+  const unsigned char*    remaining_bytes() const;
+  
+  /*!
+   *  \brief Appends the encoded frame to a buffer of outgoing bytes.
+   */
+  void                    encode(std::vector<unsigned char>& out) const;
+  
+  /*!
+   *  \brief Receives a whole frame, replacing this one.
+   *  
+   *  \throws std::runtime_error If the connection failed or the frame is
+   *          larger than \ref DEVICE_SERVER_MAX_PAYLOAD.
+   */
+  void                    receive(tcp_socket& socket);
+  
+  
+  
+  /*! \brief The type of the frame, a \ref device_server_message. */
+  unsigned char           type;
+  
+  /*! \brief The payload of the frame. */
+  std::vector<unsigned char> payload;
+  
+  /*! \brief The offset of the next payload byte to read. */
+  unsigned int            read_offset;
+};
+
+
+
+/*!
+ *  \brief Connects to a \ref device_server and exchanges
+ *         \ref DEVICE_SERVER_HELLO messages with it.
+ *  
+ *  \param [out] socket The socket to connect. Must not be open.
+ *  \param [in] host The host name or address of the server.
+ *  \param [in] port The TCP port of the server.
+ *  
+ *  \throws std::runtime_error If the server could not be reached or does not
+ *          speak this version of the protocol. The socket is left closed.
+ */
+void device_server_connect(tcp_socket& socket, const std::string& host, unsigned short port);
+
+#endif /* defined(__DEVICE_SERVER_PROTOCOL_H__) */
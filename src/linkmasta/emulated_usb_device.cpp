@@ -0,0 +1,1149 @@
+/*! \file
+ *  \brief File containing the implementation of the \ref emulated_usb_device
+ *         class.
+ *  
+ *  File containing the implementation of the \ref emulated_usb_device class.
+ *  See corresponding header file to view documentation for the class, its
+ *  methods, and its member variables.
+ *  
+ *  \see emulated_usb_device
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "emulated_usb_device.h"
+#include "ngp_linkmasta_messages.h"
+#include "ws_linkmasta_messages.h"
+#include "usb/exception/disconnected_exception.h"
+#include "usb/exception/timeout_exception.h"
+#include "usb/exception/uninitialized_exception.h"
+#include "usb/exception/unopen_exception.h"
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+#define CLASS_NAME "emulated_usb_device"
+
+#define LINKMASTA_VENDOR_ID           0x20A0
+#define NGP_LINKMASTA_PRODUCT_ID      0x4256
+#define WS_LINKMASTA_PRODUCT_ID       0x4252
+
+#define PACKET_SIZE                   64
+#define PAGE_SIZE                     0x1000
+#define DEFAULT_MAX_PENDING_TRANSFERS 16
+
+// Message types received by the firmware. These must match the private
+// definitions in ngp_linkmasta_messages.cpp and ws_linkmasta_messages.cpp.
+#define MSG_TYPE_OFFSET               0
+#define MSG_GETVERSION                0x00
+#define MSG_READ_CMD                  0x01
+#define MSG_WRITE_CMD                 0x02
+#define MSG_READ64xN_CMD              0x04
+#define MSG_FLASHWRITE32_CMD          0x05
+#define MSG_FLASHWRITE_N_CMD          0x06
+#define MSG_FLASHWRITE64xN_CMD        0x07
+#define MSG_BLINK_LED                 0x09
+#define MSG_WS_WRITE16_CMD            0x0E
+#define MSG_WS_READ16_CMD             0x0F
+#define MSG_WS_SRAMWRITE64xN_CMD      0x10
+#define MSG_WS_GET_CARTINFO_CMD       0x11
+#define MSG_WS_SET_CARTSLOT_CMD       0x12
+
+// Flash command cycles
+#define NGP_ADDR_COMMAND1             0x5555
+#define NGP_ADDR_COMMAND2             0x2AAA
+#define NGP_ADDR_COMMAND_MASK         0x7FFF
+#define NGP_AUTOSELECT_SHIFT          0
+#define NGP_BLOCK_SIZE                0x10000
+#define WS_ADDR_COMMAND1              0x0AAA
+#define WS_ADDR_COMMAND2              0x0555
+#define WS_ADDR_COMMAND_MASK          0x0FFF
+#define WS_AUTOSELECT_SHIFT           1
+#define WS_BLOCK_SIZE                 0x20000
+
+// Values read from a chip that is erasing. Bit 6 toggles with every read, and
+// neither value reads as erased.
+#define ERASE_STATUS_1                0x08
+#define ERASE_STATUS_2                0x4C
+
+typedef emulated_usb_device::timeout_t          timeout_t;
+typedef emulated_usb_device::configuration_t    configuration_t;
+typedef emulated_usb_device::interface_t        interface_t;
+typedef emulated_usb_device::endpoint_t         endpoint_t;
+typedef emulated_usb_device::data_t             data_t;
+typedef emulated_usb_device::device_description device_description;
+
+
+
+emulated_usb_device::fault_options::fault_options()
+  : timeout_rate(0.0), short_read_rate(0.0), nak_storm_rate(0.0), nak_storm_transfers(16),
+    nak_delay_us(1000), corrupt_rate(0.0), disconnect_interval(0), seed(1)
+{
+  // Nothing else to do
+}
+
+bool emulated_usb_device::fault_options::any() const
+{
+  return timeout_rate > 0 || short_read_rate > 0 || nak_storm_rate > 0
+         || corrupt_rate > 0 || disconnect_interval > 0;
+}
+
+
+
+emulated_usb_device::options::options(linkmasta_system system)
+  : system(system), latency_us(0), bytes_per_second(0), max_packet_size(PACKET_SIZE),
+    fail_read_interval(0), block_erase_ms(0), chip_erase_ms(0),
+    product_id(system == LINKMASTA_WONDERSWAN ? WS_LINKMASTA_PRODUCT_ID : NGP_LINKMASTA_PRODUCT_ID),
+    firmware_major_version(1), firmware_minor_version(0),
+    serial_number("EMULATED"),
+    num_chips(system == LINKMASTA_WONDERSWAN ? 1 : 2),
+    manufacturer_id(system == LINKMASTA_WONDERSWAN ? 0x01 : 0x98),
+    device_id(system == LINKMASTA_WONDERSWAN ? 0x7E : 0x2F),
+    factory_prot(0x85), num_slots(8), slot_addr_lines(24), sram_size(0x80000)
+{
+  // Nothing else to do
+}
+
+
+
+emulated_usb_device::emulated_usb_device(const options& opts)
+  : m_options(opts), m_description(new device_description(0)),
+    m_was_initialized(false), m_is_open(false), m_timeout(0),
+    m_configuration(0), m_interface(0), m_input_endpoint(0),
+    m_output_endpoint(0), m_max_pending_transfers(DEFAULT_MAX_PENDING_TRANSFERS),
+    m_bus_free(clock_t::now()), m_data_packets_expected(0),
+    m_data_packets_received(0), m_data_packets_programmed(0), m_data_chip(0),
+    m_data_address(0), m_data_to_sram(false), m_current_slot(0),
+    m_reads_since_failure(0), m_faults_enabled(opts.faults.any()),
+    m_fault_rng(opts.faults.seed), m_fault_counts(), m_nak_transfers_left(0),
+    m_transfers_since_open(0), m_disconnected(false)
+{
+  m_description->device_class = 0;
+  m_description->vendor_id = LINKMASTA_VENDOR_ID;
+  m_description->product_id = m_options.product_id;
+  
+  // Determine size of each chip
+  unsigned int num_bytes;
+  if (m_options.system == LINKMASTA_WONDERSWAN)
+  {
+    num_bytes = m_options.num_slots << m_options.slot_addr_lines;
+    m_sram.resize(std::max(m_options.sram_size, 1u), 0xFF);
+  }
+  else
+  {
+    switch (m_options.device_id)
+    {
+    case 0x2C:  num_bytes = 0x100000; break;
+    case 0xAB:  num_bytes = 0x80000;  break;
+    case 0x2F:
+    default:    num_bytes = 0x200000; break;
+    }
+  }
+  
+  // Neo Geo Pocket cartridges can have a missing chip, which simply doesn't
+  // respond to anything
+  unsigned int num_chips = (m_options.system == LINKMASTA_WONDERSWAN ? 1 : 2);
+  m_chips.resize(num_chips);
+  for (unsigned int i = 0; i < num_chips; ++i)
+  {
+    m_chips[i].present = (i < m_options.num_chips);
+    m_chips[i].num_bytes = num_bytes;
+    m_chips[i].mode = FLASH_READ;
+    m_chips[i].erase_done = clock_t::now();
+    m_chips[i].toggle = ERASE_STATUS_1;
+    m_chips[i].bus_value = 0xFF;
+  }
+}
+
+emulated_usb_device::~emulated_usb_device()
+{
+  delete m_description;
+}
+
+void emulated_usb_device::init()
+{
+  m_was_initialized = true;
+}
+
+
+
+timeout_t emulated_usb_device::timeout() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  return m_timeout;
+}
+
+configuration_t emulated_usb_device::configuration() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  return m_configuration;
+}
+
+interface_t emulated_usb_device::interface() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  return m_interface;
+}
+
+endpoint_t emulated_usb_device::input_endpoint() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  return m_input_endpoint;
+}
+
+endpoint_t emulated_usb_device::output_endpoint() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  return m_output_endpoint;
+}
+
+const device_description* emulated_usb_device::get_device_description() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  return m_description;
+}
+
+std::string emulated_usb_device::get_manufacturer_string()
+{
+  return "7400 Circuits";
+}
+
+std::string emulated_usb_device::get_product_string()
+{
+  if (m_options.system == LINKMASTA_WONDERSWAN)
+  {
+    return "Emulated WonderSwan LinkMasta";
+  }
+  else
+  {
+    return "Emulated Neo Geo Pocket LinkMasta";
+  }
+}
+
+std::string emulated_usb_device::get_serial_number()
+{
+  return m_options.serial_number;
+}
+
+unsigned int emulated_usb_device::max_packet_size(endpoint_t endpoint) const
+{
+  (void) endpoint;
+  return m_options.max_packet_size;
+}
+
+
+
+void emulated_usb_device::set_timeout(timeout_t timeout)
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  m_timeout = timeout;
+}
+
+void emulated_usb_device::set_configuration(configuration_t configuration)
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  m_configuration = configuration;
+}
+
+void emulated_usb_device::set_interface(interface_t interface)
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  m_interface = interface;
+}
+
+void emulated_usb_device::set_input_endpoint(endpoint_t input_endpoint)
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  m_input_endpoint = input_endpoint;
+}
+
+void emulated_usb_device::set_output_endpoint(endpoint_t output_endpoint)
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  m_output_endpoint = output_endpoint;
+}
+
+
+
+void emulated_usb_device::open()
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  
+  // Opening a device that dropped off the bus stands for plugging it back in
+  m_is_open = true;
+  m_disconnected = false;
+  m_transfers_since_open = 0;
+}
+
+void emulated_usb_device::close()
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  cancel_pending_transfers();
+  m_is_open = false;
+}
+
+unsigned int emulated_usb_device::read(data_t* data, unsigned int num_bytes)
+{
+  return read(data, num_bytes, m_timeout);
+}
+
+unsigned int emulated_usb_device::read(data_t* data, unsigned int num_bytes, timeout_t timeout)
+{
+  (void) timeout;
+  validate_state();
+  
+  clock_t::time_point done = schedule_transfer(num_bytes);
+  fault_type fault = (m_faults_enabled ? next_fault(true, num_bytes, &done) : FAULT_NONE);
+  std::this_thread::sleep_until(done);
+  return transfer_read(data, num_bytes, fault);
+}
+
+unsigned int emulated_usb_device::write(const data_t* buffer, unsigned int num_bytes)
+{
+  return write(buffer, num_bytes, m_timeout);
+}
+
+unsigned int emulated_usb_device::write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+{
+  (void) timeout;
+  validate_state();
+  
+  clock_t::time_point done = schedule_transfer(num_bytes);
+  fault_type fault = (m_faults_enabled ? next_fault(false, num_bytes, &done) : FAULT_NONE);
+  std::this_thread::sleep_until(done);
+  if (fault == FAULT_TIMEOUT)
+  {
+    throw usb::timeout_exception(m_timeout);
+  }
+  transfer_write(buffer, num_bytes);
+  return num_bytes;
+}
+
+unsigned int emulated_usb_device::write(data_t* buffer, unsigned int num_bytes)
+{
+  return write((const data_t*) buffer, num_bytes, m_timeout);
+}
+
+unsigned int emulated_usb_device::write(data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+{
+  return write((const data_t*) buffer, num_bytes, timeout);
+}
+
+
+
+bool emulated_usb_device::supports_async_transfers() const
+{
+  return true;
+}
+
+unsigned int emulated_usb_device::max_pending_transfers() const
+{
+  return m_max_pending_transfers;
+}
+
+void emulated_usb_device::set_max_pending_transfers(unsigned int max_pending)
+{
+  if (max_pending == 0)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(max_pending)
+                                + " for max pending transfers");
+  }
+  m_max_pending_transfers = max_pending;
+}
+
+unsigned int emulated_usb_device::num_pending_transfers() const
+{
+  return (unsigned int) m_pending_transfers.size();
+}
+
+void emulated_usb_device::submit_read(data_t* data, unsigned int num_bytes)
+{
+  validate_state();
+  if (m_pending_transfers.size() >= m_max_pending_transfers)
+  {
+    throw std::runtime_error("Too many pending transfers");
+  }
+  
+  // The reply is collected on completion, since the command it answers may
+  // not have been written yet
+  pending_transfer transfer = {data, num_bytes, schedule_transfer(num_bytes), FAULT_NONE};
+  if (m_faults_enabled)
+  {
+    transfer.fault = next_fault(true, num_bytes, &transfer.done);
+  }
+  m_pending_transfers.push_back(transfer);
+}
+
+void emulated_usb_device::submit_write(const data_t* data, unsigned int num_bytes)
+{
+  validate_state();
+  if (m_pending_transfers.size() >= m_max_pending_transfers)
+  {
+    throw std::runtime_error("Too many pending transfers");
+  }
+  
+  // The firmware acts on the data right away; only the completion is deferred
+  pending_transfer transfer = {nullptr, num_bytes, schedule_transfer(num_bytes), FAULT_NONE};
+  if (m_faults_enabled)
+  {
+    transfer.fault = next_fault(false, num_bytes, &transfer.done);
+  }
+  if (transfer.fault != FAULT_TIMEOUT)
+  {
+    transfer_write(data, num_bytes);
+  }
+  m_pending_transfers.push_back(transfer);
+}
+
+unsigned int emulated_usb_device::complete_transfer()
+{
+  if (m_disconnected)
+  {
+    throw usb::disconnected_exception();
+  }
+  if (m_pending_transfers.empty())
+  {
+    throw std::runtime_error("No pending transfers");
+  }
+  
+  pending_transfer transfer = m_pending_transfers.front();
+  m_pending_transfers.pop_front();
+  std::this_thread::sleep_until(transfer.done);
+  
+  if (transfer.data == nullptr)
+  {
+    if (transfer.fault == FAULT_TIMEOUT)
+    {
+      throw usb::timeout_exception(m_timeout);
+    }
+    return transfer.num_bytes;
+  }
+  return transfer_read(transfer.data, transfer.num_bytes, transfer.fault);
+}
+
+void emulated_usb_device::cancel_pending_transfers()
+{
+  m_pending_transfers.clear();
+}
+
+bool emulated_usb_device::recover()
+{
+  if (!m_is_open || m_disconnected)
+  {
+    return false;
+  }
+  
+  // Stale replies are drained and the firmware gives up on any batch it was
+  // still waiting for data for
+  cancel_pending_transfers();
+  m_replies.clear();
+  m_data_packets_expected = 0;
+  return true;
+}
+
+
+
+const emulated_usb_device::fault_counts& emulated_usb_device::injected_faults() const
+{
+  return m_fault_counts;
+}
+
+
+
+void emulated_usb_device::validate_state() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  if (!m_is_open) throw usb::unopen_exception(CLASS_NAME);
+  if (m_disconnected) throw usb::disconnected_exception();
+}
+
+emulated_usb_device::clock_t::time_point emulated_usb_device::schedule_transfer(unsigned int num_bytes)
+{
+  clock_t::time_point now = clock_t::now();
+  
+  // Transfers queue up behind each other on the bus, but each one's latency
+  // runs concurrently with the transfers ahead of it
+  clock_t::time_point start = std::max(now, m_bus_free);
+  if (m_options.bytes_per_second > 0)
+  {
+    start += std::chrono::microseconds((unsigned long long) num_bytes * 1000000 / m_options.bytes_per_second);
+  }
+  m_bus_free = start;
+  
+  return std::max(start, now + std::chrono::microseconds(m_options.latency_us));
+}
+
+unsigned int emulated_usb_device::transfer_read(data_t* data, unsigned int num_bytes, fault_type fault)
+{
+  if (fault == FAULT_TIMEOUT
+      || (m_options.fail_read_interval > 0 && num_bytes > PACKET_SIZE
+          && ++m_reads_since_failure >= m_options.fail_read_interval))
+  {
+    m_reads_since_failure = 0;
+    throw usb::timeout_exception(m_timeout);
+  }
+  
+  // A bulk transfer keeps collecting packets until it is full, or on a short
+  // read, until it has half of them
+  unsigned int wanted = num_bytes;
+  if (fault == FAULT_SHORT_READ)
+  {
+    wanted = std::max((num_bytes + PACKET_SIZE - 1) / PACKET_SIZE / 2, 1u) * PACKET_SIZE;
+  }
+  unsigned int num_read = 0;
+  while (num_read < wanted)
+  {
+    // Real hardware would wait out the timeout before failing
+    if (m_replies.empty())
+    {
+      throw usb::timeout_exception(m_timeout);
+    }
+    
+    unsigned int packet_size = std::min(num_bytes - num_read, (unsigned int) PACKET_SIZE);
+    std::copy(m_replies.front().begin(), m_replies.front().begin() + packet_size, data + num_read);
+    m_replies.pop_front();
+    num_read += packet_size;
+  }
+  
+  if (fault == FAULT_CORRUPT)
+  {
+    data[m_fault_rng() % num_read] ^= 0xFF;
+  }
+  return num_read;
+}
+
+void emulated_usb_device::transfer_write(const data_t* data, unsigned int num_bytes)
+{
+  for (unsigned int offset = 0; offset < num_bytes; offset += PACKET_SIZE)
+  {
+    unsigned int packet_size = std::min(num_bytes - offset, (unsigned int) PACKET_SIZE);
+    
+    // Short packets are padded with zeroes
+    packet_t packet;
+    packet.fill(0);
+    std::copy(data + offset, data + offset + packet_size, packet.begin());
+    handle_packet(packet.data());
+  }
+}
+
+emulated_usb_device::fault_type emulated_usb_device::next_fault(bool is_read, unsigned int num_bytes, clock_t::time_point* done)
+{
+  const fault_options& faults = m_options.faults;
+  
+  // Dropping off the bus loses whatever the firmware was in the middle of
+  if (faults.disconnect_interval > 0 && ++m_transfers_since_open > faults.disconnect_interval)
+  {
+    ++m_fault_counts.disconnects;
+    m_disconnected = true;
+    m_replies.clear();
+    m_data_packets_expected = 0;
+    for (flash_chip& chip : m_chips)
+    {
+      chip.mode = FLASH_READ;
+    }
+    throw usb::disconnected_exception();
+  }
+  
+  // The host controller retries NAKed packets on its own, so a storm only
+  // shows as transfers taking longer, until they take longer than the timeout
+  if (m_nak_transfers_left == 0 && roll(faults.nak_storm_rate))
+  {
+    ++m_fault_counts.nak_storms;
+    m_nak_transfers_left = faults.nak_storm_transfers;
+  }
+  if (m_nak_transfers_left > 0)
+  {
+    --m_nak_transfers_left;
+    if (m_timeout > 0 && faults.nak_delay_us >= (unsigned long long) m_timeout * 1000)
+    {
+      *done += std::chrono::milliseconds(m_timeout);
+      ++m_fault_counts.timeouts;
+      return FAULT_TIMEOUT;
+    }
+    *done += std::chrono::microseconds(faults.nak_delay_us);
+  }
+  
+  if (roll(faults.timeout_rate))
+  {
+    ++m_fault_counts.timeouts;
+    return FAULT_TIMEOUT;
+  }
+  if (is_read && num_bytes > PACKET_SIZE && roll(faults.short_read_rate))
+  {
+    ++m_fault_counts.short_reads;
+    return FAULT_SHORT_READ;
+  }
+  if (is_read && roll(faults.corrupt_rate))
+  {
+    ++m_fault_counts.corrupted_packets;
+    return FAULT_CORRUPT;
+  }
+  return FAULT_NONE;
+}
+
+bool emulated_usb_device::roll(double rate)
+{
+  return rate > 0 && (double) (m_fault_rng() - std::minstd_rand::min())
+                     / ((double) std::minstd_rand::max() - std::minstd_rand::min() + 1) < rate;
+}
+
+emulated_usb_device::packet_t& emulated_usb_device::queue_reply()
+{
+  m_replies.push_back(packet_t());
+  m_replies.back().fill(0);
+  return m_replies.back();
+}
+
+
+
+void emulated_usb_device::handle_packet(const data_t* packet)
+{
+  if (m_data_packets_expected > 0)
+  {
+    handle_data_packet(packet);
+  }
+  else if (m_options.system == LINKMASTA_WONDERSWAN)
+  {
+    handle_ws_command(packet);
+  }
+  else
+  {
+    handle_ngp_command(packet);
+  }
+}
+
+void emulated_usb_device::handle_ngp_command(const data_t* packet)
+{
+  using namespace ngpmsg;
+  
+  // The message parsers don't take const buffers
+  packet_t command;
+  std::copy(packet, packet + PACKET_SIZE, command.begin());
+  uint8_t* buf = command.data();
+  
+  uint8_t addr_hb, addr_mb, addr_lb, chip, data, n, bypass;
+  uint8_t* payload;
+  
+  switch (buf[MSG_TYPE_OFFSET])
+  {
+  case MSG_GETVERSION:
+    build_getversion_reply(queue_reply().data(), m_options.firmware_major_version, m_options.firmware_minor_version);
+    break;
+  
+  case MSG_READ_CMD:
+    get_read_message(buf, &addr_hb, &addr_mb, &addr_lb, &chip);
+    data = read_chip(chip, (addr_hb << 16) | (addr_mb << 8) | addr_lb);
+    build_read_reply(queue_reply().data(), addr_hb, addr_mb, addr_lb, data, chip);
+    break;
+  
+  case MSG_WRITE_CMD:
+    get_write_message(buf, &addr_hb, &addr_mb, &addr_lb, &data, &chip);
+    write_chip(chip, (addr_hb << 16) | (addr_mb << 8) | addr_lb, data);
+    build_reply_success(queue_reply().data());
+    break;
+  
+  case MSG_READ64xN_CMD:
+    get_read64xN_message(buf, &addr_hb, &addr_mb, &addr_lb, &chip, &n);
+    for (unsigned int i = 0; i < (unsigned int) n * PACKET_SIZE; ++i)
+    {
+      if (i % PACKET_SIZE == 0)
+      {
+        queue_reply();
+      }
+      m_replies.back()[i % PACKET_SIZE] = read_chip(chip, ((addr_hb << 16) | (addr_mb << 8) | addr_lb) + i);
+    }
+    break;
+  
+  case MSG_FLASHWRITE32_CMD:
+  case MSG_FLASHWRITE_N_CMD:
+    if (buf[MSG_TYPE_OFFSET] == MSG_FLASHWRITE32_CMD)
+    {
+      payload = get_flash_write_32_command(buf, &addr_hb, &addr_mb, &addr_lb, &chip, &bypass);
+      n = 32;
+    }
+    else
+    {
+      payload = get_flash_write_N_command(buf, &addr_hb, &addr_mb, &addr_lb, &chip, &n, &bypass);
+    }
+    if (chip >= m_chips.size() || !m_chips[chip].present || is_erasing(m_chips[chip]))
+    {
+      build_reply_fail(queue_reply().data());
+      break;
+    }
+    for (unsigned int i = 0; i < n && i < PACKET_SIZE / 2; ++i)
+    {
+      program_array(m_chips[chip], ((addr_hb << 16) | (addr_mb << 8) | addr_lb) + i, payload[i]);
+    }
+    build_reply_success(queue_reply().data());
+    break;
+  
+  case MSG_FLASHWRITE64xN_CMD:
+    get_flash_write64xN_message(buf, &addr_hb, &addr_mb, &addr_lb, &chip, &n, &bypass);
+    m_data_packets_expected = n;
+    m_data_packets_received = 0;
+    m_data_packets_programmed = 0;
+    m_data_chip = chip;
+    m_data_address = (addr_hb << 16) | (addr_mb << 8) | addr_lb;
+    m_data_to_sram = false;
+    if (n == 0)
+    {
+      build_flash_write64xN_reply(queue_reply().data(), 0);
+    }
+    break;
+  
+  case MSG_BLINK_LED:
+    // Nothing to see here
+    break;
+  
+  default:
+    build_reply_fail(queue_reply().data());
+    break;
+  }
+}
+
+void emulated_usb_device::handle_ws_command(const data_t* packet)
+{
+  using namespace wsmsg;
+  
+  // The message parsers don't take const buffers
+  packet_t command;
+  std::copy(packet, packet + PACKET_SIZE, command.begin());
+  uint8_t* buf = command.data();
+  
+  uint8_t addr_hb, addr_mb, addr_lb, addr_no, target, data, data_hb, n;
+  uint8_t data16[2];
+  uint8_t* payload;
+  address_t address;
+  
+  switch (buf[MSG_TYPE_OFFSET])
+  {
+  case MSG_GETVERSION:
+    build_getversion_reply(queue_reply().data(), m_options.firmware_major_version, m_options.firmware_minor_version);
+    break;
+  
+  case MSG_WS_GET_CARTINFO_CMD:
+    build_getcartinfo_reply(queue_reply().data(), 1, 1, (uint8_t) m_options.num_slots, (uint8_t) m_options.slot_addr_lines);
+    break;
+  
+  case MSG_WS_SET_CARTSLOT_CMD:
+    get_set_cartslot_command(buf, &data);
+    if (data < m_options.num_slots)
+    {
+      m_current_slot = data;
+      build_reply_success(queue_reply().data());
+    }
+    else
+    {
+      build_reply_fail(queue_reply().data());
+    }
+    break;
+  
+  case MSG_READ_CMD:
+  case MSG_WS_READ16_CMD:
+    get_read_message(buf, &addr_hb, &addr_mb, &addr_lb, &addr_no, &target);
+    address = ws_address(addr_hb, addr_mb, addr_lb, addr_no);
+    data16[1] = 0xFF;
+    
+    // An 8-bit read only touches one byte, so that the status of an erasing
+    // chip toggles once per read
+    for (unsigned int i = 0; i < (buf[MSG_TYPE_OFFSET] == MSG_READ_CMD ? 1u : 2u); ++i)
+    {
+      switch (target)
+      {
+      case TARGET_ROM:  data16[i] = read_chip(0, ws_rom_address(address + i)); break;
+      case TARGET_SRAM: data16[i] = m_sram[(address + i) % m_sram.size()]; break;
+      default:          data16[i] = 0xFF; break;
+      }
+    }
+    if (buf[MSG_TYPE_OFFSET] == MSG_READ_CMD)
+    {
+      build_read8_reply(queue_reply().data(), addr_hb, addr_mb, addr_lb, addr_no, data16[0]);
+    }
+    else
+    {
+      build_read16_reply(queue_reply().data(), addr_hb, addr_mb, addr_lb, data16[1], data16[0]);
+    }
+    break;
+  
+  case MSG_WRITE_CMD:
+  case MSG_WS_WRITE16_CMD:
+    if (buf[MSG_TYPE_OFFSET] == MSG_WRITE_CMD)
+    {
+      get_write8_message(buf, &addr_hb, &addr_mb, &addr_lb, &addr_no, &data, &target);
+      data_hb = 0;
+    }
+    else
+    {
+      get_write16_message(buf, &addr_hb, &addr_mb, &addr_lb, &data_hb, &data, &target);
+      addr_no = 0;
+    }
+    address = ws_address(addr_hb, addr_mb, addr_lb, addr_no);
+    switch (target)
+    {
+    case TARGET_ROM:
+      // Flash commands only ever use the low byte
+      write_chip(0, ws_rom_address(address), data);
+      break;
+    
+    case TARGET_SRAM:
+      m_sram[address % m_sram.size()] = data;
+      if (buf[MSG_TYPE_OFFSET] == MSG_WS_WRITE16_CMD)
+      {
+        m_sram[(address + 1) % m_sram.size()] = data_hb;
+      }
+      break;
+    }
+    build_reply_success(queue_reply().data());
+    break;
+  
+  case MSG_READ64xN_CMD:
+    get_read64xN_message(buf, &addr_hb, &addr_mb, &addr_lb, &addr_no, &n, &target);
+    address = ws_address(addr_hb, addr_mb, addr_lb, addr_no);
+    for (unsigned int i = 0; i < (unsigned int) n * PACKET_SIZE; ++i)
+    {
+      if (i % PACKET_SIZE == 0)
+      {
+        queue_reply();
+      }
+      switch (target)
+      {
+      case TARGET_ROM:  data = read_chip(0, ws_rom_address(address + i)); break;
+      case TARGET_SRAM: data = m_sram[(address + i) % m_sram.size()]; break;
+      default:          data = 0xFF; break;
+      }
+      m_replies.back()[i % PACKET_SIZE] = data;
+    }
+    break;
+  
+  case MSG_FLASHWRITE32_CMD:
+  case MSG_FLASHWRITE_N_CMD:
+    if (buf[MSG_TYPE_OFFSET] == MSG_FLASHWRITE32_CMD)
+    {
+      payload = get_flash_write_32_command(buf, &addr_hb, &addr_mb, &addr_lb, &addr_no);
+      n = 32;
+    }
+    else
+    {
+      payload = get_flash_write_N_command(buf, &addr_hb, &addr_mb, &addr_lb, &addr_no, &n);
+    }
+    if (is_erasing(m_chips[0]))
+    {
+      build_reply_fail(queue_reply().data());
+      break;
+    }
+    address = ws_address(addr_hb, addr_mb, addr_lb, addr_no);
+    for (unsigned int i = 0; i < n && i < PACKET_SIZE / 2; ++i)
+    {
+      program_array(m_chips[0], ws_rom_address(address + i), payload[i]);
+    }
+    build_reply_success(queue_reply().data());
+    break;
+  
+  case MSG_FLASHWRITE64xN_CMD:
+  case MSG_WS_SRAMWRITE64xN_CMD:
+    if (buf[MSG_TYPE_OFFSET] == MSG_FLASHWRITE64xN_CMD)
+    {
+      get_flash_write64xN_message(buf, &addr_hb, &addr_mb, &addr_lb, &addr_no, &n);
+    }
+    else
+    {
+      get_sram_write64xN_message(buf, &addr_hb, &addr_mb, &addr_lb, &addr_no, &n);
+    }
+    m_data_packets_expected = n;
+    m_data_packets_received = 0;
+    m_data_packets_programmed = 0;
+    m_data_chip = 0;
+    m_data_address = ws_address(addr_hb, addr_mb, addr_lb, addr_no);
+    m_data_to_sram = (buf[MSG_TYPE_OFFSET] == MSG_WS_SRAMWRITE64xN_CMD);
+    if (n == 0)
+    {
+      build_write64xN_reply(queue_reply().data(), 0);
+    }
+    break;
+  
+  case MSG_BLINK_LED:
+    // Nothing to see here
+    break;
+  
+  default:
+    build_reply_fail(queue_reply().data());
+    break;
+  }
+}
+
+void emulated_usb_device::handle_data_packet(const data_t* packet)
+{
+  address_t address = m_data_address + m_data_packets_received * PACKET_SIZE;
+  ++m_data_packets_received;
+  
+  if (m_data_to_sram)
+  {
+    for (unsigned int i = 0; i < PACKET_SIZE; ++i)
+    {
+      m_sram[(address + i) % m_sram.size()] = packet[i];
+    }
+    ++m_data_packets_programmed;
+  }
+  else if (m_data_chip < m_chips.size() && m_chips[m_data_chip].present
+           && !is_erasing(m_chips[m_data_chip]))
+  {
+    for (unsigned int i = 0; i < PACKET_SIZE; ++i)
+    {
+      if (m_options.system == LINKMASTA_WONDERSWAN)
+      {
+        program_array(m_chips[m_data_chip], ws_rom_address(address + i), packet[i]);
+      }
+      else
+      {
+        program_array(m_chips[m_data_chip], address + i, packet[i]);
+      }
+    }
+    ++m_data_packets_programmed;
+  }
+  
+  // Packets that could not be programmed are left out of the count in the
+  // reply, and both protocols use the same reply layout
+  if (m_data_packets_received == m_data_packets_expected)
+  {
+    ngpmsg::build_flash_write64xN_reply(queue_reply().data(), (uint8_t) m_data_packets_programmed);
+    m_data_packets_expected = 0;
+  }
+}
+
+
+
+data_t emulated_usb_device::read_chip(unsigned int chip_i, address_t address)
+{
+  if (chip_i >= m_chips.size())
+  {
+    return 0xFF;
+  }
+  
+  flash_chip& chip = m_chips[chip_i];
+  if (!chip.present)
+  {
+    return chip.bus_value;
+  }
+  
+  if (is_erasing(chip))
+  {
+    data_t status = chip.toggle;
+    chip.toggle = (chip.toggle == ERASE_STATUS_1 ? ERASE_STATUS_2 : ERASE_STATUS_1);
+    return status;
+  }
+  
+  if (chip.mode == FLASH_AUTOSELECT)
+  {
+    unsigned int shift = (m_options.system == LINKMASTA_WONDERSWAN ? WS_AUTOSELECT_SHIFT : NGP_AUTOSELECT_SHIFT);
+    switch ((address >> shift) & 0xFF)
+    {
+    case 0x00:  return m_options.manufacturer_id;
+    case 0x01:  return m_options.device_id;
+    case 0x02:  return 0x00; // Block not protected
+    case 0x03:  return m_options.factory_prot;
+    default:    return 0x00;
+    }
+  }
+  
+  return read_array(chip, address);
+}
+
+void emulated_usb_device::write_chip(unsigned int chip_i, address_t address, data_t data)
+{
+  if (chip_i >= m_chips.size())
+  {
+    return;
+  }
+  
+  flash_chip& chip = m_chips[chip_i];
+  chip.bus_value = data;
+  if (!chip.present || is_erasing(chip))
+  {
+    // Commands written while erasing are ignored
+    return;
+  }
+  
+  address_t command1, command2, command;
+  if (m_options.system == LINKMASTA_WONDERSWAN)
+  {
+    command1 = WS_ADDR_COMMAND1;
+    command2 = WS_ADDR_COMMAND2;
+    command = address & WS_ADDR_COMMAND_MASK;
+  }
+  else
+  {
+    command1 = NGP_ADDR_COMMAND1;
+    command2 = NGP_ADDR_COMMAND2;
+    command = address & NGP_ADDR_COMMAND_MASK;
+  }
+  
+  switch (chip.mode)
+  {
+  case FLASH_READ:
+  case FLASH_AUTOSELECT:
+    if (data == 0xF0)
+    {
+      chip.mode = FLASH_READ;
+    }
+    else if (command == command1 && data == 0xAA)
+    {
+      chip.mode = FLASH_UNLOCK1;
+    }
+    break;
+  
+  case FLASH_UNLOCK1:
+    chip.mode = (command == command2 && data == 0x55 ? FLASH_UNLOCK2 : FLASH_READ);
+    break;
+  
+  case FLASH_UNLOCK2:
+    chip.mode = FLASH_READ;
+    if (command == command1)
+    {
+      switch (data)
+      {
+      case 0x90:  chip.mode = FLASH_AUTOSELECT; break;
+      case 0xA0:  chip.mode = FLASH_PROGRAM; break;
+      case 0x80:  chip.mode = FLASH_ERASE_SETUP; break;
+      case 0x20:  chip.mode = FLASH_BYPASS; break;
+      }
+    }
+    break;
+  
+  case FLASH_PROGRAM:
+    program_array(chip, address, data);
+    chip.mode = FLASH_READ;
+    break;
+  
+  case FLASH_ERASE_SETUP:
+    chip.mode = (command == command1 && data == 0xAA ? FLASH_ERASE_UNLOCK1 : FLASH_READ);
+    break;
+  
+  case FLASH_ERASE_UNLOCK1:
+    chip.mode = (command == command2 && data == 0x55 ? FLASH_ERASE_UNLOCK2 : FLASH_READ);
+    break;
+  
+  case FLASH_ERASE_UNLOCK2:
+    chip.mode = FLASH_READ;
+    if (command == command1 && data == 0x10)
+    {
+      erase_array(chip, 0, chip.num_bytes, m_options.chip_erase_ms);
+    }
+    else if (data == 0x30)
+    {
+      erase_block(chip, address);
+    }
+    break;
+  
+  case FLASH_BYPASS:
+    if (data == 0xA0)
+    {
+      chip.mode = FLASH_BYPASS_PROGRAM;
+    }
+    else if (data == 0x90)
+    {
+      chip.mode = FLASH_BYPASS_RESET;
+    }
+    break;
+  
+  case FLASH_BYPASS_PROGRAM:
+    program_array(chip, address, data);
+    chip.mode = FLASH_BYPASS;
+    break;
+  
+  case FLASH_BYPASS_RESET:
+    chip.mode = (data == 0x00 ? FLASH_READ : FLASH_BYPASS);
+    break;
+  }
+}
+
+data_t emulated_usb_device::read_array(const flash_chip& chip, address_t address) const
+{
+  address %= chip.num_bytes;
+  auto page = chip.pages.find(address - address % PAGE_SIZE);
+  if (page == chip.pages.end())
+  {
+    return 0xFF;
+  }
+  return page->second[address % PAGE_SIZE];
+}
+
+void emulated_usb_device::program_array(flash_chip& chip, address_t address, data_t data)
+{
+  address %= chip.num_bytes;
+  std::vector<data_t>& page = chip.pages[address - address % PAGE_SIZE];
+  if (page.empty())
+  {
+    page.resize(PAGE_SIZE, 0xFF);
+  }
+  
+  // Programming can only clear bits
+  page[address % PAGE_SIZE] &= data;
+}
+
+void emulated_usb_device::erase_array(flash_chip& chip, address_t address, unsigned int num_bytes, unsigned int erase_ms)
+{
+  chip.pages.erase(chip.pages.lower_bound(address), chip.pages.lower_bound(address + num_bytes));
+  chip.erase_done = clock_t::now() + std::chrono::milliseconds(erase_ms);
+  chip.toggle = ERASE_STATUS_1;
+}
+
+void emulated_usb_device::erase_block(flash_chip& chip, address_t address)
+{
+  address %= chip.num_bytes;
+  
+  if (m_options.system == LINKMASTA_WONDERSWAN)
+  {
+    address -= address % WS_BLOCK_SIZE;
+    erase_array(chip, address, WS_BLOCK_SIZE, m_options.block_erase_ms);
+    return;
+  }
+  
+  // The last 64 KiB of a Neo Geo Pocket chip is split into blocks of 32 KiB,
+  // 8 KiB, 8 KiB, and 16 KiB
+  address_t last_block = chip.num_bytes - NGP_BLOCK_SIZE;
+  if (address < last_block)
+  {
+    address -= address % NGP_BLOCK_SIZE;
+    erase_array(chip, address, NGP_BLOCK_SIZE, m_options.block_erase_ms);
+  }
+  else if (address < last_block + 0x8000)
+  {
+    erase_array(chip, last_block, 0x8000, m_options.block_erase_ms);
+  }
+  else if (address < last_block + 0xA000)
+  {
+    erase_array(chip, last_block + 0x8000, 0x2000, m_options.block_erase_ms);
+  }
+  else if (address < last_block + 0xC000)
+  {
+    erase_array(chip, last_block + 0xA000, 0x2000, m_options.block_erase_ms);
+  }
+  else
+  {
+    erase_array(chip, last_block + 0xC000, 0x4000, m_options.block_erase_ms);
+  }
+}
+
+bool emulated_usb_device::is_erasing(const flash_chip& chip) const
+{
+  return clock_t::now() < chip.erase_done;
+}
+
+
+
+address_t emulated_usb_device::ws_address(data_t addr_hb, data_t addr_mb, data_t addr_lb, data_t addr_no)
+{
+  // Addresses are sent as word addresses, with the low bit of the byte address
+  // sent separately
+  address_t address = ((address_t) addr_hb << 16) | ((address_t) addr_mb << 8) | addr_lb;
+  return (address << 1) | (addr_no & 0x01);
+}
+
+address_t emulated_usb_device::ws_rom_address(address_t address) const
+{
+  // Addresses are relative to the current slot
+  address_t slot_size = (address_t) 1 << m_options.slot_addr_lines;
+  return m_current_slot * slot_size + (address % slot_size);
+}
@@ -0,0 +1,570 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref emulated_usb_device
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref emulated_usb_device class. This file includes the minimal number of
+ *  files necessary to use any instance of the \ref emulated_usb_device class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __EMULATED_USB_DEVICE_H__
+#define __EMULATED_USB_DEVICE_H__
+
+#include "usb/usb_device.h"
+#include "linkmasta_device.h"
+#include <array>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+/*! \class emulated_usb_device
+ *  \brief In-process stand-in for a LinkMasta device attached over USB.
+ *  
+ *  Implementation of \ref usb::usb_device that, rather than talking to
+ *  hardware, runs the Neo Geo Pocket or WonderSwan LinkMasta message protocol
+ *  against an in-memory model of the cartridge's flash. Passing an instance of
+ *  this class to \ref ngp_linkmasta_device or \ref ws_linkmasta_device
+ *  allows cartridge operations, benchmarks, and the rest of the transfer
+ *  pipeline to be exercised without a device attached.
+ *  
+ *  Flash chips are modelled as AMD-style command state machines, including
+ *  autoselect, unlock bypass, programming (which can only clear bits), and
+ *  block and chip erase. Erases take a configurable amount of time, during
+ *  which reads of the chip toggle as they would on real hardware.
+ *  
+ *  Every transfer takes at least the configured latency from submission to
+ *  completion, and transfers share a bus of the configured bandwidth.
+ *  Asynchronous transfers overlap their latency the way real pipelined
+ *  transfers do, so the effect of batching and pipelining can be measured.
+ *  A read for which the device has nothing to send fails with
+ *  \ref usb::timeout_exception right away rather than waiting out the
+ *  timeout.
+ *  
+ *  Faults can be injected at configurable rates, see \ref fault_options, so
+ *  that the retry, resume, and recovery paths can be exercised and timed
+ *  without misbehaving hardware. With every rate left at 0 a transfer costs
+ *  no more than a single check.
+ *  
+ *  This class is *not* thread-safe. Use caution when working in a multithreaded
+ *  environment.
+ */
+class emulated_usb_device : public usb::usb_device
+{
+public:
+  
+  /*!
+   *  \brief Rates at which faults are injected into transfers.
+   *  
+   *  Rates are the fraction of eligible transfers, from 0 for never to 1 for
+   *  every one, drawn from a generator seeded with \ref seed so that a run
+   *  can be repeated exactly.
+   */
+  struct fault_options
+  {
+    /*! \brief Transfers that time out. A read leaves its data unread and a
+     *         write never reaches the firmware, as a glitch on the bus
+     *         would. */
+    double                  timeout_rate;
+    
+    /*! \brief Reads of more than one packet that end early, leaving the
+     *         packets they didn't collect for the next read. */
+    double                  short_read_rate;
+    
+    /*! \brief Transfers that start a NAK storm, in which the next
+     *         \ref nak_storm_transfers transfers are each held up by
+     *         \ref nak_delay_us. A transfer held up for longer than the
+     *         timeout times out once the timeout has passed. */
+    double                  nak_storm_rate;
+    unsigned int            nak_storm_transfers;
+    unsigned int            nak_delay_us;
+    
+    /*! \brief Reads with a byte of one of their packets flipped. */
+    double                  corrupt_rate;
+    
+    /*! \brief Number of transfers after which the device drops off the
+     *         bus, after which every transfer fails with
+     *         \ref usb::disconnected_exception until the device is closed and
+     *         opened again, as if it had been plugged back in. 0 for never. */
+    unsigned int            disconnect_interval;
+    
+    /*! \brief Seed of the generator deciding which transfers fail. */
+    unsigned int            seed;
+    
+    /*!
+     *  \brief Initializes the options to inject no faults.
+     */
+    fault_options();
+    
+    /*!
+     *  \brief Determines whether any fault is enabled.
+     */
+    bool                    any() const;
+  };
+  
+  /*!
+   *  \brief Number of each kind of fault injected so far.
+   */
+  struct fault_counts
+  {
+    unsigned int            timeouts;
+    unsigned int            short_reads;
+    unsigned int            nak_storms;
+    unsigned int            corrupted_packets;
+    unsigned int            disconnects;
+  };
+  
+  /*!
+   *  \brief Parameters of the emulated device.
+   */
+  struct options
+  {
+    /*! \brief The system whose LinkMasta protocol to emulate. */
+    linkmasta_system        system;
+    
+    /*! \brief Minimum time in microseconds from submitting a transfer to its
+     *         completion. */
+    unsigned int            latency_us;
+    
+    /*! \brief Bandwidth of the bus shared by all transfers. 0 for unlimited. */
+    unsigned int            bytes_per_second;
+    
+    /*! \brief Largest packet reported for the bulk endpoints. 512 emulates
+     *         a high-speed device. */
+    unsigned int            max_packet_size;
+    
+    /*! \brief Makes every Nth read of more than one packet time out,
+     *         leaving its data unread as a glitch on the bus would. 0 for
+     *         never. */
+    unsigned int            fail_read_interval;
+    
+    /*! \brief Faults injected at random. */
+    fault_options           faults;
+    
+    /*! \brief Time taken to erase a single block. */
+    unsigned int            block_erase_ms;
+    
+    /*! \brief Time taken to erase an entire chip. */
+    unsigned int            chip_erase_ms;
+    
+    /*! \brief USB product ID reported by the device. */
+    int                     product_id;
+    
+    /*! \brief Firmware version reported by the device. */
+    unsigned char           firmware_major_version;
+    unsigned char           firmware_minor_version;
+    
+    /*! \brief Serial number reported by the device. */
+    std::string             serial_number;
+    
+    /*! \brief Number of flash chips present. Only 1 or 2 are meaningful for
+     *         a Neo Geo Pocket cartridge. */
+    unsigned int            num_chips;
+    
+    /*! \brief Manufacturer ID reported by each chip in autoselect mode. */
+    unsigned char           manufacturer_id;
+    
+    /*! \brief Device ID reported by each chip in autoselect mode. On a Neo
+     *         Geo Pocket cartridge, also determines the size of the chip. */
+    unsigned char           device_id;
+    
+    /*! \brief Factory protection value reported by each chip. 0x85
+     *         identifies a Neo Geo Pocket FlashMasta. */
+    unsigned char           factory_prot;
+    
+    /*! \brief Number of slots on a WonderSwan cartridge. */
+    unsigned int            num_slots;
+    
+    /*! \brief Number of address lines per WonderSwan slot, such that each slot
+     *         holds 2^slot_addr_lines bytes. */
+    unsigned int            slot_addr_lines;
+    
+    /*! \brief Size in bytes of the WonderSwan cartridge's save RAM. */
+    unsigned int            sram_size;
+    
+    /*!
+     *  \brief Initializes the options to those of a typical FlashMasta of the
+     *         given system with an instantaneous transport.
+     *  
+     *  \param [in] system The system whose LinkMasta to emulate.
+     */
+    explicit options(linkmasta_system system = LINKMASTA_NEO_GEO_POCKET);
+  };
+  
+  
+  
+  /*!
+   *  \brief Main constructor for the class.
+   *  
+   *  \param [in] opts Parameters of the device to emulate. The flash starts out
+   *         fully erased.
+   */
+                            emulated_usb_device(const options& opts);
+  
+  /*!
+   *  \brief The destructor for the class.
+   */
+                            ~emulated_usb_device();
+  
+  /*!
+   *  \see usb_device::init()
+   */
+  void                      init();
+  
+  
+  
+  /*!
+   *  \see usb_device::timeout()
+   */
+  timeout_t                 timeout() const;
+  
+  /*!
+   *  \see usb_device::configuration()
+   */
+  configuration_t           configuration() const;
+  
+  /*!
+   *  \see usb_device::interface()
+   */
+  interface_t               interface() const;
+  
+  /*!
+   *  \see usb_device::input_endpoint()
+   */
+  endpoint_t                input_endpoint() const;
+  
+  /*!
+   *  \see usb_device::output_endpoint()
+   */
+  endpoint_t                output_endpoint() const;
+  
+  /*!
+   *  \see usb_device::get_device_description()
+   */
+  const device_description* get_device_description() const;
+  
+  /*!
+   *  \see usb_device::get_manufacturer_string()
+   */
+  std::string               get_manufacturer_string();
+  
+  /*!
+   *  \see usb_device::get_product_string()
+   */
+  std::string               get_product_string();
+  
+  /*!
+   *  \see usb_device::get_serial_number()
+   */
+  std::string               get_serial_number();
+  
+  /*!
+   *  \see usb_device::max_packet_size(endpoint_t endpoint)
+   */
+  unsigned int              max_packet_size(endpoint_t endpoint) const;
+  
+  
+  
+  /*!
+   *  \see usb_device::set_timeout(timeout_t timeout)
+   */
+  void                      set_timeout(timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::set_configuration(configuration_t configuration)
+   */
+  void                      set_configuration(configuration_t configuration);
+  
+  /*!
+   *  \see usb_device::set_interface(interface_t interface)
+   */
+  void                      set_interface(interface_t interface);
+  
+  /*!
+   *  \see usb_device::set_input_endpoint(endpoint_t input_endpoint)
+   */
+  void                      set_input_endpoint(endpoint_t input_endpoint);
+  
+  /*!
+   *  \see usb_device::set_output_endpoint(endpoint_t output_endpoint)
+   */
+  void                      set_output_endpoint(endpoint_t output_endpoint);
+  
+  
+  
+  /*!
+   *  \see usb_device::open()
+   */
+  void                      open();
+  
+  /*!
+   *  \see usb_device::close()
+   */
+  void                      close();
+  
+  /*!
+   *  \see usb_device::read(data_t* data, unsigned int num_bytes)
+   */
+  unsigned int              read(data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::read(data_t* data, unsigned int num_bytes, timeout_t timeout)
+   */
+  unsigned int              read(data_t* data, unsigned int num_bytes, timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::write(const data_t* buffer, unsigned int num_bytes)
+   */
+  unsigned int              write(const data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+   */
+  unsigned int              write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::write(data_t* buffer, unsigned int num_bytes)
+   */
+  unsigned int              write(data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::write(data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+   */
+  unsigned int              write(data_t* buffer, unsigned int num_bytes, timeout_t timeout);
+  
+  
+  
+  /*!
+   *  \see usb_device::supports_async_transfers()
+   */
+  bool                      supports_async_transfers() const;
+  
+  /*!
+   *  \see usb_device::max_pending_transfers()
+   */
+  unsigned int              max_pending_transfers() const;
+  
+  /*!
+   *  \see usb_device::set_max_pending_transfers(unsigned int max_pending)
+   */
+  void                      set_max_pending_transfers(unsigned int max_pending);
+  
+  /*!
+   *  \see usb_device::num_pending_transfers()
+   */
+  unsigned int              num_pending_transfers() const;
+  
+  /*!
+   *  \see usb_device::submit_read(data_t* data, unsigned int num_bytes)
+   */
+  void                      submit_read(data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::submit_write(const data_t* data, unsigned int num_bytes)
+   */
+  void                      submit_write(const data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::complete_transfer()
+   */
+  unsigned int              complete_transfer();
+  
+  /*!
+   *  \see usb_device::cancel_pending_transfers()
+   */
+  void                      cancel_pending_transfers();
+
+  /*!
+   *  \see usb_device::recover()
+   */
+  bool                      recover();
+  
+  
+  
+  /*!
+   *  \brief Gets the number of each kind of fault injected so far.
+   */
+  const fault_counts&       injected_faults() const;
+
+
+
+private:
+  
+  /*! \brief Clock used for simulating transfer and erase times. */
+  typedef std::chrono::steady_clock      clock_t;
+  
+  /*! \brief A single USB packet. */
+  typedef std::array<data_t, 64>         packet_t;
+  
+  /*!
+   *  \brief Command state of an emulated flash chip.
+   */
+  enum flash_mode
+  {
+    FLASH_READ,
+    FLASH_UNLOCK1,
+    FLASH_UNLOCK2,
+    FLASH_AUTOSELECT,
+    FLASH_PROGRAM,
+    FLASH_ERASE_SETUP,
+    FLASH_ERASE_UNLOCK1,
+    FLASH_ERASE_UNLOCK2,
+    FLASH_BYPASS,
+    FLASH_BYPASS_PROGRAM,
+    FLASH_BYPASS_RESET
+  };
+  
+  /*!
+   *  \brief In-memory model of a single flash chip.
+   *  
+   *  Contents are stored sparsely in pages that are allocated when first
+   *  programmed, so that large, mostly erased chips are cheap to emulate.
+   */
+  struct flash_chip
+  {
+    /*! \brief Whether the chip responds at all. */
+    bool                    present;
+    
+    /*! \brief The size of the chip in bytes. */
+    unsigned int            num_bytes;
+    
+    /*! \brief The current command state of the chip. */
+    flash_mode              mode;
+    
+    /*! \brief Programmed pages, keyed by base address. Missing pages are
+     *         erased. */
+    std::map<address_t, std::vector<data_t>> pages;
+    
+    /*! \brief Time at which the erase in progress, if any, finishes. */
+    clock_t::time_point     erase_done;
+    
+    /*! \brief Status bits returned by the next read during an erase. */
+    data_t                  toggle;
+    
+    /*! \brief The last value written to the chip, read back from a chip that
+     *         is not present. */
+    data_t                  bus_value;
+  };
+  
+  /*!
+   *  \brief Fault injected into a single transfer.
+   */
+  enum fault_type
+  {
+    FAULT_NONE,
+    FAULT_TIMEOUT,
+    FAULT_SHORT_READ,
+    FAULT_CORRUPT
+  };
+  
+  /*!
+   *  \brief A transfer submitted but not yet completed.
+   */
+  struct pending_transfer
+  {
+    /*! \brief Destination of a read, or nullptr for a write. */
+    data_t*                 data;
+    
+    /*! \brief The number of bytes to transfer. */
+    unsigned int            num_bytes;
+    
+    /*! \brief The time at which the transfer completes. */
+    clock_t::time_point     done;
+    
+    /*! \brief The fault injected into the transfer. */
+    fault_type              fault;
+  };
+  
+  
+  
+  // Transport simulation
+  void                      validate_state() const;
+  clock_t::time_point       schedule_transfer(unsigned int num_bytes);
+  unsigned int              transfer_read(data_t* data, unsigned int num_bytes, fault_type fault = FAULT_NONE);
+  void                      transfer_write(const data_t* data, unsigned int num_bytes);
+  packet_t&                 queue_reply();
+  
+  // Fault injection
+  fault_type                next_fault(bool is_read, unsigned int num_bytes, clock_t::time_point* done);
+  bool                      roll(double rate);
+  
+  // Firmware emulation
+  void                      handle_packet(const data_t* packet);
+  void                      handle_ngp_command(const data_t* packet);
+  void                      handle_ws_command(const data_t* packet);
+  void                      handle_data_packet(const data_t* packet);
+  
+  // Flash emulation
+  data_t                    read_chip(unsigned int chip, address_t address);
+  void                      write_chip(unsigned int chip, address_t address, data_t data);
+  data_t                    read_array(const flash_chip& chip, address_t address) const;
+  void                      program_array(flash_chip& chip, address_t address, data_t data);
+  void                      erase_array(flash_chip& chip, address_t address, unsigned int num_bytes, unsigned int erase_ms);
+  void                      erase_block(flash_chip& chip, address_t address);
+  bool                      is_erasing(const flash_chip& chip) const;
+  
+  // WonderSwan address translation
+  static address_t          ws_address(data_t addr_hb, data_t addr_mb, data_t addr_lb, data_t addr_no);
+  address_t                 ws_rom_address(address_t address) const;
+  
+  
+  
+  const options             m_options;
+  device_description*       m_description;
+  
+  bool                      m_was_initialized;
+  bool                      m_is_open;
+  timeout_t                 m_timeout;
+  configuration_t           m_configuration;
+  interface_t               m_interface;
+  endpoint_t                m_input_endpoint;
+  endpoint_t                m_output_endpoint;
+  
+  /*! \brief Replies queued by the firmware, waiting to be read. */
+  std::deque<packet_t>      m_replies;
+  
+  /*! \brief Transfers submitted asynchronously, in order of submission. */
+  std::deque<pending_transfer> m_pending_transfers;
+  unsigned int              m_max_pending_transfers;
+  
+  /*! \brief The time at which the bus finishes its last scheduled transfer. */
+  clock_t::time_point       m_bus_free;
+  
+  /*! \brief Number of data packets still expected by a 64xN write command. */
+  unsigned int              m_data_packets_expected;
+  unsigned int              m_data_packets_received;
+  unsigned int              m_data_packets_programmed;
+  unsigned int              m_data_chip;
+  address_t                 m_data_address;
+  bool                      m_data_to_sram;
+  
+  std::vector<flash_chip>   m_chips;
+  std::vector<data_t>       m_sram;
+  unsigned int              m_current_slot;
+  
+  /*! \brief Number of reads since the last one made to fail. */
+  unsigned int              m_reads_since_failure;
+  
+  /*! \brief Whether any fault is injected, so that clean transfers skip the
+   *         rest. */
+  const bool                m_faults_enabled;
+  std::minstd_rand          m_fault_rng;
+  fault_counts              m_fault_counts;
+  
+  /*! \brief Transfers left in the NAK storm in progress. */
+  unsigned int              m_nak_transfers_left;
+  
+  /*! \brief Transfers since the device was last opened. */
+  unsigned int              m_transfers_since_open;
+  
+  /*! \brief Whether the device has dropped off the bus. */
+  bool                      m_disconnected;
+};
+
+#endif /* defined(__EMULATED_USB_DEVICE_H__) */
@@ -0,0 +1,244 @@
+/*! \file
+ *  \brief File containing the implementation of \ref job_client.
+ *  
+ *  File containing the implementation of \ref job_client.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see job_client
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-30
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "job_client.h"
+#include <stdexcept>
+
+#define LOOPBACK_HOST "127.0.0.1"
+
+using namespace std;
+
+
+
+job_client::job_client(event_listener listener)
+  : m_listener(listener), m_connected(false)
+{
+  // Nothing else to do
+}
+
+job_client::~job_client()
+{
+  disconnect();
+}
+
+void job_client::connect(unsigned short port)
+{
+  disconnect();
+  
+  m_socket.connect(LOOPBACK_HOST, port);
+  try
+  {
+    vector<unsigned char> out;
+    device_server_frame hello(JOB_SERVER_HELLO);
+    hello.put_u32(JOB_SERVER_MAGIC);
+    hello.put_u32(JOB_SERVER_PROTOCOL_VERSION);
+    hello.encode(out);
+    m_socket.send_all(out.data(), out.size());
+    
+    device_server_frame reply;
+    reply.receive(m_socket);
+    if (reply.type != JOB_SERVER_HELLO || reply.get_u32() != JOB_SERVER_MAGIC
+        || reply.get_u32() != JOB_SERVER_PROTOCOL_VERSION)
+    {
+      throw std::runtime_error("Incompatible job server on port " + to_string(port));
+    }
+  }
+  catch (...)
+  {
+    m_socket.close();
+    throw;
+  }
+  
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_connected = true;
+    m_replies.clear();
+    m_jobs.clear();
+  }
+  m_thread = std::thread(&job_client::receive_frames, this);
+  
+  // The server sends every job it knows of right after the hello, so once
+  // the reply to a request arrives, they all have
+  get_devices();
+}
+
+void job_client::disconnect()
+{
+  if (m_thread.joinable())
+  {
+    m_socket.shutdown();
+    m_thread.join();
+  }
+  m_socket.close();
+}
+
+bool job_client::is_connected()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_connected;
+}
+
+
+
+std::vector<job_server_device> job_client::get_devices()
+{
+  device_server_frame reply = call(device_server_frame(JOB_SERVER_DEVICES));
+  vector<job_server_device> devices(reply.get_u32());
+  for (job_server_device& device : devices)
+  {
+    device.device_id = reply.get_u32();
+    device.claimed = (reply.get_u8() != 0);
+    device.product = reply.get_string();
+    device.serial_number = reply.get_string();
+  }
+  return devices;
+}
+
+unsigned int job_client::submit_job(job_server_job_kind kind, unsigned int device_id, const std::string& path, int slot, int other_slot)
+{
+  device_server_frame request(JOB_SERVER_SUBMIT);
+  request.put_u8(kind);
+  request.put_u32(device_id);
+  request.put_u32((unsigned int) slot);
+  request.put_u32((unsigned int) other_slot);
+  request.put_string(path);
+  
+  device_server_frame reply = call(request);
+  bool submitted = (reply.get_u8() != 0);
+  unsigned int job_id = reply.get_u32();
+  string error = reply.get_string();
+  if (!submitted)
+  {
+    throw std::runtime_error(error);
+  }
+  return job_id;
+}
+
+void job_client::cancel_job(unsigned int job_id)
+{
+  device_server_frame request(JOB_SERVER_CANCEL);
+  request.put_u32(job_id);
+  send(request);
+}
+
+void job_client::set_job_priority(unsigned int job_id, int priority)
+{
+  device_server_frame request(JOB_SERVER_PRIORITY);
+  request.put_u32(job_id);
+  request.put_u32((unsigned int) priority);
+  send(request);
+}
+
+std::vector<job_server_event> job_client::get_jobs()
+{
+  lock_guard<mutex> lock(m_mutex);
+  vector<job_server_event> jobs;
+  for (auto& job_pair : m_jobs)
+  {
+    jobs.push_back(job_pair.second);
+  }
+  return jobs;
+}
+
+bool job_client::get_job(unsigned int job_id, job_server_event& event)
+{
+  lock_guard<mutex> lock(m_mutex);
+  auto it = m_jobs.find(job_id);
+  if (it == m_jobs.end())
+  {
+    return false;
+  }
+  event = it->second;
+  return true;
+}
+
+
+
+void job_client::receive_frames()
+{
+  try
+  {
+    while (true)
+    {
+      device_server_frame frame;
+      frame.receive(m_socket);
+      
+      if (frame.type != JOB_SERVER_EVENT)
+      {
+        lock_guard<mutex> lock(m_mutex);
+        m_replies.push_back(std::move(frame));
+        m_condition.notify_all();
+        continue;
+      }
+      
+      job_server_event event;
+      event.decode(frame);
+      {
+        lock_guard<mutex> lock(m_mutex);
+        m_jobs[event.job_id] = event;
+      }
+      if (m_listener)
+      {
+        m_listener(event);
+      }
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // The server is gone or the client disconnected
+  }
+  
+  lock_guard<mutex> lock(m_mutex);
+  m_connected = false;
+  m_condition.notify_all();
+}
+
+device_server_frame job_client::call(const device_server_frame& request)
+{
+  lock_guard<mutex> call_lock(m_call_mutex);
+  send(request);
+  
+  unique_lock<mutex> lock(m_mutex);
+  m_condition.wait(lock, [this] { return !m_connected || !m_replies.empty(); });
+  if (m_replies.empty())
+  {
+    throw std::runtime_error("Connection to job server lost");
+  }
+  
+  device_server_frame reply = std::move(m_replies.front());
+  m_replies.pop_front();
+  if (reply.type != request.type)
+  {
+    throw std::runtime_error("Unexpected reply from job server");
+  }
+  return reply;
+}
+
+void job_client::send(const device_server_frame& request)
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    if (!m_connected)
+    {
+      throw std::runtime_error("Not connected to a job server");
+    }
+  }
+  
+  vector<unsigned char> out;
+  request.encode(out);
+  lock_guard<mutex> send_lock(m_send_mutex);
+  m_socket.send_all(out.data(), out.size());
+}
@@ -0,0 +1,200 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref job_client class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref job_client class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-30
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __JOB_CLIENT_H__
+#define __JOB_CLIENT_H__
+
+#include "common/tcp_socket.h"
+#include "job_server_protocol.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*! \class job_client
+ *  \brief Client of a \ref job_server running on this machine.
+ *  
+ *  Client through which a front end runs jobs in the background process of a
+ *  \ref job_server rather than in its own. Jobs are submitted with
+ *  \ref submit_job() and keep running if the client disconnects or the
+ *  front end exits. The server reports the state of every job, including
+ *  those submitted by other clients, and the latest state of each is kept
+ *  here to be queried with \ref get_jobs() or handed to the event listener
+ *  as it arrives. The command line tool's **--watch** is such a client.
+ *  
+ *  Events are received by a thread of the client's own, which calls the
+ *  event listener. The listener must not call back into the client's
+ *  requests, such as \ref submit_job(), which wait for that same thread.
+ *  
+ *  This class is thread-safe.
+ */
+class job_client
+{
+public:
+  
+  /*!
+   *  \brief Function type called with every event the server sends.
+   */
+  typedef std::function<void(const job_server_event& event)> event_listener;
+  
+  /*!
+   *  \brief Class constructor. Does not connect.
+   *  
+   *  \param [in] listener Optional function to call on the client's thread
+   *         with every event received.
+   */
+  explicit                job_client(event_listener listener = nullptr);
+  
+  /*!
+   *  \brief Class destructor. Disconnects from the server. Jobs keep running.
+   */
+                          ~job_client();
+  
+  /*!
+   *  \brief Connects to the server on this machine and waits for it to
+   *         report the jobs it knows of.
+   *  
+   *  \param [in] port The TCP port the server listens on.
+   *  
+   *  \throws std::runtime_error If no server listens on the port or it does
+   *          not speak this version of the protocol.
+   */
+  void                    connect(unsigned short port = JOB_SERVER_DEFAULT_PORT);
+  
+  /*!
+   *  \brief Disconnects from the server. Jobs keep running.
+   */
+  void                    disconnect();
+  
+  /*!
+   *  \brief Gets whether the client is connected to a server.
+   */
+  bool                    is_connected();
+  
+  
+  
+  /*!
+   *  \brief Lists the devices attached to the server's machine.
+   *  
+   *  \throws std::runtime_error If the connection was lost.
+   */
+  std::vector<job_server_device> get_devices();
+  
+  /*!
+   *  \brief Queues a job on the server.
+   *  
+   *  \param [in] kind The kind of job to run.
+   *  \param [in] device_id The ID of the device to run the job on.
+   *  \param [in] path The path of the file the job reads or writes, on the
+   *         server's machine. Ignored by jobs that use no file.
+   *  \param [in] slot The slot to work on, or \ref cartridge::SLOT_ALL.
+   *  \param [in] other_slot The second slot of the job, if it uses one.
+   *         \see job_server_job_kind
+   *  
+   *  \return The ID of the newly queued job.
+   *  
+   *  \throws std::runtime_error If the server refused the job or the
+   *          connection was lost.
+   */
+  unsigned int            submit_job(job_server_job_kind kind, unsigned int device_id, const std::string& path, int slot = -1, int other_slot = -1);
+  
+  /*!
+   *  \brief Cancels a job on the server.
+   *  
+   *  \throws std::runtime_error If the connection was lost.
+   */
+  void                    cancel_job(unsigned int job_id);
+  
+  /*!
+   *  \brief Changes the priority of a job on the server.
+   *  
+   *  \see device_job_scheduler::set_job_priority()
+   *  
+   *  \throws std::runtime_error If the connection was lost.
+   */
+  void                    set_job_priority(unsigned int job_id, int priority);
+  
+  /*!
+   *  \brief Gets the latest state reported for every job, in order of ID.
+   */
+  std::vector<job_server_event> get_jobs();
+  
+  /*!
+   *  \brief Gets the latest state reported for a job.
+   *  
+   *  \param [out] event The state of the job.
+   *  
+   *  \return **false** if nothing was reported for the job yet.
+   */
+  bool                    get_job(unsigned int job_id, job_server_event& event);
+
+
+
+private:
+  job_client(const job_client& other) = delete;
+  job_client& operator=(const job_client& other) = delete;
+  
+  /*!
+   *  \brief Entry point of the thread receiving replies and events.
+   */
+  void                    receive_frames();
+  
+  /*!
+   *  \brief Sends a request and waits for its reply.
+   *  
+   *  \throws std::runtime_error If the connection was lost.
+   */
+  device_server_frame     call(const device_server_frame& request);
+  
+  /*!
+   *  \brief Sends a request that is never answered.
+   *  
+   *  \throws std::runtime_error If the connection was lost.
+   */
+  void                    send(const device_server_frame& request);
+  
+  
+  
+  /*! \brief Function called with every event. */
+  const event_listener    m_listener;
+  
+  /*! \brief The connection to the server. */
+  tcp_socket              m_socket;
+  
+  /*! \brief The thread receiving replies and events. */
+  std::thread             m_thread;
+  
+  /*! \brief Mutex serializing requests, so that replies arrive in the order
+   *         of their callers. */
+  std::mutex              m_call_mutex;
+  
+  /*! \brief Mutex keeping requests from interleaving on the socket. */
+  std::mutex              m_send_mutex;
+  
+  /*! \brief Everything below is guarded by this mutex. */
+  std::mutex              m_mutex;
+  std::condition_variable m_condition;
+  
+  /*! \brief Replies received but not yet collected by their caller. */
+  std::deque<device_server_frame> m_replies;
+  
+  /*! \brief The latest event received for every job. */
+  std::map<unsigned int, job_server_event> m_jobs;
+  
+  /*! \brief Whether the connection is up. */
+  bool                    m_connected;
+};
+
+#endif /* defined(__JOB_CLIENT_H__) */
@@ -0,0 +1,489 @@
+/*! \file
+ *  \brief File containing the implementation of \ref job_server.
+ *  
+ *  File containing the implementation of \ref job_server.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see job_server
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-30
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "job_server.h"
+#include "device_job_scheduler.h"
+#include "device_manager.h"
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+// How long accepting waits before checking whether to stop
+#define ACCEPT_INTERVAL_MS   250
+
+using namespace std;
+
+
+
+job_server::job_server(device_job_scheduler* scheduler, device_manager* manager, unsigned short port)
+  : m_scheduler(scheduler), m_manager(manager), m_port(port), m_stopping(false)
+{
+  // Nothing else to do
+}
+
+job_server::~job_server()
+{
+  stop();
+}
+
+void job_server::start()
+{
+  if (m_thread.joinable())
+  {
+    return;
+  }
+  
+  // Only front ends on this machine may submit jobs
+  m_socket.listen(m_port, true);
+  m_stopping = false;
+  m_thread = std::thread(&job_server::serve, this);
+  m_publisher = std::thread(&job_server::publish, this);
+}
+
+void job_server::stop()
+{
+  if (!m_thread.joinable())
+  {
+    return;
+  }
+  
+  m_stopping = true;
+  m_thread.join();
+  m_publisher.join();
+  m_socket.close();
+  
+  // Disconnecting the clients wakes their threads up
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (connection* c : m_connections)
+    {
+      lock_guard<mutex> connection_lock(c->mutex);
+      c->closed = true;
+      c->condition.notify_all();
+      c->socket.shutdown();
+    }
+  }
+  reap_connections(true);
+}
+
+unsigned int job_server::num_connections()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return (unsigned int) m_connections.size();
+}
+
+
+
+void job_server::serve()
+{
+  while (!m_stopping)
+  {
+    reap_connections(false);
+    
+    connection* c = new connection;
+    if (m_socket.accept(c->socket, ACCEPT_INTERVAL_MS))
+    {
+      c->subscribed = false;
+      c->closed = false;
+      c->finished = false;
+      
+      lock_guard<mutex> lock(m_mutex);
+      m_connections.push_back(c);
+      c->reader = std::thread(&job_server::read_requests, this, c);
+      c->writer = std::thread(&job_server::send_frames, this, c);
+    }
+    else
+    {
+      delete c;
+    }
+  }
+}
+
+void job_server::publish()
+{
+  // Jobs that are queued or finish wake the thread up between snapshots
+  unsigned long long changes = 0;
+  chrono::steady_clock::time_point next_snapshot = chrono::steady_clock::now();
+  while (!m_stopping)
+  {
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    bool snapshot = (now >= next_snapshot);
+    if (snapshot)
+    {
+      next_snapshot = now + chrono::milliseconds(JOB_SERVER_EVENT_INTERVAL_MS);
+    }
+    else
+    {
+      unsigned int wait_ms = (unsigned int) chrono::duration_cast<chrono::milliseconds>(next_snapshot - now).count() + 1;
+      if (!m_scheduler->wait_for_job_change(changes, wait_ms))
+      {
+        continue;
+      }
+    }
+    publish_events(snapshot);
+  }
+}
+
+void job_server::reap_connections(bool all)
+{
+  vector<connection*> finished;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (auto it = m_connections.begin(); it != m_connections.end();)
+    {
+      bool done;
+      {
+        lock_guard<mutex> connection_lock((*it)->mutex);
+        done = (*it)->finished;
+      }
+      
+      if (all || done)
+      {
+        finished.push_back(*it);
+        it = m_connections.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+  
+  for (connection* c : finished)
+  {
+    c->reader.join();
+    c->writer.join();
+    delete c;
+  }
+}
+
+void job_server::publish_events(bool snapshot)
+{
+  // Take a snapshot of every job without holding the server's lock, so that
+  // submitting a job never waits on the scheduler behind it
+  vector<job_server_event> events;
+  for (unsigned int job_id : m_scheduler->get_jobs())
+  {
+    device_job_scheduler::job_info info = m_scheduler->get_job_info(job_id);
+    job_server_event event;
+    event.job_id = info.job_id;
+    event.device_id = info.device_id;
+    event.status = info.status;
+    event.phase = info.phase;
+    event.work_expected = (unsigned int) std::max(info.work_expected, 0);
+    event.work_progress = (unsigned int) std::max(info.work_progress, 0);
+    event.work_per_second = (unsigned int) std::max(info.smoothed_work_per_second, 0.0);
+    event.result = info.result;
+    event.error = info.error;
+    events.push_back(event);
+  }
+  
+  lock_guard<mutex> lock(m_mutex);
+  vector<unsigned char> frames;
+  for (job_server_event& event : events)
+  {
+    auto kind = m_job_kinds.find(event.job_id);
+    if (kind != m_job_kinds.end())
+    {
+      event.kind = kind->second;
+    }
+    
+    // Between snapshots, progress waits however many updates the job makes
+    auto last = m_events.find(event.job_id);
+    if (last == m_events.end() || event.differs_in_outcome_from(last->second)
+        || (snapshot && event.differs_from(last->second)))
+    {
+      m_events[event.job_id] = event;
+      device_server_frame frame(JOB_SERVER_EVENT);
+      event.encode(frame);
+      frame.encode(frames);
+    }
+  }
+  
+  if (frames.empty())
+  {
+    return;
+  }
+  for (connection* c : m_connections)
+  {
+    lock_guard<mutex> connection_lock(c->mutex);
+    if (c->subscribed && !c->closed)
+    {
+      queue_frames(c, frames);
+    }
+  }
+}
+
+
+
+void job_server::read_requests(connection* c)
+{
+  try
+  {
+    bool keep_going = true;
+    while (keep_going)
+    {
+      device_server_frame frame;
+      frame.receive(c->socket);
+      keep_going = run_request(c, frame);
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // The client disconnected or broke the protocol
+  }
+  
+  lock_guard<mutex> lock(c->mutex);
+  c->closed = true;
+  c->condition.notify_all();
+}
+
+void job_server::send_frames(connection* c)
+{
+  unique_lock<mutex> lock(c->mutex);
+  while (true)
+  {
+    c->condition.wait(lock, [c] { return c->closed || !c->out.empty(); });
+    
+    // Whatever was queued before closing still goes out, such as the reply
+    // to an incompatible hello
+    if (!c->out.empty())
+    {
+      vector<unsigned char> frames;
+      frames.swap(c->out);
+      lock.unlock();
+      
+      try
+      {
+        c->socket.send_all(frames.data(), frames.size());
+      }
+      catch (std::exception& ex)
+      {
+        (void) ex;
+        // The client is gone
+        lock.lock();
+        c->closed = true;
+        break;
+      }
+      
+      lock.lock();
+      continue;
+    }
+    
+    if (c->closed)
+    {
+      break;
+    }
+  }
+  
+  // Wake the reader up if the client is still connected
+  c->socket.shutdown();
+  c->finished = true;
+}
+
+bool job_server::run_request(connection* c, device_server_frame& frame)
+{
+  switch (frame.type)
+  {
+  case JOB_SERVER_HELLO:
+  {
+    bool compatible = (frame.get_u32() == JOB_SERVER_MAGIC && frame.get_u32() == JOB_SERVER_PROTOCOL_VERSION);
+    vector<unsigned char> frames;
+    device_server_frame reply(JOB_SERVER_HELLO);
+    reply.put_u32(JOB_SERVER_MAGIC);
+    reply.put_u32(JOB_SERVER_PROTOCOL_VERSION);
+    reply.encode(frames);
+    
+    // Catch the client up on every job before it is sent the changes, all
+    // under the server's lock so that none are missed in between
+    lock_guard<mutex> lock(m_mutex);
+    if (compatible)
+    {
+      for (auto& event_pair : m_events)
+      {
+        device_server_frame event(JOB_SERVER_EVENT);
+        event_pair.second.encode(event);
+        event.encode(frames);
+      }
+    }
+    lock_guard<mutex> connection_lock(c->mutex);
+    queue_frames(c, frames);
+    c->subscribed = compatible;
+    return compatible;
+  }
+  
+  case JOB_SERVER_DEVICES:
+    list_devices(c);
+    return true;
+  
+  case JOB_SERVER_SUBMIT:
+    submit_job(c, frame);
+    return true;
+  
+  case JOB_SERVER_CANCEL:
+  {
+    unsigned int job_id = frame.get_u32();
+    try
+    {
+      m_scheduler->cancel_job(job_id);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Unknown jobs have nothing to cancel
+    }
+    return true;
+  }
+  
+  case JOB_SERVER_PRIORITY:
+  {
+    unsigned int job_id = frame.get_u32();
+    int priority = (int) frame.get_u32();
+    try
+    {
+      m_scheduler->set_job_priority(job_id, priority);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Unknown jobs have no priority to change
+    }
+    return true;
+  }
+  
+  default:
+    throw std::runtime_error("Unknown job server message " + std::to_string(frame.type));
+  }
+}
+
+void job_server::list_devices(connection* c)
+{
+  vector<device_server_frame> entries;
+  for (unsigned int id : m_manager->get_connected_devices())
+  {
+    device_server_frame entry;
+    try
+    {
+      entry.put_u32(id);
+      entry.put_u8(m_manager->is_device_claimed(id) ? 1 : 0);
+      entry.put_string(m_manager->get_product_string(id));
+      entry.put_string(m_manager->get_serial_number(id));
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // The device was disconnected in the meantime
+      continue;
+    }
+    entries.push_back(entry);
+  }
+  
+  device_server_frame reply(JOB_SERVER_DEVICES);
+  reply.put_u32((unsigned int) entries.size());
+  for (const device_server_frame& entry : entries)
+  {
+    reply.put_bytes(entry.payload.data(), (unsigned int) entry.payload.size());
+  }
+  
+  vector<unsigned char> frames;
+  reply.encode(frames);
+  lock_guard<mutex> lock(c->mutex);
+  queue_frames(c, frames);
+}
+
+void job_server::submit_job(connection* c, device_server_frame& frame)
+{
+  unsigned int kind = frame.get_u8();
+  unsigned int device_id = frame.get_u32();
+  int slot = (int) frame.get_u32();
+  int other_slot = (int) frame.get_u32();
+  string path = frame.get_string();
+  
+  device_server_frame reply(JOB_SERVER_SUBMIT);
+  try
+  {
+    // Submitting and recording the kind together keeps the job from being
+    // published without it
+    lock_guard<mutex> lock(m_mutex);
+    unsigned int job_id;
+    switch (kind)
+    {
+    case JOB_SERVER_BACKUP:
+      job_id = m_scheduler->submit_backup_job(device_id, path, slot);
+      break;
+    
+    case JOB_SERVER_BACKUP_SAVE:
+      job_id = m_scheduler->submit_save_backup_job(device_id, path, slot);
+      break;
+    
+    case JOB_SERVER_FLASH:
+      job_id = m_scheduler->submit_flash_job(device_id, path, slot);
+      break;
+    
+    case JOB_SERVER_VERIFY:
+      job_id = m_scheduler->submit_verify_job(device_id, path, slot);
+      break;
+    
+    case JOB_SERVER_COPY_SLOT:
+      job_id = m_scheduler->submit_copy_slot_job(device_id, other_slot, slot);
+      break;
+    
+    case JOB_SERVER_SWAP_SLOTS:
+      job_id = m_scheduler->submit_swap_slots_job(device_id, slot, other_slot);
+      break;
+    
+    default:
+      throw std::invalid_argument("Unknown job kind " + std::to_string(kind));
+    }
+    m_job_kinds[job_id] = kind;
+    
+    reply.put_u8(1);
+    reply.put_u32(job_id);
+    reply.put_string("");
+  }
+  catch (std::exception& ex)
+  {
+    reply.put_u8(0);
+    reply.put_u32(0);
+    reply.put_string(ex.what());
+  }
+  
+  vector<unsigned char> frames;
+  reply.encode(frames);
+  lock_guard<mutex> lock(c->mutex);
+  queue_frames(c, frames);
+}
+
+void job_server::queue_frames(connection* c, const std::vector<unsigned char>& frames)
+{
+  if (c->closed)
+  {
+    return;
+  }
+  
+  if (c->out.size() + frames.size() > JOB_SERVER_MAX_BACKLOG)
+  {
+    // The client stopped reading. Jobs must not wait on it, so let it go
+    c->out.clear();
+    c->closed = true;
+    c->socket.shutdown();
+  }
+  else
+  {
+    c->out.insert(c->out.end(), frames.begin(), frames.end());
+  }
+  c->condition.notify_all();
+}
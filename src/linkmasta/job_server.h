@@ -0,0 +1,229 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref job_server class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref job_server class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-30
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __JOB_SERVER_H__
+#define __JOB_SERVER_H__
+
+#include "common/tcp_socket.h"
+#include "job_server_protocol.h"
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class device_manager;
+class device_job_scheduler;
+
+/*! \brief How many bytes of events may wait for a client that isn't reading
+ *         them before it is disconnected. */
+#define JOB_SERVER_MAX_BACKLOG          0x100000
+
+/*! \class job_server
+ *  \brief Server that lets front ends on this machine run and watch jobs on
+ *         a \ref device_job_scheduler.
+ *  
+ *  Server that exposes a \ref device_job_scheduler, and the devices of its
+ *  \ref device_manager, to clients on the loopback interface, so that jobs
+ *  run in a long-lived background process rather than in whichever front end
+ *  started them. A front end connects with \ref job_client, submits jobs, and
+ *  is sent the state of every job as it changes. Jobs keep running when
+ *  their client disconnects, and any number of clients can watch the same
+ *  jobs. The protocol is described in job_server_protocol.h.
+ *  
+ *  The command line tool runs the server with **--daemon** and watches it
+ *  with **--watch**. The Qt app doesn't use the server yet: its tasks still
+ *  open the cartridges and run their jobs in its own process.
+ *  
+ *  Jobs report progress far more often than any client needs to hear of it,
+ *  so rather than forwarding every update, a thread of the server takes a
+ *  snapshot of every job once per \ref JOB_SERVER_EVENT_INTERVAL_MS and
+ *  sends an event for each job that changed since the last one. A job that
+ *  is queued or finishes is sent without waiting for the next snapshot.
+ *  
+ *  The server never waits on a client while holding up a job: events are
+ *  queued for each client and sent by a thread of its own, and clients that
+ *  fall more than \ref JOB_SERVER_MAX_BACKLOG bytes behind are disconnected.
+ *  
+ *  Every connection is served by a thread that reads its requests and a
+ *  thread that sends it replies and events.
+ */
+class job_server
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Does not start the server.
+   *  
+   *  \param [in] scheduler The scheduler to run jobs on. Must outlive the
+   *         server.
+   *  \param [in] manager The manager of the scheduler's devices. Must outlive
+   *         the server.
+   *  \param [in] port The TCP port to listen on.
+   */
+                          job_server(device_job_scheduler* scheduler, device_manager* manager, unsigned short port = JOB_SERVER_DEFAULT_PORT);
+  
+  /*!
+   *  \brief Class destructor. Stops the server if it is running.
+   */
+                          ~job_server();
+  
+  /*!
+   *  \brief Starts listening and serving clients in the background.
+   *  
+   *  \throws std::runtime_error If the port could not be listened on, such as
+   *          when another server already runs on it.
+   */
+  void                    start();
+  
+  /*!
+   *  \brief Stops the server, disconnecting every client. Jobs already
+   *         submitted keep running.
+   */
+  void                    stop();
+  
+  /*!
+   *  \brief Gets the number of clients currently connected.
+   */
+  unsigned int            num_connections();
+
+
+
+private:
+  job_server(const job_server& other) = delete;
+  job_server& operator=(const job_server& other) = delete;
+  
+  /*!
+   *  \brief Struct containing the state of a client connection.
+   */
+  struct connection
+  {
+    tcp_socket            socket;
+    std::thread           reader;
+    std::thread           writer;
+    
+    /*! \brief Everything below is guarded by this mutex. */
+    std::mutex            mutex;
+    std::condition_variable condition;
+    
+    /*! \brief Encoded frames waiting to be sent. */
+    std::vector<unsigned char> out;
+    
+    /*! \brief Whether the connection is sent events. Only changed with the
+     *         server's mutex held as well. */
+    bool                  subscribed;
+    bool                  closed;
+    bool                  finished;
+  };
+  
+  /*!
+   *  \brief Entry point of the thread accepting connections.
+   */
+  void                    serve();
+  
+  /*!
+   *  \brief Entry point of the thread publishing events, as snapshots at a
+   *         fixed rate and as jobs are queued or finish.
+   */
+  void                    publish();
+  
+  /*!
+   *  \brief Joins and deletes the connections that have finished.
+   *  
+   *  \param [in] all Whether to wait for every connection rather than only
+   *         the finished ones.
+   */
+  void                    reap_connections(bool all);
+  
+  /*!
+   *  \brief Queues an event for every job whose state changed since it was
+   *         last published.
+   *  
+   *  \param [in] snapshot Whether to publish every change, rather than only
+   *         jobs that are new or have an outcome not yet published.
+   */
+  void                    publish_events(bool snapshot);
+  
+  /*!
+   *  \brief Entry point of a connection's reader thread.
+   */
+  void                    read_requests(connection* c);
+  
+  /*!
+   *  \brief Entry point of a connection's writer thread.
+   */
+  void                    send_frames(connection* c);
+  
+  /*!
+   *  \brief Runs a request, queueing its reply.
+   *  
+   *  \return **false** if the connection should be closed.
+   */
+  bool                    run_request(connection* c, device_server_frame& frame);
+  
+  /*!
+   *  \brief Answers a \ref JOB_SERVER_DEVICES request.
+   */
+  void                    list_devices(connection* c);
+  
+  /*!
+   *  \brief Answers a \ref JOB_SERVER_SUBMIT request.
+   */
+  void                    submit_job(connection* c, device_server_frame& frame);
+  
+  /*!
+   *  \brief Queues encoded frames to be sent on a connection, disconnecting
+   *         it if too much is already waiting. Must be called with the
+   *         connection's mutex held.
+   */
+  static void             queue_frames(connection* c, const std::vector<unsigned char>& frames);
+  
+  
+  
+  /*! \brief The scheduler jobs are run on. */
+  device_job_scheduler* const m_scheduler;
+  
+  /*! \brief The manager of the scheduler's devices. */
+  device_manager* const   m_manager;
+  
+  /*! \brief The TCP port to listen on. */
+  const unsigned short    m_port;
+  
+  /*! \brief The listening socket. */
+  tcp_socket              m_socket;
+  
+  /*! \brief Flag telling the server thread to stop. */
+  std::atomic<bool>       m_stopping;
+  
+  /*! \brief The thread accepting connections. */
+  std::thread             m_thread;
+  
+  /*! \brief The thread publishing events. */
+  std::thread             m_publisher;
+  
+  /*! \brief The client connections. */
+  std::list<connection*>  m_connections;
+  
+  /*! \brief The kind of every job submitted through the server. */
+  std::map<unsigned int, unsigned int> m_job_kinds;
+  
+  /*! \brief The last event published for every job. */
+  std::map<unsigned int, job_server_event> m_events;
+  
+  /*! \brief Mutex guarding \ref m_connections, \ref m_job_kinds, and
+   *         \ref m_events. */
+  std::mutex              m_mutex;
+};
+
+#endif /* defined(__JOB_SERVER_H__) */
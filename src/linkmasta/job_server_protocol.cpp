@@ -0,0 +1,89 @@
+/*! \file
+ *  \brief File containing the implementation of \ref job_server_event.
+ *  
+ *  File containing the implementation of \ref job_server_event.
+ *  
+ *  See corrensponding header file to view documentation for struct, its
+ *  methods, and its member variables.
+ *  
+ *  \see job_server_event
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-30
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "job_server_protocol.h"
+
+using namespace std;
+
+
+
+job_server_event::job_server_event()
+  : job_id(0), device_id(0), kind(JOB_SERVER_OTHER), status(task_status::NOT_STARTED), phase(TASK_PHASE_OTHER),
+    work_expected(0), work_progress(0), work_per_second(0), result(false)
+{
+  // Nothing else to do
+}
+
+
+
+void job_server_event::encode(device_server_frame& frame) const
+{
+  frame.put_u32(job_id);
+  frame.put_u32(device_id);
+  frame.put_u8(kind);
+  frame.put_u8((unsigned int) status);
+  frame.put_u8((unsigned int) phase);
+  frame.put_u32(work_expected);
+  frame.put_u32(work_progress);
+  frame.put_u32(work_per_second);
+  frame.put_u8(result ? 1 : 0);
+  frame.put_string(error);
+}
+
+void job_server_event::decode(device_server_frame& frame)
+{
+  job_id = frame.get_u32();
+  device_id = frame.get_u32();
+  kind = frame.get_u8();
+  status = (task_status) frame.get_u8();
+  phase = (task_phase) frame.get_u8();
+  work_expected = frame.get_u32();
+  work_progress = frame.get_u32();
+  work_per_second = frame.get_u32();
+  result = (frame.get_u8() != 0);
+  error = frame.get_string();
+}
+
+bool job_server_event::differs_from(const job_server_event& other) const
+{
+  return job_id != other.job_id || device_id != other.device_id || kind != other.kind
+    || status != other.status || phase != other.phase
+    || work_expected != other.work_expected || work_progress != other.work_progress
+    || result != other.result || error != other.error;
+}
+
+bool job_server_event::differs_in_outcome_from(const job_server_event& other) const
+{
+  return job_id != other.job_id || kind != other.kind
+    || result != other.result || error != other.error
+    || (status != other.status && (status == task_status::COMPLETED || status == task_status::CANCELLED
+      || status == task_status::ERROR));
+}
+
+
+
+const char* job_server_kind_name(unsigned int kind)
+{
+  switch (kind)
+  {
+  case JOB_SERVER_BACKUP:      return "backup";
+  case JOB_SERVER_BACKUP_SAVE: return "backup-save";
+  case JOB_SERVER_FLASH:       return "flash";
+  case JOB_SERVER_VERIFY:      return "verify";
+  case JOB_SERVER_COPY_SLOT:   return "copy-slot";
+  case JOB_SERVER_SWAP_SLOTS:  return "swap-slots";
+  default:                     return "other";
+  }
+}
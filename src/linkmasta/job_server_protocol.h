@@ -0,0 +1,224 @@
+/*! \file
+ *  \brief File containing the definitions shared by \ref job_server and
+ *         \ref job_client.
+ *  
+ *  File containing the message types and records of the protocol
+ *  \ref job_server speaks with \ref job_client. Messages are framed with
+ *  \ref device_server_frame, so integers and strings are encoded as described
+ *  in device_server_protocol.h.
+ *  
+ *  A connection starts with the client sending a \ref JOB_SERVER_HELLO and
+ *  the server answering with one of its own, followed by a
+ *  \ref JOB_SERVER_EVENT for every job the server knows of. From then on the
+ *  server sends an event as soon as a job is queued or finishes, whether it
+ *  succeeded or failed. Changes of status, phase, and progress in between
+ *  are coalesced into a single event per job every
+ *  \ref JOB_SERVER_EVENT_INTERVAL_MS, however many updates the job made in
+ *  the meantime, so that watching many jobs moving data a packet at a time
+ *  takes little bandwidth. Events are sent whether or not the job was
+ *  submitted over this connection.
+ *  
+ *  Requests that expect a reply are answered in the order they were sent,
+ *  with a frame of the same type. Events may arrive between a request and its
+ *  reply.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-30
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __JOB_SERVER_PROTOCOL_H__
+#define __JOB_SERVER_PROTOCOL_H__
+
+#include "device_server_protocol.h"
+#include "task/task_controller.h"
+#include <string>
+
+/*! \brief The TCP port \ref job_server listens on by default. */
+#define JOB_SERVER_DEFAULT_PORT         7401
+
+/*! \brief The version of the protocol, exchanged in \ref JOB_SERVER_HELLO. */
+#define JOB_SERVER_PROTOCOL_VERSION     1
+
+/*! \brief Identifies the protocol at the start of \ref JOB_SERVER_HELLO. */
+#define JOB_SERVER_MAGIC                0x534A4446 /* "FDJS" */
+
+/*! \brief How often the server sends the progress of running jobs, in
+ *         milliseconds. */
+#define JOB_SERVER_EVENT_INTERVAL_MS    250
+
+/*! \brief The slot number sent for the whole cartridge. */
+#define JOB_SERVER_SLOT_ALL             0xFFFFFFFF
+
+
+
+/*!
+ *  \brief The types of message exchanged with a \ref job_server.
+ */
+enum job_server_message
+{
+  /*!
+   *  \brief Opens the conversation. Both ways: u32 magic, u32 version.
+   */
+  JOB_SERVER_HELLO = 1,
+  
+  /*!
+   *  \brief Lists the server's devices. Request: empty. Reply: u32 count,
+   *         then for each device u32 id, u8 claimed flag, and the product
+   *         and serial number strings.
+   */
+  JOB_SERVER_DEVICES,
+  
+  /*!
+   *  \brief Queues a job. Request: u8 \ref job_server_job_kind, u32 device
+   *         id, u32 slot, u32 second slot, and the path string. Reply: u8
+   *         success flag, u32 job id, and an error message string.
+   */
+  JOB_SERVER_SUBMIT,
+  
+  /*!
+   *  \brief Cancels a job. Request: u32 job id. Never answered.
+   */
+  JOB_SERVER_CANCEL,
+  
+  /*!
+   *  \brief Changes the priority of a job. Request: u32 job id, u32 priority
+   *         as a two's complement integer. Never answered.
+   */
+  JOB_SERVER_PRIORITY,
+  
+  /*!
+   *  \brief The state of a job. Sent by the server only: a
+   *         \ref job_server_event.
+   */
+  JOB_SERVER_EVENT
+};
+
+/*!
+ *  \brief The kinds of job that can be submitted to a \ref job_server.
+ *  
+ *  Each kind runs the \ref device_job_scheduler job of the same name. The
+ *  slot is the one the job works on, and the second slot is only used by
+ *  \ref JOB_SERVER_COPY_SLOT, as the slot copied from, and by
+ *  \ref JOB_SERVER_SWAP_SLOTS. Jobs that were not submitted through the
+ *  server are reported as \ref JOB_SERVER_OTHER.
+ */
+enum job_server_job_kind
+{
+  /*! \brief A job submitted to the scheduler directly. */
+  JOB_SERVER_OTHER = 0,
+  
+  /*! \brief Backs up game data to the path. */
+  JOB_SERVER_BACKUP,
+  
+  /*! \brief Backs up save data to the path. */
+  JOB_SERVER_BACKUP_SAVE,
+  
+  /*! \brief Flashes the file at the path. */
+  JOB_SERVER_FLASH,
+  
+  /*! \brief Verifies game data against the file at the path. */
+  JOB_SERVER_VERIFY,
+  
+  /*! \brief Copies the game in the second slot to the slot. */
+  JOB_SERVER_COPY_SLOT,
+  
+  /*! \brief Swaps the games in the slot and the second slot. */
+  JOB_SERVER_SWAP_SLOTS
+};
+
+
+
+/*! \struct job_server_device
+ *  \brief A device listed by a \ref job_server.
+ */
+struct job_server_device
+{
+  /*! \brief The ID of the device on the server. */
+  unsigned int            device_id;
+  
+  /*! \brief Whether the device is claimed, typically by a running job. */
+  bool                    claimed;
+  
+  /*! \brief The product string of the device. */
+  std::string             product;
+  
+  /*! \brief The serial number of the device. */
+  std::string             serial_number;
+};
+
+/*! \struct job_server_event
+ *  \brief The state of a job as reported by a \ref job_server.
+ */
+struct job_server_event
+{
+  /*!
+   *  \brief Constructs an event for no job in particular.
+   */
+                          job_server_event();
+  
+  /*!
+   *  \brief Appends the event to a frame's payload.
+   */
+  void                    encode(device_server_frame& frame) const;
+  
+  /*!
+   *  \brief Reads the event from a frame's payload.
+   *  
+   *  \throws std::runtime_error If the payload is too short.
+   */
+  void                    decode(device_server_frame& frame);
+  
+  /*!
+   *  \brief Gets whether the event reports anything another doesn't,
+   *         ignoring the work rate.
+   */
+  bool                    differs_from(const job_server_event& other) const;
+  
+  /*!
+   *  \brief Gets whether the event reports an outcome another doesn't, such
+   *         as the job having finished, which is worth sending right away
+   *         rather than with the next snapshot.
+   */
+  bool                    differs_in_outcome_from(const job_server_event& other) const;
+  
+  
+  
+  /*! \brief The ID of the job. */
+  unsigned int            job_id;
+  
+  /*! \brief The ID of the device the job runs on. */
+  unsigned int            device_id;
+  
+  /*! \brief The \ref job_server_job_kind of the job. */
+  unsigned int            kind;
+  
+  /*! \brief The status of the job. */
+  task_status             status;
+  
+  /*! \brief The phase the job is in. */
+  task_phase              phase;
+  
+  /*! \brief The amount of work the job expects to perform. */
+  unsigned int            work_expected;
+  
+  /*! \brief The amount of work the job has performed so far. */
+  unsigned int            work_progress;
+  
+  /*! \brief The work performed per second, smoothed over the last few
+   *         seconds. */
+  unsigned int            work_per_second;
+  
+  /*! \brief The value returned by the job, valid once it has completed. */
+  bool                    result;
+  
+  /*! \brief Description of the error that ended the job, if any. */
+  std::string             error;
+};
+
+/*!
+ *  \brief Gets the name of a \ref job_server_job_kind, such as "flash".
+ */
+const char* job_server_kind_name(unsigned int kind);
+
+#endif /* defined(__JOB_SERVER_PROTOCOL_H__) */
@@ -15,22 +15,70 @@
 
 #include "common/log.h"
 #include "libusb-1.0/libusb.h"
+#include "usb/libusb_event_reactor.h"
 #include "usb/libusb_usb_device.h"
+#include "usb/usbfs_usb_device.h"
 #include "linkmasta_device.h"
+#include "task/task_controller.h"
+
+#include <algorithm>
+#include <chrono>
 
 using namespace std;
 
+#define HOTPLUG_VENDOR_ID               0x20A0
+#define HOTPLUG_REFRESH_INTERVAL_MS     10000
+
+
+
+static int LIBUSB_CALL on_hotplug_event(libusb_context* context, libusb_device* device, libusb_hotplug_event event, void* user_data)
+{
+  (void) context;
+  (void) device;
+  (void) event;
+  
+  // libusb calls are not allowed from here, so let the refresh thread do it
+  static_cast<libusb_device_manager*>(user_data)->request_refresh();
+  return 0;
+}
+
 
 
-libusb_device_manager::libusb_device_manager()
-  : device_manager(), m_libusb_init(false)
+libusb_device_manager::libusb_device_manager(bool use_usbfs)
+  : device_manager(), m_libusb_init(false), m_hotplug_registered(false),
+    m_hotplug_handle(0), m_use_usbfs(use_usbfs), m_reactor(nullptr),
+    m_device_table(std::make_shared<const device_table>())
 {
   m_libusb_mutex.lock();
   libusb_init(&m_libusb);
   m_libusb_init = true;
   m_libusb_mutex.unlock();
   
+  // One thread handles the events of every device rather than each device's
+  // thread taking turns
+  m_reactor = new usb::libusb_event_reactor(m_libusb);
+  m_reactor->start();
+  
+  // Prefer hotplug notifications, falling back to periodic polling if the
+  // platform doesn't support them
+  if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+  {
+    libusb_hotplug_callback_handle handle;
+    int error = libusb_hotplug_register_callback(m_libusb,
+      (libusb_hotplug_event) (LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+      (libusb_hotplug_flag) 0, HOTPLUG_VENDOR_ID, LIBUSB_HOTPLUG_MATCH_ANY,
+      LIBUSB_HOTPLUG_MATCH_ANY, on_hotplug_event, this, &handle);
+    
+    if (error == LIBUSB_SUCCESS)
+    {
+      m_hotplug_registered = true;
+      m_hotplug_handle = handle;
+      set_refresh_interval(HOTPLUG_REFRESH_INTERVAL_MS);
+    }
+  }
+  
   start_auto_refresh();
+  request_refresh();
 }
 
 libusb_device_manager::~libusb_device_manager()
@@ -39,13 +87,24 @@ libusb_device_manager::~libusb_device_manager()
   
   stop_auto_refresh_and_wait();
   
+  if (m_hotplug_registered)
+  {
+    libusb_hotplug_deregister_callback(m_libusb, m_hotplug_handle);
+    m_hotplug_registered = false;
+  }
+  
   m_libusb_mutex.lock();
   m_connected_devices_mutex.lock();
-  for (auto entry : m_connected_devices)
+  for (auto& entry : *std::atomic_load(&m_device_table))
   {
-    delete entry.second.linkmasta;
-    libusb_unref_device(entry.second.device);
+    delete entry.second->linkmasta;
+    libusb_unref_device(entry.second->device);
   }
+  std::atomic_store(&m_device_table, std::make_shared<const device_table>());
+  
+  // Devices are gone, so nothing is left waiting on the reactor
+  delete m_reactor;
+  m_reactor = nullptr;
   
   libusb_exit(m_libusb);
   m_libusb_init = false;
@@ -61,219 +120,186 @@ std::vector<unsigned int> libusb_device_manager::get_connected_devices()
 {
   vector<unsigned int> list;
   
-  m_connected_devices_mutex.lock();
-  list.reserve(m_connected_devices.size());
+  auto table = std::atomic_load(&m_device_table);
+  list.reserve(table->size());
   
-  for (auto entry : m_connected_devices)
+  for (auto& entry : *table)
   {
     list.push_back(entry.first);
   }
-  m_connected_devices_mutex.unlock();
   
   return list;
 }
 
 bool libusb_device_manager::try_get_connected_devices(std::vector<unsigned int>& devices)
 {
-  // Only continue if background process isn't running
-  if (m_connected_devices_mutex.try_lock())
-  {
-    devices.clear();
-    devices.reserve(m_connected_devices.size());
-    
-    for (auto entry : m_connected_devices)
-    {
-      devices.push_back(entry.first);
-    }
-    
-    m_connected_devices_mutex.unlock();
-    return true;
-  }
-  else
-  {
-    return false;
-  }
+  // Reading a snapshot never blocks, so this can't fail
+  devices = get_connected_devices();
+  return true;
 }
 
 bool libusb_device_manager::is_connected(unsigned int id)
 {
-  m_connected_devices_mutex.lock(); // LOCK m_connected_devices
-  
-  bool r = (m_connected_devices.find(id) != m_connected_devices.end());
-  
-  m_connected_devices_mutex.unlock(); // UNLOCK m_connected_devices
-  
-  return r;
+  auto table = std::atomic_load(&m_device_table);
+  return (table->find(id) != table->end());
 }
 
 unsigned int libusb_device_manager::get_vendor_id(unsigned int id)
 {
-  m_connected_devices_mutex.lock(); // LOCK m_connected_devices
-  
-  auto it = m_connected_devices.find(id);
-  
-  if (it == m_connected_devices.end())
-  {
-    m_connected_devices_mutex.unlock(); // UNLOCK m_connected_devices
-    throw std::invalid_argument("Unknown connected device ID " + std::to_string(id));
-  }
-  
-  id = it->second.vendor_id;
-  
-  m_connected_devices_mutex.unlock(); // UNLOCK m_connected_devices
-  
-  return id;
+  return find_device(id)->vendor_id;
 }
 
 unsigned int libusb_device_manager::get_product_id(unsigned int id)
 {
-  m_connected_devices_mutex.lock(); // LOCK m_connected_devices
-  
-  auto it = m_connected_devices.find(id);
-  
-  if (it == m_connected_devices.end())
-  {
-    m_connected_devices_mutex.unlock(); // UNLOCK m_connected_devices
-    throw std::invalid_argument("Unknown connected device ID " + std::to_string(id));
-  }
-  
-  id = it->second.product_id;
-  
-  m_connected_devices_mutex.unlock(); // UNLOCK m_connected_devices
-  
-  return id;
+  return find_device(id)->product_id;
 }
 
 string libusb_device_manager::get_manufacturer_string(unsigned int id)
 {
-  m_connected_devices_mutex.lock(); // LOCK m_connected_devices
-  
-  auto it = m_connected_devices.find(id);
+  auto device = find_device(id);
+  fetch_device_strings(device);
   
-  if (it == m_connected_devices.end())
-  {
-    m_connected_devices_mutex.unlock(); // UNLOCK m_connected_devices
-    throw std::invalid_argument("Unknown connected device ID " + std::to_string(id));
-  }
-  
-  auto r = it->second.manufacturer_string;
-  
-  m_connected_devices_mutex.unlock(); // UNLOCK m_connected_devices
-  
-  return r;
+  lock_guard<mutex> lock(device->strings_mutex);
+  return device->manufacturer_string;
 }
 
 string libusb_device_manager::get_product_string(unsigned int id)
 {
-  m_connected_devices_mutex.lock(); // LOCK m_connected_devices
-  
-  auto it = m_connected_devices.find(id);
+  auto device = find_device(id);
+  fetch_device_strings(device);
   
-  if (it == m_connected_devices.end())
-  {
-    m_connected_devices_mutex.unlock(); // UNLOCK m_connected_devices
-    throw std::invalid_argument("Unknown connected device ID " + std::to_string(id));
-  }
-  
-  auto r = it->second.product_string;
-  
-  m_connected_devices_mutex.unlock(); // UNLOCK m_connected_devices
-  
-  return r;
+  lock_guard<mutex> lock(device->strings_mutex);
+  return device->product_string;
 }
 
 string libusb_device_manager::get_serial_number(unsigned int id)
 {
-  m_connected_devices_mutex.lock(); // LOCK m_connected_devices
+  auto device = find_device(id);
+  fetch_device_strings(device);
   
-  auto it = m_connected_devices.find(id);
-  
-  if (it == m_connected_devices.end())
-  {
-    m_connected_devices_mutex.unlock(); // UNLOCK m_connected_devices
-    throw std::invalid_argument("Unknown connected device ID " + std::to_string(id));
-  }
-  
-  auto r = it->second.serial_number;
-  
-  m_connected_devices_mutex.unlock(); // UNLOCK m_connected_devices
-  
-  return r;
+  lock_guard<mutex> lock(device->strings_mutex);
+  return device->serial_number;
+}
+
+unsigned int libusb_device_manager::get_bus_number(unsigned int id)
+{
+  return find_device(id)->bus_number;
+}
+
+string libusb_device_manager::get_port_path(unsigned int id)
+{
+  return find_device(id)->port_path;
+}
+
+bool libusb_device_manager::is_on_shared_hub(unsigned int id)
+{
+  return find_device(id)->shared_hub;
 }
 
 linkmasta_device* libusb_device_manager::get_linkmasta_device(unsigned int id)
 {
-  m_connected_devices_mutex.lock();
-  
-  auto it = m_connected_devices.find(id);
-  
-  if (it == m_connected_devices.end())
-  {
-    m_connected_devices_mutex.unlock();
-    throw std::invalid_argument("Unknown connected device ID " + std::to_string(id));
-  }
-  
-  auto r = it->second.linkmasta;
-  
-  m_connected_devices_mutex.unlock();
-  
-  return r;
+  return find_device(id)->linkmasta;
 }
 
 bool libusb_device_manager::is_device_claimed(unsigned int id)
 {
-  m_connected_devices_mutex.lock();
-  
-  auto it = m_connected_devices.find(id);
-  
-  if (it == m_connected_devices.end())
-  {
-    m_connected_devices_mutex.unlock();
-    throw std::invalid_argument("Unknown connected device ID " + std::to_string(id));
-  }
-  
-  auto r = it->second.claimed;
-  
-  m_connected_devices_mutex.unlock();
-  
-  return r;
+  return find_device(id)->claimed.load();
 }
 
 bool libusb_device_manager::try_claim_device(unsigned int id)
 {
-  m_connected_devices_mutex.lock();
-  
-  auto it = m_connected_devices.find(id);
+  return try_claim(find_device(id));
+}
+
+bool libusb_device_manager::claim_device(unsigned int id, unsigned int timeout_ms)
+{
+  return claim_device(id, timeout_ms, nullptr);
+}
+
+bool libusb_device_manager::claim_device(unsigned int id, unsigned int timeout_ms, task_controller* controller)
+{
+  auto device = find_device(id);
+  unique_lock<mutex> lock(device->claim_mutex);
   
-  if (it == m_connected_devices.end())
+  if (device->removed)
   {
-    m_connected_devices_mutex.unlock();
-    throw std::invalid_argument("Unknown connected device ID " + std::to_string(id));
+    throw std::invalid_argument("Device " + std::to_string(id) + " was disconnected");
   }
   
-  auto r = it->second.claimed;
-  it->second.claimed = true;
+  if (!device->claimed.load() && device->waiters.empty())
+  {
+    device->claimed.store(true);
+    return true;
+  }
   
-  m_connected_devices_mutex.unlock();
+  // Take a place in line and sleep until it's our turn. The ticket is kept
+  // while checking on the task, so a cancellable wait doesn't lose its place
+  unsigned long long ticket = device->next_ticket++;
+  device->waiters.push_back(ticket);
   
-  return !r;
-}
-
-void libusb_device_manager::release_device(unsigned int id)
-{
-  m_connected_devices_mutex.lock();
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+  bool acquired = false;
+  bool timed_out = false;
+  while (!device->removed && !timed_out && (controller == nullptr || !controller->is_task_cancelled()))
+  {
+    if (!device->claimed.load() && device->waiters.front() == ticket)
+    {
+      device->claimed.store(true);
+      acquired = true;
+      break;
+    }
+    
+    if (controller != nullptr)
+    {
+      auto wake = chrono::steady_clock::now() + chrono::milliseconds(CLAIM_CANCEL_CHECK_INTERVAL_MS);
+      if (timeout_ms != CLAIM_TIMEOUT_INFINITE && deadline < wake)
+      {
+        wake = deadline;
+      }
+      device->claim_condition.wait_until(lock, wake);
+      timed_out = (timeout_ms != CLAIM_TIMEOUT_INFINITE && chrono::steady_clock::now() >= deadline);
+    }
+    else if (timeout_ms == CLAIM_TIMEOUT_INFINITE)
+    {
+      device->claim_condition.wait(lock);
+    }
+    else
+    {
+      timed_out = (device->claim_condition.wait_until(lock, deadline) == cv_status::timeout);
+    }
+  }
   
-  auto it = m_connected_devices.find(id);
+  device->waiters.erase(std::find(device->waiters.begin(), device->waiters.end(), ticket));
+  bool removed = device->removed;
+  lock.unlock();
   
-  if (it == m_connected_devices.end())
+  if (!acquired)
   {
-    m_connected_devices_mutex.unlock();
-    throw std::invalid_argument("Unknown connected device ID " + std::to_string(id));
+    // Whoever is next in line may be able to go now
+    device->claim_condition.notify_all();
   }
   
-  it->second.claimed = false;
+  if (removed)
+  {
+    throw std::invalid_argument("Device " + std::to_string(id) + " was disconnected");
+  }
   
-  m_connected_devices_mutex.unlock();
+  return acquired;
+}
+
+void libusb_device_manager::release_device(unsigned int id)
+{
+  release(find_device(id));
+}
+
+usb::usb_device* libusb_device_manager::get_usb_device(unsigned int id)
+{
+  return find_device(id)->usb_device;
+}
+
+void libusb_device_manager::set_io_thread_options(const io_thread_options& options)
+{
+  m_reactor->set_io_thread_options(options.high_priority, options.cpu_for(0));
 }
 
 
@@ -289,19 +315,23 @@ void libusb_device_manager::refresh_device_list()
   
   libusb_device** device_list;
   ssize_t num_devices = libusb_get_device_list(m_libusb, &device_list);
-  std::map<unsigned int, bool> device_status;
+  std::unordered_map<unsigned int, bool> device_status;
+  std::vector<libusb_device*> new_devices;
+  std::vector<std::shared_ptr<connected_device>> removed_devices;
   
-  m_connected_devices_mutex.lock(); // LOCK m_connected_devices
+  m_connected_devices_mutex.lock(); // LOCK m_device_table writers
+  
+  auto old_table = std::atomic_load(&m_device_table);
   
   // mark all devices as not found
-  for (auto entry : m_connected_devices)
+  device_status.reserve(old_table->size());
+  for (auto& entry : *old_table)
   {
     device_status[entry.first] = false;
   }
   
   for (int i = 0; i < num_devices; ++i)
   {
-    bool found = false;
     libusb_device_descriptor desc;
     libusb_get_device_descriptor(device_list[i], &desc);
     
@@ -312,65 +342,244 @@ void libusb_device_manager::refresh_device_list()
     }
     
     // See if we already know about the device
-    for (auto entry : m_connected_devices)
+    auto known = m_device_ids.find(device_list[i]);
+    if (known != m_device_ids.end())
+    {
+      device_status[known->second] = true;
+    }
+    else
+    {
+      // Remember new devices so they can be set up without holding the lock
+      new_devices.push_back(device_list[i]);
+    }
+  }
+  
+  // Remove devices that were not found, but only if they are not claimed.
+  // Claiming them here keeps anyone holding an old snapshot from claiming
+  // them after they are gone.
+  std::shared_ptr<device_table> new_table;
+  for (auto& entry : device_status)
+  {
+    if (entry.second)
     {
-      if (entry.second.device == device_list[i])
+      continue;
+    }
+    
+    auto device = old_table->find(entry.first)->second;
+    bool claimed = false;
+    {
+      lock_guard<mutex> lock(device->claim_mutex);
+      if (!device->claimed.load())
       {
-        found = true;
-        device_status[entry.first] = true;
-        break;
+        device->claimed.store(true);
+        device->removed = true;
+        claimed = true;
       }
     }
     
-    // Create new entry if necessary
-    if (!found)
+    if (claimed)
     {
-      connected_device new_device;
-      new_device.id = generate_id();
-      new_device.vendor_id = desc.idVendor;
-      new_device.product_id = desc.idProduct;
-      new_device.device = device_list[i];
-      new_device.claimed = false;
+      // Nobody waiting on the device will ever get it now
+      device->claim_condition.notify_all();
       
-      usb::libusb_usb_device* usb_device = new usb::libusb_usb_device(new_device.device);
-      usb_device->init();
-      usb_device->open();
-      new_device.manufacturer_string = usb_device->get_manufacturer_string();
-      new_device.product_string = usb_device->get_product_string();
-      new_device.serial_number = usb_device->get_serial_number();
-      usb_device->close();
-      new_device.linkmasta = build_linkmasta_device(usb_device);
-      
-      m_connected_devices[new_device.id] = new_device;
-      libusb_ref_device(device_list[i]);
+      if (!new_table)
+      {
+        new_table = std::make_shared<device_table>(*old_table);
+      }
+      new_table->erase(entry.first);
+      m_device_ids.erase(device->device);
+      removed_devices.push_back(device);
     }
   }
   
-  // Remove devices that were not found, but only if they are not claimed
-  for (auto entry : device_status)
+  if (new_table)
   {
-    if (!entry.second && !m_connected_devices[entry.first].claimed)
+    std::atomic_store(&m_device_table, std::shared_ptr<const device_table>(new_table));
+  }
+  
+  m_connected_devices_mutex.unlock(); // UNLOCK m_device_table writers
+  
+  for (auto& device : removed_devices)
+  {
+    notify_device_listeners(device->id, false);
+    
+    try {
+      delete device->linkmasta;
+    } catch (std::exception &ex) {
+      (void) ex;
+      // do nothing, fail silently
+    }
+    libusb_unref_device(device->device);
+  }
+  
+  // Set up newly found devices. String descriptors are left to be fetched
+  // when first asked for.
+  for (libusb_device* device : new_devices)
+  {
+    libusb_device_descriptor desc;
+    libusb_get_device_descriptor(device, &desc);
+    
+    std::shared_ptr<connected_device> new_device = std::make_shared<connected_device>();
+    new_device->vendor_id = desc.idVendor;
+    new_device->product_id = desc.idProduct;
+    new_device->device = device;
+    
+    // Record where the device sits so that jobs can be spread across hubs.
+    // The parent is only valid while the device list is held.
+    uint8_t ports[8];
+    int num_ports = libusb_get_port_numbers(device, ports, sizeof(ports));
+    new_device->bus_number = libusb_get_bus_number(device);
+    new_device->port_path = "";
+    if (num_ports > 0)
     {
-      try {
-        delete m_connected_devices[entry.first].linkmasta;
-      } catch (std::exception &ex) {
-        (void) ex;
-        // do nothing, fail silently
+      new_device->port_path = std::to_string(new_device->bus_number) + "-";
+      for (int j = 0; j < num_ports; ++j)
+      {
+        new_device->port_path += (j > 0 ? "." : "") + std::to_string(ports[j]);
       }
-
-      libusb_unref_device(m_connected_devices[entry.first].device);
-      m_connected_devices.erase(entry.first);
     }
+    libusb_device* parent = libusb_get_parent(device);
+    new_device->shared_hub = (parent != nullptr && libusb_get_device_speed(parent) != LIBUSB_SPEED_UNKNOWN
+                              && libusb_get_device_speed(parent) < LIBUSB_SPEED_HIGH);
+    new_device->claimed.store(false);
+    new_device->removed = false;
+    new_device->next_ticket = 0;
+    new_device->strings_fetched = false;
+    new_device->usb_device = nullptr;
+    new_device->linkmasta = nullptr;
+    
+    try
+    {
+#if defined(__linux__)
+      // Libusb is only used to find the device, leaving every transfer to
+      // the device's node
+      if (m_use_usbfs)
+      {
+        new_device->usb_device = new usb::usbfs_usb_device(new_device->bus_number, libusb_get_device_address(device));
+      }
+#endif
+      if (new_device->usb_device == nullptr)
+      {
+        usb::libusb_usb_device* usb_device = new usb::libusb_usb_device(new_device->device, m_libusb);
+        usb_device->set_event_reactor(m_reactor);
+        new_device->usb_device = usb_device;
+      }
+      new_device->linkmasta = build_linkmasta_device(new_device->usb_device);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Device could not be set up, try again on the next refresh
+      if (new_device->linkmasta == nullptr)
+      {
+        delete new_device->usb_device;
+      }
+      continue;
+    }
+    
+    libusb_ref_device(device);
+    
+    m_connected_devices_mutex.lock(); // LOCK m_device_table writers
+    new_device->id = generate_id();
+    m_device_ids[device] = new_device->id;
+    
+    auto table = std::make_shared<device_table>(*std::atomic_load(&m_device_table));
+    (*table)[new_device->id] = new_device;
+    std::atomic_store(&m_device_table, std::shared_ptr<const device_table>(table));
+    m_connected_devices_mutex.unlock(); // UNLOCK m_device_table writers
+    
+    notify_device_listeners(new_device->id, true);
   }
   
-  m_connected_devices_mutex.unlock(); // UNLOCK m_connected_devices
-  
   // Free the libusb list
   libusb_free_device_list(device_list, 1);
   
   m_libusb_mutex.unlock();
 }
 
+std::shared_ptr<libusb_device_manager::connected_device> libusb_device_manager::find_device(unsigned int id)
+{
+  auto table = std::atomic_load(&m_device_table);
+  auto it = table->find(id);
+  
+  if (it == table->end())
+  {
+    throw std::invalid_argument("Unknown connected device ID " + std::to_string(id));
+  }
+  
+  return it->second;
+}
+
+void libusb_device_manager::fetch_device_strings(const std::shared_ptr<connected_device>& device)
+{
+  // Don't touch the device if it's cached
+  {
+    lock_guard<mutex> lock(device->strings_mutex);
+    if (device->strings_fetched)
+    {
+      return;
+    }
+  }
+  
+  // Claim the device for ourselves while fetching so nobody else opens it,
+  // and don't touch it if someone else is using it
+  if (!try_claim(device))
+  {
+    return;
+  }
+  
+  string manufacturer_string;
+  string product_string;
+  string serial_number;
+  bool fetched = false;
+  try
+  {
+    manufacturer_string = device->usb_device->get_manufacturer_string();
+    product_string = device->usb_device->get_product_string();
+    serial_number = device->usb_device->get_serial_number();
+    fetched = true;
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // Leave the strings unfetched so that the next call tries again
+  }
+  
+  if (fetched)
+  {
+    lock_guard<mutex> lock(device->strings_mutex);
+    device->manufacturer_string = manufacturer_string;
+    device->product_string = product_string;
+    device->serial_number = serial_number;
+    device->strings_fetched = true;
+  }
+  
+  release(device);
+}
+
+bool libusb_device_manager::try_claim(const std::shared_ptr<connected_device>& device)
+{
+  lock_guard<mutex> lock(device->claim_mutex);
+  
+  // Don't cut in front of anyone waiting in claim_device()
+  if (device->claimed.load() || !device->waiters.empty())
+  {
+    return false;
+  }
+  
+  device->claimed.store(true);
+  return true;
+}
+
+void libusb_device_manager::release(const std::shared_ptr<connected_device>& device)
+{
+  {
+    lock_guard<mutex> lock(device->claim_mutex);
+    device->claimed.store(false);
+  }
+  device->claim_condition.notify_all();
+}
+
 bool libusb_device_manager::is_supported(unsigned int vendor_id, unsigned int product_id)
 {
   return ((vendor_id == 0x20A0 && product_id == 0x4178)       // NGP (linkmasta)
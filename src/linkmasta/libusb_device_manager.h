@@ -15,13 +15,23 @@
 #define __LIBUSB_DEVICE_MANAGER_H__
 
 #include "device_manager.h"
+#include "common/io_thread.h"
 
+#include <atomic>
+#include <deque>
 #include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
 
 struct libusb_context;
 struct libusb_device;
 
+namespace usb {
+class usb_device;
+class libusb_event_reactor;
+}
+
 
 
 /*!
@@ -39,8 +49,13 @@ public:
    *  \brief Class constructor. Initializes libraries and member variables.
    *  
    *  Class constructor. Initializes libraries and member variables.
+   *  
+   *  \param [in] use_usbfs Whether to talk to devices through their usbfs
+   *         nodes with \ref usb::usbfs_usb_device rather than through Libusb.
+   *         Libusb still finds the devices. Ignored on platforms other than
+   *         Linux.
    */
-                            libusb_device_manager();
+  explicit                  libusb_device_manager(bool use_usbfs = false);
   
   /*!
    *  \brief Class destructor. Frees dynamic memory and deinitializes libraries.
@@ -91,6 +106,21 @@ public:
    */
   std::string               get_serial_number(unsigned int id);
   
+  /*!
+   *  \see device_manager::get_bus_number(unsigned int)
+   */
+  unsigned int              get_bus_number(unsigned int id);
+  
+  /*!
+   *  \see device_manager::get_port_path(unsigned int)
+   */
+  std::string               get_port_path(unsigned int id);
+  
+  /*!
+   *  \see device_manager::is_on_shared_hub(unsigned int)
+   */
+  bool                      is_on_shared_hub(unsigned int id);
+  
   /*!
    *  \see device_manager::get_linkmasta_device(unsigned int)
    */
@@ -106,11 +136,49 @@ public:
    */
   bool                      try_claim_device(unsigned int id);
   
+  /*!
+   *  \see device_manager::claim_device(unsigned int, unsigned int)
+   */
+  bool                      claim_device(unsigned int id, unsigned int timeout_ms);
+  
+  /*!
+   *  \see device_manager::claim_device(unsigned int, unsigned int, task_controller*)
+   */
+  bool                      claim_device(unsigned int id, unsigned int timeout_ms, task_controller* controller);
+  
   /*!
    *  \see device_manager::release_device(unsigned int)
    */
   void                      release_device(unsigned int id);
   
+  /*!
+   *  \brief Gets the USB device behind the \ref linkmasta_device with the
+   *         given id.
+   *  
+   *  Gets the USB device that the device's \ref linkmasta_device talks
+   *  through, so that its transfers can be relayed as they are, e.g. by
+   *  \ref device_server. The device must be claimed for as long as the USB
+   *  device is used, and it is still owned by the \ref linkmasta_device.
+   *  
+   *  \param [in] id The id of the device.
+   *  
+   *  \return The USB device.
+   *  
+   *  \throws std::invalid_argument If no device with the given id exists.
+   */
+  usb::usb_device*          get_usb_device(unsigned int id);
+  
+  /*!
+   *  \brief Sets the priority and CPU of the thread handling the USB events
+   *         of every device.
+   *  
+   *  \param [in] options How to schedule the thread. Only its first CPU is
+   *         used.
+   *  
+   *  \see configure_io_thread()
+   */
+  void                      set_io_thread_options(const io_thread_options& options);
+  
   
   
 protected:
@@ -140,6 +208,57 @@ private:
    */
   static bool               is_supported(unsigned int vendor_id, unsigned int product_id);
   
+  struct                    connected_device;
+  
+  /*!
+   *  \brief Looks up the device with the given id in the current snapshot of
+   *         \ref m_device_table.
+   *  
+   *  Looks up the device with the given id in the current snapshot of
+   *  \ref m_device_table without taking any locks. The returned entry stays
+   *  valid for as long as the caller holds on to it, even if the device is
+   *  removed from the table in the meantime.
+   *  
+   *  \param [in] id The id of the device to look up.
+   *  
+   *  \return The entry for the device.
+   *  
+   *  \throws std::invalid_argument If no device with the given id exists.
+   */
+  std::shared_ptr<connected_device> find_device(unsigned int id);
+  
+  /*!
+   *  \brief Fetches and caches the string descriptors of the given device if
+   *         they have not been fetched yet.
+   *  
+   *  Opens the device to fetch its manufacturer, product, and serial number
+   *  strings and caches the results in the device's entry. The device is
+   *  claimed for the duration of the fetch, and no locks are held while
+   *  communicating with the device. If the device is currently claimed by
+   *  someone else, then nothing is fetched and any previously cached values
+   *  are left as-is.
+   *  
+   *  \param [in] device The entry of the device to fetch strings for.
+   */
+  void                      fetch_device_strings(const std::shared_ptr<connected_device>& device);
+  
+  /*!
+   *  \brief Claims the given device if it is neither claimed nor waited on.
+   *  
+   *  \param [in] device The entry of the device to claim.
+   *  
+   *  \return true if the device was claimed, false if not.
+   */
+  static bool               try_claim(const std::shared_ptr<connected_device>& device);
+  
+  /*!
+   *  \brief Releases the claim on the given device and wakes anyone waiting
+   *         to claim it.
+   *  
+   *  \param [in] device The entry of the device to release.
+   */
+  static void               release(const std::shared_ptr<connected_device>& device);
+  
   
   
 private:
@@ -153,11 +272,30 @@ private:
   /*! \brief Flag indicating that the libusb library has been initalized. */
   bool                      m_libusb_init;
   
+  /*! \brief Flag indicating that a libusb hotplug callback is registered. */
+  bool                      m_hotplug_registered;
+  
+  /*! \brief Handle of the registered libusb hotplug callback. */
+  int                       m_hotplug_handle;
+  
+  /*! \brief Whether devices are talked to through usbfs rather than libusb. */
+  const bool                m_use_usbfs;
+  
+  /*!
+   *  \brief Reactor handling every libusb event, both hotplug callbacks and
+   *         the transfers of every connected device, from a single thread.
+   */
+  usb::libusb_event_reactor* m_reactor;
+  
   /*!
    *  \brief Struct containing data about a connected device.
    *  
    *  Struct containing data about a connected device so that metadata about the
    *  device can be cached to prevent unnecessary operations.
+   *  
+   *  Entries are shared between snapshots of \ref m_device_table. Fields other
+   *  than the string descriptors and the claim state never change once an
+   *  entry has been published.
    */
   struct                    connected_device
   {
@@ -179,27 +317,75 @@ private:
     /*! \brief USB device serial number string. */
     std::string               serial_number;
     
+    /*! \brief Number of the bus the device is attached to. */
+    unsigned int              bus_number;
+    
+    /*! \brief Chain of hub ports leading to the device, as "bus-port.port". */
+    std::string               port_path;
+    
+    /*! \brief Flag indicating the device's hub is not high speed. */
+    bool                      shared_hub;
+    
     /*! \brief Pointer to libusb handle. */
     libusb_device*            device;
     
     /*! \brief Pointer to generated \ref linkmasta_device object. */
     linkmasta_device*         linkmasta;
     
-    /*! \brief Flag indicating device is currently claimed. */
-    bool                      claimed;
+    /*! \brief Pointer to the USB device owned by \ref linkmasta. */
+    usb::usb_device*          usb_device;
+    
+    /*! \brief Flag indicating that the string descriptors have been cached. */
+    bool                      strings_fetched;
+    
+    /*! \brief Mutex guarding the string descriptors and \ref strings_fetched. */
+    std::mutex                strings_mutex;
+    
+    /*!
+     *  \brief Flag indicating device is currently claimed. Only changed while
+     *         holding \ref claim_mutex, but may be read without it.
+     */
+    std::atomic<bool>         claimed;
+    
+    /*! \brief Flag indicating the device has been removed from the table. */
+    bool                      removed;
+    
+    /*! \brief Mutex guarding changes to the claim state of the device. */
+    std::mutex                claim_mutex;
+    
+    /*! \brief Condition signalled whenever the device is released. */
+    std::condition_variable   claim_condition;
+    
+    /*! \brief Ticket handed to the next caller to start waiting. */
+    unsigned long long        next_ticket;
+    
+    /*!
+     *  \brief Tickets of the callers waiting to claim the device, in the order
+     *         they started waiting.
+     */
+    std::deque<unsigned long long> waiters;
   };
   
-  /*! \brief Map for keeping track of and accessing connected devices. */
-  std::map<unsigned int, connected_device> m_connected_devices;
+  /*! \brief Type of an immutable snapshot of the connected devices. */
+  typedef std::map<unsigned int, std::shared_ptr<connected_device>> device_table;
   
-  /*! \brief Mutex for locking the \ref m_connected_devices map. */
-  std::mutex                m_connected_devices_mutex;
+  /*!
+   *  \brief Current snapshot of the connected devices, indexed by id.
+   *  
+   *  Readers take a copy with \ref std::atomic_load and never block. The
+   *  refresh thread publishes a modified copy with \ref std::atomic_store
+   *  while holding \ref m_connected_devices_mutex.
+   */
+  std::shared_ptr<const device_table> m_device_table;
   
   /*!
-   *  \brief List of devices that have been disconnected and need to be removed
-   *  from the \ref m_connected_devices map.
+   *  \brief Index from libusb device handle to the id of the matching entry in
+   *         \ref m_device_table. Only accessed by writers.
    */
-  std::vector<connected_device> m_disconnected_devices;
+  std::unordered_map<libusb_device*, unsigned int> m_device_ids;
+  
+  /*! \brief Mutex serializing writers of \ref m_device_table. */
+  std::mutex                m_connected_devices_mutex;
 };
 
 #endif /* defined(__LIBUSB_DEVICE_MANAGER_H__) */
@@ -13,7 +13,248 @@
  */
 
 #include "linkmasta_device.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <stdexcept>
+#include <string>
+#include "cartridge/digest_manifest.h"
+#include "common/log.h"
+#include "common/memory_budget.h"
+#include "common/metrics.h"
+#include "task/forwarding_task_controller.h"
+
+// Long enough to outlast the pause between polls for an inserted cartridge
+#define DEFAULT_IDLE_TIMEOUT_MS 5000
+
+// Default USB timeouts. Commands are answered within a few milliseconds, so a
+// command that takes half a second isn't coming back. Batches are allowed to
+// program at 8 KB/s, slower than the slowest flash, which gives the largest
+// write64xN batch about as long as the single timeout used to. A chip busy
+// erasing can hold up the firmware's replies, so polls get a little longer
+#define DEFAULT_COMMAND_TIMEOUT_MS    500
+#define DEFAULT_BATCH_TIMEOUT_MS      500
+#define DEFAULT_BATCH_BYTES_PER_MS    8
+#define DEFAULT_ERASE_POLL_TIMEOUT_MS 1000
+
+// Reads are checked a packet at a time, matching the read64xN packets
+#define VERIFY_PACKET_SIZE      64
+
+// Number of times a corrupted packet is requested again before giving up
+#define VERIFY_MAX_REREADS      3
+
+// Largest read worth keeping in the read cache, and the number of ranges kept.
+// Metadata lives in a handful of small ranges, while anything bigger is a dump
+// that would only push them out
+#define READ_CACHE_MAX_BYTES    0x1000
+#define READ_CACHE_MAX_ENTRIES  32
+
+// Slot recorded before any switch, which never matches a real slot
+#define READ_CACHE_NO_SLOT      std::numeric_limits<unsigned int>::max()
+
+// The firmware releases whose protocol features differ from the release before
+// them, oldest first. A device is given the features of the newest release not
+// newer than its own firmware
+struct firmware_release
+{
+  linkmasta_system system;
+  unsigned int     major_version;
+  unsigned int     minor_version;
+  unsigned int     max_batch_packets;
+  bool             device_checksums;
+  bool             erase_status_notification;
+  bool             pipelined_acks;
+  bool             interleaved_reads;
+};
+
+static const firmware_release firmware_releases[] = {
+  // Batch lengths are sent as a single byte. The WonderSwan firmware reads
+  // the next write batch while the previous one's acknowledgement is pending.
+  // The NGP firmware takes the chip with every read batch, so batches for
+  // both chips can be queued together
+  {LINKMASTA_NEO_GEO_POCKET, 0, 0, 255, false, false, false, true},
+  {LINKMASTA_WONDERSWAN,     0, 0, 255, false, false, true,  false},
+};
+
+linkmasta_device::firmware_capabilities::firmware_capabilities()
+  : max_batch_packets(std::numeric_limits<unsigned char>::max()),
+    device_checksums(false), erase_status_notification(false),
+    pipelined_acks(false), interleaved_reads(false)
+{
+  // Nothing else to do
+}
+
+linkmasta_device::timeout_profile::timeout_profile()
+  : command_ms(DEFAULT_COMMAND_TIMEOUT_MS), batch_ms(DEFAULT_BATCH_TIMEOUT_MS),
+    batch_bytes_per_ms(DEFAULT_BATCH_BYTES_PER_MS),
+    erase_poll_ms(DEFAULT_ERASE_POLL_TIMEOUT_MS)
+{
+  // Nothing else to do
+}
+
+linkmasta_device::session::session(linkmasta_device* device)
+  : m_device(device)
+{
+  m_device->begin_session();
+}
+
+linkmasta_device::session::~session()
+{
+  try
+  {
+    m_device->end_session();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // Do nothing, fail silently
+  }
+}
+
+linkmasta_device::abortable_read::abortable_read(linkmasta_device* device, task_controller* controller)
+  : m_device(controller != nullptr ? device : nullptr)
+{
+  if (m_device != nullptr)
+  {
+    std::lock_guard<std::mutex> lock(m_device->m_abort_mutex);
+    m_device->m_abortable = true;
+  }
+}
+
+linkmasta_device::abortable_read::~abortable_read()
+{
+  end();
+}
+
+void linkmasta_device::abortable_read::end()
+{
+  if (m_device != nullptr)
+  {
+    std::lock_guard<std::mutex> lock(m_device->m_abort_mutex);
+    m_device->m_abortable = false;
+    m_device = nullptr;
+  }
+}
+
+
+
+linkmasta_device::linkmasta_device()
+  : m_num_sessions(0), m_lingering(false),
+    m_idle_timeout(DEFAULT_IDLE_TIMEOUT_MS),
+    m_last_used(std::chrono::steady_clock::now()),
+    m_verify_reads(false), m_verifying_read(false), m_cache_reads(false),
+    m_read_cache_budget(process_memory_budget()),
+    m_read_cache_slot(READ_CACHE_NO_SLOT), m_abortable(false),
+    m_adaptive_batches(false), m_batch_tuning(nullptr),
+    m_batch_max_packets(std::numeric_limits<uint8_t>::max()), m_batch_packet_step(1),
+    m_metric_batches(nullptr), m_metric_reconnects(nullptr), m_metric_rereads(nullptr)
+{
+  m_metric_batch_packets[BATCH_READ] = nullptr;
+  m_metric_batch_packets[BATCH_WRITE] = nullptr;
+}
+
+linkmasta_device::~linkmasta_device()
+{
+  invalidate_read_cache();
+}
+
+
+
+bool linkmasta_device::probe_for_cartridge()
+{
+  return test_for_cartridge();
+}
+
+std::string linkmasta_device::fingerprint_cartridge()
+{
+  return std::string();
+}
+
+usb::result<linkmasta_device::word_t> linkmasta_device::try_read_word(chip_index chip, address_t address) noexcept
+{
+  try
+  {
+    return usb::result<word_t>::success(read_word(chip, address));
+  }
+  catch (std::exception& ex)
+  {
+    return usb::result<word_t>::failure(usb::status_of(ex), std::current_exception());
+  }
+  catch (...)
+  {
+    return usb::result<word_t>::failure(usb::TRANSFER_FAILED, std::current_exception());
+  }
+}
+
+usb::result<void> linkmasta_device::try_write_word(chip_index chip, address_t address, word_t data) noexcept
+{
+  try
+  {
+    write_word(chip, address, data);
+    return usb::result<void>::success();
+  }
+  catch (std::exception& ex)
+  {
+    return usb::result<void>::failure(usb::status_of(ex), std::current_exception());
+  }
+  catch (...)
+  {
+    return usb::result<void>::failure(usb::TRANSFER_FAILED, std::current_exception());
+  }
+}
+
+usb::result<bool> linkmasta_device::try_test_for_cartridge() noexcept
+{
+  try
+  {
+    return usb::result<bool>::success(test_for_cartridge());
+  }
+  catch (std::exception& ex)
+  {
+    return usb::result<bool>::failure(usb::status_of(ex), std::current_exception());
+  }
+  catch (...)
+  {
+    return usb::result<bool>::failure(usb::TRANSFER_FAILED, std::current_exception());
+  }
+}
+
+usb::result<bool> linkmasta_device::try_probe_for_cartridge() noexcept
+{
+  try
+  {
+    return usb::result<bool>::success(probe_for_cartridge());
+  }
+  catch (std::exception& ex)
+  {
+    return usb::result<bool>::failure(usb::status_of(ex), std::current_exception());
+  }
+  catch (...)
+  {
+    return usb::result<bool>::failure(usb::TRANSFER_FAILED, std::current_exception());
+  }
+}
+
+bool linkmasta_device::recover_connection()
+{
+  return false;
+}
+
+void linkmasta_device::abort_transfers()
+{
+  std::lock_guard<std::mutex> lock(m_abort_mutex);
+  if (m_abortable)
+  {
+    abort_usb_transfers();
+  }
+}
+
+void linkmasta_device::abort_usb_transfers()
+{
+  // Nothing to do
+}
+
+
 
 linkmasta_system linkmasta_device::system() const
 {
@@ -70,6 +311,31 @@ bool linkmasta_device::supports_switch_slot() const
   return false;
 }
 
+bool linkmasta_device::supports_stream_read_bytes() const
+{
+  return false;
+}
+
+bool linkmasta_device::supports_interleaved_read_bytes() const
+{
+  return false;
+}
+
+bool linkmasta_device::supports_word_sequence() const
+{
+  return false;
+}
+
+bool linkmasta_device::supports_checksum_range() const
+{
+  return false;
+}
+
+bool linkmasta_device::supports_erase_notification() const
+{
+  return false;
+}
+
 
 
 unsigned int linkmasta_device::read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, task_controller* controller)
@@ -93,6 +359,83 @@ unsigned int linkmasta_device::program_bytes(chip_index chip, address_t start_ad
   throw std::runtime_error("ERROR: NOT SUPPORTED");
 }
 
+unsigned int linkmasta_device::stream_read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, unsigned int pipeline_depth, task_controller* controller)
+{
+  // No pipelining available; fall back to plain batch reads
+  (void) pipeline_depth;
+  return read_bytes(chip, start_address, buffer, num_bytes, controller);
+}
+
+unsigned int linkmasta_device::interleaved_read_bytes(read_lane* lanes, unsigned int num_lanes, unsigned int pipeline_depth, task_controller* controller)
+{
+  // No interleaving available; read each chip in turn
+  unsigned int total_bytes = 0;
+  for (unsigned int i = 0; i < num_lanes; ++i)
+  {
+    lanes[i].bytes_read = 0;
+    total_bytes += lanes[i].num_bytes;
+  }
+  if (controller != nullptr)
+  {
+    controller->on_task_start(total_bytes);
+  }
+  
+  unsigned int bytes_read = 0;
+  try
+  {
+    for (unsigned int i = 0; i < num_lanes && (controller == nullptr || !controller->is_task_cancelled()); ++i)
+    {
+      read_lane& lane = lanes[i];
+      if (controller == nullptr)
+      {
+        lane.bytes_read = stream_read_bytes(lane.chip, lane.start_address, lane.buffer, lane.num_bytes, pipeline_depth);
+      }
+      else
+      {
+        forwarding_task_controller fwd_controller(controller);
+        fwd_controller.scale_work_to(lane.num_bytes);
+        lane.bytes_read = stream_read_bytes(lane.chip, lane.start_address, lane.buffer, lane.num_bytes, pipeline_depth, &fwd_controller);
+      }
+      bytes_read += lane.bytes_read;
+      if (lane.bytes_read < lane.num_bytes)
+      {
+        break;
+      }
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    if (controller != nullptr)
+    {
+      controller->on_task_end(task_status::ERROR, bytes_read);
+    }
+    throw;
+  }
+  
+  if (controller != nullptr)
+  {
+    controller->on_task_end(bytes_read < total_bytes && controller->is_task_cancelled() ? task_status::CANCELLED : task_status::COMPLETED, bytes_read);
+  }
+  return bytes_read;
+}
+
+void linkmasta_device::run_word_sequence(chip_index chip, word_command* commands, unsigned int num_commands)
+{
+  // No pipelining available; send the commands one at a time
+  for (unsigned int i = 0; i < num_commands; ++i)
+  {
+    if (commands[i].type == WORD_READ)
+    {
+      commands[i].data = read_word(chip, commands[i].address);
+    }
+    else
+    {
+      write_word(chip, commands[i].address, commands[i].data);
+    }
+  }
+}
+
 void linkmasta_device::erase_chip(chip_index chip)
 {
   (void) chip;
@@ -106,6 +449,29 @@ void linkmasta_device::erase_chip_block(chip_index chip, address_t block_address
   throw std::runtime_error("ERROR: NOT SUPPORTED");
 }
 
+bool linkmasta_device::wait_for_erase_notification(chip_index chip, unsigned int timeout_ms)
+{
+  (void) chip;
+  (void) timeout_ms;
+  throw std::runtime_error("ERROR: NOT SUPPORTED");
+}
+
+linkmasta_device::word_t linkmasta_device::read_erase_status(chip_index chip, address_t address)
+{
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  word_t status = read_word(chip, address);
+  record_latency(LATENCY_ERASE_POLL, started);
+  return status;
+}
+
+unsigned int linkmasta_device::checksum_range(chip_index chip, address_t start_address, unsigned int num_bytes)
+{
+  (void) chip;
+  (void) start_address;
+  (void) num_bytes;
+  throw std::runtime_error("ERROR: NOT SUPPORTED");
+}
+
 unsigned int linkmasta_device::read_manufacturer_id(chip_index chip)
 {
   (void) chip;
@@ -142,3 +508,586 @@ bool linkmasta_device::switch_slot(unsigned int slot_num)
   throw std::runtime_error("ERROR: NOT SUPPORTED");
 }
 
+void linkmasta_device::read_slot_footers(chip_index chip, unsigned int num_bytes, data_t* buffer, unsigned int final_slot)
+{
+  if (read_cached_slot_footers(chip, num_bytes, buffer, final_slot))
+  {
+    return;
+  }
+  
+  // No batching available; visit each slot in turn, which caches each footer
+  // as it goes
+  unsigned int num_slots = read_num_slots();
+  for (unsigned int slot = 0; slot < num_slots; ++slot)
+  {
+    if (!switch_slot(slot))
+    {
+      throw std::runtime_error("Error occured while attempting to switch slot");
+    }
+    read_bytes(chip, read_slot_size(slot) - num_bytes, buffer + slot * num_bytes, num_bytes);
+  }
+  if (!switch_slot(final_slot))
+  {
+    throw std::runtime_error("Error occured while attempting to switch slot");
+  }
+}
+
+buffer_pool& linkmasta_device::buffers()
+{
+  return m_buffers;
+}
+
+const linkmasta_device::firmware_capabilities& linkmasta_device::capabilities() const
+{
+  return m_capabilities;
+}
+
+linkmasta_device::firmware_capabilities linkmasta_device::negotiate_capabilities(linkmasta_system system, unsigned int major_version, unsigned int minor_version)
+{
+  firmware_capabilities capabilities;
+  for (const firmware_release& release : firmware_releases)
+  {
+    if (release.system != system || release.major_version > major_version
+        || (release.major_version == major_version && release.minor_version > minor_version))
+    {
+      continue;
+    }
+    
+    capabilities.max_batch_packets = release.max_batch_packets;
+    capabilities.device_checksums = release.device_checksums;
+    capabilities.erase_status_notification = release.erase_status_notification;
+    capabilities.pipelined_acks = release.pipelined_acks;
+    capabilities.interleaved_reads = release.interleaved_reads;
+  }
+  return capabilities;
+}
+
+void linkmasta_device::set_capabilities(const firmware_capabilities& capabilities)
+{
+  m_capabilities = capabilities;
+}
+
+void linkmasta_device::verify_read(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes)
+{
+  // The reads made while checking are compared against each other instead
+  if (!m_verify_reads || m_verifying_read || num_bytes == 0)
+  {
+    return;
+  }
+  
+  m_verifying_read = true;
+  try
+  {
+    // Let the device vouch for the whole range at once when it can
+    if (supports_checksum_range()
+        && checksum_range(chip, start_address, num_bytes) == digest_manifest::crc32c(buffer, num_bytes))
+    {
+      m_verifying_read = false;
+      return;
+    }
+    
+    buffer_pool::buffer second_memory = buffers().acquire(num_bytes);
+    data_t* second = second_memory.data();
+    if (read_bytes(chip, start_address, second, num_bytes) != num_bytes)
+    {
+      throw std::runtime_error("Unable to read data a second time");
+    }
+    
+    // Request only the packets that differ again until two reads agree
+    unsigned int num_corrupted = 0;
+    for (unsigned int offset = 0; offset < num_bytes; offset += VERIFY_PACKET_SIZE)
+    {
+      unsigned int packet_size = std::min<unsigned int>(VERIFY_PACKET_SIZE, num_bytes - offset);
+      if (memcmp(&buffer[offset], &second[offset], packet_size) == 0)
+      {
+        continue;
+      }
+      
+      ++num_corrupted;
+      bool agreed = false;
+      data_t third[VERIFY_PACKET_SIZE];
+      for (unsigned int attempt = 0; attempt < VERIFY_MAX_REREADS && !agreed; ++attempt)
+      {
+        if (read_bytes(chip, start_address + offset, third, packet_size) != packet_size)
+        {
+          throw std::runtime_error("Unable to read data a second time");
+        }
+        
+        if (memcmp(third, &buffer[offset], packet_size) == 0)
+        {
+          agreed = true;
+        }
+        else if (memcmp(third, &second[offset], packet_size) == 0)
+        {
+          memcpy(&buffer[offset], third, packet_size);
+          agreed = true;
+        }
+        else
+        {
+          // Compare the next read against the most recent one
+          memcpy(&second[offset], third, packet_size);
+        }
+      }
+      
+      if (!agreed)
+      {
+        throw std::runtime_error("Unable to read consistent data at address " + std::to_string(start_address + offset));
+      }
+    }
+    
+    if (num_corrupted > 0)
+    {
+      log(log_level::INFO, ("Read " + std::to_string(num_corrupted) + " corrupted packets again").c_str());
+      if (m_metric_rereads != nullptr)
+      {
+        m_metric_rereads->add(num_corrupted);
+      }
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    m_verifying_read = false;
+    throw;
+  }
+  m_verifying_read = false;
+}
+
+bool linkmasta_device::read_cached(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes)
+{
+  if (!m_cache_reads || m_verifying_read || num_bytes == 0)
+  {
+    return false;
+  }
+  
+  for (auto it = m_read_cache.begin(); it != m_read_cache.end(); ++it)
+  {
+    if (it->chip != chip || it->slot_num != m_read_cache_slot
+        || start_address < it->start_address
+        || start_address - it->start_address + num_bytes > it->data.size())
+    {
+      continue;
+    }
+    
+    memcpy(buffer, &it->data[start_address - it->start_address], num_bytes);
+    
+    // Keep the ranges in use ahead of the ones to evict
+    m_read_cache.splice(m_read_cache.begin(), m_read_cache, it);
+    return true;
+  }
+  return false;
+}
+
+void linkmasta_device::cache_read(chip_index chip, address_t start_address, const data_t* buffer, unsigned int num_bytes)
+{
+  if (!m_cache_reads || m_verifying_read || num_bytes == 0 || num_bytes > READ_CACHE_MAX_BYTES)
+  {
+    return;
+  }
+  
+  // Reads are only worth keeping while there's room for them
+  if (m_read_cache_budget != nullptr && !m_read_cache_budget->try_reserve(num_bytes))
+  {
+    return;
+  }
+  
+  cached_read entry;
+  entry.chip = chip;
+  entry.slot_num = m_read_cache_slot;
+  entry.start_address = start_address;
+  entry.data.assign(buffer, buffer + num_bytes);
+  m_read_cache.push_front(entry);
+  
+  while (m_read_cache.size() > READ_CACHE_MAX_ENTRIES)
+  {
+    if (m_read_cache_budget != nullptr)
+    {
+      m_read_cache_budget->release(m_read_cache.back().data.size());
+    }
+    m_read_cache.pop_back();
+  }
+}
+
+void linkmasta_device::invalidate_read_cache(chip_index chip)
+{
+  for (auto it = m_read_cache.begin(); it != m_read_cache.end();)
+  {
+    if (it->chip == chip)
+    {
+      if (m_read_cache_budget != nullptr)
+      {
+        m_read_cache_budget->release(it->data.size());
+      }
+      it = m_read_cache.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+void linkmasta_device::invalidate_read_cache()
+{
+  for (const cached_read& entry : m_read_cache)
+  {
+    if (m_read_cache_budget != nullptr)
+    {
+      m_read_cache_budget->release(entry.data.size());
+    }
+  }
+  m_read_cache.clear();
+  m_read_cache_slot = READ_CACHE_NO_SLOT;
+}
+
+void linkmasta_device::forget_chip_modes()
+{
+  m_chip_modes.clear();
+}
+
+void linkmasta_device::forget_cartridge_state()
+{
+  invalidate_read_cache();
+  forget_chip_modes();
+}
+
+void linkmasta_device::on_chip_command(chip_index chip)
+{
+  invalidate_read_cache(chip);
+  m_chip_modes.erase(chip);
+}
+
+void linkmasta_device::on_chip_command(chip_index chip, const word_command* commands, unsigned int num_commands)
+{
+  for (unsigned int i = 0; i < num_commands; ++i)
+  {
+    if (commands[i].type == WORD_WRITE)
+    {
+      on_chip_command(chip);
+      return;
+    }
+  }
+}
+
+void linkmasta_device::set_read_cache_slot(unsigned int slot_num)
+{
+  m_read_cache_slot = slot_num;
+}
+
+bool linkmasta_device::read_cached_slot_footers(chip_index chip, unsigned int num_bytes, data_t* buffer, unsigned int final_slot)
+{
+  if (!m_cache_reads || m_read_cache_slot != final_slot)
+  {
+    return false;
+  }
+  
+  // Look each footer up under its own slot
+  unsigned int num_slots = read_num_slots();
+  bool found = true;
+  for (unsigned int slot = 0; found && slot < num_slots; ++slot)
+  {
+    m_read_cache_slot = slot;
+    found = read_cached(chip, read_slot_size(slot) - num_bytes, buffer + slot * num_bytes, num_bytes);
+  }
+  m_read_cache_slot = final_slot;
+  return found;
+}
+
+void linkmasta_device::cache_slot_footers(chip_index chip, unsigned int num_bytes, const data_t* buffer)
+{
+  if (!m_cache_reads)
+  {
+    return;
+  }
+  
+  unsigned int current_slot = m_read_cache_slot;
+  unsigned int num_slots = read_num_slots();
+  for (unsigned int slot = 0; slot < num_slots; ++slot)
+  {
+    m_read_cache_slot = slot;
+    cache_read(chip, read_slot_size(slot) - num_bytes, buffer + slot * num_bytes, num_bytes);
+  }
+  m_read_cache_slot = current_slot;
+}
+
+void linkmasta_device::bind_metrics(const std::string& serial)
+{
+  if (m_metric_batches != nullptr)
+  {
+    return;
+  }
+  
+  std::string labels = metrics_label("serial", serial);
+  m_metric_batches = metrics_counter("flashmasta_linkmasta_batches_total", "Batches of data moved to or from a linkmasta device", labels);
+  m_metric_reconnects = metrics_counter("flashmasta_linkmasta_retries_total", "Operations retried on a linkmasta device", labels + ",kind=\"reconnect\"");
+  m_metric_rereads = metrics_counter("flashmasta_linkmasta_retries_total", "Operations retried on a linkmasta device", labels + ",kind=\"reread\"");
+  m_metric_batch_packets[BATCH_READ] = metrics_gauge("flashmasta_linkmasta_batch_packets", "Packets per batch moved to or from a linkmasta device", labels + ",direction=\"read\"");
+  m_metric_batch_packets[BATCH_WRITE] = metrics_gauge("flashmasta_linkmasta_batch_packets", "Packets per batch moved to or from a linkmasta device", labels + ",direction=\"write\"");
+}
+
+void linkmasta_device::count_batch()
+{
+  if (m_metric_batches != nullptr)
+  {
+    m_metric_batches->add();
+  }
+}
+
+void linkmasta_device::count_reconnect()
+{
+  if (m_metric_reconnects != nullptr)
+  {
+    m_metric_reconnects->add();
+  }
+}
+
+void linkmasta_device::start_batch_tuning(const std::string& serial, unsigned int max_packets, unsigned int packet_step)
+{
+  m_batch_serial = serial;
+  m_batch_max_packets = max_packets;
+  m_batch_packet_step = packet_step;
+  
+  for (int direction = BATCH_READ; direction <= BATCH_WRITE; ++direction)
+  {
+    unsigned int initial = 0;
+    if (m_batch_tuning != nullptr && !m_batch_serial.empty())
+    {
+      initial = m_batch_tuning->get(m_batch_serial, (batch_direction) direction);
+    }
+    m_batch_tuners[direction].reset(m_batch_max_packets, m_batch_packet_step, initial);
+    
+    if (m_metric_batch_packets[direction] != nullptr)
+    {
+      m_metric_batch_packets[direction]->set(batch_packets((batch_direction) direction));
+    }
+  }
+}
+
+void linkmasta_device::record_batch(batch_direction direction, unsigned int num_packets, std::chrono::steady_clock::time_point started)
+{
+  record_latency(direction == BATCH_READ ? LATENCY_READ_BATCH : LATENCY_WRITE_ACK, started);
+  if (!m_adaptive_batches)
+  {
+    return;
+  }
+  
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  if (m_batch_tuners[direction].record_batch(num_packets, seconds))
+  {
+    on_batch_size_changed(direction);
+  }
+}
+
+void linkmasta_device::record_batch_failure(batch_direction direction)
+{
+  if (m_adaptive_batches && m_batch_tuners[direction].record_failure())
+  {
+    on_batch_size_changed(direction);
+  }
+}
+
+void linkmasta_device::record_latency(command_latency command, std::chrono::steady_clock::time_point started)
+{
+  m_latencies[command].record_since(started);
+}
+
+void linkmasta_device::on_batch_size_changed(batch_direction direction)
+{
+  unsigned int packets = m_batch_tuners[direction].packets();
+  if (m_metric_batch_packets[direction] != nullptr)
+  {
+    m_metric_batch_packets[direction]->set(packets);
+  }
+  
+  // Failing to record the size only loses it for the next run
+  if (m_batch_tuning != nullptr && !m_batch_serial.empty())
+  {
+    try
+    {
+      m_batch_tuning->set(m_batch_serial, direction, packets);
+    }
+    catch (std::exception& ex)
+    {
+      log(log_level::INFO, ex.what());
+    }
+  }
+}
+
+unsigned int linkmasta_device::idle_timeout() const
+{
+  return m_idle_timeout;
+}
+
+void linkmasta_device::set_idle_timeout(unsigned int timeout_ms)
+{
+  m_idle_timeout = timeout_ms;
+}
+
+bool linkmasta_device::close_if_idle()
+{
+  if (m_num_sessions > 0 || !m_lingering)
+  {
+    return false;
+  }
+  
+  auto idle_time = std::chrono::steady_clock::now() - m_last_used;
+  if (idle_time < std::chrono::milliseconds(m_idle_timeout))
+  {
+    return false;
+  }
+  
+  m_lingering = false;
+  close();
+  return true;
+}
+
+bool linkmasta_device::verify_reads() const
+{
+  return m_verify_reads;
+}
+
+void linkmasta_device::set_verify_reads(bool verify)
+{
+  m_verify_reads = verify;
+}
+
+bool linkmasta_device::cache_reads() const
+{
+  return m_cache_reads;
+}
+
+void linkmasta_device::set_cache_reads(bool enabled)
+{
+  m_cache_reads = enabled;
+  if (!enabled)
+  {
+    invalidate_read_cache();
+  }
+}
+
+bool linkmasta_device::adaptive_batches() const
+{
+  return m_adaptive_batches;
+}
+
+void linkmasta_device::set_adaptive_batches(bool enabled, batch_tuning_store* store)
+{
+  // Jobs set this every time they start, which mustn't lose what was tuned
+  if (enabled == m_adaptive_batches && store == m_batch_tuning)
+  {
+    return;
+  }
+  
+  m_adaptive_batches = enabled;
+  m_batch_tuning = store;
+  start_batch_tuning(m_batch_serial, m_batch_max_packets, m_batch_packet_step);
+}
+
+unsigned int linkmasta_device::batch_packets(batch_direction direction) const
+{
+  return (m_adaptive_batches ? m_batch_tuners[direction].packets() : m_batch_max_packets);
+}
+
+const latency_histogram& linkmasta_device::command_latencies(command_latency command) const
+{
+  return m_latencies[command];
+}
+
+void linkmasta_device::reset_command_latencies()
+{
+  for (unsigned int i = 0; i < NUM_COMMAND_LATENCIES; ++i)
+  {
+    m_latencies[i].reset();
+  }
+}
+
+const linkmasta_device::timeout_profile& linkmasta_device::timeouts() const
+{
+  return m_timeouts;
+}
+
+void linkmasta_device::set_timeouts(const timeout_profile& profile)
+{
+  m_timeouts = profile;
+}
+
+linkmasta_device::timeout_t linkmasta_device::batch_timeout(unsigned int num_bytes) const
+{
+  if (m_timeouts.batch_ms == 0)
+  {
+    return 0;
+  }
+  return m_timeouts.batch_ms + (m_timeouts.batch_bytes_per_ms > 0 ? num_bytes / m_timeouts.batch_bytes_per_ms : 0);
+}
+
+int linkmasta_device::chip_mode(chip_index chip) const
+{
+  auto it = m_chip_modes.find(chip);
+  if (it == m_chip_modes.end())
+  {
+    return CHIP_MODE_UNKNOWN;
+  }
+  return it->second;
+}
+
+void linkmasta_device::set_chip_mode(chip_index chip, int mode)
+{
+  if (mode == CHIP_MODE_UNKNOWN)
+  {
+    m_chip_modes.erase(chip);
+  }
+  else
+  {
+    m_chip_modes[chip] = mode;
+  }
+}
+
+
+
+bool linkmasta_device::defer_close()
+{
+  if (m_num_sessions == 0 && !m_lingering)
+  {
+    return false;
+  }
+  
+  m_last_used = std::chrono::steady_clock::now();
+  return true;
+}
+
+void linkmasta_device::end_all_sessions()
+{
+  m_num_sessions = 0;
+  m_lingering = false;
+}
+
+
+
+void linkmasta_device::begin_session()
+{
+  // Open first so that a failure doesn't leave a session counted
+  open();
+  ++m_num_sessions;
+}
+
+void linkmasta_device::end_session()
+{
+  if (m_num_sessions == 0)
+  {
+    return;
+  }
+  
+  m_last_used = std::chrono::steady_clock::now();
+  if (--m_num_sessions > 0)
+  {
+    return;
+  }
+  
+  // Keep the device open for the next sequence of operations, unless it has
+  // been closed behind our back
+  m_lingering = (m_idle_timeout > 0 && is_open());
+  if (!m_lingering)
+  {
+    close();
+  }
+}
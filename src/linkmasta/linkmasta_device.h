@@ -14,12 +14,27 @@
 #ifndef __LINKMASTSA_DEVICE_H__
 #define __LINKMASTSA_DEVICE_H__
 
+#include "batch_tuner.h"
+#include "common/buffer_pool.h"
+#include "common/latency_histogram.h"
 #include "common/types.h"
+#include "usb/usb_result.h"
+#include <chrono>
+#include <list>
+#include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 class cartridge;
+class memory_budget;
+class metric;
 class task_controller;
 
+/*! \brief Value of \ref linkmasta_device::chip_mode() for a chip whose mode
+ *         is not known. */
+#define CHIP_MODE_UNKNOWN (-1)
+
 
 
 /*! \enum linkmasta_system
@@ -40,6 +55,32 @@ enum linkmasta_system
   LINKMASTA_WONDERSWAN
 };
 
+/*! \enum command_latency
+ *  \brief Enumeration of the kinds of exchange with a linkmasta device whose
+ *         latencies are recorded.
+ *  
+ *  \see linkmasta_device::command_latencies(command_latency command) const
+ */
+enum command_latency
+{
+  /*! \brief A read64xN batch, from its command, or the end of the batch
+   *         before it if the two overlapped, to its last packet. */
+  LATENCY_READ_BATCH,
+  
+  /*! \brief A write64xN batch, from its command, or the acknowledgement
+   *         before it if the two overlapped, to its acknowledgement. */
+  LATENCY_WRITE_ACK,
+  
+  /*! \brief A single word write and its reply. */
+  LATENCY_WORD_WRITE,
+  
+  /*! \brief A single read of the status of a chip being erased. */
+  LATENCY_ERASE_POLL,
+  
+  /*! \brief The number of kinds of exchange. Not a kind. */
+  NUM_COMMAND_LATENCIES
+};
+
 
 
 /*! \class linkmasta_device
@@ -73,14 +114,183 @@ public:
   /*! \brief Type used for indicating chip indexes in some operations. */
   typedef unsigned int     chip_index;
   
+  /*! \brief Enumeration of the kinds of operations in a \ref word_command. */
+  enum word_command_type
+  {
+    /*! \brief Write \ref word_command::data to \ref word_command::address. */
+    WORD_WRITE,
+    
+    /*! \brief Read a word from \ref word_command::address into
+     *         \ref word_command::data. */
+    WORD_READ
+  };
+  
+  /*!
+   *  \brief A single word operation in a sequence passed to
+   *         \ref run_word_sequence().
+   */
+  struct word_command
+  {
+    /*! \brief The kind of operation to perform. */
+    word_command_type      type;
+    
+    /*! \brief The address on the chip to write to or read from. */
+    address_t              address;
+    
+    /*! \brief The word to write, or the word read once the sequence has run. */
+    word_t                 data;
+  };
+  
+  /*!
+   *  \brief A single chip's share of the reads passed to
+   *         \ref interleaved_read_bytes().
+   */
+  struct read_lane
+  {
+    /*! \brief The index of the chip to read from. */
+    chip_index             chip;
+    
+    /*! \brief The address on the chip of the first byte to read. */
+    address_t              start_address;
+    
+    /*! \brief The array to read the bytes into, at least
+     *         \ref read_lane::num_bytes long. */
+    data_t*                buffer;
+    
+    /*! \brief The number of sequential bytes to read from the chip. */
+    unsigned int           num_bytes;
+    
+    /*! \brief Set to the number of bytes successfully read from the chip. */
+    unsigned int           bytes_read;
+  };
+  
+  /*!
+   *  \brief The protocol features offered by a device's firmware.
+   *  
+   *  The protocol features a device's firmware offers, negotiated from its
+   *  firmware version when the device is opened.
+   *  
+   *  \see negotiate_capabilities(linkmasta_system system, unsigned int major_version, unsigned int minor_version)
+   */
+  struct firmware_capabilities
+  {
+    /*!
+     *  \brief Constructs the capabilities every firmware version offers.
+     */
+    firmware_capabilities();
+    
+    /*! \brief The largest number of packets in a read64xN or write64xN batch. */
+    unsigned int           max_batch_packets;
+    
+    /*! \brief Whether the device can checksum a range of memory itself. */
+    bool                   device_checksums;
+    
+    /*! \brief Whether the device reports when an erase has finished instead
+     *         of having to be polled. */
+    bool                   erase_status_notification;
+    
+    /*! \brief Whether the device accepts the next write batch before the
+     *         previous batch's acknowledgement has been read. */
+    bool                   pipelined_acks;
+    
+    /*! \brief Whether the device accepts read batches for different chips
+     *         queued behind one another. */
+    bool                   interleaved_reads;
+  };
+  
+  /*!
+   *  \brief The USB timeouts of each kind of exchange with the device.
+   *  
+   *  Rather than a single timeout for every transfer, each kind of exchange
+   *  is given about as long as it can legitimately take, so that a command
+   *  the device never answers fails in a fraction of a second while a large
+   *  batch the device is still working through doesn't time out. A timeout
+   *  of 0 never runs out.
+   *  
+   *  \see set_timeouts(const timeout_profile& profile)
+   */
+  struct timeout_profile
+  {
+    /*!
+     *  \brief Constructs the default timeouts.
+     */
+    timeout_profile();
+    
+    /*! \brief Timeout in milliseconds of single-packet commands and their
+     *         replies, also used for anything not covered below. */
+    timeout_t              command_ms;
+    
+    /*! \brief Timeout in milliseconds of a read64xN or write64xN batch,
+     *         before adding time for its size. */
+    timeout_t              batch_ms;
+    
+    /*! \brief The slowest rate in bytes per millisecond a batch may move at
+     *         before timing out, which adds time for each byte of the batch,
+     *         or 0 to give every batch \ref batch_ms regardless of size. */
+    unsigned int           batch_bytes_per_ms;
+    
+    /*! \brief Timeout in milliseconds of each read polling a chip for the
+     *         end of an erase. */
+    timeout_t              erase_poll_ms;
+  };
+  
+  /*! \class session
+   *  \brief Keeps a device open for a sequence of operations.
+   *  
+   *  Lease that opens a device when constructed and keeps it open until it is
+   *  destroyed. While a session is held, calls to \ref close() only send any
+   *  queued writes, so a sequence of cartridge operations that each open and
+   *  close the device only sets up the USB interface once.
+   *  
+   *  When the last session on a device ends, the device stays open for its
+   *  \ref idle_timeout() so that the next sequence can pick up where this one
+   *  left off. It is closed for good by \ref close_if_idle().
+   *  
+   *  Sessions must only be started and ended by whoever currently has the
+   *  device claimed.
+   */
+  class session
+  {
+  public:
+  
+    /*!
+     *  \brief Class constructor. Opens the device if it is not already open.
+     *  
+     *  \param [in] device The device to keep open. Must outlive the session.
+     *  
+     *  \throws std::runtime_error If the device could not be opened.
+     */
+    explicit               session(linkmasta_device* device);
+    
+    /*!
+     *  \brief Class destructor. Ends the session.
+     */
+                           ~session();
+  
+  
+  
+  private:
+    session(const session& other) = delete;
+    session& operator=(const session& other) = delete;
+    
+    /*! \brief The device being kept open. */
+    linkmasta_device*      m_device;
+  };
+  
   
   
+  /*!
+   *  \brief Class constructor.
+   */
+                           linkmasta_device();
+  
   /*!
    *  \brief Class destructor.
    *  
-   *  Destructor for the class. Exists to surpress warnings.
+   *  Destructor for the class. Gives the memory of the cached reads back to
+   *  the budget.
    */
-  virtual                  ~linkmasta_device() {};
+  virtual                  ~linkmasta_device();
   
   /*!
    *  \brief Initializes the device using default settings.
@@ -106,18 +316,19 @@ public:
   virtual bool             is_open() const = 0;
   
   /*!
-   *  \brief Gets the current timeout setting used for all communication with
-   *         the underlying USB device.
+   *  \brief Gets the current timeout setting used for commands sent to the
+   *         underlying USB device.
    *  
-   *  Gets the current timeout setting used for all communication with the
-   *  underlying USB device. This value is used when sending and recieving data
-   *  over USB, but does not apply to operations in the class. In other words,
-   *  if a single operation requires the sending and recieving of multiple
-   *  messages over USB, then this timeout will be multiplied by the number of
-   *  messages sent or recieved. This value will fluctuate depending on the
-   *  underlying implementation.
+   *  Gets the current timeout setting used for single-packet commands sent
+   *  to the underlying USB device, \ref timeout_profile::command_ms. This
+   *  value is used when sending and recieving data over USB, but does not
+   *  apply to operations in the class. In other words, if a single operation
+   *  requires the sending and recieving of multiple messages over USB, then
+   *  this timeout will be multiplied by the number of messages sent or
+   *  recieved. Batches and erase polls have timeouts of their own, see
+   *  \ref timeouts().
    *  
-   *  \return Number of milliseconds that all USB operations will be capped at.
+   *  \return Number of milliseconds that USB commands will be capped at.
    *  
    *  \see set_timeout(timeout_t timeout)
    */
@@ -161,13 +372,14 @@ public:
   
   
   /*!
-   *  \brief Sets the maximum number of milliseconds that USB operations should
+   *  \brief Sets the maximum number of milliseconds that USB commands should
    *         be allowed to take before being terminated.
    *  
-   *  Sets the maximum number of milliseconds that USB operations should be
-   *  allowed to take before being terminated. If a negative number is given,
-   *  then all timeouts will be removed, potentially allowing USB operations to
-   *  hang indefinitely.
+   *  Sets the maximum number of milliseconds that single-packet USB commands
+   *  should be allowed to take before being terminated, leaving the other
+   *  timeouts of \ref timeouts() as they are. If 0 is given, then the
+   *  timeout will be removed, potentially allowing USB commands to hang
+   *  indefinitely.
    *  
    *  \param [in] timeout The number of milliseconds to allow USB operations to
    *                      take.
@@ -206,6 +418,48 @@ public:
    */
   virtual void             close() = 0;
   
+  /*!
+   *  \brief Attempts to recover from a failed transfer without reopening the
+   *         device.
+   *  
+   *  Has the underlying USB device discard stale transfers and clear any
+   *  stalled endpoints, then checks that the firmware answers requests in step
+   *  again. Should be called after a transfer fails and before the failed
+   *  operation is retried, so that the retry doesn't read replies meant for
+   *  the attempt that failed.
+   *  
+   *  This is a blocking function that can take a fraction of a second to
+   *  complete.
+   *  
+   *  \return true if operations can carry on, false if the device must be
+   *          closed and reopened. The default implementation always returns
+   *          false.
+   */
+  virtual bool             recover_connection();
+  
+  /*!
+   *  \brief Makes the transfers in flight fail right away so that a cancelled
+   *         operation stops without waiting for them.
+   *  
+   *  Meant to be called from another thread right after cancelling the task
+   *  controller of an operation running on this device. Only reads given a
+   *  controller are aborted, since they can be stopped at any point: the read
+   *  sees its transfers fail, brings the connection back in step with
+   *  \ref recover_connection(), and ends as cancelled instead of as failed.
+   *  Programming is left to stop at the end of its current batch so that the
+   *  firmware isn't left waiting for the rest of a command, and erases
+   *  already under way can't be interrupted at all and are waited out.
+   *  
+   *  Together with the checks between batches, this bounds how long
+   *  cancelling takes to about one batch or one recovery, rather than one USB
+   *  timeout per retry.
+   *  
+   *  This method may be called from any thread.
+   *  
+   *  \see usb::usb_device::abort_pending_transfers()
+   */
+  void                     abort_transfers();
+  
   /*!
    *  \brief Reads an individual word from the underlying USB device which may
    *         be data or control information.
@@ -293,6 +547,103 @@ public:
    */
   virtual bool             test_for_cartridge() = 0;
   
+  /*!
+   *  \brief Quickly checks for a connected cartridge, for polling.
+   *  
+   *  Cheaper and less thorough version of \ref test_for_cartridge(), meant to
+   *  be called periodically without taking much bandwidth from other devices
+   *  on the same bus. Callers should confirm a change in the answer with
+   *  \ref test_for_cartridge().
+   *  
+   *  The default implementation calls \ref test_for_cartridge().
+   *  
+   *  If an operation fails or an error occures, this method will throw an
+   *  exception.
+   *  
+   *  \return true if a cartridge is likely connected, false if not.
+   */
+  virtual bool             probe_for_cartridge();
+  
+  /*!
+   *  \brief Reads a quick fingerprint of the connected cartridge.
+   *  
+   *  Reads just enough of the connected cartridge to tell it apart from
+   *  others, such as its chip IDs and a checksum of its game header, so that
+   *  what was learned about a cartridge that is pulled and seated again can
+   *  be reused instead of probing it from scratch. Cartridges that give the
+   *  same fingerprint should not be assumed to be the same if their contents
+   *  may have changed in the meantime.
+   *  
+   *  The default implementation returns an empty string, meaning that
+   *  cartridges can't be told apart.
+   *  
+   *  If an operation fails or an error occures, this method will throw an
+   *  exception.
+   *  
+   *  
+eturn The fingerprint, or an empty string if none could be taken.
+   */
+  virtual std::string      fingerprint_cartridge();
+  
+  /*!
+   *  \brief Reads an individual word without throwing.
+   *  
+   *  Same as \ref read_word(), except that failures are returned instead of
+   *  thrown, for loops where failures are expected. The default
+   *  implementation catches whatever \ref read_word() throws.
+   *  
+   *  \param [in] chip    The index of the hardware chip on the connected
+   *                      cartridge to read the word from.
+   *  \param [in] address The memory address on the hardware chip on the
+   *                      connected cartridge of the word to read.
+   *  
+   *  \return The word read, or how the read failed.
+   */
+  virtual usb::result<word_t> try_read_word(chip_index chip, address_t address) noexcept;
+  
+  /*!
+   *  \brief Writes an individual word without throwing.
+   *  
+   *  Same as \ref write_word(), except that failures are returned instead of
+   *  thrown. The default implementation catches whatever \ref write_word()
+   *  throws.
+   *  
+   *  \param [in] chip    The index of the hardware chip on the connected
+   *                      cartridge to write the word to.
+   *  \param [in] address The memory address on the hardware chip on the
+   *                      connected cartridge of the word to write.
+   *  \param [in] data    The word of data to write to the hardware device.
+   *  
+   *  \return How the write failed, if it did.
+   */
+  virtual usb::result<void> try_write_word(chip_index chip, address_t address, word_t data) noexcept;
+  
+  /*!
+   *  \brief Tests for the existance of a connected cartridge without
+   *         throwing.
+   *  
+   *  Same as \ref test_for_cartridge(), except that failures are returned
+   *  instead of thrown. The default implementation catches whatever
+   *  \ref test_for_cartridge() throws.
+   *  
+   *  \return Whether a cartridge is connected, or how the test failed.
+   */
+  virtual usb::result<bool> try_test_for_cartridge() noexcept;
+  
+  /*!
+   *  \brief Quickly checks for a connected cartridge without throwing.
+   *  
+   *  Same as \ref probe_for_cartridge(), except that failures are returned
+   *  instead of thrown, so that polling a device that keeps failing, such as
+   *  one being unplugged, doesn't unwind an exception on each poll. The
+   *  default implementation catches whatever \ref probe_for_cartridge()
+   *  throws.
+   *  
+   *  \return Whether a cartridge is likely connected, or how the probe
+   *          failed.
+   */
+  virtual usb::result<bool> try_probe_for_cartridge() noexcept;
+  
   /*!
    *  \brief Builds a \ref cartridge object that can be used to perform
    *         high-level cartidge operations on.
@@ -453,6 +804,87 @@ public:
    */
   virtual bool             supports_switch_slot() const;
   
+  /*!
+   *  \brief Gets whether or not this particular implementation supports
+   *         pipelined calls to \ref stream_read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr).
+   *  
+   *  Gets whether or not this particular implementation supports pipelined
+   *  streaming reads. If this method returns false, calls to
+   *  \ref stream_read_bytes() are still valid but are simply forwarded to
+   *  \ref read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, task_controller* controller = nullptr).
+   *  
+   *  \return true if this implementation pipelines calls to
+   *          \ref stream_read_bytes(), false if not. Unless overridden, this
+   *          function returns false.
+   *  
+   *  \see stream_read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr)
+   */
+  virtual bool             supports_stream_read_bytes() const;
+  
+  /*!
+   *  \brief Gets whether or not this particular implementation interleaves the
+   *         batches of calls to \ref interleaved_read_bytes(read_lane* lanes, unsigned int num_lanes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr).
+   *  
+   *  Gets whether or not this particular implementation can keep read batches
+   *  for several chips queued on the device at once. If this method returns
+   *  false, calls to \ref interleaved_read_bytes() are still valid but read
+   *  each chip in turn with \ref stream_read_bytes().
+   *  
+   *  \return true if this implementation interleaves calls to
+   *          \ref interleaved_read_bytes(), false if not. Unless overridden,
+   *          this function returns false.
+   *  
+   *  \see interleaved_read_bytes(read_lane* lanes, unsigned int num_lanes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr)
+   */
+  virtual bool             supports_interleaved_read_bytes() const;
+  
+  /*!
+   *  \brief Gets whether or not this particular implementation pipelines calls
+   *         to \ref run_word_sequence(chip_index chip, word_command* commands, unsigned int num_commands).
+   *  
+   *  Gets whether or not this particular implementation sends the commands of
+   *  a word sequence in a single burst. If this method returns false, calls to
+   *  \ref run_word_sequence() are still valid but are simply carried out one
+   *  command at a time using \ref read_word() and \ref write_word().
+   *  
+   *  \return true if this implementation pipelines calls to
+   *          \ref run_word_sequence(), false if not. Unless overridden, this
+   *          function returns false.
+   */
+  virtual bool             supports_word_sequence() const;
+  
+  /*!
+   *  \brief Gets whether or not this particular implementation supports calls
+   *         to \ref checksum_range(chip_index chip, address_t start_address, unsigned int num_bytes).
+   *  
+   *  Gets whether or not the connected device can checksum a range of a chip
+   *  itself, so that data can be verified without being read back. If this
+   *  method returns false, then calls to \ref checksum_range() will throw an
+   *  exception. Implementations whose firmware offers the command should
+   *  report \ref firmware_capabilities::device_checksums here.
+   *  
+   *  \return true if this implementation supports calls to
+   *          \ref checksum_range(), false if not. Unless overridden, this
+   *          function returns false.
+   */
+  virtual bool             supports_checksum_range() const;
+  
+  /*!
+   *  \brief Gets whether or not this particular implementation supports calls
+   *         to \ref wait_for_erase_notification(chip_index chip, unsigned int timeout_ms).
+   *  
+   *  Gets whether or not the connected device reports on an interrupt
+   *  endpoint when an erase has finished, so that the chip doesn't have to be
+   *  polled. Requires both firmware offering
+   *  \ref firmware_capabilities::erase_status_notification and a USB
+   *  connection able to read the endpoint.
+   *  
+   *  \return true if this implementation supports calls to
+   *          \ref wait_for_erase_notification(), false if not. Unless
+   *          overridden, this function returns false.
+   */
+  virtual bool             supports_erase_notification() const;
+  
   
   
   /*!
@@ -529,6 +961,107 @@ public:
    */
   virtual unsigned int     program_bytes(chip_index chip, address_t start_address, const data_t* buffer, unsigned int num_bytes, bool bypass_mode, task_controller* controller = nullptr);
   
+  /*!
+   *  \brief Reads a sequence of bytes from the indicated chip on the connected
+   *         cartridge, keeping several read requests queued on the device.
+   *  
+   *  Reads a sequence of bytes from the indicated chip on the connected
+   *  cartridge into the provided array. Behaves like
+   *  \ref read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, task_controller* controller = nullptr),
+   *  except that the next batch of data is requested from the device while the
+   *  previous batch is still being received, so that the device never sits
+   *  idle between batches.
+   *  
+   *  If the implementation does not support pipelining, as reported by
+   *  \ref supports_stream_read_bytes(), the call is forwarded to
+   *  \ref read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, task_controller* controller = nullptr).
+   *  
+   *  This is a blocking function that can take a long time to complete. An
+   *  optional \ref task_controller can be provided to track the progress of the
+   *  operation.
+   *  
+   *  \param [in] chip The index of the chip to read the bytes from.
+   *  \param [in] start_address The start address to begin reading the sequence
+   *         of bytes in increasing order.
+   *  \param [out] buffer Output array to which all read bytes will be written.
+   *         Must be allocated and at least as large as the value of
+   *         \ref num_bytes
+   *  \param [in] num_bytes Number of sequential bytes to read from the device.
+   *  \param [in] pipeline_depth The maximum number of batch read requests that
+   *         may be outstanding on the device at once. A value of 1 behaves
+   *         like \ref read_bytes().
+   *  \param [out] controller Optional \ref task_controller object to report
+   *         progress of the operation to. If nullptr is given, then this
+   *         parameter will be ignored.
+   *  
+   *  \return The number of bytes successfully read from the device.
+   *  
+   *  \see supports_stream_read_bytes()
+   *  \see read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, task_controller* controller = nullptr)
+   */
+  virtual unsigned int     stream_read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr);
+  
+  /*!
+   *  \brief Reads sequences of bytes from several chips on the connected
+   *         cartridge at once, alternating batches between the chips.
+   *  
+   *  Reads a sequence of bytes from each of the given chips into its own
+   *  array. Behaves like calling
+   *  \ref stream_read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr)
+   *  for each lane in turn, except that batches for each chip are requested
+   *  in turn and kept queued on the device together, so that the device sets
+   *  up the next chip while the previous chip's batch is still being
+   *  received.
+   *  
+   *  If the implementation does not support interleaving, as reported by
+   *  \ref supports_interleaved_read_bytes(), each lane is read in turn with
+   *  \ref stream_read_bytes().
+   *  
+   *  This is a blocking function that can take a long time to complete. An
+   *  optional \ref task_controller can be provided to track the progress of the
+   *  operation, reported as the total of every lane.
+   *  
+   *  \param [in,out] lanes The chips to read and the arrays to read them
+   *         into. \ref read_lane::bytes_read is set for each.
+   *  \param [in] num_lanes The number of lanes.
+   *  \param [in] pipeline_depth The maximum number of batch read requests that
+   *         may be outstanding on the device at once, across every lane.
+   *  \param [out] controller Optional \ref task_controller object to report
+   *         progress of the operation to. If nullptr is given, then this
+   *         parameter will be ignored.
+   *  
+   *  \return The total number of bytes successfully read from the device.
+   *  
+   *  \see supports_interleaved_read_bytes()
+   *  \see stream_read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr)
+   */
+  virtual unsigned int     interleaved_read_bytes(read_lane* lanes, unsigned int num_lanes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr);
+  
+  /*!
+   *  \brief Performs a sequence of word reads and writes on the indicated chip
+   *         on the connected cartridge.
+   *  
+   *  Performs a sequence of word reads and writes on the indicated chip in the
+   *  order given. This is equivalent to calling \ref read_word() and
+   *  \ref write_word() for each command in turn, except that implementations
+   *  that support it send every command before waiting for the replies, so
+   *  that an unlock sequence followed by a read costs roughly one round trip
+   *  instead of one per command. The results of read commands are stored in
+   *  the \ref word_command::data field of the corresponding command.
+   *  
+   *  If an error occurs during this operation, an exception will be thrown and
+   *  the chip may have received only some of the commands.
+   *  
+   *  This is a blocking function that can take several seconds to complete.
+   *  
+   *  \param [in] chip The index of the chip to send the commands to.
+   *  \param [in,out] commands Array of commands to perform.
+   *  \param [in] num_commands The number of commands in the array.
+   *  
+   *  \see supports_word_sequence()
+   */
+  virtual void             run_word_sequence(chip_index chip, word_command* commands, unsigned int num_commands);
+  
   /*!
    *  \brief Erases an entire chip on the connected cartridge.
    *  
@@ -576,6 +1109,66 @@ public:
    */
   virtual void             erase_chip_block(chip_index chip, address_t block_address);
   
+  /*!
+   *  \brief Waits for the device to report that an erase on a chip has
+   *         finished.
+   *  
+   *  Blocks until the device sends its erase-complete notification for the
+   *  given chip or the timeout runs out, without sending anything to the
+   *  device meanwhile. Notifications for other chips are discarded. A
+   *  notification only says the chip has stopped erasing, so callers should
+   *  still read its status once to tell whether it succeeded.
+   *  
+   *  Not all implementations will support this method and some may throw an
+   *  exception if they do not. Check if the implementation supports this method
+   *  by calling \ref supports_erase_notification() first before calling this
+   *  method.
+   *  
+   *  \param [in] chip The index of the chip being erased.
+   *  \param [in] timeout_ms How long to wait, in milliseconds.
+   *  
+   *  \return true if the notification arrived, false if the timeout ran out.
+   *  
+   *  \see supports_erase_notification()
+   */
+  virtual bool             wait_for_erase_notification(chip_index chip, unsigned int timeout_ms);
+  
+  /*!
+   *  \brief Reads a word from a chip to check whether an erase has finished.
+   *  
+   *  Same as \ref read_word(), except that implementations give the exchange
+   *  \ref timeout_profile::erase_poll_ms rather than the command timeout. The
+   *  default implementation calls \ref read_word().
+   *  
+   *  \param [in] chip The index of the chip being erased.
+   *  \param [in] address The address on the chip of the word to read.
+   *  
+   *  \return The word read.
+   */
+  virtual word_t           read_erase_status(chip_index chip, address_t address);
+  
+  /*!
+   *  \brief Computes the checksum of a range of a chip on the device.
+   *  
+   *  Has the device compute the CRC32C checksum of a range of bytes on a chip
+   *  of the connected cartridge without sending the bytes themselves. The
+   *  result equals \ref digest_manifest::crc32c(const unsigned char*, unsigned int)
+   *  of the same bytes.
+   *  
+   *  Not all implementations will support this method and some may throw an
+   *  exception if they do not. Check if the implementation supports this method
+   *  by calling \ref supports_checksum_range() first before calling this method.
+   *  
+   *  \param [in] chip The index of the chip to checksum.
+   *  \param [in] start_address The address of the first byte of the range.
+   *  \param [in] num_bytes The number of bytes in the range.
+   *  
+   *  \return The CRC32C checksum of the range.
+   *  
+   *  \see supports_checksum_range()
+   */
+  virtual unsigned int     checksum_range(chip_index chip, address_t start_address, unsigned int num_bytes);
+  
   /*!
    *  \brief Reads the manufacturer's ID from the specified chip on the
    *         connected cartridge.
@@ -729,6 +1322,684 @@ public:
    *  \see supports_switch_slot()
    */
   virtual bool             switch_slot(unsigned int slot_num);
+  
+  /*!
+   *  \brief Reads the last bytes of every game slot on the cartridge.
+   *  
+   *  Reads the last \ref num_bytes bytes of each game slot on the cartridge,
+   *  where games keep their metadata, then switches to \ref final_slot.
+   *  Implementations may send the requests for every slot in one burst
+   *  instead of waiting for each to complete. Unless overridden, this method
+   *  calls \ref switch_slot(unsigned int slot_num) and
+   *  \ref read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, task_controller* controller = nullptr)
+   *  for each slot in turn.
+   *  
+   *  Requires support for \ref read_num_slots(),
+   *  \ref read_slot_size(unsigned int slot_num), and
+   *  \ref switch_slot(unsigned int slot_num).
+   *  
+   *  This is a blocking function that can take a long time to complete.
+   *  
+   *  If an error occurs during this operation, an exception will be thrown and
+   *  the device may be in an unresponsive state. This may mean the device will
+   *  need to be physically disconnected from the system in order to be reset.
+   *  
+   *  \param [in] chip The index of the chip to read from.
+   *  \param [in] num_bytes The number of bytes to read from the end of each
+   *         slot.
+   *  \param [out] buffer The buffer to read into. Must hold \ref num_bytes
+   *         bytes for every slot, which are stored one slot after another.
+   *  \param [in] final_slot The index of the slot to switch to afterwards.
+   *  
+   *  \see supports_switch_slot()
+   */
+  virtual void             read_slot_footers(chip_index chip, unsigned int num_bytes, data_t* buffer, unsigned int final_slot);
+  
+  
+  
+  /*!
+   *  \brief Gets the pool of scratch buffers for operations on this device.
+   *  
+   *  Gets the pool that cartridges connected through this device borrow their
+   *  block buffers from, so that a batch of backups, restores, and compares on
+   *  the same device reuses the same few buffers.
+   */
+  buffer_pool&             buffers();
+  
+  /*!
+   *  \brief Gets the protocol features offered by the device's firmware.
+   *  
+   *  Gets the protocol features negotiated from the device's firmware version
+   *  when it was opened. Before then, only the features every firmware
+   *  version offers are reported.
+   */
+  const firmware_capabilities& capabilities() const;
+  
+  /*!
+   *  \brief Determines the protocol features a firmware version offers.
+   *  
+   *  \param [in] system The system of the LinkMasta running the firmware.
+   *  \param [in] major_version The firmware's major version number.
+   *  \param [in] minor_version The firmware's minor version number.
+   *  
+   *  \return The features offered. Unrecognized versions are given the
+   *          features of the newest release before them.
+   */
+  static firmware_capabilities negotiate_capabilities(linkmasta_system system, unsigned int major_version, unsigned int minor_version);
+  
+  /*!
+   *  \brief Gets how long the device is kept open after its last
+   *         \ref session ends.
+   *  
+   *  \return The idle timeout in milliseconds.
+   */
+  unsigned int             idle_timeout() const;
+  
+  /*!
+   *  \brief Sets how long the device is kept open after its last
+   *         \ref session ends.
+   *  
+   *  \param [in] timeout_ms The idle timeout in milliseconds. With 0, the
+   *         device is closed as soon as the last session ends.
+   */
+  void                     set_idle_timeout(unsigned int timeout_ms);
+  
+  /*!
+   *  \brief Closes the device if it has outlived its idle timeout.
+   *  
+   *  Closes the device if no \ref session is held and the last one ended at
+   *  least \ref idle_timeout() milliseconds ago. Must only be called by
+   *  whoever currently has the device claimed.
+   *  
+   *  \return true if the device was closed, false otherwise.
+   */
+  bool                     close_if_idle();
+  
+  /*!
+   *  \brief Gets whether data received by reads is checked for corrupted
+   *         packets.
+   *  
+   *  \see set_verify_reads(bool verify)
+   */
+  bool                     verify_reads() const;
+  
+  /*!
+   *  \brief Sets whether data received by reads is checked for corrupted
+   *         packets.
+   *  
+   *  When set, \ref read_bytes() and \ref stream_read_bytes() check the data
+   *  they received before returning. The device checksums the range itself if
+   *  it supports \ref checksum_range(). Otherwise, or if the checksums differ,
+   *  the range is read a second time and only the packets that differ between
+   *  the two reads are requested again until two reads of each agree, so that
+   *  long dumps can be trusted without reading them back a second time.
+   *  
+   *  \param [in] verify true to check reads, false to trust them. Off by
+   *         default.
+   */
+  void                     set_verify_reads(bool verify);
+  
+  /*!
+   *  \brief Gets whether small reads are answered from a cache of earlier
+   *         ones.
+   *  
+   *  \see set_cache_reads(bool enabled)
+   */
+  bool                     cache_reads() const;
+  
+  /*!
+   *  \brief Sets whether small reads are answered from a cache of earlier
+   *         ones.
+   *  
+   *  When set, calls to \ref read_bytes() that have no controller and read no
+   *  more than a few kilobytes are remembered by chip, slot, and address
+   *  range, and later such reads that fall within a remembered range are
+   *  answered without touching the device. Cartridge headers, slot footers,
+   *  and the other metadata read whenever a cartridge is built or refreshed
+   *  then cost nothing after the first fetch.
+   *  
+   *  Writes, programming, and erases made through this object forget what was
+   *  cached for their chip, switching slots moves on to the ranges of the new
+   *  slot, and closing the device or finding the cartridge gone forgets
+   *  everything.
+   *  
+   *  \param [in] enabled true to cache reads, false to always read the
+   *         device. Off by default.
+   */
+  void                     set_cache_reads(bool enabled);
+  
+  /*!
+   *  \brief Gets whether the size of read64xN and write64xN batches adapts
+   *         to the device.
+   *  
+   *  \see set_adaptive_batches(bool enabled, batch_tuning_store* store)
+   */
+  bool                     adaptive_batches() const;
+  
+  /*!
+   *  \brief Sets whether the size of read64xN and write64xN batches adapts
+   *         to the device.
+   *  
+   *  When set, rather than always sending the largest batches the firmware
+   *  accepts, reads and programming time their batches and adapt the number
+   *  of packets in each, separately for each direction, to whatever moves data
+   *  fastest without failing, see \ref batch_tuner. Batches that time out
+   *  make the next ones smaller right away, which helps on hubs that can't
+   *  keep up with large transfers.
+   *  
+   *  Given a store, tuning starts from the sizes it recorded for the device's
+   *  serial number when the device is opened, and every size settled on is
+   *  recorded there for the next run. Changing the setting starts tuning
+   *  over.
+   *  
+   *  \param [in] enabled true to adapt batch sizes, false to always use the
+   *         largest. Off by default.
+   *  \param [in] store The store to load and record tuned sizes in, or
+   *         **nullptr** to keep them for as long as this object lives. Must
+   *         outlive this object or the next call.
+   */
+  void                     set_adaptive_batches(bool enabled, batch_tuning_store* store = nullptr);
+  
+  /*!
+   *  \brief Gets the number of packets in the next full read64xN or write64xN
+   *         batch.
+   *  
+   *  \param [in] direction The direction of the batch.
+   *  
+   *  \return The number of packets tuned for the direction if batches are
+   *          adaptive, or the largest the firmware accepts otherwise.
+   */
+  unsigned int             batch_packets(batch_direction direction) const;
+  
+  /*!
+   *  \brief Gets the latencies of one kind of exchange with the device.
+   *  
+   *  Every exchange of the kinds in \ref command_latency is timed, whether or
+   *  not anything else is measuring, so that the occasional stall that
+   *  averages hide shows up in the histogram's tail. The histogram is kept
+   *  for as long as this object lives, across reopening the device, until
+   *  \ref reset_command_latencies() is called.
+   *  
+   *  The histogram may be read from any thread while the device is in use.
+   *  
+   *  \param [in] command The kind of exchange.
+   */
+  const latency_histogram& command_latencies(command_latency command) const;
+  
+  /*!
+   *  \brief Forgets the latencies recorded for every kind of exchange.
+   */
+  void                     reset_command_latencies();
+  
+  /*!
+   *  \brief Gets the USB timeouts of each kind of exchange with the device.
+   *  
+   *  \see set_timeouts(const timeout_profile& profile)
+   */
+  const timeout_profile&   timeouts() const;
+  
+  /*!
+   *  \brief Sets the USB timeouts of each kind of exchange with the device.
+   *  
+   *  Implementations apply \ref timeout_profile::command_ms to the USB device
+   *  as its default timeout once initialized, as \ref set_timeout() does. The
+   *  others apply from the next transfer of their kind.
+   *  
+   *  \param [in] profile The timeouts to use.
+   */
+  virtual void             set_timeouts(const timeout_profile& profile);
+  
+  /*!
+   *  \brief Gets the timeout of a read64xN or write64xN batch.
+   *  
+   *  \param [in] num_bytes The number of bytes the batch moves.
+   *  
+   *  \return \ref timeout_profile::batch_ms plus the time the batch takes at
+   *          \ref timeout_profile::batch_bytes_per_ms, or 0 if batches never
+   *          time out.
+   */
+  timeout_t                batch_timeout(unsigned int num_bytes) const;
+  
+  /*!
+   *  \brief Gets the mode a chip was last left in, as recorded by whoever
+   *         drove it.
+   *  
+   *  Chip objects such as \ref ngp_chip record here, rather than in
+   *  themselves, the mode each of their command sequences leaves the chip in.
+   *  Every object driving the same chip, such as those of a cartridge built
+   *  again, then agrees on it, and reset, unlock, and autoselect sequences
+   *  are only sent when the mode really changes. The meaning of the values is
+   *  up to the chip objects.
+   *  
+   *  The mode is forgotten whenever it may have changed behind their backs:
+   *  as soon as a write, programming, or sequence containing writes is sent
+   *  to the chip, until whoever sent it records the outcome; when the
+   *  connection is recovered; when the device is closed; and when the
+   *  cartridge is tested for.
+   *  
+   *  \param [in] chip The index of the chip.
+   *  
+   *  \return The recorded mode, or \ref CHIP_MODE_UNKNOWN if there is none.
+   */
+  int                      chip_mode(chip_index chip) const;
+  
+  /*!
+   *  \brief Records the mode a chip has been left in.
+   *  
+   *  \param [in] chip The index of the chip.
+   *  \param [in] mode The mode, or \ref CHIP_MODE_UNKNOWN to forget it.
+   *  
+   *  \see chip_mode(chip_index chip)
+   */
+  void                     set_chip_mode(chip_index chip, int mode);
+
+  
+  
+protected:
+  
+  /*! \class abortable_read
+   *  \brief Marks a read as one that \ref abort_transfers() may abort.
+   *  
+   *  Held by implementations of \ref read_bytes() and
+   *  \ref stream_read_bytes() for as long as they are transferring data for
+   *  a controller that can cancel them. Reads without a controller can't end
+   *  as cancelled, so they are never aborted.
+   */
+  class abortable_read
+  {
+  public:
+    
+    /*!
+     *  \brief Class constructor. Allows aborting if **controller** isn't
+     *         **nullptr**.
+     *  
+     *  \param [in] device The device doing the read. Must outlive this
+     *         object.
+     *  \param [in] controller The controller of the read.
+     */
+                           abortable_read(linkmasta_device* device, task_controller* controller);
+    
+    /*!
+     *  \brief Class destructor. Calls \ref end().
+     */
+                           ~abortable_read();
+    
+    /*!
+     *  \brief Stops allowing aborts, such as before checking the data
+     *         received.
+     */
+    void                   end();
+    
+    
+    
+  private:
+    abortable_read(const abortable_read& other) = delete;
+    abortable_read& operator=(const abortable_read& other) = delete;
+    
+    /*! \brief The device doing the read, or nullptr once ended. */
+    linkmasta_device*      m_device;
+  };
+  
+  
+  
+  /*!
+   *  \brief Makes the USB transfers in flight fail right away.
+   *  
+   *  Called by \ref abort_transfers() while an \ref abortable_read is held.
+   *  May be called from any thread. The default implementation does nothing.
+   */
+  virtual void             abort_usb_transfers();
+  
+  /*!
+   *  \brief Checks whether a call to \ref close() should leave the device
+   *         open.
+   *  
+   *  Called by implementations at the start of \ref close(). Returns true
+   *  while a \ref session is held or the device is waiting out its idle
+   *  timeout, in which case the implementation should only send any queued
+   *  writes. Counts as a use of the device for the idle timeout.
+   */
+  bool                     defer_close();
+  
+  /*!
+   *  \brief Forgets all sessions so that the next call to \ref close() really
+   *         closes the device.
+   *  
+   *  Called by implementations before closing the device for good, such as in
+   *  their destructors.
+   */
+  void                     end_all_sessions();
+  
+  /*!
+   *  \brief Sets the protocol features reported by \ref capabilities().
+   *  
+   *  Called by implementations once the firmware version is known.
+   *  
+   *  \param [in] capabilities The negotiated features.
+   */
+  void                     set_capabilities(const firmware_capabilities& capabilities);
+  
+  /*!
+   *  \brief Checks the data received by a read for corrupted packets,
+   *         requesting them again if necessary.
+   *  
+   *  Called by implementations at the end of \ref read_bytes() and
+   *  \ref stream_read_bytes(). Does nothing unless \ref verify_reads() is set,
+   *  nor for the reads made while checking.
+   *  
+   *  \param [in] chip The index of the chip that was read.
+   *  \param [in] start_address The address of the first byte read.
+   *  \param [in,out] buffer The data received. Corrupted packets are replaced.
+   *  \param [in] num_bytes The number of bytes received.
+   *  
+   *  \throws std::runtime_error If no two reads of a packet agree.
+   */
+  void                     verify_read(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Answers a read from the cache if it can.
+   *  
+   *  Called by implementations at the start of \ref read_bytes() for reads
+   *  without a controller. Does nothing unless \ref cache_reads() is set.
+   *  
+   *  \param [in] chip The index of the chip to read.
+   *  \param [in] start_address The address of the first byte to read.
+   *  \param [out] buffer The buffer to fill.
+   *  \param [in] num_bytes The number of bytes to read.
+   *  
+   *  \return true if the whole range was cached and copied into **buffer**,
+   *          false if the device has to be read.
+   */
+  bool                     read_cached(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Remembers the data received by a read.
+   *  
+   *  Called by implementations at the end of \ref read_bytes() for reads
+   *  without a controller, once the data has been checked. Does nothing unless
+   *  \ref cache_reads() is set, nor for reads too large to be worth keeping or
+   *  the reads made while checking.
+   *  
+   *  \param [in] chip The index of the chip that was read.
+   *  \param [in] start_address The address of the first byte read.
+   *  \param [in] buffer The data received.
+   *  \param [in] num_bytes The number of bytes received.
+   */
+  void                     cache_read(chip_index chip, address_t start_address, const data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Forgets the cached reads of a chip.
+   *  
+   *  \param [in] chip The index of the chip.
+   */
+  void                     invalidate_read_cache(chip_index chip);
+  
+  /*!
+   *  \brief Forgets every cached read.
+   */
+  void                     invalidate_read_cache();
+  
+  /*!
+   *  \brief Forgets the mode of every chip, such as when the connection is
+   *         recovered and commands may have been lost.
+   */
+  void                     forget_chip_modes();
+  
+  /*!
+   *  \brief Forgets the cached reads and modes of every chip, such as when
+   *         the device is closed or the cartridge may have been swapped.
+   */
+  void                     forget_cartridge_state();
+  
+  /*!
+   *  \brief Forgets the cached reads and mode of a chip.
+   *  
+   *  Called by implementations before sending anything that may change what
+   *  the chip reads back or the mode it is in, such as writes, programming,
+   *  and erase sequences.
+   *  
+   *  \param [in] chip The index of the chip.
+   */
+  void                     on_chip_command(chip_index chip);
+  
+  /*!
+   *  \brief Forgets the cached reads and mode of a chip if a sequence
+   *         contains any writes.
+   *  
+   *  \param [in] chip The index of the chip.
+   *  \param [in] commands The sequence about to be sent.
+   *  \param [in] num_commands The number of commands in the sequence.
+   */
+  void                     on_chip_command(chip_index chip, const word_command* commands, unsigned int num_commands);
+  
+  /*!
+   *  \brief Records the slot the cartridge now has switched in, so that
+   *         reads are cached and looked up under it.
+   *  
+   *  Called by implementations whenever a slot switch succeeds.
+   *  
+   *  \param [in] slot_num The index of the slot.
+   */
+  void                     set_read_cache_slot(unsigned int slot_num);
+  
+  /*!
+   *  \brief Answers \ref read_slot_footers() from the cache if it can.
+   *  
+   *  Only answers if the slot switched in is already **final_slot**, so that
+   *  nothing needs switching, and the footer of every slot is cached.
+   *  
+   *  \return true if every footer was copied into **buffer**, false if the
+   *          slots have to be visited.
+   */
+  bool                     read_cached_slot_footers(chip_index chip, unsigned int num_bytes, data_t* buffer, unsigned int final_slot);
+  
+  /*!
+   *  \brief Remembers the footers received by \ref read_slot_footers(), each
+   *         under its own slot.
+   *  
+   *  Called by implementations that read the footers without going through
+   *  \ref read_bytes().
+   */
+  void                     cache_slot_footers(chip_index chip, unsigned int num_bytes, const data_t* buffer);
+  
+  /*!
+   *  \brief Looks up the metrics fed by this device, labelled with its serial
+   *         number.
+   *  
+   *  Called by implementations once the device is open. Until then nothing is
+   *  counted.
+   *  
+   *  \param [in] serial The serial number of the device.
+   */
+  void                     bind_metrics(const std::string& serial);
+  
+  /*!
+   *  \brief Counts one batch of data moved to or from the device.
+   */
+  void                     count_batch();
+  
+  /*!
+   *  \brief Starts tuning batch sizes for a device that was just opened.
+   *  
+   *  Called by implementations once the device is open and its firmware's
+   *  limits are known. Tuning starts from the sizes recorded for the device
+   *  in the store given to \ref set_adaptive_batches(), if any.
+   *  
+   *  \param [in] serial The serial number of the device, or an empty string
+   *         if it couldn't be read, in which case nothing is recorded.
+   *  \param [in] max_packets The largest number of packets per batch the
+   *         firmware accepts.
+   *  \param [in] packet_step The number of packets batches should be a
+   *         multiple of, such as the number that fill a USB packet.
+   */
+  void                     start_batch_tuning(const std::string& serial, unsigned int max_packets, unsigned int packet_step);
+  
+  /*!
+   *  \brief Records how long a batch took, letting adaptive batch sizes
+   *         adapt.
+   *  
+   *  \param [in] direction The direction of the batch.
+   *  \param [in] num_packets The number of packets in the batch.
+   *  \param [in] started When the batch's command was sent, or when the
+   *         previous batch completed if the two overlapped. The batch is
+   *         taken to have completed just now.
+   *  
+   *  The batch's latency is recorded whether or not batches are adaptive,
+   *  see \ref command_latencies().
+   */
+  void                     record_batch(batch_direction direction, unsigned int num_packets, std::chrono::steady_clock::time_point started);
+  
+  /*!
+   *  \brief Records a batch that failed, making adaptive batches smaller.
+   *  
+   *  \param [in] direction The direction of the batch.
+   */
+  void                     record_batch_failure(batch_direction direction);
+  
+  /*!
+   *  \brief Records how long an exchange with the device took.
+   *  
+   *  Called by implementations for exchanges not already recorded by
+   *  \ref record_batch().
+   *  
+   *  \param [in] command The kind of exchange.
+   *  \param [in] started When the exchange started. It is taken to have
+   *         completed just now.
+   */
+  void                     record_latency(command_latency command, std::chrono::steady_clock::time_point started);
+  
+  /*!
+   *  \brief Counts one attempt to recover the connection part-way through an
+   *         operation.
+   */
+  void                     count_reconnect();
+  
+  
+  
+private:
+  
+  /*!
+   *  \brief Opens the device and starts a \ref session.
+   */
+  void                     begin_session();
+  
+  /*!
+   *  \brief Ends a \ref session, closing the device if it was the last one
+   *         and there is no idle timeout.
+   */
+  void                     end_session();
+  
+  /*! \brief Scratch buffers shared by operations on this device. */
+  buffer_pool              m_buffers;
+  
+  /*! \brief The protocol features offered by the device's firmware. */
+  firmware_capabilities    m_capabilities;
+  
+  /*! \brief The USB timeouts of each kind of exchange. */
+  timeout_profile          m_timeouts;
+  
+  /*! \brief The number of sessions currently held. */
+  unsigned int             m_num_sessions;
+  
+  /*! \brief Flag indicating that the last session has ended and the device
+   *         is being kept open until its idle timeout. */
+  bool                     m_lingering;
+  
+  /*! \brief How long in milliseconds to keep the device open after the last
+   *         session ends. */
+  unsigned int             m_idle_timeout;
+  
+  /*! \brief When the device was last used during or after a session. */
+  std::chrono::steady_clock::time_point m_last_used;
+  
+  /*! \brief Flag indicating that reads are checked for corrupted packets. */
+  bool                     m_verify_reads;
+  
+  /*! \brief Flag indicating that a read is being checked. */
+  bool                     m_verifying_read;
+  
+  /*!
+   *  \brief Struct containing a range of a chip remembered by the read
+   *         cache.
+   */
+  struct cached_read
+  {
+    /*! \brief The index of the chip the range was read from. */
+    chip_index             chip;
+    
+    /*! \brief The slot that was switched in when the range was read. */
+    unsigned int           slot_num;
+    
+    /*! \brief The address of the first byte of the range. */
+    address_t              start_address;
+    
+    /*! \brief The data read. */
+    std::vector<data_t>    data;
+  };
+  
+  /*! \brief Flag indicating that small reads are cached. */
+  bool                     m_cache_reads;
+  
+  /*! \brief The cached ranges, most recently used first. */
+  std::list<cached_read>   m_read_cache;
+  
+  /*! \brief The budget cached reads are charged to, or **nullptr** if none. */
+  memory_budget* const     m_read_cache_budget;
+  
+  /*! \brief The slot currently switched in, as far as the read cache knows. */
+  unsigned int             m_read_cache_slot;
+  
+  /*! \brief The mode each chip was last left in, by chip index. Chips
+   *         missing from it are in an unknown mode. */
+  std::map<chip_index, int> m_chip_modes;
+  
+  /*! \brief Flag indicating that an \ref abortable_read is held. */
+  bool                     m_abortable;
+  
+  /*! \brief Mutex guarding \ref m_abortable, held while aborting so that a
+   *         read can't end and the next operation start part-way through. */
+  std::mutex               m_abort_mutex;
+  
+  /*!
+   *  \brief Passes a newly tuned batch size on to the store and metrics.
+   */
+  void                     on_batch_size_changed(batch_direction direction);
+  
+  /*! \brief Flag indicating that batch sizes adapt to the device. */
+  bool                     m_adaptive_batches;
+  
+  /*! \brief Store of tuned batch sizes, or nullptr for none. */
+  batch_tuning_store*      m_batch_tuning;
+  
+  /*! \brief The serial number tuned batch sizes are recorded under. */
+  std::string              m_batch_serial;
+  
+  /*! \brief The largest number of packets per batch the firmware accepts. */
+  unsigned int             m_batch_max_packets;
+  
+  /*! \brief The number of packets batches should be a multiple of. */
+  unsigned int             m_batch_packet_step;
+  
+  /*! \brief The tuners of read and write batches, by \ref batch_direction. */
+  batch_tuner              m_batch_tuners[2];
+  
+  /*! \brief Metric counting batches moved, or nullptr until bound. */
+  metric*                  m_metric_batches;
+  
+  /*! \brief Metric counting connection recoveries, or nullptr until bound. */
+  metric*                  m_metric_reconnects;
+  
+  /*! \brief Metric counting packets read again by \ref verify_read(), or
+   *         nullptr until bound. */
+  metric*                  m_metric_rereads;
+  
+  /*! \brief Gauges of the tuned batch sizes, by \ref batch_direction, or
+   *         nullptr until bound. */
+  metric*                  m_metric_batch_packets[2];
+  
+  /*! \brief The latencies of each kind of exchange, by
+   *         \ref command_latency. */
+  latency_histogram        m_latencies[NUM_COMMAND_LATENCIES];
 };
 
 #endif /* defined(__LINKMASTSA_DEVICE_H__) */
@@ -15,10 +15,17 @@
 
 #include "ngp_linkmasta_device.h"
 #include "usb/usb_device.h"
+#include "usb/exception/timeout_exception.h"
 #include "cartridge/ngp_cartridge.h"
 #include "ngp_linkmasta_messages.h"
 #include "task/task_controller.h"
+#include "common/trace.h"
+#include <algorithm>
+#include <chrono>
 #include <limits>
+#include <stdexcept>
+#include <deque>
+#include <vector>
 
 using namespace usb;
 
@@ -27,6 +34,7 @@ typedef ngp_linkmasta_device::word_t     word_t;
 typedef ngp_linkmasta_device::timeout_t  timeout_t;
 typedef ngp_linkmasta_device::version_t  version_t;
 typedef ngp_linkmasta_device::chip_index chip_index;
+typedef usb_device::endpoint_t            endpoint_t;
 
 
 
@@ -40,7 +48,8 @@ typedef ngp_linkmasta_device::chip_index chip_index;
 #define NGP_LINKMASTA_USB_ENDPOINT_IN   0x81
 #define NGP_LINKMASTA_USB_ENDPOINT_OUT  0x02
 #define NGP_LINKMASTA_USB_RXTX_SIZE     64
-#define NGP_LINKMASTA_USB_TIMEOUT       2000
+#define NGP_LINKMASTA_MAX_RECOVERIES    3
+#define NGP_LINKMASTA_MAX_QUEUED_WRITES 16
 
 using namespace ngpmsg;
 
@@ -51,7 +60,9 @@ using namespace ngpmsg;
 ngp_linkmasta_device::ngp_linkmasta_device(usb_device* usb_device)
   : m_usb_device(usb_device),
     m_was_init(false), m_is_open(false), m_firmware_version_set(false),
-    m_firmware_major_version(0), m_firmware_minor_version(0)
+    m_firmware_major_version(0), m_firmware_minor_version(0),
+    m_usb_packet_size(NGP_LINKMASTA_USB_RXTX_SIZE), m_interrupt_endpoint(ENDPOINT_UNSET_VALUE), m_max_batch_packets(std::numeric_limits<uint8_t>::max()),
+    m_coalesce_writes(true)
 {
   // Nothing else to do
 }
@@ -60,6 +71,7 @@ ngp_linkmasta_device::~ngp_linkmasta_device()
 {
   if (m_is_open)
   {
+    end_all_sessions();
     try
     {
       close();
@@ -98,12 +110,21 @@ void ngp_linkmasta_device::init()
   }
   
   // Set device configuration
-  m_usb_device->set_timeout(NGP_LINKMASTA_USB_TIMEOUT);
+  m_usb_device->set_timeout(timeouts().command_ms);
   m_usb_device->set_configuration(NGP_LINKMASTA_USB_CONFIGURATION);
   m_usb_device->set_interface(NGP_LINKMASTA_USB_INTERFACE);
   m_usb_device->set_input_endpoint(NGP_LINKMASTA_USB_ENDPOINT_IN);
   m_usb_device->set_output_endpoint(NGP_LINKMASTA_USB_ENDPOINT_OUT);
   
+  // Size batches to the endpoints, treating any that aren't described or
+  // don't hold a whole number of protocol packets as full-speed endpoints
+  unsigned int packet_size = std::min(m_usb_device->max_packet_size(NGP_LINKMASTA_USB_ENDPOINT_IN),
+                                      m_usb_device->max_packet_size(NGP_LINKMASTA_USB_ENDPOINT_OUT));
+  m_usb_packet_size = (packet_size >= NGP_LINKMASTA_USB_RXTX_SIZE && packet_size % NGP_LINKMASTA_USB_RXTX_SIZE == 0 ? packet_size : NGP_LINKMASTA_USB_RXTX_SIZE);
+  
+  // Firmware that notifies of finished erases does so on an interrupt endpoint
+  // of its own, which current devices don't describe
+  m_interrupt_endpoint = (m_usb_device->supports_interrupt_reads() ? m_usb_device->find_interrupt_in_endpoint() : ENDPOINT_UNSET_VALUE);
   m_was_init = true;
 }
 
@@ -156,7 +177,18 @@ void ngp_linkmasta_device::set_timeout(timeout_t timeout)
     throw std::runtime_error("ERROR: Object not initialized");
   }
   
-  return m_usb_device->set_timeout(timeout);
+  timeout_profile profile = timeouts();
+  profile.command_ms = timeout;
+  set_timeouts(profile);
+}
+
+void ngp_linkmasta_device::set_timeouts(const timeout_profile& profile)
+{
+  linkmasta_device::set_timeouts(profile);
+  if (m_was_init)
+  {
+    m_usb_device->set_timeout(profile.command_ms);
+  }
 }
 
 void ngp_linkmasta_device::open()
@@ -176,6 +208,36 @@ void ngp_linkmasta_device::open()
   m_usb_device->open();
   
   m_is_open = true;
+  
+  // Label the device's metrics once its serial number can be read
+  std::string serial;
+  try
+  {
+    serial = m_usb_device->get_serial_number();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+  }
+  bind_metrics(serial);
+  
+  // Turn on the protocol features the firmware offers. Firmware that can't
+  // report its version only gets the features every version offers
+  firmware_capabilities capabilities;
+  try
+  {
+    fetch_firmware_version();
+    capabilities = negotiate_capabilities(system(), m_firmware_major_version, m_firmware_minor_version);
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+  }
+  set_capabilities(capabilities);
+  
+  // Batch lengths are sent as a single byte
+  m_max_batch_packets = std::min(capabilities.max_batch_packets, (unsigned int) std::numeric_limits<uint8_t>::max());
+  start_batch_tuning(serial, m_max_batch_packets, m_usb_packet_size / NGP_LINKMASTA_USB_RXTX_SIZE);
 }
 
 void ngp_linkmasta_device::close()
@@ -192,41 +254,148 @@ void ngp_linkmasta_device::close()
     return;
   }
   
+  // Leave the device open for the rest of the session
+  if (defer_close())
+  {
+    flush_writes();
+    return;
+  }
+  
+  // The cartridge may be swapped while the device is closed
+  forget_cartridge_state();
+  
+  // Send anything still queued, but close the device regardless
+  try
+  {
+    flush_writes();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    m_usb_device->close();
+    m_is_open = false;
+    throw;
+  }
+  
   m_usb_device->close();
   
   m_is_open = false;
 }
 
+bool ngp_linkmasta_device::recover_connection()
+{
+  count_reconnect();
+  
+  // Writes queued for the operation that failed are abandoned along with it,
+  // and whichever commands made it to the chips left them in unknown modes
+  m_queued_writes.clear();
+  forget_chip_modes();
+  
+  try
+  {
+    if (!m_usb_device->recover())
+    {
+      return false;
+    }
+    
+    // Replies are back in step once the firmware answers as it did on open
+    unsigned int major_version = m_firmware_major_version;
+    unsigned int minor_version = m_firmware_minor_version;
+    fetch_firmware_version();
+    return m_firmware_major_version == major_version && m_firmware_minor_version == minor_version;
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    return false;
+  }
+}
+
+void ngp_linkmasta_device::abort_usb_transfers()
+{
+  m_usb_device->abort_pending_transfers();
+}
+
 word_t ngp_linkmasta_device::read_word(chip_index chip, address_t address)
+{
+  return try_read_word(chip, address).get();
+}
+
+void ngp_linkmasta_device::write_word(chip_index chip, address_t address, word_t data)
+{
+  try_write_word(chip, address, data).get();
+}
+
+result<word_t> ngp_linkmasta_device::try_read_word(chip_index chip, address_t address) noexcept
 {
   // Make sure we are in a ready state
   if (!m_was_init)
   {
-    throw std::runtime_error("Device not initialized");
+    return result<word_t>::failure(TRANSFER_FAILED, 0, "Device not initialized");
   }
   if (!m_is_open)
   {
-    throw std::runtime_error("Device not opened");
+    return result<word_t>::failure(TRANSFER_FAILED, 0, "Device not opened");
   }
   
-  uint8_t data;
-  data_t buffer[NGP_LINKMASTA_USB_RXTX_SIZE] = {0};
-  
-  build_read_command(buffer, address, chip);
-  m_usb_device->write(buffer, NGP_LINKMASTA_USB_RXTX_SIZE);
+  result<void> flushed = try_flush_writes();
+  if (!flushed)
+  {
+    return result<word_t>::failure(flushed);
+  }
   
-  m_usb_device->read(buffer, NGP_LINKMASTA_USB_RXTX_SIZE);
-  if (get_read_reply(buffer, &address, &data))
+  word_command command = {WORD_READ, address, 0};
+  result<void> sent = try_send_word(chip, command);
+  if (!sent)
   {
-    return data;
+    return result<word_t>::failure(sent);
   }
-  else
+  return result<word_t>::success(command.data);
+}
+
+result<void> ngp_linkmasta_device::try_write_word(chip_index chip, address_t address, word_t data) noexcept
+{
+  // Make sure we are in a ready state
+  if (!m_was_init)
+  {
+    return result<void>::failure(TRANSFER_FAILED, 0, "Device not initialized");
+  }
+  if (!m_is_open)
+  {
+    return result<void>::failure(TRANSFER_FAILED, 0, "Device not opened");
+  }
+  
+  on_chip_command(chip);
+  
+  // Queue the write to be sent along with the ones around it
+  if (m_coalesce_writes)
   {
-    throw std::runtime_error("Error occured when reading word from device");
+    queued_write write;
+    write.chip = chip;
+    write.command.type = WORD_WRITE;
+    write.command.address = address;
+    write.command.data = data;
+    try
+    {
+      m_queued_writes.push_back(write);
+    }
+    catch (std::exception& ex)
+    {
+      return result<void>::failure(status_of(ex), std::current_exception());
+    }
+    
+    if (m_queued_writes.size() >= NGP_LINKMASTA_MAX_QUEUED_WRITES)
+    {
+      return try_flush_writes();
+    }
+    return result<void>::success();
   }
+  
+  word_command command = {WORD_WRITE, address, data};
+  return try_send_word(chip, command);
 }
 
-void ngp_linkmasta_device::write_word(chip_index chip, address_t address, word_t data)
+void ngp_linkmasta_device::run_word_sequence(chip_index chip, word_command* commands, unsigned int num_commands)
 {
   // Make sure we are in a ready state
   if (!m_was_init)
@@ -238,24 +407,189 @@ void ngp_linkmasta_device::write_word(chip_index chip, address_t address, word_t
     throw std::runtime_error("Device not opened");
   }
   
-  uint8_t result;
+  on_chip_command(chip, commands, num_commands);
+  flush_writes();
+  send_word_sequence(chip, commands, num_commands);
+}
+
+result<void> ngp_linkmasta_device::try_send_word(chip_index chip, word_command& command) noexcept
+{
   data_t buffer[NGP_LINKMASTA_USB_RXTX_SIZE] = {0};
+  trace_scope trace(TRACE_COMMAND, NGP_LINKMASTA_USB_RXTX_SIZE);
   
-  build_write_command(buffer, address, (uint8_t) data, chip);
-  m_usb_device->write(buffer, NGP_LINKMASTA_USB_RXTX_SIZE);
+  if (command.type == WORD_READ)
+  {
+    build_read_command(buffer, command.address, chip);
+  }
+  else
+  {
+    build_write_command(buffer, command.address, (uint8_t) command.data, chip);
+  }
   
-  m_usb_device->read(buffer, NGP_LINKMASTA_USB_RXTX_SIZE);
-  get_result_reply(buffer, &result);
-  if (result == MSG_RESULT_SUCCESS)
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  result<unsigned int> transferred = m_usb_device->try_write(buffer, NGP_LINKMASTA_USB_RXTX_SIZE, m_usb_device->timeout());
+  if (transferred)
   {
-    // Yay!
+    transferred = m_usb_device->try_read(buffer, NGP_LINKMASTA_USB_RXTX_SIZE, m_usb_device->timeout());
+  }
+  if (!transferred)
+  {
+    return result<void>::failure(transferred);
+  }
+  
+  if (command.type == WORD_READ)
+  {
+    address_t address;
+    uint8_t data;
+    if (!get_read_reply(buffer, &address, &data))
+    {
+      return result<void>::failure(TRANSFER_FAILED, 0, "Error occured when reading word from device");
+    }
+    command.data = data;
   }
   else
   {
-    throw std::runtime_error("Error occured while attempting to write word to device");
+    uint8_t reply;
+    get_result_reply(buffer, &reply);
+    if (reply != MSG_RESULT_SUCCESS)
+    {
+      return result<void>::failure(TRANSFER_FAILED, 0, "Error occured while attempting to write word to device");
+    }
+    record_latency(LATENCY_WORD_WRITE, started);
+  }
+  return result<void>::success();
+}
+
+void ngp_linkmasta_device::send_word_sequence(chip_index chip, word_command* commands, unsigned int num_commands)
+{
+  data_t               buffer[NGP_LINKMASTA_USB_RXTX_SIZE] = {0};
+  std::vector<data_t>  replies(num_commands * NGP_LINKMASTA_USB_RXTX_SIZE);
+  unsigned int         max_pending = m_usb_device->max_pending_transfers();
+  unsigned int         sent = 0;      // Commands sent to the device
+  unsigned int         received = 0;  // Replies received from the device
+  trace_scope          trace(TRACE_COMMAND, num_commands * NGP_LINKMASTA_USB_RXTX_SIZE);
+  
+  try
+  {
+    while (received < num_commands)
+    {
+      // Send commands ahead of their replies, keeping a read queued for each
+      while (sent < num_commands && m_usb_device->num_pending_transfers() < max_pending)
+      {
+        if (commands[sent].type == WORD_READ)
+        {
+          build_read_command(buffer, commands[sent].address, chip);
+        }
+        else
+        {
+          build_write_command(buffer, commands[sent].address, (uint8_t) commands[sent].data, chip);
+        }
+        m_usb_device->write(buffer, NGP_LINKMASTA_USB_RXTX_SIZE);
+        m_usb_device->submit_read(&replies[sent * NGP_LINKMASTA_USB_RXTX_SIZE], NGP_LINKMASTA_USB_RXTX_SIZE);
+        ++sent;
+      }
+      
+      if (m_usb_device->complete_transfer() != NGP_LINKMASTA_USB_RXTX_SIZE)
+      {
+        throw std::runtime_error("Unexpected number of bytes received from USB device");
+      }
+      
+      // Check the reply of the oldest outstanding command
+      data_t* reply = &replies[received * NGP_LINKMASTA_USB_RXTX_SIZE];
+      if (commands[received].type == WORD_READ)
+      {
+        address_t address;
+        uint8_t data;
+        if (!get_read_reply(reply, &address, &data))
+        {
+          throw std::runtime_error("Error occured when reading word from device");
+        }
+        commands[received].data = data;
+      }
+      else
+      {
+        uint8_t result;
+        get_result_reply(reply, &result);
+        if (result != MSG_RESULT_SUCCESS)
+        {
+          throw std::runtime_error("Error occured while attempting to write word to device");
+        }
+      }
+      ++received;
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    m_usb_device->cancel_pending_transfers();
+    throw;
   }
 }
 
+bool ngp_linkmasta_device::coalesce_writes() const
+{
+  return m_coalesce_writes;
+}
+
+void ngp_linkmasta_device::set_coalesce_writes(bool enabled)
+{
+  if (!enabled && m_is_open)
+  {
+    flush_writes();
+  }
+  m_coalesce_writes = enabled;
+}
+
+void ngp_linkmasta_device::flush_writes()
+{
+  if (m_queued_writes.empty())
+  {
+    return;
+  }
+  
+  // Take the queue so that it's empty even if sending fails
+  std::vector<queued_write> writes;
+  writes.swap(m_queued_writes);
+  
+  // Send each run of writes to the same chip as a single burst
+  std::vector<word_command> commands;
+  commands.reserve(writes.size());
+  unsigned int i = 0;
+  while (i < writes.size())
+  {
+    chip_index chip = writes[i].chip;
+    commands.clear();
+    while (i < writes.size() && writes[i].chip == chip)
+    {
+      commands.push_back(writes[i].command);
+      ++i;
+    }
+    send_word_sequence(chip, commands.data(), (unsigned int) commands.size());
+  }
+}
+
+result<void> ngp_linkmasta_device::try_flush_writes() noexcept
+{
+  if (m_queued_writes.empty())
+  {
+    return result<void>::success();
+  }
+  
+  try
+  {
+    flush_writes();
+  }
+  catch (std::exception& ex)
+  {
+    return result<void>::failure(status_of(ex), std::current_exception());
+  }
+  catch (...)
+  {
+    return result<void>::failure(TRANSFER_FAILED, std::current_exception());
+  }
+  return result<void>::success();
+}
+
 bool ngp_linkmasta_device::test_for_cartridge()
 {
   if (is_integrated_with_cartridge())
@@ -264,10 +598,73 @@ bool ngp_linkmasta_device::test_for_cartridge()
   }
   else
   {
+    // Whoever asks suspects the cartridge may have changed
+    forget_cartridge_state();
     return ngp_cartridge::test_for_cartridge(this);
   }
 }
 
+bool ngp_linkmasta_device::probe_for_cartridge()
+{
+  if (is_integrated_with_cartridge())
+  {
+    return true;
+  }
+  else
+  {
+    forget_cartridge_state();
+    return ngp_cartridge::probe_for_cartridge(this);
+  }
+}
+
+std::string ngp_linkmasta_device::fingerprint_cartridge()
+{
+  if (is_integrated_with_cartridge())
+  {
+    return linkmasta_device::fingerprint_cartridge();
+  }
+  else
+  {
+    return ngp_cartridge::fingerprint_cartridge(this);
+  }
+}
+
+result<bool> ngp_linkmasta_device::try_probe_for_cartridge() noexcept
+{
+  if (is_integrated_with_cartridge())
+  {
+    return result<bool>::success(true);
+  }
+  if (!m_was_init || !m_is_open || !m_queued_writes.empty())
+  {
+    return linkmasta_device::try_probe_for_cartridge();
+  }
+  
+  forget_cartridge_state();
+  
+  // Same commands as ngp_chip::test_present(): reset, enter autoselect, read
+  // the manufacturer ID, and reset again
+  word_command commands[6] = {
+    {WORD_WRITE, 0x0000, 0xF0},
+    {WORD_WRITE, 0x5555, 0xAA},
+    {WORD_WRITE, 0x2AAA, 0x55},
+    {WORD_WRITE, 0x5555, 0x90},
+    {WORD_READ,  0x0000, 0},
+    {WORD_WRITE, 0x0000, 0xF0}
+  };
+  for (word_command& command : commands)
+  {
+    result<void> sent = try_send_word(0, command);
+    if (!sent)
+    {
+      return result<bool>::failure(sent);
+    }
+  }
+  
+  // Without a chip to answer, the bus still holds the autoselect command
+  return result<bool>::success(commands[4].data != 0x90);
+}
+
 cartridge* ngp_linkmasta_device::build_cartridge()
 {
   ngp_cartridge* cart = new ngp_cartridge(this);
@@ -292,7 +689,91 @@ bool ngp_linkmasta_device::supports_program_bytes() const
   return true;
 }
 
+bool ngp_linkmasta_device::supports_stream_read_bytes() const
+{
+  return true;
+}
+
+bool ngp_linkmasta_device::supports_interleaved_read_bytes() const
+{
+  return (m_is_open && capabilities().interleaved_reads);
+}
+
+bool ngp_linkmasta_device::supports_word_sequence() const
+{
+  return true;
+}
+
+bool ngp_linkmasta_device::supports_erase_notification() const
+{
+  return (m_is_open && capabilities().erase_status_notification && m_interrupt_endpoint != ENDPOINT_UNSET_VALUE);
+}
+
+bool ngp_linkmasta_device::wait_for_erase_notification(chip_index chip, unsigned int timeout_ms)
+{
+  // Make sure we are in a ready state
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Device not initialized");
+  }
+  if (!m_is_open)
+  {
+    throw std::runtime_error("Device not opened");
+  }
+  if (!supports_erase_notification())
+  {
+    throw std::runtime_error("ERROR: NOT SUPPORTED");
+  }
+  
+  // Erase commands may still be waiting to be sent
+  flush_writes();
+  
+  data_t buffer[NGP_LINKMASTA_USB_RXTX_SIZE] = {0};
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (true)
+  {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0)
+    {
+      return false;
+    }
+    
+    unsigned int num_bytes;
+    try
+    {
+      num_bytes = m_usb_device->read_interrupt(m_interrupt_endpoint, buffer, NGP_LINKMASTA_USB_RXTX_SIZE, (timeout_t) remaining);
+    }
+    catch (usb::timeout_exception& ex)
+    {
+      (void) ex;
+      return false;
+    }
+    
+    // Notifications left over from other chips' erases are of no use to
+    // anyone, since whoever erased them is polling by now
+    uint8_t notified_chip;
+    if (num_bytes >= 2 && get_erase_done_message(buffer, &notified_chip) && notified_chip == (uint8_t) chip)
+    {
+      return true;
+    }
+  }
+}
+
+
 
+word_t ngp_linkmasta_device::read_erase_status(chip_index chip, address_t address)
+{
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Device not initialized");
+  }
+  
+  scoped_timeout poll_timeout(m_usb_device, timeouts().erase_poll_ms);
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  word_t status = read_word(chip, address);
+  record_latency(LATENCY_ERASE_POLL, started);
+  return status;
+}
 
 unsigned int ngp_linkmasta_device::read_bytes(chip_index chip, address_t start_address, data_t *buffer, unsigned int num_bytes, task_controller* controller)
 {
@@ -306,9 +787,19 @@ unsigned int ngp_linkmasta_device::read_bytes(chip_index chip, address_t start_a
     throw std::runtime_error("Device not opened");
   }
   
+  // Make sure queued writes reach the chip first
+  flush_writes();
+  
+  // Metadata read before answers without the device
+  if (controller == nullptr && read_cached(chip, start_address, buffer, num_bytes))
+  {
+    return num_bytes;
+  }
+  
   // Some working variables
   data_t   _buffer[NGP_LINKMASTA_USB_RXTX_SIZE] = {0};
   unsigned int offset = 0;
+  unsigned int num_recoveries = 0;
   
   // Inform the controller that the task has begun
   if (controller != nullptr)
@@ -316,34 +807,87 @@ unsigned int ngp_linkmasta_device::read_bytes(chip_index chip, address_t start_a
     controller->on_task_start(num_bytes);
   }
   
+  // Cancelling can abort the transfers from here on
+  abortable_read abortable(this, controller);
+  
   // Get as many bytes of data as possible in packets of 64
   while ((num_bytes - offset) / NGP_LINKMASTA_USB_RXTX_SIZE >= 1
          && (controller == nullptr || !controller->is_task_cancelled()))
   {
     // Calculate number of packets. Don't go over packet limit
-    unsigned int num_packets = (num_bytes - offset) / NGP_LINKMASTA_USB_RXTX_SIZE;
-    if (num_packets > std::numeric_limits<uint8_t>::max())
-    {
-      num_packets = std::numeric_limits<uint8_t>::max();
-    }
+    unsigned int num_packets = next_batch_packets(num_bytes - offset, BATCH_READ);
     
+    trace_scope trace(TRACE_DATA, num_packets * NGP_LINKMASTA_USB_RXTX_SIZE);
+    count_batch();
+    auto batch_start = std::chrono::steady_clock::now();
     build_read64xN_command(_buffer, start_address + offset, chip, num_packets);
     m_usb_device->write(_buffer, NGP_LINKMASTA_USB_RXTX_SIZE);
     
-    for (unsigned int packets_i = 0; packets_i < num_packets; ++packets_i)
+    // Receive the batch as a few large bulk transfers rather than one per
+    // packet, all in flight at once, so that the host controller can pack the
+    // packets back to back and the bus is never idle waiting on the host
+    unsigned int max_pending = m_usb_device->max_pending_transfers();
+    unsigned int packets_per_usb_packet = m_usb_packet_size / NGP_LINKMASTA_USB_RXTX_SIZE;
+    unsigned int packets_per_transfer = (num_packets + max_pending - 1) / max_pending;
+    packets_per_transfer = (packets_per_transfer + packets_per_usb_packet - 1) / packets_per_usb_packet * packets_per_usb_packet;
+    
+    try
     {
-      // Get response from device and write directly to buffer
-      if (m_usb_device->read(&buffer[offset], NGP_LINKMASTA_USB_RXTX_SIZE) != NGP_LINKMASTA_USB_RXTX_SIZE)
+      // Each transfer may wait on those before it, so all get as long as the
+      // whole batch may take
       {
-        throw std::runtime_error("Unexpected number of bytes received from USB device");
+        scoped_timeout transfer_timeout(m_usb_device, batch_timeout(num_packets * NGP_LINKMASTA_USB_RXTX_SIZE));
+        for (unsigned int packet_i = 0; packet_i < num_packets; packet_i += packets_per_transfer)
+        {
+          // Responses are written directly to buffer
+          unsigned int transfer_packets = std::min(packets_per_transfer, num_packets - packet_i);
+          m_usb_device->submit_read(&buffer[offset + packet_i * NGP_LINKMASTA_USB_RXTX_SIZE], transfer_packets * NGP_LINKMASTA_USB_RXTX_SIZE);
+        }
       }
       
-      // Update offset and inform controller of progress
-      offset += NGP_LINKMASTA_USB_RXTX_SIZE;
-      if (controller != nullptr)
+      for (unsigned int packet_i = 0; packet_i < num_packets; packet_i += packets_per_transfer)
+      {
+        unsigned int transfer_size = std::min(packets_per_transfer, num_packets - packet_i) * NGP_LINKMASTA_USB_RXTX_SIZE;
+        if (m_usb_device->complete_transfer() != transfer_size)
+        {
+          throw std::runtime_error("Unexpected number of bytes received from USB device");
+        }
+        
+        // Update offset and inform controller of progress
+        offset += transfer_size;
+        if (controller != nullptr)
+        {
+          controller->on_task_update(task_status::RUNNING, transfer_size);
+        }
+      }
+      record_batch(BATCH_READ, num_packets, batch_start);
+      num_recoveries = 0;
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      m_usb_device->cancel_pending_transfers();
+      
+      // A cancelled read, whose transfers may have been aborted on purpose,
+      // stops here once the device is back in step
+      if (controller != nullptr && controller->is_task_cancelled())
       {
-        controller->on_task_update(task_status::RUNNING, NGP_LINKMASTA_USB_RXTX_SIZE);
+        if (recover_connection())
+        {
+          break;
+        }
+        throw;
       }
+      
+      // Carry on from the first packet that didn't arrive, in smaller batches
+      // if they adapt, unless the connection can't be brought back without
+      // reopening the device
+      record_batch_failure(BATCH_READ);
+      if (num_recoveries++ < NGP_LINKMASTA_MAX_RECOVERIES && recover_connection())
+      {
+        continue;
+      }
+      throw;
     }
   }
   
@@ -374,6 +918,14 @@ unsigned int ngp_linkmasta_device::read_bytes(chip_index chip, address_t start_a
     }
   }
   
+  // Check for packets that were corrupted on the way
+  abortable.end();
+  verify_read(chip, start_address, buffer, offset);
+  if (controller == nullptr)
+  {
+    cache_read(chip, start_address, buffer, offset);
+  }
+  
   // Inform controller that task is complete
   if (controller != nullptr)
   {
@@ -389,6 +941,11 @@ unsigned int ngp_linkmasta_device::program_bytes(chip_index chip, address_t star
     throw std::runtime_error("ERROR");
   }
   
+  on_chip_command(chip);
+  
+  // Queued unlock and program commands must reach the chip before the data
+  flush_writes();
+  
   // Some working variables
   data_t   _buffer[NGP_LINKMASTA_USB_RXTX_SIZE] = {0};
   unsigned int offset = 0;
@@ -405,42 +962,58 @@ unsigned int ngp_linkmasta_device::program_bytes(chip_index chip, address_t star
          && (controller == nullptr || !controller->is_task_cancelled()))
   {
     // Makes sure we don't go over the packet limit
-    unsigned int num_packets = (num_bytes - offset) / NGP_LINKMASTA_USB_RXTX_SIZE;
-    if (num_packets > std::numeric_limits<uint8_t>::max())
-    {
-      num_packets = std::numeric_limits<uint8_t>::max();
-    }
-    
-    build_flash_write64xN_command(_buffer, start_address + offset, chip, num_packets, bypass_mode);
-    m_usb_device->write(_buffer, NGP_LINKMASTA_USB_RXTX_SIZE);
+    unsigned int num_packets = next_batch_packets(num_bytes - offset, BATCH_WRITE);
+    auto batch_start = std::chrono::steady_clock::now();
     
-    // Send chunks of 64 bytes to device
-    for (unsigned int packet_i = 0; packet_i < num_packets; ++packet_i)
+    try
     {
-      build_flash_write64xN_data_packet(_buffer, &buffer[offset]);
-      m_usb_device->write(_buffer, NGP_LINKMASTA_USB_RXTX_SIZE);
+      {
+        trace_scope trace(TRACE_DATA, num_packets * NGP_LINKMASTA_USB_RXTX_SIZE);
+        count_batch();
+        build_flash_write64xN_command(_buffer, start_address + offset, chip, num_packets, bypass_mode);
+        m_usb_device->write(_buffer, NGP_LINKMASTA_USB_RXTX_SIZE);
+        
+        // Data packets are the raw bytes, so send every packet straight from
+        // the buffer in a single bulk transfer
+        unsigned int batch_size = num_packets * NGP_LINKMASTA_USB_RXTX_SIZE;
+        if (m_usb_device->write(&buffer[offset], batch_size, batch_timeout(batch_size)) != batch_size)
+        {
+          throw std::runtime_error("Unexpected number of bytes sent to USB device");
+        }
+        
+        // Update offset and inform controller of progress
+        offset += batch_size;
+        if (controller != nullptr)
+        {
+          controller->on_task_update(task_status::RUNNING, batch_size);
+        }
+      }
       
-      // Update offset and inform controller of progress
-      offset += NGP_LINKMASTA_USB_RXTX_SIZE;
-      if (controller != nullptr)
+      // Verify that operaton worked. The reply only comes once the whole
+      // batch is programmed
+      uint8_t packets_processed;
       {
-        controller->on_task_update(task_status::RUNNING, NGP_LINKMASTA_USB_RXTX_SIZE);
+        trace_scope trace(TRACE_ACK, NGP_LINKMASTA_USB_RXTX_SIZE);
+        m_usb_device->read(_buffer, NGP_LINKMASTA_USB_RXTX_SIZE, batch_timeout(num_packets * NGP_LINKMASTA_USB_RXTX_SIZE));
+      }
+      get_flash_write64xN_reply(_buffer, &result, &packets_processed);
+      
+      if(result != MSG_WRITE64xN_REPLY)
+      {
+        throw std::runtime_error("Unexpected reply from device");
+      }
+      if(packets_processed != num_packets)
+      {
+        throw std::runtime_error("Unexpected number of packets processed");
       }
     }
-    
-    // Verify that operaton worked
-    uint8_t packets_processed;
-    m_usb_device->read(_buffer, NGP_LINKMASTA_USB_RXTX_SIZE);
-    get_flash_write64xN_reply(_buffer, &result, &packets_processed);
-    
-    if(result != MSG_WRITE64xN_REPLY)
-    {
-      throw std::runtime_error("Unexpected reply from device");
-    }
-    if(packets_processed != num_packets)
+    catch (std::exception& ex)
     {
-      throw std::runtime_error("Unexpected number of packets processed");
+      (void) ex;
+      record_batch_failure(BATCH_WRITE);
+      throw;
     }
+    record_batch(BATCH_WRITE, num_packets, batch_start);
   }
   
   // If at least 32 bytes remain, write them
@@ -508,9 +1081,247 @@ unsigned int ngp_linkmasta_device::program_bytes(chip_index chip, address_t star
 }
 
 
+unsigned int ngp_linkmasta_device::stream_read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, unsigned int pipeline_depth, task_controller* controller)
+{
+  read_lane lane = {chip, start_address, buffer, num_bytes, 0};
+  return pipelined_read(&lane, 1, pipeline_depth, controller);
+}
+
+unsigned int ngp_linkmasta_device::interleaved_read_bytes(read_lane* lanes, unsigned int num_lanes, unsigned int pipeline_depth, task_controller* controller)
+{
+  // Firmware that can't take batches for different chips in a row reads one
+  // chip at a time
+  if (num_lanes > 1 && !supports_interleaved_read_bytes())
+  {
+    return linkmasta_device::interleaved_read_bytes(lanes, num_lanes, pipeline_depth, controller);
+  }
+  return pipelined_read(lanes, num_lanes, pipeline_depth, controller);
+}
+
+unsigned int ngp_linkmasta_device::pipelined_read(read_lane* lanes, unsigned int num_lanes, unsigned int pipeline_depth, task_controller* controller)
+{
+  // Make sure we are in a ready state
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Device not initialized");
+  }
+  if (!m_is_open)
+  {
+    throw std::runtime_error("Device not opened");
+  }
+  
+  // Make sure queued writes reach the chip first
+  flush_writes();
+  if (pipeline_depth == 0)
+  {
+    pipeline_depth = 1;
+  }
+  
+  // Progress through a single lane
+  struct lane_progress
+  {
+    unsigned int full_bytes;  // Bytes read in whole packets
+    unsigned int offset;      // Bytes received
+    unsigned int requested;   // Bytes requested from the device
+  };
+  
+  // A batch requested from the device but not yet received
+  struct read_batch
+  {
+    unsigned int lane;
+    unsigned int begin;
+    unsigned int end;
+  };
+  
+  // Some working variables
+  data_t       _buffer[NGP_LINKMASTA_USB_RXTX_SIZE] = {0};
+  unsigned int max_pending = m_usb_device->max_pending_transfers();
+  unsigned int total_bytes = 0;
+  unsigned int full_bytes = 0;
+  unsigned int received = 0;       // Bytes received from every lane
+  unsigned int num_submitted = 0;  // Leading batches a transfer was submitted for
+  unsigned int next_lane = 0;      // Lane whose turn it is to request a batch
+  std::vector<lane_progress> progress(num_lanes);
+  std::deque<read_batch> batches;  // In the order they were requested
+  auto batch_start = std::chrono::steady_clock::now();
+  
+  for (unsigned int i = 0; i < num_lanes; ++i)
+  {
+    progress[i].full_bytes = lanes[i].num_bytes - (lanes[i].num_bytes % NGP_LINKMASTA_USB_RXTX_SIZE);
+    progress[i].offset = 0;
+    progress[i].requested = 0;
+    lanes[i].bytes_read = 0;
+    total_bytes += lanes[i].num_bytes;
+    full_bytes += progress[i].full_bytes;
+  }
+  
+  // Inform the controller that the task has begun
+  if (controller != nullptr)
+  {
+    controller->on_task_start(total_bytes);
+  }
+  
+  trace_scope trace(TRACE_DATA, full_bytes);
+  count_batch();
+  
+  // Once cancelled, stop requesting data but drain what was already requested
+  // so that the device is left in a consistent state, unless the transfers are
+  // aborted
+  bool cancelled = false;
+  abortable_read abortable(this, controller);
+  unsigned int num_recoveries = 0;
+  while (received < full_bytes && (!cancelled || !batches.empty()))
+  {
+    cancelled = cancelled || (controller != nullptr && controller->is_task_cancelled());
+    
+    try
+    {
+      // Keep up to pipeline_depth batches queued on the device, taking turns
+      // between the lanes with data left to request so that the device sets
+      // up one chip while the other's batch is still on its way
+      while (!cancelled && batches.size() < pipeline_depth)
+      {
+        unsigned int lane = num_lanes;
+        for (unsigned int i = 0; i < num_lanes && lane == num_lanes; ++i)
+        {
+          unsigned int candidate = (next_lane + i) % num_lanes;
+          if (progress[candidate].requested < progress[candidate].full_bytes)
+          {
+            lane = candidate;
+          }
+        }
+        if (lane == num_lanes)
+        {
+          break;
+        }
+        
+        lane_progress& lane_state = progress[lane];
+        unsigned int num_packets = next_batch_packets(lane_state.full_bytes - lane_state.requested, BATCH_READ);
+        
+        build_read64xN_command(_buffer, lanes[lane].start_address + lane_state.requested, lanes[lane].chip, num_packets);
+        m_usb_device->write(_buffer, NGP_LINKMASTA_USB_RXTX_SIZE);
+        
+        read_batch batch = {lane, lane_state.requested, lane_state.requested + num_packets * NGP_LINKMASTA_USB_RXTX_SIZE};
+        batches.push_back(batch);
+        lane_state.requested = batch.end;
+        next_lane = (lane + 1) % num_lanes;
+      }
+      
+      if (batches.empty())
+      {
+        break;
+      }
+      
+      // Keep a bulk transfer in flight for each batch requested so far. Each
+      // waits on everything still to arrive before it, so is given as long as
+      // a batch of all of it may take
+      unsigned int bytes_ahead = 0;
+      for (unsigned int i = 0; i < num_submitted; ++i)
+      {
+        bytes_ahead += batches[i].end - batches[i].begin;
+      }
+      while (num_submitted < batches.size() && m_usb_device->num_pending_transfers() < max_pending)
+      {
+        const read_batch& batch = batches[num_submitted];
+        bytes_ahead += batch.end - batch.begin;
+        scoped_timeout transfer_timeout(m_usb_device, batch_timeout(bytes_ahead));
+        m_usb_device->submit_read(&lanes[batch.lane].buffer[batch.begin], batch.end - batch.begin);
+        ++num_submitted;
+      }
+      
+      read_batch batch = batches.front();
+      unsigned int transfer_size = batch.end - batch.begin;
+      if (m_usb_device->complete_transfer() != transfer_size)
+      {
+        throw std::runtime_error("Unexpected number of bytes received from USB device");
+      }
+      batches.pop_front();
+      --num_submitted;
+      
+      // Update offset and inform controller of progress. With batches queued
+      // back to back, each takes from the end of the one before
+      progress[batch.lane].offset = batch.end;
+      received += transfer_size;
+      record_batch(BATCH_READ, transfer_size / NGP_LINKMASTA_USB_RXTX_SIZE, batch_start);
+      batch_start = std::chrono::steady_clock::now();
+      if (controller != nullptr)
+      {
+        controller->on_task_update(task_status::RUNNING, transfer_size);
+      }
+      num_recoveries = 0;
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      m_usb_device->cancel_pending_transfers();
+      
+      // Everything past the last transfer received is requested again, unless
+      // the connection can't be brought back without reopening the device.
+      // A cancelled read, whose transfers may have been aborted on purpose,
+      // only needs the device back in step and then stops
+      bool cancelled_now = (controller != nullptr && controller->is_task_cancelled());
+      if (!cancelled_now)
+      {
+        record_batch_failure(BATCH_READ);
+      }
+      if ((cancelled_now || num_recoveries++ < NGP_LINKMASTA_MAX_RECOVERIES) && recover_connection())
+      {
+        for (lane_progress& lane_state : progress)
+        {
+          lane_state.requested = lane_state.offset;
+        }
+        batches.clear();
+        num_submitted = 0;
+        batch_start = std::chrono::steady_clock::now();
+        continue;
+      }
+      
+      if (controller != nullptr)
+      {
+        controller->on_task_end(task_status::ERROR, received);
+      }
+      throw;
+    }
+  }
+  abortable.end();
+  
+  unsigned int bytes_read = 0;
+  for (unsigned int i = 0; i < num_lanes; ++i)
+  {
+    read_lane& lane = lanes[i];
+    unsigned int offset = progress[i].offset;
+    
+    // Check for packets that were corrupted on the way. The regular method
+    // checks the remaining bytes itself
+    verify_read(lane.chip, lane.start_address, lane.buffer, offset);
+    
+    // Get any remaining bytes with the regular method
+    if (offset == progress[i].full_bytes && offset < lane.num_bytes
+        && (controller == nullptr || !controller->is_task_cancelled()))
+    {
+      unsigned int remaining = read_bytes(lane.chip, lane.start_address + offset, &lane.buffer[offset], lane.num_bytes - offset);
+      offset += remaining;
+      if (controller != nullptr)
+      {
+        controller->on_task_update(task_status::RUNNING, remaining);
+      }
+    }
+    lane.bytes_read = offset;
+    bytes_read += offset;
+  }
+  
+  // Inform controller that task is complete
+  if (controller != nullptr)
+  {
+    controller->on_task_end(bytes_read < total_bytes && controller->is_task_cancelled() ?  task_status::CANCELLED : task_status::COMPLETED, bytes_read);
+  }
+  return bytes_read;
+}
 
 void ngp_linkmasta_device::fetch_firmware_version()
 {
+  flush_writes();
+  
   data_t buffer[NGP_LINKMASTA_USB_RXTX_SIZE] = {0};
   build_getversion_command(buffer);
   
@@ -533,3 +1344,17 @@ void ngp_linkmasta_device::fetch_firmware_version()
   m_firmware_minor_version = (unsigned int) minVer;
   m_firmware_version_set = true;
 }
+
+unsigned int ngp_linkmasta_device::next_batch_packets(unsigned int num_bytes, batch_direction direction) const
+{
+  unsigned int num_packets = std::min(num_bytes / NGP_LINKMASTA_USB_RXTX_SIZE, batch_packets(direction));
+  
+  // Keep batches to whole USB packets so that only the last transfer of a
+  // read can end on a short packet
+  unsigned int packets_per_usb_packet = m_usb_packet_size / NGP_LINKMASTA_USB_RXTX_SIZE;
+  if (num_packets > packets_per_usb_packet)
+  {
+    num_packets -= num_packets % packets_per_usb_packet;
+  }
+  return num_packets;
+}
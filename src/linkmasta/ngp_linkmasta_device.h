@@ -16,6 +16,7 @@
 
 #include "linkmasta_device.h"
 #include "usb/usbfwd.h"
+#include <vector>
 
 
 
@@ -92,6 +93,11 @@ public:
    */
   void             set_timeout(timeout_t timeout);
   
+  /*!
+   *  \see linkmasta_device::set_timeouts(const timeout_profile& profile)
+   */
+  void             set_timeouts(const timeout_profile& profile);
+  
   /*!
    *  \see linkmasta_device::open()
    */
@@ -102,6 +108,11 @@ public:
    */
   void             close();
   
+  /*!
+   *  \see linkmasta_device::recover_connection()
+   */
+  bool             recover_connection();
+  
   /*!
    *  \see linkmasta_device::read_word(chip_index chip, address_t address)
    */
@@ -112,11 +123,48 @@ public:
    */
   void             write_word(chip_index chip, address_t address, word_t data);
   
+  /*!
+   *  \see linkmasta_device::run_word_sequence(chip_index chip, word_command* commands, unsigned int num_commands)
+   */
+  void             run_word_sequence(chip_index chip, word_command* commands, unsigned int num_commands);
+  
   /*!
    *  \see linkmasta_device::test_for_cartridge()
    */
   bool             test_for_cartridge();
   
+  /*!
+   *  \see linkmasta_device::probe_for_cartridge()
+   */
+  bool             probe_for_cartridge();
+  
+  /*!
+   *  \see linkmasta_device::fingerprint_cartridge()
+   */
+  std::string      fingerprint_cartridge();
+  
+  /*!
+   *  \see linkmasta_device::try_read_word(chip_index chip, address_t address)
+   */
+  usb::result<word_t> try_read_word(chip_index chip, address_t address) noexcept;
+  
+  /*!
+   *  \see linkmasta_device::try_write_word(chip_index chip, address_t address, word_t data)
+   */
+  usb::result<void> try_write_word(chip_index chip, address_t address, word_t data) noexcept;
+  
+  /*!
+   *  \brief Quickly checks for a connected cartridge without throwing.
+   *  
+   *  Sends the same commands as \ref probe_for_cartridge(), but one round
+   *  trip at a time through the non-throwing USB calls instead of as a
+   *  pipelined sequence. Falls back to the throwing version if the device is
+   *  not open or has writes queued.
+   *  
+   *  \see linkmasta_device::try_probe_for_cartridge()
+   */
+  usb::result<bool> try_probe_for_cartridge() noexcept;
+  
   /*!
    *  \see linkmasta_device::build_cartridge()
    */
@@ -143,6 +191,46 @@ public:
    */
   bool             supports_program_bytes() const;
   
+  /*!
+   *  \return true
+   *  
+   *  \see linkmasta_device::supports_stream_read_bytes()
+   */
+  bool             supports_stream_read_bytes() const;
+  
+  /*!
+   *  \return true if the firmware accepts read batches for different chips
+   *          queued behind one another.
+   *  
+   *  \see linkmasta_device::supports_interleaved_read_bytes()
+   */
+  bool             supports_interleaved_read_bytes() const;
+  
+  /*!
+   *  \return true
+   *  
+   *  \see linkmasta_device::supports_word_sequence()
+   */
+  bool             supports_word_sequence() const;
+  
+  /*!
+   *  \return true if the firmware offers erase notifications and the device
+   *          has an interrupt endpoint to send them on.
+   *  
+   *  \see linkmasta_device::supports_erase_notification()
+   */
+  bool             supports_erase_notification() const;
+  
+  /*!
+   *  \see linkmasta_device::wait_for_erase_notification(chip_index chip, unsigned int timeout_ms)
+   */
+  bool             wait_for_erase_notification(chip_index chip, unsigned int timeout_ms);
+  
+  /*!
+   *  \see linkmasta_device::read_erase_status(chip_index chip, address_t address)
+   */
+  word_t           read_erase_status(chip_index chip, address_t address);
+  
   
   
   /*!
@@ -155,10 +243,109 @@ public:
    */
   unsigned int     program_bytes(chip_index chip, address_t start_address, const data_t* buffer, unsigned int num_bytes, bool bypass_mode, task_controller* controller = nullptr);
   
+  /*!
+   *  \see linkmasta_device::stream_read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr)
+   */
+  unsigned int     stream_read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr);
+  
+  /*!
+   *  \see linkmasta_device::interleaved_read_bytes(read_lane* lanes, unsigned int num_lanes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr)
+   */
+  unsigned int     interleaved_read_bytes(read_lane* lanes, unsigned int num_lanes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr);
+  
+  
+  
+  /*!
+   *  \brief Gets whether calls to \ref write_word() are coalesced.
+   *  
+   *  \return true if writes are coalesced, false if each write waits for its
+   *          reply. See \ref set_coalesce_writes(bool enabled).
+   */
+  bool             coalesce_writes() const;
+  
+  /*!
+   *  \brief Enables or disables coalescing of calls to \ref write_word().
+   *  
+   *  When enabled, \ref write_word() only queues the write on the host. Queued
+   *  writes are sent back-to-back in a single burst, and their replies are
+   *  checked together, just before any other operation is performed on the
+   *  device, when the device is closed, or once enough writes have been
+   *  queued. A failed write is therefore reported by whichever later call
+   *  sends it. Enabled by default.
+   *  
+   *  Disabling coalescing sends any writes that are still queued.
+   *  
+   *  \param [in] enabled true to coalesce writes, false to send each write
+   *         immediately.
+   */
+  void             set_coalesce_writes(bool enabled);
+  
+  /*!
+   *  \brief Sends any writes queued by \ref write_word() to the device.
+   *  
+   *  Sends any writes queued by \ref write_word() to the device in a single
+   *  burst and checks their replies. Does nothing if no writes are queued.
+   *  
+   *  If any queued write fails, an exception is thrown. The remaining queued
+   *  writes are discarded.
+   */
+  void             flush_writes();
+  
+  
+  
+protected:
+  
+  /*!
+   *  \see linkmasta_device::abort_usb_transfers()
+   */
+  void             abort_usb_transfers();
+  
   
   
 private:
   
+  /*!
+   *  \brief Struct representing a write queued by \ref write_word().
+   */
+  struct queued_write
+  {
+    /*! \brief The index of the chip to write to. */
+    chip_index     chip;
+    
+    /*! \brief The write to perform. */
+    word_command   command;
+  };
+  
+  /*!
+   *  \brief Sends a sequence of word commands to the device without flushing
+   *         queued writes.
+   *  
+   *  Sends every command before waiting for the replies, keeping a read
+   *  queued for each command's reply, and then checks the replies in order.
+   *  
+   *  \see run_word_sequence(chip_index chip, word_command* commands, unsigned int num_commands)
+   */
+  void             send_word_sequence(chip_index chip, word_command* commands, unsigned int num_commands);
+  
+  /*!
+   *  \brief Sends a single word command and waits for its reply, without
+   *         throwing or flushing queued writes.
+   *  
+   *  \param [in] chip The index of the chip.
+   *  \param [in,out] command The command to send. The word read is stored in
+   *         its data for reads.
+   *  
+   *  \return How the command failed, if it did.
+   */
+  usb::result<void> try_send_word(chip_index chip, word_command& command) noexcept;
+  
+  /*!
+   *  \brief Sends any queued writes, returning failures instead of throwing.
+   *  
+   *  \see flush_writes()
+   */
+  usb::result<void> try_flush_writes() noexcept;
+  
   /*!
    *  \brief Fetches the firmware version directly from the associated LinkMasta
    *         device through USB.
@@ -172,6 +359,35 @@ private:
    */
   void             fetch_firmware_version();
   
+  /*!
+   *  \brief Reads from every lane with read64xN batches, keeping up to
+   *         **pipeline_depth** batches queued on the device and taking turns
+   *         between the lanes.
+   *  
+   *  The engine behind both \ref stream_read_bytes() and
+   *  \ref interleaved_read_bytes(), which reads a single lane.
+   *  
+   *  \see interleaved_read_bytes(read_lane* lanes, unsigned int num_lanes, unsigned int pipeline_depth = 2, task_controller* controller = nullptr)
+   */
+  unsigned int     pipelined_read(read_lane* lanes, unsigned int num_lanes, unsigned int pipeline_depth, task_controller* controller);
+  
+  /*!
+   *  \brief Gets the number of packets in the next read64xN or write64xN
+   *         batch.
+   *  
+   *  Gets the number of packets to request or send in the next batch, limited
+   *  to the size given by \ref batch_packets() and, when there is more than a
+   *  USB packet's worth, rounded down to whole USB packets of the device's
+   *  endpoints.
+   *  
+   *  \param [in] num_bytes The number of bytes left to transfer.
+   *  \param [in] direction The direction of the batch.
+   *  
+   *  \return The number of packets in the next batch, or 0 if fewer bytes
+   *          remain than fill a single packet.
+   */
+  unsigned int     next_batch_packets(unsigned int num_bytes, batch_direction direction) const;
+  
   
   
   /*!
@@ -197,6 +413,32 @@ private:
   
   /*! \brief Cached firmware minor version. */
   unsigned int     m_firmware_minor_version;
+  
+  /*!
+   *  \brief The largest packet the device's bulk endpoints carry, always a
+   *         whole number of protocol packets.
+   */
+  unsigned int     m_usb_packet_size;
+  
+  /*!
+   *  \brief The address of the interrupt endpoint erase notifications arrive
+   *         on, or \ref ENDPOINT_UNSET_VALUE if the device has none.
+   */
+  unsigned int     m_interrupt_endpoint;
+  
+  /*! \brief The largest number of packets in a read64xN or write64xN batch. */
+  unsigned int     m_max_batch_packets;
+  
+  /*!
+   *  \brief Flag indicating that \ref write_word() queues writes instead of
+   *         sending them right away.
+   *  
+   *  \see set_coalesce_writes(bool enabled)
+   */
+  bool             m_coalesce_writes;
+  
+  /*! \brief Writes queued by \ref write_word() that have not been sent yet. */
+  std::vector<queued_write> m_queued_writes;
 };
 
 #endif /* defined(__NGP_LINKMASTA_DEVICE_H__) */
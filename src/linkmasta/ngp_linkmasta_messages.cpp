@@ -31,6 +31,7 @@
 #define MSG_FLASHWRITE64xN_CMD      0x07
 #define MSG_BLINK_LED               0x09
 #define MSG_SPI_SEND_RECV_CMD       0x0A
+#define MSG_ERASE_DONE              0x20  // sent unasked on the interrupt endpoint
 
 #define MSG_TYPE_OFFSET             0
 
@@ -48,6 +49,8 @@
 #define MSG_FWRITE_UBYPASS_MODE     8
 #define MSG_FWRITE_PAYLOAD_OFFSET  32
 
+#define MSG_ERASE_CHIP_OFFSET       1
+
 //when calling build_read64xN_command, this is the recommended value for N
 #define COUNT_64xN (0x80)  //should be a power of 2 and fit into a uint8_t
 
@@ -343,6 +346,16 @@ void get_result_reply(uint8_t *buf, uint8_t *result)
   *result = buf[MSG_TYPE_OFFSET];
 }
 
+bool get_erase_done_message(uint8_t *buf, uint8_t *chip)
+{
+  if (buf[MSG_TYPE_OFFSET] != MSG_ERASE_DONE)
+  {
+    return false;
+  }
+  *chip = buf[MSG_ERASE_CHIP_OFFSET];
+  return true;
+}
+
 void get_blink_led_message(uint8_t *buf, uint8_t *blinkCount)
 {
   *blinkCount = buf[MSG_DATA_OFFSET];
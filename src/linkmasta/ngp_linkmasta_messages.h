@@ -54,6 +54,7 @@ void get_SPI_send_recv_message(uint8_t *buf, uint8_t *data);
 int get_read_reply(uint8_t *buf, uint32_t *addr21, uint8_t *data);
 void get_flash_write64xN_reply(uint8_t *buf, uint8_t *msgType, uint8_t *packetsProcessed);
 void get_result_reply(uint8_t *buf, uint8_t *result);
+bool get_erase_done_message(uint8_t *buf, uint8_t *chip);
 void get_blink_led_message(uint8_t *buf, uint8_t *blinkCount);
 
 }
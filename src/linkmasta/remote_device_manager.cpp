@@ -0,0 +1,431 @@
+/*! \file
+ *  \brief File containing the implementation of \ref remote_device_manager.
+ *  
+ *  File containing the implementation of \ref remote_device_manager.
+ *  
+ *  See corrensponding header file to view documentation for struct, its
+ *  methods, and its member variables.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-23
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "remote_device_manager.h"
+
+#include "common/log.h"
+#include "common/tcp_socket.h"
+#include "device_server_protocol.h"
+#include "linkmasta_device.h"
+
+#include <chrono>
+#include <stdexcept>
+
+using namespace std;
+
+#define REMOTE_REFRESH_INTERVAL_MS  5000
+
+
+
+remote_device_manager::remote_device_manager(const std::vector<std::string>& nodes)
+  : device_manager()
+{
+  for (const string& address : nodes)
+  {
+    node n;
+    n.host = address;
+    n.port = DEVICE_SERVER_DEFAULT_PORT;
+    
+    size_t colon = address.rfind(':');
+    if (colon != string::npos)
+    {
+      n.host = address.substr(0, colon);
+      unsigned long port = 0;
+      try
+      {
+        size_t end;
+        port = stoul(address.substr(colon + 1), &end);
+        if (end != address.size() - colon - 1)
+        {
+          port = 0;
+        }
+      }
+      catch (std::exception& ex)
+      {
+        (void) ex;
+        // Reported below
+      }
+      if (port == 0 || port > 0xFFFF)
+      {
+        throw std::invalid_argument("Invalid port in device server address " + address);
+      }
+      n.port = (unsigned short) port;
+    }
+    if (n.host.empty())
+    {
+      throw std::invalid_argument("Missing host in device server address " + address);
+    }
+    
+    n.socket.reset(new tcp_socket());
+    m_nodes.push_back(std::move(n));
+  }
+  
+  set_refresh_interval(REMOTE_REFRESH_INTERVAL_MS);
+  start_auto_refresh();
+  request_refresh();
+}
+
+remote_device_manager::~remote_device_manager()
+{
+  log_start(log_level::DEBUG, "~RemoteDeviceManager() {");
+  
+  stop_auto_refresh_and_wait();
+  
+  lock_guard<mutex> lock(m_devices_mutex);
+  for (auto& entry : m_devices)
+  {
+    delete entry.second->linkmasta;
+  }
+  m_devices.clear();
+  
+  log_end("}");
+}
+
+
+
+std::vector<unsigned int> remote_device_manager::get_connected_devices()
+{
+  vector<unsigned int> list;
+  
+  lock_guard<mutex> lock(m_devices_mutex);
+  list.reserve(m_devices.size());
+  for (auto& entry : m_devices)
+  {
+    list.push_back(entry.first);
+  }
+  
+  return list;
+}
+
+bool remote_device_manager::try_get_connected_devices(std::vector<unsigned int>& devices)
+{
+  unique_lock<mutex> lock(m_devices_mutex, try_to_lock);
+  if (!lock.owns_lock())
+  {
+    return false;
+  }
+  
+  devices.clear();
+  devices.reserve(m_devices.size());
+  for (auto& entry : m_devices)
+  {
+    devices.push_back(entry.first);
+  }
+  return true;
+}
+
+bool remote_device_manager::is_connected(unsigned int id)
+{
+  lock_guard<mutex> lock(m_devices_mutex);
+  return (m_devices.find(id) != m_devices.end());
+}
+
+unsigned int remote_device_manager::get_vendor_id(unsigned int id)
+{
+  return find_device(id)->info.vendor_id;
+}
+
+unsigned int remote_device_manager::get_product_id(unsigned int id)
+{
+  return find_device(id)->info.product_id;
+}
+
+string remote_device_manager::get_manufacturer_string(unsigned int id)
+{
+  return find_device(id)->info.manufacturer_string;
+}
+
+string remote_device_manager::get_product_string(unsigned int id)
+{
+  return find_device(id)->info.product_string;
+}
+
+string remote_device_manager::get_serial_number(unsigned int id)
+{
+  return find_device(id)->info.serial_number;
+}
+
+unsigned int remote_device_manager::get_bus_number(unsigned int id)
+{
+  // Buses of different nodes never share bandwidth
+  auto device = find_device(id);
+  return (device->node_index << 16) | (device->info.bus_number & 0xFFFF);
+}
+
+string remote_device_manager::get_port_path(unsigned int id)
+{
+  auto device = find_device(id);
+  return device->info.host + ":" + to_string(device->info.port) + "/" + device->info.port_path;
+}
+
+bool remote_device_manager::is_on_shared_hub(unsigned int id)
+{
+  return find_device(id)->info.shared_hub;
+}
+
+linkmasta_device* remote_device_manager::get_linkmasta_device(unsigned int id)
+{
+  return find_device(id)->linkmasta;
+}
+
+bool remote_device_manager::is_device_claimed(unsigned int id)
+{
+  auto device = find_device(id);
+  lock_guard<mutex> lock(device->claim_mutex);
+  return device->claimed;
+}
+
+bool remote_device_manager::try_claim_device(unsigned int id)
+{
+  auto device = find_device(id);
+  lock_guard<mutex> lock(device->claim_mutex);
+  if (device->claimed)
+  {
+    return false;
+  }
+  device->claimed = true;
+  return true;
+}
+
+bool remote_device_manager::claim_device(unsigned int id, unsigned int timeout_ms)
+{
+  auto device = find_device(id);
+  unique_lock<mutex> lock(device->claim_mutex);
+  
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+  while (device->claimed && !device->removed)
+  {
+    if (timeout_ms == CLAIM_TIMEOUT_INFINITE)
+    {
+      device->claim_condition.wait(lock);
+    }
+    else if (device->claim_condition.wait_until(lock, deadline) == cv_status::timeout)
+    {
+      break;
+    }
+  }
+  
+  if (device->removed)
+  {
+    throw std::invalid_argument("Device " + std::to_string(id) + " was disconnected");
+  }
+  if (device->claimed)
+  {
+    return false;
+  }
+  
+  device->claimed = true;
+  return true;
+}
+
+void remote_device_manager::release_device(unsigned int id)
+{
+  auto device = find_device(id);
+  {
+    lock_guard<mutex> lock(device->claim_mutex);
+    device->claimed = false;
+  }
+  device->claim_condition.notify_all();
+}
+
+
+
+void remote_device_manager::refresh_device_list()
+{
+  vector<shared_ptr<remote_device>> added_devices;
+  vector<shared_ptr<remote_device>> removed_devices;
+  
+  for (unsigned int i = 0; i < m_nodes.size(); ++i)
+  {
+    // A node that can't be reached loses its idle devices until it answers
+    // again, so that work goes elsewhere, but a device in use has a
+    // connection of its own and is left to find out for itself
+    vector<remote_device_info> listed;
+    if (!list_node(m_nodes[i], listed))
+    {
+      listed.clear();
+    }
+    
+    map<unsigned int, bool> found;
+    {
+      lock_guard<mutex> lock(m_devices_mutex);
+      for (auto& entry : m_devices)
+      {
+        if (entry.second->node_index == i)
+        {
+          found[entry.second->info.remote_id] = false;
+        }
+      }
+    }
+    
+    for (const remote_device_info& info : listed)
+    {
+      if (found.find(info.remote_id) != found.end())
+      {
+        found[info.remote_id] = true;
+        continue;
+      }
+      
+      shared_ptr<remote_device> device = make_shared<remote_device>();
+      device->node_index = i;
+      device->info = info;
+      device->claimed = false;
+      device->removed = false;
+      device->linkmasta = nullptr;
+      
+      remote_usb_device* usb_device = new remote_usb_device(info);
+      try
+      {
+        device->linkmasta = build_linkmasta_device(usb_device);
+      }
+      catch (std::exception& ex)
+      {
+        (void) ex;
+        // Device could not be set up, try again on the next refresh
+      }
+      if (device->linkmasta == nullptr)
+      {
+        delete usb_device;
+        continue;
+      }
+      added_devices.push_back(device);
+    }
+    
+    // Remove devices the node no longer lists, but only if they are not
+    // claimed
+    lock_guard<mutex> lock(m_devices_mutex);
+    for (auto it = m_devices.begin(); it != m_devices.end();)
+    {
+      shared_ptr<remote_device> device = it->second;
+      if (device->node_index != i || found[device->info.remote_id])
+      {
+        ++it;
+        continue;
+      }
+      
+      {
+        lock_guard<mutex> claim_lock(device->claim_mutex);
+        if (device->claimed)
+        {
+          ++it;
+          continue;
+        }
+        device->claimed = true;
+        device->removed = true;
+      }
+      device->claim_condition.notify_all();
+      removed_devices.push_back(device);
+      it = m_devices.erase(it);
+    }
+  }
+  
+  for (auto& device : removed_devices)
+  {
+    notify_device_listeners(device->id, false);
+    
+    try
+    {
+      delete device->linkmasta;
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // do nothing, fail silently
+    }
+  }
+  
+  for (auto& device : added_devices)
+  {
+    {
+      lock_guard<mutex> lock(m_devices_mutex);
+      device->id = generate_id();
+      m_devices[device->id] = device;
+    }
+    log(log_level::INFO, ("Found remote device " + to_string(device->info.remote_id) + " on "
+                          + device->info.host + ":" + to_string(device->info.port)).c_str());
+    notify_device_listeners(device->id, true);
+  }
+}
+
+bool remote_device_manager::list_node(node& n, std::vector<remote_device_info>& devices)
+{
+  bool was_connected = n.socket->is_open();
+  try
+  {
+    if (!n.socket->is_open())
+    {
+      device_server_connect(*n.socket, n.host, n.port);
+    }
+    
+    vector<unsigned char> out;
+    device_server_frame(DEVICE_SERVER_LIST).encode(out);
+    n.socket->send_all(out.data(), out.size());
+    
+    device_server_frame reply;
+    reply.receive(*n.socket);
+    if (reply.type != DEVICE_SERVER_LIST)
+    {
+      throw std::runtime_error("Unexpected reply from device server");
+    }
+    
+    unsigned int num_devices = reply.get_u32();
+    devices.clear();
+    for (unsigned int i = 0; i < num_devices; ++i)
+    {
+      remote_device_info info;
+      info.host = n.host;
+      info.port = n.port;
+      info.remote_id = reply.get_u32();
+      info.vendor_id = reply.get_u32();
+      info.product_id = reply.get_u32();
+      info.bus_number = reply.get_u32();
+      info.shared_hub = (reply.get_u8() != 0);
+      info.manufacturer_string = reply.get_string();
+      info.product_string = reply.get_string();
+      info.serial_number = reply.get_string();
+      info.port_path = reply.get_string();
+      unsigned int num_endpoints = reply.get_u32();
+      for (unsigned int j = 0; j < num_endpoints; ++j)
+      {
+        unsigned int address = reply.get_u32();
+        info.max_packet_sizes[address] = reply.get_u32();
+      }
+      devices.push_back(info);
+    }
+    return true;
+  }
+  catch (std::exception& ex)
+  {
+    // Reconnect on the next refresh, only reporting the first failure
+    if (was_connected)
+    {
+      log(log_level::INFO, ("Lost device server " + n.host + ":" + to_string(n.port)
+                            + ": " + ex.what()).c_str());
+    }
+    n.socket->close();
+    return false;
+  }
+}
+
+std::shared_ptr<remote_device_manager::remote_device> remote_device_manager::find_device(unsigned int id)
+{
+  lock_guard<mutex> lock(m_devices_mutex);
+  auto it = m_devices.find(id);
+  
+  if (it == m_devices.end())
+  {
+    throw std::invalid_argument("Unknown connected device ID " + std::to_string(id));
+  }
+  
+  return it->second;
+}
@@ -0,0 +1,240 @@
+/*! \file
+ *  \brief File containing the declaration of \ref remote_device_manager.
+ *  
+ *  File containing the header information and declaration of
+ *  \ref remote_device_manager.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-23
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __REMOTE_DEVICE_MANAGER_H__
+#define __REMOTE_DEVICE_MANAGER_H__
+
+#include "device_manager.h"
+#include "remote_usb_device.h"
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class tcp_socket;
+
+
+
+/*!
+ *  \brief Implementation of \ref device_manager for devices attached to other
+ *         machines running a \ref device_server.
+ *  
+ *  Implementation of \ref device_manager that lists the devices of one or
+ *  more \ref device_server nodes and hands out \ref linkmasta_device objects
+ *  that drive them through \ref remote_usb_device, so that one host can run
+ *  jobs on devices spread across many machines. Each node's devices are
+ *  listed over a connection kept open for that purpose, and each device opens
+ *  a connection of its own while in use.
+ *  
+ *  Claims are tracked locally. The server claims a device again when its
+ *  connection opens it, so devices shared with other clients of the same
+ *  node report \ref usb::busy_exception while someone else has them open.
+ */
+class remote_device_manager : public device_manager
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Starts listing the devices of the given nodes.
+   *  
+   *  \param [in] nodes The servers to use, each as "host" or "host:port".
+   *         Nodes without a port use \ref DEVICE_SERVER_DEFAULT_PORT.
+   *  
+   *  \throws std::invalid_argument If a node is malformed.
+   */
+  explicit                  remote_device_manager(const std::vector<std::string>& nodes);
+  
+  /*!
+   *  \brief Class destructor. Stops refreshing and frees every device.
+   */
+                            ~remote_device_manager();
+  
+  
+  
+  /*!
+   *  \see device_manager::get_connected_devices()
+   */
+  std::vector<unsigned int> get_connected_devices();
+  
+  /*!
+   *  \see device_manager::try_get_connected_devices(std::vector<unsigned int>&)
+   */
+  bool                      try_get_connected_devices(std::vector<unsigned int>& devices);
+  
+  /*!
+   *  \see device_manager::is_connected(unsigned int)
+   */
+  bool                      is_connected(unsigned int id);
+  
+  /*!
+   *  \see device_manager::get_vendor_id(unsigned int)
+   */
+  unsigned int              get_vendor_id(unsigned int id);
+  
+  /*!
+   *  \see device_manager::get_product_id(unsigned int)
+   */
+  unsigned int              get_product_id(unsigned int id);
+  
+  /*!
+   *  \see device_manager::get_manufacturer_string(unsigned int)
+   */
+  std::string               get_manufacturer_string(unsigned int id);
+  
+  /*!
+   *  \see device_manager::get_product_string(unsigned int)
+   */
+  std::string               get_product_string(unsigned int id);
+  
+  /*!
+   *  \see device_manager::get_serial_number(unsigned int)
+   */
+  std::string               get_serial_number(unsigned int id);
+  
+  /*!
+   *  \brief Gets the bus number of the device, made unique across nodes.
+   *  
+   *  \see device_manager::get_bus_number(unsigned int)
+   */
+  unsigned int              get_bus_number(unsigned int id);
+  
+  /*!
+   *  \brief Gets the port path of the device, prefixed with "host:port/".
+   *  
+   *  \see device_manager::get_port_path(unsigned int)
+   */
+  std::string               get_port_path(unsigned int id);
+  
+  /*!
+   *  \see device_manager::is_on_shared_hub(unsigned int)
+   */
+  bool                      is_on_shared_hub(unsigned int id);
+  
+  /*!
+   *  \see device_manager::get_linkmasta_device(unsigned int)
+   */
+  linkmasta_device*         get_linkmasta_device(unsigned int id);
+  
+  /*!
+   *  \see device_manager::is_device_claimed(unsigned int)
+   */
+  bool                      is_device_claimed(unsigned int id);
+  
+  /*!
+   *  \see device_manager::try_claim_device(unsigned int)
+   */
+  bool                      try_claim_device(unsigned int id);
+  
+  /*!
+   *  \see device_manager::claim_device(unsigned int, unsigned int)
+   */
+  bool                      claim_device(unsigned int id, unsigned int timeout_ms);
+  using device_manager::claim_device;
+  
+  /*!
+   *  \see device_manager::release_device(unsigned int)
+   */
+  void                      release_device(unsigned int id);
+
+
+
+protected:
+  
+  /*!
+   *  \see device_manager::refresh_device_list()
+   */
+  void                      refresh_device_list();
+
+
+
+private:
+  
+  struct                    remote_device;
+  
+  /*!
+   *  \brief Struct containing a server and the connection used to list its
+   *         devices.
+   */
+  struct                    node
+  {
+    /*! \brief The host name or address of the server. */
+    std::string               host;
+    
+    /*! \brief The TCP port of the server. */
+    unsigned short            port;
+    
+    /*! \brief The connection used to list devices, opened on demand. */
+    std::unique_ptr<tcp_socket> socket;
+  };
+  
+  /*!
+   *  \brief Lists the devices of a node, reconnecting to it if needed.
+   *  
+   *  \param [in] n The node to list the devices of.
+   *  \param [out] devices The devices the node listed.
+   *  
+   *  \return **true** if the node answered, **false** if it could not be
+   *          reached.
+   */
+  bool                      list_node(node& n, std::vector<remote_device_info>& devices);
+  
+  /*!
+   *  \brief Looks up the device with the given id.
+   *  
+   *  \throws std::invalid_argument If no device with the given id exists.
+   */
+  std::shared_ptr<remote_device> find_device(unsigned int id);
+  
+  
+  
+  /*!
+   *  \brief Struct containing a device listed by one of the nodes.
+   */
+  struct                    remote_device
+  {
+    /*! \brief Internal id of the device as provided by \ref generate_id(). */
+    unsigned int              id;
+    
+    /*! \brief Index of the node the device is attached to. */
+    unsigned int              node_index;
+    
+    /*! \brief The device as listed by its node. */
+    remote_device_info        info;
+    
+    /*! \brief Pointer to generated \ref linkmasta_device object. */
+    linkmasta_device*         linkmasta;
+    
+    /*! \brief Flag indicating the device is currently claimed. */
+    bool                      claimed;
+    
+    /*! \brief Flag indicating the device has been removed. */
+    bool                      removed;
+    
+    /*! \brief Mutex guarding \ref claimed and \ref removed. */
+    std::mutex                claim_mutex;
+    
+    /*! \brief Condition signalled whenever the device is released. */
+    std::condition_variable   claim_condition;
+  };
+  
+  /*! \brief The servers devices are listed from. */
+  std::vector<node>         m_nodes;
+  
+  /*! \brief The listed devices, indexed by id. */
+  std::map<unsigned int, std::shared_ptr<remote_device>> m_devices;
+  
+  /*! \brief Mutex guarding \ref m_devices. */
+  std::mutex                m_devices_mutex;
+};
+
+#endif /* defined(__REMOTE_DEVICE_MANAGER_H__) */
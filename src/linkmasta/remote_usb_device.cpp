@@ -0,0 +1,552 @@
+/*! \file
+ *  \brief File containing the implementation of the \ref remote_usb_device
+ *         class.
+ *  
+ *  File containing the implementation of the \ref remote_usb_device class.
+ *  See corresponding header file to view documentation for the class, its
+ *  methods, and its member variables.
+ *  
+ *  \see remote_usb_device
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-23
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "remote_usb_device.h"
+#include "device_server_protocol.h"
+#include "usb/usb.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#define CLASS_NAME "remote_usb_device"
+
+#define DEFAULT_MAX_PENDING_TRANSFERS 32
+
+// Number of queued bytes after which writes are sent without waiting for a
+// reply to be needed
+#define FLUSH_THRESHOLD               0x10000
+
+typedef remote_usb_device::timeout_t          timeout_t;
+typedef remote_usb_device::configuration_t    configuration_t;
+typedef remote_usb_device::interface_t        interface_t;
+typedef remote_usb_device::endpoint_t         endpoint_t;
+typedef remote_usb_device::data_t             data_t;
+typedef remote_usb_device::device_description device_description;
+
+
+
+remote_usb_device::remote_usb_device(const remote_device_info& info)
+  : m_info(info), m_description(new device_description(0)),
+    m_was_initialized(false), m_is_open(false), m_disconnected(false),
+    m_timeout(0), m_configuration(0), m_interface(0), m_input_endpoint(0),
+    m_output_endpoint(0), m_max_pending_transfers(DEFAULT_MAX_PENDING_TRANSFERS),
+    m_replies_owed(0), m_replies_discarded(0)
+{
+  m_description->device_class = 0;
+  m_description->vendor_id = m_info.vendor_id;
+  m_description->product_id = m_info.product_id;
+}
+
+remote_usb_device::~remote_usb_device()
+{
+  try
+  {
+    close();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // The server releases the device on its own once the connection drops
+  }
+  delete m_description;
+}
+
+void remote_usb_device::init()
+{
+  m_was_initialized = true;
+}
+
+
+
+timeout_t remote_usb_device::timeout() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  return m_timeout;
+}
+
+configuration_t remote_usb_device::configuration() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  return m_configuration;
+}
+
+interface_t remote_usb_device::interface() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  return m_interface;
+}
+
+endpoint_t remote_usb_device::input_endpoint() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  return m_input_endpoint;
+}
+
+endpoint_t remote_usb_device::output_endpoint() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  return m_output_endpoint;
+}
+
+const device_description* remote_usb_device::get_device_description() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  return m_description;
+}
+
+std::string remote_usb_device::get_manufacturer_string()
+{
+  return m_info.manufacturer_string;
+}
+
+std::string remote_usb_device::get_product_string()
+{
+  return m_info.product_string;
+}
+
+std::string remote_usb_device::get_serial_number()
+{
+  return m_info.serial_number;
+}
+
+unsigned int remote_usb_device::max_packet_size(endpoint_t endpoint) const
+{
+  auto it = m_info.max_packet_sizes.find(endpoint);
+  return (it == m_info.max_packet_sizes.end() ? 0 : it->second);
+}
+
+
+
+void remote_usb_device::set_timeout(timeout_t timeout)
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  m_timeout = timeout;
+}
+
+void remote_usb_device::set_configuration(configuration_t configuration)
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  m_configuration = configuration;
+}
+
+void remote_usb_device::set_interface(interface_t interface)
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  m_interface = interface;
+}
+
+void remote_usb_device::set_input_endpoint(endpoint_t input_endpoint)
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  m_input_endpoint = input_endpoint;
+}
+
+void remote_usb_device::set_output_endpoint(endpoint_t output_endpoint)
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  m_output_endpoint = output_endpoint;
+}
+
+
+
+void remote_usb_device::open()
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  if (m_is_open)
+  {
+    return;
+  }
+  
+  // Held throughout so that an abort from another thread never sees the
+  // socket half set up
+  std::lock_guard<std::mutex> lock(m_send_mutex);
+  
+  device_server_frame reply;
+  try
+  {
+    device_server_connect(m_socket, m_info.host, m_info.port);
+    
+    std::vector<unsigned char> out;
+    device_server_frame request(DEVICE_SERVER_OPEN);
+    request.put_u32(m_info.remote_id);
+    request.encode(out);
+    m_socket.send_all(out.data(), out.size());
+    reply.receive(m_socket);
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    m_socket.close();
+    throw usb::disconnected_exception();
+  }
+  
+  try
+  {
+    if (reply.type != DEVICE_SERVER_OPEN)
+    {
+      throw usb::exception("Unexpected reply from device server");
+    }
+    throw_status(reply);
+  }
+  catch (...)
+  {
+    m_socket.close();
+    throw;
+  }
+  
+  m_is_open = true;
+  m_disconnected = false;
+  m_pending_transfers.clear();
+  m_replies_owed = 0;
+  m_replies_discarded = 0;
+  m_out.clear();
+}
+
+void remote_usb_device::close()
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  if (!m_is_open)
+  {
+    return;
+  }
+  
+  cancel_pending_transfers();
+  if (!m_disconnected)
+  {
+    try
+    {
+      // Wait for the server to finish what was sent so that the device is
+      // idle before anyone else may claim it
+      queue_frame(device_server_frame(DEVICE_SERVER_CLOSE));
+      flush();
+      device_server_frame reply;
+      do
+      {
+        receive_frame(reply);
+      } while (reply.type != DEVICE_SERVER_CLOSE);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Closing anyway
+    }
+  }
+  
+  std::lock_guard<std::mutex> lock(m_send_mutex);
+  m_socket.close();
+  m_out.clear();
+  m_is_open = false;
+}
+
+unsigned int remote_usb_device::read(data_t* data, unsigned int num_bytes)
+{
+  return read(data, num_bytes, m_timeout);
+}
+
+unsigned int remote_usb_device::read(data_t* data, unsigned int num_bytes, timeout_t timeout)
+{
+  validate_state();
+  for (const pending_transfer& transfer : m_pending_transfers)
+  {
+    if (transfer.data != nullptr)
+    {
+      // Its reply would arrive ahead of this one
+      throw std::runtime_error("Cannot read while reads are pending");
+    }
+  }
+  
+  device_server_frame request(DEVICE_SERVER_READ);
+  request.put_u32(timeout);
+  request.put_u32(num_bytes);
+  queue_frame(request);
+  ++m_replies_owed;
+  return receive_read(data, num_bytes);
+}
+
+unsigned int remote_usb_device::write(const data_t* buffer, unsigned int num_bytes)
+{
+  return write(buffer, num_bytes, m_timeout);
+}
+
+unsigned int remote_usb_device::write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+{
+  validate_state();
+  
+  // Sent along with whatever comes next; a failure surfaces on the next read
+  device_server_frame request(DEVICE_SERVER_WRITE);
+  request.put_u32(timeout);
+  request.put_bytes(buffer, num_bytes);
+  queue_frame(request);
+  if (m_out.size() >= FLUSH_THRESHOLD)
+  {
+    flush();
+  }
+  return num_bytes;
+}
+
+unsigned int remote_usb_device::write(data_t* buffer, unsigned int num_bytes)
+{
+  return write((const data_t*) buffer, num_bytes, m_timeout);
+}
+
+unsigned int remote_usb_device::write(data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+{
+  return write((const data_t*) buffer, num_bytes, timeout);
+}
+
+
+
+bool remote_usb_device::supports_async_transfers() const
+{
+  return true;
+}
+
+unsigned int remote_usb_device::max_pending_transfers() const
+{
+  return m_max_pending_transfers;
+}
+
+void remote_usb_device::set_max_pending_transfers(unsigned int max_pending)
+{
+  if (max_pending == 0)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(max_pending)
+                                + " for max pending transfers");
+  }
+  m_max_pending_transfers = max_pending;
+}
+
+unsigned int remote_usb_device::num_pending_transfers() const
+{
+  return (unsigned int) m_pending_transfers.size();
+}
+
+void remote_usb_device::submit_read(data_t* data, unsigned int num_bytes)
+{
+  validate_state();
+  if (m_pending_transfers.size() >= m_max_pending_transfers)
+  {
+    throw std::runtime_error("Too many pending transfers");
+  }
+  
+  // Sent once the first reply is collected, so that a whole pipeline of reads
+  // goes out together
+  device_server_frame request(DEVICE_SERVER_READ);
+  request.put_u32(m_timeout);
+  request.put_u32(num_bytes);
+  queue_frame(request);
+  ++m_replies_owed;
+  
+  pending_transfer transfer = {data, num_bytes};
+  m_pending_transfers.push_back(transfer);
+}
+
+void remote_usb_device::submit_write(const data_t* data, unsigned int num_bytes)
+{
+  validate_state();
+  if (m_pending_transfers.size() >= m_max_pending_transfers)
+  {
+    throw std::runtime_error("Too many pending transfers");
+  }
+  
+  write(data, num_bytes, m_timeout);
+  pending_transfer transfer = {nullptr, num_bytes};
+  m_pending_transfers.push_back(transfer);
+}
+
+unsigned int remote_usb_device::complete_transfer()
+{
+  if (m_pending_transfers.empty())
+  {
+    throw std::runtime_error("No pending transfers");
+  }
+  
+  pending_transfer transfer = m_pending_transfers.front();
+  m_pending_transfers.pop_front();
+  
+  if (transfer.data == nullptr)
+  {
+    flush();
+    return transfer.num_bytes;
+  }
+  return receive_read(transfer.data, transfer.num_bytes);
+}
+
+void remote_usb_device::cancel_pending_transfers()
+{
+  // The server still answers every read sent, so the replies are skipped as
+  // they arrive
+  m_pending_transfers.clear();
+  m_replies_discarded = m_replies_owed;
+}
+
+void remote_usb_device::abort_pending_transfers()
+{
+  std::lock_guard<std::mutex> lock(m_send_mutex);
+  if (!m_socket.is_open())
+  {
+    return;
+  }
+  
+  std::vector<unsigned char> out;
+  device_server_frame(DEVICE_SERVER_ABORT).encode(out);
+  try
+  {
+    m_socket.send_all(out.data(), out.size());
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // The owning thread finds out about the lost connection on its own
+  }
+}
+
+bool remote_usb_device::recover()
+{
+  if (!m_is_open || m_disconnected)
+  {
+    return false;
+  }
+  
+  try
+  {
+    cancel_pending_transfers();
+    queue_frame(device_server_frame(DEVICE_SERVER_RECOVER));
+    flush();
+    
+    device_server_frame reply;
+    receive_frame(reply);
+    if (reply.type != DEVICE_SERVER_RECOVER)
+    {
+      disconnect();
+    }
+    throw_status(reply);
+    return reply.get_u8() != 0;
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    return false;
+  }
+}
+
+
+
+void remote_usb_device::validate_state() const
+{
+  if (!m_was_initialized) throw usb::uninitialized_exception(CLASS_NAME);
+  if (!m_is_open) throw usb::unopen_exception(CLASS_NAME);
+  if (m_disconnected) throw usb::disconnected_exception();
+}
+
+void remote_usb_device::queue_frame(const device_server_frame& frame)
+{
+  frame.encode(m_out);
+}
+
+void remote_usb_device::flush()
+{
+  if (m_out.empty())
+  {
+    return;
+  }
+  
+  std::lock_guard<std::mutex> lock(m_send_mutex);
+  try
+  {
+    m_socket.send_all(m_out.data(), m_out.size());
+    m_out.clear();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    m_out.clear();
+    disconnect();
+  }
+}
+
+void remote_usb_device::receive_frame(device_server_frame& frame)
+{
+  while (true)
+  {
+    try
+    {
+      frame.receive(m_socket);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      disconnect();
+    }
+    
+    if (frame.type != DEVICE_SERVER_READ)
+    {
+      return;
+    }
+    if (m_replies_owed == 0)
+    {
+      disconnect();
+    }
+    --m_replies_owed;
+    if (m_replies_discarded == 0)
+    {
+      return;
+    }
+    --m_replies_discarded;
+  }
+}
+
+unsigned int remote_usb_device::receive_read(data_t* data, unsigned int num_bytes)
+{
+  flush();
+  
+  device_server_frame reply;
+  receive_frame(reply);
+  if (reply.type != DEVICE_SERVER_READ)
+  {
+    disconnect();
+  }
+  throw_status(reply);
+  
+  unsigned int num_read = std::min(reply.remaining(), num_bytes);
+  memcpy(data, reply.remaining_bytes(), num_read);
+  return num_read;
+}
+
+void remote_usb_device::disconnect()
+{
+  m_disconnected = true;
+  throw usb::disconnected_exception();
+}
+
+void remote_usb_device::throw_status(device_server_frame& frame)
+{
+  unsigned int status = frame.get_u8();
+  if (status == DEVICE_SERVER_OK)
+  {
+    return;
+  }
+  
+  unsigned int timeout = frame.get_u32();
+  std::string message = frame.get_string();
+  switch (status)
+  {
+  case DEVICE_SERVER_TIMEOUT:       throw usb::timeout_exception(timeout);
+  case DEVICE_SERVER_DISCONNECTED:  throw usb::disconnected_exception();
+  case DEVICE_SERVER_INTERRUPTED:   throw usb::interrupted_exception();
+  case DEVICE_SERVER_BUSY:          throw usb::busy_exception();
+  default:                          throw usb::exception(message);
+  }
+}
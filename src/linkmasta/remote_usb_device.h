@@ -0,0 +1,390 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref remote_usb_device
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref remote_usb_device class. This file includes the minimal number of
+ *  files necessary to use any instance of the \ref remote_usb_device class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-23
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __REMOTE_USB_DEVICE_H__
+#define __REMOTE_USB_DEVICE_H__
+
+#include "usb/usb_device.h"
+#include "common/tcp_socket.h"
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct device_server_frame;
+
+/*!
+ *  \brief Struct describing a device attached to a \ref device_server, as
+ *         listed by the server.
+ */
+struct remote_device_info
+{
+  /*! \brief The host name or address of the server. */
+  std::string             host;
+  
+  /*! \brief The TCP port of the server. */
+  unsigned short          port;
+  
+  /*! \brief The id of the device on the server. */
+  unsigned int            remote_id;
+  
+  /*! \brief USB vendor ID of the device. */
+  unsigned int            vendor_id;
+  
+  /*! \brief USB product ID of the device. */
+  unsigned int            product_id;
+  
+  /*! \brief Number of the bus the device is attached to on the server. */
+  unsigned int            bus_number;
+  
+  /*! \brief Flag indicating the device's hub is not high speed. */
+  bool                    shared_hub;
+  
+  /*! \brief USB device manufacturer string. */
+  std::string             manufacturer_string;
+  
+  /*! \brief USB device product string. */
+  std::string             product_string;
+  
+  /*! \brief USB device serial number string. */
+  std::string             serial_number;
+  
+  /*! \brief Chain of hub ports leading to the device on the server. */
+  std::string             port_path;
+  
+  /*! \brief Largest packet size of each of the device's endpoints, by
+   *         address. */
+  std::map<unsigned int, unsigned int> max_packet_sizes;
+};
+
+
+
+/*! \class remote_usb_device
+ *  \brief Stand-in for a USB device attached to another machine.
+ *  
+ *  Implementation of \ref usb::usb_device whose transfers are relayed to a
+ *  device attached to a \ref device_server. Passing an instance of this class
+ *  to \ref ngp_linkmasta_device or \ref ws_linkmasta_device lets the rest of
+ *  the program use the device as if it was attached locally.
+ *  
+ *  Opening the device connects to the server and claims the device there,
+ *  and closing it releases the claim and disconnects. In between, writes are
+ *  batched up and only sent once a reply is needed or enough of them have
+ *  piled up, and reads are sent as soon as they are submitted so that their
+ *  replies stream back while the device works through the batch. Writes are
+ *  not acknowledged, so a write that fails on the server is reported by the
+ *  next read or recovery instead. A lost connection is reported as
+ *  \ref usb::disconnected_exception; closing and reopening the device
+ *  connects again.
+ *  
+ *  This class is *not* thread-safe, except for
+ *  \ref abort_pending_transfers(), which may be called from any thread.
+ */
+class remote_usb_device : public usb::usb_device
+{
+public:
+  
+  /*!
+   *  \brief Main constructor for the class.
+   *  
+   *  \param [in] info The device to relay transfers to, as listed by its
+   *         server.
+   */
+  explicit                  remote_usb_device(const remote_device_info& info);
+  
+  /*!
+   *  \brief The destructor for the class. Closes the device if it is open.
+   */
+                            ~remote_usb_device();
+  
+  /*!
+   *  \see usb_device::init()
+   */
+  void                      init();
+  
+  
+  
+  /*!
+   *  \see usb_device::timeout()
+   */
+  timeout_t                 timeout() const;
+  
+  /*!
+   *  \see usb_device::configuration()
+   */
+  configuration_t           configuration() const;
+  
+  /*!
+   *  \see usb_device::interface()
+   */
+  interface_t               interface() const;
+  
+  /*!
+   *  \see usb_device::input_endpoint()
+   */
+  endpoint_t                input_endpoint() const;
+  
+  /*!
+   *  \see usb_device::output_endpoint()
+   */
+  endpoint_t                output_endpoint() const;
+  
+  /*!
+   *  \see usb_device::get_device_description()
+   */
+  const device_description* get_device_description() const;
+  
+  /*!
+   *  \see usb_device::get_manufacturer_string()
+   */
+  std::string               get_manufacturer_string();
+  
+  /*!
+   *  \see usb_device::get_product_string()
+   */
+  std::string               get_product_string();
+  
+  /*!
+   *  \see usb_device::get_serial_number()
+   */
+  std::string               get_serial_number();
+  
+  /*!
+   *  \see usb_device::max_packet_size(endpoint_t endpoint)
+   */
+  unsigned int              max_packet_size(endpoint_t endpoint) const;
+  
+  
+  
+  /*!
+   *  \see usb_device::set_timeout(timeout_t timeout)
+   */
+  void                      set_timeout(timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::set_configuration(configuration_t configuration)
+   */
+  void                      set_configuration(configuration_t configuration);
+  
+  /*!
+   *  \see usb_device::set_interface(interface_t interface)
+   */
+  void                      set_interface(interface_t interface);
+  
+  /*!
+   *  \see usb_device::set_input_endpoint(endpoint_t input_endpoint)
+   */
+  void                      set_input_endpoint(endpoint_t input_endpoint);
+  
+  /*!
+   *  \see usb_device::set_output_endpoint(endpoint_t output_endpoint)
+   */
+  void                      set_output_endpoint(endpoint_t output_endpoint);
+  
+  
+  
+  /*!
+   *  \see usb_device::open()
+   */
+  void                      open();
+  
+  /*!
+   *  \see usb_device::close()
+   */
+  void                      close();
+  
+  /*!
+   *  \see usb_device::read(data_t* data, unsigned int num_bytes)
+   */
+  unsigned int              read(data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::read(data_t* data, unsigned int num_bytes, timeout_t timeout)
+   */
+  unsigned int              read(data_t* data, unsigned int num_bytes, timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::write(const data_t* buffer, unsigned int num_bytes)
+   */
+  unsigned int              write(const data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+   */
+  unsigned int              write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::write(data_t* buffer, unsigned int num_bytes)
+   */
+  unsigned int              write(data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::write(data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+   */
+  unsigned int              write(data_t* buffer, unsigned int num_bytes, timeout_t timeout);
+  
+  
+  
+  /*!
+   *  \see usb_device::supports_async_transfers()
+   */
+  bool                      supports_async_transfers() const;
+  
+  /*!
+   *  \see usb_device::max_pending_transfers()
+   */
+  unsigned int              max_pending_transfers() const;
+  
+  /*!
+   *  \see usb_device::set_max_pending_transfers(unsigned int max_pending)
+   */
+  void                      set_max_pending_transfers(unsigned int max_pending);
+  
+  /*!
+   *  \see usb_device::num_pending_transfers()
+   */
+  unsigned int              num_pending_transfers() const;
+  
+  /*!
+   *  \see usb_device::submit_read(data_t* data, unsigned int num_bytes)
+   */
+  void                      submit_read(data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::submit_write(const data_t* data, unsigned int num_bytes)
+   */
+  void                      submit_write(const data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::complete_transfer()
+   */
+  unsigned int              complete_transfer();
+  
+  /*!
+   *  \see usb_device::cancel_pending_transfers()
+   */
+  void                      cancel_pending_transfers();
+  
+  /*!
+   *  \see usb_device::abort_pending_transfers()
+   */
+  void                      abort_pending_transfers();
+  
+  /*!
+   *  \see usb_device::recover()
+   */
+  bool                      recover();
+
+
+
+private:
+  remote_usb_device(const remote_usb_device& other) = delete;
+  remote_usb_device& operator=(const remote_usb_device& other) = delete;
+  
+  /*!
+   *  \brief Struct containing a transfer submitted but not yet collected.
+   */
+  struct pending_transfer
+  {
+    data_t*                 data;
+    unsigned int            num_bytes;
+  };
+  
+  /*!
+   *  \brief Throws an exception if the device is not initialized, open, and
+   *         connected.
+   */
+  void                      validate_state() const;
+  
+  /*!
+   *  \brief Queues a frame to be sent with the next batch.
+   */
+  void                      queue_frame(const device_server_frame& frame);
+  
+  /*!
+   *  \brief Sends every frame queued so far.
+   */
+  void                      flush();
+  
+  /*!
+   *  \brief Receives the next frame, skipping the replies of cancelled reads.
+   */
+  void                      receive_frame(device_server_frame& frame);
+  
+  /*!
+   *  \brief Waits for the reply of the oldest read sent.
+   *  
+   *  \return The number of bytes read.
+   */
+  unsigned int              receive_read(data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Marks the connection as lost and throws
+   *         \ref usb::disconnected_exception.
+   */
+  void                      disconnect();
+  
+  /*!
+   *  \brief Reads a status and throws the exception it stands for, if any.
+   */
+  static void               throw_status(device_server_frame& frame);
+  
+  
+  
+  /*! \brief The device on the server. */
+  const remote_device_info  m_info;
+  
+  /*! \brief Description of the device, built from \ref m_info. */
+  device_description*       m_description;
+  
+  /*! \brief Whether \ref init() has been called. */
+  bool                      m_was_initialized;
+  
+  /*! \brief Whether the device is open. */
+  bool                      m_is_open;
+  
+  /*! \brief Whether the connection was lost since the device was opened. */
+  bool                      m_disconnected;
+  
+  /*! \brief The configured settings of the device. */
+  timeout_t                 m_timeout;
+  configuration_t           m_configuration;
+  interface_t               m_interface;
+  endpoint_t                m_input_endpoint;
+  endpoint_t                m_output_endpoint;
+  
+  /*! \brief The most transfers that may be pending at once. */
+  unsigned int              m_max_pending_transfers;
+  
+  /*! \brief Transfers submitted but not yet collected, oldest first. */
+  std::deque<pending_transfer> m_pending_transfers;
+  
+  /*! \brief The number of read replies the server still owes. */
+  unsigned int              m_replies_owed;
+  
+  /*! \brief The number of owed replies belonging to cancelled reads. */
+  unsigned int              m_replies_discarded;
+  
+  /*! \brief Frames queued to be sent with the next batch. */
+  std::vector<unsigned char> m_out;
+  
+  /*! \brief The connection to the server. */
+  tcp_socket                m_socket;
+  
+  /*! \brief Mutex guarding sends on \ref m_socket, which aborts make from
+   *         other threads. */
+  std::mutex                m_send_mutex;
+};
+
+#endif /* defined(__REMOTE_USB_DEVICE_H__) */
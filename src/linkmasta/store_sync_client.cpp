@@ -0,0 +1,176 @@
+/*! \file
+ *  \brief File containing the implementation of \ref store_sync_client.
+ *  
+ *  File containing the implementation of \ref store_sync_client.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see store_sync_client
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "store_sync_client.h"
+#include "common/dump_store.h"
+#include "common/tcp_socket.h"
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+
+using namespace std;
+
+
+
+store_sync_client::store_sync_client(dump_store* store)
+  : m_store(store)
+{
+  // Nothing else to do
+}
+
+
+
+store_sync_client::summary store_sync_client::push(const std::string& host, unsigned short port)
+{
+  summary result;
+  result.files = 0;
+  result.files_sent = 0;
+  result.chunks = 0;
+  result.chunks_sent = 0;
+  result.bytes = 0;
+  result.bytes_sent = 0;
+  
+  vector<string> files = m_store->digests();
+  sort(files.begin(), files.end());
+  result.files = (unsigned int) files.size();
+  
+  tcp_socket socket;
+  store_sync_connect(socket, host, port);
+  for (const string& file : find_missing(socket, STORE_SYNC_MISSING_FILES, files))
+  {
+    push_file(socket, file, result);
+  }
+  socket.close();
+  return result;
+}
+
+
+
+device_server_frame store_sync_client::exchange(tcp_socket& socket, const device_server_frame& request)
+{
+  vector<unsigned char> out;
+  request.encode(out);
+  socket.send_all(out.data(), out.size());
+  
+  device_server_frame reply;
+  reply.receive(socket);
+  if (reply.type != request.type)
+  {
+    throw std::runtime_error("Unexpected store sync message " + to_string(reply.type));
+  }
+  return reply;
+}
+
+std::vector<std::string> store_sync_client::find_missing(tcp_socket& socket, unsigned char type, const std::vector<std::string>& digests)
+{
+  vector<string> missing;
+  for (size_t start = 0; start < digests.size(); start += STORE_SYNC_MAX_DIGESTS)
+  {
+    size_t end = min(digests.size(), start + STORE_SYNC_MAX_DIGESTS);
+    device_server_frame request(type);
+    request.put_u32((unsigned int) (end - start));
+    for (size_t i = start; i < end; ++i)
+    {
+      request.put_string(digests[i]);
+    }
+    
+    device_server_frame reply = exchange(socket, request);
+    for (unsigned int count = reply.get_u32(); count > 0; --count)
+    {
+      missing.push_back(reply.get_string());
+    }
+  }
+  return missing;
+}
+
+void store_sync_client::push_file(tcp_socket& socket, const std::string& file, summary& result)
+{
+  vector<unsigned char> data = m_store->read(file);
+  vector<string> chunk_digests = store_sync_chunk_digests(data.data(), (unsigned int) data.size());
+  
+  // Ask about every distinct chunk once
+  vector<string> distinct;
+  set<string> listed;
+  for (const string& digest : chunk_digests)
+  {
+    if (listed.insert(digest).second)
+    {
+      distinct.push_back(digest);
+    }
+  }
+  vector<string> missing_list = find_missing(socket, STORE_SYNC_MISSING_CHUNKS, distinct);
+  set<string> missing(missing_list.begin(), missing_list.end());
+  
+  // Send the missing chunks in batches. Chunks aren't answered, so they
+  // stream out back to back ahead of the file they belong to
+  device_server_frame batch(STORE_SYNC_CHUNKS);
+  unsigned int batch_count = 0;
+  unsigned int batch_bytes = 0;
+  auto send_batch = [&]()
+  {
+    device_server_frame full(STORE_SYNC_CHUNKS);
+    full.put_u32(batch_count);
+    full.put_bytes(batch.payload.data(), (unsigned int) batch.payload.size());
+    vector<unsigned char> out;
+    full.encode(out);
+    socket.send_all(out.data(), out.size());
+    batch.payload.clear();
+    batch_count = 0;
+    batch_bytes = 0;
+  };
+  for (unsigned int i = 0; i < chunk_digests.size(); ++i)
+  {
+    if (missing.erase(chunk_digests[i]) == 0)
+    {
+      continue;
+    }
+    
+    unsigned int offset = i * STORE_SYNC_CHUNK_SIZE;
+    unsigned int size = min((unsigned int) STORE_SYNC_CHUNK_SIZE, (unsigned int) data.size() - offset);
+    if (batch_count > 0 && batch_bytes + size > STORE_SYNC_MAX_BATCH_BYTES)
+    {
+      send_batch();
+    }
+    
+    batch.put_string(chunk_digests[i]);
+    batch.put_string(string((const char*) data.data() + offset, size));
+    ++batch_count;
+    batch_bytes += size;
+    ++result.chunks_sent;
+    result.bytes_sent += size;
+  }
+  if (batch_count > 0)
+  {
+    send_batch();
+  }
+  
+  device_server_frame request(STORE_SYNC_PUT_FILE);
+  request.put_string(file);
+  request.put_u32((unsigned int) data.size());
+  request.put_u32((unsigned int) chunk_digests.size());
+  for (const string& digest : chunk_digests)
+  {
+    request.put_string(digest);
+  }
+  device_server_frame reply = exchange(socket, request);
+  if (reply.get_u8() == 0)
+  {
+    throw std::runtime_error("Archive refused file " + file + ": " + reply.get_string());
+  }
+  
+  ++result.files_sent;
+  result.chunks += (unsigned int) chunk_digests.size();
+  result.bytes += data.size();
+}
@@ -0,0 +1,126 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref store_sync_client
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref store_sync_client class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __STORE_SYNC_CLIENT_H__
+#define __STORE_SYNC_CLIENT_H__
+
+#include "store_sync_protocol.h"
+#include <string>
+#include <vector>
+
+class dump_store;
+class tcp_socket;
+
+/*! \class store_sync_client
+ *  \brief Class copying the files of a \ref dump_store into the central
+ *         archive kept by a \ref store_sync_server.
+ *  
+ *  Class that brings a central archive up to date with the store of this
+ *  station. The archive is sent the digests of the store's files, in batches
+ *  of \ref STORE_SYNC_MAX_DIGESTS, and answers with the ones it lacks. Each
+ *  of those is then split into chunks, the archive answers with the chunks
+ *  it has in no file of its own, and only those are sent, in batches of up
+ *  to \ref STORE_SYNC_MAX_BATCH_BYTES. A chunk that appears more than once
+ *  in a file, such as unused space, is sent once.
+ *  
+ *  Files are only ever added to the archive. Running the client again after
+ *  an interruption resends only what didn't make it.
+ *  
+ *  This class is *not* thread-safe.
+ */
+class store_sync_client
+{
+public:
+  
+  /*!
+   *  \brief Struct containing the amount of work done by \ref push().
+   */
+  struct summary
+  {
+    /*! \brief The number of files in the store. */
+    unsigned int          files;
+    
+    /*! \brief The number of files the archive lacked and was sent. */
+    unsigned int          files_sent;
+    
+    /*! \brief The number of chunks in the files sent. */
+    unsigned int          chunks;
+    
+    /*! \brief The number of chunks the archive lacked and was sent. */
+    unsigned int          chunks_sent;
+    
+    /*! \brief The total size of the files sent, in bytes. */
+    unsigned long long    bytes;
+    
+    /*! \brief The total size of the chunks sent, in bytes. */
+    unsigned long long    bytes_sent;
+  };
+  
+  
+  
+  /*!
+   *  \brief Class constructor.
+   *  
+   *  \param [in] store The store to copy files from. Must outlive the
+   *         client.
+   */
+  explicit                store_sync_client(dump_store* store);
+  
+  
+  
+  /*!
+   *  \brief Sends every file of the store the archive lacks.
+   *  
+   *  \param [in] host The host name or address of the archive.
+   *  \param [in] port The TCP port of the archive.
+   *  
+   *  \return The amount of work done.
+   *  
+   *  \throws std::runtime_error If the archive could not be reached, the
+   *          connection failed, a stored file could not be read, or the
+   *          archive refused a file. Files sent before the failure stay in
+   *          the archive.
+   */
+  summary                 push(const std::string& host, unsigned short port = STORE_SYNC_DEFAULT_PORT);
+
+
+
+private:
+  
+  /*!
+   *  \brief Sends a request and receives its reply.
+   *  
+   *  \throws std::runtime_error If the connection failed or the reply is of
+   *          another type.
+   */
+  static device_server_frame exchange(tcp_socket& socket, const device_server_frame& request);
+  
+  /*!
+   *  \brief Sends a list of digests and receives the ones the archive lacks.
+   *  
+   *  \param [in] type \ref STORE_SYNC_MISSING_FILES or
+   *         \ref STORE_SYNC_MISSING_CHUNKS.
+   */
+  static std::vector<std::string> find_missing(tcp_socket& socket, unsigned char type, const std::vector<std::string>& digests);
+  
+  /*!
+   *  \brief Sends a single file the archive lacks.
+   */
+  void                    push_file(tcp_socket& socket, const std::string& file, summary& result);
+  
+  
+  
+  /*! \brief The store files are copied from. */
+  dump_store* const       m_store;
+};
+
+#endif /* defined(__STORE_SYNC_CLIENT_H__) */
@@ -0,0 +1,77 @@
+/*! \file
+ *  \brief File containing the implementation of the helpers shared by
+ *         \ref store_sync_server and \ref store_sync_client.
+ *  
+ *  File containing the implementation of the helpers shared by
+ *  \ref store_sync_server and \ref store_sync_client.
+ *  
+ *  See corrensponding header file to view documentation for the protocol and
+ *  its helpers.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "store_sync_protocol.h"
+#include "common/dump_store.h"
+#include "common/tcp_socket.h"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+
+
+std::vector<std::string> store_sync_chunk_digests(const unsigned char* data, unsigned int num_bytes)
+{
+  vector<string> digests;
+  for (unsigned int offset = 0; offset < num_bytes; offset += STORE_SYNC_CHUNK_SIZE)
+  {
+    digests.push_back(dump_store::sha256(data + offset, min((unsigned int) STORE_SYNC_CHUNK_SIZE, num_bytes - offset)));
+  }
+  return digests;
+}
+
+bool store_sync_is_digest(const std::string& digest)
+{
+  if (digest.size() != 64)
+  {
+    return false;
+  }
+  for (char c : digest)
+  {
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void store_sync_connect(tcp_socket& socket, const std::string& host, unsigned short port)
+{
+  socket.connect(host, port);
+  try
+  {
+    vector<unsigned char> out;
+    device_server_frame hello(STORE_SYNC_HELLO);
+    hello.put_u32(STORE_SYNC_MAGIC);
+    hello.put_u32(STORE_SYNC_PROTOCOL_VERSION);
+    hello.encode(out);
+    socket.send_all(out.data(), out.size());
+    
+    device_server_frame reply;
+    reply.receive(socket);
+    if (reply.type != STORE_SYNC_HELLO || reply.get_u32() != STORE_SYNC_MAGIC
+        || reply.get_u32() != STORE_SYNC_PROTOCOL_VERSION)
+    {
+      throw std::runtime_error("Incompatible archive at " + host + ":" + to_string(port));
+    }
+  }
+  catch (...)
+  {
+    socket.close();
+    throw;
+  }
+}
@@ -0,0 +1,143 @@
+/*! \file
+ *  \brief File containing the definitions shared by \ref store_sync_server
+ *         and \ref store_sync_client.
+ *  
+ *  File containing the message types of the protocol \ref store_sync_client
+ *  speaks with \ref store_sync_server to copy the files of a station's
+ *  \ref dump_store into a central archive. Messages are framed with
+ *  \ref device_server_frame, so integers and strings are encoded as described
+ *  in device_server_protocol.h. Digests are sent as strings of 64 lowercase
+ *  hexadecimal digits.
+ *  
+ *  Files are compared as chunks of \ref STORE_SYNC_CHUNK_SIZE bytes, each
+ *  named by its SHA-256 digest. Dumps of different revisions of a game, or of
+ *  cartridges with the same unused space, share most of their chunks, so a
+ *  file the archive doesn't have yet seldom needs all of its chunks sent.
+ *  
+ *  A connection starts with the client sending a \ref STORE_SYNC_HELLO and
+ *  the server answering with one of its own. The client then asks which of
+ *  its files the archive lacks with \ref STORE_SYNC_MISSING_FILES. For each
+ *  of those, it asks which of the file's chunks the archive lacks with
+ *  \ref STORE_SYNC_MISSING_CHUNKS, sends them in batches with
+ *  \ref STORE_SYNC_CHUNKS, and has the archive put the file together from
+ *  those and the chunks it already had with \ref STORE_SYNC_PUT_FILE.
+ *  
+ *  Every request but \ref STORE_SYNC_CHUNKS is answered with a frame of the
+ *  same type, in the order the requests were sent. A request naming anything
+ *  but a well-formed digest closes the connection.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __STORE_SYNC_PROTOCOL_H__
+#define __STORE_SYNC_PROTOCOL_H__
+
+#include "device_server_protocol.h"
+#include <string>
+#include <vector>
+
+/*! \brief The TCP port \ref store_sync_server listens on by default. */
+#define STORE_SYNC_DEFAULT_PORT         7402
+
+/*! \brief The version of the protocol, exchanged in \ref STORE_SYNC_HELLO. */
+#define STORE_SYNC_PROTOCOL_VERSION     1
+
+/*! \brief Identifies the protocol at the start of \ref STORE_SYNC_HELLO. */
+#define STORE_SYNC_MAGIC                0x53534446 /* "FDSS" */
+
+/*! \brief The size of the chunks files are compared in. The last chunk of a
+ *         file may be smaller. */
+#define STORE_SYNC_CHUNK_SIZE           0x10000
+
+/*! \brief The most digests a client lists in a single request. */
+#define STORE_SYNC_MAX_DIGESTS          0x1000
+
+/*! \brief The most chunk bytes a client sends in a single
+ *         \ref STORE_SYNC_CHUNKS frame. */
+#define STORE_SYNC_MAX_BATCH_BYTES      0x400000
+
+/*! \brief The largest file the archive accepts, in bytes. */
+#define STORE_SYNC_MAX_FILE_BYTES       0x4000000
+
+
+
+/*!
+ *  \brief The types of message exchanged with a \ref store_sync_server.
+ */
+enum store_sync_message
+{
+  /*!
+   *  \brief Opens the conversation. Both ways: u32 magic, u32 version.
+   */
+  STORE_SYNC_HELLO = 1,
+  
+  /*!
+   *  \brief Finds the files the archive lacks. Request: u32 count, then
+   *         each file's digest. Reply: u32 count, then the digests of the
+   *         files among them the archive doesn't hold.
+   */
+  STORE_SYNC_MISSING_FILES,
+  
+  /*!
+   *  \brief Finds the chunks the archive lacks. Request: u32 count, then
+   *         each chunk's digest. Reply: u32 count, then the digests of the
+   *         chunks among them the archive holds in no file and wasn't sent
+   *         yet.
+   */
+  STORE_SYNC_MISSING_CHUNKS,
+  
+  /*!
+   *  \brief Sends chunks. Request: u32 count, then for each chunk its
+   *         digest and its bytes as a string. Never answered. The server
+   *         keeps the chunks until the next \ref STORE_SYNC_PUT_FILE.
+   */
+  STORE_SYNC_CHUNKS,
+  
+  /*!
+   *  \brief Puts a file together and adds it to the archive. Request: the
+   *         file's digest, u32 size, u32 count, then the digest of each of
+   *         its chunks in order. Reply: u8 success flag and an error message
+   *         string.
+   */
+  STORE_SYNC_PUT_FILE
+};
+
+
+
+/*!
+ *  \brief Splits data into chunks of \ref STORE_SYNC_CHUNK_SIZE bytes and
+ *         computes the digest of each.
+ *  
+ *  \param [in] data Pointer to the data.
+ *  \param [in] num_bytes The number of bytes of data.
+ *  
+ *  \return The digest of every chunk, in order.
+ */
+std::vector<std::string> store_sync_chunk_digests(const unsigned char* data, unsigned int num_bytes);
+
+/*!
+ *  \brief Checks that a string received as a digest is one.
+ *  
+ *  \param [in] digest The string to check.
+ *  
+ *  \return true if the string is exactly 64 lowercase hexadecimal digits,
+ *          false otherwise.
+ */
+bool store_sync_is_digest(const std::string& digest);
+
+/*!
+ *  \brief Connects to a \ref store_sync_server and exchanges
+ *         \ref STORE_SYNC_HELLO messages with it.
+ *  
+ *  \param [out] socket The socket to connect. Must not be open.
+ *  \param [in] host The host name or address of the server.
+ *  \param [in] port The TCP port of the server.
+ *  
+ *  \throws std::runtime_error If the server could not be reached or does not
+ *          speak this version of the protocol. The socket is left closed.
+ */
+void store_sync_connect(tcp_socket& socket, const std::string& host, unsigned short port);
+
+#endif /* defined(__STORE_SYNC_PROTOCOL_H__) */
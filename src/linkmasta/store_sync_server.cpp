@@ -0,0 +1,451 @@
+/*! \file
+ *  \brief File containing the implementation of \ref store_sync_server.
+ *  
+ *  File containing the implementation of \ref store_sync_server.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see store_sync_server
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "store_sync_server.h"
+#include "common/dump_store.h"
+#include "common/file_util.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+
+// First line of the index, followed by its chunk size
+#define INDEX_MAGIC          "fmci1"
+#define TEMP_EXTENSION       ".tmp"
+
+// How long accepting waits before checking whether to stop
+#define ACCEPT_INTERVAL_MS   250
+
+using namespace std;
+
+
+
+// Receives a digest from a client. Digests name files in the store, so
+// anything else is refused before it gets near the file system
+static string get_digest(device_server_frame& frame)
+{
+  string digest = frame.get_string();
+  if (!store_sync_is_digest(digest))
+  {
+    throw std::runtime_error("Malformed store sync digest");
+  }
+  return digest;
+}
+
+// Builds the line of the index listing the chunks of a file
+static string index_line(const string& file, unsigned int num_bytes, const vector<string>& chunk_digests)
+{
+  string line = file + "\t" + to_string(num_bytes);
+  for (const string& digest : chunk_digests)
+  {
+    line += "\t" + digest;
+  }
+  return line + "\n";
+}
+
+
+
+store_sync_server::store_sync_server(dump_store* store, unsigned short port)
+  : m_store(store), m_port(port), m_stopping(false)
+{
+  // Nothing else to do
+}
+
+store_sync_server::~store_sync_server()
+{
+  stop();
+}
+
+void store_sync_server::start()
+{
+  if (m_thread.joinable())
+  {
+    return;
+  }
+  
+  load_index();
+  
+  // Stations push to the archive from other machines
+  m_socket.listen(m_port, false);
+  m_stopping = false;
+  m_thread = std::thread(&store_sync_server::serve, this);
+}
+
+void store_sync_server::stop()
+{
+  if (!m_thread.joinable())
+  {
+    return;
+  }
+  
+  m_stopping = true;
+  m_thread.join();
+  m_socket.close();
+  
+  // Disconnecting the clients wakes their threads up
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (connection* c : m_connections)
+    {
+      c->socket.shutdown();
+    }
+  }
+  reap_connections(true);
+}
+
+unsigned int store_sync_server::num_connections()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return (unsigned int) m_connections.size();
+}
+
+unsigned int store_sync_server::num_chunks()
+{
+  lock_guard<mutex> lock(m_mutex);
+  return (unsigned int) m_chunks.size();
+}
+
+
+
+void store_sync_server::load_index()
+{
+  string index_path = m_store->directory() + "/" STORE_SYNC_INDEX_NAME;
+  
+  // Read what was indexed before. An index of another chunk size is of no
+  // use, and a line cut off while being written is left out
+  map<string, pair<unsigned int, vector<string>>> indexed;
+  ifstream fin(index_path.c_str(), ios::binary);
+  string line;
+  if (fin.is_open() && getline(fin, line) && line == INDEX_MAGIC "\t" + to_string(STORE_SYNC_CHUNK_SIZE))
+  {
+    while (getline(fin, line) && !fin.eof())
+    {
+      vector<string> fields = split_fields(line);
+      if (fields.size() < 2 || fields[0].size() != 64)
+      {
+        continue;
+      }
+      unsigned long long num_bytes = strtoull(fields[1].c_str(), nullptr, 10);
+      vector<string> chunk_digests(fields.begin() + 2, fields.end());
+      if (chunk_digests.size() == (num_bytes + STORE_SYNC_CHUNK_SIZE - 1) / STORE_SYNC_CHUNK_SIZE)
+      {
+        indexed[fields[0]] = make_pair((unsigned int) num_bytes, chunk_digests);
+      }
+    }
+  }
+  fin.close();
+  
+  lock_guard<mutex> lock(m_mutex);
+  m_chunks.clear();
+  string contents = INDEX_MAGIC "\t" + to_string(STORE_SYNC_CHUNK_SIZE) + "\n";
+  for (const string& file : m_store->digests())
+  {
+    auto it = indexed.find(file);
+    if (it == indexed.end())
+    {
+      vector<unsigned char> data = m_store->read(file);
+      it = indexed.insert(make_pair(file, make_pair((unsigned int) data.size(), store_sync_chunk_digests(data.data(), (unsigned int) data.size())))).first;
+    }
+    index_file(file, it->second.first, it->second.second);
+    contents += index_line(file, it->second.first, it->second.second);
+  }
+  
+  // Replace the index whole, so that an interrupted write leaves the old one
+  ofstream fout((index_path + TEMP_EXTENSION).c_str(), ios::binary | ios::out | ios::trunc);
+  fout.write(contents.data(), contents.size());
+  fout.close();
+  if (!fout || !replace_file(index_path + TEMP_EXTENSION, index_path))
+  {
+    remove((index_path + TEMP_EXTENSION).c_str());
+    throw std::runtime_error("Unable to write file " + index_path);
+  }
+}
+
+void store_sync_server::index_file(const std::string& file, unsigned int num_bytes, const std::vector<std::string>& chunk_digests)
+{
+  for (unsigned int i = 0; i < chunk_digests.size(); ++i)
+  {
+    if (m_chunks.find(chunk_digests[i]) == m_chunks.end())
+    {
+      chunk_location location;
+      location.file = file;
+      location.offset = i * STORE_SYNC_CHUNK_SIZE;
+      location.size = min((unsigned int) STORE_SYNC_CHUNK_SIZE, num_bytes - location.offset);
+      m_chunks[chunk_digests[i]] = location;
+    }
+  }
+}
+
+void store_sync_server::serve()
+{
+  while (!m_stopping)
+  {
+    reap_connections(false);
+    
+    connection* c = new connection;
+    if (m_socket.accept(c->socket, ACCEPT_INTERVAL_MS))
+    {
+      c->pending_bytes = 0;
+      c->finished = false;
+      
+      lock_guard<mutex> lock(m_mutex);
+      m_connections.push_back(c);
+      c->thread = std::thread(&store_sync_server::read_requests, this, c);
+    }
+    else
+    {
+      delete c;
+    }
+  }
+}
+
+void store_sync_server::reap_connections(bool all)
+{
+  vector<connection*> finished;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    for (auto it = m_connections.begin(); it != m_connections.end();)
+    {
+      if (all || (*it)->finished)
+      {
+        finished.push_back(*it);
+        it = m_connections.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+  
+  for (connection* c : finished)
+  {
+    c->thread.join();
+    delete c;
+  }
+}
+
+
+
+void store_sync_server::read_requests(connection* c)
+{
+  try
+  {
+    bool keep_going = true;
+    while (keep_going)
+    {
+      device_server_frame frame;
+      frame.receive(c->socket);
+      keep_going = run_request(c, frame);
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // The client disconnected or broke the protocol
+  }
+  
+  c->socket.shutdown();
+  lock_guard<mutex> lock(m_mutex);
+  c->finished = true;
+}
+
+bool store_sync_server::run_request(connection* c, device_server_frame& frame)
+{
+  device_server_frame reply(frame.type);
+  bool keep_going = true;
+  switch (frame.type)
+  {
+  case STORE_SYNC_HELLO:
+    keep_going = (frame.get_u32() == STORE_SYNC_MAGIC && frame.get_u32() == STORE_SYNC_PROTOCOL_VERSION);
+    reply.put_u32(STORE_SYNC_MAGIC);
+    reply.put_u32(STORE_SYNC_PROTOCOL_VERSION);
+    break;
+  
+  case STORE_SYNC_MISSING_FILES:
+  {
+    vector<string> missing;
+    for (unsigned int count = frame.get_u32(); count > 0; --count)
+    {
+      string file = get_digest(frame);
+      if (!m_store->contains(file))
+      {
+        missing.push_back(file);
+      }
+    }
+    reply.put_u32((unsigned int) missing.size());
+    for (const string& file : missing)
+    {
+      reply.put_string(file);
+    }
+    break;
+  }
+  
+  case STORE_SYNC_MISSING_CHUNKS:
+  {
+    vector<string> missing;
+    set<string> listed;
+    {
+      lock_guard<mutex> lock(m_mutex);
+      for (unsigned int count = frame.get_u32(); count > 0; --count)
+      {
+        string chunk = get_digest(frame);
+        if (m_chunks.find(chunk) == m_chunks.end() && c->chunks.find(chunk) == c->chunks.end()
+            && listed.insert(chunk).second)
+        {
+          missing.push_back(chunk);
+        }
+      }
+    }
+    reply.put_u32((unsigned int) missing.size());
+    for (const string& chunk : missing)
+    {
+      reply.put_string(chunk);
+    }
+    break;
+  }
+  
+  case STORE_SYNC_CHUNKS:
+    receive_chunks(c, frame);
+    return true;
+  
+  case STORE_SYNC_PUT_FILE:
+    put_file(c, frame, reply);
+    break;
+  
+  default:
+    throw std::runtime_error("Unknown store sync message " + std::to_string(frame.type));
+  }
+  
+  vector<unsigned char> out;
+  reply.encode(out);
+  c->socket.send_all(out.data(), out.size());
+  return keep_going;
+}
+
+void store_sync_server::receive_chunks(connection* c, device_server_frame& frame)
+{
+  for (unsigned int count = frame.get_u32(); count > 0; --count)
+  {
+    string digest = get_digest(frame);
+    string bytes = frame.get_string();
+    if (bytes.empty() || bytes.size() > STORE_SYNC_CHUNK_SIZE)
+    {
+      throw std::runtime_error("Store sync chunk of the wrong size");
+    }
+    
+    // A chunk that doesn't match its digest is dropped, so that the file it
+    // belongs to fails to go together rather than going together wrong
+    if (dump_store::sha256((const unsigned char*) bytes.data(), (unsigned int) bytes.size()) != digest
+        || c->chunks.find(digest) != c->chunks.end())
+    {
+      continue;
+    }
+    if (c->pending_bytes + bytes.size() > STORE_SYNC_MAX_PENDING_BYTES)
+    {
+      throw std::runtime_error("Too many store sync chunks waiting for their file");
+    }
+    c->chunks[digest].assign(bytes.begin(), bytes.end());
+    c->pending_bytes += (unsigned int) bytes.size();
+  }
+}
+
+void store_sync_server::put_file(connection* c, device_server_frame& frame, device_server_frame& reply)
+{
+  string file = get_digest(frame);
+  unsigned int num_bytes = frame.get_u32();
+  vector<string> chunk_digests;
+  for (unsigned int count = frame.get_u32(); count > 0; --count)
+  {
+    chunk_digests.push_back(get_digest(frame));
+  }
+  
+  try
+  {
+    if (num_bytes > STORE_SYNC_MAX_FILE_BYTES)
+    {
+      throw std::invalid_argument("File " + file + " is too large for the archive");
+    }
+    if (chunk_digests.size() != ((unsigned long long) num_bytes + STORE_SYNC_CHUNK_SIZE - 1) / STORE_SYNC_CHUNK_SIZE)
+    {
+      throw std::invalid_argument("Wrong number of chunks for file " + file);
+    }
+    
+    // Put the file together from the chunks just sent and those already in
+    // the archive. Stored files never change, so they can be read unlocked
+    vector<unsigned char> data;
+    data.reserve(num_bytes);
+    for (unsigned int i = 0; i < chunk_digests.size(); ++i)
+    {
+      unsigned int size = min((unsigned int) STORE_SYNC_CHUNK_SIZE, num_bytes - i * STORE_SYNC_CHUNK_SIZE);
+      auto pending = c->chunks.find(chunk_digests[i]);
+      if (pending != c->chunks.end() && pending->second.size() == size)
+      {
+        data.insert(data.end(), pending->second.begin(), pending->second.end());
+        continue;
+      }
+      
+      chunk_location location;
+      {
+        lock_guard<mutex> lock(m_mutex);
+        auto stored = m_chunks.find(chunk_digests[i]);
+        if (stored == m_chunks.end() || stored->second.size != size)
+        {
+          throw std::runtime_error("Archive is missing chunk " + chunk_digests[i] + " of file " + file);
+        }
+        location = stored->second;
+      }
+      
+      ifstream fin(m_store->path_for(location.file).c_str(), ios::binary);
+      data.resize(data.size() + size);
+      fin.seekg(location.offset);
+      if (!fin.read((char*) &data[data.size() - size], size))
+      {
+        throw std::runtime_error("Unable to read file " + m_store->path_for(location.file));
+      }
+    }
+    
+    if (dump_store::sha256(data.data(), num_bytes) != file)
+    {
+      throw std::runtime_error("File " + file + " doesn't match its digest");
+    }
+    
+    // Another station may have sent the same file in the meantime, in which
+    // case it is already indexed. Checking and adding under the lock keeps
+    // two uploads of the same file from both indexing it
+    lock_guard<mutex> lock(m_mutex);
+    if (!m_store->contains(file))
+    {
+      m_store->add_data(data.data(), num_bytes);
+      index_file(file, num_bytes, chunk_digests);
+      ofstream fout((m_store->directory() + "/" STORE_SYNC_INDEX_NAME).c_str(), ios::binary | ios::out | ios::app);
+      string line = index_line(file, num_bytes, chunk_digests);
+      fout.write(line.data(), line.size());
+    }
+    
+    reply.put_u8(1);
+    reply.put_string("");
+  }
+  catch (std::exception& ex)
+  {
+    reply.put_u8(0);
+    reply.put_string(ex.what());
+  }
+  
+  c->chunks.clear();
+  c->pending_bytes = 0;
+}
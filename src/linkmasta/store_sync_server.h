@@ -0,0 +1,223 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref store_sync_server
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref store_sync_server class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __STORE_SYNC_SERVER_H__
+#define __STORE_SYNC_SERVER_H__
+
+#include "common/tcp_socket.h"
+#include "store_sync_protocol.h"
+#include <atomic>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class dump_store;
+
+/*! \brief Name of the file in the store's directory the index of chunks is
+ *         kept in between runs. */
+#define STORE_SYNC_INDEX_NAME           "chunks.fmci"
+
+/*! \brief How many bytes of chunks a client may send ahead of the file they
+ *         belong to before it is disconnected. */
+#define STORE_SYNC_MAX_PENDING_BYTES    0x4000000
+
+/*! \class store_sync_server
+ *  \brief Server that keeps a central archive of the \ref dump_store of
+ *         every station.
+ *  
+ *  Server that receives the files of other stations' stores from
+ *  \ref store_sync_client and adds them to a \ref dump_store of its own, so
+ *  that every distinct backup made anywhere ends up in one place. Only the
+ *  files the archive lacks are sent, and of those only the chunks it holds
+ *  in no other file, so bringing an archive up to date costs little more
+ *  than the backups that are really new. The protocol is described in
+ *  store_sync_protocol.h.
+ *  
+ *  The server keeps the digest of every chunk of every file in the archive,
+ *  along with where to find it, in \ref STORE_SYNC_INDEX_NAME in the store's
+ *  directory. Starting the server only reads the files that were added to
+ *  the store since the index was last written.
+ *  
+ *  Every connection is served by a thread of its own, and files from
+ *  several stations may be received at once.
+ */
+class store_sync_server
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Does not start the server.
+   *  
+   *  \param [in] store The store to keep the archive in. Must outlive the
+   *         server.
+   *  \param [in] port The TCP port to listen on.
+   */
+                          store_sync_server(dump_store* store, unsigned short port = STORE_SYNC_DEFAULT_PORT);
+  
+  /*!
+   *  \brief Class destructor. Stops the server if it is running.
+   */
+                          ~store_sync_server();
+  
+  /*!
+   *  \brief Brings the index of chunks up to date, then starts listening and
+   *         serving clients in the background.
+   *  
+   *  \throws std::runtime_error If a stored file could not be read, the
+   *          index could not be written, or the port could not be listened
+   *          on.
+   */
+  void                    start();
+  
+  /*!
+   *  \brief Stops the server, disconnecting every client. Files not finished
+   *         yet are left out of the archive.
+   */
+  void                    stop();
+  
+  /*!
+   *  \brief Gets the number of clients currently connected.
+   */
+  unsigned int            num_connections();
+  
+  /*!
+   *  \brief Gets the number of distinct chunks the archive holds.
+   */
+  unsigned int            num_chunks();
+
+
+
+private:
+  store_sync_server(const store_sync_server& other) = delete;
+  store_sync_server& operator=(const store_sync_server& other) = delete;
+  
+  /*!
+   *  \brief Struct telling where a copy of a chunk is stored.
+   */
+  struct chunk_location
+  {
+    /*! \brief The digest of the stored file holding the chunk. */
+    std::string           file;
+    
+    /*! \brief The offset of the chunk in the file. */
+    unsigned int          offset;
+    
+    /*! \brief The size of the chunk in bytes. */
+    unsigned int          size;
+  };
+  
+  /*!
+   *  \brief Struct containing the state of a client connection.
+   */
+  struct connection
+  {
+    tcp_socket            socket;
+    std::thread           thread;
+    
+    /*! \brief The chunks sent for the next file, by digest. Only used by the
+     *         connection's thread. */
+    std::map<std::string, std::vector<unsigned char>> chunks;
+    
+    /*! \brief The total size of \ref chunks. */
+    unsigned int          pending_bytes;
+    
+    /*! \brief Whether the thread has finished. Guarded by the server's
+     *         mutex. */
+    bool                  finished;
+  };
+  
+  /*!
+   *  \brief Reads the index of chunks, indexes every stored file missing
+   *         from it, and writes it back without the files no longer stored.
+   */
+  void                    load_index();
+  
+  /*!
+   *  \brief Adds the chunks of a file to the index. Must be called with the
+   *         server's mutex held.
+   *  
+   *  \param [in] file The digest of the file.
+   *  \param [in] num_bytes The size of the file in bytes.
+   *  \param [in] chunk_digests The digest of each chunk of the file.
+   */
+  void                    index_file(const std::string& file, unsigned int num_bytes, const std::vector<std::string>& chunk_digests);
+  
+  /*!
+   *  \brief Entry point of the thread accepting connections.
+   */
+  void                    serve();
+  
+  /*!
+   *  \brief Joins and deletes the connections that have finished.
+   *  
+   *  \param [in] all Whether to wait for every connection rather than only
+   *         the finished ones.
+   */
+  void                    reap_connections(bool all);
+  
+  /*!
+   *  \brief Entry point of a connection's thread.
+   */
+  void                    read_requests(connection* c);
+  
+  /*!
+   *  \brief Runs a request, sending its reply.
+   *  
+   *  \return **false** if the connection should be closed.
+   */
+  bool                    run_request(connection* c, device_server_frame& frame);
+  
+  /*!
+   *  \brief Keeps the chunks of a \ref STORE_SYNC_CHUNKS request for the
+   *         next file.
+   */
+  void                    receive_chunks(connection* c, device_server_frame& frame);
+  
+  /*!
+   *  \brief Answers a \ref STORE_SYNC_PUT_FILE request.
+   */
+  void                    put_file(connection* c, device_server_frame& frame, device_server_frame& reply);
+  
+  
+  
+  /*! \brief The store the archive is kept in. */
+  dump_store* const       m_store;
+  
+  /*! \brief The TCP port to listen on. */
+  const unsigned short    m_port;
+  
+  /*! \brief The listening socket. */
+  tcp_socket              m_socket;
+  
+  /*! \brief Flag telling the server thread to stop. */
+  std::atomic<bool>       m_stopping;
+  
+  /*! \brief The thread accepting connections. */
+  std::thread             m_thread;
+  
+  /*! \brief The client connections. */
+  std::list<connection*>  m_connections;
+  
+  /*! \brief Where a copy of every chunk in the archive is stored, by the
+   *         chunk's digest. */
+  std::unordered_map<std::string, chunk_location> m_chunks;
+  
+  /*! \brief Mutex guarding \ref m_connections, \ref m_chunks, the index
+   *         file, and adding files to the store. */
+  std::mutex              m_mutex;
+};
+
+#endif /* defined(__STORE_SYNC_SERVER_H__) */
@@ -15,10 +15,19 @@
 
 #include "ws_linkmasta_device.h"
 #include "usb/usb_device.h"
+#include "usb/exception/timeout_exception.h"
 #include "ws_linkmasta_messages.h"
 #include "task/task_controller.h"
 #include "cartridge/ws_cartridge.h"
+#include "common/trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include <limits>
+#include <stdexcept>
+#include <deque>
+#include <vector>
+#include <utility>
 
 using namespace usb;
 
@@ -27,6 +36,7 @@ typedef ws_linkmasta_device::word_t     word_t;
 typedef ws_linkmasta_device::timeout_t  timeout_t;
 typedef ws_linkmasta_device::version_t  version_t;
 typedef ws_linkmasta_device::chip_index chip_index;
+typedef usb_device::endpoint_t           endpoint_t;
 
 #define WS_LINKMASTA_VENDOR_ID          0x20A0
 #define WS_LINKMASTA_PRODUCT_ID         0x4252
@@ -36,7 +46,15 @@ typedef ws_linkmasta_device::chip_index chip_index;
 #define WS_LINKMASTA_USB_ENDPOINT_IN    0x81
 #define WS_LINKMASTA_USB_ENDPOINT_OUT   0x02
 #define WS_LINKMASTA_USB_RXTX_SIZE      64
-#define WS_LINKMASTA_USB_TIMEOUT        2000
+#define WS_LINKMASTA_MAX_RECOVERIES     3
+#define WS_LINKMASTA_WRITE_WINDOW       2
+#define WS_LINKMASTA_SCAN_WINDOW        8
+
+// Size of the linkmasta's own EEPROM, the most bytes a single EEPROM command
+// carries, and how many EEPROM commands are kept queued on the device
+#define WS_LINKMASTA_EEPROM_SIZE        4096
+#define WS_LINKMASTA_EEPROM_PACKET      32
+#define WS_LINKMASTA_EEPROM_WINDOW      8
 
 using namespace wsmsg;
 
@@ -46,8 +64,10 @@ ws_linkmasta_device::ws_linkmasta_device(usb::usb_device* usb_device)
   : m_usb_device(usb_device),
     m_was_init(false), m_is_open(false), m_firmware_version_set(false),
     m_slot_info_set(false), m_firmware_major_version(0),
-    m_firmware_minor_version(0), m_static_num_slots(false),
-    m_static_slot_sizes(false)
+    m_firmware_minor_version(0),
+    m_usb_packet_size(WS_LINKMASTA_USB_RXTX_SIZE), m_interrupt_endpoint(ENDPOINT_UNSET_VALUE), m_max_batch_packets(std::numeric_limits<uint8_t>::max()),
+    m_static_num_slots(false),
+    m_static_slot_sizes(false), m_write_window(WS_LINKMASTA_WRITE_WINDOW)
 {
   // Nothing else to do
 }
@@ -56,6 +76,7 @@ ws_linkmasta_device::~ws_linkmasta_device()
 {
   if (m_is_open)
   {
+    end_all_sessions();
     close();
   }
   
@@ -86,12 +107,21 @@ void ws_linkmasta_device::init()
   }
   
   // Set device configuration
-  m_usb_device->set_timeout(WS_LINKMASTA_USB_TIMEOUT);
+  m_usb_device->set_timeout(timeouts().command_ms);
   m_usb_device->set_configuration(WS_LINKMASTA_USB_CONFIGURATION);
   m_usb_device->set_interface(WS_LINKMASTA_USB_INTERFACE);
   m_usb_device->set_input_endpoint(WS_LINKMASTA_USB_ENDPOINT_IN);
   m_usb_device->set_output_endpoint(WS_LINKMASTA_USB_ENDPOINT_OUT);
   
+  // Size batches to the endpoints, treating any that aren't described or
+  // don't hold a whole number of protocol packets as full-speed endpoints
+  unsigned int packet_size = std::min(m_usb_device->max_packet_size(WS_LINKMASTA_USB_ENDPOINT_IN),
+                                      m_usb_device->max_packet_size(WS_LINKMASTA_USB_ENDPOINT_OUT));
+  m_usb_packet_size = (packet_size >= WS_LINKMASTA_USB_RXTX_SIZE && packet_size % WS_LINKMASTA_USB_RXTX_SIZE == 0 ? packet_size : WS_LINKMASTA_USB_RXTX_SIZE);
+  
+  // Firmware that notifies of finished erases does so on an interrupt endpoint
+  // of its own, which current devices don't describe
+  m_interrupt_endpoint = (m_usb_device->supports_interrupt_reads() ? m_usb_device->find_interrupt_in_endpoint() : ENDPOINT_UNSET_VALUE);
   m_was_init = true;
 }
 
@@ -148,7 +178,18 @@ void ws_linkmasta_device::set_timeout(timeout_t timeout)
     throw std::runtime_error("ERROR: Object not initialized");
   }
   
-  return m_usb_device->set_timeout(timeout);
+  timeout_profile profile = timeouts();
+  profile.command_ms = timeout;
+  set_timeouts(profile);
+}
+
+void ws_linkmasta_device::set_timeouts(const timeout_profile& profile)
+{
+  linkmasta_device::set_timeouts(profile);
+  if (m_was_init)
+  {
+    m_usb_device->set_timeout(profile.command_ms);
+  }
 }
 
 void ws_linkmasta_device::open()
@@ -168,6 +209,36 @@ void ws_linkmasta_device::open()
   m_usb_device->open();
   
   m_is_open = true;
+  
+  // Label the device's metrics once its serial number can be read
+  std::string serial;
+  try
+  {
+    serial = m_usb_device->get_serial_number();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+  }
+  bind_metrics(serial);
+  
+  // Turn on the protocol features the firmware offers. Firmware that can't
+  // report its version only gets the features every version offers
+  firmware_capabilities capabilities;
+  try
+  {
+    fetch_firmware_version();
+    capabilities = negotiate_capabilities(system(), m_firmware_major_version, m_firmware_minor_version);
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+  }
+  set_capabilities(capabilities);
+  
+  // Batch lengths are sent as a single byte
+  m_max_batch_packets = std::min(capabilities.max_batch_packets, (unsigned int) std::numeric_limits<uint8_t>::max());
+  start_batch_tuning(serial, m_max_batch_packets, m_usb_packet_size / WS_LINKMASTA_USB_RXTX_SIZE);
 }
 
 void ws_linkmasta_device::close()
@@ -184,11 +255,52 @@ void ws_linkmasta_device::close()
     return;
   }
   
+  // Leave the device open for the rest of the session
+  if (defer_close())
+  {
+    return;
+  }
+  
+  // The cartridge may be swapped while the device is closed
+  forget_cartridge_state();
+  
   m_usb_device->close();
   
   m_is_open = false;
 }
 
+bool ws_linkmasta_device::recover_connection()
+{
+  count_reconnect();
+  
+  // Whichever commands made it to the chips left them in unknown modes
+  forget_chip_modes();
+  
+  try
+  {
+    if (!m_usb_device->recover())
+    {
+      return false;
+    }
+    
+    // Replies are back in step once the firmware answers as it did on open
+    unsigned int major_version = m_firmware_major_version;
+    unsigned int minor_version = m_firmware_minor_version;
+    fetch_firmware_version();
+    return m_firmware_major_version == major_version && m_firmware_minor_version == minor_version;
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    return false;
+  }
+}
+
+void ws_linkmasta_device::abort_usb_transfers()
+{
+  m_usb_device->abort_pending_transfers();
+}
+
 word_t ws_linkmasta_device::read_word(chip_index chip, address_t address)
 {
   // Make sure we are in a ready state
@@ -203,6 +315,7 @@ word_t ws_linkmasta_device::read_word(chip_index chip, address_t address)
   
   uint8_t data;
   data_t buffer[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
+  trace_scope trace(TRACE_COMMAND, WS_LINKMASTA_USB_RXTX_SIZE);
   
   build_read8_command(buffer, address, chip);
   m_usb_device->write(buffer, WS_LINKMASTA_USB_RXTX_SIZE);
@@ -230,10 +343,14 @@ void ws_linkmasta_device::write_word(chip_index chip, address_t address, word_t
     throw std::runtime_error("Device not opened");
   }
   
+  on_chip_command(chip);
+  
   uint8_t result;
   data_t buffer[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
+  trace_scope trace(TRACE_COMMAND, WS_LINKMASTA_USB_RXTX_SIZE);
   
   build_write8_command(buffer, address, data, chip);
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
   m_usb_device->write(buffer, WS_LINKMASTA_USB_RXTX_SIZE);
   
   m_usb_device->read(buffer, WS_LINKMASTA_USB_RXTX_SIZE);
@@ -242,6 +359,85 @@ void ws_linkmasta_device::write_word(chip_index chip, address_t address, word_t
   {
     throw std::runtime_error("Error occured while attempting to write word");
   }
+  record_latency(LATENCY_WORD_WRITE, started);
+}
+
+void ws_linkmasta_device::run_word_sequence(chip_index chip, word_command* commands, unsigned int num_commands)
+{
+  // Make sure we are in a ready state
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Device not initialized");
+  }
+  if (!m_is_open)
+  {
+    throw std::runtime_error("Device not opened");
+  }
+  
+  on_chip_command(chip, commands, num_commands);
+  
+  data_t               buffer[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
+  std::vector<data_t>  replies(num_commands * WS_LINKMASTA_USB_RXTX_SIZE);
+  unsigned int         max_pending = m_usb_device->max_pending_transfers();
+  unsigned int         sent = 0;      // Commands sent to the device
+  unsigned int         received = 0;  // Replies received from the device
+  trace_scope          trace(TRACE_COMMAND, num_commands * WS_LINKMASTA_USB_RXTX_SIZE);
+  
+  try
+  {
+    while (received < num_commands)
+    {
+      // Send commands ahead of their replies, keeping a read queued for each
+      while (sent < num_commands && m_usb_device->num_pending_transfers() < max_pending)
+      {
+        if (commands[sent].type == WORD_READ)
+        {
+          build_read8_command(buffer, commands[sent].address, chip);
+        }
+        else
+        {
+          build_write8_command(buffer, commands[sent].address, commands[sent].data, chip);
+        }
+        m_usb_device->write(buffer, WS_LINKMASTA_USB_RXTX_SIZE);
+        m_usb_device->submit_read(&replies[sent * WS_LINKMASTA_USB_RXTX_SIZE], WS_LINKMASTA_USB_RXTX_SIZE);
+        ++sent;
+      }
+      
+      if (m_usb_device->complete_transfer() != WS_LINKMASTA_USB_RXTX_SIZE)
+      {
+        throw std::runtime_error("Unexpected number of bytes received from USB device");
+      }
+      
+      // Check the reply of the oldest outstanding command
+      data_t* reply = &replies[received * WS_LINKMASTA_USB_RXTX_SIZE];
+      if (commands[received].type == WORD_READ)
+      {
+        address_t address;
+        uint8_t data;
+        if (!get_read8_reply(reply, &address, &data))
+        {
+          throw std::runtime_error("Error occured while attempting to read word");
+        }
+        commands[received].data = data;
+      }
+      else
+      {
+        uint8_t result;
+        get_result_reply(reply, &result);
+        if (result != MSG_RESULT_SUCCESS)
+        {
+          throw std::runtime_error("Error occured while attempting to write word");
+        }
+      }
+      ++received;
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    m_usb_device->cancel_pending_transfers();
+    throw;
+  }
 }
 
 bool ws_linkmasta_device::test_for_cartridge()
@@ -288,7 +484,78 @@ bool ws_linkmasta_device::supports_switch_slot() const
   return true;
 }
 
+bool ws_linkmasta_device::supports_word_sequence() const
+{
+  return true;
+}
 
+bool ws_linkmasta_device::supports_erase_notification() const
+{
+  return (m_is_open && capabilities().erase_status_notification && m_interrupt_endpoint != ENDPOINT_UNSET_VALUE);
+}
+
+bool ws_linkmasta_device::wait_for_erase_notification(chip_index chip, unsigned int timeout_ms)
+{
+  // Make sure we are in a ready state
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Device not initialized");
+  }
+  if (!m_is_open)
+  {
+    throw std::runtime_error("Device not opened");
+  }
+  if (!supports_erase_notification())
+  {
+    throw std::runtime_error("ERROR: NOT SUPPORTED");
+  }
+  
+  data_t buffer[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+  while (true)
+  {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining <= 0)
+    {
+      return false;
+    }
+    
+    unsigned int num_bytes;
+    try
+    {
+      num_bytes = m_usb_device->read_interrupt(m_interrupt_endpoint, buffer, WS_LINKMASTA_USB_RXTX_SIZE, (timeout_t) remaining);
+    }
+    catch (usb::timeout_exception& ex)
+    {
+      (void) ex;
+      return false;
+    }
+    
+    // Notifications left over from other chips' erases are of no use to
+    // anyone, since whoever erased them is polling by now
+    uint8_t notified_chip;
+    if (num_bytes >= 2 && get_erase_done_message(buffer, &notified_chip) && notified_chip == (uint8_t) chip)
+    {
+      return true;
+    }
+  }
+}
+
+
+
+word_t ws_linkmasta_device::read_erase_status(chip_index chip, address_t address)
+{
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Device not initialized");
+  }
+  
+  scoped_timeout poll_timeout(m_usb_device, timeouts().erase_poll_ms);
+  std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+  word_t status = read_word(chip, address);
+  record_latency(LATENCY_ERASE_POLL, started);
+  return status;
+}
 
 unsigned int ws_linkmasta_device::read_bytes(chip_index chip, address_t start_address, data_t *buffer, unsigned int num_bytes, task_controller* controller)
 {
@@ -302,9 +569,22 @@ unsigned int ws_linkmasta_device::read_bytes(chip_index chip, address_t start_ad
     throw std::runtime_error("Device not opened");
   }
   
+  // EEPROM saves have commands of their own
+  if (chip == target_enum::TARGET_EEPROM)
+  {
+    return read_eeprom(start_address, buffer, num_bytes, controller);
+  }
+  
+  // Metadata read before answers without the device
+  if (controller == nullptr && read_cached(chip, start_address, buffer, num_bytes))
+  {
+    return num_bytes;
+  }
+  
   // Some working variables
   data_t   _buffer[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
   unsigned int offset = 0;
+  unsigned int num_recoveries = 0;
   
   // Inform the controller that the task has begun
   if (controller != nullptr)
@@ -312,34 +592,87 @@ unsigned int ws_linkmasta_device::read_bytes(chip_index chip, address_t start_ad
     controller->on_task_start(num_bytes);
   }
   
+  // Cancelling can abort the transfers from here on
+  abortable_read abortable(this, controller);
+  
   // Get as many bytes of data as possible in packets of 64
   while ((num_bytes - offset) / WS_LINKMASTA_USB_RXTX_SIZE >= 1
          && (controller == nullptr || !controller->is_task_cancelled()))
   {
     // Calculate number of packets. Don't go over packet limit
-    unsigned int num_packets = (num_bytes - offset) / WS_LINKMASTA_USB_RXTX_SIZE;
-    if (num_packets > std::numeric_limits<uint8_t>::max())
-    {
-      num_packets = std::numeric_limits<uint8_t>::max();
-    }
+    unsigned int num_packets = next_batch_packets(num_bytes - offset, BATCH_READ);
     
-    build_read64xN_command(_buffer, start_address + offset, num_packets, chip);
-    m_usb_device->write(_buffer, WS_LINKMASTA_USB_RXTX_SIZE);
-    
-    for (unsigned int packets_i = 0; packets_i < num_packets; ++packets_i)
+    trace_scope trace(TRACE_DATA, num_packets * WS_LINKMASTA_USB_RXTX_SIZE);
+    count_batch();
+    unsigned int batch_size = num_packets * WS_LINKMASTA_USB_RXTX_SIZE;
+    auto batch_start = std::chrono::steady_clock::now();
+    try
     {
-      // Get response from device and write directly to buffer
-      if (m_usb_device->read(&buffer[offset], WS_LINKMASTA_USB_RXTX_SIZE) != WS_LINKMASTA_USB_RXTX_SIZE)
+      build_read64xN_command(_buffer, start_address + offset, num_packets, chip);
+      m_usb_device->write(_buffer, WS_LINKMASTA_USB_RXTX_SIZE);
+      
+      // Get the whole batch in a single bulk transfer, written directly to
+      // buffer, so that the host controller can pack the packets back to back
+      if (m_usb_device->read(&buffer[offset], batch_size, batch_timeout(batch_size)) != batch_size)
       {
         throw std::runtime_error("Unexpected number of bytes received");
       }
+      record_batch(BATCH_READ, num_packets, batch_start);
+      num_recoveries = 0;
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
       
-      // Update offset and inform controller of progress
-      offset += WS_LINKMASTA_USB_RXTX_SIZE;
-      if (controller != nullptr)
+      // A cancelled read, whose transfer may have been aborted on purpose,
+      // stops here once the device is back in step
+      if (controller != nullptr && controller->is_task_cancelled())
+      {
+        if (recover_connection())
+        {
+          break;
+        }
+        throw;
+      }
+      
+      // Ask for the batch again, smaller if batches adapt, unless the
+      // connection can't be brought back without reopening the device
+      record_batch_failure(BATCH_READ);
+      if (num_recoveries++ < WS_LINKMASTA_MAX_RECOVERIES && recover_connection())
       {
-        controller->on_task_update(task_status::RUNNING, WS_LINKMASTA_USB_RXTX_SIZE);
+        continue;
       }
+      throw;
+    }
+    
+    // Update offset and inform controller of progress
+    offset += batch_size;
+    if (controller != nullptr)
+    {
+      controller->on_task_update(task_status::RUNNING, batch_size);
+    }
+  }
+  
+  // Get the remaining bytes with one packet ending on the last byte rather
+  // than a byte at a time
+  if (num_bytes - offset > 0 && num_bytes >= WS_LINKMASTA_USB_RXTX_SIZE
+      && (controller == nullptr || !controller->is_task_cancelled()))
+  {
+    build_read64xN_command(_buffer, start_address + num_bytes - WS_LINKMASTA_USB_RXTX_SIZE, 1, chip);
+    m_usb_device->write(_buffer, WS_LINKMASTA_USB_RXTX_SIZE);
+    if (m_usb_device->read(_buffer, WS_LINKMASTA_USB_RXTX_SIZE) != WS_LINKMASTA_USB_RXTX_SIZE)
+    {
+      throw std::runtime_error("Unexpected number of bytes received");
+    }
+    
+    unsigned int num_remaining = num_bytes - offset;
+    memcpy(&buffer[offset], &_buffer[WS_LINKMASTA_USB_RXTX_SIZE - num_remaining], num_remaining);
+    
+    // Update offset and inform controller of progress
+    offset = num_bytes;
+    if (controller != nullptr)
+    {
+      controller->on_task_update(task_status::RUNNING, num_remaining);
     }
   }
   
@@ -371,6 +704,14 @@ unsigned int ws_linkmasta_device::read_bytes(chip_index chip, address_t start_ad
     }
   }
   
+  // Check for packets that were corrupted on the way
+  abortable.end();
+  verify_read(chip, start_address, buffer, offset);
+  if (controller == nullptr)
+  {
+    cache_read(chip, start_address, buffer, offset);
+  }
+  
   // Inform controller that task is complete
   if (controller != nullptr)
   {
@@ -392,6 +733,12 @@ unsigned int ws_linkmasta_device::program_bytes(chip_index chip, address_t start
     throw std::runtime_error("Device not opened");
   }
   
+  // EEPROM saves have commands of their own
+  if (chip == target_enum::TARGET_EEPROM)
+  {
+    return program_eeprom(start_address, buffer, num_bytes, controller);
+  }
+  
   // Validate chip index
   if (chip != target_enum::TARGET_ROM
       && chip != target_enum::TARGET_SRAM)
@@ -399,79 +746,121 @@ unsigned int ws_linkmasta_device::program_bytes(chip_index chip, address_t start
     throw std::invalid_argument("Unexpected chip value " + std::to_string(chip));
   }
   
+  on_chip_command(chip);
+  
   // Some working variables
   data_t   _buffer[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
   unsigned int offset = 0;
   uint8_t  result;
   
+  // Batches that have been sent but whose replies have not yet been checked.
+  // Only firmware that pipelines acknowledgements can have more than one
+  std::deque<std::pair<address_t, unsigned int>> unchecked_batches;
+  unsigned int write_window = (capabilities().pipelined_acks ? m_write_window : 1);
+  
   // Inform controller that task has started
   if (controller != nullptr)
   {
     controller->on_task_start(num_bytes);
   }
   
-  // Read in packets of 64 bytes
-  while ((num_bytes - offset) / WS_LINKMASTA_USB_RXTX_SIZE >= 1
-         && (controller == nullptr || !controller->is_task_cancelled()))
+  // Each batch is timed from the reply before it, which with a window of
+  // batches in flight is how often batches complete
+  auto last_reply = std::chrono::steady_clock::now();
+  try
   {
-    // Makes sure we don't go over the packet limit
-    unsigned int num_packets = (num_bytes - offset) / WS_LINKMASTA_USB_RXTX_SIZE;
-    if (num_packets > std::numeric_limits<uint8_t>::max())
-    {
-      num_packets = std::numeric_limits<uint8_t>::max();
-    }
-    
-    // Treat writes to flash and sram differently
-    switch (chip)
+    // Read in packets of 64 bytes
+    while ((num_bytes - offset) / WS_LINKMASTA_USB_RXTX_SIZE >= 1
+           && (controller == nullptr || !controller->is_task_cancelled()))
     {
-    case target_enum::TARGET_ROM:
-      build_flash_write64xN_command(_buffer, start_address + offset, num_packets);
-      break;
+      // Makes sure we don't go over the packet limit
+      unsigned int num_packets = next_batch_packets(num_bytes - offset, BATCH_WRITE);
       
-    case target_enum::TARGET_SRAM:
-      build_sram_write64xN_command(_buffer, start_address + offset, num_packets);
-      break;
-    }
-    m_usb_device->write(_buffer, WS_LINKMASTA_USB_RXTX_SIZE);
-    
-    // Send chunks of 64 bytes to device
-    for (unsigned int packet_i = 0; packet_i < num_packets; ++packet_i)
-    {
-      // Tread writes to flash and sram differently
-      switch (chip)
       {
-      case target_enum::TARGET_ROM:
-        build_flash_write64xN_data_packet(_buffer, &buffer[offset]);
-        break;
+        trace_scope trace(TRACE_DATA, num_packets * WS_LINKMASTA_USB_RXTX_SIZE);
+        count_batch();
+        // Treat writes to flash and sram differently
+        switch (chip)
+        {
+        case target_enum::TARGET_ROM:
+          build_flash_write64xN_command(_buffer, start_address + offset, num_packets);
+          break;
+        
+        case target_enum::TARGET_SRAM:
+          build_sram_write64xN_command(_buffer, start_address + offset, num_packets);
+          break;
+        }
+        m_usb_device->write(_buffer, WS_LINKMASTA_USB_RXTX_SIZE);
         
-      case target_enum::TARGET_SRAM:
-        build_sram_write64xN_data_packet(_buffer, &buffer[offset]);
-        break;
+        // Data packets for both flash and sram are the raw bytes, so send
+        // every packet straight from the buffer in a single bulk transfer
+        unsigned int batch_size = num_packets * WS_LINKMASTA_USB_RXTX_SIZE;
+        if (m_usb_device->write(&buffer[offset], batch_size, batch_timeout(batch_size)) != batch_size)
+        {
+          throw std::runtime_error("Unexpected number of bytes sent");
+        }
+        
+        // Update offset and inform controller of progress
+        offset += batch_size;
+        if (controller != nullptr)
+        {
+          controller->on_task_update(task_status::RUNNING, batch_size);
+        }
       }
-
-      m_usb_device->write(_buffer, WS_LINKMASTA_USB_RXTX_SIZE);
       
-      // Update offset and inform controller of progress
-      offset += WS_LINKMASTA_USB_RXTX_SIZE;
-      if (controller != nullptr)
+      // Defer verification until the window is full so that the device can
+      // begin working on the next batch while we wait for its reply
+      unchecked_batches.push_back(std::make_pair(start_address + offset - num_packets * WS_LINKMASTA_USB_RXTX_SIZE, num_packets));
+      while (unchecked_batches.size() >= write_window)
       {
-        controller->on_task_update(task_status::RUNNING, WS_LINKMASTA_USB_RXTX_SIZE);
+        check_write64xN_reply(unchecked_batches.front().first, unchecked_batches.front().second, controller, offset);
+        record_batch(BATCH_WRITE, unchecked_batches.front().second, last_reply);
+        last_reply = std::chrono::steady_clock::now();
+        unchecked_batches.pop_front();
       }
     }
     
-    // Verify that operaton worked
-    uint8_t packets_processed;
-    m_usb_device->read(_buffer, WS_LINKMASTA_USB_RXTX_SIZE);
-    get_write64xN_reply(_buffer, &result, &packets_processed);
+    // Verify any batches still awaiting a reply
+    while (!unchecked_batches.empty())
+    {
+      check_write64xN_reply(unchecked_batches.front().first, unchecked_batches.front().second, controller, offset);
+      record_batch(BATCH_WRITE, unchecked_batches.front().second, last_reply);
+      last_reply = std::chrono::steady_clock::now();
+      unchecked_batches.pop_front();
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    record_batch_failure(BATCH_WRITE);
+    throw;
+  }
+  
+  // Finish an SRAM write with one packet ending on the last byte rather than
+  // a byte at a time. Rewriting the bytes it overlaps is harmless in SRAM
+  if (num_bytes - offset > 0 && num_bytes >= WS_LINKMASTA_USB_RXTX_SIZE
+      && chip == target_enum::TARGET_SRAM
+      && (controller == nullptr || !controller->is_task_cancelled()))
+  {
+    address_t tail_address = start_address + num_bytes - WS_LINKMASTA_USB_RXTX_SIZE;
     
-    if(result != MSG_WRITE64xN_REPLY)
+    build_sram_write64xN_command(_buffer, tail_address, 1);
+    m_usb_device->write(_buffer, WS_LINKMASTA_USB_RXTX_SIZE);
+    
+    // The data packet is the raw bytes, so send it straight from the buffer
+    // rather than copying it into the command buffer first
+    if (m_usb_device->write(&buffer[num_bytes - WS_LINKMASTA_USB_RXTX_SIZE], WS_LINKMASTA_USB_RXTX_SIZE) != WS_LINKMASTA_USB_RXTX_SIZE)
     {
-      throw std::runtime_error("Unexpected reply from device");
+      throw std::runtime_error("Unexpected number of bytes sent");
     }
-    if(packets_processed != num_packets)
+    check_write64xN_reply(tail_address, 1, controller, offset);
+    
+    // Update offset and inform controller of progress
+    if (controller != nullptr)
     {
-      throw std::runtime_error("Unexpected number of packets processed");
+      controller->on_task_update(task_status::RUNNING, num_bytes - offset);
     }
+    offset = num_bytes;
   }
   
   // If at least 32 bytes remain, write them
@@ -507,13 +896,13 @@ unsigned int ws_linkmasta_device::program_bytes(chip_index chip, address_t start
     {
     case target_enum::TARGET_ROM:
       {
-        unsigned int num_bytes_ = num_bytes;
+        unsigned int num_bytes_ = num_bytes - offset;
         if (num_bytes_ > WS_LINKMASTA_USB_RXTX_SIZE / 2)
         {
           num_bytes_ = (WS_LINKMASTA_USB_RXTX_SIZE / 2);
         }
         
-        build_flash_write_N_command(_buffer, start_address + offset, &buffer[offset], num_bytes_ - offset);
+        build_flash_write_N_command(_buffer, start_address + offset, &buffer[offset], num_bytes_);
         m_usb_device->write(_buffer, WS_LINKMASTA_USB_RXTX_SIZE);
         
         // Verify that operation worked
@@ -529,14 +918,14 @@ unsigned int ws_linkmasta_device::program_bytes(chip_index chip, address_t start
         }
         
         // Update offset and inform controller of progress
-        offset += num_bytes_ - offset;
+        offset += num_bytes_;
         if (controller != nullptr)
         {
-          controller->on_task_end(task_status::RUNNING, num_bytes - offset);
+          controller->on_task_update(task_status::RUNNING, num_bytes_);
         }
       }
       break;
-      
+    
     case target_enum::TARGET_SRAM:
       {
         build_write8_command(_buffer, start_address + offset, buffer[offset], chip);
@@ -573,6 +962,16 @@ unsigned int ws_linkmasta_device::program_bytes(chip_index chip, address_t start
   return offset;
 }
 
+unsigned int ws_linkmasta_device::write_window() const
+{
+  return m_write_window;
+}
+
+void ws_linkmasta_device::set_write_window(unsigned int num_batches)
+{
+  m_write_window = (num_batches == 0 ? 1 : num_batches);
+}
+
 unsigned int ws_linkmasta_device::read_num_slots()
 {
   // Make sure object has been initialized at least
@@ -650,7 +1049,93 @@ bool ws_linkmasta_device::switch_slot(unsigned int slot_num)
   uint8_t result;
   get_result_reply(buffer, &result);
   
-  return (result == MSG_RESULT_SUCCESS);
+  if (result != MSG_RESULT_SUCCESS)
+  {
+    return false;
+  }
+  set_read_cache_slot(slot_num);
+  return true;
+}
+
+void ws_linkmasta_device::read_slot_footers(chip_index chip, unsigned int num_bytes, data_t* buffer, unsigned int final_slot)
+{
+  // Make sure object has been initialized at least
+  if (!m_was_init)
+  {
+    throw std::runtime_error("Device not initialized");
+  }
+  if (!m_is_open)
+  {
+    throw std::runtime_error("Device not opened");
+  }
+  
+  unsigned int num_slots = read_num_slots();
+  bool fits = (num_bytes <= WS_LINKMASTA_USB_RXTX_SIZE);
+  for (unsigned int slot = 0; fits && slot < num_slots; ++slot)
+  {
+    fits = (read_slot_size(slot) >= WS_LINKMASTA_USB_RXTX_SIZE);
+  }
+  if (!fits)
+  {
+    linkmasta_device::read_slot_footers(chip, num_bytes, buffer, final_slot);
+    return;
+  }
+  if (read_cached_slot_footers(chip, num_bytes, buffer, final_slot))
+  {
+    return;
+  }
+  
+  // Every slot takes a switch followed by a read of its last packet, with one
+  // more switch at the end. Replies come back in the order the commands were
+  // sent, so commands are kept queued ahead of the replies being collected
+  trace_scope trace(TRACE_DATA, num_slots * WS_LINKMASTA_USB_RXTX_SIZE);
+  count_batch();
+  unsigned int num_commands = num_slots * 2 + 1;
+  unsigned int num_sent = 0;
+  data_t _buffer[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
+  
+  for (unsigned int num_received = 0; num_received < num_commands; ++num_received)
+  {
+    while (num_sent < num_commands && num_sent - num_received < WS_LINKMASTA_SCAN_WINDOW)
+    {
+      // Commands only set the fields they use, so each starts from a clean packet
+      data_t command[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
+      unsigned int slot = num_sent / 2;
+      if (num_sent % 2 == 0)
+      {
+        build_set_cartslot_command(command, (unsigned char) (slot < num_slots ? slot : final_slot));
+      }
+      else
+      {
+        build_read64xN_command(command, read_slot_size(slot) - WS_LINKMASTA_USB_RXTX_SIZE, 1, chip);
+      }
+      m_usb_device->write(command, WS_LINKMASTA_USB_RXTX_SIZE);
+      ++num_sent;
+    }
+    
+    if (m_usb_device->read(_buffer, WS_LINKMASTA_USB_RXTX_SIZE) != WS_LINKMASTA_USB_RXTX_SIZE)
+    {
+      throw std::runtime_error("Unexpected number of bytes received");
+    }
+    
+    if (num_received % 2 == 0)
+    {
+      uint8_t result;
+      get_result_reply(_buffer, &result);
+      if (result != MSG_RESULT_SUCCESS)
+      {
+        throw std::runtime_error("Error occured while attempting to switch slot");
+      }
+    }
+    else
+    {
+      memcpy(&buffer[(num_received / 2) * num_bytes], &_buffer[WS_LINKMASTA_USB_RXTX_SIZE - num_bytes], num_bytes);
+    }
+  }
+  
+  // The scan ended on the final slot
+  set_read_cache_slot(final_slot);
+  cache_slot_footers(chip, num_bytes, buffer);
 }
 
 
@@ -680,6 +1165,20 @@ void ws_linkmasta_device::fetch_firmware_version()
   m_firmware_version_set = true;
 }
 
+unsigned int ws_linkmasta_device::next_batch_packets(unsigned int num_bytes, batch_direction direction) const
+{
+  unsigned int num_packets = std::min(num_bytes / WS_LINKMASTA_USB_RXTX_SIZE, batch_packets(direction));
+  
+  // Keep batches to whole USB packets so that only the last transfer of a
+  // read can end on a short packet
+  unsigned int packets_per_usb_packet = m_usb_packet_size / WS_LINKMASTA_USB_RXTX_SIZE;
+  if (num_packets > packets_per_usb_packet)
+  {
+    num_packets -= num_packets % packets_per_usb_packet;
+  }
+  return num_packets;
+}
+
 void ws_linkmasta_device::fetch_slot_info()
 {
   data_t buffer[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
@@ -704,4 +1203,185 @@ void ws_linkmasta_device::fetch_slot_info()
   m_static_slot_sizes = (isSlotSizeFixed == 1);
   m_num_slots = (unsigned int) numSlotsPerCart;
   m_slot_size = 1 << numAddrLinesPerSlot;
+  m_slot_info_set = true;
+}
+
+void ws_linkmasta_device::check_write64xN_reply(address_t batch_address, unsigned int num_packets, task_controller* controller, unsigned int bytes_sent)
+{
+  data_t   _buffer[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
+  uint8_t  result;
+  uint8_t  packets_processed;
+  
+  // The reply only comes once the whole batch is programmed
+  {
+    trace_scope trace(TRACE_ACK, WS_LINKMASTA_USB_RXTX_SIZE);
+    m_usb_device->read(_buffer, WS_LINKMASTA_USB_RXTX_SIZE, batch_timeout(num_packets * WS_LINKMASTA_USB_RXTX_SIZE));
+  }
+  get_write64xN_reply(_buffer, &result, &packets_processed);
+  
+  if (result != MSG_WRITE64xN_REPLY)
+  {
+    if (controller != nullptr)
+    {
+      controller->on_task_end(task_status::ERROR, bytes_sent);
+    }
+    throw std::runtime_error("Unexpected reply from device");
+  }
+  if (packets_processed != num_packets)
+  {
+    if (controller != nullptr)
+    {
+      controller->on_task_end(task_status::ERROR, bytes_sent);
+    }
+    throw std::runtime_error("Unexpected number of packets processed: device "
+      "programmed " + std::to_string(packets_processed) + " of "
+      + std::to_string(num_packets) + " packets in batch starting at address "
+      + std::to_string(batch_address));
+  }
+}
+
+unsigned int ws_linkmasta_device::read_eeprom(address_t start_address, data_t* buffer, unsigned int num_bytes, task_controller* controller)
+{
+  if (start_address > WS_LINKMASTA_EEPROM_SIZE || num_bytes > WS_LINKMASTA_EEPROM_SIZE - start_address)
+  {
+    throw std::invalid_argument("EEPROM range out of bounds");
+  }
+  
+  // Inform the controller that the task has begun
+  if (controller != nullptr)
+  {
+    controller->on_task_start(num_bytes);
+  }
+  
+  // Replies come back in the order the commands were sent, so commands are
+  // kept queued ahead of the replies being collected
+  trace_scope trace(TRACE_DATA, num_bytes);
+  count_batch();
+  unsigned int num_commands = (num_bytes + WS_LINKMASTA_EEPROM_PACKET - 1) / WS_LINKMASTA_EEPROM_PACKET;
+  unsigned int num_sent = 0;
+  unsigned int offset = 0;
+  data_t _buffer[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
+  
+  for (unsigned int num_received = 0; num_received < num_commands; ++num_received)
+  {
+    // Stop sending once cancelled, but collect the replies already asked for
+    // so the device stays in step
+    while (num_sent < num_commands && num_sent - num_received < WS_LINKMASTA_EEPROM_WINDOW
+           && (controller == nullptr || !controller->is_task_cancelled()))
+    {
+      // Commands only set the fields they use, so each starts from a clean packet
+      data_t command[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
+      unsigned int chunk_offset = num_sent * WS_LINKMASTA_EEPROM_PACKET;
+      unsigned int chunk_size = std::min(num_bytes - chunk_offset, (unsigned int) WS_LINKMASTA_EEPROM_PACKET);
+      build_eeprom_read_N_command(command, start_address + chunk_offset, (uint8_t) chunk_size);
+      m_usb_device->write(command, WS_LINKMASTA_USB_RXTX_SIZE);
+      ++num_sent;
+    }
+    if (num_received == num_sent)
+    {
+      break;
+    }
+    
+    if (m_usb_device->read(_buffer, WS_LINKMASTA_USB_RXTX_SIZE) != WS_LINKMASTA_USB_RXTX_SIZE)
+    {
+      throw std::runtime_error("Unexpected number of bytes received");
+    }
+    
+    uint8_t addrHB, addrMB, addrLB, n;
+    const uint8_t* payload = get_eeprom_read_N_reply(_buffer, &addrHB, &addrMB, &addrLB, &n);
+    unsigned int chunk_size = std::min(num_bytes - offset, (unsigned int) WS_LINKMASTA_EEPROM_PACKET);
+    if (n != chunk_size)
+    {
+      throw std::runtime_error("Unexpected reply from device");
+    }
+    memcpy(&buffer[offset], payload, chunk_size);
+    
+    // Update offset and inform controller of progress
+    offset += chunk_size;
+    if (controller != nullptr)
+    {
+      controller->on_task_update(task_status::RUNNING, chunk_size);
+    }
+  }
+  
+  // Inform controller that task is complete
+  if (controller != nullptr)
+  {
+    controller->on_task_end(offset < num_bytes && controller->is_task_cancelled() ? task_status::CANCELLED : task_status::COMPLETED, offset);
+  }
+  return offset;
+}
+
+unsigned int ws_linkmasta_device::program_eeprom(address_t start_address, const data_t* buffer, unsigned int num_bytes, task_controller* controller)
+{
+  if (start_address > WS_LINKMASTA_EEPROM_SIZE || num_bytes > WS_LINKMASTA_EEPROM_SIZE - start_address)
+  {
+    throw std::invalid_argument("EEPROM range out of bounds");
+  }
+  
+  // Inform controller that task has started
+  if (controller != nullptr)
+  {
+    controller->on_task_start(num_bytes);
+  }
+  
+  // Only firmware that pipelines acknowledgements is sent the next write
+  // before the previous one is acknowledged
+  trace_scope trace(TRACE_DATA, num_bytes);
+  count_batch();
+  unsigned int window = (capabilities().pipelined_acks ? WS_LINKMASTA_EEPROM_WINDOW : 1);
+  unsigned int num_commands = (num_bytes + WS_LINKMASTA_EEPROM_PACKET - 1) / WS_LINKMASTA_EEPROM_PACKET;
+  unsigned int num_sent = 0;
+  unsigned int offset = 0;
+  data_t _buffer[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
+  
+  for (unsigned int num_received = 0; num_received < num_commands; ++num_received)
+  {
+    // Stop sending once cancelled, but check the writes already sent
+    while (num_sent < num_commands && num_sent - num_received < window
+           && (controller == nullptr || !controller->is_task_cancelled()))
+    {
+      data_t command[WS_LINKMASTA_USB_RXTX_SIZE] = {0};
+      unsigned int chunk_offset = num_sent * WS_LINKMASTA_EEPROM_PACKET;
+      unsigned int chunk_size = std::min(num_bytes - chunk_offset, (unsigned int) WS_LINKMASTA_EEPROM_PACKET);
+      build_eeprom_write_N_command(command, start_address + chunk_offset, &buffer[chunk_offset], (uint8_t) chunk_size);
+      m_usb_device->write(command, WS_LINKMASTA_USB_RXTX_SIZE);
+      ++num_sent;
+    }
+    if (num_received == num_sent)
+    {
+      break;
+    }
+    
+    // Verify that operation worked
+    uint8_t result;
+    {
+      trace_scope ack_trace(TRACE_ACK, WS_LINKMASTA_USB_RXTX_SIZE);
+      m_usb_device->read(_buffer, WS_LINKMASTA_USB_RXTX_SIZE);
+    }
+    get_result_reply(_buffer, &result);
+    if (result != MSG_RESULT_SUCCESS)
+    {
+      if (controller != nullptr)
+      {
+        controller->on_task_end(task_status::ERROR, offset);
+      }
+      throw std::runtime_error("Error occured while attempting to program EEPROM");
+    }
+    
+    // Update offset and inform controller of progress
+    unsigned int chunk_size = std::min(num_bytes - offset, (unsigned int) WS_LINKMASTA_EEPROM_PACKET);
+    offset += chunk_size;
+    if (controller != nullptr)
+    {
+      controller->on_task_update(task_status::RUNNING, chunk_size);
+    }
+  }
+  
+  // Inform controller that task is complete
+  if (controller != nullptr)
+  {
+    controller->on_task_end(offset < num_bytes && controller->is_task_cancelled() ? task_status::CANCELLED : task_status::COMPLETED, offset);
+  }
+  return offset;
 }
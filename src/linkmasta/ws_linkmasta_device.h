@@ -92,6 +92,11 @@ public:
    */
   void             set_timeout(timeout_t timeout);
   
+  /*!
+   *  \see linkmasta_device::set_timeouts(const timeout_profile& profile)
+   */
+  void             set_timeouts(const timeout_profile& profile);
+  
   /*!
    *  \see linkmasta_device::open()
    */
@@ -102,6 +107,11 @@ public:
    */
   void             close();
   
+  /*!
+   *  \see linkmasta_device::recover_connection()
+   */
+  bool             recover_connection();
+  
   /*!
    *  \see linkmasta_device::read_word(chip_index chip, address_t address)
    */
@@ -112,6 +122,11 @@ public:
    */
   void             write_word(chip_index chip, address_t address, word_t data);
   
+  /*!
+   *  \see linkmasta_device::run_word_sequence(chip_index chip, word_command* commands, unsigned int num_commands)
+   */
+  void             run_word_sequence(chip_index chip, word_command* commands, unsigned int num_commands);
+  
   /*!
    *  \see linkmasta_device::test_for_cartridge()
    */
@@ -164,14 +179,47 @@ public:
    */
   bool             supports_switch_slot() const;
   
+  /*!
+   *  \return true
+   *  
+   *  \see linkmasta_device::supports_word_sequence()
+   */
+  bool             supports_word_sequence() const;
+  
+  /*!
+   *  \return true if the firmware offers erase notifications and the device
+   *          has an interrupt endpoint to send them on.
+   *  
+   *  \see linkmasta_device::supports_erase_notification()
+   */
+  bool             supports_erase_notification() const;
+  
+  /*!
+   *  \see linkmasta_device::wait_for_erase_notification(chip_index chip, unsigned int timeout_ms)
+   */
+  bool             wait_for_erase_notification(chip_index chip, unsigned int timeout_ms);
+  
+  /*!
+   *  \see linkmasta_device::read_erase_status(chip_index chip, address_t address)
+   */
+  word_t           read_erase_status(chip_index chip, address_t address);
+  
   
   
   /*!
+   *  \brief Reads bytes from a chip. \ref wsmsg::TARGET_EEPROM reads the
+   *         linkmasta's own EEPROM, where EEPROM saves are kept, through
+   *         \ref read_eeprom().
+   *  
    *  \see linkmasa_device::read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, task_controller* controller = nullptr)
    */
   unsigned int     read_bytes(chip_index chip, address_t start_address, data_t* buffer, unsigned int num_bytes, task_controller* controller = nullptr);
   
   /*!
+   *  \brief Programs bytes to a chip. \ref wsmsg::TARGET_EEPROM writes the
+   *         linkmasta's own EEPROM, where EEPROM saves are kept, through
+   *         \ref program_eeprom().
+   *  
    *  \see linkmasta_device::program_bytes(chip_index chip, address_t start_address, const data_t* buffer, unsigned int num_bytes, bool bypass_mode, task_controller* controller = nullptr)
    */
   unsigned int     program_bytes(chip_index chip, address_t start_address, const data_t* buffer, unsigned int num_bytes, bool bypass_mode, task_controller* controller = nullptr);
@@ -191,6 +239,52 @@ public:
    */
   bool             switch_slot(unsigned int slot_num);
   
+  /*!
+   *  \brief Reads the last bytes of every game slot in one pipelined burst.
+   *  
+   *  Sends the slot switch and a single 64-byte read for every slot without
+   *  waiting for replies in between, keeping a few requests queued on the
+   *  device, then collects the replies in order. Footers larger than a packet
+   *  and slots smaller than one fall back to the one-slot-at-a-time default.
+   *  
+   *  \see linkmasta_device::read_slot_footers(chip_index chip, unsigned int num_bytes, data_t* buffer, unsigned int final_slot)
+   */
+  void             read_slot_footers(chip_index chip, unsigned int num_bytes, data_t* buffer, unsigned int final_slot);
+  
+  /*!
+   *  \brief Gets the number of 64xN write batches that may be outstanding
+   *         before \ref program_bytes() waits for the device's reply.
+   *  
+   *  Gets the number of 64xN write batches that may be sent to the device
+   *  before \ref program_bytes() stops to check the reply of the oldest one. A
+   *  value of 1 means every batch is verified before the next is sent.
+   */
+  unsigned int     write_window() const;
+  
+  /*!
+   *  \brief Sets the number of 64xN write batches that may be outstanding
+   *         before \ref program_bytes() waits for the device's reply.
+   *  
+   *  Sets the number of 64xN write batches that may be outstanding. Larger
+   *  windows let the device program one batch while the next is still being
+   *  transmitted. Replies are still checked in order, and a shortfall in any
+   *  batch causes \ref program_bytes() to throw. A value of 0 is treated as 1.
+   *  Firmware that doesn't pipeline acknowledgements is always sent one batch
+   *  at a time, whatever the window.
+   *  
+   *  \param num_batches The new window size.
+   */
+  void             set_write_window(unsigned int num_batches);
+  
+  
+  
+protected:
+  
+  /*!
+   *  \see linkmasta_device::abort_usb_transfers()
+   */
+  void             abort_usb_transfers();
+  
   
   
 private:
@@ -222,6 +316,79 @@ private:
    */
   void             fetch_slot_info();
   
+  /*!
+   *  \brief Reads and verifies the device's reply to a previously sent 64xN
+   *         write batch.
+   *  
+   *  Reads and verifies the device's reply to a previously sent 64xN write
+   *  batch. If the device reports an unexpected reply or fewer packets
+   *  processed than were sent, the controller (if any) is informed of the
+   *  error and an exception is thrown identifying the failed batch.
+   *  
+   *  \param batch_address The address of the first byte in the batch.
+   *  \param num_packets The number of packets sent in the batch.
+   *  \param controller The controller to notify on failure. Can be nullptr.
+   *  \param bytes_sent The number of bytes sent so far, reported on failure.
+   */
+  void             check_write64xN_reply(address_t batch_address, unsigned int num_packets, task_controller* controller, unsigned int bytes_sent);
+  
+  /*!
+   *  \brief Reads bytes from the linkmasta's EEPROM in a pipelined burst.
+   *  
+   *  Each EEPROM read command carries at most 32 bytes, so rather than waiting
+   *  for each reply before sending the next command, a few commands are kept
+   *  queued on the device while the replies are collected in order, as
+   *  \ref read_slot_footers() does.
+   *  
+   *  \param [in] start_address The address of the first byte to read.
+   *  \param [out] buffer The buffer to read into.
+   *  \param [in] num_bytes The number of bytes to read.
+   *  \param [in] controller The controller to report progress to, or nullptr.
+   *  
+   *  \return The number of bytes read, fewer if cancelled.
+   *  
+   *  \throws std::invalid_argument If the range doesn't fit in the EEPROM.
+   */
+  unsigned int     read_eeprom(address_t start_address, data_t* buffer, unsigned int num_bytes, task_controller* controller);
+  
+  /*!
+   *  \brief Writes bytes to the linkmasta's EEPROM in a pipelined burst.
+   *  
+   *  Sends EEPROM write commands of up to 32 bytes each. Firmware that
+   *  accepts commands while an acknowledgement is pending is sent a few
+   *  commands ahead of the replies being checked, as with 64xN write batches,
+   *  so the device writes one while the next is on its way. Other firmware is
+   *  sent one command at a time.
+   *  
+   *  \param [in] start_address The address of the first byte to write.
+   *  \param [in] buffer The bytes to write.
+   *  \param [in] num_bytes The number of bytes to write.
+   *  \param [in] controller The controller to report progress to, or nullptr.
+   *  
+   *  \return The number of bytes written, fewer if cancelled.
+   *  
+   *  \throws std::invalid_argument If the range doesn't fit in the EEPROM.
+   *  \throws std::runtime_error If the device reports a failed write.
+   */
+  unsigned int     program_eeprom(address_t start_address, const data_t* buffer, unsigned int num_bytes, task_controller* controller);
+  
+  /*!
+   *  \brief Gets the number of packets in the next read64xN or write64xN
+   *         batch.
+   *  
+   *  Gets the number of packets to request or send in the next batch, limited
+   *  to the size given by \ref batch_packets() and, when there is more than a
+   *  USB packet's worth, rounded down to whole USB packets of the device's
+   *  endpoints.
+   *  
+   *  \param [in] num_bytes The number of bytes left to transfer.
+   *  \param [in] direction The direction of the batch.
+   *  
+   *  \return The number of packets in the next batch, or 0 if fewer bytes
+   *          remain than fill a single packet.
+   */
+  unsigned int     next_batch_packets(unsigned int num_bytes, batch_direction direction) const;
+  
   
   
   /*!
@@ -255,6 +422,21 @@ private:
   /*! \brief Cached firmware minor version. */
   unsigned int     m_firmware_minor_version;
   
+  /*!
+   *  \brief The largest packet the device's bulk endpoints carry, always a
+   *         whole number of protocol packets.
+   */
+  unsigned int     m_usb_packet_size;
+  
+  /*!
+   *  \brief The address of the interrupt endpoint erase notifications arrive
+   *         on, or \ref ENDPOINT_UNSET_VALUE if the device has none.
+   */
+  unsigned int     m_interrupt_endpoint;
+  
+  /*! \brief The largest number of packets in a read64xN or write64xN batch. */
+  unsigned int     m_max_batch_packets;
+  
   /*! \brief Cached flag indicating if number of slots will never change. */
   bool             m_static_num_slots;
   
@@ -266,6 +448,9 @@ private:
   
   /*! \brief Cached size of slots on cartridge (if uniform and static). */
   unsigned int     m_slot_size;
+  
+  /*! \brief Number of 64xN write batches allowed to await a reply. */
+  unsigned int     m_write_window;
 };
 
 #endif /* defined(__WS_LINKMASTA_DEVICE_H__) */
@@ -41,6 +41,7 @@
 #define MSG_SRAMWRITE64xN_CMD       0x10
 #define MSG_GET_CARTINFO_CMD        0x11
 #define MSG_SET_CARTSLOT_CMD        0x12
+#define MSG_ERASE_DONE              0x20  // sent unasked on the interrupt endpoint
 
 #define MSG_EEPROMWRITE_N_CMD       0x80
 #define MSG_EEPROMREAD_N_CMD        0x81
@@ -77,6 +78,8 @@
 
 #define MSG_TARGET_OFFSET           10
 
+#define MSG_ERASE_CHIP_OFFSET       1
+
 #define MSG_FWRITE_PAYLOAD_OFFSET  32
 
 //when calling build_read64xN_command, this is the recommended value for N
@@ -387,7 +390,7 @@ void build_read64_command(uint8_t *buf, uint32_t addr, uint8_t target_chip)
   build_read64xN_command(buf, addr, 1, target_chip);
 }
 
-void build_eeprom_write_N_command(uint8_t *buf, uint32_t addr_host, uint8_t *data, uint8_t n)
+void build_eeprom_write_N_command(uint8_t *buf, uint32_t addr_host, const uint8_t *data, uint8_t n)
 {
   buf[MSG_TYPE_OFFSET] = MSG_EEPROMWRITE_N_CMD;
   buf[MSG_FWRITE_BYTE_COUNT] = n;
@@ -412,6 +415,16 @@ void build_eeprom_write_N_command(uint8_t *buf, uint32_t addr_host, uint8_t *dat
     buf[MSG_FWRITE_PAYLOAD_OFFSET+i] = data[i];
 }
 
+void build_eeprom_read_N_command(uint8_t *buf, uint32_t addr_host, uint8_t n)
+{
+  buf[MSG_TYPE_OFFSET] = MSG_EEPROMREAD_N_CMD;
+  buf[MSG_FWRITE_BYTE_COUNT] = n;
+  
+  buf[MSG_ADDRHB_OFFSET] = addr_host>>16;
+  buf[MSG_ADDRMB_OFFSET] = addr_host>>8;
+  buf[MSG_ADDRLB_OFFSET] = addr_host;
+}
+
 
 /*void build_SPI_send_recv_command(uint8_t *buf, uint8_t data)
  {
@@ -519,6 +532,12 @@ uint8_t *get_eeprom_write_N_command(uint8_t *buf, uint8_t *addrHB, uint8_t *addr
   return &buf[MSG_FWRITE_PAYLOAD_OFFSET];
 }
 
+//the reply to an eeprom read is laid out like an eeprom write, with the bytes read as its payload
+uint8_t *get_eeprom_read_N_reply(uint8_t *buf, uint8_t *addrHB, uint8_t *addrMB, uint8_t *addrLB, uint8_t *n)
+{
+  return get_eeprom_write_N_command(buf, addrHB, addrMB, addrLB, n);
+}
+
 
 void build_set_addr_command(uint8_t *buf, uint32_t addr_host)
 {
@@ -659,6 +678,16 @@ void get_result_reply(uint8_t *buf, uint8_t *result)
   *result = buf[MSG_TYPE_OFFSET];
 }
 
+bool get_erase_done_message(uint8_t *buf, uint8_t *chip)
+{
+  if (buf[MSG_TYPE_OFFSET] != MSG_ERASE_DONE)
+  {
+    return false;
+  }
+  *chip = buf[MSG_ERASE_CHIP_OFFSET];
+  return true;
+}
+
 void get_blink_led_message(uint8_t *buf, uint8_t *blinkCount)
 {
   *blinkCount = buf[MSG_DATA8_OFFSET];
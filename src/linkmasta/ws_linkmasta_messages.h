@@ -29,7 +29,8 @@ enum target_enum
   TARGET_ROM = 0,             //this is a 0-based word address into ROM
   TARGET_SRAM = 1,            //this is a 0-based byte address into SRAM
   TARGET_PORTIO = 2,          //this is a PORT address
-  TARGET_CART = 3             //this is a raw address that the MBC will map to SRAM/ROM/etc. using its bank register(s)
+  TARGET_CART = 3,            //this is a raw address that the MBC will map to SRAM/ROM/etc. using its bank register(s)
+  TARGET_EEPROM = 4           //this is a 0-based byte address into the linkmasta's own EEPROM, where EEPROM saves are kept. Only used on the host; EEPROM has its own commands
   //TARGET_MICROSD someday?
 };
 
@@ -61,6 +62,7 @@ void build_read16_command(uint8_t *buf, uint32_t addr_host, uint8_t target);
 void build_read64xN_command(uint8_t *buf, uint32_t addr_host, uint8_t n, uint8_t target_chip);
 void build_read64_command(uint8_t *buf, uint32_t addr, uint8_t target_chip);
 void build_eeprom_write_N_command(uint8_t *buf, uint32_t addr_host, const uint8_t *data, uint8_t n);
+void build_eeprom_read_N_command(uint8_t *buf, uint32_t addr_host, uint8_t n);
 
 void build_read8_reply(uint8_t *buf, uint8_t addrHB, uint8_t addrMB, uint8_t addrLB, uint8_t addrNO, uint8_t data);
 void build_read16_reply(uint8_t *buf, uint8_t addrHB, uint8_t addrMB, uint8_t addrLB, uint8_t dataHigh, uint8_t dataLow);
@@ -73,6 +75,7 @@ void get_flash_write64xN_message(uint8_t *buf, uint8_t *addrHB, uint8_t *addrMB,
 void get_sram_write64xN_message(uint8_t *buf, uint8_t *addrHB, uint8_t *addrMB, uint8_t *addrLB, uint8_t *addrNO, uint8_t *n);
 void get_read64xN_message(uint8_t *buf, uint8_t *addrHB, uint8_t *addrMB, uint8_t *addrLB, uint8_t *addrNO, uint8_t *n, uint8_t *targetChip);
 uint8_t *get_eeprom_write_N_command(uint8_t *buf, uint8_t *addrHB, uint8_t *addrMB, uint8_t *addrLB, uint8_t *n);
+uint8_t *get_eeprom_read_N_reply(uint8_t *buf, uint8_t *addrHB, uint8_t *addrMB, uint8_t *addrLB, uint8_t *n);
 
 void build_set_addr_command(uint8_t *buf, uint32_t addr_host);
 void get_set_addr_message(uint8_t *buf, uint8_t *addrHB, uint8_t *addrMB, uint8_t *addrLB, uint8_t *addrNO);
@@ -86,6 +89,7 @@ int get_read8_reply(uint8_t *buf, uint32_t *addr32, uint8_t *data);
 int get_read16_reply(uint8_t *buf, uint32_t *addr32, uint16_t *data);
 void get_write64xN_reply(uint8_t *buf, uint8_t *msgType, uint8_t *packetsProcessed);
 void get_result_reply(uint8_t *buf, uint8_t *result);
+bool get_erase_done_message(uint8_t *buf, uint8_t *chip);
 void get_blink_led_message(uint8_t *buf, uint8_t *blinkCount);
 void get_set_cartslot_command(uint8_t *buf, uint8_t *slot_num);
 
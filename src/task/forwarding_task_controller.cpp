@@ -12,14 +12,20 @@
 #include "forwarding_task_controller.h"
 
 forwarding_task_controller::forwarding_task_controller(task_controller* receiver)
-  : task_controller(), m_receiver(receiver), m_task_work_target(0), m_mutex(new std::mutex())
+  : task_controller(),
+    m_receiver(dynamic_cast<forwarding_task_controller*>(receiver) != nullptr
+               ? dynamic_cast<forwarding_task_controller*>(receiver)->m_receiver
+               : receiver),
+    m_parent(dynamic_cast<forwarding_task_controller*>(receiver)),
+    m_task_work_target(0), m_weight(0)
 {
   // Nothing else to do
 }
 
 forwarding_task_controller::forwarding_task_controller(const forwarding_task_controller& other)
-  : task_controller(other), m_receiver(other.m_receiver),
-    m_task_work_target(other.m_task_work_target), m_mutex(new std::mutex())
+  : task_controller(other), m_receiver(other.m_receiver), m_parent(other.m_parent),
+    m_task_work_target(other.m_task_work_target.load()),
+    m_weight(other.m_weight.load())
 {
   // Nothing else to do
 }
@@ -27,44 +33,76 @@ forwarding_task_controller::forwarding_task_controller(const forwarding_task_con
 forwarding_task_controller::~forwarding_task_controller()
 {
   // Nothing else to do
-  delete m_mutex;
 }
 
 
 
+void forwarding_task_controller::on_task_start(int work_expected)
+{
+  task_controller::on_task_start(work_expected);
+  update_weight();
+}
+
 void forwarding_task_controller::on_task_update(task_status status, int work_progress)
 {
-  m_mutex->lock();
+  unsigned long long prev_progress = (unsigned int) record_task_update(status, work_progress);
+  unsigned long long curr_progress = prev_progress + work_progress;
+  unsigned long long weight = m_weight.load(std::memory_order_relaxed);
   
-  unsigned long long prev_progress = get_task_work_progress();
-  task_controller::on_task_update(status, work_progress);
-  unsigned long long curr_progress = get_task_work_progress();
-  
-  // Calculate scaled progress value
-  int scaled_progress = (int) (curr_progress * m_task_work_target / get_task_expected_work());
-  scaled_progress -= (int) (prev_progress * m_task_work_target / get_task_expected_work());
+  // Scale cumulative progress so that rounding errors don't add up, splitting
+  // the fixed-point weight to avoid overflowing 64 bits
+  unsigned long long weight_int = weight >> 32;
+  unsigned long long weight_frac = weight & 0xFFFFFFFFULL;
+  int scaled_progress = (int) (curr_progress * weight_int + ((curr_progress * weight_frac) >> 32));
+  scaled_progress -= (int) (prev_progress * weight_int + ((prev_progress * weight_frac) >> 32));
   
   m_receiver->on_task_update(status, scaled_progress);
-  
-  m_mutex->unlock();
+}
+
+void forwarding_task_controller::on_task_time_saved(int milliseconds)
+{
+  task_controller::on_task_time_saved(milliseconds);
+  m_receiver->on_task_time_saved(milliseconds);
+}
+
+void forwarding_task_controller::on_task_phase(task_phase phase)
+{
+  task_controller::on_task_phase(phase);
+  m_receiver->on_task_phase(phase);
 }
 
 bool forwarding_task_controller::is_task_cancelled() const
 {
-  m_mutex->lock();
-  
-  auto r = m_receiver->is_task_cancelled();
-  
-  m_mutex->unlock();
-  return r;
+  return m_receiver->is_task_cancelled();
 }
 
 forwarding_task_controller& forwarding_task_controller::scale_work_to(int work_target)
 {
-  m_mutex->lock();
+  m_task_work_target.store(work_target, std::memory_order_relaxed);
+  update_weight();
+  return *this;
+}
+
+
+
+void forwarding_task_controller::update_weight()
+{
+  unsigned long long work_expected = (unsigned int) get_task_expected_work();
+  unsigned long long work_target = (unsigned int) m_task_work_target.load(std::memory_order_relaxed);
+  unsigned long long parent_weight = 1ULL << 32;
+  if (m_parent != nullptr)
+  {
+    parent_weight = m_parent->m_weight.load(std::memory_order_relaxed);
+  }
   
-  m_task_work_target = work_target;
+  if (work_expected == 0)
+  {
+    m_weight.store(0, std::memory_order_relaxed);
+    return;
+  }
   
-  m_mutex->unlock();
-  return *this;
+  // weight = parent_weight * work_target / work_expected without overflowing
+  unsigned long long weight = (parent_weight / work_expected) * work_target;
+  weight += (parent_weight % work_expected) * work_target / work_expected;
+  m_weight.store(weight, std::memory_order_relaxed);
 }
@@ -16,7 +16,7 @@
 #define __FORWARDING_TASK_CONTROLLER_H__
 
 #include "task_controller.h"
-#include <mutex>
+#include <atomic>
 
 /*!
  *  \brief A specialized implementation of \ref task_controller that allows
@@ -28,6 +28,14 @@
  *  the expected work values of the parent task. Automatically scales progress
  *  updates to a predetermined work total.
  *  
+ *  Chains of forwarding task controllers are flattened on construction: when
+ *  the receiver is itself a \ref forwarding_task_controller, updates are sent
+ *  straight to the first receiver up the chain that is not, using a fixed-point
+ *  weight precomputed from the scaling of every link in between. Reporting
+ *  progress therefore costs the same no matter how deeply sub-tasks are nested.
+ *  As a consequence, intermediate forwarding task controllers only count work
+ *  that was reported to them directly.
+ *  
  *  This class is thread-safe and thus can be used for communication between
  *  threads.
  *  
@@ -71,6 +79,20 @@ public:
   
   
   
+  /*!
+   *  \brief Callback for when the task begins execution.
+   *  
+   *  Callback for when the task begins execution. Precomputes the weight used
+   *  to scale this task's progress to the units of the receiver at the top of
+   *  the chain. Not forwarded to the parent \ref task_controller.
+   *  
+   *  \param [in] work_expected The expected amount of work the task will
+   *         perform.
+   *  
+   *  \see task_controller::on_task_start(int work_expected)
+   */
+  virtual void on_task_start(int work_expected);
+  
   /*!
    *  \brief Callback for task status updates.
    *  
@@ -87,6 +109,33 @@ public:
    */
   virtual void on_task_update(task_status status, int work_progress);
   
+  /*!
+   *  \brief Callback for the task to report time saved by an optimization.
+   *  
+   *  Callback for the task to report time saved by an optimization. Calls to
+   *  this method are propagated up to this object's parent
+   *  \ref task_controller object unchanged.
+   *  
+   *  \param [in] milliseconds The estimated number of milliseconds saved.
+   *  
+   *  \see task_controller::on_task_time_saved(int milliseconds)
+   */
+  virtual void on_task_time_saved(int milliseconds);
+  
+  /*!
+   *  \brief Callback for the task to report that it moved on to a different
+   *         kind of work.
+   *  
+   *  Callback for the task to report the phase it is now in. Calls to this
+   *  method are propagated up to this object's parent \ref task_controller
+   *  object unchanged.
+   *  
+   *  \param [in] phase The phase the task is now in.
+   *  
+   *  \see task_controller::on_task_phase(task_phase phase)
+   */
+  virtual void on_task_phase(task_phase phase);
+  
   /*!
    *  \brief Method used by the task to determine if it should self-terminate.
    *  
@@ -126,14 +175,33 @@ public:
   
 private:
   
-  /*! \brief This object's parent \ref task_controller to forward updates to. */
+  /*!
+   *  \brief Recomputes \ref m_weight from the current scaling values.
+   */
+  void update_weight();
+  
+  
+  
+  /*!
+   *  \brief The first \ref task_controller up the chain that is not a
+   *         \ref forwarding_task_controller, to forward updates to.
+   */
   task_controller* const m_receiver;
   
+  /*!
+   *  \brief This object's parent if it is a \ref forwarding_task_controller,
+   *         nullptr otherwise.
+   */
+  const forwarding_task_controller* const m_parent;
+  
   /*! \brief The adjusted expected work value to scale progress updates to. */
-  int m_task_work_target;
+  std::atomic<int> m_task_work_target;
   
-  /*! \brief A thread lock used to keep this class thread-safe. */
-  std::mutex* m_mutex;
+  /*!
+   *  \brief Units of work of \ref m_receiver per unit of work of this task,
+   *         as a 32.32 fixed-point number.
+   */
+  std::atomic<unsigned long long> m_weight;
 };
 
 #endif /* defined(__FORWARDING_TASK_CONTROLLER_H__) */
@@ -9,108 +9,278 @@
  */
 
 #include "task_controller.h"
+#include <chrono>
+#include <cmath>
+
+/*!
+ *  \brief Gets the current time in microseconds of the steady clock.
+ */
+static long long steady_time_us()
+{
+  return (long long) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
 
 task_controller::task_controller()
   : m_task_status(NOT_STARTED), m_task_work_expected(0), m_task_work_total(0),
-    m_task_is_cancelled(false), m_mutex(new std::mutex())
+    m_task_time_saved(0), m_task_is_cancelled(false), m_start_time(0),
+    m_end_time(0), m_task_phase(TASK_PHASE_OTHER), m_phase_start_time(0),
+    m_sample_time(0), m_sample_work(0), m_work_rate(0.0),
+    m_smoothed_work_rate(-1.0), m_sampling(false)
 {
-  // Nothing else to do
+  for (unsigned int i = 0; i < NUM_TASK_PHASES; ++i)
+  {
+    m_phase_time[i].store(0, std::memory_order_relaxed);
+  }
 }
 
 task_controller::task_controller(const task_controller& other)
-  : m_task_status(other.m_task_status),
-    m_task_work_expected(other.m_task_work_expected),
-    m_task_work_total(other.m_task_work_total),
-    m_task_is_cancelled(other.m_task_is_cancelled),
-    m_mutex(new std::mutex())
+  : m_task_status(other.m_task_status.load()),
+    m_task_work_expected(other.m_task_work_expected.load()),
+    m_task_work_total(other.m_task_work_total.load()),
+    m_task_time_saved(other.m_task_time_saved.load()),
+    m_task_is_cancelled(other.m_task_is_cancelled.load()),
+    m_start_time(other.m_start_time.load()),
+    m_end_time(other.m_end_time.load()),
+    m_task_phase(other.m_task_phase.load()),
+    m_phase_start_time(other.m_phase_start_time.load()),
+    m_sample_time(other.m_sample_time.load()),
+    m_sample_work(other.m_sample_work.load()),
+    m_work_rate(other.m_work_rate.load()),
+    m_smoothed_work_rate(other.m_smoothed_work_rate.load()),
+    m_sampling(false)
 {
-  // Nothing else to do
+  for (unsigned int i = 0; i < NUM_TASK_PHASES; ++i)
+  {
+    m_phase_time[i].store(other.m_phase_time[i].load(), std::memory_order_relaxed);
+  }
 }
 
 task_controller::~task_controller()
 {
   // Nothing else to do
-  delete m_mutex;
 }
 
 void task_controller::on_task_start(int work_expected)
 {
-  m_mutex->lock();
-  m_task_status = RUNNING;
-  m_task_work_expected = work_expected;
-  m_task_work_total = 0;
-  m_mutex->unlock();
+  long long now = steady_time_us();
+  
+  m_task_work_expected.store(work_expected, std::memory_order_relaxed);
+  m_task_work_total.store(0, std::memory_order_relaxed);
+  m_task_time_saved.store(0, std::memory_order_relaxed);
+  
+  m_task_phase.store(TASK_PHASE_OTHER, std::memory_order_relaxed);
+  m_phase_start_time.store(now, std::memory_order_relaxed);
+  for (unsigned int i = 0; i < NUM_TASK_PHASES; ++i)
+  {
+    m_phase_time[i].store(0, std::memory_order_relaxed);
+  }
+  m_sample_time.store(now, std::memory_order_relaxed);
+  m_sample_work.store(0, std::memory_order_relaxed);
+  m_work_rate.store(0.0, std::memory_order_relaxed);
+  m_smoothed_work_rate.store(-1.0, std::memory_order_relaxed);
+  m_end_time.store(0, std::memory_order_relaxed);
+  m_start_time.store(now, std::memory_order_relaxed);
+  
+  m_task_status.store(RUNNING, std::memory_order_relaxed);
 }
 
 void task_controller::on_task_update(task_status status, int work_progress)
 {
-  m_mutex->lock();
-  m_task_status = status;
-  m_task_work_total += work_progress;
-  m_mutex->unlock();
+  record_task_update(status, work_progress);
 }
 
 void task_controller::on_task_end(task_status status, int work_total)
 {
-  m_mutex->lock();
-  m_task_status = status;
-  m_task_work_total = work_total;
-  m_mutex->unlock();
+  long long now = steady_time_us();
+  
+  // Close off the phase the task ended in
+  long long phase_start = m_phase_start_time.exchange(now, std::memory_order_relaxed);
+  m_phase_time[m_task_phase.load(std::memory_order_relaxed)].fetch_add(now - phase_start, std::memory_order_relaxed);
+  m_end_time.store(now, std::memory_order_relaxed);
+  
+  m_task_work_total.store(work_total, std::memory_order_relaxed);
+  m_task_status.store(status, std::memory_order_relaxed);
 }
 
-bool task_controller::is_task_cancelled() const
+void task_controller::on_task_time_saved(int milliseconds)
 {
-  m_mutex->lock();
-  auto r = m_task_is_cancelled;
-  m_mutex->unlock();
-  return r;
+  m_task_time_saved.fetch_add(milliseconds, std::memory_order_relaxed);
 }
 
-float task_controller::get_task_progress_percentage() const
+void task_controller::on_task_phase(task_phase phase)
 {
-  m_mutex->lock();
-  float r;
-  if (m_task_work_expected == 0)
+  long long now = steady_time_us();
+  
+  task_phase prev_phase = m_task_phase.exchange(phase, std::memory_order_relaxed);
+  long long phase_start = m_phase_start_time.exchange(now, std::memory_order_relaxed);
+  if (m_start_time.load(std::memory_order_relaxed) != 0 && m_end_time.load(std::memory_order_relaxed) == 0)
   {
-    r = 0.0f;
+    m_phase_time[prev_phase].fetch_add(now - phase_start, std::memory_order_relaxed);
   }
-  else
+}
+
+bool task_controller::is_task_cancelled() const
+{
+  return m_task_is_cancelled.load(std::memory_order_relaxed);
+}
+
+float task_controller::get_task_progress_percentage() const
+{
+  int work_expected = m_task_work_expected.load(std::memory_order_relaxed);
+  if (work_expected == 0)
   {
-    r = ((float) m_task_work_total / (float) m_task_work_expected);
+    return 0.0f;
   }
-  m_mutex->unlock();
-  return r;
+  return ((float) m_task_work_total.load(std::memory_order_relaxed) / (float) work_expected);
 }
 
 
 
 task_status task_controller::get_task_status() const
 {
-  m_mutex->lock();
-  auto r = m_task_status;
-  m_mutex->unlock();
-  return r;
+  return m_task_status.load(std::memory_order_relaxed);
 }
 
 int task_controller::get_task_expected_work() const
 {
-  m_mutex->lock();
-  auto r = m_task_work_expected; 
-  m_mutex->unlock();
-  return r;
+  return m_task_work_expected.load(std::memory_order_relaxed);
 }
 
 int task_controller::get_task_work_progress() const
 {
-  m_mutex->lock();
-  auto r = m_task_work_total;
-  m_mutex->unlock();
-  return r;
+  return m_task_work_total.load(std::memory_order_relaxed);
+}
+
+int task_controller::get_task_time_saved() const
+{
+  return m_task_time_saved.load(std::memory_order_relaxed);
+}
+
+task_phase task_controller::get_task_phase() const
+{
+  return m_task_phase.load(std::memory_order_relaxed);
+}
+
+double task_controller::get_task_seconds_elapsed() const
+{
+  long long start = m_start_time.load(std::memory_order_relaxed);
+  if (start == 0)
+  {
+    return 0.0;
+  }
+  
+  long long end = m_end_time.load(std::memory_order_relaxed);
+  return (double) ((end != 0 ? end : steady_time_us()) - start) / 1e6;
+}
+
+double task_controller::get_task_phase_seconds(task_phase phase) const
+{
+  long long phase_time = m_phase_time[phase].load(std::memory_order_relaxed);
+  
+  // Count the time since the task last entered the phase it is still in
+  if (m_task_phase.load(std::memory_order_relaxed) == phase
+      && m_start_time.load(std::memory_order_relaxed) != 0
+      && m_end_time.load(std::memory_order_relaxed) == 0)
+  {
+    phase_time += steady_time_us() - m_phase_start_time.load(std::memory_order_relaxed);
+  }
+  return (double) phase_time / 1e6;
+}
+
+double task_controller::get_task_work_rate() const
+{
+  if (m_start_time.load(std::memory_order_relaxed) == 0 || m_end_time.load(std::memory_order_relaxed) != 0)
+  {
+    return m_work_rate.load(std::memory_order_relaxed);
+  }
+  
+  // A task that has stopped reporting progress isn't measured anymore, so
+  // measure it here instead
+  long long since_sample = steady_time_us() - m_sample_time.load(std::memory_order_relaxed);
+  if (since_sample >= 2 * TASK_RATE_SAMPLE_MS * 1000LL)
+  {
+    int work = m_task_work_total.load(std::memory_order_relaxed) - m_sample_work.load(std::memory_order_relaxed);
+    return (double) work * 1e6 / (double) since_sample;
+  }
+  return m_work_rate.load(std::memory_order_relaxed);
+}
+
+double task_controller::get_task_smoothed_work_rate() const
+{
+  double rate = m_smoothed_work_rate.load(std::memory_order_relaxed);
+  return (rate < 0.0 ? 0.0 : rate);
+}
+
+double task_controller::get_task_seconds_remaining() const
+{
+  if (m_end_time.load(std::memory_order_relaxed) != 0)
+  {
+    return 0.0;
+  }
+  
+  double rate = m_smoothed_work_rate.load(std::memory_order_relaxed);
+  if (rate <= 0.0)
+  {
+    return -1.0;
+  }
+  
+  int work_remaining = m_task_work_expected.load(std::memory_order_relaxed) - m_task_work_total.load(std::memory_order_relaxed);
+  return (work_remaining > 0 ? (double) work_remaining / rate : 0.0);
 }
 
 void task_controller::cancel_task()
 {
-  m_mutex->lock();
-  m_task_is_cancelled = true;
-  m_mutex->unlock();
+  m_task_is_cancelled.store(true, std::memory_order_relaxed);
+}
+
+
+
+int task_controller::record_task_update(task_status status, int work_progress)
+{
+  m_task_status.store(status, std::memory_order_relaxed);
+  int prev_progress = m_task_work_total.fetch_add(work_progress, std::memory_order_relaxed);
+  update_work_rate(prev_progress + work_progress);
+  return prev_progress;
+}
+
+
+
+void task_controller::update_work_rate(int work_total)
+{
+  const long long sample_us = TASK_RATE_SAMPLE_MS * 1000LL;
+  long long now = steady_time_us();
+  if (m_start_time.load(std::memory_order_relaxed) == 0
+      || now - m_sample_time.load(std::memory_order_relaxed) < sample_us
+      || m_sampling.exchange(true, std::memory_order_acquire))
+  {
+    return;
+  }
+  
+  // Another thread may have measured in the meantime
+  long long elapsed = now - m_sample_time.load(std::memory_order_relaxed);
+  if (elapsed >= sample_us)
+  {
+    double rate = (double) (work_total - m_sample_work.load(std::memory_order_relaxed)) * 1e6 / (double) elapsed;
+    
+    // Weigh the new measurement by how much of the time constant it covers,
+    // so that the average doesn't depend on how often the task reports
+    double smoothed = m_smoothed_work_rate.load(std::memory_order_relaxed);
+    if (smoothed < 0.0)
+    {
+      smoothed = rate;
+    }
+    else
+    {
+      smoothed += (rate - smoothed) * (1.0 - std::exp(-(double) elapsed / (TASK_RATE_SMOOTHING_MS * 1000.0)));
+    }
+    
+    m_work_rate.store(rate, std::memory_order_relaxed);
+    m_smoothed_work_rate.store(smoothed, std::memory_order_relaxed);
+    m_sample_work.store(work_total, std::memory_order_relaxed);
+    m_sample_time.store(now, std::memory_order_relaxed);
+  }
+  
+  m_sampling.store(false, std::memory_order_release);
 }
@@ -13,7 +13,14 @@
 #ifndef __TASK_CONTROLLER_H__
 #define __TASK_CONTROLLER_H__
 
-#include <mutex>
+#include <atomic>
+
+/*! \brief The shortest interval in milliseconds over which the work rate of a
+ *         task is measured. */
+#define TASK_RATE_SAMPLE_MS    250
+
+/*! \brief The time constant in milliseconds of the smoothed work rate. */
+#define TASK_RATE_SMOOTHING_MS 3000
 
 /*!
  *  \brief Enum indicating the current status of an operation. Can be used to
@@ -43,6 +50,31 @@ enum task_status
   CANCELLED
 };
 
+/*!
+ *  \brief Enum indicating the kind of work a task is currently doing, used to
+ *         break down where its time goes.
+ */
+enum task_phase
+{
+  /*! \brief Work that fits none of the other phases, such as setting up. */
+  TASK_PHASE_OTHER,
+  
+  /*! \brief Waiting for flash memory to erase. */
+  TASK_PHASE_ERASE,
+  
+  /*! \brief Programming data into the cartridge. */
+  TASK_PHASE_PROGRAM,
+  
+  /*! \brief Reading data from the cartridge to keep it. */
+  TASK_PHASE_READ,
+  
+  /*! \brief Reading data from the cartridge to check it against a file. */
+  TASK_PHASE_VERIFY,
+  
+  /*! \brief The number of task phases. Not a phase. */
+  NUM_TASK_PHASES
+};
+
 
 
 /*!
@@ -53,7 +85,17 @@ enum task_status
  *  communicate status updates and task progress.
  *  
  *  This class is thread-safe and thus can be used for communication between
- *  threads.
+ *  threads. State is kept in atomics rather than behind a lock, so a UI thread
+ *  can poll progress as often as it likes without slowing the task down.
+ *  Each value is read on its own; a reader may see, for example, the progress
+ *  of an update whose status it has not seen yet.
+ *  
+ *  Besides the raw work counts, the controller keeps track of how fast work is
+ *  being done, both as measured over the last fraction of a second and
+ *  smoothed over the last few seconds, how long the task should take to
+ *  finish at that rate, and how much time was spent in each \ref task_phase.
+ *  Work is measured in whatever unit the task reports, which for cartridge
+ *  operations is bytes.
  */
 class task_controller
 {
@@ -135,6 +177,33 @@ public:
    */
   virtual void on_task_end(task_status status, int work_total);
   
+  /*!
+   *  \brief Callback for the task to report time saved by an optimization.
+   *  
+   *  Callback for the task to report an estimate of the time that it saved by
+   *  choosing a faster strategy, such as erasing an entire chip at once rather
+   *  than block-by-block. Estimates are accumulated over the course of the
+   *  task and can be retrieved with \ref get_task_time_saved(). This method
+   *  can be called multiple times over the course of a task's execution.
+   *  
+   *  \param [in] milliseconds The estimated number of milliseconds saved since
+   *         the last call to this method.
+   */
+  virtual void on_task_time_saved(int milliseconds);
+  
+  /*!
+   *  \brief Callback for the task to report that it moved on to a different
+   *         kind of work.
+   *  
+   *  Callback for the task to report the \ref task_phase it is now in. The
+   *  time since the previous call, or since the task started, is added to the
+   *  previous phase. Tasks start in \ref TASK_PHASE_OTHER. This method can be
+   *  called multiple times over the course of a task's execution.
+   *  
+   *  \param [in] phase The phase the task is now in.
+   */
+  virtual void on_task_phase(task_phase phase);
+  
   /*!
    *  \brief Simple getter that allows the task to determine whether or not it
    *         should prematurely terminate. This method is primarily used for
@@ -211,6 +280,77 @@ public:
    */
   virtual int get_task_work_progress() const;
   
+  /*!
+   *  \brief Gets the estimated total time saved by the task.
+   *  
+   *  Gets the sum of all estimates reported through
+   *  \ref on_task_time_saved(int milliseconds) since the task was started.
+   *  
+   *  \return The estimated number of milliseconds saved by the task.
+   */
+  virtual int get_task_time_saved() const;
+  
+  /*!
+   *  \brief Gets the last reported phase of the task.
+   *  
+   *  \return The phase passed to the last call to
+   *          \ref on_task_phase(task_phase phase).
+   */
+  virtual task_phase get_task_phase() const;
+  
+  /*!
+   *  \brief Gets the time spent on the task so far.
+   *  
+   *  \return The number of seconds since the task started, up to when it
+   *          ended if it has ended, or 0 if it hasn't started.
+   */
+  virtual double get_task_seconds_elapsed() const;
+  
+  /*!
+   *  \brief Gets the time spent in a phase of the task so far.
+   *  
+   *  \param [in] phase The phase to get the time spent in.
+   *  
+   *  \return The total number of seconds spent in the phase, including the
+   *          time since the task last entered it if it is still in it.
+   */
+  virtual double get_task_phase_seconds(task_phase phase) const;
+  
+  /*!
+   *  \brief Gets the rate at which work is currently being done.
+   *  
+   *  Gets the rate measured over the most recent interval of about
+   *  \ref TASK_RATE_SAMPLE_MS milliseconds. The rate falls towards zero while
+   *  the task makes no progress, even if it stops reporting updates.
+   *  
+   *  \return The amount of work done per second.
+   */
+  virtual double get_task_work_rate() const;
+  
+  /*!
+   *  \brief Gets the rate at which work is being done, averaged over the last
+   *         few seconds.
+   *  
+   *  Gets an exponentially weighted average of the measured rate, with a time
+   *  constant of \ref TASK_RATE_SMOOTHING_MS milliseconds. Steadier than
+   *  \ref get_task_work_rate(), and what \ref get_task_seconds_remaining()
+   *  is based on.
+   *  
+   *  \return The amount of work done per second.
+   */
+  virtual double get_task_smoothed_work_rate() const;
+  
+  /*!
+   *  \brief Estimates how long the task will take to finish.
+   *  
+   *  \return The estimated number of seconds until the expected work is done
+   *          at the smoothed rate, 0 once the task has ended, or a negative
+   *          value if there isn't enough to go on yet.
+   *  
+   *  \see get_task_smoothed_work_rate()
+   */
+  virtual double get_task_seconds_remaining() const;
+  
   /*!
    *  \brief Cancels a running task.
    *  
@@ -224,32 +364,118 @@ public:
   
   
   
+protected:
+  
+  /*!
+   *  \brief Records a status update without any further side effects.
+   *  
+   *  Records a status update the same way
+   *  \ref on_task_update(task_status status, int work_progress) does, and
+   *  returns the total progress from before the update in a single atomic
+   *  step. Allows subclasses that override
+   *  \ref on_task_update(task_status status, int work_progress) to tell how
+   *  far the task progressed without taking a lock.
+   *  
+   *  \param [in] status The current status of the task.
+   *  \param [in] work_progress Progress made since the last update.
+   *  
+   *  \return The total work progress before this update.
+   */
+  int record_task_update(task_status status, int work_progress);
+  
+  
+  
 private:
   
+  /*!
+   *  \brief Measures the work rate if a sample interval has passed since the
+   *         last measurement.
+   *  
+   *  Does nothing if another thread is measuring at the same time.
+   *  
+   *  \param [in] work_total The total work progress after the latest update.
+   */
+  void update_work_rate(int work_total);
+  
   /*!
    *  \brief The last reported status of the task.
    */
-  task_status m_task_status;
+  std::atomic<task_status> m_task_status;
   
   /*!
    *  \brief The total amount of work expected to be accomplished by the task.
    */
-  int m_task_work_expected;
+  std::atomic<int> m_task_work_expected;
   
   /*!
    *  \brief The total amount of work accomplished by the task thus far.
    */
-  int m_task_work_total;
+  std::atomic<int> m_task_work_total;
+  
+  /*!
+   *  \brief The estimated time saved by the task thus far in milliseconds.
+   */
+  std::atomic<int> m_task_time_saved;
   
   /*!
    *  \brief Flag indicating whether or not the task should self-terminate.
    */
-  bool m_task_is_cancelled;
+  std::atomic<bool> m_task_is_cancelled;
+  
+  /*!
+   *  \brief When the task started, in microseconds of the steady clock, or 0
+   *         if it hasn't.
+   */
+  std::atomic<long long> m_start_time;
+  
+  /*!
+   *  \brief When the task ended, in microseconds of the steady clock, or 0 if
+   *         it hasn't.
+   */
+  std::atomic<long long> m_end_time;
+  
+  /*!
+   *  \brief The phase the task is currently in.
+   */
+  std::atomic<task_phase> m_task_phase;
+  
+  /*!
+   *  \brief When the task entered its current phase, in microseconds of the
+   *         steady clock.
+   */
+  std::atomic<long long> m_phase_start_time;
+  
+  /*!
+   *  \brief Microseconds spent in each phase before it was last left.
+   */
+  std::atomic<long long> m_phase_time[NUM_TASK_PHASES];
+  
+  /*!
+   *  \brief When the work rate was last measured, in microseconds of the
+   *         steady clock.
+   */
+  std::atomic<long long> m_sample_time;
+  
+  /*!
+   *  \brief The total work progress when the work rate was last measured.
+   */
+  std::atomic<int> m_sample_work;
+  
+  /*!
+   *  \brief The last measured work rate, in work per second.
+   */
+  std::atomic<double> m_work_rate;
+  
+  /*!
+   *  \brief The smoothed work rate, in work per second, or a negative value
+   *         before the first measurement.
+   */
+  std::atomic<double> m_smoothed_work_rate;
   
   /*!
-   *  \brief Data lock used to make this class thread-safe.
+   *  \brief Flag held by the thread measuring the work rate.
    */
-  std::mutex* m_mutex;
+  std::atomic<bool> m_sampling;
 };
 
 #endif /* defined(__TASK_CONTROLLER_H__) */
@@ -0,0 +1,93 @@
+/*! \file
+ *  \brief File containing the implementation of \ref task_pool.
+ *  
+ *  File containing the implementation of \ref task_pool.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see task_pool
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "task_pool.h"
+#include <algorithm>
+
+using namespace std;
+
+task_pool::task_pool(unsigned int num_threads)
+  : m_stopping(false)
+{
+  if (num_threads == 0)
+  {
+    num_threads = 1;
+  }
+  
+  m_threads.reserve(num_threads);
+  for (unsigned int i = 0; i < num_threads; ++i)
+  {
+    m_threads.push_back(thread(&task_pool::thread_function, this));
+  }
+}
+
+task_pool::~task_pool()
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_condition.notify_all();
+  
+  for (thread& worker : m_threads)
+  {
+    worker.join();
+  }
+}
+
+
+
+unsigned int task_pool::num_threads() const
+{
+  return (unsigned int) m_threads.size();
+}
+
+task_pool& task_pool::shared()
+{
+  static task_pool pool(std::min(std::max(thread::hardware_concurrency(), 1u), (unsigned int) TASK_POOL_MAX_SHARED_THREADS));
+  return pool;
+}
+
+
+
+void task_pool::enqueue(std::function<void()> task)
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_queue.push_back(std::move(task));
+  }
+  m_condition.notify_one();
+}
+
+void task_pool::thread_function()
+{
+  while (true)
+  {
+    function<void()> task;
+    {
+      unique_lock<mutex> lock(m_mutex);
+      m_condition.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+      if (m_queue.empty())
+      {
+        return;
+      }
+      task = std::move(m_queue.front());
+      m_queue.pop_front();
+    }
+    
+    // Exceptions end up in the task's future, so none escape here
+    task();
+  }
+}
@@ -0,0 +1,130 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref task_pool class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref task_pool class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __TASK_POOL_H__
+#define __TASK_POOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! \brief The largest number of threads in the shared pool. */
+#define TASK_POOL_MAX_SHARED_THREADS 4
+
+/*! \class task_pool
+ *  \brief Class that runs queued tasks on a small, fixed set of threads.
+ *  
+ *  Class that runs queued tasks on a small, fixed set of worker threads, in
+ *  the order they were submitted. Used to run long, blocking cartridge
+ *  operations on many devices at once without starting a thread for every
+ *  one of them.
+ *  
+ *  Destroying a pool waits for every task already submitted to finish.
+ *  
+ *  This class is thread-safe.
+ */
+class task_pool
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Starts the worker threads.
+   *  
+   *  \param [in] num_threads The number of worker threads. 0 is treated as 1.
+   */
+  explicit                task_pool(unsigned int num_threads);
+  
+  /*!
+   *  \brief Class destructor. Finishes every queued task, then stops the
+   *         worker threads.
+   */
+                          ~task_pool();
+  
+  
+  
+  /*!
+   *  \brief Queues a function to run on one of the worker threads.
+   *  
+   *  \param [in] function The function to run. Takes no arguments.
+   *  
+   *  \return A future that receives the function's result, or the exception
+   *          it threw.
+   */
+  template<typename F>
+  std::future<typename std::result_of<F()>::type> submit(F function)
+  {
+    typedef typename std::result_of<F()>::type result_type;
+    
+    // std::function needs a copyable target, so share the task
+    std::shared_ptr<std::packaged_task<result_type()>> task =
+      std::make_shared<std::packaged_task<result_type()>>(function);
+    std::future<result_type> result = task->get_future();
+    enqueue([task]() { (*task)(); });
+    return result;
+  }
+  
+  /*!
+   *  \brief Gets the number of worker threads.
+   */
+  unsigned int            num_threads() const;
+  
+  /*!
+   *  \brief Gets the pool shared by the whole application.
+   *  
+   *  The shared pool is started the first time it is used, with one thread
+   *  per processor up to \ref TASK_POOL_MAX_SHARED_THREADS.
+   */
+  static task_pool&       shared();
+  
+  
+  
+private:
+  
+  /*! \brief Disabled copy constructor. */
+                          task_pool(const task_pool& other) = delete;
+  
+  /*! \brief Disabled copy assignment operator. */
+  task_pool&              operator=(const task_pool& other) = delete;
+  
+  /*!
+   *  \brief Adds a task to the queue and wakes a worker thread.
+   */
+  void                    enqueue(std::function<void()> task);
+  
+  /*!
+   *  \brief The function each worker thread executes.
+   */
+  void                    thread_function();
+  
+  
+  
+  /*! \brief The worker threads. */
+  std::vector<std::thread> m_threads;
+  
+  /*! \brief Tasks waiting for a worker thread. */
+  std::deque<std::function<void()>> m_queue;
+  
+  /*! \brief Mutex guarding \ref m_queue and \ref m_stopping. */
+  std::mutex              m_mutex;
+  
+  /*! \brief Condition signaling that a task was queued or the pool is stopping. */
+  std::condition_variable m_condition;
+  
+  /*! \brief Flag telling worker threads to exit once the queue is empty. */
+  bool                    m_stopping;
+};
+
+#endif /* defined(__TASK_POOL_H__) */
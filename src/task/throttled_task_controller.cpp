@@ -0,0 +1,130 @@
+/*! \file
+ *  \brief File containing the implementation of
+ *  \ref throttled_task_controller.
+ *  
+ *  File containing the implementation of \ref throttled_task_controller.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-06
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "throttled_task_controller.h"
+
+throttled_task_controller::throttled_task_controller(task_controller* receiver, int interval_ms, int work_threshold)
+  : task_controller(), m_receiver(receiver), m_interval(interval_ms),
+    m_work_threshold(work_threshold), m_pending_work(0),
+    m_pending_status(NOT_STARTED), m_forwarded_status(NOT_STARTED),
+    m_mutex(new std::mutex())
+{
+  // Nothing else to do
+}
+
+throttled_task_controller::~throttled_task_controller()
+{
+  // Nothing else to do
+  delete m_mutex;
+}
+
+
+
+void throttled_task_controller::on_task_start(int work_expected)
+{
+  m_mutex->lock();
+  
+  task_controller::on_task_start(work_expected);
+  m_pending_work = 0;
+  m_pending_status = RUNNING;
+  m_forwarded_status = RUNNING;
+  m_last_forwarded = std::chrono::steady_clock::now();
+  m_receiver->on_task_start(work_expected);
+  
+  m_mutex->unlock();
+}
+
+void throttled_task_controller::on_task_update(task_status status, int work_progress)
+{
+  m_mutex->lock();
+  
+  task_controller::on_task_update(status, work_progress);
+  m_pending_work += work_progress;
+  m_pending_status = status;
+  
+  bool forward = (status != m_forwarded_status);
+  if (!forward && m_work_threshold > 0 && m_pending_work >= m_work_threshold)
+  {
+    forward = true;
+  }
+  if (!forward && std::chrono::steady_clock::now() - m_last_forwarded >= m_interval)
+  {
+    forward = true;
+  }
+  
+  if (forward)
+  {
+    flush_locked();
+  }
+  
+  m_mutex->unlock();
+}
+
+void throttled_task_controller::on_task_end(task_status status, int work_total)
+{
+  m_mutex->lock();
+  
+  task_controller::on_task_end(status, work_total);
+  m_pending_work = 0;
+  m_forwarded_status = status;
+  m_receiver->on_task_end(status, work_total);
+  
+  m_mutex->unlock();
+}
+
+void throttled_task_controller::on_task_time_saved(int milliseconds)
+{
+  m_mutex->lock();
+  
+  task_controller::on_task_time_saved(milliseconds);
+  m_receiver->on_task_time_saved(milliseconds);
+  
+  m_mutex->unlock();
+}
+
+void throttled_task_controller::on_task_phase(task_phase phase)
+{
+  m_mutex->lock();
+  
+  flush_locked();
+  task_controller::on_task_phase(phase);
+  m_receiver->on_task_phase(phase);
+  
+  m_mutex->unlock();
+}
+
+bool throttled_task_controller::is_task_cancelled() const
+{
+  return m_receiver->is_task_cancelled();
+}
+
+void throttled_task_controller::flush()
+{
+  m_mutex->lock();
+  flush_locked();
+  m_mutex->unlock();
+}
+
+
+
+void throttled_task_controller::flush_locked()
+{
+  if (m_pending_work == 0 && m_pending_status == m_forwarded_status)
+  {
+    return;
+  }
+  
+  int work = m_pending_work;
+  m_pending_work = 0;
+  m_forwarded_status = m_pending_status;
+  m_last_forwarded = std::chrono::steady_clock::now();
+  m_receiver->on_task_update(m_pending_status, work);
+}
@@ -0,0 +1,195 @@
+/*! \file
+ *  \brief File containing the declaration of the
+ *         \ref throttled_task_controller class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref throttled_task_controller class. This file includes the minimal number
+ *  of files necessary to use any instance of the
+ *  \ref throttled_task_controller class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-08-06
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __THROTTLED_TASK_CONTROLLER_H__
+#define __THROTTLED_TASK_CONTROLLER_H__
+
+#include "task_controller.h"
+#include <chrono>
+#include <mutex>
+
+/*!
+ *  \brief A specialized implementation of \ref task_controller that coalesces
+ *         progress updates before passing them on to another task_controller.
+ *  
+ *  A specialized implementation of the \ref task_controller that coalesces
+ *  progress updates before passing them on to another task_controller. Tasks
+ *  such as cartridge transfers report progress for every USB packet, which is
+ *  far more often than a progress bar can be repainted. This class adds up the
+ *  reported work and only forwards it once enough time has passed or enough
+ *  work has accumulated, or when the reported status changes.
+ *  
+ *  Starting and ending the task are always forwarded right away, as are
+ *  estimates of time saved. The
+ *  \ref get_task_work_progress() family of methods of this object is always
+ *  up-to-date, even while updates to the receiver are being held back.
+ *  
+ *  This class is thread-safe and thus can be used for communication between
+ *  threads.
+ *  
+ *  \see task_controller
+ */
+class throttled_task_controller: public task_controller
+{
+public:
+  
+  /*!
+   *  \brief The default minimum number of milliseconds between two forwarded
+   *         updates.
+   */
+  static const int DEFAULT_INTERVAL_MS = 50;
+  
+  
+  
+  /*!
+   *  \brief The default class constructor.
+   *  
+   *  The default class constructor. Accepts a pointer to an existing parent
+   *  \ref task_controller object to which to forward coalesced task status
+   *  updates.
+   *  
+   *  \param [in,out] receiver Pointer to an existing parent
+   *         \ref task_controller object to which to forward task status
+   *         updates. This value should not be null.
+   *  \param [in] interval_ms The minimum number of milliseconds between two
+   *         forwarded updates. 0 disables time-based throttling.
+   *  \param [in] work_threshold The amount of accumulated work after which an
+   *         update is forwarded even if the interval has not yet passed. 0
+   *         disables work-based forwarding.
+   */
+  throttled_task_controller(task_controller* receiver, int interval_ms = DEFAULT_INTERVAL_MS, int work_threshold = 0);
+  
+  /*!
+   *  \brief The class destructor.
+   *  
+   *  The class destructor. Performs cleanup and releases allocated memory for
+   *  safe deletion.
+   */
+  virtual ~throttled_task_controller();
+  
+  
+  
+  /*!
+   *  \brief Callback for when the task begins execution.
+   *  
+   *  Forwarded to the parent \ref task_controller right away.
+   *  
+   *  \see task_controller::on_task_start(int work_expected)
+   */
+  virtual void on_task_start(int work_expected);
+  
+  /*!
+   *  \brief Callback for task status updates.
+   *  
+   *  Callback for task status updates. Adds the reported work to the work
+   *  held back from the parent \ref task_controller and forwards the total if
+   *  the interval has passed, the work threshold has been reached, or the
+   *  status differs from the last one forwarded.
+   *  
+   *  \param [in] status The reported status of the task.
+   *  \param [in] work_progress The work progress reported by the task made
+   *         since the last call to this method.
+   *  
+   *  \see task_controller::on_task_update(task_status status, int work_progress)
+   */
+  virtual void on_task_update(task_status status, int work_progress);
+  
+  /*!
+   *  \brief Callback for when the task ends execution.
+   *  
+   *  Forwarded to the parent \ref task_controller right away. Any work held
+   *  back is included in the work total reported by the task.
+   *  
+   *  \see task_controller::on_task_end(task_status status, int work_total)
+   */
+  virtual void on_task_end(task_status status, int work_total);
+  
+  /*!
+   *  \brief Callback for the task to report time saved by an optimization.
+   *  
+   *  Forwarded to the parent \ref task_controller right away.
+   *  
+   *  \see task_controller::on_task_time_saved(int milliseconds)
+   */
+  virtual void on_task_time_saved(int milliseconds);
+  
+  /*!
+   *  \brief Callback for the task to report that it moved on to a different
+   *         kind of work.
+   *  
+   *  Sends any pending progress first, so that it counts towards the phase it
+   *  was made in, then forwards the phase to the parent \ref task_controller
+   *  right away.
+   *  
+   *  \see task_controller::on_task_phase(task_phase phase)
+   */
+  virtual void on_task_phase(task_phase phase);
+  
+  /*!
+   *  \brief Method used by the task to determine if it should self-terminate.
+   *  
+   *  Calls to this method are propagated up to this object's parent
+   *  \ref task_controller object's \ref task_controller::is_task_cancelled()
+   *  method.
+   *  
+   *  \return true if the parent \ref task_controller has been cancelled, false
+   *          if not.
+   *  
+   *  \see task_controller::is_task_cancelled()
+   */
+  virtual bool is_task_cancelled() const;
+  
+  /*!
+   *  \brief Forwards any work held back to the parent \ref task_controller.
+   */
+  void flush();
+  
+  
+  
+private:
+  
+  /*!
+   *  \brief Forwards any work held back. Must be called with \ref m_mutex
+   *         held.
+   */
+  void flush_locked();
+  
+  
+  
+  /*! \brief This object's parent \ref task_controller to forward updates to. */
+  task_controller* const m_receiver;
+  
+  /*! \brief The minimum time between two forwarded updates. */
+  const std::chrono::milliseconds m_interval;
+  
+  /*! \brief The amount of work that triggers an update regardless of time. */
+  const int m_work_threshold;
+  
+  /*! \brief Work reported by the task but not yet forwarded. */
+  int m_pending_work;
+  
+  /*! \brief Status of the most recent update reported by the task. */
+  task_status m_pending_status;
+  
+  /*! \brief Status last forwarded to the receiver. */
+  task_status m_forwarded_status;
+  
+  /*! \brief Time at which an update was last forwarded. */
+  std::chrono::steady_clock::time_point m_last_forwarded;
+  
+  /*! \brief A thread lock used to keep this class thread-safe. */
+  std::mutex* m_mutex;
+};
+
+#endif /* defined(__THROTTLED_TASK_CONTROLLER_H__) */
@@ -0,0 +1,574 @@
+//
+//  benchmark_main.cpp
+//  FlashMasta
+//
+//  Created by Dan on 9/12/15.
+//  Copyright (c) 2015 7400 Circuits. All rights reserved.
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "cartridge_benchmark.h"
+#include "host_benchmark.h"
+#include "linkmasta_benchmark.h"
+#include "soak_benchmark.h"
+#include "common/trace.h"
+#include "linkmasta/emulated_usb_device.h"
+#include "linkmasta/libusb_device_manager.h"
+#include "linkmasta/linkmasta_device.h"
+#include "linkmasta/ngp_linkmasta_device.h"
+#include "linkmasta/ws_linkmasta_device.h"
+#include "usb/libusb_usb_device.h"
+#include "usb/replay_usb_device.h"
+
+#define DEFAULT_WAIT_MS         3000
+#define DEVICE_POLL_INTERVAL_MS 100
+#define WS_LINKMASTA_PRODUCT_ID 0x4252
+
+
+// Function forward declarations
+void print_usage(const char* program_name);
+bool run_emulated(ostream& out, const linkmasta_benchmark::options& opts, const emulated_usb_device::options& emulator_opts);
+bool run_host(ostream& out, const host_benchmark::options& opts);
+bool run_cartridges(ostream& out, const cartridge_benchmark::options& opts);
+bool run_replay(ostream& out, const linkmasta_benchmark::options& opts, const string& replay_path, double time_scale);
+bool run_soak_emulated(ostream& out, const soak_benchmark::options& opts, const emulated_usb_device::options& emulator_opts);
+bool parse_profile(const string& text, cartridge_benchmark::latency_profile* profile);
+bool write_trace(const string& trace_path);
+
+
+int main(int argc, char* argv[])
+{
+  linkmasta_benchmark::options opts;
+  emulated_usb_device::options emulator_opts;
+  host_benchmark::options host_opts;
+  cartridge_benchmark::options cartridge_opts;
+  soak_benchmark::options soak_opts;
+  bool emulate = false;
+  bool host = false;
+  bool cartridges = false;
+  bool soak = false;
+  string output_path;
+  string trace_path;
+  string capture_path;
+  string replay_path;
+  double replay_scale = 1.0;
+  int wait_ms = DEFAULT_WAIT_MS;
+  
+  // Parse command-line arguments
+  for (int i = 1; i < argc; ++i)
+  {
+    string arg = argv[i];
+    if (arg == "--destructive")
+    {
+      opts.destructive = true;
+    }
+    else if (arg == "--host")
+    {
+      host = true;
+    }
+    else if (arg == "--cartridges")
+    {
+      cartridges = true;
+    }
+    else if (arg == "--help" || arg == "-h")
+    {
+      print_usage(argv[0]);
+      return 0;
+    }
+    else if (i + 1 < argc && arg == "--output") output_path = argv[++i];
+    else if (i + 1 < argc && arg == "--trace") trace_path = argv[++i];
+    else if (i + 1 < argc && arg == "--capture") capture_path = argv[++i];
+    else if (i + 1 < argc && arg == "--replay") replay_path = argv[++i];
+    else if (i + 1 < argc && arg == "--replay-scale") replay_scale = atof(argv[++i]);
+    else if (i + 1 < argc && arg == "--wait") wait_ms = atoi(argv[++i]);
+    else if (i + 1 < argc && arg == "--chip") opts.chip = (unsigned int) strtoul(argv[++i], nullptr, 0);
+    else if (i + 1 < argc && arg == "--second-chip")
+    {
+      opts.second_chip = (unsigned int) strtoul(argv[++i], nullptr, 0);
+      opts.dual_chip = true;
+    }
+    else if (i + 1 < argc && arg == "--samples") opts.latency_samples = soak_opts.latency_samples = (unsigned int) strtoul(argv[++i], nullptr, 0);
+    else if (i + 1 < argc && arg == "--reps") opts.repetitions = host_opts.repetitions = cartridge_opts.repetitions = (unsigned int) strtoul(argv[++i], nullptr, 0);
+    else if (i + 1 < argc && arg == "--iterations") host_opts.iterations = (unsigned int) strtoul(argv[++i], nullptr, 0);
+    else if (i + 1 < argc && arg == "--catalog-dir") host_opts.catalog_dir = argv[++i];
+    else if (i + 1 < argc && arg == "--soak")
+    {
+      soak_opts.hours = atof(argv[++i]);
+      soak = true;
+    }
+    else if (i + 1 < argc && arg == "--soak-cycles") soak_opts.cycles = (unsigned int) strtoul(argv[++i], nullptr, 0);
+    else if (i + 1 < argc && arg == "--soak-pause-ms") soak_opts.pause_ms = (unsigned int) strtoul(argv[++i], nullptr, 0);
+    else if (arg == "--soak-flash") soak_opts.flash = true;
+    else if (i + 1 < argc && arg == "--profile")
+    {
+      cartridge_benchmark::latency_profile profile;
+      if (!parse_profile(argv[++i], &profile))
+      {
+        print_usage(argv[0]);
+        return 2;
+      }
+      cartridge_opts.profiles.push_back(profile);
+    }
+    else if (i + 1 < argc && arg == "--block") opts.block_address = (address_t) strtoul(argv[++i], nullptr, 0);
+    else if (i + 1 < argc && arg == "--block-size") opts.block_size = (unsigned int) strtoul(argv[++i], nullptr, 0);
+    else if (i + 1 < argc && arg == "--emulate")
+    {
+      string system = argv[++i];
+      if (system != "ngp" && system != "ws")
+      {
+        print_usage(argv[0]);
+        return 2;
+      }
+      
+      // Keep any transport settings given before the system
+      emulated_usb_device::options defaults(system == "ws" ? LINKMASTA_WONDERSWAN : LINKMASTA_NEO_GEO_POCKET);
+      defaults.latency_us = emulator_opts.latency_us;
+      defaults.bytes_per_second = emulator_opts.bytes_per_second;
+      defaults.faults = emulator_opts.faults;
+      emulator_opts = defaults;
+      emulate = true;
+    }
+    else if (i + 1 < argc && arg == "--latency-us") emulator_opts.latency_us = (unsigned int) strtoul(argv[++i], nullptr, 0);
+    else if (i + 1 < argc && arg == "--bandwidth") emulator_opts.bytes_per_second = (unsigned int) strtoul(argv[++i], nullptr, 0);
+    else if (i + 1 < argc && arg == "--fault-timeout") emulator_opts.faults.timeout_rate = atof(argv[++i]);
+    else if (i + 1 < argc && arg == "--fault-short-read") emulator_opts.faults.short_read_rate = atof(argv[++i]);
+    else if (i + 1 < argc && arg == "--fault-nak-storm") emulator_opts.faults.nak_storm_rate = atof(argv[++i]);
+    else if (i + 1 < argc && arg == "--fault-nak-us") emulator_opts.faults.nak_delay_us = (unsigned int) strtoul(argv[++i], nullptr, 0);
+    else if (i + 1 < argc && arg == "--fault-corrupt") emulator_opts.faults.corrupt_rate = atof(argv[++i]);
+    else if (i + 1 < argc && arg == "--fault-disconnect") emulator_opts.faults.disconnect_interval = (unsigned int) strtoul(argv[++i], nullptr, 0);
+    else if (i + 1 < argc && arg == "--fault-seed") emulator_opts.faults.seed = (unsigned int) strtoul(argv[++i], nullptr, 0);
+    else
+    {
+      print_usage(argv[0]);
+      return 2;
+    }
+  }
+  
+  ofstream fout;
+  if (!output_path.empty())
+  {
+    fout.open(output_path.c_str());
+    if (!fout.is_open())
+    {
+      cerr << "ERROR: Unable to open file " << output_path << endl;
+      return 1;
+    }
+  }
+  ostream& out = (output_path.empty() ? cout : fout);
+  
+  if (!trace_path.empty())
+  {
+    trace_start();
+  }
+  
+  if (host)
+  {
+    bool success = run_host(out, host_opts);
+    return (write_trace(trace_path) && success ? 0 : 1);
+  }
+  
+  if (cartridges)
+  {
+    // Only the layouts of the emulated system if one was picked, under the
+    // emulated transport if no profiles were given
+    if (emulate)
+    {
+      cartridge_opts.neo_geo_pocket = (emulator_opts.system == LINKMASTA_NEO_GEO_POCKET);
+      cartridge_opts.wonderswan = (emulator_opts.system == LINKMASTA_WONDERSWAN);
+    }
+    if (cartridge_opts.profiles.empty() && (emulator_opts.latency_us > 0 || emulator_opts.bytes_per_second > 0))
+    {
+      cartridge_benchmark::latency_profile profile = {"emulated", emulator_opts.latency_us, emulator_opts.bytes_per_second};
+      cartridge_opts.profiles.push_back(profile);
+    }
+    cartridge_opts.faults = emulator_opts.faults;
+    bool success = run_cartridges(out, cartridge_opts);
+    return (write_trace(trace_path) && success ? 0 : 1);
+  }
+  
+  if (soak && emulate)
+  {
+    bool success = run_soak_emulated(out, soak_opts, emulator_opts);
+    return (write_trace(trace_path) && success ? 0 : 1);
+  }
+  
+  if (!replay_path.empty())
+  {
+    bool success = run_replay(out, opts, replay_path, replay_scale);
+    return (write_trace(trace_path) && success ? 0 : 1);
+  }
+  
+  if (emulate)
+  {
+    bool success = run_emulated(out, opts, emulator_opts);
+    return (write_trace(trace_path) && success ? 0 : 1);
+  }
+  
+  libusb_device_manager manager;
+  
+  // The device list is filled in by the manager's refresh thread
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(wait_ms);
+  vector<unsigned int> devices = manager.get_connected_devices();
+  while (devices.empty() && chrono::steady_clock::now() < deadline)
+  {
+    this_thread::sleep_for(chrono::milliseconds(DEVICE_POLL_INTERVAL_MS));
+    devices = manager.get_connected_devices();
+  }
+  
+  if (devices.empty())
+  {
+    cerr << "ERROR: No devices found" << endl;
+  }
+  
+  // Every device takes part in every cycle of a soak, so all of them are
+  // claimed for the whole run
+  if (soak)
+  {
+    soak_benchmark benchmark(soak_opts);
+    vector<unsigned int> claimed;
+    bool success = !devices.empty();
+    for (unsigned int device_id : devices)
+    {
+      if (!manager.try_claim_device(device_id))
+      {
+        cerr << "ERROR: Device " << device_id << " is busy" << endl;
+        success = false;
+        continue;
+      }
+      claimed.push_back(device_id);
+      benchmark.add_device(manager.get_serial_number(device_id), manager.get_linkmasta_device(device_id));
+    }
+    success = benchmark.run(out) && success;
+    for (unsigned int device_id : claimed)
+    {
+      manager.release_device(device_id);
+    }
+    return (write_trace(trace_path) && success ? 0 : 1);
+  }
+  
+  time_t now = time(nullptr);
+  char timestamp[32];
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  
+  out << "{\n";
+  out << "  \"timestamp\": \"" << timestamp << "\",\n";
+  out << "  \"destructive\": " << (opts.destructive ? "true" : "false") << ",\n";
+  out << "  \"devices\": [";
+  
+  // Devices are benchmarked one at a time so they don't compete for the bus
+  bool first = true;
+  bool success = true;
+  for (unsigned int device_id : devices)
+  {
+    out << (first ? "\n" : ",\n");
+    first = false;
+    out << "    {\n";
+    out << "      \"id\": " << device_id << ",\n";
+    out << "      \"product\": " << linkmasta_benchmark::json_string(manager.get_product_string(device_id)) << ",\n";
+    out << "      \"serial\": " << linkmasta_benchmark::json_string(manager.get_serial_number(device_id)) << ",\n";
+    out << "      \"results\": ";
+    
+    if (!manager.try_claim_device(device_id))
+    {
+      out << "{\"error\": \"device is busy\"}\n    }";
+      success = false;
+      continue;
+    }
+    
+    // Each device gets a capture of its own, numbered after the first
+    usb::libusb_usb_device* usb_device = dynamic_cast<usb::libusb_usb_device*>(manager.get_usb_device(device_id));
+    if (!capture_path.empty() && usb_device != nullptr)
+    {
+      string path = (device_id == devices.front() ? capture_path : capture_path + "." + to_string(device_id));
+      try
+      {
+        usb_device->start_capture(path);
+      }
+      catch (std::exception& ex)
+      {
+        cerr << "ERROR: " << ex.what() << endl;
+        success = false;
+      }
+    }
+    
+    linkmasta_benchmark benchmark(manager.get_linkmasta_device(device_id), opts);
+    benchmark.run(out, 6);
+    if (usb_device != nullptr)
+    {
+      usb_device->stop_capture();
+    }
+    manager.release_device(device_id);
+    out << "\n    }";
+    out.flush();
+  }
+  out << (first ? "]\n" : "\n  ]\n");
+  out << "}" << endl;
+  
+  if (devices.empty())
+  {
+    success = false;
+  }
+  
+  return (write_trace(trace_path) && success ? 0 : 1);
+}
+
+void print_usage(const char* program_name)
+{
+  cerr << "usage: " << program_name << " [options]\n"
+       << "\n"
+       << "Benchmarks every attached device and writes the results as JSON.\n"
+       << "\n"
+       << "options:\n"
+       << "  --output <path>      write results to a file instead of stdout\n"
+       << "  --trace <path>       write a Chrome trace of the run to a file\n"
+       << "  --capture <path>     record every USB transfer of the run to a file\n"
+       << "  --replay <path>      benchmark a device played back from a capture instead of\n"
+       << "                       attached ones; takes the options the capture was made with\n"
+       << "  --replay-scale <x>   factor applied to the device's recorded timing (default 1,\n"
+       << "                       0 to measure the host alone)\n"
+       << "  --wait <ms>          how long to wait for devices\n"
+       << "  --chip <n>           chip to benchmark (default 0)\n"
+       << "  --second-chip <n>    also measure reading both chips at once against reading\n"
+       << "                       them in turn\n"
+       << "  --samples <n>        number of latency samples (default 1000, 100 per soak cycle)\n"
+       << "  --reps <n>           repetitions of each throughput measurement (default 5)\n"
+       << "  --destructive        also measure erase and program, destroying data\n"
+       << "  --block <address>    address of the block to erase and program\n"
+       << "  --block-size <n>     size of that block in bytes (default 0x10000)\n"
+       << "  --emulate <ngp|ws>   benchmark an emulated device instead of attached ones\n"
+       << "  --latency-us <n>     per-transfer latency of the emulated device\n"
+       << "  --bandwidth <n>      bytes per second of the emulated device (0 for unlimited)\n"
+       << "  --fault-timeout <r>  fraction of emulated transfers that time out\n"
+       << "  --fault-short-read <r>\n"
+       << "                       fraction of emulated multi-packet reads that end early\n"
+       << "  --fault-nak-storm <r>\n"
+       << "                       fraction of emulated transfers starting a storm of 16 NAKed ones\n"
+       << "  --fault-nak-us <n>   how long each NAKed transfer is held up (default 1000)\n"
+       << "  --fault-corrupt <r>  fraction of emulated reads with a corrupted byte\n"
+       << "  --fault-disconnect <n>\n"
+       << "                       emulated transfers after which the device drops off the bus\n"
+       << "  --fault-seed <n>     seed deciding which emulated transfers fail (default 1)\n"
+       << "  --host               benchmark host-side packet, kernel, catalog, and progress\n"
+       << "                       overhead instead of devices\n"
+       << "  --iterations <n>     operations per repetition of each host benchmark (default 100000)\n"
+       << "  --catalog-dir <dir>  directory of the game catalogs to benchmark lookups in\n"
+       << "  --cartridges         benchmark flash, verify, backup, and save restore on emulated\n"
+       << "                       cartridges of every layout, of the --emulate system only if given\n"
+       << "  --profile <name:latency-us:bandwidth>\n"
+       << "                       transport to run the cartridge benchmarks under; may be repeated\n"
+       << "  --soak <hours>       instead of benchmarking, back up and verify the game on every\n"
+       << "                       device over and over, writing a CSV row of throughput, latency,\n"
+       << "                       memory, and errors for every cycle (0 hours to run until killed\n"
+       << "                       or --soak-cycles are done); on the --emulate system if given\n"
+       << "  --soak-cycles <n>    stop the soak after this many cycles\n"
+       << "  --soak-pause-ms <n>  time devices sit idle between soak cycles\n"
+       << "  --soak-flash         also flash a generated game every soak cycle, destroying the\n"
+       << "                       game on the cartridge; the original is flashed back at the end\n";
+}
+
+bool run_emulated(ostream& out, const linkmasta_benchmark::options& opts, const emulated_usb_device::options& emulator_opts)
+{
+  emulated_usb_device* usb_device = new emulated_usb_device(emulator_opts);
+  linkmasta_device* linkmasta;
+  if (emulator_opts.system == LINKMASTA_WONDERSWAN)
+  {
+    linkmasta = new ws_linkmasta_device(usb_device);
+  }
+  else
+  {
+    linkmasta = new ngp_linkmasta_device(usb_device);
+  }
+  linkmasta->init();
+  linkmasta->open();
+  
+  time_t now = time(nullptr);
+  char timestamp[32];
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  
+  out << "{\n";
+  out << "  \"timestamp\": \"" << timestamp << "\",\n";
+  out << "  \"destructive\": " << (opts.destructive ? "true" : "false") << ",\n";
+  out << "  \"emulated\": {\"latency_us\": " << emulator_opts.latency_us
+      << ", \"bytes_per_second\": " << emulator_opts.bytes_per_second << "},\n";
+  out << "  \"devices\": [\n";
+  out << "    {\n";
+  out << "      \"id\": 0,\n";
+  out << "      \"product\": " << linkmasta_benchmark::json_string(usb_device->get_product_string()) << ",\n";
+  out << "      \"serial\": " << linkmasta_benchmark::json_string(usb_device->get_serial_number()) << ",\n";
+  out << "      \"results\": ";
+  
+  linkmasta_benchmark benchmark(linkmasta, opts);
+  benchmark.run(out, 6);
+  if (emulator_opts.faults.any())
+  {
+    out << ",\n      \"faults\": " << cartridge_benchmark::json_faults(usb_device->injected_faults());
+  }
+  out << "\n    }\n  ]\n}" << endl;
+  
+  // The linkmasta takes ownership of the USB device
+  delete linkmasta;
+  return true;
+}
+
+bool run_replay(ostream& out, const linkmasta_benchmark::options& opts, const string& replay_path, double time_scale)
+{
+  usb::replay_usb_device* usb_device = new usb::replay_usb_device(replay_path, time_scale);
+  try
+  {
+    usb_device->init();
+  }
+  catch (std::exception& ex)
+  {
+    cerr << "ERROR: " << ex.what() << endl;
+    delete usb_device;
+    return false;
+  }
+  
+  // The capture knows which kind of device it was made with
+  linkmasta_device* linkmasta;
+  if (usb_device->get_device_description()->product_id == WS_LINKMASTA_PRODUCT_ID)
+  {
+    linkmasta = new ws_linkmasta_device(usb_device);
+  }
+  else
+  {
+    linkmasta = new ngp_linkmasta_device(usb_device);
+  }
+  linkmasta->init();
+  linkmasta->open();
+  
+  time_t now = time(nullptr);
+  char timestamp[32];
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  
+  out << "{\n";
+  out << "  \"timestamp\": \"" << timestamp << "\",\n";
+  out << "  \"destructive\": " << (opts.destructive ? "true" : "false") << ",\n";
+  out << "  \"devices\": [\n";
+  out << "    {\n";
+  out << "      \"id\": 0,\n";
+  out << "      \"product\": " << linkmasta_benchmark::json_string(usb_device->get_product_string()) << ",\n";
+  out << "      \"serial\": " << linkmasta_benchmark::json_string(usb_device->get_serial_number()) << ",\n";
+  out << "      \"results\": ";
+  
+  auto start = chrono::steady_clock::now();
+  linkmasta_benchmark benchmark(linkmasta, opts);
+  benchmark.run(out, 6);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  
+  // A replay that didn't use up the capture took a different path than the
+  // captured run, so its timings can't be compared
+  bool complete = (usb_device->num_transfers_replayed() == usb_device->num_transfers());
+  out << ",\n";
+  out << "      \"replay\": {\"path\": " << linkmasta_benchmark::json_string(replay_path)
+      << ", \"time_scale\": " << time_scale
+      << ", \"transfers\": " << usb_device->num_transfers()
+      << ", \"transfers_replayed\": " << usb_device->num_transfers_replayed()
+      << ", \"captured_seconds\": " << usb_device->captured_duration_us() / 1e6
+      << ", \"replay_seconds\": " << seconds << "}\n";
+  out << "    }\n  ]\n}" << endl;
+  
+  // The linkmasta takes ownership of the USB device
+  delete linkmasta;
+  return complete;
+}
+
+bool run_soak_emulated(ostream& out, const soak_benchmark::options& opts, const emulated_usb_device::options& emulator_opts)
+{
+  linkmasta_device* linkmasta;
+  if (emulator_opts.system == LINKMASTA_WONDERSWAN)
+  {
+    linkmasta = new ws_linkmasta_device(new emulated_usb_device(emulator_opts));
+  }
+  else
+  {
+    linkmasta = new ngp_linkmasta_device(new emulated_usb_device(emulator_opts));
+  }
+  linkmasta->init();
+  linkmasta->open();
+  
+  bool success;
+  {
+    soak_benchmark benchmark(opts);
+    benchmark.add_device("emulated", linkmasta);
+    success = benchmark.run(out);
+  }
+  
+  // The linkmasta takes ownership of the USB device
+  delete linkmasta;
+  return success;
+}
+
+bool run_host(ostream& out, const host_benchmark::options& opts)
+{
+  time_t now = time(nullptr);
+  char timestamp[32];
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  
+  out << "{\n";
+  out << "  \"timestamp\": \"" << timestamp << "\",\n";
+  out << "  \"host\": ";
+  
+  host_benchmark benchmark(opts);
+  benchmark.run(out, 2);
+  out << "\n}" << endl;
+  return true;
+}
+
+bool run_cartridges(ostream& out, const cartridge_benchmark::options& opts)
+{
+  time_t now = time(nullptr);
+  char timestamp[32];
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  
+  out << "{\n";
+  out << "  \"timestamp\": \"" << timestamp << "\",\n";
+  out << "  \"cartridges\": ";
+  
+  cartridge_benchmark benchmark(opts);
+  benchmark.run(out, 2);
+  out << "\n}" << endl;
+  return true;
+}
+
+bool parse_profile(const string& text, cartridge_benchmark::latency_profile* profile)
+{
+  size_t first = text.find(':');
+  size_t second = (first == string::npos ? string::npos : text.find(':', first + 1));
+  if (first == 0 || second == string::npos)
+  {
+    return false;
+  }
+  
+  profile->name = text.substr(0, first);
+  profile->latency_us = (unsigned int) strtoul(text.substr(first + 1, second - first - 1).c_str(), nullptr, 0);
+  profile->bytes_per_second = (unsigned int) strtoul(text.substr(second + 1).c_str(), nullptr, 0);
+  return true;
+}
+
+bool write_trace(const string& trace_path)
+{
+  if (trace_path.empty())
+  {
+    return true;
+  }
+  
+  trace_stop();
+  ofstream fout(trace_path.c_str());
+  trace_write_chrome_json(fout);
+  if (!fout.good())
+  {
+    cerr << "ERROR: Unable to write trace to " << trace_path << endl;
+    return false;
+  }
+  return true;
+}
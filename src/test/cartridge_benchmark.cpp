@@ -0,0 +1,296 @@
+//
+//  cartridge_benchmark.cpp
+//  FlashMasta
+//
+//  Created by Dan on 9/12/15.
+//  Copyright (c) 2015 7400 Circuits. All rights reserved.
+//
+
+#include "cartridge_benchmark.h"
+#include "linkmasta_benchmark.h"
+
+#include "cartridge/cartridge.h"
+#include "cartridge/cartridge_descriptor.h"
+#include "common/output_sink.h"
+#include "linkmasta/emulated_usb_device.h"
+#include "linkmasta/ngp_linkmasta_device.h"
+#include "linkmasta/ws_linkmasta_device.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+#define NGP_LICENSE "COPYRIGHT BY SNK CORPORATION"
+
+typedef chrono::steady_clock bench_clock;
+
+static double seconds_since(bench_clock::time_point start)
+{
+  return chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// Sink that only counts what a backup writes, so that the time measured is
+// that of reading the cartridge
+class counting_sink : public output_sink
+{
+public:
+  counting_sink() : m_num_bytes(0), m_position(0) {}
+  
+  void write(const unsigned char* data, unsigned int num_bytes)
+  {
+    (void) data;
+    m_position += num_bytes;
+    m_num_bytes = (m_position > m_num_bytes ? m_position : m_num_bytes);
+  }
+  void seek(unsigned long long offset) { m_position = offset; }
+  long long tell() { return (long long) m_position; }
+  void flush() {}
+  
+  unsigned long long num_bytes() const { return m_num_bytes; }
+
+private:
+  unsigned long long m_num_bytes;
+  unsigned long long m_position;
+};
+
+// Fills an image with data that differs from one seed to the next, so that
+// flashing it again has to program every block
+static void fill_image(vector<unsigned char>& image, unsigned int seed, linkmasta_system system)
+{
+  unsigned int state = seed * 2654435761u + 1;
+  for (unsigned char& byte : image)
+  {
+    state = state * 1103515245u + 12345u;
+    byte = (unsigned char) (state >> 16);
+  }
+  
+  // Neo Geo Pocket games start with a license, which is how a cartridge
+  // tells that a game is present
+  if (system == LINKMASTA_NEO_GEO_POCKET && image.size() >= strlen(NGP_LICENSE))
+  {
+    memcpy(image.data(), NGP_LICENSE, strlen(NGP_LICENSE));
+  }
+}
+
+static string timing_field(vector<double>& seconds, unsigned long long num_bytes)
+{
+  linkmasta_benchmark::sample_stats stats = linkmasta_benchmark::compute_stats(seconds);
+  ostringstream field;
+  field << "{\"bytes\": " << num_bytes << ", \"seconds\": ";
+  linkmasta_benchmark::write_stats(field, stats);
+  field << ", \"bytes_per_second\": " << (stats.min > 0 ? num_bytes / stats.min : 0) << "}";
+  return field.str();
+}
+
+
+
+cartridge_benchmark::options::options()
+  : neo_geo_pocket(true), wonderswan(true), repetitions(1)
+{
+  // Nothing else to do
+}
+
+cartridge_benchmark::cartridge_benchmark(const options& opts)
+  : m_options(opts)
+{
+  // Nothing else to do
+}
+
+
+
+void cartridge_benchmark::run(ostream& out, unsigned int indent)
+{
+  string pad(indent, ' ');
+  
+  vector<latency_profile> profiles = m_options.profiles;
+  if (profiles.empty())
+  {
+    latency_profile instant = {"instant", 0, 0};
+    profiles.push_back(instant);
+  }
+  
+  out << "{\n" << pad << "  \"repetitions\": " << m_options.repetitions << ",\n";
+  out << pad << "  \"profiles\": [";
+  for (unsigned int p = 0; p < profiles.size(); ++p)
+  {
+    const latency_profile& profile = profiles[p];
+    out << (p == 0 ? "\n" : ",\n") << pad << "    {\n";
+    out << pad << "      \"name\": " << linkmasta_benchmark::json_string(profile.name) << ",\n";
+    out << pad << "      \"latency_us\": " << profile.latency_us << ",\n";
+    out << pad << "      \"bytes_per_second\": " << profile.bytes_per_second << ",\n";
+    out << pad << "      \"cartridges\": [";
+    
+    bool first = true;
+    for (const layout& cart_layout : layouts())
+    {
+      if ((cart_layout.system == LINKMASTA_NEO_GEO_POCKET && !m_options.neo_geo_pocket)
+          || (cart_layout.system == LINKMASTA_WONDERSWAN && !m_options.wonderswan))
+      {
+        continue;
+      }
+      out << (first ? "\n" : ",\n") << pad << "        " << measure_layout(cart_layout, profile, pad + "        ");
+      out.flush();
+      first = false;
+    }
+    out << (first ? "]\n" : "\n" + pad + "      ]\n") << pad << "    }";
+  }
+  out << "\n" << pad << "  ]\n" << pad << "}";
+}
+
+
+
+std::string cartridge_benchmark::measure_layout(const layout& cart_layout, const latency_profile& profile, const std::string& pad)
+{
+  // Fields are only added once complete so that an error part-way through
+  // still produces valid JSON
+  vector<string> fields;
+  fields.push_back(string("\"system\": ") + (cart_layout.system == LINKMASTA_WONDERSWAN ? "\"ws\"" : "\"ngp\""));
+  fields.push_back("\"layout\": " + linkmasta_benchmark::json_string(cart_layout.name));
+  
+  emulated_usb_device::options emulator_opts(cart_layout.system);
+  emulator_opts.latency_us = profile.latency_us;
+  emulator_opts.bytes_per_second = profile.bytes_per_second;
+  emulator_opts.num_chips = cart_layout.num_chips;
+  emulator_opts.faults = m_options.faults;
+  if (cart_layout.system == LINKMASTA_WONDERSWAN)
+  {
+    emulator_opts.num_slots = cart_layout.num_slots;
+    emulator_opts.slot_addr_lines = cart_layout.slot_addr_lines;
+  }
+  else
+  {
+    emulator_opts.device_id = cart_layout.device_id;
+  }
+  
+  // The linkmasta takes ownership of the USB device
+  unique_ptr<linkmasta_device> linkmasta;
+  unique_ptr<cartridge> cart;
+  emulated_usb_device* usb_device = new emulated_usb_device(emulator_opts);
+  try
+  {
+    if (cart_layout.system == LINKMASTA_WONDERSWAN)
+    {
+      linkmasta.reset(new ws_linkmasta_device(usb_device));
+    }
+    else
+    {
+      linkmasta.reset(new ngp_linkmasta_device(usb_device));
+    }
+    linkmasta->init();
+    linkmasta->open();
+    cart.reset(linkmasta->build_cartridge());
+    
+    // A Neo Geo Pocket game fills the whole cartridge, a WonderSwan game a
+    // single slot
+    int slot = (cart_layout.system == LINKMASTA_WONDERSWAN ? 0 : cartridge::SLOT_ALL);
+    unsigned int num_bytes = (slot == cartridge::SLOT_ALL ? cart->descriptor()->num_bytes : cart->slot_size(slot));
+    fields.push_back("\"slot\": " + to_string(slot));
+    vector<unsigned char> image(num_bytes);
+    
+    vector<double> flash_seconds;
+    vector<double> verify_seconds;
+    vector<double> backup_seconds;
+    unsigned long long backup_bytes = 0;
+    for (unsigned int i = 0; i < m_options.repetitions; ++i)
+    {
+      fill_image(image, i, cart_layout.system);
+      
+      auto start = bench_clock::now();
+      cart->restore_cartridge_game_data(image.data(), num_bytes, slot);
+      flash_seconds.push_back(seconds_since(start));
+      
+      start = bench_clock::now();
+      bool matches = cart->compare_cartridge_game_data(image.data(), num_bytes, slot);
+      verify_seconds.push_back(seconds_since(start));
+      if (!matches)
+      {
+        throw std::runtime_error("Flashed game doesn't match its image");
+      }
+      
+      counting_sink sink;
+      sink_ostream fout(sink);
+      start = bench_clock::now();
+      cart->backup_cartridge_game_data(fout, slot);
+      fout.flush();
+      backup_seconds.push_back(seconds_since(start));
+      backup_bytes = sink.num_bytes();
+    }
+    fields.push_back("\"flash\": " + timing_field(flash_seconds, num_bytes));
+    fields.push_back("\"verify\": " + timing_field(verify_seconds, num_bytes));
+    fields.push_back("\"backup\": " + timing_field(backup_seconds, backup_bytes));
+    
+    // Restore the save data that was just backed up
+    stringstream save;
+    cart->backup_cartridge_save_data(save, slot);
+    string save_data = save.str();
+    vector<double> restore_seconds;
+    for (unsigned int i = 0; i < m_options.repetitions; ++i)
+    {
+      istringstream fin(save_data);
+      auto start = bench_clock::now();
+      cart->restore_cartridge_save_data(fin, slot);
+      restore_seconds.push_back(seconds_since(start));
+    }
+    fields.push_back("\"save_restore\": " + timing_field(restore_seconds, save_data.size()));
+    
+    fields.push_back("\"error\": null");
+  }
+  catch (std::exception& ex)
+  {
+    fields.push_back("\"error\": " + linkmasta_benchmark::json_string(ex.what()));
+  }
+  if (m_options.faults.any())
+  {
+    fields.push_back("\"faults\": " + json_faults(usb_device->injected_faults()));
+  }
+  
+  // The cartridge uses the linkmasta, so has to go first
+  cart.reset();
+  linkmasta.reset();
+  
+  string result = "{";
+  for (unsigned int i = 0; i < fields.size(); ++i)
+  {
+    result += (i == 0 ? "\n" : ",\n") + pad + "  " + fields[i];
+  }
+  return result + "\n" + pad + "}";
+}
+
+std::string cartridge_benchmark::json_faults(const emulated_usb_device::fault_counts& counts)
+{
+  ostringstream field;
+  field << "{\"timeouts\": " << counts.timeouts
+        << ", \"short_reads\": " << counts.short_reads
+        << ", \"nak_storms\": " << counts.nak_storms
+        << ", \"corrupted_packets\": " << counts.corrupted_packets
+        << ", \"disconnects\": " << counts.disconnects << "}";
+  return field.str();
+}
+
+
+
+const std::vector<cartridge_benchmark::layout>& cartridge_benchmark::layouts()
+{
+  // Every chip size a Neo Geo Pocket FlashMasta is built with, alone and in
+  // pairs, and the ways a WonderSwan cartridge can split its flash into slots
+  static const layout known_layouts[] =
+  {
+    {"4 Mbit",              LINKMASTA_NEO_GEO_POCKET, 0xAB, 1, 1, 0},
+    {"8 Mbit",              LINKMASTA_NEO_GEO_POCKET, 0x2C, 1, 1, 0},
+    {"16 Mbit",             LINKMASTA_NEO_GEO_POCKET, 0x2F, 1, 1, 0},
+    {"2 x 4 Mbit",          LINKMASTA_NEO_GEO_POCKET, 0xAB, 2, 1, 0},
+    {"2 x 8 Mbit",          LINKMASTA_NEO_GEO_POCKET, 0x2C, 2, 1, 0},
+    {"2 x 16 Mbit",         LINKMASTA_NEO_GEO_POCKET, 0x2F, 2, 1, 0},
+    {"8 slots of 16 MiB",   LINKMASTA_WONDERSWAN,     0x7E, 1, 8, 24},
+    {"4 slots of 32 MiB",   LINKMASTA_WONDERSWAN,     0x7E, 1, 4, 25},
+    {"2 slots of 64 MiB",   LINKMASTA_WONDERSWAN,     0x7E, 1, 2, 26},
+    {"1 slot of 128 MiB",   LINKMASTA_WONDERSWAN,     0x7E, 1, 1, 27},
+  };
+  static const vector<layout> all(known_layouts, known_layouts + sizeof(known_layouts) / sizeof(known_layouts[0]));
+  return all;
+}
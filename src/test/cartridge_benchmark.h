@@ -0,0 +1,86 @@
+//
+//  cartridge_benchmark.h
+//  FlashMasta
+//
+//  Created by Dan on 9/12/15.
+//  Copyright (c) 2015 7400 Circuits. All rights reserved.
+//
+
+#ifndef __CARTRIDGE_BENCHMARK_H__
+#define __CARTRIDGE_BENCHMARK_H__
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "linkmasta/emulated_usb_device.h"
+#include "linkmasta/linkmasta_device.h"
+
+// Non-interactive end-to-end benchmark of whole cartridge operations on
+// emulated devices. For every known chip size and slot layout, builds an
+// emulated cartridge and times flashing, verifying, and backing up a game and
+// restoring save data through ngp_cartridge and ws_cartridge, the same way
+// the application does, under each of a set of latency profiles. Results
+// are written as a JSON object.
+class cartridge_benchmark
+{
+public:
+  // Transport of the emulated device, see emulated_usb_device::options
+  struct latency_profile
+  {
+    std::string  name;
+    unsigned int latency_us;
+    unsigned int bytes_per_second;
+  };
+
+  struct options
+  {
+    // Profiles to run every layout under. Instantaneous if empty
+    std::vector<latency_profile> profiles;
+
+    // Systems whose layouts to run
+    bool         neo_geo_pocket;
+    bool         wonderswan;
+
+    unsigned int repetitions;
+
+    // Faults injected into every emulated cartridge, to time the retry and
+    // recovery paths
+    emulated_usb_device::fault_options faults;
+
+    options();
+  };
+
+  explicit cartridge_benchmark(const options& opts);
+
+  // Runs all benchmarks and writes the results to out as a JSON object,
+  // indented by the given number of spaces. Errors are recorded in the
+  // object rather than thrown.
+  void run(std::ostream& out, unsigned int indent = 0);
+
+  // Writes the number of each kind of fault injected as a JSON object
+  static std::string json_faults(const emulated_usb_device::fault_counts& counts);
+
+private:
+  // An emulated cartridge. Neo Geo Pocket layouts are set by the chip's
+  // device ID and the number of chips, WonderSwan ones by the number and
+  // size of the slots
+  struct layout
+  {
+    const char*      name;
+    linkmasta_system system;
+    unsigned char    device_id;
+    unsigned int     num_chips;
+    unsigned int     num_slots;
+    unsigned int     slot_addr_lines;
+  };
+
+  // Runs every operation on one layout and returns the JSON object of its
+  // results
+  std::string measure_layout(const layout& cart_layout, const latency_profile& profile, const std::string& pad);
+
+  static const std::vector<layout>& layouts();
+
+  const options m_options;
+};
+
+#endif /* defined(__CARTRIDGE_BENCHMARK_H__) */
@@ -0,0 +1,336 @@
+//
+//  host_benchmark.cpp
+//  FlashMasta
+//
+//  Created by Dan on 9/12/15.
+//  Copyright (c) 2015 7400 Circuits. All rights reserved.
+//
+
+#include "host_benchmark.h"
+#include "linkmasta_benchmark.h"
+
+#include "cartridge/ngp_cartridge.h"
+#include "common/block_compare.h"
+#include "game/game_catalog.h"
+#include "game/game_hash.h"
+#include "linkmasta/ngp_linkmasta_messages.h"
+#include "linkmasta/ws_linkmasta_messages.h"
+#include "task/task_controller.h"
+#include "task/throttled_task_controller.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+#define PACKET_SIZE        64
+#define KERNEL_BLOCK_SIZE  0x10000
+#define KERNEL_DIVISOR     100
+#define NGP_METADATA_SIZE  48
+#define WS_METADATA_SIZE   16
+
+typedef chrono::steady_clock bench_clock;
+
+// Results of every batch are folded into this so that none of the work can be
+// optimized away
+static volatile unsigned int g_result = 0;
+
+
+
+host_benchmark::options::options()
+  : iterations(100000), repetitions(5)
+{
+  // Nothing else to do
+}
+
+host_benchmark::host_benchmark(const options& opts)
+  : m_options(opts)
+{
+  // Nothing else to do
+}
+
+
+
+void host_benchmark::run(ostream& out, unsigned int indent)
+{
+  string pad(indent, ' ');
+  unsigned int iterations = (m_options.iterations > 0 ? m_options.iterations : 1);
+  unsigned int kernel_iterations = (iterations / KERNEL_DIVISOR > 0 ? iterations / KERNEL_DIVISOR : 1);
+  
+  vector<string> fields;
+  fields.push_back("\"iterations\": " + to_string(iterations));
+  fields.push_back("\"repetitions\": " + to_string(m_options.repetitions));
+  
+  try
+  {
+    // Packets as the transfer loops build and parse them, one per operation
+    uint8_t packet[PACKET_SIZE];
+    uint8_t data[PACKET_SIZE];
+    for (unsigned int i = 0; i < PACKET_SIZE; ++i)
+    {
+      data[i] = (uint8_t) (i * 7 + 1);
+    }
+    
+    fields.push_back("\"ngp_encode_read64xN\": " + measure(iterations, [&](unsigned int n)
+    {
+      unsigned int result = 0;
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        ngpmsg::build_read64xN_command(packet, i * PACKET_SIZE, 0, 16);
+        result += packet[1];
+      }
+      return result;
+    }));
+    
+    fields.push_back("\"ngp_decode_read64xN\": " + measure(iterations, [&](unsigned int n)
+    {
+      ngpmsg::build_read64xN_command(packet, 0x123456, 1, 16);
+      unsigned int result = 0;
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        uint8_t addr_hb, addr_mb, addr_lb, chip, count;
+        ngpmsg::get_read64xN_message(packet, &addr_hb, &addr_mb, &addr_lb, &chip, &count);
+        result += addr_lb + count;
+      }
+      return result;
+    }));
+    
+    fields.push_back("\"ngp_encode_write64xN_data\": " + measure(iterations, [&](unsigned int n)
+    {
+      unsigned int result = 0;
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        data[0] = (uint8_t) i;
+        ngpmsg::build_flash_write64xN_data_packet(packet, data);
+        result += packet[0];
+      }
+      return result;
+    }, PACKET_SIZE));
+    
+    fields.push_back("\"ngp_decode_read_reply\": " + measure(iterations, [&](unsigned int n)
+    {
+      ngpmsg::build_read_reply(packet, 0x12, 0x34, 0x56, 0x78, 0);
+      unsigned int result = 0;
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        uint32_t address;
+        uint8_t value;
+        result += (unsigned int) ngpmsg::get_read_reply(packet, &address, &value) + value;
+      }
+      return result;
+    }));
+    
+    fields.push_back("\"ws_encode_read64xN\": " + measure(iterations, [&](unsigned int n)
+    {
+      unsigned int result = 0;
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        wsmsg::build_read64xN_command(packet, i * PACKET_SIZE, 16, 0);
+        result += packet[1];
+      }
+      return result;
+    }));
+    
+    fields.push_back("\"ws_decode_read64xN\": " + measure(iterations, [&](unsigned int n)
+    {
+      wsmsg::build_read64xN_command(packet, 0x123456, 16, 0);
+      unsigned int result = 0;
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        uint8_t addr_hb, addr_mb, addr_lb, addr_no, count, target;
+        wsmsg::get_read64xN_message(packet, &addr_hb, &addr_mb, &addr_lb, &addr_no, &count, &target);
+        result += addr_lb + count;
+      }
+      return result;
+    }));
+    
+    fields.push_back("\"ws_encode_write64xN_data\": " + measure(iterations, [&](unsigned int n)
+    {
+      unsigned int result = 0;
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        data[0] = (uint8_t) i;
+        wsmsg::build_flash_write64xN_data_packet(packet, data);
+        result += packet[0];
+      }
+      return result;
+    }, PACKET_SIZE));
+    
+    fields.push_back("\"ws_decode_read16_reply\": " + measure(iterations, [&](unsigned int n)
+    {
+      wsmsg::build_read16_reply(packet, 0x12, 0x34, 0x56, 0x78, 0x9A);
+      unsigned int result = 0;
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        uint32_t address;
+        uint16_t value;
+        result += (unsigned int) wsmsg::get_read16_reply(packet, &address, &value) + value;
+      }
+      return result;
+    }));
+    
+    // The kernels over identical and blank blocks, their worst case since
+    // every byte has to be looked at
+    vector<unsigned char> block_a(KERNEL_BLOCK_SIZE, 0x5A);
+    vector<unsigned char> block_b(KERNEL_BLOCK_SIZE, 0x5A);
+    vector<unsigned char> blank(KERNEL_BLOCK_SIZE, 0xFF);
+    
+    fields.push_back("\"block_compare\": " + measure(kernel_iterations, [&](unsigned int n)
+    {
+      unsigned int result = 0;
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        result += find_first_difference(block_a.data(), block_b.data(), KERNEL_BLOCK_SIZE);
+      }
+      return result;
+    }, KERNEL_BLOCK_SIZE));
+    
+    fields.push_back("\"blank_check\": " + measure(kernel_iterations, [&](unsigned int n)
+    {
+      unsigned int result = 0;
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        result += (is_blank_block(blank.data(), KERNEL_BLOCK_SIZE) ? 1 : 0);
+      }
+      return result;
+    }, KERNEL_BLOCK_SIZE));
+    
+    // Parsing the metadata at the start of every Neo Geo Pocket game
+    unsigned char header[NGP_METADATA_SIZE];
+    memset(header, ' ', sizeof(header));
+    memcpy(header, "COPYRIGHT BY SNK CORPORATION", 28);
+    
+    fields.push_back("\"ngp_read_metadata\": " + measure(iterations, [&](unsigned int n)
+    {
+      unsigned int result = 0;
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        header[32] = (unsigned char) i;
+        ngp_cartridge::game_metadata metadata;
+        metadata.read_from_data_array(header);
+        result += metadata.game_id;
+      }
+      return result;
+    }));
+    
+    // Progress reports as a transfer loop sends them, once per packet
+    fields.push_back("\"task_update\": " + measure(iterations, [](unsigned int n)
+    {
+      task_controller controller;
+      controller.on_task_start((int) n);
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        controller.on_task_update(RUNNING, 1);
+      }
+      controller.on_task_end(COMPLETED, (int) n);
+      return (unsigned int) controller.get_task_work_progress();
+    }));
+    
+    fields.push_back("\"throttled_task_update\": " + measure(iterations, [](unsigned int n)
+    {
+      task_controller receiver;
+      throttled_task_controller controller(&receiver);
+      controller.on_task_start((int) n);
+      for (unsigned int i = 0; i < n; ++i)
+      {
+        controller.on_task_update(RUNNING, 1);
+      }
+      controller.on_task_end(COMPLETED, (int) n);
+      return (unsigned int) receiver.get_task_work_progress();
+    }));
+    
+    if (!m_options.catalog_dir.empty())
+    {
+      fields.push_back("\"ngp_identify\": " + measure_catalog(m_options.catalog_dir + "/ngpgames", true));
+      fields.push_back("\"ws_identify\": " + measure_catalog(m_options.catalog_dir + "/wsgames", false));
+    }
+    
+    fields.push_back("\"error\": null");
+  }
+  catch (std::exception& ex)
+  {
+    fields.push_back("\"error\": " + linkmasta_benchmark::json_string(ex.what()));
+  }
+  
+  out << "{";
+  for (unsigned int i = 0; i < fields.size(); ++i)
+  {
+    out << (i == 0 ? "\n" : ",\n") << pad << "  " << fields[i];
+  }
+  out << "\n" << pad << "}";
+}
+
+
+
+std::string host_benchmark::measure(unsigned int iterations, const operation_batch& batch, unsigned int bytes_per_op)
+{
+  // Warm up caches and branch predictors before anything is timed
+  g_result += batch(iterations / 10 + 1);
+  
+  vector<double> ns_per_op;
+  for (unsigned int i = 0; i < m_options.repetitions; ++i)
+  {
+    auto start = bench_clock::now();
+    g_result += batch(iterations);
+    double seconds = chrono::duration<double>(bench_clock::now() - start).count();
+    ns_per_op.push_back(seconds * 1e9 / iterations);
+  }
+  
+  linkmasta_benchmark::sample_stats stats = linkmasta_benchmark::compute_stats(ns_per_op);
+  ostringstream field;
+  field << "{\"ns_per_op\": ";
+  linkmasta_benchmark::write_stats(field, stats);
+  if (bytes_per_op > 0)
+  {
+    field << ", \"bytes_per_second\": " << (stats.min > 0 ? bytes_per_op * 1e9 / stats.min : 0);
+  }
+  field << "}";
+  return field.str();
+}
+
+std::string host_benchmark::measure_catalog(const std::string& base_path, bool neo_geo_pocket)
+{
+  unique_ptr<game_catalog> catalog;
+  try
+  {
+    catalog.reset(open_game_catalog(base_path, neo_geo_pocket ? game_descriptor::NEO_GEO_POCKET : game_descriptor::WONDERSWAN));
+  }
+  catch (std::exception& ex)
+  {
+    return "{\"error\": " + linkmasta_benchmark::json_string(ex.what()) + "}";
+  }
+  
+  // The lookup identify_game() makes once a cartridge's metadata has been
+  // read: hashing the metadata and finding the hash in the catalog. Game IDs
+  // run through every value, so most lookups are of unknown games
+  unsigned char metadata[NGP_METADATA_SIZE];
+  memset(metadata, 0, sizeof(metadata));
+  game_catalog* lookup = catalog.get();
+  return measure(m_options.iterations > 0 ? m_options.iterations : 1, [&metadata, lookup, neo_geo_pocket](unsigned int n)
+  {
+    unsigned int result = 0;
+    for (unsigned int i = 0; i < n; ++i)
+    {
+      long long hash;
+      bool hashed;
+      if (neo_geo_pocket)
+      {
+        metadata[32] = (unsigned char) i;
+        metadata[33] = (unsigned char) (i >> 8);
+        hashed = ngp_image_hash(metadata, NGP_METADATA_SIZE, &hash);
+      }
+      else
+      {
+        metadata[WS_METADATA_SIZE - 8] = (unsigned char) i;
+        metadata[WS_METADATA_SIZE - 1] = (unsigned char) (i >> 8);
+        hashed = ws_image_hash(metadata, WS_METADATA_SIZE, &hash);
+      }
+      result += (hashed && lookup->identify_hash(hash) != nullptr ? 1 : 0);
+    }
+    return result;
+  });
+}
@@ -0,0 +1,62 @@
+//
+//  host_benchmark.h
+//  FlashMasta
+//
+//  Created by Dan on 9/12/15.
+//  Copyright (c) 2015 7400 Circuits. All rights reserved.
+//
+
+#ifndef __HOST_BENCHMARK_H__
+#define __HOST_BENCHMARK_H__
+
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Non-interactive benchmark of the work the host does around each transfer,
+// with no device attached: encoding and decoding linkmasta packets, the block
+// compare and blank-check kernels, parsing game metadata, looking games up in
+// the catalogs, and reporting progress to task controllers. Every benchmark
+// runs a fixed number of iterations so that runs can be compared. Results are
+// written as a JSON object.
+class host_benchmark
+{
+public:
+  struct options
+  {
+    // Operations per repetition of the per-packet benchmarks. The kernels
+    // run over whole blocks, so run a hundredth as many
+    unsigned int iterations;
+    unsigned int repetitions;
+
+    // Directory holding the ngpgames and wsgames catalogs. Catalog lookups
+    // are skipped if empty
+    std::string  catalog_dir;
+
+    options();
+  };
+
+  explicit host_benchmark(const options& opts);
+
+  // Runs all benchmarks and writes the results to out as a JSON object,
+  // indented by the given number of spaces. Errors are recorded in the
+  // object rather than thrown.
+  void run(std::ostream& out, unsigned int indent = 0);
+
+private:
+  // Function running the given number of operations and returning a value
+  // built from their results, so that the compiler can't leave them out
+  typedef std::function<unsigned int(unsigned int)> operation_batch;
+
+  // Times a batch of operations once per repetition and returns the JSON
+  // object describing the nanoseconds each operation took. Given a number of
+  // bytes per operation, the throughput is included too
+  std::string measure(unsigned int iterations, const operation_batch& batch, unsigned int bytes_per_op = 0);
+
+  std::string measure_catalog(const std::string& base_path, bool neo_geo_pocket);
+
+  const options m_options;
+};
+
+#endif /* defined(__HOST_BENCHMARK_H__) */
@@ -0,0 +1,370 @@
+//
+//  linkmasta_benchmark.cpp
+//  FlashMasta
+//
+//  Created by Dan on 9/12/15.
+//  Copyright (c) 2015 7400 Circuits. All rights reserved.
+//
+
+#include "linkmasta_benchmark.h"
+
+#include "linkmasta/linkmasta_device.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+#define PACKET_SIZE            64
+#define ERASE_TIMEOUT_MS       60000
+#define ERASE_POLL_INTERVAL_MS 1
+
+typedef chrono::steady_clock bench_clock;
+
+static double seconds_since(bench_clock::time_point start)
+{
+  return chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+
+
+linkmasta_benchmark::options::options()
+  : chip(0), latency_samples(1000), repetitions(5),
+    dual_chip(false), second_chip(1), destructive(false), block_address(0), block_size(0x10000)
+{
+  for (unsigned int packets = 1; packets <= 1024; packets *= 4)
+  {
+    batch_sizes.push_back(packets * PACKET_SIZE);
+  }
+  pipeline_depths.push_back(1);
+  pipeline_depths.push_back(2);
+  pipeline_depths.push_back(4);
+}
+
+linkmasta_benchmark::linkmasta_benchmark(linkmasta_device* linkmasta, const options& opts)
+  : m_linkmasta(linkmasta), m_options(opts)
+{
+  // Nothing else to do
+}
+
+
+
+void linkmasta_benchmark::run(ostream& out, unsigned int indent)
+{
+  string pad(indent, ' ');
+  
+  // Fields are only added once complete so that an error part-way through a
+  // benchmark still produces valid JSON
+  vector<string> fields;
+  fields.push_back("\"system\": " + to_string((int) m_linkmasta->system()));
+  
+  try
+  {
+    fields.push_back("\"firmware\": " + json_string(m_linkmasta->firmware_version()));
+    fields.push_back("\"chip\": " + to_string(m_options.chip));
+    
+    // Round-trip latency of a single word read, which is one packet each way
+    ostringstream field;
+    field << "\"latency_us\": ";
+    write_stats(field, measure_latency());
+    fields.push_back(field.str());
+    
+    // Read throughput at each batch size, with and without pipelining
+    field.str("");
+    field << "\"read\": [";
+    bool first = true;
+    if (m_linkmasta->supports_read_bytes())
+    {
+      for (unsigned int num_bytes : m_options.batch_sizes)
+      {
+        vector<unsigned int> depths(1, 1);
+        if (m_linkmasta->supports_stream_read_bytes())
+        {
+          depths = m_options.pipeline_depths;
+        }
+        
+        for (unsigned int depth : depths)
+        {
+          double seconds = measure_read(num_bytes, depth);
+          field << (first ? "\n" : ",\n") << pad << "    {\"batch_bytes\": " << num_bytes
+                << ", \"batch_packets\": " << (num_bytes / PACKET_SIZE)
+                << ", \"pipeline_depth\": " << depth
+                << ", \"seconds\": " << seconds
+                << ", \"bytes_per_second\": " << (seconds > 0 ? num_bytes * m_options.repetitions / seconds : 0)
+                << "}";
+          first = false;
+        }
+      }
+    }
+    field << (first ? "]" : "\n" + pad + "  ]");
+    fields.push_back(field.str());
+    
+    // Both chips read at once against one after the other, same bytes each
+    if (m_options.dual_chip && m_linkmasta->supports_read_bytes())
+    {
+      field.str("");
+      field << "\"dual_chip_read\": {\"second_chip\": " << m_options.second_chip
+            << ", \"interleaved\": " << (m_linkmasta->supports_interleaved_read_bytes() ? "true" : "false")
+            << ", \"results\": [";
+      first = true;
+      for (unsigned int num_bytes : m_options.batch_sizes)
+      {
+        for (unsigned int depth : m_options.pipeline_depths)
+        {
+          double sequential = measure_dual_read(num_bytes, depth, false);
+          double interleaved = measure_dual_read(num_bytes, depth, true);
+          double total_bytes = 2.0 * num_bytes * m_options.repetitions;
+          field << (first ? "\n" : ",\n") << pad << "    {\"bytes_per_chip\": " << num_bytes
+                << ", \"pipeline_depth\": " << depth
+                << ", \"sequential_seconds\": " << sequential
+                << ", \"sequential_bytes_per_second\": " << (sequential > 0 ? total_bytes / sequential : 0)
+                << ", \"interleaved_seconds\": " << interleaved
+                << ", \"interleaved_bytes_per_second\": " << (interleaved > 0 ? total_bytes / interleaved : 0)
+                << ", \"speedup\": " << (interleaved > 0 ? sequential / interleaved : 0)
+                << "}";
+          first = false;
+        }
+      }
+      field << (first ? "]}" : "\n" + pad + "  ]}");
+      fields.push_back(field.str());
+    }
+    
+    // Erase time and program throughput destroy data, so are opt-in
+    if (m_options.destructive && m_linkmasta->supports_erase_chip_block()
+        && m_linkmasta->supports_program_bytes())
+    {
+      vector<double> erase_ms;
+      field.str("");
+      field << "\"program\": [";
+      first = true;
+      for (unsigned int num_bytes : m_options.batch_sizes)
+      {
+        if (num_bytes > m_options.block_size)
+        {
+          continue;
+        }
+        
+        double seconds = 0;
+        for (unsigned int i = 0; i < m_options.repetitions; ++i)
+        {
+          erase_ms.push_back(measure_erase());
+          seconds += measure_program(num_bytes);
+        }
+        field << (first ? "\n" : ",\n") << pad << "    {\"batch_bytes\": " << num_bytes
+              << ", \"batch_packets\": " << (num_bytes / PACKET_SIZE)
+              << ", \"seconds\": " << seconds
+              << ", \"bytes_per_second\": " << (seconds > 0 ? num_bytes * m_options.repetitions / seconds : 0)
+              << "}";
+        first = false;
+      }
+      field << (first ? "]" : "\n" + pad + "  ]");
+      fields.push_back(field.str());
+      
+      // Leave the block erased
+      erase_ms.push_back(measure_erase());
+      field.str("");
+      field << "\"block_erase_ms\": ";
+      write_stats(field, compute_stats(erase_ms));
+      fields.push_back(field.str());
+    }
+    
+    fields.push_back("\"error\": null");
+  }
+  catch (std::exception& ex)
+  {
+    fields.push_back("\"error\": " + json_string(ex.what()));
+  }
+  
+  out << "{";
+  for (unsigned int i = 0; i < fields.size(); ++i)
+  {
+    out << (i == 0 ? "\n" : ",\n") << pad << "  " << fields[i];
+  }
+  out << "\n" << pad << "}";
+}
+
+
+
+linkmasta_benchmark::sample_stats linkmasta_benchmark::measure_latency()
+{
+  vector<double> samples;
+  samples.reserve(m_options.latency_samples);
+  for (unsigned int i = 0; i < m_options.latency_samples; ++i)
+  {
+    auto start = bench_clock::now();
+    m_linkmasta->read_word(m_options.chip, 0);
+    samples.push_back(seconds_since(start) * 1000000.0);
+  }
+  return compute_stats(samples);
+}
+
+double linkmasta_benchmark::measure_read(unsigned int num_bytes, unsigned int pipeline_depth)
+{
+  vector<linkmasta_device::data_t> buffer(num_bytes);
+  
+  auto start = bench_clock::now();
+  for (unsigned int i = 0; i < m_options.repetitions; ++i)
+  {
+    unsigned int num_read;
+    if (pipeline_depth > 1)
+    {
+      num_read = m_linkmasta->stream_read_bytes(m_options.chip, 0, buffer.data(), num_bytes, pipeline_depth);
+    }
+    else
+    {
+      num_read = m_linkmasta->read_bytes(m_options.chip, 0, buffer.data(), num_bytes);
+    }
+    
+    if (num_read != num_bytes)
+    {
+      throw std::runtime_error("Short read of " + to_string(num_read) + " of " + to_string(num_bytes) + " bytes");
+    }
+  }
+  return seconds_since(start);
+}
+
+double linkmasta_benchmark::measure_dual_read(unsigned int num_bytes, unsigned int pipeline_depth, bool interleaved)
+{
+  vector<linkmasta_device::data_t> buffer(2 * num_bytes);
+  linkmasta_device::read_lane lanes[2] = {
+    {m_options.chip, 0, buffer.data(), num_bytes, 0},
+    {m_options.second_chip, 0, buffer.data() + num_bytes, num_bytes, 0}
+  };
+  
+  auto start = bench_clock::now();
+  for (unsigned int i = 0; i < m_options.repetitions; ++i)
+  {
+    // Interleaved reads keep the same depth queued for each chip
+    unsigned int num_read = 0;
+    if (interleaved)
+    {
+      num_read = m_linkmasta->interleaved_read_bytes(lanes, 2, pipeline_depth * 2);
+    }
+    else
+    {
+      for (const linkmasta_device::read_lane& lane : lanes)
+      {
+        num_read += m_linkmasta->stream_read_bytes(lane.chip, lane.start_address, lane.buffer, lane.num_bytes, pipeline_depth);
+      }
+    }
+    
+    if (num_read != 2 * num_bytes)
+    {
+      throw std::runtime_error("Short read of " + to_string(num_read) + " of " + to_string(2 * num_bytes) + " bytes");
+    }
+  }
+  return seconds_since(start);
+}
+
+double linkmasta_benchmark::measure_erase()
+{
+  auto start = bench_clock::now();
+  m_linkmasta->erase_chip_block(m_options.chip, m_options.block_address);
+  wait_for_erase(m_options.block_address);
+  return seconds_since(start) * 1000.0;
+}
+
+double linkmasta_benchmark::measure_program(unsigned int num_bytes)
+{
+  vector<linkmasta_device::data_t> buffer(num_bytes);
+  for (unsigned int i = 0; i < num_bytes; ++i)
+  {
+    buffer[i] = (linkmasta_device::data_t) (i * 7 + 1);
+  }
+  
+  auto start = bench_clock::now();
+  unsigned int num_written = m_linkmasta->program_bytes(m_options.chip, m_options.block_address, buffer.data(), num_bytes, false);
+  double seconds = seconds_since(start);
+  
+  if (num_written != num_bytes)
+  {
+    throw std::runtime_error("Short write of " + to_string(num_written) + " of " + to_string(num_bytes) + " bytes");
+  }
+  return seconds;
+}
+
+void linkmasta_benchmark::wait_for_erase(address_t address)
+{
+  // Erased flash reads back as all ones, same as ngp_chip::test_erasing()
+  auto start = bench_clock::now();
+  while ((m_linkmasta->read_word(m_options.chip, address) & 0xFF) != 0xFF)
+  {
+    if (seconds_since(start) * 1000.0 > ERASE_TIMEOUT_MS)
+    {
+      throw std::runtime_error("Timed out waiting for block erase");
+    }
+    this_thread::sleep_for(chrono::milliseconds(ERASE_POLL_INTERVAL_MS));
+  }
+}
+
+
+
+linkmasta_benchmark::sample_stats linkmasta_benchmark::compute_stats(vector<double>& samples)
+{
+  sample_stats stats = {0, 0, 0, 0, 0, 0};
+  if (samples.empty())
+  {
+    return stats;
+  }
+  
+  sort(samples.begin(), samples.end());
+  double sum = 0;
+  for (double sample : samples)
+  {
+    sum += sample;
+  }
+  
+  stats.samples = (unsigned int) samples.size();
+  stats.min = samples.front();
+  stats.max = samples.back();
+  stats.mean = sum / samples.size();
+  stats.p50 = samples[samples.size() / 2];
+  stats.p99 = samples[min(samples.size() - 1, samples.size() * 99 / 100)];
+  return stats;
+}
+
+void linkmasta_benchmark::write_stats(ostream& out, const sample_stats& stats)
+{
+  out << "{\"samples\": " << stats.samples
+      << ", \"min\": " << stats.min
+      << ", \"mean\": " << stats.mean
+      << ", \"p50\": " << stats.p50
+      << ", \"p99\": " << stats.p99
+      << ", \"max\": " << stats.max << "}";
+}
+
+string linkmasta_benchmark::json_string(const string& str)
+{
+  ostringstream out;
+  out << '"';
+  for (char c : str)
+  {
+    switch (c)
+    {
+    case '"':  out << "\\\""; break;
+    case '\\': out << "\\\\"; break;
+    case '\n': out << "\\n"; break;
+    case '\r': out << "\\r"; break;
+    case '\t': out << "\\t"; break;
+    default:
+      if ((unsigned char) c < 0x20)
+      {
+        char escaped[7];
+        snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned int) (unsigned char) c);
+        out << escaped;
+      }
+      else
+      {
+        out << c;
+      }
+      break;
+    }
+  }
+  out << '"';
+  return out.str();
+}
@@ -0,0 +1,85 @@
+//
+//  linkmasta_benchmark.h
+//  FlashMasta
+//
+//  Created by Dan on 9/12/15.
+//  Copyright (c) 2015 7400 Circuits. All rights reserved.
+//
+
+#ifndef __LINKMASTA_BENCHMARK_H__
+#define __LINKMASTA_BENCHMARK_H__
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "common/types.h"
+
+class linkmasta_device;
+
+// Non-interactive benchmark of a single linkmasta_device's transport. Measures
+// single-word round-trip latency, read and stream read throughput at several
+// batch sizes, and, if enabled, two-chip interleaved read throughput against
+// reading the chips in turn, block erase time and program throughput. Results
+// are written as a JSON object.
+class linkmasta_benchmark
+{
+public:
+  struct options
+  {
+    unsigned int              chip;
+    unsigned int              latency_samples;
+    unsigned int              repetitions;
+    std::vector<unsigned int> batch_sizes;
+    std::vector<unsigned int> pipeline_depths;
+    
+    // Reads of both chips at once are measured against this second chip
+    bool                      dual_chip;
+    unsigned int              second_chip;
+
+    // Erase and program benchmarks destroy the data in this block
+    bool                      destructive;
+    address_t                 block_address;
+    unsigned int              block_size;
+
+    options();
+  };
+
+  linkmasta_benchmark(linkmasta_device* linkmasta, const options& opts);
+
+  // Runs all benchmarks and writes the results to out as a JSON object,
+  // indented by the given number of spaces. Errors are recorded in the
+  // object rather than thrown.
+  void run(std::ostream& out, unsigned int indent = 0);
+
+  // Quotes and escapes a string for use in JSON output
+  static std::string json_string(const std::string& str);
+
+  // Summary of a set of samples, written as a JSON object by write_stats()
+  struct sample_stats
+  {
+    unsigned int samples;
+    double       min;
+    double       mean;
+    double       p50;
+    double       p99;
+    double       max;
+  };
+
+  // Sorts the samples and summarizes them
+  static sample_stats compute_stats(std::vector<double>& samples);
+  static void write_stats(std::ostream& out, const sample_stats& stats);
+
+private:
+
+  sample_stats measure_latency();
+  double       measure_read(unsigned int num_bytes, unsigned int pipeline_depth);
+  double       measure_dual_read(unsigned int num_bytes, unsigned int pipeline_depth, bool interleaved);
+  double       measure_erase();
+  double       measure_program(unsigned int num_bytes);
+  void         wait_for_erase(address_t address);
+
+  linkmasta_device* const m_linkmasta;
+  const options           m_options;
+};
+
+#endif /* defined(__LINKMASTA_BENCHMARK_H__) */
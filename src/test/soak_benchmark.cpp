@@ -0,0 +1,342 @@
+//
+//  soak_benchmark.cpp
+//  FlashMasta
+//
+//  Created by Dan on 9/12/15.
+//  Copyright (c) 2015 7400 Circuits. All rights reserved.
+//
+
+#include "soak_benchmark.h"
+#include "linkmasta_benchmark.h"
+
+#include "cartridge/cartridge.h"
+#include "common/output_sink.h"
+#include "linkmasta/linkmasta_device.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#if defined(OS_WINDOWS)
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#elif defined(OS_MACOSX)
+#include <mach/mach.h>
+#elif defined(OS_LINUX)
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Bytes at the start and end of a game left alone when generating one to
+// flash, where Neo Geo Pocket games keep their license and WonderSwan games
+// the footer giving their size
+#define KEPT_HEADER_BYTES 0x40
+#define KEPT_FOOTER_BYTES 0x10
+
+typedef chrono::steady_clock bench_clock;
+
+static double seconds_since(bench_clock::time_point start)
+{
+  return chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// Sink keeping what a backup writes in memory
+class memory_sink : public output_sink
+{
+public:
+  memory_sink() : m_position(0) {}
+  
+  void write(const unsigned char* data, unsigned int num_bytes)
+  {
+    if (m_position + num_bytes > m_data.size())
+    {
+      m_data.resize(m_position + num_bytes);
+    }
+    copy(data, data + num_bytes, m_data.begin() + m_position);
+    m_position += num_bytes;
+  }
+  void seek(unsigned long long offset) { m_position = offset; }
+  long long tell() { return (long long) m_position; }
+  void flush() {}
+  
+  vector<unsigned char>& data() { return m_data; }
+
+private:
+  vector<unsigned char> m_data;
+  unsigned long long    m_position;
+};
+
+// Changes every byte of a game but the ones saying a game is there and how
+// large it is, differently from one seed to the next so that every block has
+// to be programmed again
+static void mix_image(vector<unsigned char>& image, const vector<unsigned char>& original, unsigned int seed)
+{
+  image = original;
+  unsigned int state = seed * 2654435761u + 1;
+  for (size_t i = KEPT_HEADER_BYTES; i + KEPT_FOOTER_BYTES < image.size(); ++i)
+  {
+    state = state * 1103515245u + 12345u;
+    image[i] ^= (unsigned char) (state >> 16);
+  }
+}
+
+static string csv_string(const string& str)
+{
+  string quoted = "\"";
+  for (char c : str)
+  {
+    quoted += (c == '"' ? "\"\"" : string(1, c));
+  }
+  return quoted + "\"";
+}
+
+static string rate_field(unsigned long long num_bytes, double seconds)
+{
+  return (seconds > 0 ? to_string((unsigned long long) (num_bytes / seconds)) : string());
+}
+
+static void backup_game(cartridge* cart, int slot, vector<unsigned char>& data)
+{
+  memory_sink sink;
+  sink_ostream fout(sink);
+  cart->backup_cartridge_game_data(fout, slot);
+  fout.flush();
+  data.swap(sink.data());
+}
+
+
+
+soak_benchmark::options::options()
+  : hours(8.0), cycles(0), pause_ms(0), latency_samples(100), flash(false)
+{
+  // Nothing else to do
+}
+
+soak_benchmark::soak_benchmark(const options& opts)
+  : m_options(opts)
+{
+  // Nothing else to do
+}
+
+soak_benchmark::~soak_benchmark()
+{
+  // Nothing else to do
+}
+
+void soak_benchmark::add_device(const std::string& name, linkmasta_device* linkmasta)
+{
+  device_state* device = new device_state;
+  device->name = name;
+  device->linkmasta = linkmasta;
+  device->slot = cartridge::SLOT_ALL;
+  device->cycles = 0;
+  device->errors = 0;
+  m_devices.push_back(unique_ptr<device_state>(device));
+}
+
+
+
+bool soak_benchmark::run(ostream& out)
+{
+  out << "timestamp,elapsed_seconds,cycle,device,flash_bytes_per_second,backup_bytes,"
+      << "backup_bytes_per_second,verify_bytes_per_second,latency_p50_us,latency_p95_us,"
+      << "latency_p99_us,latency_max_us,resident_kib,cycle_errors,errors,error_rate,error" << endl;
+  
+  auto start = bench_clock::now();
+  for (unsigned int cycle = 0; m_options.cycles == 0 || cycle < m_options.cycles; ++cycle)
+  {
+    if (m_options.hours > 0 && seconds_since(start) >= m_options.hours * 3600.0)
+    {
+      break;
+    }
+    
+    // Devices take turns so they don't compete for the bus
+    for (auto& device : m_devices)
+    {
+      run_cycle(*device, cycle, seconds_since(start), out);
+    }
+    
+    if (m_options.pause_ms > 0)
+    {
+      this_thread::sleep_for(chrono::milliseconds(m_options.pause_ms));
+    }
+  }
+  
+  bool success = true;
+  for (auto& device : m_devices)
+  {
+    if (m_options.flash)
+    {
+      restore_original(*device);
+    }
+    success = success && device->errors == 0;
+    device->cart.reset();
+  }
+  return success;
+}
+
+unsigned long long soak_benchmark::resident_kib()
+{
+#if defined(OS_WINDOWS)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+  {
+    return counters.WorkingSetSize / 1024;
+  }
+#elif defined(OS_MACOSX)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) == KERN_SUCCESS)
+  {
+    return info.resident_size / 1024;
+  }
+#elif defined(OS_LINUX)
+  // The second field of statm is the resident set in pages
+  FILE* file = fopen("/proc/self/statm", "r");
+  if (file != nullptr)
+  {
+    unsigned long long size = 0;
+    unsigned long long resident = 0;
+    int num_read = fscanf(file, "%llu %llu", &size, &resident);
+    fclose(file);
+    if (num_read == 2)
+    {
+      return resident * (unsigned long long) sysconf(_SC_PAGESIZE) / 1024;
+    }
+  }
+#endif
+  return 0;
+}
+
+
+
+void soak_benchmark::run_cycle(device_state& device, unsigned int cycle, double elapsed, ostream& out)
+{
+  time_t now = time(nullptr);
+  char timestamp[32];
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  
+  string flash_rate;
+  string backup_size;
+  string backup_rate;
+  string verify_rate;
+  linkmasta_benchmark::sample_stats latency = {0, 0, 0, 0, 0, 0};
+  double latency_p95 = 0;
+  string error;
+  unsigned int cycle_errors = 0;
+  
+  try
+  {
+    // Each cycle opens the device afresh, the way each job would
+    linkmasta_device::session session(device.linkmasta);
+    prepare(device);
+    
+    // The game the cartridge should hold once this cycle's flash is done
+    vector<unsigned char> flashed;
+    const vector<unsigned char>* expected = &device.original;
+    if (m_options.flash)
+    {
+      mix_image(flashed, device.original, cycle + 1);
+      auto start = bench_clock::now();
+      device.cart->restore_cartridge_game_data(flashed.data(), (unsigned int) flashed.size(), device.slot);
+      flash_rate = rate_field(flashed.size(), seconds_since(start));
+      expected = &flashed;
+    }
+    
+    vector<double> samples;
+    samples.reserve(m_options.latency_samples);
+    for (unsigned int i = 0; i < m_options.latency_samples; ++i)
+    {
+      auto start = bench_clock::now();
+      device.linkmasta->read_word(0, 0);
+      samples.push_back(seconds_since(start) * 1000000.0);
+    }
+    latency = linkmasta_benchmark::compute_stats(samples);
+    latency_p95 = (samples.empty() ? 0 : samples[min(samples.size() - 1, samples.size() * 95 / 100)]);
+    
+    vector<unsigned char> data;
+    auto start = bench_clock::now();
+    backup_game(device.cart.get(), device.slot, data);
+    backup_rate = rate_field(data.size(), seconds_since(start));
+    backup_size = to_string(data.size());
+    if (data != *expected)
+    {
+      ++cycle_errors;
+      error = "Backup differs from the game on the cartridge";
+    }
+    
+    start = bench_clock::now();
+    bool matches = device.cart->compare_cartridge_game_data(expected->data(), (unsigned int) expected->size(), device.slot);
+    verify_rate = rate_field(expected->size(), seconds_since(start));
+    if (!matches)
+    {
+      ++cycle_errors;
+      error = "Cartridge doesn't match the game on it";
+    }
+  }
+  catch (std::exception& ex)
+  {
+    // Start over with a fresh cartridge on the next cycle, in case the
+    // failure left it in the middle of something
+    ++cycle_errors;
+    error = ex.what();
+    device.cart.reset();
+  }
+  
+  ++device.cycles;
+  device.errors += cycle_errors;
+  
+  out << timestamp << "," << elapsed << "," << cycle << "," << csv_string(device.name) << ","
+      << flash_rate << "," << backup_size << "," << backup_rate << "," << verify_rate << ","
+      << latency.p50 << "," << latency_p95 << "," << latency.p99 << "," << latency.max << ","
+      << resident_kib() << "," << cycle_errors << "," << device.errors << ","
+      << (double) device.errors / device.cycles << "," << (error.empty() ? string() : csv_string(error)) << endl;
+}
+
+void soak_benchmark::prepare(device_state& device)
+{
+  if (device.cart)
+  {
+    return;
+  }
+  
+  device.cart.reset(device.linkmasta->build_cartridge());
+  
+  // A Neo Geo Pocket game fills the whole cartridge, a WonderSwan game a
+  // single slot
+  device.slot = (device.linkmasta->system() == LINKMASTA_WONDERSWAN ? 0 : cartridge::SLOT_ALL);
+  if (device.original.empty())
+  {
+    backup_game(device.cart.get(), device.slot, device.original);
+    if (device.original.size() <= KEPT_HEADER_BYTES + KEPT_FOOTER_BYTES)
+    {
+      device.original.clear();
+      throw std::runtime_error("No game on the cartridge to soak with");
+    }
+  }
+}
+
+void soak_benchmark::restore_original(device_state& device)
+{
+  if (device.original.empty())
+  {
+    return;
+  }
+  
+  try
+  {
+    prepare(device);
+    device.cart->restore_cartridge_game_data(device.original.data(), (unsigned int) device.original.size(), device.slot);
+  }
+  catch (std::exception& ex)
+  {
+    cerr << "ERROR: Unable to flash the original game back to " << device.name << ": " << ex.what() << endl;
+    ++device.errors;
+  }
+}
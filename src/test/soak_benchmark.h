@@ -0,0 +1,97 @@
+//
+//  soak_benchmark.h
+//  FlashMasta
+//
+//  Created by Dan on 9/12/15.
+//  Copyright (c) 2015 7400 Circuits. All rights reserved.
+//
+
+#ifndef __SOAK_BENCHMARK_H__
+#define __SOAK_BENCHMARK_H__
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+class cartridge;
+class linkmasta_device;
+
+// Non-interactive, long-running benchmark for telling whether devices slow
+// down or start failing over hours of use. Runs cycles of backing up a game
+// and verifying the cartridge against the backup, and, if enabled, of
+// flashing a generated game first, on every device in turn until the time or
+// number of cycles runs out. Every cycle of every device writes a CSV row of
+// its throughput, single-word latency percentiles, the process's resident
+// memory, and the errors so far, flushed right away so that a run left going
+// overnight can be read while it runs or after it is killed. Errors are
+// counted and the device's cartridge built again on the next cycle rather
+// than ending the run.
+class soak_benchmark
+{
+public:
+  struct options
+  {
+    // How long to run for. 0 to run until the number of cycles runs out
+    double       hours;
+    
+    // The number of cycles to run. 0 to run until the time runs out
+    unsigned int cycles;
+    
+    // Pause between cycles, letting the devices sit idle
+    unsigned int pause_ms;
+    
+    // Single-word reads timed every cycle
+    unsigned int latency_samples;
+    
+    // Flashing destroys the game on the cartridge. The game backed up first
+    // is flashed back at the end of the run
+    bool         flash;
+    
+    options();
+  };
+  
+  explicit soak_benchmark(const options& opts);
+  ~soak_benchmark();
+  
+  // Adds a device to run cycles on. The device must be open and is not
+  // owned by the benchmark
+  void add_device(const std::string& name, linkmasta_device* linkmasta);
+  
+  // Runs cycles and writes the CSV header and a row for every cycle of
+  // every device to out. Returns false if any cycle failed
+  bool run(std::ostream& out);
+  
+  // Gets the resident memory of this process in KiB, or 0 if unknown
+  static unsigned long long resident_kib();
+
+private:
+  struct device_state
+  {
+    std::string                name;
+    linkmasta_device*          linkmasta;
+    std::unique_ptr<cartridge> cart;
+    int                        slot;
+    
+    // The game backed up from the cartridge first, flashed back at the end
+    std::vector<unsigned char> original;
+    
+    unsigned int               cycles;
+    unsigned int               errors;
+  };
+  
+  // Runs one cycle on a device and writes its row
+  void run_cycle(device_state& device, unsigned int cycle, double elapsed, std::ostream& out);
+  
+  // Builds the device's cartridge if it doesn't have one, backing up the
+  // game the first time
+  void prepare(device_state& device);
+  
+  // Flashes the game backed up first back to the cartridge
+  void restore_original(device_state& device);
+  
+  const options                              m_options;
+  std::vector<std::unique_ptr<device_state>> m_devices;
+};
+
+#endif /* defined(__SOAK_BENCHMARK_H__) */
@@ -0,0 +1,1972 @@
+/*! \file
+ *  \brief Entry point of the headless command-line batch tool.
+ *  
+ *  Entry point of the headless command-line batch tool. Reads a manifest of
+ *  cartridge jobs, runs every job on every attached device in parallel through
+ *  a \ref device_job_scheduler, and prints progress and throughput statistics
+ *  in a machine-readable format so that the tool can be driven from scripts.
+ *  
+ *  Each non-empty line of the manifest that does not start with '#' describes
+ *  one job in the form
+ *  
+ *  \code
+ *  <command> <path> [slot]
+ *  \endcode
+ *  
+ *  where command is one of "backup", "backup-slots", "backup-save",
+ *  "save-history", "restore-save", "flash", "flash-verify", "broadcast",
+ *  "verify", "spot-check", "repair", "reflash", "clone", "identify", or
+ *  "verify-catalog", and slot defaults to all slots.
+ *  "identify" and "verify-catalog" take no path, and "backup-slots" takes no slot,
+ *  writing each slot of a WonderSwan cartridge to its own file instead.
+ *  "backup-save" only rewrites its file if the save data has changed.
+ *  "save-history" checks the save data in to a \ref save_history, storing
+ *  only the blocks changed since the last version, and "restore-save"
+ *  restores a save file or a version of a history such as "game.fmsh@3",
+ *  the latest if no version is given. Every occurrence of "%d" in a path to
+ *  back up or restore is replaced with the device ID, and if a backup or
+ *  history path contains none while several devices are attached, the device
+ *  ID is added before the file extension so that backups don't overwrite each
+ *  other.
+ *  
+ *  Backups to a path ending in ".fmz" are written as compressed archives, and
+ *  archives are extracted transparently wherever an image or save is read.
+ *  A path such as "saves.fmda#game.ngf" names a dump inside a
+ *  \ref dump_archive: backups are added to the archive, creating it if
+ *  needed, and images and saves are mapped straight out of it.
+ *  With "--store", each finished game backup is added to a \ref dump_store and
+ *  replaced by a reference if the same image was backed up before. With
+ *  "--verify-reads", every read is checked for packets corrupted on the way and
+ *  only those are read again, so backups can be trusted without a "verify" job.
+ *  With "--cache-reads", the small metadata reads repeated while a cartridge is
+ *  identified and looked over are answered from a cache after the first.
+ *  With "--trim", a Neo Geo Pocket game whose size is in the catalog is only
+ *  backed up up to the end of the game rather than to the end of its slot.
+ *  
+ *  Devices behind the same full-speed hub share its bandwidth, so only
+ *  "--max-per-hub" of them run jobs at once; the "device" records give each
+ *  device's port path so that stations can be laid out accordingly.
+ *  
+ *  With "--plan", nothing is written to any cartridge. Instead, each device
+ *  prints a "plan" record for every operation the manifest would run on it,
+ *  giving the blocks it touches, the erases it needs, the bytes it reads and
+ *  programs, and its estimated seconds, followed by a "plan-total" record.
+ *  "spot-check" and "identify" only read a few blocks and are left out, and
+ *  "repair" is planned as just its verify, since the blocks it rewrites
+ *  aren't known until then.
+ *  
+ *  With "--erase-history", the time every erase takes is recorded in the given
+ *  file for each chip of each device's cartridge. The recorded times pace the
+ *  polling of later erases and replace the typical erase times of "--plan",
+ *  and a "chip-health" record is printed at the end for every chip recorded,
+ *  with degrading=1 for chips whose erases have slowed down from when they
+ *  were first recorded, a sign of worn flash.
+ *  
+ *  With "--adaptive-batches", every device times its read64xN and write64xN
+ *  batches and adapts their size in each direction to whatever moves data
+ *  fastest without timing out, rather than always sending the largest batches
+ *  its firmware accepts. With "--batch-tuning", batches adapt as well, and the
+ *  sizes settled on are recorded in the given file by serial number so that
+ *  the next run starts from them.
+ *  
+ *  With "--latency-summary", a "latency" record is printed at the end for
+ *  each kind of exchange with each device, giving the median, 99th, and
+ *  99.9th percentile, and longest time it took, so that occasional stalls
+ *  that averages hide show up.
+ *  
+ *  With "--timeouts", the USB timeouts of every device are set to the three
+ *  given numbers of milliseconds, separated by commas: for single-packet
+ *  commands, for transfer batches before adding time for their size, and for
+ *  each poll of a chip that is erasing. Lower values detect a hung device
+ *  sooner; 0 never times out.
+ *  
+ *  With "--serve", the tool runs no manifest and instead serves the devices
+ *  attached to this machine over TCP through a \ref device_server until it is
+ *  killed. Another station given the address with "--remote" then runs its
+ *  manifest on those devices as if they were attached to it, so a single host
+ *  can drive devices spread across many small machines. Several nodes may be
+ *  given, separated by commas, and their devices are all used together.
+ *  
+ *  With "--daemon", the tool runs no manifest and instead keeps a
+ *  \ref job_server running on the loopback interface until it is killed, so
+ *  that front ends on this machine can run jobs in its process and closing
+ *  them does not stop the jobs. With "--watch", the tool connects to such a
+ *  daemon as a \ref job_client and prints a "job" record each time a job on
+ *  it changes, for as long as the daemon runs.
+ *  
+ *  With "--spread", each "flash" and "flash-verify" line is run once rather
+ *  than on every device, by a \ref device_job_coordinator that places it on
+ *  whichever device would finish it soonest and places it again elsewhere if
+ *  that device disconnects. Together with "--remote", this turns a farm of
+ *  stations into a single pool working through the manifest, and a "request"
+ *  record is printed for every line telling where it ran and how many
+ *  attempts it took.
+ *  
+ *  With "--library", the tool runs no manifest and instead indexes the game
+ *  images under the directory given in its place, printing an "image" record
+ *  for each with the game the catalog names. The index is kept in the given
+ *  file through a \ref rom_library, so that only images added or changed
+ *  since the last run are read again.
+ *  
+ *  With "--diff", the tool runs no manifest and instead compares the dump
+ *  given with it to the one given in its place, printing a "diff-range"
+ *  record for each run of differing bytes and a "diff-block" record for
+ *  each block of the cartridge they fall in. The blocks are those of a
+ *  WonderSwan cartridge for ".ws" and ".wsc" images and of a Neo Geo Pocket
+ *  cartridge otherwise, sized to fit the larger dump. The exit code is 0
+ *  only if the dumps match.
+ *  
+ *  With "--archive", the tool runs no manifest and instead keeps the
+ *  "--store" directory as a central archive for other stations through a
+ *  \ref store_sync_server until it is killed. With "--sync", the tool runs no
+ *  manifest and instead copies the files of its "--store" directory that the
+ *  archive at the given address lacks to it through a
+ *  \ref store_sync_client. Only the chunks of those files the archive holds
+ *  in no file yet are sent, and a "sync" record tells how much was sent.
+ *  
+ *  With "--metrics-port", USB, linkmasta, and job counters for every device
+ *  are served over HTTP on the loopback interface in the Prometheus text
+ *  format while the jobs run.
+ *  
+ *  With "--io-priority", the threads moving data to and from the devices run
+ *  above the normal priority, and with "--io-cpus", each is pinned to one of
+ *  the given CPUs in turn, keeping packet round trips short on a busy
+ *  machine. Whatever the platform doesn't permit is logged and left alone.
+ *  
+ *  With "--usbfs", on Linux, every transfer goes straight to the devices'
+ *  nodes under /dev/bus/usb rather than through libusb, which is then only
+ *  used to find the devices. This applies to "--serve" and "--daemon" too.
+ *  
+ *  With "--memory-budget", the buffers of every device, the images kept by
+ *  the image cache, and the cached reads of every device share a
+ *  \ref memory_budget of the given number of MiB. Jobs starting while it is
+ *  spent wait for memory, and cached images are let go least recently used
+ *  first, so that a host running many jobs at once doesn't swap. A "memory"
+ *  record tells how close the jobs came to the limit and how often they
+ *  waited for it. This applies to "--serve" and "--daemon" too.
+ *  
+ *  With "--log-level", entries below the given level are left out of
+ *  "log.txt". Per-block progress is logged at the verbose level, which
+ *  release builds leave out entirely whatever the option says.
+ *  
+ *  "spot-check" only compares a random sample of the cartridge against the
+ *  image, catching a bad chip or a wrong image with the probability given by
+ *  "--confidence" in seconds rather than minutes.
+ *  
+ *  "repair" verifies the cartridge against the image without stopping at the
+ *  first block that differs, then erases and reprograms only the blocks that
+ *  failed, and prints a "repair" record giving the number of blocks
+ *  compared, how many were rewritten, the offset of the first difference,
+ *  and whether the cartridge matched in the end.
+ *  
+ *  "identify" first samples a few blocks of the game and looks their
+ *  fingerprint up in the catalog, then falls back to the game's metadata. The
+ *  sampled fingerprint is printed as well, ready to be added to the catalog.
+ *  
+ *  "verify-catalog" reads the game on the cartridge and compares its CRC32
+ *  and SHA-1 checksums with those the catalog records for a known-good dump
+ *  of the game, so that retail cartridges can be verified without keeping
+ *  their images. The data read is hashed and thrown away. Games the catalog
+ *  has no checksums for fail the job.
+ *  
+ *  "reflash" runs a \ref device_job_graph on every device that identifies the
+ *  cartridge, backs up its save, flashes and verifies the image, then restores
+ *  and verifies the save. The image is hashed while the devices are busy, and
+ *  each device moves through its steps without waiting for the others.
+ *  
+ *  "broadcast" flashes and verifies an image loaded once through an
+ *  \ref image_cache on every device as a single batch, and reports the
+ *  batch's combined progress alongside the overall progress.
+ *  
+ *  "clone" takes the ID of a device instead of a path and copies the game on
+ *  that device's cartridge onto every other device, streaming it from one
+ *  cartridge to the other in memory.
+ *  
+ *  The image of a "flash" or "flash-verify" line may be an "http://" URL
+ *  instead of a path. The image is then downloaded once, into memory, while
+ *  every device flashes it, each block being erased and programmed as soon as
+ *  it has arrived. A download that drops or stalls picks up where it left off.
+ *  
+ *  All output is written to stdout as lines of tab-separated key=value fields,
+ *  the first field naming the kind of record. While jobs run, each combined
+ *  progress record is followed by one record per running job giving its
+ *  phase, current and smoothed bytes per second, and estimated seconds
+ *  remaining. The record of a finished job includes the seconds it spent
+ *  erasing, programming, reading, and verifying, and that of a finished
+ *  "backup" job the CRC32, MD5, and SHA-1 checksums of the backup. Each step of
+ *  a "reflash" gets a record of its own giving the seconds it spent waiting
+ *  for its device and running.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-10
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/dump_store.h"
+#include "common/hash_stream.h"
+#include "common/http_download.h"
+#include "common/io_thread.h"
+#include "common/log.h"
+#include "common/mapped_file.h"
+#include "common/memory_budget.h"
+#include "common/metrics_server.h"
+#include "common/trace.h"
+#include "cartridge/block_mismatch_map.h"
+#include "cartridge/cartridge.h"
+#include "cartridge/cartridge_descriptor.h"
+#include "cartridge/cartridge_layout.h"
+#include "cartridge/digest_manifest.h"
+#include "cartridge/dump_diff.h"
+#include "cartridge/erase_history.h"
+#include "linkmasta/batch_tuner.h"
+#include "cartridge/image_cache.h"
+#include "cartridge/image_pipe.h"
+#include "cartridge/ngp_cartridge.h"
+#include "cartridge/ws_cartridge.h"
+#include "cartridge/operation_planner.h"
+#include "game/game_descriptor.h"
+#include "game/game_catalog.h"
+#include "game/game_fingerprint.h"
+#include "game/game_hash.h"
+#include "game/rom_library.h"
+#include "linkmasta/device_job_coordinator.h"
+#include "linkmasta/device_job_graph.h"
+#include "linkmasta/device_job_scheduler.h"
+#include "linkmasta/device_server.h"
+#include "linkmasta/device_server_protocol.h"
+#include "linkmasta/job_client.h"
+#include "linkmasta/job_server.h"
+#include "linkmasta/libusb_device_manager.h"
+#include "linkmasta/linkmasta_device.h"
+#include "linkmasta/remote_device_manager.h"
+#include "linkmasta/store_sync_client.h"
+#include "linkmasta/store_sync_server.h"
+#include "task/forwarding_task_controller.h"
+
+using namespace std;
+
+#define EXIT_OK                 0
+#define EXIT_JOB_FAILED         1
+#define EXIT_USAGE              2
+
+#define DEFAULT_INTERVAL_MS     1000
+#define DEFAULT_WAIT_MS         5000
+#define DEVICE_POLL_INTERVAL_MS 100
+#define SPREAD_PLAN_BLOCK_SIZE  0x10000
+
+
+
+// Struct describing a single line of the manifest
+struct manifest_entry
+{
+  string       command;
+  string       path;
+  int          slot;
+  unsigned int line_num;
+};
+
+// Struct describing a job submitted to the scheduler
+struct submitted_job
+{
+  unsigned int job_id;
+  unsigned int device_id;
+  string       command;
+  string       path;
+  int          slot;
+};
+
+// Struct describing an image being downloaded while the jobs flashing it run
+struct streamed_image
+{
+  unique_ptr<http_download> download;
+  unique_ptr<image_pipe>    pipe;
+  thread                    downloader;
+  
+  ~streamed_image();
+};
+
+
+
+// Function forward declarations
+void print_usage(const char* program_name);
+int serve_devices(unsigned short port, const io_thread_options& io_options, bool use_usbfs);
+int run_daemon(unsigned short port, const io_thread_options& io_options, bool use_usbfs);
+int watch_daemon(unsigned short port);
+int index_library(const string& index_path, const string& directory, const string& catalog_dir);
+int diff_dumps(const string& path_a, const string& path_b);
+int serve_archive(unsigned short port, const string& store_dir);
+int sync_store(const string& address, const string& store_dir);
+vector<string> split_nodes(const string& nodes);
+bool parse_timeouts(const string& spec, linkmasta_device::timeout_profile& timeouts);
+vector<manifest_entry> load_manifest(const string& manifest_path);
+shared_ptr<streamed_image> start_download(const string& url);
+vector<unsigned int> wait_for_devices(device_manager& manager, unsigned int min_devices, int wait_ms);
+string backup_path_for(const string& path, unsigned int device_id, bool several_devices);
+const char* status_name(task_status status);
+const char* phase_name(task_phase phase);
+void print_throughput(const char* record, const device_job_scheduler::throughput_info& info);
+void print_job_progress(unsigned int job_id, unsigned int device_id, const device_job_scheduler::job_info& info);
+operation_planner::plan plan_for_image(operation_planner::operation op, unsigned int num_bytes);
+void print_plans(unsigned int device_id, cartridge* cart, const vector<manifest_entry>& entries, const operation_planner::rates& rates);
+void print_chip_health(erase_history& history);
+void print_command_latencies(unsigned int device_id, const linkmasta_device* linkmasta);
+const char* operation_name(operation_planner::operation op);
+bool verify_against_catalog(unsigned int device_id, cartridge* cart, int slot, game_catalog* catalog, task_controller* controller);
+bool repair_against_image(unsigned int device_id, cartridge* cart, shared_ptr<const mapped_file> image, int slot, task_controller* controller);
+
+// Guards stdout, which is written to by job threads as well
+mutex output_mutex;
+
+
+
+int main(int argc, char* argv[])
+{
+  string manifest_path;
+  string catalog_dir = ".";
+  int interval_ms = DEFAULT_INTERVAL_MS;
+  int wait_ms = DEFAULT_WAIT_MS;
+  unsigned int min_devices = 1;
+  string trace_path;
+  string store_dir;
+  bool trace_summary = false;
+  bool latency_summary = false;
+  bool verify_reads = false;
+  bool cache_reads = false;
+  bool trimmed = false;
+  double confidence = SPOT_CHECK_DEFAULT_CONFIDENCE;
+  int metrics_port = 0;
+  int max_per_hub = DEFAULT_MAX_JOBS_PER_HUB;
+  bool plan_only = false;
+  string erase_history_path;
+  bool adaptive_batches = false;
+  string batch_tuning_path;
+  string timeouts_spec;
+  int serve_port = 0;
+  int daemon_port = 0;
+  int watch_port = 0;
+  string remote_nodes;
+  bool spread = false;
+  string log_level_name;
+  string library_path;
+  string diff_path;
+  bool io_priority = false;
+  bool use_usbfs = false;
+  string io_cpus_spec;
+  int memory_budget_mb = 0;
+  int archive_port = 0;
+  string sync_address;
+  
+  // Parse command-line arguments
+  for (int i = 1; i < argc; ++i)
+  {
+    string arg = argv[i];
+    if ((arg == "--interval" || arg == "--wait" || arg == "--devices" || arg == "--catalog-dir" || arg == "--trace" || arg == "--store" || arg == "--confidence" || arg == "--metrics-port" || arg == "--max-per-hub" || arg == "--erase-history" || arg == "--batch-tuning" || arg == "--timeouts" || arg == "--serve" || arg == "--daemon" || arg == "--watch" || arg == "--remote" || arg == "--log-level" || arg == "--library" || arg == "--diff" || arg == "--io-cpus" || arg == "--memory-budget" || arg == "--archive" || arg == "--sync") && i + 1 < argc)
+    {
+      string value = argv[++i];
+      if (arg == "--interval") interval_ms = atoi(value.c_str());
+      else if (arg == "--wait") wait_ms = atoi(value.c_str());
+      else if (arg == "--devices") min_devices = (unsigned int) atoi(value.c_str());
+      else if (arg == "--trace") trace_path = value;
+      else if (arg == "--store") store_dir = value;
+      else if (arg == "--confidence") confidence = atof(value.c_str());
+      else if (arg == "--metrics-port") metrics_port = atoi(value.c_str());
+      else if (arg == "--max-per-hub") max_per_hub = atoi(value.c_str());
+      else if (arg == "--erase-history") erase_history_path = value;
+      else if (arg == "--batch-tuning") batch_tuning_path = value;
+      else if (arg == "--timeouts") timeouts_spec = value;
+      else if (arg == "--serve") serve_port = atoi(value.c_str());
+      else if (arg == "--daemon") daemon_port = atoi(value.c_str());
+      else if (arg == "--watch") watch_port = atoi(value.c_str());
+      else if (arg == "--remote") remote_nodes = value;
+      else if (arg == "--log-level") log_level_name = value;
+      else if (arg == "--library") library_path = value;
+      else if (arg == "--diff") diff_path = value;
+      else if (arg == "--io-cpus") io_cpus_spec = value;
+      else if (arg == "--memory-budget") memory_budget_mb = atoi(value.c_str());
+      else if (arg == "--archive") archive_port = atoi(value.c_str());
+      else if (arg == "--sync") sync_address = value;
+      else catalog_dir = value;
+    }
+    else if (arg == "--trace-summary")
+    {
+      trace_summary = true;
+    }
+    else if (arg == "--latency-summary")
+    {
+      latency_summary = true;
+    }
+    else if (arg == "--verify-reads")
+    {
+      verify_reads = true;
+    }
+    else if (arg == "--cache-reads")
+    {
+      cache_reads = true;
+    }
+    else if (arg == "--adaptive-batches")
+    {
+      adaptive_batches = true;
+    }
+    else if (arg == "--trim")
+    {
+      trimmed = true;
+    }
+    else if (arg == "--plan")
+    {
+      plan_only = true;
+    }
+    else if (arg == "--spread")
+    {
+      spread = true;
+    }
+    else if (arg == "--io-priority")
+    {
+      io_priority = true;
+    }
+    else if (arg == "--usbfs")
+    {
+      use_usbfs = true;
+    }
+    else if (arg == "--help" || arg == "-h")
+    {
+      print_usage(argv[0]);
+      return EXIT_OK;
+    }
+    else if (manifest_path.empty() && !arg.empty() && arg[0] != '-')
+    {
+      manifest_path = arg;
+    }
+    else
+    {
+      print_usage(argv[0]);
+      return EXIT_USAGE;
+    }
+  }
+  
+  // Levels below the one the build was made with stay off regardless
+  if (log_level_name == "debug") log_set_level(log_level::DEBUG);
+  else if (log_level_name == "verbose") log_set_level(log_level::VERBOSE);
+  else if (log_level_name == "info") log_set_level(log_level::INFO);
+  else if (!log_level_name.empty())
+  {
+    print_usage(argv[0]);
+    return EXIT_USAGE;
+  }
+  
+  linkmasta_device::timeout_profile timeouts;
+  if (!timeouts_spec.empty() && !parse_timeouts(timeouts_spec, timeouts))
+  {
+    print_usage(argv[0]);
+    return EXIT_USAGE;
+  }
+  
+  io_thread_options io_options;
+  io_options.high_priority = io_priority;
+  if (!io_cpus_spec.empty() && !io_thread_options::parse_cpus(io_cpus_spec, io_options.cpus))
+  {
+    print_usage(argv[0]);
+    return EXIT_USAGE;
+  }
+  
+  // Every buffer pool and cache made from here on shares the budget
+  if (memory_budget_mb < 0)
+  {
+    print_usage(argv[0]);
+    return EXIT_USAGE;
+  }
+  unique_ptr<memory_budget> budget;
+  if (memory_budget_mb > 0)
+  {
+    budget.reset(new memory_budget((unsigned long long) memory_budget_mb << 20));
+    set_process_memory_budget(budget.get());
+  }
+  
+  if (serve_port != 0)
+  {
+    if (serve_port < 0 || serve_port > 65535 || !manifest_path.empty() || !remote_nodes.empty())
+    {
+      print_usage(argv[0]);
+      return EXIT_USAGE;
+    }
+    return serve_devices((unsigned short) serve_port, io_options, use_usbfs);
+  }
+  
+  if (daemon_port != 0 || watch_port != 0)
+  {
+    int port = (daemon_port != 0 ? daemon_port : watch_port);
+    if ((daemon_port != 0 && watch_port != 0) || port < 0 || port > 65535 || !manifest_path.empty() || !remote_nodes.empty())
+    {
+      print_usage(argv[0]);
+      return EXIT_USAGE;
+    }
+    return (daemon_port != 0 ? run_daemon((unsigned short) port, io_options, use_usbfs) : watch_daemon((unsigned short) port));
+  }
+  
+  if (archive_port != 0 || !sync_address.empty())
+  {
+    if ((archive_port != 0 && !sync_address.empty()) || archive_port < 0 || archive_port > 65535
+        || store_dir.empty() || !manifest_path.empty() || !remote_nodes.empty())
+    {
+      print_usage(argv[0]);
+      return EXIT_USAGE;
+    }
+    return (archive_port != 0 ? serve_archive((unsigned short) archive_port, store_dir) : sync_store(sync_address, store_dir));
+  }
+  
+  if (!library_path.empty())
+  {
+    if (manifest_path.empty() || !remote_nodes.empty())
+    {
+      print_usage(argv[0]);
+      return EXIT_USAGE;
+    }
+    return index_library(library_path, manifest_path, catalog_dir);
+  }
+  
+  if (!diff_path.empty())
+  {
+    if (manifest_path.empty() || !remote_nodes.empty())
+    {
+      print_usage(argv[0]);
+      return EXIT_USAGE;
+    }
+    return diff_dumps(diff_path, manifest_path);
+  }
+  
+  if (manifest_path.empty() || interval_ms <= 0 || !(confidence > 0.0 && confidence < 1.0) || metrics_port < 0 || metrics_port > 65535 || max_per_hub < 0)
+  {
+    print_usage(argv[0]);
+    return EXIT_USAGE;
+  }
+  
+  vector<manifest_entry> entries;
+  try
+  {
+    entries = load_manifest(manifest_path);
+  }
+  catch (std::exception& ex)
+  {
+    cout << "error\tmessage=" << ex.what() << endl;
+    return EXIT_USAGE;
+  }
+  
+  log_init();
+  log_start("cli start...");
+  
+  if (!trace_path.empty() || trace_summary)
+  {
+    trace_start();
+  }
+  
+  // Serve the station's metrics for as long as the jobs run
+  unique_ptr<metrics_server> metrics;
+  if (metrics_port > 0)
+  {
+    metrics.reset(new metrics_server((unsigned short) metrics_port));
+    try
+    {
+      metrics->start();
+    }
+    catch (std::exception& ex)
+    {
+      cout << "error\tmessage=" << ex.what() << endl;
+      return EXIT_USAGE;
+    }
+  }
+  
+  // Keep the erase history open for as long as any cartridge may erase
+  unique_ptr<erase_history> history;
+  if (!erase_history_path.empty())
+  {
+    try
+    {
+      history.reset(new erase_history(erase_history_path));
+    }
+    catch (std::exception& ex)
+    {
+      cout << "error\tmessage=" << ex.what() << endl;
+      return EXIT_USAGE;
+    }
+  }
+  
+  // Keep the batch sizes tuned for each device for the next run
+  unique_ptr<batch_tuning_store> batch_tuning;
+  if (!batch_tuning_path.empty())
+  {
+    try
+    {
+      batch_tuning.reset(new batch_tuning_store(batch_tuning_path));
+    }
+    catch (std::exception& ex)
+    {
+      cout << "error\tmessage=" << ex.what() << endl;
+      return EXIT_USAGE;
+    }
+  }
+  
+  // Devices come either from this machine or from the given device servers
+  unique_ptr<device_manager> device_source;
+  try
+  {
+    if (remote_nodes.empty())
+    {
+      libusb_device_manager* local_manager = new libusb_device_manager(use_usbfs);
+      device_source.reset(local_manager);
+      local_manager->set_io_thread_options(io_options);
+    }
+    else
+    {
+      device_source.reset(new remote_device_manager(split_nodes(remote_nodes)));
+    }
+  }
+  catch (std::exception& ex)
+  {
+    cout << "error\tmessage=" << ex.what() << endl;
+    return EXIT_USAGE;
+  }
+  
+  int exit_code = EXIT_OK;
+  {
+    device_manager& manager = *device_source;
+    unique_ptr<game_catalog> ngp_catalog(open_game_catalog(catalog_dir + "/ngpgames", game_descriptor::game_system::NEO_GEO_POCKET));
+    unique_ptr<game_catalog> ws_catalog(open_game_catalog(catalog_dir + "/wsgames", game_descriptor::game_system::WONDERSWAN));
+    
+    vector<unsigned int> devices = wait_for_devices(manager, min_devices, wait_ms);
+    for (unsigned int device_id : devices)
+    {
+      manager.get_linkmasta_device(device_id)->set_verify_reads(verify_reads);
+      manager.get_linkmasta_device(device_id)->set_cache_reads(cache_reads);
+      manager.get_linkmasta_device(device_id)->set_adaptive_batches(adaptive_batches || batch_tuning != nullptr, batch_tuning.get());
+      manager.get_linkmasta_device(device_id)->set_timeouts(timeouts);
+      cout << "device\tid=" << device_id
+           << "\tproduct=" << manager.get_product_string(device_id)
+           << "\tserial=" << manager.get_serial_number(device_id)
+           << "\tport=" << manager.get_port_path(device_id)
+           << "\tshared_hub=" << (manager.is_on_shared_hub(device_id) ? 1 : 0) << "\n";
+    }
+    cout.flush();
+    
+    if (devices.size() < min_devices)
+    {
+      cout << "error\tmessage=found " << devices.size() << " of " << min_devices << " devices" << endl;
+      exit_code = EXIT_JOB_FAILED;
+    }
+    else
+    {
+      device_job_scheduler scheduler(&manager);
+      scheduler.set_max_jobs_per_hub((unsigned int) max_per_hub);
+      scheduler.set_io_thread_options(io_options);
+      scheduler.set_erase_history(history.get());
+      device_job_graph graph(&scheduler);
+      device_job_coordinator coordinator(&manager, &scheduler);
+      map<unsigned int, manifest_entry> requests;
+      shared_ptr<dump_store> store = (store_dir.empty() ? nullptr : make_shared<dump_store>(store_dir));
+      vector<submitted_job> jobs;
+      
+      // Images shared by all devices are mapped or hashed only once
+      map<string, shared_ptr<const mapped_file>> images;
+      map<string, shared_ptr<const digest_manifest>> manifests;
+      map<string, shared_ptr<streamed_image>> streams;
+      image_cache cache;
+      vector<vector<unsigned int>> batches;
+      
+      // A pre-flight run only plans the manifest on each device's cartridge
+      if (plan_only)
+      {
+        shared_ptr<const vector<manifest_entry>> planned_entries = make_shared<const vector<manifest_entry>>(entries);
+        for (unsigned int device_id : devices)
+        {
+          submitted_job job;
+          job.device_id = device_id;
+          job.command = "plan";
+          job.path = manifest_path;
+          job.slot = cartridge::SLOT_ALL;
+          job.job_id = scheduler.submit_job(device_id, [&scheduler, device_id, planned_entries](cartridge* cart, task_controller* controller) -> bool
+          {
+            (void) controller;
+            
+            // The device's rates already reflect the erase history, if any
+            print_plans(device_id, cart, *planned_entries, scheduler.get_estimated_rates(device_id));
+            return true;
+          });
+          jobs.push_back(job);
+        }
+        entries.clear();
+      }
+      
+      try
+      {
+        for (const manifest_entry& entry : entries)
+        {
+          shared_ptr<const mapped_file> image;
+          shared_ptr<const digest_manifest> digests;
+          shared_ptr<streamed_image> stream;
+          if (http_download::is_url(entry.path))
+          {
+            // Images on a server are flashed while they download
+            if (entry.command != "flash" && entry.command != "flash-verify")
+            {
+              throw std::runtime_error("Only flash and flash-verify can take an image from a URL, on line " + to_string(entry.line_num));
+            }
+            if (streams.find(entry.path) == streams.end())
+            {
+              streams[entry.path] = start_download(entry.path);
+            }
+            stream = streams[entry.path];
+          }
+          else if (entry.command == "flash" || entry.command == "flash-verify" || entry.command == "spot-check" || entry.command == "repair" || entry.command == "reflash")
+          {
+            if (images.find(entry.path) == images.end())
+            {
+              images[entry.path] = make_shared<const mapped_file>(entry.path);
+            }
+            image = images[entry.path];
+          }
+          else if (entry.command == "verify")
+          {
+            if (manifests.find(entry.path) == manifests.end())
+            {
+              manifests[entry.path] = digest_manifest::load_for(entry.path);
+            }
+            digests = manifests[entry.path];
+            if (digests == nullptr && images.find(entry.path) == images.end())
+            {
+              images[entry.path] = make_shared<const mapped_file>(entry.path);
+            }
+            if (digests == nullptr)
+            {
+              image = images[entry.path];
+            }
+          }
+          
+          // Workflows run through the graph rather than as single jobs
+          if (entry.command == "reflash")
+          {
+            graph.add_reflash_workflow(devices, image, entry.slot);
+            continue;
+          }
+          
+          // Spread flashes run once, on whichever device gets to them first
+          if (spread && (entry.command == "flash" || entry.command == "flash-verify"))
+          {
+            bool verify = (entry.command == "flash-verify");
+            int slot = entry.slot;
+            operation_planner::plan plan = plan_for_image(verify ? operation_planner::operation::FLASH_AND_VERIFY : operation_planner::operation::FLASH, (stream != nullptr ? stream->pipe->size() : image->size()));
+            unsigned int request_id = coordinator.submit(entry.command + " " + entry.path, [image, stream, slot, verify](device_job_scheduler* s, unsigned int device_id) -> unsigned int
+            {
+              if (stream != nullptr)
+              {
+                return s->submit_job(device_id, [stream, slot, verify](cartridge* cart, task_controller* controller) -> bool
+                {
+                  return cart->restore_streamed_cartridge_game_data(*stream->pipe, slot, verify, controller);
+                });
+              }
+              if (verify)
+              {
+                return s->submit_flash_and_verify_job(device_id, image, slot);
+              }
+              return s->submit_flash_job(device_id, image, slot);
+            }, plan);
+            requests[request_id] = entry;
+            continue;
+          }
+          
+          // Broadcasts queue one job per device in a single call
+          if (entry.command == "broadcast")
+          {
+            vector<unsigned int> job_ids = scheduler.submit_broadcast_job(devices, cache.get(entry.path), entry.slot);
+            for (unsigned int i = 0; i < job_ids.size(); ++i)
+            {
+              submitted_job job;
+              job.job_id = job_ids[i];
+              job.device_id = devices[i];
+              job.command = entry.command;
+              job.path = entry.path;
+              job.slot = entry.slot;
+              jobs.push_back(job);
+            }
+            batches.push_back(job_ids);
+            continue;
+          }
+          
+          for (unsigned int device_id : devices)
+          {
+            if (entry.command == "clone" && to_string(device_id) == entry.path)
+            {
+              continue;
+            }
+            
+            submitted_job job;
+            job.device_id = device_id;
+            job.command = entry.command;
+            job.path = entry.path;
+            job.slot = entry.slot;
+            
+            if (entry.command == "backup")
+            {
+              job.path = backup_path_for(entry.path, device_id, devices.size() > 1);
+              job.job_id = scheduler.submit_backup_job(device_id, job.path, entry.slot, store, trimmed);
+            }
+            else if (entry.command == "backup-save")
+            {
+              job.path = backup_path_for(entry.path, device_id, devices.size() > 1);
+              job.job_id = scheduler.submit_save_backup_job(device_id, job.path, entry.slot);
+            }
+            else if (entry.command == "save-history")
+            {
+              job.path = backup_path_for(entry.path, device_id, devices.size() > 1);
+              job.job_id = scheduler.submit_save_history_job(device_id, job.path, entry.slot);
+            }
+            else if (entry.command == "restore-save")
+            {
+              job.path = backup_path_for(entry.path, device_id, false);
+              job.job_id = scheduler.submit_restore_save_job(device_id, job.path, entry.slot);
+            }
+            else if (entry.command == "backup-slots")
+            {
+              job.path = backup_path_for(entry.path, device_id, devices.size() > 1);
+              job.job_id = scheduler.submit_backup_slots_job(device_id, job.path);
+            }
+            else if (stream != nullptr)
+            {
+              int slot = entry.slot;
+              bool verify = (entry.command == "flash-verify");
+              job.job_id = scheduler.submit_job(device_id, [stream, slot, verify](cartridge* cart, task_controller* controller) -> bool
+              {
+                return cart->restore_streamed_cartridge_game_data(*stream->pipe, slot, verify, controller);
+              });
+            }
+            else if (entry.command == "flash")
+            {
+              job.job_id = scheduler.submit_flash_job(device_id, image, entry.slot);
+            }
+            else if (entry.command == "flash-verify")
+            {
+              job.job_id = scheduler.submit_flash_and_verify_job(device_id, image, entry.slot);
+            }
+            else if (entry.command == "verify" && digests != nullptr)
+            {
+              job.job_id = scheduler.submit_verify_job(device_id, digests, entry.slot);
+            }
+            else if (entry.command == "verify")
+            {
+              job.job_id = scheduler.submit_verify_job(device_id, image, entry.slot);
+            }
+            else if (entry.command == "spot-check")
+            {
+              job.job_id = scheduler.submit_spot_check_job(device_id, image, entry.slot, confidence);
+            }
+            else if (entry.command == "repair")
+            {
+              int slot = entry.slot;
+              job.job_id = scheduler.submit_job(device_id, [device_id, image, slot](cartridge* cart, task_controller* controller) -> bool
+              {
+                return repair_against_image(device_id, cart, image, slot, controller);
+              });
+            }
+            else if (entry.command == "clone")
+            {
+              job.job_id = scheduler.submit_clone_job((unsigned int) stoul(entry.path), device_id, entry.slot, entry.slot);
+            }
+            else if (entry.command == "verify-catalog")
+            {
+              int slot = entry.slot;
+              game_catalog* ngp = ngp_catalog.get();
+              game_catalog* ws = ws_catalog.get();
+              job.job_id = scheduler.submit_job(device_id, [device_id, slot, ngp, ws](cartridge* cart, task_controller* controller) -> bool
+              {
+                return verify_against_catalog(device_id, cart, slot, (cart->system() == SYSTEM_WONDERSWAN ? ws : ngp), controller);
+              });
+            }
+            else
+            {
+              int slot = entry.slot;
+              game_catalog* ngp = ngp_catalog.get();
+              game_catalog* ws = ws_catalog.get();
+              job.job_id = scheduler.submit_job(device_id, [device_id, slot, ngp, ws](cartridge* cart, task_controller* controller) -> bool
+              {
+                (void) controller;
+                const game_descriptor* desc = nullptr;
+                unsigned int fingerprint = 0;
+                switch (cart->system())
+                {
+                default:
+                case SYSTEM_UNKNOWN:
+                  break;
+                case SYSTEM_NEO_GEO_POCKET:
+                  desc = quick_identify_game(ngp, cart, slot, &fingerprint);
+                  break;
+                case SYSTEM_WONDERSWAN:
+                  desc = quick_identify_game(ws, cart, slot, &fingerprint);
+                  break;
+                }
+                
+                lock_guard<mutex> lock(output_mutex);
+                ostringstream fingerprint_hex;
+                fingerprint_hex << hex << fingerprint;
+                cout << "identify\tdevice=" << device_id << "\tslot=" << slot
+                     << "\tsystem=" << (int) cart->system()
+                     << "\tfingerprint=" << fingerprint_hex.str()
+                     << "\tgame=" << (desc != nullptr ? desc->name : "") << endl;
+                return (desc != nullptr);
+              });
+            }
+            jobs.push_back(job);
+          }
+        }
+      }
+      catch (std::exception& ex)
+      {
+        cout << "error\tmessage=" << ex.what() << endl;
+        coordinator.cancel();
+        scheduler.cancel_all_jobs();
+        exit_code = EXIT_JOB_FAILED;
+      }
+      if (exit_code == EXIT_OK)
+      {
+        graph.start();
+      }
+      else
+      {
+        graph.cancel();
+      }
+      
+      // Report combined progress until every job has finished, including the
+      // graph's steps that are still waiting on earlier ones and the requests
+      // still waiting for a device
+      device_job_scheduler::throughput_info info = scheduler.get_throughput();
+      while (info.num_jobs_queued > 0 || info.num_jobs_running > 0 || (exit_code == EXIT_OK && !graph.is_finished()) || !coordinator.is_finished())
+      {
+        {
+          lock_guard<mutex> lock(output_mutex);
+          print_throughput("progress", info);
+          for (const vector<unsigned int>& batch : batches)
+          {
+            print_throughput("broadcast-progress", scheduler.get_throughput(batch));
+          }
+          for (const submitted_job& job : jobs)
+          {
+            print_job_progress(job.job_id, job.device_id, scheduler.get_job_info(job.job_id));
+          }
+          for (unsigned int request_id : coordinator.get_requests())
+          {
+            device_job_coordinator::request_info request = coordinator.get_request_info(request_id);
+            if (request.job_id >= 0)
+            {
+              print_job_progress((unsigned int) request.job_id, request.device_id, scheduler.get_job_info((unsigned int) request.job_id));
+            }
+          }
+          cout.flush();
+        }
+        this_thread::sleep_for(chrono::milliseconds(interval_ms));
+        info = scheduler.get_throughput();
+      }
+      if (exit_code == EXIT_OK)
+      {
+        graph.wait();
+      }
+      coordinator.wait();
+      scheduler.wait_for_all_jobs();
+      
+      // A request's last job is reported along with the others
+      for (auto& entry : requests)
+      {
+        device_job_coordinator::request_info request = coordinator.get_request_info(entry.first);
+        if (request.job_id >= 0)
+        {
+          submitted_job job;
+          job.job_id = (unsigned int) request.job_id;
+          job.device_id = request.device_id;
+          job.command = entry.second.command;
+          job.path = entry.second.path;
+          job.slot = entry.second.slot;
+          jobs.push_back(job);
+        }
+      }
+      
+      // Report the outcome of every job
+      lock_guard<mutex> lock(output_mutex);
+      for (const submitted_job& job : jobs)
+      {
+        device_job_scheduler::job_info job_info = scheduler.get_job_info(job.job_id);
+        cout << "job\tid=" << job.job_id << "\tdevice=" << job.device_id
+             << "\tcommand=" << job.command << "\tpath=" << job.path
+             << "\tslot=" << job.slot << "\tstatus=" << status_name(job_info.status)
+             << "\tresult=" << (job_info.result ? 1 : 0)
+             << "\twork=" << job_info.work_progress << "/" << job_info.work_expected
+             << "\terror=" << job_info.error
+             << "\terase_s=" << job_info.phase_seconds[TASK_PHASE_ERASE]
+             << "\tprogram_s=" << job_info.phase_seconds[TASK_PHASE_PROGRAM]
+             << "\tread_s=" << job_info.phase_seconds[TASK_PHASE_READ]
+             << "\tverify_s=" << job_info.phase_seconds[TASK_PHASE_VERIFY];
+        if (job.command == "backup" && job_info.status == COMPLETED)
+        {
+          ostringstream crc32_hex;
+          crc32_hex << hex << setw(8) << setfill('0') << job_info.hashes.crc32;
+          cout << "\tcrc32=" << crc32_hex.str() << "\tmd5=" << job_info.hashes.md5
+               << "\tsha1=" << job_info.hashes.sha1;
+        }
+        cout << "\n";
+        
+        if (job_info.status != COMPLETED || !job_info.result)
+        {
+          exit_code = EXIT_JOB_FAILED;
+        }
+      }
+      for (unsigned int step_id : graph.get_steps())
+      {
+        device_job_graph::step_info step = graph.get_step_info(step_id);
+        cout << "step\tid=" << step.step_id << "\tname=" << step.name;
+        if (step.on_device)
+        {
+          cout << "\tdevice=" << step.device_id << "\tjob=" << step.job_id;
+        }
+        cout << "\tstatus=" << status_name(step.status)
+             << "\tresult=" << (step.result ? 1 : 0)
+             << "\twait_s=" << step.seconds_waiting
+             << "\trun_s=" << step.seconds_running
+             << "\terror=" << step.error << "\n";
+        
+        if (step.status != COMPLETED || !step.result)
+        {
+          exit_code = EXIT_JOB_FAILED;
+        }
+      }
+      for (auto& entry : requests)
+      {
+        device_job_coordinator::request_info request = coordinator.get_request_info(entry.first);
+        cout << "request\tid=" << request.request_id << "\tname=" << request.name;
+        if (request.attempts > 0)
+        {
+          cout << "\tdevice=" << request.device_id << "\tjob=" << request.job_id;
+        }
+        cout << "\tattempts=" << request.attempts
+             << "\tstatus=" << status_name(request.status)
+             << "\tresult=" << (request.result ? 1 : 0)
+             << "\terror=" << request.error << "\n";
+        
+        if (request.status != COMPLETED || !request.result)
+        {
+          exit_code = EXIT_JOB_FAILED;
+        }
+      }
+      for (const vector<unsigned int>& batch : batches)
+      {
+        print_throughput("broadcast-summary", scheduler.get_throughput(batch));
+      }
+      print_throughput("summary", scheduler.get_throughput());
+      if (history != nullptr)
+      {
+        print_chip_health(*history);
+      }
+      if (latency_summary)
+      {
+        for (unsigned int device_id : devices)
+        {
+          print_command_latencies(device_id, manager.get_linkmasta_device(device_id));
+        }
+      }
+      if (budget != nullptr)
+      {
+        memory_budget::usage usage = budget->get_usage();
+        cout << "memory\tlimit=" << usage.limit << "\tpeak=" << usage.peak << "\twaits=" << usage.num_waits
+             << "\tovercommits=" << usage.num_overcommits << "\trefused=" << usage.num_refused << endl;
+      }
+    }
+  }
+  device_source.reset();
+  
+  // Export the trace once every job thread has stopped recording
+  if (trace_is_enabled())
+  {
+    trace_stop();
+    if (!trace_path.empty())
+    {
+      ofstream fout(trace_path.c_str());
+      trace_write_chrome_json(fout);
+      if (!fout.good())
+      {
+        cout << "error\tmessage=could not write trace to " << trace_path << endl;
+      }
+    }
+    if (trace_summary)
+    {
+      trace_write_summary(cerr);
+    }
+  }
+  
+  log_end("cli end");
+  log_deinit();
+  return exit_code;
+}
+
+
+
+void print_usage(const char* program_name)
+{
+  cerr << "usage: " << program_name << " [options] <manifest>\n"
+       << "\n"
+       << "Runs every job in the manifest on every attached device.\n"
+       << "\n"
+       << "manifest lines:\n"
+       << "  backup <path> [slot]        back up game data, %d in path is the device ID\n"
+       << "  backup-slots <path>         back up each WonderSwan slot to its own file\n"
+       << "  backup-save <path> [slot]   back up save data if it has changed\n"
+       << "  save-history <path> [slot]  check save data in to a history of its versions\n"
+       << "  restore-save <path> [slot]  restore save data from a file, or version n of a history given as path@n\n"
+       << "  flash <path> [slot]         flash game data, path may be an http:// URL\n"
+       << "  flash-verify <path> [slot]  flash game data and verify each block, path may be an http:// URL\n"
+       << "  broadcast <path> [slot]     flash and verify one cached image on every device as a batch\n"
+       << "  verify <path> [slot]        verify game data against an image\n"
+       << "  spot-check <path> [slot]    verify a random sample of game data against an image\n"
+       << "  repair <path> [slot]        verify game data and reflash only the blocks that differ\n"
+       << "  reflash <path> [slot]       flash and verify game data, keeping the save\n"
+       << "  clone <device> [slot]       copy game data from the given device to every other one\n"
+       << "  identify [slot]             look up the game on the cartridge\n"
+       << "  verify-catalog [slot]       verify game data against the catalog's checksums of a known-good dump\n"
+       << "\n"
+       << "options:\n"
+       << "  --devices <n>               number of devices to wait for (default 1)\n"
+       << "  --wait <ms>                 how long to wait for devices (default " << DEFAULT_WAIT_MS << ")\n"
+       << "  --interval <ms>             time between progress records (default " << DEFAULT_INTERVAL_MS << ")\n"
+       << "  --catalog-dir <dir>         directory containing the game catalogs (default .)\n"
+       << "  --store <dir>               keep one copy of each distinct backup in dir\n"
+       << "  --verify-reads              check every read for corrupted packets\n"
+       << "  --cache-reads               answer repeated metadata reads from a cache\n"
+       << "  --trim                      stop Neo Geo Pocket backups at the end of a known game\n"
+       << "  --confidence <p>            chance of spot-check catching a bad chip or image (default " << SPOT_CHECK_DEFAULT_CONFIDENCE << ")\n"
+       << "  --trace <path>              write a Chrome trace of USB and file activity to path\n"
+       << "  --trace-summary             print a per-phase timing summary to stderr\n"
+       << "  --latency-summary           print percentiles of how long each kind of exchange with each device took\n"
+       << "  --metrics-port <port>       serve Prometheus metrics on localhost:port/metrics\n"
+       << "  --max-per-hub <n>           devices behind one full-speed hub to run at once, 0 for all (default " << DEFAULT_MAX_JOBS_PER_HUB << ")\n"
+       << "  --plan                      print the work and estimated time of each job without running it\n"
+       << "  --erase-history <path>      record erase times in path and report chips that are slowing down\n"
+       << "  --adaptive-batches          adapt the size of transfer batches to each device\n"
+       << "  --batch-tuning <path>       adapt batch sizes and keep them per device in path for the next run\n"
+       << "  --timeouts <c>,<b>,<p>      USB timeouts in ms of commands, batches before size, and erase polls\n"
+       << "  --remote <host[:port],...>  use the devices served by other stations instead of local ones\n"
+       << "  --spread                    run each flash line once, on whichever device is free soonest\n"
+       << "  --io-priority               run the threads moving data to and from devices at a raised priority\n"
+       << "  --io-cpus <n,...>           pin the threads moving data to and from devices to the given CPUs\n"
+       << "  --usbfs                     on Linux, move data through /dev/bus/usb directly rather than libusb\n"
+       << "  --memory-budget <MiB>       cap the memory held by buffers and caches across every device\n"
+       << "  --log-level <level>         lowest of debug, verbose, or info to write to log.txt\n"
+       << "\n"
+       << "       " << program_name << " --serve <port>\n"
+       << "\n"
+       << "Serves the attached devices to other stations until killed (default port " << DEVICE_SERVER_DEFAULT_PORT << ").\n"
+       << "\n"
+       << "       " << program_name << " --daemon <port>\n"
+       << "       " << program_name << " --watch <port>\n"
+       << "\n"
+       << "Runs jobs for front ends on this machine until killed (default port " << JOB_SERVER_DEFAULT_PORT << "),\n"
+       << "or prints the jobs of such a daemon as they change.\n"
+       << "\n"
+       << "       " << program_name << " --library <index> [--catalog-dir <dir>] <directory>\n"
+       << "\n"
+       << "Indexes the game images under directory, reading only those changed since the index was saved.\n"
+       << "\n"
+       << "       " << program_name << " --diff <dump> <dump>\n"
+       << "\n"
+       << "Prints the ranges and cartridge blocks in which two dumps differ.\n"
+       << "\n"
+       << "       " << program_name << " --store <dir> --archive <port>\n"
+       << "       " << program_name << " --store <dir> --sync <host[:port]>\n"
+       << "\n"
+       << "Keeps the store as an archive for other stations until killed (default port " << STORE_SYNC_DEFAULT_PORT << "),\n"
+       << "or copies the files of the store that such an archive lacks to it.\n";
+}
+
+int serve_devices(unsigned short port, const io_thread_options& io_options, bool use_usbfs)
+{
+  log_init();
+  log_start("cli serve start...");
+  
+  int exit_code = EXIT_OK;
+  {
+    libusb_device_manager manager(use_usbfs);
+    manager.set_io_thread_options(io_options);
+    device_server server(&manager, port);
+    try
+    {
+      server.start();
+    }
+    catch (std::exception& ex)
+    {
+      cout << "error\tmessage=" << ex.what() << endl;
+      exit_code = EXIT_USAGE;
+    }
+    
+    if (exit_code == EXIT_OK)
+    {
+      cout << "serving\tport=" << port << endl;
+      
+      // Connections are handled by the server's threads until the process
+      // is killed
+      while (true)
+      {
+        this_thread::sleep_for(chrono::milliseconds(DEFAULT_INTERVAL_MS));
+      }
+    }
+  }
+  
+  log_end("cli serve end");
+  log_deinit();
+  return exit_code;
+}
+
+int run_daemon(unsigned short port, const io_thread_options& io_options, bool use_usbfs)
+{
+  log_init();
+  log_start("cli daemon start...");
+  
+  int exit_code = EXIT_OK;
+  {
+    libusb_device_manager manager(use_usbfs);
+    manager.set_io_thread_options(io_options);
+    device_job_scheduler scheduler(&manager);
+    scheduler.set_io_thread_options(io_options);
+    job_server server(&scheduler, &manager, port);
+    try
+    {
+      server.start();
+    }
+    catch (std::exception& ex)
+    {
+      cout << "error\tmessage=" << ex.what() << endl;
+      exit_code = EXIT_USAGE;
+    }
+    
+    if (exit_code == EXIT_OK)
+    {
+      cout << "daemon\tport=" << port << endl;
+      
+      // Jobs run on the scheduler's threads and clients are handled by the
+      // server's until the process is killed
+      while (true)
+      {
+        this_thread::sleep_for(chrono::milliseconds(DEFAULT_INTERVAL_MS));
+      }
+    }
+  }
+  
+  log_end("cli daemon end");
+  log_deinit();
+  return exit_code;
+}
+
+int watch_daemon(unsigned short port)
+{
+  job_client client([](const job_server_event& event)
+  {
+    lock_guard<mutex> lock(output_mutex);
+    cout << "job\tjob=" << event.job_id
+         << "\tdevice=" << event.device_id
+         << "\tcommand=" << job_server_kind_name(event.kind)
+         << "\tstatus=" << status_name(event.status)
+         << "\tphase=" << phase_name(event.phase)
+         << "\twork=" << event.work_progress << "/" << event.work_expected
+         << "\tbytes_per_s=" << event.work_per_second
+         << "\tresult=" << (event.result ? 1 : 0)
+         << "\terror=" << event.error << endl;
+  });
+  
+  try
+  {
+    client.connect(port);
+  }
+  catch (std::exception& ex)
+  {
+    cout << "error\tmessage=" << ex.what() << endl;
+    return EXIT_USAGE;
+  }
+  
+  // Events are printed by the client's thread until the daemon goes away
+  while (client.is_connected())
+  {
+    this_thread::sleep_for(chrono::milliseconds(DEVICE_POLL_INTERVAL_MS));
+  }
+  lock_guard<mutex> lock(output_mutex);
+  cout << "disconnected\tport=" << port << endl;
+  return EXIT_OK;
+}
+
+int index_library(const string& index_path, const string& directory, const string& catalog_dir)
+{
+  unique_ptr<game_catalog> ngp_catalog;
+  unique_ptr<game_catalog> ws_catalog;
+  rom_library library(index_path);
+  unsigned int num_read;
+  try
+  {
+    ngp_catalog.reset(open_game_catalog(catalog_dir + "/ngpgames", game_descriptor::game_system::NEO_GEO_POCKET));
+    ws_catalog.reset(open_game_catalog(catalog_dir + "/wsgames", game_descriptor::game_system::WONDERSWAN));
+    num_read = library.scan(vector<string>(1, directory), ngp_catalog.get(), ws_catalog.get());
+  }
+  catch (std::exception& ex)
+  {
+    cout << "error\tmessage=" << ex.what() << endl;
+    return EXIT_USAGE;
+  }
+  
+  unsigned int num_identified = 0;
+  for (const rom_library_entry& entry : library.entries())
+  {
+    cout << "image\tsystem=" << (entry.system == game_descriptor::NEO_GEO_POCKET ? "ngp" : "ws");
+    if (entry.has_hash)
+    {
+      cout << "\thash=0x" << hex << setfill('0') << setw(16) << (unsigned long long) entry.hash << dec << setfill(' ');
+    }
+    if (!entry.name.empty())
+    {
+      cout << "\tname=" << entry.name;
+      ++num_identified;
+    }
+    else if (!entry.metadata_name.empty())
+    {
+      cout << "\tmetadata_name=" << entry.metadata_name;
+    }
+    cout << "\tpath=" << entry.path << "\n";
+  }
+  cout << "library\timages=" << library.entries().size() << "\tread=" << num_read << "\tidentified=" << num_identified << endl;
+  return EXIT_OK;
+}
+
+int diff_dumps(const string& path_a, const string& path_b)
+{
+  unique_ptr<mapped_file> a;
+  unique_ptr<mapped_file> b;
+  unique_ptr<cartridge_descriptor> descriptor;
+  try
+  {
+    a.reset(new mapped_file(path_a));
+    b.reset(new mapped_file(path_b));
+    
+    // Lay the dumps over the smallest cartridge holding the larger one
+    unsigned int num_bytes = max(a->size(), b->size());
+    string extension = path_b.substr(path_b.find_last_of('.') == string::npos ? path_b.size() : path_b.find_last_of('.'));
+    if (extension == ".ws" || extension == ".wsc")
+    {
+      descriptor.reset(ws_cartridge::build_image_descriptor(num_bytes));
+    }
+    else
+    {
+      descriptor.reset(ngp_cartridge::build_image_descriptor(num_bytes));
+    }
+  }
+  catch (std::exception& ex)
+  {
+    cout << "error\tmessage=" << ex.what() << endl;
+    return EXIT_USAGE;
+  }
+  
+  auto start = chrono::steady_clock::now();
+  dump_diff diff(a->data(), a->size(), b->data(), b->size());
+  cartridge_layout layout(*descriptor);
+  vector<dump_diff::block_change> blocks = diff.changed_blocks(layout);
+  long long elapsed_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+  
+  cout << hex << setfill('0');
+  for (const dump_diff::range& r : diff.ranges())
+  {
+    cout << "diff-range\toffset=0x" << setw(6) << r.offset << "\tbytes=" << dec << r.num_bytes
+         << "\tdiffering=" << r.num_differing << hex << "\n";
+  }
+  for (const dump_diff::block_change& change : blocks)
+  {
+    cout << "diff-block\tchip=" << dec << change.chip_num << "\tblock=" << change.block_num
+         << "\taddress=0x" << hex << setw(6) << change.cartridge_address << "\tbytes=0x" << change.num_bytes
+         << "\tfirst_diff=0x" << setw(6) << change.first_difference << "\tdiffering=" << dec << change.num_differing << hex << "\n";
+  }
+  cout << dec << setfill(' ');
+  cout << "diff-total\tranges=" << diff.ranges().size() << "\tblocks=" << blocks.size()
+       << "\tdiffering=" << diff.num_differing() << "\tbytes=" << max(a->size(), b->size())
+       << "\tmatch=" << (diff.identical() ? "yes" : "no") << "\tus=" << elapsed_us << endl;
+  return (diff.identical() ? EXIT_OK : EXIT_JOB_FAILED);
+}
+
+int serve_archive(unsigned short port, const string& store_dir)
+{
+  log_init();
+  log_start("cli archive start...");
+  
+  int exit_code = EXIT_OK;
+  {
+    dump_store store(store_dir);
+    store_sync_server server(&store, port);
+    try
+    {
+      server.start();
+    }
+    catch (std::exception& ex)
+    {
+      cout << "error\tmessage=" << ex.what() << endl;
+      exit_code = EXIT_USAGE;
+    }
+    
+    if (exit_code == EXIT_OK)
+    {
+      cout << "archive\tport=" << port << "\tchunks=" << server.num_chunks() << endl;
+      
+      // Stations are handled by the server's threads until the process is
+      // killed
+      while (true)
+      {
+        this_thread::sleep_for(chrono::milliseconds(DEFAULT_INTERVAL_MS));
+      }
+    }
+  }
+  
+  log_end("cli archive end");
+  log_deinit();
+  return exit_code;
+}
+
+int sync_store(const string& address, const string& store_dir)
+{
+  string host = address;
+  int port = STORE_SYNC_DEFAULT_PORT;
+  size_t colon = address.rfind(':');
+  if (colon != string::npos)
+  {
+    host = address.substr(0, colon);
+    port = atoi(address.substr(colon + 1).c_str());
+  }
+  if (host.empty() || port <= 0 || port > 65535)
+  {
+    cout << "error\tmessage=Invalid archive address " << address << endl;
+    return EXIT_USAGE;
+  }
+  
+  dump_store store(store_dir);
+  store_sync_client client(&store);
+  store_sync_client::summary result;
+  try
+  {
+    result = client.push(host, (unsigned short) port);
+  }
+  catch (std::exception& ex)
+  {
+    cout << "error\tmessage=" << ex.what() << endl;
+    return EXIT_JOB_FAILED;
+  }
+  
+  cout << "sync\thost=" << host << ":" << port
+       << "\tfiles=" << result.files
+       << "\tfiles_sent=" << result.files_sent
+       << "\tchunks=" << result.chunks
+       << "\tchunks_sent=" << result.chunks_sent
+       << "\tbytes=" << result.bytes
+       << "\tbytes_sent=" << result.bytes_sent << endl;
+  return EXIT_OK;
+}
+
+vector<string> split_nodes(const string& nodes)
+{
+  vector<string> result;
+  stringstream sin(nodes);
+  string node;
+  while (getline(sin, node, ','))
+  {
+    if (!node.empty())
+    {
+      result.push_back(node);
+    }
+  }
+  if (result.empty())
+  {
+    throw std::invalid_argument("No device servers given in '" + nodes + "'");
+  }
+  return result;
+}
+
+bool parse_timeouts(const string& spec, linkmasta_device::timeout_profile& timeouts)
+{
+  stringstream sin(spec);
+  unsigned int command_ms, batch_ms, erase_poll_ms;
+  char comma1, comma2;
+  if (!(sin >> command_ms >> comma1 >> batch_ms >> comma2 >> erase_poll_ms)
+      || comma1 != ',' || comma2 != ',' || !(sin >> ws).eof())
+  {
+    return false;
+  }
+  
+  timeouts.command_ms = command_ms;
+  timeouts.batch_ms = batch_ms;
+  timeouts.erase_poll_ms = erase_poll_ms;
+  return true;
+}
+
+vector<manifest_entry> load_manifest(const string& manifest_path)
+{
+  ifstream fin(manifest_path.c_str());
+  if (!fin.is_open())
+  {
+    throw std::runtime_error("Unable to open file " + manifest_path);
+  }
+  
+  vector<manifest_entry> entries;
+  string line;
+  unsigned int line_num = 0;
+  while (getline(fin, line))
+  {
+    ++line_num;
+    istringstream fields(line);
+    manifest_entry entry;
+    entry.slot = cartridge::SLOT_ALL;
+    entry.line_num = line_num;
+    
+    if (!(fields >> entry.command) || entry.command[0] == '#')
+    {
+      continue;
+    }
+    
+    if (entry.command != "identify" && entry.command != "verify-catalog" && !(fields >> entry.path))
+    {
+      throw std::runtime_error("Missing path on line " + to_string(line_num) + " of " + manifest_path);
+    }
+    if (entry.command != "backup" && entry.command != "backup-slots" && entry.command != "backup-save"
+        && entry.command != "save-history" && entry.command != "restore-save" && entry.command != "flash" && entry.command != "flash-verify" && entry.command != "broadcast" && entry.command != "verify"
+        && entry.command != "spot-check" && entry.command != "repair" && entry.command != "reflash" && entry.command != "clone"
+        && entry.command != "identify" && entry.command != "verify-catalog")
+    {
+      throw std::runtime_error("Unknown command '" + entry.command + "' on line " + to_string(line_num) + " of " + manifest_path);
+    }
+    
+    if (entry.command == "clone" && entry.path.find_first_not_of("0123456789") != string::npos)
+    {
+      throw std::runtime_error("Invalid device '" + entry.path + "' on line " + to_string(line_num) + " of " + manifest_path);
+    }
+    
+    string slot;
+    if (fields >> slot)
+    {
+      char* end = nullptr;
+      entry.slot = (int) strtol(slot.c_str(), &end, 10);
+      if (*end != '\0' || entry.slot < cartridge::SLOT_ALL)
+      {
+        throw std::runtime_error("Invalid slot '" + slot + "' on line " + to_string(line_num) + " of " + manifest_path);
+      }
+      if (entry.command == "backup-slots")
+      {
+        throw std::runtime_error("backup-slots takes no slot on line " + to_string(line_num) + " of " + manifest_path);
+      }
+    }
+    
+    entries.push_back(entry);
+  }
+  
+  return entries;
+}
+
+shared_ptr<streamed_image> start_download(const string& url)
+{
+  shared_ptr<streamed_image> stream = make_shared<streamed_image>();
+  stream->download.reset(new http_download(url));
+  
+  // The whole image is kept in memory, so it has to fit a cartridge
+  unsigned long long size = stream->download->open();
+  if (size == 0 || size > 0xFFFFFFFFull)
+  {
+    throw std::runtime_error("Image at " + url + " is not the size of a game");
+  }
+  stream->pipe.reset(new image_pipe((unsigned int) size));
+  
+  streamed_image* s = stream.get();
+  stream->downloader = thread([s]()
+  {
+    try
+    {
+      s->download->read_to(s->pipe->output());
+      s->pipe->close();
+    }
+    catch (std::exception& ex)
+    {
+      s->pipe->close(ex.what());
+    }
+  });
+  return stream;
+}
+
+streamed_image::~streamed_image()
+{
+  // Every job flashing the image is done with it by now
+  if (downloader.joinable())
+  {
+    download->cancel();
+    downloader.join();
+  }
+}
+
+vector<unsigned int> wait_for_devices(device_manager& manager, unsigned int min_devices, int wait_ms)
+{
+  // The device list is filled in by the manager's refresh thread
+  auto deadline = chrono::steady_clock::now() + chrono::milliseconds(wait_ms);
+  vector<unsigned int> devices = manager.get_connected_devices();
+  while (devices.size() < min_devices && chrono::steady_clock::now() < deadline)
+  {
+    this_thread::sleep_for(chrono::milliseconds(DEVICE_POLL_INTERVAL_MS));
+    devices = manager.get_connected_devices();
+  }
+  return devices;
+}
+
+string backup_path_for(const string& path, unsigned int device_id, bool several_devices)
+{
+  string id = to_string(device_id);
+  string result = path;
+  bool replaced = false;
+  for (size_t pos = result.find("%d"); pos != string::npos; pos = result.find("%d", pos + id.size()))
+  {
+    result.replace(pos, 2, id);
+    replaced = true;
+  }
+  
+  if (!replaced && several_devices)
+  {
+    size_t dot = result.find_last_of('.');
+    size_t slash = result.find_last_of("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+    {
+      dot = result.size();
+    }
+    result.insert(dot, "-" + id);
+  }
+  
+  return result;
+}
+
+const char* status_name(task_status status)
+{
+  switch (status)
+  {
+  case ERROR:       return "error";
+  case NOT_STARTED: return "not-started";
+  case STARTING:    return "starting";
+  case RUNNING:     return "running";
+  case STOPPING:    return "stopping";
+  case COMPLETED:   return "completed";
+  case CANCELLED:   return "cancelled";
+  default:          return "unknown";
+  }
+}
+
+const char* phase_name(task_phase phase)
+{
+  switch (phase)
+  {
+  case TASK_PHASE_ERASE:   return "erase";
+  case TASK_PHASE_PROGRAM: return "program";
+  case TASK_PHASE_READ:    return "read";
+  case TASK_PHASE_VERIFY:  return "verify";
+  default:                 return "other";
+  }
+}
+
+void print_throughput(const char* record, const device_job_scheduler::throughput_info& info)
+{
+  cout << record
+       << "\telapsed_s=" << info.seconds_elapsed
+       << "\tqueued=" << info.num_jobs_queued
+       << "\trunning=" << info.num_jobs_running
+       << "\tcompleted=" << info.num_jobs_completed
+       << "\tfailed=" << info.num_jobs_failed
+       << "\tactive_devices=" << info.num_active_devices
+       << "\twork=" << info.work_progress << "/" << info.work_expected
+       << "\twork_per_s=" << info.work_per_second << endl;
+}
+
+void print_job_progress(unsigned int job_id, unsigned int device_id, const device_job_scheduler::job_info& info)
+{
+  if (info.status != RUNNING)
+  {
+    return;
+  }
+  cout << "job-progress\tid=" << job_id << "\tdevice=" << device_id
+       << "\tphase=" << phase_name(info.phase)
+       << "\twork=" << info.work_progress << "/" << info.work_expected
+       << "\twork_per_s=" << info.work_per_second
+       << "\tsmoothed_work_per_s=" << info.smoothed_work_per_second
+       << "\teta_s=" << info.seconds_remaining << "\n";
+}
+
+operation_planner::plan plan_for_image(operation_planner::operation op, unsigned int num_bytes)
+{
+  // The cartridge isn't known until a device is chosen, so assume uniform
+  // blocks that each need erasing
+  operation_planner::plan p;
+  p.op = op;
+  p.num_blocks = (num_bytes + SPREAD_PLAN_BLOCK_SIZE - 1) / SPREAD_PLAN_BLOCK_SIZE;
+  p.num_block_erases = p.num_blocks;
+  p.num_chip_erases = 0;
+  p.chip_erase_bytes = 0;
+  p.bytes_read = (op == operation_planner::operation::FLASH_AND_VERIFY ? num_bytes : 0);
+  p.bytes_programmed = num_bytes;
+  return p;
+}
+
+void print_plans(unsigned int device_id, cartridge* cart, const vector<manifest_entry>& entries, const operation_planner::rates& rates)
+{
+  typedef operation_planner::operation operation;
+  operation_planner planner(rates);
+  double total_seconds = 0.0;
+  
+  for (const manifest_entry& entry : entries)
+  {
+    // Work out which operations the command performs on this device
+    vector<operation> ops;
+    bool needs_image = false;
+    if (entry.command == "backup" || entry.command == "backup-slots" || entry.command == "verify-catalog")
+    {
+      ops.push_back(operation::BACKUP);
+    }
+    else if (entry.command == "backup-save" || entry.command == "save-history")
+    {
+      ops.push_back(operation::BACKUP_SAVE);
+    }
+    else if (entry.command == "restore-save")
+    {
+      ops.push_back(operation::RESTORE_SAVE);
+    }
+    else if (entry.command == "flash")
+    {
+      ops.push_back(operation::FLASH);
+      needs_image = true;
+    }
+    else if (entry.command == "flash-verify" || entry.command == "broadcast")
+    {
+      ops.push_back(operation::FLASH_AND_VERIFY);
+      needs_image = true;
+    }
+    else if (entry.command == "verify" || entry.command == "repair")
+    {
+      ops.push_back(operation::VERIFY);
+      needs_image = true;
+    }
+    else if (entry.command == "reflash")
+    {
+      ops.push_back(operation::BACKUP_SAVE);
+      ops.push_back(operation::FLASH);
+      ops.push_back(operation::VERIFY);
+      ops.push_back(operation::RESTORE_SAVE);
+      ops.push_back(operation::BACKUP_SAVE);
+      needs_image = true;
+    }
+    else if (entry.command == "clone" && to_string(device_id) != entry.path)
+    {
+      ops.push_back(operation::FLASH);
+    }
+    
+    int slot = (entry.command == "backup-slots" ? cartridge::SLOT_ALL : entry.slot);
+    unique_ptr<mapped_file> image;
+    if (!ops.empty() && needs_image && !http_download::is_url(entry.path))
+    {
+      image.reset(new mapped_file(entry.path));
+    }
+    
+    for (operation op : ops)
+    {
+      operation_planner::plan p;
+      if (op == operation::BACKUP_SAVE || op == operation::RESTORE_SAVE)
+      {
+        p = planner.plan_save(*cart, op, slot);
+      }
+      else if (image != nullptr)
+      {
+        p = planner.plan_game(*cart, op, slot, image->data(), image->size());
+      }
+      else
+      {
+        p = planner.plan_game(*cart, op, slot);
+      }
+      
+      double seconds = planner.estimate_seconds(p);
+      total_seconds += seconds;
+      
+      lock_guard<mutex> lock(output_mutex);
+      cout << "plan\tdevice=" << device_id << "\tline=" << entry.line_num
+           << "\tcommand=" << entry.command << "\top=" << operation_name(op)
+           << "\tslot=" << slot
+           << "\tblocks=" << p.num_blocks
+           << "\terases=" << p.num_block_erases
+           << "\tchip_erases=" << p.num_chip_erases
+           << "\tread_bytes=" << p.bytes_read
+           << "\tprogram_bytes=" << p.bytes_programmed
+           << "\terase_s=" << planner.estimate_erase_seconds(p)
+           << "\test_s=" << seconds << endl;
+    }
+  }
+  
+  lock_guard<mutex> lock(output_mutex);
+  cout << "plan-total\tdevice=" << device_id << "\test_s=" << total_seconds << endl;
+}
+
+void print_chip_health(erase_history& history)
+{
+  // Called with the output lock held
+  for (const erase_history::chip_health& health : history.get_all_chip_health())
+  {
+    ostringstream slowest_hex;
+    slowest_hex << hex << health.slowest_block_address;
+    cout << "chip-health\tserial=" << health.key.serial << "\tchip=" << health.key.chip_num
+         << "\tblock_erases=" << health.num_block_erases
+         << "\tchip_erases=" << health.num_chip_erases
+         << "\tbaseline_ms=" << health.baseline_block_ms
+         << "\trecent_ms=" << health.recent_block_ms
+         << "\tslowest_block=0x" << slowest_hex.str()
+         << "\tslowest_ms=" << health.slowest_block_ms
+         << "\tchip_erase_ms=" << health.recent_chip_ms
+         << "\tdegraded_blocks=" << health.num_degraded_blocks
+         << "\tdegrading=" << (health.degrading ? 1 : 0) << "\n";
+  }
+  cout.flush();
+}
+
+void print_command_latencies(unsigned int device_id, const linkmasta_device* linkmasta)
+{
+  // Called with the output lock held
+  static const char* const names[NUM_COMMAND_LATENCIES] = {"read-batch", "write-ack", "word-write", "erase-poll"};
+  for (unsigned int command = 0; command < NUM_COMMAND_LATENCIES; ++command)
+  {
+    latency_histogram::snapshot s = linkmasta->command_latencies((command_latency) command).read();
+    if (s.count == 0)
+    {
+      continue;
+    }
+    cout << "latency\tdevice=" << device_id << "\tcommand=" << names[command]
+         << "\tcount=" << s.count
+         << "\tmean_us=" << (unsigned long long) (s.mean_us() + 0.5)
+         << "\tp50_us=" << s.percentile_us(50.0)
+         << "\tp99_us=" << s.percentile_us(99.0)
+         << "\tp999_us=" << s.percentile_us(99.9)
+         << "\tmax_us=" << s.max_us << "\n";
+  }
+  cout.flush();
+}
+
+bool verify_against_catalog(unsigned int device_id, cartridge* cart, int slot, game_catalog* catalog, task_controller* controller)
+{
+  // Known-good dumps hold the game alone, so Neo Geo Pocket backups stop at
+  // its end rather than the end of the slot
+  long long hash = 0;
+  bool has_hash = false;
+  switch (cart->system())
+  {
+  case SYSTEM_NEO_GEO_POCKET:
+    has_hash = ngp_game_hash(cart, slot, &hash);
+    ((ngp_cartridge*) cart)->set_trimmed_backups(true);
+    break;
+  
+  case SYSTEM_WONDERSWAN:
+    has_hash = ws_game_hash(cart, slot, &hash);
+    break;
+  
+  default:
+  case SYSTEM_UNKNOWN:
+    break;
+  }
+  
+  game_image_hashes expected;
+  if (!has_hash || !catalog->known_good_hashes(hash, &expected))
+  {
+    throw std::runtime_error("No known-good checksums for the game on the cartridge");
+  }
+  const game_descriptor* desc = catalog->identify_hash(hash);
+  
+  // Hash the game as it is read, keeping none of it
+  hash_ostream hashed;
+  cart->backup_cartridge_game_data(hashed, slot, controller);
+  dump_hashes actual = hashed.hashes();
+  if (controller->is_task_cancelled())
+  {
+    return false;
+  }
+  bool match = (actual.crc32 == expected.crc32 && actual.sha1 == expected.sha1);
+  
+  lock_guard<mutex> lock(output_mutex);
+  ostringstream crc32_hex;
+  crc32_hex << hex << setw(8) << setfill('0') << actual.crc32;
+  cout << "verify-catalog\tdevice=" << device_id << "\tslot=" << slot
+       << "\tgame=" << (desc != nullptr ? desc->name : "")
+       << "\tcrc32=" << crc32_hex.str() << "\tsha1=" << actual.sha1
+       << "\tmatch=" << (match ? 1 : 0) << endl;
+  return match;
+}
+
+bool repair_against_image(unsigned int device_id, cartridge* cart, shared_ptr<const mapped_file> image, int slot, task_controller* controller)
+{
+  // Verifying and rewriting the failed blocks each get half of the progress
+  controller->on_task_start(2 * image->size());
+  
+  block_mismatch_map mismatches;
+  bool matched;
+  {
+    forwarding_task_controller fwd_controller(controller);
+    fwd_controller.scale_work_to(image->size());
+    matched = cart->compare_cartridge_game_data_blocks(image->data(), image->size(), mismatches, slot, &fwd_controller);
+  }
+  
+  bool repaired = matched;
+  if (!matched && !controller->is_task_cancelled())
+  {
+    forwarding_task_controller fwd_controller(controller);
+    fwd_controller.scale_work_to(image->size());
+    repaired = cart->repair_cartridge_game_data(image->data(), image->size(), mismatches, slot, &fwd_controller);
+  }
+  
+  bool cancelled = controller->is_task_cancelled();
+  controller->on_task_end(cancelled ? task_status::CANCELLED : task_status::COMPLETED, controller->get_task_work_progress());
+  if (cancelled)
+  {
+    return false;
+  }
+  
+  unsigned int first_difference = 0;
+  for (const block_mismatch_map::block& b : mismatches.blocks())
+  {
+    if (!b.matched)
+    {
+      first_difference = b.first_difference;
+      break;
+    }
+  }
+  
+  lock_guard<mutex> lock(output_mutex);
+  ostringstream first_hex;
+  first_hex << "0x" << hex << first_difference;
+  cout << "repair\tdevice=" << device_id << "\tslot=" << slot
+       << "\tblocks=" << mismatches.blocks().size() << "\trewritten=" << mismatches.num_mismatched()
+       << "\tfirst_diff=" << (matched ? string("") : first_hex.str())
+       << "\tmatch=" << (repaired ? 1 : 0) << endl;
+  return repaired;
+}
+
+const char* operation_name(operation_planner::operation op)
+{
+  switch (op)
+  {
+  case operation_planner::operation::BACKUP:           return "backup";
+  case operation_planner::operation::FLASH:            return "flash";
+  case operation_planner::operation::FLASH_AND_VERIFY: return "flash-verify";
+  case operation_planner::operation::VERIFY:           return "verify";
+  case operation_planner::operation::BACKUP_SAVE:      return "backup-save";
+  case operation_planner::operation::RESTORE_SAVE:     return "restore-save";
+  default:                                             return "unknown";
+  }
+}
@@ -0,0 +1,347 @@
+#include "cartridge_snapshot_cache.h"
+
+#include <set>
+
+#include "flash_masta_app.h"
+#include "cartridge/cartridge.h"
+#include "game/game_descriptor.h"
+#include "linkmasta/auto_save_backup.h"
+#include "linkmasta/device_manager.h"
+#include "linkmasta/linkmasta_device.h"
+#include "worker/game_identifying_worker.h"
+#include "worker/lm_cartridge_fetching_worker.h"
+#include "worker/lm_cartridge_polling_worker.h"
+#include "worker/worker_pool.h"
+
+CartridgeSnapshotCache::CartridgeSnapshotCache(QObject *parent) :
+  QObject(parent), m_entries(), m_device_listener(0),
+  m_device_listener_added(false)
+{
+  // The device manager is loaded in the background
+  FlashMastaApp* app = FlashMastaApp::getInstance();
+  connect(app, SIGNAL(deviceManagerReady()), this, SLOT(deviceManagerReady()));
+  connect(app, SIGNAL(selectedDeviceChanged(int,int)), this, SLOT(selectedDeviceChanged(int,int)));
+  if (app->getDeviceManager() != nullptr)
+  {
+    deviceManagerReady();
+  }
+}
+
+CartridgeSnapshotCache::~CartridgeSnapshotCache()
+{
+  if (m_device_listener_added)
+  {
+    FlashMastaApp::getInstance()->getDeviceManager()->remove_device_listener(m_device_listener);
+  }
+  for (auto& entry : m_entries)
+  {
+    cancelLoad(entry.second);
+    delete entry.second.poller;
+  }
+}
+
+
+
+std::shared_ptr<const CartridgeSnapshot> CartridgeSnapshotCache::snapshot(unsigned int device_id) const
+{
+  auto it = m_entries.find(device_id);
+  return (it != m_entries.end() ? it->second.snapshot : nullptr);
+}
+
+void CartridgeSnapshotCache::setSnapshot(unsigned int device_id, std::shared_ptr<const CartridgeSnapshot> snapshot)
+{
+  auto it = m_entries.find(device_id);
+  if (it == m_entries.end()) return;
+  it->second.snapshot = snapshot;
+}
+
+void CartridgeSnapshotCache::invalidate(unsigned int device_id)
+{
+  auto it = m_entries.find(device_id);
+  if (it == m_entries.end()) return;
+  it->second.snapshot.reset();
+  
+  // Whatever is loading was read before the change
+  cancelLoad(it->second);
+  
+  // The fingerprint may no longer tell the cartridge apart from what it held
+  // before
+  it->second.fingerprint.clear();
+  it->second.removed_snapshot.reset();
+}
+
+void CartridgeSnapshotCache::load(unsigned int device_id)
+{
+  auto it = m_entries.find(device_id);
+  if (it == m_entries.end()) return;
+  
+  Entry& entry = it->second;
+  if (!entry.cartridge_present || entry.snapshot != nullptr
+      || entry.fetcher != nullptr || entry.identifier != nullptr)
+  {
+    return;
+  }
+  
+  // Have worker load cartridge contents in background on the shared pool
+  LmCartridgeFetchingWorker* worker = new LmCartridgeFetchingWorker(device_id);
+  entry.fetcher = worker;
+  connect(worker, SIGNAL(finished(cartridge*,std::vector<std::string>)), this, SLOT(fetcherFinished(cartridge*,std::vector<std::string>)));
+  connect(worker, SIGNAL(finished(cartridge*,std::vector<std::string>)), worker, SLOT(deleteLater()));
+  FlashMastaApp::getInstance()->getWorkerPool()->submit([worker] { worker->run(); });
+}
+
+bool CartridgeSnapshotCache::isCartridgePresent(unsigned int device_id) const
+{
+  auto it = m_entries.find(device_id);
+  return (it != m_entries.end() && it->second.cartridge_present);
+}
+
+QString CartridgeSnapshotCache::firmwareVersion(unsigned int device_id) const
+{
+  auto it = m_entries.find(device_id);
+  return (it != m_entries.end() ? it->second.firmware_version : QString());
+}
+
+void CartridgeSnapshotCache::setFirmwareVersion(unsigned int device_id, QString version)
+{
+  auto it = m_entries.find(device_id);
+  if (it == m_entries.end()) return;
+  it->second.firmware_version = version;
+}
+
+
+
+// public slots:
+
+void CartridgeSnapshotCache::deviceManagerReady()
+{
+  if (m_device_listener_added) return;
+  
+  // Listeners run on the device manager's thread, so hop over to the UI
+  // thread first
+  m_device_listener = FlashMastaApp::getInstance()->getDeviceManager()->add_device_listener([this](unsigned int, bool)
+  {
+    QMetaObject::invokeMethod(this, "refreshDevices", Qt::QueuedConnection);
+  });
+  m_device_listener_added = true;
+  refreshDevices();
+}
+
+void CartridgeSnapshotCache::refreshDevices()
+{
+  device_manager* manager = FlashMastaApp::getInstance()->getDeviceManager();
+  std::vector<unsigned int> connected_devices = manager->get_connected_devices();
+  std::set<unsigned int> current_devices(connected_devices.begin(), connected_devices.end());
+  
+  // Forget devices that are gone
+  for (auto it = m_entries.begin(); it != m_entries.end();)
+  {
+    if (current_devices.find(it->first) == current_devices.end())
+    {
+      cancelLoad(it->second);
+      delete it->second.poller;
+      it = m_entries.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+  
+  // Start watching new devices. Devices with a built-in cartridge always have
+  // one, so there's nothing to watch for.
+  for (auto device_id : current_devices)
+  {
+    if (m_entries.find(device_id) != m_entries.end()) continue;
+    
+    linkmasta_device* linkmasta;
+    try
+    {
+      linkmasta = manager->get_linkmasta_device(device_id);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Device went away in the meantime
+      continue;
+    }
+    
+    Entry& entry = m_entries[device_id];
+    entry.poller = nullptr;
+    entry.fetcher = nullptr;
+    entry.identifier = nullptr;
+    entry.loaded_slots.clear();
+    entry.cartridge_present = linkmasta->is_integrated_with_cartridge();
+    if (entry.cartridge_present)
+    {
+      load(device_id);
+    }
+    else
+    {
+      entry.poller = new LmCartridgePollingWorker(device_id);
+      connect(entry.poller, SIGNAL(cartridgeInserted(unsigned int,QString)), this, SLOT(pollerCartridgeInserted(unsigned int,QString)));
+      connect(entry.poller, SIGNAL(cartridgeRemoved(unsigned int)), this, SLOT(pollerCartridgeRemoved(unsigned int)));
+      entry.poller->setWatched((int) device_id == FlashMastaApp::getInstance()->getSelectedDevice());
+      entry.poller->start();
+    }
+  }
+}
+
+
+
+// private slots:
+
+void CartridgeSnapshotCache::pollerCartridgeInserted(unsigned int device_id, QString fingerprint)
+{
+  auto it = m_entries.find(device_id);
+  if (it == m_entries.end()) return;
+  
+  Entry& entry = it->second;
+  entry.cartridge_present = true;
+  
+  // The same cartridge seated again is shown as it was
+  bool reseated = (!fingerprint.isEmpty() && fingerprint == entry.fingerprint);
+  entry.snapshot = (reseated ? entry.removed_snapshot : nullptr);
+  if (reseated) entry.removed_snapshot.reset();
+  entry.fingerprint = fingerprint;
+  load(device_id);
+  
+  // Back the save up before anyone has the chance to flash over it
+  auto_save_backup* backup = FlashMastaApp::getInstance()->getAutoSaveBackup();
+  if (backup != nullptr)
+  {
+    backup->cartridge_inserted(device_id, fingerprint.toStdString());
+  }
+  emit cartridgeInserted(device_id);
+}
+
+void CartridgeSnapshotCache::pollerCartridgeRemoved(unsigned int device_id)
+{
+  auto it = m_entries.find(device_id);
+  if (it == m_entries.end()) return;
+  
+  it->second.cartridge_present = false;
+  cancelLoad(it->second);
+  it->second.removed_snapshot = it->second.snapshot;
+  it->second.snapshot.reset();
+  emit cartridgeRemoved(device_id);
+}
+
+void CartridgeSnapshotCache::selectedDeviceChanged(int old_device_id, int new_device_id)
+{
+  for (auto& entry : m_entries)
+  {
+    if (entry.second.poller == nullptr) continue;
+    
+    if ((int) entry.first == old_device_id || (int) entry.first == new_device_id)
+    {
+      entry.second.poller->setWatched((int) entry.first == new_device_id);
+    }
+  }
+}
+
+void CartridgeSnapshotCache::fetcherFinished(cartridge* cart, std::vector<std::string> slot_names)
+{
+  for (auto& entry : m_entries)
+  {
+    if (entry.second.fetcher != sender()) continue;
+    
+    entry.second.fetcher = nullptr;
+    if (cart != nullptr)
+    {
+      entry.second.loaded_cartridge.reset(cart);
+      entry.second.loaded_slot_names = slot_names;
+      try
+      {
+        cart->fetch_slot_table(entry.second.loaded_slots);
+      }
+      catch (std::exception& ex)
+      {
+        (void) ex;
+        entry.second.loaded_slots.clear();
+      }
+      identify(entry.first, entry.second);
+    }
+    return;
+  }
+  
+  // The load was cancelled after the cartridge was read
+  delete cart;
+}
+
+void CartridgeSnapshotCache::identifierFinished(std::vector<const game_descriptor*> descriptors)
+{
+  for (auto& entry : m_entries)
+  {
+    if (entry.second.identifier != sender()) continue;
+    
+    entry.second.identifier = nullptr;
+    finishLoad(entry.first, entry.second, descriptors);
+    return;
+  }
+}
+
+
+
+// private:
+
+void CartridgeSnapshotCache::cancelLoad(Entry& entry)
+{
+  if (entry.fetcher != nullptr) entry.fetcher->cancel();
+  if (entry.identifier != nullptr) entry.identifier->cancel();
+  entry.fetcher = nullptr;
+  entry.identifier = nullptr;
+  entry.loaded_cartridge.reset();
+  entry.loaded_slot_names.clear();
+  entry.loaded_slots.clear();
+}
+
+void CartridgeSnapshotCache::identify(unsigned int device_id, Entry& entry)
+{
+  // A cartridge whose fingerprint changed but whose slots all hold the same
+  // headers as the one removed holds the same games
+  std::shared_ptr<const CartridgeSnapshot> removed = entry.removed_snapshot;
+  entry.removed_snapshot.reset();
+  if (removed != nullptr && entry.loaded_slots.num_slots > 0 && entry.loaded_slots.same_cartridge(removed->slots))
+  {
+    finishLoad(device_id, entry, removed->descriptors);
+    return;
+  }
+  
+  // Cartridges seen recently are named right away
+  std::vector<const game_descriptor*> descriptors;
+  if (GameIdentifyingWorker::identifyFromCache(entry.loaded_cartridge.get(), descriptors))
+  {
+    finishLoad(device_id, entry, descriptors);
+    return;
+  }
+  
+  // Have worker identify the games in background on the shared pool
+  GameIdentifyingWorker* worker = new GameIdentifyingWorker(device_id, entry.loaded_cartridge);
+  entry.identifier = worker;
+  connect(worker, SIGNAL(finished(std::vector<const game_descriptor*>)), this, SLOT(identifierFinished(std::vector<const game_descriptor*>)));
+  connect(worker, SIGNAL(finished(std::vector<const game_descriptor*>)), worker, SLOT(deleteLater()));
+  FlashMastaApp::getInstance()->getWorkerPool()->submit([worker] { worker->run(); });
+}
+
+void CartridgeSnapshotCache::finishLoad(unsigned int device_id, Entry& entry, const std::vector<const game_descriptor*>& descriptors)
+{
+  std::shared_ptr<CartridgeSnapshot> snapshot = std::make_shared<CartridgeSnapshot>();
+  snapshot->cart = entry.loaded_cartridge;
+  snapshot->slot_names = entry.loaded_slot_names;
+  snapshot->descriptors = descriptors;
+  snapshot->slots = entry.loaded_slots;
+  
+  // Official cartridges only have the descriptor for the whole cartridge
+  for (unsigned int i = 0; i < snapshot->slots.num_slots; ++i)
+  {
+    unsigned int d = (descriptors.size() > 1 ? i + 1 : 0);
+    const game_descriptor* descriptor = (d < descriptors.size() ? descriptors[d] : nullptr);
+    snapshot->slots.slots[i].game_key = (descriptor != nullptr ? slot_table::game_key(descriptor->name) : 0);
+  }
+  entry.loaded_cartridge.reset();
+  entry.loaded_slot_names.clear();
+  
+  entry.snapshot = snapshot;
+  emit snapshotReady(device_id);
+}
@@ -0,0 +1,122 @@
+#ifndef __CARTRIDGE_SNAPSHOT_CACHE_H__
+#define __CARTRIDGE_SNAPSHOT_CACHE_H__
+
+#include <QObject>
+#include <QString>
+#include "cartridge/slot_table.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class cartridge;
+class GameIdentifyingWorker;
+class LmCartridgeFetchingWorker;
+class LmCartridgePollingWorker;
+struct game_descriptor;
+
+// Everything the detail widgets show about a cartridge, read from the device
+// once. Snapshots are never modified after they're cached, so widgets can
+// share them freely.
+struct CartridgeSnapshot
+{
+  std::shared_ptr<cartridge> cart;
+  
+  // The name stored in each slot's game header
+  std::vector<std::string> slot_names;
+  
+  // The first descriptor is for the whole cartridge and the rest for each of
+  // its slots, as reported by GameIdentifyingWorker
+  std::vector<const game_descriptor*> descriptors;
+  
+  // The size and header of each slot, keyed with the game identified in it.
+  // Cheap to copy out of the snapshot or send to another process
+  slot_table slots;
+};
+
+// Application-wide cache of what's known about each connected device and the
+// cartridge in it, so that switching between devices in the UI doesn't talk
+// to them again. Watches every Link Masta for cartridges coming and going,
+// often for the device selected in the UI and only now and then for the rest,
+// and not at all for devices with a built-in cartridge;
+// a device's snapshot is only thrown away when its cartridge is removed or
+// replaced, or when its contents are changed. The snapshot of a cartridge that
+// is removed is kept aside until the next one is seated, so that if the
+// fingerprint of the next one matches, it's shown again right away instead of
+// being probed and identified from scratch. A snapshot is loaded in the
+// background as soon as a cartridge is seen, before any widget asks for it,
+// so that by the time the device is picked in the UI it's shown right away.
+// Only used from the UI thread.
+class CartridgeSnapshotCache : public QObject
+{
+  Q_OBJECT
+public:
+  explicit CartridgeSnapshotCache(QObject *parent = 0);
+  ~CartridgeSnapshotCache();
+  
+  std::shared_ptr<const CartridgeSnapshot> snapshot(unsigned int device_id) const;
+  void setSnapshot(unsigned int device_id, std::shared_ptr<const CartridgeSnapshot> snapshot);
+  void invalidate(unsigned int device_id);
+  
+  // Starts loading the snapshot in the background unless it's cached or
+  // already loading. snapshotReady() is emitted once it's cached
+  void load(unsigned int device_id);
+  
+  bool isCartridgePresent(unsigned int device_id) const;
+  
+  // Empty if not known yet
+  QString firmwareVersion(unsigned int device_id) const;
+  void setFirmwareVersion(unsigned int device_id, QString version);
+  
+public slots:
+  void refreshDevices();
+  void deviceManagerReady();
+  
+private slots:
+  void pollerCartridgeInserted(unsigned int device_id, QString fingerprint);
+  void pollerCartridgeRemoved(unsigned int device_id);
+  void selectedDeviceChanged(int old_device_id, int new_device_id);
+  void fetcherFinished(cartridge* cart, std::vector<std::string> slot_names);
+  void identifierFinished(std::vector<const game_descriptor*> descriptors);
+  
+signals:
+  void cartridgeInserted(unsigned int device_id);
+  void cartridgeRemoved(unsigned int device_id);
+  void snapshotReady(unsigned int device_id);
+  
+private:
+  struct Entry
+  {
+    LmCartridgePollingWorker* poller;
+    bool cartridge_present;
+    std::shared_ptr<const CartridgeSnapshot> snapshot;
+    QString firmware_version;
+    
+    // Fingerprint of the cartridge seated last, empty if the cartridge can't
+    // be recognized again, such as after its contents changed
+    QString fingerprint;
+    
+    // Snapshot of the cartridge while it's removed, and until the next one
+    // is read if their fingerprints don't match, in case their slots do
+    std::shared_ptr<const CartridgeSnapshot> removed_snapshot;
+    
+    // The workers loading the snapshot, at most one of them at a time, and
+    // what the first has read for the second
+    LmCartridgeFetchingWorker* fetcher;
+    GameIdentifyingWorker* identifier;
+    std::shared_ptr<cartridge> loaded_cartridge;
+    std::vector<std::string> loaded_slot_names;
+    slot_table loaded_slots;
+  };
+  
+  // Lets the workers loading a snapshot finish without it
+  void cancelLoad(Entry& entry);
+  void identify(unsigned int device_id, Entry& entry);
+  void finishLoad(unsigned int device_id, Entry& entry, const std::vector<const game_descriptor*>& descriptors);
+  
+  std::map<unsigned int, Entry> m_entries;
+  unsigned int m_device_listener;
+  bool m_device_listener_added;
+};
+
+#endif // __CARTRIDGE_SNAPSHOT_CACHE_H__
@@ -9,6 +9,7 @@
 #include "linkmasta/device_manager.h"
 #include "../flash_masta_app.h"
 #include "../main_window.h"
+#include "../svg_pixmap_cache.h"
 
 
 
@@ -19,6 +20,19 @@ CartridgeInfoWidget::CartridgeInfoWidget(int device_id, cartridge* cart, QWidget
 {
   ui->setupUi(this);
   
+  // Every slot widget shows the same check and cross artwork, so it's only
+  // rendered for the first
+  QLabel* enabled_labels[] = {ui->gameBackupEnabledLabel, ui->gameFlashEnabledLabel, ui->saveBackupEnabledLabel, ui->saveRestoreEnabledLabel};
+  QLabel* disabled_labels[] = {ui->gameBackupDisabledLabel, ui->gameFlashDisabledLabel, ui->saveBackupDisabledLabel, ui->saveRestoreDisabledLabel};
+  for (QLabel* label : enabled_labels)
+  {
+    SvgPixmapCache::setLabelPixmap(label, ":/res/res/check.svg");
+  }
+  for (QLabel* label : disabled_labels)
+  {
+    SvgPixmapCache::setLabelPixmap(label, ":/res/res/cross.svg");
+  }
+  
   if (cart == nullptr)
   {
     setGameBackupEnabled(false);
@@ -52,7 +66,7 @@ CartridgeInfoWidget::~CartridgeInfoWidget()
 
 void CartridgeInfoWidget::buildFromCartridge(cartridge* cart)
 {
-  while (!FlashMastaApp::getInstance()->getDeviceManager()->try_claim_device(m_device_id));
+  FlashMastaApp::getInstance()->getDeviceManager()->claim_device(m_device_id, CLAIM_TIMEOUT_INFINITE);
   
   const cartridge_descriptor* descriptor = cart->descriptor();
   
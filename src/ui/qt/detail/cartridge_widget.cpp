@@ -4,7 +4,6 @@
 #include <string>
 
 #include <QString>
-#include <QThread>
 
 #include "cartridge/cartridge.h"
 #include "linkmasta/linkmasta_device.h"
@@ -15,14 +14,13 @@
 #include "cartridge_info_widget.h"
 #include "fm_cartridge_slot_widget.h"
 #include "../main_window.h"
+#include "../cartridge_snapshot_cache.h"
 #include "linkmasta/device_manager.h"
-#include "../worker/lm_cartridge_fetching_worker.h"
 
 CartridgeWidget::CartridgeWidget(unsigned int device_id, QWidget *parent) :
   QWidget(parent),
   ui(new Ui::CartridgeWidget), m_current_slot(-1),
-  m_device_id(device_id), m_worker(nullptr), m_cartridge(nullptr),
-  m_slotsComboBoxHorizontalLayout(nullptr)
+  m_device_id(device_id), m_snapshot(), m_slotsComboBoxHorizontalLayout(nullptr)
 {
   ui->setupUi(this);
   
@@ -33,55 +31,49 @@ CartridgeWidget::CartridgeWidget(unsigned int device_id, QWidget *parent) :
   connect(FlashMastaApp::getInstance(), SIGNAL(selectedSlotChanged(int,int)), this, SLOT(slotSelected(int,int)));
   connect(FlashMastaApp::getInstance()->getMainWindow(), SIGNAL(cartridgeContentChanged(int,int)), this, SLOT(cartridgeContentChanged(int,int)));
   
-  refreshInBackground();
+  // Show what's already known about the cartridge without touching the device.
+  // The cache usually started loading it as soon as the cartridge was seen
+  CartridgeSnapshotCache* cache = FlashMastaApp::getInstance()->getCartridgeSnapshotCache();
+  connect(cache, SIGNAL(snapshotReady(unsigned int)), this, SLOT(snapshotReady(unsigned int)));
+  m_snapshot = cache->snapshot(m_device_id);
+  if (m_snapshot != nullptr)
+  {
+    refreshUi();
+  }
+  else
+  {
+    cache->load(m_device_id);
+  }
 }
 
 CartridgeWidget::~CartridgeWidget()
 {
-  if (m_worker != nullptr) m_worker->cancel();
-  if (m_cartridge != nullptr) delete m_cartridge;
-  
   delete ui;
 }
 
 
 
-void CartridgeWidget::refreshInBackground()
-{
-  // Make sure we don't already have a background worker doing this
-  if (m_worker != nullptr) return;
-  
-  // Spin up new thread, have worker load cartridgte contents in background
-  QThread* thread = new QThread();
-  m_worker = new LmCartridgeFetchingWorker(m_device_id);
-  m_worker->moveToThread(thread);
-  connect(thread, SIGNAL(started()), m_worker, SLOT(run()));
-  connect(m_worker, SIGNAL(finished(cartridge*,std::string)), this, SLOT(cartridgeLoaded(cartridge*,std::string)));
-  connect(m_worker, SIGNAL(finished(cartridge*,std::string)), thread, SLOT(quit()));
-  connect(m_worker, SIGNAL(finished(cartridge*,std::string)), m_worker, SLOT(deleteLater()));
-  connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
-  thread->start();  
-}
-
 void CartridgeWidget::refreshUi()
 {
   int oldIndex = ui->slotsComboBox->currentIndex();
-  setSlotsComboBoxVisible(m_cartridge->type() == cartridge_type::CARTRIDGE_FLASHMASTA);
+  cartridge* cart = m_snapshot->cart.get();
+  const std::vector<const game_descriptor*>& descriptors = m_snapshot->descriptors;
+  setSlotsComboBoxVisible(cart->type() == cartridge_type::CARTRIDGE_FLASHMASTA);
   
   // Generate and display a name for the connected cartridge
-  while (!FlashMastaApp::getInstance()->getDeviceManager()->try_claim_device(m_device_id));
+  FlashMastaApp::getInstance()->getDeviceManager()->claim_device(m_device_id, CLAIM_TIMEOUT_INFINITE);
   linkmasta_device* linkmasta = FlashMastaApp::getInstance()->getDeviceManager()->get_linkmasta_device(m_device_id);
   if (!linkmasta->is_integrated_with_cartridge())
   {
     std::string cartridgeName;
-    switch (m_cartridge->type())
+    switch (cart->type())
     {
     default:
     case CARTRIDGE_UNKNOWN:
       cartridgeName = "Unrecognized Cartridge";
       break;
     case CARTRIDGE_FLASHMASTA:
-      switch (m_cartridge->system())
+      switch (cart->system())
       {
       default:
       case SYSTEM_UNKNOWN:
@@ -96,29 +88,14 @@ void CartridgeWidget::refreshUi()
       }
       break;
     case CARTRIDGE_OFFICIAL:
-      const game_descriptor* desc = nullptr;
-      switch (m_cartridge->system())
-      {
-      default:
-      case SYSTEM_UNKNOWN:
-        cartridgeName = "Unrecognized Game";
-        break;
-      case SYSTEM_NEO_GEO_POCKET:
-        desc = FlashMastaApp::getInstance()->getNeoGeoGameCatalog()->identify_game(m_cartridge);
-        cartridgeName = (desc != nullptr ? desc->name : "Unrecognized Game");
-        break;
-      case SYSTEM_WONDERSWAN:
-        desc = FlashMastaApp::getInstance()->getWonderswanGameCatalog()->identify_game(m_cartridge);
-        cartridgeName = (desc != nullptr ? desc->name : "Unrecognized Game");
-        break;
-      }
-      if (desc != nullptr) delete desc;
+      const game_descriptor* desc = descriptors.empty() ? nullptr : descriptors[0];
+      cartridgeName = (desc != nullptr ? desc->name : "Unrecognized Game");
       break;
     }
     setCartridgeName(cartridgeName);
   }
   setCartridgeNameVisible(!linkmasta->is_integrated_with_cartridge());
-  setCartridgeSubtitleVisible(m_cartridge->type() == CARTRIDGE_OFFICIAL);
+  setCartridgeSubtitleVisible(cart->type() == CARTRIDGE_OFFICIAL);
   FlashMastaApp::getInstance()->getDeviceManager()->release_device(m_device_id);
   
   // Reset everything and erase cached data
@@ -128,18 +105,20 @@ void CartridgeWidget::refreshUi()
     delete widget;
   }
   m_slot_widgets.clear();
-  m_slot_widgets.reserve(m_cartridge->num_slots() + 1);
+  m_slot_widgets.reserve(cart->num_slots() + 1);
   
   ui->slotsComboBox->insertItem(0, "Cartridge Info");
-  m_slot_widgets.push_back(new CartridgeInfoWidget((int) m_device_id, m_cartridge, ui->verticalLayout->widget()));
+  m_slot_widgets.push_back(new CartridgeInfoWidget((int) m_device_id, cart, ui->verticalLayout->widget()));
   m_slot_widgets.back()->hide();
   ui->verticalLayout->addWidget(m_slot_widgets.back(), 1);
   
-  if (m_cartridge->type() == cartridge_type::CARTRIDGE_FLASHMASTA)
+  if (cart->type() == cartridge_type::CARTRIDGE_FLASHMASTA)
   {
-    for (unsigned int i = 0; i < m_cartridge->num_slots(); ++i)
+    for (unsigned int i = 0; i < cart->num_slots(); ++i)
     {
-      FmCartridgeSlotWidget* slot_widget = new FmCartridgeSlotWidget(m_device_id, m_cartridge, (int) i, ui->verticalLayout->widget());
+      const game_descriptor* descriptor = (i + 1 < descriptors.size() ? descriptors[i + 1] : nullptr);
+      QString cart_name = (i < m_snapshot->slot_names.size() ? QString(m_snapshot->slot_names[i].c_str()) : QString());
+      FmCartridgeSlotWidget* slot_widget = new FmCartridgeSlotWidget(m_device_id, cart, (int) i, descriptor, cart_name, ui->verticalLayout->widget());
       m_slot_widgets.push_back(slot_widget);
       slot_widget->hide();
       
@@ -232,13 +211,14 @@ bool CartridgeWidget::slotsComboBoxVisible() const
 
 // public slots:
 
-void CartridgeWidget::cartridgeLoaded(cartridge* cartridge, std::string cartridge_game_name)
+void CartridgeWidget::snapshotReady(unsigned int device_id)
 {
-  if (m_cartridge != nullptr) delete m_cartridge;
-  m_cartridge = cartridge;
-  m_cartridge_game_name = cartridge_game_name;
-  m_worker = nullptr;
-  refreshUi();
+  if (device_id != m_device_id) return;
+  m_snapshot = FlashMastaApp::getInstance()->getCartridgeSnapshotCache()->snapshot(m_device_id);
+  if (m_snapshot != nullptr)
+  {
+    refreshUi();
+  }
 }
 
 void CartridgeWidget::deviceSelected(int old_device_id, int new_device_id)
@@ -259,7 +239,7 @@ void CartridgeWidget::slotSelected(int old_slot_id, int new_slot_id)
 void CartridgeWidget::updateEnabledActions()
 {
   FlashMastaApp* app = FlashMastaApp::getInstance();
-  if (m_cartridge == nullptr || m_slot_widgets.empty() || m_slot_widgets[0] == nullptr)
+  if (m_snapshot == nullptr || m_slot_widgets.empty() || m_slot_widgets[0] == nullptr)
   {
     app->setGameBackupEnabled(false);
     app->setGameFlashEnabled(false);
@@ -287,7 +267,9 @@ void CartridgeWidget::cartridgeContentChanged(int device_id, int slot)
   
   if (device_id == (int) m_device_id)
   {
-    refreshInBackground();
+    CartridgeSnapshotCache* cache = FlashMastaApp::getInstance()->getCartridgeSnapshotCache();
+    cache->invalidate(m_device_id);
+    cache->load(m_device_id);
   }
 }
 
@@ -3,6 +3,7 @@
 
 #include <QWidget>
 
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -13,7 +14,8 @@ class CartridgeWidget;
 }
 
 class cartridge;
-class LmCartridgeFetchingWorker;
+struct game_descriptor;
+struct CartridgeSnapshot;
 class QLayoutItem;
 
 class CartridgeWidget : public QWidget
@@ -24,7 +26,6 @@ public:
   explicit CartridgeWidget(unsigned int device_id, QWidget *parent = 0);
   ~CartridgeWidget();
   
-  void refreshInBackground();
   void refreshUi();
   void setCartridgeName(std::string label);
   void setCartridgeNameVisible(bool visible);
@@ -36,7 +37,7 @@ public:
   bool slotsComboBoxVisible() const;
   
 public slots:
-  void cartridgeLoaded(cartridge* cartridge, std::string cartridge_game_name);
+  void snapshotReady(unsigned int device_id);
   void deviceSelected(int old_device_id, int new_device_id);
   void slotSelected(int old_slot_id, int new_slot_id);
   void updateEnabledActions();
@@ -53,9 +54,7 @@ private:
   bool m_is_selected;
   
   unsigned int m_device_id;
-  LmCartridgeFetchingWorker* m_worker;
-  cartridge* m_cartridge;
-  std::string m_cartridge_game_name;
+  std::shared_ptr<const CartridgeSnapshot> m_snapshot;
   std::vector<QWidget*> m_slot_widgets;
   
   QLayoutItem* m_slotsComboBoxHorizontalLayout;
@@ -4,7 +4,6 @@
 #include "cartridge/cartridge.h"
 #include "cartridge/ngp_cartridge.h"
 #include "cartridge/ws_cartridge.h"
-#include "game/game_catalog.h"
 #include "game/game_descriptor.h"
 
 #include "linkmasta/device_manager.h"
@@ -15,7 +14,7 @@
 
 // public:
 
-FmCartridgeSlotWidget::FmCartridgeSlotWidget(int device_id, cartridge* cart, int slot, QWidget *parent) :
+FmCartridgeSlotWidget::FmCartridgeSlotWidget(int device_id, cartridge* cart, int slot, const game_descriptor* descriptor, QString cart_name, QWidget *parent) :
   QWidget(parent),
   ui(new Ui::FmCartridgeSlotWidget), m_device_id(device_id)
 {
@@ -23,7 +22,7 @@ FmCartridgeSlotWidget::FmCartridgeSlotWidget(int device_id, cartridge* cart, int
   
   if (cart != nullptr && slot != -1)
   {
-    buildFromCartridge(cart, slot);
+    buildFromCartridge(cart, slot, descriptor, cart_name);
   }
   
   FlashMastaApp* app = FlashMastaApp::getInstance();
@@ -51,7 +50,7 @@ FmCartridgeSlotWidget::~FmCartridgeSlotWidget()
 
 
 
-void FmCartridgeSlotWidget::buildFromCartridge(cartridge* cart, int slot)
+void FmCartridgeSlotWidget::buildFromCartridge(cartridge* cart, int slot, const game_descriptor* descriptor, QString cart_name)
 {
   if (cart == nullptr || slot == -1 || (unsigned int) slot >= cart->num_slots()) return;
   
@@ -64,11 +63,11 @@ void FmCartridgeSlotWidget::buildFromCartridge(cartridge* cart, int slot)
   switch (cart->system())
   {
   case system_type::SYSTEM_NEO_GEO_POCKET:
-    buildFromNgpCartridge((ngp_cartridge*) cart, slot);
+    buildFromNgpCartridge((ngp_cartridge*) cart, slot, descriptor, cart_name);
     break;
     
   case system_type::SYSTEM_WONDERSWAN:
-    buildFromWsCartridge((ws_cartridge*) cart, slot);
+    buildFromWsCartridge((ws_cartridge*) cart, slot, descriptor);
     break;
     
   default:
@@ -87,16 +86,15 @@ void FmCartridgeSlotWidget::buildFromCartridge(cartridge* cart, int slot)
 
 // private:
 
-void FmCartridgeSlotWidget::buildFromNgpCartridge(ngp_cartridge* cart, int slot)
+void FmCartridgeSlotWidget::buildFromNgpCartridge(ngp_cartridge* cart, int slot, const game_descriptor* descriptor, QString cart_name)
 {
-  while (!FlashMastaApp::getInstance()->getDeviceManager()->try_claim_device(m_device_id));
-  const game_descriptor* descriptor = FlashMastaApp::getInstance()->getNeoGeoGameCatalog()->identify_game(cart, slot);
-  FlashMastaApp::getInstance()->getDeviceManager()->release_device(m_device_id);
+  (void) cart;
+  (void) slot;
   
-  std::string game_name = cart->fetch_game_name(slot);
-  if (game_name.empty())
+  // The name was read from the cartridge's header when it was fetched
+  if (cart_name.isEmpty())
   {
-    game_name = "Unknown";
+    cart_name = "Unknown";
   }
   
   // Set fields based on contents of descriptor
@@ -106,21 +104,11 @@ void FmCartridgeSlotWidget::buildFromNgpCartridge(ngp_cartridge* cart, int slot)
   setSlotGameSize(descriptor != nullptr ? descriptor->num_bytes : 0);
   setSlotDeveloperNameVisible(false);
   setSlotCartNameVisible(true);
-  setSlotCartName(QString(game_name.c_str()));
-  
-  // Delete our dynamically allocated descriptor
-  if (descriptor != nullptr)
-  {
-    delete descriptor;
-  }
+  setSlotCartName(cart_name);
 }
 
-void FmCartridgeSlotWidget::buildFromWsCartridge(ws_cartridge* cart, int slot)
+void FmCartridgeSlotWidget::buildFromWsCartridge(ws_cartridge* cart, int slot, const game_descriptor* descriptor)
 {
-  while (!FlashMastaApp::getInstance()->getDeviceManager()->try_claim_device(m_device_id));
-  const game_descriptor* descriptor = FlashMastaApp::getInstance()->getWonderswanGameCatalog()->identify_game(cart, slot);
-  FlashMastaApp::getInstance()->getDeviceManager()->release_device(m_device_id);
-  
   // Set fields based on contents of descriptor
   setSlotGameNameVisible(true);
   setSlotGameName(QString(descriptor != nullptr ? descriptor->name : "Unknown"));
@@ -129,12 +117,6 @@ void FmCartridgeSlotWidget::buildFromWsCartridge(ws_cartridge* cart, int slot)
   setSlotDeveloperNameVisible(true);
   setSlotDeveloperName(QString(descriptor != nullptr ? descriptor->developer_name : "Unknown"));
   setSlotCartNameVisible(false);
-  
-  // Delete our dynamically allocated descriptor
-  if (descriptor != nullptr)
-  {
-    delete descriptor;
-  }  
 }
 
 
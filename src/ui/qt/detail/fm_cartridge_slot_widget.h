@@ -12,19 +12,20 @@ class FmCartridgeSlotWidget;
 class cartridge;
 class ngp_cartridge;
 class ws_cartridge;
+struct game_descriptor;
 
 class FmCartridgeSlotWidget : public QWidget
 {
   Q_OBJECT
   
 public:
-  explicit FmCartridgeSlotWidget(int device_id, cartridge* cart = 0, int slot = -1, QWidget *parent = 0);
+  explicit FmCartridgeSlotWidget(int device_id, cartridge* cart = 0, int slot = -1, const game_descriptor* descriptor = 0, QString cart_name = QString(), QWidget *parent = 0);
   ~FmCartridgeSlotWidget();
   
-  void buildFromCartridge(cartridge* cart, int slot);
+  void buildFromCartridge(cartridge* cart, int slot, const game_descriptor* descriptor, QString cart_name);
 private:
-  void buildFromNgpCartridge(ngp_cartridge* cart, int slot);
-  void buildFromWsCartridge(ws_cartridge* cart, int slot);
+  void buildFromNgpCartridge(ngp_cartridge* cart, int slot, const game_descriptor* descriptor, QString cart_name);
+  void buildFromWsCartridge(ws_cartridge* cart, int slot, const game_descriptor* descriptor);
   
 public:
   int slotNumber() const;
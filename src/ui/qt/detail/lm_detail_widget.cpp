@@ -4,34 +4,52 @@
 #include "linkmasta/linkmasta_device.h"
 
 #include "cartridge_widget.h"
+#include "throughput_graph_widget.h"
 #include "linkmasta/device_manager.h"
-#include "../worker/lm_cartridge_polling_worker.h"
+#include "linkmasta/device_multiplexer.h"
+#include "../cartridge_snapshot_cache.h"
+
+// Merge key of firmware version reads queued on the device multiplexer
+#define FIRMWARE_VERSION_KEY "firmware-version"
 
 LmDetailWidget::LmDetailWidget(unsigned int device_id, QWidget *parent) :
   QWidget(parent),
   ui(new Ui::LmDetailWidget), m_device_id(device_id), m_cartridge_widget(nullptr),
-  m_pooling_thread(nullptr)
+  m_throughput_graph(nullptr)
 {
   ui->setupUi(this);
   m_default_widget = ui->contentWidget;
   
+  // Below the header, where it stays put as cartridges come and go
+  m_throughput_graph = new ThroughputGraphWidget(device_id, this);
+  ui->verticalLayout->insertWidget(2, m_throughput_graph);
+  
   connect(FlashMastaApp::getInstance(), SIGNAL(selectedDeviceChanged(int,int)), this, SLOT(selectedDeviceChanged(int,int)));
   connect(FlashMastaApp::getInstance(), SIGNAL(selectedSlotChanged(int,int)), this, SLOT(selectedSlotChanged(int,int)));
   
-  while (!FlashMastaApp::getInstance()->getDeviceManager()->try_claim_device(device_id));
-  linkmasta_device* linkmasta = FlashMastaApp::getInstance()->getDeviceManager()->get_linkmasta_device(device_id);
-  linkmasta->open();
-  std::string ver = linkmasta->firmware_version();
-  linkmasta->close();
-  FlashMastaApp::getInstance()->getDeviceManager()->release_device(device_id);
+  CartridgeSnapshotCache* cache = FlashMastaApp::getInstance()->getCartridgeSnapshotCache();
+  connect(cache, SIGNAL(cartridgeRemoved(unsigned int)), this, SLOT(deviceCartridgeRemoved(unsigned int)));
+  connect(cache, SIGNAL(cartridgeInserted(unsigned int)), this, SLOT(deviceCartridgeInserted(unsigned int)));
   
-  if (linkmasta->is_integrated_with_cartridge())
+  // The firmware version only needs to be read from the device once
+  linkmasta_device* linkmasta = FlashMastaApp::getInstance()->getDeviceManager()->get_linkmasta_device(device_id);
+  QString ver = cache->firmwareVersion(device_id);
+  if (ver.isEmpty())
   {
-    cartridgeInserted();
+    // Widgets of the same device opening at once share a single read
+    std::string version = FlashMastaApp::getInstance()->getDeviceMultiplexer()->submit(device_id, [](linkmasta_device* linkmasta)
+    {
+      return linkmasta->firmware_version();
+    }, FIRMWARE_VERSION_KEY).get();
+    ver = QString(version.c_str());
+    cache->setFirmwareVersion(device_id, ver);
   }
-  else
+  
+  // The cache watches for cartridges coming and going, even while this
+  // device isn't shown
+  if (linkmasta->is_integrated_with_cartridge() || cache->isCartridgePresent(device_id))
   {
-    startPolling();
+    cartridgeInserted();
   }
   
   // Display name of device
@@ -62,47 +80,17 @@ LmDetailWidget::LmDetailWidget(unsigned int device_id, QWidget *parent) :
   
   // Display device firmware version
   QString device_version = "v";
-  device_version += QString(ver.c_str());
+  device_version += ver;
   ui->deviceFirmwareVersionLabel->setText(device_version);
 }
 
 LmDetailWidget::~LmDetailWidget()
 {
-  stopPolling();
   delete ui;
 }
 
 
 
-void LmDetailWidget::startPolling()
-{
-  if (m_pooling_thread != nullptr) return;
-  
-  // Spin up a new thread with a worker to periodically pool linkmasta for cartridge
-  m_pooling_thread = new QThread();
-  auto worker = new LmCartridgePollingWorker(m_device_id);
-  
-  worker->moveToThread(m_pooling_thread);
-  connect(worker, SIGNAL(cartridgeRemoved()), this, SLOT(cartridgeRemoved()));
-  connect(worker, SIGNAL(cartridgeInserted()), this, SLOT(cartridgeInserted()));
-  connect(m_pooling_thread, SIGNAL(started()), worker, SLOT(start()));
-  connect(m_pooling_thread, SIGNAL(finished()), worker, SLOT(stop()));
-  connect(m_pooling_thread, SIGNAL(finished()), worker, SLOT(deleteLater()));
-  
-  m_pooling_thread->start();
-}
-
-void LmDetailWidget::stopPolling()
-{
-  if (m_pooling_thread == nullptr) return;
-  
-  m_pooling_thread->quit();
-  m_pooling_thread->deleteLater();
-  m_pooling_thread = nullptr;
-}
-
-
-
 void LmDetailWidget::disableActions()
 {
   FlashMastaApp* app = FlashMastaApp::getInstance();
@@ -144,6 +132,22 @@ void LmDetailWidget::cartridgeInserted()
   m_default_widget->hide();
 }
 
+void LmDetailWidget::deviceCartridgeRemoved(unsigned int device_id)
+{
+  if (device_id == m_device_id)
+  {
+    cartridgeRemoved();
+  }
+}
+
+void LmDetailWidget::deviceCartridgeInserted(unsigned int device_id)
+{
+  if (device_id == m_device_id)
+  {
+    cartridgeInserted();
+  }
+}
+
 void LmDetailWidget::selectedDeviceChanged(int old_device, int new_device)
 {
   (void) old_device;
@@ -3,7 +3,7 @@
 
 #include <QWidget>
 
-#include <QThread>
+class ThroughputGraphWidget;
 
 namespace Ui {
 class LmDetailWidget;
@@ -17,15 +17,15 @@ public:
   explicit LmDetailWidget(unsigned int device_id, QWidget *parent = 0);
   ~LmDetailWidget();
   
-  void startPolling();
-  void stopPolling();
-  
+
 private:
   void disableActions();
   
 public slots:
   void cartridgeRemoved();
   void cartridgeInserted();
+  void deviceCartridgeRemoved(unsigned int device_id);
+  void deviceCartridgeInserted(unsigned int device_id);
   void selectedDeviceChanged(int old_device, int new_device);
   void selectedSlotChanged(int old_slot, int new_slot);
   
@@ -35,7 +35,7 @@ private:
   
   QWidget* m_default_widget;
   QWidget* m_cartridge_widget;
-  QThread* m_pooling_thread;
+  ThroughputGraphWidget* m_throughput_graph;
 };
 
 #endif // __NGP_LINKMASTA_DETAIL_WIDGET_H__
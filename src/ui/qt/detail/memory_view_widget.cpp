@@ -0,0 +1,171 @@
+#include "memory_view_widget.h"
+
+#include <vector>
+
+#include <QFont>
+#include <QFontMetrics>
+#include <QPainter>
+#include <QScrollBar>
+
+#include "cartridge/cartridge.h"
+#include "cartridge/cartridge_memory_view.h"
+#include "../flash_masta_app.h"
+#include "../worker/memory_page_fetching_worker.h"
+#include "../worker/worker_pool.h"
+
+const unsigned int MemoryViewWidget::BYTES_PER_ROW = 16;
+
+MemoryViewWidget::MemoryViewWidget(unsigned int device_id, std::shared_ptr<cartridge> cart, int slot, QWidget *parent) :
+  QAbstractScrollArea(parent),
+  m_device_id(device_id), m_cartridge(cart),
+  m_view(new cartridge_memory_view(cart.get(), slot)), m_worker(nullptr),
+  m_failed(false)
+{
+  QFont font("Courier");
+  font.setStyleHint(QFont::TypeWriter);
+  setFont(font);
+  
+  updateScrollBars();
+}
+
+MemoryViewWidget::~MemoryViewWidget()
+{
+  // The worker keeps the view and cartridge alive until it notices
+  if (m_worker != nullptr) m_worker->cancel();
+}
+
+
+
+QSize MemoryViewWidget::sizeHint() const
+{
+  // Offset, bytes, and characters of a row, and a screenful of rows
+  QFontMetrics metrics(font());
+  return QSize(metrics.width(QString(10 + BYTES_PER_ROW * 4 + 2, QChar('0'))) + verticalScrollBar()->sizeHint().width(),
+               rowHeight() * 32);
+}
+
+void MemoryViewWidget::paintEvent(QPaintEvent* event)
+{
+  (void) event;
+  QPainter painter(viewport());
+  QFontMetrics metrics(font());
+  
+  unsigned int first_row = (unsigned int) verticalScrollBar()->value();
+  unsigned int offset = first_row * BYTES_PER_ROW;
+  unsigned int num_bytes = std::min((unsigned int) visibleRows() * BYTES_PER_ROW, m_view->size() - std::min(offset, m_view->size()));
+  
+  std::vector<unsigned char> bytes(num_bytes);
+  std::vector<bool> loaded;
+  if (num_bytes > 0)
+  {
+    m_view->copy_loaded(offset, bytes.data(), num_bytes, &loaded);
+  }
+  
+  for (unsigned int row = 0; row * BYTES_PER_ROW < num_bytes; ++row)
+  {
+    QString line = QString("%1  ").arg(offset + row * BYTES_PER_ROW, 8, 16, QChar('0')).toUpper();
+    QString text;
+    for (unsigned int i = 0; i < BYTES_PER_ROW; ++i)
+    {
+      unsigned int index = row * BYTES_PER_ROW + i;
+      if (index >= num_bytes)
+      {
+        line += "   ";
+      }
+      else if (!loaded[index])
+      {
+        line += ".. ";
+        text += ' ';
+      }
+      else
+      {
+        line += QString("%1 ").arg(bytes[index], 2, 16, QChar('0')).toUpper();
+        text += (bytes[index] >= 0x20 && bytes[index] < 0x7F ? QChar(bytes[index]) : QChar('.'));
+      }
+    }
+    painter.drawText(0, (int) row * rowHeight() + metrics.ascent(), line + " " + text);
+  }
+}
+
+void MemoryViewWidget::resizeEvent(QResizeEvent* event)
+{
+  QAbstractScrollArea::resizeEvent(event);
+  updateScrollBars();
+  requestVisiblePages();
+}
+
+void MemoryViewWidget::scrollContentsBy(int dx, int dy)
+{
+  (void) dx;
+  (void) dy;
+  viewport()->update();
+  requestVisiblePages();
+}
+
+
+
+void MemoryViewWidget::updateScrollBars()
+{
+  int num_rows = (int) ((m_view->size() + BYTES_PER_ROW - 1) / BYTES_PER_ROW);
+  verticalScrollBar()->setPageStep(visibleRows());
+  verticalScrollBar()->setSingleStep(1);
+  verticalScrollBar()->setRange(0, std::max(0, num_rows - visibleRows()));
+}
+
+void MemoryViewWidget::requestVisiblePages()
+{
+  unsigned int first = (unsigned int) verticalScrollBar()->value() * BYTES_PER_ROW;
+  unsigned int last = first + (unsigned int) visibleRows() * BYTES_PER_ROW;
+  unsigned int first_page = first / MEMORY_VIEW_PAGE_SIZE;
+  unsigned int last_page = (last + MEMORY_VIEW_PAGE_SIZE - 1) / MEMORY_VIEW_PAGE_SIZE;
+  m_view->request_pages(first_page, last_page - first_page);
+  
+  fetchInBackground();
+}
+
+void MemoryViewWidget::fetchInBackground()
+{
+  // A running worker picks up whatever was requested since it started, and
+  // a cartridge that couldn't be read isn't asked again
+  if (m_worker != nullptr || m_failed || !m_view->has_pending()) return;
+  
+  MemoryPageFetchingWorker* worker = new MemoryPageFetchingWorker(m_device_id, m_cartridge, m_view);
+  m_worker = worker;
+  connect(worker, SIGNAL(pageFetched()), this, SLOT(pageFetched()));
+  connect(worker, SIGNAL(finished(QString)), this, SLOT(fetchFinished(QString)));
+  connect(worker, SIGNAL(finished(QString)), worker, SLOT(deleteLater()));
+  FlashMastaApp::getInstance()->getWorkerPool()->submit([worker] { worker->run(); });
+}
+
+int MemoryViewWidget::rowHeight() const
+{
+  return QFontMetrics(font()).height();
+}
+
+int MemoryViewWidget::visibleRows() const
+{
+  return std::max(1, viewport()->height() / rowHeight() + 1);
+}
+
+
+
+void MemoryViewWidget::pageFetched()
+{
+  viewport()->update();
+}
+
+void MemoryViewWidget::fetchFinished(QString error)
+{
+  m_worker = nullptr;
+  viewport()->update();
+  
+  if (!error.isEmpty())
+  {
+    m_failed = true;
+    emit readFailed(error);
+    return;
+  }
+  
+  // Pages may have been requested after the worker found nothing left to do
+  fetchInBackground();
+}
@@ -0,0 +1,53 @@
+#ifndef __MEMORY_VIEW_WIDGET_H__
+#define __MEMORY_VIEW_WIDGET_H__
+
+#include <QAbstractScrollArea>
+#include <QString>
+#include <memory>
+
+class cartridge;
+class cartridge_memory_view;
+class MemoryPageFetchingWorker;
+
+// Hex view of one slot of a cartridge that reads only what is scrolled to.
+// Bytes that haven't been read yet show as "..", and fill in as the pages on
+// screen and those around them arrive in the background.
+class MemoryViewWidget : public QAbstractScrollArea
+{
+  Q_OBJECT
+public:
+  explicit MemoryViewWidget(unsigned int device_id, std::shared_ptr<cartridge> cart, int slot, QWidget *parent = 0);
+  ~MemoryViewWidget();
+  
+  QSize sizeHint() const;
+
+protected:
+  void paintEvent(QPaintEvent* event);
+  void resizeEvent(QResizeEvent* event);
+  void scrollContentsBy(int dx, int dy);
+
+private:
+  void updateScrollBars();
+  void requestVisiblePages();
+  void fetchInBackground();
+  int rowHeight() const;
+  int visibleRows() const;
+
+private slots:
+  void pageFetched();
+  void fetchFinished(QString error);
+
+signals:
+  void readFailed(QString error);
+
+private:
+  static const unsigned int BYTES_PER_ROW;
+  
+  unsigned int m_device_id;
+  std::shared_ptr<cartridge> m_cartridge;
+  std::shared_ptr<cartridge_memory_view> m_view;
+  MemoryPageFetchingWorker* m_worker;
+  bool m_failed;
+};
+
+#endif // __MEMORY_VIEW_WIDGET_H__
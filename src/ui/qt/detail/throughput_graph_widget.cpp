@@ -0,0 +1,180 @@
+#include "throughput_graph_widget.h"
+
+#include <algorithm>
+
+#include <QFontMetrics>
+#include <QPainter>
+#include <QTimer>
+
+#include "../flash_masta_app.h"
+#include "../main_window.h"
+#include "../device_list_model.h"
+
+// The task measures its rate this often, so sampling faster shows nothing new
+const int ThroughputGraphWidget::SAMPLE_INTERVAL_MS = TASK_RATE_SAMPLE_MS;
+
+// A minute of history
+const unsigned int ThroughputGraphWidget::NUM_SAMPLES = 60000 / TASK_RATE_SAMPLE_MS;
+
+ThroughputGraphWidget::ThroughputGraphWidget(unsigned int device_id, QWidget *parent) :
+  QWidget(parent),
+  m_device_id(device_id), m_timer(new QTimer(this)), m_samples(),
+  m_task(nullptr), m_running(false)
+{
+  m_timer->setInterval(SAMPLE_INTERVAL_MS);
+  connect(m_timer, SIGNAL(timeout()), this, SLOT(sample()));
+  setMinimumHeight(48);
+}
+
+
+
+QSize ThroughputGraphWidget::sizeHint() const
+{
+  return QSize((int) NUM_SAMPLES * 2, QFontMetrics(font()).height() * 5);
+}
+
+void ThroughputGraphWidget::paintEvent(QPaintEvent* event)
+{
+  (void) event;
+  QPainter painter(this);
+  QFontMetrics metrics(font());
+  
+  QRect graph = rect().adjusted(0, metrics.height() + 2, -1, -1);
+  painter.setPen(palette().color(QPalette::Mid));
+  painter.drawRect(graph);
+  
+  double peak = 0.0;
+  for (const Sample& s : m_samples)
+  {
+    peak = std::max(peak, s.rate);
+  }
+  
+  // Newest sample on the right, each the same width no matter how many there
+  // are yet
+  if (peak > 0.0 && graph.height() > 1)
+  {
+    double bar_width = (double) (graph.width() - 1) / NUM_SAMPLES;
+    double x = graph.right() - bar_width * m_samples.size();
+    for (const Sample& s : m_samples)
+    {
+      int height = (int) ((graph.height() - 1) * s.rate / peak + 0.5);
+      int left = (int) x;
+      x += bar_width;
+      if (height > 0)
+      {
+        painter.fillRect(left + 1, graph.bottom() - height, std::max(1, (int) x - left), height, phaseColor(s.phase));
+      }
+    }
+  }
+  
+  QString label;
+  if (m_running && !m_samples.empty())
+  {
+    label = QString("%1: %2 KiB/s").arg(phaseName(m_samples.back().phase)).arg(m_samples.back().rate / 1024.0, 0, 'f', 1);
+  }
+  else
+  {
+    label = "Idle";
+  }
+  if (peak > 0.0)
+  {
+    label += QString(", peak %1 KiB/s").arg(peak / 1024.0, 0, 'f', 1);
+  }
+  painter.setPen(palette().color(QPalette::WindowText));
+  painter.drawText(0, metrics.ascent(), label);
+}
+
+void ThroughputGraphWidget::showEvent(QShowEvent* event)
+{
+  QWidget::showEvent(event);
+  m_timer->start();
+  sample();
+}
+
+void ThroughputGraphWidget::hideEvent(QHideEvent* event)
+{
+  QWidget::hideEvent(event);
+  m_timer->stop();
+}
+
+
+
+void ThroughputGraphWidget::sample()
+{
+  const task_controller* task = FlashMastaApp::getInstance()->getMainWindow()->getDeviceListModel()->deviceTask(m_device_id);
+  bool running = (task != nullptr && task->get_task_status() == RUNNING);
+  
+  // The last task's graph stays up until the next one starts
+  if (task != nullptr && (task != m_task || (running && !m_running)))
+  {
+    m_samples.clear();
+  }
+  if (task != nullptr)
+  {
+    m_task = task;
+  }
+  
+  if (running)
+  {
+    Sample s;
+    s.rate = task->get_task_work_rate();
+    s.phase = task->get_task_phase();
+    m_samples.push_back(s);
+    if (m_samples.size() > NUM_SAMPLES)
+    {
+      m_samples.pop_front();
+    }
+  }
+  
+  if (running || running != m_running)
+  {
+    m_running = running;
+    update();
+  }
+}
+
+
+
+QColor ThroughputGraphWidget::phaseColor(task_phase phase)
+{
+  switch (phase)
+  {
+  case TASK_PHASE_ERASE:
+    return QColor(0xD0, 0x60, 0x40);
+  
+  case TASK_PHASE_PROGRAM:
+    return QColor(0xE0, 0xA0, 0x30);
+  
+  case TASK_PHASE_READ:
+    return QColor(0x40, 0x80, 0xD0);
+  
+  case TASK_PHASE_VERIFY:
+    return QColor(0x50, 0xB0, 0x60);
+  
+  default:
+  case TASK_PHASE_OTHER:
+    return QColor(0x90, 0x90, 0x90);
+  }
+}
+
+QString ThroughputGraphWidget::phaseName(task_phase phase)
+{
+  switch (phase)
+  {
+  case TASK_PHASE_ERASE:
+    return "Erasing";
+  
+  case TASK_PHASE_PROGRAM:
+    return "Programming";
+  
+  case TASK_PHASE_READ:
+    return "Reading";
+  
+  case TASK_PHASE_VERIFY:
+    return "Verifying";
+  
+  default:
+  case TASK_PHASE_OTHER:
+    return "Working";
+  }
+}
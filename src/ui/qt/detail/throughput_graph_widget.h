@@ -0,0 +1,50 @@
+#ifndef __THROUGHPUT_GRAPH_WIDGET_H__
+#define __THROUGHPUT_GRAPH_WIDGET_H__
+
+#include <QWidget>
+#include <deque>
+#include "task/task_controller.h"
+
+class QTimer;
+
+// Strip chart of how fast the task running on a device moves data, colored by
+// the phase it was in. The task's rate is sampled a few times a second while
+// the widget is shown, so a slow hub or a cartridge that keeps slowing down
+// stands out without costing the task anything.
+class ThroughputGraphWidget : public QWidget
+{
+  Q_OBJECT
+public:
+  explicit ThroughputGraphWidget(unsigned int device_id, QWidget *parent = 0);
+  
+  QSize sizeHint() const;
+
+protected:
+  void paintEvent(QPaintEvent* event);
+  void showEvent(QShowEvent* event);
+  void hideEvent(QHideEvent* event);
+
+private slots:
+  void sample();
+
+private:
+  struct Sample
+  {
+    double rate;
+    task_phase phase;
+  };
+  
+  static const int SAMPLE_INTERVAL_MS;
+  static const unsigned int NUM_SAMPLES;
+  
+  static QColor phaseColor(task_phase phase);
+  static QString phaseName(task_phase phase);
+  
+  unsigned int m_device_id;
+  QTimer* m_timer;
+  std::deque<Sample> m_samples;
+  const task_controller* m_task;
+  bool m_running;
+};
+
+#endif // __THROUGHPUT_GRAPH_WIDGET_H__
@@ -0,0 +1,73 @@
+#include "device_list_delegate.h"
+#include "device_list_model.h"
+
+#include <QApplication>
+#include <QPainter>
+
+const int DeviceListDelegate::ROW_HEIGHT = 40;
+const int DeviceListDelegate::PROGRESS_HEIGHT = 3;
+const int DeviceListDelegate::MARGIN = 6;
+
+DeviceListDelegate::DeviceListDelegate(QObject *parent) :
+  QStyledItemDelegate(parent)
+{
+  // Nothing else to do
+}
+
+
+
+void DeviceListDelegate::paint(QPainter* painter, const QStyleOptionViewItem& option, const QModelIndex& index) const
+{
+  QStyleOptionViewItem opt = option;
+  initStyleOption(&opt, index);
+  
+  // Let the style draw the background and selection highlight, then draw the
+  // text ourselves
+  QString name = opt.text;
+  opt.text = "";
+  const QWidget* widget = opt.widget;
+  QStyle* style = (widget != nullptr ? widget->style() : QApplication::style());
+  style->drawControl(QStyle::CE_ItemViewItem, &opt, painter, widget);
+  
+  QString status = index.data(DeviceListModel::StatusRole).toString();
+  double progress = index.data(DeviceListModel::ProgressRole).toDouble();
+  QRect area = opt.rect.adjusted(MARGIN, 0, -MARGIN, 0);
+  
+  painter->save();
+  painter->setPen(opt.palette.color(opt.state & QStyle::State_Selected ? QPalette::HighlightedText : QPalette::Text));
+  
+  if (status.isEmpty())
+  {
+    painter->drawText(area, Qt::AlignLeft | Qt::AlignVCenter, name);
+  }
+  else
+  {
+    // Name on top, a smaller status line underneath
+    QRect top(area.left(), area.top(), area.width(), area.height() / 2);
+    QRect bottom(area.left(), top.bottom(), area.width(), area.height() - top.height() - PROGRESS_HEIGHT);
+    painter->drawText(top, Qt::AlignLeft | Qt::AlignBottom, name);
+    
+    QFont small = opt.font;
+    small.setPointSizeF(small.pointSizeF() * 0.85);
+    painter->setFont(small);
+    painter->drawText(bottom, Qt::AlignLeft | Qt::AlignVCenter,
+                      QFontMetrics(small).elidedText(status, Qt::ElideRight, bottom.width()));
+  }
+  
+  if (progress >= 0.0)
+  {
+    QRect bar(area.left(), opt.rect.bottom() - PROGRESS_HEIGHT - 1, area.width(), PROGRESS_HEIGHT);
+    painter->fillRect(bar, opt.palette.color(QPalette::Mid));
+    bar.setWidth((int) (bar.width() * (progress > 1.0 ? 1.0 : progress)));
+    painter->fillRect(bar, opt.palette.color(opt.state & QStyle::State_Selected ? QPalette::HighlightedText : QPalette::Highlight));
+  }
+  
+  painter->restore();
+}
+
+QSize DeviceListDelegate::sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const
+{
+  QSize size = QStyledItemDelegate::sizeHint(option, index);
+  size.setHeight(ROW_HEIGHT);
+  return size;
+}
@@ -0,0 +1,23 @@
+#ifndef __DEVICE_LIST_DELEGATE_H__
+#define __DEVICE_LIST_DELEGATE_H__
+
+#include <QStyledItemDelegate>
+
+// Draws a compact row for each device in a DeviceListModel: the device's name,
+// what it's doing, and a thin progress bar while a task is running on it.
+class DeviceListDelegate : public QStyledItemDelegate
+{
+  Q_OBJECT
+public:
+  explicit DeviceListDelegate(QObject *parent = 0);
+  
+  void paint(QPainter* painter, const QStyleOptionViewItem& option, const QModelIndex& index) const;
+  QSize sizeHint(const QStyleOptionViewItem& option, const QModelIndex& index) const;
+  
+private:
+  static const int ROW_HEIGHT;
+  static const int PROGRESS_HEIGHT;
+  static const int MARGIN;
+};
+
+#endif // __DEVICE_LIST_DELEGATE_H__
@@ -0,0 +1,116 @@
+#include "device_list_model.h"
+
+DeviceListModel::DeviceListModel(QObject *parent) :
+  QAbstractListModel(parent), m_entries()
+{
+  // Nothing else to do
+}
+
+
+
+int DeviceListModel::rowCount(const QModelIndex& parent) const
+{
+  return (parent.isValid() ? 0 : (int) m_entries.size());
+}
+
+QVariant DeviceListModel::data(const QModelIndex& index, int role) const
+{
+  if (!index.isValid() || index.row() >= (int) m_entries.size())
+  {
+    return QVariant();
+  }
+  
+  const Entry& entry = m_entries[index.row()];
+  switch (role)
+  {
+  case Qt::DisplayRole:
+    return entry.name;
+    
+  case DeviceIdRole:
+    return entry.device_id;
+    
+  case StatusRole:
+    return entry.status;
+    
+  case ProgressRole:
+    return entry.progress;
+    
+  default:
+    return QVariant();
+  }
+}
+
+
+
+void DeviceListModel::addDevice(unsigned int device_id, QString name)
+{
+  int row = (int) m_entries.size();
+  beginInsertRows(QModelIndex(), row, row);
+  Entry entry;
+  entry.device_id = device_id;
+  entry.name = name;
+  entry.status = "";
+  entry.progress = -1.0;
+  entry.task = nullptr;
+  m_entries.push_back(entry);
+  endInsertRows();
+}
+
+void DeviceListModel::removeDevice(int row)
+{
+  beginRemoveRows(QModelIndex(), row, row);
+  m_entries.erase(m_entries.begin() + row);
+  endRemoveRows();
+}
+
+int DeviceListModel::rowOfDevice(unsigned int device_id) const
+{
+  for (unsigned int i = 0; i < m_entries.size(); ++i)
+  {
+    if (m_entries[i].device_id == device_id)
+    {
+      return (int) i;
+    }
+  }
+  return -1;
+}
+
+unsigned int DeviceListModel::deviceIdAt(int row) const
+{
+  return m_entries[row].device_id;
+}
+
+void DeviceListModel::setDeviceActivity(unsigned int device_id, QString status, double progress)
+{
+  int row = rowOfDevice(device_id);
+  if (row < 0) return;
+  
+  Entry& entry = m_entries[row];
+  if (entry.status == status && entry.progress == progress) return;
+  
+  entry.status = status;
+  entry.progress = progress;
+  
+  // Only the changed row is repainted
+  QModelIndex changed = index(row);
+  emit dataChanged(changed, changed);
+}
+
+void DeviceListModel::clearDeviceActivity(unsigned int device_id)
+{
+  setDeviceActivity(device_id, "", -1.0);
+}
+
+void DeviceListModel::setDeviceTask(unsigned int device_id, const task_controller* task)
+{
+  int row = rowOfDevice(device_id);
+  if (row < 0) return;
+  
+  m_entries[row].task = task;
+}
+
+const task_controller* DeviceListModel::deviceTask(unsigned int device_id) const
+{
+  int row = rowOfDevice(device_id);
+  return (row < 0 ? nullptr : m_entries[row].task);
+}
@@ -0,0 +1,56 @@
+#ifndef __DEVICE_LIST_MODEL_H__
+#define __DEVICE_LIST_MODEL_H__
+
+#include <QAbstractListModel>
+#include <QString>
+#include <vector>
+
+class task_controller;
+
+// List model of the connected devices. Each row only holds what the device
+// list needs to draw it, so that rows stay cheap no matter how many devices
+// are connected; detail panels are built separately for the selected device.
+class DeviceListModel : public QAbstractListModel
+{
+  Q_OBJECT
+public:
+  enum Role
+  {
+    DeviceIdRole = Qt::UserRole,
+    StatusRole,
+    ProgressRole
+  };
+  
+  explicit DeviceListModel(QObject *parent = 0);
+  
+  int rowCount(const QModelIndex& parent = QModelIndex()) const;
+  QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+  
+  void addDevice(unsigned int device_id, QString name);
+  void removeDevice(int row);
+  int rowOfDevice(unsigned int device_id) const;
+  unsigned int deviceIdAt(int row) const;
+  
+  // Progress runs from 0 to 1, or is negative if the device isn't busy
+  void setDeviceActivity(unsigned int device_id, QString status, double progress = -1.0);
+  void clearDeviceActivity(unsigned int device_id);
+  
+  // The task running on a device, for panels that show more than the row
+  // does. Cleared before the task is destroyed
+  void setDeviceTask(unsigned int device_id, const task_controller* task);
+  const task_controller* deviceTask(unsigned int device_id) const;
+  
+private:
+  struct Entry
+  {
+    unsigned int device_id;
+    QString name;
+    QString status;
+    double progress;
+    const task_controller* task;
+  };
+  
+  std::vector<Entry> m_entries;
+};
+
+#endif // __DEVICE_LIST_MODEL_H__
@@ -1,10 +1,18 @@
 #include "flash_masta_app.h"
 
+#include <vector>
+
 #include "common/log.h"
+#include "cartridge/image_cache.h"
+#include "linkmasta/auto_save_backup.h"
+#include "linkmasta/device_job_scheduler.h"
+#include "linkmasta/device_multiplexer.h"
 #include "linkmasta/libusb_device_manager.h"
-#include "game/ws_game_catalog.h"
-#include "game/ngp_game_catalog.h"
+#include "game/game_catalog.h"
+#include "game/game_identification_cache.h"
+#include "cartridge_snapshot_cache.h"
 #include "main_window.h"
+#include "worker/worker_pool.h"
 
 FlashMastaApp* FlashMastaApp::instance = nullptr;
 const int FlashMastaApp::NO_DEVICE = -1;
@@ -13,23 +21,59 @@ const int FlashMastaApp::NO_SLOT = -1;
 FlashMastaApp::FlashMastaApp(int argc, char **argv, int flags)
   : QApplication(argc, argv, flags),
     m_main_window(nullptr), m_device_manager(nullptr),
+    m_device_multiplexer(nullptr), m_job_scheduler(nullptr),
+    m_auto_save_backup(nullptr), m_auto_save_directory(),
     m_ws_game_catalog(nullptr), m_ngp_game_catalog(nullptr),
+    m_game_identification_cache(nullptr),
+    m_image_cache(nullptr), m_worker_pool(nullptr),
+    m_cartridge_snapshot_cache(nullptr),
     m_game_backup_enabled(false), m_game_flash_enabled(false),
     m_game_verify_enabled(false), m_save_backup_enabled(false),
     m_save_restore_enabled(false), m_save_verify_enabled(false),
-    m_selected_device(NO_DEVICE), m_selected_slot(NO_SLOT)
+    m_selected_device(NO_DEVICE), m_selected_slot(NO_SLOT),
+    m_loading_mutex(), m_catalogs_loaded(), m_catalogs_ready(false),
+    m_loaded_device_manager(nullptr)
 {
   if (FlashMastaApp::instance == nullptr)
   {
     FlashMastaApp::instance = this;
   }
   
-  m_device_manager = new libusb_device_manager();
-  m_ws_game_catalog = new ws_game_catalog((QCoreApplication::applicationDirPath() + QString("/wsgames.db")).toStdString().c_str());
-  m_ngp_game_catalog = new ngp_game_catalog((QCoreApplication::applicationDirPath() + QString("/ngpgames.db")).toStdString().c_str());
+  m_game_identification_cache = new game_identification_cache();
+  m_image_cache = new image_cache();
+  m_worker_pool = new WorkerPool();
+  
+  // Initializing libusb and opening the catalogs are slow on older machines,
+  // so do both in the background and show the window right away
+  m_worker_pool->submit([this]
+  {
+    device_manager* manager = new libusb_device_manager();
+    m_loading_mutex.lock();
+    m_loaded_device_manager = manager;
+    m_loading_mutex.unlock();
+    QMetaObject::invokeMethod(this, "deviceManagerLoaded", Qt::QueuedConnection);
+  }, false);
+  
+  m_worker_pool->submit([this]
+  {
+    QString dir = QCoreApplication::applicationDirPath();
+    game_catalog* ws_catalog = open_game_catalog((dir + QString("/wsgames")).toStdString(), game_descriptor::game_system::WONDERSWAN);
+    game_catalog* ngp_catalog = open_game_catalog((dir + QString("/ngpgames")).toStdString(), game_descriptor::game_system::NEO_GEO_POCKET);
+    
+    m_loading_mutex.lock();
+    m_ws_game_catalog = ws_catalog;
+    m_ngp_game_catalog = ngp_catalog;
+    m_catalogs_ready = true;
+    m_catalogs_loaded.wakeAll();
+    m_loading_mutex.unlock();
+  }, false);
+  
+  m_cartridge_snapshot_cache = new CartridgeSnapshotCache();
   m_main_window = new MainWindow();
   
   qRegisterMetaType<std::string>("std::string");
+  qRegisterMetaType<std::vector<std::string>>("std::vector<std::string>");
+  qRegisterMetaType<std::vector<const game_descriptor*>>("std::vector<const game_descriptor*>");
   
   connect(m_main_window, SIGNAL(destroyed(QObject*)), this, SLOT(mainWindowDestroyed(QObject*)));
   m_main_window->show();
@@ -38,9 +82,21 @@ FlashMastaApp::FlashMastaApp(int argc, char **argv, int flags)
 FlashMastaApp::~FlashMastaApp()
 {
   log_start(log_level::DEBUG, "deleting FlashMastaApp...");
-  delete m_device_manager;
+  delete m_cartridge_snapshot_cache;
+  delete m_worker_pool;
+  
+  // Workers may wait on the multiplexer, and it and queued jobs on the device
+  // manager
+  delete m_auto_save_backup;
+  delete m_job_scheduler;
+  delete m_device_multiplexer;
+  
+  // The device manager may have finished loading without being handed over
+  delete m_loaded_device_manager;
+  delete m_game_identification_cache;
   delete m_ws_game_catalog;
   delete m_ngp_game_catalog;
+  delete m_image_cache;
   log_end("done");
 }
 
@@ -49,6 +105,21 @@ device_manager* FlashMastaApp::getDeviceManager() const
   return m_device_manager;
 }
 
+device_multiplexer* FlashMastaApp::getDeviceMultiplexer() const
+{
+  return m_device_multiplexer;
+}
+
+device_job_scheduler* FlashMastaApp::getJobScheduler() const
+{
+  return m_job_scheduler;
+}
+
+auto_save_backup* FlashMastaApp::getAutoSaveBackup() const
+{
+  return m_auto_save_backup;
+}
+
 MainWindow* FlashMastaApp::getMainWindow() const
 {
   return m_main_window;
@@ -56,14 +127,36 @@ MainWindow* FlashMastaApp::getMainWindow() const
 
 game_catalog* FlashMastaApp::getWonderswanGameCatalog() const
 {
+  waitForCatalogs();
   return m_ws_game_catalog;
 }
 
 game_catalog* FlashMastaApp::getNeoGeoGameCatalog() const
 {
+  waitForCatalogs();
   return m_ngp_game_catalog;
 }
 
+game_identification_cache* FlashMastaApp::getGameIdentificationCache() const
+{
+  return m_game_identification_cache;
+}
+
+WorkerPool* FlashMastaApp::getWorkerPool() const
+{
+  return m_worker_pool;
+}
+
+CartridgeSnapshotCache* FlashMastaApp::getCartridgeSnapshotCache() const
+{
+  return m_cartridge_snapshot_cache;
+}
+
+image_cache* FlashMastaApp::getImageCache() const
+{
+  return m_image_cache;
+}
+
 int FlashMastaApp::getSelectedDevice() const
 {
   return m_selected_device;
@@ -74,6 +167,12 @@ int FlashMastaApp::getSelectedSlot() const
   return m_selected_slot;
 }
 
+bool FlashMastaApp::catalogsReady() const
+{
+  QMutexLocker lock(&m_loading_mutex);
+  return m_catalogs_ready;
+}
+
 
 
 // public slots:
@@ -125,6 +224,20 @@ void FlashMastaApp::setSelectedDevice(int device_id)
   }
 }
 
+void FlashMastaApp::setAutoSaveBackupDirectory(QString directory)
+{
+  // Waits for a backup that's already running on the old directory
+  delete m_auto_save_backup;
+  m_auto_save_backup = nullptr;
+  
+  // Until the device manager is loaded there's nothing to queue backups on
+  m_auto_save_directory = directory;
+  if (!directory.isEmpty() && m_job_scheduler != nullptr)
+  {
+    m_auto_save_backup = new auto_save_backup(m_job_scheduler, directory.toStdString());
+  }
+}
+
 void FlashMastaApp::setSelectedSlot(int slot_id)
 {
   int old_id = m_selected_slot;
@@ -154,6 +267,39 @@ void FlashMastaApp::mainWindowDestroyed(QObject* object)
   }
 }
 
+void FlashMastaApp::deviceManagerLoaded()
+{
+  m_loading_mutex.lock();
+  m_device_manager = m_loaded_device_manager;
+  m_loading_mutex.unlock();
+  
+  // Everything short the UI asks of a device goes through its queue
+  m_device_multiplexer = new device_multiplexer(m_device_manager);
+  
+  // Queued jobs run on every device at once, each claiming its device in
+  // turn with the requests above
+  m_job_scheduler = new device_job_scheduler(m_device_manager);
+  if (!m_auto_save_directory.isEmpty())
+  {
+    m_auto_save_backup = new auto_save_backup(m_job_scheduler, m_auto_save_directory.toStdString());
+  }
+  
+  emit deviceManagerReady();
+}
+
+
+
+// private:
+
+void FlashMastaApp::waitForCatalogs() const
+{
+  QMutexLocker lock(&m_loading_mutex);
+  while (!m_catalogs_ready)
+  {
+    m_catalogs_loaded.wait(&m_loading_mutex);
+  }
+}
+
 
 
 FlashMastaApp* FlashMastaApp::getInstance()
@@ -2,10 +2,20 @@
 #define __FLASH_MASTA_APP_H__
 
 #include <QApplication>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
 
 class device_manager;
+class device_multiplexer;
+class device_job_scheduler;
+class auto_save_backup;
 class MainWindow;
 class game_catalog;
+class game_identification_cache;
+class image_cache;
+class WorkerPool;
+class CartridgeSnapshotCache;
 
 class FlashMastaApp: public QApplication
 {
@@ -15,11 +25,19 @@ public:
   ~FlashMastaApp();
   
   device_manager* getDeviceManager() const;
+  device_multiplexer* getDeviceMultiplexer() const;
+  device_job_scheduler* getJobScheduler() const;
+  auto_save_backup* getAutoSaveBackup() const;
   MainWindow* getMainWindow() const;
   game_catalog* getWonderswanGameCatalog() const;
   game_catalog* getNeoGeoGameCatalog() const;
+  game_identification_cache* getGameIdentificationCache() const;
+  image_cache* getImageCache() const;
+  WorkerPool* getWorkerPool() const;
+  CartridgeSnapshotCache* getCartridgeSnapshotCache() const;
   int getSelectedDevice() const;
   int getSelectedSlot() const;
+  bool catalogsReady() const;
   
 public slots:
   void setGameBackupEnabled(bool enabled);
@@ -31,8 +49,13 @@ public slots:
   void setSelectedDevice(int device_id);
   void setSelectedSlot(int slot_id);
   
+  // Backs up the save of every cartridge inserted into the given directory,
+  // or stops if it's empty
+  void setAutoSaveBackupDirectory(QString directory);
+  
 private slots:
   void mainWindowDestroyed(QObject*);
+  void deviceManagerLoaded();
   
 signals:
   void gameBackupEnabledChanged(bool);
@@ -43,6 +66,7 @@ signals:
   void saveVerifyEnabledChanged(bool);
   void selectedDeviceChanged(int, int);
   void selectedSlotChanged(int, int);
+  void deviceManagerReady();
   
 public:
   static FlashMastaApp* getInstance();
@@ -50,10 +74,20 @@ public:
 private:
   Q_DISABLE_COPY(FlashMastaApp)
   
+  void waitForCatalogs() const;
+  
   MainWindow* m_main_window;
   device_manager* m_device_manager;
+  device_multiplexer* m_device_multiplexer;
+  device_job_scheduler* m_job_scheduler;
+  auto_save_backup* m_auto_save_backup;
+  QString m_auto_save_directory;
   game_catalog* m_ws_game_catalog;
   game_catalog* m_ngp_game_catalog;
+  game_identification_cache* m_game_identification_cache;
+  image_cache* m_image_cache;
+  WorkerPool* m_worker_pool;
+  CartridgeSnapshotCache* m_cartridge_snapshot_cache;
   bool m_game_backup_enabled;
   bool m_game_flash_enabled;
   bool m_game_verify_enabled;
@@ -63,6 +97,11 @@ private:
   int m_selected_device;
   int m_selected_slot;
   
+  mutable QMutex m_loading_mutex;
+  mutable QWaitCondition m_catalogs_loaded;
+  bool m_catalogs_ready;
+  device_manager* m_loaded_device_manager;
+  
   static FlashMastaApp* instance;
   static const int NO_DEVICE;
   static const int NO_SLOT;
@@ -0,0 +1,192 @@
+#include "job_queue_widget.h"
+
+#include <stdexcept>
+
+#include <QHBoxLayout>
+#include <QPushButton>
+#include <QStringList>
+#include <QTimer>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+#include "linkmasta/device_job_scheduler.h"
+#include "flash_masta_app.h"
+
+// Matches how often jobs measure their own rate
+const int JobQueueWidget::REFRESH_INTERVAL_MS = TASK_RATE_SAMPLE_MS * 2;
+
+JobQueueWidget::JobQueueWidget(QWidget *parent) :
+  QWidget(parent),
+  m_tree(new QTreeWidget(this)),
+  m_cancel_button(new QPushButton("Cancel", this)),
+  m_clear_button(new QPushButton("Clear Finished", this)),
+  m_timer(new QTimer(this)), m_jobs()
+{
+  m_tree->setColumnCount(5);
+  m_tree->setHeaderLabels(QStringList() << "Device" << "Job" << "Status" << "Progress" << "Speed");
+  m_tree->setRootIsDecorated(false);
+  m_tree->setUniformRowHeights(true);
+  m_tree->setSelectionMode(QAbstractItemView::ExtendedSelection);
+  
+  QHBoxLayout* buttons = new QHBoxLayout();
+  buttons->addStretch(1);
+  buttons->addWidget(m_clear_button);
+  buttons->addWidget(m_cancel_button);
+  
+  QVBoxLayout* layout = new QVBoxLayout(this);
+  layout->setContentsMargins(0, 0, 0, 0);
+  layout->addWidget(m_tree, 1);
+  layout->addLayout(buttons);
+  
+  connect(m_tree, SIGNAL(itemSelectionChanged()), this, SLOT(updateButtons()));
+  connect(m_cancel_button, SIGNAL(clicked()), this, SLOT(cancelSelected()));
+  connect(m_clear_button, SIGNAL(clicked()), this, SLOT(clearFinished()));
+  
+  m_timer->setInterval(REFRESH_INTERVAL_MS);
+  connect(m_timer, SIGNAL(timeout()), this, SLOT(refresh()));
+  updateButtons();
+}
+
+
+
+void JobQueueWidget::addJob(unsigned int job_id, unsigned int device_id, QString device_name, int slot, QString description)
+{
+  Job job;
+  job.job_id = job_id;
+  job.device_id = device_id;
+  job.slot = slot;
+  job.finished = false;
+  job.item = new QTreeWidgetItem(m_tree, QStringList() << device_name << description << "Queued" << "" << "");
+  m_jobs.push_back(job);
+  
+  m_timer->start();
+  refresh();
+}
+
+
+
+void JobQueueWidget::refresh()
+{
+  device_job_scheduler* scheduler = FlashMastaApp::getInstance()->getJobScheduler();
+  bool any_unfinished = false;
+  for (Job& job : m_jobs)
+  {
+    if (job.finished) continue;
+    
+    device_job_scheduler::job_info info;
+    try
+    {
+      info = scheduler->get_job_info(job.job_id);
+    }
+    catch (std::invalid_argument& ex)
+    {
+      (void) ex;
+      job.finished = true;
+      job.item->setText(2, "Unknown");
+      continue;
+    }
+    
+    QString status;
+    if (info.finished)
+    {
+      job.finished = true;
+      if (info.status == COMPLETED && info.result) status = "Done";
+      else if (info.status == CANCELLED) status = "Cancelled";
+      else if (!info.error.empty()) status = QString("Failed: ") + info.error.c_str();
+      else status = "Failed";
+    }
+    else if (info.status == RUNNING)
+    {
+      switch (info.phase)
+      {
+      case TASK_PHASE_ERASE:   status = "Erasing"; break;
+      case TASK_PHASE_PROGRAM: status = "Programming"; break;
+      case TASK_PHASE_READ:    status = "Reading"; break;
+      case TASK_PHASE_VERIFY:  status = "Verifying"; break;
+      default:                 status = "Running"; break;
+      }
+    }
+    else if (info.status == STARTING || info.status == STOPPING)
+    {
+      status = "Running";
+    }
+    else
+    {
+      status = "Queued";
+    }
+    job.item->setText(2, status);
+    
+    if (info.work_expected > 0)
+    {
+      job.item->setText(3, QString("%1%").arg(100 * (long long) info.work_progress / info.work_expected));
+    }
+    if (job.finished)
+    {
+      job.item->setText(4, "");
+      emit jobFinished((int) job.device_id, job.slot);
+    }
+    else if (info.status == RUNNING && info.smoothed_work_per_second > 0.0)
+    {
+      QString speed = QString("%1 KiB/s").arg(info.smoothed_work_per_second / 1024.0, 0, 'f', 1);
+      if (info.seconds_remaining >= 0.0)
+      {
+        int seconds = (int) (info.seconds_remaining + 0.5);
+        speed += QString(", %1:%2 left").arg(seconds / 60).arg(seconds % 60, 2, 10, QChar('0'));
+      }
+      job.item->setText(4, speed);
+    }
+    
+    any_unfinished = any_unfinished || !job.finished;
+  }
+  
+  // Nothing left to poll for
+  if (!any_unfinished)
+  {
+    m_timer->stop();
+  }
+  updateButtons();
+}
+
+void JobQueueWidget::cancelSelected()
+{
+  device_job_scheduler* scheduler = FlashMastaApp::getInstance()->getJobScheduler();
+  for (const Job& job : m_jobs)
+  {
+    if (!job.finished && job.item->isSelected())
+    {
+      scheduler->cancel_job(job.job_id);
+    }
+  }
+  refresh();
+}
+
+void JobQueueWidget::clearFinished()
+{
+  std::vector<Job> unfinished;
+  for (const Job& job : m_jobs)
+  {
+    if (job.finished)
+    {
+      delete job.item;
+    }
+    else
+    {
+      unfinished.push_back(job);
+    }
+  }
+  m_jobs.swap(unfinished);
+  updateButtons();
+}
+
+void JobQueueWidget::updateButtons()
+{
+  bool can_cancel = false;
+  bool can_clear = false;
+  for (const Job& job : m_jobs)
+  {
+    can_cancel = can_cancel || (!job.finished && job.item->isSelected());
+    can_clear = can_clear || job.finished;
+  }
+  m_cancel_button->setEnabled(can_cancel);
+  m_clear_button->setEnabled(can_clear);
+}
@@ -0,0 +1,53 @@
+#ifndef __JOB_QUEUE_WIDGET_H__
+#define __JOB_QUEUE_WIDGET_H__
+
+#include <QString>
+#include <QWidget>
+#include <vector>
+
+class QPushButton;
+class QTimer;
+class QTreeWidget;
+class QTreeWidgetItem;
+
+// Panel listing the jobs queued on the app's job scheduler from the UI. Jobs on
+// different devices run at the same time, and each can be cancelled on its
+// own. Progress is polled from the scheduler a few times a second while any
+// job is unfinished.
+class JobQueueWidget : public QWidget
+{
+  Q_OBJECT
+public:
+  explicit JobQueueWidget(QWidget *parent = 0);
+  
+  void addJob(unsigned int job_id, unsigned int device_id, QString device_name, int slot, QString description);
+
+signals:
+  void jobFinished(int device_id, int slot);
+
+private slots:
+  void refresh();
+  void cancelSelected();
+  void clearFinished();
+  void updateButtons();
+
+private:
+  struct Job
+  {
+    unsigned int job_id;
+    unsigned int device_id;
+    int slot;
+    bool finished;
+    QTreeWidgetItem* item;
+  };
+  
+  static const int REFRESH_INTERVAL_MS;
+  
+  QTreeWidget* m_tree;
+  QPushButton* m_cancel_button;
+  QPushButton* m_clear_button;
+  QTimer* m_timer;
+  std::vector<Job> m_jobs;
+};
+
+#endif // __JOB_QUEUE_WIDGET_H__
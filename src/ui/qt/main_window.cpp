@@ -1,22 +1,33 @@
 #include "main_window.h"
 #include "ui_main_window.h"
 
-#include <algorithm>
-#include <iterator>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
 
+#include <QDialog>
+#include <QDockWidget>
+#include <QFileDialog>
+#include <QFileInfo>
 #include <QLayout>
 #include <QMessageBox>
+#include <QVBoxLayout>
 #include <QString>
 
 #include "detail/lm_detail_widget.h"
+#include "detail/memory_view_widget.h"
+#include "device_list_delegate.h"
+#include "device_list_model.h"
+#include "job_queue_widget.h"
+#include "linkmasta/device_job_scheduler.h"
 #include "linkmasta/device_manager.h"
+#include "linkmasta/device_multiplexer.h"
 #include "flash_masta_app.h"
 #include "task/ngp_cartridge_backup_task.h"
 #include "task/ngp_cartridge_backup_save_task.h"
 #include "task/ngp_cartridge_flash_task.h"
+#include "task/ngp_cartridge_reflash_task.h"
 #include "task/ngp_cartridge_restore_save_task.h"
 #include "task/ngp_cartridge_verify_task.h"
 #include "task/ngp_cartridge_verify_save_task.h"
@@ -48,10 +59,10 @@ using namespace std;
     return;\
   }\
   \
-  while (!FlashMastaApp::getInstance()->getDeviceManager()->try_claim_device(device_index));
+  FlashMastaApp::getInstance()->getDeviceMultiplexer()->begin_job(device_index);
 
 #define POST_ACTION \
-  FlashMastaApp::getInstance()->getDeviceManager()->release_device(device_index);\
+  FlashMastaApp::getInstance()->getDeviceMultiplexer()->end_job(device_index);\
   delete cart;\
   emit cartridgeContentChanged(device_index, slot_index);
 
@@ -59,25 +70,43 @@ using namespace std;
 
 MainWindow::MainWindow(QWidget *parent) 
   : QMainWindow(parent), ui(new Ui::MainWindow),
-    m_target_system(system_type::SYSTEM_UNKNOWN), m_timer(this), m_device_ids(),
-    m_device_detail_widgets(), m_prompt_no_devices(nullptr),
-    m_current_widget(nullptr)
+    m_target_system(system_type::SYSTEM_UNKNOWN), m_device_listener(0),
+    m_device_listener_added(false),
+    m_device_list_model(new DeviceListModel(this)), m_prompt_no_devices(nullptr),
+    m_current_widget(nullptr), m_current_device(-1), m_job_queue(nullptr),
+    m_job_queue_dock(nullptr)
 {
   // Set up UI
   ui->setupUi(this);
   m_prompt_no_devices = ui->promptNoDevices;
   
   // Remove blue glow aroudn QListView on Macs
-  ui->deviceListWidget->setAttribute(Qt::WA_MacShowFocusRect, false);
+  ui->deviceListView->setAttribute(Qt::WA_MacShowFocusRect, false);
+  
+  // Every row is the same height, which lets the view skip measuring rows
+  // that aren't visible
+  ui->deviceListView->setModel(m_device_list_model);
+  ui->deviceListView->setItemDelegate(new DeviceListDelegate(ui->deviceListView));
+  ui->deviceListView->setUniformItemSizes(true);
+  connect(ui->deviceListView->selectionModel(), SIGNAL(currentChanged(QModelIndex,QModelIndex)),
+          this, SLOT(deviceListView_currentChanged(QModelIndex,QModelIndex)));
   
   // connect ui to actions
   FlashMastaApp* app = FlashMastaApp::getInstance();
   connect(ui->actionBackupROM, SIGNAL(triggered(bool)), this, SLOT(triggerActionBackupGame()));
   connect(ui->actionRestoreROM, SIGNAL(triggered(bool)), this, SLOT(triggerActionFlashGame()));
+  connect(ui->actionUpgradeROM, SIGNAL(triggered(bool)), this, SLOT(triggerActionUpgradeGame()));
   connect(ui->actionVerifyROM, SIGNAL(triggered(bool)), this, SLOT(triggerActionVerifyGame()));
   connect(ui->actionBackupSave, SIGNAL(triggered(bool)), this, SLOT(triggerActionBackupSave()));
   connect(ui->actionRestoreSave, SIGNAL(triggered(bool)), this, SLOT(triggerActionRestoreSave()));
   connect(ui->actionVerifySave, SIGNAL(triggered(bool)), this, SLOT(triggerActionVerifySave()));
+  connect(ui->actionBrowseMemory, SIGNAL(triggered(bool)), this, SLOT(triggerActionBrowseMemory()));
+  connect(ui->actionQueueBackupROM, SIGNAL(triggered(bool)), this, SLOT(triggerActionQueueBackupGame()));
+  connect(ui->actionQueueRestoreROM, SIGNAL(triggered(bool)), this, SLOT(triggerActionQueueFlashGame()));
+  connect(ui->actionQueueVerifyROM, SIGNAL(triggered(bool)), this, SLOT(triggerActionQueueVerifyGame()));
+  connect(ui->actionQueueBackupSave, SIGNAL(triggered(bool)), this, SLOT(triggerActionQueueBackupSave()));
+  connect(ui->actionQueueRestoreSave, SIGNAL(triggered(bool)), this, SLOT(triggerActionQueueRestoreSave()));
+  connect(ui->actionAutoBackupSaves, SIGNAL(toggled(bool)), this, SLOT(toggleActionAutoBackupSaves(bool)));
   connect(app, SIGNAL(gameBackupEnabledChanged(bool)), this, SLOT(setGameBackupEnabled(bool)));
   connect(app, SIGNAL(gameFlashEnabledChanged(bool)), this, SLOT(setGameFlashEnabled(bool)));
   connect(app, SIGNAL(gameVerifyEnabledChanged(bool)), this, SLOT(setGameVerifyEnabled(bool)));
@@ -85,6 +114,17 @@ MainWindow::MainWindow(QWidget *parent)
   connect(app, SIGNAL(saveRestoreEnabledChanged(bool)), this, SLOT(setSaveRestoreEnabled(bool)));
   connect(app, SIGNAL(saveVerifyEnabledChanged(bool)), this, SLOT(setSaveVerifyEnabled(bool)));
   
+  // Queued jobs show in a panel of their own rather than a modal dialog, so
+  // several can run on different devices at once
+  m_job_queue = new JobQueueWidget();
+  m_job_queue_dock = new QDockWidget("Job Queue", this);
+  m_job_queue_dock->setObjectName("jobQueueDock");
+  m_job_queue_dock->setWidget(m_job_queue);
+  addDockWidget(Qt::BottomDockWidgetArea, m_job_queue_dock);
+  m_job_queue_dock->hide();
+  ui->menuQueue->addAction(m_job_queue_dock->toggleViewAction());
+  connect(m_job_queue, SIGNAL(jobFinished(int,int)), this, SIGNAL(cartridgeContentChanged(int,int)));
+  
   // Refresh action states
   app->setSelectedDevice(app->getSelectedDevice());
   app->setSelectedSlot(app->getSelectedSlot());
@@ -94,13 +134,20 @@ MainWindow::MainWindow(QWidget *parent)
   ui->mainToolBar->hide();
 #endif
   
-  // Start the automatic list refresh timer
-  connect(&m_timer, SIGNAL(timeout()), this, SLOT(refreshDeviceList_timeout()));
-  m_timer.start(10);
+  // The device manager is loaded in the background
+  connect(app, SIGNAL(deviceManagerReady()), this, SLOT(deviceManagerReady()));
+  if (app->getDeviceManager() != nullptr)
+  {
+    deviceManagerReady();
+  }
 }
 
 MainWindow::~MainWindow()
 {
+  if (m_device_listener_added)
+  {
+    FlashMastaApp::getInstance()->getDeviceManager()->remove_device_listener(m_device_listener);
+  }
   delete ui;
 }
 
@@ -129,9 +176,11 @@ cartridge* MainWindow::buildCartridgeForDevice(int id)
     break;
   }
   
-  while (!FlashMastaApp::getInstance()->getDeviceManager()->try_claim_device(id));
-  cart->init();
-  FlashMastaApp::getInstance()->getDeviceManager()->release_device(id);
+  FlashMastaApp::getInstance()->getDeviceMultiplexer()->submit(id, [cart](linkmasta_device* linkmasta)
+  {
+    (void) linkmasta;
+    cart->init();
+  }).get();
   return cart;
 }
 
@@ -142,26 +191,33 @@ cartridge* MainWindow::buildCartridgeForDevice(int id)
 void MainWindow::setGameBackupEnabled(bool enabled)
 {
   ui->actionBackupROM->setEnabled(enabled);
+  ui->actionQueueBackupROM->setEnabled(enabled);
+  ui->actionBrowseMemory->setEnabled(enabled);
 }
 
 void MainWindow::setGameFlashEnabled(bool enabled)
 {
   ui->actionRestoreROM->setEnabled(enabled);
+  ui->actionUpgradeROM->setEnabled(enabled);
+  ui->actionQueueRestoreROM->setEnabled(enabled);
 }
 
 void MainWindow::setGameVerifyEnabled(bool enabled)
 {
   ui->actionVerifyROM->setEnabled(enabled);
+  ui->actionQueueVerifyROM->setEnabled(enabled);
 }
 
 void MainWindow::setSaveBackupEnabled(bool enabled)
 {
   ui->actionBackupSave->setEnabled(enabled);
+  ui->actionQueueBackupSave->setEnabled(enabled);
 }
 
 void MainWindow::setSaveRestoreEnabled(bool enabled)
 {
   ui->actionRestoreSave->setEnabled(enabled);
+  ui->actionQueueRestoreSave->setEnabled(enabled);
 }
 
 void MainWindow::setSaveVerifyEnabled(bool enabled)
@@ -231,6 +287,38 @@ void MainWindow::triggerActionFlashGame()
   POST_ACTION
 }
 
+void MainWindow::triggerActionUpgradeGame()
+{
+  PRE_ACTION
+  
+  try
+  {
+    switch (cart->system())
+    {
+    case system_type::SYSTEM_NEO_GEO_POCKET:
+      NgpCartridgeReflashTask(this, cart, slot_index).go();
+      break;
+      
+    case system_type::SYSTEM_WONDERSWAN:
+      // WonderSwan saves live in SRAM, which flashing the game leaves alone
+      WsCartridgeFlashTask(this, cart, slot_index).go();
+      break;
+      
+    default:
+      // Too bad, so sad
+      break;
+    }
+  }
+  catch (std::runtime_error& ex)
+  {
+    QMessageBox msgBox(this);
+    msgBox.setText(ex.what());
+    msgBox.exec();    
+  }
+  
+  POST_ACTION
+}
+
 void MainWindow::triggerActionVerifyGame()
 {
   PRE_ACTION
@@ -351,154 +439,204 @@ void MainWindow::triggerActionVerifySave()
   POST_ACTION
 }
 
-void MainWindow::refreshDeviceList_timeout()
+void MainWindow::triggerActionBrowseMemory()
 {
-  vector<unsigned int> connected_devices;
+  int device_index = FlashMastaApp::getInstance()->getSelectedDevice();
+  int slot_index = FlashMastaApp::getInstance()->getSelectedSlot();
+  std::shared_ptr<cartridge> cart(device_index != -1 ? buildCartridgeForDevice(device_index) : nullptr);
+  
+  if (cart == nullptr)
+  {
+    QMessageBox msgBox(this);
+    msgBox.setText("Please select a Flash Masta and a game slot.");
+    msgBox.exec();
+    return;
+  }
   
-  set<unsigned int> known_devices;    // devices we knew about previously
-  set<unsigned int> current_devices;  // devices that are currently connected
-  set<unsigned int> new_devices;      // newly connected devices
-  set<unsigned int> removed_devices;  // recently removed devices
+  // Official cartridges have a single slot and nothing to select
+  QDialog dialog(this);
+  dialog.setWindowTitle("Cartridge Memory");
+  QVBoxLayout* layout = new QVBoxLayout(&dialog);
+  MemoryViewWidget* view = new MemoryViewWidget(device_index, cart, (slot_index < 0 ? 0 : slot_index), &dialog);
+  layout->addWidget(view);
+  connect(view, SIGNAL(readFailed(QString)), this, SLOT(memoryReadFailed(QString)));
   
-  if (FlashMastaApp::getInstance()->getDeviceManager()->try_get_connected_devices(connected_devices))
+  dialog.exec();
+}
+
+void MainWindow::triggerActionQueueBackupGame()
+{
+  queueJob("Backup ROM", false, true, [](device_job_scheduler* scheduler, unsigned int device_id, const std::string& path, int slot)
   {
-    // new row selection after updating list
-    int selection = -1;
-    
-    // Construct sets. Use STL algorithms to generate set of removed devices and
-    // set of newly connected devices.
-    for (auto device_id : m_device_ids) known_devices.insert(device_id);
-    for (auto device_id : connected_devices) current_devices.insert(device_id);
-    set_difference(current_devices.begin(), current_devices.end(),
-                   known_devices.begin(), known_devices.end(),
-                   inserter(new_devices, new_devices.end()));
-    set_difference(known_devices.begin(), known_devices.end(),
-                   current_devices.begin(), current_devices.end(),
-                   inserter(removed_devices, removed_devices.end()));
-    
-    // Handle disconnected devices
-    for (unsigned int i = 0; i < m_device_ids.size();)
+    return scheduler->submit_backup_job(device_id, path, slot);
+  });
+}
+
+void MainWindow::triggerActionQueueFlashGame()
+{
+  queueJob("Restore ROM", false, false, [](device_job_scheduler* scheduler, unsigned int device_id, const std::string& path, int slot)
+  {
+    return scheduler->submit_flash_job(device_id, path, slot);
+  });
+}
+
+void MainWindow::triggerActionQueueVerifyGame()
+{
+  queueJob("Verify ROM", false, false, [](device_job_scheduler* scheduler, unsigned int device_id, const std::string& path, int slot)
+  {
+    return scheduler->submit_verify_job(device_id, path, slot);
+  });
+}
+
+void MainWindow::triggerActionQueueBackupSave()
+{
+  queueJob("Backup Save", true, true, [](device_job_scheduler* scheduler, unsigned int device_id, const std::string& path, int slot)
+  {
+    return scheduler->submit_save_backup_job(device_id, path, slot);
+  });
+}
+
+void MainWindow::triggerActionQueueRestoreSave()
+{
+  queueJob("Restore Save", true, false, [](device_job_scheduler* scheduler, unsigned int device_id, const std::string& path, int slot)
+  {
+    return scheduler->submit_restore_save_job(device_id, path, slot);
+  });
+}
+
+void MainWindow::toggleActionAutoBackupSaves(bool checked)
+{
+  FlashMastaApp* app = FlashMastaApp::getInstance();
+  if (!checked)
+  {
+    app->setAutoSaveBackupDirectory(QString());
+    return;
+  }
+  
+  // Backups are opt-in, so nothing happens until a folder is picked
+  QString directory = QFileDialog::getExistingDirectory(this, tr("Save History Folder"));
+  if (directory.isEmpty())
+  {
+    ui->actionAutoBackupSaves->setChecked(false);
+    return;
+  }
+  app->setAutoSaveBackupDirectory(directory);
+}
+
+void MainWindow::refreshDeviceList()
+{
+  vector<unsigned int> connected_devices;
+  if (!FlashMastaApp::getInstance()->getDeviceManager()->try_get_connected_devices(connected_devices))
+  {
+    return;
+  }
+  set<unsigned int> current_devices(connected_devices.begin(), connected_devices.end());
+  
+  // Handle disconnected devices. The view moves the selection on its own if
+  // the selected device goes away.
+  for (int row = m_device_list_model->rowCount() - 1; row >= 0; --row)
+  {
+    if (current_devices.find(m_device_list_model->deviceIdAt(row)) == current_devices.end())
     {
-      auto device_id = m_device_ids[i];
-      auto item = ui->deviceListWidget->item(i);
-      if (item->isSelected())
-      {
-        selection = i;
-      }
-      
-      if (removed_devices.find(device_id) != removed_devices.end())
-      {
-        // Remove listing from device list
-        if (item->isSelected()) m_current_widget = nullptr;
-        ui->deviceListWidget->takeItem(i);
-        delete item;
-        
-        // Find and delete device's widget
-        auto it = m_device_detail_widgets.find(m_device_ids[i]);
-        if (it != m_device_detail_widgets.end())
-        {
-          delete it->second;
-          m_device_detail_widgets.erase(it);
-        }
-        
-        // Forget device id
-        m_device_ids.erase(m_device_ids.begin() + i);
-      }
-      else
-      {
-        i++;
-      }
+      m_device_list_model->removeDevice(row);
     }
-    
-    // Handle newly connected devices
-    for (auto device_id : new_devices)
+  }
+  
+  // Handle newly connected devices
+  for (auto device_id : current_devices)
+  {
+    if (m_device_list_model->rowOfDevice(device_id) < 0)
     {
-      // Instantiate a new item and append it to the list widget
-      QString device_name = "";
       linkmasta_device* linkmasta = FlashMastaApp::getInstance()->getDeviceManager()->get_linkmasta_device(device_id);
-      switch (linkmasta->system())
-      {
-      default:
-      case LINKMASTA_UNKNOWN:
-        device_name = "Unknown Device";
-        break;
-        
-      case LINKMASTA_NEO_GEO_POCKET:
-        if (linkmasta->is_integrated_with_cartridge())
-        {
-          device_name = "Neo Geo USB Flash Masta";
-        }
-        else
-        {
-          device_name = "Neo Geo Link Masta";
-        }
-        break;
-        
-      case LINKMASTA_WONDERSWAN:
-        device_name = "Wonderswan Flash Masta";
-        break;
-      }
-      QListWidgetItem *item = new QListWidgetItem(QString(device_name));
-      auto size = item->sizeHint();
-      size.setHeight(40);
-      item->setSizeHint(size);
-      ui->deviceListWidget->insertItem(ui->deviceListWidget->count(), item);
-      
-      // Remember this device id
-      m_device_ids.push_back(device_id);
-      
-      // Instantiate widget object for connected device
-      auto widget = new LmDetailWidget(device_id, ui->scrollAreaWidgetContents);
-      m_device_detail_widgets[device_id] = widget;
-      widget->hide();
-      ui->scrollAreaWidgetContents->layout()->addWidget(widget);
+      m_device_list_model->addDevice(device_id, deviceName(linkmasta));
     }
-    
-    // Update selection if selected device was disconnected
-    if (selection >= ui->deviceListWidget->count())
-    {
-      selection = ui->deviceListWidget->count() - 1;
-    }
-    if (selection < 0 && ui->deviceListWidget->count() > 0)
+  }
+  
+  // Make sure a device is selected if there are any
+  if (!ui->deviceListView->currentIndex().isValid())
+  {
+    if (m_device_list_model->rowCount() > 0)
     {
-      selection = 0;
+      ui->deviceListView->setCurrentIndex(m_device_list_model->index(0));
     }
-    
-    // Select device in list and act as if user selected it
-    if (selection < 0 || !ui->deviceListWidget->item(selection)->isSelected())
+    else
     {
-      if (selection >= 0)
-      {
-        ui->deviceListWidget->item(selection)->setSelected(true);
-      }
-      on_deviceListWidget_currentRowChanged(selection);
+      showDevice(-1);
     }
   }
-  
-  m_timer.start(10);
+  else if (m_current_device != (int) m_device_list_model->deviceIdAt(ui->deviceListView->currentIndex().row()))
+  {
+    showDevice(ui->deviceListView->currentIndex().row());
+  }
 }
 
+void MainWindow::deviceManagerReady()
+{
+  if (m_device_listener_added) return;
+  
+  // Refresh the device list whenever a device comes or goes. Listeners run
+  // on the device manager's thread, so hop over to the UI thread first.
+  m_device_listener = FlashMastaApp::getInstance()->getDeviceManager()->add_device_listener([this](unsigned int, bool)
+  {
+    QMetaObject::invokeMethod(this, "refreshDeviceList", Qt::QueuedConnection);
+  });
+  m_device_listener_added = true;
+  refreshDeviceList();
+}
 
+DeviceListModel* MainWindow::getDeviceListModel() const
+{
+  return m_device_list_model;
+}
 
-// private slots:
+QString MainWindow::deviceName(linkmasta_device* linkmasta)
+{
+  switch (linkmasta->system())
+  {
+  default:
+  case LINKMASTA_UNKNOWN:
+    return "Unknown Device";
+    
+  case LINKMASTA_NEO_GEO_POCKET:
+    if (linkmasta->is_integrated_with_cartridge())
+    {
+      return "Neo Geo USB Flash Masta";
+    }
+    else
+    {
+      return "Neo Geo Link Masta";
+    }
+    
+  case LINKMASTA_WONDERSWAN:
+    return "Wonderswan Flash Masta";
+  }
+}
 
-void MainWindow::on_deviceListWidget_currentRowChanged(int currentRow)
+void MainWindow::showDevice(int row)
 {
+  int device_id = (row >= 0 ? (int) m_device_list_model->deviceIdAt(row) : -1);
+  if (device_id == m_current_device && (device_id < 0 || m_current_widget != nullptr))
+  {
+    return;
+  }
+  
+  // Detail panels are only built for the selected device, so that nothing is
+  // polling or drawing devices that aren't being looked at
   if (m_current_widget != nullptr)
   {
     m_current_widget->hide();
+    delete m_current_widget;
     m_current_widget = nullptr;
   }
-  else
-  {
-    m_prompt_no_devices->hide();
-  }
+  m_current_device = device_id;
   
-  if (currentRow >= 0)
+  if (device_id >= 0)
   {
-    m_current_widget = m_device_detail_widgets[m_device_ids[currentRow]];
+    m_prompt_no_devices->hide();
+    m_current_widget = new LmDetailWidget((unsigned int) device_id, ui->scrollAreaWidgetContents);
+    ui->scrollAreaWidgetContents->layout()->addWidget(m_current_widget);
     m_current_widget->show();
-    FlashMastaApp::getInstance()->setSelectedDevice(m_device_ids[currentRow]);
+    FlashMastaApp::getInstance()->setSelectedDevice(device_id);
   }
   else
   {
@@ -507,4 +645,90 @@ void MainWindow::on_deviceListWidget_currentRowChanged(int currentRow)
   }
 }
 
+QString MainWindow::askForFile(linkmasta_device* linkmasta, bool save_data, bool to_file)
+{
+  QString name;
+  QString filter;
+  switch (linkmasta->system())
+  {
+  case LINKMASTA_NEO_GEO_POCKET:
+    name = (save_data ? "save_backup.ngf" : "backup.ngp");
+    filter = (save_data ? tr("Neo Geo File (*.ngf);;All files (*)") : tr("Neo Geo Pocket (*.ngp);;All files (*)"));
+    break;
+    
+  case LINKMASTA_WONDERSWAN:
+    name = (save_data ? "save_backup.wsf" : "backup.wsc");
+    filter = (save_data ? tr("WonderSwan File (*.wsf);;All Files (*)") : tr("WonderSwan Color (*.wsc);;WonderSwan (*.ws);;All Files (*)"));
+    break;
+    
+  default:
+  case LINKMASTA_UNKNOWN:
+    filter = tr("All files (*)");
+    break;
+  }
+  
+  if (to_file)
+  {
+    return QFileDialog::getSaveFileName(this, tr("Save File"), name, filter);
+  }
+  return QFileDialog::getOpenFileName(this, tr("Open File"), QString(), filter);
+}
+
+void MainWindow::queueJob(QString description, bool save_data, bool to_file, JobSubmitter submit)
+{
+  FlashMastaApp* app = FlashMastaApp::getInstance();
+  int device_index = app->getSelectedDevice();
+  int slot_index = app->getSelectedSlot();
+  linkmasta_device* linkmasta = (device_index != -1 && app->getJobScheduler() != nullptr ? app->getDeviceManager()->get_linkmasta_device(device_index) : nullptr);
+  
+  if (linkmasta == nullptr)
+  {
+    QMessageBox msgBox(this);
+    msgBox.setText("Please select a Flash Masta and a game slot.");
+    msgBox.exec();
+    return;
+  }
+  
+  QString filename = askForFile(linkmasta, save_data, to_file);
+  if (filename.isEmpty())
+  {
+    // Quietly fail
+    return;
+  }
+  
+  // The job runs on the scheduler's thread for the device, leaving the
+  // window free to queue more
+  try
+  {
+    unsigned int job_id = submit(app->getJobScheduler(), (unsigned int) device_index, filename.toStdString(), slot_index);
+    if (slot_index >= 0)
+    {
+      description += QString(" slot %1").arg(slot_index + 1);
+    }
+    m_job_queue->addJob(job_id, (unsigned int) device_index, deviceName(linkmasta), slot_index, description + ": " + QFileInfo(filename).fileName());
+    m_job_queue_dock->show();
+  }
+  catch (std::exception& ex)
+  {
+    QMessageBox msgBox(this);
+    msgBox.setText(ex.what());
+    msgBox.exec();
+  }
+}
+
+
+
+// private slots:
 
+void MainWindow::memoryReadFailed(QString error)
+{
+  QMessageBox msgBox(this);
+  msgBox.setText("Could not read the cartridge: " + error);
+  msgBox.exec();
+}
+
+void MainWindow::deviceListView_currentChanged(const QModelIndex& current, const QModelIndex& previous)
+{
+  (void) previous;
+  showDevice(current.isValid() ? current.row() : -1);
+}
@@ -2,7 +2,9 @@
 #define __MAIN_WINDOW_H__
 
 #include <QMainWindow>
-#include <QTimer>
+#include <QModelIndex>
+#include <functional>
+#include <string>
 
 #include "cartridge/cartridge.h"
 
@@ -10,6 +12,11 @@ namespace Ui {
 class MainWindow;
 }
 class DeviceInfoWidget;
+class DeviceListModel;
+class JobQueueWidget;
+class QDockWidget;
+class device_job_scheduler;
+class linkmasta_device;
 
 class MainWindow : public QMainWindow
 {
@@ -19,8 +26,17 @@ public:
   explicit MainWindow(QWidget *parent = 0);
   ~MainWindow();
   
+  DeviceListModel* getDeviceListModel() const;
+  
 private:
   cartridge* buildCartridgeForDevice(int id);
+  static QString deviceName(linkmasta_device* linkmasta);
+  void showDevice(int row);
+  
+  // Submits a job for the selected device and slot to the job scheduler
+  typedef std::function<unsigned int(device_job_scheduler*, unsigned int, const std::string&, int)> JobSubmitter;
+  QString askForFile(linkmasta_device* linkmasta, bool save_data, bool to_file);
+  void queueJob(QString description, bool save_data, bool to_file, JobSubmitter submit);
   
 public slots:
   void setGameBackupEnabled(bool enabled);
@@ -31,28 +47,42 @@ public slots:
   void setSaveVerifyEnabled(bool enabled);
   void triggerActionBackupGame();
   void triggerActionFlashGame();
+  void triggerActionUpgradeGame();
   void triggerActionVerifyGame();
   void triggerActionBackupSave();
   void triggerActionRestoreSave();
   void triggerActionVerifySave();
-  void refreshDeviceList_timeout();
+  void triggerActionBrowseMemory();
+  void triggerActionQueueBackupGame();
+  void triggerActionQueueFlashGame();
+  void triggerActionQueueVerifyGame();
+  void triggerActionQueueBackupSave();
+  void triggerActionQueueRestoreSave();
+  void toggleActionAutoBackupSaves(bool checked);
+  void refreshDeviceList();
+  void deviceManagerReady();
   
 private slots:
-  void on_deviceListWidget_currentRowChanged(int currentRow);
-  
+  void deviceListView_currentChanged(const QModelIndex& current, const QModelIndex& previous);
+  void memoryReadFailed(QString error);
+
 signals:
   void cartridgeContentChanged(int, int);
   
 private:
   Ui::MainWindow *ui;
   system_type m_target_system;
-  QTimer m_timer;
+  unsigned int m_device_listener;
+  bool m_device_listener_added;
   
-  std::vector<unsigned int> m_device_ids;
-  std::map<unsigned int, QWidget*> m_device_detail_widgets;
+  DeviceListModel* m_device_list_model;
   QWidget* m_prompt_no_devices;
   QWidget* m_prompt_none_selected;
   QWidget* m_current_widget;
+  int m_current_device;
+  
+  JobQueueWidget* m_job_queue;
+  QDockWidget* m_job_queue_dock;
 };
 
 #endif // __MAIN_WINDOW_H__
@@ -0,0 +1,64 @@
+#include "svg_pixmap_cache.h"
+
+#include <QLabel>
+#include <QPainter>
+#include <QSvgRenderer>
+
+QPixmap SvgPixmapCache::pixmap(const QString& path, const QSize& size, qreal pixel_ratio)
+{
+  QHash<QString, QPixmap>& cache = pixmaps();
+  QString pixmap_key = key(path, size, pixel_ratio);
+  QHash<QString, QPixmap>::const_iterator it = cache.constFind(pixmap_key);
+  if (it != cache.constEnd())
+  {
+    return it.value();
+  }
+  
+  // Artwork that can't be loaded is cached too, as a null pixmap, rather than
+  // parsed again by every widget
+  QPixmap result;
+  QSvgRenderer renderer(path);
+  if (renderer.isValid() && !size.isEmpty())
+  {
+    result = QPixmap(size * pixel_ratio);
+    result.fill(Qt::transparent);
+    QPainter painter(&result);
+    renderer.render(&painter);
+    painter.end();
+#if QT_VERSION >= 0x050000
+    result.setDevicePixelRatio(pixel_ratio);
+#endif
+  }
+  cache.insert(pixmap_key, result);
+  return result;
+}
+
+void SvgPixmapCache::setLabelPixmap(QLabel* label, const QString& path)
+{
+  qreal pixel_ratio = 1.0;
+#if QT_VERSION >= 0x050000
+  pixel_ratio = label->devicePixelRatio();
+#endif
+  label->setPixmap(pixmap(path, label->maximumSize(), pixel_ratio));
+}
+
+int SvgPixmapCache::size()
+{
+  return pixmaps().size();
+}
+
+void SvgPixmapCache::clear()
+{
+  pixmaps().clear();
+}
+
+QHash<QString, QPixmap>& SvgPixmapCache::pixmaps()
+{
+  static QHash<QString, QPixmap> cache;
+  return cache;
+}
+
+QString SvgPixmapCache::key(const QString& path, const QSize& size, qreal pixel_ratio)
+{
+  return path + QString("@%1x%2@%3").arg(size.width()).arg(size.height()).arg(pixel_ratio);
+}
@@ -0,0 +1,34 @@
+#ifndef __SVG_PIXMAP_CACHE_H__
+#define __SVG_PIXMAP_CACHE_H__
+
+#include <QHash>
+#include <QPixmap>
+#include <QSize>
+#include <QString>
+
+class QLabel;
+
+// Application-wide cache of SVG artwork rasterized for the widgets, keyed by
+// the file, the size it's drawn at, and the pixel ratio of the screen. Each is
+// rendered once per process, since rendering SVGs was most of the time taken
+// to create a slot widget, and a hub full of devices plugged in at once
+// creates a lot of them. Pixmaps are implicitly shared, so every widget showing
+// the same artwork holds the same pixels. Only used from the UI thread.
+class SvgPixmapCache
+{
+public:
+  static QPixmap pixmap(const QString& path, const QSize& size, qreal pixel_ratio = 1.0);
+  
+  // Shows the artwork in a label at the label's maximum size and the pixel
+  // ratio of its screen
+  static void setLabelPixmap(QLabel* label, const QString& path);
+  
+  static int size();
+  static void clear();
+
+private:
+  static QHash<QString, QPixmap>& pixmaps();
+  static QString key(const QString& path, const QSize& size, qreal pixel_ratio);
+};
+
+#endif // __SVG_PIXMAP_CACHE_H__
@@ -64,7 +64,10 @@ void NgpCartridgeBackupSaveTask::run_task()
   // Begin task
   try
   {
-    m_cartridge->backup_cartridge_save_data(*m_fout, (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), this);
+    run_in_background([&]
+    {
+      m_cartridge->backup_cartridge_save_data(*m_fout, (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), controller());
+    });
   }
   catch (std::exception& ex)
   {
@@ -36,9 +36,6 @@ void NgpCartridgeBackupTask::run_task()
                                     "Would you like to back up the entire cartridge instead?",
                                     QMessageBox::No|QMessageBox::Yes, QMessageBox::Yes);
       
-      delete curr_game;
-      delete othr_game;
-      
       switch (reply)
       {
       case QMessageBox::Yes:
@@ -88,7 +85,10 @@ void NgpCartridgeBackupTask::run_task()
   // Begin task
   try
   {
-    m_cartridge->backup_cartridge_game_data(*m_fout, (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), this);
+    run_in_background([&]
+    {
+      m_cartridge->backup_cartridge_game_data(*m_fout, (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), controller());
+    });
   }
   catch (std::exception& ex)
   {
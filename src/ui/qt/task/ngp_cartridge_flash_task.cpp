@@ -1,8 +1,9 @@
 #include "ngp_cartridge_flash_task.h"
 #include <QFileDialog>
 #include <QMessageBox>
-#include <fstream>
 #include "cartridge/cartridge.h"
+#include "cartridge/image_cache.h"
+#include "cartridge/restore_plan.h"
 #include "../flash_masta_app.h"
 #include "game/game_catalog.h"
 
@@ -52,9 +53,6 @@ void NgpCartridgeFlashTask::run_task()
                                       ") unplayable. Are you sure you want to continue?",
                                     QMessageBox::Cancel|QMessageBox::Yes, QMessageBox::Yes);
       
-      delete curr_game;
-      delete othr_game;
-      
       switch (reply)
       {
       case QMessageBox::Yes:
@@ -79,30 +77,55 @@ void NgpCartridgeFlashTask::run_task()
     return;
   }
   
-  // Initialize inputfile
-  m_fin = new std::ifstream(filename.toStdString().c_str(), std::ios::binary);
-  if (!m_fin->is_open())
+  // Check which game the file holds before loading all of it
+  const game_descriptor* game = FlashMastaApp::getInstance()->getNeoGeoGameCatalog()->identify_image(filename.toStdString());
+  if (game == nullptr)
+  {
+    QMessageBox::StandardButton reply;
+    reply = QMessageBox::question((QWidget*) parent(), "Unknown Game",
+                                  "The selected file is not a known Neo Geo Pocket game. "
+                                  "Flash it anyway?",
+                                  QMessageBox::Cancel|QMessageBox::Ok, QMessageBox::Ok);
+    
+    switch (reply)
+    {
+    case QMessageBox::Ok:
+      // User's ok with it, so we continue
+      break;
+    
+    case QMessageBox::Cancel:
+    default:
+      // User decides to cancel, so we cancel
+      return;
+    }
+  }
+  QString source = (game == nullptr ? QString("data from file") : QString(game->name));
+  
+  // Load the image, sharing it with any other job flashing the same file
+  try
+  {
+    m_image = FlashMastaApp::getInstance()->getImageCache()->get(filename.toStdString());
+    
+    // Plan from the image's blank flags rather than reading every block again
+    restore_plan::share_image(m_image);
+  }
+  catch (std::exception& ex)
   {
-    delete m_fin;
     QMessageBox msgBox;
-    msgBox.setText("Unable to open file");
+    msgBox.setText(QString("Unable to open file: ") + ex.what());
     msgBox.exec();
     return;
   }
   
   // Gather size of file to flash
-  unsigned int file_size;
-  m_fin->seekg(0, m_fin->end);
-  file_size = m_fin->tellg();
-  m_fin->seekg(0, m_fin->beg);
+  unsigned int file_size = m_image->size();
   
   if (file_size > m_cartridge->descriptor()->num_bytes)
   {
     QMessageBox::information((QWidget*) parent(), "File Too Large",
                              "The selected file is too large to fit on this cartridge.",
                              QMessageBox::Ok);
-    m_fin->close();
-    delete m_fin;
+    m_image.reset();
     return;
   }
   else if (m_slot != -1 && file_size > m_cartridge->slot_size(m_slot))
@@ -123,8 +146,7 @@ void NgpCartridgeFlashTask::run_task()
     case QMessageBox::Cancel:
     default:
       // User decides to cancel, so we cancel;
-      m_fin->close();
-      delete m_fin;
+      m_image.reset();
       return;
     }
   }
@@ -149,8 +171,7 @@ void NgpCartridgeFlashTask::run_task()
     case QMessageBox::Cancel:
     default:
       // User decides to cancel, so we cancel
-      m_fin->close();
-      delete m_fin;
+      m_image.reset();
       return;
       break;
     }
@@ -158,23 +179,22 @@ void NgpCartridgeFlashTask::run_task()
   
   if (m_slot == -1)
   {
-    setProgressLabel(QString("Flashing data from file to entire cartridge"));
+    setProgressLabel(QString("Flashing ") + source + " to entire cartridge");
   }
   else
   {
-    setProgressLabel(QString("Flashing data from file to slot ") + QString::number(m_slot+1));
+    setProgressLabel(QString("Flashing ") + source + " to slot " + QString::number(m_slot+1));
   }
   
   // Begin task
   try
   {
-    m_cartridge->restore_cartridge_game_data(*m_fin, (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), this);
+    write_image();
   }
   catch (std::exception& ex)
   {
     (void) ex;
-    m_fin->close();
-    delete m_fin;
+    m_image.reset();
     
     if (is_task_cancelled())
     {
@@ -193,6 +213,13 @@ void NgpCartridgeFlashTask::run_task()
   }
   
   // Cleanup
-  m_fin->close();
-  delete m_fin;
+  m_image.reset();
+}
+
+void NgpCartridgeFlashTask::write_image()
+{
+  run_in_background([&]
+  {
+    m_cartridge->restore_cartridge_game_data(m_image->data(), m_image->size(), (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), controller());
+  });
 }
@@ -2,7 +2,8 @@
 #define __NGP_CARTRIDGE_FLASH_TASK_H__
 
 #include "ngp_cartridge_task.h"
-#include <iosfwd>
+#include <memory>
+#include "cartridge/image_cache.h"
 
 class NgpCartridgeFlashTask: public NgpCartridgeTask
 {
@@ -15,9 +16,10 @@ public:
   
 protected:
   void run_task();
+  virtual void write_image();
   
-private:
-  std::ifstream* m_fin;
+protected:
+  std::shared_ptr<const image_cache::image> m_image;
 };
 
 #endif // __NGP_CARTRIDGE_FLASH_TASK_H__
@@ -0,0 +1,39 @@
+#include "ngp_cartridge_reflash_task.h"
+#include "cartridge/cartridge.h"
+#include "linkmasta/device_manager.h"
+#include "linkmasta/linkmasta_device.h"
+#include "../flash_masta_app.h"
+
+NgpCartridgeReflashTask::NgpCartridgeReflashTask(QWidget* parent, cartridge* cart, int slot)
+  : NgpCartridgeFlashTask(parent, cart, slot)
+{
+  // Nothing else to do
+}
+
+NgpCartridgeReflashTask::~NgpCartridgeReflashTask()
+{
+  // Nothing else to do
+}
+
+
+
+void NgpCartridgeReflashTask::write_image()
+{
+  if (m_slot == -1)
+  {
+    setProgressLabel(QString("Upgrading game on entire cartridge, keeping save data"));
+  }
+  else
+  {
+    setProgressLabel(QString("Upgrading game in slot ") + QString::number(m_slot+1) + QString(", keeping save data"));
+  }
+  
+  run_in_background([&]
+  {
+    // Keep the device open from backing up the save to restoring it
+    linkmasta_device* linkmasta = FlashMastaApp::getInstance()->getDeviceManager()->get_linkmasta_device(m_device_id);
+    linkmasta_device::session session(linkmasta);
+    
+    m_cartridge->reflash_cartridge_game_data(m_image->data(), m_image->size(), (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), controller());
+  });
+}
@@ -0,0 +1,18 @@
+#ifndef __NGP_CARTRIDGE_REFLASH_TASK_H__
+#define __NGP_CARTRIDGE_REFLASH_TASK_H__
+
+#include "ngp_cartridge_flash_task.h"
+
+// Flashes a game the same way as NgpCartridgeFlashTask while keeping the
+// save that's on the cartridge, in one pass over a single device session
+class NgpCartridgeReflashTask: public NgpCartridgeFlashTask
+{
+public:
+  explicit NgpCartridgeReflashTask(QWidget* parent, cartridge* cart, int slot = -1);
+  ~NgpCartridgeReflashTask();
+  
+protected:
+  void write_image();
+};
+
+#endif // __NGP_CARTRIDGE_REFLASH_TASK_H__
@@ -52,7 +52,10 @@ void NgpCartridgeRestoreSaveTask::run_task()
   // Begin task
   try
   {
-    m_cartridge->restore_cartridge_save_data(*m_fin, (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), this);
+    run_in_background([&]
+    {
+      m_cartridge->restore_cartridge_save_data(*m_fin, (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), controller());
+    });
   }
   catch (std::exception& ex)
   {
@@ -50,7 +50,13 @@ void NgpCartridgeVerifySaveTask::run_task()
   // Begin task
   try
   {
-    if (m_cartridge->compare_cartridge_save_data(*m_fin, (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), this) && !is_task_cancelled())
+    bool matched = false;
+    run_in_background([&]
+    {
+      matched = m_cartridge->compare_cartridge_save_data(*m_fin, (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), controller());
+    });
+    
+    if (matched && !is_task_cancelled())
     {
       QMessageBox msgBox;
       msgBox.setText("Cartridge and file match.");
@@ -1,8 +1,9 @@
 #include "ngp_cartridge_verify_task.h"
 #include <QFileDialog>
 #include <QMessageBox>
-#include <fstream>
 #include "cartridge/cartridge.h"
+#include "cartridge/digest_manifest.h"
+#include "cartridge/image_cache.h"
 #include "../flash_masta_app.h"
 #include "game/game_catalog.h"
 
@@ -36,9 +37,6 @@ void NgpCartridgeVerifyTask::run_task()
                                     "Would you like to verify the entire cartridge instead?",
                                     QMessageBox::No|QMessageBox::Yes, QMessageBox::Yes);
       
-      delete curr_game;
-      delete othr_game;
-      
       switch (reply)
       {
       case QMessageBox::Yes:
@@ -64,15 +62,24 @@ void NgpCartridgeVerifyTask::run_task()
     return;
   }
   
-  // Initialize inputfile
-  m_fin = new std::ifstream(filename.toStdString().c_str(), std::ios::binary);
-  if (!m_fin->is_open())
+  // Compare against the digest manifest stored next to the file if there is
+  // one so the file itself never needs to be read. Otherwise use the manifest
+  // of the cached image, sharing it with any other job using the same file.
+  m_manifest = digest_manifest::load_for(filename.toStdString());
+  if (m_manifest == nullptr)
   {
-    delete m_fin;
-    QMessageBox msgBox;
-    msgBox.setText("Unable to open file");
-    msgBox.exec();
-    return;
+    try
+    {
+      m_image = FlashMastaApp::getInstance()->getImageCache()->get(filename.toStdString());
+      m_manifest = m_image->manifest();
+    }
+    catch (std::exception& ex)
+    {
+      QMessageBox msgBox;
+      msgBox.setText(QString("Unable to open file: ") + ex.what());
+      msgBox.exec();
+      return;
+    }
   }
   
   if (m_slot == -1)
@@ -87,7 +94,13 @@ void NgpCartridgeVerifyTask::run_task()
   // Begin task
   try
   {
-    if (m_cartridge->compare_cartridge_game_data(*m_fin, (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), this) && !is_task_cancelled())
+    bool matched = false;
+    run_in_background([&]
+    {
+      matched = m_cartridge->compare_cartridge_game_data(*m_manifest, (m_slot == -1 ? cartridge::SLOT_ALL : m_slot), controller());
+    });
+    
+    if (matched && !is_task_cancelled())
     {
       QMessageBox msgBox;
       msgBox.setText("Cartridge and file match.");
@@ -103,12 +116,12 @@ void NgpCartridgeVerifyTask::run_task()
   catch (std::exception& ex)
   {
     (void) ex;
-    m_fin->close();
-    delete m_fin;
+    m_manifest.reset();
+    m_image.reset();
     throw;
   }
   
   // Cleanup
-  m_fin->close();
-  delete m_fin;
+  m_manifest.reset();
+  m_image.reset();
 }
@@ -43,7 +43,10 @@ void WsCartridgeBackupSaveTask::run_task()
   // Begin task
   try
   {
-    m_cartridge->backup_cartridge_save_data(*m_fout, m_slot, this);
+    run_in_background([&]
+    {
+      m_cartridge->backup_cartridge_save_data(*m_fout, m_slot, controller());
+    });
   }
   catch (std::exception& ex)
   {
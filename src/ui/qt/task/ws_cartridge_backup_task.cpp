@@ -43,7 +43,10 @@ void WsCartridgeBackupTask::run_task()
   // Begin task
   try
   {
-    m_cartridge->backup_cartridge_game_data(*m_fout, m_slot, this);
+    run_in_background([&]
+    {
+      m_cartridge->backup_cartridge_game_data(*m_fout, m_slot, controller());
+    });
   }
   catch (std::exception& ex)
   {
@@ -1,8 +1,10 @@
 #include "ws_cartridge_flash_task.h"
 #include <QFileDialog>
 #include <QMessageBox>
-#include <fstream>
 #include "cartridge/cartridge.h"
+#include "cartridge/image_cache.h"
+#include "../flash_masta_app.h"
+#include "game/game_catalog.h"
 
 WsCartridgeFlashTask::WsCartridgeFlashTask(QWidget* parent, cartridge* cart, int slot)
   : WsCartridgeTask(parent, cart, slot)
@@ -29,29 +31,57 @@ void WsCartridgeFlashTask::run_task()
     return;
   }
   
-  // Initialize inputfile
-  m_fin = new std::ifstream(filename.toStdString().c_str(), std::ios::binary);
-  if (!m_fin->is_open())
+  // Check which game the file holds before loading all of it
+  const game_descriptor* game = FlashMastaApp::getInstance()->getWonderswanGameCatalog()->identify_image(filename.toStdString());
+  if (game == nullptr)
+  {
+    QMessageBox::StandardButton reply;
+    reply = QMessageBox::question((QWidget*) parent(), "Unknown Game",
+                                  "The selected file is not a known WonderSwan game. "
+                                  "Flash it anyway?",
+                                  QMessageBox::Cancel|QMessageBox::Ok, QMessageBox::Ok);
+    
+    switch (reply)
+    {
+    case QMessageBox::Ok:
+      // User's ok with it, so we continue
+      break;
+    
+    case QMessageBox::Cancel:
+    default:
+      // User decides to cancel, so we cancel
+      return;
+    }
+  }
+  QString source = (game == nullptr ? QString("data from file") : QString(game->name));
+  
+  // Load the image, sharing it with any other job flashing the same file
+  try
+  {
+    m_image = FlashMastaApp::getInstance()->getImageCache()->get(filename.toStdString());
+  }
+  catch (std::exception& ex)
   {
-    delete m_fin;
     QMessageBox msgBox;
-    msgBox.setText("Unable to open file");
+    msgBox.setText(QString("Unable to open file: ") + ex.what());
     msgBox.exec();
     return;
   }
   
-  set_progress_label("Writing data to cartridge");
+  set_progress_label(QString("Writing ") + source + " to cartridge");
   
   // Begin task
   try
   {
-    m_cartridge->restore_cartridge_game_data(*m_fin, m_slot, this);
+    run_in_background([&]
+    {
+      m_cartridge->restore_cartridge_game_data(m_image->data(), m_image->size(), m_slot, controller());
+    });
   }
   catch (std::exception& ex)
   {
     (void) ex;
-    m_fin->close();
-    delete m_fin;
+    m_image.reset();
     
     if (is_task_cancelled())
     {
@@ -70,6 +100,5 @@ void WsCartridgeFlashTask::run_task()
   }
   
   // Cleanup
-  m_fin->close();
-  delete m_fin;
+  m_image.reset();
 }
@@ -2,7 +2,8 @@
 #define __WS_CARTRIDGE_FLASH_TASK_H__
 
 #include "ws_cartridge_task.h"
-#include <iosfwd>
+#include <memory>
+#include "cartridge/image_cache.h"
 
 class WsCartridgeFlashTask: public WsCartridgeTask
 {
@@ -14,7 +15,7 @@ protected:
   void run_task();
   
 private:
-  std::ifstream* m_fin;
+  std::shared_ptr<const image_cache::image> m_image;
 };
 
 #endif // __WS_CARTRIDGE_FLASH_TASK_H__
@@ -45,7 +45,10 @@ void WsCartridgeRestoreSaveTask::run_task()
   // Begin task
   try
   {
-    m_cartridge->restore_cartridge_save_data(*m_fin, m_slot, this);
+    run_in_background([&]
+    {
+      m_cartridge->restore_cartridge_save_data(*m_fin, m_slot, controller());
+    });
   }
   catch (std::exception& ex)
   {
@@ -1,10 +1,16 @@
 #include "ws_cartridge_task.h"
 #include <QMessageBox>
 #include <QProgressDialog>
-#include <QApplication>
+#include <QEventLoop>
 #include <fstream>
 #include <limits>
 #include "cartridge/ws_cartridge.h"
+#include "task/throttled_task_controller.h"
+#include "../worker/cartridge_task_worker.h"
+#include "../worker/worker_pool.h"
+#include "../flash_masta_app.h"
+#include "../main_window.h"
+#include "../device_list_model.h"
 #include "usb/libusb_usb_device.h"
 #include "linkmasta/ws_linkmasta_device.h"
 #include "libusb-1.0/libusb.h"
@@ -13,14 +19,19 @@ using namespace usb;
 
 WsCartridgeTask::WsCartridgeTask(QWidget *parent, cartridge* cart, int slot) 
   : QObject(parent), task_controller(), m_cartridge(cart), m_slot(slot),
-    m_mutex(new std::mutex()), m_progress(nullptr), m_progress_label()
+    m_device_id(FlashMastaApp::getInstance()->getSelectedDevice()),
+    m_controller(new throttled_task_controller(this)),
+    m_progress(nullptr), m_progress_label(), m_work_expected(0)
 {
-  // Nothing else to do
+  // Progress is reported from the worker thread, so the dialog is only ever
+  // touched through queued signals
+  connect(this, SIGNAL(taskStarted(int)), this, SLOT(startProgress(int)));
+  connect(this, SIGNAL(taskProgressChanged(int)), this, SLOT(updateProgress(int)));
 }
 
 WsCartridgeTask::~WsCartridgeTask()
 {
-  delete m_mutex;
+  delete m_controller;
 }
 
 void WsCartridgeTask::go()
@@ -48,50 +59,73 @@ void WsCartridgeTask::go()
   {
     m_progress->close();
     delete m_progress;
+    m_progress = nullptr;
   }
+  DeviceListModel* devices = FlashMastaApp::getInstance()->getMainWindow()->getDeviceListModel();
+  devices->clearDeviceActivity(m_device_id);
+  devices->setDeviceTask(m_device_id, nullptr);
 }
 
 
 
 void WsCartridgeTask::on_task_start(int work_expected)
 {
-  m_mutex->lock();
   task_controller::on_task_start(work_expected);
-  
-  // Create progress bar
-  m_progress = new QProgressDialog(m_progress_label, "Cancel", 0, get_task_expected_work(), (QWidget*) this->parent());
-  m_progress->setAutoClose(false);
-  m_progress->setAutoReset(false);
-  m_progress->setWindowModality(Qt::WindowModal);
-  m_progress->setMinimumDuration(0);
-  m_mutex->unlock();
+  emit taskStarted(work_expected);
 }
 
 void WsCartridgeTask::on_task_update(task_status status, int work_progress)
 {
-  m_mutex->lock();
   task_controller::on_task_update(status, work_progress);
-  m_progress->setValue(get_task_work_progress());
-  QApplication::processEvents();
-  m_mutex->unlock();
+  emit taskProgressChanged(get_task_work_progress());
 }
 
 void WsCartridgeTask::on_task_end(task_status status, int work_total)
 {
-  m_mutex->lock();
   task_controller::on_task_end(status, work_total);
-  m_mutex->unlock();
 }
 
-bool WsCartridgeTask::is_task_cancelled() const
+
+
+task_controller* WsCartridgeTask::controller()
 {
-  m_mutex->lock();
-  auto r = m_progress->wasCanceled();
-  m_mutex->unlock();
-  return r;
+  // Cartridges report progress for every packet, so updates are coalesced
+  // before they reach the progress dialog
+  return m_controller;
 }
 
-
+void WsCartridgeTask::run_in_background(std::function<void()> operation)
+{
+  // Create progress bar. Its range is set once the operation reports how much
+  // work it expects to do.
+  if (m_progress == nullptr)
+  {
+    m_progress = new QProgressDialog(m_progress_label, "Cancel", 0, 0, (QWidget*) this->parent());
+    m_progress->setAutoClose(false);
+    m_progress->setAutoReset(false);
+    m_progress->setWindowModality(Qt::WindowModal);
+    m_progress->setMinimumDuration(0);
+    connect(m_progress, SIGNAL(canceled()), this, SLOT(cancelTask()));
+  }
+  
+  // Run the operation on the shared pool so that it never waits on the UI,
+  // and keep handling events here until it's done
+  CartridgeTaskWorker* worker = new CartridgeTaskWorker(operation);
+  
+  QEventLoop loop;
+  connect(worker, SIGNAL(finished()), &loop, SLOT(quit()), Qt::QueuedConnection);
+  FlashMastaApp::getInstance()->getWorkerPool()->submit([worker] { worker->run(); });
+  loop.exec();
+  
+  std::exception_ptr error = worker->error();
+  delete worker;
+  
+  m_progress->close();
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+}
 
 QString WsCartridgeTask::get_progress_label() const
 {
@@ -102,3 +136,52 @@ void WsCartridgeTask::set_progress_label(QString label)
 {
   m_progress_label = label;
 }
+
+
+
+void WsCartridgeTask::startProgress(int work_expected)
+{
+  m_work_expected = work_expected;
+  if (m_progress != nullptr)
+  {
+    m_progress->setMaximum(work_expected);
+  }
+  DeviceListModel* devices = FlashMastaApp::getInstance()->getMainWindow()->getDeviceListModel();
+  devices->setDeviceActivity(m_device_id, m_progress_label, 0.0);
+  devices->setDeviceTask(m_device_id, this);
+}
+
+void WsCartridgeTask::updateProgress(int work_progress)
+{
+  // Mirror the progress in the device list so it shows while the dialog is
+  // out of sight
+  if (m_work_expected > 0)
+  {
+    FlashMastaApp::getInstance()->getMainWindow()->getDeviceListModel()->setDeviceActivity(m_device_id, m_progress_label, (double) work_progress / m_work_expected);
+  }
+  
+  if (m_progress != nullptr)
+  {
+    m_progress->setValue(work_progress);
+    
+    // Show the real throughput and how long is left once there's a measure
+    double rate = get_task_smoothed_work_rate();
+    double remaining = get_task_seconds_remaining();
+    QString label = m_progress_label;
+    if (rate > 0.0)
+    {
+      label += QString("\n%1 KiB/s").arg(rate / 1024.0, 0, 'f', 1);
+    }
+    if (remaining >= 0.0)
+    {
+      int seconds = (int) (remaining + 0.5);
+      label += QString(", %1:%2 remaining").arg(seconds / 60).arg(seconds % 60, 2, 10, QChar('0'));
+    }
+    m_progress->setLabelText(label);
+  }
+}
+
+void WsCartridgeTask::cancelTask()
+{
+  cancel_task();
+}
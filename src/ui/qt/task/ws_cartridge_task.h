@@ -2,11 +2,12 @@
 #define __WS_CARTRIDGE_TASK_H__
 
 #include <QObject>
-#include <mutex>
+#include <functional>
 #include "task/task_controller.h"
 #include "usb/usbfwd.h"
 
 class cartridge;
+class throttled_task_controller;
 class QProgressDialog;
 class linkmasta_device;
 struct libusb_context;
@@ -25,21 +26,33 @@ public:
   virtual void          on_task_start(int work_expected);
   virtual void          on_task_update(task_status status, int work_progress);
   virtual void          on_task_end(task_status status, int work_total);
-  virtual bool          is_task_cancelled() const;
+  
+signals:
+  void                  taskStarted(int work_expected);
+  void                  taskProgressChanged(int work_progress);
   
 protected:
   virtual void          run_task() = 0;
+  task_controller*      controller();
+  void                  run_in_background(std::function<void()> operation);
   virtual QString       get_progress_label() const;
   virtual void          set_progress_label(QString label);
   
 protected:
   cartridge*            m_cartridge;
   int                   m_slot;
+  int                   m_device_id;
+  
+private slots:
+  void                  startProgress(int work_expected);
+  void                  updateProgress(int work_progress);
+  void                  cancelTask();
   
 private:
-  std::mutex*           m_mutex;
+  throttled_task_controller* m_controller;
   QProgressDialog*      m_progress;
   QString               m_progress_label;
+  int                   m_work_expected;
 };
 
 #endif // __WS_CARTRIDGE_TASK_H__
@@ -43,7 +43,13 @@ void WsCartridgeVerifySaveTask::run_task()
   // Begin task
   try
   {
-    if (m_cartridge->compare_cartridge_save_data(*m_fin, m_slot, this) && !is_task_cancelled())
+    bool matched = false;
+    run_in_background([&]
+    {
+      matched = m_cartridge->compare_cartridge_save_data(*m_fin, m_slot, controller());
+    });
+    
+    if (matched && !is_task_cancelled())
     {
       QMessageBox msgBox;
       msgBox.setText("Cartridge and file match.");
@@ -2,7 +2,8 @@
 #define __WS_CARTRIDGE_VERIFY_TASK_H__
 
 #include "ws_cartridge_task.h"
-#include <iosfwd>
+#include <memory>
+#include "cartridge/image_cache.h"
 
 class WsCartridgeVerifyTask : public WsCartridgeTask
 {
@@ -14,7 +15,8 @@ protected:
   void run_task();
   
 private:
-  std::ifstream* m_fin;
+  std::shared_ptr<const image_cache::image> m_image;
+  std::shared_ptr<const digest_manifest> m_manifest;
 };
 
 #endif // __WS_CARTRIDGE_VERIFY_TASK_H__
@@ -0,0 +1,29 @@
+#include "cartridge_task_worker.h"
+
+CartridgeTaskWorker::CartridgeTaskWorker(std::function<void()> operation, QObject *parent) :
+  QObject(parent), m_operation(operation), m_error()
+{
+  // Nothing else to do
+}
+
+
+
+std::exception_ptr CartridgeTaskWorker::error() const
+{
+  return m_error;
+}
+
+void CartridgeTaskWorker::run()
+{
+  // Hold on to any error so it can be rethrown on the thread that's waiting
+  try
+  {
+    m_operation();
+  }
+  catch (...)
+  {
+    m_error = std::current_exception();
+  }
+  
+  emit finished();
+}
@@ -0,0 +1,27 @@
+#ifndef __CARTRIDGE_TASK_WORKER_H__
+#define __CARTRIDGE_TASK_WORKER_H__
+
+#include <QObject>
+#include <exception>
+#include <functional>
+
+class CartridgeTaskWorker : public QObject
+{
+  Q_OBJECT
+public:
+  explicit CartridgeTaskWorker(std::function<void()> operation, QObject *parent = 0);
+  
+  std::exception_ptr error() const;
+  
+public slots:
+  void run();
+  
+signals:
+  void finished();
+  
+private:
+  std::function<void()> m_operation;
+  std::exception_ptr m_error;
+};
+
+#endif // __CARTRIDGE_TASK_WORKER_H__
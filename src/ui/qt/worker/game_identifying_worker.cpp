@@ -0,0 +1,134 @@
+#include "game_identifying_worker.h"
+
+#include "../flash_masta_app.h"
+#include "linkmasta/device_manager.h"
+#include "linkmasta/device_multiplexer.h"
+#include "cartridge/cartridge.h"
+#include "game/game_catalog.h"
+#include "game/game_identification_cache.h"
+
+GameIdentifyingWorker::GameIdentifyingWorker(unsigned int device_id, std::shared_ptr<cartridge> cart, QObject *parent) :
+  QObject(parent), m_device_id(device_id), m_cartridge(cart), m_cancelled(false)
+{
+  // Nothing else to do
+}
+
+
+
+bool GameIdentifyingWorker::identifyFromCache(cartridge* cart, std::vector<const game_descriptor*>& descriptors)
+{
+  // Don't hold up the caller while the catalogs are still loading; a worker
+  // will wait for them instead
+  if (!FlashMastaApp::getInstance()->catalogsReady()) return false;
+  return identify(cart, descriptors, true);
+}
+
+bool GameIdentifyingWorker::identify(cartridge* cart, std::vector<const game_descriptor*>& descriptors, bool cached_only)
+{
+  game_identification_cache* cache = FlashMastaApp::getInstance()->getGameIdentificationCache();
+  game_catalog* catalog = nullptr;
+  switch (cart->system())
+  {
+  case SYSTEM_NEO_GEO_POCKET:
+    catalog = FlashMastaApp::getInstance()->getNeoGeoGameCatalog();
+    break;
+  case SYSTEM_WONDERSWAN:
+    catalog = FlashMastaApp::getInstance()->getWonderswanGameCatalog();
+    break;
+  default:
+    break;
+  }
+  
+  // Official cartridges hold a single game, Flash Masta cartridges one per slot
+  descriptors.assign(cart->type() == CARTRIDGE_FLASHMASTA ? cart->num_slots() + 1 : 1, nullptr);
+  if (catalog == nullptr)
+  {
+    return true;
+  }
+  
+  std::vector<int> slots;
+  std::vector<unsigned int> indices;
+  for (unsigned int i = 0; i < descriptors.size(); ++i)
+  {
+    int slot = (int) i - 1;
+    if (slot == -1 && cart->type() != CARTRIDGE_OFFICIAL)
+    {
+      continue;
+    }
+    
+    if (cached_only)
+    {
+      if (!cache->lookup(cart, slot, &descriptors[i])) return false;
+    }
+    else
+    {
+      slots.push_back(slot);
+      indices.push_back(i);
+    }
+  }
+  
+  // Every slot of a multi-game cartridge is identified in one lookup
+  if (!slots.empty())
+  {
+    std::vector<const game_descriptor*> found;
+    cache->identify_games(catalog, cart, slots, found);
+    for (unsigned int i = 0; i < indices.size(); ++i)
+    {
+      descriptors[indices[i]] = found[i];
+    }
+  }
+  return true;
+}
+
+void GameIdentifyingWorker::run()
+{
+  bool cancel = false;
+  std::vector<const game_descriptor*> descriptors;
+  
+  // Let the catalogs load before taking the device's turn, so that other
+  // requests to it aren't held up meanwhile
+  FlashMastaApp::getInstance()->getNeoGeoGameCatalog();
+  FlashMastaApp::getInstance()->getWonderswanGameCatalog();
+  
+  try
+  {
+    FlashMastaApp::getInstance()->getDeviceMultiplexer()->submit(m_device_id, [this, &descriptors](linkmasta_device* linkmasta)
+    {
+      (void) linkmasta;
+      bool cancel = false;
+      m_mutex.lock();
+      if (m_cancelled) cancel = true;
+      m_mutex.unlock();
+      
+      if (!cancel)
+      {
+        identify(m_cartridge.get(), descriptors, false);
+      }
+    }).get();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // Leave the games unidentified
+    descriptors.assign(m_cartridge->type() == CARTRIDGE_FLASHMASTA ? m_cartridge->num_slots() + 1 : 1, nullptr);
+  }
+  
+  m_mutex.lock();
+  if (m_cancelled) cancel = true;
+  m_mutex.unlock();
+  
+  // Whoever cancelled no longer wants the cartridge
+  if (cancel)
+  {
+    m_cartridge.reset();
+  }
+  
+  emit finished(descriptors);
+}
+
+void GameIdentifyingWorker::cancel()
+{
+  m_mutex.lock();
+  m_cancelled = true;
+  m_mutex.unlock();
+}
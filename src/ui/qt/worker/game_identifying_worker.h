@@ -0,0 +1,40 @@
+#ifndef __GAME_IDENTIFYING_WORKER_H__
+#define __GAME_IDENTIFYING_WORKER_H__
+
+#include <QObject>
+#include <QMutex>
+#include <memory>
+#include <vector>
+
+class cartridge;
+struct game_descriptor;
+
+class GameIdentifyingWorker : public QObject
+{
+  Q_OBJECT
+public:
+  explicit GameIdentifyingWorker(unsigned int device_id, std::shared_ptr<cartridge> cart, QObject *parent = 0);
+  
+  // Fills in the descriptors if every game on the cartridge was identified
+  // recently, so that callers can skip starting a worker
+  static bool identifyFromCache(cartridge* cart, std::vector<const game_descriptor*>& descriptors);
+  
+public slots:
+  void run();
+  void cancel();
+  
+signals:
+  // The first descriptor is for the whole cartridge and the rest for each of
+  // its slots, if it has more than one
+  void finished(std::vector<const game_descriptor*> descriptors);
+  
+private:
+  static bool identify(cartridge* cart, std::vector<const game_descriptor*>& descriptors, bool cached_only);
+  
+  unsigned int m_device_id;
+  std::shared_ptr<cartridge> m_cartridge;
+  QMutex m_mutex;
+  bool m_cancelled;
+};
+
+#endif // __GAME_IDENTIFYING_WORKER_H__
@@ -2,10 +2,12 @@
 
 #include "../flash_masta_app.h"
 #include "linkmasta/device_manager.h"
+#include "linkmasta/device_multiplexer.h"
 #include "cartridge/cartridge.h"
 #include "cartridge/ngp_cartridge.h"
 #include "cartridge/ws_cartridge.h"
 #include "linkmasta/linkmasta_device.h"
+#include <memory>
 
 LmCartridgeFetchingWorker::LmCartridgeFetchingWorker(unsigned int device_id, QObject *parent) :
   QObject(parent), m_device_id(device_id), m_cancelled(false)
@@ -19,40 +21,48 @@ void LmCartridgeFetchingWorker::run()
 {
   bool cancel = false;
   cartridge* cart = nullptr;
-  std::string game_name = "";
-  while (!FlashMastaApp::getInstance()->getDeviceManager()->try_claim_device(m_device_id));
+  std::vector<std::string> slot_names;
   
-  m_mutex.lock();
-  if (m_cancelled) cancel = true;
-  m_mutex.unlock();
-  
-  linkmasta_device* linkmasta;
-  
-  if (!cancel)
+  try
   {
-    linkmasta = FlashMastaApp::getInstance()->getDeviceManager()->get_linkmasta_device(m_device_id);
-    m_mutex.lock();
-    if (m_cancelled) cancel = true;
-    m_mutex.unlock();
+    cart = FlashMastaApp::getInstance()->getDeviceMultiplexer()->submit(m_device_id, [this, &slot_names](linkmasta_device* linkmasta) -> cartridge*
+    {
+      bool cancel = false;
+      std::unique_ptr<cartridge> cart;
+      
+      m_mutex.lock();
+      if (m_cancelled) cancel = true;
+      m_mutex.unlock();
+      
+      if (!cancel)
+      {
+        // Slot names are read from the same headers as the cartridge's metadata
+        linkmasta->set_cache_reads(true);
+        cart.reset(linkmasta->build_cartridge());
+        m_mutex.lock();
+        if (m_cancelled) cancel = true;
+        m_mutex.unlock();
+      }
+      
+      // Read every slot's name now so that showing the cartridge later doesn't
+      // need the device. Only Neo Geo slots show theirs.
+      for (unsigned int i = 0; !cancel && cart->system() == SYSTEM_NEO_GEO_POCKET && i < cart->num_slots(); ++i)
+      {
+        slot_names.push_back(cart->fetch_game_name((int) i));
+        m_mutex.lock();
+        if (m_cancelled) cancel = true;
+        m_mutex.unlock();
+      }
+      return cart.release();
+    }).get();
   }
-  
-  if (!cancel)
-  {
-    cart = linkmasta->build_cartridge();
-    m_mutex.lock();
-    if (m_cancelled) cancel = true;
-    m_mutex.unlock();
-  }
-  
-  if (!cancel)
+  catch (std::exception& ex)
   {
-    game_name = cart->fetch_game_name(0);
-    m_mutex.lock();
-    if (m_cancelled) cancel = true;
-    m_mutex.unlock();
+    (void) ex;
+    // The device went away or the cartridge couldn't be read
+    slot_names.clear();
   }
   
-  FlashMastaApp::getInstance()->getDeviceManager()->release_device(m_device_id);
   m_mutex.lock();
   if (m_cancelled) cancel = true;
   m_mutex.unlock();
@@ -63,7 +73,7 @@ void LmCartridgeFetchingWorker::run()
     cart = nullptr;
   }
   
-  emit finished(cart, game_name);
+  emit finished(cart, slot_names);
 }
 
 void LmCartridgeFetchingWorker::cancel()
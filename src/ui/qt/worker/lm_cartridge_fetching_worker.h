@@ -4,6 +4,7 @@
 #include <QObject>
 #include <QMutex>
 #include <string>
+#include <vector>
 
 class cartridge;
 
@@ -18,7 +19,7 @@ public slots:
   void cancel();
   
 signals:
-  void finished(cartridge* cart, std::string cartridge_game_name);
+  void finished(cartridge* cart, std::vector<std::string> slot_names);
   
 private:
   unsigned int m_device_id;
@@ -2,28 +2,59 @@
 
 #include "../flash_masta_app.h"
 #include "linkmasta/device_manager.h"
+#include "linkmasta/device_multiplexer.h"
 #include "cartridge/ngp_cartridge.h"
 #include "linkmasta/linkmasta_device.h"
+#include "worker_pool.h"
+#include <QThread>
+#include <string>
 
-const int LmCartridgePollingWorker::INTERVAL = 2000; // 1k milliseconds = 1 second
+// Merge key of the full test confirming a change the probe saw
+#define POLL_TEST_KEY "presence-test"
+
+const int LmCartridgePollingWorker::WATCHED_INTERVAL = 2000; // 1k milliseconds = 1 second
+const int LmCartridgePollingWorker::IDLE_INTERVAL = 15000;
+
+// What the full test of a poll found
+struct poll_test
+{
+  bool ok;
+  bool connected;
+  std::string fingerprint;
+  
+  poll_test() : ok(false), connected(false) {}
+};
 
 LmCartridgePollingWorker::LmCartridgePollingWorker(unsigned int id, QObject *parent) :
   QObject(parent),
-  m_id(id), m_device_connected(false), m_running(false), m_timer(this)
+  m_id(id), m_device_connected(false), m_running(false), m_watched(false),
+  m_polling(false),
+  m_timer(this)
 {
   // Nothing else to do
 }
 
+LmCartridgePollingWorker::~LmCartridgePollingWorker()
+{
+  stop();
+  
+  // Let a poll that's already on the pool finish with this object
+  while (m_polling)
+  {
+    QThread::msleep(1);
+  }
+}
+
 
 
 void LmCartridgePollingWorker::start()
 {
   // Configure the timer to trigger periodically
-  m_timer.setInterval(INTERVAL);
+  m_timer.setInterval(m_watched ? WATCHED_INTERVAL : IDLE_INTERVAL);
   m_timer.setSingleShot(false);
   
   // Connect all our slots
-  connect(&m_timer, SIGNAL(timeout()), this, SLOT(run()));
+  connect(&m_timer, SIGNAL(timeout()), this, SLOT(poll()));
   
   // Let's get this party started
   m_timer.start();
@@ -34,49 +65,105 @@ void LmCartridgePollingWorker::stop()
   m_timer.stop();
 }
 
-void LmCartridgePollingWorker::run()
+void LmCartridgePollingWorker::setWatched(bool watched)
 {
-  if (!FlashMastaApp::getInstance()->getDeviceManager()->try_claim_device(m_id))
+  if (m_watched == watched) return;
+  m_watched = watched;
+  m_timer.setInterval(m_watched ? WATCHED_INTERVAL : IDLE_INTERVAL);
+  
+  // A device that was idle may not have been polled for a while
+  if (m_watched && m_timer.isActive())
+  {
+    poll();
+  }
+}
+
+void LmCartridgePollingWorker::poll()
+{
+  // A job only runs on a cartridge that's there, and whatever it does to the
+  // cartridge is refreshed once it's done, so leave the device alone
+  if (FlashMastaApp::getInstance()->getDeviceMultiplexer()->is_job_running(m_id))
   {
-    // Do nothing
     return;
   }
   
-  // This function simply tests if a cartridge was connected or disconnected
-  linkmasta_device* linkmasta = FlashMastaApp::getInstance()->getDeviceManager()->get_linkmasta_device(m_id);
-  bool device_connected;
+  // Skip this poll if the last one is still waiting for its turn
+  if (m_polling.exchange(true))
+  {
+    return;
+  }
+  
+  FlashMastaApp::getInstance()->getWorkerPool()->submit([this]
+  {
+    run();
+    m_polling = false;
+  });
+}
+
+void LmCartridgePollingWorker::run()
+{
+  device_multiplexer* multiplexer = FlashMastaApp::getInstance()->getDeviceMultiplexer();
+  poll_test poll;
   
   try
   {
-    device_connected = linkmasta->test_for_cartridge();
+    // Poll with the cheap probe, and only probe fully when it sees a change.
+    // A device that keeps failing, such as one being unplugged, fails here on
+    // every poll, so failures are returned rather than thrown. While a job
+    // runs on the device, the probe is answered without asking it
+    usb::result<bool> probed = multiplexer->probe_for_cartridge(m_id).get();
+    if (!probed || probed.value() == m_device_connected)
+    {
+      // No change or failed; do nothing
+      return;
+    }
+    
+    bool was_connected = m_device_connected;
+    poll = multiplexer->submit(m_id, [was_connected](linkmasta_device* linkmasta) -> poll_test
+    {
+      poll_test result;
+      usb::result<bool> connected = linkmasta->try_test_for_cartridge();
+      result.ok = (bool) connected;
+      result.connected = (connected && connected.value());
+      
+      // Lets a cartridge that was only reseated be recognized without
+      // probing it again
+      if (result.connected && !was_connected)
+      {
+        try
+        {
+          result.fingerprint = linkmasta->fingerprint_cartridge();
+        }
+        catch (std::exception& ex)
+        {
+          (void) ex;
+          // Treat it as a cartridge never seen before
+        }
+      }
+      return result;
+    }, POLL_TEST_KEY).get();
   }
-  catch (std::runtime_error& ex)
+  catch (std::exception& ex)
   {
     (void) ex;
-    // Do nothing; fail quietly
-    FlashMastaApp::getInstance()->getDeviceManager()->release_device(m_id);
+    // Claiming or opening the device failed; fail quietly
     return;
   }
   
-  // Must release device when done using it so as to not block other functions
-  FlashMastaApp::getInstance()->getDeviceManager()->release_device(m_id);
-  
-  if (m_device_connected == device_connected)
+  if (!poll.ok || m_device_connected == poll.connected)
   {
     // No change; do nothing
     return;
   }
   
-  m_device_connected = device_connected;
+  m_device_connected = poll.connected;
   
   if (m_device_connected)
   {
-    emit cartridgeInserted();
+    emit cartridgeInserted(m_id, QString(poll.fingerprint.c_str()));
   }
   else
   {
-    emit cartridgeRemoved();
+    emit cartridgeRemoved(m_id);
   }
 }
-
-
@@ -2,30 +2,45 @@
 #define __LM_CARTRIDGE_POLLING_WORKER_H__
 
 #include <QObject>
+#include <QString>
 #include <QTimer>
+#include <atomic>
 
 class LmCartridgePollingWorker : public QObject
 {
   Q_OBJECT
 public:
   explicit LmCartridgePollingWorker(unsigned int id, QObject *parent = 0);
+  ~LmCartridgePollingWorker();
   
 private:
-  static const int INTERVAL;
+  // Devices shown in the UI are polled often, the rest only now and then
+  static const int WATCHED_INTERVAL;
+  static const int IDLE_INTERVAL;
   
 public slots:
   void start();
   void stop();
+  void poll();
+  
+  // Whether the UI is showing the device, so that a change to its cartridge
+  // should show up quickly
+  void setWatched(bool watched);
+  
+private:
   void run();
   
 signals:
-  void cartridgeInserted();
-  void cartridgeRemoved();
+  // The fingerprint is empty if the cartridge can't be told apart from others
+  void cartridgeInserted(unsigned int device_id, QString fingerprint);
+  void cartridgeRemoved(unsigned int device_id);
   
 private:
   unsigned int m_id;
   bool m_device_connected;
   bool m_running;
+  bool m_watched;
+  std::atomic<bool> m_polling;
   
   QTimer m_timer;
 };
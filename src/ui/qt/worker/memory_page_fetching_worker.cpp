@@ -0,0 +1,56 @@
+#include "memory_page_fetching_worker.h"
+
+#include "../flash_masta_app.h"
+#include "linkmasta/device_manager.h"
+#include "linkmasta/device_multiplexer.h"
+#include "cartridge/cartridge.h"
+#include "cartridge/cartridge_memory_view.h"
+
+MemoryPageFetchingWorker::MemoryPageFetchingWorker(unsigned int device_id, std::shared_ptr<cartridge> cart, std::shared_ptr<cartridge_memory_view> view, QObject *parent) :
+  QObject(parent), m_device_id(device_id), m_cartridge(cart), m_view(view), m_cancelled(false)
+{
+  // Nothing else to do
+}
+
+
+
+void MemoryPageFetchingWorker::run()
+{
+  bool cancel = false;
+  QString error;
+  
+  while (!cancel)
+  {
+    // One page per request, so that others get their turn in between
+    bool fetched = false;
+    try
+    {
+      std::shared_ptr<cartridge_memory_view> view = m_view;
+      fetched = FlashMastaApp::getInstance()->getDeviceMultiplexer()->submit(m_device_id, [view](linkmasta_device* linkmasta)
+      {
+        (void) linkmasta;
+        return view->fetch_next();
+      }).get();
+    }
+    catch (std::exception& ex)
+    {
+      error = ex.what();
+    }
+    
+    if (!fetched) break;
+    emit pageFetched();
+    
+    m_mutex.lock();
+    if (m_cancelled) cancel = true;
+    m_mutex.unlock();
+  }
+  
+  emit finished(error);
+}
+
+void MemoryPageFetchingWorker::cancel()
+{
+  m_mutex.lock();
+  m_cancelled = true;
+  m_mutex.unlock();
+}
@@ -0,0 +1,39 @@
+#ifndef __MEMORY_PAGE_FETCHING_WORKER_H__
+#define __MEMORY_PAGE_FETCHING_WORKER_H__
+
+#include <QObject>
+#include <QMutex>
+#include <QString>
+#include <memory>
+
+class cartridge;
+class cartridge_memory_view;
+
+// Reads the pages a memory view is waiting for, one at a time, until none are
+// left. The device is claimed for each page only, so that polling and other
+// background work keep going while the memory is browsed.
+class MemoryPageFetchingWorker : public QObject
+{
+  Q_OBJECT
+public:
+  explicit MemoryPageFetchingWorker(unsigned int device_id, std::shared_ptr<cartridge> cart, std::shared_ptr<cartridge_memory_view> view, QObject *parent = 0);
+
+public slots:
+  void run();
+  void cancel();
+
+signals:
+  void pageFetched();
+  
+  // The error is empty unless a page could not be read
+  void finished(QString error);
+
+private:
+  unsigned int m_device_id;
+  std::shared_ptr<cartridge> m_cartridge;
+  std::shared_ptr<cartridge_memory_view> m_view;
+  QMutex m_mutex;
+  bool m_cancelled;
+};
+
+#endif // __MEMORY_PAGE_FETCHING_WORKER_H__
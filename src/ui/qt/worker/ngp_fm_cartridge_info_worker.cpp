@@ -31,7 +31,7 @@ void NgpFmCartridgeInfoWorker:run()
     DeviceManager* device_manager = FlashMasta::get_instance()->get_device_manager();
     if (device_manager->is_connected(m_id))
     {
-      while (!device_manager->claim_device(m_id));
+      device_manager->claim_device(m_id, CLAIM_TIMEOUT_INFINITE);
       
       cartridge = new ngp_cartridge(device_manager->get_linkmasta_device(m_id));
       cartridge->init();
@@ -0,0 +1,149 @@
+#include "worker_pool.h"
+
+#include <QRunnable>
+#include <QThread>
+#include <algorithm>
+
+const int WorkerPool::DEFAULT_MAX_USB_OPERATIONS = 4;
+
+namespace
+{
+
+class FunctionRunnable : public QRunnable
+{
+public:
+  explicit FunctionRunnable(std::function<void()> work) : m_work(work)
+  {
+    setAutoDelete(true);
+  }
+  
+  void run()
+  {
+    m_work();
+  }
+  
+private:
+  std::function<void()> m_work;
+};
+
+}
+
+WorkerPool::WorkerPool(QObject *parent) :
+  QObject(parent),
+  m_pool(), m_mutex(), m_max_usb_operations(DEFAULT_MAX_USB_OPERATIONS),
+  m_num_usb_operations(0), m_usb_queue()
+{
+  // Leave room for work that doesn't touch a device alongside the USB work
+  m_pool.setMaxThreadCount(std::max(QThread::idealThreadCount(), DEFAULT_MAX_USB_OPERATIONS + 2));
+}
+
+WorkerPool::~WorkerPool()
+{
+  waitForDone();
+}
+
+
+
+void WorkerPool::submit(std::function<void()> work, bool uses_usb)
+{
+  if (uses_usb)
+  {
+    QMutexLocker lock(&m_mutex);
+    if (m_num_usb_operations >= m_max_usb_operations)
+    {
+      m_usb_queue.push_back(work);
+      return;
+    }
+    ++m_num_usb_operations;
+  }
+  
+  start(work, uses_usb);
+}
+
+int WorkerPool::maxUsbOperations() const
+{
+  QMutexLocker lock(&m_mutex);
+  return m_max_usb_operations;
+}
+
+void WorkerPool::setMaxUsbOperations(int max_operations)
+{
+  std::deque<std::function<void()>> ready;
+  {
+    QMutexLocker lock(&m_mutex);
+    m_max_usb_operations = std::max(max_operations, 1);
+    m_pool.setMaxThreadCount(std::max(QThread::idealThreadCount(), m_max_usb_operations + 2));
+    
+    // A higher cap lets queued work start right away
+    while (!m_usb_queue.empty() && m_num_usb_operations < m_max_usb_operations)
+    {
+      ready.push_back(m_usb_queue.front());
+      m_usb_queue.pop_front();
+      ++m_num_usb_operations;
+    }
+  }
+  
+  for (std::function<void()>& work : ready)
+  {
+    start(work, true);
+  }
+}
+
+void WorkerPool::waitForDone()
+{
+  // USB work still queued is started as earlier work finishes, so keep
+  // waiting until the queue has drained as well
+  while (true)
+  {
+    m_pool.waitForDone();
+    
+    QMutexLocker lock(&m_mutex);
+    if (m_usb_queue.empty() && m_num_usb_operations == 0)
+    {
+      break;
+    }
+  }
+}
+
+
+
+void WorkerPool::start(std::function<void()> work, bool uses_usb)
+{
+  m_pool.start(new FunctionRunnable([this, work, uses_usb]
+  {
+    // Workers report their own errors; an escaping exception must not leave
+    // a place taken forever
+    try
+    {
+      work();
+    }
+    catch (...)
+    {
+      // Do nothing; fail quietly
+    }
+    
+    if (uses_usb)
+    {
+      usbOperationFinished();
+    }
+  }));
+}
+
+void WorkerPool::usbOperationFinished()
+{
+  std::function<void()> next;
+  {
+    QMutexLocker lock(&m_mutex);
+    if (m_usb_queue.empty() || m_num_usb_operations > m_max_usb_operations)
+    {
+      --m_num_usb_operations;
+      return;
+    }
+    
+    // Hand this operation's place straight to the next one waiting
+    next = m_usb_queue.front();
+    m_usb_queue.pop_front();
+  }
+  
+  start(next, true);
+}
@@ -0,0 +1,42 @@
+#ifndef __WORKER_POOL_H__
+#define __WORKER_POOL_H__
+
+#include <QObject>
+#include <QMutex>
+#include <QThreadPool>
+#include <deque>
+#include <functional>
+
+// Application-wide pool of threads that every background worker runs on, so
+// that threads are reused instead of created for each refresh, poll, and
+// task. Work that talks to a device counts against a cap on concurrent USB
+// operations, and waits in a queue of its own until a place is free so that
+// it never ties up a thread while waiting.
+class WorkerPool : public QObject
+{
+  Q_OBJECT
+public:
+  explicit WorkerPool(QObject *parent = 0);
+  ~WorkerPool();
+  
+  void submit(std::function<void()> work, bool uses_usb = true);
+  
+  int maxUsbOperations() const;
+  void setMaxUsbOperations(int max_operations);
+  
+  void waitForDone();
+  
+private:
+  void start(std::function<void()> work, bool uses_usb);
+  void usbOperationFinished();
+  
+  static const int DEFAULT_MAX_USB_OPERATIONS;
+  
+  QThreadPool m_pool;
+  mutable QMutex m_mutex;
+  int m_max_usb_operations;
+  int m_num_usb_operations;
+  std::deque<std::function<void()>> m_usb_queue;
+};
+
+#endif // __WORKER_POOL_H__
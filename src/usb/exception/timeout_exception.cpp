@@ -14,16 +14,17 @@
  */
 
 #include "timeout_exception.h"
+#include <sstream>
 
 namespace usb
 {
 
-std::ostringstream timeout_exception::m_stream;
-
 timeout_exception::timeout_exception(unsigned int timeout)
   : exception("operation exceeded timeout"), m_timeout(timeout)
 {
-  // Nothing else to do
+  std::ostringstream stream;
+  stream << exception::what() << ": " << m_timeout << " milliseconds";
+  m_message = stream.str();
 }
 
 timeout_exception::timeout_exception(const timeout_exception& other)
@@ -36,9 +37,7 @@ timeout_exception::timeout_exception(const timeout_exception& other)
 
 const char* timeout_exception::what() const throw()
 {
-  m_stream.str("");
-  m_stream << exception::what() << ": " << timeout() << " milliseconds";
-  return m_stream.str().c_str();
+  return m_message.c_str();
 }
 
 unsigned int timeout_exception::timeout() const throw()
@@ -16,7 +16,7 @@
 #define __USB_TIMEOUT_EXCEPTION_H__
 
 #include "exception.h"
-#include <sstream>
+#include <string>
 
 namespace usb
 {
@@ -93,10 +93,11 @@ private:
   unsigned int m_timeout;
   
   /*!
-   *  \brief A private output string stream used for building the exception
-   *         message provided by \ref what().
+   *  \brief The exception message provided by \ref what(), built once so
+   *         that the pointer returned stays valid for as long as the
+   *         exception does.
    */
-  static std::ostringstream m_stream;
+  std::string m_message;
 };
 
 }
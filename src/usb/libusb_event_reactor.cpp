@@ -0,0 +1,120 @@
+/*! \file
+ *  \brief File containing the implementation of
+ *         \ref usb::libusb_event_reactor.
+ *  
+ *  File containing the implementation of \ref usb::libusb_event_reactor.
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see usb::libusb_event_reactor
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "libusb_event_reactor.h"
+#include "common/io_thread.h"
+#include "libusb-1.0/libusb.h"
+
+// How often the event thread checks whether it has been told to exit, since
+// this version of Libusb can't interrupt a thread waiting for events
+#define EVENT_TIMEOUT_MS 500
+
+namespace usb
+{
+
+libusb_event_reactor::libusb_event_reactor(libusb_context* context)
+  : m_context(context), m_kill(false), m_running(false), m_high_priority(false),
+    m_cpu(-1), m_io_generation(0)
+{
+  // Nothing else to do
+}
+
+libusb_event_reactor::~libusb_event_reactor()
+{
+  stop();
+}
+
+
+
+void libusb_event_reactor::start()
+{
+  if (m_thread.joinable())
+  {
+    return;
+  }
+  
+  m_kill = false;
+  m_running = true;
+  m_thread = std::thread(&libusb_event_reactor::thread_function, this);
+}
+
+void libusb_event_reactor::stop()
+{
+  if (!m_thread.joinable())
+  {
+    return;
+  }
+  
+  m_kill = true;
+  m_thread.join();
+}
+
+bool libusb_event_reactor::is_running() const
+{
+  return m_running;
+}
+
+libusb_context* libusb_event_reactor::context() const
+{
+  return m_context;
+}
+
+void libusb_event_reactor::set_io_thread_options(bool high_priority, int cpu)
+{
+  std::lock_guard<std::mutex> lock(m_io_mutex);
+  m_high_priority = high_priority;
+  m_cpu = cpu;
+  ++m_io_generation;
+}
+
+
+
+void libusb_event_reactor::thread_function()
+{
+  // The thread is only touched once options have been set
+  unsigned int io_generation = 0;
+  
+  while (!m_kill)
+  {
+    bool configure = false;
+    bool high_priority = false;
+    int cpu = -1;
+    {
+      std::lock_guard<std::mutex> lock(m_io_mutex);
+      if (io_generation != m_io_generation)
+      {
+        configure = true;
+        high_priority = m_high_priority;
+        cpu = m_cpu;
+        io_generation = m_io_generation;
+      }
+    }
+    if (configure)
+    {
+      configure_io_thread(high_priority, cpu);
+    }
+    
+    timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = EVENT_TIMEOUT_MS * 1000;
+    libusb_handle_events_timeout(m_context, &timeout);
+  }
+  
+  // Anyone still waiting on a transfer has to handle events on their own now
+  m_running = false;
+}
+
+}
@@ -0,0 +1,133 @@
+/*! \file
+ *  \brief File containing the declaration of the
+ *         \ref usb::libusb_event_reactor class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref usb::libusb_event_reactor class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-18
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __LIBUSB_EVENT_REACTOR_H__
+#define __LIBUSB_EVENT_REACTOR_H__
+
+#include "usbfwd.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+struct libusb_context;
+
+namespace usb
+{
+
+/*! \class libusb_event_reactor
+ *  \brief Handles every Libusb event of a context from a single thread.
+ *  
+ *  Runs a single thread that handles all Libusb events of a context, so that
+ *  the transfers of every \ref libusb_usb_device using the reactor, along with
+ *  any hotplug callbacks registered on the context, complete on that one
+ *  thread. Devices waiting on a transfer then sleep until they are woken by
+ *  its completion instead of each taking turns running the event loop
+ *  themselves.
+ *  
+ *  \see libusb_usb_device::set_event_reactor(libusb_event_reactor* reactor)
+ */
+class libusb_event_reactor
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Does not start the event thread.
+   *  
+   *  \param [in] context The Libusb context whose events to handle. Must
+   *         outlive the reactor.
+   */
+  explicit                libusb_event_reactor(libusb_context* context);
+  
+  /*!
+   *  \brief Class destructor. Stops the event thread.
+   */
+                          ~libusb_event_reactor();
+  
+  
+  
+  /*!
+   *  \brief Starts the event thread. Does nothing if it is already running.
+   */
+  void                    start();
+  
+  /*!
+   *  \brief Stops the event thread and waits for it to exit.
+   *  
+   *  Devices that are still waiting on transfers go back to handling events
+   *  themselves. Does nothing if the thread is not running.
+   */
+  void                    stop();
+  
+  /*!
+   *  \brief Checks whether the event thread is running.
+   */
+  bool                    is_running() const;
+  
+  /*!
+   *  \brief Gets the Libusb context whose events are handled.
+   */
+  libusb_context*         context() const;
+  
+  /*!
+   *  \brief Sets the priority and CPU of the event thread.
+   *  
+   *  The event thread applies them, see \ref configure_io_thread(), when it
+   *  next wakes, which is at most half a second later.
+   *  
+   *  \param [in] high_priority Whether to run the thread above the normal
+   *         priority.
+   *  \param [in] cpu The CPU to pin the thread to, or -1 to let it run on
+   *         any.
+   */
+  void                    set_io_thread_options(bool high_priority, int cpu);
+  
+  
+  
+private:
+  libusb_event_reactor(const libusb_event_reactor& other) = delete;
+  libusb_event_reactor& operator=(const libusb_event_reactor& other) = delete;
+  
+  /*!
+   *  \brief The function that the event thread executes.
+   *  
+   *  Handles Libusb events until \ref m_kill is set.
+   */
+  void                    thread_function();
+  
+  /*! \brief The Libusb context whose events are handled. */
+  libusb_context* const   m_context;
+  
+  /*! \brief The event thread. */
+  std::thread             m_thread;
+  
+  /*! \brief Flag telling the event thread to exit, checked between waits
+   *         for events. */
+  std::atomic<bool>       m_kill;
+  
+  /*! \brief Flag indicating that the event thread is running. */
+  std::atomic<bool>       m_running;
+  
+  /*! \brief How the event thread is to be scheduled. */
+  bool                    m_high_priority;
+  int                     m_cpu;
+  
+  /*! \brief Incremented whenever the scheduling of the event thread
+   *         changes. */
+  unsigned int            m_io_generation;
+  
+  /*! \brief Mutex guarding the scheduling of the event thread. */
+  std::mutex              m_io_mutex;
+};
+
+}
+
+#endif /* defined(__LIBUSB_EVENT_REACTOR_H__) */
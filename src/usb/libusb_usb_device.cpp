@@ -18,12 +18,18 @@
 #endif
 
 #include "libusb_usb_device.h"
+#include "libusb_event_reactor.h"
 #include "usb.h"
 #include "task/task_controller.h"
 #include "task/forwarding_task_controller.h"
+#include "common/trace.h"
+#include "common/metrics.h"
 #include "libusb-1.0/libusb.h"
+#include <map>
+#include <new>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 
 #define CLASS_NAME "libusb_usb_device"
 #define CONFIG_NAME "USB configuration"
@@ -32,6 +38,19 @@
 #define OUTPUT_ENDPOINT_NAME "USB output endpoint"
 #define TIMEOUT_NAME "USB timeout"
 
+#define DEFAULT_MAX_PENDING_TRANSFERS 16
+
+// How often a thread waiting on the event reactor checks that it is still
+// running
+#define REACTOR_CHECK_INTERVAL_MS     100
+
+// Stale data is assumed to have all arrived once the input endpoint has been
+// quiet this long
+#define RECOVER_DRAIN_TIMEOUT_MS      50
+
+// Upper bound on stale packets discarded, in case the device keeps talking
+#define RECOVER_MAX_DRAIN_PACKETS     1024
+
 namespace usb
 {
 
@@ -48,7 +67,7 @@ typedef libusb_usb_device::device_alt_setting   device_alt_setting;
 typedef libusb_usb_device::device_endpoint      device_endpoint;
 
 
-libusb_usb_device::libusb_usb_device(libusb_device* device)
+libusb_usb_device::libusb_usb_device(libusb_device* device, libusb_context* context)
   : m_was_initialized    (false),
     m_is_open            (false),
     m_kernel_was_attached(false),
@@ -65,14 +84,31 @@ libusb_usb_device::libusb_usb_device(libusb_device* device)
     m_output_endpoint    (0),
     m_alt_setting        (0),
     m_device             (device),
+    m_context            (context),
     m_device_handle      (nullptr),
-    m_device_description (nullptr),
+    m_device_description (),
     m_manufacturer_string(),
     m_manufacturer_string_set(false),
     m_product_string     (),
     m_product_string_set (false),
     m_serial_number      (),
-    m_serial_number_set  (false)
+    m_serial_number_set  (false),
+    m_transfer_state     (),
+    m_write_buffer       (nullptr),
+    m_write_buffer_size  (0),
+    m_max_pending_transfers(DEFAULT_MAX_PENDING_TRANSFERS),
+    m_pending_transfers  (),
+    m_free_transfers     (),
+    m_sync_transfer      (nullptr),
+    m_reactor            (nullptr),
+    m_abort_generation   (0),
+    m_metric_transfers_in(nullptr),
+    m_metric_transfers_out(nullptr),
+    m_metric_bytes_in    (nullptr),
+    m_metric_bytes_out   (nullptr),
+    m_metric_errors      (nullptr),
+    m_metric_timeouts    (nullptr),
+    m_capture            (nullptr)
 {
   // Increment the reference counter for the device
   libusb_ref_device(m_device);
@@ -80,15 +116,6 @@ libusb_usb_device::libusb_usb_device(libusb_device* device)
 
 libusb_usb_device::~libusb_usb_device()
 {
-  // Clean up results of being initialized
-  if (m_was_initialized)
-  {
-    if (m_device_description != nullptr)
-    {
-      delete m_device_description;
-    }
-  }
-  
   // Close connection if opened
   if (m_is_open)
   {
@@ -103,6 +130,16 @@ libusb_usb_device::~libusb_usb_device()
     }
   }
   
+  // Release transfer slots and staging buffer
+  free_transfer_slots();
+  if (m_sync_transfer != nullptr)
+  {
+    libusb_free_transfer(m_sync_transfer->transfer);
+    delete m_sync_transfer;
+  }
+  delete [] m_write_buffer;
+  delete m_capture;
+  
   // Decrement the reference counter for the device
   libusb_unref_device(m_device);
 }
@@ -115,12 +152,52 @@ void libusb_usb_device::init()
     return;
   }
   
-  // Build device description
-  m_device_description = build_device_description();
+  // Fetch device description
+  m_device_description = shared_device_description();
   
   // TODO: Error check
   
   m_was_initialized = true;
+  update_transfer_state();
+}
+
+void libusb_usb_device::set_event_reactor(libusb_event_reactor* reactor)
+{
+  if (!m_pending_transfers.empty())
+  {
+    throw std::runtime_error("Cannot change event reactor while transfers are pending");
+  }
+  
+  m_reactor = reactor;
+}
+
+void libusb_usb_device::start_capture(const std::string& path)
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  if (!m_pending_transfers.empty())
+  {
+    throw std::runtime_error("Cannot start a capture while transfers are pending");
+  }
+  
+  // Strings are fetched first, since fetching them may open the device
+  std::string manufacturer = get_manufacturer_string();
+  std::string product = get_product_string();
+  std::string serial_number = get_serial_number();
+  capture_writer* capture = new capture_writer(path, *m_device_description, manufacturer, product, serial_number);
+  
+  delete m_capture;
+  m_capture = capture;
+}
+
+void libusb_usb_device::stop_capture()
+{
+  delete m_capture;
+  m_capture = nullptr;
+}
+
+bool libusb_usb_device::is_capturing() const
+{
+  return m_capture != nullptr;
 }
 
 
@@ -191,7 +268,7 @@ const device_description* libusb_usb_device::get_device_description() const
 {
   if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
   
-  return m_device_description;
+  return m_device_description.get();
 }
 
 std::string libusb_usb_device::get_manufacturer_string()
@@ -351,6 +428,7 @@ void libusb_usb_device::set_configuration(configuration_t configuration)
     m_configuration = (unsigned int) configuration;
     m_configuration_set = true;
     m_interface_set = false;
+    update_transfer_state();
     
     // Switch device's current configuration
     if (m_is_open)
@@ -408,6 +486,7 @@ void libusb_usb_device::set_interface(interface_t interface)
     }
     
     m_interface = (unsigned int) interface;
+    update_transfer_state();
     
     error = libusb_claim_interface(m_device_handle, m_interface);
     if (libusb_error_occured(error))
@@ -419,6 +498,7 @@ void libusb_usb_device::set_interface(interface_t interface)
   {
     m_interface_set = true;
     m_interface = (unsigned int) interface;
+    update_transfer_state();
   }
   
   
@@ -449,6 +529,8 @@ void libusb_usb_device::set_interface(interface_t interface)
       }
     }
   }
+  
+  update_transfer_state();
 }
 
 void libusb_usb_device::set_input_endpoint(endpoint_t input_endpoint)
@@ -494,6 +576,7 @@ void libusb_usb_device::set_input_endpoint(endpoint_t input_endpoint)
   
   m_input_endpoint = i;
   m_input_endpoint_set = true;
+  update_transfer_state();
 }
 
 void libusb_usb_device::set_output_endpoint(endpoint_t output_endpoint)
@@ -539,6 +622,7 @@ void libusb_usb_device::set_output_endpoint(endpoint_t output_endpoint)
   
   m_output_endpoint = i;
   m_output_endpoint_set = true;
+  update_transfer_state();
 }
 
 
@@ -635,6 +719,8 @@ void libusb_usb_device::open()
   }
   
   m_is_open = true;
+  update_transfer_state();
+  bind_metrics();
 }
 
 void libusb_usb_device::close()
@@ -646,7 +732,12 @@ void libusb_usb_device::close()
   }
   
   int error;
+  
+  // Transfers cannot outlive the device handle
+  cancel_pending_transfers();
+  
   m_is_open = false;
+  update_transfer_state();
   
   // Attempt to release the claim on the interface
   if (m_interface_set)
@@ -669,6 +760,7 @@ void libusb_usb_device::close()
   else
   {
     m_configuration_set = false;
+    update_transfer_state();
   }
   
   // Attempt to reattach the kernel driver
@@ -695,43 +787,401 @@ unsigned int libusb_usb_device::read(data_t *buffer, unsigned int num_bytes)
 
 unsigned int libusb_usb_device::read(data_t* buffer, unsigned int num_bytes, timeout_t timeout)
 {
-  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
-  if (!m_is_open) throw unopen_exception(CLASS_NAME);
-  if (!m_configuration_set) throw unconfigured_exception(CONFIG_NAME);
-  if (!m_interface_set) throw unconfigured_exception(INTERFACE_NAME);
-  if (!m_input_endpoint_set) throw unconfigured_exception(INPUT_ENDPOINT_NAME);
+  if (!m_transfer_state.read_ready) validate_read_state();
   
-  int bytes_written = 0;
-  unsigned char endpoint = get_device_description()
-    ->configurations[m_configuration]
-    ->interfaces[m_interface]
-    ->alt_settings[m_alt_setting]
-    ->endpoints[m_input_endpoint]
-    ->address;
+  if (uses_reactor())
+  {
+    trace_scope trace(TRACE_TRANSFER_IN, num_bytes);
+    return reactor_transfer(m_transfer_state.input_address, buffer, num_bytes, timeout);
+  }
+  
+  return try_read(buffer, num_bytes, timeout).get();
+}
+
+unsigned int libusb_usb_device::write(const data_t* data, unsigned int num_bytes)
+{
+  return write(data, num_bytes, timeout());
+}
+
+unsigned int libusb_usb_device::write(const data_t* data, unsigned int num_bytes, timeout_t timeout)
+{
+  // Copy data array to the staging buffer so that it is writable
+  if (!stage_write(data, num_bytes))
+  {
+    throw_libusb_exception(LIBUSB_ERROR_NO_MEM, timeout);
+  }
+  
+  return bulk_write(m_write_buffer, num_bytes, timeout);
+}
+
+unsigned int libusb_usb_device::write(data_t* data, unsigned int num_bytes)
+{
+  return write(data, num_bytes, timeout());
+}
+
+unsigned int libusb_usb_device::write(data_t* data, unsigned int num_bytes, timeout_t timeout)
+{
+  // Buffer is already writable; hand it straight to Libusb
+  return bulk_write(data, num_bytes, timeout);
+}
+
+result<unsigned int> libusb_usb_device::try_read(data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept
+{
+  // Anything but a plain transfer on a ready device is rare enough to go
+  // through the throwing version
+  if (!m_transfer_state.read_ready || uses_reactor())
+  {
+    return usb_device::try_read(data, num_bytes, timeout);
+  }
+  
+  int bytes_read = 0;
+  unsigned char endpoint = m_transfer_state.input_address;
+  trace_scope trace(TRACE_TRANSFER_IN, num_bytes);
+  
+  capture_writer::ticket_t ticket = capture_begin(endpoint, false, false, num_bytes, data);
+  int error = libusb_bulk_transfer(m_device_handle, endpoint, data, num_bytes, &bytes_read, (unsigned int) timeout);
+  capture_end(ticket, endpoint, error, timeout, bytes_read, data, capture_writer::clock_t::now());
+  if (libusb_error_occured(error))
+  {
+    count_error(error);
+    return libusb_failure(error, timeout);
+  }
+  count_transfer(endpoint, bytes_read);
+  
+  // Adjust number of bytes read to conform to the return type
+  if (bytes_read < 0)
+  {
+    bytes_read = 0;
+  }
+  
+  return result<unsigned int>::success((unsigned int) bytes_read);
+}
+
+result<unsigned int> libusb_usb_device::try_write(const data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept
+{
+  if (!m_transfer_state.write_ready || uses_reactor())
+  {
+    return usb_device::try_write(data, num_bytes, timeout);
+  }
+  
+  if (!stage_write(data, num_bytes))
+  {
+    return libusb_failure(LIBUSB_ERROR_NO_MEM, timeout);
+  }
+  return try_bulk_write(m_write_buffer, num_bytes, timeout);
+}
+
+
+
+bool libusb_usb_device::supports_async_transfers() const
+{
+  return true;
+}
+
+unsigned int libusb_usb_device::max_pending_transfers() const
+{
+  return m_max_pending_transfers;
+}
+
+void libusb_usb_device::set_max_pending_transfers(unsigned int max_pending)
+{
+  if (max_pending == 0)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(max_pending)
+                                + " for argument 1: expected value greater than 0.");
+  }
+  if (!m_pending_transfers.empty())
+  {
+    throw std::runtime_error("Cannot change queue depth while transfers are pending");
+  }
+  
+  m_max_pending_transfers = max_pending;
+  
+  // Trim unneeded slots
+  while (m_free_transfers.size() > m_max_pending_transfers)
+  {
+    async_transfer* slot = m_free_transfers.back();
+    m_free_transfers.pop_back();
+    libusb_free_transfer(slot->transfer);
+    delete [] slot->buffer;
+    delete slot;
+  }
+}
+
+unsigned int libusb_usb_device::num_pending_transfers() const
+{
+  return (unsigned int) m_pending_transfers.size();
+}
+
+void libusb_usb_device::submit_read(data_t* data, unsigned int num_bytes)
+{
+  if (!m_transfer_state.read_ready) validate_read_state();
+  
+  unsigned char endpoint = m_transfer_state.input_address;
+  
+  // Reads land directly in the caller's buffer
+  submit_transfer(endpoint, data, num_bytes, acquire_transfer_slot());
+}
+
+void libusb_usb_device::submit_write(const data_t* data, unsigned int num_bytes)
+{
+  if (!m_transfer_state.write_ready) validate_write_state();
+  
+  unsigned char endpoint = m_transfer_state.output_address;
+  
+  async_transfer* slot = acquire_transfer_slot();
+  
+  // Stage outgoing data in the slot's own buffer, growing it only if needed
+  if (slot->buffer_size < num_bytes)
+  {
+    delete [] slot->buffer;
+    slot->buffer = new data_t[num_bytes];
+    slot->buffer_size = num_bytes;
+  }
+  for (unsigned int i = 0; i < num_bytes; ++i)
+  {
+    slot->buffer[i] = data[i];
+  }
+  
+  submit_transfer(endpoint, slot->buffer, num_bytes, slot);
+}
+
+unsigned int libusb_usb_device::complete_transfer()
+{
+  if (m_pending_transfers.empty())
+  {
+    throw std::runtime_error("No pending transfers");
+  }
+  
+  async_transfer* slot = m_pending_transfers.front();
+  {
+    // Only the time spent waiting on the transfer is recorded
+    trace_scope trace((slot->transfer->endpoint & LIBUSB_ENDPOINT_IN) ? TRACE_TRANSFER_IN : TRACE_TRANSFER_OUT,
+                      (unsigned int) slot->transfer->length);
+    wait_for_transfer(slot);
+  }
+  m_pending_transfers.pop_front();
   
-  // Transfer data, catching errors and throwing exceptions if necessary
-  int error = libusb_bulk_transfer(m_device_handle, endpoint, buffer, num_bytes, &bytes_written, (unsigned int) timeout);
+  // Collect results before recycling the slot
+  int status = slot->transfer->status;
+  int actual_length = slot->transfer->actual_length;
+  timeout_t transfer_timeout = slot->transfer->timeout;
+  unsigned char endpoint = slot->transfer->endpoint;
+  m_free_transfers.push_back(slot);
+  
+  int error = transfer_error(status);
+  capture_end(slot->capture_ticket, endpoint, error, transfer_timeout, actual_length, slot->transfer->buffer, slot->finished);
   if (libusb_error_occured(error))
   {
+    count_error(error);
+    throw_libusb_exception(error, transfer_timeout);
+  }
+  count_transfer(endpoint, actual_length);
+  
+  // Adjust number of bytes transferred to conform to the return type
+  if (actual_length < 0)
+  {
+    actual_length = 0;
+  }
+  
+  return (unsigned int) actual_length;
+}
+
+void libusb_usb_device::cancel_pending_transfers()
+{
+  // Request cancellation of everything still in flight
+  for (async_transfer* slot : m_pending_transfers)
+  {
+    if (!slot->completed)
+    {
+      libusb_cancel_transfer(slot->transfer);
+    }
+  }
+  
+  // Libusb still owns the transfers until their callbacks have fired
+  while (!m_pending_transfers.empty())
+  {
+    async_transfer* slot = m_pending_transfers.front();
+    try
+    {
+      wait_for_transfer(slot);
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Well... this is awkward
+    }
+    capture_end(slot->capture_ticket, slot->transfer->endpoint, LIBUSB_ERROR_INTERRUPTED, slot->transfer->timeout,
+                0, nullptr, capture_writer::clock_t::now());
+    m_pending_transfers.pop_front();
+    m_free_transfers.push_back(slot);
+  }
+}
+
+
+
+void libusb_usb_device::abort_pending_transfers()
+{
+  // Waiters notice the new generation as soon as they wake
+  std::lock_guard<std::mutex> lock(m_completion_mutex);
+  ++m_abort_generation;
+  m_completion_condition.notify_all();
+}
+
+bool libusb_usb_device::recover()
+{
+  if (!m_is_open)
+  {
+    return false;
+  }
+  
+  cancel_pending_transfers();
+  
+  unsigned char input_address = m_transfer_state.input_address;
+  unsigned char output_address = m_transfer_state.output_address;
+  
+  // Stalled endpoints refuse every transfer until their halt is cleared
+  int error;
+  if (m_transfer_state.write_ready)
+  {
+    error = libusb_clear_halt(m_device_handle, output_address);
+    if (libusb_error_occured(error) && error != LIBUSB_ERROR_NOT_FOUND)
+    {
+      return false;
+    }
+  }
+  if (!m_transfer_state.read_ready)
+  {
+    return true;
+  }
+  error = libusb_clear_halt(m_device_handle, input_address);
+  if (libusb_error_occured(error) && error != LIBUSB_ERROR_NOT_FOUND)
+  {
+    return false;
+  }
+  
+  // Throw away replies to requests that have already been given up on.
+  // Reads are a whole packet so that a packet can't overflow the buffer
+  unsigned int packet_size = max_packet_size(input_address);
+  if (packet_size == 0)
+  {
+    packet_size = 512;
+  }
+  std::vector<data_t> packet(packet_size);
+  for (unsigned int i = 0; i < RECOVER_MAX_DRAIN_PACKETS; ++i)
+  {
+    int bytes_read = 0;
+    error = libusb_bulk_transfer(m_device_handle, input_address, packet.data(), packet_size, &bytes_read, RECOVER_DRAIN_TIMEOUT_MS);
+    if (error == LIBUSB_ERROR_TIMEOUT)
+    {
+      return true;
+    }
+    if (libusb_error_occured(error))
+    {
+      return false;
+    }
+  }
+  
+  // Device never went quiet
+  return false;
+}
+
+
+
+bool libusb_usb_device::supports_interrupt_reads() const
+{
+  return true;
+}
+
+unsigned int libusb_usb_device::read_interrupt(endpoint_t endpoint, data_t* data, unsigned int num_bytes, timeout_t timeout)
+{
+  if (!m_transfer_state.read_ready) validate_read_state();
+  
+  if ((endpoint & LIBUSB_ENDPOINT_IN) == 0 || endpoint > 255)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(endpoint)
+                                + " for argument 1: endpoint address does not indicate input.");
+  }
+  
+  // Waiting on a notification isn't traced, and a notification that doesn't
+  // come in time isn't an error worth counting
+  if (uses_reactor())
+  {
+    return reactor_transfer((unsigned char) endpoint, data, num_bytes, timeout, true);
+  }
+  
+  int bytes_read = 0;
+  capture_writer::ticket_t ticket = capture_begin((unsigned char) endpoint, true, false, num_bytes, data);
+  int error = libusb_interrupt_transfer(m_device_handle, (unsigned char) endpoint, data, (int) num_bytes, &bytes_read, (unsigned int) timeout);
+  capture_end(ticket, (unsigned char) endpoint, error, timeout, bytes_read, data, capture_writer::clock_t::now());
+  if (libusb_error_occured(error))
+  {
+    if (error != LIBUSB_ERROR_TIMEOUT)
+    {
+      count_error(error);
+    }
     throw_libusb_exception(error, timeout);
-    return bytes_written;
+    return 0;
   }
+  count_transfer((unsigned char) endpoint, bytes_read);
   
   // Adjust number of bytes read to conform to the return type
-  if (bytes_written < 0)
+  if (bytes_read < 0)
   {
-    bytes_written = 0;
+    bytes_read = 0;
   }
   
-  return (unsigned int) bytes_written;
+  return (unsigned int) bytes_read;
 }
 
-unsigned int libusb_usb_device::write(const data_t* data, unsigned int num_bytes)
+
+
+void libusb_usb_device::update_transfer_state()
 {
-  return write(data, num_bytes, timeout());
+  bool ready = m_was_initialized && m_is_open && m_configuration_set && m_interface_set;
+  
+  m_transfer_state.read_ready = ready && m_input_endpoint_set;
+  m_transfer_state.write_ready = ready && m_output_endpoint_set;
+  
+  // Resolve endpoint addresses once rather than on every transfer
+  const device_alt_setting* alt_setting = nullptr;
+  if (ready)
+  {
+    alt_setting = m_device_description
+      ->configurations[m_configuration]
+      ->interfaces[m_interface]
+      ->alt_settings[m_alt_setting];
+  }
+  
+  // Endpoint indexes may be stale while the interface is being switched
+  if (m_transfer_state.read_ready && m_input_endpoint >= alt_setting->num_endpoints)
+  {
+    m_transfer_state.read_ready = false;
+  }
+  if (m_transfer_state.write_ready && m_output_endpoint >= alt_setting->num_endpoints)
+  {
+    m_transfer_state.write_ready = false;
+  }
+  
+  m_transfer_state.input_address = (m_transfer_state.read_ready
+    ? (unsigned char) alt_setting->endpoints[m_input_endpoint]->address : 0);
+  m_transfer_state.output_address = (m_transfer_state.write_ready
+    ? (unsigned char) alt_setting->endpoints[m_output_endpoint]->address : 0);
 }
 
-unsigned int libusb_usb_device::write(const data_t* data, unsigned int num_bytes, timeout_t timeout)
+void libusb_usb_device::validate_read_state() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  if (!m_is_open) throw unopen_exception(CLASS_NAME);
+  if (!m_configuration_set) throw unconfigured_exception(CONFIG_NAME);
+  if (!m_interface_set) throw unconfigured_exception(INTERFACE_NAME);
+  if (!m_input_endpoint_set) throw unconfigured_exception(INPUT_ENDPOINT_NAME);
+  
+  // Every flag is set, so the selected endpoint must not exist
+  throw unconfigured_exception(INPUT_ENDPOINT_NAME);
+}
+
+void libusb_usb_device::validate_write_state() const
 {
   if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
   if (!m_is_open) throw unopen_exception(CLASS_NAME);
@@ -739,31 +1189,38 @@ unsigned int libusb_usb_device::write(const data_t* data, unsigned int num_bytes
   if (!m_interface_set) throw unconfigured_exception(INTERFACE_NAME);
   if (!m_output_endpoint_set) throw unconfigured_exception(OUTPUT_ENDPOINT_NAME);
   
-  // Copy data array to new array that is writiable
-  data_t* data_writable = new data_t[num_bytes];
-  for (unsigned int i = 0; i < num_bytes; ++i)
+  // Every flag is set, so the selected endpoint must not exist
+  throw unconfigured_exception(OUTPUT_ENDPOINT_NAME);
+}
+
+unsigned int libusb_usb_device::bulk_write(data_t* data, unsigned int num_bytes, timeout_t timeout)
+{
+  if (!m_transfer_state.write_ready) validate_write_state();
+  
+  if (uses_reactor())
   {
-    data_writable[i] = data[i];
+    trace_scope trace(TRACE_TRANSFER_OUT, num_bytes);
+    return reactor_transfer(m_transfer_state.output_address, data, num_bytes, timeout);
   }
   
+  return try_bulk_write(data, num_bytes, timeout).get();
+}
+
+result<unsigned int> libusb_usb_device::try_bulk_write(data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept
+{
   int bytes_read = 0;
-  unsigned char endpoint = get_device_description()
-    ->configurations[m_configuration]
-    ->interfaces[m_interface]
-    ->alt_settings[m_alt_setting]
-    ->endpoints[m_output_endpoint]
-    ->address;
+  unsigned char endpoint = m_transfer_state.output_address;
+  trace_scope trace(TRACE_TRANSFER_OUT, num_bytes);
   
-  // Transfer data, catching errors and throwing exceptions if necessary
-  int error = libusb_bulk_transfer(m_device_handle, endpoint, data_writable, num_bytes, &bytes_read, (unsigned int) timeout);
+  capture_writer::ticket_t ticket = capture_begin(endpoint, false, false, num_bytes, data);
+  int error = libusb_bulk_transfer(m_device_handle, endpoint, data, num_bytes, &bytes_read, (unsigned int) timeout);
+  capture_end(ticket, endpoint, error, timeout, bytes_read, nullptr, capture_writer::clock_t::now());
   if (libusb_error_occured(error))
   {
-    delete [] data_writable;
-    throw_libusb_exception(error, timeout);
-    return bytes_read;
+    count_error(error);
+    return libusb_failure(error, timeout);
   }
-  
-  delete [] data_writable;
+  count_transfer(endpoint, bytes_read);
   
   // Adjust number of bytes read to conform to the return type
   if (bytes_read < 0)
@@ -771,10 +1228,352 @@ unsigned int libusb_usb_device::write(const data_t* data, unsigned int num_bytes
     bytes_read = 0;
   }
   
-  return (unsigned int) bytes_read;
+  return result<unsigned int>::success((unsigned int) bytes_read);
 }
 
+bool libusb_usb_device::stage_write(const data_t* data, unsigned int num_bytes) noexcept
+{
+  if (m_write_buffer_size < num_bytes)
+  {
+    data_t* buffer = new (std::nothrow) data_t[num_bytes];
+    if (buffer == nullptr)
+    {
+      return false;
+    }
+    delete [] m_write_buffer;
+    m_write_buffer = buffer;
+    m_write_buffer_size = num_bytes;
+  }
+  for (unsigned int i = 0; i < num_bytes; ++i)
+  {
+    m_write_buffer[i] = data[i];
+  }
+  return true;
+}
 
+void libusb_usb_device::on_transfer_complete(libusb_transfer* transfer)
+{
+  async_transfer* slot = (async_transfer*) transfer->user_data;
+  
+  // Runs on the reactor's thread, so wake whoever is waiting on the transfer
+  std::lock_guard<std::mutex> lock(slot->owner->m_completion_mutex);
+  if (slot->owner->m_capture != nullptr)
+  {
+    slot->finished = capture_writer::clock_t::now();
+  }
+  slot->completed = 1;
+  slot->owner->m_completion_condition.notify_all();
+}
+
+void libusb_usb_device::submit_transfer(unsigned char endpoint, data_t* buffer, unsigned int num_bytes, async_transfer* slot)
+{
+  slot->completed = 0;
+  slot->generation = m_abort_generation;
+  libusb_fill_bulk_transfer(slot->transfer, m_device_handle, endpoint, buffer, (int) num_bytes,
+                            &libusb_usb_device::on_transfer_complete, slot, (unsigned int) timeout());
+  
+  slot->capture_ticket = capture_begin(endpoint, false, true, num_bytes, buffer);
+  int error = libusb_submit_transfer(slot->transfer);
+  if (libusb_error_occured(error))
+  {
+    capture_end(slot->capture_ticket, endpoint, error, timeout(), 0, nullptr, capture_writer::clock_t::now());
+    m_free_transfers.push_back(slot);
+    throw_libusb_exception(error, timeout());
+    return;
+  }
+  
+  m_pending_transfers.push_back(slot);
+}
+
+libusb_usb_device::async_transfer* libusb_usb_device::acquire_transfer_slot()
+{
+  if (m_pending_transfers.size() >= m_max_pending_transfers)
+  {
+    throw std::runtime_error("Too many pending transfers");
+  }
+  
+  // Reuse an old slot if possible
+  if (!m_free_transfers.empty())
+  {
+    async_transfer* slot = m_free_transfers.back();
+    m_free_transfers.pop_back();
+    return slot;
+  }
+  
+  libusb_transfer* transfer = libusb_alloc_transfer(0);
+  if (transfer == nullptr)
+  {
+    throw_libusb_exception(LIBUSB_ERROR_NO_MEM, timeout());
+    return nullptr;
+  }
+  
+  async_transfer* slot = new async_transfer();
+  slot->transfer = transfer;
+  slot->buffer = nullptr;
+  slot->buffer_size = 0;
+  slot->completed = 0;
+  slot->owner = this;
+  slot->generation = 0;
+  slot->capture_ticket = 0;
+  return slot;
+}
+
+void libusb_usb_device::wait_for_transfer(async_transfer* slot)
+{
+  bool aborted = false;
+  
+  // Sleep while the reactor handles events for us, checking now and then
+  // that it is still around to do so
+  if (m_reactor != nullptr)
+  {
+    std::unique_lock<std::mutex> lock(m_completion_mutex);
+    while (!slot->completed && m_reactor->is_running())
+    {
+      if (!aborted && slot->generation != m_abort_generation)
+      {
+        // The reactor takes the lock to report the cancellation
+        lock.unlock();
+        libusb_cancel_transfer(slot->transfer);
+        aborted = true;
+        lock.lock();
+        continue;
+      }
+      m_completion_condition.wait_for(lock, std::chrono::milliseconds(REACTOR_CHECK_INTERVAL_MS));
+    }
+  }
+  
+  while (!slot->completed)
+  {
+    if (!aborted && slot->generation != m_abort_generation)
+    {
+      libusb_cancel_transfer(slot->transfer);
+      aborted = true;
+    }
+    
+    timeval tv = {0, REACTOR_CHECK_INTERVAL_MS * 1000};
+    int error = libusb_handle_events_timeout_completed(m_context, &tv, &slot->completed);
+    if (libusb_error_occured(error) && error != LIBUSB_ERROR_INTERRUPTED)
+    {
+      throw_libusb_exception(error, timeout());
+      return;
+    }
+  }
+}
+
+void libusb_usb_device::free_transfer_slots()
+{
+  for (async_transfer* slot : m_free_transfers)
+  {
+    libusb_free_transfer(slot->transfer);
+    delete [] slot->buffer;
+    delete slot;
+  }
+  m_free_transfers.clear();
+}
+
+unsigned int libusb_usb_device::reactor_transfer(unsigned char endpoint, data_t* buffer, unsigned int num_bytes, timeout_t timeout, bool interrupt)
+{
+  // Blocking transfers don't count against the pending transfer limit, so
+  // they get a slot of their own
+  if (m_sync_transfer == nullptr)
+  {
+    libusb_transfer* transfer = libusb_alloc_transfer(0);
+    if (transfer == nullptr)
+    {
+      throw_libusb_exception(LIBUSB_ERROR_NO_MEM, timeout);
+      return 0;
+    }
+    
+    m_sync_transfer = new async_transfer();
+    m_sync_transfer->transfer = transfer;
+    m_sync_transfer->buffer = nullptr;
+    m_sync_transfer->buffer_size = 0;
+    m_sync_transfer->owner = this;
+    m_sync_transfer->capture_ticket = 0;
+  }
+  
+  m_sync_transfer->completed = 0;
+  m_sync_transfer->generation = m_abort_generation;
+  if (interrupt)
+  {
+    libusb_fill_interrupt_transfer(m_sync_transfer->transfer, m_device_handle, endpoint, buffer, (int) num_bytes,
+                                   &libusb_usb_device::on_transfer_complete, m_sync_transfer, (unsigned int) timeout);
+  }
+  else
+  {
+    libusb_fill_bulk_transfer(m_sync_transfer->transfer, m_device_handle, endpoint, buffer, (int) num_bytes,
+                              &libusb_usb_device::on_transfer_complete, m_sync_transfer, (unsigned int) timeout);
+  }
+  
+  capture_writer::ticket_t ticket = capture_begin(endpoint, interrupt, false, num_bytes, buffer);
+  int error = libusb_submit_transfer(m_sync_transfer->transfer);
+  if (libusb_error_occured(error))
+  {
+    capture_end(ticket, endpoint, error, timeout, 0, nullptr, capture_writer::clock_t::now());
+    count_error(error);
+    throw_libusb_exception(error, timeout);
+    return 0;
+  }
+  wait_for_transfer(m_sync_transfer);
+  
+  error = transfer_error(m_sync_transfer->transfer->status);
+  capture_end(ticket, endpoint, error, timeout, m_sync_transfer->transfer->actual_length, buffer, m_sync_transfer->finished);
+  if (libusb_error_occured(error))
+  {
+    if (!interrupt || error != LIBUSB_ERROR_TIMEOUT)
+    {
+      count_error(error);
+    }
+    throw_libusb_exception(error, timeout);
+    return 0;
+  }
+  
+  // Adjust number of bytes transferred to conform to the return type
+  int actual_length = m_sync_transfer->transfer->actual_length;
+  count_transfer(endpoint, actual_length);
+  if (actual_length < 0)
+  {
+    actual_length = 0;
+  }
+  
+  return (unsigned int) actual_length;
+}
+
+void libusb_usb_device::bind_metrics()
+{
+  if (m_metric_errors != nullptr)
+  {
+    return;
+  }
+  
+  std::string serial;
+  try
+  {
+    serial = get_serial_number();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // Count the device's transfers without a serial number
+  }
+  
+  std::string labels = metrics_label("serial", serial);
+  m_metric_transfers_in = metrics_counter("flashmasta_usb_transfers_total", "USB transfers completed", labels + ",direction=\"in\"");
+  m_metric_transfers_out = metrics_counter("flashmasta_usb_transfers_total", "USB transfers completed", labels + ",direction=\"out\"");
+  m_metric_bytes_in = metrics_counter("flashmasta_usb_bytes_total", "Bytes moved over USB", labels + ",direction=\"in\"");
+  m_metric_bytes_out = metrics_counter("flashmasta_usb_bytes_total", "Bytes moved over USB", labels + ",direction=\"out\"");
+  m_metric_timeouts = metrics_counter("flashmasta_usb_timeouts_total", "USB transfers that timed out", labels);
+  m_metric_errors = metrics_counter("flashmasta_usb_errors_total", "USB transfers that failed, including timeouts", labels);
+}
+
+void libusb_usb_device::count_transfer(unsigned char endpoint, int num_bytes)
+{
+  if (m_metric_errors == nullptr)
+  {
+    return;
+  }
+  
+  if (endpoint & LIBUSB_ENDPOINT_IN)
+  {
+    m_metric_transfers_in->add();
+    m_metric_bytes_in->add(num_bytes < 0 ? 0 : num_bytes);
+  }
+  else
+  {
+    m_metric_transfers_out->add();
+    m_metric_bytes_out->add(num_bytes < 0 ? 0 : num_bytes);
+  }
+}
+
+void libusb_usb_device::count_error(int libusb_error)
+{
+  if (m_metric_errors == nullptr)
+  {
+    return;
+  }
+  
+  m_metric_errors->add();
+  if (libusb_error == LIBUSB_ERROR_TIMEOUT)
+  {
+    m_metric_timeouts->add();
+  }
+}
+
+capture_writer::ticket_t libusb_usb_device::capture_begin(unsigned char endpoint, bool interrupt, bool async, unsigned int num_bytes, const data_t* data) noexcept
+{
+  if (m_capture == nullptr)
+  {
+    return 0;
+  }
+  
+  if (endpoint & LIBUSB_ENDPOINT_IN)
+  {
+    return m_capture->begin_transfer(interrupt ? CAPTURED_INTERRUPT_IN : CAPTURED_BULK_IN, endpoint, async, num_bytes, nullptr);
+  }
+  return m_capture->begin_transfer(CAPTURED_BULK_OUT, endpoint, async, num_bytes, data);
+}
+
+void libusb_usb_device::capture_end(capture_writer::ticket_t ticket, unsigned char endpoint, int libusb_error, timeout_t timeout,
+                                    int num_bytes, const data_t* data, capture_writer::clock_t::time_point finished) noexcept
+{
+  if (m_capture == nullptr)
+  {
+    return;
+  }
+  
+  // Failures are recorded the way the non-throwing calls report them
+  transfer_status status = TRANSFER_OK;
+  int code = 0;
+  if (libusb_error_occured(libusb_error))
+  {
+    result<unsigned int> failure = libusb_failure(libusb_error, timeout);
+    status = failure.status();
+    code = failure.code();
+  }
+  m_capture->end_transfer(ticket, status, code, (unsigned int) (num_bytes < 0 ? 0 : num_bytes),
+                          (endpoint & LIBUSB_ENDPOINT_IN) ? data : nullptr, finished);
+}
+
+bool libusb_usb_device::uses_reactor() const
+{
+  return m_reactor != nullptr && m_reactor->is_running();
+}
+
+
+
+std::shared_ptr<const device_description> libusb_usb_device::shared_device_description()
+{
+  // Descriptors only change along with the firmware, which bumps the release
+  // number, so the trees built are kept for as long as the program runs. There
+  // are only ever a handful of models
+  typedef std::tuple<uint16_t, uint16_t, uint16_t, int> model_key;
+  static std::mutex descriptions_mutex;
+  static std::map<model_key, std::shared_ptr<const device_description>> descriptions;
+  
+  // The device descriptor is kept by libusb, so reading it costs no transfer
+  libusb_device_descriptor device_descriptor;
+  int error = libusb_get_device_descriptor(m_device, &device_descriptor);
+  if (libusb_error_occured(error))
+  {
+    throw_libusb_exception(error, timeout());
+  }
+  model_key key(device_descriptor.idVendor, device_descriptor.idProduct,
+                device_descriptor.bcdDevice, libusb_get_device_speed(m_device));
+  
+  std::lock_guard<std::mutex> lock(descriptions_mutex);
+  auto it = descriptions.find(key);
+  if (it != descriptions.end())
+  {
+    return it->second;
+  }
+  
+  std::shared_ptr<const device_description> description(build_device_description());
+  if (description != nullptr)
+  {
+    descriptions[key] = description;
+  }
+  return description;
+}
 
 device_description* libusb_usb_device::build_device_description()
 {
@@ -909,6 +1708,10 @@ device_endpoint* libusb_usb_device::build_device_endpoint(const libusb_interface
   device_endpoint* endpoint = new device_endpoint();
   endpoint->address = libusb_endpoint->bEndpointAddress;
   
+  // Bits 11 and 12 count extra transactions per microframe on high-speed
+  // isochronous and interrupt endpoints and aren't part of the size
+  endpoint->max_packet_size = libusb_endpoint->wMaxPacketSize & 0x07FF;
+  
   switch (endpoint->address & LIBUSB_ENDPOINT_IN)
   {
   case LIBUSB_ENDPOINT_IN:
@@ -942,11 +1745,52 @@ device_endpoint* libusb_usb_device::build_device_endpoint(const libusb_interface
   return endpoint;
 }
 
+int libusb_usb_device::transfer_error(int status)
+{
+  switch (status)
+  {
+  case LIBUSB_TRANSFER_COMPLETED:
+    return LIBUSB_SUCCESS;
+  case LIBUSB_TRANSFER_TIMED_OUT:
+    return LIBUSB_ERROR_TIMEOUT;
+  case LIBUSB_TRANSFER_CANCELLED:
+    return LIBUSB_ERROR_INTERRUPTED;
+  case LIBUSB_TRANSFER_NO_DEVICE:
+    return LIBUSB_ERROR_NO_DEVICE;
+  case LIBUSB_TRANSFER_STALL:
+    return LIBUSB_ERROR_PIPE;
+  case LIBUSB_TRANSFER_OVERFLOW:
+    return LIBUSB_ERROR_OVERFLOW;
+  case LIBUSB_TRANSFER_ERROR:
+  default:
+    return LIBUSB_ERROR_IO;
+  }
+}
+
 bool libusb_usb_device::libusb_error_occured(int libusb_error)
 {
   return (libusb_error != LIBUSB_SUCCESS);
 }
 
+result<unsigned int> libusb_usb_device::libusb_failure(int libusb_error, timeout_t timeout) noexcept
+{
+  // Mirrors throw_libusb_exception() so that the throwing wrappers rethrow
+  // exactly what they used to
+  switch (libusb_error)
+  {
+    case LIBUSB_ERROR_NO_DEVICE:
+      return result<unsigned int>::failure(TRANSFER_DISCONNECTED, libusb_error, libusb_error_name(libusb_error));
+    case LIBUSB_ERROR_BUSY:
+      return result<unsigned int>::failure(TRANSFER_BUSY, libusb_error, libusb_error_name(libusb_error));
+    case LIBUSB_ERROR_TIMEOUT:
+      return result<unsigned int>::failure(TRANSFER_TIMEOUT, (int) timeout, libusb_error_name(libusb_error));
+    case LIBUSB_ERROR_INTERRUPTED:
+      return result<unsigned int>::failure(TRANSFER_INTERRUPTED, libusb_error, libusb_error_name(libusb_error));
+    default:
+      return result<unsigned int>::failure(TRANSFER_USB_ERROR, libusb_error, libusb_error_name(libusb_error));
+  }
+}
+
 void libusb_usb_device::throw_libusb_exception(int libusb_error, timeout_t timeout)
 {
   switch (libusb_error)
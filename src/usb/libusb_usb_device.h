@@ -6,7 +6,7 @@
  *  \ref usb::libusb_usb_device class. This file includes the minimal number of
  *  files necessary to use any instance of the \ref usb::libusb_usb_device
  *  class.
- *
+ *  
  *  \author Daniel Andrus
  *  \date 2015-08-05
  *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
@@ -17,12 +17,22 @@
 
 #include "usbfwd.h"
 #include "usb_device.h"
+#include "usb_capture.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
 
+struct libusb_context;
 struct libusb_device;
 struct libusb_device_handle;
 struct libusb_config_descriptor;
 struct libusb_interface;
 struct libusb_interface_descriptor;
+struct libusb_transfer;
+class metric;
 
 namespace usb
 {
@@ -50,8 +60,11 @@ public:
    *  
    *  \param [in] device The handle to the USb device to use for communicating
    *         with Libusb.
+   *  \param [in] context The Libusb context to which \ref device belongs. Used
+   *         for handling events of asynchronous transfers. If **nullptr**,
+   *         the default Libusb context is used.
    */
-                            libusb_usb_device(libusb_device* device);
+                            libusb_usb_device(libusb_device* device, libusb_context* context = nullptr);
   
   /*!
    *  \brief The destructor for the class.
@@ -66,6 +79,50 @@ public:
    */
   void                      init();
   
+  /*!
+   *  \brief Sets the reactor that handles events for this device's transfers.
+   *  
+   *  Has all of this device's transfers, synchronous ones included, completed
+   *  by the given reactor's event thread while it is running, with the calling
+   *  thread sleeping until its transfer has finished. Without a running
+   *  reactor, the calling thread handles events itself. Cannot be changed
+   *  while transfers are pending.
+   *  
+   *  \param [in] reactor The reactor to use, or nullptr for none. Must handle
+   *         events for the context this device belongs to and must outlive
+   *         the device.
+   */
+  void                      set_event_reactor(libusb_event_reactor* reactor);
+  
+  /*!
+   *  \brief Starts recording every transfer to a capture file.
+   *  
+   *  Records the direction, size, outcome, and timing of every transfer made
+   *  from now on, along with the data read from the device, to a compact
+   *  binary file that \ref replay_usb_device can play back. Replaces any
+   *  capture already in progress. Recording never makes a transfer fail; if
+   *  the file can't be written, the capture is cut short.
+   *  
+   *  \param [in] path The path of the capture file to create.
+   *  
+   *  \throws std::runtime_error If the file can't be created.
+   *  
+   *  \see capture_writer
+   */
+  void                      start_capture(const std::string& path);
+  
+  /*!
+   *  \brief Finishes the capture in progress, if any, and closes its file.
+   *  
+   *  Transfers still pending are left out of the capture.
+   */
+  void                      stop_capture();
+  
+  /*!
+   *  \brief Gets whether transfers are being recorded.
+   */
+  bool                      is_capturing() const;
+  
   
   
   /*!
@@ -172,10 +229,354 @@ public:
    */
   unsigned int              write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout);
   
+  /*!
+   *  \see usb_device::write(data_t* buffer, unsigned int num_bytes)
+   */
+  unsigned int              write(data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::write(data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+   */
+  unsigned int              write(data_t* buffer, unsigned int num_bytes, timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::try_read(data_t* data, unsigned int num_bytes, timeout_t timeout)
+   */
+  result<unsigned int>      try_read(data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept;
+  
+  /*!
+   *  \see usb_device::try_write(const data_t* data, unsigned int num_bytes, timeout_t timeout)
+   */
+  result<unsigned int>      try_write(const data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept;
+  
+  
+  
+  /*!
+   *  \see usb_device::supports_async_transfers()
+   */
+  bool                      supports_async_transfers() const;
+  
+  /*!
+   *  \see usb_device::max_pending_transfers()
+   */
+  unsigned int              max_pending_transfers() const;
+  
+  /*!
+   *  \see usb_device::set_max_pending_transfers(unsigned int max_pending)
+   */
+  void                      set_max_pending_transfers(unsigned int max_pending);
+  
+  /*!
+   *  \see usb_device::num_pending_transfers()
+   */
+  unsigned int              num_pending_transfers() const;
+  
+  /*!
+   *  \see usb_device::submit_read(data_t* data, unsigned int num_bytes)
+   */
+  void                      submit_read(data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::submit_write(const data_t* data, unsigned int num_bytes)
+   */
+  void                      submit_write(const data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::complete_transfer()
+   */
+  unsigned int              complete_transfer();
+  
+  /*!
+   *  \see usb_device::cancel_pending_transfers()
+   */
+  void                      cancel_pending_transfers();
+  
+  /*!
+   *  \see usb_device::abort_pending_transfers()
+   */
+  void                      abort_pending_transfers();
+  
+  /*!
+   *  \see usb_device::recover()
+   */
+  bool                      recover();
+  
   
   
+  /*!
+   *  \see usb_device::supports_interrupt_reads()
+   */
+  bool                      supports_interrupt_reads() const;
+  
+  /*!
+   *  \see usb_device::read_interrupt(endpoint_t endpoint, data_t* data, unsigned int num_bytes, timeout_t timeout)
+   */
+  unsigned int              read_interrupt(endpoint_t endpoint, data_t* data, unsigned int num_bytes, timeout_t timeout);
+
+
+
 private:
   
+  /*!
+   *  \brief Flattened state consulted on every transfer.
+   *  
+   *  Flattened copy of the state needed to perform a transfer, computed once
+   *  by \ref update_transfer_state() whenever the configuration, interface,
+   *  endpoints, or open state change. Lets the hot path test a single flag and
+   *  load a single address rather than validating every flag and walking the
+   *  device descriptor for each packet.
+   */
+  struct transfer_state
+  {
+    /*! \brief Flag indicating that read operations may proceed. */
+    bool                    read_ready;
+    
+    /*! \brief Flag indicating that write operations may proceed. */
+    bool                    write_ready;
+    
+    /*! \brief The resolved address of the endpoint used for reads. */
+    unsigned char           input_address;
+    
+    /*! \brief The resolved address of the endpoint used for writes. */
+    unsigned char           output_address;
+  };
+  
+  /*!
+   *  \brief Bookkeeping for a single asynchronous transfer.
+   *  
+   *  Bookkeeping for a single asynchronous transfer. Slots are allocated once
+   *  and recycled between transfers so that submitting a transfer does not
+   *  require any allocations in the common case.
+   */
+  struct async_transfer
+  {
+    /*! \brief The Libusb transfer handle owned by this slot. */
+    libusb_transfer*        transfer;
+    
+    /*! \brief Buffer owned by this slot used for staging outgoing data. */
+    data_t*                 buffer;
+    
+    /*! \brief The size in bytes of \ref buffer. */
+    unsigned int            buffer_size;
+    
+    /*! \brief Nonzero once Libusb has reported the transfer as finished. */
+    int                     completed;
+    
+    /*! \brief The device that submitted the transfer. */
+    libusb_usb_device*      owner;
+    
+    /*! \brief The value of \ref m_abort_generation when the transfer was
+     *         submitted. */
+    unsigned int            generation;
+    
+    /*! \brief Identifies the transfer in the capture in progress, if any. */
+    capture_writer::ticket_t capture_ticket;
+    
+    /*! \brief The time at which Libusb reported the transfer as finished.
+     *         Only kept while capturing. */
+    capture_writer::clock_t::time_point finished;
+  };
+  
+  /*!
+   *  \brief Recomputes the cached \ref transfer_state.
+   *  
+   *  Recomputes the cached \ref transfer_state from the current
+   *  configuration, interface, and endpoint selections. Must be called
+   *  whenever any of these, or the open state of the device, changes.
+   */
+  void                      update_transfer_state();
+  
+  /*!
+   *  \brief Throws the exception describing why the device cannot be read
+   *         from.
+   *  
+   *  Checks each precondition of a read operation in turn and throws the
+   *  exception corresponding to the first one that is not met. Only called
+   *  off the hot path, once the cached \ref transfer_state has indicated that
+   *  the device is not ready.
+   */
+  void                      validate_read_state() const;
+  
+  /*!
+   *  \brief Throws the exception describing why the device cannot be written
+   *         to.
+   *  
+   *  Checks each precondition of a write operation in turn and throws the
+   *  exception corresponding to the first one that is not met. Only called
+   *  off the hot path, once the cached \ref transfer_state has indicated that
+   *  the device is not ready.
+   */
+  void                      validate_write_state() const;
+  
+  /*!
+   *  \brief Performs a blocking bulk transfer to the output endpoint.
+   *  
+   *  Performs a blocking bulk transfer to the output endpoint straight from the
+   *  provided buffer. Shared by all overloads of \ref write().
+   *  
+   *  \param [in] data The data to send. Libusb requires a mutable buffer but
+   *         will not modify its contents.
+   *  \param [in] num_bytes The number of bytes to send.
+   *  \param [in] timeout The timeout of the operation in milliseconds.
+   *  
+   *  \return The number of bytes written to the device.
+   */
+  unsigned int              bulk_write(data_t* data, unsigned int num_bytes, timeout_t timeout);
+  
+  /*!
+   *  \brief Performs a blocking bulk transfer to the output endpoint without
+   *         throwing.
+   *  
+   *  The synchronous part of \ref bulk_write(). The device must be ready to
+   *  write and not be using a reactor.
+   */
+  result<unsigned int>      try_bulk_write(data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept;
+  
+  /*!
+   *  \brief Copies data to the staging buffer used by writes from const
+   *         buffers, growing it if needed.
+   *  
+   *  \return false if the buffer could not be grown.
+   */
+  bool                      stage_write(const data_t* data, unsigned int num_bytes) noexcept;
+  
+  /*!
+   *  \brief Callback invoked by Libusb when an asynchronous transfer finishes.
+   *  
+   *  Callback invoked by Libusb from within the event handler when an
+   *  asynchronous transfer finishes, successfully or otherwise. Flags the
+   *  owning \ref async_transfer as completed.
+   *  
+   *  \param [in] transfer The Libusb transfer that finished.
+   */
+  static void               on_transfer_complete(libusb_transfer* transfer);
+  
+  /*!
+   *  \brief Fills and submits an asynchronous bulk transfer.
+   *  
+   *  Takes a free \ref async_transfer slot, fills it in with the provided
+   *  parameters, and submits it to Libusb, appending it to the queue of
+   *  pending transfers.
+   *  
+   *  \param [in] endpoint The address of the endpoint to transfer on.
+   *  \param [in] buffer The buffer to transfer to or from.
+   *  \param [in] num_bytes The number of bytes to transfer.
+   *  \param [in] slot The slot to submit, previously obtained from
+   *         \ref acquire_transfer_slot().
+   */
+  void                      submit_transfer(unsigned char endpoint, data_t* buffer, unsigned int num_bytes, async_transfer* slot);
+  
+  /*!
+   *  \brief Gets an unused \ref async_transfer slot.
+   *  
+   *  Gets an unused \ref async_transfer slot, reusing a previously released
+   *  slot if one is available. Throws an exception if the maximum number of
+   *  pending transfers has been reached.
+   *  
+   *  \return Pointer to an unused transfer slot.
+   */
+  async_transfer*           acquire_transfer_slot();
+  
+  /*!
+   *  \brief Waits for the given transfer to be flagged as completed.
+   *  
+   *  Pumps Libusb's event handler until the given transfer has been flagged as
+   *  completed by \ref on_transfer_complete().
+   *  
+   *  \param [in,out] slot The transfer to wait on.
+   */
+  void                      wait_for_transfer(async_transfer* slot);
+  
+  /*!
+   *  \brief Frees every \ref async_transfer slot owned by this object.
+   *  
+   *  Frees every \ref async_transfer slot owned by this object. Must only be
+   *  called when no transfers are pending.
+   */
+  void                      free_transfer_slots();
+  
+  /*!
+   *  \brief Performs a blocking bulk or interrupt transfer as an asynchronous
+   *         transfer completed by the event reactor.
+   *  
+   *  \param [in] endpoint The address of the endpoint to transfer on.
+   *  \param [in] buffer The buffer to transfer to or from.
+   *  \param [in] num_bytes The number of bytes to transfer.
+   *  \param [in] timeout The timeout of the operation in milliseconds.
+   *  \param [in] interrupt Whether the endpoint is an interrupt endpoint
+   *         rather than a bulk one.
+   *  
+   *  \return The number of bytes transferred.
+   */
+  unsigned int              reactor_transfer(unsigned char endpoint, data_t* buffer, unsigned int num_bytes, timeout_t timeout, bool interrupt = false);
+  
+  /*!
+   *  \brief Determines whether transfers are completed by a running event
+   *         reactor.
+   */
+  bool                      uses_reactor() const;
+  
+  /*!
+   *  \brief Looks up the metrics fed by this device, labelled with its serial
+   *         number. Called when the device is opened.
+   */
+  void                      bind_metrics();
+  
+  /*!
+   *  \brief Counts a transfer that completed in the device's metrics.
+   *  
+   *  \param [in] endpoint The address of the endpoint transferred on.
+   *  \param [in] num_bytes The number of bytes transferred.
+   */
+  void                      count_transfer(unsigned char endpoint, int num_bytes);
+  
+  /*!
+   *  \brief Counts a transfer that failed in the device's metrics.
+   *  
+   *  \param [in] libusb_error The Libusb error code of the failure.
+   */
+  void                      count_error(int libusb_error);
+  
+  /*!
+   *  \brief Records the start of a transfer in the capture in progress.
+   *  
+   *  \param [in] endpoint The address of the endpoint transferred on.
+   *  \param [in] interrupt Whether the transfer is an interrupt transfer.
+   *  \param [in] async Whether the transfer was submitted asynchronously.
+   *  \param [in] num_bytes The number of bytes to transfer.
+   *  \param [in] data The data being sent, or the buffer being read into.
+   *  
+   *  \return The ticket with which to finish the transfer, or 0 if nothing
+   *          is being captured.
+   */
+  capture_writer::ticket_t  capture_begin(unsigned char endpoint, bool interrupt, bool async, unsigned int num_bytes, const data_t* data) noexcept;
+  
+  /*!
+   *  \brief Records the outcome of a transfer in the capture in progress.
+   *  
+   *  \param [in] ticket The ticket \ref capture_begin() returned.
+   *  \param [in] endpoint The address of the endpoint transferred on.
+   *  \param [in] libusb_error The Libusb error code of the transfer.
+   *  \param [in] timeout The timeout of the transfer in milliseconds.
+   *  \param [in] num_bytes The number of bytes transferred.
+   *  \param [in] data The buffer read into, or **nullptr** for a write.
+   *  \param [in] finished The time at which the transfer finished.
+   */
+  void                      capture_end(capture_writer::ticket_t ticket, unsigned char endpoint, int libusb_error, timeout_t timeout,
+                                        int num_bytes, const data_t* data, capture_writer::clock_t::time_point finished) noexcept;
+  
+  /*!
+   *  \brief Translates the status of a finished asynchronous transfer into a
+   *         Libusb error code.
+   *  
+   *  \param [in] status The status of the transfer.
+   *  
+   *  \return LIBUSB_SUCCESS if the transfer completed, or the corresponding
+   *          error code otherwise.
+   */
+  static int                transfer_error(int status);
+  
+  
   /*!
    *  \brief Builds the device's \ref device_description descriptor.
    *  
@@ -186,6 +587,20 @@ private:
    */
   device_description*       build_device_description();
   
+  /*!
+   *  \brief Gets the device's \ref device_description descriptor, building
+   *         it only if no device of the same model was seen before.
+   *  
+   *  Descriptor trees are shared, read-only, by every device with the same
+   *  vendor ID, product ID, and release number connected at the same speed,
+   *  which describes its endpoints differently. A device that re-enumerates,
+   *  or several of the same model, then cost no more than the first.
+   *  
+   *  \return The shared descriptor. If an error occured, will return an empty
+   *          pointer instead.
+   */
+  std::shared_ptr<const device_description> shared_device_description();
+  
   /*!
    *  \brief Builds one of the device's \ref device_configuration descriptors.
    *  
@@ -275,6 +690,14 @@ private:
    */
   static void               throw_libusb_exception(int libusb_error, timeout_t timeout);
   
+  /*!
+   *  \brief Makes the failed result matching a Libusb error code, without
+   *         throwing.
+   *  
+   *  \see throw_libusb_exception(int libusb_error, timeout_t timeout)
+   */
+  static result<unsigned int> libusb_failure(int libusb_error, timeout_t timeout) noexcept;
+  
   
   
   /*! \brief Flag indicating that the object has been initalized. */
@@ -332,11 +755,15 @@ private:
   /*! \brief Device struct used for interacting with Libusb. */
   libusb_device* const      m_device;
   
+  /*! \brief Libusb context used for handling asynchronous events. */
+  libusb_context* const     m_context;
+  
   /*! \brief Handle used for communications with the device through Libusb. */
   libusb_device_handle*     m_device_handle;
   
-  /*! \brief Cached device descritor built during initialization. */
-  device_description*       m_device_description;
+  /*! \brief Cached device descritor fetched during initialization, shared
+   *         with other devices of the same model. */
+  std::shared_ptr<const device_description> m_device_description;
   
   /*! \brief Cached value of the device's manufacturer string. */
   std::string               m_manufacturer_string;
@@ -355,6 +782,79 @@ private:
   
   /*! \brief Flag indicating that \ref m_serial_number has been set. */
   bool                      m_serial_number_set;
+  
+  
+  
+  /*! \brief Cached transfer state. See \ref update_transfer_state(). */
+  transfer_state            m_transfer_state;
+  
+  /*!
+   *  \brief Reusable staging buffer used to hand const data to Libusb.
+   *  
+   *  Reusable staging buffer used by
+   *  \ref write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+   *  to copy const data into memory Libusb can accept. Grows as needed and is
+   *  never shrunk, so steady-state writes perform no allocations.
+   */
+  data_t*                   m_write_buffer;
+  
+  /*! \brief The size in bytes of \ref m_write_buffer. */
+  unsigned int              m_write_buffer_size;
+  
+  /*! \brief The maximum number of transfers allowed to be pending at once. */
+  unsigned int              m_max_pending_transfers;
+  
+  /*! \brief Submitted transfers, oldest first, that have not been collected. */
+  std::deque<async_transfer*> m_pending_transfers;
+  
+  /*! \brief Previously allocated transfer slots available for reuse. */
+  std::vector<async_transfer*> m_free_transfers;
+  
+  /*! \brief Slot used by blocking transfers completed by the reactor, or
+   *         nullptr if none has been needed yet. */
+  async_transfer*           m_sync_transfer;
+  
+  
+  
+  /*! \brief The reactor completing this device's transfers, if any. */
+  libusb_event_reactor*     m_reactor;
+  
+  /*! \brief Mutex guarding the completion flags of this device's transfers
+   *         while a reactor is in use. */
+  std::mutex                m_completion_mutex;
+  
+  /*! \brief Condition signalled whenever one of this device's transfers
+   *         finishes. */
+  std::condition_variable   m_completion_condition;
+  
+  /*! \brief Count of calls to \ref abort_pending_transfers(). Transfers
+   *         submitted before the latest call are abandoned. */
+  std::atomic<unsigned int> m_abort_generation;
+  
+  
+  
+  /*! \brief Metric counting completed transfers from the device. */
+  metric*                   m_metric_transfers_in;
+  
+  /*! \brief Metric counting completed transfers to the device. */
+  metric*                   m_metric_transfers_out;
+  
+  /*! \brief Metric counting bytes received from the device. */
+  metric*                   m_metric_bytes_in;
+  
+  /*! \brief Metric counting bytes sent to the device. */
+  metric*                   m_metric_bytes_out;
+  
+  /*! \brief Metric counting failed transfers, including timeouts. */
+  metric*                   m_metric_errors;
+  
+  /*! \brief Metric counting transfers that timed out. */
+  metric*                   m_metric_timeouts;
+  
+  
+  
+  /*! \brief The capture transfers are recorded to, if any. */
+  capture_writer*           m_capture;
 };
 
 }
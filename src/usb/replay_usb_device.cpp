@@ -0,0 +1,420 @@
+/*! \file
+ *  \brief File containing the implementation of the
+ *         \ref usb::replay_usb_device class.
+ *  
+ *  File containing the implementation of the \ref usb::replay_usb_device
+ *  class. See corresponding header file to view documentation for the class,
+ *  its methods, and its member variables.
+ *  
+ *  \see usb::replay_usb_device
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-27
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "replay_usb_device.h"
+#include "usb_result.h"
+#include "exception/uninitialized_exception.h"
+#include "exception/unopen_exception.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#define CLASS_NAME "replay_usb_device"
+
+#define DEFAULT_MAX_PENDING_TRANSFERS 16
+
+#define REPLAYED_FAILURE_MESSAGE      "failure replayed from USB capture"
+
+namespace usb
+{
+
+typedef replay_usb_device::timeout_t          timeout_t;
+typedef replay_usb_device::configuration_t    configuration_t;
+typedef replay_usb_device::interface_t        interface_t;
+typedef replay_usb_device::endpoint_t         endpoint_t;
+typedef replay_usb_device::data_t             data_t;
+typedef replay_usb_device::device_description device_description;
+
+static const char* transfer_type_name(captured_transfer_type type)
+{
+  switch (type)
+  {
+  case CAPTURED_BULK_OUT:     return "write";
+  case CAPTURED_BULK_IN:      return "read";
+  case CAPTURED_INTERRUPT_IN: return "interrupt read";
+  default:                    return "transfer";
+  }
+}
+
+
+
+replay_usb_device::replay_usb_device(const std::string& path, double time_scale)
+  : m_path(path), m_time_scale(time_scale < 0 ? 0 : time_scale), m_session(nullptr),
+    m_was_initialized(false), m_is_open(false), m_timeout(0),
+    m_configuration(0), m_interface(0), m_input_endpoint(0),
+    m_output_endpoint(0), m_next_transfer(0),
+    m_max_pending_transfers(DEFAULT_MAX_PENDING_TRANSFERS)
+{
+  // Nothing else to do
+}
+
+replay_usb_device::~replay_usb_device()
+{
+  delete m_session;
+}
+
+void replay_usb_device::init()
+{
+  if (m_was_initialized)
+  {
+    return;
+  }
+  
+  m_session = new capture_session(m_path);
+  m_was_initialized = true;
+}
+
+
+
+timeout_t replay_usb_device::timeout() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  return m_timeout;
+}
+
+configuration_t replay_usb_device::configuration() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  return m_configuration;
+}
+
+interface_t replay_usb_device::interface() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  return m_interface;
+}
+
+endpoint_t replay_usb_device::input_endpoint() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  return m_input_endpoint;
+}
+
+endpoint_t replay_usb_device::output_endpoint() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  return m_output_endpoint;
+}
+
+const device_description* replay_usb_device::get_device_description() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  return m_session->description();
+}
+
+std::string replay_usb_device::get_manufacturer_string()
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  return m_session->manufacturer;
+}
+
+std::string replay_usb_device::get_product_string()
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  return m_session->product;
+}
+
+std::string replay_usb_device::get_serial_number()
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  return m_session->serial_number;
+}
+
+
+
+void replay_usb_device::set_timeout(timeout_t timeout)
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  m_timeout = timeout;
+}
+
+void replay_usb_device::set_configuration(configuration_t configuration)
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  m_configuration = configuration;
+}
+
+void replay_usb_device::set_interface(interface_t interface)
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  m_interface = interface;
+}
+
+void replay_usb_device::set_input_endpoint(endpoint_t input_endpoint)
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  m_input_endpoint = input_endpoint;
+}
+
+void replay_usb_device::set_output_endpoint(endpoint_t output_endpoint)
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  m_output_endpoint = output_endpoint;
+}
+
+
+
+void replay_usb_device::open()
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  m_is_open = true;
+}
+
+void replay_usb_device::close()
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  cancel_pending_transfers();
+  m_is_open = false;
+}
+
+unsigned int replay_usb_device::read(data_t* data, unsigned int num_bytes)
+{
+  return read(data, num_bytes, m_timeout);
+}
+
+unsigned int replay_usb_device::read(data_t* data, unsigned int num_bytes, timeout_t timeout)
+{
+  (void) timeout;
+  validate_state();
+  
+  const captured_transfer& transfer = next_transfer(CAPTURED_BULK_IN, num_bytes, nullptr);
+  std::this_thread::sleep_until(completion_time(transfer));
+  return finish_transfer(transfer, data);
+}
+
+unsigned int replay_usb_device::write(const data_t* buffer, unsigned int num_bytes)
+{
+  return write(buffer, num_bytes, m_timeout);
+}
+
+unsigned int replay_usb_device::write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+{
+  (void) timeout;
+  validate_state();
+  
+  const captured_transfer& transfer = next_transfer(CAPTURED_BULK_OUT, num_bytes, buffer);
+  std::this_thread::sleep_until(completion_time(transfer));
+  return finish_transfer(transfer, nullptr);
+}
+
+unsigned int replay_usb_device::write(data_t* buffer, unsigned int num_bytes)
+{
+  return write((const data_t*) buffer, num_bytes, m_timeout);
+}
+
+unsigned int replay_usb_device::write(data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+{
+  return write((const data_t*) buffer, num_bytes, timeout);
+}
+
+
+
+bool replay_usb_device::supports_async_transfers() const
+{
+  return true;
+}
+
+unsigned int replay_usb_device::max_pending_transfers() const
+{
+  return m_max_pending_transfers;
+}
+
+void replay_usb_device::set_max_pending_transfers(unsigned int max_pending)
+{
+  if (max_pending == 0)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(max_pending)
+                                + " for max pending transfers");
+  }
+  m_max_pending_transfers = max_pending;
+}
+
+unsigned int replay_usb_device::num_pending_transfers() const
+{
+  return (unsigned int) m_pending_transfers.size();
+}
+
+void replay_usb_device::submit_read(data_t* data, unsigned int num_bytes)
+{
+  validate_state();
+  if (m_pending_transfers.size() >= m_max_pending_transfers)
+  {
+    throw std::runtime_error("Too many pending transfers");
+  }
+  
+  const captured_transfer& transfer = next_transfer(CAPTURED_BULK_IN, num_bytes, nullptr);
+  pending_transfer pending = {&transfer, data, completion_time(transfer)};
+  m_pending_transfers.push_back(pending);
+}
+
+void replay_usb_device::submit_write(const data_t* data, unsigned int num_bytes)
+{
+  validate_state();
+  if (m_pending_transfers.size() >= m_max_pending_transfers)
+  {
+    throw std::runtime_error("Too many pending transfers");
+  }
+  
+  // The data is checked now, since the caller may reuse its buffer
+  const captured_transfer& transfer = next_transfer(CAPTURED_BULK_OUT, num_bytes, data);
+  pending_transfer pending = {&transfer, nullptr, completion_time(transfer)};
+  m_pending_transfers.push_back(pending);
+}
+
+unsigned int replay_usb_device::complete_transfer()
+{
+  if (m_pending_transfers.empty())
+  {
+    throw std::runtime_error("No pending transfers");
+  }
+  
+  pending_transfer pending = m_pending_transfers.front();
+  m_pending_transfers.pop_front();
+  std::this_thread::sleep_until(pending.done);
+  return finish_transfer(*pending.transfer, pending.data);
+}
+
+void replay_usb_device::cancel_pending_transfers()
+{
+  // The cancelled transfers were recorded as they were submitted, so they
+  // have already been played back
+  m_pending_transfers.clear();
+}
+
+bool replay_usb_device::recover()
+{
+  if (!m_is_open)
+  {
+    return false;
+  }
+  
+  cancel_pending_transfers();
+  return true;
+}
+
+
+
+bool replay_usb_device::supports_interrupt_reads() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  
+  for (const captured_transfer& transfer : m_session->transfers)
+  {
+    if (transfer.type == CAPTURED_INTERRUPT_IN)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned int replay_usb_device::read_interrupt(endpoint_t endpoint, data_t* data, unsigned int num_bytes, timeout_t timeout)
+{
+  (void) endpoint;
+  (void) timeout;
+  validate_state();
+  
+  const captured_transfer& transfer = next_transfer(CAPTURED_INTERRUPT_IN, num_bytes, nullptr);
+  std::this_thread::sleep_until(completion_time(transfer));
+  return finish_transfer(transfer, data);
+}
+
+
+
+unsigned int replay_usb_device::num_transfers() const
+{
+  return (m_session != nullptr ? (unsigned int) m_session->transfers.size() : 0);
+}
+
+unsigned int replay_usb_device::num_transfers_replayed() const
+{
+  return m_next_transfer;
+}
+
+unsigned long long replay_usb_device::captured_duration_us() const
+{
+  unsigned long long duration_us = 0;
+  if (m_session != nullptr)
+  {
+    for (const captured_transfer& transfer : m_session->transfers)
+    {
+      duration_us = std::max(duration_us, transfer.start_us + transfer.duration_us);
+    }
+  }
+  return duration_us;
+}
+
+
+
+void replay_usb_device::validate_state() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  if (!m_is_open) throw unopen_exception(CLASS_NAME);
+}
+
+const captured_transfer& replay_usb_device::next_transfer(captured_transfer_type type, unsigned int num_bytes, const data_t* data)
+{
+  std::string position = "transfer " + std::to_string(m_next_transfer + 1);
+  if (m_next_transfer >= m_session->transfers.size())
+  {
+    throw std::runtime_error("Replay of " + m_path + " ran past the end of the capture at " + position);
+  }
+  
+  const captured_transfer& transfer = m_session->transfers[m_next_transfer];
+  if (transfer.type != type)
+  {
+    throw std::runtime_error("Replay of " + m_path + " diverged at " + position + ": expected a "
+                             + transfer_type_name(transfer.type) + ", got a " + transfer_type_name(type));
+  }
+  
+  // A read may be given a larger buffer than it was during the capture, as
+  // long as what the device sent still fits
+  bool size_matches = (type == CAPTURED_BULK_OUT ? transfer.num_bytes == num_bytes : transfer.actual_bytes <= num_bytes);
+  if (!size_matches)
+  {
+    throw std::runtime_error("Replay of " + m_path + " diverged at " + position + ": expected a "
+                             + transfer_type_name(type) + " of " + std::to_string(transfer.num_bytes)
+                             + " bytes, got one of " + std::to_string(num_bytes));
+  }
+  if (type == CAPTURED_BULK_OUT && capture_checksum(data, num_bytes) != transfer.checksum)
+  {
+    throw std::runtime_error("Replay of " + m_path + " diverged at " + position + ": data written differs from the capture");
+  }
+  
+  ++m_next_transfer;
+  return transfer;
+}
+
+replay_usb_device::clock_t::time_point replay_usb_device::completion_time(const captured_transfer& transfer) const
+{
+  return clock_t::now() + std::chrono::microseconds((unsigned long long) (transfer.duration_us * m_time_scale));
+}
+
+unsigned int replay_usb_device::finish_transfer(const captured_transfer& transfer, data_t* data)
+{
+  if (transfer.status != TRANSFER_OK)
+  {
+    result<unsigned int>::failure(transfer.status, transfer.code, REPLAYED_FAILURE_MESSAGE).throw_if_failed();
+  }
+  
+  if (data != nullptr && !transfer.data.empty())
+  {
+    memcpy(data, transfer.data.data(), transfer.data.size());
+  }
+  return transfer.actual_bytes;
+}
+
+}
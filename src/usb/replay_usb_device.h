@@ -0,0 +1,352 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref usb::replay_usb_device
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref usb::replay_usb_device class. This file includes the minimal number of
+ *  files necessary to use any instance of the \ref usb::replay_usb_device
+ *  class.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-27
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __REPLAY_USB_DEVICE_H__
+#define __REPLAY_USB_DEVICE_H__
+
+#include "usb_device.h"
+#include "usb_capture.h"
+#include <chrono>
+#include <deque>
+#include <string>
+
+namespace usb
+{
+
+/*! \class replay_usb_device
+ *  \brief Implementation of \ref usb_device that plays back a session
+ *         recorded by \ref libusb_usb_device::start_capture().
+ *  
+ *  Rather than talking to hardware, answers every transfer with the next one
+ *  recorded in a capture file: reads return the data the device sent, writes
+ *  are checked against the checksum of the data the host sent, and failures
+ *  are thrown again as the exceptions they caused. Each transfer takes as
+ *  long as the device took to complete it during the capture, scaled by a
+ *  configurable factor, while the time the host spends between transfers is
+ *  its own. Passing an instance of this class to \ref ngp_linkmasta_device or
+ *  \ref ws_linkmasta_device therefore reruns a real session against the real
+ *  device's timing, so that changes to the linkmasta and cartridge code can
+ *  be timed and checked without the device attached.
+ *  
+ *  A replay only works as long as the host issues the same transfers in the
+ *  same order as it did during the capture. As soon as it doesn't, the
+ *  transfer throws std::runtime_error naming the first transfer that
+ *  differed.
+ *  
+ *  This class is *not* thread-safe. Use caution when working in a multithreaded
+ *  environment.
+ */
+class replay_usb_device : public usb_device
+{
+public:
+  
+  /*!
+   *  \brief Main constructor for the class.
+   *  
+   *  \param [in] path The path of the capture file to play back. The file is
+   *         only read by \ref init().
+   *  \param [in] time_scale Factor by which to multiply the time each
+   *         transfer took during the capture. 0 completes every transfer
+   *         right away, measuring only the host's share of the time.
+   */
+                            replay_usb_device(const std::string& path, double time_scale = 1.0);
+  
+  /*!
+   *  \brief The destructor for the class.
+   */
+                            ~replay_usb_device();
+  
+  /*!
+   *  \see usb_device::init()
+   *  
+   *  \throws std::runtime_error If the capture file can't be read.
+   */
+  void                      init();
+  
+  
+  
+  /*!
+   *  \see usb_device::timeout()
+   */
+  timeout_t                 timeout() const;
+  
+  /*!
+   *  \see usb_device::configuration()
+   */
+  configuration_t           configuration() const;
+  
+  /*!
+   *  \see usb_device::interface()
+   */
+  interface_t               interface() const;
+  
+  /*!
+   *  \see usb_device::input_endpoint()
+   */
+  endpoint_t                input_endpoint() const;
+  
+  /*!
+   *  \see usb_device::output_endpoint()
+   */
+  endpoint_t                output_endpoint() const;
+  
+  /*!
+   *  \brief Gets the descriptor of the device that was captured.
+   *  
+   *  \see usb_device::get_device_description()
+   */
+  const device_description* get_device_description() const;
+  
+  /*!
+   *  \see usb_device::get_manufacturer_string()
+   */
+  std::string               get_manufacturer_string();
+  
+  /*!
+   *  \see usb_device::get_product_string()
+   */
+  std::string               get_product_string();
+  
+  /*!
+   *  \see usb_device::get_serial_number()
+   */
+  std::string               get_serial_number();
+  
+  
+  
+  /*!
+   *  \see usb_device::set_timeout(timeout_t timeout)
+   */
+  void                      set_timeout(timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::set_configuration(configuration_t configuration)
+   */
+  void                      set_configuration(configuration_t configuration);
+  
+  /*!
+   *  \see usb_device::set_interface(interface_t interface)
+   */
+  void                      set_interface(interface_t interface);
+  
+  /*!
+   *  \see usb_device::set_input_endpoint(endpoint_t input_endpoint)
+   */
+  void                      set_input_endpoint(endpoint_t input_endpoint);
+  
+  /*!
+   *  \see usb_device::set_output_endpoint(endpoint_t output_endpoint)
+   */
+  void                      set_output_endpoint(endpoint_t output_endpoint);
+  
+  
+  
+  /*!
+   *  \see usb_device::open()
+   */
+  void                      open();
+  
+  /*!
+   *  \see usb_device::close()
+   */
+  void                      close();
+  
+  /*!
+   *  \see usb_device::read(data_t* data, unsigned int num_bytes)
+   */
+  unsigned int              read(data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::read(data_t* data, unsigned int num_bytes, timeout_t timeout)
+   */
+  unsigned int              read(data_t* data, unsigned int num_bytes, timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::write(const data_t* buffer, unsigned int num_bytes)
+   */
+  unsigned int              write(const data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+   */
+  unsigned int              write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::write(data_t* buffer, unsigned int num_bytes)
+   */
+  unsigned int              write(data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::write(data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+   */
+  unsigned int              write(data_t* buffer, unsigned int num_bytes, timeout_t timeout);
+  
+  
+  
+  /*!
+   *  \see usb_device::supports_async_transfers()
+   */
+  bool                      supports_async_transfers() const;
+  
+  /*!
+   *  \see usb_device::max_pending_transfers()
+   */
+  unsigned int              max_pending_transfers() const;
+  
+  /*!
+   *  \see usb_device::set_max_pending_transfers(unsigned int max_pending)
+   */
+  void                      set_max_pending_transfers(unsigned int max_pending);
+  
+  /*!
+   *  \see usb_device::num_pending_transfers()
+   */
+  unsigned int              num_pending_transfers() const;
+  
+  /*!
+   *  \see usb_device::submit_read(data_t* data, unsigned int num_bytes)
+   */
+  void                      submit_read(data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::submit_write(const data_t* data, unsigned int num_bytes)
+   */
+  void                      submit_write(const data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::complete_transfer()
+   */
+  unsigned int              complete_transfer();
+  
+  /*!
+   *  \see usb_device::cancel_pending_transfers()
+   */
+  void                      cancel_pending_transfers();
+  
+  /*!
+   *  \brief Discards pending transfers. Recordings don't include the stale
+   *         data \ref libusb_usb_device::recover() drains, so nothing is
+   *         read.
+   *  
+   *  \see usb_device::recover()
+   */
+  bool                      recover();
+  
+  /*!
+   *  \brief Determines whether the capture includes interrupt transfers.
+   *  
+   *  \see usb_device::supports_interrupt_reads()
+   */
+  bool                      supports_interrupt_reads() const;
+  
+  /*!
+   *  \see usb_device::read_interrupt(endpoint_t endpoint, data_t* data, unsigned int num_bytes, timeout_t timeout)
+   */
+  unsigned int              read_interrupt(endpoint_t endpoint, data_t* data, unsigned int num_bytes, timeout_t timeout);
+  
+  
+  
+  /*!
+   *  \brief Gets the number of transfers in the capture.
+   */
+  unsigned int              num_transfers() const;
+  
+  /*!
+   *  \brief Gets the number of transfers played back so far.
+   */
+  unsigned int              num_transfers_replayed() const;
+  
+  /*!
+   *  \brief Gets the time in microseconds from the start of the capture to
+   *         the completion of its last transfer, the time the captured
+   *         session took.
+   */
+  unsigned long long        captured_duration_us() const;
+
+
+
+private:
+  
+  /*! \brief Clock used for simulating transfer times. */
+  typedef std::chrono::steady_clock clock_t;
+  
+  /*!
+   *  \brief A transfer submitted but not yet completed.
+   */
+  struct pending_transfer
+  {
+    /*! \brief The recorded transfer being played back. */
+    const captured_transfer* transfer;
+    
+    /*! \brief Destination of a read, or nullptr for a write. */
+    data_t*                 data;
+    
+    /*! \brief The time at which the transfer completes. */
+    clock_t::time_point     done;
+  };
+  
+  
+  
+  void                      validate_state() const;
+  
+  /*!
+   *  \brief Takes the next recorded transfer, checking that it is the one
+   *         the host is making.
+   *  
+   *  \param [in] type The kind of transfer the host is making.
+   *  \param [in] num_bytes The number of bytes the host asked to transfer.
+   *  \param [in] data The data the host is writing, or **nullptr** for a
+   *         read.
+   *  
+   *  \throws std::runtime_error If the capture has run out or the recorded
+   *          transfer differs.
+   */
+  const captured_transfer&  next_transfer(captured_transfer_type type, unsigned int num_bytes, const data_t* data);
+  
+  /*!
+   *  \brief Gets the time at which a transfer started now completes.
+   */
+  clock_t::time_point       completion_time(const captured_transfer& transfer) const;
+  
+  /*!
+   *  \brief Produces the result of a recorded transfer once it has completed,
+   *         copying the data of a read and throwing a recorded failure.
+   */
+  unsigned int              finish_transfer(const captured_transfer& transfer, data_t* data);
+  
+  
+  
+  const std::string         m_path;
+  const double              m_time_scale;
+  capture_session*          m_session;
+  
+  bool                      m_was_initialized;
+  bool                      m_is_open;
+  timeout_t                 m_timeout;
+  configuration_t           m_configuration;
+  interface_t               m_interface;
+  endpoint_t                m_input_endpoint;
+  endpoint_t                m_output_endpoint;
+  
+  /*! \brief Index of the next recorded transfer to play back. */
+  unsigned int              m_next_transfer;
+  
+  /*! \brief Transfers submitted asynchronously, in order of submission. */
+  std::deque<pending_transfer> m_pending_transfers;
+  unsigned int              m_max_pending_transfers;
+};
+
+}
+
+#endif /* defined(__REPLAY_USB_DEVICE_H__) */
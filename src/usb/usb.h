@@ -19,6 +19,7 @@
 #include "usbfwd.h"
 #include "usb_device.h"
 #include "libusb_usb_device.h"
+#include "usbfs_usb_device.h"
 
 #include "exception/exception.h"
 #include "exception/busy_exception.h"
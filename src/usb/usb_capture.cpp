@@ -0,0 +1,509 @@
+/*! \file
+ *  \brief File containing the implementation of the \ref usb::capture_writer
+ *         and \ref usb::capture_session classes.
+ *  
+ *  File containing the implementation of the \ref usb::capture_writer and
+ *  \ref usb::capture_session classes. See corresponding header file to view
+ *  documentation for the classes, their methods, and their member variables.
+ *  
+ *  \see usb::capture_writer
+ *  \see usb::capture_session
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-27
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "usb_capture.h"
+#include <stdexcept>
+
+#define CAPTURE_MAGIC          "FMUSBCAP"
+#define CAPTURE_MAGIC_SIZE     8
+#define CAPTURE_VERSION        1
+
+// Layout of the byte at the start of every transfer record
+#define RECORD_TYPE_MASK       0x03
+#define RECORD_ASYNC           0x04
+#define RECORD_FAILED          0x08
+
+// Longest string descriptor USB allows, with room to spare
+#define MAX_STRING_SIZE        0x400
+
+#define FNV_OFFSET_BASIS       2166136261u
+#define FNV_PRIME              16777619u
+
+namespace usb
+{
+
+typedef usb_device::device_description   device_description;
+typedef usb_device::device_configuration device_configuration;
+typedef usb_device::device_interface     device_interface;
+typedef usb_device::device_alt_setting   device_alt_setting;
+typedef usb_device::device_endpoint      device_endpoint;
+
+// Signed values are stored zigzag-encoded so that small negative codes stay
+// small
+static unsigned long long zigzag_encode(long long value)
+{
+  return ((unsigned long long) value << 1) ^ (unsigned long long) (value >> 63);
+}
+
+static long long zigzag_decode(unsigned long long value)
+{
+  return (long long) (value >> 1) ^ -(long long) (value & 1);
+}
+
+uint32_t capture_checksum(const unsigned char* data, unsigned int num_bytes) noexcept
+{
+  uint32_t hash = FNV_OFFSET_BASIS;
+  for (unsigned int i = 0; i < num_bytes; ++i)
+  {
+    hash = (hash ^ data[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+
+
+capture_writer::capture_writer(const std::string& path, const device_description& description,
+                               const std::string& manufacturer, const std::string& product,
+                               const std::string& serial_number)
+  : m_path(path), m_start(clock_t::now()), m_failed(false), m_first_ticket(0),
+    m_last_start_us(0), m_num_transfers(0)
+{
+  m_file.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!m_file.is_open())
+  {
+    throw std::runtime_error("Unable to open file " + path);
+  }
+  
+  m_file.write(CAPTURE_MAGIC, CAPTURE_MAGIC_SIZE);
+  write_number(CAPTURE_VERSION);
+  write_string(manufacturer);
+  write_string(product);
+  write_string(serial_number);
+  write_description(description);
+  
+  if (!m_file.good())
+  {
+    throw std::runtime_error("Error occured while writing to file " + path);
+  }
+}
+
+capture_writer::~capture_writer()
+{
+  write_finished();
+  m_file.close();
+}
+
+capture_writer::ticket_t capture_writer::begin_transfer(captured_transfer_type type, unsigned char endpoint, bool async,
+                                                        unsigned int num_bytes, const unsigned char* data) noexcept
+{
+  ticket_t ticket = m_first_ticket + m_queue.size();
+  if (m_failed)
+  {
+    return ticket;
+  }
+  
+  try
+  {
+    m_queue.push_back(entry());
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    m_failed = true;
+    return ticket;
+  }
+  
+  entry& started = m_queue.back();
+  started.finished = false;
+  started.transfer.type = type;
+  started.transfer.async = async;
+  started.transfer.endpoint = endpoint;
+  started.transfer.status = TRANSFER_OK;
+  started.transfer.code = 0;
+  started.transfer.num_bytes = num_bytes;
+  started.transfer.actual_bytes = 0;
+  started.transfer.start_us = (unsigned long long) std::chrono::duration_cast<std::chrono::microseconds>(clock_t::now() - m_start).count();
+  started.transfer.duration_us = 0;
+  started.transfer.checksum = (data != nullptr ? capture_checksum(data, num_bytes) : 0);
+  return ticket;
+}
+
+void capture_writer::end_transfer(ticket_t ticket, transfer_status status, int code, unsigned int actual_bytes,
+                                  const unsigned char* data, clock_t::time_point finished) noexcept
+{
+  if (m_failed || ticket < m_first_ticket || ticket - m_first_ticket >= m_queue.size())
+  {
+    return;
+  }
+  
+  entry& ended = m_queue[(size_t) (ticket - m_first_ticket)];
+  unsigned long long end_us = (unsigned long long) std::chrono::duration_cast<std::chrono::microseconds>(finished - m_start).count();
+  ended.finished = true;
+  ended.transfer.status = status;
+  ended.transfer.code = code;
+  ended.transfer.actual_bytes = actual_bytes;
+  ended.transfer.duration_us = (end_us > ended.transfer.start_us ? end_us - ended.transfer.start_us : 0);
+  
+  try
+  {
+    // Incoming data is always stored in full so that the record can be read
+    // back
+    if (status == TRANSFER_OK && ended.transfer.type != CAPTURED_BULK_OUT)
+    {
+      if (data != nullptr)
+      {
+        ended.transfer.data.assign(data, data + actual_bytes);
+      }
+      else
+      {
+        ended.transfer.data.assign(actual_bytes, 0);
+      }
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    m_failed = true;
+    return;
+  }
+  
+  write_finished();
+}
+
+void capture_writer::end_transfer(ticket_t ticket, transfer_status status, int code, unsigned int actual_bytes,
+                                  const unsigned char* data) noexcept
+{
+  end_transfer(ticket, status, code, actual_bytes, data, clock_t::now());
+}
+
+bool capture_writer::failed() const noexcept
+{
+  return m_failed;
+}
+
+unsigned long long capture_writer::num_transfers() const noexcept
+{
+  return m_num_transfers;
+}
+
+
+
+void capture_writer::write_finished() noexcept
+{
+  if (m_failed)
+  {
+    return;
+  }
+  
+  try
+  {
+    while (!m_queue.empty() && m_queue.front().finished)
+    {
+      write_transfer(m_queue.front().transfer);
+      m_queue.pop_front();
+      ++m_first_ticket;
+      ++m_num_transfers;
+    }
+    if (!m_file.good())
+    {
+      m_failed = true;
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    m_failed = true;
+  }
+}
+
+void capture_writer::write_transfer(const captured_transfer& transfer)
+{
+  bool failed = (transfer.status != TRANSFER_OK);
+  unsigned char flags = (unsigned char) (transfer.type & RECORD_TYPE_MASK);
+  flags |= (transfer.async ? RECORD_ASYNC : 0);
+  flags |= (failed ? RECORD_FAILED : 0);
+  m_file.put((char) flags);
+  m_file.put((char) transfer.endpoint);
+  
+  // Transfers are written in the order they were started, so each start is
+  // stored as a small step from the last
+  write_number(transfer.start_us >= m_last_start_us ? transfer.start_us - m_last_start_us : 0);
+  m_last_start_us = (transfer.start_us >= m_last_start_us ? transfer.start_us : m_last_start_us);
+  write_number(transfer.duration_us);
+  write_number(transfer.num_bytes);
+  write_number(transfer.actual_bytes);
+  
+  if (failed)
+  {
+    m_file.put((char) transfer.status);
+    write_number(zigzag_encode(transfer.code));
+  }
+  
+  if (transfer.type == CAPTURED_BULK_OUT)
+  {
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+      m_file.put((char) (transfer.checksum >> (i * 8)));
+    }
+  }
+  else if (!failed)
+  {
+    m_file.write((const char*) transfer.data.data(), (std::streamsize) transfer.data.size());
+  }
+}
+
+void capture_writer::write_description(const device_description& description)
+{
+  write_number(zigzag_encode(description.device_class));
+  write_number((unsigned int) description.vendor_id);
+  write_number((unsigned int) description.product_id);
+  
+  // Missing descriptors are written as empty ones
+  write_number(description.num_configurations);
+  for (unsigned int c = 0; c < description.num_configurations; ++c)
+  {
+    const device_configuration* config = description.configurations[c];
+    write_number(config != nullptr ? config->config_id : 0);
+    write_number(config != nullptr ? config->num_interfaces : 0);
+    for (unsigned int i = 0; config != nullptr && i < config->num_interfaces; ++i)
+    {
+      const device_interface* interface = config->interfaces[i];
+      write_number(interface != nullptr ? interface->interface_id : 0);
+      write_number(interface != nullptr ? interface->num_alt_settings : 0);
+      for (unsigned int a = 0; interface != nullptr && a < interface->num_alt_settings; ++a)
+      {
+        const device_alt_setting* alt_setting = interface->alt_settings[a];
+        write_number(alt_setting != nullptr ? alt_setting->interface_id : 0);
+        write_number(alt_setting != nullptr ? alt_setting->alt_setting_id : 0);
+        write_number(alt_setting != nullptr ? alt_setting->num_endpoints : 0);
+        for (unsigned int e = 0; alt_setting != nullptr && e < alt_setting->num_endpoints; ++e)
+        {
+          device_endpoint empty;
+          const device_endpoint* endpoint = (alt_setting->endpoints[e] != nullptr ? alt_setting->endpoints[e] : &empty);
+          write_number(endpoint->address);
+          write_number(endpoint->transfer_type);
+          write_number(endpoint->direction);
+          write_number(endpoint->max_packet_size);
+        }
+      }
+    }
+  }
+}
+
+void capture_writer::write_number(unsigned long long value)
+{
+  // Seven bits at a time, lowest first, with the top bit set on all but the
+  // last byte
+  while (value >= 0x80)
+  {
+    m_file.put((char) ((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  m_file.put((char) value);
+}
+
+void capture_writer::write_string(const std::string& value)
+{
+  write_number(value.size());
+  m_file.write(value.data(), (std::streamsize) value.size());
+}
+
+
+
+capture_session::capture_session(const std::string& path)
+  : m_path(path), m_description(nullptr)
+{
+  m_file.open(path.c_str(), std::ios::in | std::ios::binary);
+  if (!m_file.is_open())
+  {
+    throw std::runtime_error("Unable to open file " + path);
+  }
+  
+  char magic[CAPTURE_MAGIC_SIZE];
+  m_file.read(magic, CAPTURE_MAGIC_SIZE);
+  if (!m_file.good() || std::string(magic, CAPTURE_MAGIC_SIZE) != CAPTURE_MAGIC)
+  {
+    throw std::runtime_error(path + " is not a USB capture");
+  }
+  if (read_number() != CAPTURE_VERSION)
+  {
+    throw std::runtime_error(path + " is a USB capture of an unsupported version");
+  }
+  
+  manufacturer = read_string();
+  product = read_string();
+  serial_number = read_string();
+  m_description = read_description();
+  
+  try
+  {
+    unsigned long long last_start_us = 0;
+    while (m_file.peek() != std::ifstream::traits_type::eof())
+    {
+      transfers.push_back(captured_transfer());
+      read_transfer(&transfers.back(), &last_start_us);
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    
+    // A capture cut short, as by the program being killed, ends with a
+    // partial record, which is dropped
+    if (!transfers.empty())
+    {
+      transfers.pop_back();
+    }
+  }
+  m_file.close();
+}
+
+capture_session::~capture_session()
+{
+  delete m_description;
+}
+
+const device_description* capture_session::description() const
+{
+  return m_description;
+}
+
+
+
+device_description* capture_session::read_description()
+{
+  int device_class = (int) zigzag_decode(read_number());
+  int vendor_id = (int) read_number();
+  int product_id = (int) read_number();
+  
+  device_description* description = new device_description((unsigned int) read_number());
+  description->device_class = device_class;
+  description->vendor_id = vendor_id;
+  description->product_id = product_id;
+  try
+  {
+    for (unsigned int c = 0; c < description->num_configurations; ++c)
+    {
+      unsigned int config_id = (unsigned int) read_number();
+      device_configuration* config = new device_configuration((unsigned int) read_number());
+      description->configurations[c] = config;
+      config->config_id = config_id;
+      for (unsigned int i = 0; i < config->num_interfaces; ++i)
+      {
+        usb_device::interface_t interface_id = (usb_device::interface_t) read_number();
+        device_interface* interface = new device_interface((unsigned int) read_number());
+        config->interfaces[i] = interface;
+        interface->interface_id = interface_id;
+        for (unsigned int a = 0; a < interface->num_alt_settings; ++a)
+        {
+          usb_device::interface_t alt_interface_id = (usb_device::interface_t) read_number();
+          usb_device::alt_setting_t alt_setting_id = (usb_device::alt_setting_t) read_number();
+          device_alt_setting* alt_setting = new device_alt_setting((unsigned int) read_number());
+          interface->alt_settings[a] = alt_setting;
+          alt_setting->interface_id = alt_interface_id;
+          alt_setting->alt_setting_id = alt_setting_id;
+          for (unsigned int e = 0; e < alt_setting->num_endpoints; ++e)
+          {
+            device_endpoint* endpoint = new device_endpoint();
+            alt_setting->endpoints[e] = endpoint;
+            endpoint->address = (usb_device::endpoint_t) read_number();
+            endpoint->transfer_type = (usb_device::endpoint_transfer_type) read_number();
+            endpoint->direction = (usb_device::endpoint_direction) read_number();
+            endpoint->max_packet_size = (unsigned int) read_number();
+          }
+        }
+      }
+    }
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    delete description;
+    throw;
+  }
+  return description;
+}
+
+void capture_session::read_transfer(captured_transfer* transfer, unsigned long long* last_start_us)
+{
+  unsigned char header[2];
+  read_bytes(header, sizeof(header));
+  bool failed = (header[0] & RECORD_FAILED) != 0;
+  transfer->type = (captured_transfer_type) (header[0] & RECORD_TYPE_MASK);
+  transfer->async = (header[0] & RECORD_ASYNC) != 0;
+  transfer->endpoint = header[1];
+  
+  *last_start_us += read_number();
+  transfer->start_us = *last_start_us;
+  transfer->duration_us = read_number();
+  transfer->num_bytes = (unsigned int) read_number();
+  transfer->actual_bytes = (unsigned int) read_number();
+  transfer->status = TRANSFER_OK;
+  transfer->code = 0;
+  transfer->checksum = 0;
+  
+  if (failed)
+  {
+    unsigned char status;
+    read_bytes(&status, 1);
+    transfer->status = (transfer_status) status;
+    transfer->code = (int) zigzag_decode(read_number());
+  }
+  
+  if (transfer->type == CAPTURED_BULK_OUT)
+  {
+    unsigned char checksum[4];
+    read_bytes(checksum, sizeof(checksum));
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+      transfer->checksum |= (uint32_t) checksum[i] << (i * 8);
+    }
+  }
+  else if (!failed)
+  {
+    transfer->data.resize(transfer->actual_bytes);
+    read_bytes(transfer->data.data(), transfer->actual_bytes);
+  }
+}
+
+unsigned long long capture_session::read_number()
+{
+  unsigned long long value = 0;
+  for (unsigned int shift = 0; shift < 64; shift += 7)
+  {
+    unsigned char byte;
+    read_bytes(&byte, 1);
+    value |= (unsigned long long) (byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0)
+    {
+      return value;
+    }
+  }
+  throw std::runtime_error(m_path + " is a corrupt USB capture");
+}
+
+std::string capture_session::read_string()
+{
+  unsigned long long num_bytes = read_number();
+  if (num_bytes > MAX_STRING_SIZE)
+  {
+    throw std::runtime_error(m_path + " is a corrupt USB capture");
+  }
+  std::string value((size_t) num_bytes, '\0');
+  read_bytes((unsigned char*) &value[0], (unsigned int) num_bytes);
+  return value;
+}
+
+void capture_session::read_bytes(unsigned char* data, unsigned int num_bytes)
+{
+  m_file.read((char*) data, num_bytes);
+  if ((unsigned int) m_file.gcount() != num_bytes)
+  {
+    throw std::runtime_error(m_path + " is a corrupt USB capture");
+  }
+}
+
+}
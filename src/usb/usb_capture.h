@@ -0,0 +1,318 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref usb::capture_writer and
+ *         \ref usb::capture_session classes.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref usb::capture_writer and \ref usb::capture_session classes, which
+ *  record the transfers of a \ref usb::usb_device to a file and read them
+ *  back, along with the \ref usb::captured_transfer struct describing a single
+ *  recorded transfer.
+ *  
+ *  A capture file starts with a header describing the device, followed by one
+ *  record per transfer, in the order in which the transfers were started.
+ *  Numbers are stored as variable-length integers. Data read from the device
+ *  is stored in full, since it is needed to play the session back, while
+ *  data written to it is only stored as a checksum, which is enough to tell
+ *  that a replay sends the same data as the capture did.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-27
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __USB_CAPTURE_H__
+#define __USB_CAPTURE_H__
+
+#include "usb_device.h"
+#include "usb_result.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace usb
+{
+
+/*! \enum captured_transfer_type
+ *  \brief Enumeration of the kinds of transfer a capture records.
+ */
+enum captured_transfer_type
+{
+  /*! \brief A bulk transfer from the host to the device. */
+  CAPTURED_BULK_OUT,
+  
+  /*! \brief A bulk transfer from the device to the host. */
+  CAPTURED_BULK_IN,
+  
+  /*! \brief An interrupt transfer from the device to the host. */
+  CAPTURED_INTERRUPT_IN
+};
+
+/*! \struct captured_transfer
+ *  \brief A single transfer recorded in a capture.
+ */
+struct captured_transfer
+{
+  /*! \brief The kind of transfer. */
+  captured_transfer_type     type;
+  
+  /*! \brief Whether the transfer was submitted asynchronously with
+   *         \ref usb_device::submit_read() or \ref usb_device::submit_write()
+   *         rather than made by a blocking call. */
+  bool                       async;
+  
+  /*! \brief The address of the endpoint used for the transfer. */
+  unsigned char              endpoint;
+  
+  /*! \brief The outcome of the transfer. */
+  transfer_status            status;
+  
+  /*! \brief The code describing a failure, see \ref result_error::code(). */
+  int                        code;
+  
+  /*! \brief The number of bytes the host asked to transfer. */
+  unsigned int               num_bytes;
+  
+  /*! \brief The number of bytes actually transferred. */
+  unsigned int               actual_bytes;
+  
+  /*! \brief Time at which the transfer was started, in microseconds since
+   *         the capture began. */
+  unsigned long long         start_us;
+  
+  /*! \brief Time in microseconds from starting the transfer to the device
+   *         completing it. */
+  unsigned long long         duration_us;
+  
+  /*! \brief Checksum of the data written by an outgoing transfer, see
+   *         \ref capture_checksum(). */
+  uint32_t                   checksum;
+  
+  /*! \brief The data received by a successful incoming transfer. */
+  std::vector<unsigned char> data;
+};
+
+/*!
+ *  \brief Computes the checksum a capture stores in place of the data written
+ *         to the device.
+ *  
+ *  \param [in] data The data written.
+ *  \param [in] num_bytes The number of bytes written.
+ *  
+ *  \return The 32-bit FNV-1a hash of the data.
+ */
+uint32_t capture_checksum(const unsigned char* data, unsigned int num_bytes) noexcept;
+
+
+
+/*! \class capture_writer
+ *  \brief Records the transfers of a USB device to a capture file.
+ *  
+ *  Transfers are started with \ref begin_transfer() and finished with
+ *  \ref end_transfer(). Asynchronous transfers can be finished in any order,
+ *  but are written to the file in the order in which they were started, so
+ *  that a replay sees them in the order the host issued them.
+ *  
+ *  Recording a transfer never throws: if the file can't be written, the
+ *  capture stops and \ref failed() starts returning **true**, so that a
+ *  failing capture never makes the transfers it records fail.
+ *  
+ *  This class is *not* thread-safe.
+ */
+class capture_writer
+{
+public:
+  
+  /*! \brief Clock used for timing the recorded transfers. */
+  typedef std::chrono::steady_clock clock_t;
+  
+  /*! \brief Identifies a transfer started with \ref begin_transfer(). */
+  typedef unsigned long long        ticket_t;
+  
+  /*!
+   *  \brief Main constructor for the class.
+   *  
+   *  Creates the capture file and writes the header describing the device.
+   *  Timing of the transfers is relative to this moment.
+   *  
+   *  \param [in] path The path of the file to create, replacing any file
+   *         already there.
+   *  \param [in] description The descriptor of the device being captured.
+   *  \param [in] manufacturer The device's manufacturer string.
+   *  \param [in] product The device's product string.
+   *  \param [in] serial_number The device's serial number.
+   *  
+   *  \throws std::runtime_error If the file can't be created.
+   */
+                            capture_writer(const std::string& path, const usb_device::device_description& description,
+                                           const std::string& manufacturer, const std::string& product,
+                                           const std::string& serial_number);
+  
+  /*!
+   *  \brief Class destructor.
+   *  
+   *  Writes any transfers that were finished and closes the file. Transfers
+   *  that were started but never finished are left out.
+   */
+                            ~capture_writer();
+  
+  /*!
+   *  \brief Records the start of a transfer.
+   *  
+   *  \param [in] type The kind of transfer.
+   *  \param [in] endpoint The address of the endpoint used.
+   *  \param [in] async Whether the transfer was submitted asynchronously.
+   *  \param [in] num_bytes The number of bytes to transfer.
+   *  \param [in] data The data being written by an outgoing transfer, or
+   *         **nullptr** for an incoming one.
+   *  
+   *  \return The ticket with which to finish the transfer.
+   */
+  ticket_t                  begin_transfer(captured_transfer_type type, unsigned char endpoint, bool async,
+                                           unsigned int num_bytes, const unsigned char* data) noexcept;
+  
+  /*!
+   *  \brief Records the outcome of a transfer.
+   *  
+   *  \param [in] ticket The ticket \ref begin_transfer() returned.
+   *  \param [in] status The outcome of the transfer.
+   *  \param [in] code The code describing a failure.
+   *  \param [in] actual_bytes The number of bytes transferred.
+   *  \param [in] data The data received by an incoming transfer, or
+   *         **nullptr** for an outgoing one.
+   *  \param [in] finished The time at which the device completed the
+   *         transfer, which for an asynchronous transfer can be well before
+   *         the host collected it.
+   */
+  void                      end_transfer(ticket_t ticket, transfer_status status, int code, unsigned int actual_bytes,
+                                         const unsigned char* data, clock_t::time_point finished) noexcept;
+  
+  /*!
+   *  \brief Records the outcome of a transfer that completed just now.
+   *  
+   *  \see end_transfer(ticket_t ticket, transfer_status status, int code, unsigned int actual_bytes, const unsigned char* data, clock_t::time_point finished)
+   */
+  void                      end_transfer(ticket_t ticket, transfer_status status, int code, unsigned int actual_bytes,
+                                         const unsigned char* data) noexcept;
+  
+  /*!
+   *  \brief Gets whether writing the capture file failed, ending the capture.
+   */
+  bool                      failed() const noexcept;
+  
+  /*!
+   *  \brief Gets the number of transfers written to the file so far.
+   */
+  unsigned long long        num_transfers() const noexcept;
+
+
+
+private:
+  
+  /*!
+   *  \brief A started transfer, along with whether it has finished.
+   */
+  struct entry
+  {
+    captured_transfer       transfer;
+    bool                    finished;
+  };
+  
+  /*!
+   *  \brief Writes the finished transfers at the front of the queue.
+   */
+  void                      write_finished() noexcept;
+  
+  void                      write_transfer(const captured_transfer& transfer);
+  void                      write_description(const usb_device::device_description& description);
+  void                      write_number(unsigned long long value);
+  void                      write_string(const std::string& value);
+  
+  
+  
+  std::ofstream             m_file;
+  const std::string         m_path;
+  const clock_t::time_point m_start;
+  bool                      m_failed;
+  
+  /*! \brief Transfers started but not yet written, in order of starting. */
+  std::deque<entry>         m_queue;
+  
+  /*! \brief The ticket of the transfer at the front of \ref m_queue. */
+  ticket_t                  m_first_ticket;
+  
+  /*! \brief Start time of the last transfer written, which the next one's is
+   *         stored relative to. */
+  unsigned long long        m_last_start_us;
+  
+  unsigned long long        m_num_transfers;
+};
+
+
+
+/*! \class capture_session
+ *  \brief A capture file read back into memory.
+ */
+class capture_session
+{
+public:
+  
+  /*!
+   *  \brief Main constructor for the class.
+   *  
+   *  Reads an entire capture file.
+   *  
+   *  \param [in] path The path of the capture file.
+   *  
+   *  \throws std::runtime_error If the file can't be read or isn't a capture.
+   */
+  explicit                  capture_session(const std::string& path);
+  
+  /*!
+   *  \brief Class destructor.
+   */
+                            ~capture_session();
+  
+  /*!
+   *  \brief Gets the descriptor of the device that was captured.
+   */
+  const usb_device::device_description* description() const;
+  
+  /*! \brief The captured device's manufacturer string. */
+  std::string               manufacturer;
+  
+  /*! \brief The captured device's product string. */
+  std::string               product;
+  
+  /*! \brief The captured device's serial number. */
+  std::string               serial_number;
+  
+  /*! \brief Every recorded transfer, in the order in which they were
+   *         started. */
+  std::vector<captured_transfer> transfers;
+
+
+
+private:
+                            
+                            capture_session(const capture_session& other) = delete;
+  capture_session&          operator=(const capture_session& other) = delete;
+  
+  usb_device::device_description* read_description();
+  void                      read_transfer(captured_transfer* transfer, unsigned long long* last_start_us);
+  unsigned long long        read_number();
+  std::string               read_string();
+  void                      read_bytes(unsigned char* data, unsigned int num_bytes);
+  
+  
+  
+  std::ifstream             m_file;
+  const std::string         m_path;
+  usb_device::device_description* m_description;
+};
+
+}
+
+#endif /* defined(__USB_CAPTURE_H__) */
@@ -18,6 +18,7 @@
 
 #include "usb_device.h"
 #include <stddef.h>
+#include <stdexcept>
 
 namespace usb
 {
@@ -37,6 +38,212 @@ usb_device::~usb_device()
 
 
 
+unsigned int usb_device::write(data_t* buffer, unsigned int num_bytes)
+{
+  return write((const data_t*) buffer, num_bytes);
+}
+
+unsigned int usb_device::write(data_t* buffer, unsigned int num_bytes, timeout_t timeout)
+{
+  return write((const data_t*) buffer, num_bytes, timeout);
+}
+
+result<unsigned int> usb_device::try_read(data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept
+{
+  try
+  {
+    return result<unsigned int>::success(read(data, num_bytes, timeout));
+  }
+  catch (std::exception& ex)
+  {
+    return result<unsigned int>::failure(status_of(ex), std::current_exception());
+  }
+  catch (...)
+  {
+    return result<unsigned int>::failure(TRANSFER_FAILED, std::current_exception());
+  }
+}
+
+result<unsigned int> usb_device::try_write(const data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept
+{
+  try
+  {
+    return result<unsigned int>::success(write(data, num_bytes, timeout));
+  }
+  catch (std::exception& ex)
+  {
+    return result<unsigned int>::failure(status_of(ex), std::current_exception());
+  }
+  catch (...)
+  {
+    return result<unsigned int>::failure(TRANSFER_FAILED, std::current_exception());
+  }
+}
+
+
+
+unsigned int usb_device::max_packet_size(endpoint_t endpoint) const
+{
+  const device_description* desc = get_device_description();
+  for (unsigned int c = 0; c < desc->num_configurations; ++c)
+  {
+    const device_configuration* config = desc->configurations[c];
+    for (unsigned int i = 0; config != nullptr && i < config->num_interfaces; ++i)
+    {
+      const device_interface* interface = config->interfaces[i];
+      for (unsigned int a = 0; interface != nullptr && a < interface->num_alt_settings; ++a)
+      {
+        const device_alt_setting* alt_setting = interface->alt_settings[a];
+        for (unsigned int e = 0; alt_setting != nullptr && e < alt_setting->num_endpoints; ++e)
+        {
+          const device_endpoint* desc_endpoint = alt_setting->endpoints[e];
+          if (desc_endpoint != nullptr && desc_endpoint->address == endpoint)
+          {
+            return desc_endpoint->max_packet_size;
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+
+
+bool usb_device::supports_async_transfers() const
+{
+  return false;
+}
+
+unsigned int usb_device::max_pending_transfers() const
+{
+  return (unsigned int) -1;
+}
+
+void usb_device::set_max_pending_transfers(unsigned int max_pending)
+{
+  // Synchronous transfers have no limit
+  (void) max_pending;
+}
+
+unsigned int usb_device::num_pending_transfers() const
+{
+  return (unsigned int) m_completed_transfers.size();
+}
+
+void usb_device::submit_read(data_t* data, unsigned int num_bytes)
+{
+  // No asynchronous support; perform the transfer now and queue the result
+  m_completed_transfers.push_back(read(data, num_bytes));
+}
+
+void usb_device::submit_write(const data_t* data, unsigned int num_bytes)
+{
+  // No asynchronous support; perform the transfer now and queue the result
+  m_completed_transfers.push_back(write(data, num_bytes));
+}
+
+unsigned int usb_device::complete_transfer()
+{
+  if (m_completed_transfers.empty())
+  {
+    throw std::runtime_error("No pending transfers");
+  }
+  
+  unsigned int r = m_completed_transfers.front();
+  m_completed_transfers.pop_front();
+  return r;
+}
+
+void usb_device::cancel_pending_transfers()
+{
+  m_completed_transfers.clear();
+}
+
+void usb_device::abort_pending_transfers()
+{
+  // Nothing to do
+}
+
+bool usb_device::recover()
+{
+  cancel_pending_transfers();
+  return false;
+}
+
+
+
+bool usb_device::supports_interrupt_reads() const
+{
+  return false;
+}
+
+unsigned int usb_device::read_interrupt(endpoint_t endpoint, data_t* data, unsigned int num_bytes, timeout_t timeout)
+{
+  (void) endpoint;
+  (void) data;
+  (void) num_bytes;
+  (void) timeout;
+  throw std::runtime_error("Interrupt transfers are not supported");
+}
+
+usb_device::endpoint_t usb_device::find_interrupt_in_endpoint() const
+{
+  const device_description* desc = get_device_description();
+  for (unsigned int c = 0; c < desc->num_configurations; ++c)
+  {
+    const device_configuration* config = desc->configurations[c];
+    for (unsigned int i = 0; config != nullptr && i < config->num_interfaces; ++i)
+    {
+      const device_interface* interface = config->interfaces[i];
+      for (unsigned int a = 0; interface != nullptr && a < interface->num_alt_settings; ++a)
+      {
+        const device_alt_setting* alt_setting = interface->alt_settings[a];
+        for (unsigned int e = 0; alt_setting != nullptr && e < alt_setting->num_endpoints; ++e)
+        {
+          const device_endpoint* desc_endpoint = alt_setting->endpoints[e];
+          if (desc_endpoint != nullptr && desc_endpoint->transfer_type == ENDPOINT_TYPE_INTERRUPT
+              && desc_endpoint->direction == ENDPOINT_DIRECTION_IN)
+          {
+            return desc_endpoint->address;
+          }
+        }
+      }
+    }
+  }
+  return ENDPOINT_UNSET_VALUE;
+}
+
+
+
+scoped_timeout::scoped_timeout(usb_device* device, usb_device::timeout_t timeout)
+  : m_device(device), m_previous(device->timeout())
+{
+  if (timeout != m_previous)
+  {
+    m_device->set_timeout(timeout);
+  }
+}
+
+scoped_timeout::~scoped_timeout()
+{
+  try
+  {
+    if (m_device->timeout() != m_previous)
+    {
+      m_device->set_timeout(m_previous);
+    }
+  }
+  catch (std::exception& ex)
+  {
+    // Only an uninitialized device refuses, and the constructor needed it
+    // initialized
+    (void) ex;
+  }
+}
+
+
+
 device_description::device_description(unsigned int num_configurations)
   : num_configurations(num_configurations),
     configurations(new device_configuration*[num_configurations])
@@ -190,13 +397,14 @@ device_alt_setting::~device_alt_setting()
 
 
 device_endpoint::device_endpoint()
+  : max_packet_size(0)
 {
   // Nothing else to do here
 }
 
 device_endpoint::device_endpoint(const device_endpoint& other)
   : address(other.address), transfer_type(other.transfer_type),
-    direction(other.direction)
+    direction(other.direction), max_packet_size(other.max_packet_size)
 {
   // Nothing else to do here
 }
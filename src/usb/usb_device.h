@@ -15,7 +15,9 @@
 #define __USB_DEVICE_H__
 
 #include "usbfwd.h"
+#include "usb_result.h"
 #include <string>
+#include <deque>
 
 #define TIMEOUT_UNSET_VALUE       ((timeout_t) 0xFFFFFFFF)
 #define CONFIGURATION_UNSET_VALUE ((configuration_t) 0xFFFFFFFF)
@@ -381,6 +383,357 @@ public:
    *  \return The number of bytes written to the device.
    */
   virtual unsigned int write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout) = 0;
+  
+  /*!
+   *  \brief Writes a sequence of bytes to the device directly from a mutable
+   *         buffer.
+   *  
+   *  Writes a sequence of bytes to the device using the device's designated
+   *  input endpoint. Uses the currently set timeout value to limit how long
+   *  the operation can execute with no results.
+   *  
+   *  Because the buffer is not const, implementations are free to hand it
+   *  directly to the USB stack without first copying it. The contents of the
+   *  buffer are not modified. The default implementation forwards the call to
+   *  \ref write(const data_t* buffer, unsigned int num_bytes).
+   *  
+   *  This is a blocking function that can take several seconds to complete.
+   *  
+   *  \param [in] data The array containing the data to be sent to the device.
+   *  \param [in] num_bytes The number of bytes to write to the device.
+   *  
+   *  \return The number of bytes written to the device.
+   */
+  virtual unsigned int write(data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Writes a sequence of bytes to the device directly from a mutable
+   *         buffer.
+   *  
+   *  Writes a sequence of bytes to the device using the device's designated
+   *  input endpoint. Uses the provided timeout value to limit how long the
+   *  operation can execute with no results.
+   *  
+   *  Because the buffer is not const, implementations are free to hand it
+   *  directly to the USB stack without first copying it. The contents of the
+   *  buffer are not modified. The default implementation forwards the call to
+   *  \ref write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout).
+   *  
+   *  This is a blocking function that can take several seconds to complete.
+   *  
+   *  \param [in] data The array containing the data to be sent to the device.
+   *  \param [in] num_bytes The number of bytes to write to the device.
+   *  \param [in] timeout The number of milliseconds to wait for confirmation
+   *         before failing.
+   *  
+   *  \return The number of bytes written to the device.
+   */
+  virtual unsigned int write(data_t* buffer, unsigned int num_bytes, timeout_t timeout);
+  
+  /*!
+   *  \brief Reads a sequence of bytes from the device without throwing.
+   *  
+   *  Same as \ref read(data_t* data, unsigned int num_bytes, timeout_t timeout),
+   *  except that failures are returned instead of thrown, for loops where
+   *  failures are expected, such as polling. The default implementation
+   *  catches whatever the throwing version throws.
+   *  
+   *  \param [out] data The array to which to dump the results of the read.
+   *  \param [in] num_bytes The maximum number of bytes to read from the device.
+   *  \param [in] timeout The number of milliseconds to wait for a response
+   *         before failing.
+   *  
+   *  \return The number of bytes read from the device, or how the read
+   *          failed.
+   */
+  virtual result<unsigned int> try_read(data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept;
+  
+  /*!
+   *  \brief Writes a sequence of bytes to the device without throwing.
+   *  
+   *  Same as
+   *  \ref write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout),
+   *  except that failures are returned instead of thrown. The default
+   *  implementation catches whatever the throwing version throws.
+   *  
+   *  \param [in] data The array containing the data to be sent to the device.
+   *  \param [in] num_bytes The number of bytes to write to the device.
+   *  \param [in] timeout The number of milliseconds to wait for confirmation
+   *         before failing.
+   *  
+   *  \return The number of bytes written to the device, or how the write
+   *          failed.
+   */
+  virtual result<unsigned int> try_write(const data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept;
+  
+  /*!
+   *  \brief Gets the largest packet an endpoint carries.
+   *  
+   *  Gets the largest packet the endpoint with the given address carries, as
+   *  reported by its descriptor. Bulk transfers arrive in packets of this
+   *  size, so transfers sized in multiples of it never end mid-packet. The
+   *  default implementation searches the descriptor returned by
+   *  \ref get_device_description().
+   *  
+   *  \param [in] endpoint The address of the endpoint.
+   *  
+   *  \return The largest packet size in bytes, or 0 if no endpoint with the
+   *          given address is described.
+   */
+  virtual unsigned int max_packet_size(endpoint_t endpoint) const;
+  
+  
+  
+  /*!
+   *  \brief Determines whether or not transfers submitted through
+   *         \ref submit_read() and \ref submit_write() are truly
+   *         asynchronous.
+   *  
+   *  Determines whether or not transfers submitted through \ref submit_read()
+   *  and \ref submit_write() are queued with the USB stack and allowed to
+   *  execute in the background. If not, the default implementation of these
+   *  methods performs the transfer synchronously at submission time and
+   *  simply queues the result, so callers may use the same code path
+   *  regardless.
+   *  
+   *  \return **true** if transfers are performed asynchronously, **false** if
+   *          not.
+   */
+  virtual bool supports_async_transfers() const;
+  
+  /*!
+   *  \brief Gets the maximum number of transfers that may be pending at once.
+   *  
+   *  Gets the maximum number of submitted transfers that may be pending at
+   *  once. A transfer remains pending from the moment it is submitted until it
+   *  is collected with a call to \ref complete_transfer().
+   *  
+   *  \return The maximum number of transfers that may be pending at once.
+   *  
+   *  \see set_max_pending_transfers(unsigned int max_pending)
+   */
+  virtual unsigned int max_pending_transfers() const;
+  
+  /*!
+   *  \brief Sets the maximum number of transfers that may be pending at once.
+   *  
+   *  Sets the maximum number of submitted transfers that may be pending at
+   *  once. Larger values allow more transfers to be in flight at the same time
+   *  at the cost of additional memory. Cannot be changed while transfers are
+   *  pending.
+   *  
+   *  \param [in] max_pending The maximum number of pending transfers. Must be
+   *         greater than 0.
+   *  
+   *  \see max_pending_transfers()
+   */
+  virtual void set_max_pending_transfers(unsigned int max_pending);
+  
+  /*!
+   *  \brief Gets the number of transfers that have been submitted but not yet
+   *         collected.
+   *  
+   *  Gets the number of transfers that have been submitted through
+   *  \ref submit_read() or \ref submit_write() but have not yet been
+   *  collected with \ref complete_transfer().
+   *  
+   *  \return The number of pending transfers.
+   */
+  virtual unsigned int num_pending_transfers() const;
+  
+  /*!
+   *  \brief Queues a read of a sequence of bytes from the device.
+   *  
+   *  Queues a read of a sequence of bytes from the device using the device's
+   *  designated output endpoint and the currently set timeout value. The
+   *  provided buffer must remain valid and must not be modified until the
+   *  transfer has been collected with \ref complete_transfer().
+   *  
+   *  Transfers are completed in the order in which they were submitted.
+   *  
+   *  \param [out] data The array to which to dump the results of the read.
+   *  \param [in] num_bytes The maximum number of bytes to read from the device.
+   *  
+   *  \see complete_transfer()
+   *  \see read(data_t* data, unsigned int num_bytes)
+   */
+  virtual void submit_read(data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Queues a write of a sequence of bytes to the device.
+   *  
+   *  Queues a write of a sequence of bytes to the device using the device's
+   *  designated input endpoint and the currently set timeout value. The
+   *  contents of the provided buffer are captured at submission time, so the
+   *  buffer may be reused as soon as this method returns.
+   *  
+   *  Transfers are completed in the order in which they were submitted.
+   *  
+   *  \param [in] data The array containing the data to be sent to the device.
+   *  \param [in] num_bytes The number of bytes to write to the device.
+   *  
+   *  \see complete_transfer()
+   *  \see write(const data_t* buffer, unsigned int num_bytes)
+   */
+  virtual void submit_write(const data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Waits for the oldest pending transfer to finish and collects its
+   *         result.
+   *  
+   *  Waits for the oldest pending transfer to finish and removes it from the
+   *  queue. If the transfer failed, throws the corresponding
+   *  \ref usb::exception after removing it from the queue.
+   *  
+   *  This is a blocking function that can take several seconds to complete.
+   *  
+   *  \return The number of bytes transferred by the collected transfer.
+   *  
+   *  \see submit_read(data_t* data, unsigned int num_bytes)
+   *  \see submit_write(const data_t* data, unsigned int num_bytes)
+   */
+  virtual unsigned int complete_transfer();
+  
+  /*!
+   *  \brief Cancels and discards all pending transfers.
+   *  
+   *  Cancels all pending transfers and waits for the USB stack to release
+   *  them. The results of any discarded transfers are lost.
+   */
+  virtual void cancel_pending_transfers();
+  
+  /*!
+   *  \brief Makes the transfers currently in flight fail as soon as possible.
+   *  
+   *  Asks the USB stack to abandon every transfer submitted before this call,
+   *  so that a thread blocked in \ref complete_transfer() or a blocking read
+   *  or write returns with an error within a few milliseconds instead of
+   *  waiting for the data or the timeout. Transfers submitted later are not
+   *  affected.
+   *  
+   *  Unlike the other methods of this class, this method may be called from
+   *  any thread, such as the one cancelling a task. The thread using the
+   *  device is still responsible for calling \ref recover() afterwards.
+   *  
+   *  The default implementation does nothing.
+   */
+  virtual void abort_pending_transfers();
+  
+  /*!
+   *  \brief Attempts to bring the connection back to a usable state after a
+   *         failed transfer without closing it.
+   *  
+   *  Attempts to recover from a failed transfer, such as a timeout or a
+   *  stalled endpoint, without closing and reopening the device. Discards all
+   *  pending transfers, clears any halt condition on the endpoints, and
+   *  discards any stale data still waiting to be read, so that the next
+   *  transfer starts from a clean state. The caller is responsible for
+   *  resynchronizing whatever protocol runs on top of the connection.
+   *  
+   *  The default implementation only discards pending transfers and reports
+   *  that the connection could not be recovered.
+   *  
+   *  This is a blocking function that can take a fraction of a second to
+   *  complete.
+   *  
+   *  \return **true** if the connection is usable again, **false** if the
+   *          device must be closed and reopened.
+   */
+  virtual bool recover();
+  
+  
+  
+  /*!
+   *  \brief Determines whether or not \ref read_interrupt() is supported.
+   *  
+   *  \return **true** if interrupt endpoints can be read from, **false** if
+   *          not. The default implementation returns **false**.
+   */
+  virtual bool supports_interrupt_reads() const;
+  
+  /*!
+   *  \brief Reads a notification from an interrupt IN endpoint.
+   *  
+   *  Blocks until the device sends a packet on the given interrupt endpoint or
+   *  the timeout runs out. Unlike the bulk endpoints used for everything else,
+   *  an interrupt endpoint only carries packets when the device has something
+   *  to report, so waiting on it generates no traffic at all. Transfers
+   *  pending on the bulk endpoints are not affected.
+   *  
+   *  The default implementation throws std::runtime_error.
+   *  
+   *  \param [in] endpoint The address of the interrupt IN endpoint, as found
+   *         by \ref find_interrupt_in_endpoint().
+   *  \param [out] data The array to which to dump the packet.
+   *  \param [in] num_bytes The maximum number of bytes to read. Should be at
+   *         least the endpoint's \ref max_packet_size().
+   *  \param [in] timeout The timeout of the operation in milliseconds.
+   *  
+   *  \return The number of bytes read from the device.
+   *  
+   *  \throws usb::timeout_exception If nothing arrived in time.
+   */
+  virtual unsigned int read_interrupt(endpoint_t endpoint, data_t* data, unsigned int num_bytes, timeout_t timeout);
+  
+  /*!
+   *  \brief Looks for an interrupt IN endpoint among the device's endpoints.
+   *  
+   *  \return The address of the first interrupt IN endpoint described, or
+   *          \ref ENDPOINT_UNSET_VALUE if the device has none.
+   */
+  endpoint_t find_interrupt_in_endpoint() const;
+
+
+
+private:
+  
+  /*!
+   *  \brief Results of transfers performed synchronously by the default
+   *         implementation of \ref submit_read() and \ref submit_write().
+   */
+  std::deque<unsigned int> m_completed_transfers;
+};
+
+
+
+/*! \class scoped_timeout
+ *  \brief Changes the timeout of a \ref usb_device for as long as it lives.
+ *  
+ *  Sets the timeout of a device when constructed and puts back the one it
+ *  replaced when destroyed. Meant for transfers that take the device's
+ *  timeout rather than one of their own, such as those started by
+ *  \ref usb_device::submit_read(), which keep the timeout they were submitted
+ *  with.
+ */
+class scoped_timeout
+{
+public:
+  
+  /*!
+   *  \brief Class constructor. Sets the device's timeout.
+   *  
+   *  \param [in] device The device, which must be initialized and outlive
+   *         this object.
+   *  \param [in] timeout The timeout to use until this object is destroyed.
+   */
+                            scoped_timeout(usb_device* device, usb_device::timeout_t timeout);
+  
+  /*!
+   *  \brief Class destructor. Puts back the device's previous timeout.
+   */
+                            ~scoped_timeout();
+
+
+
+private:
+  scoped_timeout(const scoped_timeout& other) = delete;
+  scoped_timeout& operator=(const scoped_timeout& other) = delete;
+  
+  /*! \brief The device whose timeout was changed. */
+  usb_device* const         m_device;
+  
+  /*! \brief The timeout to put back. */
+  const usb_device::timeout_t m_previous;
 };
 
 
@@ -666,6 +1019,9 @@ struct usb_device::device_endpoint
   
   /*! \brief The direction of data flow of this endpoint. */
   usb_device::endpoint_direction      direction;
+  
+  /*! \brief The largest packet this endpoint carries, in bytes. */
+  unsigned int                        max_packet_size;
 };
 
 }
@@ -0,0 +1,127 @@
+/*! \file
+ *  \brief File containing the implementation of \ref usb::result.
+ *  
+ *  File containing the implementation of \ref usb::result_error and
+ *  \ref usb::status_of().
+ *  
+ *  See corrensponding header file to view documentation for class, its
+ *  methods, and its member variables.
+ *  
+ *  \see usb::result
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-26
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "usb_result.h"
+#include "exception/busy_exception.h"
+#include "exception/disconnected_exception.h"
+#include "exception/interrupted_exception.h"
+#include "exception/timeout_exception.h"
+#include <stdexcept>
+#include <string>
+
+namespace usb
+{
+
+transfer_status status_of(const std::exception& ex) noexcept
+{
+  if (dynamic_cast<const timeout_exception*>(&ex) != nullptr)
+  {
+    return TRANSFER_TIMEOUT;
+  }
+  if (dynamic_cast<const disconnected_exception*>(&ex) != nullptr)
+  {
+    return TRANSFER_DISCONNECTED;
+  }
+  if (dynamic_cast<const busy_exception*>(&ex) != nullptr)
+  {
+    return TRANSFER_BUSY;
+  }
+  if (dynamic_cast<const interrupted_exception*>(&ex) != nullptr)
+  {
+    return TRANSFER_INTERRUPTED;
+  }
+  if (dynamic_cast<const usb::exception*>(&ex) != nullptr)
+  {
+    return TRANSFER_USB_ERROR;
+  }
+  return TRANSFER_FAILED;
+}
+
+
+
+result_error::result_error() noexcept
+  : m_status(TRANSFER_OK), m_code(0), m_message("")
+{
+  // Nothing else to do
+}
+
+result_error::result_error(transfer_status status, int code, const char* message) noexcept
+  : m_status(status), m_code(code), m_message(message == nullptr ? "" : message)
+{
+  // Nothing else to do
+}
+
+result_error::result_error(transfer_status status, std::exception_ptr ex) noexcept
+  : m_status(status), m_code(0), m_message(""), m_exception(ex)
+{
+  // Nothing else to do
+}
+
+
+
+bool result_error::ok() const noexcept
+{
+  return m_status == TRANSFER_OK;
+}
+
+result_error::operator bool() const noexcept
+{
+  return ok();
+}
+
+transfer_status result_error::status() const noexcept
+{
+  return m_status;
+}
+
+int result_error::code() const noexcept
+{
+  return m_code;
+}
+
+const char* result_error::message() const noexcept
+{
+  return m_message;
+}
+
+void result_error::throw_if_failed() const
+{
+  if (m_exception != nullptr)
+  {
+    std::rethrow_exception(m_exception);
+  }
+  
+  switch (m_status)
+  {
+    case TRANSFER_OK:
+      return;
+    case TRANSFER_TIMEOUT:
+      throw timeout_exception((unsigned int) m_code);
+    case TRANSFER_DISCONNECTED:
+      throw disconnected_exception();
+    case TRANSFER_BUSY:
+      throw busy_exception();
+    case TRANSFER_INTERRUPTED:
+      throw interrupted_exception();
+    case TRANSFER_USB_ERROR:
+      throw usb::exception("libusb error code " + std::to_string(m_code) + " (" + m_message + ")");
+    case TRANSFER_FAILED:
+    default:
+      throw std::runtime_error(m_message);
+  }
+}
+
+}
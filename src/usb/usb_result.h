@@ -0,0 +1,361 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref usb::result class
+ *         template.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref usb::result class template and the \ref usb::transfer_status
+ *  enumeration, used by the calls that report failures without throwing.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-09-26
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __USB_RESULT_H__
+#define __USB_RESULT_H__
+
+#include <exception>
+
+namespace usb
+{
+
+/*! \enum transfer_status
+ *  \brief Enumeration of the outcomes of a call that does not throw.
+ *  
+ *  Each failure matches the exception the throwing version of the call
+ *  throws for it.
+ */
+enum transfer_status
+{
+  /*! \brief The call succeeded. */
+  TRANSFER_OK,
+  
+  /*! \brief The call timed out, as with \ref usb::timeout_exception. */
+  TRANSFER_TIMEOUT,
+  
+  /*! \brief The device went away, as with
+   *         \ref usb::disconnected_exception. */
+  TRANSFER_DISCONNECTED,
+  
+  /*! \brief The device is busy, as with \ref usb::busy_exception. */
+  TRANSFER_BUSY,
+  
+  /*! \brief The call was interrupted, as with
+   *         \ref usb::interrupted_exception. */
+  TRANSFER_INTERRUPTED,
+  
+  /*! \brief The USB stack reported an error, as with \ref usb::exception. */
+  TRANSFER_USB_ERROR,
+  
+  /*! \brief Anything else went wrong, as with std::runtime_error. */
+  TRANSFER_FAILED
+};
+
+/*!
+ *  \brief Gets the status matching the type of an exception.
+ *  
+ *  \param [in] ex The exception.
+ *  
+ *  \return The status of the most specific usb exception **ex** is, or
+ *          \ref TRANSFER_FAILED if it is none of them.
+ */
+transfer_status status_of(const std::exception& ex) noexcept;
+
+
+
+/*! \class result_error
+ *  \brief The part of a \ref result that describes how a call failed.
+ *  
+ *  Failures either carry a status, a code, and a message that must outlive
+ *  the result, such as a string literal, so that nothing is allocated when a
+ *  call fails, or carry the exception a throwing call threw, so that it can be
+ *  thrown again exactly as it was.
+ */
+class result_error
+{
+public:
+  
+  /*!
+   *  \brief Gets whether the call succeeded.
+   */
+  bool               ok() const noexcept;
+  
+  /*!
+   *  \brief Gets whether the call succeeded.
+   */
+  explicit           operator bool() const noexcept;
+  
+  /*!
+   *  \brief Gets the outcome of the call.
+   */
+  transfer_status    status() const noexcept;
+  
+  /*!
+   *  \brief Gets the code describing the failure.
+   *  
+   *  The number of milliseconds waited for \ref TRANSFER_TIMEOUT, the error
+   *  code of the USB stack for \ref TRANSFER_USB_ERROR, and 0 otherwise or if
+   *  the failure carries an exception.
+   */
+  int                code() const noexcept;
+  
+  /*!
+   *  \brief Gets the message describing the failure, or an empty string if
+   *         there is none.
+   */
+  const char*        message() const noexcept;
+  
+  /*!
+   *  \brief Throws the exception the throwing version of the call would have
+   *         thrown. Does nothing if the call succeeded.
+   *  
+   *  \throws std::exception The exception carried, or one made from the
+   *          status, code, and message.
+   */
+  void               throw_if_failed() const;
+
+
+
+protected:
+  
+  /*!
+   *  \brief Constructs a successful result.
+   */
+                     result_error() noexcept;
+  
+  /*!
+   *  \brief Constructs a failed result from a status, a code, and a static
+   *         message.
+   */
+                     result_error(transfer_status status, int code, const char* message) noexcept;
+  
+  /*!
+   *  \brief Constructs a failed result carrying an exception.
+   */
+                     result_error(transfer_status status, std::exception_ptr ex) noexcept;
+
+
+
+private:
+  
+  /*! \brief The outcome of the call. */
+  transfer_status    m_status;
+  
+  /*! \brief The code describing the failure. */
+  int                m_code;
+  
+  /*! \brief The message describing the failure. */
+  const char*        m_message;
+  
+  /*! \brief The exception the call threw, if any. */
+  std::exception_ptr m_exception;
+};
+
+
+
+/*! \class result
+ *  \brief The value returned by a call that reports failures without
+ *         throwing, or how it failed.
+ *  
+ *  Returned by the *try_* versions of calls that are made often and in
+ *  loops that expect failures, such as polling for a cartridge, so that a
+ *  failure costs a return rather than an exception being unwound. The
+ *  throwing versions of these calls are wrappers that check the result with
+ *  \ref get().
+ *  
+ *  \tparam T The type of value returned on success. Must be default- and
+ *          copy-constructible without throwing.
+ */
+template<typename T>
+class result: public result_error
+{
+public:
+  
+  /*!
+   *  \brief Makes a successful result.
+   */
+  static result      success(T value) noexcept
+  {
+    result r;
+    r.m_value = value;
+    return r;
+  }
+  
+  /*!
+   *  \brief Makes a failed result.
+   *  
+   *  \param [in] status The outcome of the call. Must not be
+   *         \ref TRANSFER_OK.
+   *  \param [in] code The code describing the failure, see
+   *         \ref result_error::code().
+   *  \param [in] message The message describing the failure. Must outlive
+   *         the result.
+   */
+  static result      failure(transfer_status status, int code, const char* message) noexcept
+  {
+    return result(status, code, message);
+  }
+  
+  /*!
+   *  \brief Makes a failed result carrying an exception, such as from within
+   *         a catch block using std::current_exception().
+   */
+  static result      failure(transfer_status status, std::exception_ptr ex) noexcept
+  {
+    return result(status, ex);
+  }
+  
+  /*!
+   *  \brief Makes a failed result with the same failure as another result.
+   */
+  static result      failure(const result_error& other) noexcept
+  {
+    return result(other);
+  }
+  
+  /*!
+   *  \brief Gets the value returned by the call, or a default-constructed
+   *         value if it failed.
+   */
+  T                  value() const noexcept
+  {
+    return m_value;
+  }
+  
+  /*!
+   *  \brief Gets the value returned by the call, or the given value if it
+   *         failed.
+   */
+  T                  value_or(T fallback) const noexcept
+  {
+    return ok() ? m_value : fallback;
+  }
+  
+  /*!
+   *  \brief Gets the value returned by the call, throwing if it failed.
+   *  
+   *  \throws std::exception See \ref result_error::throw_if_failed().
+   */
+  T                  get() const
+  {
+    throw_if_failed();
+    return m_value;
+  }
+
+
+
+private:
+                     result() noexcept
+                       : result_error(), m_value()
+  {
+    // Nothing else to do
+  }
+                     
+                     result(transfer_status status, int code, const char* message) noexcept
+                       : result_error(status, code, message), m_value()
+  {
+    // Nothing else to do
+  }
+                     
+                     result(transfer_status status, std::exception_ptr ex) noexcept
+                       : result_error(status, ex), m_value()
+  {
+    // Nothing else to do
+  }
+  
+  explicit           result(const result_error& error) noexcept
+                       : result_error(error), m_value()
+  {
+    // Nothing else to do
+  }
+  
+  /*! \brief The value returned by the call. */
+  T                  m_value;
+};
+
+
+
+/*! \class result<void>
+ *  \brief The outcome of a call that returns nothing and reports failures
+ *         without throwing.
+ *  
+ *  \see result
+ */
+template<>
+class result<void>: public result_error
+{
+public:
+  
+  /*!
+   *  \brief Makes a successful result.
+   */
+  static result      success() noexcept
+  {
+    return result();
+  }
+  
+  /*!
+   *  \see result::failure(transfer_status status, int code, const char* message)
+   */
+  static result      failure(transfer_status status, int code, const char* message) noexcept
+  {
+    return result(status, code, message);
+  }
+  
+  /*!
+   *  \see result::failure(transfer_status status, std::exception_ptr ex)
+   */
+  static result      failure(transfer_status status, std::exception_ptr ex) noexcept
+  {
+    return result(status, ex);
+  }
+  
+  /*!
+   *  \see result::failure(const result_error& other)
+   */
+  static result      failure(const result_error& other) noexcept
+  {
+    return result(other);
+  }
+  
+  /*!
+   *  \brief Throws if the call failed.
+   *  
+   *  \throws std::exception See \ref result_error::throw_if_failed().
+   */
+  void               get() const
+  {
+    throw_if_failed();
+  }
+
+
+
+private:
+                     result() noexcept
+                       : result_error()
+  {
+    // Nothing else to do
+  }
+                     
+                     result(transfer_status status, int code, const char* message) noexcept
+                       : result_error(status, code, message)
+  {
+    // Nothing else to do
+  }
+                     
+                     result(transfer_status status, std::exception_ptr ex) noexcept
+                       : result_error(status, ex)
+  {
+    // Nothing else to do
+  }
+  
+  explicit           result(const result_error& error) noexcept
+                       : result_error(error)
+  {
+    // Nothing else to do
+  }
+};
+
+}
+
+#endif /* defined(__USB_RESULT_H__) */
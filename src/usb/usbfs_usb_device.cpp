@@ -0,0 +1,1586 @@
+/*! \file
+ *  \brief File containing the implementation of the \ref usb::usbfs_usb_device
+ *         class.
+ *  
+ *  File containing the implementation of the \ref usb::usbfs_usb_device class.
+ *  See corresponding header file to view documentation for the class, its
+ *  methods, and its member variables.
+ *  
+ *  \see usb::usbfs_usb_device
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#include "usbfs_usb_device.h"
+
+#if defined(__linux__)
+
+#include "usb.h"
+#include "common/trace.h"
+#include "common/metrics.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <linux/usbdevice_fs.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define CLASS_NAME "usbfs_usb_device"
+#define CONFIG_NAME "USB configuration"
+#define INTERFACE_NAME "USB interface"
+#define INPUT_ENDPOINT_NAME "USB input endpoint"
+#define OUTPUT_ENDPOINT_NAME "USB output endpoint"
+
+#define DEFAULT_MAX_PENDING_TRANSFERS 16
+
+// How often a thread waiting on a URB checks whether transfers were aborted
+#define ABORT_CHECK_INTERVAL_MS       100
+
+// Stale data is assumed to have all arrived once the input endpoint has been
+// quiet this long
+#define RECOVER_DRAIN_TIMEOUT_MS      50
+
+// Upper bound on stale packets discarded, in case the device keeps talking
+#define RECOVER_MAX_DRAIN_PACKETS     1024
+
+// Timeout of requests on the default endpoint
+#define CONTROL_TIMEOUT_MS            1000
+
+// Bit of an endpoint address or request type marking it as an input
+#define DIRECTION_IN                  0x80
+
+// Standard requests and descriptors, from chapter 9 of the USB specification
+#define REQUEST_GET_DESCRIPTOR        0x06
+#define REQUEST_GET_CONFIGURATION     0x08
+#define DESCRIPTOR_DEVICE             0x01
+#define DESCRIPTOR_CONFIGURATION      0x02
+#define DESCRIPTOR_STRING             0x03
+#define DESCRIPTOR_INTERFACE          0x04
+#define DESCRIPTOR_ENDPOINT           0x05
+#define DEVICE_DESCRIPTOR_SIZE        18
+#define CONFIGURATION_DESCRIPTOR_SIZE 9
+#define INTERFACE_DESCRIPTOR_SIZE     9
+#define ENDPOINT_DESCRIPTOR_SIZE      7
+
+namespace usb
+{
+
+typedef usbfs_usb_device::timeout_t            timeout_t;
+typedef usbfs_usb_device::configuration_t      configuration_t;
+typedef usbfs_usb_device::interface_t          interface_t;
+typedef usbfs_usb_device::endpoint_t           endpoint_t;
+typedef usbfs_usb_device::data_t               data_t;
+
+typedef usbfs_usb_device::device_description   device_description;
+typedef usbfs_usb_device::device_configuration device_configuration;
+typedef usbfs_usb_device::device_interface     device_interface;
+typedef usbfs_usb_device::device_alt_setting   device_alt_setting;
+typedef usbfs_usb_device::device_endpoint      device_endpoint;
+
+
+
+// Alternate setting as found in a configuration descriptor, before the
+// interfaces it belongs to are counted
+struct parsed_alt_setting
+{
+  unsigned int                  interface_id;
+  unsigned int                  alt_setting_id;
+  std::vector<device_endpoint>  endpoints;
+};
+
+static unsigned int read_le16(const unsigned char* data)
+{
+  return (unsigned int) data[0] | ((unsigned int) data[1] << 8);
+}
+
+static std::string node_path(unsigned int bus_number, unsigned int device_address)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/dev/bus/usb/%03u/%03u", bus_number, device_address);
+  return std::string(path);
+}
+
+// The message of a failed result must outlive it, so names are literals
+static const char* error_name(int error)
+{
+  switch (error)
+  {
+  case ENODEV:    return "ENODEV";
+  case EBUSY:     return "EBUSY";
+  case ETIMEDOUT: return "ETIMEDOUT";
+  case EINTR:     return "EINTR";
+  case EPIPE:     return "EPIPE";
+  case EOVERFLOW: return "EOVERFLOW";
+  case EPROTO:    return "EPROTO";
+  case EILSEQ:    return "EILSEQ";
+  case ENOMEM:    return "ENOMEM";
+  case EACCES:    return "EACCES";
+  case EPERM:     return "EPERM";
+  case EINVAL:    return "EINVAL";
+  case ENOENT:    return "ENOENT";
+  default:        return "usbfs error";
+  }
+}
+
+static device_endpoint parse_endpoint(const unsigned char* descriptor)
+{
+  device_endpoint endpoint;
+  endpoint.address = descriptor[2];
+  
+  // Bits 11 and 12 count extra transactions per microframe on high-speed
+  // isochronous and interrupt endpoints and aren't part of the size
+  endpoint.max_packet_size = read_le16(descriptor + 4) & 0x07FF;
+  endpoint.direction = ((descriptor[2] & DIRECTION_IN)
+                        ? usb_device::ENDPOINT_DIRECTION_IN : usb_device::ENDPOINT_DIRECTION_OUT);
+  
+  switch (descriptor[3] & 0x03)
+  {
+  case 0:
+    endpoint.transfer_type = usb_device::ENDPOINT_TYPE_CONTROL;
+    break;
+  case 1:
+    endpoint.transfer_type = usb_device::ENDPOINT_TYPE_ISOCHRONOUS;
+    break;
+  case 2:
+    endpoint.transfer_type = usb_device::ENDPOINT_TYPE_BULK;
+    break;
+  default:
+    endpoint.transfer_type = usb_device::ENDPOINT_TYPE_INTERRUPT;
+    break;
+  }
+  
+  return endpoint;
+}
+
+// Builds a configuration from its descriptor and every descriptor following
+// it, which together are wTotalLength bytes long
+static device_configuration* parse_configuration(const unsigned char* data, size_t length)
+{
+  // Endpoint descriptors follow the interface descriptor they belong to.
+  // Descriptors of any other kind are skipped
+  std::vector<parsed_alt_setting> alt_settings;
+  size_t offset = data[0];
+  while (offset + 2 <= length)
+  {
+    const unsigned char* descriptor = data + offset;
+    unsigned int size = descriptor[0];
+    if (size < 2 || offset + size > length)
+    {
+      break;
+    }
+    
+    if (descriptor[1] == DESCRIPTOR_INTERFACE && size >= INTERFACE_DESCRIPTOR_SIZE)
+    {
+      parsed_alt_setting alt_setting;
+      alt_setting.interface_id = descriptor[2];
+      alt_setting.alt_setting_id = descriptor[3];
+      alt_settings.push_back(alt_setting);
+    }
+    else if (descriptor[1] == DESCRIPTOR_ENDPOINT && size >= ENDPOINT_DESCRIPTOR_SIZE && !alt_settings.empty())
+    {
+      alt_settings.back().endpoints.push_back(parse_endpoint(descriptor));
+    }
+    offset += size;
+  }
+  
+  // Interfaces are listed in the order their first alternate setting appears
+  std::vector<unsigned int> interface_ids;
+  for (const parsed_alt_setting& alt_setting : alt_settings)
+  {
+    if (std::find(interface_ids.begin(), interface_ids.end(), alt_setting.interface_id) == interface_ids.end())
+    {
+      interface_ids.push_back(alt_setting.interface_id);
+    }
+  }
+  
+  device_configuration* configuration = new device_configuration((unsigned int) interface_ids.size());
+  configuration->config_id = data[5];
+  for (unsigned int i = 0; i < configuration->num_interfaces; ++i)
+  {
+    unsigned int num_alt_settings = 0;
+    for (const parsed_alt_setting& alt_setting : alt_settings)
+    {
+      num_alt_settings += (alt_setting.interface_id == interface_ids[i] ? 1 : 0);
+    }
+    
+    device_interface* interface = new device_interface(num_alt_settings);
+    interface->interface_id = interface_ids[i];
+    configuration->interfaces[i] = interface;
+    
+    unsigned int j = 0;
+    for (const parsed_alt_setting& parsed : alt_settings)
+    {
+      if (parsed.interface_id != interface_ids[i])
+      {
+        continue;
+      }
+      
+      device_alt_setting* alt_setting = new device_alt_setting((unsigned int) parsed.endpoints.size());
+      alt_setting->interface_id = parsed.interface_id;
+      alt_setting->alt_setting_id = parsed.alt_setting_id;
+      for (unsigned int k = 0; k < alt_setting->num_endpoints; ++k)
+      {
+        alt_setting->endpoints[k] = new device_endpoint(parsed.endpoints[k]);
+      }
+      interface->alt_settings[j++] = alt_setting;
+    }
+  }
+  
+  return configuration;
+}
+
+
+
+usbfs_usb_device::usbfs_usb_device(unsigned int bus_number, unsigned int device_address)
+  : m_path               (node_path(bus_number, device_address)),
+    m_fd                 (-1),
+    m_was_initialized    (false),
+    m_is_open            (false),
+    m_kernel_was_attached(false),
+    m_configuration_set  (false),
+    m_interface_set      (false),
+    m_input_endpoint_set (false),
+    m_output_endpoint_set(false),
+    m_timeout            (0),
+    m_configuration      (0),
+    m_old_configuration  (0),
+    m_interface          (0),
+    m_input_endpoint     (0),
+    m_output_endpoint    (0),
+    m_alt_setting        (0),
+    m_device_description (),
+    m_string_indexes     {0, 0, 0},
+    m_manufacturer_string(),
+    m_manufacturer_string_set(false),
+    m_product_string     (),
+    m_product_string_set (false),
+    m_serial_number      (),
+    m_serial_number_set  (false),
+    m_transfer_state     (),
+    m_max_pending_transfers(DEFAULT_MAX_PENDING_TRANSFERS),
+    m_pending_transfers  (),
+    m_free_transfers     (),
+    m_sync_transfer      (nullptr),
+    m_abort_generation   (0),
+    m_metric_transfers_in(nullptr),
+    m_metric_transfers_out(nullptr),
+    m_metric_bytes_in    (nullptr),
+    m_metric_bytes_out   (nullptr),
+    m_metric_errors      (nullptr),
+    m_metric_timeouts    (nullptr)
+{
+  // Nothing else to do
+}
+
+usbfs_usb_device::~usbfs_usb_device()
+{
+  // Close connection if opened
+  if (m_is_open)
+  {
+    try
+    {
+      close();
+    }
+    catch (std::exception& ex)
+    {
+      (void) ex;
+      // Do nothing, fail silently
+    }
+  }
+  if (m_fd >= 0)
+  {
+    ::close(m_fd);
+  }
+  
+  // Release URB slots
+  for (urb_slot* slot : m_free_transfers)
+  {
+    delete_urb_slot(slot);
+  }
+  delete_urb_slot(m_sync_transfer);
+}
+
+const std::string& usbfs_usb_device::path() const
+{
+  return m_path;
+}
+
+void usbfs_usb_device::init()
+{
+  // Check if we were already initialized
+  if (m_was_initialized)
+  {
+    return;
+  }
+  
+  m_device_description.reset(build_device_description());
+  m_was_initialized = true;
+}
+
+
+
+timeout_t usbfs_usb_device::timeout() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  
+  return m_timeout;
+}
+
+configuration_t usbfs_usb_device::configuration() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  if (!m_configuration_set) throw unconfigured_exception(CONFIG_NAME);
+  
+  return m_device_description
+    ->configurations[m_configuration]
+    ->config_id;
+}
+
+interface_t usbfs_usb_device::interface() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  if (!m_configuration_set) throw unconfigured_exception(CONFIG_NAME);
+  if (!m_interface_set) throw unconfigured_exception(INTERFACE_NAME);
+  
+  return m_device_description
+    ->configurations[m_configuration]
+    ->interfaces[m_interface]
+    ->interface_id;
+}
+
+endpoint_t usbfs_usb_device::input_endpoint() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  if (!m_configuration_set) throw unconfigured_exception(CONFIG_NAME);
+  if (!m_interface_set) throw unconfigured_exception(INTERFACE_NAME);
+  if (!m_input_endpoint_set) throw unconfigured_exception(INPUT_ENDPOINT_NAME);
+  
+  return m_device_description
+    ->configurations[m_configuration]
+    ->interfaces[m_interface]
+    ->alt_settings[m_alt_setting]
+    ->endpoints[m_input_endpoint]
+    ->address;
+}
+
+endpoint_t usbfs_usb_device::output_endpoint() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  if (!m_configuration_set) throw unconfigured_exception(CONFIG_NAME);
+  if (!m_interface_set) throw unconfigured_exception(INTERFACE_NAME);
+  if (!m_output_endpoint_set) throw unconfigured_exception(OUTPUT_ENDPOINT_NAME);
+  
+  return m_device_description
+    ->configurations[m_configuration]
+    ->interfaces[m_interface]
+    ->alt_settings[m_alt_setting]
+    ->endpoints[m_output_endpoint]
+    ->address;
+}
+
+const device_description* usbfs_usb_device::get_device_description() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  
+  return m_device_description.get();
+}
+
+std::string usbfs_usb_device::get_manufacturer_string()
+{
+  return cached_string(m_string_indexes[0], m_manufacturer_string, m_manufacturer_string_set);
+}
+
+std::string usbfs_usb_device::get_product_string()
+{
+  return cached_string(m_string_indexes[1], m_product_string, m_product_string_set);
+}
+
+std::string usbfs_usb_device::get_serial_number()
+{
+  return cached_string(m_string_indexes[2], m_serial_number, m_serial_number_set);
+}
+
+
+
+void usbfs_usb_device::set_timeout(timeout_t timeout)
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  
+  m_timeout = (unsigned int) timeout;
+}
+
+void usbfs_usb_device::set_configuration(configuration_t configuration)
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  
+  const device_configuration* config = nullptr;
+  
+  // Search for config in descriptor
+  for (unsigned int i = 0; i < m_device_description->num_configurations; ++i)
+  {
+    if (m_device_description->configurations[i]->config_id == configuration)
+    {
+      config = m_device_description->configurations[i];
+      configuration = i;
+    }
+  }
+  
+  // Validate arguments
+  if (config == nullptr)
+  {
+    throw not_found_exception("configuration{id: " + std::to_string(configuration) + "}");
+  }
+  
+  // Only change configuration if new value differs from old value
+  if (!m_configuration_set || m_configuration != (int) configuration)
+  {
+    m_configuration = (int) configuration;
+    m_configuration_set = true;
+    m_interface_set = false;
+    update_transfer_state();
+    
+    // Switch device's current configuration
+    if (m_is_open)
+    {
+      unsigned int config_id = config->config_id;
+      if (ioctl(m_fd, USBDEVFS_SETCONFIGURATION, &config_id) < 0)
+      {
+        throw_usbfs_exception(errno, m_timeout);
+      }
+    }
+  }
+}
+
+void usbfs_usb_device::set_interface(interface_t interface)
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  if (!m_configuration_set) throw unconfigured_exception(CONFIG_NAME);
+  
+  const device_interface* inter = nullptr;
+  const device_configuration* config = m_device_description->configurations[m_configuration];
+  
+  // Search for interface in descriptor
+  for (unsigned int i = 0; i < config->num_interfaces; ++i)
+  {
+    if (config->interfaces[i]->interface_id == interface)
+    {
+      inter = config->interfaces[i];
+      interface = i;
+    }
+  }
+  
+  // Validate arguments
+  if (inter == nullptr)
+  {
+    throw not_found_exception("interface{id: " + std::to_string(interface) + "}");
+  }
+  
+  // Claim interface if applicable
+  if (m_is_open)
+  {
+    // Release old interface if one was previously claimed
+    if (m_interface_set)
+    {
+      unsigned int old_id = config->interfaces[m_interface]->interface_id;
+      if (ioctl(m_fd, USBDEVFS_RELEASEINTERFACE, &old_id) < 0)
+      {
+        throw_usbfs_exception(errno, m_timeout);
+      }
+    }
+    else
+    {
+      m_interface_set = true;
+    }
+    
+    m_interface = (int) interface;
+    update_transfer_state();
+    
+    unsigned int new_id = inter->interface_id;
+    if (ioctl(m_fd, USBDEVFS_CLAIMINTERFACE, &new_id) < 0)
+    {
+      throw_usbfs_exception(errno, m_timeout);
+    }
+  }
+  else
+  {
+    m_interface_set = true;
+    m_interface = (int) interface;
+    update_transfer_state();
+  }
+  
+  // Automatically set endpoints if unset
+  if (!m_input_endpoint_set || !m_output_endpoint_set)
+  {
+    const device_alt_setting* alt_setting = inter->alt_settings[m_alt_setting];
+    
+    for (unsigned int i = 0; i < alt_setting->num_endpoints && (!m_input_endpoint_set || !m_output_endpoint_set); ++i)
+    {
+      if (alt_setting->endpoints[i]->transfer_type != ENDPOINT_TYPE_BULK)
+      {
+        continue;
+      }
+      if (alt_setting->endpoints[i]->direction == ENDPOINT_DIRECTION_OUT && !m_output_endpoint_set)
+      {
+        m_output_endpoint_set = true;
+        m_output_endpoint = i;
+      }
+      else if (alt_setting->endpoints[i]->direction == ENDPOINT_DIRECTION_IN && !m_input_endpoint_set)
+      {
+        m_input_endpoint_set = true;
+        m_input_endpoint = i;
+      }
+    }
+  }
+  
+  update_transfer_state();
+}
+
+void usbfs_usb_device::set_input_endpoint(endpoint_t input_endpoint)
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  if (!m_configuration_set) throw unconfigured_exception(CONFIG_NAME);
+  if (!m_interface_set) throw unconfigured_exception(INTERFACE_NAME);
+  
+  // Validate input
+  if (input_endpoint > 255)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(input_endpoint)
+                                + " for argument 1: expected value between 0 and 255.");
+  }
+  else if ((input_endpoint & 0x70) != 0)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(input_endpoint)
+                                + " for argument 1: invaild endpoint address.");
+  }
+  else if ((input_endpoint & DIRECTION_IN) == 0)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(input_endpoint)
+                                + " for argument 1: endpoint address does not indicate input.");
+  }
+  
+  // Find desired endpoint
+  const device_alt_setting* as = m_device_description->configurations[m_configuration]->interfaces[m_interface]->alt_settings[m_alt_setting];
+  unsigned int i;
+  for (i = 0; i < as->num_endpoints; ++i)
+  {
+    if (as->endpoints[i]->address == input_endpoint)
+    {
+      break;
+    }
+  }
+  
+  if (i == as->num_endpoints)
+  {
+    throw not_found_exception("endpoint{address: " + std::to_string(input_endpoint) + "}");
+  }
+  
+  m_input_endpoint = i;
+  m_input_endpoint_set = true;
+  update_transfer_state();
+}
+
+void usbfs_usb_device::set_output_endpoint(endpoint_t output_endpoint)
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  if (!m_configuration_set) throw unconfigured_exception(CONFIG_NAME);
+  if (!m_interface_set) throw unconfigured_exception(INTERFACE_NAME);
+  
+  // Validate input
+  if (output_endpoint > 255)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(output_endpoint)
+                                + " for argument 1: expected value between 0 and 255.");
+  }
+  else if ((output_endpoint & 0x70) != 0)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(output_endpoint)
+                                + " for argument 1: invaild endpoint address.");
+  }
+  else if ((output_endpoint & DIRECTION_IN) != 0)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(output_endpoint)
+                                + " for argument 1: endpoint address does not indicate output.");
+  }
+  
+  // Find desired endpoint
+  const device_alt_setting* as = m_device_description->configurations[m_configuration]->interfaces[m_interface]->alt_settings[m_alt_setting];
+  unsigned int i;
+  for (i = 0; i < as->num_endpoints; ++i)
+  {
+    if (as->endpoints[i]->address == output_endpoint)
+    {
+      break;
+    }
+  }
+  
+  if (i == as->num_endpoints)
+  {
+    throw not_found_exception("endpoint{address: " + std::to_string(output_endpoint) + "}");
+  }
+  
+  m_output_endpoint = i;
+  m_output_endpoint_set = true;
+  update_transfer_state();
+}
+
+
+
+void usbfs_usb_device::open()
+{
+  if (m_is_open)
+  {
+    // Already open: do nothing
+    return;
+  }
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  
+  // A node left open for fetching strings is reopened from scratch
+  if (m_fd >= 0)
+  {
+    ::close(m_fd);
+  }
+  m_fd = open_node();
+  if (m_fd < 0)
+  {
+    throw_usbfs_exception(errno, m_timeout);
+  }
+  
+  // Nothing claimed so far needs undoing, so just close the node
+  auto fail = [this](int error)
+  {
+    ::close(m_fd);
+    m_fd = -1;
+    throw_usbfs_exception(error, m_timeout);
+  };
+  
+  // Detach the kernel driver bound to the interface, unless it's usbfs itself
+  usbdevfs_getdriver driver;
+  memset(&driver, 0, sizeof(driver));
+  driver.interface = (unsigned int) m_interface;
+  m_kernel_was_attached = false;
+  if (ioctl(m_fd, USBDEVFS_GETDRIVER, &driver) == 0 && strcmp(driver.driver, "usbfs") != 0)
+  {
+    usbdevfs_ioctl command;
+    command.ifno = m_interface;
+    command.ioctl_code = USBDEVFS_DISCONNECT;
+    command.data = nullptr;
+    if (ioctl(m_fd, USBDEVFS_IOCTL, &command) < 0)
+    {
+      fail(errno);
+    }
+    m_kernel_was_attached = true;
+  }
+  
+  // Retrieve the current configuration so we can restore it later
+  data_t current = 0;
+  int result = control_transfer(DIRECTION_IN, REQUEST_GET_CONFIGURATION, 0, 0, &current, 1);
+  if (result < 0)
+  {
+    fail(-result);
+  }
+  m_old_configuration = 0;
+  for (unsigned int i = 0; i < m_device_description->num_configurations; ++i)
+  {
+    if (m_device_description->configurations[i]->config_id == current)
+    {
+      m_old_configuration = (int) i;
+      break;
+    }
+  }
+  
+  // Attempt to set the configuration
+  if (m_configuration_set)
+  {
+    if (m_configuration != m_old_configuration)
+    {
+      unsigned int config_id = m_device_description->configurations[m_configuration]->config_id;
+      if (ioctl(m_fd, USBDEVFS_SETCONFIGURATION, &config_id) < 0)
+      {
+        fail(errno);
+      }
+    }
+  }
+  else
+  {
+    m_configuration_set = true;
+    m_configuration = m_old_configuration;
+  }
+  
+  // Attempt to claim the desired interface
+  if (m_interface_set)
+  {
+    unsigned int interface_id = interface();
+    if (ioctl(m_fd, USBDEVFS_CLAIMINTERFACE, &interface_id) < 0)
+    {
+      fail(errno);
+    }
+  }
+  
+  m_is_open = true;
+  update_transfer_state();
+  bind_metrics();
+}
+
+void usbfs_usb_device::close()
+{
+  if (!m_is_open)
+  {
+    // Already closed: do nothing
+    return;
+  }
+  
+  // URBs cannot outlive the device node
+  cancel_pending_transfers();
+  
+  m_is_open = false;
+  update_transfer_state();
+  
+  // Undo everything open() did, closing the node even if a step fails
+  int error = 0;
+  if (m_interface_set)
+  {
+    unsigned int interface_id = interface();
+    if (ioctl(m_fd, USBDEVFS_RELEASEINTERFACE, &interface_id) < 0)
+    {
+      error = errno;
+    }
+  }
+  
+  unsigned int config_id = m_device_description->configurations[m_old_configuration]->config_id;
+  if (ioctl(m_fd, USBDEVFS_SETCONFIGURATION, &config_id) < 0)
+  {
+    error = (error == 0 ? errno : error);
+  }
+  else
+  {
+    m_configuration_set = false;
+    update_transfer_state();
+  }
+  
+  if (m_kernel_was_attached)
+  {
+    usbdevfs_ioctl command;
+    command.ifno = m_interface;
+    command.ioctl_code = USBDEVFS_CONNECT;
+    command.data = nullptr;
+    if (ioctl(m_fd, USBDEVFS_IOCTL, &command) < 0)
+    {
+      error = (error == 0 ? errno : error);
+    }
+  }
+  
+  ::close(m_fd);
+  m_fd = -1;
+  
+  if (error != 0)
+  {
+    throw_usbfs_exception(error, m_timeout);
+  }
+}
+
+
+
+unsigned int usbfs_usb_device::read(data_t* data, unsigned int num_bytes)
+{
+  return read(data, num_bytes, m_timeout);
+}
+
+unsigned int usbfs_usb_device::read(data_t* data, unsigned int num_bytes, timeout_t timeout)
+{
+  if (!m_transfer_state.read_ready) validate_read_state();
+  
+  return try_read(data, num_bytes, timeout).get();
+}
+
+unsigned int usbfs_usb_device::write(const data_t* data, unsigned int num_bytes)
+{
+  return write(data, num_bytes, m_timeout);
+}
+
+unsigned int usbfs_usb_device::write(const data_t* data, unsigned int num_bytes, timeout_t timeout)
+{
+  if (!m_transfer_state.write_ready) validate_write_state();
+  
+  return try_write(data, num_bytes, timeout).get();
+}
+
+result<unsigned int> usbfs_usb_device::try_read(data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept
+{
+  // The throwing version explains why the device isn't ready
+  if (!m_transfer_state.read_ready)
+  {
+    return usb_device::try_read(data, num_bytes, timeout);
+  }
+  
+  unsigned char endpoint = m_transfer_state.input_address;
+  trace_scope trace(TRACE_TRANSFER_IN, num_bytes);
+  
+  unsigned int bytes_read = 0;
+  int error = transfer(USBDEVFS_URB_TYPE_BULK, endpoint, data, num_bytes, timeout, bytes_read);
+  if (error != 0)
+  {
+    count_error(error);
+    return usbfs_failure(error, timeout);
+  }
+  count_transfer(endpoint, bytes_read);
+  
+  return result<unsigned int>::success(bytes_read);
+}
+
+result<unsigned int> usbfs_usb_device::try_write(const data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept
+{
+  if (!m_transfer_state.write_ready)
+  {
+    return usb_device::try_write(data, num_bytes, timeout);
+  }
+  
+  unsigned char endpoint = m_transfer_state.output_address;
+  trace_scope trace(TRACE_TRANSFER_OUT, num_bytes);
+  
+  // The kernel copies the data as the URB is submitted and never writes to it
+  unsigned int bytes_written = 0;
+  int error = transfer(USBDEVFS_URB_TYPE_BULK, endpoint, const_cast<data_t*>(data), num_bytes, timeout, bytes_written);
+  if (error != 0)
+  {
+    count_error(error);
+    return usbfs_failure(error, timeout);
+  }
+  count_transfer(endpoint, bytes_written);
+  
+  return result<unsigned int>::success(bytes_written);
+}
+
+
+
+bool usbfs_usb_device::supports_async_transfers() const
+{
+  return true;
+}
+
+unsigned int usbfs_usb_device::max_pending_transfers() const
+{
+  return m_max_pending_transfers;
+}
+
+void usbfs_usb_device::set_max_pending_transfers(unsigned int max_pending)
+{
+  if (max_pending == 0)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(max_pending)
+                                + " for argument 1: expected value greater than 0.");
+  }
+  if (!m_pending_transfers.empty())
+  {
+    throw std::runtime_error("Cannot change queue depth while transfers are pending");
+  }
+  
+  m_max_pending_transfers = max_pending;
+  
+  // Trim unneeded slots
+  while (m_free_transfers.size() > m_max_pending_transfers)
+  {
+    delete_urb_slot(m_free_transfers.back());
+    m_free_transfers.pop_back();
+  }
+}
+
+unsigned int usbfs_usb_device::num_pending_transfers() const
+{
+  return (unsigned int) m_pending_transfers.size();
+}
+
+void usbfs_usb_device::submit_read(data_t* data, unsigned int num_bytes)
+{
+  if (!m_transfer_state.read_ready) validate_read_state();
+  
+  // The kernel copies the data read into the caller's buffer as the URB is
+  // reaped
+  submit_async(m_transfer_state.input_address, data, num_bytes);
+}
+
+void usbfs_usb_device::submit_write(const data_t* data, unsigned int num_bytes)
+{
+  if (!m_transfer_state.write_ready) validate_write_state();
+  
+  // The kernel copies the data as the URB is submitted, so the caller's
+  // buffer may be reused as soon as this returns
+  submit_async(m_transfer_state.output_address, const_cast<data_t*>(data), num_bytes);
+}
+
+unsigned int usbfs_usb_device::complete_transfer()
+{
+  if (m_pending_transfers.empty())
+  {
+    throw std::runtime_error("No pending transfers");
+  }
+  
+  urb_slot* slot = m_pending_transfers.front();
+  int error;
+  {
+    // Only the time spent waiting on the transfer is recorded
+    trace_scope trace((slot->urb->endpoint & DIRECTION_IN) ? TRACE_TRANSFER_IN : TRACE_TRANSFER_OUT,
+                      (unsigned int) slot->urb->buffer_length);
+    error = wait_for_urb(slot);
+  }
+  m_pending_transfers.pop_front();
+  m_free_transfers.push_back(slot);
+  
+  if (error == 0)
+  {
+    error = urb_error(slot);
+  }
+  if (error != 0)
+  {
+    count_error(error);
+    throw_usbfs_exception(error, slot->timeout);
+  }
+  
+  // Adjust number of bytes transferred to conform to the return type
+  unsigned int actual_length = (slot->urb->actual_length < 0 ? 0 : (unsigned int) slot->urb->actual_length);
+  count_transfer(slot->urb->endpoint, actual_length);
+  return actual_length;
+}
+
+void usbfs_usb_device::cancel_pending_transfers()
+{
+  // Ask the kernel to give back everything still in flight
+  for (urb_slot* slot : m_pending_transfers)
+  {
+    if (!slot->completed && !slot->discarded)
+    {
+      slot->discarded = true;
+      ioctl(m_fd, USBDEVFS_DISCARDURB, slot->urb);
+    }
+  }
+  
+  // The kernel still owns the URBs until they have been reaped
+  while (!m_pending_transfers.empty())
+  {
+    wait_for_urb(m_pending_transfers.front());
+    m_free_transfers.push_back(m_pending_transfers.front());
+    m_pending_transfers.pop_front();
+  }
+}
+
+void usbfs_usb_device::abort_pending_transfers()
+{
+  // Waiters notice the new generation the next time they wake
+  ++m_abort_generation;
+}
+
+bool usbfs_usb_device::recover()
+{
+  if (!m_is_open)
+  {
+    return false;
+  }
+  
+  cancel_pending_transfers();
+  
+  // Stalled endpoints refuse every transfer until their halt is cleared
+  if (m_transfer_state.write_ready)
+  {
+    unsigned int output_address = m_transfer_state.output_address;
+    if (ioctl(m_fd, USBDEVFS_CLEAR_HALT, &output_address) < 0 && errno != ENOENT)
+    {
+      return false;
+    }
+  }
+  if (!m_transfer_state.read_ready)
+  {
+    return true;
+  }
+  unsigned int input_address = m_transfer_state.input_address;
+  if (ioctl(m_fd, USBDEVFS_CLEAR_HALT, &input_address) < 0 && errno != ENOENT)
+  {
+    return false;
+  }
+  
+  // Throw away replies to requests that have already been given up on.
+  // Reads are a whole packet so that a packet can't overflow the buffer
+  unsigned int packet_size = max_packet_size(input_address);
+  if (packet_size == 0)
+  {
+    packet_size = 512;
+  }
+  std::vector<data_t> packet(packet_size);
+  for (unsigned int i = 0; i < RECOVER_MAX_DRAIN_PACKETS; ++i)
+  {
+    unsigned int bytes_read = 0;
+    int error = transfer(USBDEVFS_URB_TYPE_BULK, (unsigned char) input_address, packet.data(), packet_size,
+                         RECOVER_DRAIN_TIMEOUT_MS, bytes_read);
+    if (error == ETIMEDOUT)
+    {
+      return true;
+    }
+    if (error != 0)
+    {
+      return false;
+    }
+  }
+  
+  // Device never went quiet
+  return false;
+}
+
+
+
+bool usbfs_usb_device::supports_interrupt_reads() const
+{
+  return true;
+}
+
+unsigned int usbfs_usb_device::read_interrupt(endpoint_t endpoint, data_t* data, unsigned int num_bytes, timeout_t timeout)
+{
+  if (!m_transfer_state.read_ready) validate_read_state();
+  
+  if ((endpoint & DIRECTION_IN) == 0 || endpoint > 255)
+  {
+    throw std::invalid_argument("Unexpected value " + std::to_string(endpoint)
+                                + " for argument 1: endpoint address does not indicate input.");
+  }
+  
+  // Waiting on a notification isn't traced, and a notification that doesn't
+  // come in time isn't an error worth counting
+  unsigned int bytes_read = 0;
+  int error = transfer(USBDEVFS_URB_TYPE_INTERRUPT, (unsigned char) endpoint, data, num_bytes, timeout, bytes_read);
+  if (error != 0)
+  {
+    if (error != ETIMEDOUT)
+    {
+      count_error(error);
+    }
+    throw_usbfs_exception(error, timeout);
+  }
+  count_transfer((unsigned char) endpoint, bytes_read);
+  
+  return bytes_read;
+}
+
+
+
+void usbfs_usb_device::update_transfer_state()
+{
+  bool ready = m_was_initialized && m_is_open && m_configuration_set && m_interface_set;
+  
+  m_transfer_state.read_ready = ready && m_input_endpoint_set;
+  m_transfer_state.write_ready = ready && m_output_endpoint_set;
+  
+  // Resolve endpoint addresses once rather than on every transfer
+  const device_alt_setting* alt_setting = nullptr;
+  if (ready)
+  {
+    alt_setting = m_device_description
+      ->configurations[m_configuration]
+      ->interfaces[m_interface]
+      ->alt_settings[m_alt_setting];
+  }
+  
+  // Endpoint indexes may be stale while the interface is being switched
+  if (m_transfer_state.read_ready && m_input_endpoint >= alt_setting->num_endpoints)
+  {
+    m_transfer_state.read_ready = false;
+  }
+  if (m_transfer_state.write_ready && m_output_endpoint >= alt_setting->num_endpoints)
+  {
+    m_transfer_state.write_ready = false;
+  }
+  
+  m_transfer_state.input_address = (m_transfer_state.read_ready
+    ? (unsigned char) alt_setting->endpoints[m_input_endpoint]->address : 0);
+  m_transfer_state.output_address = (m_transfer_state.write_ready
+    ? (unsigned char) alt_setting->endpoints[m_output_endpoint]->address : 0);
+}
+
+void usbfs_usb_device::validate_read_state() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  if (!m_is_open) throw unopen_exception(CLASS_NAME);
+  if (!m_configuration_set) throw unconfigured_exception(CONFIG_NAME);
+  if (!m_interface_set) throw unconfigured_exception(INTERFACE_NAME);
+  if (!m_input_endpoint_set) throw unconfigured_exception(INPUT_ENDPOINT_NAME);
+  
+  // Every flag is set, so the selected endpoint must not exist
+  throw unconfigured_exception(INPUT_ENDPOINT_NAME);
+}
+
+void usbfs_usb_device::validate_write_state() const
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  if (!m_is_open) throw unopen_exception(CLASS_NAME);
+  if (!m_configuration_set) throw unconfigured_exception(CONFIG_NAME);
+  if (!m_interface_set) throw unconfigured_exception(INTERFACE_NAME);
+  if (!m_output_endpoint_set) throw unconfigured_exception(OUTPUT_ENDPOINT_NAME);
+  
+  // Every flag is set, so the selected endpoint must not exist
+  throw unconfigured_exception(OUTPUT_ENDPOINT_NAME);
+}
+
+
+
+int usbfs_usb_device::transfer(unsigned char type, unsigned char endpoint, data_t* buffer, unsigned int num_bytes,
+                               timeout_t timeout, unsigned int& num_transferred) noexcept
+{
+  num_transferred = 0;
+  
+  // Blocking transfers don't count against the pending transfer limit, so
+  // they get a slot of their own
+  if (m_sync_transfer == nullptr)
+  {
+    m_sync_transfer = new_urb_slot();
+    if (m_sync_transfer == nullptr)
+    {
+      return ENOMEM;
+    }
+  }
+  
+  int error = submit_urb(m_sync_transfer, type, endpoint, buffer, num_bytes, timeout);
+  if (error == 0)
+  {
+    error = wait_for_urb(m_sync_transfer);
+  }
+  if (error == 0)
+  {
+    error = urb_error(m_sync_transfer);
+  }
+  if (error == 0 && m_sync_transfer->urb->actual_length > 0)
+  {
+    num_transferred = (unsigned int) m_sync_transfer->urb->actual_length;
+  }
+  return error;
+}
+
+int usbfs_usb_device::submit_urb(urb_slot* slot, unsigned char type, unsigned char endpoint, data_t* buffer,
+                                 unsigned int num_bytes, timeout_t timeout) noexcept
+{
+  usbdevfs_urb* urb = slot->urb;
+  memset(urb, 0, sizeof(*urb));
+  urb->type = type;
+  urb->endpoint = endpoint;
+  urb->buffer = buffer;
+  urb->buffer_length = (int) num_bytes;
+  urb->usercontext = slot;
+  
+  slot->completed = false;
+  slot->discarded = false;
+  slot->timed_out = false;
+  slot->timeout = timeout;
+  slot->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  slot->generation = m_abort_generation;
+  
+  if (ioctl(m_fd, USBDEVFS_SUBMITURB, urb) < 0)
+  {
+    slot->completed = true;
+    return errno;
+  }
+  return 0;
+}
+
+int usbfs_usb_device::wait_for_urb(urb_slot* slot) noexcept
+{
+  while (true)
+  {
+    // URBs finishing behind this one are reaped along with it, so waiting on
+    // them later costs no system call
+    int error = reap_finished_urbs();
+    if (slot->completed)
+    {
+      return 0;
+    }
+    if (error != 0)
+    {
+      return error;
+    }
+    
+    // Once the URB has run out of time or been aborted, the kernel still has
+    // to hand it back before its buffer can be reused
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    bool aborted = (slot->generation != m_abort_generation);
+    if (!slot->discarded && (aborted || (slot->timeout != 0 && now >= slot->deadline)))
+    {
+      slot->discarded = true;
+      slot->timed_out = !aborted;
+      ioctl(m_fd, USBDEVFS_DISCARDURB, slot->urb);
+      continue;
+    }
+    
+    int wait_ms = ABORT_CHECK_INTERVAL_MS;
+    if (!slot->discarded && slot->timeout != 0)
+    {
+      long long remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(slot->deadline - now).count() + 1;
+      wait_ms = (int) std::min<long long>(wait_ms, remaining_ms);
+    }
+    
+    // The node polls writable while a finished URB waits to be reaped
+    pollfd fd;
+    fd.fd = m_fd;
+    fd.events = POLLOUT;
+    fd.revents = 0;
+    if (poll(&fd, 1, wait_ms) < 0 && errno != EINTR)
+    {
+      return errno;
+    }
+  }
+}
+
+int usbfs_usb_device::reap_finished_urbs() noexcept
+{
+  while (true)
+  {
+    usbdevfs_urb* urb = nullptr;
+    if (ioctl(m_fd, USBDEVFS_REAPURBNDELAY, &urb) < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return (errno == EAGAIN ? 0 : errno);
+    }
+    ((urb_slot*) urb->usercontext)->completed = true;
+  }
+}
+
+int usbfs_usb_device::urb_error(const urb_slot* slot) noexcept
+{
+  // A URB may finish just as it is discarded, in which case it still counts
+  int status = -slot->urb->status;
+  if (status == 0)
+  {
+    return 0;
+  }
+  if (slot->timed_out)
+  {
+    return ETIMEDOUT;
+  }
+  
+  switch (status)
+  {
+  case ENOENT:
+  case ECONNRESET:
+    // Discarded before it finished
+    return EINTR;
+  case ESHUTDOWN:
+    return ENODEV;
+  default:
+    return status;
+  }
+}
+
+usbfs_usb_device::urb_slot* usbfs_usb_device::new_urb_slot() noexcept
+{
+  urb_slot* slot = new (std::nothrow) urb_slot();
+  if (slot == nullptr)
+  {
+    return nullptr;
+  }
+  slot->urb = new (std::nothrow) usbdevfs_urb();
+  if (slot->urb == nullptr)
+  {
+    delete slot;
+    return nullptr;
+  }
+  slot->completed = true;
+  slot->discarded = false;
+  slot->timed_out = false;
+  slot->timeout = 0;
+  slot->generation = 0;
+  return slot;
+}
+
+void usbfs_usb_device::delete_urb_slot(urb_slot* slot) noexcept
+{
+  if (slot != nullptr)
+  {
+    delete slot->urb;
+    delete slot;
+  }
+}
+
+usbfs_usb_device::urb_slot* usbfs_usb_device::acquire_urb_slot()
+{
+  if (m_pending_transfers.size() >= m_max_pending_transfers)
+  {
+    throw std::runtime_error("Too many pending transfers");
+  }
+  
+  // Reuse an old slot if possible
+  if (!m_free_transfers.empty())
+  {
+    urb_slot* slot = m_free_transfers.back();
+    m_free_transfers.pop_back();
+    return slot;
+  }
+  
+  urb_slot* slot = new_urb_slot();
+  if (slot == nullptr)
+  {
+    throw_usbfs_exception(ENOMEM, m_timeout);
+  }
+  return slot;
+}
+
+void usbfs_usb_device::submit_async(unsigned char endpoint, data_t* buffer, unsigned int num_bytes)
+{
+  urb_slot* slot = acquire_urb_slot();
+  int error = submit_urb(slot, USBDEVFS_URB_TYPE_BULK, endpoint, buffer, num_bytes, m_timeout);
+  if (error != 0)
+  {
+    m_free_transfers.push_back(slot);
+    throw_usbfs_exception(error, m_timeout);
+  }
+  
+  m_pending_transfers.push_back(slot);
+}
+
+
+
+int usbfs_usb_device::control_transfer(unsigned char request_type, unsigned char request, unsigned short value,
+                                       unsigned short index, data_t* data, unsigned short length) noexcept
+{
+  usbdevfs_ctrltransfer control;
+  control.bRequestType = request_type;
+  control.bRequest = request;
+  control.wValue = value;
+  control.wIndex = index;
+  control.wLength = length;
+  control.timeout = CONTROL_TIMEOUT_MS;
+  control.data = data;
+  
+  int result = ioctl(m_fd, USBDEVFS_CONTROL, &control);
+  return (result < 0 ? -errno : result);
+}
+
+std::string usbfs_usb_device::fetch_string(unsigned int index)
+{
+  if (index == 0)
+  {
+    return std::string();
+  }
+  
+  // String 0 lists the languages the device knows, and the first is used
+  data_t buffer[255];
+  int length = control_transfer(DIRECTION_IN, REQUEST_GET_DESCRIPTOR, DESCRIPTOR_STRING << 8, 0, buffer, sizeof(buffer));
+  if (length < 4 || buffer[1] != DESCRIPTOR_STRING)
+  {
+    return std::string();
+  }
+  unsigned short language = (unsigned short) read_le16(buffer + 2);
+  
+  length = control_transfer(DIRECTION_IN, REQUEST_GET_DESCRIPTOR, (unsigned short) ((DESCRIPTOR_STRING << 8) | index),
+                            language, buffer, sizeof(buffer));
+  if (length < 2 || buffer[1] != DESCRIPTOR_STRING)
+  {
+    return std::string();
+  }
+  
+  // Characters are UTF-16LE
+  std::string string;
+  length = std::min(length, (int) buffer[0]);
+  for (int i = 2; i + 1 < length; i += 2)
+  {
+    string += (buffer[i + 1] == 0 && buffer[i] < 0x80 ? (char) buffer[i] : '?');
+  }
+  return string;
+}
+
+std::string usbfs_usb_device::cached_string(unsigned int index, std::string& string, bool& string_set)
+{
+  if (!m_was_initialized) throw uninitialized_exception(CLASS_NAME);
+  
+  if (!string_set)
+  {
+    // Requests on the default endpoint need no claimed interface
+    bool was_open = (m_fd >= 0);
+    if (!was_open)
+    {
+      m_fd = open_node();
+      if (m_fd < 0)
+      {
+        throw_usbfs_exception(errno, m_timeout);
+      }
+    }
+    
+    string = fetch_string(index);
+    string_set = true;
+    
+    if (!was_open)
+    {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+  }
+  
+  return string;
+}
+
+int usbfs_usb_device::open_node() const noexcept
+{
+  return ::open(m_path.c_str(), O_RDWR | O_CLOEXEC);
+}
+
+device_description* usbfs_usb_device::build_device_description()
+{
+  // Reading the node gives the device descriptor followed by every
+  // configuration descriptor, as cached by the kernel, so no transfer is made
+  int fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    throw_usbfs_exception(errno, m_timeout);
+  }
+  std::vector<unsigned char> raw;
+  unsigned char chunk[1024];
+  ssize_t num_read;
+  while ((num_read = ::read(fd, chunk, sizeof(chunk))) > 0)
+  {
+    raw.insert(raw.end(), chunk, chunk + num_read);
+  }
+  int error = (num_read < 0 ? errno : 0);
+  ::close(fd);
+  if (error != 0)
+  {
+    throw_usbfs_exception(error, m_timeout);
+  }
+  
+  if (raw.size() < DEVICE_DESCRIPTOR_SIZE || raw[0] < DEVICE_DESCRIPTOR_SIZE || raw[1] != DESCRIPTOR_DEVICE)
+  {
+    throw usb::exception("Unexpected device descriptor from " + m_path);
+  }
+  
+  // Create description and fill with data
+  std::unique_ptr<device_description> description(new device_description(raw[17]));
+  description->device_class = raw[4];
+  description->vendor_id = (int) read_le16(&raw[8]);
+  description->product_id = (int) read_le16(&raw[10]);
+  m_string_indexes[0] = raw[14];
+  m_string_indexes[1] = raw[15];
+  m_string_indexes[2] = raw[16];
+  
+  size_t offset = raw[0];
+  for (unsigned int i = 0; i < description->num_configurations; ++i)
+  {
+    size_t total_length = 0;
+    if (offset + CONFIGURATION_DESCRIPTOR_SIZE <= raw.size() && raw[offset + 1] == DESCRIPTOR_CONFIGURATION)
+    {
+      total_length = read_le16(&raw[offset + 2]);
+    }
+    if (total_length < CONFIGURATION_DESCRIPTOR_SIZE || offset + total_length > raw.size())
+    {
+      throw usb::exception("Unexpected configuration descriptor from " + m_path);
+    }
+    
+    description->configurations[i] = parse_configuration(&raw[offset], total_length);
+    offset += total_length;
+  }
+  
+  return description.release();
+}
+
+
+
+void usbfs_usb_device::bind_metrics()
+{
+  if (m_metric_errors != nullptr)
+  {
+    return;
+  }
+  
+  std::string serial;
+  try
+  {
+    serial = get_serial_number();
+  }
+  catch (std::exception& ex)
+  {
+    (void) ex;
+    // Count the device's transfers without a serial number
+  }
+  
+  std::string labels = metrics_label("serial", serial);
+  m_metric_transfers_in = metrics_counter("flashmasta_usb_transfers_total", "USB transfers completed", labels + ",direction=\"in\"");
+  m_metric_transfers_out = metrics_counter("flashmasta_usb_transfers_total", "USB transfers completed", labels + ",direction=\"out\"");
+  m_metric_bytes_in = metrics_counter("flashmasta_usb_bytes_total", "Bytes moved over USB", labels + ",direction=\"in\"");
+  m_metric_bytes_out = metrics_counter("flashmasta_usb_bytes_total", "Bytes moved over USB", labels + ",direction=\"out\"");
+  m_metric_timeouts = metrics_counter("flashmasta_usb_timeouts_total", "USB transfers that timed out", labels);
+  m_metric_errors = metrics_counter("flashmasta_usb_errors_total", "USB transfers that failed, including timeouts", labels);
+}
+
+void usbfs_usb_device::count_transfer(unsigned char endpoint, unsigned int num_bytes)
+{
+  if (m_metric_errors == nullptr)
+  {
+    return;
+  }
+  
+  if (endpoint & DIRECTION_IN)
+  {
+    m_metric_transfers_in->add();
+    m_metric_bytes_in->add(num_bytes);
+  }
+  else
+  {
+    m_metric_transfers_out->add();
+    m_metric_bytes_out->add(num_bytes);
+  }
+}
+
+void usbfs_usb_device::count_error(int error)
+{
+  if (m_metric_errors == nullptr)
+  {
+    return;
+  }
+  
+  m_metric_errors->add();
+  if (error == ETIMEDOUT)
+  {
+    m_metric_timeouts->add();
+  }
+}
+
+result<unsigned int> usbfs_usb_device::usbfs_failure(int error, timeout_t timeout) noexcept
+{
+  // Mirrors throw_usbfs_exception() so that the throwing wrappers throw the
+  // same exceptions
+  switch (error)
+  {
+    case ENODEV:
+      return result<unsigned int>::failure(TRANSFER_DISCONNECTED, error, error_name(error));
+    case EBUSY:
+      return result<unsigned int>::failure(TRANSFER_BUSY, error, error_name(error));
+    case ETIMEDOUT:
+      return result<unsigned int>::failure(TRANSFER_TIMEOUT, (int) timeout, error_name(error));
+    case EINTR:
+      return result<unsigned int>::failure(TRANSFER_INTERRUPTED, error, error_name(error));
+    default:
+      return result<unsigned int>::failure(TRANSFER_USB_ERROR, error, error_name(error));
+  }
+}
+
+void usbfs_usb_device::throw_usbfs_exception(int error, timeout_t timeout)
+{
+  switch (error)
+  {
+    case ENODEV:
+      throw disconnected_exception();
+    case EBUSY:
+      throw busy_exception();
+    case ETIMEDOUT:
+      throw timeout_exception(timeout);
+    case EINTR:
+      throw interrupted_exception();
+    default:
+      throw usb::exception("usbfs error code " + std::to_string(error) + " (" + strerror(error) + ")");
+  }
+}
+
+}
+
+#endif /* defined(__linux__) */
@@ -0,0 +1,586 @@
+/*! \file
+ *  \brief File containing the declaration of the \ref usb::usbfs_usb_device
+ *         class.
+ *  
+ *  File containing the header information and declaration of the
+ *  \ref usb::usbfs_usb_device class. The class is only available on Linux.
+ *  
+ *  \author Daniel Andrus
+ *  \date 2015-10-14
+ *  \copyright Copyright (c) 2015 7400 Circuits. All rights reserved.
+ */
+
+#ifndef __USBFS_USB_DEVICE_H__
+#define __USBFS_USB_DEVICE_H__
+
+#if defined(__linux__)
+
+#include "usbfwd.h"
+#include "usb_device.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct usbdevfs_urb;
+class metric;
+
+namespace usb
+{
+
+/*! \class usbfs_usb_device
+ *  \brief Linux usbfs-based implementation of the \ref usb_device class.
+ *  
+ *  Implementation of the \ref usb_device class that talks to the device node
+ *  under /dev/bus/usb directly, skipping the bookkeeping Libusb adds to
+ *  every transfer. Every transfer is a single URB handed to the kernel with
+ *  **USBDEVFS_SUBMITURB**. Transfers submitted with \ref submit_read() and
+ *  \ref submit_write() queue up in the kernel, and whenever one is waited on,
+ *  every URB that has finished is reaped in the same pass, so that the
+ *  transfers behind it complete without another system call.
+ *  
+ *  Outgoing data is copied by the kernel as the URB is submitted, so writes
+ *  are never staged. Incoming data is copied to the caller's buffer as the
+ *  URB is reaped.
+ *  
+ *  Unlike \ref libusb_usb_device, transfers can't be captured and there is no
+ *  event reactor; the calling thread always waits on its own transfers.
+ *  
+ *  This class is *not* thread-safe, except for
+ *  \ref abort_pending_transfers().
+ */
+class usbfs_usb_device : public usb_device
+{
+public:
+  
+  /*!
+   *  \brief Main constructor for the class.
+   *  
+   *  \param [in] bus_number The number of the bus the device is on.
+   *  \param [in] device_address The address of the device on its bus.
+   */
+                            usbfs_usb_device(unsigned int bus_number, unsigned int device_address);
+  
+  /*!
+   *  \brief The destructor for the class.
+   *  
+   *  The destructor for the class. Closes open connections and releases any
+   *  dynamically allocated resources.
+   */
+                            ~usbfs_usb_device();
+  
+  /*!
+   *  \brief Gets the path of the device's node, such as
+   *         /dev/bus/usb/001/004.
+   */
+  const std::string&        path() const;
+  
+  /*!
+   *  \see usb_device::init()
+   */
+  void                      init();
+  
+  /*!
+   *  \see usb_device::timeout()
+   */
+  timeout_t                 timeout() const;
+  
+  /*!
+   *  \see usb_device::configuration()
+   */
+  configuration_t           configuration() const;
+  
+  /*!
+   *  \see usb_device::interface()
+   */
+  interface_t               interface() const;
+  
+  /*!
+   *  \see usb_device::input_endpoint()
+   */
+  endpoint_t                input_endpoint() const;
+  
+  /*!
+   *  \see usb_device::output_endpoint()
+   */
+  endpoint_t                output_endpoint() const;
+  
+  /*!
+   *  \see usb_device::get_device_description()
+   */
+  const device_description* get_device_description() const;
+  
+  /*!
+   *  \see usb_device::get_manufacturer_string()
+   */
+  std::string               get_manufacturer_string();
+  
+  /*!
+   *  \see usb_device::get_product_string()
+   */
+  std::string               get_product_string();
+  
+  /*!
+   *  \see usb_device::get_serial_number()
+   */
+  std::string               get_serial_number();
+  
+  /*!
+   *  \see usb_device::set_timeout()
+   */
+  void                      set_timeout(timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::set_configuration()
+   */
+  void                      set_configuration(configuration_t configuration);
+  
+  /*!
+   *  \see usb_device::set_interface()
+   */
+  void                      set_interface(interface_t interface);
+  
+  /*!
+   *  \see usb_device::set_input_endpoint()
+   */
+  void                      set_input_endpoint(endpoint_t input_endpoint);
+  
+  /*!
+   *  \see usb_device::set_output_endpoint()
+   */
+  void                      set_output_endpoint(endpoint_t output_endpoint);
+  
+  /*!
+   *  \see usb_device::open()
+   */
+  void                      open();
+  
+  /*!
+   *  \see usb_device::close()
+   */
+  void                      close();
+  
+  /*!
+   *  \see usb_device::read(data_t*, unsigned int)
+   */
+  unsigned int              read(data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::read(data_t*, unsigned int, timeout_t)
+   */
+  unsigned int              read(data_t* data, unsigned int num_bytes, timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::write(const data_t*, unsigned int)
+   */
+  unsigned int              write(const data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::write(const data_t*, unsigned int, timeout_t)
+   */
+  unsigned int              write(const data_t* buffer, unsigned int num_bytes, timeout_t timeout);
+  
+  /*!
+   *  \see usb_device::try_read(data_t*, unsigned int, timeout_t)
+   */
+  result<unsigned int>      try_read(data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept;
+  
+  /*!
+   *  \see usb_device::try_write(const data_t*, unsigned int, timeout_t)
+   */
+  result<unsigned int>      try_write(const data_t* data, unsigned int num_bytes, timeout_t timeout) noexcept;
+  
+  /*!
+   *  \see usb_device::supports_async_transfers()
+   */
+  bool                      supports_async_transfers() const;
+  
+  /*!
+   *  \see usb_device::max_pending_transfers()
+   */
+  unsigned int              max_pending_transfers() const;
+  
+  /*!
+   *  \see usb_device::set_max_pending_transfers()
+   */
+  void                      set_max_pending_transfers(unsigned int max_pending);
+  
+  /*!
+   *  \see usb_device::num_pending_transfers()
+   */
+  unsigned int              num_pending_transfers() const;
+  
+  /*!
+   *  \see usb_device::submit_read()
+   */
+  void                      submit_read(data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::submit_write()
+   */
+  void                      submit_write(const data_t* data, unsigned int num_bytes);
+  
+  /*!
+   *  \see usb_device::complete_transfer()
+   */
+  unsigned int              complete_transfer();
+  
+  /*!
+   *  \see usb_device::cancel_pending_transfers()
+   */
+  void                      cancel_pending_transfers();
+  
+  /*!
+   *  \see usb_device::abort_pending_transfers()
+   */
+  void                      abort_pending_transfers();
+  
+  /*!
+   *  \see usb_device::recover()
+   */
+  bool                      recover();
+  
+  /*!
+   *  \see usb_device::supports_interrupt_reads()
+   */
+  bool                      supports_interrupt_reads() const;
+  
+  /*!
+   *  \see usb_device::read_interrupt()
+   */
+  unsigned int              read_interrupt(endpoint_t endpoint, data_t* data, unsigned int num_bytes, timeout_t timeout);
+
+
+
+private:
+  
+  /*!
+   *  \brief Struct caching whether the device is ready for transfers and the
+   *         addresses of the endpoints to use.
+   */
+  struct transfer_state
+  {
+    /*! \brief Whether every setting needed for a read is in place. */
+    bool                    read_ready;
+    
+    /*! \brief Whether every setting needed for a write is in place. */
+    bool                    write_ready;
+    
+    /*! \brief The address of the input endpoint, if \ref read_ready. */
+    unsigned char           input_address;
+    
+    /*! \brief The address of the output endpoint, if \ref write_ready. */
+    unsigned char           output_address;
+  };
+  
+  /*!
+   *  \brief Struct holding a URB along with what is needed to wait on it.
+   */
+  struct urb_slot
+  {
+    /*! \brief The URB handed to the kernel. */
+    usbdevfs_urb*           urb;
+    
+    /*! \brief Whether the URB has been reaped. */
+    bool                    completed;
+    
+    /*! \brief Whether the URB has been asked to be discarded. */
+    bool                    discarded;
+    
+    /*! \brief Whether the URB was discarded because it ran out of time. */
+    bool                    timed_out;
+    
+    /*! \brief The timeout the URB was submitted with, for errors. */
+    timeout_t               timeout;
+    
+    /*! \brief When the URB runs out of time, if \ref timeout isn't 0. */
+    std::chrono::steady_clock::time_point deadline;
+    
+    /*! \brief The value of \ref m_abort_generation when the URB was
+     *         submitted. */
+    unsigned int            generation;
+  };
+  
+  /*!
+   *  \brief Recomputes \ref m_transfer_state after a setting changed.
+   */
+  void                      update_transfer_state();
+  
+  /*!
+   *  \brief Throws the exception explaining why the device isn't ready to
+   *         read.
+   */
+  void                      validate_read_state() const;
+  
+  /*!
+   *  \brief Throws the exception explaining why the device isn't ready to
+   *         write.
+   */
+  void                      validate_write_state() const;
+  
+  /*!
+   *  \brief Makes a single blocking transfer.
+   *  
+   *  \param [in] type The USBDEVFS_URB_TYPE_ of the transfer.
+   *  \param [in] endpoint The address of the endpoint.
+   *  \param [in,out] buffer The data to send, or where to put the data read.
+   *  \param [in] num_bytes The size of the buffer.
+   *  \param [in] timeout The timeout in milliseconds, or 0 for none.
+   *  \param [out] num_transferred Set to the number of bytes transferred.
+   *  
+   *  \return 0 on success, or the errno value describing the failure.
+   */
+  int                       transfer(unsigned char type, unsigned char endpoint, data_t* buffer, unsigned int num_bytes,
+                                     timeout_t timeout, unsigned int& num_transferred) noexcept;
+  
+  /*!
+   *  \brief Hands a URB to the kernel.
+   *  
+   *  \return 0 on success, or the errno value describing the failure.
+   */
+  int                       submit_urb(urb_slot* slot, unsigned char type, unsigned char endpoint, data_t* buffer,
+                                       unsigned int num_bytes, timeout_t timeout) noexcept;
+  
+  /*!
+   *  \brief Waits for a URB to be reaped, reaping every other URB that has
+   *         finished along the way. Discards the URB once it runs out of time
+   *         or the transfers are aborted.
+   *  
+   *  \return 0 once the URB is reaped, or the errno value describing why it
+   *          can't be.
+   */
+  int                       wait_for_urb(urb_slot* slot) noexcept;
+  
+  /*!
+   *  \brief Reaps every URB that has finished, without waiting.
+   *  
+   *  \return 0, or the errno value describing the failure.
+   */
+  int                       reap_finished_urbs() noexcept;
+  
+  /*!
+   *  \brief Gets the errno value describing the outcome of a reaped URB, or
+   *         0 if it succeeded.
+   */
+  static int                urb_error(const urb_slot* slot) noexcept;
+  
+  /*!
+   *  \brief Allocates a URB slot, or returns **nullptr** if out of memory.
+   */
+  static urb_slot*          new_urb_slot() noexcept;
+  
+  /*!
+   *  \brief Frees a URB slot allocated by \ref new_urb_slot().
+   */
+  static void               delete_urb_slot(urb_slot* slot) noexcept;
+  
+  /*!
+   *  \brief Takes a slot for an asynchronous transfer, reusing a free one if
+   *         possible.
+   *  
+   *  \throws std::runtime_error If \ref max_pending_transfers() transfers
+   *          are already pending.
+   */
+  urb_slot*                 acquire_urb_slot();
+  
+  /*!
+   *  \brief Hands a URB for an asynchronous transfer to the kernel and queues
+   *         it.
+   */
+  void                      submit_async(unsigned char endpoint, data_t* buffer, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Makes a control transfer on the default endpoint.
+   *  
+   *  \return The number of bytes transferred, or minus the errno value
+   *          describing the failure.
+   */
+  int                       control_transfer(unsigned char request_type, unsigned char request, unsigned short value,
+                                             unsigned short index, data_t* data, unsigned short length) noexcept;
+  
+  /*!
+   *  \brief Fetches a string descriptor in the device's first language,
+   *         replacing characters outside of ASCII with '?'.
+   *  
+   *  \param [in] index The index of the string, or 0 for none.
+   *  
+   *  \return The string, or an empty string if it couldn't be fetched.
+   */
+  std::string               fetch_string(unsigned int index);
+  
+  /*!
+   *  \brief Gets the cached string with the given index, opening the device
+   *         node to fetch it the first time.
+   */
+  std::string               cached_string(unsigned int index, std::string& string, bool& string_set);
+  
+  /*!
+   *  \brief Opens the device node for reading and writing.
+   *  
+   *  \return The file descriptor, or -1 with errno set.
+   */
+  int                       open_node() const noexcept;
+  
+  /*!
+   *  \brief Builds the device description from the descriptors the kernel
+   *         gives when the device node is read.
+   *  
+   *  \throws usb::exception If the descriptors can't be read or make no
+   *          sense.
+   */
+  device_description*       build_device_description();
+  
+  /*!
+   *  \brief Creates the metrics counting the device's transfers, labeled with
+   *         its serial number. Done once, on the first \ref open().
+   */
+  void                      bind_metrics();
+  
+  /*!
+   *  \brief Counts a completed transfer on the given endpoint.
+   */
+  void                      count_transfer(unsigned char endpoint, unsigned int num_bytes);
+  
+  /*!
+   *  \brief Counts a failed transfer.
+   */
+  void                      count_error(int error);
+  
+  /*!
+   *  \brief Makes a failed result from an errno value.
+   */
+  static result<unsigned int> usbfs_failure(int error, timeout_t timeout) noexcept;
+  
+  /*!
+   *  \brief Throws the exception matching an errno value.
+   */
+  static void               throw_usbfs_exception(int error, timeout_t timeout);
+  
+  /*! \brief Disabled copy constructor. */
+                            usbfs_usb_device(const usbfs_usb_device& other) = delete;
+  
+  /*! \brief Disabled copy assignment operator. */
+  usbfs_usb_device&         operator=(const usbfs_usb_device& other) = delete;
+  
+  
+  
+  /*! \brief The path of the device node. */
+  const std::string         m_path;
+  
+  /*! \brief The open device node, or -1. */
+  int                       m_fd;
+  
+  /*! \brief Flag indicating whether \ref init() was called. */
+  bool                      m_was_initialized;
+  
+  /*! \brief Flag indicating whether the device is open. */
+  bool                      m_is_open;
+  
+  /*! \brief Flag indicating whether a kernel driver was detached from the
+   *         interface by \ref open(). */
+  bool                      m_kernel_was_attached;
+  
+  /*! \brief Flag indicating whether a configuration was selected. */
+  bool                      m_configuration_set;
+  
+  /*! \brief Flag indicating whether an interface was selected. */
+  bool                      m_interface_set;
+  
+  /*! \brief Flag indicating whether an input endpoint was selected. */
+  bool                      m_input_endpoint_set;
+  
+  /*! \brief Flag indicating whether an output endpoint was selected. */
+  bool                      m_output_endpoint_set;
+  
+  /*! \brief The default timeout of transfers in milliseconds. */
+  unsigned int              m_timeout;
+  
+  /*! \brief The index of the selected configuration. */
+  int                       m_configuration;
+  
+  /*! \brief The index of the configuration the device was in when opened. */
+  int                       m_old_configuration;
+  
+  /*! \brief The index of the selected interface. */
+  int                       m_interface;
+  
+  /*! \brief The index of the selected input endpoint. */
+  unsigned char             m_input_endpoint;
+  
+  /*! \brief The index of the selected output endpoint. */
+  unsigned char             m_output_endpoint;
+  
+  /*! \brief The index of the selected alternate setting. */
+  unsigned int              m_alt_setting;
+  
+  /*! \brief The description of the device, built by \ref init(). */
+  std::unique_ptr<device_description> m_device_description;
+  
+  /*! \brief The indexes of the manufacturer, product, and serial number
+   *         strings. */
+  unsigned int              m_string_indexes[3];
+  
+  /*! \brief The cached manufacturer string. */
+  std::string               m_manufacturer_string;
+  
+  /*! \brief Whether \ref m_manufacturer_string was fetched. */
+  bool                      m_manufacturer_string_set;
+  
+  /*! \brief The cached product string. */
+  std::string               m_product_string;
+  
+  /*! \brief Whether \ref m_product_string was fetched. */
+  bool                      m_product_string_set;
+  
+  /*! \brief The cached serial number. */
+  std::string               m_serial_number;
+  
+  /*! \brief Whether \ref m_serial_number was fetched. */
+  bool                      m_serial_number_set;
+  
+  /*! \brief Whether the device is ready for transfers. */
+  transfer_state            m_transfer_state;
+  
+  /*! \brief Most transfers that may be pending at once. */
+  unsigned int              m_max_pending_transfers;
+  
+  /*! \brief Asynchronous transfers in the order they were submitted. */
+  std::deque<urb_slot*>     m_pending_transfers;
+  
+  /*! \brief Slots of finished asynchronous transfers, kept for reuse. */
+  std::vector<urb_slot*>    m_free_transfers;
+  
+  /*! \brief Slot used by blocking transfers, which don't count against
+   *         \ref m_max_pending_transfers. */
+  urb_slot*                 m_sync_transfer;
+  
+  /*! \brief Bumped by \ref abort_pending_transfers() to have every waiting
+   *         URB discarded. */
+  std::atomic<unsigned int> m_abort_generation;
+  
+  /*! \brief Counter of transfers completed from the device. */
+  metric*                   m_metric_transfers_in;
+  
+  /*! \brief Counter of transfers completed to the device. */
+  metric*                   m_metric_transfers_out;
+  
+  /*! \brief Counter of bytes read from the device. */
+  metric*                   m_metric_bytes_in;
+  
+  /*! \brief Counter of bytes written to the device. */
+  metric*                   m_metric_bytes_out;
+  
+  /*! \brief Counter of failed transfers. */
+  metric*                   m_metric_errors;
+  
+  /*! \brief Counter of transfers that timed out. */
+  metric*                   m_metric_timeouts;
+};
+
+}
+
+#endif /* defined(__linux__) */
+
+#endif /* defined(__USBFS_USB_DEVICE_H__) */
@@ -24,6 +24,8 @@ namespace usb
 
 class usb_device;
 class libusb_usb_device;
+class usbfs_usb_device;
+class libusb_event_reactor;
 
 class exception;
 class busy_exception;
@@ -12,3 +12,5 @@ CREATE TABLE SaveBlocks (
 );
 
 CREATE INDEX SaveBlocks_GameID_ind ON SaveBlocks (GameID);
+
+UPDATE Games SET CartChips = NULL, CartSize = NULL;
@@ -14,7 +14,10 @@ CREATE TABLE Games (
   CartName TEXT,
   GameName TEXT,
   CartChips INTEGER DEFAULT NULL,
-  CartSize INTEGER DEFAULT NULL
+  CartSize INTEGER DEFAULT NULL,
+  Fingerprint INTEGER DEFAULT NULL,
+  ImageCRC32 INTEGER DEFAULT NULL,
+  ImageSHA1 TEXT DEFAULT NULL
 );
 
 CREATE INDEX Games_Hash_ind ON Games (`Hash`);
@@ -2,11 +2,27 @@
 #include "ws-games-row.h"
 #include "ngp-games-row.h"
 #include "ngp-cart-row.h"
+#include <atomic>
+#include <cstring>
+#include <thread>
 
 int main(const int argc, const char** const argv)
 {
-  (void) argc;
-  (void) argv;
+  // With --incremental, existing game tables are updated in place from the
+  // XML instead of being rebuilt
+  bool incremental = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--incremental") == 0)
+    {
+      incremental = true;
+    }
+    else
+    {
+      cerr << "Usage: " << argv[0] << " [--incremental]" << endl;
+      return 1;
+    }
+  }
   
   /////////////////////////////////////
   // Initialize operation parameters //
@@ -43,14 +59,59 @@ int main(const int argc, const char** const argv)
     new ngpcart::ngp_cart_row
   };
   
-  // Build each database using parameters above
+  // Build each database using parameters above. The WonderSwan database is
+  // independent of the others, but cartridge information is added to the Neo
+  // Geo Pocket database, so has to wait for it
+  const vector<vector<int>> chains = {{0}, {1, 2}};
+  vector<int> codes(num_databases, 0);
+  vector<thread> threads;
+  for (const vector<int>& chain : chains)
+  {
+    threads.emplace_back([&, chain]()
+    {
+      for (int i : chain)
+      {
+        codes[i] = build_database(db_file_name[i], schema_file_name[i], data_file_name[i], data_row[i], incremental);
+        if (codes[i] != 0)
+        {
+          cerr << "Failed to build database " << db_file_name[i] << endl;
+          break;
+        }
+      }
+    });
+  }
+  for (thread& t : threads)
+  {
+    t.join();
+  }
+  
   int code = 0;
   for (int i = 0; code == 0 && i < num_databases; i++)
   {
-    code = build_database(db_file_name[i], schema_file_name[i], data_file_name[i], data_row[i]);
+    code = codes[i];
+  }
+  
+  // Export compact binary catalogs of the game databases for fast lookup
+  const int num_catalogs = 2;
+  const string catalog_db_file_name[] = {
+    ws::db_file_name,
+    ngp::db_file_name
+  };
+  const string catalog_file_name[] = {
+    ws::bin_file_name,
+    ngp::bin_file_name
+  };
+  const string catalog_query[] = {
+    ws::bin_query,
+    ngp::bin_query
+  };
+  
+  for (int i = 0; code == 0 && i < num_catalogs; i++)
+  {
+    code = build_binary_catalog(catalog_db_file_name[i], catalog_file_name[i], catalog_query[i]);
     if (code != 0)
     {
-      cerr << "Failed to build database " << db_file_name[i] << endl;
+      cerr << "Failed to build catalog " << catalog_file_name[i] << endl;
     }
   }
   
@@ -65,7 +126,7 @@ int main(const int argc, const char** const argv)
 
 
 
-int build_database(const string& db_file_name, const string& schema_file_name, const string& data_file_name, games_row* const data_row)
+int build_database(const string& db_file_name, const string& schema_file_name, const string& data_file_name, games_row* const data_row, bool incremental)
 {
   // Declare some variables we're going to be using a lot of
   sqlite3* db;
@@ -81,20 +142,40 @@ int build_database(const string& db_file_name, const string& schema_file_name, c
     return e;
   }
   
-  // Open and execute schema sql file
-  ifstream f_schema(schema_file_name.c_str());
-  if (!f_schema)
+  // An existing table is only diffed against the XML if the rows say which
+  // columns to compare. Otherwise it is dropped and rebuilt as usual
+  const string columns = data_row->update_columns();
+  const bool diff = incremental && !columns.empty() && table_exists(db, "Games");
+  
+  // Open and execute schema sql file. Indexes are created after the games
+  // are added, since building them once is much faster than updating them on
+  // every insert
+  vector<string> deferred;
+  if (!diff)
   {
-    cerr << "Unable to open schema file '" << schema_file_name << "'" << endl;
-    sqlite3_close(db);
-    return 1;
+    ifstream f_schema(schema_file_name.c_str());
+    if (!f_schema)
+    {
+      cerr << "Unable to open schema file '" << schema_file_name << "'" << endl;
+      sqlite3_close(db);
+      return 1;
+    }
+    if (!execute_file(f_schema, db, &deferred))
+    {
+      sqlite3_close(db);
+      return 1;
+    }
+    f_schema.close();
   }
-  if (!execute_file(f_schema, db))
+  
+  // Unqualified table names resolve to the temp schema first, so a temporary
+  // copy of Games catches the new rows for comparison with the real one
+  else if (sqlite3_exec(db, "CREATE TEMP TABLE Games AS SELECT * FROM main.Games WHERE 0", nullptr, nullptr, nullptr) != SQLITE_OK)
   {
+    cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
     sqlite3_close(db);
     return 1;
   }
-  f_schema.close();
   
   // Open and parse game information xml
   file<> games_file(data_file_name.c_str());
@@ -106,12 +187,26 @@ int build_database(const string& db_file_name, const string& schema_file_name, c
     cerr << "An error occured while adding games to database" << endl;
   }
   
+  // Apply only the differences between the new rows and the existing ones
+  if (diff && !update_games(db, columns, db_file_name))
+  {
+    sqlite3_close(db);
+    return 1;
+  }
+  
+  // Create the indexes skipped above
+  if (!execute_statements(deferred, db))
+  {
+    sqlite3_close(db);
+    return 1;
+  }
+  
   // Close database connection
   sqlite3_close(db);
   return 0;
 }
 
-bool execute_file(ifstream& fin, sqlite3* db)
+bool execute_file(ifstream& fin, sqlite3* db, vector<string>* deferred)
 {
   bool success = true;
   string query;
@@ -127,7 +222,20 @@ bool execute_file(ifstream& fin, sqlite3* db)
   while (success && c != &(query.c_str()[query.size()]))
   {
     sqlite3_stmt* statement;
+    const char* start = c;
     sqlite3_prepare_v2(db, c, -1, &statement, &c);
+    
+    // Set aside index creation if the caller wants to run it later
+    string text(start, c);
+    size_t first = text.find_first_not_of(" \t\r\n");
+    if (deferred != nullptr && statement != nullptr && first != string::npos
+        && text.compare(first, 12, "CREATE INDEX") == 0)
+    {
+      deferred->push_back(text);
+      sqlite3_finalize(statement);
+      continue;
+    }
+    
     sqlite3_step(statement);
     
     // Check for query errors
@@ -144,38 +252,59 @@ bool execute_file(ifstream& fin, sqlite3* db)
   return success;
 }
 
+bool execute_statements(const vector<string>& statements, sqlite3* db)
+{
+  for (const string& statement : statements)
+  {
+    if (sqlite3_exec(db, statement.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+      cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
 bool add_games_to_db(sqlite3* db, const doc_t* games_xml, games_row* row)
 {
   bool success = true;
   
-  // Parse each ROMINFO node and add to table
-  node_t* rominfo_node = games_xml->first_node()->first_node();
-  while (success && rominfo_node != nullptr)
+  // Prepared statements for each distinct query string, reused across rows
+  map<string, vector<sqlite3_stmt*>> statements;
+  
+  // Convert every ROMINFO node up front, then add them to the table in order
+  vector<unique_ptr<games_row>> rows;
+  parse_games(db, games_xml, row, rows);
+  
+  // Add every row in one transaction rather than committing each insert
+  if (sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, nullptr) != SQLITE_OK)
   {
-    // Create struct from xml data
-    if (!row->parse_xml(rominfo_node, db))
+    cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
+    return false;
+  }
+  
+  for (size_t i = 0; success && i < rows.size(); i++)
+  {
+    if (rows[i] == nullptr)
     {
-      cerr << "An error occured while parsing XML" << endl;
-      rominfo_node = rominfo_node->next_sibling();
       continue;
     }
+    games_row* parsed = rows[i].get();
     
     // Get query string
     string query;
-    if (success) query = row->insert_query();
+    if (success) query = parsed->insert_query();
     
-    // Execute all statements in query string
-    const char* c = &(query.c_str()[0]);
-    for (int q = 0;
-         success && c != &(query.c_str()[query.size()]);
-         q++)
-    {
-      // Construct statement that uses bound parameters
-      sqlite3_stmt* stmt = nullptr;
-      if (success)
+    // Prepare the statements in the query string the first time it is seen
+    vector<sqlite3_stmt*>& stmts = statements[query];
+    if (stmts.empty())
+    {
+      const char* c = &(query.c_str()[0]);
+      while (success && c != &(query.c_str()[query.size()]))
       {
+        sqlite3_stmt* stmt = nullptr;
         sqlite3_prepare_v2(db, c, -1, &stmt, &c);
-
+        
         // Check for statement errors
         int errcode = sqlite3_errcode(db);
         if (errcode != SQLITE_OK && errcode != SQLITE_ROW && errcode != SQLITE_DONE)
@@ -183,19 +312,28 @@ bool add_games_to_db(sqlite3* db, const doc_t* games_xml, games_row* row)
           cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
           success = false;
         }
+        stmts.push_back(stmt);
       }
-
+    }
+    
+    // Execute all statements in query string
+    for (int q = 0; success && q < (int) stmts.size(); q++)
+    {
+      sqlite3_stmt* stmt = stmts[q];
+      sqlite3_reset(stmt);
+      sqlite3_clear_bindings(stmt);
+      
       // Bind parameters to statement
-      if (success) if (!row->bind_to_stmt(stmt, q))
+      if (success) if (!parsed->bind_to_stmt(stmt, q))
       {
         cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
         cerr << "An error occured while binding parameters to statement" << endl;
         success = false;
       }
-
+      
       // Insert into database
       if (success) sqlite3_step(stmt);
-
+      
       // Check for query errors
       int errcode = sqlite3_errcode(db);
       if (success) if (errcode != SQLITE_OK && errcode != SQLITE_ROW && errcode != SQLITE_DONE)
@@ -203,14 +341,319 @@ bool add_games_to_db(sqlite3* db, const doc_t* games_xml, games_row* row)
         cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
         success = false;
       }
-
-      // Clean up prepared statement
+    }
+  }
+  
+  // Clean up prepared statements
+  for (auto& entry : statements)
+  {
+    for (sqlite3_stmt* stmt : entry.second)
+    {
       sqlite3_finalize(stmt);
     }
-    
-    // Move to next node
-    if (success) rominfo_node = rominfo_node->next_sibling();
   }
   
+  // Keep whatever was added before any error, as when each insert was
+  // committed on its own
+  if (sqlite3_exec(db, "COMMIT TRANSACTION", nullptr, nullptr, nullptr) != SQLITE_OK)
+  {
+    cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
+    success = false;
+  }
+  
+  return success;
+}
+
+void parse_games(sqlite3* db, const doc_t* games_xml, const games_row* row, vector<unique_ptr<games_row>>& rows)
+{
+  vector<node_t*> nodes;
+  for (node_t* rominfo_node = games_xml->first_node()->first_node();
+       rominfo_node != nullptr;
+       rominfo_node = rominfo_node->next_sibling())
+  {
+    nodes.push_back(rominfo_node);
+  }
+  rows.clear();
+  rows.resize(nodes.size());
+  
+  // Nodes are independent, so spread them over every core. Rows never write
+  // to the database while parsing, so sharing the connection is safe
+  atomic<size_t> next_node(0);
+  unsigned int num_threads = max(1u, thread::hardware_concurrency());
+  vector<thread> threads;
+  for (unsigned int t = 0; t < num_threads; t++)
+  {
+    threads.emplace_back([&]()
+    {
+      for (size_t i = next_node++; i < nodes.size(); i = next_node++)
+      {
+        // Create struct from xml data. Failed nodes are left empty and skipped
+        unique_ptr<games_row> parsed(row->clone());
+        if (parsed->parse_xml(nodes[i], db))
+        {
+          rows[i] = move(parsed);
+        }
+        else
+        {
+          cerr << "An error occured while parsing XML" << endl;
+        }
+      }
+    });
+  }
+  for (thread& t : threads)
+  {
+    t.join();
+  }
+}
+
+bool table_exists(sqlite3* db, const string& table)
+{
+  sqlite3_stmt* stmt = nullptr;
+  bool exists = false;
+  if (sqlite3_prepare_v2(db, "SELECT 1 FROM main.sqlite_master WHERE type = 'table' AND name = ?", -1, &stmt, nullptr) == SQLITE_OK
+      && sqlite3_bind_text(stmt, 1, table.c_str(), -1, SQLITE_TRANSIENT) == SQLITE_OK)
+  {
+    exists = (sqlite3_step(stmt) == SQLITE_ROW);
+  }
+  sqlite3_finalize(stmt);
+  return exists;
+}
+
+struct games_record
+{
+  long long                 id;
+  long long                 hash;
+  vector<pair<int, string>> values;
+};
+
+static bool read_games(sqlite3* db, const string& query, int num_columns, vector<games_record>& records)
+{
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+  {
+    cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
+    sqlite3_finalize(stmt);
+    return false;
+  }
+  
+  int result;
+  while ((result = sqlite3_step(stmt)) == SQLITE_ROW)
+  {
+    games_record record;
+    record.id = sqlite3_column_int64(stmt, 0);
+    record.hash = sqlite3_column_int64(stmt, 1);
+    for (int i = 1; i <= num_columns; i++)
+    {
+      const char* text = (const char*) sqlite3_column_text(stmt, i);
+      record.values.push_back(make_pair(sqlite3_column_type(stmt, i), string(text == nullptr ? "" : text)));
+    }
+    records.push_back(record);
+  }
+  sqlite3_finalize(stmt);
+  
+  if (result != SQLITE_DONE)
+  {
+    cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
+    return false;
+  }
+  return true;
+}
+
+static bool step_with_ids(sqlite3_stmt* stmt, long long first, long long second)
+{
+  sqlite3_reset(stmt);
+  sqlite3_bind_int64(stmt, 1, first);
+  if (sqlite3_bind_parameter_count(stmt) > 1)
+  {
+    sqlite3_bind_int64(stmt, 2, second);
+  }
+  return sqlite3_step(stmt) == SQLITE_DONE;
+}
+
+bool update_games(sqlite3* db, const string& columns, const string& db_file_name)
+{
+  bool success = true;
+  
+  // Split column list for building the per-column update
+  vector<string> names;
+  stringstream ss(columns);
+  for (string name; getline(ss, name, ',');)
+  {
+    names.push_back(name);
+  }
+  
+  // Both sides are sorted by hash, then in the order the rows were added
+  vector<games_record> old_rows;
+  vector<games_record> new_rows;
+  if (!read_games(db, "SELECT ID, " + columns + " FROM main.Games ORDER BY `Hash`, ID", (int) names.size(), old_rows)
+      || !read_games(db, "SELECT rowid, " + columns + " FROM temp.Games ORDER BY `Hash`, rowid", (int) names.size(), new_rows))
+  {
+    return false;
+  }
+  
+  string update = "UPDATE main.Games SET ";
+  for (size_t i = 0; i < names.size(); i++)
+  {
+    update += (i == 0 ? "" : ",") + names[i] + "=(SELECT " + names[i] + " FROM temp.Games WHERE rowid = ?2)";
+  }
+  update += " WHERE ID = ?1";
+  const string insert = "INSERT INTO main.Games (" + columns + ") SELECT " + columns + " FROM temp.Games WHERE rowid = ?1";
+  const string remove = "DELETE FROM main.Games WHERE ID = ?1";
+  
+  sqlite3_stmt* update_stmt = nullptr;
+  sqlite3_stmt* insert_stmt = nullptr;
+  sqlite3_stmt* remove_stmt = nullptr;
+  if (sqlite3_prepare_v2(db, update.c_str(), -1, &update_stmt, nullptr) != SQLITE_OK
+      || sqlite3_prepare_v2(db, insert.c_str(), -1, &insert_stmt, nullptr) != SQLITE_OK
+      || sqlite3_prepare_v2(db, remove.c_str(), -1, &remove_stmt, nullptr) != SQLITE_OK
+      || sqlite3_exec(db, "BEGIN TRANSACTION", nullptr, nullptr, nullptr) != SQLITE_OK)
+  {
+    cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
+    success = false;
+  }
+  
+  // Walk both lists by hash. Rows sharing a hash are paired in order, so
+  // unchanged games keep their IDs and anything referring to them stays valid
+  unsigned int num_inserted = 0;
+  unsigned int num_updated = 0;
+  unsigned int num_deleted = 0;
+  size_t o = 0;
+  size_t n = 0;
+  while (success && (o < old_rows.size() || n < new_rows.size()))
+  {
+    if (n == new_rows.size() || (o < old_rows.size() && old_rows[o].hash < new_rows[n].hash))
+    {
+      success = step_with_ids(remove_stmt, old_rows[o++].id, 0);
+      num_deleted++;
+    }
+    else if (o == old_rows.size() || new_rows[n].hash < old_rows[o].hash)
+    {
+      success = step_with_ids(insert_stmt, new_rows[n++].id, 0);
+      num_inserted++;
+    }
+    else
+    {
+      if (old_rows[o].values != new_rows[n].values)
+      {
+        success = step_with_ids(update_stmt, old_rows[o].id, new_rows[n].id);
+        num_updated++;
+      }
+      o++;
+      n++;
+    }
+  }
+  
+  if (success)
+  {
+    success = sqlite3_exec(db, "COMMIT TRANSACTION", nullptr, nullptr, nullptr) == SQLITE_OK;
+  }
+  if (!success)
+  {
+    cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
+    sqlite3_exec(db, "ROLLBACK TRANSACTION", nullptr, nullptr, nullptr);
+  }
+  sqlite3_finalize(update_stmt);
+  sqlite3_finalize(insert_stmt);
+  sqlite3_finalize(remove_stmt);
+  sqlite3_exec(db, "DROP TABLE temp.Games", nullptr, nullptr, nullptr);
+  
+  if (success)
+  {
+    cout << db_file_name << ": " << num_inserted << " inserted, " << num_updated << " updated, " << num_deleted << " deleted" << endl;
+  }
   return success;
 }
+
+static void write_u32(vector<char>& out, size_t pos, unsigned int value)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    out[pos + i] = (char) ((value >> (8 * i)) & 0xFF);
+  }
+}
+
+int build_binary_catalog(const string& db_file_name, const string& bin_file_name, const string& query)
+{
+  sqlite3* db;
+  if (sqlite3_open_v2(db_file_name.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+  {
+    cerr << sqlite3_errmsg(db) << endl;
+    sqlite3_close(db);
+    return 1;
+  }
+  
+  // Query returns hash, name, developer name, game size, sample fingerprint,
+  // and the CRC32 and SHA-1 of the known-good image, sorted by hash
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+  {
+    cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    return 1;
+  }
+  
+  vector<char> entries;
+  vector<char> strings;
+  unsigned int num_entries = 0;
+  long long prev_hash = 0;
+  int result;
+  while ((result = sqlite3_step(stmt)) == SQLITE_ROW)
+  {
+    // Keep only the first game for each hash
+    long long hash = sqlite3_column_int64(stmt, 0);
+    if (num_entries > 0 && hash == prev_hash)
+    {
+      continue;
+    }
+    prev_hash = hash;
+    
+    size_t pos = entries.size();
+    entries.resize(pos + BINARY_CATALOG_ENTRY_SIZE, 0);
+    write_u32(entries, pos, (unsigned int) ((unsigned long long) hash & 0xFFFFFFFF));
+    write_u32(entries, pos + 4, (unsigned int) ((unsigned long long) hash >> 32));
+    const int string_columns[] = {1, 2, 6};
+    const size_t string_fields[] = {8, 12, 28};
+    for (int i = 0; i < 3; i++)
+    {
+      const char* text = (const char*) sqlite3_column_text(stmt, string_columns[i]);
+      write_u32(entries, pos + string_fields[i], (unsigned int) strings.size());
+      if (text != nullptr)
+      {
+        strings.insert(strings.end(), text, text + strlen(text));
+      }
+      strings.push_back('\0');
+    }
+    write_u32(entries, pos + 16, (unsigned int) sqlite3_column_int(stmt, 3));
+    write_u32(entries, pos + 20, (unsigned int) sqlite3_column_int64(stmt, 4));
+    write_u32(entries, pos + 24, (unsigned int) sqlite3_column_int64(stmt, 5));
+    num_entries++;
+  }
+  sqlite3_finalize(stmt);
+  
+  if (result != SQLITE_DONE)
+  {
+    cerr << sqlite3_errcode(db) << ": " << sqlite3_errmsg(db) << endl;
+    sqlite3_close(db);
+    return 1;
+  }
+  sqlite3_close(db);
+  
+  // Write header, entries, then string table
+  vector<char> header(BINARY_CATALOG_HEADER_SIZE, 0);
+  memcpy(&header[0], BINARY_CATALOG_MAGIC, 4);
+  write_u32(header, 4, BINARY_CATALOG_VERSION);
+  write_u32(header, 8, num_entries);
+  write_u32(header, 12, (unsigned int) (BINARY_CATALOG_HEADER_SIZE + entries.size()));
+  
+  ofstream fout(bin_file_name.c_str(), ios::out | ios::binary | ios::trunc);
+  fout.write(header.data(), header.size());
+  fout.write(entries.data(), entries.size());
+  fout.write(strings.data(), strings.size());
+  if (!fout.good())
+  {
+    cerr << "Unable to write catalog file '" << bin_file_name << "'" << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -1,6 +1,7 @@
 #ifndef __BUILD_DATABASE_H__
 #define __BUILD_DATABASE_H__
 
+#include <cctype>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
@@ -8,6 +9,8 @@
 #include <string>
 #include <cstdlib>
 #include <sstream>
+#include <map>
+#include <memory>
 
 #include "sqlite/sqlite3.h"
 #include "rapidxml/rapidxml.hpp"
@@ -20,9 +23,15 @@ typedef xml_node<> node_t;
 typedef xml_document<> doc_t;
 
 #include "games-row.h"
+#include "../../src/game/binary_catalog_format.h"
 
-int build_database(const string& db_file_name, const string& schema_file_name, const string& data_file_name, games_row* const data_row);
-bool execute_file(ifstream& fin, sqlite3* db);
+int build_database(const string& db_file_name, const string& schema_file_name, const string& data_file_name, games_row* const data_row, bool incremental = false);
+bool execute_file(ifstream& fin, sqlite3* db, vector<string>* deferred = nullptr);
+bool execute_statements(const vector<string>& statements, sqlite3* db);
 bool add_games_to_db(sqlite3* db, const doc_t* games_xml, games_row* row);
+bool table_exists(sqlite3* db, const string& table);
+bool update_games(sqlite3* db, const string& columns, const string& db_file_name);
+void parse_games(sqlite3* db, const doc_t* games_xml, const games_row* row, vector<unique_ptr<games_row>>& rows);
+int build_binary_catalog(const string& db_file_name, const string& bin_file_name, const string& query);
 
 #endif
@@ -9,9 +9,14 @@ class games_row
 {
 public:
   virtual             ~games_row() {};
+  virtual games_row*  clone() const = 0;
   virtual std::string insert_query() const = 0;
   virtual bool        parse_xml(const node_t* node, sqlite3* db) = 0;
   virtual bool        bind_to_stmt(sqlite3_stmt* stmt, int query) = 0;
+  
+  // Columns of the Games table filled from the XML, starting with `Hash`.
+  // Rows that return none can't be diffed and are always reloaded in full
+  virtual std::string update_columns() const { return ""; }
 };
 
 #endif
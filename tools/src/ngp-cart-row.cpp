@@ -4,6 +4,11 @@
 namespace ngpcart
 {
 
+games_row* ngp_cart_row::clone() const
+{
+  return new ngp_cart_row(*this);
+}
+
 string ngp_cart_row::insert_query() const
 {
   stringstream query;
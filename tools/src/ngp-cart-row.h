@@ -19,6 +19,7 @@ class ngp_cart_row : public games_row
 {
 public:
               ~ngp_cart_row() {};
+  games_row*  clone() const;
   std::string insert_query() const;
   bool        parse_xml(const node_t* node, sqlite3* db);
   bool        bind_to_stmt(sqlite3_stmt* stmt, int query);
@@ -13,12 +13,16 @@ namespace ngp
 const string schema_file_name = "ngpschema.sql";
 const string data_file_name = "ngpgames.xml";
 const string db_file_name = "ngpgames.db";
+const string bin_file_name = "ngpgames.bin";
+const string bin_query = "SELECT `Hash`, GameName, '', IFNULL(CartSize, 0) << 17, IFNULL(Fingerprint, 0), IFNULL(ImageCRC32, 0), IFNULL(ImageSHA1, '') FROM Games ORDER BY `Hash`, ID";
 
 class ngp_games_row : public games_row
 {
 public:
               ~ngp_games_row() {};
+  games_row*  clone() const;
   std::string insert_query() const;
+  std::string update_columns() const;
   bool        parse_xml(const node_t* node, sqlite3* db);
   bool        bind_to_stmt(sqlite3_stmt* stmt, int query);
   
@@ -31,6 +35,9 @@ public:
   string License;
   string CartName;
   string GameName;
+  unsigned int Fingerprint;
+  unsigned int ImageCRC32;
+  string ImageSHA1;
 };
 
 }
@@ -3,6 +3,11 @@
 namespace ws
 {
 
+games_row* ws_games_row::clone() const
+{
+  return new ws_games_row(*this);
+}
+
 string ws_games_row::insert_query() const
 {
   return string("INSERT INTO Games ("
@@ -16,7 +21,10 @@ string ws_games_row::insert_query() const
     "MapperVersion,"
     "RTC,"
     "`Checksum`,"
-    "Flags"
+    "Flags,"
+    "Fingerprint,"
+    "ImageCRC32,"
+    "ImageSHA1"
     ") VALUES ("
     ":hash,"
     ":gameid,"
@@ -28,10 +36,31 @@ string ws_games_row::insert_query() const
     ":mapperversion,"
     ":rtc,"
     ":checksum,"
-    ":flags"
+    ":flags,"
+    ":fingerprint,"
+    ":imagecrc32,"
+    ":imagesha1"
     ")");
 }
 
+string ws_games_row::update_columns() const
+{
+  return string("`Hash`,"
+    "GameID,"
+    "GameName,"
+    "Developer,"
+    "RomSize,"
+    "SaveSize,"
+    "MinSystem,"
+    "MapperVersion,"
+    "RTC,"
+    "`Checksum`,"
+    "Flags,"
+    "Fingerprint,"
+    "ImageCRC32,"
+    "ImageSHA1");
+}
+
 bool ws_games_row::parse_xml(const node_t* node, sqlite3* db)
 {
   (void) db;
@@ -52,6 +81,32 @@ bool ws_games_row::parse_xml(const node_t* node, sqlite3* db)
     else GameName = string(n_->value());
   }
   
+  // Sample fingerprint, only present for games whose image has been sampled
+  if (success)
+  {
+    Fingerprint = 0;
+    node_t* n_ = node->first_node("DUMP");
+    if (n_ != nullptr) n_ = n_->first_node("SAMPLE_FINGERPRINT");
+    if (n_ != nullptr) Fingerprint = (unsigned int) std::strtoul(n_->value(), 0, 16);
+  }
+  
+  // Checksums of the whole image, only present for games with a known-good
+  // dump. A game needs both to be verified against them
+  if (success)
+  {
+    ImageCRC32 = 0;
+    ImageSHA1 = "";
+    node_t* n_ = node->first_node("DUMP");
+    node_t* crc32 = (n_ == nullptr ? nullptr : n_->first_node("CRC32"));
+    node_t* sha1 = (n_ == nullptr ? nullptr : n_->first_node("SHA1"));
+    if (crc32 != nullptr && sha1 != nullptr)
+    {
+      ImageCRC32 = (unsigned int) std::strtoul(crc32->value(), 0, 16);
+      ImageSHA1 = string(sha1->value());
+      for (char& c : ImageSHA1) c = (char) tolower((unsigned char) c);
+    }
+  }
+  
   // Metadata and hash
   if (success)
   {
@@ -370,6 +425,42 @@ bool ws_games_row::bind_to_stmt(sqlite3_stmt* stmt, int query)
       cerr << "Unable to bind parameter 'flags'" << endl;
       return false;
     }
+
+    ind = sqlite3_bind_parameter_index(stmt, ":fingerprint");
+    if (ind == 0)
+    {
+      cerr << "Unable to find index of parameter 'fingerprint'" << endl;
+      return false;
+    }
+    if ((Fingerprint == 0 ? sqlite3_bind_null(stmt, ind) : sqlite3_bind_int64(stmt, ind, Fingerprint)) != SQLITE_OK)
+    {
+      cerr << "Unable to bind parameter 'fingerprint'" << endl;
+      return false;
+    }
+    
+    ind = sqlite3_bind_parameter_index(stmt, ":imagecrc32");
+    if (ind == 0)
+    {
+      cerr << "Unable to find index of parameter 'imagecrc32'" << endl;
+      return false;
+    }
+    if ((ImageSHA1.empty() ? sqlite3_bind_null(stmt, ind) : sqlite3_bind_int64(stmt, ind, ImageCRC32)) != SQLITE_OK)
+    {
+      cerr << "Unable to bind parameter 'imagecrc32'" << endl;
+      return false;
+    }
+    
+    ind = sqlite3_bind_parameter_index(stmt, ":imagesha1");
+    if (ind == 0)
+    {
+      cerr << "Unable to find index of parameter 'imagesha1'" << endl;
+      return false;
+    }
+    if ((ImageSHA1.empty() ? sqlite3_bind_null(stmt, ind) : sqlite3_bind_text(stmt, ind, ImageSHA1.c_str(), -1, SQLITE_TRANSIENT)) != SQLITE_OK)
+    {
+      cerr << "Unable to bind parameter 'imagesha1'" << endl;
+      return false;
+    }
     break;
     
   default:
@@ -13,12 +13,16 @@ namespace ws
 const string schema_file_name = "wsschema.sql";
 const string data_file_name = "wsgames.xml";
 const string db_file_name = "wsgames.db";
+const string bin_file_name = "wsgames.bin";
+const string bin_query = "SELECT `Hash`, GameName, Developer, 0, IFNULL(Fingerprint, 0), IFNULL(ImageCRC32, 0), IFNULL(ImageSHA1, '') FROM Games ORDER BY `Hash`, ID";
 
 class ws_games_row : public games_row
 {
 public:
               ~ws_games_row() {};
+  games_row*  clone() const;
   std::string insert_query() const;
+  std::string update_columns() const;
   bool        parse_xml(const node_t* node, sqlite3* db);
   bool        bind_to_stmt(sqlite3_stmt* stmt, int query);
   
@@ -34,6 +38,9 @@ public:
   int RTC;
   int Checksum;
   int Flags;
+  unsigned int Fingerprint;
+  unsigned int ImageCRC32;
+  string ImageSHA1;
 };
 
 }
@@ -13,7 +13,10 @@ CREATE TABLE Games (
   MapperVersion INTEGER,
   RTC INTEGER,
   `Checksum` INTEGER,
-  Flags INTEGER
+  Flags INTEGER,
+  Fingerprint INTEGER DEFAULT NULL,
+  ImageCRC32 INTEGER DEFAULT NULL,
+  ImageSHA1 TEXT DEFAULT NULL
 );
 
 CREATE INDEX Games_Hash_ind ON Games (`Hash`);